@@ -0,0 +1,507 @@
+"""
+CLI tool for benchmarking shadow on end-to-end simulations.
+
+Runs a sweep of phold or tgen simulations over the number of hosts,
+parallelism, scheduler, and interface qdisc, and writes a json report of how
+long each simulation took. A report can be compared against a baseline report
+(for example one generated by a previous version of shadow) to find
+simulations that have become slower.
+
+Can be executed as `shadow-bench` after installing the package, or without
+installing e.g. as
+`PYTHONPATH=/reporoot/shadowtools/src python3 -m shadowtools.bench`.
+
+The phold workload requires the `test-phold` binary that is built with
+shadow's tests (`build/src/test/phold/test-phold`). The tgen workload requires
+[tgen](https://github.com/shadow/tgen) and uses the tgen configs from
+`src/test/tgen/fixed_size/` by default.
+
+Example:
+
+```
+$ shadow-bench run --phold-bin build/src/test/phold/test-phold \\
+    --hosts 100,1000 --parallelism 1,8 --output report.json
+$ shadow-bench compare report.json baseline.json
+```
+"""
+
+import argparse
+import itertools
+import json
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+import yaml
+
+from dataclasses import asdict, dataclass
+from pathlib import Path
+from typing import Any, Callable, Dict, Final, Iterable, List, Optional, TextIO, cast
+
+import shadowtools.config as scfg
+
+REPORT_VERSION: Final[int] = 1
+
+WORKLOADS: Final = ("phold", "tgen")
+SCHEDULERS: Final = ("thread-per-core", "thread-per-host", "hybrid")
+QDISCS: Final = ("fifo", "round-robin")
+
+# The simulated time at which the phold and tgen processes start.
+_START_TIME_SEC: Final[int] = 1
+
+_TGEN_DIR: Final = Path(__file__).parents[3] / "src/test/tgen/fixed_size"
+
+
+@dataclass(frozen=True)
+class Case:
+    """A single simulation in the sweep."""
+
+    workload: str
+    hosts: int
+    parallelism: int
+    scheduler: str
+    qdisc: str
+
+    @property
+    def name(self) -> str:
+        return (
+            f"{self.workload}-{self.hosts}hosts-{self.parallelism}par-"
+            f"{self.scheduler}-{self.qdisc}"
+        )
+
+
+@dataclass
+class Result:
+    """The measurements of a case. Times are medians over the repetitions."""
+
+    wall_seconds: float
+    sim_seconds: float
+    events: int
+    events_per_second: float
+    sim_seconds_per_wall_second: float
+
+
+@dataclass
+class Workload:
+    """The options used to generate the cases' configs."""
+
+    stop_time_sec: int
+    phold_bin: Optional[Path] = None
+    tgen_bin: str = "tgen"
+    tgen_server_conf: Path = _TGEN_DIR / "server.graphml"
+    tgen_client_conf: Path = _TGEN_DIR / "client.1stream_1kib_100x.graphml"
+
+
+def cases(
+    workloads: Iterable[str],
+    hosts: Iterable[int],
+    parallelism: Iterable[int],
+    schedulers: Iterable[str],
+    qdiscs: Iterable[str],
+) -> List[Case]:
+    """All combinations of the swept parameters."""
+
+    return [
+        Case(*x)
+        for x in itertools.product(workloads, hosts, parallelism, schedulers, qdiscs)
+    ]
+
+
+def _graph() -> scfg.Graph:
+    return scfg.Graph(
+        type="gml",
+        inline="""graph [
+  directed 0
+  node [
+    id 0
+    host_bandwidth_down "100 Mbit"
+    host_bandwidth_up "100 Mbit"
+  ]
+  edge [
+    source 0
+    target 0
+    latency "50 ms"
+    packet_loss 0.0
+  ]
+]
+""",
+    )
+
+
+def config(case: Case, workload: Workload, sim_dir: Path) -> scfg.Config:
+    """The shadow config for `case`. Supporting files are written to `sim_dir`."""
+
+    hosts: Dict[str, scfg.Host] = {}
+
+    if case.workload == "phold":
+        if workload.phold_bin is None:
+            raise ValueError("The phold workload requires the path to test-phold")
+        weights = sim_dir / "weights.txt"
+        weights.write_text("1.0\n" * case.hosts)
+        # stop sending a second before the end, so that the processes have exited
+        runtime = max(workload.stop_time_sec - _START_TIME_SEC - 1, 1)
+        args = (
+            f"loglevel=info basename=peer quantity={case.hosts} msgload=1 "
+            f"cpuload=1 size=1 weightsfilepath={weights.resolve()} "
+            f"runtime={runtime}"
+        )
+        for i in range(case.hosts):
+            hosts[f"peer{i + 1}"] = scfg.Host(
+                network_node_id=0,
+                processes=[
+                    scfg.Process(
+                        path=str(workload.phold_bin.resolve()),
+                        args=args,
+                        start_time=_START_TIME_SEC,
+                    )
+                ],
+            )
+    elif case.workload == "tgen":
+        # See https://shadow.github.io/docs/guide/compatibility_notes.html#libopenblas
+        environment = {"OPENBLAS_NUM_THREADS": "1"}
+        hosts["server"] = scfg.Host(
+            network_node_id=0,
+            processes=[
+                scfg.Process(
+                    path=workload.tgen_bin,
+                    environment=environment,
+                    args=str(workload.tgen_server_conf.resolve()),
+                    start_time=_START_TIME_SEC,
+                    expected_final_state="running",
+                )
+            ],
+        )
+        for i in range(case.hosts - 1):
+            hosts[f"client{i + 1}"] = scfg.Host(
+                network_node_id=0,
+                processes=[
+                    scfg.Process(
+                        path=workload.tgen_bin,
+                        environment=environment,
+                        args=str(workload.tgen_client_conf.resolve()),
+                        start_time=_START_TIME_SEC,
+                    )
+                ],
+            )
+    else:
+        raise ValueError(f"Unknown workload '{case.workload}'")
+
+    return scfg.Config(
+        general=scfg.General(
+            stop_time=workload.stop_time_sec,
+            parallelism=case.parallelism,
+            data_directory=str(sim_dir / "shadow.data"),
+            log_level="warning",
+            progress=False,
+            # also sets the interval of the stats stream
+            heartbeat_interval=workload.stop_time_sec,
+        ),
+        network=scfg.Network(graph=_graph()),
+        experimental=scfg.Experimental(
+            scheduler=cast(Any, case.scheduler),
+            interface_qdisc=cast(Any, case.qdisc),
+            use_sim_stats_stream=True,
+        ),
+        hosts=hosts,
+    )
+
+
+def read_stats_stream(path: Path) -> Dict[str, int]:
+    """
+    The total number of events and the final simulated time (in nanoseconds)
+    in a `sim-stats.ndjson` file.
+    """
+
+    events = 0
+    sim_time_ns = 0
+    with path.open() as f:
+        for line in f:
+            if not line.strip():
+                continue
+            record = json.loads(line)
+            events += record["events"]
+            sim_time_ns = max(sim_time_ns, record["sim_time_ns"])
+    return {"events": events, "sim_time_ns": sim_time_ns}
+
+
+class SimulationError(Exception):
+    pass
+
+
+def run_case(
+    case: Case,
+    workload: Workload,
+    shadow_bin: str,
+    work_dir: Path,
+    repeat: int = 1,
+) -> Result:
+    """Run `case` `repeat` times and return the median measurements."""
+
+    runs = []
+    for i in range(repeat):
+        sim_dir = work_dir / f"{case.name}.{i}"
+        sim_dir.mkdir(parents=True)
+        config_path = sim_dir / "shadow.yaml"
+        config_path.write_text(yaml.safe_dump(config(case, workload, sim_dir)))
+
+        with (sim_dir / "shadow.log").open("w") as log:
+            start = time.monotonic()
+            rv = subprocess.run(
+                [shadow_bin, str(config_path)],
+                stdout=log,
+                stderr=subprocess.STDOUT,
+                cwd=sim_dir,
+            )
+            wall_seconds = time.monotonic() - start
+        if rv.returncode != 0:
+            raise SimulationError(
+                f"shadow exited with {rv.returncode}, see {sim_dir / 'shadow.log'}"
+            )
+
+        stats = read_stats_stream(sim_dir / "shadow.data/sim-stats.ndjson")
+        runs.append((wall_seconds, stats["sim_time_ns"] / 1e9, stats["events"]))
+
+    wall_seconds = statistics.median(x[0] for x in runs)
+    sim_seconds = statistics.median(x[1] for x in runs)
+    events = int(statistics.median(x[2] for x in runs))
+    return Result(
+        wall_seconds=wall_seconds,
+        sim_seconds=sim_seconds,
+        events=events,
+        events_per_second=events / wall_seconds,
+        sim_seconds_per_wall_second=sim_seconds / wall_seconds,
+    )
+
+
+def shadow_version(shadow_bin: str) -> str:
+    rv = subprocess.run(
+        [shadow_bin, "--version"], stdout=subprocess.PIPE, text=True, check=True
+    )
+    return rv.stdout.splitlines()[0] if rv.stdout else ""
+
+
+def report(shadow_version: str, results: Dict[Case, Result]) -> Dict[str, Any]:
+    return {
+        "version": REPORT_VERSION,
+        "shadow_version": shadow_version,
+        "cases": [
+            {"name": case.name, **asdict(case), **asdict(result)}
+            for case, result in results.items()
+        ],
+    }
+
+
+@dataclass
+class Comparison:
+    name: str
+    baseline: float
+    current: float
+
+    @property
+    def change(self) -> float:
+        """The relative change in simulation speed."""
+        if self.baseline == 0:
+            return 0.0
+        return self.current / self.baseline - 1
+
+
+def compare(current: Dict[str, Any], baseline: Dict[str, Any]) -> List[Comparison]:
+    """
+    Compare the simulation speed (sim-sec/wall-sec) of the cases that are in
+    both reports.
+    """
+
+    baseline_cases = {x["name"]: x for x in baseline["cases"]}
+    comparisons = []
+    for case in current["cases"]:
+        base = baseline_cases.get(case["name"])
+        if base is None:
+            continue
+        comparisons.append(
+            Comparison(
+                name=case["name"],
+                baseline=base["sim_seconds_per_wall_second"],
+                current=case["sim_seconds_per_wall_second"],
+            )
+        )
+    return comparisons
+
+
+def print_comparisons(
+    comparisons: List[Comparison], tolerance: float, output: TextIO
+) -> int:
+    """
+    Print the comparisons and return the number of cases that are slower than
+    the baseline by more than `tolerance`.
+    """
+
+    regressions = 0
+    for c in comparisons:
+        slower = c.change < -tolerance
+        regressions += slower
+        note = "  SLOWER" if slower else ""
+        print(
+            f"{c.name}: {c.baseline:.3f} -> {c.current:.3f} sim-sec/wall-sec "
+            f"({c.change:+.1%}){note}",
+            file=output,
+        )
+    return regressions
+
+
+def _int_list(s: str) -> List[int]:
+    return [int(x) for x in s.split(",")]
+
+
+def _choice_list(choices: Iterable[str]) -> Callable[[str], List[str]]:
+    valid = tuple(choices)
+
+    def parse(s: str) -> List[str]:
+        values = s.split(",")
+        for x in values:
+            if x not in valid:
+                raise argparse.ArgumentTypeError(
+                    f"invalid choice '{x}' (choose from {', '.join(valid)})"
+                )
+        return values
+
+    return parse
+
+
+def _run(res: argparse.Namespace, progname: str) -> int:
+    workload = Workload(
+        stop_time_sec=res.stop_time,
+        phold_bin=res.phold_bin,
+        tgen_bin=res.tgen_bin,
+    )
+    if res.tgen_server_conf is not None:
+        workload.tgen_server_conf = res.tgen_server_conf
+    if res.tgen_client_conf is not None:
+        workload.tgen_client_conf = res.tgen_client_conf
+
+    all_cases = cases(
+        res.workload, res.hosts, res.parallelism, res.scheduler, res.qdisc
+    )
+    work_dir = Path(tempfile.mkdtemp(prefix=f"{progname}-", dir=res.work_dir))
+    print(f"{progname}: writing simulations to {work_dir}", file=sys.stderr)
+
+    results: Dict[Case, Result] = {}
+    for case in all_cases:
+        print(f"{progname}: running {case.name}", file=sys.stderr)
+        try:
+            result = run_case(case, workload, res.shadow_bin, work_dir, res.repeat)
+        except SimulationError as e:
+            print(f"{progname}: {case.name}: {e}", file=sys.stderr)
+            return 1
+        print(
+            f"{progname}: {case.name}: {result.wall_seconds:.2f} wall-sec, "
+            f"{result.events_per_second:.0f} events/sec, "
+            f"{result.sim_seconds_per_wall_second:.3f} sim-sec/wall-sec",
+            file=sys.stderr,
+        )
+        results[case] = result
+
+    out = report(shadow_version(res.shadow_bin), results)
+    res.output.write_text(json.dumps(out, indent=2) + "\n")
+
+    if res.baseline is not None:
+        baseline = json.loads(res.baseline.read_text())
+        regressions = print_comparisons(
+            compare(out, baseline), res.tolerance, sys.stdout
+        )
+        if regressions:
+            return 1
+    return 0
+
+
+def _compare(res: argparse.Namespace) -> int:
+    current = json.loads(res.report.read_text())
+    baseline = json.loads(res.baseline.read_text())
+    regressions = print_comparisons(
+        compare(current, baseline), res.tolerance, sys.stdout
+    )
+    return 1 if regressions else 0
+
+
+def __main__() -> None:
+    """Raw main, suitable for use with `project.scripts` in `pyproject.toml`"""
+
+    PROGNAME: Final[str] = "shadow-bench"
+
+    parser = argparse.ArgumentParser(
+        prog=PROGNAME,
+        description="Benchmarks shadow on sweeps of phold and tgen simulations.",
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    tolerance_help = (
+        "fraction by which a case's sim-sec/wall-sec may be lower than the "
+        "baseline's before it's reported as slower"
+    )
+
+    run = subparsers.add_parser("run", help="run the simulations and write a report")
+    run.add_argument(
+        "--shadow-bin", default="shadow", help="shadow binary basename or path"
+    )
+    run.add_argument(
+        "--workload",
+        type=_choice_list(WORKLOADS),
+        default=["phold"],
+        help=f"comma-separated workloads ({', '.join(WORKLOADS)})",
+    )
+    run.add_argument(
+        "--hosts", type=_int_list, default=[10, 100], help="comma-separated host counts"
+    )
+    run.add_argument(
+        "--parallelism",
+        type=_int_list,
+        default=[1],
+        help="comma-separated worker thread counts",
+    )
+    run.add_argument(
+        "--scheduler",
+        type=_choice_list(SCHEDULERS),
+        default=["thread-per-core"],
+        help=f"comma-separated schedulers ({', '.join(SCHEDULERS)})",
+    )
+    run.add_argument(
+        "--qdisc",
+        type=_choice_list(QDISCS),
+        default=["fifo"],
+        help=f"comma-separated interface qdiscs ({', '.join(QDISCS)})",
+    )
+    run.add_argument(
+        "--stop-time", type=int, default=10, help="simulated seconds per simulation"
+    )
+    run.add_argument(
+        "--repeat", type=int, default=1, help="number of runs of each simulation"
+    )
+    run.add_argument("--phold-bin", type=Path, help="path to the test-phold binary")
+    run.add_argument("--tgen-bin", default="tgen", help="tgen binary basename or path")
+    run.add_argument("--tgen-server-conf", type=Path, help="tgen server graphml")
+    run.add_argument("--tgen-client-conf", type=Path, help="tgen client graphml")
+    run.add_argument(
+        "--work-dir", type=Path, help="directory in which to write the simulations"
+    )
+    run.add_argument(
+        "--output", type=Path, default=Path("bench-report.json"), help="report file"
+    )
+    run.add_argument("--baseline", type=Path, help="report to compare against")
+    run.add_argument("--tolerance", type=float, default=0.05, help=tolerance_help)
+
+    cmp = subparsers.add_parser("compare", help="compare a report against a baseline")
+    cmp.add_argument("report", type=Path)
+    cmp.add_argument("baseline", type=Path)
+    cmp.add_argument("--tolerance", type=float, default=0.05, help=tolerance_help)
+
+    res = parser.parse_args()
+    if res.command == "run":
+        if "phold" in res.workload and res.phold_bin is None:
+            parser.error("the phold workload requires --phold-bin")
+        sys.exit(_run(res, PROGNAME))
+    else:
+        sys.exit(_compare(res))
+
+
+if __name__ == "__main__":
+    __main__()
@@ -58,14 +58,26 @@ class GraphFile(TypedDict, total=False):
 
 
 class Graph(TypedDict, total=False):
-    type: Union[Literal["gml"], Literal["1_gbit_switch"]]
+    type: Union[
+        Literal["gml"], Literal["matrix"], Literal["coordinates"], Literal["1_gbit_switch"]
+    ]
     file: GraphFile
     inline: str
 
 
+class GraphUpdate(TypedDict, total=False):
+    time: Union[str, int]
+    source: int
+    target: int
+    latency: Union[str, int]
+    packet_loss: float
+    up: bool
+
+
 class Network(TypedDict, total=False):
     use_shortest_path: bool
     graph: Graph
+    graph_updates: List[GraphUpdate]
 
 
 class General(TypedDict, total=False):
@@ -82,37 +94,95 @@ class General(TypedDict, total=False):
 
 
 class Experimental(TypedDict, total=False):
+    bootstrap_runahead: Union[str, None]
+    file_cache_paths: List[str]
+    host_data_memory_budget: Union[str, int, None]
+    host_data_memory_path: Union[str, None]
+    host_data_spill_patterns: List[str]
+    idle_host_reclaim_delay: Union[str, None]
     interface_qdisc: Union[Literal["fifo"], Literal["round-robin"]]
+    router_qdisc: Union[Literal["codel"], Literal["fq-codel"]]
+    ipc_spin_limit: int
+    managed_cgroup_cpu_limit: Union[float, None]
+    managed_cgroup_cpus: Union[str, None]
     max_unapplied_cpu_latency: str
+    metrics_address: Union[str, None]
+    native_preemption_backoff: bool
     report_errors_to_stderr: bool
     runahead: Union[str, None]
-    scheduler: Union[Literal["thread-per-core"], Literal["thread-per-host"]]
+    routing_cache_directory: Union[str, None]
+    scheduler: Union[
+        Literal["thread-per-core"], Literal["thread-per-host"], Literal["hybrid"]
+    ]
+    shortest_path_cache_size: Union[int, None]
+    socket_buffer_host_budget: Union[str, int, None]
+    socket_buffer_total_budget: Union[str, int, None]
     socket_recv_autotune: bool
     socket_recv_buffer: Union[str, int]
     socket_send_autotune: bool
     socket_send_buffer: Union[str, int]
     strace_logging_mode: Union[
-        Literal["off"], Literal["standard"], Literal["deterministic"]
+        Literal["off"],
+        Literal["standard"],
+        Literal["deterministic"],
+        Literal["binary"],
     ]
     unblocked_syscall_latency: str
     unblocked_vdso_latency: str
+    use_adaptive_cpu_latency: bool
+    use_adaptive_worker_participation: bool
+    use_batched_memory_writes: bool
+    use_calendar_event_queue: bool
+    use_cgroup_isolation: bool
+    use_continuous_rate_limits: bool
     use_cpu_pinning: bool
+    use_deferred_tcp_flush: bool
+    use_direct_loopback: bool
     use_dynamic_runahead: bool
+    use_event_trace: bool
+    use_file_io_offload: bool
+    use_host_cost_balancing: bool
+    use_libc_patching: bool
     use_memory_manager: bool
+    use_memory_manager_huge_pages: bool
+    use_memory_manager_shared_file_pages: bool
+    use_native_file_io: bool
     use_new_tcp: bool
+    use_new_tcp_delayed_ack: bool
+    use_numa_host_groups: bool
     use_object_counters: bool
+    use_output_segments: bool
+    use_packet_counters: bool
+    use_packet_outbox: bool
+    use_packet_trains: bool
+    use_per_host_lookahead: bool
     use_preload_libc: bool
     use_preload_openssl_crypto: bool
     use_preload_openssl_rng: bool
+    use_process_prelaunch: bool
+    use_profiling: bool
+    use_rdtsc_patching: bool
     use_sched_fifo: bool
+    use_shim_futex_wake: bool
+    use_shim_log_ring: bool
+    use_shim_random: bool
+    use_sim_stats_stream: bool
+    use_smt_sibling_affinity: bool
+    use_startup_probe_cache: bool
     use_syscall_counters: bool
+    use_template_hardlinks: bool
+    use_timer_wheel: bool
     use_worker_spinning: bool
+    use_zygotes: bool
+    worker_threads_per_cpu: int
 
 
 class HostOptions(TypedDict, total=False):
     log_level: Union[LogLevel, None]
     pcap_capture_size: Union[str, int]
     pcap_enabled: bool
+    pcap_ring_duration: Union[str, int, None]
+    pcap_ring_packets: Union[int, None]
 
 
 class Exited(TypedDict):
@@ -127,6 +197,7 @@ class Process(TypedDict, total=False):
     args: Union[str, List[str]]
     environment: Dict[str, str]
     expected_final_state: Union[Exited, Signaled, Literal["running"]]
+    native_syscalls: List[str]
     path: str
     shutdown_signal: UnixSignal
     shutdown_time: Union[str, int, None]
@@ -136,6 +207,7 @@ class Process(TypedDict, total=False):
 class Host(TypedDict, total=False):
     bandwidth_down: Union[str, int, None]
     bandwidth_up: Union[str, int, None]
+    count: Union[int, None]
     ip_addr: Union[str, None]
     network_node_id: int
     host_options: HostOptions
@@ -0,0 +1,238 @@
+"""
+CLI tool for converting shadow's binary event traces to the Chrome trace event
+format, which can be viewed with Perfetto (https://ui.perfetto.dev) or
+`chrome://tracing`.
+
+Shadow writes a trace (`event-trace.bin` in the data directory) when the
+experimental `use_event_trace` option is enabled. See
+`src/main/core/event_trace.rs` for the format.
+
+Each worker thread is shown as a process and each host as a thread within it,
+so the trace shows what each worker spent its time on. Each event's arguments
+include its simulation time, and the number of packets that it delivered or
+the syscalls that the host handled while running it.
+
+Can be executed as `shadow-event-trace` after installing the package, or
+without installing e.g. as
+`PYTHONPATH=/reporoot/shadowtools/src python3 -m shadowtools.event_trace`.
+
+Example:
+
+```
+$ shadow-event-trace shadow.data/event-trace.bin -o event-trace.json
+```
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+from dataclasses import dataclass
+from typing import Any, BinaryIO, Dict, Final, Iterator, Set, TextIO, Tuple
+
+MAGIC: Final[bytes] = b"SHDWEVTR"
+VERSION: Final[int] = 1
+
+RECORD_EVENT: Final[int] = 1
+RECORD_HOST_NAME: Final[int] = 2
+RECORD_TASK_NAME: Final[int] = 3
+
+KIND_PACKET: Final[int] = 0
+KIND_LOCAL: Final[int] = 1
+
+_HEADER: Final = struct.Struct("<8sII")
+# type, kind, reserved, worker, host, task id, sim time, wall start, wall
+# duration, packets, syscalls
+_EVENT_RECORD: Final = struct.Struct("<BBHIIIQQQII")
+# type, reserved, name length, id
+_NAME_RECORD: Final = struct.Struct("<BBHI")
+
+
+class DecodeError(Exception):
+    pass
+
+
+@dataclass
+class EventRecord:
+    worker: int
+    host_id: int
+    host: str
+    # "packets" for packet events, otherwise the type name of the task
+    name: str
+    kind: int
+    sim_time_ns: int
+    wall_start_ns: int
+    wall_duration_ns: int
+    packets: int
+    syscalls: int
+
+
+def _read_exact(f: BinaryIO, n: int) -> bytes:
+    data = f.read(n)
+    if len(data) != n:
+        raise DecodeError("unexpected end of file")
+    return data
+
+
+def _padded(n: int) -> int:
+    return (n + 7) // 8 * 8
+
+
+def decode(f: BinaryIO) -> Iterator[EventRecord]:
+    """Decode the event records of a binary event trace."""
+
+    magic, version, _ = _HEADER.unpack(_read_exact(f, _HEADER.size))
+    if magic != MAGIC:
+        raise DecodeError("not a shadow event trace")
+    if version != VERSION:
+        raise DecodeError(f"unsupported format version {version}")
+
+    hosts: Dict[int, str] = {}
+    tasks: Dict[int, str] = {}
+
+    while True:
+        first = f.read(1)
+        if not first:
+            return
+        record_type = first[0]
+
+        if record_type in (RECORD_HOST_NAME, RECORD_TASK_NAME):
+            rest = _read_exact(f, _NAME_RECORD.size - 1)
+            _, _, name_len, name_id = _NAME_RECORD.unpack(first + rest)
+            name = _read_exact(f, _padded(name_len))[:name_len].decode("utf-8")
+            if record_type == RECORD_HOST_NAME:
+                hosts[name_id] = name
+            else:
+                tasks[name_id] = name
+        elif record_type == RECORD_EVENT:
+            rest = _read_exact(f, _EVENT_RECORD.size - 1)
+            fields = _EVENT_RECORD.unpack(first + rest)
+            _, kind, _, worker, host_id, task_id = fields[:6]
+            sim_time_ns, wall_start_ns, wall_duration_ns, packets, syscalls = fields[6:]
+            if kind == KIND_PACKET:
+                name = "packets"
+            else:
+                name = tasks.get(task_id, f"task_{task_id}")
+            yield EventRecord(
+                worker=worker,
+                host_id=host_id,
+                host=hosts.get(host_id, f"host_{host_id}"),
+                name=name,
+                kind=kind,
+                sim_time_ns=sim_time_ns,
+                wall_start_ns=wall_start_ns,
+                wall_duration_ns=wall_duration_ns,
+                packets=packets,
+                syscalls=syscalls,
+            )
+        else:
+            raise DecodeError(f"unknown record type {record_type}")
+
+
+def to_chrome_events(
+    records: Iterator[EventRecord], sim_clock: bool = False
+) -> Iterator[Dict[str, Any]]:
+    """
+    Convert event records to Chrome trace events. The events are placed on the
+    wall clock timeline, or on the simulation clock timeline if `sim_clock` is
+    set (in which case each event is still shown with its wall duration).
+    """
+
+    workers: Set[int] = set()
+    threads: Set[Tuple[int, int]] = set()
+
+    for record in records:
+        if record.worker not in workers:
+            workers.add(record.worker)
+            yield {
+                "ph": "M",
+                "name": "process_name",
+                "pid": record.worker,
+                "args": {"name": f"worker {record.worker}"},
+            }
+        if (record.worker, record.host_id) not in threads:
+            threads.add((record.worker, record.host_id))
+            yield {
+                "ph": "M",
+                "name": "thread_name",
+                "pid": record.worker,
+                "tid": record.host_id,
+                "args": {"name": record.host},
+            }
+
+        args: Dict[str, Any] = {
+            "host": record.host,
+            "sim_time_ns": record.sim_time_ns,
+            "syscalls": record.syscalls,
+        }
+        if record.kind == KIND_PACKET:
+            args["packets"] = record.packets
+
+        start_ns = record.sim_time_ns if sim_clock else record.wall_start_ns
+        yield {
+            "ph": "X",
+            "name": record.name,
+            "cat": "packet" if record.kind == KIND_PACKET else "local",
+            "pid": record.worker,
+            "tid": record.host_id,
+            # the format's times are in microseconds
+            "ts": start_ns / 1000,
+            "dur": record.wall_duration_ns / 1000,
+            "args": args,
+        }
+
+
+def write_chrome_trace(events: Iterator[Dict[str, Any]], output: TextIO) -> None:
+    """Write the events as a JSON trace, one event per line."""
+
+    output.write('{"displayTimeUnit": "ns", "traceEvents": [\n')
+    first = True
+    for event in events:
+        if not first:
+            output.write(",\n")
+        first = False
+        output.write(json.dumps(event))
+    output.write("\n]}\n")
+
+
+def _main(input: BinaryIO, output: TextIO, sim_clock: bool) -> None:
+    write_chrome_trace(to_chrome_events(decode(input), sim_clock), output)
+
+
+def __main__() -> None:
+    """Raw main, suitable for use with `project.scripts` in `pyproject.toml`"""
+
+    PROGNAME: Final[str] = "shadow-event-trace"
+
+    parser = argparse.ArgumentParser(
+        prog=PROGNAME,
+        description="Converts a shadow event trace to the Chrome trace event format.",
+    )
+    parser.add_argument("file", help="binary event trace (`event-trace.bin`)")
+    parser.add_argument(
+        "-o",
+        "--output",
+        help="file to write the JSON trace to (default: stdout)",
+    )
+    parser.add_argument(
+        "--sim-clock",
+        action="store_true",
+        help="place events at their simulation time instead of their wall time",
+    )
+    res = parser.parse_args()
+
+    output = open(res.output, "w") if res.output is not None else sys.stdout
+    with open(res.file, "rb") as f:
+        try:
+            _main(f, output, res.sim_clock)
+        except DecodeError as e:
+            print(f"{PROGNAME}: {res.file}: {e}", file=sys.stderr)
+            sys.exit(1)
+        finally:
+            if output is not sys.stdout:
+                output.close()
+
+
+if __name__ == "__main__":
+    __main__()
@@ -0,0 +1,153 @@
+"""
+CLI tool for recreating the stdout and stderr files of shadow's managed
+processes from the output segments.
+
+Shadow appends the output of all processes to the segments
+(`output/segment-<n>.bin` in the data directory) when the experimental
+`use_output_segments` option is enabled, and names each output stream in
+`output/index.tsv`. See `src/main/core/output_store.rs` for the format.
+
+Each stream is written to the file in the data directory that shadow would
+otherwise have written it to (e.g. `hosts/server/server.curl.1000.stdout`).
+
+Can be executed as `shadow-extract-output` after installing the package, or
+without installing e.g. as
+`PYTHONPATH=/reporoot/shadowtools/src python3 -m shadowtools.output_segments`.
+
+Example:
+
+```
+$ shadow-extract-output shadow.data
+```
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+from dataclasses import dataclass
+from typing import BinaryIO, Dict, Final, Iterator, TextIO
+
+MAGIC: Final[bytes] = b"SHDWOUTS"
+VERSION: Final[int] = 1
+
+_HEADER: Final = struct.Struct("<8sII")
+# stream id, data length, offset within the stream
+_RECORD: Final = struct.Struct("<IIQ")
+
+
+class DecodeError(Exception):
+    pass
+
+
+@dataclass
+class OutputRecord:
+    stream: int
+    offset: int
+    data: bytes
+
+
+def _read_exact(f: BinaryIO, n: int) -> bytes:
+    data = f.read(n)
+    if len(data) != n:
+        raise DecodeError("unexpected end of file")
+    return data
+
+
+def read_index(f: TextIO) -> Dict[int, str]:
+    """Read the stream ids and their paths (relative to the data directory)."""
+
+    streams: Dict[int, str] = {}
+    for line in f:
+        line = line.rstrip("\n")
+        if not line:
+            continue
+        stream, sep, path = line.partition("\t")
+        if not sep or not stream.isdigit():
+            raise DecodeError(f"malformed index line {line!r}")
+        if os.path.isabs(path) or ".." in path.split(os.sep):
+            raise DecodeError(f"path {path!r} is outside of the data directory")
+        streams[int(stream)] = path
+    return streams
+
+
+def decode(f: BinaryIO) -> Iterator[OutputRecord]:
+    """Decode the records of an output segment."""
+
+    magic, version, _ = _HEADER.unpack(_read_exact(f, _HEADER.size))
+    if magic != MAGIC:
+        raise DecodeError("not a shadow output segment")
+    if version != VERSION:
+        raise DecodeError(f"unsupported format version {version}")
+
+    while True:
+        header = f.read(_RECORD.size)
+        if not header:
+            return
+        if len(header) != _RECORD.size:
+            raise DecodeError("unexpected end of file")
+        stream, length, offset = _RECORD.unpack(header)
+        yield OutputRecord(stream=stream, offset=offset, data=_read_exact(f, length))
+
+
+def extract(data_dir: str) -> int:
+    """
+    Write each stream of the output segments in `data_dir` to its file. Returns
+    the number of files written.
+    """
+
+    output_dir = os.path.join(data_dir, "output")
+    with open(os.path.join(output_dir, "index.tsv")) as f:
+        streams = read_index(f)
+
+    # processes that never wrote anything still get an (empty) file
+    files: Dict[int, BinaryIO] = {}
+    try:
+        for stream, path in streams.items():
+            path = os.path.join(data_dir, path)
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            files[stream] = open(path, "wb")
+
+        segments = sorted(
+            name
+            for name in os.listdir(output_dir)
+            if name.startswith("segment-") and name.endswith(".bin")
+        )
+        for name in segments:
+            with open(os.path.join(output_dir, name), "rb") as f:
+                for record in decode(f):
+                    out = files.get(record.stream)
+                    if out is None:
+                        raise DecodeError(f"unknown stream {record.stream} in {name}")
+                    # a stream's records may be spread over several segments
+                    out.seek(record.offset)
+                    out.write(record.data)
+    finally:
+        for out in files.values():
+            out.close()
+
+    return len(files)
+
+
+def __main__() -> None:
+    """Raw main, suitable for use with `project.scripts` in `pyproject.toml`"""
+
+    PROGNAME: Final[str] = "shadow-extract-output"
+
+    parser = argparse.ArgumentParser(
+        prog=PROGNAME,
+        description="Recreates the process output files from shadow's output segments.",
+    )
+    parser.add_argument("data_dir", help="shadow's data directory (e.g. `shadow.data`)")
+    res = parser.parse_args()
+
+    try:
+        extract(res.data_dir)
+    except DecodeError as e:
+        print(f"{PROGNAME}: {res.data_dir}: {e}", file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    __main__()
@@ -0,0 +1,166 @@
+"""
+CLI tool for converting shadow's binary strace logs to text.
+
+Shadow writes these logs (`<procname>.<pid>.strace.bin`) when the experimental
+`strace_logging_mode` option is set to "binary". See
+`src/main/host/syscall/binary_strace.rs` for the format.
+
+Can be executed as `shadow-strace-decode` after installing the package, or
+without installing e.g. as
+`PYTHONPATH=/reporoot/shadowtools/src python3 -m shadowtools.strace_decode`.
+
+Example:
+
+```
+$ shadow-strace-decode shadow.data/hosts/client/curl.1000.strace.bin
+00:00:00.000000000 [tid 1000] brk(0x0, 0x0, 0x0, 0x0, 0x0, 0x0) = <native>
+...
+```
+"""
+
+import argparse
+import errno
+import struct
+import sys
+
+from dataclasses import dataclass
+from typing import BinaryIO, Dict, Final, Iterator, TextIO, Tuple
+
+MAGIC: Final[bytes] = b"SHDWSTRC"
+VERSION: Final[int] = 1
+
+RECORD_SYSCALL: Final[int] = 1
+RECORD_NAME: Final[int] = 2
+
+RESULT_OK: Final[int] = 0
+RESULT_ERROR: Final[int] = 1
+RESULT_NATIVE: Final[int] = 2
+RESULT_BLOCKED: Final[int] = 3
+
+_HEADER: Final = struct.Struct("<8sII")
+# type, result type, capture length, tid, time, number, reserved, args, rv
+_SYSCALL_RECORD: Final = struct.Struct("<BBHiQII6Qq")
+# type, name length, reserved, number
+_NAME_RECORD: Final = struct.Struct("<BBHI")
+
+
+class DecodeError(Exception):
+    pass
+
+
+@dataclass
+class SyscallRecord:
+    time_ns: int
+    tid: int
+    number: int
+    name: str
+    args: Tuple[int, ...]
+    result_type: int
+    rv: int
+    captured: bytes
+
+    def format(self) -> str:
+        secs, nanos = divmod(self.time_ns, 1_000_000_000)
+        mins, secs = divmod(secs, 60)
+        hours, mins = divmod(mins, 60)
+        args = ", ".join(hex(x) for x in self.args)
+
+        if self.result_type == RESULT_OK:
+            rv = str(self.rv)
+        elif self.result_type == RESULT_ERROR:
+            rv = f"{self.rv} ({errno.errorcode.get(-self.rv, 'unknown')})"
+        elif self.result_type == RESULT_NATIVE:
+            rv = "<native>"
+        elif self.result_type == RESULT_BLOCKED:
+            rv = "<blocked>"
+        else:
+            rv = f"<unknown result type {self.result_type}>"
+
+        time = f"{hours:02}:{mins:02}:{secs:02}.{nanos:09}"
+        line = f"{time} [tid {self.tid}] {self.name}({args}) = {rv}"
+        if self.captured:
+            line += f" data={self.captured!r}"
+        return line
+
+
+def _read_exact(f: BinaryIO, n: int) -> bytes:
+    data = f.read(n)
+    if len(data) != n:
+        raise DecodeError("unexpected end of file")
+    return data
+
+
+def _padded(n: int) -> int:
+    return (n + 7) // 8 * 8
+
+
+def decode(f: BinaryIO) -> Iterator[SyscallRecord]:
+    """Decode the syscall records of a binary strace log."""
+
+    magic, version, _ = _HEADER.unpack(_read_exact(f, _HEADER.size))
+    if magic != MAGIC:
+        raise DecodeError("not a shadow binary strace log")
+    if version != VERSION:
+        raise DecodeError(f"unsupported format version {version}")
+
+    names: Dict[int, str] = {}
+
+    while True:
+        first = f.read(1)
+        if not first:
+            return
+        record_type = first[0]
+
+        if record_type == RECORD_NAME:
+            rest = _read_exact(f, _NAME_RECORD.size - 1)
+            _, name_len, _, number = _NAME_RECORD.unpack(first + rest)
+            name = _read_exact(f, _padded(name_len))[:name_len]
+            names[number] = name.decode("ascii")
+        elif record_type == RECORD_SYSCALL:
+            rest = _read_exact(f, _SYSCALL_RECORD.size - 1)
+            fields = _SYSCALL_RECORD.unpack(first + rest)
+            _, result_type, capture_len, tid, time_ns, number, _ = fields[:7]
+            args = fields[7:13]
+            rv = fields[13]
+            captured = _read_exact(f, _padded(capture_len))[:capture_len]
+            yield SyscallRecord(
+                time_ns=time_ns,
+                tid=tid,
+                number=number,
+                name=names.get(number, f"syscall_{number}"),
+                args=args,
+                result_type=result_type,
+                rv=rv,
+                captured=captured,
+            )
+        else:
+            raise DecodeError(f"unknown record type {record_type}")
+
+
+def _main(input: BinaryIO, output: TextIO) -> None:
+    for record in decode(input):
+        print(record.format(), file=output)
+
+
+def __main__() -> None:
+    """Raw main, suitable for use with `project.scripts` in `pyproject.toml`"""
+
+    PROGNAME: Final[str] = "shadow-strace-decode"
+
+    parser = argparse.ArgumentParser(
+        prog=PROGNAME,
+        description="Converts a shadow binary strace log to text.",
+    )
+    parser.add_argument("file", help="binary strace log (`*.strace.bin`)")
+    res = parser.parse_args()
+
+    with open(res.file, "rb") as f:
+        try:
+            _main(f, sys.stdout)
+        except DecodeError as e:
+            print(f"{PROGNAME}: {res.file}: {e}", file=sys.stderr)
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    __main__()
@@ -0,0 +1,89 @@
+import io
+import json
+import tempfile
+import unittest
+
+from pathlib import Path
+from typing import Any, Dict
+
+from shadowtools import bench
+
+
+class TestBench(unittest.TestCase):
+    def test_cases(self) -> None:
+        schedulers = ["thread-per-core", "thread-per-host"]
+        cases = bench.cases(["phold"], [10, 100], [1, 4], schedulers, ["fifo"])
+        self.assertEqual(len(cases), 8)
+        self.assertEqual(len({c.name for c in cases}), 8)
+        self.assertEqual(cases[0].name, "phold-10hosts-1par-thread-per-core-fifo")
+
+    def test_phold_config(self) -> None:
+        case = bench.Case("phold", 3, 2, "thread-per-host", "round-robin")
+        workload = bench.Workload(stop_time_sec=10, phold_bin=Path("test-phold"))
+        with tempfile.TemporaryDirectory() as d:
+            config = bench.config(case, workload, Path(d))
+            weights = Path(d, "weights.txt").read_text().splitlines()
+
+        self.assertEqual(len(weights), 3)
+        self.assertEqual(sorted(config["hosts"]), ["peer1", "peer2", "peer3"])
+        args = config["hosts"]["peer1"]["processes"][0]["args"]
+        self.assertIn("quantity=3", args)
+        self.assertIn("runtime=8", args)
+        self.assertEqual(config["general"]["parallelism"], 2)
+        self.assertEqual(config["experimental"]["scheduler"], "thread-per-host")
+        self.assertEqual(config["experimental"]["interface_qdisc"], "round-robin")
+        self.assertTrue(config["experimental"]["use_sim_stats_stream"])
+
+    def test_tgen_config(self) -> None:
+        case = bench.Case("tgen", 3, 1, "thread-per-core", "fifo")
+        workload = bench.Workload(stop_time_sec=60)
+        with tempfile.TemporaryDirectory() as d:
+            config = bench.config(case, workload, Path(d))
+        self.assertEqual(sorted(config["hosts"]), ["client1", "client2", "server"])
+
+    def test_read_stats_stream(self) -> None:
+        with tempfile.TemporaryDirectory() as d:
+            path = Path(d, "sim-stats.ndjson")
+            path.write_text(
+                '{"sim_time_ns": 5000000000, "events": 10}\n'
+                '{"sim_time_ns": 10000000000, "events": 32}\n'
+            )
+            stats = bench.read_stats_stream(path)
+        self.assertEqual(stats, {"events": 42, "sim_time_ns": 10_000_000_000})
+
+    def test_compare(self) -> None:
+        def report(speeds: Dict[str, float]) -> Dict[str, Any]:
+            return {
+                "cases": [
+                    {"name": name, "sim_seconds_per_wall_second": speed}
+                    for name, speed in speeds.items()
+                ]
+            }
+
+        baseline = report({"a": 2.0, "b": 1.0, "c": 1.0})
+        current = report({"a": 1.0, "b": 1.02, "d": 5.0})
+        comparisons = bench.compare(current, baseline)
+        self.assertEqual([c.name for c in comparisons], ["a", "b"])
+        self.assertAlmostEqual(comparisons[0].change, -0.5)
+
+        output = io.StringIO()
+        regressions = bench.print_comparisons(comparisons, 0.05, output)
+        self.assertEqual(regressions, 1)
+        lines = output.getvalue().splitlines()
+        self.assertTrue(lines[0].endswith("SLOWER"))
+        self.assertFalse(lines[1].endswith("SLOWER"))
+
+    def test_report(self) -> None:
+        case = bench.Case("phold", 10, 1, "thread-per-core", "fifo")
+        result = bench.Result(
+            wall_seconds=2.0,
+            sim_seconds=10.0,
+            events=1000,
+            events_per_second=500.0,
+            sim_seconds_per_wall_second=5.0,
+        )
+        report = json.loads(json.dumps(bench.report("Shadow 3.2.0", {case: result})))
+        self.assertEqual(report["shadow_version"], "Shadow 3.2.0")
+        self.assertEqual(report["cases"][0]["name"], case.name)
+        self.assertEqual(report["cases"][0]["hosts"], 10)
+        self.assertEqual(report["cases"][0]["sim_seconds_per_wall_second"], 5.0)
@@ -0,0 +1,127 @@
+import io
+import json
+import struct
+import unittest
+
+from typing import Any, Dict, List
+
+from shadowtools import event_trace as et
+
+
+def _header() -> bytes:
+    return et.MAGIC + struct.pack("<II", et.VERSION, 0)
+
+
+def _name(record_type: int, id: int, name: str) -> bytes:
+    encoded = name.encode("utf-8")
+    padding = b"\0" * (-len(encoded) % 8)
+    return struct.pack("<BBHI", record_type, 0, len(encoded), id) + encoded + padding
+
+
+def _event(
+    kind: int,
+    worker: int = 0,
+    host: int = 1,
+    task: int = 0,
+    packets: int = 0,
+    syscalls: int = 0,
+) -> bytes:
+    return struct.pack(
+        "<BBHIIIQQQII",
+        et.RECORD_EVENT,
+        kind,
+        0,
+        worker,
+        host,
+        task,
+        5_000_000,
+        3_000,
+        1_500,
+        packets,
+        syscalls,
+    )
+
+
+class TestDecode(unittest.TestCase):
+    def test_decode(self) -> None:
+        data = (
+            _header()
+            + _name(et.RECORD_HOST_NAME, 1, "server")
+            + _name(et.RECORD_TASK_NAME, 1, "shadow_rs::foo::{{closure}}")
+            + _event(et.KIND_LOCAL, task=1, syscalls=4)
+            + _event(et.KIND_PACKET, worker=2, packets=3)
+            # a host without a name record
+            + _event(et.KIND_PACKET, host=9, packets=1)
+        )
+        records = list(et.decode(io.BytesIO(data)))
+        self.assertEqual(len(records), 3)
+
+        local = records[0]
+        self.assertEqual(local.host, "server")
+        self.assertEqual(local.name, "shadow_rs::foo::{{closure}}")
+        self.assertEqual(local.sim_time_ns, 5_000_000)
+        self.assertEqual(local.wall_start_ns, 3_000)
+        self.assertEqual(local.wall_duration_ns, 1_500)
+        self.assertEqual(local.syscalls, 4)
+
+        packet = records[1]
+        self.assertEqual(packet.worker, 2)
+        self.assertEqual(packet.name, "packets")
+        self.assertEqual(packet.packets, 3)
+
+        self.assertEqual(records[2].host, "host_9")
+
+    def test_bad_magic(self) -> None:
+        with self.assertRaises(et.DecodeError):
+            list(et.decode(io.BytesIO(b"NOTATRCE" + bytes(8))))
+
+    def test_truncated(self) -> None:
+        data = _header() + _event(et.KIND_PACKET)[:20]
+        with self.assertRaises(et.DecodeError):
+            list(et.decode(io.BytesIO(data)))
+
+
+class TestChromeTrace(unittest.TestCase):
+    def _convert(self, data: bytes, sim_clock: bool = False) -> List[Dict[str, Any]]:
+        output = io.StringIO()
+        et._main(io.BytesIO(data), output, sim_clock)
+        trace = json.loads(output.getvalue())
+        events: List[Dict[str, Any]] = trace["traceEvents"]
+        return events
+
+    def test_convert(self) -> None:
+        data = (
+            _header()
+            + _name(et.RECORD_HOST_NAME, 1, "server")
+            + _event(et.KIND_PACKET, packets=3)
+            + _event(et.KIND_PACKET, packets=1)
+        )
+        events = self._convert(data)
+
+        # the worker and host names, then the events
+        self.assertEqual([x["ph"] for x in events], ["M", "M", "X", "X"])
+        self.assertEqual(events[0]["args"], {"name": "worker 0"})
+        self.assertEqual(events[1]["args"], {"name": "server"})
+
+        event = events[2]
+        self.assertEqual(event["pid"], 0)
+        self.assertEqual(event["tid"], 1)
+        self.assertEqual(event["ts"], 3.0)
+        self.assertEqual(event["dur"], 1.5)
+        self.assertEqual(
+            event["args"],
+            {"host": "server", "sim_time_ns": 5_000_000, "syscalls": 0, "packets": 3},
+        )
+
+    def test_sim_clock(self) -> None:
+        data = _header() + _event(et.KIND_LOCAL)
+        events = self._convert(data, sim_clock=True)
+        self.assertEqual(events[-1]["ts"], 5_000.0)
+        self.assertEqual(events[-1]["dur"], 1.5)
+
+    def test_empty(self) -> None:
+        self.assertEqual(self._convert(_header()), [])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,74 @@
+import io
+import os
+import struct
+import tempfile
+import unittest
+
+from shadowtools import output_segments as seg
+
+
+def _header() -> bytes:
+    return seg.MAGIC + struct.pack("<II", seg.VERSION, 0)
+
+
+def _record(stream: int, offset: int, data: bytes) -> bytes:
+    return struct.pack("<IIQ", stream, len(data), offset) + data
+
+
+class TestDecode(unittest.TestCase):
+    def test_decode(self) -> None:
+        data = _header() + _record(1, 0, b"hello ") + _record(1, 6, b"world")
+        records = list(seg.decode(io.BytesIO(data)))
+        self.assertEqual(
+            records,
+            [
+                seg.OutputRecord(stream=1, offset=0, data=b"hello "),
+                seg.OutputRecord(stream=1, offset=6, data=b"world"),
+            ],
+        )
+
+    def test_bad_magic(self) -> None:
+        with self.assertRaises(seg.DecodeError):
+            list(seg.decode(io.BytesIO(b"NOTOUTPUT" + b"\0" * 7)))
+
+    def test_truncated(self) -> None:
+        data = _header() + _record(1, 0, b"hello")
+        with self.assertRaises(seg.DecodeError):
+            list(seg.decode(io.BytesIO(data[:-1])))
+
+    def test_index(self) -> None:
+        index = io.StringIO("0\thosts/a/a.1000.stdout\n1\thosts/a/a.1000.stderr\n")
+        self.assertEqual(
+            seg.read_index(index),
+            {0: "hosts/a/a.1000.stdout", 1: "hosts/a/a.1000.stderr"},
+        )
+        with self.assertRaises(seg.DecodeError):
+            seg.read_index(io.StringIO("0\t../outside\n"))
+
+
+class TestExtract(unittest.TestCase):
+    def test_extract(self) -> None:
+        with tempfile.TemporaryDirectory() as data_dir:
+            output_dir = os.path.join(data_dir, "output")
+            os.mkdir(output_dir)
+            with open(os.path.join(output_dir, "index.tsv"), "w") as f:
+                f.write("0\thosts/a/a.1000.stdout\n1\thosts/a/a.1000.stderr\n")
+
+            # the stream's records are spread over both segments, as if the host had moved to
+            # another worker
+            with open(os.path.join(output_dir, "segment-0.bin"), "wb") as f:
+                f.write(_header() + _record(0, 0, b"hello "))
+            with open(os.path.join(output_dir, "segment-1.bin"), "wb") as f:
+                f.write(_header() + _record(0, 6, b"world\n"))
+
+            self.assertEqual(seg.extract(data_dir), 2)
+
+            host_dir = os.path.join(data_dir, "hosts", "a")
+            with open(os.path.join(host_dir, "a.1000.stdout"), "rb") as f:
+                self.assertEqual(f.read(), b"hello world\n")
+            with open(os.path.join(host_dir, "a.1000.stderr"), "rb") as f:
+                self.assertEqual(f.read(), b"")
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,70 @@
+import io
+import struct
+import unittest
+
+from shadowtools import strace_decode as sd
+
+
+def _header() -> bytes:
+    return sd.MAGIC + struct.pack("<II", sd.VERSION, 0)
+
+
+def _name(number: int, name: str) -> bytes:
+    encoded = name.encode("ascii")
+    padding = b"\0" * (-len(encoded) % 8)
+    header = struct.pack("<BBHI", sd.RECORD_NAME, len(encoded), 0, number)
+    return header + encoded + padding
+
+
+def _syscall(
+    number: int, result_type: int, rv: int, captured: bytes = b"", tid: int = 1000
+) -> bytes:
+    padding = b"\0" * (-len(captured) % 8)
+    args = (3, 0x1000, len(captured), 0, 0, 0)
+    return (
+        struct.pack(
+            "<BBHiQII6Qq",
+            sd.RECORD_SYSCALL,
+            result_type,
+            len(captured),
+            tid,
+            3_723_000_000_005,
+            number,
+            0,
+            *args,
+            rv,
+        )
+        + captured
+        + padding
+    )
+
+
+class TestStraceDecode(unittest.TestCase):
+    def test_decode(self) -> None:
+        data = (
+            _header()
+            + _name(1, "write")
+            + _syscall(1, sd.RESULT_OK, 5, b"hello")
+            + _syscall(1, sd.RESULT_ERROR, -9)
+            + _syscall(7, sd.RESULT_BLOCKED, 0)
+        )
+        records = list(sd.decode(io.BytesIO(data)))
+        self.assertEqual(len(records), 3)
+        self.assertEqual(records[0].captured, b"hello")
+        self.assertEqual(
+            records[0].format(),
+            "01:02:03.000000005 [tid 1000] write(0x3, 0x1000, 0x5, 0x0, 0x0, 0x0) = 5"
+            + " data=b'hello'",
+        )
+        self.assertTrue(records[1].format().endswith(" = -9 (EBADF)"))
+        self.assertEqual(records[2].name, "syscall_7")
+        self.assertTrue(records[2].format().endswith(" = <blocked>"))
+
+    def test_bad_magic(self) -> None:
+        with self.assertRaises(sd.DecodeError):
+            list(sd.decode(io.BytesIO(b"NOTSTRCE" + bytes(8))))
+
+    def test_truncated(self) -> None:
+        data = _header() + _syscall(1, sd.RESULT_OK, 0)[:20]
+        with self.assertRaises(sd.DecodeError):
+            list(sd.decode(io.BytesIO(data)))
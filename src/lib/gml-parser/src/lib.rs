@@ -32,8 +32,13 @@ graph [
 pub mod gml;
 mod parser;
 
+use std::borrow::Cow;
+use std::collections::HashSet;
+
 use nom::Finish;
 
+use crate::gml::GmlItem;
+
 /// Parse the graph string into a [`gml::Gml`] object. If the graph contains syntax errors, a
 /// human-readable error message will be returned.
 /// ```
@@ -58,3 +63,98 @@ pub fn parse(gml_str: &str) -> Result<gml::Gml, String> {
         Err(e) => Err(nom_language::error::convert_error(gml_str, e)),
     }
 }
+
+/// Parse the graph string one item at a time, for example to convert very large graphs to another
+/// representation without first building a [`gml::Gml`] object containing every node and edge.
+/// Returns an error if the graph doesn't start with a valid graph header. The items borrow from
+/// the graph string where possible.
+/// ```
+/// # use gml_parser::gml::GmlItem;
+/// let graph = r#"
+/// graph [
+///   directed 1
+///   node [
+///     id 0
+///   ]
+///   edge [
+///     source 0
+///     target 0
+///   ]
+/// ]"#;
+/// let items: Vec<GmlItem> = gml_parser::parse_items(graph)
+///     .unwrap()
+///     .collect::<Result<_, _>>()
+///     .unwrap();
+/// assert_eq!(items.len(), 3);
+/// assert_eq!(items[0], GmlItem::Directed(true));
+/// ```
+pub fn parse_items(gml_str: &str) -> Result<GmlItems<'_>, String> {
+    match parser::graph_start::<nom_language::error::VerboseError<&str>>(gml_str).finish() {
+        Ok((remaining, ())) => Ok(GmlItems {
+            full_input: gml_str,
+            input: remaining,
+            seen_directed: false,
+            other_keys: HashSet::new(),
+            done: false,
+        }),
+        Err(e) => Err(nom_language::error::convert_error(gml_str, e)),
+    }
+}
+
+/// An iterator over the items of a GML graph, returned by [`parse_items`]. Items are parsed as the
+/// iterator advances. After an error is returned, the iterator ends.
+#[derive(Debug)]
+pub struct GmlItems<'a> {
+    full_input: &'a str,
+    /// The input after the previous item.
+    input: &'a str,
+    seen_directed: bool,
+    /// Keys of the graph's other key-value pairs, used to reject duplicate keys.
+    other_keys: HashSet<Cow<'a, str>>,
+    done: bool,
+}
+
+impl<'a> Iterator for GmlItems<'a> {
+    type Item = Result<GmlItem<'a>, String>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.done {
+            return None;
+        }
+
+        // the end of the graph
+        if self.input.starts_with(']') {
+            self.done = true;
+            return None;
+        }
+
+        let item =
+            match parser::item::<nom_language::error::VerboseError<&str>>(self.input).finish() {
+                Ok((remaining, item)) => {
+                    self.input = remaining;
+                    item
+                }
+                Err(e) => {
+                    self.done = true;
+                    return Some(Err(nom_language::error::convert_error(self.full_input, e)));
+                }
+            };
+
+        let err = match &item {
+            GmlItem::Directed(_) if std::mem::replace(&mut self.seen_directed, true) => {
+                Some("The 'directed' key must only be specified once")
+            }
+            GmlItem::KeyValue((key, _)) if !self.other_keys.insert(key.clone()) => {
+                Some("Duplicate keys are not supported")
+            }
+            _ => None,
+        };
+
+        if let Some(err) = err {
+            self.done = true;
+            return Some(Err(err.to_string()));
+        }
+
+        Some(Ok(item))
+    }
+}
@@ -62,13 +62,19 @@ pub fn item<'a, E: GmlParseError<'a>>(input: &'a str) -> IResult<&'a str, GmlIte
     }
 }
 
-/// Parse a GML graph.
-pub fn gml<'a, E: GmlParseError<'a>>(input: &'a str) -> IResult<&'a str, Gml<'a>, E> {
+/// Parse the start of a GML graph, up to its first item.
+pub fn graph_start<'a, E: GmlParseError<'a>>(input: &'a str) -> IResult<&'a str, (), E> {
     let (input, _) = multispace0(input)?;
     let (input, _) = tag("graph")(input)?;
     let (input, _) = space0(input)?;
     let (input, _) = tag("[")(input)?;
     let (input, _) = newline(input)?;
+    Ok((input, ()))
+}
+
+/// Parse a GML graph.
+pub fn gml<'a, E: GmlParseError<'a>>(input: &'a str) -> IResult<&'a str, Gml<'a>, E> {
+    let (input, _) = graph_start(input)?;
 
     let (input, (items, _)) = nom::multi::many_till(item, tag("]")).parse(input)?;
 
@@ -232,6 +238,14 @@ fn float<'a, E: GmlParseError<'a>>(input: &'a str) -> IResult<&'a str, Value<'a>
 /// Parse a GML string.
 fn string<'a, E: GmlParseError<'a>>(input: &'a str) -> IResult<&'a str, Value<'a>, E> {
     let (input, _) = tag("\"")(input)?;
+
+    // strings without escape sequences can be borrowed from the input
+    let borrowed: IResult<&'a str, &'a str, E> =
+        nom::sequence::terminated(is_not("\"\\"), tag("\"")).parse(input);
+    if let Ok((input, value)) = borrowed {
+        return Ok((input, Value::Str(value.into())));
+    }
+
     let (input, value) = escaped_transform(
         is_not("\""),
         '\\',
@@ -4,3 +4,5 @@ pub use bindings::linux_new_utsname;
 #[allow(non_camel_case_types)]
 pub type new_utsname = linux_new_utsname;
 unsafe impl shadow_pod::Pod for linux_new_utsname {}
+// SAFETY: contains only character arrays.
+unsafe impl vasi::VirtualAddressSpaceIndependent for linux_new_utsname {}
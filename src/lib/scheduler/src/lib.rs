@@ -38,7 +38,7 @@
 //!
 //! // a scheduler with two threads (no cpu pinning) and three hosts
 //! let mut sched: ThreadPerCoreSched<Host> =
-//!     ThreadPerCoreSched::new(&[None, None], hosts, false);
+//!     ThreadPerCoreSched::new(&[None, None], hosts, false, false, false, None, None);
 //!
 //! // the counter is owned by this main thread with a non-static lifetime, but
 //! // because of the "scoped threads" design it can be accessed by the task in
@@ -229,6 +229,35 @@ impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope
             }),
         }
     }
+
+    /// Like [`run_with_data`](Self::run_with_data), but only runs the closure on the first
+    /// `num_threads` threads (at least one). The other threads stay parked rather than being
+    /// woken, and the threads that run are given all hosts. This is useful when there is too little
+    /// work to be worth waking every thread. The closure may run on more threads than requested.
+    ///
+    /// The thread-per-host scheduler runs the closure on all threads, since each of its threads
+    /// has a single host.
+    pub fn run_with_data_on<T>(
+        self,
+        num_threads: usize,
+        data: &'scope [T],
+        f: impl Fn(usize, &mut HostIter<HostType>, &T) + Send + Sync + 'scope,
+    ) where
+        T: Sync,
+    {
+        match self {
+            Self::ThreadPerHost(scope) => scope.run_with_data(data, move |idx, iter, elem| {
+                let mut iter = HostIter::ThreadPerHost(iter);
+                f(idx, &mut iter, elem)
+            }),
+            Self::ThreadPerCore(scope) => {
+                scope.run_with_data_on(num_threads, data, move |idx, iter, elem| {
+                    let mut iter = HostIter::ThreadPerCore(iter);
+                    f(idx, &mut iter, elem)
+                })
+            }
+        }
+    }
 }
 
 /// Supports iterating over all hosts assigned to this thread.
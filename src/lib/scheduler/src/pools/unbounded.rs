@@ -5,12 +5,14 @@
 use std::marker::PhantomData;
 use std::ops::Deref;
 use std::sync::Arc;
-use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::atomic::{AtomicBool, AtomicU32, Ordering};
 
 use atomic_refcell::AtomicRefCell;
+use nix::errno::Errno;
 
-use crate::sync::count_down_latch::{self, build_count_down_latch};
-use crate::sync::simple_latch;
+use crate::sync::selective_latch;
+use crate::sync::simple_latch::libc_futex;
+use crate::sync::tree_latch::{self, build_tree_latch};
 
 // If making substantial changes to this scheduler, you should verify the compilation error message
 // for each test at the end of this file to make sure that they correctly cause the expected
@@ -24,17 +26,26 @@ use crate::sync::simple_latch;
 pub trait TaskFn: Fn(usize) + Send + Sync {}
 impl<T> TaskFn for T where T: Fn(usize) + Send + Sync {}
 
-/// A thread pool that runs a task on many threads. A task will run once on each thread.
+/// The number of times the main thread checks if a partial task has finished before
+/// futex-waiting.
+const PARTIAL_END_SPIN_ITERS: u32 = 1_000;
+
+/// A thread pool that runs a task on many threads. A task will run once on each thread, or once on
+/// each of the first few threads.
 pub struct UnboundedThreadPool {
     /// Handles for joining threads when they've exited.
     thread_handles: Vec<std::thread::JoinHandle<()>>,
     /// State shared between all threads.
     shared_state: Arc<SharedState>,
     /// A latch that is opened when the task is set. Indicates to the threads that they should start
-    /// running the task.
-    task_start_latch: simple_latch::Latch,
-    /// The main thread uses this to wait for the threads to finish running the task.
-    task_end_waiter: count_down_latch::LatchWaiter,
+    /// running the task. Only the threads that run the task are woken.
+    task_start_latch: selective_latch::SelectiveLatch,
+    /// The main thread uses this to wait for the threads to finish running a task that runs on
+    /// all threads.
+    task_end_waiter: tree_latch::TreeLatchWaiter,
+    num_threads: usize,
+    /// The number of threads that run the current task.
+    num_task_threads: usize,
 }
 
 pub struct SharedState {
@@ -42,6 +53,86 @@ pub struct SharedState {
     task: AtomicRefCell<Option<Box<dyn TaskFn>>>,
     /// Has a thread panicked?
     has_thread_panicked: AtomicBool,
+    /// The threads count down on this at the end of a task that doesn't run on all threads.
+    partial_task_end: PartialTaskEnd,
+}
+
+/// Counts the threads that haven't finished a task that only runs on some of the threads. Such
+/// tasks only run on a few threads, so the threads share a single counter rather than a tree
+/// latch.
+struct PartialTaskEnd {
+    remaining: AtomicU32,
+    /// Is the main thread futex-waiting (or about to)?
+    waiter_sleeping: AtomicBool,
+}
+
+impl PartialTaskEnd {
+    fn new() -> Self {
+        Self {
+            remaining: AtomicU32::new(0),
+            waiter_sleeping: AtomicBool::new(false),
+        }
+    }
+
+    /// Must be called before the threads are started.
+    fn reset(&self, num_threads: usize) {
+        self.remaining
+            .store(num_threads.try_into().unwrap(), Ordering::Relaxed);
+    }
+
+    fn count_down(&self) {
+        // this must be sequentially consistent with the waiter's accesses, so that either we see
+        // that the waiter is sleeping or the waiter sees that no threads remain
+        if self.remaining.fetch_sub(1, Ordering::SeqCst) == 1
+            && self.waiter_sleeping.load(Ordering::SeqCst)
+        {
+            libc_futex(
+                &self.remaining,
+                libc::FUTEX_WAKE | libc::FUTEX_PRIVATE_FLAG,
+                1,
+                None,
+                None,
+                0,
+            )
+            .expect("FUTEX_WAKE failed");
+        }
+    }
+
+    fn wait(&self) {
+        let mut spins = 0;
+
+        loop {
+            let remaining = self.remaining.load(Ordering::Acquire);
+            if remaining == 0 {
+                self.waiter_sleeping.store(false, Ordering::Relaxed);
+                break;
+            }
+
+            if spins < PARTIAL_END_SPIN_ITERS {
+                spins += 1;
+                std::hint::spin_loop();
+                continue;
+            }
+
+            self.waiter_sleeping.store(true, Ordering::SeqCst);
+            if self.remaining.load(Ordering::SeqCst) != remaining {
+                continue;
+            }
+
+            let rv = libc_futex(
+                &self.remaining,
+                libc::FUTEX_WAIT | libc::FUTEX_PRIVATE_FLAG,
+                remaining,
+                None,
+                None,
+                0,
+            );
+            assert!(
+                matches!(rv, Ok(_) | Err(Errno::EAGAIN | Errno::EINTR)),
+                "FUTEX_WAIT failed with {rv:?}"
+            );
+        }
+    }
 }
 
 impl UnboundedThreadPool {
@@ -49,30 +140,30 @@ impl UnboundedThreadPool {
         let shared_state = Arc::new(SharedState {
             task: AtomicRefCell::new(None),
             has_thread_panicked: AtomicBool::new(false),
+            partial_task_end: PartialTaskEnd::new(),
         });
 
-        let (task_end_counter, task_end_waiter) = build_count_down_latch();
-        let mut task_start_latch = simple_latch::Latch::new();
+        let (task_end_counters, task_end_waiter) = build_tree_latch(num_threads);
+        let mut task_start_latch = selective_latch::SelectiveLatch::new();
 
         let mut thread_handles = Vec::new();
 
-        for i in 0..num_threads {
+        for (i, task_end_counter) in task_end_counters.into_iter().enumerate() {
             let shared_state_clone = Arc::clone(&shared_state);
 
             // enabling spinning on the threads may improve performance under some conditions
             // (see https://github.com/shadow/shadow/issues/2877)
             let task_start_waiter = task_start_latch.waiter(yield_spin);
 
-            let task_end_counter_clone = task_end_counter.clone();
-
             let handle = std::thread::Builder::new()
                 .name(thread_name.to_string())
                 .spawn(move || {
                     work_loop(
                         i,
+                        num_threads,
                         shared_state_clone,
                         task_start_waiter,
-                        task_end_counter_clone,
+                        task_end_counter,
                     )
                 })
                 .unwrap();
@@ -85,6 +176,8 @@ impl UnboundedThreadPool {
             shared_state,
             task_start_latch,
             task_end_waiter,
+            num_threads,
+            num_task_threads: num_threads,
         }
     }
 
@@ -101,10 +194,10 @@ impl UnboundedThreadPool {
         let check_for_errors = !self
             .shared_state
             .has_thread_panicked
-            .load(Ordering::Relaxed);
+            .load(Ordering::Acquire);
 
         // start the threads
-        self.task_start_latch.open();
+        self.task_start_latch.open(self.num_threads);
 
         for handle in self.thread_handles.drain(..) {
             let result = handle.join();
@@ -143,7 +236,7 @@ impl UnboundedThreadPool {
             !self
                 .shared_state
                 .has_thread_panicked
-                .load(Ordering::Relaxed),
+                .load(Ordering::Acquire),
             "Attempting to use a workpool that previously panicked"
         );
 
@@ -176,7 +269,11 @@ impl std::ops::Drop for WorkerScope<'_> {
         // if the task was set (if `TaskRunner::run` was called)
         if self.pool.shared_state.task.borrow().is_some() {
             // wait for the task to complete
-            self.pool.task_end_waiter.wait();
+            if self.pool.num_task_threads < self.pool.num_threads {
+                self.pool.shared_state.partial_task_end.wait();
+            } else {
+                self.pool.task_end_waiter.wait();
+            }
 
             // clear the task
             *self.pool.shared_state.task.borrow_mut() = None;
@@ -186,7 +283,7 @@ impl std::ops::Drop for WorkerScope<'_> {
                 .pool
                 .shared_state
                 .has_thread_panicked
-                .load(Ordering::Relaxed)
+                .load(Ordering::Acquire)
             {
                 // we could store the thread's panic message and propagate it, but I don't think
                 // that's worth handling
@@ -206,6 +303,12 @@ pub struct TaskRunner<'a, 'scope> {
 impl<'scope> TaskRunner<'_, 'scope> {
     /// Run a task on the pool's threads.
     pub fn run(self, f: impl TaskFn + 'scope) {
+        self.run_on(usize::MAX, f);
+    }
+
+    /// Run a task on the first `num_threads` of the pool's threads (at least one). The other
+    /// threads aren't woken. The task may run on more threads than requested.
+    pub fn run_on(self, num_threads: usize, f: impl TaskFn + 'scope) {
         let f = Box::new(f);
 
         // SAFETY: WorkerScope will drop this TaskFn before the end of 'scope
@@ -213,18 +316,28 @@ impl<'scope> TaskRunner<'_, 'scope> {
             std::mem::transmute::<Box<dyn TaskFn + 'scope>, Box<dyn TaskFn + 'static>>(f)
         };
 
-        *self.scope.pool.shared_state.task.borrow_mut() = Some(f);
+        let pool = &mut self.scope.pool;
+        *pool.shared_state.task.borrow_mut() = Some(f);
+
+        let num_threads = pool
+            .task_start_latch
+            .num_released(std::cmp::max(num_threads, 1));
+        pool.num_task_threads = num_threads;
+        if num_threads < pool.num_threads {
+            pool.shared_state.partial_task_end.reset(num_threads);
+        }
 
         // we've set the task, so start the threads
-        self.scope.pool.task_start_latch.open();
+        pool.task_start_latch.open(num_threads);
     }
 }
 
 fn work_loop(
     thread_index: usize,
+    num_threads: usize,
     shared_state: Arc<SharedState>,
-    mut start_waiter: simple_latch::LatchWaiter,
-    mut end_counter: count_down_latch::LatchCounter,
+    mut start_waiter: selective_latch::SelectiveLatchWaiter,
+    mut end_counter: tree_latch::TreeLatchCounter,
 ) {
     // we don't use `catch_unwind` here for two main reasons:
     //
@@ -251,7 +364,23 @@ fn work_loop(
         fn drop(&mut self) {
             // if we panicked, then inform other threads that we panicked and allow them to exit
             // gracefully
-            self.0.has_thread_panicked.store(true, Ordering::Relaxed);
+            self.0.has_thread_panicked.store(true, Ordering::Release);
+        }
+    }
+
+    // counts down at the end of a partial task, even if the task panics
+    struct CountDownWhenDropped<'a>(&'a SharedState);
+
+    impl std::ops::Drop for CountDownWhenDropped<'_> {
+        fn drop(&mut self) {
+            // this is dropped before `PoisonWhenDropped`, so poison the workpool before counting
+            // down, otherwise the main thread could see the task end without seeing the panic
+            if std::thread::panicking() {
+                self.0.has_thread_panicked.store(true, Ordering::Release);
+            }
+            // the count down is a release operation, which the main thread's acquire of the count
+            // synchronizes with
+            self.0.partial_task_end.count_down();
         }
     }
 
@@ -260,7 +389,11 @@ fn work_loop(
 
     loop {
         // wait for a new task
-        start_waiter.wait();
+        let num_task_threads = start_waiter.wait();
+        let is_partial = num_task_threads < num_threads;
+
+        // declared before the task is borrowed so that it's dropped after the borrow
+        let partial_count_down = is_partial.then(|| CountDownWhenDropped(shared_state));
 
         // scope used to make sure we drop the task before counting down
         {
@@ -275,7 +408,10 @@ fn work_loop(
         }
 
         // SAFETY: we do not hold any references/borrows to the task at this time
-        end_counter.count_down();
+        match partial_count_down {
+            Some(x) => std::mem::drop(x),
+            None => end_counter.count_down(),
+        }
     }
 
     // didn't panic, so forget the poison handler and return normally
@@ -318,6 +454,39 @@ mod tests {
         assert_eq!(counter.load(Ordering::SeqCst), 12);
     }
 
+    #[test]
+    fn test_run_on() {
+        let mut pool = UnboundedThreadPool::new(4, "worker", false);
+
+        let counters: Vec<_> = (0..4).map(|_| AtomicU32::new(0)).collect();
+        for num_threads in [1, 2, 4, 3, 0, 10] {
+            pool.scope(|s| {
+                s.run_on(num_threads, |i| {
+                    counters[i].fetch_add(1, Ordering::SeqCst);
+                });
+            });
+        }
+
+        // a thread runs in each round that it's one of the first 'num_threads' threads, and
+        // always runs at least one thread
+        let counters: Vec<_> = counters.iter().map(|x| x.load(Ordering::SeqCst)).collect();
+        assert_eq!(counters, [6, 4, 3, 2]);
+    }
+
+    #[test]
+    #[should_panic]
+    fn test_panic_run_on() {
+        let mut pool = UnboundedThreadPool::new(4, "worker", false);
+
+        pool.scope(|s| {
+            s.run_on(2, |i| {
+                if i == 1 {
+                    panic!("{}", i);
+                }
+            });
+        });
+    }
+
     #[test]
     fn test_large_num_threads() {
         let mut pool = UnboundedThreadPool::new(100, "worker", false);
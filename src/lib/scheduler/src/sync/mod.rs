@@ -1,3 +1,8 @@
 pub mod count_down_latch;
+pub mod selective_latch;
+// the unbounded pool starts its threads with the selective latch, but the latch is kept since
+// it's simpler
+#[allow(dead_code)]
 pub mod simple_latch;
 pub mod thread_parking;
+pub mod tree_latch;
@@ -0,0 +1,292 @@
+use std::sync::Arc;
+use std::sync::atomic::{AtomicU32, AtomicUsize, Ordering};
+
+use nix::errno::Errno;
+
+use crate::sync::simple_latch::libc_futex;
+
+/// If a waiter hasn't been released for this many generations, the next opening releases every
+/// waiter so that the waiter's generation can't wrap around to the latch's generation.
+const MAX_SKIPPED_GENERATIONS: u32 = 1 << 30;
+
+/// A reusable latch like [`simple_latch`](crate::sync::simple_latch), but where each opening only
+/// releases the waiters with an index below some number. The other waiters stay parked (they
+/// aren't woken by the kernel) and skip that generation. Each waiter has a fixed index, and waiters
+/// with an index of 32 or more may be woken spuriously, in which case they go back to waiting.
+///
+/// After opening the latch, you must not open it again until all released waiters have returned
+/// from [`wait()`](SelectiveLatchWaiter::wait).
+///
+/// The latch uses release-acquire ordering, so any changes made before an `open()` should be
+/// visible in the released threads after a `wait()` returns.
+#[derive(Debug)]
+pub struct SelectiveLatch {
+    inner: Arc<SelectiveLatchInner>,
+    /// The number of waiters that have been created.
+    num_waiters: usize,
+    /// The last generation that released every waiter.
+    last_full_generation: u32,
+}
+
+/// A waiter for a [`SelectiveLatch`].
+#[derive(Debug)]
+pub struct SelectiveLatchWaiter {
+    inner: Arc<SelectiveLatchInner>,
+    index: usize,
+    /// The latest generation that this waiter has seen.
+    generation: u32,
+    /// Should we sched_yield in a spinloop indefinitely rather than futex-wait?
+    spin_yield: bool,
+}
+
+#[derive(Debug)]
+struct SelectiveLatchInner {
+    /// The generation of the latch. The waiters futex-wait on this.
+    generation: AtomicU32,
+    /// The number of waiters released by each generation, indexed by the generation's parity.
+    /// The value for a generation is written before the generation is opened, and is only
+    /// overwritten when opening the generation after the next.
+    num_released: [AtomicUsize; 2],
+}
+
+impl SelectiveLatch {
+    /// Create a new latch.
+    pub fn new() -> Self {
+        Self {
+            inner: Arc::new(SelectiveLatchInner {
+                generation: AtomicU32::new(0),
+                num_released: [AtomicUsize::new(0), AtomicUsize::new(0)],
+            }),
+            num_waiters: 0,
+            last_full_generation: 0,
+        }
+    }
+
+    /// Get a new waiter for this latch with the next index, starting from 0. A single
+    /// [`wait()`](SelectiveLatchWaiter::wait) will block the waiter until the next latch opening
+    /// that releases it.
+    ///
+    /// If `spin_yield` is `true`, the waiter will `sched_yield` in a spinloop indefinitely. If
+    /// `spin_yield` is `false`, the waiter will futex-wait.
+    pub fn waiter(&mut self, spin_yield: bool) -> SelectiveLatchWaiter {
+        let index = self.num_waiters;
+        self.num_waiters += 1;
+
+        SelectiveLatchWaiter {
+            inner: Arc::clone(&self.inner),
+            index,
+            // we're the only one who can mutate the atomic, so there's no race condition here
+            generation: self.inner.generation.load(Ordering::Relaxed),
+            spin_yield,
+        }
+    }
+
+    /// The number of waiters that the next [`open()`](Self::open) will release if given
+    /// `num_waiters`. This is all waiters if some waiter must be released to keep it in sync with
+    /// the latch.
+    pub fn num_released(&self, num_waiters: usize) -> usize {
+        let generation = self
+            .inner
+            .generation
+            .load(Ordering::Relaxed)
+            .wrapping_add(1);
+
+        if generation.wrapping_sub(self.last_full_generation) >= MAX_SKIPPED_GENERATIONS {
+            self.num_waiters
+        } else {
+            std::cmp::min(num_waiters, self.num_waiters)
+        }
+    }
+
+    /// Open the latch for the waiters with an index below `num_waiters`, which must be at least 1.
+    /// Returns the number of waiters that were released (see [`num_released()`](Self::num_released)).
+    pub fn open(&mut self, num_waiters: usize) -> usize {
+        assert!(num_waiters > 0);
+
+        let num_waiters = self.num_released(num_waiters);
+        let generation = self
+            .inner
+            .generation
+            .load(Ordering::Relaxed)
+            .wrapping_add(1);
+
+        if num_waiters == self.num_waiters {
+            self.last_full_generation = generation;
+        }
+
+        // this must be a release store so that a waiter that reads the value also sees the
+        // previous generation, which is what it checks to detect that the value was overwritten
+        self.inner.num_released[generation as usize % 2].store(num_waiters, Ordering::Release);
+        self.inner.generation.store(generation, Ordering::Release);
+
+        // each waiter waits on the bit of its index, so this doesn't wake the other waiters
+        let bitset = match num_waiters {
+            0 => return 0,
+            32.. => u32::MAX,
+            x => (1 << x) - 1,
+        };
+
+        libc_futex(
+            &self.inner.generation,
+            libc::FUTEX_WAKE_BITSET | libc::FUTEX_PRIVATE_FLAG,
+            i32::MAX as u32,
+            None,
+            None,
+            bitset,
+        )
+        .expect("FUTEX_WAKE_BITSET failed");
+
+        num_waiters
+    }
+}
+
+impl Default for SelectiveLatch {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl SelectiveLatchWaiter {
+    /// Wait for the latch to be opened for this waiter, skipping any generations that don't
+    /// release it. Returns the number of waiters that were released.
+    pub fn wait(&mut self) -> usize {
+        loop {
+            let generation = self.inner.generation.load(Ordering::Acquire);
+
+            if generation != self.generation {
+                let num_released =
+                    self.inner.num_released[generation as usize % 2].load(Ordering::Acquire);
+
+                // if the generation changed again, the value may have been for a later generation
+                if self.inner.generation.load(Ordering::Relaxed) != generation {
+                    continue;
+                }
+
+                self.generation = generation;
+                if self.index < num_released {
+                    return num_released;
+                }
+            }
+
+            if !self.spin_yield {
+                let rv = libc_futex(
+                    &self.inner.generation,
+                    libc::FUTEX_WAIT_BITSET | libc::FUTEX_PRIVATE_FLAG,
+                    self.generation,
+                    None,
+                    None,
+                    1 << (self.index % 32),
+                );
+                assert!(
+                    matches!(rv, Ok(_) | Err(Errno::EAGAIN | Errno::EINTR)),
+                    "FUTEX_WAIT_BITSET failed with {rv:?}"
+                );
+            } else {
+                std::hint::spin_loop();
+                std::thread::yield_now();
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::atomic::AtomicBool;
+
+    use super::*;
+
+    #[test]
+    fn test_simple() {
+        let mut latch = SelectiveLatch::new();
+        let mut waiter = latch.waiter(false);
+
+        for _ in 0..3 {
+            assert_eq!(latch.open(1), 1);
+            assert_eq!(waiter.wait(), 1);
+        }
+    }
+
+    #[test]
+    fn test_skip() {
+        let mut latch = SelectiveLatch::new();
+        let mut waiter_0 = latch.waiter(false);
+        let mut waiter_1 = latch.waiter(false);
+
+        // the second waiter skips the generations that don't release it
+        latch.open(1);
+        waiter_0.wait();
+        latch.open(1);
+        waiter_0.wait();
+        latch.open(2);
+        waiter_0.wait();
+        assert_eq!(waiter_1.wait(), 2);
+    }
+
+    #[test]
+    fn test_release_all_after_skipping() {
+        let mut latch = SelectiveLatch::new();
+        let mut waiter_0 = latch.waiter(false);
+        let _waiter_1 = latch.waiter(false);
+
+        latch.last_full_generation = 0u32.wrapping_sub(MAX_SKIPPED_GENERATIONS);
+        assert_eq!(latch.num_released(1), 2);
+        assert_eq!(latch.open(1), 2);
+        waiter_0.wait();
+        assert_eq!(latch.open(1), 1);
+    }
+
+    #[test]
+    fn test_multi_thread() {
+        let num_threads = 6;
+        let repeat = 300;
+
+        let mut latch = SelectiveLatch::new();
+        // the number of times that each thread was released
+        let counts: Arc<Vec<AtomicUsize>> =
+            Arc::new((0..num_threads).map(|_| AtomicUsize::new(0)).collect());
+        let remaining = Arc::new(AtomicUsize::new(0));
+        let stop = Arc::new(AtomicBool::new(false));
+
+        let handles: Vec<_> = (0..num_threads)
+            .map(|i| {
+                let mut waiter = latch.waiter(i % 2 == 0);
+                let counts = Arc::clone(&counts);
+                let remaining = Arc::clone(&remaining);
+                let stop = Arc::clone(&stop);
+                std::thread::spawn(move || {
+                    loop {
+                        waiter.wait();
+                        if stop.load(Ordering::Relaxed) {
+                            break;
+                        }
+                        counts[i].fetch_add(1, Ordering::Relaxed);
+                        remaining.fetch_sub(1, Ordering::Release);
+                    }
+                })
+            })
+            .collect();
+
+        let mut expected = vec![0; num_threads];
+        for round in 0..repeat {
+            let num_waiters = round % num_threads + 1;
+            remaining.store(num_waiters, Ordering::Relaxed);
+            assert_eq!(latch.open(num_waiters), num_waiters);
+            while remaining.load(Ordering::Acquire) != 0 {
+                std::hint::spin_loop();
+            }
+            for x in &mut expected[..num_waiters] {
+                *x += 1;
+            }
+        }
+
+        // stop the threads
+        stop.store(true, Ordering::Relaxed);
+        assert_eq!(latch.open(usize::MAX), num_threads);
+        for h in handles {
+            h.join().unwrap();
+        }
+
+        let counts: Vec<_> = counts.iter().map(|x| x.load(Ordering::Relaxed)).collect();
+        assert_eq!(counts, expected);
+    }
+}
@@ -0,0 +1,329 @@
+use std::sync::Arc;
+use std::sync::atomic::{AtomicBool, AtomicU32, Ordering};
+
+use crossbeam::utils::CachePadded;
+use nix::errno::Errno;
+
+use crate::sync::simple_latch::libc_futex;
+
+/// The maximum number of counters (or child nodes) that count down on a single tree node.
+const FAN_IN: usize = 4;
+
+/// The number of times the waiter checks the latch before futex-waiting.
+const WAITER_SPIN_ITERS: u32 = 1 << 12;
+
+/// A reusable count-down latch for a fixed number of counters and a single waiter, intended for
+/// ending a round of work on many threads.
+///
+/// Unlike [`count_down_latch`](crate::sync::count_down_latch), counters don't share a lock or a
+/// single atomic. They count down on the leaves of a combining tree, where each node is an atomic
+/// on its own cache line that is shared by at most [`FAN_IN`] counters or child nodes. The last
+/// counter to reach a node continues to its parent, and the last counter to reach the root opens
+/// the latch. The waiter spins briefly and then futex-waits, so short rounds don't pay for a
+/// futex wake-up and long rounds don't waste a CPU.
+///
+/// Each counter must count down exactly once per generation, and the waiter must wait once per
+/// generation. A counter that is dropped without counting down in the current generation will
+/// count down so that the waiter is not blocked forever (for example if a thread panics), but the
+/// latch must not be used for later generations after that.
+///
+/// The latch uses release-acquire ordering, so any changes made by counters before a
+/// `count_down()` should be visible to the waiter after `wait()` returns.
+#[derive(Debug)]
+pub struct TreeLatchCounter {
+    inner: Arc<TreeLatchInner>,
+    /// The leaf node that this counter counts down on.
+    leaf: usize,
+    /// The generation that this counter will next count down for.
+    generation: u32,
+}
+
+/// The waiter for a [`TreeLatchCounter`].
+#[derive(Debug)]
+pub struct TreeLatchWaiter {
+    inner: Arc<TreeLatchInner>,
+    /// The generation that this waiter will next wait for.
+    generation: u32,
+}
+
+#[derive(Debug)]
+struct TreeLatchInner {
+    /// The tree nodes. The leaves are first, and the root is last.
+    nodes: Vec<CachePadded<Node>>,
+    /// The number of generations that have completed. The waiter futex-waits on this.
+    generation: CachePadded<AtomicU32>,
+    /// Is the waiter futex-waiting (or about to)? Lets the last counter skip the futex wake
+    /// syscall while the waiter is spinning.
+    waiter_sleeping: AtomicBool,
+}
+
+#[derive(Debug)]
+struct Node {
+    /// The number of counters or children that still need to reach this node in this generation.
+    remaining: AtomicU32,
+    /// The total number of counters or children of this node.
+    total: u32,
+    /// The index of the parent node, or `None` for the root.
+    parent: Option<usize>,
+}
+
+/// Build a tree latch with `num_counters` counters and one waiter. Panics if `num_counters` is 0.
+pub fn build_tree_latch(num_counters: usize) -> (Vec<TreeLatchCounter>, TreeLatchWaiter) {
+    assert!(num_counters > 0);
+
+    // build the tree one level at a time starting from the leaves; `level` is the number of
+    // counters or nodes in the previous level that need to be attached to the new level
+    let mut nodes: Vec<Node> = Vec::new();
+    let mut prev_level_start = 0;
+    let mut level = num_counters;
+    let mut is_leaf_level = true;
+
+    loop {
+        let level_start = nodes.len();
+        let num_nodes = level.div_ceil(FAN_IN);
+
+        for i in 0..num_nodes {
+            let total = std::cmp::min(FAN_IN, level - i * FAN_IN);
+            nodes.push(Node {
+                remaining: AtomicU32::new(total.try_into().unwrap()),
+                total: total.try_into().unwrap(),
+                parent: None,
+            });
+        }
+
+        // attach the previous level's nodes to this level
+        if !is_leaf_level {
+            for i in 0..level {
+                nodes[prev_level_start + i].parent = Some(level_start + i / FAN_IN);
+            }
+        }
+
+        if num_nodes == 1 {
+            break;
+        }
+
+        prev_level_start = level_start;
+        level = num_nodes;
+        is_leaf_level = false;
+    }
+
+    let inner = Arc::new(TreeLatchInner {
+        nodes: nodes.into_iter().map(CachePadded::new).collect(),
+        generation: CachePadded::new(AtomicU32::new(0)),
+        waiter_sleeping: AtomicBool::new(false),
+    });
+
+    let counters = (0..num_counters)
+        .map(|i| TreeLatchCounter {
+            inner: Arc::clone(&inner),
+            leaf: i / FAN_IN,
+            generation: 0,
+        })
+        .collect();
+
+    let waiter = TreeLatchWaiter {
+        inner,
+        generation: 0,
+    };
+
+    (counters, waiter)
+}
+
+impl TreeLatchInner {
+    fn arrive(&self, leaf: usize) {
+        let mut node_idx = leaf;
+
+        loop {
+            let node = &self.nodes[node_idx];
+
+            // acquire the changes of the counters that arrived before us, and release them (along
+            // with our own) to whoever arrives last
+            let prev = node.remaining.fetch_sub(1, Ordering::AcqRel);
+            debug_assert!(prev > 0);
+
+            if prev != 1 {
+                // not the last to arrive at this node
+                return;
+            }
+
+            // we're the last to arrive, so reset the node for the next generation; nobody else
+            // will touch this node until the waiter has returned and the next round has started
+            node.remaining.store(node.total, Ordering::Relaxed);
+
+            match node.parent {
+                Some(parent) => node_idx = parent,
+                None => break,
+            }
+        }
+
+        // we were the last to arrive at the root, so open the latch; this must be sequentially
+        // consistent with the waiter's accesses of `waiter_sleeping` and `generation`, so that
+        // either we see that the waiter is sleeping or the waiter sees the new generation
+        self.generation.fetch_add(1, Ordering::SeqCst);
+        if self.waiter_sleeping.load(Ordering::SeqCst) {
+            libc_futex(
+                &self.generation,
+                libc::FUTEX_WAKE | libc::FUTEX_PRIVATE_FLAG,
+                1,
+                None,
+                None,
+                0,
+            )
+            .expect("FUTEX_WAKE failed");
+        }
+    }
+}
+
+impl TreeLatchCounter {
+    /// Count down. The waiter is woken once all counters have counted down. Must only be called
+    /// once per generation.
+    pub fn count_down(&mut self) {
+        debug_assert_eq!(
+            self.generation,
+            self.inner.generation.load(Ordering::Relaxed),
+            "Counted down multiple times in the same generation"
+        );
+
+        self.inner.arrive(self.leaf);
+        self.generation = self.generation.wrapping_add(1);
+    }
+}
+
+impl std::ops::Drop for TreeLatchCounter {
+    fn drop(&mut self) {
+        // if we haven't already counted down during the current generation
+        if self.generation == self.inner.generation.load(Ordering::Acquire) {
+            self.inner.arrive(self.leaf);
+        }
+    }
+}
+
+impl TreeLatchWaiter {
+    /// Wait for all counters to count down in the current generation.
+    pub fn wait(&mut self) {
+        let mut spins = 0;
+
+        loop {
+            let latch_gen = self.inner.generation.load(Ordering::Acquire);
+
+            if latch_gen != self.generation {
+                debug_assert_eq!(latch_gen, self.generation.wrapping_add(1));
+                self.inner.waiter_sleeping.store(false, Ordering::Relaxed);
+                break;
+            }
+
+            if spins < WAITER_SPIN_ITERS {
+                spins += 1;
+                std::hint::spin_loop();
+                continue;
+            }
+
+            self.inner.waiter_sleeping.store(true, Ordering::SeqCst);
+            if self.inner.generation.load(Ordering::SeqCst) != latch_gen {
+                continue;
+            }
+
+            let rv = libc_futex(
+                &self.inner.generation,
+                libc::FUTEX_WAIT | libc::FUTEX_PRIVATE_FLAG,
+                latch_gen,
+                None,
+                None,
+                0,
+            );
+            assert!(
+                matches!(rv, Ok(_) | Err(Errno::EAGAIN | Errno::EINTR)),
+                "FUTEX_WAIT failed with {rv:?}"
+            );
+        }
+
+        self.generation = self.generation.wrapping_add(1);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::atomic::AtomicUsize;
+
+    use super::*;
+
+    #[test]
+    fn test_tree_shape() {
+        for num_counters in [1, 2, FAN_IN, FAN_IN + 1, FAN_IN * FAN_IN, 100] {
+            let (counters, _waiter) = build_tree_latch(num_counters);
+            let nodes = &counters[0].inner.nodes;
+
+            // exactly one root, and it's the last node
+            assert!(nodes.last().unwrap().parent.is_none());
+            assert_eq!(nodes.iter().filter(|x| x.parent.is_none()).count(), 1);
+
+            // every node's total matches the number of counters or children attached to it
+            for (i, node) in nodes.iter().enumerate() {
+                let children = nodes.iter().filter(|x| x.parent == Some(i)).count();
+                let leaf_counters = counters.iter().filter(|x| x.leaf == i).count();
+                assert_eq!(node.total as usize, children + leaf_counters);
+                assert!(node.total as usize <= FAN_IN);
+            }
+        }
+    }
+
+    #[test]
+    fn test_single_thread() {
+        let (mut counters, mut waiter) = build_tree_latch(10);
+
+        for _ in 0..3 {
+            for counter in &mut counters {
+                counter.count_down();
+            }
+            waiter.wait();
+        }
+    }
+
+    #[test]
+    fn test_drop_counts_down() {
+        let (mut counters, mut waiter) = build_tree_latch(3);
+
+        counters[0].count_down();
+        // dropping a counter that has already counted down does nothing
+        std::mem::drop(counters.remove(0));
+        // dropping the others counts them down
+        std::mem::drop(counters);
+        waiter.wait();
+    }
+
+    #[test]
+    fn test_multi_thread() {
+        let num_threads = 9;
+        let repeat = 200;
+
+        let (counters, mut waiter) = build_tree_latch(num_threads);
+        let mut start = crate::sync::simple_latch::Latch::new();
+        let sum = Arc::new(AtomicUsize::new(0));
+
+        let handles: Vec<_> = counters
+            .into_iter()
+            .map(|mut counter| {
+                let mut start_waiter = start.waiter(false);
+                let sum = Arc::clone(&sum);
+                std::thread::spawn(move || {
+                    for _ in 0..repeat {
+                        start_waiter.wait();
+                        sum.fetch_add(1, Ordering::Relaxed);
+                        counter.count_down();
+                    }
+                })
+            })
+            .collect();
+
+        for i in 1..=repeat {
+            start.open();
+            waiter.wait();
+            // every thread must have finished this round
+            assert_eq!(sum.load(Ordering::Relaxed), i * num_threads);
+        }
+
+        for h in handles {
+            h.join().unwrap();
+        }
+    }
+}
@@ -3,7 +3,10 @@
 // unsafe code should be isolated to the thread pool
 #![forbid(unsafe_code)]
 
+use std::cmp::Reverse;
+use std::collections::BinaryHeap;
 use std::fmt::Debug;
+use std::time::{Duration, Instant};
 
 use crossbeam::queue::ArrayQueue;
 
@@ -13,26 +16,124 @@ use crate::pools::unbounded::{TaskRunner, UnboundedThreadPool};
 pub trait Host: Debug + Send {}
 impl<T> Host for T where T: Debug + Send {}
 
+/// When cost balancing is enabled, the hosts are reassigned to threads after this many rounds.
+/// Reassigning hosts is done serially between rounds, so we don't do it every round.
+const REBALANCE_INTERVAL: u64 = 64;
+
 /// A host scheduler.
 pub struct ThreadPerCoreSched<HostType: Host> {
     pool: UnboundedThreadPool,
     num_threads: usize,
-    thread_hosts: Vec<ArrayQueue<HostType>>,
-    thread_hosts_processed: Vec<ArrayQueue<HostType>>,
+    thread_hosts: Vec<ArrayQueue<HostEntry<HostType>>>,
+    thread_hosts_processed: Vec<ArrayQueue<HostEntry<HostType>>>,
     hosts_need_swap: bool,
+    /// Should we measure how long each host takes to run, and use that to assign hosts to threads?
+    cost_balancing: bool,
+    /// Should hosts that keep a thread busy on their own be given dedicated threads when the hosts
+    /// are reassigned?
+    pin_busy_hosts: bool,
+    /// Whether each thread is dedicated to a single busy host. Other threads don't take hosts from
+    /// a dedicated thread, and a dedicated thread doesn't take hosts from other threads.
+    pinned_threads: Vec<bool>,
+    /// If set, hosts stay with the thread they're assigned to, and a thread only takes hosts from
+    /// another thread after it has been idle for this long.
+    steal_delay: Option<Duration>,
+    /// The number of rounds that have run hosts.
+    num_rounds: u64,
+    /// The locality group (for example the NUMA node) of each thread, if hosts should be kept
+    /// within a group.
+    thread_groups: Option<Vec<u32>>,
+    /// For each thread, the order of the thread queues that it should take hosts from.
+    steal_order: Vec<Vec<usize>>,
+}
+
+/// Options for a [`ThreadPerCoreSched`]. See [`ThreadPerCoreSched::new`].
+#[derive(Debug, Default, Clone, Copy)]
+pub struct ThreadPerCoreOptions<'a> {
+    /// Should the threads `sched_yield` in a spinloop while waiting for work, rather than sleep?
+    pub yield_spin: bool,
+    /// Should the hosts be reassigned to threads by how long they take to run?
+    pub cost_balancing: bool,
+    /// Should hosts that keep a thread busy on their own be given dedicated threads?
+    pub pin_busy_hosts: bool,
+    /// How long a thread waits before taking hosts from other threads, if hosts should stay with
+    /// their own thread.
+    pub steal_delay: Option<Duration>,
+    /// The locality group of each thread, if hosts should be kept within a group.
+    pub thread_groups: Option<&'a [u32]>,
+}
+
+/// A host and the recent cost of running it.
+#[derive(Debug)]
+struct HostEntry<HostType> {
+    host: HostType,
+    /// A moving average of the time taken to process the host each round. Only measured if cost
+    /// balancing is enabled.
+    cost: Duration,
+}
+
+impl<HostType> HostEntry<HostType> {
+    fn new(host: HostType) -> Self {
+        Self {
+            host,
+            cost: Duration::ZERO,
+        }
+    }
+
+    /// Update the cost using an exponential moving average so that a single slow round doesn't
+    /// move the host too much.
+    fn update_cost(&mut self, elapsed: Duration) {
+        self.cost = (self.cost * 3 + elapsed) / 4;
+    }
 }
 
 impl<HostType: Host> ThreadPerCoreSched<HostType> {
     /// A new host scheduler with threads that are pinned to the provided OS processors. Each thread
     /// is assigned many hosts, and threads may steal hosts from other threads. The number of
     /// threads created will be the length of `cpu_ids`.
-    pub fn new<T>(cpu_ids: &[Option<u32>], hosts: T, yield_spin: bool) -> Self
+    ///
+    /// If `yield_spin` is enabled, the threads `sched_yield` in a spinloop while waiting for work.
+    ///
+    /// If `cost_balancing` is enabled, the scheduler measures how long each host takes to run, and
+    /// periodically reassigns hosts to threads so that each thread has a similar total cost. Each
+    /// thread's hosts are ordered with the most expensive first so that expensive hosts don't get
+    /// picked up late in the round.
+    ///
+    /// If `pin_busy_hosts` is enabled, the costs are measured as for `cost_balancing`, and when
+    /// hosts are reassigned each host whose cost is at least a thread's share of the total cost is
+    /// given a dedicated thread (in its pinned CPU). The remaining hosts are assigned by cost to the
+    /// remaining threads, which steal hosts only from each other. At least one thread in each group
+    /// is always left for the remaining hosts.
+    ///
+    /// If `steal_delay` is provided, hosts have a sticky affinity to the thread they're assigned to
+    /// (until they're reassigned by cost balancing). A thread that has run all of its own hosts
+    /// waits until it has been idle for `steal_delay` before taking hosts from other threads, and a
+    /// host taken from another thread is returned to that thread. This reduces how often hosts
+    /// (and their managed threads) move between CPUs, at the cost of some idle time.
+    ///
+    /// If `thread_groups` is provided, it gives a locality group (for example the NUMA node of the
+    /// thread's CPU) for each thread. Threads prefer to steal hosts from threads in the same group,
+    /// and a host stolen from a thread in a different group is returned to that thread's group so
+    /// that each host stays within the group it was first assigned to.
+    pub fn new<T>(cpu_ids: &[Option<u32>], hosts: T, options: ThreadPerCoreOptions) -> Self
     where
         T: IntoIterator<Item = HostType, IntoIter: ExactSizeIterator>,
     {
+        let ThreadPerCoreOptions {
+            yield_spin,
+            cost_balancing,
+            pin_busy_hosts,
+            steal_delay,
+            thread_groups,
+        } = options;
         let hosts = hosts.into_iter();
 
         let num_threads = cpu_ids.len();
+
+        if let Some(thread_groups) = thread_groups {
+            assert_eq!(thread_groups.len(), num_threads);
+        }
+
         let mut pool = UnboundedThreadPool::new(num_threads, "shadow-worker", yield_spin);
 
         // set the affinity of each thread
@@ -61,15 +162,27 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
 
         // assign hosts to threads in a round-robin manner
         for (thread_queue, host) in thread_hosts.iter().cycle().zip(hosts) {
-            thread_queue.push(host).unwrap();
+            thread_queue.push(HostEntry::new(host)).unwrap();
         }
 
+        let pinned_threads = vec![false; num_threads];
+        let steal_order = (0..num_threads)
+            .map(|i| steal_order(i, num_threads, thread_groups, &pinned_threads))
+            .collect();
+
         Self {
             pool,
             num_threads,
             thread_hosts,
             thread_hosts_processed: thread_hosts_2,
             hosts_need_swap: false,
+            cost_balancing: cost_balancing || pin_busy_hosts,
+            pin_busy_hosts,
+            pinned_threads,
+            steal_delay,
+            num_rounds: 0,
+            thread_groups: thread_groups.map(|x| x.to_vec()),
+            steal_order,
         }
     }
 
@@ -90,12 +203,21 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
 
             std::mem::swap(&mut self.thread_hosts, &mut self.thread_hosts_processed);
             self.hosts_need_swap = false;
+
+            self.num_rounds += 1;
+            if self.cost_balancing && self.num_rounds % REBALANCE_INTERVAL == 0 {
+                self.rebalance();
+            }
         }
 
         // data/references that we'll pass to the scope
         let thread_hosts = &self.thread_hosts;
         let thread_hosts_processed = &self.thread_hosts_processed;
         let hosts_need_swap = &mut self.hosts_need_swap;
+        let cost_balancing = self.cost_balancing;
+        let thread_groups = self.thread_groups.as_deref();
+        let steal_order = &self.steal_order;
+        let steal_delay = self.steal_delay;
 
         // we cannot access `self` after calling `pool.scope()` since `SchedulerScope` has a
         // lifetime of `'scope` (which at minimum spans the entire current function)
@@ -105,6 +227,10 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
                 thread_hosts,
                 thread_hosts_processed,
                 hosts_need_swap,
+                cost_balancing,
+                thread_groups,
+                steal_order,
+                steal_delay,
                 runner: s,
             };
 
@@ -116,6 +242,150 @@ impl<HostType: Host> ThreadPerCoreSched<HostType> {
     pub fn join(self) {
         self.pool.join();
     }
+
+    /// Reassign all hosts to threads based on their recent costs. If the threads have groups,
+    /// hosts are only reassigned to threads within the same group. If busy hosts are pinned, the
+    /// dedicated threads are chosen again.
+    fn rebalance(&mut self) {
+        let groups: Vec<Vec<usize>> = match &self.thread_groups {
+            Some(thread_groups) => {
+                let mut group_ids = thread_groups.clone();
+                group_ids.sort_unstable();
+                group_ids.dedup();
+                group_ids
+                    .into_iter()
+                    .map(|group| {
+                        (0..self.num_threads)
+                            .filter(|i| thread_groups[*i] == group)
+                            .collect()
+                    })
+                    .collect()
+            }
+            None => vec![(0..self.num_threads).collect()],
+        };
+
+        for threads in groups {
+            let entries: Vec<_> = threads
+                .iter()
+                .flat_map(|i| std::iter::from_fn(|| self.thread_hosts[*i].pop()))
+                .collect();
+
+            let (assigned, pinned) = if self.pin_busy_hosts {
+                assign_with_pinning(entries, threads.len())
+            } else {
+                (
+                    assign_by_cost(entries, threads.len()),
+                    vec![false; threads.len()],
+                )
+            };
+
+            for ((i, entries), pinned) in threads.iter().zip(assigned).zip(pinned) {
+                self.pinned_threads[*i] = pinned;
+                for entry in entries {
+                    self.thread_hosts[*i].push(entry).unwrap();
+                }
+            }
+        }
+
+        if self.pin_busy_hosts {
+            let thread_groups = self.thread_groups.as_deref();
+            self.steal_order = (0..self.num_threads)
+                .map(|i| steal_order(i, self.num_threads, thread_groups, &self.pinned_threads))
+                .collect();
+        }
+    }
+}
+
+/// The order of thread queues that thread `this_thread` should take hosts from. It starts with its
+/// own queue, followed by the queues of the threads in the same group, and then any remaining
+/// queues. Within each set the queues are in cyclic order starting from `this_thread`. A thread
+/// that's dedicated to a busy host (in `pinned_threads`) only takes hosts from its own queue, and
+/// no other thread takes hosts from its queue.
+fn steal_order(
+    this_thread: usize,
+    num_threads: usize,
+    thread_groups: Option<&[u32]>,
+    pinned_threads: &[bool],
+) -> Vec<usize> {
+    if pinned_threads[this_thread] {
+        return vec![this_thread];
+    }
+
+    let cyclic = || {
+        (0..num_threads)
+            .map(move |x| (this_thread + x) % num_threads)
+            .filter(|i| !pinned_threads[*i])
+    };
+
+    let Some(thread_groups) = thread_groups else {
+        return cyclic().collect();
+    };
+
+    let this_group = thread_groups[this_thread];
+
+    cyclic()
+        .filter(|i| thread_groups[*i] == this_group)
+        .chain(cyclic().filter(|i| thread_groups[*i] != this_group))
+        .collect()
+}
+
+/// Assign hosts to `num_threads` threads using the "longest processing time first" rule: the most
+/// expensive remaining host is given to the thread with the lowest total cost so far. Each thread's
+/// hosts are returned with the most expensive first.
+fn assign_by_cost<HostType>(
+    mut entries: Vec<HostEntry<HostType>>,
+    num_threads: usize,
+) -> Vec<Vec<HostEntry<HostType>>> {
+    // a stable sort so that hosts with the same cost keep their relative order
+    entries.sort_by_key(|entry| Reverse(entry.cost));
+
+    let mut assigned: Vec<Vec<_>> = (0..num_threads).map(|_| Vec::new()).collect();
+
+    // a min-heap of (total cost, thread index)
+    let mut loads: BinaryHeap<_> = (0..num_threads)
+        .map(|i| Reverse((Duration::ZERO, i)))
+        .collect();
+
+    for entry in entries {
+        let Reverse((load, i)) = loads.pop().unwrap();
+        loads.push(Reverse((load + entry.cost, i)));
+        assigned[i].push(entry);
+    }
+
+    assigned
+}
+
+/// Give each host whose cost is at least the average cost per thread of it and the hosts after it
+/// (in order of decreasing cost) a dedicated thread, leaving at least one thread, and assign the
+/// remaining hosts to the remaining threads with [`assign_by_cost`]. Returns the hosts of each
+/// thread, and whether each thread is dedicated to a single host. The dedicated threads are first.
+fn assign_with_pinning<HostType>(
+    mut entries: Vec<HostEntry<HostType>>,
+    num_threads: usize,
+) -> (Vec<Vec<HostEntry<HostType>>>, Vec<bool>) {
+    // a stable sort so that hosts with the same cost keep their relative order
+    entries.sort_by_key(|entry| Reverse(entry.cost));
+
+    let mut remaining_cost: Duration = entries.iter().map(|entry| entry.cost).sum();
+    let mut entries = entries.into_iter().peekable();
+    let mut assigned = Vec::new();
+
+    while assigned.len() + 1 < num_threads {
+        let remaining_threads = u32::try_from(num_threads - assigned.len()).unwrap();
+        let Some(entry) = entries.next_if(|entry| {
+            !entry.cost.is_zero() && entry.cost * remaining_threads >= remaining_cost
+        }) else {
+            break;
+        };
+        remaining_cost -= entry.cost;
+        assigned.push(vec![entry]);
+    }
+
+    let num_pinned = assigned.len();
+    assigned.extend(assign_by_cost(entries.collect(), num_threads - num_pinned));
+    let pinned = (0..num_threads).map(|i| i < num_pinned).collect();
+
+    (assigned, pinned)
 }
 
 /// A wrapper around the work pool's scoped runner.
@@ -123,9 +393,13 @@ pub struct SchedulerScope<'sched, 'pool, 'scope, HostType: Host>
 where
     'sched: 'scope,
 {
-    thread_hosts: &'sched Vec<ArrayQueue<HostType>>,
-    thread_hosts_processed: &'sched Vec<ArrayQueue<HostType>>,
+    thread_hosts: &'sched Vec<ArrayQueue<HostEntry<HostType>>>,
+    thread_hosts_processed: &'sched Vec<ArrayQueue<HostEntry<HostType>>>,
     hosts_need_swap: &'sched mut bool,
+    cost_balancing: bool,
+    thread_groups: Option<&'sched [u32]>,
+    steal_order: &'sched [Vec<usize>],
+    steal_delay: Option<Duration>,
     runner: TaskRunner<'pool, 'scope>,
 }
 
@@ -145,8 +419,13 @@ impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope
         self.runner.run(move |i| {
             let mut host_iter = HostIter {
                 thread_hosts_from: self.thread_hosts,
-                thread_hosts_to: &self.thread_hosts_processed[i],
+                thread_hosts_to: self.thread_hosts_processed,
                 this_thread_index: i,
+                steal_order: &self.steal_order[i],
+                thread_groups: self.thread_groups,
+                measure_cost: self.cost_balancing,
+                steal_delay: self.steal_delay,
+                partial: false,
             };
 
             f(i, &mut host_iter);
@@ -163,13 +442,33 @@ impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope
     ) where
         T: Sync,
     {
-        self.runner.run(move |i| {
+        let num_threads = self.thread_hosts.len();
+        self.run_with_data_on(num_threads, data, f);
+    }
+
+    /// See [`crate::SchedulerScope::run_with_data_on`].
+    pub fn run_with_data_on<T>(
+        self,
+        num_threads: usize,
+        data: &'scope [T],
+        f: impl Fn(usize, &mut HostIter<'_, HostType>, &T) + Send + Sync + 'scope,
+    ) where
+        T: Sync,
+    {
+        let partial = num_threads < self.thread_hosts.len();
+
+        self.runner.run_on(num_threads, move |i| {
             let this_elem = &data[i];
 
             let mut host_iter = HostIter {
                 thread_hosts_from: self.thread_hosts,
-                thread_hosts_to: &self.thread_hosts_processed[i],
+                thread_hosts_to: self.thread_hosts_processed,
                 this_thread_index: i,
+                steal_order: &self.steal_order[i],
+                thread_groups: self.thread_groups,
+                measure_cost: self.cost_balancing,
+                steal_delay: self.steal_delay,
+                partial,
             };
 
             f(i, &mut host_iter, this_elem);
@@ -183,12 +482,24 @@ impl<'sched, 'pool, 'scope, HostType: Host> SchedulerScope<'sched, 'pool, 'scope
 /// the iterator may steal hosts from other threads.
 pub struct HostIter<'a, HostType: Host> {
     /// Queues to take hosts from.
-    thread_hosts_from: &'a [ArrayQueue<HostType>],
-    /// The queue to add hosts to when done with them.
-    thread_hosts_to: &'a ArrayQueue<HostType>,
-    /// The index of this thread. This is the first queue of `thread_hosts_from` that we take hosts
-    /// from.
+    thread_hosts_from: &'a [ArrayQueue<HostEntry<HostType>>],
+    /// Queues to add hosts to when done with them. Hosts are normally added to this thread's
+    /// queue.
+    thread_hosts_to: &'a [ArrayQueue<HostEntry<HostType>>],
+    /// The index of this thread.
     this_thread_index: usize,
+    /// The order of the queues in `thread_hosts_from` that we take hosts from. The first is this
+    /// thread's own queue.
+    steal_order: &'a [usize],
+    /// The locality group of each thread, if any.
+    thread_groups: Option<&'a [u32]>,
+    /// Should we measure the time taken to process each host?
+    measure_cost: bool,
+    /// If set, hosts taken from other threads are returned to them, and are only taken after this
+    /// thread has been idle for this long.
+    steal_delay: Option<Duration>,
+    /// Is the task only running on some of the threads?
+    partial: bool,
 }
 
 impl<HostType: Host> HostIter<'_, HostType> {
@@ -197,17 +508,67 @@ impl<HostType: Host> HostIter<'_, HostType> {
     where
         F: FnMut(HostType) -> HostType,
     {
-        for from_queue in self
-            .thread_hosts_from
-            .iter()
-            .cycle()
-            // start from the current thread index
-            .skip(self.this_thread_index)
-            .take(self.thread_hosts_from.len())
-        {
-            while let Some(host) = from_queue.pop() {
-                self.thread_hosts_to.push(f(host)).unwrap();
+        if self.partial {
+            // the other threads may not be running, so take hosts from every thread (including
+            // threads dedicated to a host) without waiting, and return each host to its thread
+            let num_queues = self.thread_hosts_from.len();
+            for x in 0..num_queues {
+                let index = (self.this_thread_index + x) % num_queues;
+                self.run_queue(index, index, &mut f);
             }
+            return;
+        }
+
+        // the time at which this thread ran out of its own hosts
+        let mut idle_start = None;
+
+        for &from_index in self.steal_order {
+            let from_queue = &self.thread_hosts_from[from_index];
+            let is_own_queue = from_index == self.this_thread_index;
+
+            if let (false, Some(steal_delay)) = (is_own_queue, self.steal_delay) {
+                // give the other thread a chance to run its own hosts
+                let idle_start = *idle_start.get_or_insert_with(Instant::now);
+                while !from_queue.is_empty() && idle_start.elapsed() < steal_delay {
+                    std::hint::spin_loop();
+                }
+            }
+
+            // a host taken from a thread in a different group is returned to that thread so that
+            // the host stays in its group, and with sticky affinity every host taken from another
+            // thread is returned
+            let same_group = self
+                .thread_groups
+                .is_none_or(|groups| groups[from_index] == groups[self.this_thread_index]);
+            let keep = is_own_queue || (same_group && self.steal_delay.is_none());
+            let to_index = if keep {
+                self.this_thread_index
+            } else {
+                from_index
+            };
+
+            self.run_queue(from_index, to_index, &mut f);
+        }
+    }
+
+    /// Run all hosts in the queue `from_index` of `thread_hosts_from`, and add them to the queue
+    /// `to_index` of `thread_hosts_to`.
+    fn run_queue<F>(&self, from_index: usize, to_index: usize, f: &mut F)
+    where
+        F: FnMut(HostType) -> HostType,
+    {
+        let from_queue = &self.thread_hosts_from[from_index];
+        let to_queue = &self.thread_hosts_to[to_index];
+
+        while let Some(mut entry) = from_queue.pop() {
+            if self.measure_cost {
+                let start = Instant::now();
+                entry.host = f(entry.host);
+                entry.update_cost(start.elapsed());
+            } else {
+                entry.host = f(entry.host);
+            }
+            to_queue.push(entry).unwrap();
         }
     }
 }
@@ -225,7 +586,7 @@ mod tests {
     fn test_parallelism() {
         let hosts = [(); 5].map(|_| TestHost {});
         let sched: ThreadPerCoreSched<TestHost> =
-            ThreadPerCoreSched::new(&[None, None], hosts, false);
+            ThreadPerCoreSched::new(&[None, None], hosts, ThreadPerCoreOptions::default());
 
         assert_eq!(sched.parallelism(), 2);
 
@@ -236,7 +597,7 @@ mod tests {
     fn test_no_join() {
         let hosts = [(); 5].map(|_| TestHost {});
         let _sched: ThreadPerCoreSched<TestHost> =
-            ThreadPerCoreSched::new(&[None, None], hosts, false);
+            ThreadPerCoreSched::new(&[None, None], hosts, ThreadPerCoreOptions::default());
     }
 
     #[test]
@@ -244,7 +605,7 @@ mod tests {
     fn test_panic() {
         let hosts = [(); 5].map(|_| TestHost {});
         let mut sched: ThreadPerCoreSched<TestHost> =
-            ThreadPerCoreSched::new(&[None, None], hosts, false);
+            ThreadPerCoreSched::new(&[None, None], hosts, ThreadPerCoreOptions::default());
 
         sched.scope(|s| {
             s.run(|x| {
@@ -259,7 +620,7 @@ mod tests {
     fn test_run() {
         let hosts = [(); 5].map(|_| TestHost {});
         let mut sched: ThreadPerCoreSched<TestHost> =
-            ThreadPerCoreSched::new(&[None, None], hosts, false);
+            ThreadPerCoreSched::new(&[None, None], hosts, ThreadPerCoreOptions::default());
 
         let counter = AtomicU32::new(0);
 
@@ -280,7 +641,7 @@ mod tests {
     fn test_run_with_hosts() {
         let hosts = [(); 5].map(|_| TestHost {});
         let mut sched: ThreadPerCoreSched<TestHost> =
-            ThreadPerCoreSched::new(&[None, None], hosts, false);
+            ThreadPerCoreSched::new(&[None, None], hosts, ThreadPerCoreOptions::default());
 
         let counter = AtomicU32::new(0);
 
@@ -304,7 +665,7 @@ mod tests {
     fn test_run_with_data() {
         let hosts = [(); 5].map(|_| TestHost {});
         let mut sched: ThreadPerCoreSched<TestHost> =
-            ThreadPerCoreSched::new(&[None, None], hosts, false);
+            ThreadPerCoreSched::new(&[None, None], hosts, ThreadPerCoreOptions::default());
 
         let data = vec![0u32; sched.parallelism()];
         let data: Vec<_> = data.into_iter().map(std::sync::Mutex::new).collect();
@@ -326,4 +687,285 @@ mod tests {
 
         sched.join();
     }
+
+    #[test]
+    fn test_run_with_data_on() {
+        let hosts: [u32; 12] = std::array::from_fn(|i| i as u32);
+        let num_threads = 3;
+        let mut sched: ThreadPerCoreSched<u32> =
+            ThreadPerCoreSched::new(&[None; 3], hosts, ThreadPerCoreOptions::default());
+
+        let data: Vec<_> = (0..num_threads).map(|_| AtomicU32::new(0)).collect();
+
+        for round in 0..6 {
+            // fewer than all threads
+            let participants = round % (num_threads - 1) + 1;
+            sched.scope(|s| {
+                s.run_with_data_on(participants, &data, |i, hosts, elem| {
+                    assert!(i < participants);
+                    hosts.for_each(|host| {
+                        elem.fetch_add(1, Ordering::SeqCst);
+                        host
+                    });
+                });
+            });
+
+            // the participating threads ran every host, and each host stays on its own thread
+            for (i, queue) in sched.thread_hosts_processed.iter().enumerate() {
+                assert_eq!(queue.len(), 12 / num_threads);
+                for _ in 0..queue.len() {
+                    let entry = queue.pop().unwrap();
+                    assert_eq!(entry.host as usize % num_threads, i);
+                    queue.push(entry).unwrap();
+                }
+            }
+        }
+
+        let sum: u32 = data.iter().map(|x| x.load(Ordering::SeqCst)).sum();
+        assert_eq!(sum, 12 * 6);
+        // the first thread ran in every round
+        assert!(data[0].load(Ordering::SeqCst) > 0);
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_cost_balancing() {
+        let hosts = [(); 5].map(|_| TestHost {});
+        let mut sched: ThreadPerCoreSched<TestHost> = ThreadPerCoreSched::new(
+            &[None, None],
+            hosts,
+            ThreadPerCoreOptions {
+                cost_balancing: true,
+                ..Default::default()
+            },
+        );
+
+        let counter = AtomicU32::new(0);
+
+        // run enough rounds that the hosts are rebalanced at least once
+        for _ in 0..(2 * REBALANCE_INTERVAL) {
+            sched.scope(|s| {
+                s.run_with_hosts(|_, hosts| {
+                    hosts.for_each(|host| {
+                        counter.fetch_add(1, Ordering::SeqCst);
+                        host
+                    });
+                });
+            });
+        }
+
+        assert_eq!(
+            counter.load(Ordering::SeqCst),
+            5 * 2 * REBALANCE_INTERVAL as u32
+        );
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_thread_groups() {
+        let hosts: [u32; 12] = std::array::from_fn(|i| i as u32);
+        let groups = [0, 0, 1, 1];
+        let mut sched: ThreadPerCoreSched<u32> = ThreadPerCoreSched::new(
+            &[None; 4],
+            hosts,
+            ThreadPerCoreOptions {
+                cost_balancing: true,
+                thread_groups: Some(&groups),
+                ..Default::default()
+            },
+        );
+
+        // the group that each host was first assigned to (round-robin)
+        let host_group = |host: u32| groups[host as usize % groups.len()];
+
+        for _ in 0..(2 * REBALANCE_INTERVAL) {
+            sched.scope(|s| {
+                s.run_with_hosts(|_, hosts| {
+                    hosts.for_each(|host| host);
+                });
+            });
+
+            // a host may be run by a thread in a different group, but it must always be queued
+            // within its own group
+
+            for (i, queue) in sched.thread_hosts_processed.iter().enumerate() {
+                for _ in 0..queue.len() {
+                    let entry = queue.pop().unwrap();
+                    assert_eq!(host_group(entry.host), groups[i]);
+                    queue.push(entry).unwrap();
+                }
+            }
+        }
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_sticky_affinity() {
+        let hosts: [u32; 12] = std::array::from_fn(|i| i as u32);
+        let num_threads = 3;
+        let mut sched: ThreadPerCoreSched<u32> = ThreadPerCoreSched::new(
+            &[None; 3],
+            hosts,
+            ThreadPerCoreOptions {
+                steal_delay: Some(Duration::ZERO),
+                ..Default::default()
+            },
+        );
+
+        let counter = AtomicU32::new(0);
+
+        for _ in 0..10 {
+            sched.scope(|s| {
+                s.run_with_hosts(|i, hosts| {
+                    // the first thread is slow to start, so other threads take its hosts
+                    if i == 0 {
+                        std::thread::sleep(Duration::from_millis(1));
+                    }
+                    hosts.for_each(|host| {
+                        counter.fetch_add(1, Ordering::SeqCst);
+                        host
+                    });
+                });
+            });
+
+            // every host is queued on the thread it was first assigned to (round-robin)
+            for (i, queue) in sched.thread_hosts_processed.iter().enumerate() {
+                assert_eq!(queue.len(), 12 / num_threads);
+                for _ in 0..queue.len() {
+                    let entry = queue.pop().unwrap();
+                    assert_eq!(entry.host as usize % num_threads, i);
+                    queue.push(entry).unwrap();
+                }
+            }
+        }
+
+        assert_eq!(counter.load(Ordering::SeqCst), 12 * 10);
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_steal_order() {
+        let unpinned = [false; 4];
+        assert_eq!(steal_order(1, 4, None, &unpinned), [1, 2, 3, 0]);
+        assert_eq!(
+            steal_order(1, 4, Some(&[0, 1, 0, 1]), &unpinned),
+            [1, 3, 2, 0]
+        );
+        assert_eq!(
+            steal_order(2, 4, Some(&[0, 0, 1, 1]), &unpinned),
+            [2, 3, 0, 1]
+        );
+
+        // dedicated threads only take from their own queue, and aren't taken from
+        let pinned = [true, false, false, true];
+        assert_eq!(steal_order(0, 4, None, &pinned), [0]);
+        assert_eq!(steal_order(1, 4, None, &pinned), [1, 2]);
+        assert_eq!(steal_order(2, 4, Some(&[0, 0, 1, 1]), &pinned), [2, 1]);
+    }
+
+    #[test]
+    fn test_assign_with_pinning() {
+        let entries = |costs: &[u64]| -> Vec<_> {
+            costs
+                .iter()
+                .map(|cost| HostEntry {
+                    host: *cost,
+                    cost: Duration::from_millis(*cost),
+                })
+                .collect()
+        };
+        let hosts = |assigned: &[Vec<HostEntry<u64>>]| -> Vec<Vec<u64>> {
+            assigned
+                .iter()
+                .map(|x| x.iter().map(|entry| entry.host).collect())
+                .collect()
+        };
+
+        // 20 is at least a third of the total, then 10 is at least half of the rest
+        let (assigned, pinned) = assign_with_pinning(entries(&[1, 20, 2, 10, 3, 4]), 3);
+        assert_eq!(hosts(&assigned), [vec![20], vec![10], vec![4, 3, 2, 1]]);
+        assert_eq!(pinned, [true, true, false]);
+
+        // similar costs are all balanced by cost
+        let (assigned, pinned) = assign_with_pinning(entries(&[5, 4, 5, 4]), 2);
+        assert_eq!(hosts(&assigned), [vec![5, 4], vec![5, 4]]);
+        assert_eq!(pinned, [false, false]);
+
+        // at least one thread is left for the other hosts
+        let (assigned, pinned) = assign_with_pinning(entries(&[10, 10]), 2);
+        assert_eq!(hosts(&assigned), [vec![10], vec![10]]);
+        assert_eq!(pinned, [true, false]);
+
+        // hosts with no cost aren't pinned
+        let (_, pinned) = assign_with_pinning(entries(&[0, 0, 0]), 3);
+        assert_eq!(pinned, [false, false, false]);
+    }
+
+    #[test]
+    fn test_pin_busy_hosts() {
+        let hosts: [u32; 8] = std::array::from_fn(|i| i as u32);
+        let mut sched: ThreadPerCoreSched<u32> = ThreadPerCoreSched::new(
+            &[None; 2],
+            hosts,
+            ThreadPerCoreOptions {
+                pin_busy_hosts: true,
+                ..Default::default()
+            },
+        );
+
+        let counter = AtomicU32::new(0);
+
+        for _ in 0..(2 * REBALANCE_INTERVAL) {
+            sched.scope(|s| {
+                s.run_with_hosts(|_, hosts| {
+                    hosts.for_each(|host| {
+                        // host 0 is much busier than the others
+                        if host == 0 {
+                            std::thread::sleep(Duration::from_micros(500));
+                        }
+                        counter.fetch_add(1, Ordering::SeqCst);
+                        host
+                    });
+                });
+            });
+        }
+
+        assert_eq!(
+            counter.load(Ordering::SeqCst),
+            8 * 2 * REBALANCE_INTERVAL as u32
+        );
+
+        // host 0 was given a dedicated thread, and has stayed on it since
+        assert_eq!(sched.pinned_threads, [true, false]);
+        assert_eq!(sched.steal_order[0], [0]);
+        let queue = &sched.thread_hosts_processed[0];
+        assert_eq!(queue.len(), 1);
+        assert_eq!(queue.pop().unwrap().host, 0);
+
+        sched.join();
+    }
+
+    #[test]
+    fn test_assign_by_cost() {
+        let entries: Vec<_> = [10, 1, 6, 5, 3, 2]
+            .into_iter()
+            .map(|cost| HostEntry {
+                host: cost,
+                cost: Duration::from_millis(cost),
+            })
+            .collect();
+
+        let assigned = assign_by_cost(entries, 2);
+        let hosts: Vec<Vec<u64>> = assigned
+            .iter()
+            .map(|x| x.iter().map(|entry| entry.host).collect())
+            .collect();
+
+        // 10 -> t0, 6 -> t1, 5 -> t1, 3 -> t0, 2 -> t1, 1 -> t0
+        assert_eq!(hosts, [vec![10, 3, 1], vec![6, 5, 2]]);
+    }
 }
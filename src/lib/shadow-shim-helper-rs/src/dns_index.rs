@@ -0,0 +1,171 @@
+//! A read-only hash table of the simulation's host names and their addresses. Shadow writes it to a
+//! memory file (whose descriptor is in [`ManagerShmem`](crate::shim_shmem::ManagerShmem)), and the
+//! shim maps the file so that it can resolve names without a syscall or scanning `/etc/hosts`.
+//!
+//! The table is a sequence of native-endian `u32` words. It starts with a header of
+//! [`HEADER_WORDS`] words: [`MAGIC`], the number of buckets (a power of two), and the number of
+//! bytes of names. The header is followed by the buckets, each of [`BUCKET_WORDS`] words: the
+//! hash of the name, the offset and length of the name in the names section, and the address in
+//! network byte order. An empty bucket has a name length of 0. The names follow the buckets.
+//!
+//! Names are placed with linear probing from the bucket given by their hash, and the table is at
+//! most half full, so most lookups only need to look at one bucket.
+
+#[cfg(any(test, feature = "alloc"))]
+extern crate alloc;
+
+pub const MAGIC: u32 = u32::from_ne_bytes(*b"SDNS");
+pub const HEADER_WORDS: usize = 3;
+pub const BUCKET_WORDS: usize = 4;
+
+/// The FNV-1a hash of `name`.
+pub fn name_hash(name: &[u8]) -> u32 {
+    name.iter().fold(0x811c9dc5, |hash, byte| {
+        (hash ^ u32::from(*byte)).wrapping_mul(0x01000193)
+    })
+}
+
+fn word(index: &[u8], i: usize) -> Option<u32> {
+    let bytes = index.get(i * 4..i * 4 + 4)?;
+    Some(u32::from_ne_bytes(bytes.try_into().unwrap()))
+}
+
+/// Look up `name` in the table `index`. Returns its address in network byte order, or `None` if
+/// it isn't in the table or the table is malformed.
+pub fn lookup(index: &[u8], name: &[u8]) -> Option<u32> {
+    if name.is_empty() || word(index, 0)? != MAGIC {
+        return None;
+    }
+    let num_buckets = usize::try_from(word(index, 1)?).unwrap();
+    if !num_buckets.is_power_of_two() {
+        return None;
+    }
+    let names_start = (HEADER_WORDS + num_buckets * BUCKET_WORDS) * 4;
+
+    let hash = name_hash(name);
+    let mut bucket = usize::try_from(hash).unwrap() & (num_buckets - 1);
+    for _ in 0..num_buckets {
+        let base = HEADER_WORDS + bucket * BUCKET_WORDS;
+        let name_len = usize::try_from(word(index, base + 2)?).unwrap();
+        if name_len == 0 {
+            return None;
+        }
+        if word(index, base)? == hash && name_len == name.len() {
+            let name_offset = names_start + usize::try_from(word(index, base + 1)?).unwrap();
+            if index.get(name_offset..name_offset + name_len)? == name {
+                return word(index, base + 3);
+            }
+        }
+        bucket = (bucket + 1) & (num_buckets - 1);
+    }
+    None
+}
+
+/// Build a table of the given names and addresses (in network byte order). The names must be
+/// unique and non-empty.
+#[cfg(any(test, feature = "alloc"))]
+pub fn build<'a>(entries: impl ExactSizeIterator<Item = (&'a [u8], u32)>) -> alloc::vec::Vec<u8> {
+    let num_buckets = (entries.len() * 2).next_power_of_two().max(1);
+    let mut buckets = alloc::vec![0u32; num_buckets * BUCKET_WORDS];
+    let mut names = alloc::vec::Vec::new();
+
+    for (name, addr) in entries {
+        assert!(!name.is_empty());
+        let hash = name_hash(name);
+        let mut bucket = usize::try_from(hash).unwrap() & (num_buckets - 1);
+        while buckets[bucket * BUCKET_WORDS + 2] != 0 {
+            bucket = (bucket + 1) & (num_buckets - 1);
+        }
+        buckets[bucket * BUCKET_WORDS..][..BUCKET_WORDS].copy_from_slice(&[
+            hash,
+            u32::try_from(names.len()).unwrap(),
+            u32::try_from(name.len()).unwrap(),
+            addr,
+        ]);
+        names.extend_from_slice(name);
+    }
+
+    let header = [
+        MAGIC,
+        u32::try_from(num_buckets).unwrap(),
+        u32::try_from(names.len()).unwrap(),
+    ];
+    let mut index =
+        alloc::vec::Vec::with_capacity((header.len() + buckets.len()) * 4 + names.len());
+    for word in header.iter().chain(buckets.iter()) {
+        index.extend_from_slice(&word.to_ne_bytes());
+    }
+    index.extend_from_slice(&names);
+    index
+}
+
+pub mod export {
+    use super::*;
+
+    /// Look up the null-terminated `name` in the table of `index_len` bytes at `index`, and set
+    /// `addr` to its address in network byte order. Returns false if the name isn't in the table.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn dnsindex_lookupIpv4(
+        index: *const u8,
+        index_len: usize,
+        name: *const core::ffi::c_char,
+        addr: *mut u32,
+    ) -> bool {
+        let index = unsafe { core::slice::from_raw_parts(index, index_len) };
+        let name = unsafe { core::ffi::CStr::from_ptr(name) };
+        match lookup(index, name.to_bytes()) {
+            Some(found) => {
+                unsafe { addr.write(found) };
+                true
+            }
+            None => false,
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_lookup() {
+        let names: Vec<String> = (0..1000).map(|i| format!("host{i}")).collect();
+        let index = build(
+            names
+                .iter()
+                .enumerate()
+                .map(|(i, name)| (name.as_bytes(), u32::try_from(i).unwrap().to_be())),
+        );
+
+        for (i, name) in names.iter().enumerate() {
+            assert_eq!(
+                lookup(&index, name.as_bytes()),
+                Some(u32::try_from(i).unwrap().to_be())
+            );
+        }
+        assert_eq!(lookup(&index, b"host1000"), None);
+        assert_eq!(lookup(&index, b"host"), None);
+        assert_eq!(lookup(&index, b""), None);
+    }
+
+    #[test]
+    fn test_empty() {
+        let index = build(std::iter::empty());
+        assert_eq!(lookup(&index, b"host"), None);
+    }
+
+    #[test]
+    fn test_malformed() {
+        assert_eq!(lookup(&[], b"host"), None);
+        assert_eq!(lookup(&[0u8; 64], b"host"), None);
+
+        // truncated
+        let index = build([(&b"host"[..], 1)].into_iter());
+        assert_eq!(lookup(&index[..index.len() - 1], b"host"), None);
+        assert_eq!(lookup(&index, b"host"), Some(1));
+    }
+}
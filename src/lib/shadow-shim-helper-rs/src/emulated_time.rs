@@ -297,4 +297,12 @@ impl AtomicEmulatedTime {
     pub fn store(&self, val: EmulatedTime, order: Ordering) {
         self.0.store(val.0, order)
     }
+
+    pub fn swap(&self, val: EmulatedTime, order: Ordering) -> EmulatedTime {
+        EmulatedTime(self.0.swap(val.0, order))
+    }
+
+    pub fn fetch_min(&self, val: EmulatedTime, order: Ordering) -> EmulatedTime {
+        EmulatedTime(self.0.fetch_min(val.0, order))
+    }
 }
@@ -3,45 +3,78 @@ use vasi_sync::scchannel::SelfContainedChannel;
 
 use crate::shim_event::{ShimEventToShadow, ShimEventToShim};
 
+/// Aligns and pads `T` to its own pair of cache lines. 128 bytes rather than 64, since x86-64 CPUs
+/// prefetch cache lines in adjacent pairs.
+#[derive(VirtualAddressSpaceIndependent)]
+#[repr(C, align(128))]
+struct CacheLinePadded<T>(T);
+
 /// Manages communication between the Shadow process and the shim library
 /// running inside Shadow managed threads.
+///
+/// Each channel is on its own cache lines, so that one side polling or updating its receiving
+/// channel doesn't invalidate the other side's cached copy of its own receiving channel. The
+/// alignment also makes the shared-memory allocator put each `IPCData` on its own cache lines,
+/// so that the channels of different threads don't share them either.
 #[derive(VirtualAddressSpaceIndependent)]
 #[repr(C)]
-// In the microbenchmarks introduced in
-// https://github.com/shadow/shadow/pull/2791, adding a large alignment to
-// the mock IPC helped make some measurement artifacts go away by ensuring
-// the two channels are on the same cache line.
 pub struct IPCData {
-    shadow_to_plugin: SelfContainedChannel<ShimEventToShim>,
-    plugin_to_shadow: SelfContainedChannel<ShimEventToShadow>,
+    shadow_to_plugin: CacheLinePadded<SelfContainedChannel<ShimEventToShim>>,
+    plugin_to_shadow: CacheLinePadded<SelfContainedChannel<ShimEventToShadow>>,
+}
+
+fn channel<T>(spin_limit: u32, collect_stats: bool) -> SelfContainedChannel<T> {
+    let channel = SelfContainedChannel::with_spin_limit(spin_limit);
+    if collect_stats {
+        channel.with_stats()
+    } else {
+        channel
+    }
 }
 
 impl IPCData {
     pub fn new() -> Self {
+        Self::with_spin_limit(0, false)
+    }
+
+    /// Each side polls its receiving channel up to `spin_limit` times before sleeping. See
+    /// [`SelfContainedChannel::with_spin_limit`]. If `collect_stats` is set, both channels count
+    /// how their messages were received; see [`SelfContainedChannel::with_stats`].
+    pub fn with_spin_limit(spin_limit: u32, collect_stats: bool) -> Self {
         Self {
-            shadow_to_plugin: SelfContainedChannel::new(),
-            plugin_to_shadow: SelfContainedChannel::new(),
+            shadow_to_plugin: CacheLinePadded(channel(spin_limit, collect_stats)),
+            plugin_to_shadow: CacheLinePadded(channel(spin_limit, collect_stats)),
         }
     }
 
+    /// The number of times each side polls its receiving channel before sleeping.
+    pub fn spin_limit(&self) -> u32 {
+        self.shadow_to_plugin.0.spin_limit()
+    }
+
+    /// Whether the channels count how their messages were received.
+    pub fn collects_stats(&self) -> bool {
+        self.shadow_to_plugin.0.collects_stats()
+    }
+
     /// Returns a reference to the "Shadow to Plugin" channel.
     pub fn to_plugin(&self) -> &SelfContainedChannel<ShimEventToShim> {
-        &self.shadow_to_plugin
+        &self.shadow_to_plugin.0
     }
 
     /// Returns a reference to the "Plugin to Shadow" channel.
     pub fn to_shadow(&self) -> &SelfContainedChannel<ShimEventToShadow> {
-        &self.plugin_to_shadow
+        &self.plugin_to_shadow.0
     }
 
     /// Returns a reference to the "Plugin to Shadow" channel.
     pub fn from_plugin(&self) -> &SelfContainedChannel<ShimEventToShadow> {
-        &self.plugin_to_shadow
+        &self.plugin_to_shadow.0
     }
 
     /// Returns a reference to the "Shadow to Plugin" channel.
     pub fn from_shadow(&self) -> &SelfContainedChannel<ShimEventToShim> {
-        &self.shadow_to_plugin
+        &self.shadow_to_plugin.0
     }
 }
 
@@ -50,3 +83,23 @@ impl Default for IPCData {
         Self::new()
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_channels_on_separate_cache_lines() {
+        assert_eq!(core::mem::align_of::<IPCData>(), 128);
+        assert_eq!(core::mem::size_of::<IPCData>() % 128, 0);
+
+        let ipc = IPCData::new();
+        let to_plugin = core::ptr::from_ref(ipc.to_plugin()) as usize;
+        let to_shadow = core::ptr::from_ref(ipc.to_shadow()) as usize;
+        assert_eq!(to_plugin % 128, 0);
+        assert_eq!(to_shadow % 128, 0);
+        assert!(
+            to_shadow >= to_plugin + core::mem::size_of::<SelfContainedChannel<ShimEventToShim>>()
+        );
+    }
+}
@@ -6,6 +6,7 @@
 
 use vasi::VirtualAddressSpaceIndependent;
 
+pub mod dns_index;
 pub mod emulated_time;
 pub mod explicit_drop;
 pub mod ipc;
@@ -14,10 +15,12 @@ pub mod option;
 pub mod rootedcell;
 pub mod shadow_syscalls;
 pub mod shim_event;
+pub mod shim_log_ring;
 pub mod shim_shmem;
 pub mod simulation_time;
 pub mod syscall_types;
 pub mod util;
+pub mod zygote;
 
 #[repr(transparent)]
 #[derive(
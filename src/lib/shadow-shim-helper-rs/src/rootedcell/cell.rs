@@ -43,11 +43,7 @@ impl<T> RootedCell<T> {
     #[inline]
     pub fn replace(&self, root: &Root, val: T) -> T {
         // Prove that the root is held for this tag.
-        assert_eq!(
-            root.tag, self.tag,
-            "Expected {:?} Got {:?}",
-            self.tag, root.tag
-        );
+        root.check_tag(self.tag);
 
         unsafe { self.val.get().replace(val) }
     }
@@ -62,11 +58,7 @@ impl<T: Copy> RootedCell<T> {
     #[inline]
     pub fn get(&self, root: &Root) -> T {
         // Prove that the root is held for this tag.
-        assert_eq!(
-            root.tag, self.tag,
-            "Expected {:?} Got {:?}",
-            self.tag, root.tag
-        );
+        root.check_tag(self.tag);
 
         unsafe { *self.val.get() }
     }
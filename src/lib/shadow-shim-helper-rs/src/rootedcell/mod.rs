@@ -89,6 +89,8 @@ impl Default for Tag {
 #[repr(C)]
 pub struct Root {
     tag: Tag,
+    /// Whether accesses through this root check the object's tag in release builds.
+    checked: bool,
     _notsync: core::marker::PhantomData<core::cell::Cell<()>>,
 }
 
@@ -97,14 +99,49 @@ impl Root {
         let tag = Tag::new();
         Self {
             tag,
+            checked: true,
             _notsync: PhantomData,
         }
     }
 
+    /// Create a root that only checks that it's the right root for an object in debug builds.
+    /// Each access to a rooted object through it then saves loading and comparing the tags in
+    /// release builds.
+    ///
+    /// # Safety
+    ///
+    /// The root must only be used to access objects (`RootedRc`, `RootedRefCell`, and
+    /// `RootedCell`) that were created with this root. Accessing an object of another root through
+    /// it is undefined behaviour in release builds, since the object may concurrently be accessed
+    /// through its own root on another thread.
+    pub unsafe fn new_unchecked() -> Self {
+        Self {
+            checked: false,
+            ..Self::new()
+        }
+    }
+
     /// This root's globally unique tag.
     fn tag(&self) -> Tag {
         self.tag
     }
+
+    /// Panics if this isn't the root with `tag`, i.e. if it's being used to access an object
+    /// associated with a different root.
+    ///
+    /// For a root created with [`Root::new_unchecked`] this is only checked in debug builds.
+    #[inline]
+    #[track_caller]
+    fn check_tag(&self, tag: Tag) {
+        if !self.checked && !cfg!(debug_assertions) {
+            return;
+        }
+        assert_eq!(
+            self.tag, tag,
+            "Tried using root {:?} instead of {:?}",
+            self.tag, tag
+        );
+    }
 }
 
 impl Default for Root {
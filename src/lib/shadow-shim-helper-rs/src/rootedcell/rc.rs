@@ -67,11 +67,7 @@ impl<T> RootedRcCommon<T> {
     // Validates that no other thread currently has access to self.internal, and
     // return a reference to it.
     pub fn borrow_internal(&self, root: &Root) -> &RootedRcInternal<T> {
-        assert_eq!(
-            root.tag, self.tag,
-            "Tried using root {:?} instead of {:?}",
-            root.tag, self.tag
-        );
+        root.check_tag(self.tag);
         // SAFETY:
         // * Holding a reference to `root` proves no other threads can currently
         //   access `self.internal`.
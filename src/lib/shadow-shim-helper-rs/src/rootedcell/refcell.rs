@@ -39,11 +39,7 @@ impl<T> RootedRefCell<T> {
     #[inline]
     pub fn borrow<'a>(&'a self, root: &'a Root) -> RootedRefCellRef<'a, T> {
         // Prove that the root is held for this tag.
-        assert_eq!(
-            root.tag, self.tag,
-            "Expected {:?} Got {:?}",
-            self.tag, root.tag
-        );
+        root.check_tag(self.tag);
 
         assert!(!self.writer.get());
 
@@ -57,11 +53,7 @@ impl<T> RootedRefCell<T> {
     #[inline]
     pub fn borrow_mut<'a>(&'a self, root: &'a Root) -> RootedRefCellRefMut<'a, T> {
         // Prove that the root is held for this tag.
-        assert_eq!(
-            root.tag, self.tag,
-            "Expected {:?} Got {:?}",
-            self.tag, root.tag
-        );
+        root.check_tag(self.tag);
 
         assert!(!self.writer.get());
         assert!(self.reader_count.get() == 0);
@@ -155,6 +147,26 @@ mod test_rooted_refcell {
         let _ = RootedRefCell::new(&root, 0);
     }
 
+    #[test]
+    #[should_panic]
+    fn borrow_with_wrong_root_panics() {
+        let root = Root::new();
+        let other_root = Root::new();
+        let cell = RootedRefCell::new(&root, 0);
+        let _ = cell.borrow(&other_root);
+    }
+
+    #[test]
+    #[cfg(debug_assertions)]
+    #[should_panic]
+    fn borrow_with_wrong_unchecked_root_panics_in_debug_builds() {
+        let root = Root::new();
+        // SAFETY: only reached in debug builds, where the root is still checked.
+        let other_root = unsafe { Root::new_unchecked() };
+        let cell = RootedRefCell::new(&root, 0);
+        let _ = cell.borrow(&other_root);
+    }
+
     #[test]
     fn share_with_worker_thread() {
         let root = Root::new();
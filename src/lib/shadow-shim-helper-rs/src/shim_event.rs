@@ -1,6 +1,7 @@
 use shadow_shmem::allocator::ShMemBlockSerialized;
 use vasi::VirtualAddressSpaceIndependent;
 
+use crate::option::FfiOption;
 use crate::syscall_types::{ForeignPtr, SyscallArgs, SyscallReg, UntypedForeignPtr};
 
 #[derive(Copy, Clone, Debug, VirtualAddressSpaceIndependent)]
@@ -36,6 +37,11 @@ pub struct ShimEventSyscallComplete {
 #[repr(C)]
 pub struct ShimEventAddThreadReq {
     pub ipc_block: ShMemBlockSerialized,
+    /// The new thread's shared memory, and its process's shared memory. Only set for a new thread
+    /// in the same process (`CLONE_THREAD`), which can then start without first asking shadow for
+    /// them.
+    pub thread_shmem_block: FfiOption<ShMemBlockSerialized>,
+    pub process_shmem_block: FfiOption<ShMemBlockSerialized>,
     /// clone flags.
     pub flags: libc::c_ulong,
     /// clone stack. u8 pointer in shim's memory
@@ -0,0 +1,167 @@
+//! A ring of log output in a thread's shared memory. When the experimental `use_shim_log_ring`
+//! option is enabled, the shim appends its formatted log records to the ring instead of writing
+//! them to the shim log file, and Shadow drains the ring to the file whenever the thread returns
+//! control to it. This saves a write syscall in the managed process for each record.
+//!
+//! The ring has a single producer (the shim, on the thread that the ring belongs to) and a single
+//! consumer (Shadow).
+
+use core::cell::UnsafeCell;
+use core::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+
+use vasi::VirtualAddressSpaceIndependent;
+
+/// The number of bytes in a [`ShimLogRing`].
+pub const SHIM_LOG_RING_LEN: usize = 16 * 1024;
+
+#[derive(VirtualAddressSpaceIndependent)]
+#[repr(C)]
+pub struct ShimLogRing {
+    /// The total number of bytes ever pushed. Only written by the producer.
+    head: AtomicU64,
+    /// The total number of bytes ever drained. Only written by the consumer.
+    tail: AtomicU64,
+    /// Set while the producer is pushing, so that a push from a signal handler that interrupted
+    /// another push fails instead of corrupting the ring.
+    pushing: AtomicBool,
+    buf: UnsafeCell<[u8; SHIM_LOG_RING_LEN]>,
+}
+
+// SAFETY: The producer only writes to the unused part of `buf` (between `head` and `tail` plus
+// the length), and the consumer only reads from the used part, with `head` and `tail` published
+// with release ordering after the bytes are written or read.
+unsafe impl Sync for ShimLogRing {}
+
+impl ShimLogRing {
+    pub const fn new() -> Self {
+        Self {
+            head: AtomicU64::new(0),
+            tail: AtomicU64::new(0),
+            pushing: AtomicBool::new(false),
+            buf: UnsafeCell::new([0; SHIM_LOG_RING_LEN]),
+        }
+    }
+
+    /// Append `data` to the ring. Returns `false` without appending anything if there isn't room
+    /// for all of it (or the push interrupted another push), in which case the caller should write
+    /// it elsewhere.
+    ///
+    /// Must only be called by the producer.
+    pub fn push(&self, data: &[u8]) -> bool {
+        if self.pushing.swap(true, Ordering::Acquire) {
+            return false;
+        }
+
+        let head = self.head.load(Ordering::Relaxed);
+        let tail = self.tail.load(Ordering::Acquire);
+        let used = usize::try_from(head - tail).unwrap();
+
+        let pushed = data.len() <= SHIM_LOG_RING_LEN - used;
+        if pushed {
+            let start = usize::try_from(head % SHIM_LOG_RING_LEN as u64).unwrap();
+            let (first, second) = data.split_at(data.len().min(SHIM_LOG_RING_LEN - start));
+            let buf = self.buf.get().cast::<u8>();
+            // SAFETY: The bytes from `head` to `tail + SHIM_LOG_RING_LEN` aren't used, so the
+            // consumer won't read them until we update `head`.
+            unsafe {
+                core::ptr::copy_nonoverlapping(first.as_ptr(), buf.add(start), first.len());
+                core::ptr::copy_nonoverlapping(second.as_ptr(), buf, second.len());
+            }
+            self.head
+                .store(head + u64::try_from(data.len()).unwrap(), Ordering::Release);
+        }
+
+        self.pushing.store(false, Ordering::Release);
+        pushed
+    }
+
+    /// Whether there's nothing to drain.
+    pub fn is_empty(&self) -> bool {
+        self.head.load(Ordering::Relaxed) == self.tail.load(Ordering::Relaxed)
+    }
+
+    /// Pass the pushed bytes to `f` (in at most two slices) and remove them from the ring.
+    ///
+    /// Must only be called by the consumer.
+    pub fn drain(&self, mut f: impl FnMut(&[u8])) {
+        let tail = self.tail.load(Ordering::Relaxed);
+        let head = self.head.load(Ordering::Acquire);
+        if head == tail {
+            return;
+        }
+
+        let len = usize::try_from(head - tail).unwrap();
+        let start = usize::try_from(tail % SHIM_LOG_RING_LEN as u64).unwrap();
+        let first_len = len.min(SHIM_LOG_RING_LEN - start);
+        let buf = self.buf.get().cast::<u8>().cast_const();
+        // SAFETY: The bytes from `tail` to `head` are used, so the producer won't write them until
+        // we update `tail`.
+        unsafe {
+            f(core::slice::from_raw_parts(buf.add(start), first_len));
+            if len > first_len {
+                f(core::slice::from_raw_parts(buf, len - first_len));
+            }
+        }
+
+        self.tail.store(head, Ordering::Release);
+    }
+}
+
+impl Default for ShimLogRing {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn drain_to_vec(ring: &ShimLogRing) -> Vec<u8> {
+        let mut out = Vec::new();
+        ring.drain(|x| out.extend_from_slice(x));
+        out
+    }
+
+    #[test]
+    fn test_push_and_drain() {
+        let ring = ShimLogRing::new();
+        assert!(ring.is_empty());
+        assert!(ring.push(b"hello "));
+        assert!(ring.push(b"world\n"));
+        assert!(!ring.is_empty());
+        assert_eq!(drain_to_vec(&ring), b"hello world\n");
+        assert!(ring.is_empty());
+        assert_eq!(drain_to_vec(&ring), b"");
+    }
+
+    #[test]
+    fn test_full() {
+        let ring = ShimLogRing::new();
+        let data = vec![b'x'; SHIM_LOG_RING_LEN - 1];
+        assert!(ring.push(&data));
+        assert!(!ring.push(b"ab"));
+        assert!(ring.push(b"a"));
+        assert!(!ring.push(b"b"));
+        assert_eq!(drain_to_vec(&ring).len(), SHIM_LOG_RING_LEN);
+        assert!(ring.push(b"b"));
+    }
+
+    #[test]
+    fn test_wrap_around() {
+        let ring = ShimLogRing::new();
+        let line: Vec<u8> = (0..100).collect();
+        let mut expected = Vec::new();
+        let mut drained = Vec::new();
+        // enough to wrap around several times
+        for _ in 0..1000 {
+            assert!(ring.push(&line));
+            expected.extend_from_slice(&line);
+            if expected.len() - drained.len() > SHIM_LOG_RING_LEN / 2 {
+                drained.extend(drain_to_vec(&ring));
+            }
+        }
+        drained.extend(drain_to_vec(&ring));
+        assert_eq!(drained, expected);
+    }
+}
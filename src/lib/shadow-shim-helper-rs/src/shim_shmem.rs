@@ -1,10 +1,15 @@
+use core::sync::atomic::{AtomicBool, AtomicI32, AtomicU64, Ordering};
+
 use linux_api::signal::{Signal, sigaction, siginfo_t, sigset_t, stack_t};
+use linux_api::syscall::SyscallNum;
+use linux_api::utsname::new_utsname;
 use shadow_shmem::allocator::{ShMemBlock, ShMemBlockSerialized};
 use vasi::VirtualAddressSpaceIndependent;
 use vasi_sync::scmutex::SelfContainedMutex;
 
 use crate::HostId;
 use crate::option::FfiOption;
+use crate::shim_log_ring::ShimLogRing;
 use crate::{
     emulated_time::{AtomicEmulatedTime, EmulatedTime},
     rootedcell::{Root, refcell::RootedRefCell},
@@ -58,6 +63,60 @@ pub struct NativePreemptionConfig {
     /// Amount of simulation-time to move forward after `native_duration_micros`
     /// has elapsed without returning control to Shadow.
     pub sim_duration: SimulationTime,
+    /// Whether to double both durations each time a thread is preempted again without having
+    /// returned control to Shadow in between, up to a limit.
+    pub backoff: bool,
+}
+
+/// The vDSO functions that the shim replaces.
+#[derive(Debug, Copy, Clone, PartialEq, Eq, VirtualAddressSpaceIndependent)]
+#[repr(C)]
+pub enum VdsoFunction {
+    Gettimeofday,
+    Time,
+    ClockGettime,
+    Getcpu,
+}
+
+impl VdsoFunction {
+    pub const ALL: [Self; 4] = [
+        Self::Gettimeofday,
+        Self::Time,
+        Self::ClockGettime,
+        Self::Getcpu,
+    ];
+
+    /// The name of the function's symbol in the vDSO.
+    pub fn symbol_name(self) -> &'static str {
+        match self {
+            Self::Gettimeofday => "__vdso_gettimeofday",
+            Self::Time => "__vdso_time",
+            Self::ClockGettime => "__vdso_clock_gettime",
+            Self::Getcpu => "__vdso_getcpu",
+        }
+    }
+}
+
+/// A function's symbol in the vDSO.
+#[derive(Debug, Copy, Clone, PartialEq, Eq, VirtualAddressSpaceIndependent)]
+#[repr(C)]
+pub struct VdsoSymbol {
+    /// The offset of the function from the start of the vDSO.
+    pub offset: u64,
+    /// The size of the function, or 0 if the vDSO doesn't have the function.
+    pub size: u64,
+}
+
+/// Where the shim should patch the vDSO. The vDSO is the same in every process, so Shadow finds
+/// this once in its own vDSO, saving each managed process from parsing `/proc/self/maps` and the
+/// vDSO's symbol table.
+#[derive(Debug, Copy, Clone, PartialEq, Eq, VirtualAddressSpaceIndependent)]
+#[repr(C)]
+pub struct VdsoPatchTable {
+    /// The length of the vDSO's mapping.
+    pub len: u64,
+    /// The symbol of each [`VdsoFunction`], indexed by the function.
+    pub symbols: [VdsoSymbol; VdsoFunction::ALL.len()],
 }
 
 #[derive(VirtualAddressSpaceIndependent)]
@@ -65,6 +124,18 @@ pub struct NativePreemptionConfig {
 pub struct ManagerShmem {
     pub log_start_time_micros: i64,
     pub native_preemption_config: FfiOption<NativePreemptionConfig>,
+    // Whether to patch libc's syscall wrappers to call into the shim directly.
+    pub use_libc_patching: bool,
+    // Whether to rewrite recognized rdtsc sites to call into the shim directly.
+    pub use_rdtsc_patching: bool,
+    // Shadow's descriptor for the memory file containing the table of host names described in
+    // `crate::dns_index`, or -1 if there isn't one.
+    pub dns_index_fd: i32,
+    // Whether the shim should buffer its log records in `ThreadShmem::shim_log` for Shadow to
+    // write to the shim log file.
+    pub use_shim_log_ring: bool,
+    // Where to patch the vDSO, or `None` if the shim must find it itself.
+    pub vdso_patch_table: FfiOption<VdsoPatchTable>,
 }
 
 #[derive(VirtualAddressSpaceIndependent)]
@@ -105,8 +176,19 @@ pub struct HostShmem {
     // Current simulation time.
     pub sim_time: AtomicEmulatedTime,
 
+    // The number of times that the shim has natively preempted managed code on this host.
+    pub native_preemptions: AtomicU64,
+
+    // Whether any futex on this host may have waiters. While it doesn't, the shim handles futex
+    // wakes itself (see the `use_shim_futex_wake` option). Only updated by Shadow before it runs
+    // one of the host's threads.
+    pub futex_waiters: AtomicBool,
+
     pub shim_log_level: logger::LogLevel,
 
+    // The result of `uname()` on this host, which doesn't change during the simulation.
+    pub utsname: new_utsname,
+
     pub manager_shmem: ShMemBlockSerialized,
 }
 assert_shmem_safe!(HostShmem, _hostshmem_test_fn);
@@ -122,16 +204,21 @@ impl HostShmem {
         shadow_pid: libc::pid_t,
         tsc_hz: u64,
         shim_log_level: ::logger::LogLevel,
+        utsname: new_utsname,
         manager_shmem: &ShMemBlock<ManagerShmem>,
+        lock_spin_limit: u32,
     ) -> Self {
         Self {
             host_id,
-            protected: SelfContainedMutex::new(HostShmemProtected {
-                host_id,
-                root: Root::new(),
-                unapplied_cpu_latency: SimulationTime::ZERO,
-                max_runahead_time: EmulatedTime::MIN,
-            }),
+            protected: SelfContainedMutex::with_spin_limit(
+                HostShmemProtected {
+                    host_id,
+                    root: Root::new(),
+                    unapplied_cpu_latency: SimulationTime::ZERO,
+                    max_runahead_time: EmulatedTime::MIN,
+                },
+                lock_spin_limit,
+            ),
             model_unblocked_syscall_latency,
             max_unapplied_cpu_latency,
             unblocked_syscall_latency,
@@ -139,7 +226,10 @@ impl HostShmem {
             shadow_pid,
             tsc_hz,
             sim_time: AtomicEmulatedTime::new(EmulatedTime::MIN),
+            native_preemptions: AtomicU64::new(0),
+            futex_waiters: AtomicBool::new(true),
             shim_log_level,
+            utsname,
             manager_shmem: manager_shmem.serialize(),
         }
     }
@@ -169,25 +259,94 @@ pub struct HostShmemProtected {
 pub struct ProcessShmem {
     host_id: HostId,
 
+    /// The id of the process, which doesn't change during the lifetime of the process.
+    pub pid: libc::pid_t,
+
     /// Handle to shared memory for the Host
     pub host_shmem: ShMemBlockSerialized,
     pub strace_fd: FfiOption<libc::c_int>,
 
+    /// Syscalls that the shim's seccomp filter lets the process make natively.
+    native_syscalls: [u32; MAX_NATIVE_SYSCALLS],
+    num_native_syscalls: usize,
+
+    /// For each of the process's fds below [`MAX_LOCAL_FILES`], how the shim handles the file's
+    /// I/O itself (see [`LocalFile`]), or -1 if Shadow handles the file's I/O. Only changed by
+    /// Shadow while the process's threads are stopped.
+    local_files: [AtomicI32; MAX_LOCAL_FILES],
+
+    /// Whether the process may have process-directed pending signals. See
+    /// [`signals_maybe_pending`].
+    pub maybe_pending_signals: AtomicBool,
+
     pub protected: RootedRefCell<ProcessShmemProtected>,
 }
 assert_shmem_safe!(ProcessShmem, _test_processshmem_fn);
 
+/// The maximum number of syscalls in [`ProcessShmem::native_syscalls`].
+pub const MAX_NATIVE_SYSCALLS: usize = 64;
+
+/// Only fds below this can have their I/O handled by the shim.
+pub const MAX_LOCAL_FILES: usize = 1024;
+
+/// How the shim handles the I/O of a file itself, rather than asking Shadow to handle it.
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub enum LocalFile {
+    /// Do the file's I/O natively on this fd of the managed process.
+    Native(i32),
+    /// Serve reads of the file from the thread's random bytes (see
+    /// [`ThreadShmemProtected::take_random_bytes`]).
+    Random,
+}
+
+impl LocalFile {
+    const NONE: i32 = -1;
+    const RANDOM: i32 = -2;
+
+    fn from_raw(raw: i32) -> Option<Self> {
+        match raw {
+            Self::RANDOM => Some(Self::Random),
+            fd if fd >= 0 => Some(Self::Native(fd)),
+            _ => None,
+        }
+    }
+
+    fn to_raw(file: Option<Self>) -> i32 {
+        match file {
+            Some(Self::Native(fd)) => {
+                assert!(fd >= 0);
+                fd
+            }
+            Some(Self::Random) => Self::RANDOM,
+            None => Self::NONE,
+        }
+    }
+}
+
 impl ProcessShmem {
     pub fn new(
         host_root: &Root,
         host_shmem: ShMemBlockSerialized,
         host_id: HostId,
+        pid: libc::pid_t,
         strace_fd: Option<libc::c_int>,
+        native_syscalls: &[SyscallNum],
     ) -> Self {
+        assert!(native_syscalls.len() <= MAX_NATIVE_SYSCALLS);
+        let mut native_syscalls_buf = [0; MAX_NATIVE_SYSCALLS];
+        for (dst, src) in native_syscalls_buf.iter_mut().zip(native_syscalls) {
+            *dst = src.val();
+        }
+
         Self {
             host_id,
+            pid,
             host_shmem,
             strace_fd: strace_fd.into(),
+            native_syscalls: native_syscalls_buf,
+            num_native_syscalls: native_syscalls.len(),
+            local_files: [const { AtomicI32::new(LocalFile::NONE) }; MAX_LOCAL_FILES],
+            maybe_pending_signals: AtomicBool::new(false),
             protected: RootedRefCell::new(
                 host_root,
                 ProcessShmemProtected {
@@ -200,6 +359,41 @@ impl ProcessShmem {
             ),
         }
     }
+
+    /// Syscalls that the process is allowed to make natively, without being trapped by the shim's
+    /// seccomp filter.
+    pub fn native_syscalls(&self) -> impl Iterator<Item = SyscallNum> + '_ {
+        self.native_syscalls[..self.num_native_syscalls]
+            .iter()
+            .map(|x| SyscallNum::new(*x))
+    }
+
+    /// How the shim handles the I/O of `fd`, if it handles it.
+    pub fn local_file(&self, fd: u32) -> Option<LocalFile> {
+        let raw = self
+            .local_files
+            .get(usize::try_from(fd).unwrap())?
+            .load(Ordering::Relaxed);
+        LocalFile::from_raw(raw)
+    }
+
+    /// Set or clear how the shim handles the I/O of `fd`. Returns how it previously handled it,
+    /// if it did. Panics if `file` is `Some` and `fd` isn't below [`MAX_LOCAL_FILES`].
+    pub fn set_local_file(&self, fd: u32, file: Option<LocalFile>) -> Option<LocalFile> {
+        let Some(entry) = self.local_files.get(usize::try_from(fd).unwrap()) else {
+            assert!(file.is_none());
+            return None;
+        };
+        LocalFile::from_raw(entry.swap(LocalFile::to_raw(file), Ordering::Relaxed))
+    }
+
+    /// The fds whose I/O the shim handles, and how it handles them.
+    pub fn local_files(&self) -> impl Iterator<Item = (u32, LocalFile)> + '_ {
+        self.local_files.iter().enumerate().filter_map(|(fd, raw)| {
+            let file = LocalFile::from_raw(raw.load(Ordering::Relaxed))?;
+            Some((u32::try_from(fd).unwrap(), file))
+        })
+    }
 }
 
 #[derive(VirtualAddressSpaceIndependent)]
@@ -298,6 +492,14 @@ pub struct ThreadShmem {
     pub host_id: HostId,
     pub tid: libc::pid_t,
 
+    // The shim's buffered log records (accessed without the host lock, since the shim may log
+    // while holding it).
+    pub shim_log: ShimLogRing,
+
+    /// Whether the thread may have thread-directed pending signals. See
+    /// [`signals_maybe_pending`].
+    pub maybe_pending_signals: AtomicBool,
+
     pub protected: RootedRefCell<ThreadShmemProtected>,
 }
 assert_shmem_safe!(ThreadShmem, _test_threadshmem_fn);
@@ -307,6 +509,8 @@ impl ThreadShmem {
         Self {
             host_id: host.host_id,
             tid,
+            shim_log: ShimLogRing::new(),
+            maybe_pending_signals: AtomicBool::new(false),
             protected: RootedRefCell::new(
                 &host.root,
                 ThreadShmemProtected {
@@ -320,6 +524,8 @@ impl ThreadShmem {
                         ss_flags: libc::SS_DISABLE,
                         ss_size: 0,
                     }),
+                    random_bytes: [0; RANDOM_BYTES_LEN],
+                    random_bytes_remaining: 0,
                 },
             ),
         }
@@ -328,10 +534,16 @@ impl ThreadShmem {
     /// Create a copy of `Self`. We can't implement the `Clone` trait since we
     /// need the `root`.
     pub fn clone(&self, root: &Root) -> Self {
+        let mut protected = *self.protected.borrow(root);
+        // the copy mustn't return the same random bytes
+        protected.random_bytes_remaining = 0;
         Self {
             host_id: self.host_id,
             tid: self.tid,
-            protected: RootedRefCell::new(root, *self.protected.borrow(root)),
+            // the caller drains the original's records
+            shim_log: ShimLogRing::new(),
+            maybe_pending_signals: AtomicBool::new(!protected.pending_signals.is_empty()),
+            protected: RootedRefCell::new(root, protected),
         }
     }
 }
@@ -357,8 +569,16 @@ pub struct ThreadShmemProtected {
 
     // Configured alternate signal stack for this thread.
     sigaltstack: StackWrapper,
+
+    // Random bytes from the host's random source that the shim can return without asking Shadow.
+    // The unused bytes are the last `random_bytes_remaining` bytes.
+    random_bytes: [u8; RANDOM_BYTES_LEN],
+    random_bytes_remaining: usize,
 }
 
+/// The number of random bytes in [`ThreadShmemProtected`].
+pub const RANDOM_BYTES_LEN: usize = 4096;
+
 impl ThreadShmemProtected {
     pub fn pending_standard_siginfo(&self, signal: Signal) -> Option<&siginfo_t> {
         if self.pending_signals.has(signal) {
@@ -390,6 +610,25 @@ impl ThreadShmemProtected {
         &mut self.sigaltstack.0
     }
 
+    /// Copy `buf.len()` unused random bytes to `buf`. Returns `false` without copying any if
+    /// there aren't enough.
+    pub fn take_random_bytes(&mut self, buf: &mut [u8]) -> bool {
+        if buf.len() > self.random_bytes_remaining {
+            return false;
+        }
+        let start = RANDOM_BYTES_LEN - self.random_bytes_remaining;
+        buf.copy_from_slice(&self.random_bytes[start..][..buf.len()]);
+        self.random_bytes_remaining -= buf.len();
+        true
+    }
+
+    /// Replace the used random bytes using `fill`.
+    pub fn refill_random_bytes(&mut self, fill: impl FnOnce(&mut [u8])) {
+        let used = RANDOM_BYTES_LEN - self.random_bytes_remaining;
+        fill(&mut self.random_bytes[..used]);
+        self.random_bytes_remaining = RANDOM_BYTES_LEN;
+    }
+
     pub fn take_pending_unblocked_signal(&mut self) -> Option<(Signal, siginfo_t)> {
         let pending_unblocked_signals = self.pending_signals & !self.blocked_signals;
         if pending_unblocked_signals.is_empty() {
@@ -415,6 +654,42 @@ unsafe impl Send for StackWrapper {}
 // except from the original virtual address space: in the shim.
 unsafe impl VirtualAddressSpaceIndependent for StackWrapper {}
 
+/// Whether the thread may have a pending thread- or process-directed signal, without taking the
+/// host lock. Whoever adds a signal to a pending signal set must also set the corresponding
+/// `maybe_pending_signals` flag, and the flags are only cleared by
+/// [`clear_maybe_pending_signals`], so if this returns false there are no pending signals.
+pub fn signals_maybe_pending(process: &ProcessShmem, thread: &ThreadShmem) -> bool {
+    thread.maybe_pending_signals.load(Ordering::Relaxed)
+        || process.maybe_pending_signals.load(Ordering::Relaxed)
+}
+
+/// Clear the `maybe_pending_signals` flags of the thread and process if they have no pending
+/// signals.
+pub fn clear_maybe_pending_signals(
+    lock: &HostShmemProtected,
+    process: &ProcessShmem,
+    thread: &ThreadShmem,
+) {
+    if thread
+        .protected
+        .borrow(&lock.root)
+        .pending_signals
+        .is_empty()
+    {
+        thread.maybe_pending_signals.store(false, Ordering::Relaxed);
+    }
+    if process
+        .protected
+        .borrow(&lock.root)
+        .pending_signals
+        .is_empty()
+    {
+        process
+            .maybe_pending_signals
+            .store(false, Ordering::Relaxed);
+    }
+}
+
 /// Take the next unblocked thread- *or* process-directed signal.
 pub fn take_pending_unblocked_signal(
     lock: &HostShmemProtected,
@@ -510,6 +785,20 @@ pub mod export {
         host_mem.shim_log_level
     }
 
+    /// Whether any futex on the host may have waiters, in which case futex wakes must be handled
+    /// by Shadow.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn shimshmem_hasFutexWaiters(
+        host_mem: *const ShimShmemHost,
+    ) -> bool {
+        let host_mem = unsafe { host_mem.as_ref().unwrap() };
+        host_mem.futex_waiters.load(Ordering::Relaxed)
+    }
+
     /// # Safety
     ///
     /// Pointer args must be safely dereferenceable.
@@ -558,6 +847,28 @@ pub mod export {
         host_mem.max_runahead_time = EmulatedTime::from_c_emutime(t).unwrap();
     }
 
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn shimshmem_getUtsname(
+        host: *const ShimShmemHost,
+    ) -> *const linux_api::utsname::linux_new_utsname {
+        let host = unsafe { host.as_ref().unwrap() };
+        &host.utsname
+    }
+
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn shimshmem_getProcessId(
+        process: *const ShimShmemProcess,
+    ) -> libc::pid_t {
+        let process_mem = unsafe { process.as_ref().unwrap() };
+        process_mem.pid
+    }
+
     /// # Safety
     ///
     /// Pointer args must be safely dereferenceable.
@@ -569,6 +880,71 @@ pub mod export {
         process_mem.strace_fd.unwrap_or(-1)
     }
 
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn shimshmem_getNumNativeSyscalls(
+        process: *const ShimShmemProcess,
+    ) -> usize {
+        let process_mem = unsafe { process.as_ref().unwrap() };
+        process_mem.num_native_syscalls
+    }
+
+    /// Get the native fd that the shim should do the I/O of `fd` on, or -1 if the syscall
+    /// should be handled by Shadow.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn shimshmem_getNativeFile(
+        process: *const ShimShmemProcess,
+        fd: libc::c_int,
+    ) -> libc::c_int {
+        let process_mem = unsafe { process.as_ref().unwrap() };
+        let Ok(fd) = u32::try_from(fd) else {
+            return -1;
+        };
+        match process_mem.local_file(fd) {
+            Some(LocalFile::Native(native_fd)) => native_fd,
+            _ => -1,
+        }
+    }
+
+    /// Whether the shim should serve reads of `fd` from the thread's random bytes.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn shimshmem_isRandomFile(
+        process: *const ShimShmemProcess,
+        fd: libc::c_int,
+    ) -> bool {
+        let process_mem = unsafe { process.as_ref().unwrap() };
+        let Ok(fd) = u32::try_from(fd) else {
+            return false;
+        };
+        process_mem.local_file(fd) == Some(LocalFile::Random)
+    }
+
+    /// Get the syscall number at `index` of the syscalls that the process is allowed to make
+    /// natively. `index` must be less than `shimshmem_getNumNativeSyscalls()`.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn shimshmem_getNativeSyscall(
+        process: *const ShimShmemProcess,
+        index: usize,
+    ) -> u32 {
+        let process_mem = unsafe { process.as_ref().unwrap() };
+        assert!(index < process_mem.num_native_syscalls);
+        process_mem.native_syscalls[index]
+    }
+
     /// # Safety
     ///
     /// Pointer args must be safely dereferenceable.
@@ -648,6 +1024,30 @@ pub mod export {
         protected.blocked_signals = sigset_t::wrap(s);
     }
 
+    /// Copy `len` of the thread's random bytes to `buf`. Returns `false` without copying any if
+    /// the thread doesn't have enough random bytes left.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable, and `buf` must be valid for `len` bytes.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn shimshmem_takeRandomBytes(
+        lock: *const ShimShmemHostLock,
+        thread: *const ShimShmemThread,
+        buf: *mut u8,
+        len: usize,
+    ) -> bool {
+        let thread_mem = unsafe { thread.as_ref().unwrap() };
+        let lock = unsafe { lock.as_ref().unwrap() };
+        let mut protected = thread_mem.protected.borrow_mut(&lock.root);
+        // leave empty reads to shadow, since `buf` may be null
+        if len == 0 || len > RANDOM_BYTES_LEN {
+            return false;
+        }
+        let buf = unsafe { core::slice::from_raw_parts_mut(buf, len) };
+        protected.take_random_bytes(buf)
+    }
+
     /// Get the signal stack as set by `sigaltstack(2)`.
     ///
     /// # Safety
@@ -780,4 +1180,83 @@ pub mod export {
         let manager = unsafe { manager.as_ref().unwrap() };
         manager.log_start_time_micros
     }
+
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn shimshmem_getUseLibcPatching(
+        manager: *const ShimShmemManager,
+    ) -> bool {
+        let manager = unsafe { manager.as_ref().unwrap() };
+        manager.use_libc_patching
+    }
+
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn shimshmem_getUseRdtscPatching(
+        manager: *const ShimShmemManager,
+    ) -> bool {
+        let manager = unsafe { manager.as_ref().unwrap() };
+        manager.use_rdtsc_patching
+    }
+
+    /// Get Shadow's descriptor for the memory file containing the table of host names, or -1.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn shimshmem_getDnsIndexFd(
+        manager: *const ShimShmemManager,
+    ) -> i32 {
+        let manager = unsafe { manager.as_ref().unwrap() };
+        manager.dns_index_fd
+    }
+
+    /// Get the length of the vDSO's mapping, or 0 if Shadow didn't find where to patch the vDSO.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn shimshmem_getVdsoLen(
+        manager: *const ShimShmemManager,
+    ) -> usize {
+        let manager = unsafe { manager.as_ref().unwrap() };
+        match &manager.vdso_patch_table {
+            FfiOption::Some(table) => table.len.try_into().unwrap(),
+            FfiOption::None => 0,
+        }
+    }
+
+    /// Get the offset and size of `function` in the vDSO. Returns false if Shadow didn't find
+    /// where to patch the vDSO or if the vDSO doesn't have the function.
+    ///
+    /// # Safety
+    ///
+    /// Pointer args must be safely dereferenceable.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn shimshmem_getVdsoSymbol(
+        manager: *const ShimShmemManager,
+        function: VdsoFunction,
+        offset: *mut usize,
+        size: *mut usize,
+    ) -> bool {
+        let manager = unsafe { manager.as_ref().unwrap() };
+        let FfiOption::Some(table) = &manager.vdso_patch_table else {
+            return false;
+        };
+
+        let symbol = table.symbols[function as usize];
+        if symbol.size == 0 {
+            return false;
+        }
+
+        unsafe { offset.write(symbol.offset.try_into().unwrap()) };
+        unsafe { size.write(symbol.size.try_into().unwrap()) };
+        true
+    }
 }
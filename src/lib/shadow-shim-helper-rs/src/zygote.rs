@@ -0,0 +1,31 @@
+//! Messages exchanged between Shadow and a zygote process.
+//!
+//! A zygote is a managed binary that Shadow starts with a unix seqpacket socket as its stdin. The
+//! shim in the zygote stops before initializing, and forks a new process for each
+//! [`ZygoteSpawnRequest`] it receives on the socket. The new process then initializes the shim as
+//! usual, using the IPC channel from the request. This avoids paying for `execve` and dynamic
+//! linking in every process that's spawned from the same binary, arguments, and environment.
+//!
+//! Each request is sent with an `SCM_RIGHTS` control message carrying the new process's log file,
+//! followed by its strace file if [`ZygoteSpawnRequest::strace_fd`] isn't -1.
+
+use shadow_shmem::allocator::ShMemBlockSerialized;
+
+#[derive(Copy, Clone, Debug)]
+#[repr(C)]
+pub struct ZygoteSpawnRequest {
+    /// The new process's IPC channel, which it would otherwise read from stdin.
+    pub ipc_block: ShMemBlockSerialized,
+    /// The descriptor number that the new process's strace file should have, or -1.
+    pub strace_fd: i32,
+}
+
+#[derive(Copy, Clone, Debug)]
+#[repr(C)]
+pub struct ZygoteSpawnReply {
+    /// The native pid of the new process, or a negated errno if it couldn't be forked.
+    pub pid: i32,
+}
+
+/// The maximum number of descriptors sent with a [`ZygoteSpawnRequest`].
+pub const ZYGOTE_MAX_FDS: usize = 2;
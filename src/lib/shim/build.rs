@@ -16,6 +16,7 @@ fn run_bindgen(build_common: &ShadowBuildCommon) {
         .header("shim_sys.h")
         .allowlist_function("shim_sys_get_simtime_nanos")
         .header("shim_syscall.h")
+        .header("shim_rdtsc.h")
         .header("shim_tls.h")
         // get libc types from libc crate
         .blocklist_type("addrinfo")
@@ -111,6 +112,7 @@ fn main() {
     build_common
         .cc_build()
         .files(&[
+            "patch_libc.c",
             "patch_vdso.c",
             "shim.c",
             "shim_api_addrinfo.c",
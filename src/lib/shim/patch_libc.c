@@ -0,0 +1,116 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+#include "lib/shim/patch_libc.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <link.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "lib/logger/logger.h"
+#include "lib/shim/patch_vdso.h"
+#include "lib/shim/shim_api.h"
+
+// Defines a replacement for the libc wrapper `fn_name` that passes its arguments
+// to the shim as syscall `syscall_name`. `shim_api_syscall` sets errno the same
+// way as the libc wrapper. Like the wrappers in preload-libc, these ignore
+// pthread cancellation points.
+#define REPLACEMENT(fn_name, syscall_name)                                                         \
+    static long _replacement_##fn_name(long a, long b, long c, long d, long e, long f) {           \
+        return shim_api_syscall(SYS_##syscall_name, a, b, c, d, e, f);                             \
+    }
+
+REPLACEMENT(read, read)
+REPLACEMENT(write, write)
+REPLACEMENT(readv, readv)
+REPLACEMENT(writev, writev)
+REPLACEMENT(pread64, pread64)
+REPLACEMENT(pwrite64, pwrite64)
+REPLACEMENT(close, close)
+REPLACEMENT(lseek, lseek)
+REPLACEMENT(sendto, sendto)
+REPLACEMENT(recvfrom, recvfrom)
+REPLACEMENT(sendmsg, sendmsg)
+REPLACEMENT(recvmsg, recvmsg)
+REPLACEMENT(poll, poll)
+REPLACEMENT(epoll_wait, epoll_wait)
+REPLACEMENT(sched_yield, sched_yield)
+
+// `syscall(2)` itself. Variadic arguments are passed in the same registers as
+// fixed arguments on x86-64, so this can take them as fixed arguments.
+static long _replacement_syscall(long n, long a, long b, long c, long d, long e, long f) {
+    return shim_api_syscall(n, a, b, c, d, e, f);
+}
+
+static void _patch_symbol(void* libc, const char* fnName, void* replacementFn) {
+    void* start = dlsym(libc, fnName);
+    if (start == NULL) {
+        warning("Couldn't find libc symbol '%s' to override", fnName);
+        return;
+    }
+
+    // Get the symbol's size, so that we don't overwrite the following function.
+    Dl_info info;
+    const ElfW(Sym)* symbol = NULL;
+    if (dladdr1(start, &info, (void**)&symbol, RTLD_DL_SYMENT) == 0 || symbol == NULL) {
+        warning("Couldn't find the size of libc symbol '%s'", fnName);
+        return;
+    }
+
+    // The trampoline is at most a few bytes, but may cross a page boundary.
+    const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    void* pageStart = (void*)((uintptr_t)start & ~(pageSize - 1));
+    size_t regionSize = (uintptr_t)start + symbol->st_size - (uintptr_t)pageStart;
+
+    if (mprotect(pageStart, regionSize, PROT_READ | PROT_WRITE | PROT_EXEC)) {
+        panic("mprotect: %s", strerror(errno));
+    }
+
+    size_t trampolineSize = patch_inject_trampoline(start, symbol->st_size, replacementFn);
+
+    if (mprotect(pageStart, regionSize, PROT_READ | PROT_EXEC)) {
+        panic("mprotect: %s", strerror(errno));
+    }
+
+    if (trampolineSize == 0) {
+        // Calls to this function will still be trapped by the seccomp filter.
+        warning("Couldn't patch libc symbol '%s'", fnName);
+        return;
+    }
+
+    trace("Patched libc symbol '%s' at %p", fnName, start);
+}
+
+void patch_libc() {
+    void* libc = dlopen("libc.so.6", RTLD_LAZY | RTLD_NOLOAD);
+    if (libc == NULL) {
+        // e.g. the program uses a different C library.
+        warning("Couldn't find libc to patch: %s", dlerror());
+        return;
+    }
+
+    _patch_symbol(libc, "read", _replacement_read);
+    _patch_symbol(libc, "write", _replacement_write);
+    _patch_symbol(libc, "readv", _replacement_readv);
+    _patch_symbol(libc, "writev", _replacement_writev);
+    _patch_symbol(libc, "pread64", _replacement_pread64);
+    _patch_symbol(libc, "pwrite64", _replacement_pwrite64);
+    _patch_symbol(libc, "close", _replacement_close);
+    _patch_symbol(libc, "lseek", _replacement_lseek);
+    _patch_symbol(libc, "sendto", _replacement_sendto);
+    _patch_symbol(libc, "recvfrom", _replacement_recvfrom);
+    _patch_symbol(libc, "sendmsg", _replacement_sendmsg);
+    _patch_symbol(libc, "recvmsg", _replacement_recvmsg);
+    _patch_symbol(libc, "poll", _replacement_poll);
+    _patch_symbol(libc, "epoll_wait", _replacement_epoll_wait);
+    _patch_symbol(libc, "sched_yield", _replacement_sched_yield);
+    _patch_symbol(libc, "syscall", _replacement_syscall);
+
+    dlclose(libc);
+}
@@ -0,0 +1,10 @@
+#ifndef SHIM_PATCH_LIBC_H
+#define SHIM_PATCH_LIBC_H
+
+// Hot-patch frequently used syscall wrapper functions in the running program's
+// libc to call into the shim directly. Unlike preloading, this also catches
+// calls that libc makes to its own wrappers internally (e.g. `fwrite` calling
+// `write`), which would otherwise be trapped by the seccomp filter.
+void patch_libc();
+
+#endif
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <elf.h>
 #include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,6 +10,8 @@
 #include <unistd.h>
 
 #include "lib/logger/logger.h"
+#include "lib/shim/patch_vdso.h"
+#include "lib/shim/shim.h"
 
 static void _getVdsoBounds(void** start, void** end) {
     assert(start);
@@ -218,6 +221,21 @@ static size_t _inject_trampoline_absolute(void* start, size_t symbolSize, void*
     return actualTrampolineSize;
 }
 
+static void _patch_symbol(uint8_t* start, size_t symbolSize, void* replacementFn,
+                          const char* vdsoFnName) {
+    size_t actualTrampolineSize = patch_inject_trampoline(start, symbolSize, replacementFn);
+    if (actualTrampolineSize == 0) {
+        // TODO: Make make this a warning or error when shim-side logs are more visible.
+        panic("Couldn't patch symbol '%s'", vdsoFnName);
+    }
+
+    // Validate that we didn't actually clobber another symbol.
+    if (symbolSize < actualTrampolineSize) {
+        panic("Accidentally wrote %zd byte trampoline into %zd byte symbol %s",
+              actualTrampolineSize, symbolSize, vdsoFnName);
+    }
+}
+
 static void _inject_trampoline(struct ParsedElf* parsedElf, const char* vdsoFnName,
                                void* replacementFn) {
     const Elf64_Sym* symbol = _findSymbol(parsedElf, vdsoFnName);
@@ -228,11 +246,13 @@ static void _inject_trampoline(struct ParsedElf* parsedElf, const char* vdsoFnNa
     }
 
     uint8_t* start = (void*)parsedElf->hdr + symbol->st_value;
+    _patch_symbol(start, symbol->st_size, replacementFn, vdsoFnName);
+}
 
-    size_t actualTrampolineSize =
-        _inject_trampoline_relative(start, symbol->st_size, replacementFn);
+size_t patch_inject_trampoline(void* start, size_t symbolSize, void* replacementFn) {
+    size_t actualTrampolineSize = _inject_trampoline_relative(start, symbolSize, replacementFn);
     if (actualTrampolineSize == 0) {
-        actualTrampolineSize = _inject_trampoline_absolute(start, symbol->st_size, replacementFn);
+        actualTrampolineSize = _inject_trampoline_absolute(start, symbolSize, replacementFn);
     }
     // TODO: Some other trampoline strategies if neither of the above work:
     //
@@ -243,33 +263,64 @@ static void _inject_trampoline(struct ParsedElf* parsedElf, const char* vdsoFnNa
     //   SIGILL; we could get control in the SIGILL signal handler and figure out
     //   which patched function we're trying to execute by inspecting the
     //   instruction pointer in the siginfo_t.
-
-    if (actualTrampolineSize == 0) {
-        // TODO: Make make this a warning or error when shim-side logs are more visible.
-        panic("Couldn't patch symbol '%s'", vdsoFnName);
-    }
-
-    // Validate that we didn't actually clobber another symbol.
-    if (symbol->st_size < actualTrampolineSize) {
-        panic("Accidentally wrote %zd byte trampoline into %zd byte symbol %s",
-              actualTrampolineSize, symbol->st_size, vdsoFnName);
-    }
+    return actualTrampolineSize;
 }
 
+// The vDSO functions to replace.
+static const struct {
+    VdsoFunction function;
+    const char* name;
+    void* replacementFn;
+} _patches[] = {
+    {VDSO_FUNCTION_GETTIMEOFDAY, "__vdso_gettimeofday", _replacement_gettimeofday},
+    {VDSO_FUNCTION_TIME, "__vdso_time", _replacement_time},
+    {VDSO_FUNCTION_CLOCK_GETTIME, "__vdso_clock_gettime", _replacement_clock_gettime},
+    {VDSO_FUNCTION_GETCPU, "__vdso_getcpu", _replacement_getcpu},
+};
+
 void patch_vdso(void* vdsoBase) {
-    struct ParsedElf parsedElf = _parseElf(vdsoBase);
-    size_t regionSize = (size_t)parsedElf.mapEnd - (size_t)parsedElf.mapStart;
+    const ShimShmemManager* manager = shim_managerSharedMem();
+    const size_t numPatches = sizeof(_patches) / sizeof(_patches[0]);
+
+    // Shadow normally found where to patch the vDSO in its own vDSO, which is the same as ours.
+    // Otherwise we need to find the vDSO's mapping and symbols ourselves.
+    size_t regionSize = shimshmem_getVdsoLen(manager);
+    const bool useTable = regionSize != 0;
+    void* regionStart = vdsoBase;
+    struct ParsedElf parsedElf = {0};
+    if (!useTable) {
+        parsedElf = _parseElf(vdsoBase);
+        regionStart = (void*)parsedElf.mapStart;
+        regionSize = (size_t)parsedElf.mapEnd - (size_t)parsedElf.mapStart;
+    } else {
+        _checkIdentByte(((const Elf64_Ehdr*)vdsoBase)->e_ident, EI_MAG0, ELFMAG0);
+        _checkIdentByte(((const Elf64_Ehdr*)vdsoBase)->e_ident, EI_MAG1, ELFMAG1);
+        _checkIdentByte(((const Elf64_Ehdr*)vdsoBase)->e_ident, EI_MAG2, ELFMAG2);
+        _checkIdentByte(((const Elf64_Ehdr*)vdsoBase)->e_ident, EI_MAG3, ELFMAG3);
+    }
 
-    if (mprotect((void*)parsedElf.mapStart, regionSize, PROT_READ | PROT_WRITE | PROT_EXEC)) {
+    if (mprotect(regionStart, regionSize, PROT_READ | PROT_WRITE | PROT_EXEC)) {
         panic("mprotect: %s", strerror(errno));
     }
 
-    _inject_trampoline(&parsedElf, "__vdso_gettimeofday", _replacement_gettimeofday);
-    _inject_trampoline(&parsedElf, "__vdso_time", _replacement_time);
-    _inject_trampoline(&parsedElf, "__vdso_clock_gettime", _replacement_clock_gettime);
-    _inject_trampoline(&parsedElf, "__vdso_getcpu", _replacement_getcpu);
+    for (size_t i = 0; i < numPatches; i++) {
+        if (!useTable) {
+            _inject_trampoline(&parsedElf, _patches[i].name, _patches[i].replacementFn);
+            continue;
+        }
 
-    if (mprotect((void*)parsedElf.mapStart, regionSize, PROT_READ | PROT_EXEC)) {
+        size_t offset;
+        size_t size;
+        if (!shimshmem_getVdsoSymbol(manager, _patches[i].function, &offset, &size)) {
+            // This could happen e.g. if vdso is disabled at the system level.
+            warning("Couldn't find symbol '%s' to override", _patches[i].name);
+            continue;
+        }
+        _patch_symbol((uint8_t*)vdsoBase + offset, size, _patches[i].replacementFn,
+                      _patches[i].name);
+    }
+
+    if (mprotect(regionStart, regionSize, PROT_READ | PROT_EXEC)) {
         panic("mprotect: %s", strerror(errno));
     }
-}
\ No newline at end of file
+}
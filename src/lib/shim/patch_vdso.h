@@ -1,8 +1,15 @@
 #ifndef SHIM_PATCH_VDSO_H
 #define SHIM_PATCH_VDSO_H
 
+#include <stddef.h>
+
 // Hot-patch VDSO functions in the current-running programming to call the
 // `syscall(2)` function, which can be intercepted via LD_PRELOAD. 
 void patch_vdso(void* vdsoBase);
 
+// Overwrite the start of a `symbolSize`-byte function at `start` with a jump
+// to `replacementFn`. `start` must already be writable. Returns the number of
+// bytes written, or 0 if the function is too small for any trampoline.
+size_t patch_inject_trampoline(void* start, size_t symbolSize, void* replacementFn);
+
 #endif
\ No newline at end of file
@@ -22,6 +22,7 @@
 #include "lib/log-c2rust/rustlogger.h"
 #include "lib/logger/logger.h"
 #include "lib/shadow-shim-helper-rs/shim_helper.h"
+#include "lib/shim/patch_libc.h"
 #include "lib/shim/patch_vdso.h"
 #include "lib/shim/shim_api.h"
 #include "lib/shim/shim_rdtsc.h"
@@ -105,6 +106,12 @@ static void _shim_parent_init_memory_manager() {
     }
 }
 
+static void _shim_parent_init_libc_patching() {
+    if (shimshmem_getUseLibcPatching(shim_managerSharedMem())) {
+        patch_libc();
+    }
+}
+
 static void _shim_parent_init_seccomp() {
     shim_seccomp_init();
 }
@@ -122,10 +129,12 @@ void _shim_parent_init_preload() {
     _shim_ipc_wait_for_start_event();
 
     shim_install_hardware_error_handlers();
-    patch_vdso((void*)getauxval(AT_SYSINFO_EHDR));
     _shim_parent_init_host_shm();
     _shim_parent_init_manager_shm();
+    // uses the patch table in the manager's shared memory
+    patch_vdso((void*)getauxval(AT_SYSINFO_EHDR));
     _shim_parent_init_logging();
+    _shim_parent_init_libc_patching();
     _shim_init_signal_stack();
     _shim_init_death_signal();
     _shim_parent_init_memory_manager();
@@ -140,9 +149,11 @@ void _shim_child_thread_init_preload() {
         panic("Unexpectedly called from non-shadow context");
     }
 
-    _shim_preload_only_child_ipc_wait_for_start_event();
+    // The thread's shared memory was already set from the clone request.
+    _shim_preload_only_child_ipc_wait_for_start_res();
 
     _shim_init_signal_stack();
+    shim_rdtsc_init_thread();
 }
 
 void _shim_child_process_init_preload() {
@@ -16,7 +16,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -144,8 +146,9 @@ static void _getaddrinfo_appendv4(struct addrinfo** head, struct addrinfo** tail
 static void _getaddrinfo_add_matching_hosts_ipv4(struct addrinfo** head, struct addrinfo** tail,
                                                  const char* node, bool add_tcp, bool add_udp,
                                                  bool add_raw, in_port_t port) {
-    // TODO: Parse hosts file once and keep it in an efficiently-searchable
-    // in-memory format.
+    // This is only a fallback for names that shadow couldn't resolve (simulated
+    // host names are found in shadow's DNS index), so we don't bother parsing the
+    // file into a searchable format.
     GError* error = NULL;
     gchar* hosts = NULL;
     char* pattern = NULL;
@@ -218,6 +221,51 @@ out:
         g_free(hosts);
 }
 
+// Shadow's index of the simulated host names (see `dns_index.rs`), mapped read-only into this
+// process the first time that it's needed. The mapping is never unmapped, and is inherited by forked
+// children. NULL if there's no index or it couldn't be mapped.
+static const uint8_t* _dns_index = NULL;
+static size_t _dns_index_len = 0;
+
+static void _shim_api_map_dns_index() {
+    static gsize initialized = 0;
+    if (!g_once_init_enter(&initialized)) {
+        return;
+    }
+
+    int index_fd = shimshmem_getDnsIndexFd(shim_managerSharedMem());
+    if (index_fd < 0) {
+        goto out;
+    }
+
+    // Open the index through shadow's descriptor, as we do for mmap.
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fd/%d", shimshmem_getShadowPid(shim_hostSharedMem()),
+             index_fd);
+    long fd = shim_native_syscall(NULL, SYS_openat, AT_FDCWD, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        warning("Couldn't open the DNS index at %s: %s", path, strerror(-fd));
+        goto out;
+    }
+
+    struct stat st = {0};
+    long rv = shim_native_syscall(NULL, SYS_fstat, fd, &st);
+    if (rv == 0 && st.st_size > 0) {
+        long ptr =
+            shim_native_syscall(NULL, SYS_mmap, NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (ptr < 0) {
+            warning("Couldn't map the DNS index: %s", strerror(-ptr));
+        } else {
+            _dns_index = (const uint8_t*)ptr;
+            _dns_index_len = st.st_size;
+        }
+    }
+    shim_native_syscall(NULL, SYS_close, fd);
+
+out:
+    g_once_init_leave(&initialized, 1);
+}
+
 // Ask shadow to provide an ipv4 addr for a node using a custom syscall.
 // Returns true if we got a valid address from shadow, false otherwise.
 static bool _shim_api_hostname_to_addr_ipv4(const char* node, uint32_t* addr) {
@@ -233,6 +281,13 @@ static bool _shim_api_hostname_to_addr_ipv4(const char* node, uint32_t* addr) {
         return true;
     }
 
+    // Simulated host names are usually in shadow's index, which we can search without a syscall.
+    _shim_api_map_dns_index();
+    if (_dns_index != NULL && dnsindex_lookupIpv4(_dns_index, _dns_index_len, node, addr)) {
+        trace("found name %s in the DNS index", node);
+        return true;
+    }
+
     // Resolve the hostname (find the ipv4 `addr` associated with hostname `name`) using a custom
     // syscall that Shadow handles internally. We want to execute natively in ptrace mode so ptrace
     // can intercept it, but we want to send to Shadow through shmem in preload mode. Let
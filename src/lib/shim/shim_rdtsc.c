@@ -3,9 +3,13 @@
  * See LICENSE for licensing information
  */
 
+#include <cpuid.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
 #include <sys/ucontext.h>
@@ -39,16 +43,339 @@ static uint64_t _shim_rdtsc_nanos(ExecutionContext ctx) {
     return (uint64_t)t.tv_nsec + (uint64_t)t.tv_sec * 1000000000;
 }
 
+static bool _tsc_initd = false;
+static Tsc _tsc;
+
+static Tsc* _shim_rdtsc_tsc() {
+    if (!_tsc_initd) {
+        trace("Initializing tsc");
+        _tsc = Tsc_create(shimshmem_getTscHz(shim_hostSharedMem()));
+        _tsc_initd = true;
+    }
+    return &_tsc;
+}
+
+// Whether to rewrite recognized rdtsc sites, and the size of the buffer that
+// `_shim_rdtsc_stub` needs for `xsave`. Set once in `shim_rdtsc_init`.
+static bool _patching_enabled = false;
+__attribute__((used)) static uint64_t _shim_rdtsc_xsave_size = 0;
+
+// `_shim_rdtsc_stub` runs on a per-thread stack owned by the shim rather than
+// on the application's stack, which may be too small for the xsave area and
+// the emulation code, or may not be a normal stack at all. The stack has a
+// guard page below it. `_shim_rdtsc_stack_top` is 0 for threads that don't
+// have one, in which case the stub falls back to the application's stack.
+//
+// The stub reads the variable directly through %fs, so it uses the
+// initial-exec model, which never calls `__tls_get_addr`.
+#define RDTSC_STACK_GUARD_SIZE 4096
+#define RDTSC_STACK_SIZE (128 * 1024)
+__attribute__((used, tls_model("initial-exec"))) static __thread uintptr_t _shim_rdtsc_stack_top =
+    0;
+
+// A site is only rewritten when the rdtsc or rdtscp is immediately followed by
+// `shl $0x20, %rdx`, which is what gcc and clang emit for `__rdtsc()` and
+// `__rdtscp()`. The rdtsc instruction alone is too short to hold a 5-byte jmp,
+// and the shl can be relocated into the trampoline as-is since it doesn't
+// refer to the instruction pointer. We assume nothing branches to the shl.
+static const unsigned char _shl_rdx_32[] = {0x48, 0xc1, 0xe2, 0x20};
+
+// Each trampoline skips the red zone, calls the stub through rax (which the
+// rdtsc overwrites anyway), runs the relocated shl, and jumps back to the
+// instruction after the rewritten sequence. The shl also recomputes the flags,
+// so the stub doesn't need to preserve them.
+static const unsigned char _trampoline_template[] = {
+    0x48, 0x8d, 0x64, 0x24, 0x80, // lea -0x80(%rsp), %rsp
+    0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, // movabs $stub, %rax
+    0xff, 0xd0, // call *%rax
+    0x48, 0x8d, 0xa4, 0x24, 0x80, 0x00, 0x00, 0x00, // lea 0x80(%rsp), %rsp
+    0x48, 0xc1, 0xe2, 0x20, // shl $0x20, %rdx
+    0xe9, 0, 0, 0, 0, // jmp <site + len>
+};
+#define TRAMPOLINE_STUB_OFFSET 7
+#define TRAMPOLINE_JMP_OFFSET 29
+#define TRAMPOLINE_SLOT_SIZE 64
+_Static_assert(sizeof(_trampoline_template) == TRAMPOLINE_JMP_OFFSET + 5, "template layout");
+_Static_assert(sizeof(_trampoline_template) <= TRAMPOLINE_SLOT_SIZE, "template size");
+
+// The emulated TSC value for a rewritten site. For rdtscp also stores the
+// emulated IA32_TSC_AUX in `*rcx`. Called by `_shim_rdtsc_stub` from the
+// application's context.
+__attribute__((used)) static uint64_t _shim_rdtsc_emulate_patched(bool rdtscp, uint64_t* rcx) {
+    ExecutionContext prev_ctx = shim_swapExecutionContext(EXECUTION_CONTEXT_SHADOW);
+    uint64_t nanos = _shim_rdtsc_nanos(prev_ctx);
+    uint64_t rax, rdx, rip = 0;
+    if (rdtscp) {
+        Tsc_emulateRdtscp(_shim_rdtsc_tsc(), &rax, &rdx, rcx, &rip, nanos);
+    } else {
+        Tsc_emulateRdtsc(_shim_rdtsc_tsc(), &rax, &rdx, &rip, nanos);
+    }
+    shim_swapExecutionContext(prev_ctx);
+    return (rdx << 32) | (uint32_t)rax;
+}
+
+__attribute__((visibility("hidden"))) void _shim_rdtsc_stub();
+__attribute__((visibility("hidden"))) void _shim_rdtscp_stub();
+
+#define STRINGIFY(x) #x
+#define XSTRINGIFY(x) STRINGIFY(x)
+
+// Called from a trampoline with a call instruction that could be anywhere in
+// the application's code, so this preserves every register other than the
+// ones that the replaced instruction writes: rax and rdx, and rcx for rdtscp.
+// The extended (x87/SSE/AVX) state is saved with xsave, since the C code (and
+// any libc functions it calls) may clobber it.
+//
+// Only the saved rbp goes on the application's stack. Everything else goes on
+// the thread's rdtsc stack, unless the stub is already running on it (e.g. from
+// a signal handler that ran during the emulation), in which case it stays
+// where it is.
+__asm__(".text\n"
+        ".globl _shim_rdtscp_stub\n"
+        ".hidden _shim_rdtscp_stub\n"
+        ".type _shim_rdtscp_stub, @function\n"
+        "_shim_rdtscp_stub:\n"
+        "    mov $1, %edx\n"
+        "    jmp 1f\n"
+        ".globl _shim_rdtsc_stub\n"
+        ".hidden _shim_rdtsc_stub\n"
+        ".type _shim_rdtsc_stub, @function\n"
+        "_shim_rdtsc_stub:\n"
+        "    xor %edx, %edx\n"
+        "1:\n"
+        "    push %rbp\n"
+        "    mov %rsp, %rbp\n"
+        // Without a thread pointer there's no thread-local storage to read.
+        "    mov %fs:0, %rax\n"
+        "    test %rax, %rax\n"
+        "    jz 3f\n"
+        "    mov _shim_rdtsc_stack_top@gottpoff(%rip), %rax\n"
+        "    mov %fs:(%rax), %rax\n"
+        "    test %rax, %rax\n"
+        "    jz 3f\n"
+        "    cmp %rax, %rsp\n"
+        "    ja 2f\n"
+        "    sub $" XSTRINGIFY(RDTSC_STACK_SIZE) ", %rax\n"
+        "    cmp %rax, %rsp\n"
+        "    ja 3f\n"
+        "    add $" XSTRINGIFY(RDTSC_STACK_SIZE) ", %rax\n"
+        "2:\n"
+        "    mov %rax, %rsp\n"
+        "3:\n"
+        "    push %rcx\n"
+        "    push %rsi\n"
+        "    push %rdi\n"
+        "    push %r8\n"
+        "    push %r9\n"
+        "    push %r10\n"
+        "    push %r11\n"
+        "    push %rbx\n"
+        "    mov %rsp, %rbx\n"
+        "    mov %edx, %edi\n"
+        "    sub _shim_rdtsc_xsave_size(%rip), %rsp\n"
+        "    and $-64, %rsp\n"
+        // xrstor requires the reserved bytes of the xsave header to be zero.
+        "    xor %eax, %eax\n"
+        "    mov %rax, 512(%rsp)\n"
+        "    mov %rax, 520(%rsp)\n"
+        "    mov %rax, 528(%rsp)\n"
+        "    mov %rax, 536(%rsp)\n"
+        "    mov %rax, 544(%rsp)\n"
+        "    mov %rax, 552(%rsp)\n"
+        "    mov %rax, 560(%rsp)\n"
+        "    mov %rax, 568(%rsp)\n"
+        "    mov $-1, %eax\n"
+        "    mov $-1, %edx\n"
+        "    xsave64 (%rsp)\n"
+        // rdtscp writes its rcx result to the saved rcx, which is restored below.
+        "    lea 56(%rbx), %rsi\n"
+        "    call _shim_rdtsc_emulate_patched\n"
+        "    mov %rax, %r8\n"
+        "    mov $-1, %eax\n"
+        "    mov $-1, %edx\n"
+        "    xrstor64 (%rsp)\n"
+        "    mov %r8, %rax\n"
+        "    mov %rax, %rdx\n"
+        "    shr $32, %rdx\n"
+        "    mov %eax, %eax\n"
+        "    mov %rbx, %rsp\n"
+        "    pop %rbx\n"
+        "    pop %r11\n"
+        "    pop %r10\n"
+        "    pop %r9\n"
+        "    pop %r8\n"
+        "    pop %rdi\n"
+        "    pop %rsi\n"
+        "    pop %rcx\n"
+        "    mov %rbp, %rsp\n"
+        "    pop %rbp\n"
+        "    ret\n");
+
+static bool _shim_rdtsc_has_thread_pointer() {
+    uintptr_t fs;
+    __asm__("mov %%fs:0, %0" : "=r"(fs));
+    return fs != 0;
+}
+
+void shim_rdtsc_init_thread() {
+    if (!_patching_enabled || !_shim_rdtsc_has_thread_pointer() || _shim_rdtsc_stack_top != 0) {
+        return;
+    }
+
+    size_t size = RDTSC_STACK_GUARD_SIZE + RDTSC_STACK_SIZE;
+    long addr = shim_native_syscall(NULL, SYS_mmap, NULL, size, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr < 0 && addr > -4096) {
+        warning("Couldn't allocate rdtsc stack: %s", strerror(-addr));
+        return;
+    }
+    long rv = shim_native_syscall(NULL, SYS_mprotect, addr, RDTSC_STACK_GUARD_SIZE, PROT_NONE);
+    if (rv != 0) {
+        panic("mprotect: %s", strerror(-rv));
+    }
+    _shim_rdtsc_stack_top = (uintptr_t)addr + size;
+}
+
+void shim_rdtsc_free_thread() {
+    if (!_shim_rdtsc_has_thread_pointer() || _shim_rdtsc_stack_top == 0) {
+        return;
+    }
+
+    size_t size = RDTSC_STACK_GUARD_SIZE + RDTSC_STACK_SIZE;
+    shim_native_syscall(NULL, SYS_munmap, _shim_rdtsc_stack_top - size, size);
+    _shim_rdtsc_stack_top = 0;
+}
+
+#define TRAMPOLINE_PAGE_SIZE 4096
+
+static bool _fits_rel32(uintptr_t from, uintptr_t to) {
+    int64_t offset = (int64_t)(to - from);
+    return offset >= INT32_MIN && offset <= INT32_MAX;
+}
+
+// Whether every address in the page is reachable from `site` with a rel32
+// displacement, and vice-versa.
+static bool _page_is_near(uintptr_t site, uintptr_t page) {
+    return _fits_rel32(site, page) && _fits_rel32(site, page + TRAMPOLINE_PAGE_SIZE) &&
+           _fits_rel32(page, site) && _fits_rel32(page + TRAMPOLINE_PAGE_SIZE, site);
+}
+
+// Write to our own memory through /proc/self/mem, which (like ptrace) ignores
+// the page protections. This avoids having to mprotect the application's code,
+// whose original protections we don't know. The file is reopened for every
+// write since a forked child would otherwise write to its parent's memory.
+static bool _shim_rdtsc_write_code(uintptr_t addr, const void* buf, size_t len) {
+    long fd =
+        shim_native_syscall(NULL, SYS_openat, AT_FDCWD, "/proc/self/mem", O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        warning("Couldn't open /proc/self/mem: %s", strerror(-fd));
+        return false;
+    }
+    long rv = shim_native_syscall(NULL, SYS_pwrite64, fd, buf, len, addr);
+    shim_native_syscall(NULL, SYS_close, fd);
+    if (rv != (long)len) {
+        warning("Couldn't write code at %p: %s", (void*)addr, rv < 0 ? strerror(-rv) : "short write");
+        return false;
+    }
+    return true;
+}
+
+// Returns a trampoline slot that is reachable from `site` with a rel32 jmp
+// (and vice-versa), or NULL. Slots are carved from executable pages mapped
+// near the sites that use them, and are never freed.
+static uintptr_t _shim_rdtsc_alloc_trampoline(uintptr_t site) {
+    static uintptr_t page = 0;
+    static size_t used = 0;
+
+    if (page != 0 && used + TRAMPOLINE_SLOT_SIZE <= TRAMPOLINE_PAGE_SIZE && _page_is_near(site, page)) {
+        uintptr_t slot = page + used;
+        used += TRAMPOLINE_SLOT_SIZE;
+        return slot;
+    }
+
+    // Try addresses at increasing distances on either side of the site. The
+    // kernel rejects a hint that overlaps an existing mapping (or ignores it,
+    // before linux 4.17), so the result is checked either way.
+    const uintptr_t step = 64 << 20;
+    uintptr_t site_page = site & ~(uintptr_t)(TRAMPOLINE_PAGE_SIZE - 1);
+    for (int i = 1; i <= 16; i++) {
+        for (int dir = -1; dir <= 1; dir += 2) {
+            uintptr_t delta = (uintptr_t)i * step;
+            if (dir < 0 && site_page < delta) {
+                continue;
+            }
+            uintptr_t hint = dir < 0 ? site_page - delta : site_page + delta;
+            long rv = shim_native_syscall(NULL, SYS_mmap, hint, TRAMPOLINE_PAGE_SIZE, PROT_READ | PROT_EXEC,
+                                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+            if (rv < 0 && rv > -4096) {
+                continue;
+            }
+            uintptr_t addr = (uintptr_t)rv;
+            if (!_page_is_near(site, addr)) {
+                shim_native_syscall(NULL, SYS_munmap, addr, TRAMPOLINE_PAGE_SIZE);
+                continue;
+            }
+            page = addr;
+            used = TRAMPOLINE_SLOT_SIZE;
+            return addr;
+        }
+    }
+
+    return 0;
+}
+
+// Rewrite the rdtsc (or rdtscp) at `insn` to jump to a new trampoline, if the
+// site is one we recognize. Returns whether the site was rewritten.
+static bool _shim_rdtsc_try_patch(unsigned char* insn, size_t insn_len, bool rdtscp) {
+    uintptr_t site = (uintptr_t)insn;
+    size_t len = insn_len + sizeof(_shl_rdx_32);
+
+    // Don't read past the end of the instruction's page, which might not be
+    // mapped, or rewrite a sequence that straddles two pages.
+    if ((site & (TRAMPOLINE_PAGE_SIZE - 1)) + len > TRAMPOLINE_PAGE_SIZE) {
+        return false;
+    }
+    if (memcmp(insn + insn_len, _shl_rdx_32, sizeof(_shl_rdx_32)) != 0) {
+        return false;
+    }
+
+    uintptr_t trampoline = _shim_rdtsc_alloc_trampoline(site);
+    if (trampoline == 0) {
+        trace("No trampoline reachable from rdtsc at %p", insn);
+        return false;
+    }
+
+    unsigned char code[sizeof(_trampoline_template)];
+    memcpy(code, _trampoline_template, sizeof(code));
+    uint64_t stub = (uint64_t)(rdtscp ? _shim_rdtscp_stub : _shim_rdtsc_stub);
+    memcpy(&code[TRAMPOLINE_STUB_OFFSET], &stub, sizeof(stub));
+    int32_t back = (int32_t)((site + len) - (trampoline + TRAMPOLINE_JMP_OFFSET + 5));
+    memcpy(&code[TRAMPOLINE_JMP_OFFSET + 1], &back, sizeof(back));
+    if (!_shim_rdtsc_write_code(trampoline, code, sizeof(code))) {
+        return false;
+    }
+
+    // The rest of the rewritten sequence is never executed; fill it with int3
+    // so that a branch into it fails loudly instead of running garbage.
+    unsigned char jmp[8];
+    memset(jmp, 0xcc, sizeof(jmp));
+    jmp[0] = 0xe9;
+    int32_t there = (int32_t)(trampoline - (site + 5));
+    memcpy(&jmp[1], &there, sizeof(there));
+    // Only one thread of a managed process runs at a time, so no other thread
+    // can be executing the sequence while it's rewritten.
+    if (!_shim_rdtsc_write_code(site, jmp, len)) {
+        return false;
+    }
+    trace("Rewrote %s at %p to use trampoline at %p", rdtscp ? "rdtscp" : "rdtsc", insn,
+          (void*)trampoline);
+    return true;
+}
+
 static void _shim_rdtsc_handle_sigsegv(int sig, siginfo_t* info, void* voidUcontext) {
     ExecutionContext prev_ctx = shim_swapExecutionContext(EXECUTION_CONTEXT_SHADOW);
     trace("Trapped sigsegv");
-    static bool tsc_initd = false;
-    static Tsc tsc;
-    if (!tsc_initd) {
-        trace("Initializing tsc");
-        tsc = Tsc_create(shimshmem_getTscHz(shim_hostSharedMem()));
-        tsc_initd = true;
-    }
+    Tsc* tsc = _shim_rdtsc_tsc();
 
     bool handled = false;
 
@@ -65,12 +392,18 @@ static void _shim_rdtsc_handle_sigsegv(int sig, siginfo_t* info, void* voidUcont
         ucontext_t* ctx = (ucontext_t*)(voidUcontext);
         greg_t* regs = ctx->uc_mcontext.gregs;
         unsigned char* insn = (unsigned char*)regs[REG_RIP];
-        if (isRdtsc(insn)) {
+        if (_patching_enabled && isRdtsc(insn) && _shim_rdtsc_try_patch(insn, 2, false)) {
+            // Leave the instruction pointer at the site, so that returning from
+            // the handler executes (and emulates) it through the trampoline.
+            handled = true;
+        } else if (_patching_enabled && isRdtscp(insn) && _shim_rdtsc_try_patch(insn, 3, true)) {
+            handled = true;
+        } else if (isRdtsc(insn)) {
             trace("Emulating rdtsc");
             uint64_t nanos = _shim_rdtsc_nanos(prev_ctx);
             uint64_t rax, rdx;
             uint64_t rip = regs[REG_RIP];
-            Tsc_emulateRdtsc(&tsc, &rax, &rdx, &rip, nanos);
+            Tsc_emulateRdtsc(tsc, &rax, &rdx, &rip, nanos);
             regs[REG_RDX] = rdx;
             regs[REG_RAX] = rax;
             regs[REG_RIP] = rip;
@@ -80,7 +413,7 @@ static void _shim_rdtsc_handle_sigsegv(int sig, siginfo_t* info, void* voidUcont
             uint64_t nanos = _shim_rdtsc_nanos(prev_ctx);
             uint64_t rax, rdx, rcx;
             uint64_t rip = regs[REG_RIP];
-            Tsc_emulateRdtscp(&tsc, &rax, &rdx, &rcx, &rip, nanos);
+            Tsc_emulateRdtscp(tsc, &rax, &rdx, &rcx, &rip, nanos);
             regs[REG_RDX] = rdx;
             regs[REG_RAX] = rax;
             regs[REG_RCX] = rcx;
@@ -97,7 +430,29 @@ static void _shim_rdtsc_handle_sigsegv(int sig, siginfo_t* info, void* voidUcont
     shim_swapExecutionContext(prev_ctx);
 }
 
+// Enables rewriting rdtsc sites if it's configured and the CPU supports xsave,
+// which the trampolines need to preserve the extended register state.
+static void _shim_rdtsc_init_patching() {
+    if (!shimshmem_getUseRdtscPatching(shim_managerSharedMem())) {
+        return;
+    }
+
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)) {
+        warning("xsave unsupported; not rewriting rdtsc sites");
+        return;
+    }
+    // ebx of leaf 0xd, subleaf 0 is the size of the xsave area for the
+    // features currently enabled in XCR0.
+    __cpuid_count(0xd, 0, eax, ebx, ecx, edx);
+    _shim_rdtsc_xsave_size = ebx;
+    _patching_enabled = true;
+}
+
 void shim_rdtsc_init() {
+    _shim_rdtsc_init_patching();
+    shim_rdtsc_init_thread();
+
     // Force a SEGV on any rdtsc or rdtscp instruction.
     if (prctl(PR_SET_TSC, PR_TSC_SIGSEGV) < 0) {
         panic("pctl: %s", strerror(errno));
@@ -9,4 +9,12 @@
 // Initialize a signal handler function for rdtsc and rdtscp instructions.
 void shim_rdtsc_init();
 
+// Allocate the calling thread's stack for running rewritten rdtsc sites, if
+// rewriting is enabled. Ok to call if the thread already has one.
+void shim_rdtsc_init_thread();
+
+// Free the calling thread's rdtsc stack, if it has one. The thread must not be
+// running on it.
+void shim_rdtsc_free_thread();
+
 #endif // SRC_LIB_SHIM_SHIM_RDTSC_H_
@@ -7,10 +7,12 @@
 #include <assert.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <link.h>
 #include <linux/filter.h>
 #include <linux/seccomp.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
@@ -19,6 +21,7 @@
 #include <unistd.h>
 
 #include "lib/logger/logger.h"
+#include "lib/shim/shim.h"
 #include "lib/shim/shim_syscall.h"
 #include "lib/shim/shim_tls.h"
 
@@ -68,41 +71,46 @@ static void _shim_seccomp_handle_sigsys(int sig, siginfo_t* info, void* voidUcon
     shim_swapExecutionContext(prev_ctx);
 }
 
-// TODO: dedupe this with `maps` parsing in `patch_vdso.c` and `proc_maps.rs`,
-// ideally into something that doesn't allocate or use libc.
-static void _getSectionContaining(const void* target, void** start, void** end) {
-    assert(start);
-    *start = NULL;
-    assert(end);
-    *end = NULL;
+struct SegmentSearch {
+    const void* target;
+    void* start;
+    void* end;
+};
 
-    FILE* maps = fopen("/proc/self/maps", "r");
+static int _findSegmentCallback(struct dl_phdr_info* info, size_t size, void* data) {
+    struct SegmentSearch* search = data;
+    const uintptr_t pageSize = getpagesize();
 
-    size_t n = 100;
-    // `line` has to be `malloc`'d for compatibility with `getline`, below.
-    char* line = malloc(n);
-
-    while (true) {
-        ssize_t rv = getline(&line, &n, maps);
-        if (rv < 0) {
-            break;
-        }
-        if (sscanf(line, "%p-%p", start, end) != 2) {
-            warning("Couldn't parse maps line: %s", line);
-            // Ensure both are still NULL.
-            *start = NULL;
-            *end = NULL;
-            // Might as well keep going and see if another line matches and parses.
+    for (size_t i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_LOAD) {
             continue;
         }
-        if (target >= *start && target < *end) {
-            // Success
-            break;
+
+        uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+        uintptr_t end = start + phdr->p_memsz;
+        if ((uintptr_t)search->target >= start && (uintptr_t)search->target < end) {
+            // The segment is mapped in whole pages.
+            search->start = (void*)(start & ~(pageSize - 1));
+            search->end = (void*)((end + pageSize - 1) & ~(pageSize - 1));
+            return 1;
         }
     }
 
-    free(line);
-    fclose(maps);
+    return 0;
+}
+
+// Find the mapped segment containing `target` from the program headers of the loaded objects,
+// rather than parsing `/proc/self/maps`, which is much slower for processes with many mappings.
+static void _getSectionContaining(const void* target, void** start, void** end) {
+    assert(start);
+    assert(end);
+
+    struct SegmentSearch search = {.target = target, .start = NULL, .end = NULL};
+    dl_iterate_phdr(_findSegmentCallback, &search);
+
+    *start = search.start;
+    *end = search.end;
 }
 
 void shim_seccomp_init() {
@@ -186,13 +194,16 @@ void shim_seccomp_init() {
      * version 5.11, though.
      * https://www.kernel.org/doc./html/latest/admin-guide/syscall-user-dispatch.html
      */
-    struct sock_filter filter[] = {
+    struct sock_filter prologue[] = {
         /* accumulator := syscall number */
         BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, nr)),
 
         /* Always allow sigreturn; otherwise we'd crash returning from our signal handler. */
         BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, SYS_rt_sigreturn, /*true-skip=*/0, /*false-skip=*/1),
         BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
+    };
+
+    struct sock_filter filter[] = {
 
     /* This block was intended to whitelist reads and writes to a socket
      * used to communicate with Shadow. It turns out to be unnecessary though,
@@ -269,9 +280,33 @@ void shim_seccomp_init() {
         /* Allow  */
         BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW),
     };
+
+    /* Allow syscalls that the process was configured to make natively, from
+     * any instruction pointer. Shadow would only tell the shim to run these
+     * natively anyway, so this skips trapping them and the round trip to Shadow.
+     * The accumulator still holds the syscall number from the prologue.
+     */
+    const size_t prologue_len = sizeof(prologue) / sizeof(prologue[0]);
+    const size_t filter_len = sizeof(filter) / sizeof(filter[0]);
+    const size_t num_native = shimshmem_getNumNativeSyscalls(shim_processSharedMem());
+    const size_t prog_len = prologue_len + 2 * num_native + filter_len;
+
+    struct sock_filter* prog_filter = malloc(prog_len * sizeof(*prog_filter));
+    memcpy(prog_filter, prologue, sizeof(prologue));
+    for (size_t i = 0; i < num_native; i++) {
+        uint32_t nr = shimshmem_getNativeSyscall(shim_processSharedMem(), i);
+        trace("Allowing native syscall %" PRIu32, nr);
+        prog_filter[prologue_len + 2 * i] =
+            (struct sock_filter)BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, nr, /*true-skip=*/0,
+                                         /*false-skip=*/1);
+        prog_filter[prologue_len + 2 * i + 1] =
+            (struct sock_filter)BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW);
+    }
+    memcpy(&prog_filter[prologue_len + 2 * num_native], filter, sizeof(filter));
+
     struct sock_fprog prog = {
-        .len = (unsigned short)(sizeof(filter) / sizeof(filter[0])),
-        .filter = filter,
+        .len = (unsigned short)prog_len,
+        .filter = prog_filter,
     };
 
     // Re SECCOMP_FILTER_FLAG_SPEC_ALLOW: Without this flag, installing a
@@ -283,4 +318,6 @@ void shim_seccomp_init() {
     if (syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_SPEC_ALLOW, &prog)) {
         panic("seccomp: %s", strerror(errno));
     }
+
+    free(prog_filter);
 }
@@ -5,6 +5,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <linux/futex.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -12,6 +13,7 @@
 #include <sys/param.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
+#include <sys/utsname.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -20,6 +22,7 @@
 #include "lib/shim/shim.h"
 #include "lib/shim/shim_api.h"
 #include "lib/shim/shim_sys.h"
+#include "lib/shim/shim_syscall.h"
 
 static CEmulatedTime _shim_sys_get_time() {
     const ShimShmemHost* mem = shim_hostSharedMem();
@@ -57,6 +60,42 @@ static CSimulationTime _shim_sys_latency_for_syscall(long n) {
     return shimshmem_unblockedSyscallLatency(shim_hostSharedMem());
 }
 
+// If the process does the I/O of the file that is the first argument of the syscall natively
+// (see the `use_native_file_io` option), do the syscall on the native fd for the file.
+static bool _shim_sys_native_file_io(long syscall_num, long* rv, va_list args) {
+    va_list args_copy;
+    va_copy(args_copy, args);
+    int fd = va_arg(args_copy, int);
+    long a1 = va_arg(args_copy, long);
+    long a2 = va_arg(args_copy, long);
+    long a3 = va_arg(args_copy, long);
+    long a4 = va_arg(args_copy, long);
+    long a5 = va_arg(args_copy, long);
+    va_end(args_copy);
+
+    int native_fd = shimshmem_getNativeFile(shim_processSharedMem(), fd);
+    if (native_fd < 0) {
+        return false;
+    }
+
+    *rv = shim_native_syscall(NULL, syscall_num, native_fd, a1, a2, a3, a4, a5);
+    return true;
+}
+
+// Copy `len` bytes from the thread's buffer of random bytes (see the `use_shim_random` option)
+// to `buf`, if it has enough left.
+static bool _shim_sys_random_bytes(void* buf, size_t len, long* rv) {
+    ShimShmemHostLock* host_lock = shimshmemhost_lock(shim_hostSharedMem());
+    bool taken = shimshmem_takeRandomBytes(host_lock, shim_threadSharedMem(), buf, len);
+    shimshmemhost_unlock(shim_hostSharedMem(), &host_lock);
+
+    if (!taken) {
+        return false;
+    }
+    *rv = len;
+    return true;
+}
+
 bool shim_sys_handle_syscall_locally(long syscall_num, long* rv, va_list args) {
     if (shim_getExecutionContext() != EXECUTION_CONTEXT_SHADOW) {
         panic("Unexpectedly called from non-shadow context");
@@ -134,6 +173,113 @@ bool shim_sys_handle_syscall_locally(long syscall_num, long* rv, va_list args) {
             break;
         }
 
+        // The results of the following syscalls are kept up to date in shared memory by Shadow,
+        // so we don't need to ask Shadow for them.
+
+        case SYS_getpid: {
+            syscallName = "getpid";
+            *rv = shimshmem_getProcessId(shim_processSharedMem());
+            break;
+        }
+
+        case SYS_gettid: {
+            syscallName = "gettid";
+            *rv = shimshmem_getThreadId(shim_threadSharedMem());
+            break;
+        }
+
+        case SYS_uname: {
+            syscallName = "uname";
+
+            struct utsname* buf = va_arg(args, struct utsname*);
+
+            _Static_assert(sizeof(*buf) == sizeof(struct linux_new_utsname), "utsname size");
+            if (buf) {
+                memcpy(buf, shimshmem_getUtsname(shim_hostSharedMem()), sizeof(*buf));
+                *rv = 0;
+            } else {
+                *rv = -EFAULT;
+            }
+
+            break;
+        }
+
+        case SYS_sched_getaffinity: {
+            // We may not handle the syscall, so leave `args` for the caller.
+            va_list argsCopy;
+            va_copy(argsCopy, args);
+            pid_t tid = va_arg(argsCopy, pid_t);
+            size_t cpusetsize = va_arg(argsCopy, size_t);
+            unsigned char* mask = va_arg(argsCopy, unsigned char*);
+            va_end(argsCopy);
+
+            // Only the calling thread is known to exist without asking Shadow.
+            if (tid != 0 && tid != shimshmem_getThreadId(shim_threadSharedMem())) {
+                return false;
+            }
+
+            syscallName = "sched_getaffinity";
+
+            // Shadow runs each host on a single CPU.
+            if (cpusetsize == 0) {
+                *rv = -EINVAL;
+            } else if (mask) {
+                mask[0] = 1;
+                *rv = 1;
+            } else {
+                *rv = -EFAULT;
+            }
+
+            break;
+        }
+
+        // Shadow runs these natively, so we can run them natively here too.
+        case SYS_getuid: {
+            syscallName = "getuid";
+            *rv = shim_native_syscall(NULL, SYS_getuid);
+            break;
+        }
+
+        case SYS_geteuid: {
+            syscallName = "geteuid";
+            *rv = shim_native_syscall(NULL, SYS_geteuid);
+            break;
+        }
+
+        case SYS_getgid: {
+            syscallName = "getgid";
+            *rv = shim_native_syscall(NULL, SYS_getgid);
+            break;
+        }
+
+        case SYS_getegid: {
+            syscallName = "getegid";
+            *rv = shim_native_syscall(NULL, SYS_getegid);
+            break;
+        }
+
+#ifdef SYS_io_uring_setup
+        // Shadow doesn't emulate io_uring. Fail immediately, as a kernel without io_uring would,
+        // so that the application falls back to other I/O interfaces.
+        case SYS_io_uring_setup: {
+            syscallName = "io_uring_setup";
+            *rv = -ENOSYS;
+            break;
+        }
+
+        case SYS_io_uring_enter: {
+            syscallName = "io_uring_enter";
+            *rv = -ENOSYS;
+            break;
+        }
+
+        case SYS_io_uring_register: {
+            syscallName = "io_uring_register";
+            *rv = -ENOSYS;
+            break;
+        }
+#endif
+
         case SYS_sched_yield: {
             syscallName = "sched_yield";
 
@@ -144,6 +290,171 @@ bool shim_sys_handle_syscall_locally(long syscall_num, long* rv, va_list args) {
             break;
         }
 
+        case SYS_getrandom: {
+            va_list args_copy;
+            va_copy(args_copy, args);
+            void* buf = va_arg(args_copy, void*);
+            size_t len = va_arg(args_copy, size_t);
+            va_end(args_copy);
+
+            // The flags don't matter since the bytes all come from the host's random source.
+            if (!_shim_sys_random_bytes(buf, len, rv)) {
+                return false;
+            }
+            syscallName = "getrandom";
+            break;
+        }
+
+        // Wakes of futexes when no thread on the host is waiting on a futex (see the
+        // `use_shim_futex_wake` option), which would wake no threads.
+        case SYS_futex: {
+            va_list args_copy;
+            va_copy(args_copy, args);
+            (void)va_arg(args_copy, uint32_t*);
+            int futex_op = va_arg(args_copy, int);
+            // skip `val`, `timeout`, and `uaddr2`
+            (void)va_arg(args_copy, long);
+            (void)va_arg(args_copy, long);
+            (void)va_arg(args_copy, long);
+            uint32_t val3 = va_arg(args_copy, long);
+            va_end(args_copy);
+
+            int operation = futex_op & ~(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME);
+            // Shadow doesn't support other bitsets, so leave those to it.
+            bool is_wake = operation == FUTEX_WAKE ||
+                           (operation == FUTEX_WAKE_BITSET && val3 == FUTEX_BITSET_MATCH_ANY);
+            if (!is_wake || shimshmem_hasFutexWaiters(shim_hostSharedMem())) {
+                return false;
+            }
+            syscallName = "futex";
+            *rv = 0;
+            break;
+        }
+
+        // The I/O of regular files that the process does natively, and reads of random files.
+        case SYS_read: {
+            va_list args_copy;
+            va_copy(args_copy, args);
+            int fd = va_arg(args_copy, int);
+            void* buf = va_arg(args_copy, void*);
+            size_t len = va_arg(args_copy, size_t);
+            va_end(args_copy);
+
+            if (shimshmem_isRandomFile(shim_processSharedMem(), fd)) {
+                if (!_shim_sys_random_bytes(buf, len, rv)) {
+                    return false;
+                }
+            } else if (!_shim_sys_native_file_io(syscall_num, rv, args)) {
+                return false;
+            }
+            syscallName = "read";
+            break;
+        }
+
+        case SYS_write: {
+            if (!_shim_sys_native_file_io(syscall_num, rv, args)) {
+                return false;
+            }
+            syscallName = "write";
+            break;
+        }
+
+        case SYS_pread64: {
+            if (!_shim_sys_native_file_io(syscall_num, rv, args)) {
+                return false;
+            }
+            syscallName = "pread64";
+            break;
+        }
+
+        case SYS_pwrite64: {
+            if (!_shim_sys_native_file_io(syscall_num, rv, args)) {
+                return false;
+            }
+            syscallName = "pwrite64";
+            break;
+        }
+
+        case SYS_readv: {
+            if (!_shim_sys_native_file_io(syscall_num, rv, args)) {
+                return false;
+            }
+            syscallName = "readv";
+            break;
+        }
+
+        case SYS_writev: {
+            if (!_shim_sys_native_file_io(syscall_num, rv, args)) {
+                return false;
+            }
+            syscallName = "writev";
+            break;
+        }
+
+        case SYS_preadv: {
+            if (!_shim_sys_native_file_io(syscall_num, rv, args)) {
+                return false;
+            }
+            syscallName = "preadv";
+            break;
+        }
+
+        case SYS_pwritev: {
+            if (!_shim_sys_native_file_io(syscall_num, rv, args)) {
+                return false;
+            }
+            syscallName = "pwritev";
+            break;
+        }
+
+        case SYS_preadv2: {
+            if (!_shim_sys_native_file_io(syscall_num, rv, args)) {
+                return false;
+            }
+            syscallName = "preadv2";
+            break;
+        }
+
+        case SYS_pwritev2: {
+            if (!_shim_sys_native_file_io(syscall_num, rv, args)) {
+                return false;
+            }
+            syscallName = "pwritev2";
+            break;
+        }
+
+        case SYS_lseek: {
+            if (!_shim_sys_native_file_io(syscall_num, rv, args)) {
+                return false;
+            }
+            syscallName = "lseek";
+            break;
+        }
+
+        case SYS_fstat: {
+            if (!_shim_sys_native_file_io(syscall_num, rv, args)) {
+                return false;
+            }
+            syscallName = "fstat";
+            break;
+        }
+
+        case SYS_fsync: {
+            if (!_shim_sys_native_file_io(syscall_num, rv, args)) {
+                return false;
+            }
+            syscallName = "fsync";
+            break;
+        }
+
+        case SYS_fdatasync: {
+            if (!_shim_sys_native_file_io(syscall_num, rv, args)) {
+                return false;
+            }
+            syscallName = "fdatasync";
+            break;
+        }
+
         default: {
             // the syscall was not handled
             return false;
@@ -3,7 +3,6 @@ use linux_api::sched::{CloneFlags, CloneResult};
 use linux_api::signal::Signal;
 use linux_api::ucontext::{sigcontext, ucontext};
 use shadow_shim_helper_rs::shim_event::ShimEventAddThreadReq;
-use shadow_shmem::allocator::ShMemBlockSerialized;
 
 use crate::ExecutionContext;
 
@@ -104,20 +103,24 @@ unsafe extern "C-unwind" fn set_context(ctx: &sigcontext) -> ! {
     };
 }
 
-/// `extern "C-unwind"` wrapper for `crate::tls_ipc::set`, which we can call from
-/// assembly.
+/// Set up the IPC block and shared memory of a new thread from the `AddThreadReq` event that
+/// created it. Uses C ABI so that we can call from assembly.
 ///
 /// # Safety
 ///
-/// `blk` must contained a serialized block of
-/// type `IPCData`, which outlives the current thread.
-unsafe extern "C-unwind" fn tls_ipc_set(blk: *const ShMemBlockSerialized) {
+/// `event` must be dereferenceable, and its blocks must be of the correct types and outlive the
+/// current thread.
+unsafe extern "C-unwind" fn init_thread_blocks(event: *const ShimEventAddThreadReq) {
     debug_assert_eq!(ExecutionContext::current(), ExecutionContext::Shadow);
 
-    let blk = unsafe { blk.as_ref().unwrap() };
+    let event = unsafe { event.as_ref().unwrap() };
 
     // SAFETY: ensured by caller
-    unsafe { crate::tls_ipc::set(blk) };
+    unsafe { crate::tls_ipc::set(&event.ipc_block) };
+    // SAFETY: ensured by caller
+    unsafe { crate::tls_thread_shmem::set(event.thread_shmem_block.as_ref().unwrap()) };
+    // SAFETY: ensured by caller
+    unsafe { crate::tls_process_shmem::set(event.process_shmem_block.as_ref().unwrap()) };
 }
 
 /// Execute a native `clone` syscall to create a new thread in a new process.
@@ -246,17 +249,17 @@ unsafe fn do_clone_thread(ctx: &ucontext, event: &ShimEventAddThreadReq) -> i64
     let child_sigctx = unsafe { child_sigcontext.as_mut().unwrap() };
     child_sigctx.rsp = child_stack as u64;
 
-    // Copy child's IPC block to child's stack
+    // Copy the event, with the child's IPC and shared memory blocks, to child's stack
     let child_current_rsp =
-        unsafe { child_current_rsp.sub(core::mem::size_of::<ShMemBlockSerialized>()) };
+        unsafe { child_current_rsp.sub(core::mem::size_of::<ShimEventAddThreadReq>()) };
     let child_current_rsp = unsafe {
         align_down(
             child_current_rsp,
-            core::mem::align_of::<ShMemBlockSerialized>(),
+            core::mem::align_of::<ShimEventAddThreadReq>(),
         )
     };
-    let child_ipc_blk = child_current_rsp.cast::<ShMemBlockSerialized>();
-    unsafe { core::ptr::write(child_ipc_blk, event.ipc_block) };
+    let child_event = child_current_rsp.cast::<ShimEventAddThreadReq>();
+    unsafe { core::ptr::write(child_event, *event) };
 
     // Ensure stack is 16-aligned so that we can safely make function calls.
     let child_current_rsp = unsafe { align_down(child_current_rsp, 16) };
@@ -292,9 +295,9 @@ unsafe fn do_clone_thread(ctx: &ucontext, event: &ShimEventAddThreadReq) -> i64
             "mov rdi, {exe_ctx_shadow}",
             "call {shim_swapExecutionContext}",
 
-            // Initialize the IPC block for this thread
-            "mov rdi, {blk}",
-            "call {tls_ipc_set}",
+            // Initialize the IPC block and shared memory for this thread
+            "mov rdi, {event}",
+            "call {init_thread_blocks}",
 
             // Initialize state for this thread
             "call {shim_init_thread}",
@@ -320,11 +323,11 @@ unsafe fn do_clone_thread(ctx: &ucontext, event: &ShimEventAddThreadReq) -> i64
             in("r10") ctid,
             // clone syscall arg5
             in("r8") newtls,
-            blk = in(reg) child_ipc_blk,
+            event = in(reg) child_event,
             exe_ctx_shadow = const crate::EXECUTION_CONTEXT_SHADOW_CONST,
             exe_ctx_application = const crate::EXECUTION_CONTEXT_APPLICATION_CONST,
             shim_swapExecutionContext = sym crate::export::shim_swapExecutionContext,
-            tls_ipc_set = sym tls_ipc_set,
+            init_thread_blocks = sym init_thread_blocks,
             shim_init_thread = sym crate::init_thread,
             // callee-saved register
             in("r12") child_sigcontext as * const _,
@@ -38,6 +38,7 @@ pub mod reinit_auxvec_random;
 pub mod shimlogger;
 pub mod syscall;
 pub mod tls;
+pub mod zygote;
 
 pub use shimlogger::export as shimlogger_export;
 
@@ -301,6 +302,14 @@ mod tls_thread_shmem {
         f(SHMEM.get().borrow().as_ref().unwrap())
     }
 
+    /// Like `with`, but returns `None` if `set` hasn't been called yet.
+    pub fn try_with<O>(f: impl FnOnce(&ThreadShmem) -> O) -> Option<O> {
+        debug_assert_eq!(ExecutionContext::current(), ExecutionContext::Shadow);
+        let shmem = SHMEM.get();
+        let shmem = shmem.try_borrow().ok()?;
+        Some(f(shmem.as_ref()?))
+    }
+
     /// The previous value, if any, is dropped.
     ///
     /// # Safety
@@ -579,6 +588,19 @@ fn wait_for_start_event(is_first_thread: bool) {
     }
 }
 
+/// Wait for the "start" event from Shadow in a new thread of the current
+/// process, whose thread and process shared memory were already set from the
+/// clone request that created it.
+fn wait_for_start_res() {
+    debug_assert_eq!(ExecutionContext::current(), ExecutionContext::Shadow);
+    log::trace!("waiting for start response");
+
+    let res = tls_ipc::with(|ipc| ipc.from_shadow().receive().unwrap());
+    let ShimEventToShim::StartRes(_) = res else {
+        panic!("Unexpected response: {res:?}");
+    };
+}
+
 // Rust's linking of a `cdylib` only considers Rust `pub extern "C-unwind"` entry
 // points, and the symbols those recursively used, to be used. i.e. any function
 // called from outside of the shim needs to be exported from the Rust code. We
@@ -702,9 +724,15 @@ pub mod export {
     /// # Safety
     ///
     /// stdin must contained a serialized block of
-    /// type `IPCData`, which outlives the current thread.
+    /// type `IPCData`, which outlives the current thread, or be a zygote's
+    /// socket (see [`crate::zygote`]).
     #[unsafe(no_mangle)]
     pub unsafe extern "C-unwind" fn _shim_parent_init_ipc() {
+        if let Some(ipc_blk) = crate::zygote::serve_if_zygote() {
+            // SAFETY: caller is responsible for `set`'s preconditions.
+            unsafe { tls_ipc::set(&ipc_blk) };
+            return;
+        }
         let mut bytes = [0; core::mem::size_of::<ShMemBlockSerialized>()];
         let bytes_read = rustix::io::read(
             unsafe { rustix::fd::BorrowedFd::borrow_raw(libc::STDIN_FILENO) },
@@ -801,6 +829,13 @@ pub mod export {
         wait_for_start_event(false);
     }
 
+    /// Wait for start response from shadow, from a newly spawned thread in the
+    /// same process.
+    #[unsafe(no_mangle)]
+    pub extern "C-unwind" fn _shim_preload_only_child_ipc_wait_for_start_res() {
+        wait_for_start_res();
+    }
+
     #[unsafe(no_mangle)]
     pub extern "C-unwind" fn _shim_ipc_wait_for_start_event() {
         wait_for_start_event(true);
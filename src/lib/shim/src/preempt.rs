@@ -9,7 +9,17 @@
 //!
 //! `enable` should be called to enable preemption for the current thread, and
 //! `disable` to disable preemption for the current thread.
+//!
+//! If backoff is configured, a thread that is preempted again without having
+//! returned control to Shadow in between (i.e. a thread that never makes
+//! syscalls) has both its native and simulated intervals doubled, up to
+//! `MAX_BACKOFF` times. This avoids a storm of preemption signals for such
+//! threads while moving simulated time forward at the same rate.
+use core::cell::Cell;
+use core::sync::atomic::Ordering;
+
 use linux_api::signal::{SigActionFlags, siginfo_t, sigset_t};
+use linux_api::time::kernel_old_timeval;
 use log::{debug, trace};
 use shadow_shim_helper_rs::option::FfiOption;
 use shadow_shim_helper_rs::shadow_syscalls::ShadowSyscallNum;
@@ -17,10 +27,35 @@ use shadow_shim_helper_rs::shim_event::ShimEventSyscall;
 use shadow_shim_helper_rs::syscall_types::SyscallArgs;
 
 use crate::ExecutionContext;
+use crate::tls::ShimTlsVar;
 
 // The signal we use for preemption.
 const PREEMPTION_SIGNAL: linux_api::signal::Signal = linux_api::signal::Signal::SIGVTALRM;
 
+/// The maximum number of times that a thread's preemption intervals are doubled.
+const MAX_BACKOFF: u32 = 6;
+
+#[derive(Copy, Clone, Default)]
+struct Backoff {
+    /// The number of times that the current thread's intervals have been doubled.
+    shift: u32,
+    /// Whether the current thread was preempted since preemption was last enabled.
+    preempted: bool,
+}
+
+static BACKOFF: ShimTlsVar<Cell<Backoff>> =
+    ShimTlsVar::new(&crate::SHIM_TLS, || Cell::new(Backoff::default()));
+
+/// `interval` doubled `shift` times.
+fn backed_off(interval: kernel_old_timeval, shift: u32) -> kernel_old_timeval {
+    let micros = interval.tv_sec * 1_000_000 + interval.tv_usec;
+    let micros = micros.saturating_mul(1 << shift);
+    kernel_old_timeval {
+        tv_sec: micros / 1_000_000,
+        tv_usec: micros % 1_000_000,
+    }
+}
+
 extern "C" fn handle_timer_signal(signo: i32, _info: *mut siginfo_t, _ctx: *mut core::ffi::c_void) {
     let prev = ExecutionContext::Shadow.enter();
     trace!("Got preemption timer signal.");
@@ -41,17 +76,27 @@ extern "C" fn handle_timer_signal(signo: i32, _info: *mut siginfo_t, _ctx: *mut
         panic!("Preemption signal handler somehow invoked when it wasn't configured.");
     };
 
+    let backoff = BACKOFF.get();
+    let shift = backoff.get().shift;
+    let sim_duration = config.sim_duration.saturating_mul(1 << shift);
+    backoff.set(Backoff {
+        shift,
+        preempted: true,
+    });
+
     // Preemption should be rare. Probably worth at least a debug-level message.
     debug!(
         "Native preemption incrementing simulated CPU latency by {:?} after waiting {:?}",
-        config.sim_duration, config.native_duration
+        sim_duration,
+        backed_off(config.native_duration, shift)
     );
 
     {
         // Move simulated time forward.
         let host = crate::global_host_shmem::get();
+        host.native_preemptions.fetch_add(1, Ordering::Relaxed);
         let mut host_lock = host.protected().lock();
-        host_lock.unapplied_cpu_latency += config.sim_duration;
+        host_lock.unapplied_cpu_latency += sim_duration;
     }
     // Transfer control to shadow, which will handle the time update and potentially
     // reschedule this thread.
@@ -165,10 +210,21 @@ pub unsafe fn enable() {
     else {
         return;
     };
-    log::trace!(
-        "Enabling preemption with native duration {:?}",
-        config.native_duration
-    );
+
+    // keep backing off if the thread was preempted, otherwise start over
+    let backoff = BACKOFF.get();
+    let Backoff { shift, preempted } = backoff.get();
+    let shift = match (config.backoff, preempted) {
+        (true, true) => (shift + 1).min(MAX_BACKOFF),
+        _ => 0,
+    };
+    backoff.set(Backoff {
+        shift,
+        preempted: false,
+    });
+    let native_duration = backed_off(config.native_duration, shift);
+
+    log::trace!("Enabling preemption with native duration {native_duration:?}");
     linux_api::time::setitimer(
         linux_api::time::ITimerId::ITIMER_VIRTUAL,
         &linux_api::time::kernel_old_itimerval {
@@ -180,8 +236,8 @@ pub unsafe fn enable() {
             // just returns, and the timer won't be re-armed. We *could*
             // explicitly re-arm the timer there, but probably more robust to
             // just have an interval here.
-            it_interval: config.native_duration,
-            it_value: config.native_duration,
+            it_interval: native_duration,
+            it_value: native_duration,
         },
         None,
     )
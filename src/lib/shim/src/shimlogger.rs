@@ -5,8 +5,8 @@ use formatting_nostd::{BorrowedFdWriter, FormatBuffer};
 use rustix::fd::BorrowedFd;
 use shadow_shim_helper_rs::util::time::TimeParts;
 
-/// For internal use; writes to an internal buffer, flushing to stdout
-/// when the buffer fills or the object is dropped.
+/// For internal use; writes to an internal buffer, flushing to stdout (or to the
+/// thread's log ring, if enabled) when the buffer fills or the object is dropped.
 struct ShimLoggerWriter {
     buffer: FormatBuffer<1000>,
     stdout: BorrowedFdWriter<'static>,
@@ -23,9 +23,20 @@ impl ShimLoggerWriter {
     }
 
     pub fn flush(&mut self) {
-        self.stdout.write_str(self.buffer.as_str()).unwrap();
+        Self::write_out(&mut self.stdout, self.buffer.as_str()).unwrap();
         self.buffer.reset();
     }
+
+    /// Append `s` to the thread's log ring if it's enabled and has room, for Shadow to write to
+    /// the log file, or otherwise write it to the log file directly. A record that doesn't fit
+    /// in the ring may appear in the file before earlier records that are still in the ring.
+    fn write_out(stdout: &mut BorrowedFdWriter<'static>, s: &str) -> Result<(), core::fmt::Error> {
+        let use_ring = crate::global_manager_shmem::try_get().is_some_and(|m| m.use_shim_log_ring);
+        let pushed = use_ring
+            && crate::tls_thread_shmem::try_with(|thread| thread.shim_log.push(s.as_bytes()))
+                .unwrap_or(false);
+        if pushed { Ok(()) } else { stdout.write_str(s) }
+    }
 }
 
 impl core::fmt::Write for ShimLoggerWriter {
@@ -35,8 +46,8 @@ impl core::fmt::Write for ShimLoggerWriter {
             self.flush();
         }
         if s.len() > self.buffer.capacity_remaining() {
-            // There will never be enough room. Write directly to stdout.
-            self.stdout.write_str(s)
+            // There will never be enough room. Write it out directly.
+            Self::write_out(&mut self.stdout, s)
         } else {
             // Write to buffer. Should be impossible to fail.
             self.buffer.write_str(s)
@@ -109,6 +109,13 @@ fn die_with_fatal_signal(sig: Signal) -> ! {
 pub unsafe fn process_signals(mut ucontext: Option<&mut ucontext>) -> bool {
     debug_assert_eq!(ExecutionContext::current(), ExecutionContext::Shadow);
 
+    // the common case, which doesn't need the host lock
+    if !tls_process_shmem::with(|process| {
+        tls_thread_shmem::with(|thread| shim_shmem::signals_maybe_pending(process, thread))
+    }) {
+        return true;
+    }
+
     let mut host = crate::global_host_shmem::get();
     let mut host_lock = host.protected().lock();
 
@@ -120,6 +127,11 @@ pub unsafe fn process_signals(mut ucontext: Option<&mut ucontext>) -> bool {
                 shim_shmem::take_pending_unblocked_signal(&host_lock, process, thread)
             })
         }) else {
+            tls_process_shmem::with(|process| {
+                tls_thread_shmem::with(|thread| {
+                    shim_shmem::clear_maybe_pending_signals(&host_lock, process, thread)
+                })
+            });
             break;
         };
 
@@ -374,6 +386,9 @@ unsafe fn handle_hardware_error_signal_inner(
             let mut thread_protected = thread.protected.borrow_mut(&host_lock.root);
             thread_protected.pending_signals |= signal.into();
             thread_protected.set_pending_standard_siginfo(signal, info);
+            thread
+                .maybe_pending_signals
+                .store(true, core::sync::atomic::Ordering::Relaxed);
         }
     });
 
@@ -24,9 +24,10 @@ unsafe fn native_syscall(args: &SyscallArgs) -> SyscallReg {
         panic!("Shouldn't get here. Should have gone through ShimEventAddThreadReq");
     } else if args.number == libc::SYS_exit {
         let exit_status = i32::from(args.args[0]);
-        // This thread is exiting. Arrange for its thread-local-storage and
-        // signal stack to be freed.
+        // This thread is exiting. Arrange for its thread-local-storage,
+        // signal stack, and rdtsc stack to be freed.
         unsafe { bindings::shim_freeSignalStack() };
+        unsafe { bindings::shim_rdtsc_free_thread() };
         // SAFETY: We don't try to recover from panics.
         // TODO: make shim fully no_std and install a panic handler that aborts.
         // https://doc.rust-lang.org/nomicon/panic-handler.html
@@ -0,0 +1,245 @@
+//! Zygote mode. See [`shadow_shim_helper_rs::zygote`].
+//!
+//! The zygote runs this before any of the shim's per-process initialization, so at that point
+//! the only work that a forked process shares with it is the `execve`, the dynamic linking of the
+//! executable and its libraries, and the constructors of the libraries that the shim depends on.
+
+use core::mem::MaybeUninit;
+
+use shadow_shim_helper_rs::zygote::{ZYGOTE_MAX_FDS, ZygoteSpawnReply, ZygoteSpawnRequest};
+use shadow_shmem::allocator::ShMemBlockSerialized;
+
+/// Whether stdin is a socket, which is how Shadow starts a zygote. Other processes get the
+/// serialized IPC block through a pipe.
+fn stdin_is_socket() -> bool {
+    let mut stat = MaybeUninit::<libc::stat>::uninit();
+    // SAFETY: `stat` is large enough for the result.
+    if unsafe { libc::fstat(libc::STDIN_FILENO, stat.as_mut_ptr()) } != 0 {
+        return false;
+    }
+    // SAFETY: Initialized by the successful fstat.
+    let stat = unsafe { stat.assume_init() };
+    (stat.st_mode & libc::S_IFMT) == libc::S_IFSOCK
+}
+
+/// A request and the descriptors that came with it.
+struct Request {
+    req: ZygoteSpawnRequest,
+    log_fd: i32,
+    strace_fd: Option<i32>,
+}
+
+/// Receive the next request on stdin, or `None` if Shadow closed its end of the socket.
+fn receive_request() -> Option<Request> {
+    let mut req = MaybeUninit::<ZygoteSpawnRequest>::zeroed();
+    // Large (and aligned) enough for a control message with `ZYGOTE_MAX_FDS` descriptors.
+    let mut cmsg_buf = [0u64; 8];
+    // SAFETY: Doesn't dereference anything.
+    let cmsg_space = unsafe { libc::CMSG_SPACE((ZYGOTE_MAX_FDS * size_of::<i32>()) as u32) };
+    assert!(cmsg_space as usize <= size_of_val(&cmsg_buf));
+    let mut iov = libc::iovec {
+        iov_base: req.as_mut_ptr().cast(),
+        iov_len: size_of::<ZygoteSpawnRequest>(),
+    };
+    // SAFETY: All-zero is a valid msghdr.
+    let mut msg: libc::msghdr = unsafe { core::mem::zeroed() };
+    msg.msg_iov = &mut iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buf.as_mut_ptr().cast();
+    msg.msg_controllen = size_of_val(&cmsg_buf);
+
+    let n = loop {
+        // SAFETY: The buffers referenced by `msg` are live and writable.
+        let n = unsafe { libc::recvmsg(libc::STDIN_FILENO, &mut msg, libc::MSG_CMSG_CLOEXEC) };
+        if n >= 0 || unsafe { *libc::__errno_location() } != libc::EINTR {
+            break n;
+        }
+    };
+    if n == 0 {
+        return None;
+    }
+    assert_eq!(
+        n,
+        isize::try_from(size_of::<ZygoteSpawnRequest>()).unwrap(),
+        "Bad zygote request"
+    );
+    // SAFETY: All bytes were received.
+    let req = unsafe { req.assume_init() };
+
+    let mut fds = [-1i32; ZYGOTE_MAX_FDS];
+    let mut num_fds = 0;
+    // SAFETY: `msg` was filled in by a successful `recvmsg`.
+    let cmsg = unsafe { libc::CMSG_FIRSTHDR(&msg) };
+    if let Some(cmsg) = unsafe { cmsg.as_ref() } {
+        assert_eq!(cmsg.cmsg_level, libc::SOL_SOCKET);
+        assert_eq!(cmsg.cmsg_type, libc::SCM_RIGHTS);
+        // SAFETY: Doesn't dereference anything.
+        let header_len = unsafe { libc::CMSG_LEN(0) } as usize;
+        num_fds = (cmsg.cmsg_len - header_len) / size_of::<i32>();
+        assert!(num_fds <= ZYGOTE_MAX_FDS);
+        // SAFETY: The control message holds `num_fds` descriptors. They may be unaligned.
+        let data = unsafe { libc::CMSG_DATA(cmsg) }.cast::<i32>();
+        for (i, fd) in fds.iter_mut().enumerate().take(num_fds) {
+            *fd = unsafe { data.add(i).read_unaligned() };
+        }
+    }
+
+    let expected_fds = if req.strace_fd >= 0 { 2 } else { 1 };
+    assert_eq!(num_fds, expected_fds, "Bad zygote request descriptors");
+
+    Some(Request {
+        req,
+        log_fd: fds[0],
+        strace_fd: (req.strace_fd >= 0).then_some(fds[1]),
+    })
+}
+
+fn send_reply(reply: ZygoteSpawnReply) {
+    // SAFETY: `reply` is a plain integer.
+    let n = unsafe {
+        libc::send(
+            libc::STDIN_FILENO,
+            core::ptr::from_ref(&reply).cast(),
+            size_of::<ZygoteSpawnReply>(),
+            libc::MSG_NOSIGNAL,
+        )
+    };
+    // If Shadow went away there's nobody to tell, and we'll see EOF on the next receive.
+    let _ = n;
+}
+
+/// Set up the descriptors of a newly forked process.
+fn setup_child_fds(request: &Request) {
+    // SAFETY: These descriptors were received for this purpose, and nothing in this process is
+    // using the descriptor numbers that they're moved to.
+    unsafe {
+        libc::dup2(request.log_fd, libc::STDOUT_FILENO);
+        libc::dup2(request.log_fd, libc::STDERR_FILENO);
+        if let Some(strace_fd) = request.strace_fd {
+            let target = request.req.strace_fd;
+            if strace_fd != target {
+                // This clears O_CLOEXEC, as in a process spawned by Shadow directly.
+                libc::dup2(strace_fd, target);
+                libc::close(strace_fd);
+            }
+            if request.log_fd != target {
+                libc::close(request.log_fd);
+            }
+        } else {
+            libc::close(request.log_fd);
+        }
+    }
+}
+
+fn close_request_fds(request: &Request) {
+    // SAFETY: The descriptors are owned by the request.
+    unsafe {
+        libc::close(request.log_fd);
+        if let Some(fd) = request.strace_fd {
+            libc::close(fd);
+        }
+    }
+}
+
+/// Fork a new process for `request`, returning true in the new process. The new process is
+/// forked from a short-lived intermediate process so that it's reparented to Shadow (which is a
+/// child subreaper) rather than being a child of the zygote. Shadow needs to be the parent to be
+/// able to `waitpid` for it.
+fn spawn(request: &Request) -> bool {
+    let mut pipe_fds = [-1i32; 2];
+    // SAFETY: `pipe_fds` is large enough.
+    if unsafe { libc::pipe2(pipe_fds.as_mut_ptr(), libc::O_CLOEXEC) } != 0 {
+        send_reply(ZygoteSpawnReply {
+            pid: -unsafe { *libc::__errno_location() },
+        });
+        return false;
+    }
+    let [pipe_reader, pipe_writer] = pipe_fds;
+
+    // Use libc's `fork` rather than a raw syscall so that libc updates its cached thread id.
+    //
+    // SAFETY: This process is single-threaded.
+    let intermediate = unsafe { libc::fork() };
+    if intermediate == 0 {
+        // SAFETY: As above.
+        let pid = unsafe { libc::fork() };
+        if pid == 0 {
+            // SAFETY: Only closing the pipe.
+            unsafe {
+                libc::close(pipe_reader);
+                libc::close(pipe_writer);
+            }
+            setup_child_fds(request);
+            return true;
+        }
+        let pid = if pid < 0 {
+            -unsafe { *libc::__errno_location() }
+        } else {
+            pid
+        };
+        // SAFETY: Writing a plain integer to our pipe, then exiting without running any of the
+        // zygote's atexit handlers.
+        unsafe {
+            libc::write(
+                pipe_writer,
+                core::ptr::from_ref(&pid).cast(),
+                size_of::<i32>(),
+            );
+            libc::_exit(0);
+        }
+    }
+
+    // SAFETY: Only closing our copies of the descriptors.
+    unsafe { libc::close(pipe_writer) };
+    close_request_fds(request);
+
+    let pid = if intermediate < 0 {
+        -unsafe { *libc::__errno_location() }
+    } else {
+        // Wait for the intermediate process to exit, after which the new process has been
+        // reparented and Shadow can safely wait for it.
+        // SAFETY: `intermediate` is our child.
+        unsafe { libc::waitpid(intermediate, core::ptr::null_mut(), 0) };
+        let mut pid = -libc::ECHILD;
+        // SAFETY: Reading a plain integer.
+        let n = unsafe {
+            libc::read(
+                pipe_reader,
+                core::ptr::from_mut(&mut pid).cast(),
+                size_of::<i32>(),
+            )
+        };
+        if n != isize::try_from(size_of::<i32>()).unwrap() {
+            pid = -libc::ECHILD;
+        }
+        pid
+    };
+    // SAFETY: Only closing the pipe.
+    unsafe { libc::close(pipe_reader) };
+
+    send_reply(ZygoteSpawnReply { pid });
+    false
+}
+
+/// If this process was started as a zygote, serve spawn requests until Shadow closes the socket
+/// and then exit. Otherwise return `None` immediately.
+///
+/// Returns (only) in a newly spawned process, with that process's IPC block.
+pub fn serve_if_zygote() -> Option<ShMemBlockSerialized> {
+    if !stdin_is_socket() {
+        return None;
+    }
+
+    // Don't outlive Shadow. Processes that we fork don't inherit this; the shim sets it again
+    // after they've been reparented to Shadow.
+    rustix::process::set_parent_process_death_signal(Some(rustix::process::Signal::Kill)).unwrap();
+
+    while let Some(request) = receive_request() {
+        if spawn(&request) {
+            return Some(request.req.ipc_block);
+        }
+    }
+
+    // SAFETY: Exit without running the application's atexit handlers, since it never ran.
+    unsafe { libc::_exit(0) }
+}
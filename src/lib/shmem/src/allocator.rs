@@ -140,7 +140,7 @@ where
     T: Sync + VirtualAddressSpaceIndependent,
 {
     pub fn serialize(&self) -> ShMemBlockSerialized {
-        let serialized = SHMALLOC.lock().internal.serialize(self.block);
+        let serialized = crate::shmalloc_impl::serialize(self.block);
         ShMemBlockSerialized {
             internal: serialized,
         }
@@ -301,8 +301,8 @@ impl<'alloc> SharedMemAllocator<'alloc> {
 
     fn free<T: Sync + VirtualAddressSpaceIndependent>(&mut self, mut block: ShMemBlock<'alloc, T>) {
         self.nallocs -= 1;
-        block.block = core::ptr::null_mut();
-        self.internal.dealloc(block.block);
+        let block_p = core::mem::replace(&mut block.block, core::ptr::null_mut());
+        self.internal.dealloc(block_p);
     }
 
     fn destruct(&mut self) {
@@ -477,6 +477,62 @@ mod tests {
         shfree(original_block);
     }
 
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn freed_blocks_are_reused() {
+        // Use a size class that the other tests don't, since they share the global allocator.
+        let block = shmalloc([1u64; 100]);
+        let data_addr = *block as *const [u64; 100] as usize;
+        shfree(block);
+
+        // A different type in the same size class should get the freed block back.
+        let block = shmalloc([2u8; 1000]);
+        assert_eq!(*block as *const [u8; 1000] as usize, data_addr);
+        assert_eq!(*block, [2; 1000]);
+        drop(block);
+
+        let block = shmalloc([3u64; 100]);
+        assert_eq!(*block as *const [u64; 100] as usize, data_addr);
+        shfree(block);
+    }
+
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn size_classes_round_trip() {
+        let small = shmalloc(1u8);
+        let medium = shmalloc([7u64; 20]);
+        let large = shmalloc([9u8; 5000]);
+
+        let medium_alias = unsafe { shdeserialize::<[u64; 20]>(&medium.serialize()) };
+        let large_alias = unsafe { shdeserialize::<[u8; 5000]>(&large.serialize()) };
+        assert_eq!(*small, 1);
+        assert_eq!(*medium_alias, [7; 20]);
+        assert_eq!(*large_alias, [9; 5000]);
+
+        shfree(large);
+        shfree(medium);
+        shfree(small);
+    }
+
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn allocations_larger_than_every_size_class() {
+        // Larger than the largest size class (4 MiB), and too large to build on the stack.
+        const NBYTES: usize = 5 * 1024 * 1024;
+        register_teardown();
+
+        let block = SHMALLOC.lock().internal.alloc(NBYTES, 8);
+        let data = unsafe { (*block).get_mut_ref::<u8>() };
+        assert_eq!(data.len(), NBYTES);
+        data.fill(7);
+
+        let serialized = crate::shmalloc_impl::serialize(block);
+        let alias = SHDESERIALIZER.lock().internal.deserialize(&serialized);
+        assert!(unsafe { (*alias).get_ref::<u8>() }.iter().all(|x| *x == 7));
+
+        SHMALLOC.lock().internal.dealloc(block);
+    }
+
     // Validate our guarantee that the data pointer doesn't move, even if the block does.
     // Host relies on this for soundness.
     #[test]
@@ -3,9 +3,11 @@
 //! Shadow's shim library, which must async-signal-safe.
 //!
 //! The allocator chains together chunks of shared memory and divvies out portions of each chunk
-//! using a first-fit strategy. The allocator also implements a freelist so that allocated blocks
-//! can be reused efficiently after free. The allocator design isn't good for general-purpose
-//! allocation, but should be OK when used for just a few types.
+//! in power-of-two size classes. Each size class has its own freelist so that freed blocks can be
+//! reused in constant time, and many blocks share a single shared memory file. Allocations too
+//! large for the biggest size class get a shared memory file of their own, which is removed as soon
+//! as the allocation is freed. The allocator design isn't good for general-purpose allocation, but
+//! should be OK when used for just a few types.
 //!
 //! This code is intended to be private; the `allocator` module is the public, safer-to-use
 //! front end.
@@ -138,6 +140,7 @@ fn format_shmem_name(buf: &mut PathBuf) {
 }
 
 const CHUNK_NBYTES_DEFAULT: usize = 8 * 1024 * 1024; // 8 MiB
+const PAGE_NBYTES: usize = 4096;
 
 fn create_map_shared_memory<'a>(path_buf: &PathBuf, nbytes: usize) -> (&'a mut [u8], i32) {
     use linux_api::fcntl::OFlag;
@@ -289,6 +292,8 @@ pub(crate) struct Block {
     next_free_block: *mut Block, // This can't be a short pointer, because it may point across chunks.
     alloc_nbytes: u32,           // What is the size of the block
     data_offset: u32,            // From the start location of the block header
+    chunk_offset: u32,           // From the start location of the chunk header to the block header
+    size_class: u32,             // Index of the freelist that the block is returned to
     canary_back: CanaryBuf,
 }
 
@@ -389,11 +394,39 @@ pub(crate) fn rewind(p: *mut u8) -> *mut Block {
 }
 
 */
+// The smallest size class. Smaller allocations are rounded up to this size.
+const MIN_SIZE_CLASS_NBYTES: usize = 16;
+const MIN_SIZE_CLASS_SHIFT: u32 = MIN_SIZE_CLASS_NBYTES.trailing_zeros();
+
+// One size class for each power of two from `MIN_SIZE_CLASS_NBYTES` up to half the chunk size. A
+// block the size of a whole chunk wouldn't fit next to the chunk and block headers.
+const NUM_SIZE_CLASSES: usize =
+    (CHUNK_NBYTES_DEFAULT.trailing_zeros() - MIN_SIZE_CLASS_SHIFT) as usize;
+
+// The size class of blocks that have a chunk to themselves. They're never put on a freelist.
+const DIRECT_SIZE_CLASS: usize = NUM_SIZE_CLASSES;
+
+/// Returns the index of the smallest size class that can hold `alloc_nbytes`, or
+/// `DIRECT_SIZE_CLASS` if it's larger than every size class.
+fn size_class_index(alloc_nbytes: usize) -> usize {
+    if alloc_nbytes > size_class_nbytes(NUM_SIZE_CLASSES - 1) {
+        return DIRECT_SIZE_CLASS;
+    }
+    let class_nbytes = core::cmp::max(alloc_nbytes, MIN_SIZE_CLASS_NBYTES).next_power_of_two();
+    (class_nbytes.trailing_zeros() - MIN_SIZE_CLASS_SHIFT) as usize
+}
+
+const fn size_class_nbytes(size_class: usize) -> usize {
+    MIN_SIZE_CLASS_NBYTES << size_class
+}
 
 #[derive(Debug)]
 pub(crate) struct FreelistAllocator {
     first_chunk: *mut Chunk,
-    next_free_block: *mut Block,
+    // The head of the freelist for each size class.
+    free_blocks: [*mut Block; NUM_SIZE_CLASSES],
+    // Chunks holding a single `DIRECT_SIZE_CLASS` block.
+    direct_chunks: *mut Chunk,
     chunk_nbytes: usize,
 }
 
@@ -401,7 +434,8 @@ impl FreelistAllocator {
     pub const fn new() -> Self {
         FreelistAllocator {
             first_chunk: core::ptr::null_mut(),
-            next_free_block: core::ptr::null_mut(),
+            free_blocks: [core::ptr::null_mut(); NUM_SIZE_CLASSES],
+            direct_chunks: core::ptr::null_mut(),
             chunk_nbytes: CHUNK_NBYTES_DEFAULT,
         }
     }
@@ -425,23 +459,28 @@ impl FreelistAllocator {
         Ok(())
     }
 
-    /// Returns the block and its predecessor (if it exists)
-    fn check_free_list_for_acceptable_block(
-        &mut self,
-        alloc_nbytes: usize,
-        alloc_alignment: usize,
-    ) -> (*mut Block, *mut Block) // (pred, block)
-    {
-        let mut block = self.next_free_block;
+    /// Removes and returns a block from the size class's freelist whose data is suitably aligned,
+    /// or null if there is no such block. Every block in a size class has the same capacity, so
+    /// only the alignment needs to be checked, and the first block almost always matches.
+    fn take_free_block(&mut self, size_class: usize, alloc_alignment: usize) -> *mut Block {
+        let mut block = self.free_blocks[size_class];
         let mut pred: *mut Block = core::ptr::null_mut();
 
         while !block.is_null() {
             let (start_p, _) = unsafe { (*block).get_block_data_range() };
 
-            if unsafe { (*block).alloc_nbytes as usize == alloc_nbytes }
-                && start_p.align_offset(alloc_alignment) == 0
-            {
-                return (pred, block);
+            if start_p.align_offset(alloc_alignment) == 0 {
+                let next = unsafe { (*block).next_free_block };
+                if pred.is_null() {
+                    // The block was the first element on the list.
+                    self.free_blocks[size_class] = next;
+                } else {
+                    // We can just update the predecessor
+                    unsafe {
+                        (*pred).next_free_block = next;
+                    }
+                }
+                return block;
             }
 
             pred = block;
@@ -450,7 +489,7 @@ impl FreelistAllocator {
             }
         }
 
-        (pred, core::ptr::null_mut())
+        core::ptr::null_mut()
     }
 
     fn find_next_suitable_positions(
@@ -466,7 +505,8 @@ impl FreelistAllocator {
 
     fn try_creating_block_in_chunk(
         chunk: &mut Chunk,
-        alloc_nbytes: usize,
+        size_class: usize,
+        block_nbytes: usize,
         alloc_alignment: usize,
     ) -> *mut Block {
         let chunk_start = core::ptr::from_mut(chunk) as *mut u8;
@@ -480,7 +520,7 @@ impl FreelistAllocator {
             BLOCK_STRUCT_ALIGNMENT,
         );
         let (block_data_start, block_data_end) =
-            Self::find_next_suitable_positions(block_struct_end, alloc_nbytes, alloc_alignment);
+            Self::find_next_suitable_positions(block_struct_end, block_nbytes, alloc_alignment);
 
         let data_offset = unsafe { block_data_start.offset_from(block_struct_start) };
 
@@ -490,77 +530,115 @@ impl FreelistAllocator {
             // The block fits.
             // Initialize the block
             let block = block_struct_start as *mut Block;
+            let chunk_offset = unsafe { block_struct_start.offset_from(chunk_start) };
 
             unsafe {
                 (*block).canary_init();
                 (*block).next_free_block = core::ptr::null_mut();
-                (*block).alloc_nbytes = alloc_nbytes as u32;
                 (*block).data_offset = data_offset as u32;
+                (*block).chunk_offset = chunk_offset as u32;
+                (*block).size_class = size_class as u32;
             }
 
+            // The data cursor is relative to the start of the chunk's data segment.
+            chunk.data_cur = unsafe { block_data_end.offset_from(chunk.get_data_start()) } as u32;
+
             return block;
         }
 
         core::ptr::null_mut()
     }
 
-    pub fn alloc(&mut self, alloc_nbytes: usize, alloc_alignment: usize) -> *mut Block {
-        // First, check the free list
-        let (pred, mut block) =
-            self.check_free_list_for_acceptable_block(alloc_nbytes, alloc_alignment);
-
-        if !block.is_null() {
-            // We found a hit off the free list, we can just return that.
-            // But first we update the free list.
-            if pred.is_null() {
-                // The block was the first element on the list.
-                self.next_free_block = unsafe { (*block).next_free_block };
-            } else {
-                // We can just update the predecessor
-                unsafe {
-                    (*pred).next_free_block = (*block).next_free_block;
-                }
-            }
+    /// Allocates a block in a new chunk that is just large enough to hold it.
+    fn alloc_direct(&mut self, alloc_nbytes: usize, alloc_alignment: usize) -> *mut Block {
+        let chunk_nbytes = (core::mem::size_of::<Chunk>()
+            + BLOCK_STRUCT_ALIGNMENT
+            + BLOCK_STRUCT_NBYTES
+            + alloc_alignment
+            + alloc_nbytes)
+            .next_multiple_of(PAGE_NBYTES);
+        assert!(u32::try_from(chunk_nbytes).is_ok());
 
-            let (p, _) = unsafe { (*block).get_block_data_range() };
-            assert!(p.align_offset(alloc_alignment) == 0);
+        let mut path_buf = crate::util::NULL_PATH_BUF;
+        format_shmem_name(&mut path_buf);
+        let chunk = allocate_shared_chunk(&path_buf, chunk_nbytes);
 
-            return block;
+        unsafe {
+            (*chunk).next_chunk = self.direct_chunks;
         }
+        self.direct_chunks = chunk;
 
-        // If nothing in the free list, then check if the current chunk can handle the allocation
-        block = Self::try_creating_block_in_chunk(
-            unsafe { &mut (*self.first_chunk) },
+        Self::try_creating_block_in_chunk(
+            unsafe { &mut (*chunk) },
+            DIRECT_SIZE_CLASS,
             alloc_nbytes,
             alloc_alignment,
-        );
+        )
+    }
+
+    /// Unlinks and deallocates the chunk of a `DIRECT_SIZE_CLASS` block.
+    fn dealloc_direct(&mut self, block: *mut Block) {
+        let offset = unsafe { (*block).chunk_offset } as usize;
+        let chunk = unsafe { (block as *mut u8).sub(offset) } as *mut Chunk;
+
+        // There are rarely more than a few direct chunks, so a linear search is fine.
+        let mut link: *mut *mut Chunk = &raw mut self.direct_chunks;
+        while unsafe { *link } != chunk {
+            assert!(!unsafe { *link }.is_null());
+            link = unsafe { &raw mut (**link).next_chunk };
+        }
+        unsafe {
+            *link = (*chunk).next_chunk;
+        }
+
+        deallocate_shared_chunk(chunk);
+    }
+
+    /// Allocates a block of the size class from its freelist, or else from the current chunk.
+    fn alloc_in_size_class(&mut self, size_class: usize, alloc_alignment: usize) -> *mut Block {
+        // First, check the free list
+        let mut block = self.take_free_block(size_class, alloc_alignment);
+
+        if block.is_null() {
+            // If nothing in the free list, then check if the current chunk can handle the
+            // allocation
+            block = Self::try_creating_block_in_chunk(
+                unsafe { &mut (*self.first_chunk) },
+                size_class,
+                size_class_nbytes(size_class),
+                alloc_alignment,
+            );
+        }
 
         if block.is_null() {
             // Chunk didn't have enough capacity...
             self.add_chunk().unwrap();
+
+            block = Self::try_creating_block_in_chunk(
+                unsafe { &mut (*self.first_chunk) },
+                size_class,
+                size_class_nbytes(size_class),
+                alloc_alignment,
+            );
         }
 
-        block = Self::try_creating_block_in_chunk(
-            unsafe { &mut (*self.first_chunk) },
-            alloc_nbytes,
-            alloc_alignment,
-        );
+        block
+    }
 
-        let block_p = block as *mut u8;
+    pub fn alloc(&mut self, alloc_nbytes: usize, alloc_alignment: usize) -> *mut Block {
+        let size_class = size_class_index(alloc_nbytes);
 
-        let block_end = unsafe {
-            let data_offset = (*block).data_offset;
-            assert!(data_offset > 0);
-            block_p.add(data_offset as usize).add(alloc_nbytes)
+        let block = if size_class == DIRECT_SIZE_CLASS {
+            self.alloc_direct(alloc_nbytes, alloc_alignment)
+        } else {
+            self.alloc_in_size_class(size_class, alloc_alignment)
         };
 
-        let chunk_p = self.first_chunk as *mut u8;
+        assert!(!block.is_null());
         unsafe {
-            let data_cur = block_end.offset_from(chunk_p);
-            (*self.first_chunk).data_cur = data_cur as u32;
+            (*block).alloc_nbytes = alloc_nbytes as u32;
         }
 
-        assert!(!block.is_null());
         let (p, _) = unsafe { (*block).get_block_data_range() };
         assert!(p.align_offset(alloc_alignment) == 0);
 
@@ -575,66 +653,25 @@ impl FreelistAllocator {
         unsafe {
             (*block).canary_assert();
         }
-        let old_block = self.next_free_block;
-        unsafe {
-            (*block).next_free_block = old_block;
+        let size_class = unsafe { (*block).size_class } as usize;
+        if size_class == DIRECT_SIZE_CLASS {
+            self.dealloc_direct(block);
+            return;
         }
-        self.next_free_block = block;
-    }
-
-    // PRE: Block was allocated with this allocator
-    fn find_chunk(&self, block: *const Block) -> Option<*const Chunk> {
+        let old_block = self.free_blocks[size_class];
         unsafe {
-            (*block).canary_assert();
-        }
-
-        if !self.first_chunk.is_null() {
-            let mut chunk_to_check = self.first_chunk;
-
-            while !chunk_to_check.is_null() {
-                // Safe to deref throughout this block because we checked for null above
-                unsafe {
-                    (*chunk_to_check).canary_assert();
-                }
-                let data_start = unsafe { (*chunk_to_check).get_data_start() };
-                let data_end = unsafe { (chunk_to_check as *const u8).add(self.chunk_nbytes) };
-
-                // Now we just see if the block is in the range.
-                let block_p = block as *const u8;
-
-                if block_p >= data_start && block_p < data_end {
-                    return Some(chunk_to_check);
-                }
-
-                chunk_to_check = unsafe { (*chunk_to_check).next_chunk };
-            }
+            (*block).next_free_block = old_block;
         }
-
-        None
+        self.free_blocks[size_class] = block;
     }
 
-    // PRE: Block was allocated with this allocator
-    pub fn serialize(&self, block: *const Block) -> BlockSerialized {
-        unsafe {
-            (*block).canary_assert();
-        }
-
-        if let Some(chunk) = self.find_chunk(block) {
-            let chunk_p = chunk as *const u8;
-            let block_p = block as *const u8;
-            let offset = unsafe { block_p.offset_from(chunk_p) };
-            assert!(offset > 0);
-
-            BlockSerialized {
-                chunk_name: unsafe { (*chunk).chunk_name },
-                offset,
-            }
-        } else {
-            log_err_and_exit(AllocError::WrongAllocator, None);
+    pub fn destruct(&mut self) {
+        while !self.direct_chunks.is_null() {
+            let chunk = self.direct_chunks;
+            self.direct_chunks = unsafe { (*chunk).next_chunk };
+            deallocate_shared_chunk(chunk);
         }
-    }
 
-    pub fn destruct(&mut self) {
         if !self.first_chunk.is_null() {
             let mut chunk_to_dealloc = self.first_chunk;
 
@@ -648,10 +685,34 @@ impl FreelistAllocator {
             }
 
             self.first_chunk = core::ptr::null_mut();
+            self.free_blocks = [core::ptr::null_mut(); NUM_SIZE_CLASSES];
         }
     }
 }
 
+/// Serializes a block using the chunk offset stored in its header, so this doesn't need access to
+/// the allocator (or its lock).
+///
+/// PRE: Block was allocated by a `FreelistAllocator` in this process.
+pub(crate) fn serialize(block: *const Block) -> BlockSerialized {
+    unsafe {
+        (*block).canary_assert();
+    }
+
+    let offset = unsafe { (*block).chunk_offset } as isize;
+    assert!(offset > 0);
+
+    let chunk = unsafe { (block as *const u8).offset(-offset) } as *const Chunk;
+    if !unsafe { (*chunk).canary_check() } {
+        log_err_and_exit(AllocError::WrongAllocator, None);
+    }
+
+    BlockSerialized {
+        chunk_name: unsafe { (*chunk).chunk_name },
+        offset,
+    }
+}
+
 const CHUNK_CAPACITY: usize = 64;
 
 #[repr(C)]
@@ -685,7 +746,19 @@ impl FreelistDeserializer {
     }
 
     fn map_chunk(&mut self, chunk_name: &PathBuf) -> *mut Chunk {
-        let chunk = view_shared_chunk(chunk_name, self.chunk_nbytes);
+        let mut chunk = view_shared_chunk(chunk_name, self.chunk_nbytes);
+
+        // Chunks holding a single large block have their own size, which we only know once the
+        // chunk header is mapped.
+        let chunk_nbytes = unsafe { (*chunk).chunk_nbytes };
+        if chunk_nbytes != self.chunk_nbytes {
+            if let Err(errno) = munmap(unsafe {
+                core::slice::from_raw_parts_mut(chunk as *mut u8, self.chunk_nbytes)
+            }) {
+                log_err(AllocError::MUnmap, Some(errno));
+            }
+            chunk = view_shared_chunk(chunk_name, chunk_nbytes);
+        }
 
         if self.nmapped_chunks == CHUNK_CAPACITY {
             // Ran out of chunk slots -- we're going to leak the handle.
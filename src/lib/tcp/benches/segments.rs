@@ -0,0 +1,126 @@
+//! Measures the TCP state machine processing segments for a bulk transfer over an established
+//! connection: the client sends application writes of a given size, the segments and ACKs are
+//! exchanged between the two states without loss, and the server reads the data as it arrives.
+
+use std::net::{Ipv4Addr, SocketAddrV4};
+use std::time::{Duration, Instant};
+
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+use tcp::{Dependencies, TcpConfig, TcpState, TimerRegisteredBy};
+
+/// The number of bytes transferred per iteration.
+const TRANSFER_BYTES: usize = 1 << 20;
+
+/// The benchmark doesn't run timers, since no segments are lost and the connection is never
+/// closed.
+#[derive(Debug)]
+struct BenchDeps {
+    start: Instant,
+}
+
+impl Dependencies for BenchDeps {
+    type Instant = Instant;
+    type Duration = Duration;
+
+    fn register_timer(
+        &self,
+        _time: Instant,
+        _f: impl FnOnce(&mut TcpState<Self>, TimerRegisteredBy) + Send + Sync + 'static,
+    ) {
+    }
+
+    // time doesn't advance, so the segments are exchanged with no delay
+    fn current_time(&self) -> Instant {
+        self.start
+    }
+
+    fn fork(&self) -> Self {
+        Self { start: self.start }
+    }
+}
+
+/// Move all pending segments from `from` to `to`. Returns the number of segments moved.
+fn forward(from: &mut TcpState<BenchDeps>, to: &mut TcpState<BenchDeps>) -> usize {
+    let mut count = 0;
+    while let Ok((header, payload)) = from.pop_packet() {
+        to.push_packet(&header, payload).unwrap();
+        count += 1;
+    }
+    count
+}
+
+/// Exchange segments until neither state has any left to send.
+fn exchange(a: &mut TcpState<BenchDeps>, b: &mut TcpState<BenchDeps>) {
+    while forward(a, b) + forward(b, a) > 0 {}
+}
+
+/// Returns an established client state and the server state that it's connected to.
+fn establish() -> (TcpState<BenchDeps>, TcpState<BenchDeps>) {
+    let start = Instant::now();
+    let client_addr = SocketAddrV4::new(Ipv4Addr::new(1, 2, 3, 4), 10);
+    let server_addr = SocketAddrV4::new(Ipv4Addr::new(5, 6, 7, 8), 20);
+
+    let mut listener = TcpState::new(BenchDeps { start }, TcpConfig::default());
+    listener.listen(10, || Ok::<_, ()>(())).unwrap();
+
+    let mut client = TcpState::new(BenchDeps { start }, TcpConfig::default());
+    client
+        .connect(server_addr, || Ok::<_, ()>((client_addr, ())))
+        .unwrap();
+
+    exchange(&mut client, &mut listener);
+
+    let server = listener.accept().unwrap().finalize(|_| ());
+    (client, server)
+}
+
+/// Send `TRANSFER_BYTES` from the client to the server in writes of `write_size` bytes.
+fn transfer(client: &mut TcpState<BenchDeps>, server: &mut TcpState<BenchDeps>, write_size: usize) {
+    let data = vec![0u8; write_size];
+    let mut sink = vec![0u8; 1 << 16];
+    let mut sent = 0;
+    let mut received = 0;
+
+    while received < TRANSFER_BYTES {
+        if sent < TRANSFER_BYTES {
+            // the send buffer may be full until the server's ACKs arrive
+            if let Ok(n) = client.send(&data[..], write_size) {
+                sent += n;
+            }
+        }
+
+        exchange(client, server);
+
+        while let Ok(n) = server.recv(&mut sink[..], sink.len()) {
+            if n == 0 {
+                break;
+            }
+            received += n;
+        }
+    }
+}
+
+fn bench_segments(c: &mut Criterion) {
+    let mut group = c.benchmark_group("tcp_bulk_transfer");
+    group.throughput(Throughput::Bytes(TRANSFER_BYTES as u64));
+
+    // a small write such as a request line, a typical buffered write, and a large write that's
+    // split over many segments
+    for write_size in [100, 4096, 65536] {
+        group.bench_with_input(
+            BenchmarkId::from_parameter(write_size),
+            &write_size,
+            |b, &write_size| {
+                // the receive buffer is read as data arrives, so one connection can be reused for
+                // every iteration
+                let (mut client, mut server) = establish();
+                b.iter(|| transfer(&mut client, &mut server, write_size));
+            },
+        );
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_segments);
+criterion_main!(benches);
@@ -1,4 +1,4 @@
-use std::collections::LinkedList;
+use std::collections::{LinkedList, VecDeque};
 use std::io::{Read, Write};
 
 use bytes::{Buf, Bytes, BytesMut};
@@ -8,7 +8,9 @@ use crate::util::time::Instant;
 
 #[derive(Debug)]
 pub(crate) struct SendQueue<T: Instant> {
-    segments: LinkedList<Segment>,
+    /// The segments and their starting sequence numbers. This is a `VecDeque` rather than a linked
+    /// list so that we can binary search it for a sequence number.
+    segments: VecDeque<(Seq, Segment)>,
     time_last_segment_sent: Option<T>,
     // exclusive
     transmitted_up_to: Seq,
@@ -23,7 +25,7 @@ pub(crate) struct SendQueue<T: Instant> {
 impl<T: Instant> SendQueue<T> {
     pub fn new(initial_seq: Seq) -> Self {
         let mut queue = Self {
-            segments: LinkedList::new(),
+            segments: VecDeque::new(),
             time_last_segment_sent: None,
             transmitted_up_to: initial_seq,
             start_seq: initial_seq,
@@ -107,8 +109,9 @@ impl<T: Instant> SendQueue<T> {
             return;
         }
 
-        self.end_seq += seg.len();
-        self.segments.push_back(seg);
+        let len = seg.len();
+        self.segments.push_back((self.end_seq, seg));
+        self.end_seq += len;
     }
 
     pub fn start_seq(&self) -> Seq {
@@ -134,7 +137,7 @@ impl<T: Instant> SendQueue<T> {
             let advance_by = new_start - self.start_seq;
 
             // this shouldn't panic due to the assertion above
-            let front = self.segments.front_mut().unwrap();
+            let (front_seq, front) = self.segments.front_mut().unwrap();
 
             // if the chunk would be completely removed
             if front.len() <= advance_by {
@@ -155,12 +158,12 @@ impl<T: Instant> SendQueue<T> {
             assert!(!data.is_empty());
 
             self.start_seq += advance_by;
+            *front_seq = self.start_seq;
         }
     }
 
     /// Get the next segment that has not yet been transmitted. The `offset` argument can be used to
     /// return the next segment starting at `offset` bytes from the next non-transmitted segment.
-    // TODO: this is slow and is called often
     pub fn next_not_transmitted(&self, offset: u32) -> Option<(Seq, Segment)> {
         // the sequence number of the segment we want to return
         let target_seq = self.transmitted_up_to + offset;
@@ -170,33 +173,32 @@ impl<T: Instant> SendQueue<T> {
             return None;
         }
 
-        let mut seq_cursor = self.start_seq;
-        for seg in &self.segments {
-            let len = seg.len();
-
-            // if the target sequence number is within this segment
-            if SeqRange::new(seq_cursor, seq_cursor + len).contains(target_seq) {
-                let new_segment = match seg {
-                    Segment::Syn => Segment::Syn,
-                    Segment::Fin => Segment::Fin,
-                    Segment::Data(chunk) => {
-                        // the target sequence number might be somewhere within this chunk, so we
-                        // need to trim any bytes with a lower sequence number
-                        let chunk_offset = target_seq - seq_cursor;
-                        let chunk_offset: usize = chunk_offset.try_into().unwrap();
-                        Segment::Data(chunk.slice(chunk_offset..))
-                    }
-                };
-
-                return Some((target_seq, new_segment));
+        // The segments are sorted by their starting sequence number, so find the last segment that
+        // starts at or before the target sequence number. We compare offsets from the start of the
+        // buffer since sequence numbers wrap around.
+        let target_offset = target_seq - self.start_seq;
+        let index = self
+            .segments
+            .partition_point(|(seq, _)| *seq - self.start_seq <= target_offset);
+
+        // we confirmed above that the target sequence number is contained within the buffer, and
+        // the first segment starts at the start of the buffer
+        let (seg_seq, seg) = &self.segments[index.checked_sub(1).unwrap()];
+        debug_assert!(SeqRange::new(*seg_seq, *seg_seq + seg.len()).contains(target_seq));
+
+        let new_segment = match seg {
+            Segment::Syn => Segment::Syn,
+            Segment::Fin => Segment::Fin,
+            Segment::Data(chunk) => {
+                // the target sequence number might be somewhere within this chunk, so we need to
+                // trim any bytes with a lower sequence number
+                let chunk_offset = target_seq - *seg_seq;
+                let chunk_offset: usize = chunk_offset.try_into().unwrap();
+                Segment::Data(chunk.slice(chunk_offset..))
             }
+        };
 
-            seq_cursor += len;
-        }
-
-        // we confirmed above that the target sequence number is contained within the buffer, but we
-        // looped over all segments in the buffer and didn't find it
-        unreachable!();
+        Some((target_seq, new_segment))
     }
 
     pub fn mark_as_transmitted(&mut self, up_to: Seq, time: T) {
@@ -348,3 +350,78 @@ impl Segment {
         }
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn data_queue(initial_seq: Seq, chunks: &[&[u8]]) -> SendQueue<std::time::Instant> {
+        let mut queue = SendQueue::new(initial_seq);
+        for chunk in chunks {
+            queue.add_data(*chunk, chunk.len()).unwrap();
+        }
+        queue
+    }
+
+    fn data(segment: Segment) -> Bytes {
+        match segment {
+            Segment::Data(data) => data,
+            x => panic!("Unexpected segment: {x:?}"),
+        }
+    }
+
+    #[test]
+    fn test_next_not_transmitted() {
+        // sequence numbers wrap around within the buffer
+        let initial_seq = Seq::new(u32::MAX - 3);
+        let mut queue = data_queue(initial_seq, &[b"hello", b"world"]);
+        queue.add_fin();
+
+        let (seq, segment) = queue.next_not_transmitted(0).unwrap();
+        assert_eq!(seq, initial_seq);
+        assert!(matches!(segment, Segment::Syn));
+
+        let (seq, segment) = queue.next_not_transmitted(1).unwrap();
+        assert_eq!(seq, initial_seq + 1);
+        assert_eq!(data(segment), &b"hello"[..]);
+
+        let (seq, segment) = queue.next_not_transmitted(4).unwrap();
+        assert_eq!(seq, initial_seq + 4);
+        assert_eq!(data(segment), &b"lo"[..]);
+
+        let (seq, segment) = queue.next_not_transmitted(6).unwrap();
+        assert_eq!(seq, initial_seq + 6);
+        assert_eq!(data(segment), &b"world"[..]);
+
+        let (seq, segment) = queue.next_not_transmitted(11).unwrap();
+        assert_eq!(seq, initial_seq + 11);
+        assert!(matches!(segment, Segment::Fin));
+
+        assert!(queue.next_not_transmitted(12).is_none());
+    }
+
+    #[test]
+    fn test_next_not_transmitted_after_advance() {
+        let initial_seq = Seq::new(100);
+        let mut queue = data_queue(initial_seq, &[b"hello", b"world"]);
+        let now = std::time::Instant::now();
+
+        queue.mark_as_transmitted(initial_seq + 4, now);
+        // acknowledge part of the first data segment
+        queue.advance_start(initial_seq + 3);
+
+        let (seq, segment) = queue.next_not_transmitted(0).unwrap();
+        assert_eq!(seq, initial_seq + 4);
+        assert_eq!(data(segment), &b"lo"[..]);
+
+        let (seq, segment) = queue.next_not_transmitted(3).unwrap();
+        assert_eq!(seq, initial_seq + 7);
+        assert_eq!(data(segment), &b"orld"[..]);
+
+        queue.advance_start(initial_seq + 8);
+        let (seq, segment) = queue.next_not_transmitted(4).unwrap();
+        assert_eq!(seq, initial_seq + 8);
+        assert_eq!(data(segment), &b"rld"[..]);
+        assert!(queue.next_not_transmitted(7).is_none());
+    }
+}
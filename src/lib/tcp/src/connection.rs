@@ -4,7 +4,7 @@ use std::net::SocketAddrV4;
 
 use crate::buffer::{RecvQueue, Segment};
 use crate::seq::{Seq, SeqRange};
-use crate::util::time::Instant;
+use crate::util::time::{Duration, Instant};
 use crate::window_scaling::WindowScaling;
 use crate::{
     Ipv4Header, Payload, PopPacketError, PushPacketError, RecvError, SendError, TcpConfig,
@@ -20,6 +20,11 @@ pub(crate) struct Connection<I: Instant> {
     pub(crate) send: ConnectionSend<I>,
     pub(crate) recv: Option<ConnectionRecv>,
     pub(crate) need_to_ack: bool,
+    /// If set, we're holding back the acknowledgement that we need to send until this time (or
+    /// until we receive another segment).
+    pub(crate) delayed_ack_deadline: Option<I>,
+    /// Set when we start delaying an acknowledgement, until the state registers a timer for it.
+    pub(crate) delayed_ack_timer_needed: bool,
     pub(crate) last_advertised_window: Option<u32>,
     pub(crate) window_scaling: WindowScaling,
     pub(crate) send_rst_if_recv_payload: bool,
@@ -33,6 +38,10 @@ impl<I: Instant> Connection<I> {
     const SEND_BUF_MAX: usize = 100_000;
     const RECV_BUF_MAX: u32 = 100_000;
 
+    /// How long to delay an acknowledgement for. This is Linux's minimum delayed ACK timeout
+    /// (`TCP_DELACK_MIN`).
+    const DELAYED_ACK_TIMEOUT_MS: u64 = 40;
+
     pub fn new(
         local_addr: SocketAddrV4,
         remote_addr: SocketAddrV4,
@@ -46,6 +55,8 @@ impl<I: Instant> Connection<I> {
             send: ConnectionSend::new(send_initial_seq),
             recv: None,
             need_to_ack: true,
+            delayed_ack_deadline: None,
+            delayed_ack_timer_needed: false,
             last_advertised_window: None,
             window_scaling: WindowScaling::new(),
             send_rst_if_recv_payload: false,
@@ -120,6 +131,7 @@ impl<I: Instant> Connection<I> {
         &mut self,
         header: &TcpHeader,
         payload: Payload,
+        now: I,
     ) -> Result<u32, PushPacketError> {
         if self.is_reset {
             panic!(
@@ -171,7 +183,7 @@ impl<I: Instant> Connection<I> {
                 // if this really matters in practice since the peer would receive the packet and
                 // send another RST packet based on the ACK value we send.
 
-                self.need_to_ack = true;
+                self.ack_now();
                 return Ok(0);
             }
 
@@ -210,7 +222,7 @@ impl<I: Instant> Connection<I> {
             // the sequence range of the segment does not overlap with the receive window, so we
             // must drop the packet and send an ACK
 
-            self.need_to_ack = true;
+            self.ack_now();
             return Ok(0);
         };
 
@@ -237,6 +249,7 @@ impl<I: Instant> Connection<I> {
         }
 
         let mut pushed_len = 0;
+        let payload_len = payload.len();
         // the receive buffer's initial next sequence number; useful so we can check if we need to
         // acknowledge or not
         let initial_seq = recv.buffer.next_seq();
@@ -262,7 +275,6 @@ impl<I: Instant> Connection<I> {
                 0
             };
 
-            let payload_len = payload.len();
             let payload_seq = (payload_len != 0).then_some(Seq::new(header.seq) + syn_len);
             let fin_seq = header
                 .flags
@@ -293,7 +305,28 @@ impl<I: Instant> Connection<I> {
         // we've added to the receive buffer (payload, syn, or fin), so we need to send an
         // acknowledgement
         if recv.buffer.next_seq() != initial_seq {
-            self.need_to_ack = true;
+            // RFC 1122 4.2.3.2.:
+            // > A TCP SHOULD implement a delayed ACK, but an ACK should not be excessively delayed;
+            // > in particular, the delay MUST be less than 0.5 seconds, and in a stream of
+            // > full-sized segments there SHOULD be an ACK for at least every second segment.
+            //
+            // We only delay acknowledging payload, and acknowledge every second segment.
+            let only_payload = !header.flags.intersects(TcpFlags::SYN | TcpFlags::FIN);
+            if self.config.delayed_ack_enabled
+                && only_payload
+                && !self.need_to_ack
+                && self.delayed_ack_deadline.is_none()
+            {
+                self.need_to_ack = true;
+                self.delayed_ack_deadline =
+                    Some(now + I::Duration::from_millis(Self::DELAYED_ACK_TIMEOUT_MS));
+                self.delayed_ack_timer_needed = true;
+            } else {
+                self.ack_now();
+            }
+        } else if payload_len != 0 && self.delayed_ack_deadline.is_some() {
+            // the payload was a duplicate or out of order, so don't keep the peer waiting
+            self.ack_now();
         }
 
         // update the send window, applying the window scale shift only if it wasn't a SYN packet
@@ -405,6 +438,7 @@ impl<I: Instant> Connection<I> {
 
         // we're sending the most up-to-date acknowledgement
         self.need_to_ack = false;
+        self.delayed_ack_deadline = None;
 
         // inform the buffer that we transmitted this segment
         self.send.buffer.mark_as_transmitted(seq_range.end, now);
@@ -469,7 +503,7 @@ impl<I: Instant> Connection<I> {
             let mut send_empty_packet = false;
 
             // do we need to send an acknowledgement?
-            if self.need_to_ack {
+            if self.need_to_ack && self.delayed_ack_deadline.is_none() {
                 send_empty_packet = true;
             }
 
@@ -479,7 +513,14 @@ impl<I: Instant> Connection<I> {
 
                 let apparent_window = window >> window_scale << window_scale;
 
-                if self.last_advertised_window != Some(apparent_window) {
+                // the peer already knows that the window shrank by the payload that we're delaying
+                // the acknowledgement of
+                let shrank_by_delayed_payload = self.delayed_ack_deadline.is_some()
+                    && self.last_advertised_window > Some(apparent_window);
+
+                if self.last_advertised_window != Some(apparent_window)
+                    && !shrank_by_delayed_payload
+                {
                     send_empty_packet = true;
                 }
             }
@@ -582,6 +623,29 @@ impl<I: Instant> Connection<I> {
         None
     }
 
+    /// Send an acknowledgement with the next packet, without delaying it.
+    fn ack_now(&mut self) {
+        self.need_to_ack = true;
+        self.delayed_ack_deadline = None;
+    }
+
+    /// Returns when the delayed acknowledgement should be sent if we started delaying one since
+    /// the last call, so that a timer can be registered for it.
+    pub fn take_delayed_ack_timer(&mut self) -> Option<I> {
+        if !std::mem::take(&mut self.delayed_ack_timer_needed) {
+            return None;
+        }
+        self.delayed_ack_deadline
+    }
+
+    /// The timer for the delayed acknowledgement that was due at `deadline` fired. If we're still
+    /// delaying that acknowledgement, stop delaying it.
+    pub fn delayed_ack_timeout(&mut self, deadline: I) {
+        if self.delayed_ack_deadline == Some(deadline) {
+            self.delayed_ack_deadline = None;
+        }
+    }
+
     /// Returns true if we received a RST packet, or if we want to send a RST packet.
     pub fn is_reset(&self) -> bool {
         self.is_reset
@@ -616,6 +680,12 @@ impl<I: Instant> Connection<I> {
         send_buffer_len < Self::SEND_BUF_MAX
     }
 
+    /// The number of bytes in the send and receive buffers.
+    pub fn buffer_lens(&self) -> (u32, u32) {
+        let recv_buffer_len = self.recv.as_ref().map(|x| x.buffer.len()).unwrap_or(0);
+        (self.send.buffer.len(), recv_buffer_len)
+    }
+
     /// Returns true if the recv buffer has data to read. Does not consider whether the connection
     /// is open/closed, either due to FIN packets or `shutdown()`.
     pub fn recv_buf_has_data(&self) -> bool {
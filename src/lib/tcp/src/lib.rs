@@ -238,6 +238,9 @@ where
     fn wants_to_send(&self) -> bool;
 
     fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)>;
+
+    /// The number of bytes in the send and receive buffers.
+    fn buffer_lens(&self) -> (u32, u32);
 }
 
 #[derive(Debug)]
@@ -338,6 +341,13 @@ impl<X: Dependencies> TcpState<X> {
     pub fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)> {
         self.0.as_ref().unwrap().local_remote_addrs()
     }
+
+    /// The number of bytes in the send and receive buffers. For a listening socket, this includes
+    /// the buffers of its child connections that haven't been accept()ed yet.
+    #[inline]
+    pub fn buffer_lens(&self) -> (u32, u32) {
+        self.0.as_ref().unwrap().buffer_lens()
+    }
 }
 
 /// A macro that forwards an argument-less method to the inner type.
@@ -645,18 +655,26 @@ bitflags::bitflags! {
 #[non_exhaustive]
 pub struct TcpConfig {
     pub(crate) window_scaling_enabled: bool,
+    pub(crate) delayed_ack_enabled: bool,
 }
 
 impl TcpConfig {
     pub fn window_scaling(&mut self, enable: bool) {
         self.window_scaling_enabled = enable;
     }
+
+    /// Delay acknowledging received payload, acknowledging every second segment or after a
+    /// timeout, rather than acknowledging each segment.
+    pub fn delayed_ack(&mut self, enable: bool) {
+        self.delayed_ack_enabled = enable;
+    }
 }
 
 impl Default for TcpConfig {
     fn default() -> Self {
         Self {
             window_scaling_enabled: true,
+            delayed_ack_enabled: false,
         }
     }
 }
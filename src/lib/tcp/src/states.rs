@@ -140,14 +140,105 @@ pub(crate) struct Common<X: Dependencies> {
     /// can use to lookup ths child state.
     pub(crate) child_key: Option<ChildTcpKey>,
     pub(crate) error: Option<TcpError>,
+    pub(crate) timers: TimerSlot<X>,
+}
+
+type TimerCallback<X> = Box<dyn FnOnce(TcpStateEnum<X>) -> TcpStateEnum<X> + Send + Sync>;
+
+/// The timers of a state. Rather than registering a timer with the [`Dependencies`] for each of
+/// the state's timers, the callbacks are kept here and a dependency timer is only registered when
+/// none of the already registered ones will fire by the earliest deadline. When a dependency timer
+/// fires it runs all of the callbacks that are due.
+pub(crate) struct TimerSlot<X: Dependencies> {
+    /// The callbacks that haven't run yet, and when they should run.
+    pending: Vec<(X::Instant, TimerCallback<X>)>,
+    /// The deadlines of the dependency timers that haven't fired yet.
+    registered: Vec<X::Instant>,
+}
+
+impl<X: Dependencies> TimerSlot<X> {
+    pub fn new() -> Self {
+        Self {
+            pending: Vec::new(),
+            registered: Vec::new(),
+        }
+    }
+
+    /// The earliest deadline that doesn't have a dependency timer to run it, if any.
+    fn deadline_to_register(&self) -> Option<X::Instant> {
+        let earliest = self.pending.iter().map(|(time, _)| *time).min()?;
+        if self.registered.iter().any(|x| *x <= earliest) {
+            return None;
+        }
+        Some(earliest)
+    }
+
+    /// Take the callbacks that are due at `now`, in the order that they were registered.
+    fn take_due(&mut self, now: X::Instant) -> Vec<TimerCallback<X>> {
+        let mut due = Vec::new();
+        let mut i = 0;
+        while i < self.pending.len() {
+            if self.pending[i].0 <= now {
+                due.push(self.pending.remove(i).1);
+            } else {
+                i += 1;
+            }
+        }
+        due
+    }
+}
+
+impl<X: Dependencies> std::fmt::Debug for TimerSlot<X> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("TimerSlot")
+            .field(
+                "pending",
+                &self
+                    .pending
+                    .iter()
+                    .map(|(time, _)| time)
+                    .collect::<Vec<_>>(),
+            )
+            .field("registered", &self.registered)
+            .finish()
+    }
 }
 
 impl<X: Dependencies> Common<X> {
+    pub fn new(deps: X, child_key: Option<ChildTcpKey>) -> Self {
+        Self {
+            deps,
+            child_key,
+            error: None,
+            timers: TimerSlot::new(),
+        }
+    }
+
     /// Register a timer for this state.
     ///
     /// This method will make sure that the callback gets run on the correct state, even if called
     /// by a child state.
     pub fn register_timer(
+        &mut self,
+        time: X::Instant,
+        f: impl FnOnce(TcpStateEnum<X>) -> TcpStateEnum<X> + Send + Sync + 'static,
+    ) {
+        self.timers.pending.push((time, Box::new(f)));
+        self.register_deps_timer_if_needed();
+    }
+
+    /// Register a dependency timer for the earliest pending timer if there's no registered
+    /// dependency timer that will fire by then.
+    fn register_deps_timer_if_needed(&mut self) {
+        let Some(time) = self.timers.deadline_to_register() else {
+            return;
+        };
+        self.timers.registered.push(time);
+        self.register_deps_timer(time, move |state| run_due_timers(state, time));
+    }
+
+    /// Register a timer with the dependencies.
+    fn register_deps_timer(
         &self,
         time: X::Instant,
         f: impl FnOnce(TcpStateEnum<X>) -> TcpStateEnum<X> + Send + Sync + 'static,
@@ -216,6 +307,79 @@ impl<X: Dependencies> Common<X> {
 
         false
     }
+
+    /// Register a timer to send the connection's acknowledgement if it started delaying one.
+    pub fn register_delayed_ack_timer(&mut self, connection: &mut Connection<X::Instant>) {
+        let Some(deadline) = connection.take_delayed_ack_timer() else {
+            return;
+        };
+
+        self.register_timer(deadline, move |mut state| {
+            if let Some(connection) = state.connection_mut() {
+                connection.delayed_ack_timeout(deadline);
+            }
+            state
+        });
+    }
+}
+
+/// Run the state's timers that are due. This is the callback of each dependency timer registered
+/// for a [`TimerSlot`], where `time` is when the dependency timer was registered to fire.
+fn run_due_timers<X: Dependencies>(
+    mut state: TcpStateEnum<X>,
+    time: X::Instant,
+) -> TcpStateEnum<X> {
+    let common = state.common_mut();
+    let registered = &mut common.timers.registered;
+    if let Some(i) = registered.iter().position(|x| *x == time) {
+        registered.swap_remove(i);
+    }
+
+    let now = common.current_time();
+    for f in common.timers.take_due(now) {
+        state = f(state);
+    }
+
+    // the callbacks may have registered new timers, or there may be pending timers that the
+    // dependency timer that just fired was covering
+    state.common_mut().register_deps_timer_if_needed();
+
+    state
+}
+
+impl<X: Dependencies> TcpStateEnum<X> {
+    fn common_mut(&mut self) -> &mut Common<X> {
+        match self {
+            Self::Init(x) => &mut x.common,
+            Self::Listen(x) => &mut x.common,
+            Self::SynSent(x) => &mut x.common,
+            Self::SynReceived(x) => &mut x.common,
+            Self::Established(x) => &mut x.common,
+            Self::FinWaitOne(x) => &mut x.common,
+            Self::FinWaitTwo(x) => &mut x.common,
+            Self::Closing(x) => &mut x.common,
+            Self::TimeWait(x) => &mut x.common,
+            Self::CloseWait(x) => &mut x.common,
+            Self::LastAck(x) => &mut x.common,
+            Self::Rst(x) => &mut x.common,
+            Self::Closed(x) => &mut x.common,
+        }
+    }
+
+    fn connection_mut(&mut self) -> Option<&mut Connection<X::Instant>> {
+        match self {
+            Self::SynSent(x) => Some(&mut x.connection),
+            Self::SynReceived(x) => Some(&mut x.connection),
+            Self::Established(x) => Some(&mut x.connection),
+            Self::FinWaitOne(x) => Some(&mut x.connection),
+            Self::FinWaitTwo(x) => Some(&mut x.connection),
+            Self::Closing(x) => Some(&mut x.connection),
+            Self::TimeWait(x) => Some(&mut x.connection),
+            Self::CloseWait(x) => Some(&mut x.connection),
+            Self::LastAck(x) => Some(&mut x.connection),
+            Self::Init(_) | Self::Listen(_) | Self::Rst(_) | Self::Closed(_) => None,
+        }
+    }
 }
 
 /// A pair of remote and local addresses, typically used to represent a connection (the 4-tuple).
@@ -249,11 +413,7 @@ pub(crate) struct ChildEntry<X: Dependencies> {
 
 impl<X: Dependencies> InitState<X> {
     pub fn new(deps: X, config: TcpConfig) -> Self {
-        let common = Common {
-            deps,
-            child_key: None,
-            error: None,
-        };
+        let common = Common::new(deps, None);
 
         InitState { common, config }
     }
@@ -341,6 +501,10 @@ impl<X: Dependencies> TcpStateTrait<X> for InitState<X> {
     fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)> {
         None
     }
+
+    fn buffer_lens(&self) -> (u32, u32) {
+        (0, 0)
+    }
 }
 
 impl<X: Dependencies> ListenState<X> {
@@ -362,18 +526,16 @@ impl<X: Dependencies> ListenState<X> {
         let conn_addrs = RemoteLocalPair::new(header.src(), header.dst());
 
         let key = self.children.insert_with_key(|key| {
-            let common = Common {
-                deps: self.common.deps.fork(),
-                child_key: Some(key),
-                error: None,
-            };
+            let common = Common::new(self.common.deps.fork(), Some(key));
 
             assert!(header.flags.contains(TcpFlags::SYN));
             assert!(!header.flags.contains(TcpFlags::RST));
 
             let mut connection =
                 Connection::new(header.dst(), header.src(), Seq::new(0), self.config);
-            connection.push_packet(header, payload).unwrap();
+            connection
+                .push_packet(header, payload, self.common.current_time())
+                .unwrap();
 
             let new_tcp = SynReceivedState::new(common, connection);
 
@@ -734,11 +896,20 @@ impl<X: Dependencies> TcpStateTrait<X> for ListenState<X> {
     fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)> {
         None
     }
+
+    fn buffer_lens(&self) -> (u32, u32) {
+        // the children's buffers are owned by this socket until they're accept()ed
+        self.children
+            .values()
+            .filter_map(|child| child.state.as_ref())
+            .map(|state| state.buffer_lens())
+            .fold((0, 0), |(send, recv), (x, y)| (send + x, recv + y))
+    }
 }
 
 impl<X: Dependencies> SynSentState<X> {
     fn new(common: Common<X>, connection: Connection<X::Instant>) -> Self {
-        let state = SynSentState { common, connection };
+        let mut state = SynSentState { common, connection };
 
         // if still in the "syn-sent" state after 60 seconds, close it
         let timeout = state.common.current_time() + X::Duration::from_secs(60);
@@ -830,10 +1001,12 @@ impl<X: Dependencies> TcpStateTrait<X> for SynSentState<X> {
             return (self.into(), Ok(0));
         }
 
-        let pushed_len = match self.connection.push_packet(header, payload) {
+        let now = self.common.current_time();
+        let pushed_len = match self.connection.push_packet(header, payload, now) {
             Ok(v) => v,
             Err(e) => return (self.into(), Err(e)),
         };
+        self.common.register_delayed_ack_timer(&mut self.connection);
 
         // if the connection was reset
         if self.connection.is_reset() {
@@ -893,11 +1066,15 @@ impl<X: Dependencies> TcpStateTrait<X> for SynSentState<X> {
     fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)> {
         Some((self.connection.local_addr, self.connection.remote_addr))
     }
+
+    fn buffer_lens(&self) -> (u32, u32) {
+        self.connection.buffer_lens()
+    }
 }
 
 impl<X: Dependencies> SynReceivedState<X> {
     fn new(common: Common<X>, connection: Connection<X::Instant>) -> Self {
-        let state = SynReceivedState { common, connection };
+        let mut state = SynReceivedState { common, connection };
 
         // if still in the "syn-received" state after 60 seconds, close it with a RST
         let timeout = state.common.current_time() + X::Duration::from_secs(60);
@@ -991,10 +1168,12 @@ impl<X: Dependencies> TcpStateTrait<X> for SynReceivedState<X> {
             return (self.into(), Ok(0));
         }
 
-        let pushed_len = match self.connection.push_packet(header, payload) {
+        let now = self.common.current_time();
+        let pushed_len = match self.connection.push_packet(header, payload, now) {
             Ok(v) => v,
             Err(e) => return (self.into(), Err(e)),
         };
+        self.common.register_delayed_ack_timer(&mut self.connection);
 
         // if the connection was reset
         if self.connection.is_reset() {
@@ -1046,6 +1225,10 @@ impl<X: Dependencies> TcpStateTrait<X> for SynReceivedState<X> {
     fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)> {
         Some((self.connection.local_addr, self.connection.remote_addr))
     }
+
+    fn buffer_lens(&self) -> (u32, u32) {
+        self.connection.buffer_lens()
+    }
 }
 
 impl<X: Dependencies> EstablishedState<X> {
@@ -1130,10 +1313,12 @@ impl<X: Dependencies> TcpStateTrait<X> for EstablishedState<X> {
             return (self.into(), Ok(0));
         }
 
-        let pushed_len = match self.connection.push_packet(header, payload) {
+        let now = self.common.current_time();
+        let pushed_len = match self.connection.push_packet(header, payload, now) {
             Ok(v) => v,
             Err(e) => return (self.into(), Err(e)),
         };
+        self.common.register_delayed_ack_timer(&mut self.connection);
 
         // if the connection was reset
         if self.connection.is_reset() {
@@ -1193,6 +1378,10 @@ impl<X: Dependencies> TcpStateTrait<X> for EstablishedState<X> {
     fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)> {
         Some((self.connection.local_addr, self.connection.remote_addr))
     }
+
+    fn buffer_lens(&self) -> (u32, u32) {
+        self.connection.buffer_lens()
+    }
 }
 
 impl<X: Dependencies> FinWaitOneState<X> {
@@ -1261,10 +1450,12 @@ impl<X: Dependencies> TcpStateTrait<X> for FinWaitOneState<X> {
             return (self.into(), Ok(0));
         }
 
-        let pushed_len = match self.connection.push_packet(header, payload) {
+        let now = self.common.current_time();
+        let pushed_len = match self.connection.push_packet(header, payload, now) {
             Ok(v) => v,
             Err(e) => return (self.into(), Err(e)),
         };
+        self.common.register_delayed_ack_timer(&mut self.connection);
 
         // if the connection was reset
         if self.connection.is_reset() {
@@ -1336,6 +1527,10 @@ impl<X: Dependencies> TcpStateTrait<X> for FinWaitOneState<X> {
     fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)> {
         Some((self.connection.local_addr, self.connection.remote_addr))
     }
+
+    fn buffer_lens(&self) -> (u32, u32) {
+        self.connection.buffer_lens()
+    }
 }
 
 impl<X: Dependencies> FinWaitTwoState<X> {
@@ -1404,10 +1599,12 @@ impl<X: Dependencies> TcpStateTrait<X> for FinWaitTwoState<X> {
             return (self.into(), Ok(0));
         }
 
-        let pushed_len = match self.connection.push_packet(header, payload) {
+        let now = self.common.current_time();
+        let pushed_len = match self.connection.push_packet(header, payload, now) {
             Ok(v) => v,
             Err(e) => return (self.into(), Err(e)),
         };
+        self.common.register_delayed_ack_timer(&mut self.connection);
 
         // if the connection was reset
         if self.connection.is_reset() {
@@ -1467,6 +1664,10 @@ impl<X: Dependencies> TcpStateTrait<X> for FinWaitTwoState<X> {
     fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)> {
         Some((self.connection.local_addr, self.connection.remote_addr))
     }
+
+    fn buffer_lens(&self) -> (u32, u32) {
+        self.connection.buffer_lens()
+    }
 }
 
 impl<X: Dependencies> ClosingState<X> {
@@ -1542,10 +1743,12 @@ impl<X: Dependencies> TcpStateTrait<X> for ClosingState<X> {
             return (self.into(), Ok(0));
         }
 
-        let pushed_len = match self.connection.push_packet(header, payload) {
+        let now = self.common.current_time();
+        let pushed_len = match self.connection.push_packet(header, payload, now) {
             Ok(v) => v,
             Err(e) => return (self.into(), Err(e)),
         };
+        self.common.register_delayed_ack_timer(&mut self.connection);
 
         // if the connection was reset
         if self.connection.is_reset() {
@@ -1609,11 +1812,15 @@ impl<X: Dependencies> TcpStateTrait<X> for ClosingState<X> {
     fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)> {
         Some((self.connection.local_addr, self.connection.remote_addr))
     }
+
+    fn buffer_lens(&self) -> (u32, u32) {
+        self.connection.buffer_lens()
+    }
 }
 
 impl<X: Dependencies> TimeWaitState<X> {
     fn new(common: Common<X>, connection: Connection<X::Instant>) -> Self {
-        let state = TimeWaitState { common, connection };
+        let mut state = TimeWaitState { common, connection };
 
         // taken from /proc/sys/net/ipv4/tcp_fin_timeout
         let timeout = X::Duration::from_secs(60);
@@ -1700,10 +1907,12 @@ impl<X: Dependencies> TcpStateTrait<X> for TimeWaitState<X> {
         }
 
         // TODO: send RST for all packets?
-        let pushed_len = match self.connection.push_packet(header, payload) {
+        let now = self.common.current_time();
+        let pushed_len = match self.connection.push_packet(header, payload, now) {
             Ok(v) => v,
             Err(e) => return (self.into(), Err(e)),
         };
+        self.common.register_delayed_ack_timer(&mut self.connection);
 
         // if the connection was reset
         if self.connection.is_reset() {
@@ -1759,6 +1968,10 @@ impl<X: Dependencies> TcpStateTrait<X> for TimeWaitState<X> {
     fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)> {
         Some((self.connection.local_addr, self.connection.remote_addr))
     }
+
+    fn buffer_lens(&self) -> (u32, u32) {
+        self.connection.buffer_lens()
+    }
 }
 
 impl<X: Dependencies> CloseWaitState<X> {
@@ -1850,10 +2063,12 @@ impl<X: Dependencies> TcpStateTrait<X> for CloseWaitState<X> {
             return (self.into(), Ok(0));
         }
 
-        let pushed_len = match self.connection.push_packet(header, payload) {
+        let now = self.common.current_time();
+        let pushed_len = match self.connection.push_packet(header, payload, now) {
             Ok(v) => v,
             Err(e) => return (self.into(), Err(e)),
         };
+        self.common.register_delayed_ack_timer(&mut self.connection);
 
         // if the connection was reset
         if self.connection.is_reset() {
@@ -1909,6 +2124,10 @@ impl<X: Dependencies> TcpStateTrait<X> for CloseWaitState<X> {
     fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)> {
         Some((self.connection.local_addr, self.connection.remote_addr))
     }
+
+    fn buffer_lens(&self) -> (u32, u32) {
+        self.connection.buffer_lens()
+    }
 }
 
 impl<X: Dependencies> LastAckState<X> {
@@ -1984,10 +2203,12 @@ impl<X: Dependencies> TcpStateTrait<X> for LastAckState<X> {
             return (self.into(), Ok(0));
         }
 
-        let pushed_len = match self.connection.push_packet(header, payload) {
+        let now = self.common.current_time();
+        let pushed_len = match self.connection.push_packet(header, payload, now) {
             Ok(v) => v,
             Err(e) => return (self.into(), Err(e)),
         };
+        self.common.register_delayed_ack_timer(&mut self.connection);
 
         // if the connection was reset
         if self.connection.is_reset() {
@@ -2051,6 +2272,10 @@ impl<X: Dependencies> TcpStateTrait<X> for LastAckState<X> {
     fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)> {
         Some((self.connection.local_addr, self.connection.remote_addr))
     }
+
+    fn buffer_lens(&self) -> (u32, u32) {
+        self.connection.buffer_lens()
+    }
 }
 
 impl<X: Dependencies> RstState<X> {
@@ -2181,6 +2406,10 @@ impl<X: Dependencies> TcpStateTrait<X> for RstState<X> {
     fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)> {
         None
     }
+
+    fn buffer_lens(&self) -> (u32, u32) {
+        (0, 0)
+    }
 }
 
 impl<X: Dependencies> ClosedState<X> {
@@ -2294,6 +2523,10 @@ impl<X: Dependencies> TcpStateTrait<X> for ClosedState<X> {
     fn local_remote_addrs(&self) -> Option<(SocketAddrV4, SocketAddrV4)> {
         None
     }
+
+    fn buffer_lens(&self) -> (u32, u32) {
+        (0, self.recv_buffer.len())
+    }
 }
 
 /// Reset the connection, get the resulting RST packet, and return a new `RstState` that will send
@@ -839,12 +839,21 @@ fn verify_send_sync() {
 /// Returns an established socket that is bound to the host's IP at port 10 and connected to
 /// 5.6.7.8:20.
 fn establish_helper(scheduler: &Scheduler, host: &mut Host) -> Rc<RefCell<TcpSocket>> {
+    establish_helper_with_config(scheduler, host, TcpConfig::default())
+}
+
+/// Same as [`establish_helper`], but with the given config.
+fn establish_helper_with_config(
+    scheduler: &Scheduler,
+    host: &mut Host,
+    config: TcpConfig,
+) -> Rc<RefCell<TcpSocket>> {
     /// Helper to get the state from a socket.
     fn s(tcp: &Rc<RefCell<TcpSocket>>) -> Ref<TcpState<TestEnvState>> {
         Ref::map(tcp.borrow(), |x| x.tcp_state())
     }
 
-    let tcp = TcpSocket::new(scheduler, TcpConfig::default());
+    let tcp = TcpSocket::new(scheduler, config);
     assert!(s(&tcp).as_init().is_some());
 
     TcpSocket::bind(&tcp, SocketAddrV4::new(host.ip_addr, 10), host).unwrap();
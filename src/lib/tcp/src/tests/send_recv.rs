@@ -5,8 +5,10 @@ use std::rc::Rc;
 
 use bytes::Bytes;
 
-use crate::tests::{Host, Scheduler, TcpSocket, TestEnvState, establish_helper};
-use crate::{Ipv4Header, Payload, Shutdown, TcpFlags, TcpHeader, TcpState};
+use crate::tests::{
+    Host, Scheduler, TcpSocket, TestEnvState, establish_helper, establish_helper_with_config,
+};
+use crate::{Ipv4Header, Payload, Shutdown, TcpConfig, TcpFlags, TcpHeader, TcpState};
 
 #[test]
 fn test_send_recv() {
@@ -57,6 +59,49 @@ fn test_send_recv() {
     assert_eq!(recv_buf, b"world");
 }
 
+#[test]
+fn test_buffer_lens() {
+    let scheduler = Scheduler::new();
+    let mut host = Host::new();
+
+    fn buffer_lens(tcp: &Rc<RefCell<TcpSocket>>) -> (u32, u32) {
+        tcp.borrow().tcp_state().buffer_lens()
+    }
+
+    let tcp = establish_helper(&scheduler, &mut host);
+    assert_eq!(buffer_lens(&tcp), (0, 0));
+
+    // the data stays in the send buffer until it's acknowledged
+    TcpSocket::sendmsg(&tcp, &b"hello"[..], 5).unwrap();
+    scheduler.pop_packet().unwrap();
+    assert_eq!(buffer_lens(&tcp), (5, 0));
+
+    // acknowledge the data and send some of our own
+    let header = TcpHeader {
+        ip: Ipv4Header {
+            src: "5.6.7.8".parse().unwrap(),
+            dst: host.ip_addr,
+        },
+        flags: TcpFlags::empty(),
+        src_port: 20,
+        dst_port: 10,
+        seq: 1,
+        ack: 6,
+        window_size: 10000,
+        selective_acks: None,
+        window_scale: None,
+        timestamp: None,
+        timestamp_echo: None,
+    };
+    tcp.borrow_mut()
+        .push_in_packet(&header, Bytes::from(&b"world!"[..]).into());
+    assert_eq!(buffer_lens(&tcp), (0, 6));
+
+    let mut recv_buf = vec![0; 6];
+    TcpSocket::recvmsg(&tcp, &mut recv_buf[..], 6).unwrap();
+    assert_eq!(buffer_lens(&tcp), (0, 0));
+}
+
 /// This test tries to make sure that an acknowledgement sent while the socket's usable send window
 /// (send window excluding in-flight not-acked data) is empty uses the correct sequence number.
 /// (This test doesn't require that the usable send window is actually empty, just that it's empty
@@ -502,3 +547,78 @@ fn test_incoming_payload_after_shutdown_read() {
     let mut recv_buf = [0; 5];
     assert_eq!(TcpSocket::recvmsg(&tcp, &mut recv_buf[..], 5), Ok(0));
 }
+
+#[test]
+fn test_delayed_ack() {
+    let scheduler = Scheduler::new();
+    let mut host = Host::new();
+
+    let mut config = TcpConfig::default();
+    config.delayed_ack(true);
+
+    // get an established tcp socket
+    let tcp = establish_helper_with_config(&scheduler, &mut host, config);
+
+    let push_payload = |seq: u32| {
+        let header = TcpHeader {
+            ip: Ipv4Header {
+                src: "5.6.7.8".parse().unwrap(),
+                dst: host.ip_addr,
+            },
+            flags: TcpFlags::ACK,
+            src_port: 20,
+            dst_port: 10,
+            seq,
+            ack: 1,
+            window_size: 10000,
+            selective_acks: None,
+            window_scale: None,
+            timestamp: None,
+            timestamp_echo: None,
+        };
+        let pushed_len = tcp
+            .borrow_mut()
+            .push_in_packet(&header, Bytes::from(&b"hello"[..]).into());
+        assert_eq!(pushed_len, 5);
+    };
+
+    // the first segment isn't acknowledged immediately
+    let timers = scheduler.event_queue_rc().borrow().len();
+    push_payload(1);
+    assert!(scheduler.pop_packet().is_none());
+    assert_eq!(scheduler.event_queue_rc().borrow().len(), timers + 1);
+
+    // but the second one is
+    push_payload(6);
+    let (header, _) = scheduler.pop_packet().unwrap();
+    assert_eq!(header.flags, TcpFlags::ACK);
+    assert_eq!(header.ack, 11);
+    assert!(scheduler.pop_packet().is_none());
+
+    // the third is acknowledged after the timeout, which the first segment's timer is already
+    // registered for
+    push_payload(11);
+    assert_eq!(scheduler.event_queue_rc().borrow().len(), timers + 1);
+    assert!(scheduler.pop_packet().is_none());
+    scheduler.advance(std::time::Duration::from_millis(39));
+    assert!(scheduler.pop_packet().is_none());
+    scheduler.advance(std::time::Duration::from_millis(1));
+    let (header, _) = scheduler.pop_packet().unwrap();
+    assert_eq!(header.ack, 16);
+
+    // a segment that arrives while an earlier delayed acknowledgement's timer is still pending
+    // doesn't register another timer
+    push_payload(16);
+    push_payload(21);
+    assert_eq!(scheduler.pop_packet().unwrap().0.ack, 26);
+    assert_eq!(scheduler.event_queue_rc().borrow().len(), timers + 1);
+    scheduler.advance(std::time::Duration::from_millis(10));
+    push_payload(26);
+    assert_eq!(scheduler.event_queue_rc().borrow().len(), timers + 1);
+
+    // the pending timer fires before the acknowledgement is due, and is re-registered for it
+    scheduler.advance(std::time::Duration::from_millis(30));
+    assert!(scheduler.pop_packet().is_none());
+    scheduler.advance(std::time::Duration::from_millis(10));
+    assert_eq!(scheduler.pop_packet().unwrap().0.ack, 31);
+}
@@ -22,6 +22,8 @@ use std::fmt::Debug;
 /// that should work with not just the real time, but also simulated time.
 pub trait Instant:
     'static
+    + Send
+    + Sync
     + Sized
     + Copy
     + Clone
@@ -14,7 +14,7 @@ struct Ipc(SelfContainedChannel<()>, SelfContainedChannel<()>);
 
 const PID_ZERO: Option<Pid> = Pid::from_raw(0);
 
-fn ping_pong(bencher: &mut Bencher, do_pinning: bool) {
+fn ping_pong(bencher: &mut Bencher, do_pinning: bool, spin_limit: u32) {
     let initial_cpu_set = rustix::process::sched_getaffinity(PID_ZERO).unwrap();
     let pinned_cpu_id = (0..).find(|i| initial_cpu_set.is_set(*i)).unwrap();
     let pinned_cpu_set = {
@@ -27,8 +27,8 @@ fn ping_pong(bencher: &mut Bencher, do_pinning: bool) {
     }
 
     let ipc = Arc::new(Ipc(
-        SelfContainedChannel::new(),
-        SelfContainedChannel::new(),
+        SelfContainedChannel::with_spin_limit(spin_limit),
+        SelfContainedChannel::with_spin_limit(spin_limit),
     ));
 
     let receiver_thread = {
@@ -53,14 +53,17 @@ fn ping_pong(bencher: &mut Bencher, do_pinning: bool) {
 
     ipc.0.close_writer();
     receiver_thread.join().unwrap();
+
     if do_pinning {
         rustix::process::sched_setaffinity(PID_ZERO, &initial_cpu_set).unwrap();
     }
 }
 
 pub fn criterion_benchmark(c: &mut Criterion) {
-    c.bench_function("ping pong", |b| ping_pong(b, false));
-    c.bench_function("ping pong pinned", |b| ping_pong(b, true));
+    c.bench_function("ping pong", |b| ping_pong(b, false, 0));
+    c.bench_function("ping pong pinned", |b| ping_pong(b, true, 0));
+    c.bench_function("ping pong spin", |b| ping_pong(b, false, 10_000));
+    c.bench_function("ping pong pinned spin", |b| ping_pong(b, true, 10_000));
 }
 
 criterion_group!(benches, criterion_benchmark);
@@ -3,7 +3,7 @@ use core::mem::MaybeUninit;
 
 use vasi::VirtualAddressSpaceIndependent;
 
-use crate::sync::{self, AtomicU32, UnsafeCell};
+use crate::sync::{self, AtomicU32, AtomicU64, UnsafeCell};
 
 #[derive(Debug, Copy, Clone, Eq, PartialEq, VirtualAddressSpaceIndependent)]
 #[repr(u8)]
@@ -121,6 +121,24 @@ impl AtomicChannelState {
     }
 }
 
+/// The smallest number of times that `receive` polls a channel with a non-zero spin limit.
+const MIN_SPIN_WINDOW: u32 = 16;
+
+/// Every `SPIN_PROBE_INTERVAL`th wait polls up to the spin limit, so that the channel can learn
+/// that messages have started arriving sooner.
+const SPIN_PROBE_INTERVAL: u32 = 64;
+
+/// How a channel's `receive` calls got their messages.
+#[derive(Debug, Copy, Clone, Default, Eq, PartialEq)]
+pub struct SelfContainedChannelStats {
+    /// The message was already in the channel.
+    pub ready: u64,
+    /// The message arrived while polling.
+    pub spun: u64,
+    /// The reader slept on a futex.
+    pub slept: u64,
+}
+
 #[derive(Debug, Copy, Clone, Eq, PartialEq)]
 pub enum SelfContainedChannelError {
     WriterIsClosed,
@@ -166,16 +184,111 @@ impl Display for SelfContainedChannelError {
 pub struct SelfContainedChannel<T> {
     message: UnsafeCell<MaybeUninit<T>>,
     state: AtomicChannelState,
+    spin_limit: u32,
+    collect_stats: bool,
+    // A moving average of how many times `receive` polled before a message arrived. Only the
+    // reader accesses the fields below, but they're atomic so that the channel stays `Sync`.
+    // Since there's only one reader, it updates them with plain loads and stores rather than
+    // read-modify-write operations.
+    spin_estimate: AtomicU32,
+    num_waits: AtomicU32,
+    num_ready: AtomicU64,
+    num_spun: AtomicU64,
+    num_slept: AtomicU64,
 }
 
 impl<T> SelfContainedChannel<T> {
     pub fn new() -> Self {
+        Self::with_spin_limit(0)
+    }
+
+    /// Like [`new`](Self::new), but `receive` may poll the channel up to `spin_limit` times
+    /// before sleeping on a futex. If the message arrives while spinning, neither the reader nor
+    /// the writer needs to make a futex syscall. This is only useful if the writer can make
+    /// progress while the reader is spinning, for example if they're running on different CPUs.
+    ///
+    /// The channel learns how long messages usually take to arrive, and only polls for about
+    /// twice that long. If messages usually take longer than `spin_limit` polls, the channel
+    /// mostly stops polling, but still polls up to `spin_limit` times once every 64 waits.
+    pub fn with_spin_limit(spin_limit: u32) -> Self {
         Self {
             message: UnsafeCell::new(MaybeUninit::uninit()),
             state: AtomicChannelState::new(),
+            spin_limit,
+            collect_stats: false,
+            spin_estimate: AtomicU32::new(spin_limit),
+            num_waits: AtomicU32::new(0),
+            num_ready: AtomicU64::new(0),
+            num_spun: AtomicU64::new(0),
+            num_slept: AtomicU64::new(0),
+        }
+    }
+
+    /// The most times `receive` polls the channel before sleeping.
+    pub fn spin_limit(&self) -> u32 {
+        self.spin_limit
+    }
+
+    /// Makes `receive` count how it got each message; see [`stats`](Self::stats). Counting is
+    /// disabled by default since it adds work to every `receive`.
+    pub fn with_stats(mut self) -> Self {
+        self.collect_stats = true;
+        self
+    }
+
+    /// Whether `receive` counts how it got each message.
+    pub fn collects_stats(&self) -> bool {
+        self.collect_stats
+    }
+
+    /// Counts of how `receive` calls got their messages. All zero unless the channel was
+    /// created [`with_stats`](Self::with_stats).
+    pub fn stats(&self) -> SelfContainedChannelStats {
+        SelfContainedChannelStats {
+            ready: self.num_ready.load(sync::atomic::Ordering::Relaxed),
+            spun: self.num_spun.load(sync::atomic::Ordering::Relaxed),
+            slept: self.num_slept.load(sync::atomic::Ordering::Relaxed),
         }
     }
 
+    /// How many times the next wait in `receive` should poll before sleeping.
+    fn spin_window(&self) -> u32 {
+        if self.spin_limit == 0 {
+            return 0;
+        }
+
+        let num_waits = self.num_waits.load(sync::atomic::Ordering::Relaxed);
+        self.num_waits
+            .store(num_waits.wrapping_add(1), sync::atomic::Ordering::Relaxed);
+        if num_waits % SPIN_PROBE_INTERVAL == 0 {
+            return self.spin_limit;
+        }
+
+        let estimate = self.spin_estimate.load(sync::atomic::Ordering::Relaxed);
+        estimate
+            .saturating_mul(2)
+            .saturating_add(MIN_SPIN_WINDOW)
+            .min(self.spin_limit)
+    }
+
+    /// Move the spin estimate an eighth of the way towards `spins`.
+    fn update_spin_estimate(&self, spins: u32) {
+        let estimate = self.spin_estimate.load(sync::atomic::Ordering::Relaxed);
+        let estimate = if spins >= estimate {
+            estimate + (spins - estimate) / 8
+        } else {
+            estimate - (estimate - spins) / 8
+        };
+        self.spin_estimate
+            .store(estimate, sync::atomic::Ordering::Relaxed);
+    }
+
+    /// Increments one of the reader's counters.
+    fn increment(counter: &AtomicU64) {
+        let count = counter.load(sync::atomic::Ordering::Relaxed);
+        counter.store(count + 1, sync::atomic::Ordering::Relaxed);
+    }
+
     /// Sends `message` through the channel.
     ///
     /// Panics if the channel already has an unreceived message.
@@ -218,8 +331,25 @@ impl<T> SelfContainedChannel<T> {
     /// Panics if another thread is already trying to receive on this channel.
     pub fn receive(&self) -> Result<T, SelfContainedChannelError> {
         let mut state = self.state.load(sync::atomic::Ordering::Relaxed);
+        let mut spins = 0;
+        let mut spin_window = None;
+        let mut done_spinning = false;
+        let mut slept = false;
         loop {
             if state.contents_state == ChannelContentsState::Ready {
+                let counter = if slept {
+                    &self.num_slept
+                } else if spins > 0 {
+                    if !done_spinning {
+                        self.update_spin_estimate(spins);
+                    }
+                    &self.num_spun
+                } else {
+                    &self.num_ready
+                };
+                if self.collect_stats {
+                    Self::increment(counter);
+                }
                 break;
             }
             if state.writer_closed {
@@ -230,6 +360,20 @@ impl<T> SelfContainedChannel<T> {
                     || state.contents_state == ChannelContentsState::Writing
             );
             assert!(!state.has_sleeper);
+            let window = *spin_window.get_or_insert_with(|| self.spin_window());
+            if spins < window {
+                spins += 1;
+                sync::spin_loop();
+                state = self.state.load(sync::atomic::Ordering::Relaxed);
+                continue;
+            }
+            if !done_spinning {
+                done_spinning = true;
+                if window > 0 {
+                    // polling didn't help this time
+                    self.update_spin_estimate(0);
+                }
+            }
             let mut sleeper_state = state;
             sleeper_state.has_sleeper = true;
             match self.state.compare_exchange(
@@ -246,6 +390,7 @@ impl<T> SelfContainedChannel<T> {
                 }
             };
             let expected = sleeper_state.into();
+            slept = true;
             match sync::futex_wait(&self.state.0, expected) {
                 Ok(_) | Err(rustix::io::Errno::INTR) | Err(rustix::io::Errno::AGAIN) => {
                     // Something changed; clear the sleeper bit and try again.
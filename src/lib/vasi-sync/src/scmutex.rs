@@ -144,6 +144,11 @@ impl From<FutexWord> for u32 {
 #[repr(C)]
 pub struct SelfContainedMutex<T> {
     futex: AtomicFutexWord,
+    spin_limit: u32,
+    // A moving average of how many times `lock` polled before the lock was released.
+    spin_estimate: sync::atomic::AtomicU32,
+    num_spun: sync::atomic::AtomicU64,
+    num_slept: sync::atomic::AtomicU64,
     val: sync::UnsafeCell<T>,
 }
 
@@ -154,6 +159,18 @@ const UNLOCKED: u16 = 0;
 const LOCKED: u16 = 1;
 const LOCKED_DISCONNECTED: u16 = 2;
 
+/// The smallest number of times that `lock` polls a mutex with a non-zero spin limit.
+const MIN_SPIN_WINDOW: u32 = 16;
+
+/// How contended `lock` calls got the lock. Calls that found the lock available aren't counted.
+#[derive(Debug, Copy, Clone, Default, Eq, PartialEq)]
+pub struct SelfContainedMutexStats {
+    /// The lock was released while polling.
+    pub spun: u64,
+    /// The thread slept on a futex.
+    pub slept: u64,
+}
+
 impl<T> SelfContainedMutex<T> {
     // TODO: merge with `new` when `AtomicFutexWord` supports a const `new`.
     #[cfg(not(loom))]
@@ -163,26 +180,81 @@ impl<T> SelfContainedMutex<T> {
                 lock_state: UNLOCKED,
                 num_sleepers: 0,
             }),
+            spin_limit: 0,
+            spin_estimate: sync::atomic::AtomicU32::new(0),
+            num_spun: sync::atomic::AtomicU64::new(0),
+            num_slept: sync::atomic::AtomicU64::new(0),
             val: sync::UnsafeCell::new(val),
         }
     }
 
     pub fn new(val: T) -> Self {
+        Self::with_spin_limit(val, 0)
+    }
+
+    /// Like [`new`](Self::new), but `lock` may poll the lock up to `spin_limit` times before
+    /// sleeping on a futex while another thread holds it. This is only useful if the owner can run
+    /// while the waiter is spinning, for example if they're running on different CPUs.
+    ///
+    /// The mutex only polls while the owner holds a connected guard, since a disconnected guard is
+    /// usually held until some other thread runs. It learns how long the owner usually holds the
+    /// lock, and only polls for about twice that long.
+    pub fn with_spin_limit(val: T, spin_limit: u32) -> Self {
         Self {
             futex: AtomicFutexWord::new(FutexWord {
                 lock_state: UNLOCKED,
                 num_sleepers: 0,
             }),
+            spin_limit,
+            spin_estimate: sync::atomic::AtomicU32::new(spin_limit),
+            num_spun: sync::atomic::AtomicU64::new(0),
+            num_slept: sync::atomic::AtomicU64::new(0),
             val: sync::UnsafeCell::new(val),
         }
     }
 
+    /// Counts of how contended `lock` calls got the lock.
+    pub fn stats(&self) -> SelfContainedMutexStats {
+        SelfContainedMutexStats {
+            spun: self.num_spun.load(sync::atomic::Ordering::Relaxed),
+            slept: self.num_slept.load(sync::atomic::Ordering::Relaxed),
+        }
+    }
+
+    /// How many times `lock` should poll before sleeping.
+    fn spin_window(&self) -> u32 {
+        if self.spin_limit == 0 {
+            return 0;
+        }
+        let estimate = self.spin_estimate.load(sync::atomic::Ordering::Relaxed);
+        estimate
+            .saturating_mul(2)
+            .saturating_add(MIN_SPIN_WINDOW)
+            .min(self.spin_limit)
+    }
+
+    /// Move the spin estimate an eighth of the way towards `spins`.
+    fn update_spin_estimate(&self, spins: u32) {
+        let estimate = self.spin_estimate.load(sync::atomic::Ordering::Relaxed);
+        let estimate = if spins >= estimate {
+            estimate + (spins - estimate) / 8
+        } else {
+            estimate - (estimate - spins) / 8
+        };
+        self.spin_estimate
+            .store(estimate, sync::atomic::Ordering::Relaxed);
+    }
+
     pub fn lock(&self) -> SelfContainedMutexGuard<T> {
         // On first attempt, optimistically assume the lock is uncontended.
         let mut current = FutexWord {
             lock_state: UNLOCKED,
             num_sleepers: 0,
         };
+        let mut spins = 0;
+        let mut spin_window = None;
+        let mut done_spinning = false;
+        let mut slept = false;
         loop {
             if current.lock_state == UNLOCKED {
                 // Try to take the lock.
@@ -211,7 +283,27 @@ impl<T> SelfContainedMutex<T> {
                 continue;
             }
 
+            // Poll while the owner holds a connected guard, since it's probably running and will
+            // release the lock soon.
+            if !done_spinning && current.lock_state == LOCKED {
+                let window = *spin_window.get_or_insert_with(|| self.spin_window());
+                if spins < window {
+                    spins += 1;
+                    sync::spin_loop();
+                    current = self.futex.load(sync::Ordering::Relaxed);
+                    continue;
+                }
+            }
+            if !done_spinning {
+                done_spinning = true;
+                if spin_window.is_some_and(|w| w > 0) {
+                    // polling didn't help this time
+                    self.update_spin_estimate(0);
+                }
+            }
+
             // Try to sleep on the futex.
+            slept = true;
 
             // Since incrementing is a read-modify-write operation, this does
             // not break the release sequence since the last unlock.
@@ -245,6 +337,12 @@ impl<T> SelfContainedMutex<T> {
             // not break the release sequence since the last unlock.
             current = self.futex.dec_sleepers_and_fetch(sync::Ordering::Relaxed);
         }
+        if slept {
+            self.num_slept.fetch_add(1, sync::Ordering::Relaxed);
+        } else if spins > 0 {
+            self.num_spun.fetch_add(1, sync::Ordering::Relaxed);
+            self.update_spin_estimate(spins);
+        }
         SelfContainedMutexGuard {
             mutex: Some(self),
             ptr: Some(self.val.get_mut()),
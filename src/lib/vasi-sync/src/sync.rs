@@ -8,7 +8,7 @@
 #[cfg(not(loom))]
 pub use core::{
     sync::atomic,
-    sync::atomic::{AtomicBool, AtomicI8, AtomicI32, AtomicU32, AtomicUsize, Ordering},
+    sync::atomic::{AtomicBool, AtomicI8, AtomicI32, AtomicU32, AtomicU64, AtomicUsize, Ordering},
 };
 #[cfg(loom)]
 use std::collections::HashMap;
@@ -26,7 +26,7 @@ use loom::sync::{Condvar, Mutex};
 pub use loom::{
     sync::Arc,
     sync::atomic,
-    sync::atomic::{AtomicBool, AtomicI8, AtomicI32, AtomicU32, AtomicUsize, Ordering},
+    sync::atomic::{AtomicBool, AtomicI8, AtomicI32, AtomicU32, AtomicU64, AtomicUsize, Ordering},
 };
 #[cfg(not(loom))]
 use vasi::VirtualAddressSpaceIndependent;
@@ -35,6 +35,15 @@ loom::lazy_static! {
     pub static ref FUTEXES: Mutex<HashMap<usize, Arc<Condvar>>> = Mutex::new(HashMap::new());
 }
 
+#[cfg(not(loom))]
+pub fn spin_loop() {
+    core::hint::spin_loop();
+}
+#[cfg(loom)]
+pub fn spin_loop() {
+    loom::hint::spin_loop();
+}
+
 #[cfg(not(loom))]
 pub fn sched_yield() {
     rustix::process::sched_yield();
@@ -7,7 +7,9 @@
 mod sync;
 
 mod scchannel_tests {
-    use vasi_sync::scchannel::{SelfContainedChannel, SelfContainedChannelError};
+    use vasi_sync::scchannel::{
+        SelfContainedChannel, SelfContainedChannelError, SelfContainedChannelStats,
+    };
 
     use super::*;
 
@@ -37,6 +39,58 @@ mod scchannel_tests {
         })
     }
 
+    #[test]
+    fn test_two_threads_with_spin_limit() {
+        sync::model(|| {
+            let channel = sync::Arc::new(SelfContainedChannel::with_spin_limit(2).with_stats());
+            let writer = {
+                let channel = channel.clone();
+                sync::thread::spawn(move || {
+                    channel.send(42);
+                })
+            };
+            let reader = {
+                let channel = channel.clone();
+                sync::thread::spawn(move || channel.receive())
+            };
+            writer.join().unwrap();
+            assert_eq!(reader.join().unwrap(), Ok(42));
+
+            // the message was received exactly one way
+            let stats = channel.stats();
+            assert_eq!(stats.ready + stats.spun + stats.slept, 1);
+        })
+    }
+
+    #[test]
+    fn test_stats_ready() {
+        sync::model(|| {
+            let channel = SelfContainedChannel::with_spin_limit(2).with_stats();
+            channel.send(42);
+            assert_eq!(channel.receive(), Ok(42));
+            channel.send(43);
+            assert_eq!(channel.receive(), Ok(43));
+            assert_eq!(
+                channel.stats(),
+                SelfContainedChannelStats {
+                    ready: 2,
+                    spun: 0,
+                    slept: 0
+                }
+            );
+        })
+    }
+
+    #[test]
+    fn test_stats_disabled() {
+        sync::model(|| {
+            let channel = SelfContainedChannel::with_spin_limit(2);
+            channel.send(42);
+            assert_eq!(channel.receive(), Ok(42));
+            assert_eq!(channel.stats(), SelfContainedChannelStats::default());
+        })
+    }
+
     #[test]
     fn test_drop_cross_thread() {
         sync::model(|| {
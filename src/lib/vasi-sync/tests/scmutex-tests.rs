@@ -3,7 +3,7 @@
 //! loom.
 //!
 //! [loom]: <https://docs.rs/loom/latest/loom/>
-use vasi_sync::scmutex::{SelfContainedMutex, SelfContainedMutexGuard};
+use vasi_sync::scmutex::{SelfContainedMutex, SelfContainedMutexGuard, SelfContainedMutexStats};
 
 mod sync;
 
@@ -97,4 +97,34 @@ mod scmutex_tests {
             assert_eq!(*guard, nthreads);
         })
     }
+
+    // Relies on real sleeps to make the waiter find the lock held.
+    #[cfg(not(loom))]
+    #[test]
+    fn test_contention_stats() {
+        for spin_limit in [0, u32::MAX] {
+            let mutex = std::sync::Arc::new(SelfContainedMutex::with_spin_limit(0, spin_limit));
+            assert_eq!(mutex.stats(), SelfContainedMutexStats::default());
+
+            // uncontended
+            *mutex.lock() += 1;
+            assert_eq!(mutex.stats(), SelfContainedMutexStats::default());
+
+            let guard = mutex.lock();
+            let waiter = {
+                let mutex = mutex.clone();
+                std::thread::spawn(move || *mutex.lock() += 1)
+            };
+            std::thread::sleep(std::time::Duration::from_millis(100));
+            drop(guard);
+            waiter.join().unwrap();
+
+            let stats = mutex.stats();
+            assert_eq!(stats.spun + stats.slept, 1);
+            if spin_limit == 0 {
+                assert_eq!(stats.slept, 1);
+            }
+            assert_eq!(*mutex.lock(), 2);
+        }
+    }
 }
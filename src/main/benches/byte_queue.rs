@@ -0,0 +1,79 @@
+//! Measures the `ByteQueue` that backs pipes and socket buffers. Each iteration pushes a trace of
+//! writes and then reads the queue until it's empty: stream writes of mixed sizes (small writes
+//! such as request lines, and larger buffered writes) are read with a fixed-size read buffer, and
+//! datagram writes with a mix of packet sizes are read one packet at a time.
+
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+use rand::{Rng, SeedableRng};
+use rand_xoshiro::Xoshiro256PlusPlus;
+use shadow_rs::utility::byte_queue::ByteQueue;
+
+/// The number of writes per iteration.
+const WRITES: usize = 1_000;
+
+/// The chunk capacity used by Shadow's pipes.
+const CHUNK_CAPACITY: usize = 4096;
+
+/// Stream write sizes, chosen uniformly.
+const STREAM_WRITE_SIZES: [usize; 4] = [64, 512, 4096, 16384];
+
+/// Datagram sizes: mostly small packets such as DNS queries or ACK-sized messages, and some
+/// near-MTU packets.
+const DATAGRAM_SIZES: [usize; 4] = [40, 40, 576, 1472];
+
+fn write_trace(sizes: &[usize], rng: &mut Xoshiro256PlusPlus) -> Vec<usize> {
+    (0..WRITES)
+        .map(|_| sizes[rng.random_range(0..sizes.len())])
+        .collect()
+}
+
+fn bench_stream(c: &mut Criterion) {
+    let mut group = c.benchmark_group("byte_queue_stream");
+    let mut rng = Xoshiro256PlusPlus::seed_from_u64(0);
+    let trace = write_trace(&STREAM_WRITE_SIZES, &mut rng);
+    let data = vec![0u8; *STREAM_WRITE_SIZES.iter().max().unwrap()];
+    group.throughput(Throughput::Bytes(trace.iter().sum::<usize>() as u64));
+
+    for read_size in [1024, 65536] {
+        group.bench_with_input(
+            BenchmarkId::from_parameter(read_size),
+            &read_size,
+            |b, &read_size| {
+                let mut queue = ByteQueue::new(CHUNK_CAPACITY);
+                let mut buf = vec![0u8; read_size];
+                b.iter(|| {
+                    for len in &trace {
+                        queue.push_stream(&data[..*len]).unwrap();
+                    }
+                    while queue.pop(&mut buf[..]).unwrap().is_some() {}
+                });
+            },
+        );
+    }
+
+    group.finish();
+}
+
+fn bench_packets(c: &mut Criterion) {
+    let mut group = c.benchmark_group("byte_queue_packets");
+    let mut rng = Xoshiro256PlusPlus::seed_from_u64(0);
+    let trace = write_trace(&DATAGRAM_SIZES, &mut rng);
+    let data = vec![0u8; *DATAGRAM_SIZES.iter().max().unwrap()];
+    group.throughput(Throughput::Elements(trace.len() as u64));
+
+    group.bench_function("mixed_sizes", |b| {
+        let mut queue = ByteQueue::new(CHUNK_CAPACITY);
+        let mut buf = vec![0u8; 65536];
+        b.iter(|| {
+            for len in &trace {
+                queue.push_packet(&data[..*len], *len).unwrap();
+            }
+            while queue.pop(&mut buf[..]).unwrap().is_some() {}
+        });
+    });
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_stream, bench_packets);
+criterion_main!(benches);
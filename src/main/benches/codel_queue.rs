@@ -0,0 +1,80 @@
+//! Measures the CoDel queue that holds packets in a host's upstream router. Each iteration
+//! simulates packets arriving at the router at a fixed rate while the router forwards one packet
+//! per service interval. When packets arrive no faster than they're forwarded the queue stays
+//! short, and when they arrive faster a standing queue builds up and CoDel begins dropping
+//! packets.
+
+use std::net::{Ipv4Addr, SocketAddrV4};
+
+use bytes::Bytes;
+use criterion::{BatchSize, BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+use shadow_rs::network::packet::PacketRc;
+use shadow_rs::network::router::codel_queue::CoDelQueue;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+/// The number of packets that arrive per iteration.
+const PACKETS: usize = 10_000;
+
+/// The time to forward a packet: a 1500 byte packet on a 100 Mbit/s link.
+const SERVICE_NS: u64 = 120_000;
+
+fn packets() -> Vec<PacketRc> {
+    let src = SocketAddrV4::new(Ipv4Addr::new(11, 0, 0, 1), 1000);
+    let dst = SocketAddrV4::new(Ipv4Addr::new(11, 0, 0, 2), 2000);
+    let payload = Bytes::from(vec![0u8; 1472]);
+    (0..PACKETS)
+        .map(|_| PacketRc::new_ipv4_udp(src, dst, payload.clone(), 0))
+        .collect()
+}
+
+/// Push the packets as they arrive every `arrival_ns`, and pop a packet every `SERVICE_NS`.
+/// Returns the number of packets forwarded.
+fn run(packets: Vec<PacketRc>, arrival_ns: u64) -> usize {
+    let mut queue = CoDelQueue::new();
+    let start = EmulatedTime::SIMULATION_START;
+    let mut next_service = start;
+    let mut forwarded = 0;
+
+    for (i, packet) in packets.into_iter().enumerate() {
+        let now = start + SimulationTime::from_nanos(i as u64 * arrival_ns);
+        while next_service <= now {
+            forwarded += usize::from(queue.pop(next_service).is_some());
+            next_service = next_service + SimulationTime::from_nanos(SERVICE_NS);
+        }
+        queue.push(packet, now);
+    }
+
+    while !queue.is_empty() {
+        forwarded += usize::from(queue.pop(next_service).is_some());
+        next_service = next_service + SimulationTime::from_nanos(SERVICE_NS);
+    }
+
+    forwarded
+}
+
+fn bench_codel_queue(c: &mut Criterion) {
+    let mut group = c.benchmark_group("codel_queue");
+    group.throughput(Throughput::Elements(PACKETS as u64));
+
+    // the load on the router, as a percentage of the rate that it can forward packets
+    for load in [50, 100, 150] {
+        let arrival_ns = SERVICE_NS * 100 / load;
+        group.bench_with_input(
+            BenchmarkId::new("load", load),
+            &arrival_ns,
+            |b, &arrival_ns| {
+                b.iter_batched(
+                    packets,
+                    |packets| run(packets, arrival_ns),
+                    BatchSize::LargeInput,
+                );
+            },
+        );
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_codel_queue);
+criterion_main!(benches);
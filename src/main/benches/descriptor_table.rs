@@ -0,0 +1,53 @@
+//! Measures a process's descriptor table under the churn of a server: the table holds some number
+//! of open descriptors, and each operation closes a random one and opens a new one, which is given
+//! the lowest available fd (the one that was just closed, or a lower one).
+
+use std::sync::Arc;
+
+use atomic_refcell::AtomicRefCell;
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+use rand::{Rng, SeedableRng};
+use rand_xoshiro::Xoshiro256PlusPlus;
+use shadow_rs::host::descriptor::descriptor_table::{DescriptorHandle, DescriptorTable};
+use shadow_rs::host::descriptor::eventfd::EventFd;
+use shadow_rs::host::descriptor::{CompatFile, Descriptor, File, FileStatus, OpenFile};
+
+/// The number of descriptors replaced per iteration.
+const OPS: usize = 10_000;
+
+fn descriptor() -> Descriptor {
+    let eventfd = EventFd::new(0, false, FileStatus::empty());
+    let file = File::EventFd(Arc::new(AtomicRefCell::new(eventfd)));
+    Descriptor::new(CompatFile::New(OpenFile::new(file)))
+}
+
+fn bench_descriptor_table(c: &mut Criterion) {
+    let mut group = c.benchmark_group("descriptor_table_churn");
+    group.throughput(Throughput::Elements(OPS as u64));
+
+    for open in [16, 1024, 100_000] {
+        group.bench_with_input(BenchmarkId::from_parameter(open), &open, |b, &open| {
+            // all descriptors refer to the same open file, so that replacing a descriptor doesn't
+            // close the file
+            let desc = descriptor();
+            let mut table = DescriptorTable::new();
+            let mut fds: Vec<DescriptorHandle> = (0..open)
+                .map(|_| table.register_descriptor(desc.clone()).unwrap())
+                .collect();
+            let mut rng = Xoshiro256PlusPlus::seed_from_u64(0);
+
+            b.iter(|| {
+                for _ in 0..OPS {
+                    let i = rng.random_range(0..fds.len());
+                    let old = table.deregister_descriptor(fds[i]).unwrap();
+                    fds[i] = table.register_descriptor(old).unwrap();
+                }
+            });
+        });
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_descriptor_table);
+criterion_main!(benches);
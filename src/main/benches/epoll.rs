@@ -0,0 +1,140 @@
+//! Measures an epoll instance that monitors a set of eventfds, which are always writable. The
+//! "ctl" benchmark adds each file to the epoll, modifies its interest, and removes it again, as an
+//! event loop does when its connections come and go. The "wait" benchmark repeatedly collects the
+//! ready events of level-triggered entries, as an event loop does while all of its files are ready,
+//! `max_events` events at a time.
+
+use std::sync::Arc;
+
+use atomic_refcell::AtomicRefCell;
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+use linux_api::epoll::{EpollCtlOp, EpollEvents};
+use shadow_rs::host::descriptor::epoll::Epoll;
+use shadow_rs::host::descriptor::eventfd::EventFd;
+use shadow_rs::host::descriptor::{File, FileStatus};
+use shadow_rs::utility::callback_queue::CallbackQueue;
+
+/// The number of events collected per iteration of the "wait" benchmark.
+const WAIT_EVENTS: usize = 10_000;
+
+/// The maximum number of events collected at a time, which is a common buffer size for event
+/// loops.
+const MAX_EVENTS: u32 = 64;
+
+fn eventfds(num: usize) -> Vec<File> {
+    (0..num)
+        .map(|_| {
+            let eventfd = EventFd::new(0, false, FileStatus::empty());
+            File::EventFd(Arc::new(AtomicRefCell::new(eventfd)))
+        })
+        .collect()
+}
+
+fn ctl(
+    epoll: &Arc<AtomicRefCell<Epoll>>,
+    op: EpollCtlOp,
+    fd: usize,
+    file: &File,
+    events: EpollEvents,
+) {
+    let mut cb_queue = CallbackQueue::new();
+    epoll
+        .borrow_mut()
+        .ctl(
+            op,
+            fd as i32,
+            file.clone(),
+            events,
+            fd as u64,
+            Arc::downgrade(epoll),
+            &mut cb_queue,
+        )
+        .unwrap();
+    cb_queue.run();
+}
+
+fn bench_ctl(c: &mut Criterion) {
+    let mut group = c.benchmark_group("epoll_ctl");
+
+    for num in [16, 1024] {
+        let files = eventfds(num);
+        group.throughput(Throughput::Elements(num as u64));
+        group.bench_with_input(BenchmarkId::from_parameter(num), &files, |b, files| {
+            let epoll = Epoll::new();
+            b.iter(|| {
+                for (fd, file) in files.iter().enumerate() {
+                    ctl(
+                        &epoll,
+                        EpollCtlOp::EPOLL_CTL_ADD,
+                        fd,
+                        file,
+                        EpollEvents::EPOLLIN,
+                    );
+                }
+                for (fd, file) in files.iter().enumerate() {
+                    let events = EpollEvents::EPOLLIN | EpollEvents::EPOLLOUT;
+                    ctl(&epoll, EpollCtlOp::EPOLL_CTL_MOD, fd, file, events);
+                }
+                for (fd, file) in files.iter().enumerate() {
+                    ctl(
+                        &epoll,
+                        EpollCtlOp::EPOLL_CTL_DEL,
+                        fd,
+                        file,
+                        EpollEvents::empty(),
+                    );
+                }
+            });
+        });
+    }
+
+    group.finish();
+}
+
+fn bench_wait(c: &mut Criterion) {
+    let mut group = c.benchmark_group("epoll_wait");
+    group.throughput(Throughput::Elements(WAIT_EVENTS as u64));
+
+    for num in [16, 1024] {
+        let files = eventfds(num);
+        group.bench_with_input(BenchmarkId::from_parameter(num), &files, |b, files| {
+            let epoll = Epoll::new();
+            for (fd, file) in files.iter().enumerate() {
+                ctl(
+                    &epoll,
+                    EpollCtlOp::EPOLL_CTL_ADD,
+                    fd,
+                    file,
+                    EpollEvents::EPOLLOUT,
+                );
+            }
+
+            b.iter(|| {
+                let mut collected = 0;
+                while collected < WAIT_EVENTS {
+                    let mut cb_queue = CallbackQueue::new();
+                    let events = epoll
+                        .borrow_mut()
+                        .collect_ready_events(&mut cb_queue, MAX_EVENTS);
+                    cb_queue.run();
+                    collected += events.len();
+                }
+            });
+
+            for (fd, file) in files.iter().enumerate() {
+                ctl(
+                    &epoll,
+                    EpollCtlOp::EPOLL_CTL_DEL,
+                    fd,
+                    file,
+                    EpollEvents::empty(),
+                );
+            }
+        });
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_ctl, bench_wait);
+criterion_main!(benches);
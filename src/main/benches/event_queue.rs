@@ -0,0 +1,107 @@
+//! Compares the calendar queue used by the `EventQueue` to a binary heap using the "hold" model:
+//! the queue is filled with some number of pending events, and then each iteration pops the
+//! earliest event and pushes a new event a random amount of time after it.
+
+use std::cmp::Reverse;
+use std::collections::BinaryHeap;
+
+use criterion::{BenchmarkId, Criterion, criterion_group, criterion_main};
+use rand::{Rng, SeedableRng};
+use rand_xoshiro::Xoshiro256PlusPlus;
+use shadow_rs::core::work::calendar_queue::{CalendarQueue, Timed};
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+/// The number of events popped and pushed per iteration.
+const HOLD_OPS: usize = 10_000;
+
+/// The mean delay between an event and the event it schedules.
+const MEAN_DELAY_NS: u64 = 1_000_000;
+
+#[derive(Debug, PartialEq, Eq, PartialOrd, Ord)]
+struct Item {
+    time: EmulatedTime,
+    id: u64,
+}
+
+impl Timed for Item {
+    fn time(&self) -> EmulatedTime {
+        self.time
+    }
+}
+
+/// A generator of new items, shared by both queue types so that they see the same workload.
+struct Items {
+    rng: Xoshiro256PlusPlus,
+    next_id: u64,
+}
+
+impl Items {
+    fn new() -> Self {
+        Self {
+            rng: Xoshiro256PlusPlus::seed_from_u64(0),
+            next_id: 0,
+        }
+    }
+
+    fn after(&mut self, time: EmulatedTime) -> Item {
+        let delay = SimulationTime::from_nanos(self.rng.random_range(0..2 * MEAN_DELAY_NS));
+        self.next_id += 1;
+        Item {
+            time: time + delay,
+            id: self.next_id,
+        }
+    }
+}
+
+fn hold_calendar(queue: &mut CalendarQueue<Item>, items: &mut Items) {
+    for _ in 0..HOLD_OPS {
+        let item = queue.pop().unwrap();
+        queue.push(items.after(item.time));
+    }
+}
+
+fn hold_heap(queue: &mut BinaryHeap<Reverse<Item>>, items: &mut Items) {
+    for _ in 0..HOLD_OPS {
+        let item = queue.pop().unwrap().0;
+        queue.push(Reverse(items.after(item.time)));
+    }
+}
+
+pub fn criterion_benchmark(c: &mut Criterion) {
+    let mut group = c.benchmark_group("event_queue_hold");
+
+    for pending in [100, 10_000, 100_000] {
+        group.bench_with_input(
+            BenchmarkId::new("heap", pending),
+            &pending,
+            |b, &pending| {
+                let mut items = Items::new();
+                let mut queue = BinaryHeap::new();
+                for _ in 0..pending {
+                    queue.push(Reverse(items.after(EmulatedTime::SIMULATION_START)));
+                }
+                b.iter(|| hold_heap(&mut queue, &mut items));
+            },
+        );
+
+        group.bench_with_input(
+            BenchmarkId::new("calendar", pending),
+            &pending,
+            |b, &pending| {
+                let mut items = Items::new();
+                // a scheduling round of 1 ms spanning 8 buckets, as the manager would configure
+                let mut queue = CalendarQueue::new(SimulationTime::from_nanos(MEAN_DELAY_NS / 8));
+                for _ in 0..pending {
+                    queue.push(items.after(EmulatedTime::SIMULATION_START));
+                }
+                b.iter(|| hold_calendar(&mut queue, &mut items));
+            },
+        );
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
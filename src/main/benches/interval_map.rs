@@ -0,0 +1,121 @@
+//! Measures the `IntervalMap` that holds a process's memory regions, under mapping churn shaped
+//! like that of a JVM: a large reserved heap that has pieces committed and uncommitted
+//! (`mprotect`-like inserts that split a region), thread stacks with guard pages that are mapped
+//! and unmapped, and small anonymous mappings such as allocator arenas. The map starts with some
+//! number of regions, and each operation overwrites or clears a random range.
+
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+use rand::{Rng, SeedableRng};
+use rand_xoshiro::Xoshiro256PlusPlus;
+use shadow_rs::utility::interval_map::{Interval, IntervalMap};
+
+/// The number of operations per iteration.
+const OPS: usize = 10_000;
+
+const PAGE: usize = 4096;
+
+/// The value of each region, standing in for its protection.
+#[derive(Clone, Copy)]
+enum Prot {
+    None,
+    ReadWrite,
+}
+
+enum Op {
+    Insert(Interval, Prot),
+    Clear(Interval),
+}
+
+/// A random page-aligned interval of up to `max_pages` pages within `len` pages from `base`.
+fn interval(rng: &mut Xoshiro256PlusPlus, base: usize, len: usize, max_pages: usize) -> Interval {
+    let pages = rng.random_range(1..=max_pages);
+    let start = base + rng.random_range(0..len - pages) * PAGE;
+    start..start + pages * PAGE
+}
+
+/// A map with about `regions` regions: a heap reservation that's alternately committed and
+/// uncommitted, followed by thread stacks with guard pages.
+fn initial_map(regions: usize, heap_pages: usize) -> IntervalMap<Prot> {
+    let mut map = IntervalMap::new();
+    let chunk = heap_pages / (regions / 2);
+    for i in 0..regions / 2 {
+        let prot = if i % 2 == 0 {
+            Prot::ReadWrite
+        } else {
+            Prot::None
+        };
+        map.insert(i * chunk * PAGE..(i + 1) * chunk * PAGE, prot);
+    }
+
+    let stacks = heap_pages * PAGE;
+    for i in 0..regions / 4 {
+        let stack = stacks + i * 257 * PAGE;
+        map.insert(stack..stack + PAGE, Prot::None);
+        map.insert(stack + PAGE..stack + 257 * PAGE, Prot::ReadWrite);
+    }
+    map
+}
+
+fn trace(rng: &mut Xoshiro256PlusPlus, regions: usize, heap_pages: usize) -> Vec<Op> {
+    let stacks = heap_pages * PAGE;
+    let stack_pages = regions / 4 * 257;
+    let arenas = stacks + stack_pages * PAGE;
+
+    (0..OPS)
+        .map(|_| match rng.random_range(0..4) {
+            // commit or uncommit part of the heap
+            0 => Op::Insert(interval(rng, 0, heap_pages, 512), Prot::ReadWrite),
+            1 => Op::Insert(interval(rng, 0, heap_pages, 512), Prot::None),
+            // map or unmap a thread stack
+            2 => {
+                let stack = stacks + rng.random_range(0..regions / 4) * 257 * PAGE;
+                if rng.random_bool(0.5) {
+                    Op::Clear(stack..stack + 257 * PAGE)
+                } else {
+                    Op::Insert(stack + PAGE..stack + 257 * PAGE, Prot::ReadWrite)
+                }
+            }
+            // map or unmap a small anonymous mapping
+            _ => {
+                let range = interval(rng, arenas, 64 * regions, 16);
+                if rng.random_bool(0.5) {
+                    Op::Clear(range)
+                } else {
+                    Op::Insert(range, Prot::ReadWrite)
+                }
+            }
+        })
+        .collect()
+}
+
+fn bench_interval_map(c: &mut Criterion) {
+    let mut group = c.benchmark_group("interval_map_churn");
+    group.throughput(Throughput::Elements(OPS as u64));
+
+    for regions in [100, 10_000] {
+        let heap_pages = 256 * 1024;
+        let mut rng = Xoshiro256PlusPlus::seed_from_u64(0);
+        let ops = trace(&mut rng, regions, heap_pages);
+
+        group.bench_with_input(BenchmarkId::from_parameter(regions), &ops, |b, ops| {
+            b.iter_batched_ref(
+                || initial_map(regions, heap_pages),
+                |map| {
+                    for op in ops {
+                        let mutations = match op {
+                            Op::Insert(range, prot) => map.insert(range.clone(), *prot),
+                            Op::Clear(range) => map.clear(range.clone()),
+                        };
+                        std::hint::black_box(mutations);
+                    }
+                },
+                criterion::BatchSize::LargeInput,
+            );
+        });
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_interval_map);
+criterion_main!(benches);
@@ -0,0 +1,155 @@
+//! Measures the legacy TCP stack's retransmit tally, which is updated for every ACK. The workload
+//! is a sender with a large window that loses some of its packets, so that each ACK is a duplicate
+//! ACK carrying selective ACKs for the packets received after the first hole, until the lost
+//! packets are retransmitted and the cumulative ACK advances.
+
+use std::ffi::{c_int, c_void};
+
+use criterion::{BenchmarkId, Criterion, criterion_group, criterion_main};
+use rand::{Rng, SeedableRng};
+use rand_xoshiro::Xoshiro256PlusPlus;
+// the tally is a C++ library that's linked into shadow
+extern crate shadow_rs;
+
+/// Mirrors `PacketSelectiveAckRange` in "legacypacket.h".
+#[derive(Copy, Clone)]
+#[repr(C)]
+struct PacketSelectiveAckRange {
+    start: u32,
+    end: u32,
+}
+
+/// Mirrors `PacketSelectiveAcks` in "legacypacket.h".
+#[repr(C)]
+struct PacketSelectiveAcks {
+    len: u32,
+    ranges: [PacketSelectiveAckRange; 4],
+}
+
+unsafe extern "C" {
+    fn retransmit_tally_init(p: *mut *mut c_void);
+    fn retransmit_tally_destroy(p: *mut c_void);
+    fn retransmit_tally_update(p: *mut c_void, last_ack: u32, max_ack: u32, is_dup: bool) -> c_int;
+    fn retransmit_tally_mark_sacked(p: *mut c_void, sacked: PacketSelectiveAcks);
+    fn retransmit_tally_mark_lost(p: *mut c_void, begin: u32, end: u32);
+    fn retransmit_tally_mark_retransmitted(p: *mut c_void, begin: u32, end: u32);
+    fn retransmit_tally_clear_retransmitted(p: *mut c_void);
+    fn retransmit_tally_num_lost_ranges(p: *const c_void) -> usize;
+}
+
+/// The number of windows of packets sent per iteration.
+const WINDOWS: u32 = 4;
+
+struct Tally(*mut c_void);
+
+impl Tally {
+    fn new() -> Self {
+        let mut p = std::ptr::null_mut();
+        unsafe { retransmit_tally_init(&mut p) };
+        Self(p)
+    }
+}
+
+impl Drop for Tally {
+    fn drop(&mut self) {
+        unsafe { retransmit_tally_destroy(self.0) };
+    }
+}
+
+/// The selective ACKs that a receiver would send: the (up to) 4 most recent blocks of received
+/// packets above the cumulative ACK.
+fn selective_acks(blocks: &[(u32, u32)]) -> PacketSelectiveAcks {
+    let mut sacks = PacketSelectiveAcks {
+        len: 0,
+        ranges: [PacketSelectiveAckRange { start: 0, end: 0 }; 4],
+    };
+
+    for (range, (start, end)) in sacks.ranges.iter_mut().zip(blocks.iter().rev()) {
+        range.start = *start;
+        range.end = *end;
+        sacks.len += 1;
+    }
+
+    sacks
+}
+
+/// Send `WINDOWS` windows of `window` packets with each packet lost with probability
+/// `loss_rate`, and process the ACKs for them.
+fn run_windows(window: u32, loss_rate: f64, rng: &mut Xoshiro256PlusPlus) -> usize {
+    let tally = Tally::new();
+    let mut num_lost_ranges = 0;
+    let mut last_ack = 0;
+
+    for _ in 0..WINDOWS {
+        let window_end = last_ack + window;
+
+        // the blocks of packets received above the cumulative ACK
+        let mut blocks: Vec<(u32, u32)> = Vec::new();
+
+        for seq in last_ack..window_end {
+            if rng.random_bool(loss_rate) {
+                continue;
+            }
+
+            match blocks.last_mut() {
+                Some((_, end)) if *end == seq => *end = seq + 1,
+                _ => blocks.push((seq, seq + 1)),
+            }
+
+            if blocks[0].0 == last_ack {
+                // no hole yet, so this is a new cumulative ACK
+                last_ack = blocks.remove(0).1;
+                unsafe { retransmit_tally_update(tally.0, last_ack, window_end, false) };
+                continue;
+            }
+
+            // a duplicate ACK with selective ACKs
+            unsafe {
+                retransmit_tally_update(tally.0, last_ack, window_end, true);
+                retransmit_tally_mark_sacked(tally.0, selective_acks(&blocks));
+            }
+        }
+
+        // the sender marks the holes as lost and retransmits them, which are all received
+        unsafe {
+            let mut hole_start = last_ack;
+            for (start, end) in &blocks {
+                retransmit_tally_mark_lost(tally.0, hole_start, *start);
+                hole_start = *end;
+            }
+            num_lost_ranges += retransmit_tally_num_lost_ranges(tally.0);
+
+            for (start, end) in &blocks {
+                retransmit_tally_mark_retransmitted(tally.0, last_ack, *start);
+                last_ack = *end;
+            }
+            last_ack = std::cmp::max(last_ack, window_end);
+            retransmit_tally_update(tally.0, last_ack, last_ack, false);
+            retransmit_tally_clear_retransmitted(tally.0);
+        }
+    }
+
+    num_lost_ranges
+}
+
+pub fn criterion_benchmark(c: &mut Criterion) {
+    let mut group = c.benchmark_group("retransmit_tally");
+
+    for window in [1_000, 10_000] {
+        for loss_rate in [0.001, 0.01] {
+            group.bench_with_input(
+                BenchmarkId::new(format!("loss_{loss_rate}"), window),
+                &window,
+                |b, &window| {
+                    let mut rng = Xoshiro256PlusPlus::seed_from_u64(0);
+                    b.iter(|| run_windows(window, loss_rate, &mut rng));
+                },
+            );
+        }
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
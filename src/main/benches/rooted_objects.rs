@@ -0,0 +1,103 @@
+//! Measures the rooted objects (`RootedRc`, `RootedRefCell`, and `RootedCell`) in the pattern that
+//! a syscall accesses them: the worker clones the references to the running process and thread,
+//! borrows both, mutably borrows the thread's syscall handler and the process's descriptor table,
+//! borrows the thread's shared memory, and updates a counter.
+//!
+//! The objects are accessed both through a checked root and through one created with
+//! `Root::new_unchecked`, which the `unchecked_roots` feature uses for each host's root.
+
+use criterion::{Criterion, Throughput, criterion_group, criterion_main};
+use shadow_shim_helper_rs::explicit_drop::ExplicitDrop;
+use shadow_shim_helper_rs::rootedcell::Root;
+use shadow_shim_helper_rs::rootedcell::cell::RootedCell;
+use shadow_shim_helper_rs::rootedcell::rc::RootedRc;
+use shadow_shim_helper_rs::rootedcell::refcell::RootedRefCell;
+
+/// The number of syscalls per iteration.
+const SYSCALLS: usize = 10_000;
+
+struct Process {
+    descriptor_table: RootedRefCell<Vec<u64>>,
+}
+
+struct Thread {
+    syscall_handler: RootedRefCell<u64>,
+    shmem: RootedRefCell<u64>,
+    num_syscalls: RootedCell<u64>,
+}
+
+fn syscall(
+    root: &Root,
+    process: &RootedRc<RootedRefCell<Process>>,
+    thread: &RootedRc<RootedRefCell<Thread>>,
+) -> u64 {
+    let process = process.clone(root);
+    let thread = thread.clone(root);
+
+    let rv = {
+        let process = process.borrow(root);
+        let thread = thread.borrow(root);
+
+        let mut handler = thread.syscall_handler.borrow_mut(root);
+        let mut table = process.descriptor_table.borrow_mut(root);
+        let shmem = thread.shmem.borrow(root);
+
+        *handler += 1;
+        table[0] += *shmem;
+        let n = thread.num_syscalls.get(root);
+        thread.num_syscalls.set(root, n + 1);
+        table[0]
+    };
+
+    thread.explicit_drop(root);
+    process.explicit_drop(root);
+    rv
+}
+
+fn bench_with_root(c: &mut Criterion, name: &str, root: Root) {
+    let mut group = c.benchmark_group("rooted_objects_per_syscall");
+    group.throughput(Throughput::Elements(SYSCALLS as u64));
+
+    let process = RootedRc::new(
+        &root,
+        RootedRefCell::new(
+            &root,
+            Process {
+                descriptor_table: RootedRefCell::new(&root, vec![0; 16]),
+            },
+        ),
+    );
+    let thread = RootedRc::new(
+        &root,
+        RootedRefCell::new(
+            &root,
+            Thread {
+                syscall_handler: RootedRefCell::new(&root, 0),
+                shmem: RootedRefCell::new(&root, 1),
+                num_syscalls: RootedCell::new(&root, 0),
+            },
+        ),
+    );
+
+    group.bench_function(name, |b| {
+        b.iter(|| {
+            for _ in 0..SYSCALLS {
+                std::hint::black_box(syscall(&root, &process, &thread));
+            }
+        });
+    });
+
+    group.finish();
+
+    thread.explicit_drop(&root);
+    process.explicit_drop(&root);
+}
+
+fn bench_rooted_objects(c: &mut Criterion) {
+    bench_with_root(c, "checked", Root::new());
+    // SAFETY: the root is only used to access the objects created with it.
+    bench_with_root(c, "unchecked", unsafe { Root::new_unchecked() });
+}
+
+criterion_group!(benches, bench_rooted_objects);
+criterion_main!(benches);
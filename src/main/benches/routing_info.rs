@@ -0,0 +1,108 @@
+//! Measures looking up the path between two hosts' graph nodes, which is done for every packet
+//! sent between hosts. The lookups follow a trace where most packets are sent to or from a few
+//! popular nodes (such as servers), and the rest are between random pairs of nodes. Paths are
+//! either stored in a dense matrix, computed when first needed and cached for a bounded number of
+//! source nodes, or computed from network coordinates on every lookup.
+
+use std::collections::HashMap;
+
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+use rand::{Rng, SeedableRng};
+use rand_xoshiro::Xoshiro256PlusPlus;
+use shadow_rs::network::graph::coordinates::NetworkCoordinates;
+use shadow_rs::network::graph::{PathProperties, RoutingInfo};
+
+/// The number of lookups per iteration.
+const LOOKUPS: usize = 10_000;
+
+/// The number of popular nodes, and the fraction of lookups that involve one of them.
+const POPULAR_NODES: u32 = 10;
+const POPULAR_FRACTION: f64 = 0.8;
+
+/// The number of source nodes whose paths are cached for lazily computed routing information.
+const LAZY_CACHE_CAPACITY: usize = 64;
+
+fn path(src: u32, dst: u32) -> PathProperties {
+    PathProperties {
+        latency_ns: 1_000_000 + u64::from(src.abs_diff(dst)) * 1000,
+        packet_loss: 0.0,
+    }
+}
+
+fn trace(num_nodes: u32, rng: &mut Xoshiro256PlusPlus) -> Vec<(u32, u32)> {
+    (0..LOOKUPS)
+        .map(|_| {
+            let other = rng.random_range(0..num_nodes);
+            if rng.random_bool(POPULAR_FRACTION) {
+                let popular = rng.random_range(0..POPULAR_NODES);
+                if rng.random_bool(0.5) {
+                    (popular, other)
+                } else {
+                    (other, popular)
+                }
+            } else {
+                (rng.random_range(0..num_nodes), other)
+            }
+        })
+        .collect()
+}
+
+fn dense(num_nodes: u32) -> RoutingInfo<u32> {
+    let nodes: Vec<u32> = (0..num_nodes).collect();
+    let paths = nodes
+        .iter()
+        .flat_map(|src| nodes.iter().map(|dst| path(*src, *dst)))
+        .collect();
+    RoutingInfo::from_matrix(nodes, paths)
+}
+
+fn lazy(num_nodes: u32) -> RoutingInfo<u32> {
+    RoutingInfo::new_lazy(
+        (0..num_nodes).map(|x| (x, 1_000_000)),
+        1_000_000,
+        LAZY_CACHE_CAPACITY,
+        move |src| {
+            (0..num_nodes)
+                .map(|dst| (dst, path(src, dst)))
+                .collect::<HashMap<_, _>>()
+        },
+    )
+}
+
+fn coordinates(num_nodes: u32) -> RoutingInfo<u32> {
+    let text: String = (0..num_nodes)
+        .map(|x| format!("{x}, 1 Gbit, 1 Gbit, 0.0, 0.5, {}, {}\n", x % 100, x / 100))
+        .collect();
+    let coordinates = NetworkCoordinates::parse(&text).unwrap();
+    RoutingInfo::new_coordinates(&coordinates, (0..num_nodes).map(|x| (x, x as usize)))
+}
+
+fn bench_routing_info(c: &mut Criterion) {
+    let mut group = c.benchmark_group("routing_info");
+    group.throughput(Throughput::Elements(LOOKUPS as u64));
+
+    for num_nodes in [100, 1000] {
+        let mut rng = Xoshiro256PlusPlus::seed_from_u64(0);
+        let trace = trace(num_nodes, &mut rng);
+
+        for (name, routing) in [
+            ("dense", dense(num_nodes)),
+            ("lazy", lazy(num_nodes)),
+            ("coordinates", coordinates(num_nodes)),
+        ] {
+            group.bench_with_input(BenchmarkId::new(name, num_nodes), &trace, |b, trace| {
+                b.iter(|| {
+                    trace
+                        .iter()
+                        .map(|(src, dst)| routing.path(*src, *dst).unwrap().latency_ns)
+                        .sum::<u64>()
+                });
+            });
+        }
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_routing_info);
+criterion_main!(benches);
@@ -0,0 +1,106 @@
+//! Measures the table of child sockets of a legacy TCP server under connection churn. The server
+//! has a fixed number of open connections, and in each step the oldest connection closes, a new
+//! one opens, and a few packets are received for random open connections.
+
+use std::collections::VecDeque;
+use std::ffi::c_void;
+
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+use rand::{Rng, SeedableRng};
+use rand_xoshiro::Xoshiro256PlusPlus;
+// the table is C code that's linked into shadow
+extern crate shadow_rs;
+
+unsafe extern "C" {
+    fn tcpchildtable_new(
+        min_capacity: u32,
+        value_destroy: Option<unsafe extern "C" fn(*mut c_void)>,
+    ) -> *mut c_void;
+    fn tcpchildtable_free(table: *mut c_void);
+    fn tcpchildtable_lookup(table: *const c_void, peer_ip: u32, peer_port: u16) -> *mut c_void;
+    fn tcpchildtable_replace(table: *mut c_void, peer_ip: u32, peer_port: u16, child: *mut c_void);
+    fn tcpchildtable_remove(table: *mut c_void, peer_ip: u32, peer_port: u16) -> bool;
+}
+
+/// The number of connections that are closed and opened per iteration.
+const STEPS: usize = 1_000;
+
+/// The number of packets received per step.
+const LOOKUPS_PER_STEP: usize = 8;
+
+/// The backlog that the table is initially sized for (the default `SHADOW_SOMAXCONN`).
+const BACKLOG: u32 = 4096;
+
+struct Table(*mut c_void);
+
+impl Drop for Table {
+    fn drop(&mut self) {
+        unsafe { tcpchildtable_free(self.0) };
+    }
+}
+
+/// A server with `conns` open connections from clients with random addresses.
+struct Server {
+    table: Table,
+    /// Open connections, oldest first.
+    open: VecDeque<(u32, u16)>,
+    rng: Xoshiro256PlusPlus,
+}
+
+impl Server {
+    fn new(conns: usize) -> Self {
+        let table = Table(unsafe { tcpchildtable_new(BACKLOG, None) });
+        let mut server = Self {
+            table,
+            open: VecDeque::new(),
+            rng: Xoshiro256PlusPlus::seed_from_u64(0),
+        };
+        for _ in 0..conns {
+            server.open();
+        }
+        server
+    }
+
+    fn open(&mut self) {
+        // a small pool of client hosts that each use many ephemeral ports
+        let key = (
+            0x0b00_0000 | self.rng.random_range(0..256),
+            self.rng.random(),
+        );
+        // the table never dereferences the children
+        let child = std::ptr::dangling_mut::<u8>().cast();
+        unsafe { tcpchildtable_replace(self.table.0, key.0, key.1, child) };
+        self.open.push_back(key);
+    }
+
+    fn step(&mut self) -> usize {
+        let (ip, port) = self.open.pop_front().unwrap();
+        unsafe { tcpchildtable_remove(self.table.0, ip, port) };
+        self.open();
+
+        let mut found = 0;
+        for _ in 0..LOOKUPS_PER_STEP {
+            let (ip, port) = self.open[self.rng.random_range(0..self.open.len())];
+            let child = unsafe { tcpchildtable_lookup(self.table.0, ip, port) };
+            found += usize::from(!child.is_null());
+        }
+        found
+    }
+}
+
+pub fn criterion_benchmark(c: &mut Criterion) {
+    let mut group = c.benchmark_group("tcp_child_table");
+    group.throughput(Throughput::Elements(STEPS as u64));
+
+    for conns in [1_000, 100_000] {
+        group.bench_with_input(BenchmarkId::new("churn", conns), &conns, |b, &conns| {
+            let mut server = Server::new(conns);
+            b.iter(|| (0..STEPS).map(|_| server.step()).sum::<usize>());
+        });
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, criterion_benchmark);
+criterion_main!(benches);
@@ -0,0 +1,82 @@
+//! Measures the token bucket that rate limits a relay, using the same pattern of removals as
+//! `Relay::forward_until_blocked`: the relay checks the balance, forwards packets until it runs out
+//! of tokens, removes the tokens for the packets it forwarded and asks how long it must wait for
+//! the next packet, and then runs again after that long.
+
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+use rand::{Rng, SeedableRng};
+use rand_xoshiro::Xoshiro256PlusPlus;
+use shadow_rs::network::relay::token_bucket::TokenBucket;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+/// The number of packets forwarded per iteration.
+const PACKETS: usize = 10_000;
+
+/// A 10 Mbit/s limit, configured like `create_token_bucket` in the relay with the default burst
+/// allowance of 1 MTU.
+const REFILL_SIZE: u64 = 1250;
+const CAPACITY: u64 = REFILL_SIZE + 1500;
+
+/// Packet sizes: ACKs, and full-sized data packets.
+const PACKET_SIZES: [u64; 2] = [40, 1500];
+
+fn new_bucket(continuous: bool) -> TokenBucket {
+    let refill_interval = SimulationTime::from_millis(1);
+    if continuous {
+        TokenBucket::new_continuous(CAPACITY, REFILL_SIZE, refill_interval).unwrap()
+    } else {
+        TokenBucket::new(CAPACITY, REFILL_SIZE, refill_interval).unwrap()
+    }
+}
+
+/// Forward the packets in `trace`, returning the simulated time that it took.
+fn run(tb: &mut TokenBucket, trace: &[u64], start: EmulatedTime) -> EmulatedTime {
+    let mut now = start;
+    let mut packets = trace.iter().peekable();
+
+    while packets.peek().is_some() {
+        let mut available = tb.conforming_remove_inner(0, &now).unwrap();
+        let mut used = 0;
+
+        while let Some(len) = packets.next_if(|len| **len <= available) {
+            available -= len;
+            used += len;
+        }
+
+        tb.conforming_remove_inner(used, &now).unwrap();
+        if let Some(len) = packets.peek() {
+            now = now + tb.conforming_remove_inner(**len, &now).unwrap_err();
+        }
+    }
+
+    now
+}
+
+fn bench_token_bucket(c: &mut Criterion) {
+    let mut group = c.benchmark_group("token_bucket");
+    group.throughput(Throughput::Elements(PACKETS as u64));
+
+    let mut rng = Xoshiro256PlusPlus::seed_from_u64(0);
+    let trace: Vec<u64> = (0..PACKETS)
+        .map(|_| PACKET_SIZES[rng.random_range(0..PACKET_SIZES.len())])
+        .collect();
+
+    for continuous in [false, true] {
+        let name = if continuous { "continuous" } else { "discrete" };
+        group.bench_with_input(
+            BenchmarkId::new("refill", name),
+            &continuous,
+            |b, &continuous| {
+                let mut tb = new_bucket(continuous);
+                let mut now = EmulatedTime::SIMULATION_START;
+                b.iter(|| now = run(&mut tb, &trace, now));
+            },
+        );
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_token_bucket);
+criterion_main!(benches);
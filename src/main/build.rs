@@ -336,8 +336,10 @@ fn build_shadow_c(build_common: &ShadowBuildCommon) {
         "host/descriptor/regular_file.c",
         "host/descriptor/socket.c",
         "host/descriptor/tcp.c",
+        "host/descriptor/tcp_child_table.c",
         "host/descriptor/tcp_cong.c",
         "host/descriptor/tcp_cong_reno.c",
+        "host/descriptor/tcp_packet_ring.c",
         "host/process.c",
         "host/futex.c",
         "host/syscall/handler/fcntl.c",
@@ -50,6 +50,9 @@ static PlatformCPUInfo _global_platform_info = {0};
 
 static gint _affinity_enabled = 0;
 
+// Protects the load tables, which are updated as workers are assigned CPUs.
+static pthread_mutex_t _loads_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 static gpointer _node_key(const CPUInfo* p_cpu_info) {
     assert(p_cpu_info);
     return GINT_TO_POINTER(p_cpu_info->node);
@@ -203,16 +206,67 @@ int affinity_getGoodWorkerAffinity() {
     // FIXME (rwails): This assumes that the returned affinity was actually
     // used.
 
-    static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
-    pthread_mutex_lock(&mtx);
+    pthread_mutex_lock(&_loads_mtx);
 
     const CPUInfo* p_best_cpu = _get_best_cpu();
     _update_loads(p_best_cpu);
 
-    pthread_mutex_unlock(&mtx);
+    pthread_mutex_unlock(&_loads_mtx);
     return p_best_cpu->logical_cpu_num;
 }
 
+int affinity_getSmtSibling(int cpu_num) {
+
+    if (!_affinity_enabled || cpu_num == AFFINITY_UNINIT) {
+        return AFFINITY_UNINIT;
+    }
+
+    const CPUInfo* p_cpu_info = NULL;
+    for (size_t idx = 0; idx < _global_platform_info.n_cpus; ++idx) {
+        if (_global_platform_info.p_cpus[idx].logical_cpu_num == cpu_num) {
+            p_cpu_info = &_global_platform_info.p_cpus[idx];
+            break;
+        }
+    }
+
+    if (!p_cpu_info) {
+        return AFFINITY_UNINIT;
+    }
+
+    pthread_mutex_lock(&_loads_mtx);
+
+    int sibling = AFFINITY_UNINIT;
+    for (size_t idx = 0; idx < _global_platform_info.n_cpus; ++idx) {
+        const CPUInfo* rhs = &_global_platform_info.p_cpus[idx];
+        // Another hardware thread of the same core that no worker was assigned to.
+        if (rhs->logical_cpu_num != cpu_num && rhs->core == p_cpu_info->core &&
+            rhs->socket == p_cpu_info->socket && _cpuIdxIsEligible(idx) &&
+            _hash_table_lookup(_global_platform_info.cpu_loads, _cpu_key(rhs)) == 0) {
+            sibling = rhs->logical_cpu_num;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&_loads_mtx);
+    return sibling;
+}
+
+int affinity_getCpuNode(int cpu_num) {
+
+    if (!_affinity_enabled) {
+        return AFFINITY_UNINIT;
+    }
+
+    for (size_t idx = 0; idx < _global_platform_info.n_cpus; ++idx) {
+        const CPUInfo* p_cpu_info = &_global_platform_info.p_cpus[idx];
+        if (p_cpu_info->logical_cpu_num == cpu_num) {
+            return p_cpu_info->node;
+        }
+    }
+
+    return AFFINITY_UNINIT;
+}
+
 /*
  * Read the output of the lscpu command, allocates a buffer, and sets contents
  * to point to the buffer.
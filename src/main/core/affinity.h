@@ -20,6 +20,23 @@ enum { AFFINITY_UNINIT = -1 };
  */
 int affinity_getGoodWorkerAffinity();
 
+/*
+ * Returns the NUMA node of the given logical CPU, or AFFINITY_UNINIT if the
+ * platform information hasn't been initialized or the CPU is unknown.
+ *
+ * THREAD SAFETY: Thread-safe after affinity_initPlatformInfo() has returned.
+ */
+int affinity_getCpuNode(int cpu_num);
+
+/*
+ * Returns another logical CPU on the same physical core as the given logical
+ * CPU (an SMT sibling) that no worker has been assigned to, or AFFINITY_UNINIT
+ * if there is none or the platform information hasn't been initialized.
+ *
+ * THREAD SAFETY: Thread-safe after affinity_initPlatformInfo() has returned.
+ */
+int affinity_getSmtSibling(int cpu_num);
+
 /*
  * Try to parse platform CPU orientation information from the host machine.
  *
@@ -0,0 +1,350 @@
+//! Isolation of the managed processes from Shadow's worker threads with cgroup v2.
+//!
+//! Shadow moves itself into a `shadow-workers` child of the cgroup that it was started in, and the
+//! managed processes of each host into a child of a `shadow-managed` cgroup. The `cpuset`
+//! controller can then keep the managed processes off of the CPUs that the workers run on, the
+//! `cpu` controller can limit the total CPU time of the managed processes, and the cgroup of each
+//! host accounts for the CPU time used by its managed processes.
+//!
+//! A cgroup can't have both processes and children with controllers enabled, so Shadow must be
+//! the only process in the cgroup it's started in, and it must be allowed to create children and
+//! enable controllers in it. This is the case for example when running Shadow with
+//! `systemd-run --user --scope -p Delegate=yes shadow ...`.
+//!
+//!  More info:
+//!   - <https://docs.kernel.org/admin-guide/cgroup-v2.html>
+
+use std::collections::BTreeSet;
+use std::path::{Path, PathBuf};
+use std::time::Duration;
+
+use anyhow::Context;
+use linux_api::posix_types::Pid;
+
+/// The period of the `cpu.max` limit, which is the kernel's default.
+const CPU_MAX_PERIOD_USEC: u64 = 100_000;
+
+/// The smallest `cpu.max` quota that the kernel accepts.
+const CPU_MAX_MIN_QUOTA_USEC: u64 = 1_000;
+
+/// The cgroups of the Shadow process and of the managed processes. The cgroups are removed and
+/// Shadow is moved back to its original cgroup when this is dropped.
+#[derive(Debug)]
+pub struct CgroupIsolation {
+    /// The cgroup that Shadow was started in.
+    parent: PathBuf,
+    workers: PathBuf,
+    managed: PathBuf,
+    /// Are the managed processes restricted to CPUs that the workers don't run on?
+    managed_cpuset: bool,
+    /// The controllers that were enabled for the children of `parent`.
+    controllers: Vec<&'static str>,
+}
+
+impl CgroupIsolation {
+    /// Moves Shadow into its own cgroup, and creates the cgroup for the managed processes. If
+    /// `managed_cpus` (a list in the `cpuset.cpus` format, for example "0-3,8") is given, the
+    /// managed processes only run on those CPUs and Shadow only runs on the others. If
+    /// `managed_cpu_limit` is given, the managed processes can use at most that many CPUs worth of
+    /// CPU time.
+    ///
+    /// This must be called before determining which CPUs the workers can be pinned to.
+    pub fn new(managed_cpus: Option<&str>, managed_cpu_limit: Option<f64>) -> anyhow::Result<Self> {
+        let mountinfo = read("/proc/self/mountinfo")?;
+        let mount = cgroup2_mount(&mountinfo).context("There is no cgroup v2 hierarchy")?;
+        let cgroup = read("/proc/self/cgroup")?;
+        let cgroup = cgroup2_path(&cgroup).context("Shadow is not in a cgroup v2 cgroup")?;
+        let parent = mount.join(cgroup.trim_start_matches('/'));
+
+        let managed_cpus = managed_cpus
+            .map(|x| parse_cpu_list(x).with_context(|| format!("Invalid CPU list '{x}'")))
+            .transpose()?;
+
+        let workers = parent.join("shadow-workers");
+        let managed = parent.join("shadow-managed");
+
+        create_dir(&workers)?;
+        let mut isolation = Self {
+            parent,
+            workers,
+            managed,
+            managed_cpuset: managed_cpus.is_some(),
+            controllers: Vec::new(),
+        };
+
+        // the parent may only enable controllers for its children once it has no processes
+        write(
+            isolation.workers.join("cgroup.procs"),
+            &std::process::id().to_string(),
+        )?;
+        create_dir(&isolation.managed)?;
+
+        let mut controllers = Vec::new();
+        if managed_cpus.is_some() {
+            controllers.push("cpuset");
+        }
+        if managed_cpu_limit.is_some() {
+            controllers.push("cpu");
+        }
+        if !controllers.is_empty() {
+            let enable: Vec<_> = controllers.iter().map(|x| format!("+{x}")).collect();
+            write(
+                isolation.parent.join("cgroup.subtree_control"),
+                &enable.join(" "),
+            )?;
+            isolation.controllers = controllers;
+        }
+
+        if let Some(managed_cpus) = managed_cpus {
+            let available = read(isolation.parent.join("cpuset.cpus.effective"))?;
+            let available = parse_cpu_list(&available).context("Invalid cpuset.cpus.effective")?;
+
+            if !managed_cpus.is_subset(&available) {
+                anyhow::bail!(
+                    "The CPUs for the managed processes ({}) must be a subset of Shadow's CPUs ({})",
+                    format_cpu_list(&managed_cpus),
+                    format_cpu_list(&available),
+                );
+            }
+
+            let worker_cpus: BTreeSet<_> = available.difference(&managed_cpus).copied().collect();
+            if worker_cpus.is_empty() {
+                anyhow::bail!(
+                    "There are no CPUs left for Shadow that aren't used by the managed processes"
+                );
+            }
+
+            write(
+                isolation.managed.join("cpuset.cpus"),
+                &format_cpu_list(&managed_cpus),
+            )?;
+            write(
+                isolation.workers.join("cpuset.cpus"),
+                &format_cpu_list(&worker_cpus),
+            )?;
+            log::info!(
+                "Running managed processes on CPUs {} and Shadow on CPUs {}",
+                format_cpu_list(&managed_cpus),
+                format_cpu_list(&worker_cpus),
+            );
+        }
+
+        if let Some(limit) = managed_cpu_limit {
+            if limit.is_nan() || limit <= 0.0 {
+                anyhow::bail!("The CPU limit for the managed processes must be positive");
+            }
+            let quota = (limit * CPU_MAX_PERIOD_USEC as f64).round() as u64;
+            let quota = std::cmp::max(quota, CPU_MAX_MIN_QUOTA_USEC);
+            write(
+                isolation.managed.join("cpu.max"),
+                &format!("{quota} {CPU_MAX_PERIOD_USEC}"),
+            )?;
+        }
+
+        Ok(isolation)
+    }
+
+    /// Create the cgroup for the managed processes of the host `name`.
+    pub fn new_host_cgroup(&self, name: &str) -> anyhow::Result<HostCgroup> {
+        let path = self.managed.join(name);
+        create_dir(&path)?;
+        Ok(HostCgroup {
+            path,
+            restricts_cpus: self.managed_cpuset,
+        })
+    }
+}
+
+impl Drop for CgroupIsolation {
+    fn drop(&mut self) {
+        // the host cgroups were removed when their hosts were dropped
+        remove_dir(&self.managed);
+
+        if !self.controllers.is_empty() {
+            let disable: Vec<_> = self.controllers.iter().map(|x| format!("-{x}")).collect();
+            let path = self.parent.join("cgroup.subtree_control");
+            if let Err(e) = write(path, &disable.join(" ")) {
+                log::warn!("{e:#}");
+                return;
+            }
+        }
+
+        let path = self.parent.join("cgroup.procs");
+        if let Err(e) = write(path, &std::process::id().to_string()) {
+            log::warn!("{e:#}");
+            return;
+        }
+        remove_dir(&self.workers);
+    }
+}
+
+/// The cgroup of a host's managed processes. The cgroup is removed when this is dropped, which
+/// only succeeds once the processes have been reaped.
+#[derive(Debug)]
+pub struct HostCgroup {
+    path: PathBuf,
+    restricts_cpus: bool,
+}
+
+impl HostCgroup {
+    /// Move a process and all of its threads into the cgroup. The process's future children will
+    /// also be in the cgroup.
+    pub fn add_process(&self, pid: Pid) -> anyhow::Result<()> {
+        let pid = pid.as_raw_nonzero().get();
+        write(self.path.join("cgroup.procs"), &pid.to_string())
+    }
+
+    /// The CPU time used by all processes that have been in the cgroup, including those that have
+    /// exited.
+    pub fn cpu_time(&self) -> anyhow::Result<Duration> {
+        let stat = read(self.path.join("cpu.stat"))?;
+        let usec = cpu_stat_usage_usec(&stat).context("Invalid cpu.stat")?;
+        Ok(Duration::from_micros(usec))
+    }
+
+    /// Are the processes restricted to a set of CPUs that Shadow's worker threads don't run on?
+    /// Their threads then must not be pinned to the CPUs of the workers.
+    pub fn restricts_cpus(&self) -> bool {
+        self.restricts_cpus
+    }
+}
+
+impl Drop for HostCgroup {
+    fn drop(&mut self) {
+        remove_dir(&self.path);
+    }
+}
+
+fn read(path: impl AsRef<Path>) -> anyhow::Result<String> {
+    let path = path.as_ref();
+    std::fs::read_to_string(path).with_context(|| format!("Failed to read '{}'", path.display()))
+}
+
+fn write(path: impl AsRef<Path>, contents: &str) -> anyhow::Result<()> {
+    let path = path.as_ref();
+    std::fs::write(path, contents)
+        .with_context(|| format!("Failed to write '{contents}' to '{}'", path.display()))
+}
+
+fn create_dir(path: &Path) -> anyhow::Result<()> {
+    std::fs::create_dir(path)
+        .with_context(|| format!("Failed to create cgroup '{}'", path.display()))
+}
+
+fn remove_dir(path: &Path) {
+    match std::fs::remove_dir(path) {
+        Ok(()) => {}
+        // we may have failed before creating it
+        Err(e) if e.kind() == std::io::ErrorKind::NotFound => {}
+        Err(e) => log::warn!("Failed to remove cgroup '{}': {e}", path.display()),
+    }
+}
+
+/// The mount point of the cgroup v2 hierarchy from the contents of `/proc/self/mountinfo`.
+fn cgroup2_mount(mountinfo: &str) -> Option<PathBuf> {
+    mountinfo.lines().find_map(|line| {
+        // the optional fields are terminated by a single "-"
+        let (fields, fs) = line.split_once(" - ")?;
+        if fs.split(' ').next()? != "cgroup2" {
+            return None;
+        }
+        fields.split(' ').nth(4).map(PathBuf::from)
+    })
+}
+
+/// The cgroup v2 path from the contents of `/proc/self/cgroup`.
+fn cgroup2_path(cgroup: &str) -> Option<&str> {
+    cgroup.lines().find_map(|line| line.strip_prefix("0::"))
+}
+
+/// The `usage_usec` value from the contents of a `cpu.stat` file.
+fn cpu_stat_usage_usec(stat: &str) -> Option<u64> {
+    stat.lines()
+        .find_map(|line| line.strip_prefix("usage_usec "))
+        .and_then(|x| x.trim().parse().ok())
+}
+
+/// Parse a CPU list such as "0-3,8".
+fn parse_cpu_list(list: &str) -> Option<BTreeSet<u32>> {
+    let mut cpus = BTreeSet::new();
+    for range in list.trim().split(',').filter(|x| !x.is_empty()) {
+        let (start, end): (u32, u32) = match range.split_once('-') {
+            Some((start, end)) => (start.parse().ok()?, end.parse().ok()?),
+            None => {
+                let cpu = range.parse().ok()?;
+                (cpu, cpu)
+            }
+        };
+        if start > end {
+            return None;
+        }
+        cpus.extend(start..=end);
+    }
+    Some(cpus)
+}
+
+/// Format a set of CPUs as a list such as "0-3,8".
+fn format_cpu_list(cpus: &BTreeSet<u32>) -> String {
+    let mut ranges: Vec<(u32, u32)> = Vec::new();
+    for &cpu in cpus {
+        match ranges.last_mut() {
+            Some((_, end)) if *end + 1 == cpu => *end = cpu,
+            _ => ranges.push((cpu, cpu)),
+        }
+    }
+
+    let ranges: Vec<_> = ranges
+        .into_iter()
+        .map(|(start, end)| match start == end {
+            true => format!("{start}"),
+            false => format!("{start}-{end}"),
+        })
+        .collect();
+    ranges.join(",")
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_cpu_list() {
+        let cpus = parse_cpu_list("0-3,8,10-11\n").unwrap();
+        assert_eq!(
+            cpus.iter().copied().collect::<Vec<_>>(),
+            [0, 1, 2, 3, 8, 10, 11]
+        );
+        assert_eq!(format_cpu_list(&cpus), "0-3,8,10-11");
+
+        assert_eq!(parse_cpu_list("").unwrap().len(), 0);
+        assert_eq!(format_cpu_list(&BTreeSet::new()), "");
+        assert!(parse_cpu_list("3-1").is_none());
+        assert!(parse_cpu_list("a").is_none());
+    }
+
+    #[test]
+    fn test_cgroup2_mount() {
+        let mountinfo = "\
+            25 30 0:23 / /sys rw,nosuid,nodev,noexec,relatime shared:7 - sysfs sysfs rw\n\
+            35 25 0:30 / /sys/fs/cgroup rw,nosuid,nodev,noexec,relatime shared:9 - cgroup2 cgroup2 rw,nsdelegate\n";
+        assert_eq!(
+            cgroup2_mount(mountinfo),
+            Some(PathBuf::from("/sys/fs/cgroup"))
+        );
+        assert_eq!(cgroup2_mount(mountinfo.lines().next().unwrap()), None);
+    }
+
+    #[test]
+    fn test_cgroup2_path() {
+        let cgroup = "1:name=systemd:/\n0::/user.slice/run-1.scope\n";
+        assert_eq!(cgroup2_path(cgroup), Some("/user.slice/run-1.scope"));
+        assert_eq!(cgroup2_path("1:name=systemd:/\n"), None);
+    }
+
+    #[test]
+    fn test_cpu_stat() {
+        let stat = "usage_usec 1234\nuser_usec 1000\nsystem_usec 234\n";
+        assert_eq!(cpu_stat_usage_usec(stat), Some(1234));
+        assert_eq!(cpu_stat_usage_usec("user_usec 1\n"), None);
+    }
+}
@@ -74,6 +74,17 @@ pub struct CliOptions {
     #[clap(long)]
     pub show_config: bool,
 
+    /// Run the simulation once with each seed in the comma-delimited list, one after another,
+    /// sharing the network setup between the runs. Each run uses the directory 'seed-N' in the
+    /// data directory
+    #[clap(
+        long,
+        value_name = "seeds",
+        value_delimiter = ',',
+        conflicts_with = "seed"
+    )]
+    pub seeds: Option<Vec<u32>>,
+
     #[clap(flatten)]
     pub general: GeneralOptions,
 
@@ -162,6 +173,46 @@ impl ConfigOptions {
         SimulationTime::from_nanos(nanos)
     }
 
+    pub fn idle_host_reclaim_delay(&self) -> Option<SimulationTime> {
+        self.experimental
+            .idle_host_reclaim_delay
+            .flatten_ref()
+            .map(|x| {
+                SimulationTime::from_nanos(x.convert(units::TimePrefix::Nano).unwrap().value())
+            })
+    }
+
+    /// The memory that autotuning may grow the socket buffers of each of `num_hosts` hosts by,
+    /// which is the smaller of the per-host budget and an even share of the total budget.
+    pub fn socket_buffer_budget(&self, num_hosts: usize) -> Option<u64> {
+        let bytes = |x: &units::Bytes<units::SiPrefixUpper>| {
+            x.convert(units::SiPrefixUpper::Base).unwrap().value()
+        };
+
+        let host = self
+            .experimental
+            .socket_buffer_host_budget
+            .flatten_ref()
+            .map(bytes);
+        // an even share rather than a shared pool, so that hosts on different threads don't
+        // compete for it and the simulation stays deterministic
+        let total = self
+            .experimental
+            .socket_buffer_total_budget
+            .flatten_ref()
+            .map(|x| bytes(x) / u64::try_from(std::cmp::max(num_hosts, 1)).unwrap());
+
+        [host, total].into_iter().flatten().min()
+    }
+
+    /// The space that the in-memory host data directories may use.
+    pub fn host_data_memory_budget(&self) -> Option<u64> {
+        self.experimental
+            .host_data_memory_budget
+            .flatten_ref()
+            .map(|x| x.convert(units::SiPrefixUpper::Base).unwrap().value())
+    }
+
     pub fn unblocked_syscall_latency(&self) -> SimulationTime {
         let nanos = self.experimental.unblocked_syscall_latency.unwrap();
         let nanos = nanos.convert(units::TimePrefix::Nano).unwrap().value();
@@ -209,9 +260,18 @@ impl ConfigOptions {
         match self.experimental.strace_logging_mode.as_ref().unwrap() {
             StraceLoggingMode::Standard => Some(FmtOptions::Standard),
             StraceLoggingMode::Deterministic => Some(FmtOptions::Deterministic),
-            StraceLoggingMode::Off => None,
+            StraceLoggingMode::Binary | StraceLoggingMode::Off => None,
         }
     }
+
+    /// Whether syscalls should be logged in the binary strace format; see
+    /// [`binary_strace`](crate::host::syscall::binary_strace).
+    pub fn use_binary_strace(&self) -> bool {
+        matches!(
+            self.experimental.strace_logging_mode.as_ref().unwrap(),
+            StraceLoggingMode::Binary
+        )
+    }
 }
 
 /// Help messages used by Clap for command line arguments, combining the doc string with
@@ -323,6 +383,12 @@ pub struct NetworkOptions {
     #[clap(long, value_name = "bool")]
     #[clap(help = NETWORK_HELP.get("use_shortest_path").unwrap().as_str())]
     pub use_shortest_path: Option<bool>,
+
+    /// Changes to the latency, packet loss, or availability of the network graph's edges at
+    /// given simulation times
+    #[clap(skip)]
+    #[serde(default = "default_some_vec")]
+    pub graph_updates: Option<Vec<GraphUpdate>>,
 }
 
 impl NetworkOptions {
@@ -352,12 +418,105 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("use_sched_fifo").unwrap().as_str())]
     pub use_sched_fifo: Option<bool>,
 
-    /// Count the number of occurrences for individual syscalls
+    /// Buffer the shim's log records in each thread's shared memory for shadow to write to the shim
+    /// log file, instead of writing each record with a syscall from the managed process
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_shim_log_ring").unwrap().as_str())]
+    pub use_shim_log_ring: Option<bool>,
+
+    /// Count the number of occurrences for individual syscalls, and record a histogram of each
+    /// syscall's round trip latency (the wall time from Shadow returning control to a managed
+    /// thread until the thread makes the syscall) in the `syscall_round_trips` section of
+    /// `sim-stats.json`
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bool")]
     #[clap(help = EXP_HELP.get("use_syscall_counters").unwrap().as_str())]
     pub use_syscall_counters: Option<bool>,
 
+    /// Record the wall time that each host spends in Shadow, in its managed processes, and
+    /// waiting on IPC, and histograms of how long each syscall handler takes. The profile is
+    /// written to `profile.json` in the data directory.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_profiling").unwrap().as_str())]
+    pub use_profiling: Option<bool>,
+
+    /// Append a record of simulation statistics to `sim-stats.ndjson` on every heartbeat interval
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_sim_stats_stream").unwrap().as_str())]
+    pub use_sim_stats_stream: Option<bool>,
+
+    /// Cache the results of the CPU frequency and preload library probes run at startup, and reuse
+    /// them while the shadow binary and the machine are unchanged
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_startup_probe_cache").unwrap().as_str())]
+    pub use_startup_probe_cache: Option<bool>,
+
+    /// When copying the template directory, hard link regular files that nobody has permission to
+    /// write instead of copying them. They must then not be modified during the simulation.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_template_hardlinks").unwrap().as_str())]
+    pub use_template_hardlinks: Option<bool>,
+
+    /// Write a binary trace of every event that each host runs to `event-trace.bin` in the data
+    /// directory
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_event_trace").unwrap().as_str())]
+    pub use_event_trace: Option<bool>,
+
+    /// Append the stdout and stderr of all managed processes to a few segment files in the `output`
+    /// directory of the data directory, instead of writing a file for each stream
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_output_segments").unwrap().as_str())]
+    pub use_output_segments: Option<bool>,
+
+    /// Count the number of packets sent along each network path, and log them at the end of the
+    /// simulation
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_packet_counters").unwrap().as_str())]
+    pub use_packet_counters: Option<bool>,
+
+    /// Buffer the packets sent by each worker during a round and deliver them to each destination host
+    /// in a single batch at the end of the round
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_packet_outbox").unwrap().as_str())]
+    pub use_packet_outbox: Option<bool>,
+
+    /// Deliver back-to-back packets that a host sends to the same destination host for the same time
+    /// as a single event. Implies `use_packet_outbox`
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_packet_trains").unwrap().as_str())]
+    pub use_packet_trains: Option<bool>,
+
+    /// Add bandwidth to the hosts' token buckets continuously rather than every millisecond, so that
+    /// packets leave at their exact departure times
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_continuous_rate_limits").unwrap().as_str())]
+    pub use_continuous_rate_limits: Option<bool>,
+
+    /// Deliver loopback packets as soon as they are sent, rather than from a scheduled forwarding event
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_direct_loopback").unwrap().as_str())]
+    pub use_direct_loopback: Option<bool>,
+
+    /// Keep each host's timers in a hierarchical timer wheel that schedules a single event for the next
+    /// timer to expire, rather than scheduling an event for every expiration
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_timer_wheel").unwrap().as_str())]
+    pub use_timer_wheel: Option<bool>,
+
     /// Count object allocations and deallocations. If disabled, we will not be able to detect object memory leaks
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bool")]
@@ -370,6 +529,34 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("use_preload_libc").unwrap().as_str())]
     pub use_preload_libc: Option<bool>,
 
+    /// Patch libc's syscall wrapper functions in all managed processes to call into the shim directly,
+    /// including when libc calls them internally.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_libc_patching").unwrap().as_str())]
+    pub use_libc_patching: Option<bool>,
+
+    /// On the first emulated `rdtsc` or `rdtscp` at a recognized call site, rewrite the site to call into the
+    /// shim directly instead of trapping on every execution.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_rdtsc_patching").unwrap().as_str())]
+    pub use_rdtsc_patching: Option<bool>,
+
+    /// Spawn managed processes that share a binary, arguments, and environment by forking them from a
+    /// zygote process that has already been dynamically linked, instead of with `execve`.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_zygotes").unwrap().as_str())]
+    pub use_zygotes: Option<bool>,
+
+    /// Start managed processes in the background before their start time, and have them wait in
+    /// the shim until their start time.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_process_prelaunch").unwrap().as_str())]
+    pub use_process_prelaunch: Option<bool>,
+
     /// Preload our OpenSSL RNG library for all managed processes to mitigate non-deterministic use of OpenSSL.
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bool")]
@@ -385,19 +572,157 @@ pub struct ExperimentalOptions {
     pub use_preload_openssl_crypto: Option<bool>,
 
     /// Use the MemoryManager in memory-mapping mode. This can improve
-    /// performance, but disables support for dynamically spawning processes
-    /// inside the simulation (e.g. the `fork` syscall).
+    /// performance. Processes forked inside the simulation get copy-on-write
+    /// copies of their parent's memory, and don't use memory-mapping mode
+    /// unless they `exec`.
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bool")]
     #[clap(help = EXP_HELP.get("use_memory_manager").unwrap().as_str())]
     pub use_memory_manager: Option<bool>,
 
+    /// Back the memory manager's shared memory files with transparent huge pages. This
+    /// reduces TLB misses and page table memory for processes with large heaps, but requires
+    /// that the kernel allows huge pages for shared memory (see
+    /// `/sys/kernel/mm/transparent_hugepage/shmem_enabled`). Ignored unless `use_memory_manager`
+    /// is enabled.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_memory_manager_huge_pages").unwrap().as_str())]
+    pub use_memory_manager_huge_pages: Option<bool>,
+
+    /// Leave read-only private file mappings in the kernel's page cache, where they're shared
+    /// between processes that map the same file, instead of copying them into the memory manager's
+    /// shared memory file when Shadow fails to access them. Ignored unless `use_memory_manager` is
+    /// enabled.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_memory_manager_shared_file_pages").unwrap().as_str())]
+    pub use_memory_manager_shared_file_pages: Option<bool>,
+
+    /// Hold back the writes that some syscall handlers make to plugin memory that isn't mapped into
+    /// Shadow, and make them together when the handler returns, to save syscalls.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_batched_memory_writes").unwrap().as_str())]
+    pub use_batched_memory_writes: Option<bool>,
+
+    /// Have the shim do the reads, writes, seeks, and stats of regular files natively on its own
+    /// fd for the file, rather than asking Shadow to do them. Only files that aren't shared with
+    /// other processes use native I/O.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_native_file_io").unwrap().as_str())]
+    pub use_native_file_io: Option<bool>,
+
+    /// Do the reads, writes, and syncs of regular files that Shadow does for managed processes on
+    /// background threads, so that a worker can run its other hosts while the kernel completes the
+    /// I/O. Can't be used with a runahead larger than the smallest network latency.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_file_io_offload").unwrap().as_str())]
+    pub use_file_io_offload: Option<bool>,
+
+    /// Serve reads of files within these directories from a read-only memory-mapped cache that's
+    /// shared by all hosts. The files must not be modified during the simulation
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "paths", value_delimiter = ',')]
+    #[clap(help = EXP_HELP.get("file_cache_paths").unwrap().as_str())]
+    pub file_cache_paths: Option<Vec<String>>,
+
+    /// If set, keep the hosts' data directories in a temporary directory within this directory
+    /// rather than in the data directory. This should be a memory-backed filesystem such as
+    /// `/dev/shm`. The files matching `host_data_spill_patterns` are copied to the data directory
+    /// when each host shuts down
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "path")]
+    #[clap(help = EXP_HELP.get("host_data_memory_path").unwrap().as_str())]
+    pub host_data_memory_path: Option<NullableOption<String>>,
+
+    /// If set, the amount of space that the in-memory host data directories may use. Shadow fails
+    /// to start if the filesystem has less space available, and warns if the directories grow
+    /// larger than this
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bytes")]
+    #[clap(help = EXP_HELP.get("host_data_memory_budget").unwrap().as_str())]
+    pub host_data_memory_budget: Option<NullableOption<units::Bytes<units::SiPrefixUpper>>>,
+
+    /// The files in the in-memory host data directories to copy to the data directory, as glob
+    /// patterns relative to each host's data directory
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "patterns", value_delimiter = ',')]
+    #[clap(help = EXP_HELP.get("host_data_spill_patterns").unwrap().as_str())]
+    pub host_data_spill_patterns: Option<Vec<String>>,
+
+    /// Give the native memory of a host back to the system when the host has no events for at
+    /// least this long. The private memory of the host's managed processes is paged out, and
+    /// Shadow's mappings of their memory are marked as cold. If null, memory is never reclaimed.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("idle_host_reclaim_delay").unwrap().as_str())]
+    pub idle_host_reclaim_delay: Option<NullableOption<units::Time<units::TimePrefix>>>,
+
+    /// Have the shim serve `getrandom` and reads of random files such as `/dev/urandom` from a
+    /// per-thread buffer of random bytes from the host's random source, rather than asking Shadow
+    /// to handle them
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_shim_random").unwrap().as_str())]
+    pub use_shim_random: Option<bool>,
+
+    /// Have the shim return from a futex wake without asking Shadow to handle it when no futex on the
+    /// host has any waiters
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_shim_futex_wake").unwrap().as_str())]
+    pub use_shim_futex_wake: Option<bool>,
+
     /// Pin each thread and any processes it executes to the same logical CPU Core to improve cache affinity
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bool")]
     #[clap(help = EXP_HELP.get("use_cpu_pinning").unwrap().as_str())]
     pub use_cpu_pinning: Option<bool>,
 
+    /// With `use_cpu_pinning`, pin each managed thread to an unused SMT sibling of its worker's CPU
+    /// (another hardware thread of the same core), if there is one, rather than to the worker's CPU.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_smt_sibling_affinity").unwrap().as_str())]
+    pub use_smt_sibling_affinity: Option<bool>,
+
+    /// Move Shadow and the managed processes of each host into separate cgroup v2 cgroups below
+    /// the cgroup that Shadow was started in, and account for the CPU time of each host's managed
+    /// processes. Shadow must be the only process in that cgroup and must be able to manage it.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_cgroup_isolation").unwrap().as_str())]
+    pub use_cgroup_isolation: Option<bool>,
+
+    /// With `use_cgroup_isolation`, if set, run the managed processes only on these CPUs (for
+    /// example "8-15") and Shadow only on the others
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "cpus")]
+    #[clap(help = EXP_HELP.get("managed_cgroup_cpus").unwrap().as_str())]
+    pub managed_cgroup_cpus: Option<NullableOption<String>>,
+
+    /// With `use_cgroup_isolation`, if set, limit the managed processes of all hosts to this many
+    /// CPUs worth of CPU time
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "cpus")]
+    #[clap(help = EXP_HELP.get("managed_cgroup_cpu_limit").unwrap().as_str())]
+    pub managed_cgroup_cpu_limit: Option<NullableOption<f64>>,
+
+    /// How many times a thread polls its IPC channel before sleeping while waiting for a message
+    /// from the other side. Polling avoids futex syscalls and context switches on every syscall
+    /// round trip, but only helps if Shadow and the managed threads run on different CPUs, i.e.
+    /// when `use_cpu_pinning` is disabled and there are spare CPU cores. This is an upper bound;
+    /// each channel learns how long messages usually take to arrive and only polls for about that
+    /// long. Also bounds how many times a thread polls a host's shared-memory lock while another
+    /// thread holds it.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "N")]
+    #[clap(help = EXP_HELP.get("ipc_spin_limit").unwrap().as_str())]
+    pub ipc_spin_limit: Option<u32>,
+
     /// Each worker thread will spin in a `sched_yield` loop while waiting for a new task. This is
     /// ignored if not using the thread-per-core scheduler.
     #[clap(hide_short_help = true)]
@@ -405,18 +730,121 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("use_worker_spinning").unwrap().as_str())]
     pub use_worker_spinning: Option<bool>,
 
+    /// The number of worker threads to run on each CPU. With more than one, a worker thread that
+    /// is waiting for its managed thread lets another worker thread run a different host on the
+    /// same CPU. The number of worker threads is this times the parallelism.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "N")]
+    #[clap(help = EXP_HELP.get("worker_threads_per_cpu").unwrap().as_str())]
+    pub worker_threads_per_cpu: Option<u32>,
+
+    /// Measure how long each host takes to run, and periodically reassign hosts to worker threads
+    /// so that each thread has a similar amount of work, with the most expensive hosts run first.
+    /// This is ignored if not using the thread-per-core scheduler.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_host_cost_balancing").unwrap().as_str())]
+    pub use_host_cost_balancing: Option<bool>,
+
+    /// Choose the number of worker threads that run each scheduling round from the number of active
+    /// hosts and the recent cost per host, leaving the other threads parked.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_adaptive_worker_participation").unwrap().as_str())]
+    pub use_adaptive_worker_participation: Option<bool>,
+
+    /// Keep each host on worker threads within a single NUMA node. Threads prefer to take hosts
+    /// from threads on the same node, and hosts taken by a thread on a different node are returned
+    /// to their own node. Requires CPU pinning, and is ignored if not using the thread-per-core
+    /// scheduler.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_numa_host_groups").unwrap().as_str())]
+    pub use_numa_host_groups: Option<bool>,
+
+    /// Keep hosts on the worker thread they were assigned to. A thread that has run all of its own
+    /// hosts waits this long before running hosts of other threads, and returns those hosts to
+    /// their own thread afterwards. If null, idle threads take other threads' hosts immediately
+    /// and keep them.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("host_steal_delay").unwrap().as_str())]
+    pub host_steal_delay: Option<NullableOption<units::Time<units::TimePrefix>>>,
+
+    /// Store each host's pending events in a calendar queue with buckets sized to a fraction of the
+    /// scheduling round width instead of in a binary heap. This can be faster for hosts with many
+    /// pending events, and does not change the order that events are processed.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_calendar_event_queue").unwrap().as_str())]
+    pub use_calendar_event_queue: Option<bool>,
+
     /// If set, overrides the automatically calculated minimum time workers may run ahead when sending events between nodes
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "seconds")]
     #[clap(help = EXP_HELP.get("runahead").unwrap().as_str())]
     pub runahead: Option<NullableOption<units::Time<units::TimePrefix>>>,
 
+    /// If set, the minimum runahead until `general.bootstrap_end_time`, which lets the
+    /// bootstrapping period run in fewer and longer scheduling rounds. Packets sent while
+    /// bootstrapping may then arrive later than their path latency, and unblocked syscall latency
+    /// is applied in steps of up to this size.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = EXP_HELP.get("bootstrap_runahead").unwrap().as_str())]
+    pub bootstrap_runahead: Option<NullableOption<units::Time<units::TimePrefix>>>,
+
+    /// If set, store the paths computed between graph nodes in this directory, and reuse them in
+    /// later simulations with the same network graph and the same graph nodes
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "path")]
+    #[clap(help = EXP_HELP.get("routing_cache_directory").unwrap().as_str())]
+    pub routing_cache_directory: Option<NullableOption<String>>,
+
+    /// If set, serve live simulation metrics in the OpenMetrics text format over HTTP at this
+    /// address (an `ip:port` or the path of a Unix socket)
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "address")]
+    #[clap(help = EXP_HELP.get("metrics_address").unwrap().as_str())]
+    pub metrics_address: Option<NullableOption<String>>,
+
+    /// If set, compute shortest paths between graph nodes when they're first used rather than
+    /// before the simulation starts, and keep the paths from at most this many source nodes in
+    /// memory
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "N")]
+    #[clap(help = EXP_HELP.get("shortest_path_cache_size").unwrap().as_str())]
+    pub shortest_path_cache_size: Option<NullableOption<u32>>,
+
     /// Update the minimum runahead dynamically throughout the simulation.
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bool")]
     #[clap(help = EXP_HELP.get("use_dynamic_runahead").unwrap().as_str())]
     pub use_dynamic_runahead: Option<bool>,
 
+    /// Give each host its own round window based on the lowest path latency into its network node,
+    /// rather than running all hosts in lockstep using a single runahead. Hosts that are far from
+    /// low-latency edges may then run further ahead within each round.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_per_host_lookahead").unwrap().as_str())]
+    pub use_per_host_lookahead: Option<bool>,
+
+    /// If set, the amount of memory that autotuning may grow the TCP socket buffers of each host
+    /// by. Like with the Linux `tcp_mem` limits, the host enters memory pressure at two thirds of
+    /// this and stops growing buffers until it's below half of this again.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bytes")]
+    #[clap(help = EXP_HELP.get("socket_buffer_host_budget").unwrap().as_str())]
+    pub socket_buffer_host_budget: Option<NullableOption<units::Bytes<units::SiPrefixUpper>>>,
+
+    /// If set, the amount of memory that autotuning may grow the TCP socket buffers of all hosts
+    /// by, which is divided evenly between the hosts
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bytes")]
+    #[clap(help = EXP_HELP.get("socket_buffer_total_budget").unwrap().as_str())]
+    pub socket_buffer_total_budget: Option<NullableOption<units::Bytes<units::SiPrefixUpper>>>,
+
     /// Initial size of the socket's send buffer
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "bytes")]
@@ -447,6 +875,12 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("interface_qdisc").unwrap().as_str())]
     pub interface_qdisc: Option<QDiscMode>,
 
+    /// The queueing discipline to use at the upstream router of each host
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "mode")]
+    #[clap(help = EXP_HELP.get("router_qdisc").unwrap().as_str())]
+    pub router_qdisc: Option<RouterQDiscMode>,
+
     /// Log the syscalls for each process to individual "strace" files
     #[clap(hide_short_help = true)]
     #[clap(long, value_name = "mode")]
@@ -479,6 +913,15 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("unblocked_vdso_latency").unwrap().as_str())]
     pub unblocked_vdso_latency: Option<units::Time<units::TimePrefix>>,
 
+    /// Scale `max_unapplied_cpu_latency` per thread: a thread that keeps reaching it without
+    /// using the network or blocking may batch up to 16 times as much latency before its time is
+    /// moved forward, which reduces the overhead of busy loops. The scale is reset when the thread
+    /// sends, receives, or blocks.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_adaptive_cpu_latency").unwrap().as_str())]
+    pub use_adaptive_cpu_latency: Option<bool>,
+
     /// The host scheduler implementation, which decides how to assign hosts to threads and threads
     /// to CPU cores
     #[clap(hide_short_help = true)]
@@ -498,6 +941,18 @@ pub struct ExperimentalOptions {
     #[clap(help = EXP_HELP.get("use_new_tcp").unwrap().as_str())]
     pub use_new_tcp: Option<bool>,
 
+    /// Delay acknowledgements in the rust TCP implementation
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_new_tcp_delayed_ack").unwrap().as_str())]
+    pub use_new_tcp_delayed_ack: Option<bool>,
+
+    /// Flush the legacy TCP implementation once per operation rather than after each change
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("use_deferred_tcp_flush").unwrap().as_str())]
+    pub use_deferred_tcp_flush: Option<bool>,
+
     /// When true, and when managed code runs for an extended time without
     /// returning control to shadow (e.g. by making a syscall), shadow preempts
     /// the managed code and moves simulated time forward. This can be used to
@@ -525,6 +980,15 @@ pub struct ExperimentalOptions {
     #[clap(long, value_name = "seconds")]
     #[clap(help = EXP_HELP.get("native_preemption_sim_interval").unwrap().as_str())]
     pub native_preemption_sim_interval: Option<units::Time<units::TimePrefix>>,
+
+    /// When `native_preemption_enabled` is true, double both preemption intervals each time a
+    /// thread is preempted again without having returned control to shadow in between (up to 64
+    /// times), and reset them when it does. This reduces the number of preemptions of threads that
+    /// never make syscalls.
+    #[clap(hide_short_help = true)]
+    #[clap(long, value_name = "bool")]
+    #[clap(help = EXP_HELP.get("native_preemption_backoff").unwrap().as_str())]
+    pub native_preemption_backoff: Option<bool>,
 }
 
 impl ExperimentalOptions {
@@ -539,9 +1003,26 @@ impl Default for ExperimentalOptions {
     fn default() -> Self {
         Self {
             use_sched_fifo: Some(false),
+            use_shim_log_ring: Some(false),
             use_syscall_counters: Some(true),
+            use_profiling: Some(false),
+            use_sim_stats_stream: Some(false),
+            use_startup_probe_cache: Some(false),
+            use_template_hardlinks: Some(false),
+            use_event_trace: Some(false),
+            use_output_segments: Some(false),
+            use_packet_counters: Some(true),
+            use_packet_outbox: Some(false),
+            use_packet_trains: Some(false),
+            use_continuous_rate_limits: Some(false),
+            use_direct_loopback: Some(false),
+            use_timer_wheel: Some(false),
             use_object_counters: Some(true),
             use_preload_libc: Some(true),
+            use_libc_patching: Some(false),
+            use_rdtsc_patching: Some(false),
+            use_zygotes: Some(false),
+            use_process_prelaunch: Some(false),
             use_preload_openssl_rng: Some(true),
             use_preload_openssl_crypto: Some(false),
             max_unapplied_cpu_latency: Some(units::Time::new(1, units::TimePrefix::Micro)),
@@ -552,29 +1033,64 @@ impl Default for ExperimentalOptions {
             // Actual latencies vary from ~40 to ~400 CPU cycles. https://stackoverflow.com/a/13096917
             // Default to the lower end to minimize effect in simualations without busy loops.
             unblocked_vdso_latency: Some(units::Time::new(10, units::TimePrefix::Nano)),
+            use_adaptive_cpu_latency: Some(false),
             use_memory_manager: Some(false),
+            use_memory_manager_huge_pages: Some(false),
+            use_memory_manager_shared_file_pages: Some(false),
+            use_batched_memory_writes: Some(false),
+            use_native_file_io: Some(false),
+            use_file_io_offload: Some(false),
+            file_cache_paths: Some(Vec::new()),
+            host_data_memory_path: Some(NullableOption::Null),
+            host_data_memory_budget: Some(NullableOption::Null),
+            host_data_spill_patterns: Some(vec!["**".to_string()]),
+            idle_host_reclaim_delay: Some(NullableOption::Null),
+            use_shim_random: Some(false),
+            use_shim_futex_wake: Some(false),
             use_cpu_pinning: Some(true),
+            use_smt_sibling_affinity: Some(false),
+            use_cgroup_isolation: Some(false),
+            managed_cgroup_cpus: Some(NullableOption::Null),
+            managed_cgroup_cpu_limit: Some(NullableOption::Null),
+            ipc_spin_limit: Some(0),
             use_worker_spinning: Some(true),
+            worker_threads_per_cpu: Some(1),
+            use_host_cost_balancing: Some(false),
+            use_adaptive_worker_participation: Some(false),
+            use_numa_host_groups: Some(false),
+            host_steal_delay: Some(NullableOption::Null),
+            use_calendar_event_queue: Some(false),
             runahead: Some(NullableOption::Value(units::Time::new(
                 1,
                 units::TimePrefix::Milli,
             ))),
+            bootstrap_runahead: Some(NullableOption::Null),
+            routing_cache_directory: Some(NullableOption::Null),
+            metrics_address: Some(NullableOption::Null),
+            shortest_path_cache_size: Some(NullableOption::Null),
             use_dynamic_runahead: Some(false),
+            use_per_host_lookahead: Some(false),
+            socket_buffer_host_budget: Some(NullableOption::Null),
+            socket_buffer_total_budget: Some(NullableOption::Null),
             socket_send_buffer: Some(units::Bytes::new(131_072, units::SiPrefixUpper::Base)),
             socket_send_autotune: Some(true),
             socket_recv_buffer: Some(units::Bytes::new(174_760, units::SiPrefixUpper::Base)),
             socket_recv_autotune: Some(true),
             interface_qdisc: Some(QDiscMode::Fifo),
+            router_qdisc: Some(RouterQDiscMode::Codel),
             strace_logging_mode: Some(StraceLoggingMode::Off),
             scheduler: Some(Scheduler::ThreadPerCore),
             report_errors_to_stderr: Some(true),
             use_new_tcp: Some(false),
+            use_new_tcp_delayed_ack: Some(false),
+            use_deferred_tcp_flush: Some(false),
             native_preemption_enabled: Some(false),
             native_preemption_native_interval: Some(units::Time::new(
                 100,
                 units::TimePrefix::Milli,
             )),
             native_preemption_sim_interval: Some(units::Time::new(10, units::TimePrefix::Milli)),
+            native_preemption_backoff: Some(false),
         }
     }
 }
@@ -607,6 +1123,18 @@ pub struct HostDefaultOptions {
     #[clap(long, value_name = "bytes")]
     #[clap(help = HOST_HELP.get("pcap_capture_size").unwrap().as_str())]
     pub pcap_capture_size: Option<units::Bytes<units::SiPrefixUpper>>,
+
+    /// Only keep this many of the most recent packets per interface in memory, and write them to
+    /// a pcap file when triggered, if pcap logging is enabled
+    #[clap(long, value_name = "packets")]
+    #[clap(help = HOST_HELP.get("pcap_ring_packets").unwrap().as_str())]
+    pub pcap_ring_packets: Option<NullableOption<u32>>,
+
+    /// Only keep packets from this much of the most recent simulated time per interface in memory,
+    /// and write them to a pcap file when triggered, if pcap logging is enabled
+    #[clap(long, value_name = "seconds")]
+    #[clap(help = HOST_HELP.get("pcap_ring_duration").unwrap().as_str())]
+    pub pcap_ring_duration: Option<NullableOption<units::Time<units::TimePrefix>>>,
 }
 
 impl HostDefaultOptions {
@@ -618,6 +1146,8 @@ impl HostDefaultOptions {
             // capture all the data available from the packet". The maximum length of an IP packet
             // (including the header) is 65535 bytes.
             pcap_capture_size: Some(units::Bytes::new(65535, units::SiPrefixUpper::Base)),
+            pcap_ring_packets: None,
+            pcap_ring_duration: None,
         }
     }
 
@@ -640,6 +1170,8 @@ impl Default for HostDefaultOptions {
             log_level: None,
             pcap_enabled: None,
             pcap_capture_size: None,
+            pcap_ring_packets: None,
+            pcap_ring_duration: None,
         }
     }
 }
@@ -711,6 +1243,10 @@ pub struct ProcessOptions {
     /// if the actual state doesn't match.
     #[serde(default)]
     pub expected_final_state: ProcessFinalState,
+
+    /// Syscalls that the process may make natively, without being intercepted by Shadow
+    #[serde(default)]
+    pub native_syscalls: Vec<String>,
 }
 
 #[derive(Debug, Clone, Serialize, Deserialize, JsonSchema)]
@@ -735,6 +1271,11 @@ pub struct HostOptions {
 
     #[serde(default)]
     pub host_options: HostDefaultOptions,
+
+    /// If set, configure this many identical hosts named `<hostname>1` to `<hostname><count>`
+    /// instead of a single host
+    #[serde(default)]
+    pub count: Option<u32>,
 }
 
 #[derive(Debug, Copy, Clone, Serialize, Deserialize, JsonSchema)]
@@ -938,6 +1479,8 @@ impl std::fmt::Display for EnvName {
 pub enum Scheduler {
     ThreadPerHost,
     ThreadPerCore,
+    /// The thread-per-core scheduler, with busy hosts given dedicated threads.
+    Hybrid,
 }
 
 impl FromStr for Scheduler {
@@ -981,6 +1524,23 @@ impl FromStr for QDiscMode {
     }
 }
 
+#[derive(Debug, Clone, Copy, Hash, PartialEq, Eq, Serialize, Deserialize, JsonSchema)]
+#[serde(rename_all = "kebab-case")]
+pub enum RouterQDiscMode {
+    /// A single CoDel queue for all flows.
+    Codel,
+    /// Hashed per-flow CoDel queues, scheduled with deficit round robin.
+    FqCodel,
+}
+
+impl FromStr for RouterQDiscMode {
+    type Err = serde_yaml::Error;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        serde_yaml::from_str(s)
+    }
+}
+
 #[derive(Debug, Clone, Serialize, Deserialize, JsonSchema)]
 #[serde(rename_all = "kebab-case")]
 pub enum Compression {
@@ -1009,10 +1569,42 @@ pub enum GraphSource {
 #[serde(tag = "type", rename_all = "snake_case")]
 pub enum GraphOptions {
     Gml(GraphSource),
+    /// A binary matrix of the paths between every pair of nodes, which must be an uncompressed
+    /// file.
+    Matrix(GraphSource),
+    /// The coordinates of each node, from which the path between two nodes is computed.
+    Coordinates(GraphSource),
     #[serde(rename = "1_gbit_switch")]
     OneGbitSwitch,
 }
 
+/// A change to a network graph edge, which applies from simulation time `time` on. Unset
+/// properties keep their current value.
+#[derive(Debug, Clone, Serialize, Deserialize, JsonSchema)]
+#[serde(deny_unknown_fields)]
+pub struct GraphUpdate {
+    /// The simulated time at which the edge changes
+    pub time: units::Time<units::TimePrefix>,
+
+    /// Network graph node ID of the edge's source
+    pub source: u32,
+
+    /// Network graph node ID of the edge's target
+    pub target: u32,
+
+    /// The edge's new latency
+    #[serde(default)]
+    pub latency: Option<units::Time<units::TimePrefix>>,
+
+    /// The edge's new packet loss, between 0 and 1
+    #[serde(default)]
+    pub packet_loss: Option<f32>,
+
+    /// Whether the edge is up; packets aren't routed over an edge while it's down
+    #[serde(default)]
+    pub up: Option<bool>,
+}
+
 #[derive(Debug, Clone, Serialize, JsonSchema)]
 #[serde(untagged)]
 pub enum ProcessArgs {
@@ -1174,6 +1766,7 @@ pub enum StraceLoggingMode {
     Off,
     Standard,
     Deterministic,
+    Binary,
 }
 
 impl FromStr for StraceLoggingMode {
@@ -1357,6 +1950,11 @@ fn default_some_nullable_time_1() -> Option<NullableOption<units::Time<units::Ti
     Some(NullableOption::Value(time))
 }
 
+/// Helper function for serde default `Some(Vec::new())` values.
+fn default_some_vec<T>() -> Option<Vec<T>> {
+    Some(Vec::new())
+}
+
 /// Helper function for serde default `Some(LogLevel::Info)` values.
 fn default_some_info() -> Option<LogLevel> {
     Some(LogLevel::Info)
@@ -9,6 +9,7 @@ use shadow_shim_helper_rs::emulated_time::EmulatedTime;
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
 use shadow_shim_helper_rs::util::time::TimeParts;
 
+use crate::core::cgroup::CgroupIsolation;
 use crate::core::configuration::ConfigOptions;
 use crate::core::manager::{Manager, ManagerConfig};
 use crate::core::sim_config::SimConfig;
@@ -20,12 +21,19 @@ pub struct Controller<'a> {
     config: &'a ConfigOptions,
     sim_config: Option<SimConfig>,
 
+    // the cgroups for the managed processes, if cgroup isolation is enabled
+    cgroups: Option<&'a CgroupIsolation>,
+
     // the simulator should attempt to end immediately after this time
     end_time: EmulatedTime,
 }
 
 impl<'a> Controller<'a> {
-    pub fn new(sim_config: SimConfig, config: &'a ConfigOptions) -> Self {
+    pub fn new(
+        sim_config: SimConfig,
+        config: &'a ConfigOptions,
+        cgroups: Option<&'a CgroupIsolation>,
+    ) -> Self {
         let end_time: Duration = config.general.stop_time.unwrap().into();
         let end_time: SimulationTime = end_time.try_into().unwrap();
         let end_time = EmulatedTime::SIMULATION_START + end_time;
@@ -33,6 +41,7 @@ impl<'a> Controller<'a> {
         Self {
             config,
             sim_config: Some(sim_config),
+            cgroups,
             end_time,
         }
     }
@@ -82,6 +91,9 @@ pub trait SimController {
         &self,
         min_next_event_time: EmulatedTime,
     ) -> Option<(EmulatedTime, EmulatedTime)>;
+
+    /// The cgroups for the managed processes, if cgroup isolation is enabled.
+    fn cgroups(&self) -> Option<&CgroupIsolation>;
 }
 
 impl SimController for Controller<'_> {
@@ -92,24 +104,29 @@ impl SimController for Controller<'_> {
         // TODO: once we get multiple managers, we have to block them here until they have all
         // notified us that they are finished
 
-        let runahead = worker::WORKER_SHARED
+        let new_start = min_next_event_time;
+
+        let round_length = worker::WORKER_SHARED
             .borrow()
             .as_ref()
             .unwrap()
-            .runahead
-            .get();
-        assert_ne!(runahead, SimulationTime::ZERO);
-
-        let new_start = min_next_event_time;
+            .get_round_length(new_start);
+        assert_ne!(round_length, SimulationTime::ZERO);
 
         // update the new window end as one interval past the new window start, making sure we don't
         // run over the experiment end time
-        let new_end = new_start.checked_add(runahead).unwrap_or(EmulatedTime::MAX);
+        let new_end = new_start
+            .checked_add(round_length)
+            .unwrap_or(EmulatedTime::MAX);
         let new_end = std::cmp::min(new_end, self.end_time);
 
         let continue_running = new_start < new_end;
         continue_running.then_some((new_start, new_end))
     }
+
+    fn cgroups(&self) -> Option<&CgroupIsolation> {
+        self.cgroups
+    }
 }
 
 #[derive(Debug)]
@@ -0,0 +1,326 @@
+//! A binary trace of the events that the hosts run, recorded when the experimental
+//! `use_event_trace` option is enabled and written to `event-trace.bin` in the data directory. The
+//! `shadow-event-trace` tool in shadowtools converts a trace to the Chrome trace event format.
+//!
+//! Each worker appends its records to its own [`EventTraceBuffer`], and the buffers are moved to
+//! the shared [`EventTrace`] (which writes them from a [`BackgroundWriter`]) once they're full, so
+//! that workers rarely contend on the writer. Records from different workers are therefore not in
+//! time order.
+//!
+//! All integers are little-endian. A file starts with a header:
+//!
+//! | bytes | field                 |
+//! |-------|-----------------------|
+//! | 8     | magic (`b"SHDWEVTR"`) |
+//! | 4     | format version (1)    |
+//! | 4     | reserved              |
+//!
+//! followed by records. An event record is [`EVENT_RECORD_LEN`] bytes:
+//!
+//! | bytes | field                                                                  |
+//! |-------|------------------------------------------------------------------------|
+//! | 1     | record type ([`RECORD_EVENT`])                                         |
+//! | 1     | event kind (`KIND_*`)                                                  |
+//! | 2     | reserved                                                               |
+//! | 4     | worker id                                                              |
+//! | 4     | host id                                                                |
+//! | 4     | task name id for [`KIND_LOCAL`] events, or 0                           |
+//! | 8     | simulation time in nanoseconds                                         |
+//! | 8     | wall time that the event started, in nanoseconds since the trace began |
+//! | 8     | wall time that the event took, in nanoseconds                          |
+//! | 4     | number of packets for [`KIND_PACKET`] events, or 0                     |
+//! | 4     | number of syscalls that the host handled during the event              |
+//!
+//! Hosts and task types are referred to by id, and a name record is written before the first
+//! event record that refers to each id:
+//!
+//! | bytes | field                                                      |
+//! |-------|------------------------------------------------------------|
+//! | 1     | record type ([`RECORD_HOST_NAME`] or [`RECORD_TASK_NAME`]) |
+//! | 1     | reserved                                                   |
+//! | 2     | length of the name                                         |
+//! | 4     | the host id or task name id                                |
+//! | n     | the name, padded to a multiple of 8                        |
+
+use std::collections::HashMap;
+use std::io::Write;
+use std::sync::Mutex;
+use std::time::{Duration, Instant};
+
+use anyhow::Context;
+use shadow_shim_helper_rs::HostId;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+
+use crate::utility::background_writer::BackgroundWriter;
+
+pub const MAGIC: &[u8; 8] = b"SHDWEVTR";
+pub const VERSION: u32 = 1;
+
+pub const RECORD_EVENT: u8 = 1;
+pub const RECORD_HOST_NAME: u8 = 2;
+pub const RECORD_TASK_NAME: u8 = 3;
+
+pub const KIND_PACKET: u8 = 0;
+pub const KIND_LOCAL: u8 = 1;
+
+pub const EVENT_RECORD_LEN: usize = 48;
+
+/// A worker's buffer is moved to the shared writer once it has at least this many bytes.
+const BUFFER_FLUSH_LEN: usize = 64 * 1024;
+
+/// What an event did.
+#[derive(Debug, Clone, Copy)]
+pub enum TracedEventKind {
+    /// Delivered a number of packets.
+    Packet(u32),
+    /// Ran a task, identified by its type name.
+    Local(&'static str),
+}
+
+/// The record of an event that a host ran.
+#[derive(Debug, Clone, Copy)]
+pub struct TracedEvent {
+    pub host_id: HostId,
+    pub kind: TracedEventKind,
+    pub sim_time: EmulatedTime,
+    pub wall_start: Instant,
+    pub wall_duration: Duration,
+    pub syscalls: u32,
+}
+
+/// The trace file shared by all workers.
+pub struct EventTrace {
+    /// The wall time that the trace's wall times are relative to.
+    start: Instant,
+    inner: Mutex<EventTraceInner>,
+}
+
+struct EventTraceInner {
+    writer: BackgroundWriter,
+    /// Ids assigned to task names, shared by all workers.
+    task_ids: HashMap<&'static str, u32>,
+}
+
+impl EventTrace {
+    /// Create the trace file, and write the names of the given hosts.
+    pub fn new<'a>(
+        filename: &std::path::Path,
+        hosts: impl IntoIterator<Item = (HostId, &'a str)>,
+    ) -> anyhow::Result<Self> {
+        let file = std::fs::File::create(filename)
+            .with_context(|| format!("Failed to create file '{}'", filename.display()))?;
+
+        let mut writer = BackgroundWriter::new(file);
+        writer.write_all(MAGIC)?;
+        writer.write_all(&VERSION.to_le_bytes())?;
+        writer.write_all(&0u32.to_le_bytes())?;
+
+        for (id, name) in hosts {
+            write_name(&mut writer, RECORD_HOST_NAME, u32::from(id), name)?;
+        }
+
+        Ok(Self {
+            start: Instant::now(),
+            inner: Mutex::new(EventTraceInner {
+                writer,
+                task_ids: HashMap::new(),
+            }),
+        })
+    }
+
+    /// Returns the id for `name`, writing a name record if the name doesn't have an id yet.
+    fn task_id(&self, name: &'static str) -> std::io::Result<u32> {
+        let mut inner = self.inner.lock().unwrap();
+        if let Some(id) = inner.task_ids.get(name) {
+            return Ok(*id);
+        }
+
+        // 0 means that there's no task
+        let id = u32::try_from(inner.task_ids.len() + 1).unwrap();
+        write_name(&mut inner.writer, RECORD_TASK_NAME, id, name)?;
+        inner.task_ids.insert(name, id);
+        Ok(id)
+    }
+
+    fn write(&self, bytes: &[u8]) -> std::io::Result<()> {
+        self.inner.lock().unwrap().writer.write_all(bytes)
+    }
+}
+
+fn write_name(
+    writer: &mut impl Write,
+    record_type: u8,
+    id: u32,
+    name: &str,
+) -> std::io::Result<()> {
+    let mut record = [0u8; 8];
+    record[0] = record_type;
+    record[2..4].copy_from_slice(&u16::try_from(name.len()).unwrap().to_le_bytes());
+    record[4..8].copy_from_slice(&id.to_le_bytes());
+
+    writer.write_all(&record)?;
+    writer.write_all(name.as_bytes())?;
+    writer.write_all(&[0u8; 8][..name.len().next_multiple_of(8) - name.len()])
+}
+
+/// A worker's buffer of event records that haven't been moved to the [`EventTrace`] yet.
+#[derive(Debug)]
+pub struct EventTraceBuffer {
+    worker_id: u32,
+    buf: Vec<u8>,
+    /// A cache of the task name ids in [`EventTrace`], to avoid locking it for each event.
+    task_ids: HashMap<&'static str, u32>,
+}
+
+impl EventTraceBuffer {
+    pub fn new(worker_id: u32) -> Self {
+        Self {
+            worker_id,
+            buf: Vec::with_capacity(BUFFER_FLUSH_LEN + EVENT_RECORD_LEN),
+            task_ids: HashMap::new(),
+        }
+    }
+
+    /// Add a record of `event`. The buffer is moved to `trace` if it's full.
+    pub fn add(&mut self, trace: &EventTrace, event: &TracedEvent) -> std::io::Result<()> {
+        let (kind, task_id, packets) = match event.kind {
+            TracedEventKind::Packet(packets) => (KIND_PACKET, 0, packets),
+            TracedEventKind::Local(name) => {
+                let id = match self.task_ids.get(name) {
+                    Some(id) => *id,
+                    None => {
+                        let id = trace.task_id(name)?;
+                        self.task_ids.insert(name, id);
+                        id
+                    }
+                };
+                (KIND_LOCAL, id, 0)
+            }
+        };
+
+        let sim_time = event
+            .sim_time
+            .duration_since(&EmulatedTime::SIMULATION_START);
+        let wall_start = event.wall_start.saturating_duration_since(trace.start);
+
+        let mut record = [0u8; EVENT_RECORD_LEN];
+        record[0] = RECORD_EVENT;
+        record[1] = kind;
+        record[4..8].copy_from_slice(&self.worker_id.to_le_bytes());
+        record[8..12].copy_from_slice(&u32::from(event.host_id).to_le_bytes());
+        record[12..16].copy_from_slice(&task_id.to_le_bytes());
+        record[16..24].copy_from_slice(&duration_to_ns(sim_time.into()).to_le_bytes());
+        record[24..32].copy_from_slice(&duration_to_ns(wall_start).to_le_bytes());
+        record[32..40].copy_from_slice(&duration_to_ns(event.wall_duration).to_le_bytes());
+        record[40..44].copy_from_slice(&packets.to_le_bytes());
+        record[44..48].copy_from_slice(&event.syscalls.to_le_bytes());
+        self.buf.extend_from_slice(&record);
+
+        if self.buf.len() >= BUFFER_FLUSH_LEN {
+            self.flush(trace)?;
+        }
+
+        Ok(())
+    }
+
+    /// Move all buffered records to `trace`.
+    pub fn flush(&mut self, trace: &EventTrace) -> std::io::Result<()> {
+        if self.buf.is_empty() {
+            return Ok(());
+        }
+        let rv = trace.write(&self.buf);
+        self.buf.clear();
+        rv
+    }
+}
+
+fn duration_to_ns(d: Duration) -> u64 {
+    d.as_nanos().try_into().unwrap_or(u64::MAX)
+}
+
+#[cfg(test)]
+mod tests {
+    use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+    use super::*;
+
+    fn u32_at(bytes: &[u8], offset: usize) -> u32 {
+        u32::from_le_bytes(bytes[offset..offset + 4].try_into().unwrap())
+    }
+
+    fn u64_at(bytes: &[u8], offset: usize) -> u64 {
+        u64::from_le_bytes(bytes[offset..offset + 8].try_into().unwrap())
+    }
+
+    #[test]
+    fn test_trace() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("event-trace.bin");
+        let trace = EventTrace::new(&path, [(HostId::from(7), "server")]).unwrap();
+
+        let event = TracedEvent {
+            host_id: HostId::from(7),
+            kind: TracedEventKind::Local("my::task"),
+            sim_time: EmulatedTime::SIMULATION_START + SimulationTime::from_millis(5),
+            wall_start: trace.start + Duration::from_micros(3),
+            wall_duration: Duration::from_nanos(1500),
+            syscalls: 2,
+        };
+
+        let mut buffer = EventTraceBuffer::new(1);
+        buffer.add(&trace, &event).unwrap();
+        buffer.add(&trace, &event).unwrap();
+        buffer
+            .add(
+                &trace,
+                &TracedEvent {
+                    kind: TracedEventKind::Packet(3),
+                    syscalls: 0,
+                    ..event
+                },
+            )
+            .unwrap();
+
+        // nothing has been moved to the trace yet
+        assert!(buffer.buf.len() == 3 * EVENT_RECORD_LEN);
+        buffer.flush(&trace).unwrap();
+        drop(trace);
+
+        let bytes = std::fs::read(&path).unwrap();
+        assert_eq!(&bytes[..8], MAGIC);
+        assert_eq!(u32_at(&bytes, 8), VERSION);
+
+        // host name record, "server" padded to 8 bytes
+        let host = &bytes[16..32];
+        assert_eq!(host[0], RECORD_HOST_NAME);
+        assert_eq!(u32_at(host, 4), 7);
+        assert_eq!(&host[8..14], b"server");
+
+        // the task name record was written when the task was first seen
+        let task = &bytes[32..48];
+        assert_eq!(task[0], RECORD_TASK_NAME);
+        assert_eq!(u32_at(task, 4), 1);
+        assert_eq!(&task[8..16], b"my::task");
+
+        let records: Vec<_> = bytes[48..].chunks(EVENT_RECORD_LEN).collect();
+        assert_eq!(records.len(), 3);
+
+        let local = records[0];
+        assert_eq!(local[0], RECORD_EVENT);
+        assert_eq!(local[1], KIND_LOCAL);
+        assert_eq!(u32_at(local, 4), 1);
+        assert_eq!(u32_at(local, 8), 7);
+        assert_eq!(u32_at(local, 12), 1);
+        assert_eq!(u64_at(local, 16), 5_000_000);
+        assert_eq!(u64_at(local, 24), 3_000);
+        assert_eq!(u64_at(local, 32), 1_500);
+        assert_eq!(u32_at(local, 44), 2);
+        assert_eq!(records[1], local);
+
+        let packet = records[2];
+        assert_eq!(packet[1], KIND_PACKET);
+        assert_eq!(u32_at(packet, 12), 0);
+        assert_eq!(u32_at(packet, 40), 3);
+        assert_eq!(u32_at(packet, 44), 0);
+    }
+}
@@ -1,10 +1,12 @@
 use std::cell::RefCell;
-use std::sync::Arc;
+use std::cmp::Reverse;
+use std::collections::BinaryHeap;
+use std::sync::atomic::{AtomicBool, Ordering};
 use std::sync::mpsc::{Receiver, Sender};
-use std::sync::{Mutex, RwLock};
+use std::sync::{Arc, Mutex, PoisonError};
 use std::time::Duration;
 
-use crossbeam::queue::ArrayQueue;
+use crossbeam::queue::SegQueue;
 use log::{Level, LevelFilter, Log, Metadata, Record, SetLoggerError};
 use logger as c_log;
 use once_cell::sync::{Lazy, OnceCell};
@@ -14,15 +16,18 @@ use shadow_shim_helper_rs::util::time::TimeParts;
 use crate::core::worker::Worker;
 use crate::host::host::HostInfo;
 
-/// Trigger an asynchronous flush when this many lines are queued.
-const ASYNC_FLUSH_QD_LINES_THRESHOLD: usize = 100_000;
+/// Trigger an asynchronous flush when this many lines are queued by a thread.
+const ASYNC_FLUSH_QD_LINES_THRESHOLD: usize = 4_000;
 
-/// Performs a *synchronous* flush when this many lines are queued.  i.e. if
-/// after reaching the `ASYNC_FLUSH_QD_LINES_THRESHOLD`, log lines are still
-/// coming in faster than they can actually be flushed, when we reach this limit
-/// we'll pause and let it finish flushing rather than letting the queue
+/// Performs a *synchronous* flush when this many lines are queued by a thread.
+/// i.e. if after reaching the `ASYNC_FLUSH_QD_LINES_THRESHOLD`, log lines are
+/// still coming in faster than they can actually be flushed, when we reach this
+/// limit we'll pause and let it finish flushing rather than letting the queue
 /// continue growing.
-const SYNC_FLUSH_QD_LINES_THRESHOLD: usize = 10 * ASYNC_FLUSH_QD_LINES_THRESHOLD;
+///
+/// Queues grow in small segments as records are pushed, so threads that rarely
+/// log don't pay for this capacity up front.
+const SYNC_FLUSH_QD_LINES_THRESHOLD: usize = 4 * ASYNC_FLUSH_QD_LINES_THRESHOLD;
 
 /// Logging thread flushes at least this often.
 const MIN_FLUSH_FREQUENCY: Duration = Duration::from_secs(10);
@@ -82,20 +87,25 @@ pub struct ShadowLogger {
     // it locked for as long as it's running.
     command_receiver: Mutex<Receiver<LoggerCommand>>,
 
-    // A lock-free queue for individual log records. We don't put the records
-    // themselves in the `command_sender`, because `Sender` doesn't support
-    // getting the queue length. Conversely we don't put commands in this queue
-    // because it doesn't support blocking operations.
+    // The record queues of the threads that have logged. Each thread pushes
+    // its records onto its own lock-free queue (cached in the thread-local
+    // RECORDS), so that logging threads don't contend with each other, and
+    // the queues are merged when flushing. We don't put the records themselves
+    // in the `command_sender`, because `Sender` doesn't support getting the
+    // queue length. Conversely we don't put commands in these queues because
+    // they don't support blocking operations.
     //
-    // The size is roughly SYNC_FLUSH_QD_LINES_THRESHOLD *
-    // size_of<ShadowLogRecord>; we might want to consider SegQueue (which grows
-    // and shrinks dynamically) instead if we ever make SYNC_FLUSH_QD_LINES_THRESHOLD very
-    // large.
-    records: ArrayQueue<ShadowLogRecord>,
+    // The Mutex is only locked once per thread to register its queue, and by
+    // flushes to collect the records.
+    thread_records: Mutex<Vec<Arc<SegQueue<ShadowLogRecord>>>>,
+
+    // Records from threads whose thread-local queue has already been
+    // destroyed.
+    shared_records: SegQueue<ShadowLogRecord>,
 
     // When false, sends a (still-asynchronous) flush command to the logger
-    // thread every time a record is pushed into `records`.
-    buffering_enabled: RwLock<bool>,
+    // thread every time a record is queued.
+    buffering_enabled: AtomicBool,
 
     // The maximum log level, unless overridden by a host-specific log level.
     max_log_level: OnceCell<LevelFilter>,
@@ -105,7 +115,8 @@ pub struct ShadowLogger {
 }
 
 thread_local!(static SENDER: RefCell<Option<Sender<LoggerCommand>>> = const{ RefCell::new(None)});
-thread_local!(static THREAD_NAME: String = get_thread_name());
+thread_local!(static RECORDS: RefCell<Option<Arc<SegQueue<ShadowLogRecord>>>> = const{ RefCell::new(None)});
+thread_local!(static THREAD_NAME: Arc<str> = get_thread_name().into());
 thread_local!(static THREAD_ID: nix::unistd::Pid = nix::unistd::gettid());
 
 fn get_thread_name() -> String {
@@ -146,10 +157,11 @@ impl ShadowLogger {
         let (sender, receiver) = std::sync::mpsc::channel();
 
         ShadowLogger {
-            records: ArrayQueue::new(SYNC_FLUSH_QD_LINES_THRESHOLD),
+            thread_records: Mutex::new(Vec::new()),
+            shared_records: SegQueue::new(),
             command_sender: Mutex::new(sender),
             command_receiver: Mutex::new(receiver),
-            buffering_enabled: RwLock::new(false),
+            buffering_enabled: AtomicBool::new(false),
             max_log_level: OnceCell::new(),
             report_errors_to_stderr: OnceCell::new(),
         }
@@ -173,35 +185,72 @@ impl ShadowLogger {
         }
     }
 
-    // Function called by the logger's helper thread to flush the contents of
-    // self.records. If `done_sender` is provided, it's notified after the flush
-    // has completed.
-    fn flush_records(&self, done_sender: Option<Sender<()>>) -> std::io::Result<()> {
-        use std::io::Write;
-
-        // Only flush records that are already in the queue, not ones that
+    // Take the records that are currently queued, in the order that they should
+    // be written. Each thread's records are kept in the order they were
+    // logged, and the threads' records are merged by simulation time (and then
+    // by wall time). Records that have no simulation time (e.g. from the
+    // manager thread) are ordered before those that do.
+    fn take_records(&self) -> Vec<ShadowLogRecord> {
+        // Only flush records that are already in the queues, not ones that
         // arrive while we're flushing. Otherwise callers who perform a
         // synchronous flush (whether this flush operation or another one that
         // arrives while we're flushing) will be left waiting longer than
-        // necessary. Also keeps us from holding the stdout lock indefinitely.
-        let mut toflush = self.records.len();
+        // necessary.
+        //
+        // This may be called from a panicking thread, so ignore poisoning.
+        let mut taken: Vec<std::vec::IntoIter<ShadowLogRecord>> = {
+            let mut thread_records = self
+                .thread_records
+                .lock()
+                .unwrap_or_else(PoisonError::into_inner);
+            let taken = thread_records
+                .iter()
+                .map(|queue| drain_queue(queue))
+                .chain(std::iter::once(drain_queue(&self.shared_records)))
+                .filter(|records| !records.is_empty())
+                .map(Vec::into_iter)
+                .collect();
+
+            // Forget the queues of threads that have exited.
+            thread_records.retain(|queue| Arc::strong_count(queue) > 1 || !queue.is_empty());
+
+            taken
+        };
+
+        let mut merged = Vec::with_capacity(taken.iter().map(|records| records.len()).sum());
+        if taken.len() == 1 {
+            merged.extend(taken.pop().unwrap());
+            return merged;
+        }
+
+        // Each heap entry is the next record of a thread.
+        let mut heads: BinaryHeap<_> = taken
+            .iter_mut()
+            .enumerate()
+            .filter_map(|(i, records)| Some(Reverse(MergeEntry(records.next()?, i))))
+            .collect();
+        while let Some(Reverse(MergeEntry(record, i))) = heads.pop() {
+            if let Some(next) = taken[i].next() {
+                heads.push(Reverse(MergeEntry(next, i)));
+            }
+            merged.push(record);
+        }
+        merged
+    }
+
+    // Function called by the logger's helper thread to flush the queued
+    // records. If `done_sender` is provided, it's notified after the flush has
+    // completed.
+    fn flush_records(&self, done_sender: Option<Sender<()>>) -> std::io::Result<()> {
+        use std::io::Write;
+
+        let records = self.take_records();
 
         let stdout_unlocked = std::io::stdout();
         let stdout_locked = stdout_unlocked.lock();
         let mut stdout = std::io::BufWriter::new(stdout_locked);
 
-        while toflush > 0 {
-            let record = match self.records.pop() {
-                Some(r) => r,
-                None => {
-                    // This can happen if another thread panics while the
-                    // logging thread is flushing. In that case both threads
-                    // will be consuming from the queue.
-                    break;
-                }
-            };
-            toflush -= 1;
-
+        for record in records {
             write!(stdout, "{record}")?;
 
             if record.level <= Level::Error && *self.report_errors_to_stderr.get().unwrap() {
@@ -244,12 +293,34 @@ impl ShadowLogger {
         Ok(())
     }
 
+    // Push a record onto the current thread's queue, first flushing
+    // synchronously if the queue is full. Returns the number of records in the
+    // queue.
+    fn push_record(&self, record: ShadowLogRecord) -> usize {
+        let queue = RECORDS
+            .try_with(|queue| {
+                Arc::clone(queue.borrow_mut().get_or_insert_with(|| {
+                    let queue = Arc::new(SegQueue::new());
+                    self.thread_records.lock().unwrap().push(Arc::clone(&queue));
+                    queue
+                }))
+            })
+            .ok();
+        let queue = queue.as_deref().unwrap_or(&self.shared_records);
+
+        if queue.len() >= SYNC_FLUSH_QD_LINES_THRESHOLD {
+            self.flush_sync();
+        }
+        queue.push(record);
+        queue.len()
+    }
+
     /// When disabled, the logger thread is notified to write each record as
     /// soon as it's created.  The calling thread still isn't blocked on the
     /// record actually being written, though.
     pub fn set_buffering_enabled(&self, buffering_enabled: bool) {
-        let mut writer = self.buffering_enabled.write().unwrap();
-        *writer = buffering_enabled;
+        self.buffering_enabled
+            .store(buffering_enabled, Ordering::Relaxed);
     }
 
     /// If the maximum log level has not yet been set, returns `LevelFilter::Trace`.
@@ -335,7 +406,7 @@ impl Log for ShadowLogger {
 
         let host_info = Worker::with_active_host(|host| host.info().clone());
 
-        let mut shadowrecord = ShadowLogRecord {
+        let shadowrecord = ShadowLogRecord {
             level: record.level(),
             file: record.file_static(),
             module_path: record.module_path_static(),
@@ -347,24 +418,15 @@ impl Log for ShadowLogger {
 
             emu_time: Worker::current_time(),
             thread_name: THREAD_NAME
-                .try_with(|name| (*name).clone())
-                .unwrap_or_else(|_| get_thread_name()),
+                .try_with(Arc::clone)
+                .unwrap_or_else(|_| get_thread_name().into()),
             thread_id: THREAD_ID
                 .try_with(|id| *id)
                 .unwrap_or_else(|_| nix::unistd::gettid()),
             host_info,
         };
 
-        loop {
-            match self.records.push(shadowrecord) {
-                Ok(()) => break,
-                Err(r) => {
-                    // Queue is full. Flush it and try again.
-                    shadowrecord = r;
-                    self.flush_sync();
-                }
-            }
-        }
+        let queued = self.push_record(shadowrecord);
 
         if record.level() == Level::Error {
             // Unlike in Shadow's C code, we don't abort the program on Error
@@ -373,8 +435,8 @@ impl Log for ShadowLogger {
             //
             // Flush *synchronously*, since we're likely about to crash one way or another.
             self.flush_sync();
-        } else if self.records.len() > ASYNC_FLUSH_QD_LINES_THRESHOLD
-            || !*self.buffering_enabled.read().unwrap()
+        } else if queued > ASYNC_FLUSH_QD_LINES_THRESHOLD
+            || !self.buffering_enabled.load(Ordering::Relaxed)
         {
             self.flush_async();
         }
@@ -394,11 +456,57 @@ struct ShadowLogRecord {
     wall_time: Duration,
 
     emu_time: Option<EmulatedTime>,
-    thread_name: String,
+    thread_name: Arc<str>,
     thread_id: nix::unistd::Pid,
     host_info: Option<Arc<HostInfo>>,
 }
 
+/// Pop the records that are currently in `queue`.
+fn drain_queue(queue: &SegQueue<ShadowLogRecord>) -> Vec<ShadowLogRecord> {
+    let len = queue.len();
+    let mut records = Vec::with_capacity(len);
+    // The queue may have fewer records than `len` if another thread is also
+    // flushing (for example if a thread panics while the logger thread is
+    // flushing).
+    while records.len() < len {
+        let Some(record) = queue.pop() else {
+            break;
+        };
+        records.push(record);
+    }
+    records
+}
+
+/// A record and the index of the queue it came from, ordered by the time that
+/// the record was logged.
+struct MergeEntry(ShadowLogRecord, usize);
+
+impl MergeEntry {
+    fn key(&self) -> (Option<EmulatedTime>, Duration, usize) {
+        (self.0.emu_time, self.0.wall_time, self.1)
+    }
+}
+
+impl PartialEq for MergeEntry {
+    fn eq(&self, other: &Self) -> bool {
+        self.key() == other.key()
+    }
+}
+
+impl Eq for MergeEntry {}
+
+impl PartialOrd for MergeEntry {
+    fn partial_cmp(&self, other: &Self) -> Option<std::cmp::Ordering> {
+        Some(self.cmp(other))
+    }
+}
+
+impl Ord for MergeEntry {
+    fn cmp(&self, other: &Self) -> std::cmp::Ordering {
+        self.key().cmp(&other.key())
+    }
+}
+
 impl std::fmt::Display for ShadowLogRecord {
     fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
         {
@@ -482,3 +590,56 @@ mod export {
         set_buffering_enabled(buffering_enabled != 0)
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+    use super::*;
+
+    fn record(message: &str, emu_time: Option<EmulatedTime>, wall_time: u64) -> ShadowLogRecord {
+        ShadowLogRecord {
+            level: Level::Info,
+            file: None,
+            module_path: None,
+            line: None,
+            message: message.to_string(),
+            wall_time: Duration::from_micros(wall_time),
+            emu_time,
+            thread_name: "test".into(),
+            thread_id: nix::unistd::gettid(),
+            host_info: None,
+        }
+    }
+
+    #[test]
+    fn test_take_records_merges_threads() {
+        let logger = ShadowLogger::new();
+        let t = |secs| Some(EmulatedTime::SIMULATION_START + SimulationTime::from_secs(secs));
+
+        std::thread::scope(|s| {
+            s.spawn(|| {
+                logger.push_record(record("a1", t(1), 1));
+                logger.push_record(record("a3", t(3), 2));
+                // out of order within the thread, but should stay after "a3"
+                logger.push_record(record("a2", t(2), 3));
+            });
+            s.spawn(|| {
+                logger.push_record(record("b0", None, 10));
+                logger.push_record(record("b2", t(2), 11));
+                logger.push_record(record("b4", t(4), 12));
+            });
+        });
+
+        let messages: Vec<_> = logger
+            .take_records()
+            .into_iter()
+            .map(|r| r.message)
+            .collect();
+        assert_eq!(messages, ["b0", "a1", "b2", "a3", "a2", "b4"]);
+
+        // the exited threads' queues are forgotten once they're empty
+        assert!(logger.thread_records.lock().unwrap().is_empty());
+        assert!(logger.take_records().is_empty());
+    }
+}
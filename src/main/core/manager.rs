@@ -3,8 +3,8 @@ use std::collections::HashMap;
 use std::ffi::{CStr, CString, OsStr, OsString};
 use std::os::unix::ffi::OsStrExt;
 use std::path::PathBuf;
-use std::sync::Arc;
 use std::sync::atomic::AtomicU32;
+use std::sync::{Arc, Mutex};
 use std::time::Duration;
 
 use anyhow::Context;
@@ -12,7 +12,8 @@ use atomic_refcell::AtomicRefCell;
 use log::warn;
 use rand::seq::SliceRandom;
 use rand_xoshiro::Xoshiro256PlusPlus;
-use scheduler::thread_per_core::ThreadPerCoreSched;
+use rayon::iter::{IntoParallelRefIterator, ParallelIterator};
+use scheduler::thread_per_core::{ThreadPerCoreOptions, ThreadPerCoreSched};
 use scheduler::thread_per_host::ThreadPerHostSched;
 use scheduler::{HostIter, Scheduler};
 use shadow_shim_helper_rs::HostId;
@@ -25,19 +26,42 @@ use shadow_shmem::allocator::ShMemBlock;
 use crate::core::configuration::{self, ConfigOptions, Flatten};
 use crate::core::controller::{Controller, ShadowStatusBarState, SimController};
 use crate::core::cpu;
-use crate::core::resource_usage;
-use crate::core::runahead::Runahead;
+use crate::core::event_trace::EventTrace;
+use crate::core::memory_data_dir::MemoryDataDir;
+use crate::core::metrics_server::{Metrics, MetricsServer};
+use crate::core::output_store::OutputStore;
+use crate::core::probe_cache::ProbeCache;
+use crate::core::profile;
+use crate::core::resource_usage::{self, HostMemoryUsage};
+use crate::core::runahead::{HostLookahead, RoundWindow, Runahead};
 use crate::core::sim_config::{Bandwidth, HostInfo};
-use crate::core::sim_stats;
+use crate::core::sim_stats::{self, RunaheadSchedule};
+use crate::core::stats_stream::{StatsStream, ThreadRoundStats};
 use crate::core::worker;
+use crate::core::worker_participation::WorkerParticipation;
 use crate::cshadow as c;
+use crate::host::descriptor::file_cache::FileCache;
+use crate::host::file_io_pool::FileIoPool;
 use crate::host::host::{Host, HostParameters};
+use crate::host::process_launcher::ProcessLauncher;
+use crate::host::zygote::ZygotePool;
 use crate::network::dns::DnsBuilder;
 use crate::network::graph::{IpAssignment, RoutingInfo};
+use crate::network::ip_table::Ipv4Table;
 use crate::utility;
 use crate::utility::childpid_watcher::ChildPidWatcher;
 use crate::utility::status_bar::Status;
 
+/// The number of calendar queue buckets spanned by a scheduling round, when using the calendar
+/// event queue.
+const EVENT_QUEUE_BUCKETS_PER_ROUND: u32 = 8;
+
+/// The number of hosts with the largest memory usage that are logged in heartbeat messages.
+const HEARTBEAT_NUM_HOSTS: usize = 10;
+
+/// The number of hosts with the largest memory usage that are logged when memory is running low.
+const LOW_MEMORY_NUM_HOSTS: usize = 5;
+
 pub struct Manager<'a> {
     manager_config: Option<ManagerConfig>,
     controller: &'a Controller<'a>,
@@ -48,15 +72,20 @@ pub struct Manager<'a> {
     end_time: EmulatedTime,
 
     data_path: PathBuf,
+    /// The directory that contains the data directory of each host, which is in
+    /// `memory_data_dir` if set.
     hosts_path: PathBuf,
+    memory_data_dir: Option<Arc<MemoryDataDir>>,
 
     preload_paths: Arc<Vec<PathBuf>>,
 
     check_fd_usage: bool,
     check_mem_usage: bool,
+    check_host_data_usage: bool,
 
     meminfo_file: std::fs::File,
-    shmem: ShMemBlock<'static, ManagerShmem>,
+    // Created once the DNS has been set up, before any hosts are built.
+    shmem: Option<ShMemBlock<'static, ManagerShmem>>,
 }
 
 impl<'a> Manager<'a> {
@@ -66,18 +95,31 @@ impl<'a> Manager<'a> {
         config: &'a ConfigOptions,
         end_time: EmulatedTime,
     ) -> anyhow::Result<Self> {
+        let mut probe_cache = match ProbeCache::default_path() {
+            Some(path) if config.experimental.use_startup_probe_cache.unwrap() => {
+                ProbeCache::load(&path)
+            }
+            _ => ProbeCache::disabled(),
+        };
+
         // get the system's CPU frequency
-        let raw_frequency = get_raw_cpu_frequency_hz().unwrap_or_else(|e| {
-            let default_freq = 2_500_000_000; // 2.5 GHz
-            log::debug!(
-                "Failed to get raw CPU frequency, using {} Hz instead: {}",
-                default_freq,
-                e
-            );
-            default_freq
-        });
+        let raw_frequency = probe_cache
+            .get_or_probe("raw_cpu_frequency_hz", || {
+                get_raw_cpu_frequency_hz()
+                    .map_err(|e| log::debug!("Failed to get raw CPU frequency: {e}"))
+                    .ok()
+            })
+            .unwrap_or_else(|| {
+                let default_freq = 2_500_000_000; // 2.5 GHz
+                log::debug!("Using a raw CPU frequency of {default_freq} Hz");
+                default_freq
+            });
 
-        let native_tsc_frequency = if let Some(f) = shadow_tsc::Tsc::native_cycles_per_second() {
+        let native_tsc_frequency = probe_cache.get_or_probe(
+            "native_tsc_frequency_hz",
+            shadow_tsc::Tsc::native_cycles_per_second,
+        );
+        let native_tsc_frequency = if let Some(f) = native_tsc_frequency {
             f
         } else {
             warn!(
@@ -92,17 +134,17 @@ impl<'a> Manager<'a> {
         // processes
         const PRELOAD_INJECTOR_LIB: &str = "libshadow_injector.so";
         preload_paths.push(
-            get_required_preload_path(PRELOAD_INJECTOR_LIB).with_context(|| {
-                format!("Failed to get path to preload library '{PRELOAD_INJECTOR_LIB}'")
-            })?,
+            get_required_preload_path(&mut probe_cache, PRELOAD_INJECTOR_LIB).with_context(
+                || format!("Failed to get path to preload library '{PRELOAD_INJECTOR_LIB}'"),
+            )?,
         );
 
         // preload libc lib if option is enabled
         const PRELOAD_LIBC_LIB: &str = "libshadow_libc.so";
         if config.experimental.use_preload_libc.unwrap() {
-            let path = get_required_preload_path(PRELOAD_LIBC_LIB).with_context(|| {
-                format!("Failed to get path to preload library '{PRELOAD_LIBC_LIB}'")
-            })?;
+            let path = get_required_preload_path(&mut probe_cache, PRELOAD_LIBC_LIB).with_context(
+                || format!("Failed to get path to preload library '{PRELOAD_LIBC_LIB}'"),
+            )?;
             preload_paths.push(path);
         } else {
             log::info!("Preloading the libc library is disabled");
@@ -111,9 +153,10 @@ impl<'a> Manager<'a> {
         // preload openssl rng lib if option is enabled
         const PRELOAD_OPENSSL_RNG_LIB: &str = "libshadow_openssl_rng.so";
         if config.experimental.use_preload_openssl_rng.unwrap() {
-            let path = get_required_preload_path(PRELOAD_OPENSSL_RNG_LIB).with_context(|| {
-                format!("Failed to get path to preload library '{PRELOAD_OPENSSL_RNG_LIB}'")
-            })?;
+            let path = get_required_preload_path(&mut probe_cache, PRELOAD_OPENSSL_RNG_LIB)
+                .with_context(|| {
+                    format!("Failed to get path to preload library '{PRELOAD_OPENSSL_RNG_LIB}'")
+                })?;
             preload_paths.push(path);
         } else {
             log::info!("Preloading the openssl rng library is disabled");
@@ -122,8 +165,8 @@ impl<'a> Manager<'a> {
         // preload openssl crypto lib if option is enabled
         const PRELOAD_OPENSSL_CRYPTO_LIB: &str = "libshadow_openssl_crypto.so";
         if config.experimental.use_preload_openssl_crypto.unwrap() {
-            let path =
-                get_required_preload_path(PRELOAD_OPENSSL_CRYPTO_LIB).with_context(|| {
+            let path = get_required_preload_path(&mut probe_cache, PRELOAD_OPENSSL_CRYPTO_LIB)
+                .with_context(|| {
                     format!("Failed to get path to preload library '{PRELOAD_OPENSSL_CRYPTO_LIB}'")
                 })?;
             preload_paths.push(path);
@@ -131,6 +174,8 @@ impl<'a> Manager<'a> {
             log::info!("Preloading the openssl crypto library is disabled");
         };
 
+        probe_cache.save();
+
         // use the working dir to generate absolute paths
         let cwd = std::env::current_dir()?;
         let template_path = config
@@ -149,7 +194,12 @@ impl<'a> Manager<'a> {
             );
 
             // copy the template directory to the data directory path
-            utility::copy_dir_all(&template_path, &data_path).with_context(|| {
+            utility::copy_dir_all(
+                &template_path,
+                &data_path,
+                config.experimental.use_template_hardlinks.unwrap(),
+            )
+            .with_context(|| {
                 format!(
                     "Failed to copy template directory '{}' to '{}'",
                     template_path.display(),
@@ -196,18 +246,6 @@ impl<'a> Manager<'a> {
         let meminfo_file =
             std::fs::File::open("/proc/meminfo").context("Failed to open '/proc/meminfo'")?;
 
-        let shmem = shadow_shmem::allocator::shmalloc(ManagerShmem {
-            log_start_time_micros: unsafe { c::logger_get_global_start_time_micros() },
-            native_preemption_config: if config.native_preemption_enabled() {
-                FfiOption::Some(NativePreemptionConfig {
-                    native_duration: config.native_preemption_native_interval()?,
-                    sim_duration: config.native_preemption_sim_interval(),
-                })
-            } else {
-                FfiOption::None
-            },
-        });
-
         Ok(Self {
             manager_config: Some(manager_config),
             controller,
@@ -217,11 +255,13 @@ impl<'a> Manager<'a> {
             end_time,
             data_path,
             hosts_path,
+            memory_data_dir: None,
             preload_paths: Arc::new(preload_paths),
             check_fd_usage: true,
             check_mem_usage: true,
+            check_host_data_usage: true,
             meminfo_file,
-            shmem,
+            shmem: None,
         })
     }
 
@@ -244,12 +284,70 @@ impl<'a> Manager<'a> {
         let bootstrap_end_time: SimulationTime = bootstrap_end_time.try_into().unwrap();
         let bootstrap_end_time = EmulatedTime::SIMULATION_START + bootstrap_end_time;
 
+        let bootstrap_runahead: Option<Duration> = self
+            .config
+            .experimental
+            .bootstrap_runahead
+            .flatten()
+            .map(|x| x.into());
+        let bootstrap_runahead: Option<SimulationTime> =
+            bootstrap_runahead.map(|x| x.try_into().unwrap());
+
         let smallest_latency = SimulationTime::from_nanos(
             manager_config
                 .routing_info
                 .get_smallest_latency_ns()
                 .unwrap(),
         );
+        // the smallest latency changes if the network graph changes during the simulation
+        let smallest_latency_changes: Vec<_> = manager_config
+            .routing_info
+            .smallest_latency_changes_ns()
+            .into_iter()
+            .map(|(time_ns, latency_ns)| {
+                (
+                    EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(time_ns),
+                    SimulationTime::from_nanos(latency_ns),
+                )
+            })
+            .collect();
+
+        // Packets are delivered no earlier than the end of the receiver's round. If the runahead
+        // can be larger than the smallest latency, that clamp depends on how the rounds are split,
+        // and offloaded file I/O splits rounds on when the wall-clock I/O finishes.
+        if self.config.experimental.use_file_io_offload.unwrap() {
+            let min_latency = smallest_latency_changes
+                .iter()
+                .map(|(_, latency)| *latency)
+                .fold(smallest_latency, std::cmp::min);
+            if bootstrap_runahead.is_some()
+                || min_runahead_config.is_some_and(|runahead| runahead > min_latency)
+            {
+                anyhow::bail!(
+                    "'experimental.use_file_io_offload' can't be used with a runahead larger than \
+                     the smallest network latency ({min_latency:?}), or with \
+                     'experimental.bootstrap_runahead', since the simulation would no longer be \
+                     deterministic"
+                );
+            }
+        }
+
+        // size the calendar queue buckets so that each scheduling round spans several buckets
+        let event_queue_bucket_width = self
+            .config
+            .experimental
+            .use_calendar_event_queue
+            .unwrap()
+            .then(|| {
+                let round_width = std::cmp::max(
+                    smallest_latency,
+                    min_runahead_config.unwrap_or(SimulationTime::ZERO),
+                );
+                std::cmp::max(
+                    round_width / EVENT_QUEUE_BUCKETS_PER_ROUND,
+                    SimulationTime::NANOSECOND,
+                )
+            });
 
         let parallelism: usize = match self.config.general.parallelism.unwrap() {
             0 => {
@@ -260,6 +358,23 @@ impl<'a> Manager<'a> {
             x => x.try_into().unwrap(),
         };
 
+        // the hosts' data directories must be moved before the hosts are built
+        if let Some(memory_path) = self.config.experimental.host_data_memory_path.flatten_ref() {
+            let dir = MemoryDataDir::new(
+                &std::env::current_dir()?.join(memory_path),
+                &self.hosts_path,
+                self.config
+                    .experimental
+                    .host_data_spill_patterns
+                    .as_ref()
+                    .unwrap(),
+                self.config.host_data_memory_budget(),
+                parallelism,
+            )?;
+            self.hosts_path = dir.hosts_path().to_path_buf();
+            self.memory_data_dir = Some(Arc::new(dir));
+        }
+
         // Set up the global DNS before building the hosts
         let mut dns_builder = DnsBuilder::new();
 
@@ -291,36 +406,84 @@ impl<'a> Manager<'a> {
         // Convert to a global read-only DNS struct.
         let dns = dns_builder.into_dns()?;
 
+        self.shmem = Some(shadow_shmem::allocator::shmalloc(ManagerShmem {
+            log_start_time_micros: unsafe { c::logger_get_global_start_time_micros() },
+            native_preemption_config: if self.config.native_preemption_enabled() {
+                FfiOption::Some(NativePreemptionConfig {
+                    native_duration: self.config.native_preemption_native_interval()?,
+                    sim_duration: self.config.native_preemption_sim_interval(),
+                    backoff: self.config.experimental.native_preemption_backoff.unwrap(),
+                })
+            } else {
+                FfiOption::None
+            },
+            use_libc_patching: self.config.experimental.use_libc_patching.unwrap(),
+            use_rdtsc_patching: self.config.experimental.use_rdtsc_patching.unwrap(),
+            dns_index_fd: dns.index_fd(),
+            use_shim_log_ring: self.config.experimental.use_shim_log_ring.unwrap(),
+            vdso_patch_table: utility::vdso::patch_table().into(),
+        }));
+
         // Now build the hosts using the assigned host ids.
         // note: there are several return points before we add these hosts to the scheduler and we
         // would leak memory if we return before then, but not worrying about that since the issues
         // will go away when we move the hosts to rust, and if we don't add them to the scheduler
         // then it means there was an error and we're going to exit anyways
-        let mut hosts: Vec<_> = host_init
-            .iter()
-            .map(|(info, id)| {
-                self.build_host(*id, info)
-                    .with_context(|| format!("Failed to build host '{}'", info.name))
-            })
-            .collect::<anyhow::Result<_>>()?;
+        //
+        // Hosts are built in parallel since building a host does file I/O (the host's data
+        // directory and pcap files) and allocates shared memory, which adds up for large
+        // simulations. The hosts are collected in host id order, so the order doesn't depend on
+        // which thread built each host.
+        let socket_buffer_budget = self.config.socket_buffer_budget(host_init.len());
+
+        let host_build_threads = std::cmp::max(std::cmp::min(parallelism, host_init.len()), 1);
+        let host_build_pool = rayon::ThreadPoolBuilder::new()
+            .num_threads(host_build_threads)
+            .thread_name(|i| format!("host-build-{i}"))
+            .build()
+            .context("Failed to create the thread pool for building hosts")?;
+        let mut hosts: Vec<_> = host_build_pool.install(|| {
+            host_init
+                .par_iter()
+                .map(|(info, id)| {
+                    self.build_host(*id, info, event_queue_bucket_width, socket_buffer_budget)
+                        .with_context(|| format!("Failed to build host '{}'", info.name))
+                })
+                .collect::<anyhow::Result<_>>()
+        })?;
+        drop(host_build_pool);
 
         // shuffle the list of hosts to make sure that they are randomly assigned by the scheduler
         hosts.shuffle(&mut manager_config.random);
 
         let use_cpu_pinning = self.config.experimental.use_cpu_pinning.unwrap();
 
-        // an infinite iterator that always returns `<Option<Option<u32>>>::Some`
+        let threads_per_cpu: usize = self
+            .config
+            .experimental
+            .worker_threads_per_cpu
+            .unwrap()
+            .try_into()
+            .unwrap();
+        anyhow::ensure!(
+            threads_per_cpu > 0,
+            "The worker_threads_per_cpu option must be at least 1"
+        );
+
+        // an infinite iterator that always returns `<Option<Option<u32>>>::Some`, with each cpu
+        // repeated for each of the threads that run on it
         let cpu_iter =
             std::iter::from_fn(|| {
                 // if cpu pinning is enabled, return Some(Some(cpu_id)), otherwise return Some(None)
                 Some(use_cpu_pinning.then(|| {
                     u32::try_from(unsafe { c::affinity_getGoodWorkerAffinity() }).unwrap()
                 }))
-            });
+            })
+            .flat_map(|cpu| std::iter::repeat_n(cpu, threads_per_cpu));
 
         // shadow is parallelized at the host level, so we don't need more parallelism than the
         // number of hosts
-        let parallelism = std::cmp::min(parallelism, hosts.len());
+        let parallelism = std::cmp::min(parallelism * threads_per_cpu, hosts.len());
 
         // should have either all `Some` values, or all `None` values
         let cpus: Vec<Option<u32>> = cpu_iter.take(parallelism).collect();
@@ -333,12 +496,75 @@ impl<'a> Manager<'a> {
         }
         assert_eq!(cpus.len(), parallelism);
 
+        let lookahead = self
+            .config
+            .experimental
+            .use_per_host_lookahead
+            .unwrap()
+            .then(|| {
+                let host_nodes: Vec<(HostId, u32)> = host_init
+                    .iter()
+                    .map(|(info, id)| (*id, info.network_node_id))
+                    .collect();
+                let lookahead = HostLookahead::new(&host_nodes, &manager_config.routing_info);
+                log::info!(
+                    "Using per-host lookahead with a maximum lookahead of {} ns",
+                    lookahead.max_lookahead().as_nanos()
+                );
+                lookahead
+            });
+
+        let mut host_addrs = Ipv4Table::new();
+        for (info, id) in &host_init {
+            let std::net::IpAddr::V4(addr) = info.ip_addr.unwrap() else {
+                unreachable!("IPv6 not supported");
+            };
+            let node_id = info.network_node_id;
+            let node_index = manager_config.routing_info.node_index(node_id).unwrap();
+            let old = host_addrs.insert(
+                addr,
+                worker::HostAddrInfo {
+                    host_id: *id,
+                    node_id,
+                    node_index,
+                },
+            );
+            // the DNS would have rejected duplicate addresses
+            assert!(old.is_none());
+        }
+
+        let event_trace = if self.config.experimental.use_event_trace.unwrap() {
+            let filename = self.data_path.join("event-trace.bin");
+            let hosts = host_init.iter().map(|(info, id)| (*id, info.name.as_str()));
+            Some(EventTrace::new(&filename, hosts)?)
+        } else {
+            None
+        };
+
+        let file_cache_paths = self.config.experimental.file_cache_paths.as_ref().unwrap();
+        let file_cache = if file_cache_paths.is_empty() {
+            None
+        } else {
+            Some(FileCache::new(file_cache_paths)?)
+        };
+
+        let output_store = if self.config.experimental.use_output_segments.unwrap() {
+            Some(Arc::new(OutputStore::new(
+                &self.data_path,
+                &self.hosts_path,
+                parallelism,
+            )?))
+        } else {
+            None
+        };
+
         // set the simulation's global state
         worker::WORKER_SHARED
             .borrow_mut()
             .replace(worker::WorkerShared {
                 ip_assignment: manager_config.ip_assignment,
                 routing_info: manager_config.routing_info,
+                host_addrs,
                 host_bandwidths: manager_config.host_bandwidths,
                 // safe since the DNS type has an internal mutex
                 dns,
@@ -348,13 +574,42 @@ impl<'a> Manager<'a> {
                 runahead: Runahead::new(
                     self.config.experimental.use_dynamic_runahead.unwrap(),
                     smallest_latency,
+                    smallest_latency_changes,
                     min_runahead_config,
+                    bootstrap_runahead.map(|x| (bootstrap_end_time, x)),
                 ),
+                lookahead,
                 child_pid_watcher: ChildPidWatcher::new(),
-                event_queues: hosts
+                zygotes: self
+                    .config
+                    .experimental
+                    .use_zygotes
+                    .unwrap()
+                    .then(ZygotePool::new),
+                process_launcher: self
+                    .config
+                    .experimental
+                    .use_process_prelaunch
+                    .unwrap()
+                    .then(|| ProcessLauncher::new(parallelism)),
+                file_io_pool: self
+                    .config
+                    .experimental
+                    .use_file_io_offload
+                    .unwrap()
+                    .then(|| FileIoPool::new(parallelism)),
+                event_mailboxes: hosts
                     .iter()
-                    .map(|x| (x.id(), x.event_queue().clone()))
+                    .map(|x| (x.id(), x.event_mailbox().clone()))
                     .collect(),
+                use_packet_counters: self.config.experimental.use_packet_counters.unwrap(),
+                use_packet_outbox: self.config.experimental.use_packet_outbox.unwrap()
+                    || self.config.experimental.use_packet_trains.unwrap(),
+                use_packet_trains: self.config.experimental.use_packet_trains.unwrap(),
+                event_trace,
+                file_cache,
+                output_store,
+                memory_data_dir: self.memory_data_dir.clone(),
                 bootstrap_end_time,
                 sim_end_time: self.end_time,
             });
@@ -373,12 +628,23 @@ impl<'a> Manager<'a> {
                         hosts,
                     ))
                 }
-                configuration::Scheduler::ThreadPerCore => {
-                    Scheduler::ThreadPerCore(ThreadPerCoreSched::new(
-                        &cpus,
-                        hosts,
-                        self.config.experimental.use_worker_spinning.unwrap(),
-                    ))
+                sched @ (configuration::Scheduler::ThreadPerCore
+                | configuration::Scheduler::Hybrid) => {
+                    let numa_nodes = self.worker_numa_nodes(&cpus);
+                    let is_hybrid = matches!(sched, configuration::Scheduler::Hybrid);
+                    let options = ThreadPerCoreOptions {
+                        yield_spin: self.config.experimental.use_worker_spinning.unwrap(),
+                        cost_balancing: self.config.experimental.use_host_cost_balancing.unwrap(),
+                        pin_busy_hosts: is_hybrid,
+                        steal_delay: self
+                            .config
+                            .experimental
+                            .host_steal_delay
+                            .flatten()
+                            .map(Duration::from),
+                        thread_groups: numa_nodes.as_deref(),
+                    };
+                    Scheduler::ThreadPerCore(ThreadPerCoreSched::new(&cpus, hosts, options))
                 }
             };
 
@@ -395,10 +661,13 @@ impl<'a> Manager<'a> {
                 EmulatedTime::SIMULATION_START + SimulationTime::NANOSECOND,
             ));
 
-            // the next event times for each thread; allocated here to avoid re-allocating each
-            // scheduling loop
-            let thread_next_event_times: Vec<AtomicRefCell<Option<EmulatedTime>>> =
-                vec![AtomicRefCell::new(None); scheduler.parallelism()];
+            // the next event times and round statistics for each thread; allocated here to avoid
+            // re-allocating each scheduling loop
+            let thread_round_data: Vec<AtomicRefCell<(Option<EmulatedTime>, ThreadRoundStats)>> =
+                vec![
+                    AtomicRefCell::new((None, ThreadRoundStats::default()));
+                    scheduler.parallelism()
+                ];
 
             // how often to log heartbeat messages
             let heartbeat_interval = self
@@ -408,6 +677,34 @@ impl<'a> Manager<'a> {
                 .flatten()
                 .map(|x| Duration::from(x).try_into().unwrap());
 
+            let mut stats_stream = if self.config.experimental.use_sim_stats_stream.unwrap() {
+                let filename = self.data_path.join("sim-stats.ndjson");
+                Some(StatsStream::new(&filename, heartbeat_interval)?)
+            } else {
+                None
+            };
+
+            let metrics_server = match self.config.experimental.metrics_address.clone().flatten() {
+                Some(address) => Some(MetricsServer::new(
+                    &address,
+                    Metrics::new(scheduler.parallelism()),
+                )?),
+                None => None,
+            };
+            // the round statistics of each thread, for the stats stream and metrics; allocated
+            // here to avoid re-allocating each scheduling loop
+            let mut round_stats = Vec::with_capacity(thread_round_data.len());
+
+            let mut runahead_schedule = RunaheadSchedule::new();
+
+            // chooses how many worker threads run each round, if not all of them
+            let mut worker_participation = self
+                .config
+                .experimental
+                .use_adaptive_worker_participation
+                .unwrap()
+                .then(|| WorkerParticipation::new(scheduler.parallelism(), host_init.len()));
+
             let mut last_heartbeat = EmulatedTime::SIMULATION_START;
             let mut time_of_last_usage_check = std::time::Instant::now();
 
@@ -423,69 +720,194 @@ impl<'a> Manager<'a> {
                         state.current = display_time;
                     });
 
+                // the runahead can change while the round is running (if dynamic runahead is
+                // enabled), so the hosts' window ends are based on the value at the round start
+                let round_window = RoundWindow {
+                    start: window_start,
+                    end: window_end,
+                    runahead: worker::WORKER_SHARED
+                        .borrow()
+                        .as_ref()
+                        .unwrap()
+                        .get_runahead(window_start),
+                };
+                runahead_schedule.add_round(window_start, round_window.runahead);
+
+                // log a heartbeat message every 'heartbeat_interval' amount of simulated time
+                let heartbeat_due = heartbeat_interval
+                    .is_some_and(|interval| window_start > last_heartbeat + interval);
+
+                // check resource usage every 30 real seconds
+                let usage_check_due = time_of_last_usage_check.elapsed() > Duration::from_secs(30);
+
+                // the workers collect the memory usage of each host for the heartbeat and resource
+                // usage check
+                let collect_host_memory = heartbeat_due || usage_check_due;
+                let host_memory = Mutex::new(Vec::new());
+                let host_memory_ref = &host_memory;
+
+                let round_start = std::time::Instant::now();
+                usdt_probe!(
+                    round_start,
+                    u64::MAX,
+                    window_start,
+                    window_start,
+                    window_end
+                );
+
+                let round_threads = worker_participation
+                    .as_ref()
+                    .map_or(scheduler.parallelism(), |x| x.threads());
+
                 // run the events
                 scheduler.scope(|s| {
-                    // run the closure on each of the scheduler's threads
-                    s.run_with_data(
-                        &thread_next_event_times,
+                    // run the closure on the scheduler's threads; the threads that don't run stay
+                    // parked
+                    s.run_with_data_on(
+                        round_threads,
+                        &thread_round_data,
                         // each call of the closure is given an abstract thread-specific host
-                        // iterator, and an element of 'thread_next_event_times'
-                        move |_, hosts, next_event_time| {
-                            let mut next_event_time = next_event_time.borrow_mut();
+                        // iterator, and an element of 'thread_round_data'
+                        move |_, hosts, thread_data| {
+                            let busy_start = std::time::Instant::now();
+                            let (next_event_time, round_stats) = &mut *thread_data.borrow_mut();
+                            let mut active_hosts = 0;
 
                             worker::Worker::reset_next_event_time();
-                            worker::Worker::set_round_end_time(window_end);
+                            worker::Worker::set_round_window(round_window);
 
                             for_each_host(hosts, |host| {
-                                let host_next_event_time = {
-                                    host.lock_shmem();
-                                    host.execute(window_end);
-                                    let host_next_event_time = host.next_event_time();
-                                    host.unlock_shmem();
-                                    host_next_event_time
-                                };
+                                host.dump_pcap_rings_if_requested();
+
+                                if collect_host_memory {
+                                    let usage = host.memory_usage();
+                                    host_memory_ref
+                                        .lock()
+                                        .unwrap()
+                                        .push((host.name().to_string(), usage));
+                                }
+
+                                let host_window_end =
+                                    worker::Worker::host_round_end_time(host.id());
+                                worker::Worker::set_round_end_time(host_window_end);
+
+                                // skip hosts with no events in this round without locking
+                                // them; the mailbox's time is a lower bound on the host's next
+                                // event time
+                                let host_next_event_time = host.event_mailbox().next_event_time();
+                                let host_next_event_time =
+                                    if host_next_event_time.is_some_and(|t| t < host_window_end) {
+                                        usdt_probe!(
+                                            host_execute_begin,
+                                            host.id(),
+                                            host_next_event_time,
+                                            host_window_end
+                                        );
+                                        active_hosts += 1;
+                                        host.lock_shmem();
+                                        host.execute(host_window_end);
+                                        let host_next_event_time = host.next_event_time();
+                                        host.unlock_shmem();
+                                        usdt_probe!(
+                                            host_execute_end,
+                                            host.id(),
+                                            host_next_event_time,
+                                            host_window_end
+                                        );
+                                        host_next_event_time
+                                    } else {
+                                        host_next_event_time
+                                    };
                                 *next_event_time = [*next_event_time, host_next_event_time]
                                     .into_iter()
                                     .flatten() // filter out None
                                     .reduce(std::cmp::min);
                             });
 
+                            // the hosts' mailboxes must have all of this round's packets before
+                            // the next round starts
+                            worker::Worker::flush_packet_outbox();
+
                             let packet_next_event_time = worker::Worker::get_next_event_time();
 
                             *next_event_time = [*next_event_time, packet_next_event_time]
                                 .into_iter()
                                 .flatten() // filter out None
                                 .reduce(std::cmp::min);
+
+                            // the element may have been given to other threads earlier in the
+                            // round, so add to its stats
+                            round_stats.add(
+                                worker::Worker::take_event_counts(),
+                                active_hosts,
+                                busy_start.elapsed(),
+                            );
                         },
                     );
+                });
 
-                    // log a heartbeat message every 'heartbeat_interval' amount of simulated time
-                    if let Some(heartbeat_interval) = heartbeat_interval {
-                        if window_start > last_heartbeat + heartbeat_interval {
-                            last_heartbeat = window_start;
-                            self.log_heartbeat(window_start);
-                        }
-                    }
+                usdt_probe!(round_end, u64::MAX, window_start, window_start, window_end);
 
-                    // check resource usage every 30 real seconds
-                    let current_time = std::time::Instant::now();
-                    if current_time.duration_since(time_of_last_usage_check)
-                        > Duration::from_secs(30)
-                    {
-                        time_of_last_usage_check = current_time;
-                        self.check_resource_usage();
-                    }
+                // largest first, and by name for equal usage so that the order is deterministic
+                let mut host_memory = host_memory.into_inner().unwrap();
+                host_memory.sort_unstable_by(|(name_a, a), (name_b, b)| {
+                    b.total().cmp(&a.total()).then_with(|| name_a.cmp(name_b))
                 });
 
+                if heartbeat_due {
+                    last_heartbeat = window_start;
+                    self.log_heartbeat(window_start, &host_memory);
+                }
+
+                if usage_check_due {
+                    time_of_last_usage_check = std::time::Instant::now();
+                    self.check_resource_usage(&host_memory);
+                }
+
                 // get the minimum next event time for all threads (also resets the next event times
                 // to None while we have them borrowed)
-                let min_next_event_time = thread_next_event_times
+                let min_next_event_time = thread_round_data
                     .iter()
                     // the take() resets it to None for the next scheduling loop
-                    .filter_map(|x| x.borrow_mut().take())
+                    .filter_map(|x| x.borrow_mut().0.take())
                     .reduce(std::cmp::min)
                     .unwrap_or(EmulatedTime::MAX);
 
+                let round_wall_time = round_start.elapsed();
+                round_stats.clear();
+                round_stats.extend(
+                    thread_round_data
+                        .iter()
+                        .map(|x| std::mem::take(&mut x.borrow_mut().1)),
+                );
+
+                if let Some(participation) = worker_participation.as_mut() {
+                    participation.add_round(
+                        round_stats.iter().map(|x| x.active_hosts).sum(),
+                        round_stats.iter().map(|x| x.busy).sum(),
+                    );
+                }
+
+                if let Some(server) = metrics_server.as_ref() {
+                    server.metrics().add_round(
+                        window_end,
+                        round_wall_time,
+                        round_stats.iter().copied(),
+                    );
+                }
+
+                if let Some(stream) = stats_stream.as_mut() {
+                    stream.add_round(
+                        window_end.saturating_duration_since(&window_start),
+                        round_wall_time,
+                        round_stats.iter().copied(),
+                    );
+                    if let Err(e) = stream.maybe_write_record(window_end) {
+                        log::warn!("Unable to write to the sim stats stream: {e}");
+                        stats_stream = None;
+                    }
+                }
+
                 log::debug!(
                     "Finished execution window [{}--{}], next event at {}",
                     (window_start - EmulatedTime::SIMULATION_START).as_nanos(),
@@ -500,6 +922,24 @@ impl<'a> Manager<'a> {
                     .manager_finished_current_round(min_next_event_time);
             }
 
+            worker::with_global_sim_stats(|stats| {
+                *stats.runahead_schedule.lock().unwrap() = runahead_schedule;
+            });
+
+            if let Some(mut stream) = stats_stream {
+                if let Err(e) = stream.finish(self.end_time) {
+                    log::warn!("Unable to write to the sim stats stream: {e}");
+                }
+            }
+
+            // signal every host's processes before reaping any of them, so that the kernel tears
+            // them all down concurrently
+            scheduler.scope(|s| {
+                s.run_with_hosts(move |_, hosts| {
+                    for_each_host(hosts, |host| host.kill_all_applications());
+                });
+            });
+
             scheduler.scope(|s| {
                 s.run_with_hosts(move |_, hosts| {
                     for_each_host(hosts, |host| {
@@ -508,6 +948,7 @@ impl<'a> Manager<'a> {
                         host.shutdown();
                         worker::Worker::clear_current_time();
                     });
+                    worker::Worker::flush_packet_outbox();
                 });
             });
 
@@ -536,10 +977,26 @@ impl<'a> Manager<'a> {
             .unwrap()
             .plugin_error_count();
 
+        // every worker has added its packet counts to the routing info
+        if self.config.experimental.use_packet_counters.unwrap() {
+            worker::WORKER_SHARED
+                .borrow()
+                .as_ref()
+                .unwrap()
+                .routing_info
+                .log_packet_counts();
+        }
+
         // drop the simulation's global state
         // must drop before the allocation counters have been checked
         worker::WORKER_SHARED.borrow_mut().take();
 
+        // wait for the hosts' data to be copied from memory, and remove the in-memory directories
+        if let Some(dir) = self.memory_data_dir.take() {
+            log::info!("Waiting for the host data directories to be copied");
+            drop(dir);
+        }
+
         // since the scheduler was dropped, all workers should have completed and the global object
         // and syscall counters should have been updated
 
@@ -550,7 +1007,7 @@ impl<'a> Manager<'a> {
                     stats.syscall_counts.lock().unwrap()
                 );
             }
-            if self.config.experimental.use_object_counters.unwrap() {
+            if worker::Worker::use_object_counters() {
                 let alloc_counts = stats.alloc_counts.lock().unwrap();
                 let dealloc_counts = stats.dealloc_counts.lock().unwrap();
                 log::info!("Global allocated object counts: {}", alloc_counts);
@@ -564,6 +1021,11 @@ impl<'a> Manager<'a> {
                 }
             }
 
+            if self.config.experimental.use_profiling.unwrap() {
+                let profile_filename = self.data_path.clone().join("profile.json");
+                profile::write_profile_to_file(&profile_filename, stats)?;
+            }
+
             let stats_filename = self.data_path.clone().join("sim-stats.json");
             sim_stats::write_stats_to_file(&stats_filename, stats)
         })?;
@@ -571,7 +1033,13 @@ impl<'a> Manager<'a> {
         Ok(num_plugin_errors)
     }
 
-    fn build_host(&self, host_id: HostId, host_info: &HostInfo) -> anyhow::Result<Box<Host>> {
+    fn build_host(
+        &self,
+        host_id: HostId,
+        host_info: &HostInfo,
+        event_queue_bucket_width: Option<SimulationTime>,
+        socket_buffer_budget: Option<u64>,
+    ) -> anyhow::Result<Box<Host>> {
         let hostname = CString::new(&*host_info.name).unwrap();
 
         // scope used to enforce drop order for pointers
@@ -600,23 +1068,74 @@ impl<'a> Manager<'a> {
                     .unwrap_or(logger::_LogLevel_LOGLEVEL_UNSET),
                 pcap_config: host_info.pcap_config,
                 qdisc: host_info.qdisc,
+                router_qdisc: host_info.router_qdisc,
                 init_sock_recv_buf_size: host_info.recv_buf_size,
                 autotune_recv_buf: host_info.autotune_recv_buf,
                 init_sock_send_buf_size: host_info.send_buf_size,
                 autotune_send_buf: host_info.autotune_send_buf,
+                cgroup: self
+                    .controller
+                    .cgroups()
+                    .map(|x| x.new_host_cgroup(&host_info.name))
+                    .transpose()?,
+                socket_buffer_budget,
                 native_tsc_frequency: self.native_tsc_frequency,
                 model_unblocked_syscall_latency: self.config.model_unblocked_syscall_latency(),
                 max_unapplied_cpu_latency: self.config.max_unapplied_cpu_latency(),
                 unblocked_syscall_latency: self.config.unblocked_syscall_latency(),
                 unblocked_vdso_latency: self.config.unblocked_vdso_latency(),
+                use_adaptive_cpu_latency: self
+                    .config
+                    .experimental
+                    .use_adaptive_cpu_latency
+                    .unwrap(),
+                use_batched_memory_writes: self
+                    .config
+                    .experimental
+                    .use_batched_memory_writes
+                    .unwrap(),
                 strace_logging_options: self.config.strace_logging_mode(),
+                use_binary_strace: self.config.use_binary_strace(),
                 shim_log_level: host_info
                     .log_level
                     .unwrap_or_else(|| self.config.general.log_level.unwrap())
                     .to_c_loglevel(),
                 use_new_tcp: self.config.experimental.use_new_tcp.unwrap(),
+                use_new_tcp_delayed_ack: self.config.experimental.use_new_tcp_delayed_ack.unwrap(),
+                use_deferred_tcp_flush: self.config.experimental.use_deferred_tcp_flush.unwrap(),
                 use_mem_mapper: self.config.experimental.use_memory_manager.unwrap(),
+                use_mem_mapper_huge_pages: self
+                    .config
+                    .experimental
+                    .use_memory_manager_huge_pages
+                    .unwrap(),
+                use_mem_mapper_shared_file_pages: self
+                    .config
+                    .experimental
+                    .use_memory_manager_shared_file_pages
+                    .unwrap(),
+                use_smt_sibling_affinity: self
+                    .config
+                    .experimental
+                    .use_smt_sibling_affinity
+                    .unwrap(),
                 use_syscall_counters: self.config.experimental.use_syscall_counters.unwrap(),
+                use_profiling: self.config.experimental.use_profiling.unwrap(),
+                event_queue_bucket_width,
+                use_continuous_rate_limits: self
+                    .config
+                    .experimental
+                    .use_continuous_rate_limits
+                    .unwrap(),
+                use_direct_loopback: self.config.experimental.use_direct_loopback.unwrap(),
+                use_timer_wheel: self.config.experimental.use_timer_wheel.unwrap(),
+                ipc_spin_limit: self.config.experimental.ipc_spin_limit.unwrap(),
+                use_process_prelaunch: self.config.experimental.use_process_prelaunch.unwrap(),
+                use_native_file_io: self.config.experimental.use_native_file_io.unwrap(),
+                use_file_io_offload: self.config.experimental.use_file_io_offload.unwrap(),
+                use_shim_random: self.config.experimental.use_shim_random.unwrap(),
+                use_shim_futex_wake: self.config.experimental.use_shim_futex_wake.unwrap(),
+                idle_reclaim_delay: self.config.idle_host_reclaim_delay(),
             };
 
             Box::new(Host::new(
@@ -630,7 +1149,7 @@ impl<'a> Manager<'a> {
 
         host.lock_shmem();
 
-        for proc in &host_info.processes {
+        for proc in host_info.processes.iter() {
             let plugin_path =
                 CString::new(proc.plugin.clone().into_os_string().as_bytes()).unwrap();
             let plugin_name = CString::new(proc.plugin.file_name().unwrap().as_bytes()).unwrap();
@@ -666,6 +1185,7 @@ impl<'a> Manager<'a> {
                 envv,
                 pause_for_debugging,
                 proc.expected_final_state,
+                proc.native_syscalls.clone(),
             );
 
             host.stop_execution_timer();
@@ -676,7 +1196,34 @@ impl<'a> Manager<'a> {
         Ok(host)
     }
 
-    fn log_heartbeat(&mut self, now: EmulatedTime) {
+    /// The NUMA node of each worker's CPU, if hosts should be kept within NUMA node groups.
+    fn worker_numa_nodes(&self, cpus: &[Option<u32>]) -> Option<Vec<u32>> {
+        if !self.config.experimental.use_numa_host_groups.unwrap() {
+            return None;
+        }
+
+        if cpus.iter().any(|x| x.is_none()) {
+            log::warn!("NUMA host groups require CPU pinning, so they will not be used");
+            return None;
+        }
+
+        let nodes: Vec<u32> = cpus
+            .iter()
+            .map(|cpu| {
+                let node = unsafe { c::affinity_getCpuNode(cpu.unwrap().try_into().unwrap()) };
+                // if the node is unknown, treat it as node 0
+                u32::try_from(node).unwrap_or(0)
+            })
+            .collect();
+
+        log::debug!("Worker NUMA nodes: {nodes:?}");
+
+        Some(nodes)
+    }
+
+    /// Log the resource usage of Shadow and the system. `host_memory` is the memory usage of each
+    /// host, sorted from largest to smallest.
+    fn log_heartbeat(&mut self, now: EmulatedTime, host_memory: &[(String, HostMemoryUsage)]) {
         let mut resources: libc::rusage = unsafe { std::mem::zeroed() };
         if unsafe { libc::getrusage(libc::RUSAGE_SELF, &mut resources) } != 0 {
             let err = nix::errno::Errno::last();
@@ -718,9 +1265,28 @@ impl<'a> Manager<'a> {
             (now - EmulatedTime::SIMULATION_START).as_nanos(),
             serde_json::to_string(&mem_info).unwrap(),
         );
+
+        let mut total = HostMemoryUsage::default();
+        for (_, usage) in host_memory {
+            total += *usage;
+        }
+
+        log::info!(
+            "Total host memory usage in bytes at simtime {} ns: {}",
+            (now - EmulatedTime::SIMULATION_START).as_nanos(),
+            serde_json::to_string(&total).unwrap(),
+        );
+        log::info!(
+            "Largest host memory usage in bytes at simtime {} ns: {}",
+            (now - EmulatedTime::SIMULATION_START).as_nanos(),
+            serde_json::to_string(&host_memory[..host_memory.len().min(HEARTBEAT_NUM_HOSTS)])
+                .unwrap(),
+        );
     }
 
-    fn check_resource_usage(&mut self) {
+    /// Warn if Shadow is running low on resources. `host_memory` is the memory usage of each host,
+    /// sorted from largest to smallest.
+    fn check_resource_usage(&mut self, host_memory: &[(String, HostMemoryUsage)]) {
         if self.check_fd_usage {
             match self.fd_usage() {
                 // if more than 90% in use
@@ -743,6 +1309,13 @@ impl<'a> Manager<'a> {
                 // if less than 500 MiB available
                 Ok(remaining) if remaining < 500 * 1024 * 1024 => {
                     log::warn!("Only {} MiB of memory available", remaining / 1024 / 1024);
+                    for (name, usage) in host_memory.iter().take(LOW_MEMORY_NUM_HOSTS) {
+                        log::warn!(
+                            "Host '{name}' is using {} MiB ({} MiB by managed processes)",
+                            usage.total() / 1024 / 1024,
+                            usage.managed_rss / 1024 / 1024,
+                        );
+                    }
                     self.check_mem_usage = false;
                 }
                 Err(e) => {
@@ -752,6 +1325,31 @@ impl<'a> Manager<'a> {
                 Ok(_) => {}
             }
         }
+
+        if self.check_host_data_usage {
+            // only checked if there's a budget
+            let usage = self
+                .memory_data_dir
+                .as_ref()
+                .and_then(|dir| Some((dir.usage(), dir.budget()?)));
+            match usage {
+                Some((Ok(usage), budget)) if usage > budget => {
+                    log::warn!(
+                        "The in-memory host data directories are using {} MiB, which is more \
+                         than the budget of {} MiB",
+                        usage / 1024 / 1024,
+                        budget / 1024 / 1024,
+                    );
+                    self.check_host_data_usage = false;
+                }
+                Some((Err(e), _)) => {
+                    log::warn!("Unable to check the usage of the host data directories: {e}");
+                    self.check_host_data_usage = false;
+                }
+                Some(_) => {}
+                None => self.check_host_data_usage = false,
+            }
+        }
     }
 
     /// Returns a tuple of (usage, limit).
@@ -793,7 +1391,7 @@ impl<'a> Manager<'a> {
     }
 
     pub fn shmem(&self) -> &ShMemBlock<ManagerShmem> {
-        &self.shmem
+        self.shmem.as_ref().unwrap()
     }
 }
 
@@ -802,10 +1400,10 @@ pub struct ManagerConfig {
     pub random: Xoshiro256PlusPlus,
 
     // map of ip addresses to graph nodes
-    pub ip_assignment: IpAssignment<u32>,
+    pub ip_assignment: Arc<IpAssignment<u32>>,
 
     // routing information for paths between graph nodes
-    pub routing_info: RoutingInfo<u32>,
+    pub routing_info: Arc<RoutingInfo<u32>>,
 
     // bandwidths of hosts at ip addresses
     pub host_bandwidths: HashMap<std::net::IpAddr, Bandwidth>,
@@ -833,7 +1431,18 @@ fn get_raw_cpu_frequency_hz() -> anyhow::Result<u64> {
     Ok(khz * 1000)
 }
 
-fn get_required_preload_path(libname: &str) -> anyhow::Result<PathBuf> {
+fn get_required_preload_path(
+    probe_cache: &mut ProbeCache,
+    libname: &str,
+) -> anyhow::Result<PathBuf> {
+    let cache_name = format!("preload_path:{libname}");
+    if let Some(libpath) = probe_cache
+        .get::<PathBuf>(&cache_name)
+        .filter(|x| x.is_file())
+    {
+        return Ok(libpath);
+    }
+
     let libname_c = CString::new(libname).unwrap();
     let libpath_c = unsafe { c::scanRpathForLib(libname_c.as_ptr()) };
 
@@ -862,5 +1471,6 @@ fn get_required_preload_path(libname: &str) -> anyhow::Result<PathBuf> {
         libpath.display(),
     );
 
+    probe_cache.insert(&cache_name, &libpath);
     Ok(libpath)
 }
@@ -0,0 +1,443 @@
+//! Host data directories on a memory-backed filesystem, used when the experimental
+//! `host_data_memory_path` option is set.
+//!
+//! The data directories of the hosts are kept in a directory within that path (for example
+//! within `/dev/shm`) rather than in `<data_directory>/hosts`, so that the metadata-heavy
+//! I/O of many hosts (creating, writing, and deleting many small files) doesn't contend for the
+//! disk. When a host shuts down, the files in its directory that match the
+//! `host_data_spill_patterns` are copied to its directory in `<data_directory>/hosts` on a
+//! background thread, and its in-memory directory is removed. The directory is removed once all
+//! copies have completed.
+//!
+//! The directory's name is derived from the path of the data directory rather than being random,
+//! since it's visible to the managed processes (for example as their working directory), and the
+//! simulation must be the same each time it's run.
+
+use std::ffi::CString;
+use std::os::unix::ffi::OsStrExt;
+use std::os::unix::fs::MetadataExt;
+use std::path::{Path, PathBuf};
+
+use anyhow::Context;
+
+pub struct MemoryDataDir {
+    pool: rayon::ThreadPool,
+    /// Each copy holds a clone, so that we can wait for the copies to complete.
+    pending: Option<crossbeam::sync::WaitGroup>,
+    /// The patterns of the files to copy, relative to the host's data directory.
+    patterns: Vec<String>,
+    /// The directory that contains the persistent data directory of each host.
+    persistent_hosts_path: PathBuf,
+    /// The directory that contains the in-memory data directory of each host.
+    hosts_path: PathBuf,
+    budget: Option<u64>,
+    /// Removed when dropped, after the copies have completed.
+    root: PathBuf,
+}
+
+impl MemoryDataDir {
+    /// Create a directory within `memory_path`, and copy the host directories in
+    /// `persistent_hosts_path` (for example from the template directory) to it. The files
+    /// matching `patterns` are later copied back to `persistent_hosts_path` by up to
+    /// `num_threads` threads. Fails if the directory for `persistent_hosts_path` already exists.
+    pub fn new(
+        memory_path: &Path,
+        persistent_hosts_path: &Path,
+        patterns: &[String],
+        budget: Option<u64>,
+        num_threads: usize,
+    ) -> anyhow::Result<Self> {
+        if let Some(budget) = budget {
+            let available = available_space(memory_path).with_context(|| {
+                format!(
+                    "Failed to get the available space of '{}'",
+                    memory_path.display()
+                )
+            })?;
+            if available < budget {
+                anyhow::bail!(
+                    "Only {} MiB are available in '{}', which is less than the host data memory \
+                     budget of {} MiB",
+                    available / 1024 / 1024,
+                    memory_path.display(),
+                    budget / 1024 / 1024,
+                );
+            }
+        }
+
+        let pool = rayon::ThreadPoolBuilder::new()
+            .num_threads(num_threads)
+            .thread_name(|i| format!("host-data-{i}"))
+            .build()
+            .context("Couldn't create the host data threads")?;
+
+        let root = memory_path.join(dir_name(persistent_hosts_path));
+        std::fs::create_dir(&root).with_context(|| {
+            format!(
+                "Failed to create the directory '{}' for the host data. If it already exists, \
+                 another simulation with the same data directory may be running, or a previous \
+                 one may not have exited cleanly.",
+                root.display()
+            )
+        })?;
+
+        // from here on the directory is removed when `Self` is dropped, including on errors
+        let hosts_path = root.join("hosts");
+        let dir = Self {
+            pool,
+            pending: Some(crossbeam::sync::WaitGroup::new()),
+            patterns: patterns.to_vec(),
+            persistent_hosts_path: persistent_hosts_path.to_path_buf(),
+            hosts_path,
+            budget,
+            root,
+        };
+
+        crate::utility::copy_dir_all(persistent_hosts_path, &dir.hosts_path, false).with_context(
+            || {
+                format!(
+                    "Failed to copy the hosts directory '{}' to '{}'",
+                    persistent_hosts_path.display(),
+                    dir.hosts_path.display()
+                )
+            },
+        )?;
+
+        log::info!(
+            "Keeping the host data directories in '{}'",
+            dir.hosts_path.display()
+        );
+
+        Ok(dir)
+    }
+
+    /// The directory that contains the in-memory data directory of each host.
+    pub fn hosts_path(&self) -> &Path {
+        &self.hosts_path
+    }
+
+    /// The space that the in-memory host data directories may use.
+    pub fn budget(&self) -> Option<u64> {
+        self.budget
+    }
+
+    /// The space used by the in-memory host data directories.
+    pub fn usage(&self) -> std::io::Result<u64> {
+        dir_usage(&self.hosts_path)
+    }
+
+    /// Copy the files to keep from the in-memory data directory of host `hostname` to its
+    /// persistent data directory on a background thread, and then remove the in-memory directory.
+    /// The host must not use its data directory afterwards.
+    pub fn spill(&self, hostname: &str) {
+        let src = self.hosts_path.join(hostname);
+        let dst = self.persistent_hosts_path.join(hostname);
+        let patterns = self.patterns.clone();
+        let pending = self.pending.clone().unwrap();
+
+        self.pool.spawn(move || {
+            if src.exists() {
+                if let Err(e) = copy_matching(&src, Path::new(""), &dst, &patterns) {
+                    log::warn!(
+                        "Failed to copy host data directory '{}' to '{}': {e}",
+                        src.display(),
+                        dst.display()
+                    );
+                }
+                if let Err(e) = std::fs::remove_dir_all(&src) {
+                    log::warn!(
+                        "Failed to remove host data directory '{}': {e}",
+                        src.display()
+                    );
+                }
+            }
+            drop(pending);
+        });
+    }
+
+    /// Wait for all copies to complete. No more hosts can be spilled afterwards.
+    pub fn wait(&mut self) {
+        if let Some(pending) = self.pending.take() {
+            pending.wait();
+        }
+    }
+}
+
+impl Drop for MemoryDataDir {
+    fn drop(&mut self) {
+        // the temporary directory must not be removed while it's still being copied from
+        self.wait();
+        log::debug!("Removing '{}'", self.root.display());
+        if let Err(e) = std::fs::remove_dir_all(&self.root) {
+            log::warn!("Failed to remove '{}': {e}", self.root.display());
+        }
+    }
+}
+
+impl std::fmt::Debug for MemoryDataDir {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("MemoryDataDir")
+            .field("hosts_path", &self.hosts_path)
+            .field("persistent_hosts_path", &self.persistent_hosts_path)
+            .field("patterns", &self.patterns)
+            .field("budget", &self.budget)
+            .finish_non_exhaustive()
+    }
+}
+
+/// The name of the in-memory directory for the hosts directory `persistent_hosts_path`, which is
+/// an FNV-1a hash of its path so that it's the same in each run.
+fn dir_name(persistent_hosts_path: &Path) -> String {
+    let hash = persistent_hosts_path
+        .as_os_str()
+        .as_bytes()
+        .iter()
+        .fold(0xcbf29ce484222325_u64, |hash, &byte| {
+            (hash ^ u64::from(byte)).wrapping_mul(0x100000001b3)
+        });
+    format!("shadow-hosts-{hash:016x}")
+}
+
+/// Copy the files in `src_root/rel` that match any of `patterns` to `dst_root/rel`, recursively.
+fn copy_matching(
+    src_root: &Path,
+    rel: &Path,
+    dst_root: &Path,
+    patterns: &[String],
+) -> std::io::Result<()> {
+    for entry in std::fs::read_dir(src_root.join(rel))? {
+        let entry = entry?;
+        let rel = rel.join(entry.file_name());
+        let file_type = entry.file_type()?;
+
+        if file_type.is_dir() {
+            copy_matching(src_root, &rel, dst_root, patterns)?;
+            continue;
+        }
+
+        if !(file_type.is_file() || file_type.is_symlink()) {
+            continue;
+        }
+
+        let rel_bytes = rel.as_os_str().as_bytes();
+        if !patterns
+            .iter()
+            .any(|pattern| glob_match(pattern.as_bytes(), rel_bytes))
+        {
+            continue;
+        }
+
+        let dst = dst_root.join(&rel);
+        std::fs::create_dir_all(dst.parent().unwrap())?;
+
+        if file_type.is_symlink() {
+            let target = std::fs::read_link(entry.path())?;
+            match std::fs::remove_file(&dst) {
+                Err(e) if e.kind() != std::io::ErrorKind::NotFound => return Err(e),
+                _ => {}
+            }
+            std::os::unix::fs::symlink(target, &dst)?;
+        } else {
+            std::fs::copy(entry.path(), &dst)?;
+        }
+    }
+
+    Ok(())
+}
+
+/// The space used by the files in `path`, recursively. Files that are removed while walking the
+/// directory are skipped.
+fn dir_usage(path: &Path) -> std::io::Result<u64> {
+    let mut usage = 0;
+
+    for entry in std::fs::read_dir(path)? {
+        let entry = entry?;
+        let result = entry.metadata().and_then(|metadata| {
+            if metadata.is_dir() {
+                Ok(metadata.blocks() * 512 + dir_usage(&entry.path())?)
+            } else {
+                Ok(metadata.blocks() * 512)
+            }
+        });
+
+        match result {
+            Ok(x) => usage += x,
+            Err(e) if e.kind() == std::io::ErrorKind::NotFound => {}
+            Err(e) => return Err(e),
+        }
+    }
+
+    Ok(usage)
+}
+
+/// The space available to unprivileged users in the filesystem that contains `path`.
+fn available_space(path: &Path) -> std::io::Result<u64> {
+    let path = CString::new(path.as_os_str().as_bytes()).unwrap();
+    let mut stat: libc::statvfs = unsafe { std::mem::zeroed() };
+
+    if unsafe { libc::statvfs(path.as_ptr(), &mut stat) } != 0 {
+        return Err(std::io::Error::last_os_error());
+    }
+
+    Ok(u64::from(stat.f_bavail) * u64::from(stat.f_frsize))
+}
+
+/// Whether `path` matches the glob `pattern`. `*` matches any characters other than `/`, `?`
+/// matches a single character other than `/`, and `**` matches any characters. A `**/` may also
+/// match nothing, so that `**/x` matches `x`.
+fn glob_match(pattern: &[u8], path: &[u8]) -> bool {
+    match pattern {
+        [] => path.is_empty(),
+        [b'*', b'*', rest @ ..] => {
+            if let [b'/', after @ ..] = rest {
+                if glob_match(after, path) {
+                    return true;
+                }
+            }
+            (0..=path.len()).any(|i| glob_match(rest, &path[i..]))
+        }
+        [b'*', rest @ ..] => {
+            for i in 0..=path.len() {
+                if glob_match(rest, &path[i..]) {
+                    return true;
+                }
+                if path.get(i) == Some(&b'/') {
+                    break;
+                }
+            }
+            false
+        }
+        [b'?', rest @ ..] => match path {
+            [c, path_rest @ ..] if *c != b'/' => glob_match(rest, path_rest),
+            _ => false,
+        },
+        [c, rest @ ..] => match path {
+            [x, path_rest @ ..] if x == c => glob_match(rest, path_rest),
+            _ => false,
+        },
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn matches(pattern: &str, path: &str) -> bool {
+        glob_match(pattern.as_bytes(), path.as_bytes())
+    }
+
+    #[test]
+    fn test_glob_literal() {
+        assert!(matches("a.txt", "a.txt"));
+        assert!(!matches("a.txt", "a.txt2"));
+        assert!(!matches("a.txt", "dir/a.txt"));
+        assert!(matches("", ""));
+        assert!(!matches("", "a"));
+    }
+
+    #[test]
+    fn test_glob_star() {
+        assert!(matches("*.stdout", "tor.1000.stdout"));
+        assert!(matches("*", ""));
+        assert!(!matches("*.stdout", "tor.1000.stderr"));
+        // doesn't match across directories
+        assert!(!matches("*.stdout", "dir/tor.1000.stdout"));
+        assert!(matches("*/*.stdout", "dir/tor.1000.stdout"));
+        assert!(matches("a*b*c", "aXbYbZc"));
+    }
+
+    #[test]
+    fn test_glob_question_mark() {
+        assert!(matches("?.txt", "a.txt"));
+        assert!(!matches("?.txt", ".txt"));
+        assert!(!matches("a?b", "a/b"));
+    }
+
+    #[test]
+    fn test_glob_double_star() {
+        assert!(matches("**", "a"));
+        assert!(matches("**", "a/b/c"));
+        assert!(matches("**/*.pcap", "eth0.pcap"));
+        assert!(matches("**/*.pcap", "a/b/eth0.pcap"));
+        assert!(!matches("**/*.pcap", "a/b/eth0.pcap.gz"));
+        assert!(matches("data/**", "data/a/b"));
+        assert!(!matches("data/**", "other/a"));
+    }
+
+    #[test]
+    fn test_spill() {
+        let persistent = tempfile::tempdir().unwrap();
+        let memory = tempfile::tempdir().unwrap();
+
+        // a host directory from the template
+        std::fs::create_dir_all(persistent.path().join("server")).unwrap();
+        std::fs::write(persistent.path().join("server/config"), "x").unwrap();
+
+        let patterns = ["*.stdout".to_string(), "**/*.pcap".to_string()];
+        let mut dir =
+            MemoryDataDir::new(memory.path(), persistent.path(), &patterns, None, 2).unwrap();
+
+        let host_path = dir.hosts_path().join("server");
+        assert!(host_path.join("config").exists());
+
+        std::fs::create_dir(host_path.join("pcap")).unwrap();
+        std::fs::write(host_path.join("echo.1000.stdout"), "hello").unwrap();
+        std::fs::write(host_path.join("echo.1000.stderr"), "").unwrap();
+        std::fs::write(host_path.join("pcap/eth0.pcap"), "pcap").unwrap();
+        assert!(dir.usage().unwrap() > 0);
+
+        dir.spill("server");
+        dir.wait();
+
+        let dst = persistent.path().join("server");
+        assert_eq!(
+            std::fs::read_to_string(dst.join("echo.1000.stdout")).unwrap(),
+            "hello"
+        );
+        assert_eq!(
+            std::fs::read_to_string(dst.join("pcap/eth0.pcap")).unwrap(),
+            "pcap"
+        );
+        assert!(!dst.join("echo.1000.stderr").exists());
+        assert!(!host_path.exists());
+
+        // the directory is removed
+        drop(dir);
+        assert_eq!(std::fs::read_dir(memory.path()).unwrap().count(), 0);
+    }
+
+    #[test]
+    fn test_deterministic_name() {
+        let persistent = tempfile::tempdir().unwrap();
+        let other_persistent = tempfile::tempdir().unwrap();
+        let memory = tempfile::tempdir().unwrap();
+
+        let dir = MemoryDataDir::new(memory.path(), persistent.path(), &[], None, 1).unwrap();
+        let hosts_path = dir.hosts_path().to_path_buf();
+
+        // the directory for the same data directory can't be created twice
+        assert!(MemoryDataDir::new(memory.path(), persistent.path(), &[], None, 1).is_err());
+        let other =
+            MemoryDataDir::new(memory.path(), other_persistent.path(), &[], None, 1).unwrap();
+        assert_ne!(other.hosts_path(), hosts_path);
+        drop(other);
+        assert!(hosts_path.exists());
+
+        // the same path is used the next time
+        drop(dir);
+        assert!(!hosts_path.exists());
+        let dir = MemoryDataDir::new(memory.path(), persistent.path(), &[], None, 1).unwrap();
+        assert_eq!(dir.hosts_path(), hosts_path);
+    }
+
+    #[test]
+    fn test_budget() {
+        let persistent = tempfile::tempdir().unwrap();
+        let memory = tempfile::tempdir().unwrap();
+
+        assert!(
+            MemoryDataDir::new(memory.path(), persistent.path(), &[], Some(u64::MAX), 1).is_err()
+        );
+        assert!(MemoryDataDir::new(memory.path(), persistent.path(), &[], Some(1), 1).is_ok());
+    }
+}
@@ -0,0 +1,460 @@
+//! An HTTP server for the experimental `metrics_address` option, which serves live metrics of the
+//! simulation in the [OpenMetrics] text format, so that a monitoring system like Prometheus can
+//! alert when a long simulation stalls or slows down.
+//!
+//! The manager updates the metrics atomically at the end of every scheduling round, and the
+//! server's thread reads them (along with the process's memory and file descriptor usage) when a
+//! request arrives. Any `GET` request is answered with the metrics.
+//!
+//! [OpenMetrics]: https://github.com/prometheus/OpenMetrics/blob/main/specification/OpenMetrics.md
+
+use std::fmt::Write as _;
+use std::fs::File;
+use std::io::{Read, Write};
+use std::net::{SocketAddr, TcpListener, TcpStream};
+use std::os::unix::net::{UnixListener, UnixStream};
+use std::path::PathBuf;
+use std::sync::Arc;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::thread::JoinHandle;
+use std::time::{Duration, Instant};
+
+use anyhow::Context;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+
+use crate::core::resource_usage;
+use crate::core::stats_stream::ThreadRoundStats;
+
+/// How long to wait for a client to send its request.
+const REQUEST_TIMEOUT: Duration = Duration::from_secs(5);
+
+/// The largest request that we read.
+const MAX_REQUEST_LEN: usize = 8 * 1024;
+
+/// The simulation's metrics, which are updated by the manager and read by the server.
+#[derive(Debug)]
+pub struct Metrics {
+    start: Instant,
+    rounds: AtomicU64,
+    events: AtomicU64,
+    packets: AtomicU64,
+    packet_bytes: AtomicU64,
+    syscalls: AtomicU64,
+    sim_time_ns: AtomicU64,
+    worker_busy_ns: Vec<AtomicU64>,
+    worker_idle_ns: Vec<AtomicU64>,
+}
+
+impl Metrics {
+    pub fn new(num_workers: usize) -> Self {
+        let zeros = || (0..num_workers).map(|_| AtomicU64::new(0)).collect();
+        Self {
+            start: Instant::now(),
+            rounds: AtomicU64::new(0),
+            events: AtomicU64::new(0),
+            packets: AtomicU64::new(0),
+            packet_bytes: AtomicU64::new(0),
+            syscalls: AtomicU64::new(0),
+            sim_time_ns: AtomicU64::new(0),
+            worker_busy_ns: zeros(),
+            worker_idle_ns: zeros(),
+        }
+    }
+
+    /// Record a completed scheduling round that ended at simulation time `end` and took
+    /// `wall_time` to run.
+    pub fn add_round(
+        &self,
+        end: EmulatedTime,
+        wall_time: Duration,
+        threads: impl IntoIterator<Item = ThreadRoundStats>,
+    ) {
+        // the manager is the only writer, so relaxed fetch_adds are only needed for the reader to
+        // see whole values
+        let add = |counter: &AtomicU64, x: u64| counter.fetch_add(x, Ordering::Relaxed);
+
+        add(&self.rounds, 1);
+        for (i, thread) in threads.into_iter().enumerate() {
+            add(&self.events, thread.counts.events);
+            add(&self.packets, thread.counts.packets);
+            add(&self.packet_bytes, thread.counts.packet_bytes);
+            add(&self.syscalls, thread.counts.syscalls);
+            add(&self.worker_busy_ns[i], as_u64_ns(thread.busy));
+            add(
+                &self.worker_idle_ns[i],
+                as_u64_ns(wall_time.saturating_sub(thread.busy)),
+            );
+        }
+
+        let sim_time = end.saturating_duration_since(&EmulatedTime::SIMULATION_START);
+        self.sim_time_ns
+            .store(as_u64_ns(sim_time.into()), Ordering::Relaxed);
+    }
+
+    /// Write the metrics in the OpenMetrics text format.
+    fn render(&self, out: &mut String, process: &ProcessUsage) {
+        let load = |counter: &AtomicU64| counter.load(Ordering::Relaxed);
+        let secs = |ns: u64| Duration::from_nanos(ns).as_secs_f64();
+
+        let mut metric = |name: &str, kind: &str, help: &str, samples: &[(String, String)]| {
+            writeln!(out, "# TYPE {name} {kind}").unwrap();
+            writeln!(out, "# HELP {name} {help}").unwrap();
+            let suffix = if kind == "counter" { "_total" } else { "" };
+            for (labels, value) in samples {
+                writeln!(out, "{name}{suffix}{labels} {value}").unwrap();
+            }
+        };
+        let value = |x: String| vec![(String::new(), x)];
+        let per_worker = |counters: &[AtomicU64]| {
+            counters
+                .iter()
+                .enumerate()
+                .map(|(i, x)| (format!("{{worker=\"{i}\"}}"), secs(load(x)).to_string()))
+                .collect::<Vec<_>>()
+        };
+
+        metric(
+            "shadow_rounds",
+            "counter",
+            "Scheduling rounds that have finished.",
+            &value(load(&self.rounds).to_string()),
+        );
+        metric(
+            "shadow_events",
+            "counter",
+            "Events that the hosts have run.",
+            &value(load(&self.events).to_string()),
+        );
+        metric(
+            "shadow_packets",
+            "counter",
+            "Packets that have been delivered to hosts.",
+            &value(load(&self.packets).to_string()),
+        );
+        metric(
+            "shadow_packet_payload_bytes",
+            "counter",
+            "Payload bytes of the packets that have been delivered to hosts.",
+            &value(load(&self.packet_bytes).to_string()),
+        );
+        metric(
+            "shadow_syscalls",
+            "counter",
+            "Syscalls that the hosts have handled.",
+            &value(load(&self.syscalls).to_string()),
+        );
+        metric(
+            "shadow_sim_time_seconds",
+            "gauge",
+            "Simulation time at the end of the last finished round.",
+            &value(secs(load(&self.sim_time_ns)).to_string()),
+        );
+        metric(
+            "shadow_wall_time_seconds",
+            "gauge",
+            "Wall time since the simulation started.",
+            &value(self.start.elapsed().as_secs_f64().to_string()),
+        );
+        metric(
+            "shadow_worker_busy_seconds",
+            "counter",
+            "Wall time that each worker spent running hosts.",
+            &per_worker(&self.worker_busy_ns),
+        );
+        metric(
+            "shadow_worker_idle_seconds",
+            "counter",
+            "Wall time that each worker spent waiting for the other workers to finish their rounds.",
+            &per_worker(&self.worker_idle_ns),
+        );
+        if let Some(rss) = process.rss_bytes {
+            metric(
+                "shadow_resident_memory_bytes",
+                "gauge",
+                "Resident memory of the shadow process.",
+                &value(rss.to_string()),
+            );
+        }
+        if let Some(fds) = process.open_fds {
+            metric(
+                "shadow_open_fds",
+                "gauge",
+                "File descriptors open in the shadow process.",
+                &value(fds.to_string()),
+            );
+        }
+        if let Some(limit) = process.max_fds {
+            metric(
+                "shadow_max_fds",
+                "gauge",
+                "Soft limit of the file descriptors that the shadow process can open.",
+                &value(limit.to_string()),
+            );
+        }
+
+        out.push_str("# EOF\n");
+    }
+}
+
+/// The resource usage of the shadow process, read for each request. Values that couldn't be read
+/// are `None`.
+#[derive(Debug, Default)]
+struct ProcessUsage {
+    rss_bytes: Option<u64>,
+    open_fds: Option<u64>,
+    max_fds: Option<u64>,
+}
+
+impl ProcessUsage {
+    fn read(statm_file: &mut File) -> Self {
+        let open_fds = std::fs::read_dir("/proc/self/fd")
+            .ok()
+            .map(|dir| dir.count().try_into().unwrap());
+        let max_fds = nix::sys::resource::getrlimit(nix::sys::resource::Resource::RLIMIT_NOFILE)
+            .ok()
+            .map(|(soft, _)| soft);
+
+        Self {
+            rss_bytes: resource_usage::statm_rss(statm_file).ok(),
+            open_fds,
+            max_fds,
+        }
+    }
+}
+
+enum Listener {
+    Tcp(TcpListener),
+    /// The listener, and the path of its socket file.
+    Unix(UnixListener, PathBuf),
+}
+
+trait Stream: Read + Write {
+    fn set_timeout(&self, timeout: Duration) -> std::io::Result<()>;
+}
+
+impl Stream for TcpStream {
+    fn set_timeout(&self, timeout: Duration) -> std::io::Result<()> {
+        self.set_read_timeout(Some(timeout))?;
+        self.set_write_timeout(Some(timeout))
+    }
+}
+
+impl Stream for UnixStream {
+    fn set_timeout(&self, timeout: Duration) -> std::io::Result<()> {
+        self.set_read_timeout(Some(timeout))?;
+        self.set_write_timeout(Some(timeout))
+    }
+}
+
+impl Listener {
+    fn accept(&self) -> std::io::Result<Box<dyn Stream>> {
+        Ok(match self {
+            Self::Tcp(l) => Box::new(l.accept()?.0),
+            Self::Unix(l, _) => Box::new(l.accept()?.0),
+        })
+    }
+
+    /// Connect to the listener, to wake up a thread blocked in [`Listener::accept`].
+    fn wake(&self) {
+        let _ = match self {
+            Self::Tcp(l) => l.local_addr().and_then(TcpStream::connect).map(drop),
+            Self::Unix(_, path) => UnixStream::connect(path).map(drop),
+        };
+    }
+}
+
+/// Serves the [`Metrics`] from a separate thread until dropped.
+pub struct MetricsServer {
+    metrics: Arc<Metrics>,
+    listener: Arc<Listener>,
+    stop: Arc<AtomicBool>,
+    thread: Option<JoinHandle<()>>,
+}
+
+impl MetricsServer {
+    /// Start serving `metrics` at `address`, which is either a socket address like
+    /// `127.0.0.1:9100` or the path of a Unix socket.
+    pub fn new(address: &str, metrics: Metrics) -> anyhow::Result<Self> {
+        let listener = match address.parse::<SocketAddr>() {
+            Ok(addr) => Listener::Tcp(
+                TcpListener::bind(addr)
+                    .with_context(|| format!("Failed to listen for metrics requests at {addr}"))?,
+            ),
+            Err(_) => {
+                let path = PathBuf::from(address);
+                let listener = UnixListener::bind(&path).with_context(|| {
+                    format!(
+                        "Failed to listen for metrics requests at '{}'",
+                        path.display()
+                    )
+                })?;
+                Listener::Unix(listener, path)
+            }
+        };
+        let mut statm_file =
+            File::open("/proc/self/statm").context("Failed to open '/proc/self/statm'")?;
+
+        let metrics = Arc::new(metrics);
+        let listener = Arc::new(listener);
+        let stop = Arc::new(AtomicBool::new(false));
+
+        let thread = std::thread::Builder::new()
+            .name("metrics-server".into())
+            .spawn({
+                let metrics = Arc::clone(&metrics);
+                let listener = Arc::clone(&listener);
+                let stop = Arc::clone(&stop);
+                move || {
+                    let mut body = String::new();
+                    loop {
+                        let stream = listener.accept();
+                        if stop.load(Ordering::Relaxed) {
+                            break;
+                        }
+                        let res = stream.and_then(|mut stream| {
+                            body.clear();
+                            metrics.render(&mut body, &ProcessUsage::read(&mut statm_file));
+                            respond(&mut *stream, &body)
+                        });
+                        if let Err(e) = res {
+                            log::debug!("Unable to answer a metrics request: {e}");
+                        }
+                    }
+                }
+            })
+            .context("Failed to start the metrics server thread")?;
+
+        log::info!("Serving simulation metrics at {address}");
+
+        Ok(Self {
+            metrics,
+            listener,
+            stop,
+            thread: Some(thread),
+        })
+    }
+
+    pub fn metrics(&self) -> &Metrics {
+        &self.metrics
+    }
+}
+
+impl Drop for MetricsServer {
+    fn drop(&mut self) {
+        self.stop.store(true, Ordering::Relaxed);
+        self.listener.wake();
+        if let Some(thread) = self.thread.take() {
+            thread.join().unwrap();
+        }
+        if let Listener::Unix(_, path) = &*self.listener {
+            let _ = std::fs::remove_file(path);
+        }
+    }
+}
+
+/// Read an HTTP request from `stream`, and answer a `GET` request with `body`.
+fn respond(stream: &mut dyn Stream, body: &str) -> std::io::Result<()> {
+    stream.set_timeout(REQUEST_TIMEOUT)?;
+
+    let mut request = Vec::new();
+    let mut buf = [0; 1024];
+    while !request.windows(4).any(|x| x == b"\r\n\r\n") && request.len() < MAX_REQUEST_LEN {
+        let n = stream.read(&mut buf)?;
+        if n == 0 {
+            break;
+        }
+        request.extend_from_slice(&buf[..n]);
+    }
+
+    let (status, content_type, body) = if request.starts_with(b"GET ") {
+        (
+            "200 OK",
+            "application/openmetrics-text; version=1.0.0; charset=utf-8",
+            body,
+        )
+    } else {
+        ("405 Method Not Allowed", "text/plain", "")
+    };
+
+    write!(
+        stream,
+        "HTTP/1.0 {status}\r\nContent-Type: {content_type}\r\nContent-Length: {}\r\n\
+        Connection: close\r\n\r\n{body}",
+        body.len(),
+    )?;
+    stream.flush()
+}
+
+fn as_u64_ns(d: Duration) -> u64 {
+    d.as_nanos().try_into().unwrap_or(u64::MAX)
+}
+
+#[cfg(test)]
+mod tests {
+    use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+    use super::*;
+    use crate::core::stats_stream::EventCounts;
+
+    fn get(path: &std::path::Path) -> String {
+        let mut stream = UnixStream::connect(path).unwrap();
+        stream
+            .write_all(b"GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n")
+            .unwrap();
+        let mut response = String::new();
+        stream.read_to_string(&mut response).unwrap();
+        response
+    }
+
+    #[test]
+    fn test_server() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("metrics.sock");
+
+        let server = MetricsServer::new(path.to_str().unwrap(), Metrics::new(2)).unwrap();
+
+        let thread = |events, busy_ms| ThreadRoundStats {
+            counts: EventCounts {
+                events,
+                packets: 2,
+                packet_bytes: 100,
+                syscalls: 1,
+            },
+            active_hosts: 1,
+            busy: Duration::from_millis(busy_ms),
+        };
+        server.metrics().add_round(
+            EmulatedTime::SIMULATION_START + SimulationTime::from_millis(1500),
+            Duration::from_millis(5),
+            [thread(3, 5), thread(4, 2)],
+        );
+
+        let response = get(&path);
+        let (headers, body) = response.split_once("\r\n\r\n").unwrap();
+        assert!(headers.starts_with("HTTP/1.0 200 OK\r\n"));
+        assert!(headers.contains("Content-Type: application/openmetrics-text"));
+
+        let lines: Vec<&str> = body.lines().collect();
+        for expected in [
+            "shadow_rounds_total 1",
+            "shadow_events_total 7",
+            "shadow_packets_total 4",
+            "shadow_packet_payload_bytes_total 200",
+            "shadow_syscalls_total 2",
+            "shadow_sim_time_seconds 1.5",
+            "shadow_worker_busy_seconds_total{worker=\"1\"} 0.002",
+            "shadow_worker_idle_seconds_total{worker=\"0\"} 0",
+            "shadow_worker_idle_seconds_total{worker=\"1\"} 0.003",
+        ] {
+            assert!(
+                lines.contains(&expected),
+                "missing {expected:?} in:\n{body}"
+            );
+        }
+        assert_eq!(lines.last(), Some(&"# EOF"));
+
+        // the socket is removed when the server is dropped
+        drop(server);
+        assert!(!path.exists());
+    }
+}
@@ -1,13 +1,22 @@
 //! The core infrastructure needed to configure and run the simulator.
 
+pub mod cgroup;
 pub mod configuration;
 pub mod controller;
 pub mod cpu;
+pub mod event_trace;
 pub mod logger;
 pub mod manager;
+pub mod memory_data_dir;
+pub mod metrics_server;
+pub mod output_store;
+pub mod probe_cache;
+pub mod profile;
 pub mod resource_usage;
 pub mod runahead;
 pub mod sim_config;
 pub mod sim_stats;
+pub mod stats_stream;
 pub mod work;
 pub mod worker;
+pub mod worker_participation;
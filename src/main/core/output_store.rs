@@ -0,0 +1,187 @@
+//! Segment files for the output of managed processes, used when the experimental
+//! `use_output_segments` option is enabled. Instead of writing each process's stdout and stderr to
+//! its own files in its host's data directory, the output of all processes is appended to a few
+//! large segment files `output/segment-<n>.bin` in the data directory, and `output/index.tsv`
+//! names each output stream. The `shadow-extract-output` tool in shadowtools recreates the
+//! per-process files.
+//!
+//! Each worker thread appends to its own segment (through a [`BackgroundWriter`]), so that workers
+//! rarely contend on a segment. A host may run on different workers over time, so the records of
+//! one stream may be spread over several segments, and each record gives its offset within the
+//! stream.
+//!
+//! All integers are little-endian. A segment starts with a header:
+//!
+//! | bytes | field                 |
+//! |-------|-----------------------|
+//! | 8     | magic (`b"SHDWOUTS"`) |
+//! | 4     | format version (1)    |
+//! | 4     | reserved              |
+//!
+//! followed by records:
+//!
+//! | bytes | field                                  |
+//! |-------|----------------------------------------|
+//! | 4     | stream id                              |
+//! | 4     | length of the data                     |
+//! | 8     | offset of the data within the stream   |
+//! | n     | the data                               |
+//!
+//! Each line of the index is a stream id and the path (relative to the data directory) of the file
+//! that the stream would otherwise have been written to, separated by a tab.
+
+use std::fs::File;
+use std::io::Write;
+use std::path::{Path, PathBuf};
+use std::sync::Mutex;
+use std::sync::atomic::{AtomicU32, Ordering};
+
+use anyhow::Context;
+
+use crate::core::worker::Worker;
+use crate::utility::background_writer::BackgroundWriter;
+
+pub const MAGIC: &[u8; 8] = b"SHDWOUTS";
+pub const VERSION: u32 = 1;
+
+pub const RECORD_HEADER_LEN: usize = 16;
+
+/// The output segments shared by all workers.
+pub struct OutputStore {
+    /// The data directory, which the paths in the index are relative to.
+    data_path: PathBuf,
+    /// The directory that contains the hosts' data directories, which may not be in the data
+    /// directory.
+    hosts_path: PathBuf,
+    segments: Vec<Mutex<BackgroundWriter>>,
+    index: Mutex<File>,
+    next_stream_id: AtomicU32,
+}
+
+impl OutputStore {
+    /// Create the output directory in `data_path`, with one segment for each of the
+    /// `num_segments` workers. The paths of files in `hosts_path` are given in the index as if
+    /// they were in `<data_path>/hosts`.
+    pub fn new(data_path: &Path, hosts_path: &Path, num_segments: usize) -> anyhow::Result<Self> {
+        let dir = data_path.join("output");
+        std::fs::create_dir(&dir)
+            .with_context(|| format!("Failed to create directory '{}'", dir.display()))?;
+
+        let segments = (0..num_segments.max(1))
+            .map(|i| {
+                let filename = dir.join(format!("segment-{i}.bin"));
+                let file = File::create(&filename)
+                    .with_context(|| format!("Failed to create file '{}'", filename.display()))?;
+
+                let mut writer = BackgroundWriter::new(file);
+                writer.write_all(MAGIC)?;
+                writer.write_all(&VERSION.to_le_bytes())?;
+                writer.write_all(&0u32.to_le_bytes())?;
+                Ok(Mutex::new(writer))
+            })
+            .collect::<anyhow::Result<_>>()?;
+
+        let filename = dir.join("index.tsv");
+        let index = File::create(&filename)
+            .with_context(|| format!("Failed to create file '{}'", filename.display()))?;
+
+        Ok(Self {
+            data_path: data_path.to_path_buf(),
+            hosts_path: hosts_path.to_path_buf(),
+            segments,
+            index: Mutex::new(index),
+            next_stream_id: AtomicU32::new(0),
+        })
+    }
+
+    /// Add a stream for the output that would otherwise have been written to `path`, and return
+    /// its id.
+    pub fn add_stream(&self, path: &Path) -> std::io::Result<u32> {
+        let id = self.next_stream_id.fetch_add(1, Ordering::Relaxed);
+        let path = match path.strip_prefix(&self.hosts_path) {
+            Ok(rel) => Path::new("hosts").join(rel),
+            Err(_) => path
+                .strip_prefix(&self.data_path)
+                .unwrap_or(path)
+                .to_path_buf(),
+        };
+
+        // the index is small, so it's written directly
+        let line = format!("{id}\t{}\n", path.display());
+        self.index.lock().unwrap().write_all(line.as_bytes())?;
+        Ok(id)
+    }
+
+    /// Append `data` at `offset` of `stream` to the current worker's segment.
+    pub fn write(&self, stream: u32, offset: u64, data: &[u8]) -> std::io::Result<()> {
+        if data.is_empty() {
+            return Ok(());
+        }
+
+        let worker = Worker::worker_id().map_or(0, |id| usize::try_from(id.0).unwrap());
+        let mut segment = self.segments[worker % self.segments.len()].lock().unwrap();
+
+        // records are limited to `u32::MAX` bytes
+        let mut offset = offset;
+        for chunk in data.chunks(u32::MAX as usize) {
+            let mut header = [0u8; RECORD_HEADER_LEN];
+            header[0..4].copy_from_slice(&stream.to_le_bytes());
+            header[4..8].copy_from_slice(&u32::try_from(chunk.len()).unwrap().to_le_bytes());
+            header[8..16].copy_from_slice(&offset.to_le_bytes());
+            segment.write_all(&header)?;
+            segment.write_all(chunk)?;
+            offset += u64::try_from(chunk.len()).unwrap();
+        }
+
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_store() {
+        let dir = tempfile::tempdir().unwrap();
+        let store = OutputStore::new(dir.path(), &dir.path().join("hosts"), 2).unwrap();
+
+        let stdout = store
+            .add_stream(&dir.path().join("hosts/server/echo.1000.stdout"))
+            .unwrap();
+        let stderr = store
+            .add_stream(&dir.path().join("hosts/server/echo.1000.stderr"))
+            .unwrap();
+        assert_ne!(stdout, stderr);
+
+        store.write(stdout, 0, b"hello ").unwrap();
+        store.write(stderr, 0, b"").unwrap();
+        store.write(stdout, 6, b"world").unwrap();
+        drop(store);
+
+        let index = std::fs::read_to_string(dir.path().join("output/index.tsv")).unwrap();
+        assert_eq!(
+            index,
+            format!(
+                "{stdout}\thosts/server/echo.1000.stdout\n{stderr}\thosts/server/echo.1000.stderr\n"
+            )
+        );
+
+        // not running on a worker, so everything was written to the first segment
+        let bytes = std::fs::read(dir.path().join("output/segment-0.bin")).unwrap();
+        assert_eq!(&bytes[..8], MAGIC);
+        assert_eq!(&bytes[8..12], &VERSION.to_le_bytes());
+
+        let mut expected = vec![];
+        for (offset, data) in [(0u64, &b"hello "[..]), (6, &b"world"[..])] {
+            expected.extend_from_slice(&stdout.to_le_bytes());
+            expected.extend_from_slice(&u32::try_from(data.len()).unwrap().to_le_bytes());
+            expected.extend_from_slice(&offset.to_le_bytes());
+            expected.extend_from_slice(data);
+        }
+        assert_eq!(&bytes[16..], &expected[..]);
+
+        let bytes = std::fs::read(dir.path().join("output/segment-1.bin")).unwrap();
+        assert_eq!(bytes.len(), 16);
+    }
+}
@@ -0,0 +1,271 @@
+//! A cache of the results of the probes that shadow runs at startup (the CPU and TSC frequencies
+//! and the paths of the preload libraries), used when the experimental `use_startup_probe_cache`
+//! option is enabled. The cache is kept in `$XDG_CACHE_HOME/shadow/startup-probes.json` (or
+//! `~/.cache/shadow/startup-probes.json`), and is only used while the shadow binary, the kernel,
+//! and the CPU are the same as when it was written.
+
+use std::collections::BTreeMap;
+use std::os::unix::fs::MetadataExt;
+use std::path::{Path, PathBuf};
+
+use serde::de::DeserializeOwned;
+use serde::{Deserialize, Serialize};
+
+/// Bump when the meaning of a cached value changes.
+const VERSION: u32 = 1;
+
+/// What the cached values depend on.
+#[derive(Debug, Clone, PartialEq, Eq, Serialize, Deserialize)]
+struct ProbeKey {
+    exe: PathBuf,
+    exe_dev: u64,
+    exe_ino: u64,
+    exe_len: u64,
+    exe_mtime_ns: i64,
+    kernel_release: String,
+    /// The CPU's vendor string and its signature (family, model, and stepping; from cpuid leaves 0
+    /// and 1).
+    cpu: Vec<u32>,
+}
+
+impl ProbeKey {
+    fn current() -> std::io::Result<Self> {
+        let exe = std::fs::read_link("/proc/self/exe")?;
+        let meta = std::fs::metadata(&exe)?;
+        let kernel_release = nix::sys::utsname::uname()?
+            .release()
+            .to_string_lossy()
+            .into_owned();
+
+        Ok(Self {
+            exe,
+            exe_dev: meta.dev(),
+            exe_ino: meta.ino(),
+            exe_len: meta.len(),
+            exe_mtime_ns: meta.mtime() * 1_000_000_000 + meta.mtime_nsec(),
+            kernel_release,
+            cpu: cpu_signature(),
+        })
+    }
+}
+
+#[cfg(target_arch = "x86_64")]
+fn cpu_signature() -> Vec<u32> {
+    // SAFETY: cpuid is always available on x86-64
+    let (vendor, signature) =
+        unsafe { (std::arch::x86_64::__cpuid(0), std::arch::x86_64::__cpuid(1)) };
+    vec![vendor.ebx, vendor.edx, vendor.ecx, signature.eax]
+}
+
+#[cfg(not(target_arch = "x86_64"))]
+fn cpu_signature() -> Vec<u32> {
+    Vec::new()
+}
+
+#[derive(Debug, Serialize, Deserialize)]
+struct CacheFile {
+    version: u32,
+    key: ProbeKey,
+    values: BTreeMap<String, serde_json::Value>,
+}
+
+enum State {
+    Disabled,
+    Enabled {
+        path: PathBuf,
+        key: ProbeKey,
+        values: BTreeMap<String, serde_json::Value>,
+        modified: bool,
+    },
+}
+
+pub struct ProbeCache {
+    state: State,
+}
+
+impl ProbeCache {
+    /// A cache that never has any values, so that every probe is run.
+    pub fn disabled() -> Self {
+        Self {
+            state: State::Disabled,
+        }
+    }
+
+    /// The default location of the cache file, or `None` if there's no cache or home directory.
+    pub fn default_path() -> Option<PathBuf> {
+        let dir = match std::env::var_os("XDG_CACHE_HOME") {
+            Some(dir) if Path::new(&dir).is_absolute() => PathBuf::from(dir),
+            _ => PathBuf::from(std::env::var_os("HOME")?).join(".cache"),
+        };
+        Some(dir.join("shadow").join("startup-probes.json"))
+    }
+
+    /// Load the cache at `path`. The cache is empty if the file doesn't exist or was written for a
+    /// different binary or system. Errors disable the cache rather than failing shadow's startup.
+    pub fn load(path: &Path) -> Self {
+        let key = match ProbeKey::current() {
+            Ok(key) => key,
+            Err(e) => {
+                log::debug!("Not using the startup probe cache: {e}");
+                return Self::disabled();
+            }
+        };
+
+        let values = match std::fs::read(path) {
+            Ok(bytes) => match serde_json::from_slice::<CacheFile>(&bytes) {
+                Ok(file) if file.version == VERSION && file.key == key => file.values,
+                Ok(_) => {
+                    log::debug!("The startup probe cache at {} is outdated", path.display());
+                    BTreeMap::new()
+                }
+                Err(e) => {
+                    log::debug!(
+                        "Ignoring the startup probe cache at {}: {e}",
+                        path.display()
+                    );
+                    BTreeMap::new()
+                }
+            },
+            Err(e) if e.kind() == std::io::ErrorKind::NotFound => BTreeMap::new(),
+            Err(e) => {
+                log::debug!("Unable to read the startup probe cache: {e}");
+                BTreeMap::new()
+            }
+        };
+
+        Self {
+            state: State::Enabled {
+                path: path.to_path_buf(),
+                key,
+                values,
+                modified: false,
+            },
+        }
+    }
+
+    /// The cached result of the probe `name`, if any.
+    pub fn get<T: DeserializeOwned>(&self, name: &str) -> Option<T> {
+        let State::Enabled { values, .. } = &self.state else {
+            return None;
+        };
+        let value = values.get(name)?;
+        serde_json::from_value(value.clone()).ok()
+    }
+
+    /// Cache the result of the probe `name`.
+    pub fn insert<T: Serialize>(&mut self, name: &str, value: &T) {
+        let State::Enabled {
+            values, modified, ..
+        } = &mut self.state
+        else {
+            return;
+        };
+        let value = serde_json::to_value(value).unwrap();
+        if values.get(name) != Some(&value) {
+            values.insert(name.to_string(), value);
+            *modified = true;
+        }
+    }
+
+    /// Return the cached result of the probe `name`, or run and cache the probe.
+    pub fn get_or_probe<T: Serialize + DeserializeOwned>(
+        &mut self,
+        name: &str,
+        probe: impl FnOnce() -> T,
+    ) -> T {
+        if let Some(value) = self.get(name) {
+            log::debug!("Using the cached result of startup probe '{name}'");
+            return value;
+        }
+        let value = probe();
+        self.insert(name, &value);
+        value
+    }
+
+    /// Write the cache back to its file if any value changed. The file is replaced atomically,
+    /// since concurrent shadow runs may share it.
+    pub fn save(&self) {
+        let State::Enabled {
+            path,
+            key,
+            values,
+            modified,
+        } = &self.state
+        else {
+            return;
+        };
+        if !modified {
+            return;
+        }
+
+        let file = CacheFile {
+            version: VERSION,
+            key: key.clone(),
+            values: values.clone(),
+        };
+        let tmp_path = path.with_extension(format!("json.{}", std::process::id()));
+        let res = (|| {
+            std::fs::create_dir_all(path.parent().unwrap())?;
+            std::fs::write(&tmp_path, serde_json::to_vec_pretty(&file)?)?;
+            std::fs::rename(&tmp_path, path)
+        })();
+
+        if let Err(e) = res {
+            log::debug!("Unable to write the startup probe cache: {e}");
+            let _ = std::fs::remove_file(&tmp_path);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_cache() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("shadow/startup-probes.json");
+
+        let mut cache = ProbeCache::load(&path);
+        assert_eq!(cache.get::<u64>("freq"), None);
+        assert_eq!(cache.get_or_probe("freq", || Some(5u64)), Some(5));
+        assert_eq!(cache.get_or_probe::<Option<u64>>("tsc", || None), None);
+        cache.save();
+
+        let mut cache = ProbeCache::load(&path);
+        assert_eq!(cache.get::<Option<u64>>("freq"), Some(Some(5)));
+        // a cached failure
+        assert_eq!(cache.get::<Option<u64>>("tsc"), Some(None));
+        assert_eq!(
+            cache.get_or_probe("freq", || -> Option<u64> { unreachable!() }),
+            Some(5)
+        );
+    }
+
+    #[test]
+    fn test_outdated() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("startup-probes.json");
+
+        let mut cache = ProbeCache::load(&path);
+        cache.insert("freq", &5u64);
+        cache.save();
+
+        // written by a different binary
+        let mut file: CacheFile = serde_json::from_slice(&std::fs::read(&path).unwrap()).unwrap();
+        file.key.exe_len += 1;
+        std::fs::write(&path, serde_json::to_vec(&file).unwrap()).unwrap();
+        assert_eq!(ProbeCache::load(&path).get::<u64>("freq"), None);
+
+        std::fs::write(&path, b"not json").unwrap();
+        assert_eq!(ProbeCache::load(&path).get::<u64>("freq"), None);
+    }
+
+    #[test]
+    fn test_disabled() {
+        let mut cache = ProbeCache::disabled();
+        cache.insert("freq", &5u64);
+        assert_eq!(cache.get::<u64>("freq"), None);
+        cache.save();
+    }
+}
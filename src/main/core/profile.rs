@@ -0,0 +1,396 @@
+//! Wall time profiles of the simulation, recorded when the experimental `use_profiling` option is
+//! enabled and written to `profile.json` in the data directory.
+//!
+//! Each host records where its execution time went (see [`HostProfiler`]), and each syscall
+//! handler records how long it took to handle each syscall (see [`SyscallLatencies`]).
+
+use std::collections::BTreeMap;
+use std::time::Duration;
+
+use anyhow::Context;
+use linux_api::posix_types::Pid;
+use serde::Serialize;
+
+use crate::core::sim_stats::{SYSCALL_COUNTER_OVERFLOW_KEY, SharedSimStats, syscall_counter_name};
+use crate::utility::perf_timer::PerfTimer;
+
+/// The number of buckets in a latency histogram. Bucket `i > 0` counts latencies in
+/// `[2^(i-1), 2^i)` nanoseconds, except that the last bucket also counts all longer latencies.
+const NUM_LATENCY_BUCKETS: usize = 40;
+
+/// Records the execution time of a host.
+#[derive(Debug)]
+pub struct HostProfiler {
+    execution_timer: PerfTimer,
+    plugin: Duration,
+    ipc_wait: Duration,
+    ipc_round_trips: u64,
+    /// The time that Shadow waited for each managed process in the current run (see
+    /// [`Self::end_run`]).
+    run_waits: Vec<(Pid, Duration)>,
+    /// The sum over the host's runs of the longest time that Shadow waited for one process.
+    process_critical_path: Duration,
+    /// The number of runs in which Shadow waited for more than one process.
+    multi_process_runs: u64,
+}
+
+impl HostProfiler {
+    pub fn new() -> Self {
+        Self {
+            execution_timer: PerfTimer::new_stopped(),
+            plugin: Duration::ZERO,
+            ipc_wait: Duration::ZERO,
+            ipc_round_trips: 0,
+            run_waits: Vec::new(),
+            process_critical_path: Duration::ZERO,
+            multi_process_runs: 0,
+        }
+    }
+
+    /// Start timing the host's execution, which must not already be timed.
+    pub fn start(&mut self) {
+        self.execution_timer.start();
+    }
+
+    /// Stop timing the host's execution, which must already be timed.
+    pub fn stop(&mut self) {
+        self.execution_timer.stop();
+    }
+
+    /// End a run of the host, in which it runs all of its events for a scheduling round. The
+    /// host's execution is timed for each event, so a run is usually timed several times.
+    pub fn end_run(&mut self) {
+        // if the processes had run in parallel, the run would have waited for the slowest process
+        let slowest = self.run_waits.iter().map(|(_, wait)| *wait).max();
+        self.process_critical_path += slowest.unwrap_or(Duration::ZERO);
+        if self.run_waits.len() > 1 {
+            self.multi_process_runs += 1;
+        }
+        self.run_waits.clear();
+    }
+
+    /// Record that Shadow waited `wall_time` for the managed process `pid` to return control, and
+    /// that the managed process used `cpu_time` of CPU time in the meantime.
+    pub fn add_round_trip(&mut self, pid: Pid, wall_time: Duration, cpu_time: Duration) {
+        let plugin = std::cmp::min(cpu_time, wall_time);
+        self.plugin += plugin;
+        self.ipc_wait += wall_time - plugin;
+        self.ipc_round_trips += 1;
+
+        // hosts usually have few processes
+        match self.run_waits.iter_mut().find(|(x, _)| *x == pid) {
+            Some((_, wait)) => *wait += wall_time,
+            None => self.run_waits.push((pid, wall_time)),
+        }
+    }
+
+    pub fn profile(&self) -> HostProfile {
+        let total = self.execution_timer.elapsed();
+        let shadow = total.saturating_sub(self.plugin + self.ipc_wait);
+        HostProfile {
+            shadow_ns: duration_to_ns(shadow),
+            plugin_ns: duration_to_ns(self.plugin),
+            ipc_wait_ns: duration_to_ns(self.ipc_wait),
+            ipc_round_trips: self.ipc_round_trips,
+            process_critical_path_ns: duration_to_ns(self.process_critical_path),
+            multi_process_runs: self.multi_process_runs,
+            // counted by the host
+            worker_migrations: 0,
+            native_preemptions: 0,
+            cgroup_cpu_ns: None,
+        }
+    }
+}
+
+impl Default for HostProfiler {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// Where a host's execution time went.
+#[derive(Debug, Clone, Serialize)]
+pub struct HostProfile {
+    /// Time spent in Shadow.
+    pub shadow_ns: u64,
+    /// CPU time used by the managed processes while Shadow was waiting for them.
+    pub plugin_ns: u64,
+    /// The rest of the time that Shadow was waiting for the managed processes.
+    pub ipc_wait_ns: u64,
+    /// The number of times that Shadow waited for a managed process.
+    pub ipc_round_trips: u64,
+    /// The time that Shadow would have waited for the managed processes if the processes that ran
+    /// in the same run of the host had run in parallel, which is the sum over the runs of the
+    /// longest time that Shadow waited for any one process. Compared with `plugin_ns +
+    /// ipc_wait_ns`, this bounds how much running a host's processes in parallel could save.
+    pub process_critical_path_ns: u64,
+    /// The number of runs of the host in which Shadow waited for more than one process.
+    pub multi_process_runs: u64,
+    /// The number of times that the host was run by a different worker thread than the previous
+    /// time, which moves its managed threads to a different CPU if CPU pinning is enabled.
+    pub worker_migrations: u64,
+    /// The number of times that managed code was natively preempted.
+    pub native_preemptions: u64,
+    /// The CPU time used by the managed processes according to the host's cgroup, if cgroup
+    /// isolation is enabled. Unlike `plugin_ns`, this includes time spent running while Shadow
+    /// wasn't waiting for them.
+    pub cgroup_cpu_ns: Option<u64>,
+}
+
+#[derive(Debug, Clone, Copy)]
+struct LatencyHistogram {
+    count: u64,
+    total_ns: u64,
+    buckets: [u64; NUM_LATENCY_BUCKETS],
+}
+
+impl LatencyHistogram {
+    const EMPTY: Self = Self {
+        count: 0,
+        total_ns: 0,
+        buckets: [0; NUM_LATENCY_BUCKETS],
+    };
+
+    fn add(&mut self, latency: Duration) {
+        let ns = duration_to_ns(latency);
+        let bucket = std::cmp::min(
+            (u64::BITS - ns.leading_zeros()) as usize,
+            NUM_LATENCY_BUCKETS - 1,
+        );
+        self.count += 1;
+        self.total_ns = self.total_ns.saturating_add(ns);
+        self.buckets[bucket] += 1;
+    }
+
+    fn add_histogram(&mut self, other: &Self) {
+        self.count += other.count;
+        self.total_ns = self.total_ns.saturating_add(other.total_ns);
+        for (bucket, other) in self.buckets.iter_mut().zip(&other.buckets) {
+            *bucket += other;
+        }
+    }
+}
+
+/// Histograms of syscall handler latencies, indexed by syscall number.
+#[derive(Debug, Clone, Default)]
+pub struct SyscallLatencies {
+    histograms: Vec<LatencyHistogram>,
+}
+
+impl SyscallLatencies {
+    pub const fn new() -> Self {
+        Self {
+            histograms: Vec::new(),
+        }
+    }
+
+    /// Record that handling syscall number `syscall` took `latency`. Syscall numbers that are
+    /// too large share the histogram at [`SYSCALL_COUNTER_OVERFLOW_KEY`], so that arbitrary
+    /// numbers from a plugin can't grow the array without bound.
+    pub fn add(&mut self, syscall: usize, latency: Duration) {
+        let syscall = syscall.min(SYSCALL_COUNTER_OVERFLOW_KEY);
+        if syscall >= self.histograms.len() {
+            self.histograms.resize(syscall + 1, LatencyHistogram::EMPTY);
+        }
+        self.histograms[syscall].add(latency);
+    }
+
+    /// Add all latencies in `other`.
+    pub fn add_latencies(&mut self, other: &Self) {
+        if other.histograms.len() > self.histograms.len() {
+            self.histograms
+                .resize(other.histograms.len(), LatencyHistogram::EMPTY);
+        }
+        for (histogram, other) in self.histograms.iter_mut().zip(&other.histograms) {
+            histogram.add_histogram(other);
+        }
+    }
+
+    /// The histograms by syscall name. Syscalls with the same name are combined.
+    pub fn by_name(&self) -> BTreeMap<&'static str, SyscallLatenciesForOutput> {
+        let mut combined = BTreeMap::<_, LatencyHistogram>::new();
+        for (num, histogram) in self.histograms.iter().enumerate() {
+            if histogram.count == 0 {
+                continue;
+            }
+            combined
+                .entry(syscall_counter_name(num))
+                .or_insert(LatencyHistogram::EMPTY)
+                .add_histogram(histogram);
+        }
+
+        combined
+            .into_iter()
+            .map(|(name, histogram)| (name, SyscallLatenciesForOutput::new(&histogram)))
+            .collect()
+    }
+}
+
+fn duration_to_ns(d: Duration) -> u64 {
+    d.as_nanos().try_into().unwrap_or(u64::MAX)
+}
+
+/// A latency histogram in the format to be output.
+#[derive(Serialize, Debug, Clone)]
+pub struct SyscallLatenciesForOutput {
+    count: u64,
+    total_ns: u64,
+    /// The non-empty buckets.
+    histogram: Vec<LatencyBucketForOutput>,
+}
+
+impl SyscallLatenciesForOutput {
+    fn new(histogram: &LatencyHistogram) -> Self {
+        Self {
+            count: histogram.count,
+            total_ns: histogram.total_ns,
+            histogram: histogram
+                .buckets
+                .iter()
+                .enumerate()
+                .filter(|(_, count)| **count != 0)
+                .map(|(i, count)| LatencyBucketForOutput {
+                    min_ns: if i == 0 { 0 } else { 1 << (i - 1) },
+                    count: *count,
+                })
+                .collect(),
+        }
+    }
+}
+
+#[derive(Serialize, Debug, Clone)]
+struct LatencyBucketForOutput {
+    /// The smallest latency counted by this bucket. Each bucket counts latencies up to the next
+    /// power of 2.
+    min_ns: u64,
+    count: u64,
+}
+
+/// The profile in the format to be output.
+#[derive(Serialize, Debug)]
+struct ProfileForOutput<'a> {
+    hosts: &'a BTreeMap<String, HostProfile>,
+    syscalls: BTreeMap<&'static str, SyscallLatenciesForOutput>,
+}
+
+pub fn write_profile_to_file(
+    filename: &std::path::Path,
+    stats: &SharedSimStats,
+) -> anyhow::Result<()> {
+    let hosts = stats.host_profiles.lock().unwrap();
+    let profile = ProfileForOutput {
+        hosts: &hosts,
+        syscalls: stats.syscall_latencies.lock().unwrap().by_name(),
+    };
+
+    let file = std::fs::File::create(filename)
+        .with_context(|| format!("Failed to create file '{}'", filename.display()))?;
+
+    serde_json::to_writer_pretty(file, &profile).with_context(|| {
+        format!(
+            "Failed to write profile json to file '{}'",
+            filename.display()
+        )
+    })?;
+
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_host_profiler() {
+        let pid = Pid::from_raw(1000).unwrap();
+        let mut profiler = HostProfiler::new();
+        profiler.start();
+        std::thread::sleep(Duration::from_millis(10));
+        profiler.add_round_trip(pid, Duration::from_millis(4), Duration::from_millis(1));
+        // the process can't have used more CPU time than the round trip took
+        profiler.add_round_trip(pid, Duration::from_millis(2), Duration::from_millis(3));
+        profiler.stop();
+        profiler.end_run();
+
+        let profile = profiler.profile();
+        assert_eq!(profile.plugin_ns, 3_000_000);
+        assert_eq!(profile.ipc_wait_ns, 3_000_000);
+        assert_eq!(profile.ipc_round_trips, 2);
+        assert!(profile.shadow_ns >= 4_000_000);
+        assert_eq!(profile.process_critical_path_ns, 6_000_000);
+        assert_eq!(profile.multi_process_runs, 0);
+    }
+
+    #[test]
+    fn test_process_critical_path() {
+        let pids = [1000, 1001, 1002].map(|x| Pid::from_raw(x).unwrap());
+        let ms = Duration::from_millis;
+        let mut profiler = HostProfiler::new();
+
+        // only the slowest process of each run counts, including processes that ran in different
+        // events of the run
+        profiler.start();
+        profiler.add_round_trip(pids[0], ms(1), ms(0));
+        profiler.add_round_trip(pids[1], ms(2), ms(0));
+        profiler.stop();
+        profiler.start();
+        profiler.add_round_trip(pids[0], ms(2), ms(0));
+        profiler.add_round_trip(pids[2], ms(1), ms(0));
+        profiler.stop();
+        profiler.end_run();
+
+        profiler.start();
+        profiler.add_round_trip(pids[1], ms(5), ms(0));
+        profiler.stop();
+        profiler.end_run();
+
+        // a run without processes
+        profiler.start();
+        profiler.stop();
+        profiler.end_run();
+
+        let profile = profiler.profile();
+        assert_eq!(profile.ipc_wait_ns, 11_000_000);
+        assert_eq!(profile.process_critical_path_ns, 8_000_000);
+        assert_eq!(profile.multi_process_runs, 1);
+    }
+
+    #[test]
+    fn test_syscall_latencies() {
+        let mut latencies = SyscallLatencies::new();
+        latencies.add(0, Duration::from_nanos(0));
+        latencies.add(0, Duration::from_nanos(1000));
+        latencies.add(0, Duration::from_nanos(1023));
+
+        let mut other = SyscallLatencies::new();
+        other.add(1, Duration::from_nanos(5));
+        other.add(0, Duration::from_secs(10_000));
+        latencies.add_latencies(&other);
+
+        let by_name = latencies.by_name();
+        let read = &by_name["read"];
+        assert_eq!(read.count, 4);
+        let buckets: Vec<_> = read.histogram.iter().map(|b| (b.min_ns, b.count)).collect();
+        assert_eq!(
+            buckets,
+            [(0, 1), (512, 2), (1 << (NUM_LATENCY_BUCKETS - 2), 1)]
+        );
+
+        let write = &by_name["write"];
+        assert_eq!(write.count, 1);
+        assert_eq!(write.total_ns, 5);
+    }
+
+    #[test]
+    fn test_syscall_latencies_overflow() {
+        let mut latencies = SyscallLatencies::new();
+        latencies.add(usize::MAX, Duration::from_nanos(1));
+        latencies.add(0x4000_0000, Duration::from_nanos(2));
+        assert_eq!(latencies.histograms.len(), SYSCALL_COUNTER_OVERFLOW_KEY + 1);
+
+        let by_name = latencies.by_name();
+        let unknown = &by_name["unknown-syscall"];
+        assert_eq!(unknown.count, 2);
+        assert_eq!(unknown.total_ns, 3);
+    }
+}
@@ -66,6 +66,69 @@ pub fn meminfo(file: &mut File) -> std::io::Result<MemInfo> {
     Ok(mem)
 }
 
+/// The resident set size in bytes, parsed from a '/proc/<pid>/statm' file. This function will seek
+/// to the start of the file before reading.
+pub fn statm_rss(file: &mut File) -> std::io::Result<u64> {
+    let mut buffer = String::new();
+    file.rewind()?;
+    file.read_to_string(&mut buffer)?;
+
+    // the second field is the resident set size in pages
+    let pages: u64 = buffer
+        .split_whitespace()
+        .nth(1)
+        .and_then(|x| x.parse().ok())
+        .ok_or_else(|| std::io::Error::other("Unexpected format of statm file"))?;
+
+    let page_size = u64::try_from(unsafe { libc::sysconf(libc::_SC_PAGESIZE) }).unwrap();
+
+    Ok(pages * page_size)
+}
+
+/// The memory used by a host, in bytes.
+#[derive(Copy, Clone, Debug, Default, Serialize)]
+pub struct HostMemoryUsage {
+    /// The resident set size of the host's managed processes. Pages shared between processes (for
+    /// example with a zygote) are counted once for each process.
+    pub managed_rss: u64,
+    /// An estimate of the memory used by the host's queued events, not including any memory that
+    /// the events point to.
+    pub event_queue: u64,
+    /// The data in the send and receive buffers of the host's sockets.
+    pub socket_buffers: u64,
+    /// The memory that autotuning grew the host's socket buffers by, which counts against the
+    /// host's socket buffer budget. These are buffer sizes rather than data, so they're an upper
+    /// bound and aren't included in [`HostMemoryUsage::shadow`].
+    pub socket_buffer_budget: u64,
+    /// The packets queued in the host's upstream router.
+    pub router_queue: u64,
+    /// The host's in-memory pcap rings.
+    pub pcap_rings: u64,
+}
+
+impl std::ops::AddAssign for HostMemoryUsage {
+    fn add_assign(&mut self, other: Self) {
+        self.managed_rss += other.managed_rss;
+        self.event_queue += other.event_queue;
+        self.socket_buffers += other.socket_buffers;
+        self.socket_buffer_budget += other.socket_buffer_budget;
+        self.router_queue += other.router_queue;
+        self.pcap_rings += other.pcap_rings;
+    }
+}
+
+impl HostMemoryUsage {
+    /// The total of the managed process and Shadow memory.
+    pub fn total(&self) -> u64 {
+        self.managed_rss + self.shadow()
+    }
+
+    /// The memory used by Shadow for the host.
+    pub fn shadow(&self) -> u64 {
+        self.event_queue + self.socket_buffers + self.router_queue + self.pcap_rings
+    }
+}
+
 /// Returns `None` if either the `unit` wasn't known, or the base unit is too large.
 fn as_base_unit(val: u64, unit: Option<&str>) -> Option<u64> {
     let mul = match unit {
@@ -77,3 +140,34 @@ fn as_base_unit(val: u64, unit: Option<&str>) -> Option<u64> {
 
     val.checked_mul(mul)
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_statm_rss() {
+        let mut file = File::open("/proc/self/statm").unwrap();
+        let rss = statm_rss(&mut file).unwrap();
+        assert!(rss > 0);
+        // reading again should seek back to the start
+        assert!(statm_rss(&mut file).unwrap() > 0);
+    }
+
+    #[test]
+    fn test_host_memory_usage() {
+        let mut usage = HostMemoryUsage {
+            managed_rss: 100,
+            event_queue: 1,
+            socket_buffers: 2,
+            socket_buffer_budget: 1000,
+            router_queue: 3,
+            pcap_rings: 4,
+        };
+        assert_eq!(usage.shadow(), 10);
+        assert_eq!(usage.total(), 110);
+
+        usage += usage;
+        assert_eq!(usage.total(), 220);
+    }
+}
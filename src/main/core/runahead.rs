@@ -1,7 +1,12 @@
-use std::sync::RwLock;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicU64, Ordering};
 
+use shadow_shim_helper_rs::HostId;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
+use crate::network::graph::RoutingInfo;
+
 /// Decides on the runahead for the next simulation round (the duration of the round).
 ///
 /// Having a larger runahead improves performance since more hosts and more events can be run in
@@ -12,48 +17,112 @@ use shadow_shim_helper_rs::simulation_time::SimulationTime;
 /// static lower bound.
 #[derive(Debug)]
 pub struct Runahead {
-    /// The lowest packet latency that shadow has used so far in the simulation. For performance, is
-    /// only updated if dynamic runahead is enabled for the simulation.
-    min_used_latency: RwLock<Option<SimulationTime>>,
+    /// The lowest packet latency in nanoseconds that shadow has used so far in the simulation, or
+    /// [`u64::MAX`] if none has been used. For performance, is only updated if dynamic runahead is
+    /// enabled for the simulation.
+    min_used_latency_ns: AtomicU64,
     /// The lowest latency that's possible in the simulation (the graph edge with the lowest
-    /// latency).
-    min_possible_latency: SimulationTime,
+    /// latency) from each time on, in time order. The first entry is at the start of the
+    /// simulation, and there are more if the network graph changes during the simulation.
+    min_possible_latency: Vec<(EmulatedTime, SimulationTime)>,
     /// A lower bound for the runahead as specified by the user.
     min_runahead_config: Option<SimulationTime>,
     /// Is dynamic runahead enabled?
     is_runahead_dynamic: bool,
+    /// The end of the bootstrapping period and a lower bound for the runahead until then, if the
+    /// user set one.
+    bootstrap: Option<(EmulatedTime, SimulationTime)>,
 }
 
 impl Runahead {
+    /// `latency_changes` are the times at which the lowest possible latency changes and the new
+    /// lowest latency, in time order. `bootstrap_runahead` is the end of the bootstrapping period
+    /// and the runahead to use until then.
     pub fn new(
         is_runahead_dynamic: bool,
         min_possible_latency: SimulationTime,
+        latency_changes: impl IntoIterator<Item = (EmulatedTime, SimulationTime)>,
         min_runahead_config: Option<SimulationTime>,
+        bootstrap_runahead: Option<(EmulatedTime, SimulationTime)>,
     ) -> Self {
-        assert!(!min_possible_latency.is_zero());
+        let min_possible_latency: Vec<_> = [(EmulatedTime::SIMULATION_START, min_possible_latency)]
+            .into_iter()
+            .chain(latency_changes)
+            .collect();
+        assert!(min_possible_latency.iter().all(|(_, x)| !x.is_zero()));
+        assert!(min_possible_latency.is_sorted_by_key(|(time, _)| *time));
 
         Self {
-            min_used_latency: RwLock::new(None),
+            min_used_latency_ns: AtomicU64::new(u64::MAX),
             min_possible_latency,
             min_runahead_config,
             is_runahead_dynamic,
+            bootstrap: bootstrap_runahead,
+        }
+    }
+
+    /// The longest round starting at `start` in which no packet can be sent and arrive within the
+    /// same round, given a lowest latency of `latency` (or otherwise the lowest possible latency)
+    /// at the start of the round, and the lowest possible latency after each later change.
+    fn round_latency(
+        &self,
+        start: EmulatedTime,
+        latency: Option<SimulationTime>,
+    ) -> SimulationTime {
+        let changes = &self.min_possible_latency;
+        let current = changes.partition_point(|(time, _)| *time <= start);
+        let mut latency = latency.unwrap_or(changes[current.saturating_sub(1)].1);
+
+        // a packet sent after a later change must still arrive after the end of the round
+        for (time, change_latency) in &changes[current..] {
+            let since_start = *time - start;
+            if since_start >= latency {
+                break;
+            }
+            latency = std::cmp::min(latency, since_start + *change_latency);
         }
+
+        latency
     }
 
-    /// Get the runahead for the next round.
-    pub fn get(&self) -> SimulationTime {
+    /// Get the runahead for the next round, which starts at `start`.
+    pub fn get(&self, start: EmulatedTime) -> SimulationTime {
         // If the 'min_used_latency' is None, we haven't yet been given a latency value to base our
         // runahead off of (or dynamic runahead is disabled). We use the smallest possible latency
-        // to start.
-        let runahead = self
-            .min_used_latency
-            .read()
-            .unwrap()
-            .unwrap_or(self.min_possible_latency);
+        // to start. Either is bounded by latency decreases later in the round if the network graph
+        // changes.
+        let runahead = self.round_latency(start, self.min_used_latency());
 
         // the 'runahead' config option sets a lower bound for the runahead
         let runahead_config = self.min_runahead_config.unwrap_or(SimulationTime::ZERO);
-        std::cmp::max(runahead, runahead_config)
+        let runahead = std::cmp::max(runahead, runahead_config);
+
+        // while bootstrapping, the bootstrap runahead is also a lower bound, but the round doesn't
+        // run past the end of bootstrapping; packets that would arrive within the same round are
+        // delayed to the destination's next round, which is fine while there's no loss or
+        // bandwidth limit to model
+        match self.bootstrap {
+            Some((bootstrap_end, bootstrap_runahead)) if start < bootstrap_end => {
+                let bootstrap_runahead = std::cmp::min(bootstrap_runahead, bootstrap_end - start);
+                std::cmp::max(runahead, bootstrap_runahead)
+            }
+            _ => runahead,
+        }
+    }
+
+    /// The bootstrap runahead if one was set and `time` is before the end of bootstrapping.
+    pub fn bootstrap_runahead(&self, time: EmulatedTime) -> Option<SimulationTime> {
+        let (bootstrap_end, runahead) = self.bootstrap?;
+        (time < bootstrap_end).then_some(runahead)
+    }
+
+    /// The lowest packet latency used so far, if dynamic runahead is enabled and a packet has
+    /// been sent.
+    fn min_used_latency(&self) -> Option<SimulationTime> {
+        match self.min_used_latency_ns.load(Ordering::Relaxed) {
+            u64::MAX => None,
+            x => Some(SimulationTime::from_nanos(x)),
+        }
     }
 
     /// If dynamic runahead is enabled, will compare and update the stored lowest packet latency.
@@ -61,57 +130,279 @@ impl Runahead {
     pub fn update_lowest_used_latency(&self, latency: SimulationTime) {
         assert!(latency > SimulationTime::ZERO);
 
-        // if dynamic runahead is disabled, we don't update 'min_used_latency'
+        // if dynamic runahead is disabled, we don't update 'min_used_latency_ns'
         if !self.is_runahead_dynamic {
             return;
         }
 
-        // helper function for checking if we should update the min_used_latency
-        let should_update = |min_used_latency: &Option<SimulationTime>| {
-            if let Some(min_used_latency) = min_used_latency {
-                if latency >= *min_used_latency {
-                    return false;
-                }
-            }
-            // true if runahead was never set before, or new latency is smaller than the old latency
-            true
-        };
+        let latency_ns = u64::try_from(latency.as_nanos()).unwrap();
 
-        // an initial check with only a read lock
-        {
-            let min_used_latency = self.min_used_latency.read().unwrap();
+        // a plain load first so that the common case of a latency that isn't lower doesn't need
+        // exclusive access to the cache line
+        if latency_ns >= self.min_used_latency_ns.load(Ordering::Relaxed) {
+            return;
+        }
 
-            if !should_update(&min_used_latency) {
-                return;
-            }
+        // the round boundaries order this with the reads in `get()`
+        let old_latency_ns = self
+            .min_used_latency_ns
+            .fetch_min(latency_ns, Ordering::Relaxed);
+        if latency_ns >= old_latency_ns {
+            // another thread lowered it first
+            return;
         }
 
-        let old_runahead;
-        let min_runahead_config;
+        // these info messages may appear out-of-order in the log
+        log::info!(
+            "Minimum time runahead for next scheduling round updated from {:?} \
+             to {} ns; the minimum config override is {:?} ns",
+            (old_latency_ns != u64::MAX).then_some(old_latency_ns),
+            latency_ns,
+            self.min_runahead_config.map(|x| x.as_nanos())
+        );
+    }
+}
 
-        // check the same condition again, but with a write lock
-        {
-            let mut min_used_latency = self.min_used_latency.write().unwrap();
+/// The global bounds of a scheduling round, from which each host's own window end is derived.
+#[derive(Copy, Clone, Debug)]
+pub struct RoundWindow {
+    /// The earliest event time of any host at the start of the round.
+    pub start: EmulatedTime,
+    /// No host may run past this time during the round.
+    pub end: EmulatedTime,
+    /// The runahead returned by [`Runahead::get`] when the round started.
+    pub runahead: SimulationTime,
+}
 
-            if !should_update(&min_used_latency) {
-                return;
-            }
+/// Per-host conservative lookahead, used instead of a single round width for all hosts when
+/// per-host lookahead is enabled.
+///
+/// Within a round, a host only receives packets from events that existed when the round started,
+/// and none of those events happen before the round's start time. A packet sent to a host must
+/// also travel a path of at least the smallest latency into that host's graph node, so the host
+/// can safely run up to the round's start time plus this latency. Hosts that are far from
+/// low-latency edges can then run further ahead than hosts next to them.
+#[derive(Debug)]
+pub struct HostLookahead {
+    /// For each host, the lowest path latency at any time from any node that has a host (including
+    /// its own node) to the host's node.
+    min_inbound_latency: HashMap<HostId, SimulationTime>,
+    /// The largest value in `min_inbound_latency`.
+    max_lookahead: SimulationTime,
+}
+
+impl HostLookahead {
+    /// Build the lookahead table for hosts given as `(host id, graph node id)` pairs.
+    pub fn new(hosts: &[(HostId, u32)], routing_info: &RoutingInfo<u32>) -> Self {
+        let mut nodes: Vec<u32> = hosts.iter().map(|(_, node)| *node).collect();
+        nodes.sort_unstable();
+        nodes.dedup();
+
+        // the lowest latency into each node from any node that's in use; the node itself is
+        // included since a host can send packets to another host on the same node (or to itself).
+        // With lazily computed paths this is a lower bound, so that we don't compute the paths
+        // from every node here.
+        let node_latency: HashMap<u32, SimulationTime> = nodes
+            .iter()
+            .map(|dst| {
+                let latency_ns = routing_info
+                    .lowest_inbound_latency_ns(&nodes, *dst)
+                    .unwrap();
+                (*dst, SimulationTime::from_nanos(latency_ns))
+            })
+            .collect();
+
+        let min_inbound_latency: HashMap<_, _> = hosts
+            .iter()
+            .map(|(host_id, node)| (*host_id, node_latency[node]))
+            .collect();
+
+        let max_lookahead = min_inbound_latency
+            .values()
+            .copied()
+            .max()
+            .unwrap_or(SimulationTime::ZERO);
+
+        Self {
+            min_inbound_latency,
+            max_lookahead,
+        }
+    }
+
+    /// The largest lookahead of any host. A round never needs to be longer than this (or the
+    /// runahead, if larger).
+    pub fn max_lookahead(&self) -> SimulationTime {
+        self.max_lookahead
+    }
 
-            // cache the values for logging
-            old_runahead = *min_used_latency;
-            min_runahead_config = self.min_runahead_config;
+    /// The time that the host may run up to (but not including) during the round.
+    ///
+    /// The runahead is also used as a lower bound so that a user-configured runahead or a dynamic
+    /// runahead still applies. Packets that would arrive before a host's window end must be
+    /// delayed to its window end.
+    pub fn host_window_end(&self, host_id: HostId, window: &RoundWindow) -> EmulatedTime {
+        let lookahead = std::cmp::max(self.min_inbound_latency[&host_id], window.runahead);
+        let end = window.start.saturating_add(lookahead);
+        std::cmp::min(end, window.end)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::network::graph::PathProperties;
 
-            // update the min runahead
-            *min_used_latency = Some(latency);
+    fn path(latency_ns: u64) -> PathProperties {
+        PathProperties {
+            latency_ns,
+            packet_loss: 0.0,
         }
+    }
 
-        // these info messages may appear out-of-order in the log
-        log::info!(
-            "Minimum time runahead for next scheduling round updated from {:?} \
-             to {} ns; the minimum config override is {:?} ns",
-            old_runahead.map(|x| x.as_nanos()),
-            latency.as_nanos(),
-            min_runahead_config.map(|x| x.as_nanos())
+    #[test]
+    fn test_latency_changes() {
+        let time = |ns| EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(ns);
+        let ns = SimulationTime::from_nanos;
+        let runahead = Runahead::new(
+            false,
+            ns(1_000),
+            [(time(10_000), ns(100)), (time(20_000), ns(5_000))],
+            None,
+            None,
+        );
+
+        assert_eq!(runahead.get(time(0)), ns(1_000));
+        // the round must end before a packet sent with the lower latency can arrive
+        assert_eq!(runahead.get(time(9_500)), ns(600));
+        assert_eq!(runahead.get(time(10_000)), ns(100));
+        assert_eq!(runahead.get(time(19_950)), ns(100));
+        assert_eq!(runahead.get(time(20_000)), ns(5_000));
+        assert_eq!(runahead.get(time(30_000)), ns(5_000));
+
+        // the configured runahead is still a lower bound
+        let runahead = Runahead::new(
+            false,
+            ns(1_000),
+            [(time(10_000), ns(100))],
+            Some(ns(500)),
+            None,
+        );
+        assert_eq!(runahead.get(time(10_000)), ns(500));
+    }
+
+    #[test]
+    fn test_dynamic_runahead() {
+        let start = EmulatedTime::SIMULATION_START;
+        let ns = SimulationTime::from_nanos;
+        let runahead = Runahead::new(true, ns(1_000), [], None, None);
+        assert_eq!(runahead.get(start), ns(1_000));
+
+        // the lowest used latency can be larger than the lowest possible latency
+        runahead.update_lowest_used_latency(ns(5_000));
+        assert_eq!(runahead.get(start), ns(5_000));
+
+        std::thread::scope(|s| {
+            for latency in [3_000, 2_000, 4_000] {
+                let runahead = &runahead;
+                s.spawn(move || runahead.update_lowest_used_latency(ns(latency)));
+            }
+        });
+        assert_eq!(runahead.min_used_latency(), Some(ns(2_000)));
+        assert_eq!(runahead.get(start), ns(2_000));
+
+        // a larger latency doesn't raise it
+        runahead.update_lowest_used_latency(ns(5_000));
+        assert_eq!(runahead.min_used_latency(), Some(ns(2_000)));
+
+        // it's never updated if dynamic runahead is disabled
+        let runahead = Runahead::new(false, ns(1_000), [], None, None);
+        runahead.update_lowest_used_latency(ns(500));
+        assert_eq!(runahead.min_used_latency(), None);
+        assert_eq!(runahead.get(start), ns(1_000));
+    }
+
+    #[test]
+    fn test_bootstrap_runahead() {
+        let time = |ns| EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(ns);
+        let ns = SimulationTime::from_nanos;
+        let runahead = Runahead::new(
+            false,
+            ns(1_000),
+            [],
+            Some(ns(500)),
+            Some((time(100_000), ns(30_000))),
         );
+
+        assert_eq!(runahead.get(time(0)), ns(30_000));
+        assert_eq!(runahead.bootstrap_runahead(time(0)), Some(ns(30_000)));
+        // the last round of bootstrapping ends when bootstrapping ends
+        assert_eq!(runahead.get(time(90_000)), ns(10_000));
+        // but isn't shorter than the normal runahead
+        assert_eq!(runahead.get(time(99_500)), ns(1_000));
+        assert_eq!(runahead.get(time(100_000)), ns(1_000));
+        assert_eq!(runahead.bootstrap_runahead(time(100_000)), None);
+    }
+
+    #[test]
+    fn test_host_lookahead() {
+        // nodes 0 and 1 are connected by a fast LAN link, and node 2 is far from both
+        let paths = HashMap::from([
+            ((0, 0), path(500)),
+            ((1, 1), path(500)),
+            ((2, 2), path(10_000)),
+            ((0, 1), path(100)),
+            ((1, 0), path(100)),
+            ((0, 2), path(5_000)),
+            ((2, 0), path(5_000)),
+            ((1, 2), path(7_000)),
+            ((2, 1), path(7_000)),
+        ]);
+        let routing_info = RoutingInfo::new(paths);
+
+        let hosts = [
+            (HostId::from(0), 0),
+            (HostId::from(1), 1),
+            (HostId::from(2), 2),
+            (HostId::from(3), 2),
+        ];
+        let lookahead = HostLookahead::new(&hosts, &routing_info);
+        assert_eq!(lookahead.max_lookahead(), SimulationTime::from_nanos(5_000));
+
+        let start = EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(1_000);
+        let window = RoundWindow {
+            start,
+            end: start + SimulationTime::from_nanos(5_000),
+            runahead: SimulationTime::from_nanos(200),
+        };
+
+        let window_end = |id: u32| lookahead.host_window_end(HostId::from(id), &window);
+        assert_eq!(window_end(0), start + SimulationTime::from_nanos(200));
+        assert_eq!(window_end(1), start + SimulationTime::from_nanos(200));
+        assert_eq!(window_end(2), start + SimulationTime::from_nanos(5_000));
+        assert_eq!(window_end(3), start + SimulationTime::from_nanos(5_000));
+
+        // the window end is never past the round's end
+        let window = RoundWindow {
+            end: start + SimulationTime::from_nanos(1_000),
+            ..window
+        };
+        let window_end = |id: u32| lookahead.host_window_end(HostId::from(id), &window);
+        assert_eq!(window_end(2), start + SimulationTime::from_nanos(1_000));
+    }
+
+    #[test]
+    fn test_host_lookahead_lazy() {
+        // the lookahead uses the bounds of the latencies into each node and doesn't compute paths
+        let routing_info = RoutingInfo::new_lazy([(0, 100), (1, 100), (2, 5_000)], 100, 1, |_| {
+            panic!("computed the paths")
+        });
+
+        let hosts = [
+            (HostId::from(0), 0),
+            (HostId::from(1), 1),
+            (HostId::from(2), 2),
+        ];
+        let lookahead = HostLookahead::new(&hosts, &routing_info);
+        assert_eq!(lookahead.max_lookahead(), SimulationTime::from_nanos(5_000));
     }
 }
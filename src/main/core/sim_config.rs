@@ -8,20 +8,28 @@ use std::collections::{BTreeMap, HashMap, HashSet};
 use std::ffi::{OsStr, OsString};
 use std::hash::{Hash, Hasher};
 use std::path::PathBuf;
-use std::sync::RwLock;
+use std::sync::{Arc, RwLock};
 use std::time::Duration;
 
 use anyhow::Context;
+use linux_api::syscall::SyscallNum;
 use once_cell::sync::Lazy;
 use rand::{Rng, SeedableRng};
 use rand_xoshiro::Xoshiro256PlusPlus;
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
 use crate::core::configuration::{
-    ConfigOptions, EnvName, Flatten, HostOptions, LogLevel, ProcessArgs, ProcessFinalState,
-    ProcessOptions, QDiscMode, parse_string_as_args,
+    ConfigOptions, EnvName, FileSource, Flatten, GraphOptions, GraphSource, HostOptions, LogLevel,
+    ProcessArgs, ProcessFinalState, ProcessOptions, QDiscMode, RouterQDiscMode,
+    parse_string_as_args,
+};
+use crate::host::syscall::handler::NATIVE_PASSTHROUGH_SYSCALLS;
+use crate::network::graph::coordinates::NetworkCoordinates;
+use crate::network::graph::matrix::LatencyMatrix;
+use crate::network::graph::updates::{self, EdgeUpdate};
+use crate::network::graph::{
+    IpAssignment, NetworkGraph, RoutingInfo, load_network_graph, routing_cache,
 };
-use crate::network::graph::{IpAssignment, NetworkGraph, RoutingInfo, load_network_graph};
 use crate::utility::units::{self, Unit};
 use crate::utility::{tilde_expansion, verify_plugin_path};
 
@@ -31,10 +39,10 @@ pub struct SimConfig {
     pub random: Xoshiro256PlusPlus,
 
     // map of ip addresses to graph nodes
-    pub ip_assignment: IpAssignment<u32>,
+    pub ip_assignment: Arc<IpAssignment<u32>>,
 
     // routing information for paths between graph nodes
-    pub routing_info: RoutingInfo<u32>,
+    pub routing_info: Arc<RoutingInfo<u32>>,
 
     // bandwidths of hosts at ip addresses
     pub host_bandwidths: HashMap<std::net::IpAddr, Bandwidth>,
@@ -45,44 +53,51 @@ pub struct SimConfig {
 
 impl SimConfig {
     pub fn new(config: &ConfigOptions, hosts_to_debug: &HashSet<String>) -> anyhow::Result<Self> {
-        // Xoshiro256PlusPlus is not ideal when a seed with many zeros is used, but
-        // 'seed_from_u64()' uses SplitMix64 to derive the actual seed, so we are okay here
-        let seed = config.general.seed.unwrap();
-        let mut random = Xoshiro256PlusPlus::seed_from_u64(seed.into());
-
-        // this should be the same for all hosts
-        let randomness_for_seed_calc = random.random();
+        let (random, randomness_for_seed_calc) = simulation_random(config.general.seed.unwrap());
 
         // build the host list
         let mut hosts = vec![];
         for (name, host_options) in &config.hosts {
-            let new_host = build_host(
-                config,
-                host_options,
-                name,
-                randomness_for_seed_calc,
-                hosts_to_debug,
-            )
-            .with_context(|| format!("Failed to configure host '{name}'"))?;
-            hosts.push(new_host);
+            let names = host_names(name, host_options)
+                .with_context(|| format!("Failed to configure host '{name}'"))?;
+
+            // hosts configured by the same entry share their processes
+            let processes = build_processes(config, host_options)
+                .with_context(|| format!("Failed to configure host '{name}'"))?;
+
+            for name in names {
+                hosts.push(build_host(
+                    config,
+                    host_options,
+                    name,
+                    Arc::clone(&processes),
+                    randomness_for_seed_calc,
+                    hosts_to_debug,
+                ));
+            }
         }
+
+        // keep the hosts sorted by their hostname, including the hosts configured with a count
+        hosts.sort_unstable_by(|a, b| a.name.cmp(&b.name));
+        if let Some(pair) = hosts.windows(2).find(|pair| pair[0].name == pair[1].name) {
+            return Err(anyhow::anyhow!(
+                "The host '{}' is configured more than once",
+                pair[0].name
+            ));
+        }
+
         if hosts.is_empty() {
             return Err(anyhow::anyhow!(
                 "The configuration did not contain any hosts"
             ));
         }
 
-        // load and parse the network graph
-        let graph: String = load_network_graph(config.network.graph.as_ref().unwrap())
-            .map_err(|e| anyhow::anyhow!(e))
-            .context("Failed to load the network graph")?;
-        let graph = NetworkGraph::parse(&graph)
-            .map_err(|e| anyhow::anyhow!(e))
-            .context("Failed to parse the network graph")?;
+        // load the network graph or latency matrix
+        let topology = Topology::load(config.network.graph.as_ref().unwrap())?;
 
         // check that each node ID is valid
         for host in &hosts {
-            if graph.node_id_to_index(host.network_node_id).is_none() {
+            if !topology.has_node(host.network_node_id) {
                 return Err(anyhow::anyhow!(
                     "The network node id {} for host '{}' does not exist",
                     host.network_node_id,
@@ -93,15 +108,8 @@ impl SimConfig {
 
         // assign a bandwidth to every host
         for host in &mut hosts {
-            let node_index = graph.node_id_to_index(host.network_node_id).unwrap();
-            let node = graph.graph().node_weight(*node_index).unwrap();
-
-            let graph_bw_down_bits = node
-                .bandwidth_down
-                .map(|x| x.convert(units::SiPrefixUpper::Base).unwrap().value());
-            let graph_bw_up_bits = node
-                .bandwidth_up
-                .map(|x| x.convert(units::SiPrefixUpper::Base).unwrap().value());
+            let (graph_bw_down_bits, graph_bw_up_bits) =
+                topology.node_bandwidth_bits(host.network_node_id);
 
             host.bandwidth_down_bits = host.bandwidth_down_bits.or(graph_bw_down_bits);
             host.bandwidth_up_bits = host.bandwidth_up_bits.or(graph_bw_up_bits);
@@ -133,12 +141,27 @@ impl SimConfig {
         // assign IP addresses to hosts and graph nodes
         let ip_assignment = assign_ips(&mut hosts)?;
 
+        let nodes = ip_assignment.get_nodes();
+        let use_shortest_path = config.network.use_shortest_path.unwrap();
+        let graph_updates = get_graph_updates(&config)?;
+
         // generate routing info between every pair of in-use nodes
-        let routing_info = generate_routing_info(
-            &graph,
-            &ip_assignment.get_nodes(),
-            config.network.use_shortest_path.unwrap(),
-        )?;
+        let routing_info = match topology {
+            Topology::Graph { graph, graph_text } => graph_routing_info(
+                config,
+                graph,
+                &graph_text,
+                &nodes,
+                &graph_updates,
+                use_shortest_path,
+            )?,
+            Topology::Matrix(matrix) => {
+                matrix_routing_info(matrix, &nodes, &graph_updates, use_shortest_path)?
+            }
+            Topology::Coordinates(coordinates) => {
+                coordinates_routing_info(coordinates, &nodes, &graph_updates, use_shortest_path)?
+            }
+        };
 
         // get all host bandwidths
         let host_bandwidths = hosts
@@ -156,18 +179,63 @@ impl SimConfig {
 
         Ok(Self {
             random,
-            ip_assignment,
-            routing_info,
+            ip_assignment: Arc::new(ip_assignment),
+            routing_info: Arc::new(routing_info),
             host_bandwidths,
             hosts,
         })
     }
+
+    /// The configuration of the same simulation with seed `seed`, as if `general.seed` was
+    /// `seed`. The IP assignment and routing information are shared rather than copied, since they
+    /// don't depend on the seed.
+    pub fn with_seed(&self, seed: u32) -> Self {
+        let (random, randomness_for_seed_calc) = simulation_random(seed);
+
+        let hosts = self
+            .hosts
+            .iter()
+            .map(|host| HostInfo {
+                seed: host_seed(randomness_for_seed_calc, &host.name),
+                ..host.clone()
+            })
+            .collect();
+
+        Self {
+            random,
+            ip_assignment: Arc::clone(&self.ip_assignment),
+            routing_info: Arc::clone(&self.routing_info),
+            host_bandwidths: self.host_bandwidths.clone(),
+            hosts,
+        }
+    }
+}
+
+/// The simulation's source of randomness for `seed`, and the randomness that the hosts' seeds are
+/// derived from.
+fn simulation_random(seed: u32) -> (Xoshiro256PlusPlus, u64) {
+    // Xoshiro256PlusPlus is not ideal when a seed with many zeros is used, but
+    // 'seed_from_u64()' uses SplitMix64 to derive the actual seed, so we are okay here
+    let mut random = Xoshiro256PlusPlus::seed_from_u64(seed.into());
+
+    // this should be the same for all hosts
+    let randomness_for_seed_calc = random.random();
+
+    (random, randomness_for_seed_calc)
+}
+
+/// The seed of the host `hostname`.
+fn host_seed(randomness_for_seed_calc: u64, hostname: &str) -> u64 {
+    // hostname hash is used as part of the host's seed
+    let mut hasher = std::hash::DefaultHasher::new();
+    hostname.hash(&mut hasher);
+    randomness_for_seed_calc ^ hasher.finish()
 }
 
 #[derive(Clone)]
 pub struct HostInfo {
     pub name: String,
-    pub processes: Vec<ProcessInfo>,
+    pub processes: Arc<[ProcessInfo]>,
     pub seed: u64,
     pub network_node_id: u32,
     pub pause_for_debugging: bool,
@@ -183,6 +251,7 @@ pub struct HostInfo {
     pub autotune_send_buf: bool,
     pub autotune_recv_buf: bool,
     pub qdisc: QDiscMode,
+    pub router_qdisc: RouterQDiscMode,
 }
 
 #[derive(Clone)]
@@ -194,6 +263,7 @@ pub struct ProcessInfo {
     pub args: Vec<OsString>,
     pub env: BTreeMap<EnvName, String>,
     pub expected_final_state: ProcessFinalState,
+    pub native_syscalls: Vec<SyscallNum>,
 }
 
 #[derive(Debug, Clone)]
@@ -205,41 +275,97 @@ pub struct Bandwidth {
 #[derive(Debug, Clone, Copy)]
 pub struct PcapConfig {
     pub capture_size: u64,
+    /// If set, packets are kept in an in-memory ring rather than written directly to disk.
+    pub ring: Option<PcapRingConfig>,
 }
 
-/// For a host entry in the configuration options, build `HostInfo` object.
-fn build_host(
-    config: &ConfigOptions,
-    host: &HostOptions,
-    hostname: &str,
-    randomness_for_seed_calc: u64,
-    hosts_to_debug: &HashSet<String>,
-) -> anyhow::Result<HostInfo> {
-    let hostname = hostname.to_string();
+#[derive(Debug, Clone, Copy)]
+pub struct PcapRingConfig {
+    pub max_packets: Option<u32>,
+    pub max_duration: Option<SimulationTime>,
+}
 
-    // hostname hash is used as part of the host's seed
-    let hostname_hash = {
-        let mut hasher = std::hash::DefaultHasher::new();
-        hostname.hash(&mut hasher);
-        hasher.finish()
+/// For a host entry in the configuration options, build the pcap ring configuration (if a ring is
+/// configured).
+fn build_pcap_ring(host: &HostOptions) -> Option<PcapRingConfig> {
+    let max_packets = host.host_options.pcap_ring_packets.flatten();
+    let max_duration = host
+        .host_options
+        .pcap_ring_duration
+        .flatten()
+        .map(|x| SimulationTime::try_from(Duration::from(x)).unwrap());
+
+    if max_packets.is_none() && max_duration.is_none() {
+        return None;
+    }
+
+    Some(PcapRingConfig {
+        max_packets,
+        max_duration,
+    })
+}
+
+/// The names of the hosts configured by the host entry `hostname`. If the entry has a `count`, it
+/// configures the hosts `<hostname>1` to `<hostname><count>`.
+fn host_names(hostname: &str, host: &HostOptions) -> anyhow::Result<Vec<String>> {
+    let Some(count) = host.count else {
+        return Ok(vec![hostname.to_string()]);
     };
 
-    let pause_for_debugging = hosts_to_debug.contains(&hostname);
+    if count == 0 {
+        return Err(anyhow::anyhow!("The host count must be at least 1"));
+    }
 
-    let processes: Vec<_> = host
-        .processes
+    if count > 1 && host.ip_addr.is_some() {
+        return Err(anyhow::anyhow!(
+            "An IP address can't be set for more than one host"
+        ));
+    }
+
+    // the hostname can be at most 253 characters (see `HostName`)
+    let longest = format!("{hostname}{count}");
+    if longest.len() > 253 {
+        return Err(anyhow::anyhow!(
+            "The hostname '{longest}' exceeds 253 characters"
+        ));
+    }
+
+    Ok((1..=count).map(|i| format!("{hostname}{i}")).collect())
+}
+
+/// For a host entry in the configuration options, build the `ProcessInfo` objects of its
+/// processes.
+fn build_processes(
+    config: &ConfigOptions,
+    host: &HostOptions,
+) -> anyhow::Result<Arc<[ProcessInfo]>> {
+    host.processes
         .iter()
         .map(|proc| {
             build_process(proc, config)
                 .with_context(|| format!("Failed to configure process '{}'", proc.path.display()))
         })
-        .collect::<anyhow::Result<_>>()?;
+        .collect()
+}
+
+/// For a host entry in the configuration options, build the `HostInfo` object of the host
+/// `hostname`.
+fn build_host(
+    config: &ConfigOptions,
+    host: &HostOptions,
+    hostname: String,
+    processes: Arc<[ProcessInfo]>,
+    randomness_for_seed_calc: u64,
+    hosts_to_debug: &HashSet<String>,
+) -> HostInfo {
+    let seed = host_seed(randomness_for_seed_calc, &hostname);
+    let pause_for_debugging = hosts_to_debug.contains(&hostname);
 
-    Ok(HostInfo {
+    HostInfo {
         name: hostname,
         processes,
 
-        seed: randomness_for_seed_calc ^ hostname_hash,
+        seed,
         network_node_id: host.network_node_id,
         pause_for_debugging,
 
@@ -267,6 +393,7 @@ fn build_host(
                     .convert(units::SiPrefixUpper::Base)
                     .unwrap()
                     .value(),
+                ring: build_pcap_ring(host),
             }),
 
         // some options come from the config options and not the host options
@@ -287,7 +414,8 @@ fn build_host(
         autotune_send_buf: config.experimental.socket_send_autotune.unwrap(),
         autotune_recv_buf: config.experimental.socket_recv_autotune.unwrap(),
         qdisc: config.experimental.interface_qdisc.unwrap(),
-    })
+        router_qdisc: config.experimental.router_qdisc.unwrap(),
+    }
 }
 
 /// For a process entry in the configuration options, build a `ProcessInfo` object.
@@ -325,6 +453,26 @@ fn build_process(proc: &ProcessOptions, config: &ConfigOptions) -> anyhow::Resul
         }
     }
 
+    let mut native_syscalls = Vec::new();
+    for name in &proc.native_syscalls {
+        let syscall = NATIVE_PASSTHROUGH_SYSCALLS
+            .iter()
+            .find(|x| x.to_str() == Some(name.as_str()))
+            .ok_or_else(|| {
+                let allowed: Vec<_> = NATIVE_PASSTHROUGH_SYSCALLS
+                    .iter()
+                    .map(|x| x.to_str().unwrap())
+                    .collect();
+                anyhow::anyhow!(
+                    "Syscall '{name}' can't be made natively; it must be one of: {}",
+                    allowed.join(", "),
+                )
+            })?;
+        if !native_syscalls.contains(syscall) {
+            native_syscalls.push(*syscall);
+        }
+    }
+
     let mut args = match &proc.args {
         ProcessArgs::List(x) => x.iter().map(|y| OsStr::new(y).to_os_string()).collect(),
         ProcessArgs::Str(x) => parse_string_as_args(OsStr::new(&x.trim()))
@@ -378,6 +526,7 @@ fn build_process(proc: &ProcessOptions, config: &ConfigOptions) -> anyhow::Resul
         args,
         env: proc.environment.clone(),
         expected_final_state: proc.expected_final_state,
+        native_syscalls,
     })
 }
 
@@ -406,12 +555,295 @@ fn assign_ips(hosts: &mut [HostInfo]) -> anyhow::Result<IpAssignment<u32>> {
     Ok(ip_assignment)
 }
 
+/// Get the network graph updates from the config.
+fn get_graph_updates(config: &ConfigOptions) -> anyhow::Result<Vec<EdgeUpdate>> {
+    config
+        .network
+        .graph_updates
+        .as_ref()
+        .unwrap()
+        .iter()
+        .map(|update| {
+            let edge = format!("{} -> {}", update.source, update.target);
+
+            if update.latency.is_some_and(|x| x.value() == 0) {
+                return Err(anyhow::anyhow!(
+                    "The latency of graph update for edge {edge} must not be 0"
+                ));
+            }
+            if update
+                .packet_loss
+                .is_some_and(|x| !(0.0..=1.0).contains(&x))
+            {
+                return Err(anyhow::anyhow!(
+                    "The packet loss of graph update for edge {edge} must be between 0 and 1"
+                ));
+            }
+
+            let time = Duration::from(update.time);
+            Ok(EdgeUpdate {
+                time_ns: u64::try_from(time.as_nanos()).unwrap(),
+                source: update.source,
+                target: update.target,
+                latency: update.latency,
+                packet_loss: update.packet_loss,
+                up: update.up,
+            })
+        })
+        .collect()
+}
+
+/// The network topology, as a network graph, a latency matrix, or network coordinates.
+enum Topology {
+    Graph {
+        graph: NetworkGraph,
+        /// The GML text, which the routing cache is keyed by.
+        graph_text: String,
+    },
+    Matrix(LatencyMatrix),
+    Coordinates(NetworkCoordinates),
+}
+
+impl Topology {
+    fn load(graph_options: &GraphOptions) -> anyhow::Result<Self> {
+        if let GraphOptions::Matrix(source) = graph_options {
+            let path = match source {
+                GraphSource::File(FileSource {
+                    path,
+                    compression: None,
+                }) => path,
+                GraphSource::File(FileSource {
+                    compression: Some(_),
+                    ..
+                }) => {
+                    return Err(anyhow::anyhow!(
+                        "A latency matrix file can't be compressed, since it's mapped into memory"
+                    ));
+                }
+                GraphSource::Inline(_) => {
+                    return Err(anyhow::anyhow!(
+                        "A latency matrix must be given as a file, not inline"
+                    ));
+                }
+            };
+            let matrix = LatencyMatrix::open(&tilde_expansion(path))
+                .context("Failed to load the latency matrix")?;
+            return Ok(Self::Matrix(matrix));
+        }
+
+        // load and parse the network graph
+        let graph_text: String = load_network_graph(graph_options)
+            .map_err(|e| anyhow::anyhow!(e))
+            .context("Failed to load the network graph")?;
+
+        if let GraphOptions::Coordinates(_) = graph_options {
+            let coordinates = NetworkCoordinates::parse(&graph_text)
+                .context("Failed to parse the network coordinates")?;
+            return Ok(Self::Coordinates(coordinates));
+        }
+
+        let graph = NetworkGraph::parse(&graph_text)
+            .map_err(|e| anyhow::anyhow!(e))
+            .context("Failed to parse the network graph")?;
+
+        Ok(Self::Graph { graph, graph_text })
+    }
+
+    fn has_node(&self, id: u32) -> bool {
+        match self {
+            Self::Graph { graph, .. } => graph.node_id_to_index(id).is_some(),
+            Self::Matrix(matrix) => matrix.node_index(id).is_some(),
+            Self::Coordinates(coordinates) => coordinates.node_index(id).is_some(),
+        }
+    }
+
+    /// The downstream and upstream bandwidths of a node, if it has them. Will panic if the node
+    /// doesn't exist.
+    fn node_bandwidth_bits(&self, id: u32) -> (Option<u64>, Option<u64>) {
+        match self {
+            Self::Graph { graph, .. } => {
+                let node_index = graph.node_id_to_index(id).unwrap();
+                let node = graph.graph().node_weight(*node_index).unwrap();
+
+                let bw_down_bits = node
+                    .bandwidth_down
+                    .map(|x| x.convert(units::SiPrefixUpper::Base).unwrap().value());
+                let bw_up_bits = node
+                    .bandwidth_up
+                    .map(|x| x.convert(units::SiPrefixUpper::Base).unwrap().value());
+
+                (bw_down_bits, bw_up_bits)
+            }
+            Self::Matrix(matrix) => {
+                let index = matrix.node_index(id).unwrap();
+                (
+                    matrix.bandwidth_down_bits(index),
+                    matrix.bandwidth_up_bits(index),
+                )
+            }
+            Self::Coordinates(coordinates) => {
+                let index = coordinates.node_index(id).unwrap();
+                (
+                    coordinates.bandwidth_down_bits(index),
+                    coordinates.bandwidth_up_bits(index),
+                )
+            }
+        }
+    }
+}
+
+/// Generate the routing info between every pair of `nodes` from a network graph, loading it from
+/// the routing cache if possible.
+fn graph_routing_info(
+    config: &ConfigOptions,
+    graph: NetworkGraph,
+    graph_text: &str,
+    nodes: &HashSet<u32>,
+    graph_updates: &[EdgeUpdate],
+    use_shortest_path: bool,
+) -> anyhow::Result<RoutingInfo<u32>> {
+    let shortest_path_cache_size = config
+        .experimental
+        .shortest_path_cache_size
+        .unwrap()
+        .to_option();
+
+    if !graph_updates.is_empty() && use_shortest_path && shortest_path_cache_size.is_some() {
+        return Err(anyhow::anyhow!(
+            "Graph updates can't be used with the shortest path cache"
+        ));
+    }
+
+    // the on-disk cache only holds paths that were computed up front and don't change
+    let routing_cache = config
+        .experimental
+        .routing_cache_directory
+        .as_ref()
+        .and_then(|x| x.as_ref().to_option())
+        .filter(|_| !(use_shortest_path && shortest_path_cache_size.is_some()))
+        .filter(|_| graph_updates.is_empty())
+        .map(|dir| {
+            let nodes: Vec<u32> = nodes.iter().copied().collect();
+            let input = routing_cache::CacheInput::new(graph_text, &nodes, use_shortest_path);
+            (tilde_expansion(dir), input)
+        });
+
+    let cached_routing_info = routing_cache.as_ref().and_then(|(dir, input)| {
+        routing_cache::load(dir, input).unwrap_or_else(|e| {
+            log::warn!("Ignoring the routing cache: {e:?}");
+            None
+        })
+    });
+
+    let routing_info = match cached_routing_info {
+        Some(routing_info) => {
+            log::info!("Loaded the routing info from the routing cache");
+            routing_info
+        }
+        None => {
+            let routing_info = generate_routing_info(
+                graph,
+                nodes,
+                graph_updates,
+                use_shortest_path,
+                shortest_path_cache_size,
+            )?;
+            if let Some((dir, input)) = &routing_cache {
+                if let Err(e) = routing_cache::store(dir, input, &routing_info) {
+                    log::warn!("Failed to store the routing info in the routing cache: {e:?}");
+                }
+            }
+            routing_info
+        }
+    };
+
+    Ok(routing_info)
+}
+
+/// Generate the routing info between every pair of `nodes` from a latency matrix, which gives the
+/// path between each pair of nodes directly.
+fn matrix_routing_info(
+    matrix: LatencyMatrix,
+    nodes: &HashSet<u32>,
+    graph_updates: &[EdgeUpdate],
+    use_shortest_path: bool,
+) -> anyhow::Result<RoutingInfo<u32>> {
+    check_path_options("a latency matrix", graph_updates, use_shortest_path)?;
+
+    // we checked above that every node exists
+    let nodes: Vec<(u32, usize)> = nodes
+        .iter()
+        .map(|id| (*id, matrix.node_index(*id).unwrap()))
+        .collect();
+
+    let indices: Vec<usize> = nodes.iter().map(|(_, index)| *index).collect();
+    matrix
+        .check_paths(&indices)
+        .context("Invalid paths in the latency matrix")?;
+
+    log::info!(
+        "Mapped the latency matrix with {} nodes, of which {} are in use",
+        matrix.num_nodes(),
+        nodes.len()
+    );
+
+    Ok(RoutingInfo::new_mapped(matrix, nodes))
+}
+
+/// Generate the routing info between every pair of `nodes` from network coordinates, which
+/// compute the path between each pair of nodes when it's looked up.
+fn coordinates_routing_info(
+    coordinates: NetworkCoordinates,
+    nodes: &HashSet<u32>,
+    graph_updates: &[EdgeUpdate],
+    use_shortest_path: bool,
+) -> anyhow::Result<RoutingInfo<u32>> {
+    check_path_options("network coordinates", graph_updates, use_shortest_path)?;
+
+    // we checked above that every node exists
+    let nodes: Vec<(u32, usize)> = nodes
+        .iter()
+        .map(|id| (*id, coordinates.node_index(*id).unwrap()))
+        .collect();
+
+    log::info!(
+        "Loaded the network coordinates of {} nodes, of which {} are in use",
+        coordinates.num_nodes(),
+        nodes.len()
+    );
+
+    Ok(RoutingInfo::new_coordinates(&coordinates, nodes))
+}
+
+/// Check the options that don't apply to a topology (`name`) that gives the path between each pair
+/// of nodes directly, rather than as a graph.
+fn check_path_options(
+    name: &str,
+    graph_updates: &[EdgeUpdate],
+    use_shortest_path: bool,
+) -> anyhow::Result<()> {
+    if use_shortest_path {
+        return Err(anyhow::anyhow!(
+            "With {name}, the path between each pair of nodes is given directly, so \
+             'network.use_shortest_path' must be false"
+        ));
+    }
+
+    if !graph_updates.is_empty() {
+        return Err(anyhow::anyhow!("Graph updates can't be used with {name}"));
+    }
+
+    Ok(())
+}
+
 /// Generate a map containing routing information (latency, packet loss, etc) for each pair of
-/// nodes.
+/// nodes, and how it changes after each of the graph updates.
 fn generate_routing_info(
-    graph: &NetworkGraph,
+    graph: NetworkGraph,
     nodes: &std::collections::HashSet<u32>,
+    graph_updates: &[EdgeUpdate],
     use_shortest_paths: bool,
+    shortest_path_cache_size: Option<u32>,
 ) -> anyhow::Result<RoutingInfo<u32>> {
     // convert gml node IDs to petgraph indexes
     let nodes: Vec<_> = nodes
@@ -419,30 +851,116 @@ fn generate_routing_info(
         .map(|x| *graph.node_id_to_index(*x).unwrap())
         .collect();
 
-    // helper to convert petgraph indexes back to gml node IDs
-    let to_ids = |((src, dst), path)| {
-        let src = graph.node_index_to_id(src).unwrap();
-        let dst = graph.node_index_to_id(dst).unwrap();
-        ((src, dst), path)
-    };
+    if let (true, Some(cache_size)) = (use_shortest_paths, shortest_path_cache_size) {
+        return generate_lazy_routing_info(graph, nodes, cache_size);
+    }
 
+    if !graph_updates.is_empty() {
+        return generate_updated_routing_info(graph, nodes, graph_updates, use_shortest_paths);
+    }
+
+    // the paths are computed directly into a matrix, so that we never also hold them in a map
     let paths = if use_shortest_paths {
         graph
             .compute_shortest_paths(&nodes[..])
             .map_err(|e| anyhow::anyhow!(e))
             .context("Failed to compute shortest paths between graph nodes")?
-            .into_iter()
-            .map(to_ids)
-            .collect()
     } else {
         graph
             .get_direct_paths(&nodes[..])
             .map_err(|e| anyhow::anyhow!(e))
             .context("Failed to get the direct paths between graph nodes")?
+    };
+
+    // convert petgraph indexes back to gml node IDs
+    let node_ids = nodes
+        .iter()
+        .map(|x| graph.node_index_to_id(*x).unwrap())
+        .collect();
+
+    Ok(RoutingInfo::from_matrix(node_ids, paths))
+}
+
+/// Generate routing info whose paths change after each of the graph updates.
+fn generate_updated_routing_info(
+    mut graph: NetworkGraph,
+    nodes: Vec<petgraph::graph::NodeIndex>,
+    graph_updates: &[EdgeUpdate],
+    use_shortest_paths: bool,
+) -> anyhow::Result<RoutingInfo<u32>> {
+    let (paths, path_updates) =
+        updates::compute_path_updates(&mut graph, &nodes, graph_updates, use_shortest_paths)
+            .map_err(|e| anyhow::anyhow!(e))
+            .context("Failed to compute the paths after the graph updates")?;
+
+    let to_id = |x| graph.node_index_to_id(x).unwrap();
+
+    let mut routing_info =
+        RoutingInfo::from_matrix(nodes.iter().map(|x| to_id(*x)).collect(), paths);
+
+    for update in path_updates {
+        let paths = update
+            .paths
+            .into_iter()
+            .map(|(dst, path)| (to_id(dst), path))
+            .collect();
+        routing_info.add_path_update(update.time_ns, to_id(update.src), &paths);
+    }
+
+    log::info!(
+        "Computed the paths after {} graph updates",
+        graph_updates.len()
+    );
+
+    Ok(routing_info)
+}
+
+/// Generate routing info that computes the shortest paths from a node when it first sends a
+/// packet, keeping the paths from at most `cache_size` nodes.
+fn generate_lazy_routing_info(
+    graph: NetworkGraph,
+    nodes: Vec<petgraph::graph::NodeIndex>,
+    cache_size: u32,
+) -> anyhow::Result<RoutingInfo<u32>> {
+    if cache_size == 0 {
+        return Err(anyhow::anyhow!(
+            "The shortest path cache size must be greater than 0"
+        ));
+    }
+
+    // check up front that there will be a path between every pair of nodes, since the paths are
+    // computed during the simulation
+    graph
+        .check_shortest_paths(&nodes)
+        .map_err(|e| anyhow::anyhow!(e))
+        .context("Failed to compute shortest paths between graph nodes")?;
+
+    let smallest_latency_ns = graph.smallest_outgoing_latency_ns(&nodes).unwrap_or(0);
+    // the per-host lookahead uses these bounds rather than computing the paths from every node
+    let node_ids: Vec<(u32, u64)> = nodes
+        .iter()
+        .map(|x| {
+            let id = graph.node_index_to_id(*x).unwrap();
+            (id, graph.smallest_incoming_latency_ns(*x).unwrap_or(0))
+        })
+        .collect();
+    let node_set: HashSet<_> = nodes.into_iter().collect();
+
+    let compute_paths_from = move |src: u32| {
+        let src = *graph.node_id_to_index(src).unwrap();
+        graph
+            .compute_shortest_paths_from(src, &node_set)
+            // we checked the self-loops above
+            .unwrap()
             .into_iter()
-            .map(to_ids)
+            .map(|(dst, path)| (graph.node_index_to_id(dst).unwrap(), path))
             .collect()
     };
 
-    Ok(RoutingInfo::new(paths))
+    Ok(RoutingInfo::new_lazy(
+        node_ids,
+        smallest_latency_ns,
+        cache_size.try_into().unwrap(),
+        compute_paths_from,
+    ))
 }
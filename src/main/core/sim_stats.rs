@@ -1,25 +1,115 @@
 use std::cell::RefCell;
+use std::collections::BTreeMap;
 use std::sync::Mutex;
 
 use anyhow::Context;
+use linux_api::syscall::SyscallNum;
+use rustc_hash::FxHashMap;
 use serde::Serialize;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
+use crate::core::profile::{HostProfile, SyscallLatencies, SyscallLatenciesForOutput};
 use crate::utility::counter::Counter;
+use crate::utility::flat_counter::FlatCounter;
+
+/// The names of the object types that have been counted, indexed by [`ObjectTypeId`].
+static OBJECT_TYPE_NAMES: Mutex<Vec<&'static str>> = Mutex::new(Vec::new());
+
+std::thread_local! {
+    /// Cache of [`OBJECT_TYPE_NAMES`], keyed by the address of the name.
+    static OBJECT_TYPE_IDS: RefCell<FxHashMap<usize, ObjectTypeId>> = RefCell::new(FxHashMap::default());
+}
+
+/// An interned object type name, for counting objects in a [`FlatCounter`].
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub struct ObjectTypeId(usize);
+
+impl ObjectTypeId {
+    /// Get the id for the object type `name`. Names are normally string literals, so this is
+    /// usually a lookup of the string's address in a thread-local cache.
+    pub fn new(name: &'static str) -> Self {
+        let lookup = || {
+            let mut names = OBJECT_TYPE_NAMES.lock().unwrap();
+            let id = names.iter().position(|x| *x == name).unwrap_or_else(|| {
+                names.push(name);
+                names.len() - 1
+            });
+            Self(id)
+        };
+
+        OBJECT_TYPE_IDS
+            .try_with(|ids| {
+                *ids.borrow_mut()
+                    .entry(name.as_ptr() as usize)
+                    .or_insert_with(lookup)
+            })
+            .unwrap_or_else(|_| lookup())
+    }
+
+    pub fn name(&self) -> &'static str {
+        OBJECT_TYPE_NAMES.lock().unwrap()[self.0]
+    }
+}
+
+impl From<ObjectTypeId> for usize {
+    fn from(id: ObjectTypeId) -> Self {
+        id.0
+    }
+}
+
+/// Syscall numbers at or above this are all counted under this key, so that a plugin making
+/// syscalls with arbitrary numbers can't grow the flat counters without bound. Every syscall that
+/// Linux defines is below it.
+pub const SYSCALL_COUNTER_OVERFLOW_KEY: usize = 1024;
+
+/// The key that the syscall `num` is counted under in a [`FlatCounter`]. Unknown syscall numbers
+/// that are too large share [`SYSCALL_COUNTER_OVERFLOW_KEY`].
+pub fn syscall_counter_key(num: SyscallNum) -> usize {
+    usize::try_from(u32::from(num))
+        .unwrap_or(usize::MAX)
+        .min(SYSCALL_COUNTER_OVERFLOW_KEY)
+}
+
+/// The name that syscall counts are reported under.
+pub fn syscall_counter_name(num: usize) -> &'static str {
+    u32::try_from(num)
+        .ok()
+        .and_then(|num| SyscallNum::new(num).to_str())
+        .unwrap_or("unknown-syscall")
+}
+
+/// Object counts indexed by [`ObjectTypeId`], converted to a [`Counter`] of type names.
+fn object_counts_by_name(counts: &FlatCounter) -> Counter {
+    let names = OBJECT_TYPE_NAMES.lock().unwrap();
+    counts.to_counter(|id| names[id])
+}
 
 /// Simulation statistics to be accessed by a single thread.
 #[derive(Debug)]
 pub struct LocalSimStats {
-    pub alloc_counts: RefCell<Counter>,
-    pub dealloc_counts: RefCell<Counter>,
-    pub syscall_counts: RefCell<Counter>,
+    /// Indexed by [`ObjectTypeId`].
+    pub alloc_counts: RefCell<FlatCounter>,
+    /// Indexed by [`ObjectTypeId`].
+    pub dealloc_counts: RefCell<FlatCounter>,
+    /// Indexed by syscall number.
+    pub syscall_counts: RefCell<FlatCounter>,
+    pub ipc_counts: RefCell<Counter>,
+    pub lock_counts: RefCell<Counter>,
+    pub syscall_latencies: RefCell<SyscallLatencies>,
+    pub round_trip_latencies: RefCell<SyscallLatencies>,
 }
 
 impl LocalSimStats {
     pub fn new() -> Self {
         Self {
-            alloc_counts: RefCell::new(Counter::new()),
-            dealloc_counts: RefCell::new(Counter::new()),
-            syscall_counts: RefCell::new(Counter::new()),
+            alloc_counts: RefCell::new(FlatCounter::new()),
+            dealloc_counts: RefCell::new(FlatCounter::new()),
+            syscall_counts: RefCell::new(FlatCounter::new()),
+            ipc_counts: RefCell::new(Counter::new()),
+            lock_counts: RefCell::new(Counter::new()),
+            syscall_latencies: RefCell::new(SyscallLatencies::new()),
+            round_trip_latencies: RefCell::new(SyscallLatencies::new()),
         }
     }
 }
@@ -30,12 +120,55 @@ impl Default for LocalSimStats {
     }
 }
 
+/// The runahead of the simulation's scheduling rounds, as runs of consecutive rounds with the same
+/// runahead.
+#[derive(Debug, Default, Clone)]
+pub struct RunaheadSchedule {
+    runs: Vec<RunaheadRun>,
+}
+
+#[derive(Serialize, Clone, Debug, PartialEq, Eq)]
+pub struct RunaheadRun {
+    /// The start of the first round, in nanoseconds since the start of the simulation.
+    pub start_ns: u64,
+    pub runahead_ns: u64,
+    pub rounds: u64,
+}
+
+impl RunaheadSchedule {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Add a round that starts at `start` with runahead `runahead`.
+    pub fn add_round(&mut self, start: EmulatedTime, runahead: SimulationTime) {
+        let runahead_ns = u64::try_from(runahead.as_nanos()).unwrap();
+        if let Some(last) = self.runs.last_mut() {
+            if last.runahead_ns == runahead_ns {
+                last.rounds += 1;
+                return;
+            }
+        }
+        self.runs.push(RunaheadRun {
+            start_ns: u64::try_from((start - EmulatedTime::SIMULATION_START).as_nanos()).unwrap(),
+            runahead_ns,
+            rounds: 1,
+        });
+    }
+}
+
 /// Simulation statistics to be accessed by multiple threads.
 #[derive(Debug)]
 pub struct SharedSimStats {
     pub alloc_counts: Mutex<Counter>,
     pub dealloc_counts: Mutex<Counter>,
     pub syscall_counts: Mutex<Counter>,
+    pub ipc_counts: Mutex<Counter>,
+    pub lock_counts: Mutex<Counter>,
+    pub syscall_latencies: Mutex<SyscallLatencies>,
+    pub round_trip_latencies: Mutex<SyscallLatencies>,
+    pub host_profiles: Mutex<BTreeMap<String, HostProfile>>,
+    pub runahead_schedule: Mutex<RunaheadSchedule>,
 }
 
 impl SharedSimStats {
@@ -44,26 +177,73 @@ impl SharedSimStats {
             alloc_counts: Mutex::new(Counter::new()),
             dealloc_counts: Mutex::new(Counter::new()),
             syscall_counts: Mutex::new(Counter::new()),
+            ipc_counts: Mutex::new(Counter::new()),
+            lock_counts: Mutex::new(Counter::new()),
+            syscall_latencies: Mutex::new(SyscallLatencies::new()),
+            round_trip_latencies: Mutex::new(SyscallLatencies::new()),
+            host_profiles: Mutex::new(BTreeMap::new()),
+            runahead_schedule: Mutex::new(RunaheadSchedule::new()),
         }
     }
 
+    /// Reset the stats to their initial values, before running another simulation.
+    pub fn reset(&self) {
+        let Self {
+            alloc_counts,
+            dealloc_counts,
+            syscall_counts,
+            ipc_counts,
+            lock_counts,
+            syscall_latencies,
+            round_trip_latencies,
+            host_profiles,
+            runahead_schedule,
+        } = Self::new();
+
+        *self.alloc_counts.lock().unwrap() = alloc_counts.into_inner().unwrap();
+        *self.dealloc_counts.lock().unwrap() = dealloc_counts.into_inner().unwrap();
+        *self.syscall_counts.lock().unwrap() = syscall_counts.into_inner().unwrap();
+        *self.ipc_counts.lock().unwrap() = ipc_counts.into_inner().unwrap();
+        *self.lock_counts.lock().unwrap() = lock_counts.into_inner().unwrap();
+        *self.syscall_latencies.lock().unwrap() = syscall_latencies.into_inner().unwrap();
+        *self.round_trip_latencies.lock().unwrap() = round_trip_latencies.into_inner().unwrap();
+        *self.host_profiles.lock().unwrap() = host_profiles.into_inner().unwrap();
+        *self.runahead_schedule.lock().unwrap() = runahead_schedule.into_inner().unwrap();
+    }
+
     /// Add stats from a local object to a shared object. May reset fields of `local`.
     pub fn add_from_local_stats(&self, local: &LocalSimStats) {
         let mut shared_alloc_counts = self.alloc_counts.lock().unwrap();
         let mut shared_dealloc_counts = self.dealloc_counts.lock().unwrap();
         let mut shared_syscall_counts = self.syscall_counts.lock().unwrap();
+        let mut shared_ipc_counts = self.ipc_counts.lock().unwrap();
+        let mut shared_lock_counts = self.lock_counts.lock().unwrap();
+        let mut shared_syscall_latencies = self.syscall_latencies.lock().unwrap();
+        let mut shared_round_trip_latencies = self.round_trip_latencies.lock().unwrap();
 
         let mut local_alloc_counts = local.alloc_counts.borrow_mut();
         let mut local_dealloc_counts = local.dealloc_counts.borrow_mut();
         let mut local_syscall_counts = local.syscall_counts.borrow_mut();
+        let mut local_ipc_counts = local.ipc_counts.borrow_mut();
+        let mut local_lock_counts = local.lock_counts.borrow_mut();
+        let mut local_syscall_latencies = local.syscall_latencies.borrow_mut();
+        let mut local_round_trip_latencies = local.round_trip_latencies.borrow_mut();
 
-        shared_alloc_counts.add_counter(&local_alloc_counts);
-        shared_dealloc_counts.add_counter(&local_dealloc_counts);
-        shared_syscall_counts.add_counter(&local_syscall_counts);
+        shared_alloc_counts.add_counter(&object_counts_by_name(&local_alloc_counts));
+        shared_dealloc_counts.add_counter(&object_counts_by_name(&local_dealloc_counts));
+        shared_syscall_counts.add_counter(&local_syscall_counts.to_counter(syscall_counter_name));
+        shared_ipc_counts.add_counter(&local_ipc_counts);
+        shared_lock_counts.add_counter(&local_lock_counts);
+        shared_syscall_latencies.add_latencies(&local_syscall_latencies);
+        shared_round_trip_latencies.add_latencies(&local_round_trip_latencies);
 
-        *local_alloc_counts = Counter::new();
-        *local_dealloc_counts = Counter::new();
-        *local_syscall_counts = Counter::new();
+        *local_alloc_counts = FlatCounter::new();
+        *local_dealloc_counts = FlatCounter::new();
+        *local_syscall_counts = FlatCounter::new();
+        *local_ipc_counts = Counter::new();
+        *local_lock_counts = Counter::new();
+        *local_syscall_latencies = SyscallLatencies::new();
+        *local_round_trip_latencies = SyscallLatencies::new();
     }
 }
 
@@ -78,6 +258,17 @@ impl Default for SharedSimStats {
 struct SimStatsForOutput {
     pub objects: ObjectStatsForOutput,
     pub syscalls: Counter,
+    /// How often shadow and the shim found an IPC message ready, polled for it, or slept on it.
+    pub ipc: Counter,
+    /// How often a thread waiting for a host's shared-memory lock polled until it was released,
+    /// or slept on it.
+    pub locks: Counter,
+    /// The wall time from Shadow returning control to a managed thread until the thread's next
+    /// syscall, by that syscall. For a thread making syscalls in a loop, this is the cost of the
+    /// syscall's round trip through the shim and IPC channel, excluding Shadow's handler.
+    pub syscall_round_trips: BTreeMap<&'static str, SyscallLatenciesForOutput>,
+    /// The runahead of each run of consecutive scheduling rounds with the same runahead.
+    pub runahead_schedule: Vec<RunaheadRun>,
 }
 
 #[derive(Serialize, Clone, Debug)]
@@ -96,6 +287,11 @@ impl SimStatsForOutput {
                 dealloc_counts: std::mem::take(&mut stats.dealloc_counts.lock().unwrap()),
             },
             syscalls: std::mem::take(&mut stats.syscall_counts.lock().unwrap()),
+            ipc: std::mem::take(&mut stats.ipc_counts.lock().unwrap()),
+            locks: std::mem::take(&mut stats.lock_counts.lock().unwrap()),
+            syscall_round_trips: std::mem::take(&mut stats.round_trip_latencies.lock().unwrap())
+                .by_name(),
+            runahead_schedule: std::mem::take(&mut stats.runahead_schedule.lock().unwrap()).runs,
         }
     }
 }
@@ -119,3 +315,63 @@ pub fn write_stats_to_file(
 
     Ok(())
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_object_type_id() {
+        let a = ObjectTypeId::new("TestObjectA");
+        let b = ObjectTypeId::new("TestObjectB");
+        assert_ne!(a, b);
+        assert_eq!(a, ObjectTypeId::new("TestObjectA"));
+        assert_eq!(a.name(), "TestObjectA");
+
+        // a name at a different address
+        let leaked: &'static str = String::from("TestObjectB").leak();
+        assert_eq!(ObjectTypeId::new(leaked), b);
+    }
+
+    #[test]
+    fn test_runahead_schedule() {
+        let time = |ns| EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(ns);
+        let ns = SimulationTime::from_nanos;
+
+        let mut schedule = RunaheadSchedule::new();
+        schedule.add_round(time(0), ns(10));
+        schedule.add_round(time(10), ns(10));
+        schedule.add_round(time(500), ns(2));
+        schedule.add_round(time(502), ns(10));
+        schedule.add_round(time(600), ns(10));
+
+        let run = |start_ns, runahead_ns, rounds| RunaheadRun {
+            start_ns,
+            runahead_ns,
+            rounds,
+        };
+        assert_eq!(
+            schedule.runs,
+            [run(0, 10, 2), run(500, 2, 1), run(502, 10, 2)]
+        );
+    }
+
+    #[test]
+    fn test_syscall_counter_name() {
+        assert_eq!(syscall_counter_name(0), "read");
+        assert_eq!(syscall_counter_name(usize::MAX), "unknown-syscall");
+        assert_eq!(
+            syscall_counter_name(SYSCALL_COUNTER_OVERFLOW_KEY),
+            "unknown-syscall"
+        );
+    }
+
+    #[test]
+    fn test_syscall_counter_key() {
+        assert_eq!(syscall_counter_key(SyscallNum::NR_read), 0);
+        assert_eq!(
+            syscall_counter_key(SyscallNum::new(u32::MAX)),
+            SYSCALL_COUNTER_OVERFLOW_KEY
+        );
+    }
+}
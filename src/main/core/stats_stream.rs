@@ -0,0 +1,267 @@
+//! A time series of simulation statistics, recorded when the experimental `use_sim_stats_stream`
+//! option is enabled and written to `sim-stats.ndjson` in the data directory while the simulation
+//! runs.
+//!
+//! Unlike `sim-stats.json`, which is only written when the simulation ends, a record is appended
+//! on every heartbeat interval (and once more at the end of the simulation), so that changes in
+//! the simulation's performance over a long run can be seen after the fact or while it's running.
+
+use std::fs::File;
+use std::io::{BufWriter, Write};
+use std::time::{Duration, Instant};
+
+use anyhow::Context;
+use serde::Serialize;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+use crate::core::resource_usage;
+
+/// The number of events that a worker ran, the number of packets in them, and the number of
+/// syscalls that the hosts handled.
+#[derive(Debug, Default, Clone, Copy)]
+pub struct EventCounts {
+    pub events: u64,
+    pub packets: u64,
+    /// The payload bytes of the packets.
+    pub packet_bytes: u64,
+    pub syscalls: u64,
+}
+
+impl std::ops::AddAssign for EventCounts {
+    fn add_assign(&mut self, other: Self) {
+        self.events += other.events;
+        self.packets += other.packets;
+        self.packet_bytes += other.packet_bytes;
+        self.syscalls += other.syscalls;
+    }
+}
+
+/// What a worker thread did during a scheduling round.
+#[derive(Debug, Default, Clone, Copy)]
+pub struct ThreadRoundStats {
+    pub counts: EventCounts,
+    /// The number of hosts that ran events.
+    pub active_hosts: u64,
+    /// The wall time that the thread spent running hosts.
+    pub busy: Duration,
+}
+
+impl ThreadRoundStats {
+    pub fn add(&mut self, counts: EventCounts, active_hosts: u64, busy: Duration) {
+        self.counts += counts;
+        self.active_hosts += active_hosts;
+        self.busy += busy;
+    }
+}
+
+/// Writes a record of the simulation statistics every `interval` of simulated time.
+pub struct StatsStream {
+    writer: BufWriter<File>,
+    statm_file: File,
+    interval: Option<SimulationTime>,
+    sim_start_wall_time: Instant,
+    total_rounds: u64,
+    last_record_sim_time: EmulatedTime,
+    last_record_wall_time: Instant,
+    /// Totals since the last record.
+    interval_stats: IntervalStats,
+}
+
+#[derive(Debug, Default)]
+struct IntervalStats {
+    rounds: u64,
+    round_width: Duration,
+    counts: EventCounts,
+    /// The wall time that each worker spent waiting for the other workers to finish their rounds.
+    worker_idle: Vec<Duration>,
+}
+
+/// A record in the format to be output.
+#[derive(Serialize, Debug)]
+struct StatsRecord {
+    sim_time_ns: u64,
+    wall_time_ns: u64,
+    total_rounds: u64,
+    /// The remaining fields cover the time since the previous record.
+    rounds: u64,
+    avg_round_width_ns: u64,
+    events: u64,
+    packets: u64,
+    sim_seconds_per_wall_second: f64,
+    worker_idle_ns: Vec<u64>,
+    rss_bytes: Option<u64>,
+}
+
+impl StatsStream {
+    pub fn new(
+        filename: &std::path::Path,
+        interval: Option<SimulationTime>,
+    ) -> anyhow::Result<Self> {
+        let file = File::create(filename)
+            .with_context(|| format!("Failed to create file '{}'", filename.display()))?;
+        let statm_file =
+            File::open("/proc/self/statm").context("Failed to open '/proc/self/statm'")?;
+
+        let now = Instant::now();
+
+        Ok(Self {
+            writer: BufWriter::new(file),
+            statm_file,
+            interval,
+            sim_start_wall_time: now,
+            total_rounds: 0,
+            last_record_sim_time: EmulatedTime::SIMULATION_START,
+            last_record_wall_time: now,
+            interval_stats: IntervalStats::default(),
+        })
+    }
+
+    /// Record a completed scheduling round, which spanned `width` of simulated time and took
+    /// `wall_time` to run.
+    pub fn add_round(
+        &mut self,
+        width: SimulationTime,
+        wall_time: Duration,
+        threads: impl IntoIterator<Item = ThreadRoundStats>,
+    ) {
+        self.total_rounds += 1;
+
+        let stats = &mut self.interval_stats;
+        stats.rounds += 1;
+        stats.round_width += Duration::from(width);
+
+        for (i, thread) in threads.into_iter().enumerate() {
+            stats.counts += thread.counts;
+
+            if i >= stats.worker_idle.len() {
+                stats.worker_idle.resize(i + 1, Duration::ZERO);
+            }
+            stats.worker_idle[i] += wall_time.saturating_sub(thread.busy);
+        }
+    }
+
+    /// Write a record if at least the interval has passed since the previous record.
+    pub fn maybe_write_record(&mut self, now: EmulatedTime) -> std::io::Result<()> {
+        let Some(interval) = self.interval else {
+            return Ok(());
+        };
+        if now < self.last_record_sim_time + interval {
+            return Ok(());
+        }
+        self.write_record(now)
+    }
+
+    /// Write a final record if any rounds have run since the previous record.
+    pub fn finish(&mut self, now: EmulatedTime) -> std::io::Result<()> {
+        if self.interval_stats.rounds == 0 && self.total_rounds > 0 {
+            return Ok(());
+        }
+        self.write_record(now)
+    }
+
+    /// Write a record covering the time since the previous record.
+    fn write_record(&mut self, now: EmulatedTime) -> std::io::Result<()> {
+        let wall_now = Instant::now();
+        let stats = std::mem::take(&mut self.interval_stats);
+
+        let sim_elapsed = now.saturating_duration_since(&self.last_record_sim_time);
+        let wall_elapsed = wall_now.duration_since(self.last_record_wall_time);
+
+        let avg_round_width_ns = stats
+            .round_width
+            .as_nanos()
+            .checked_div(u128::from(stats.rounds))
+            .unwrap_or(0);
+
+        let record = StatsRecord {
+            sim_time_ns: as_u64_ns(now.duration_since(&EmulatedTime::SIMULATION_START).into()),
+            wall_time_ns: as_u64_ns(wall_now.duration_since(self.sim_start_wall_time)),
+            total_rounds: self.total_rounds,
+            rounds: stats.rounds,
+            avg_round_width_ns: avg_round_width_ns.try_into().unwrap_or(u64::MAX),
+            events: stats.counts.events,
+            packets: stats.counts.packets,
+            sim_seconds_per_wall_second: if wall_elapsed.is_zero() {
+                0.0
+            } else {
+                Duration::from(sim_elapsed).as_secs_f64() / wall_elapsed.as_secs_f64()
+            },
+            worker_idle_ns: stats.worker_idle.into_iter().map(as_u64_ns).collect(),
+            rss_bytes: resource_usage::statm_rss(&mut self.statm_file).ok(),
+        };
+
+        serde_json::to_writer(&mut self.writer, &record)?;
+        self.writer.write_all(b"\n")?;
+        // flush so that the stream can be followed while the simulation runs
+        self.writer.flush()?;
+
+        self.last_record_sim_time = now;
+        self.last_record_wall_time = wall_now;
+
+        Ok(())
+    }
+}
+
+fn as_u64_ns(d: Duration) -> u64 {
+    d.as_nanos().try_into().unwrap_or(u64::MAX)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_stream() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("sim-stats.ndjson");
+        let mut stream = StatsStream::new(&path, Some(SimulationTime::SECOND)).unwrap();
+
+        let thread = |events, busy_ms| ThreadRoundStats {
+            counts: EventCounts {
+                events,
+                packets: 1,
+                ..Default::default()
+            },
+            active_hosts: 1,
+            busy: Duration::from_millis(busy_ms),
+        };
+
+        stream.add_round(
+            SimulationTime::from_millis(10),
+            Duration::from_millis(5),
+            [thread(3, 5), thread(4, 2)],
+        );
+        stream.add_round(
+            SimulationTime::from_millis(30),
+            Duration::from_millis(5),
+            [thread(1, 4), thread(2, 5)],
+        );
+
+        // not a full interval yet
+        stream
+            .maybe_write_record(EmulatedTime::SIMULATION_START + SimulationTime::from_millis(40))
+            .unwrap();
+        stream
+            .maybe_write_record(EmulatedTime::SIMULATION_START + SimulationTime::SECOND)
+            .unwrap();
+
+        let contents = std::fs::read_to_string(&path).unwrap();
+        let records: Vec<serde_json::Value> = contents
+            .lines()
+            .map(|x| serde_json::from_str(x).unwrap())
+            .collect();
+        assert_eq!(records.len(), 1);
+        let record = &records[0];
+        assert_eq!(record["sim_time_ns"], 1_000_000_000);
+        assert_eq!(record["rounds"], 2);
+        assert_eq!(record["avg_round_width_ns"], 20_000_000);
+        assert_eq!(record["events"], 10);
+        assert_eq!(record["packets"], 4);
+        assert_eq!(
+            record["worker_idle_ns"],
+            serde_json::json!([1_000_000, 3_000_000])
+        );
+        assert!(record["rss_bytes"].as_u64().unwrap() > 0);
+    }
+}
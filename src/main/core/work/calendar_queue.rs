@@ -0,0 +1,299 @@
+use std::cmp::Reverse;
+use std::collections::VecDeque;
+use std::collections::binary_heap::BinaryHeap;
+
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+use super::event_queue::PanickingOrd;
+
+/// An item with a time, for use in a [`CalendarQueue`].
+///
+/// The item's [`PartialOrd`] must be consistent with its time. That is, if `a.time() < b.time()`
+/// then `a < b`.
+pub trait Timed: PartialOrd + Eq {
+    fn time(&self) -> EmulatedTime;
+}
+
+/// The number of buckets in the calendar, including the current bucket. Items further in the
+/// future than this many buckets are kept in an overflow heap until the calendar reaches them.
+const NUM_BUCKETS: usize = 1024;
+
+/// A priority queue of [`Timed`] items, bucketed by time.
+///
+/// Items are placed in fixed-width time buckets, and only the earliest non-empty bucket is kept
+/// ordered (in a small binary heap). Pushing to a future bucket is O(1), and pushing to or popping
+/// from the current bucket is O(log k) where k is the number of items in the current bucket rather
+/// than in the entire queue. This works well when the bucket width is chosen so that each bucket
+/// holds a modest number of items (for example a fraction of the scheduling round width), and the
+/// queue falls back to a binary heap for items far in the future.
+///
+/// Items are popped in the order given by their `PartialOrd` implementation, exactly as they
+/// would be from a binary heap. Will panic if two items have no relative order.
+#[derive(Debug)]
+pub struct CalendarQueue<T: Timed> {
+    bucket_width_ns: u64,
+    /// The absolute bucket number of `current`.
+    base: u64,
+    /// Every item whose bucket number is at most `base`. Is only empty if the entire queue is
+    /// empty.
+    current: BinaryHeap<Reverse<PanickingOrd<T>>>,
+    /// Unsorted items in buckets `base + 1` to `base + NUM_BUCKETS - 1`.
+    buckets: VecDeque<Vec<T>>,
+    /// The total number of items in `buckets`.
+    num_in_buckets: usize,
+    /// Items in buckets `base + NUM_BUCKETS` and later.
+    overflow: BinaryHeap<Reverse<PanickingOrd<T>>>,
+    len: usize,
+}
+
+impl<T: Timed> CalendarQueue<T> {
+    /// A new queue with buckets of width `bucket_width`. Will panic if the width is zero.
+    pub fn new(bucket_width: SimulationTime) -> Self {
+        let bucket_width_ns = u64::try_from(bucket_width.as_nanos()).unwrap();
+        assert!(bucket_width_ns > 0);
+
+        Self {
+            bucket_width_ns,
+            base: 0,
+            current: BinaryHeap::new(),
+            buckets: (0..NUM_BUCKETS - 1).map(|_| Vec::new()).collect(),
+            num_in_buckets: 0,
+            overflow: BinaryHeap::new(),
+            len: 0,
+        }
+    }
+
+    fn bucket_of(&self, time: EmulatedTime) -> u64 {
+        let since_start = time.saturating_duration_since(&EmulatedTime::SIMULATION_START);
+        u64::try_from(since_start.as_nanos()).unwrap() / self.bucket_width_ns
+    }
+
+    /// Place an item somewhere other than `current`. The item must be in a bucket after `base`.
+    fn insert_future(&mut self, item: T, bucket: u64) {
+        debug_assert!(bucket > self.base);
+        let offset = bucket - self.base;
+        if offset < u64::try_from(NUM_BUCKETS).unwrap() {
+            self.buckets[usize::try_from(offset - 1).unwrap()].push(item);
+            self.num_in_buckets += 1;
+        } else {
+            self.overflow.push(Reverse(item.into()));
+        }
+    }
+
+    pub fn push(&mut self, item: T) {
+        let bucket = self.bucket_of(item.time());
+
+        if self.len == 0 {
+            // start the calendar at this item
+            self.base = bucket;
+            self.current.push(Reverse(item.into()));
+        } else if bucket <= self.base {
+            self.current.push(Reverse(item.into()));
+        } else {
+            self.insert_future(item, bucket);
+        }
+
+        self.len += 1;
+    }
+
+    pub fn pop(&mut self) -> Option<T> {
+        let item = self.current.pop()?.0.into_inner();
+        self.len -= 1;
+
+        if self.current.is_empty() && self.len > 0 {
+            self.advance();
+        }
+
+        Some(item)
+    }
+
+    pub fn peek(&self) -> Option<&T> {
+        self.current.peek().map(|x| &*x.0)
+    }
+
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// Free the memory of empty buckets and unused capacity.
+    pub fn shrink_to_fit(&mut self) {
+        self.current.shrink_to_fit();
+        for bucket in &mut self.buckets {
+            bucket.shrink_to_fit();
+        }
+        self.overflow.shrink_to_fit();
+    }
+
+    /// Move to the next non-empty bucket. Must only be called when `current` is empty and the
+    /// queue is not.
+    fn advance(&mut self) {
+        debug_assert!(self.current.is_empty());
+
+        if self.num_in_buckets == 0 {
+            self.restart_from_overflow();
+            return;
+        }
+
+        // rotate the calendar until we reach a non-empty bucket
+        while self.current.is_empty() {
+            let mut bucket = self.buckets.pop_front().unwrap();
+            self.base += 1;
+            self.num_in_buckets -= bucket.len();
+
+            // reuse the allocations of the old current bucket and the popped bucket
+            let mut current = std::mem::take(&mut self.current).into_vec();
+            debug_assert!(current.is_empty());
+            current.extend(bucket.drain(..).map(|x| Reverse(x.into())));
+            self.current = BinaryHeap::from(current);
+            self.buckets.push_back(bucket);
+
+            // any overflow items in the new last bucket must be moved in to the calendar
+            let last_bucket = self.base + u64::try_from(NUM_BUCKETS).unwrap() - 1;
+            while self
+                .overflow
+                .peek()
+                .is_some_and(|x| self.bucket_of(x.0.time()) == last_bucket)
+            {
+                let item = self.overflow.pop().unwrap().0.into_inner();
+                self.buckets.back_mut().unwrap().push(item);
+                self.num_in_buckets += 1;
+            }
+        }
+    }
+
+    /// Restart the calendar at the earliest overflow item. Must only be called when the calendar
+    /// is empty and the overflow heap is not.
+    fn restart_from_overflow(&mut self) {
+        let earliest = self.overflow.pop().unwrap().0.into_inner();
+        self.base = self.bucket_of(earliest.time());
+        self.current.push(Reverse(earliest.into()));
+
+        let last_bucket = self.base + u64::try_from(NUM_BUCKETS).unwrap() - 1;
+        while let Some(x) = self.overflow.peek() {
+            let bucket = self.bucket_of(x.0.time());
+            if bucket > last_bucket {
+                break;
+            }
+            let item = self.overflow.pop().unwrap().0.into_inner();
+            if bucket == self.base {
+                self.current.push(Reverse(item.into()));
+            } else {
+                self.insert_future(item, bucket);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use rand::seq::SliceRandom;
+    use rand::{Rng, SeedableRng};
+
+    use super::*;
+
+    #[derive(Debug, PartialEq, Eq, PartialOrd, Ord)]
+    struct Item {
+        time: EmulatedTime,
+        id: u64,
+    }
+
+    impl Timed for Item {
+        fn time(&self) -> EmulatedTime {
+            self.time
+        }
+    }
+
+    fn item(ns: u64, id: u64) -> Item {
+        Item {
+            time: EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(ns),
+            id,
+        }
+    }
+
+    #[test]
+    fn test_ordering() {
+        let mut queue = CalendarQueue::new(SimulationTime::from_nanos(10));
+
+        for (ns, id) in [(25, 0), (5, 1), (5, 0), (1_000_000, 0), (15, 0), (25, 1)] {
+            queue.push(item(ns, id));
+        }
+        assert_eq!(queue.len(), 6);
+
+        let popped: Vec<_> = std::iter::from_fn(|| queue.pop())
+            .map(|x| (x.time.to_abs_simtime().as_nanos(), x.id))
+            .collect();
+        assert_eq!(
+            popped,
+            [(5, 0), (5, 1), (15, 0), (25, 0), (25, 1), (1_000_000, 0)]
+        );
+        assert!(queue.is_empty());
+    }
+
+    #[test]
+    fn test_shrink_to_fit() {
+        let mut queue = CalendarQueue::new(SimulationTime::from_nanos(10));
+
+        for ns in 0..1000 {
+            queue.push(item(ns, 0));
+        }
+        for ns in [5, 2_000, 1_000_000] {
+            queue.push(item(ns, 1));
+        }
+        for _ in 0..900 {
+            queue.pop().unwrap();
+        }
+
+        queue.shrink_to_fit();
+        let popped: Vec<_> = std::iter::from_fn(|| queue.pop())
+            .map(|x| x.time.to_abs_simtime().as_nanos())
+            .collect();
+        let expected: Vec<u128> = (899..1000).chain([2_000, 1_000_000]).collect();
+        assert_eq!(popped, expected);
+    }
+
+    #[test]
+    fn test_matches_heap() {
+        let mut rng = rand_xoshiro::Xoshiro256PlusPlus::seed_from_u64(0);
+        let mut queue = CalendarQueue::new(SimulationTime::from_nanos(100));
+        let mut heap = BinaryHeap::new();
+
+        let mut now = 0;
+        let mut next_id = 0;
+        for _ in 0..10_000 {
+            // push a few items at or after the current time, some far in the future
+            let mut new_items: Vec<u64> = (0..rng.random_range(0..4))
+                .map(|_| match rng.random_range(0..10) {
+                    0 => now + rng.random_range(0..10_000_000),
+                    _ => now + rng.random_range(0..1_000),
+                })
+                .collect();
+            new_items.shuffle(&mut rng);
+            for ns in new_items {
+                queue.push(item(ns, next_id));
+                heap.push(Reverse(item(ns, next_id)));
+                next_id += 1;
+            }
+
+            for _ in 0..rng.random_range(0..4) {
+                let a = queue.pop();
+                let b = heap.pop().map(|x| x.0);
+                assert_eq!(a, b);
+                if let Some(a) = a {
+                    now = a.time.to_abs_simtime().as_nanos().try_into().unwrap();
+                }
+            }
+            assert_eq!(queue.peek(), heap.peek().map(|x| &x.0));
+            assert_eq!(queue.len(), heap.len());
+        }
+
+        while let Some(b) = heap.pop() {
+            assert_eq!(queue.pop(), Some(b.0));
+        }
+        assert!(queue.is_empty());
+    }
+}
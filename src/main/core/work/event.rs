@@ -23,6 +23,7 @@ impl Event {
             time,
             data: EventData::Packet(PacketEventData {
                 packet,
+                train: Vec::new(),
                 src_host_id: src_host.id(),
                 src_host_event_id: src_host.get_new_event_id(),
             }),
@@ -54,6 +55,66 @@ impl Event {
         self.time = time;
     }
 
+    /// A key that orders events with the same time the same way as the event's [`PartialOrd`]
+    /// implementation: packet events by their source host and then by their event ID, followed
+    /// by local events by their event ID.
+    pub(super) fn order_key(&self) -> (u32, u64) {
+        self.magic.debug_check();
+        match &self.data {
+            EventData::Packet(data) => {
+                let host = u32::from(data.src_host_id);
+                // this value is reserved for local events
+                assert_ne!(host, u32::MAX);
+                (host, data.src_host_event_id)
+            }
+            EventData::Local(data) => (u32::MAX, data.event_id),
+        }
+    }
+
+    /// Is this a packet event?
+    pub fn is_packet(&self) -> bool {
+        self.magic.debug_check();
+        matches!(self.data, EventData::Packet(_))
+    }
+
+    /// Append the packets of the packet event `other` to this packet event, so that they're
+    /// delivered together as a "packet train". Both events must be packet events from the same
+    /// source host with the same time, and `other` must be from later in the source host's
+    /// execution. Returns `other` if the events can't be merged.
+    ///
+    /// Since packet events are ordered by their source host and then by the order they were
+    /// created in, delivering the packets together does not change the order in which they're
+    /// processed, as long as no other packet event from the same source host for the same time
+    /// is merged in between.
+    pub fn try_merge_packets(&mut self, other: Event) -> Result<(), Event> {
+        self.magic.debug_check();
+        other.magic.debug_check();
+
+        if self.time != other.time {
+            return Err(other);
+        }
+
+        let (EventData::Packet(data), EventData::Packet(other_data)) =
+            (&mut self.data, &other.data)
+        else {
+            return Err(other);
+        };
+
+        if data.src_host_id != other_data.src_host_id
+            || data.src_host_event_id >= other_data.src_host_event_id
+        {
+            return Err(other);
+        }
+
+        let EventData::Packet(other_data) = other.data else {
+            unreachable!();
+        };
+        data.train.push(other_data.packet);
+        data.train.extend(other_data.train);
+
+        Ok(())
+    }
+
     /// The event data.
     pub fn data(self) -> EventData {
         self.magic.debug_check();
@@ -112,6 +173,8 @@ pub enum EventData {
 #[derive(Debug, PartialEq, Eq)]
 pub struct PacketEventData {
     packet: PacketRc,
+    /// Packets that follow `packet` in a packet train (see [`Event::try_merge_packets`]).
+    train: Vec<PacketRc>,
     src_host_id: HostId,
     src_host_event_id: u64,
 }
@@ -122,9 +185,10 @@ pub struct LocalEventData {
     event_id: u64,
 }
 
-impl From<PacketEventData> for PacketRc {
-    fn from(data: PacketEventData) -> Self {
-        data.packet
+impl PacketEventData {
+    /// The packets of the event, in the order they were sent.
+    pub fn into_packets(self) -> impl Iterator<Item = PacketRc> {
+        std::iter::once(self.packet).chain(self.train)
     }
 }
 
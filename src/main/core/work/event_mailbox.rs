@@ -0,0 +1,94 @@
+use std::sync::atomic::Ordering;
+
+use crossbeam::queue::SegQueue;
+use shadow_shim_helper_rs::emulated_time::{AtomicEmulatedTime, EmulatedTime};
+
+use super::event::Event;
+use super::event_queue::EventQueue;
+
+/// An unordered, lock-free inbox of [`Event`]s sent to a host from other hosts.
+///
+/// Any worker thread may push to the mailbox without blocking the destination host or other
+/// senders. The destination host moves the events into its own [`EventQueue`] (which orders them)
+/// when it next runs, so the order in which events arrive in the mailbox does not affect
+/// determinism.
+///
+/// The mailbox also tracks a lower bound on the time of the host's next event, including events
+/// already in the host's event queue. This allows the manager to skip hosts that have no events
+/// in a round without locking the host or its event queue.
+#[derive(Debug)]
+pub struct EventMailbox {
+    events: SegQueue<Event>,
+    /// Batches of events pushed at once with [`EventMailbox::push_batch`].
+    batches: SegQueue<Vec<Event>>,
+    /// A lower bound on the host's next event time, or `EmulatedTime::MAX` if it has no events.
+    next_event_time: AtomicEmulatedTime,
+}
+
+impl EventMailbox {
+    pub fn new() -> Self {
+        Self {
+            events: SegQueue::new(),
+            batches: SegQueue::new(),
+            next_event_time: AtomicEmulatedTime::new(EmulatedTime::MAX),
+        }
+    }
+
+    /// Add an event to the mailbox.
+    pub fn push(&self, event: Event) {
+        let time = event.time();
+        self.events.push(event);
+        self.lower_next_event_time(time);
+    }
+
+    /// Add several events to the mailbox at once. This costs a single push, and the events are
+    /// later added to the event queue together.
+    pub fn push_batch(&self, events: Vec<Event>) {
+        let Some(time) = events.iter().map(|x| x.time()).min() else {
+            return;
+        };
+        self.batches.push(events);
+        self.lower_next_event_time(time);
+    }
+
+    /// Move all events currently in the mailbox to `queue`. Events pushed concurrently may or may
+    /// not be moved.
+    pub fn drain_into(&self, queue: &mut EventQueue) {
+        while let Some(batch) = self.batches.pop() {
+            queue.extend(batch);
+        }
+        while let Some(event) = self.events.pop() {
+            queue.push(event);
+        }
+    }
+
+    /// Returns true if the mailbox currently has no events.
+    pub fn is_empty(&self) -> bool {
+        self.events.is_empty() && self.batches.is_empty()
+    }
+
+    /// A lower bound on the host's next event time, or `None` if the host has no events.
+    pub fn next_event_time(&self) -> Option<EmulatedTime> {
+        let time = self.next_event_time.load(Ordering::Acquire);
+        (time != EmulatedTime::MAX).then_some(time)
+    }
+
+    /// Inform the mailbox that the host has an event at `time`.
+    pub fn lower_next_event_time(&self, time: EmulatedTime) {
+        self.next_event_time.fetch_min(time, Ordering::AcqRel);
+    }
+
+    /// Forget the host's next event time. The host must call this before it drains the mailbox
+    /// and then inform the mailbox of its next event time, so that no concurrent pushes are
+    /// missed.
+    pub fn reset_next_event_time(&self) {
+        self.next_event_time
+            .swap(EmulatedTime::MAX, Ordering::AcqRel);
+    }
+}
+
+impl Default for EventMailbox {
+    fn default() -> Self {
+        Self::new()
+    }
+}
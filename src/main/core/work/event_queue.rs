@@ -2,55 +2,224 @@ use std::cmp::Reverse;
 use std::collections::binary_heap::BinaryHeap;
 
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
+use super::calendar_queue::{CalendarQueue, Timed};
 use super::event::Event;
 
 /// A queue of [`Event`]s ordered by their times.
+///
+/// The events themselves are stored in a slab, and the heap (or calendar) only holds small
+/// [`Entry`] handles with the event's time, ordering key, and slab slot. Sifting entries then
+/// moves 24 bytes at a time rather than entire events, and comparisons don't need to follow the
+/// events' pointers.
 #[derive(Debug)]
 pub struct EventQueue {
-    queue: BinaryHeap<Reverse<PanickingOrd<Event>>>,
+    queue: Queue,
+    /// The queued events, indexed by [`Entry::slot`].
+    events: Vec<Option<Event>>,
+    /// Slots of `events` that are empty.
+    free_slots: Vec<u32>,
     last_popped_event_time: EmulatedTime,
 }
 
+/// The data structure backing an [`EventQueue`]. Both pop events in the same order.
+#[derive(Debug)]
+enum Queue {
+    Heap(BinaryHeap<Reverse<Entry>>),
+    Calendar(CalendarQueue<Entry>),
+}
+
+/// A handle to a queued event. Entries are ordered by the event's time and then by its
+/// [`Event::order_key`], so they're in the same order as the events they refer to.
+#[derive(Debug, Copy, Clone, PartialEq, Eq, PartialOrd, Ord)]
+struct Entry {
+    time: EmulatedTime,
+    host: u32,
+    id: u64,
+    /// Only used to break ties between events that have the same time and key, which shouldn't
+    /// occur in practice. The slots are assigned deterministically, so this order is also
+    /// deterministic.
+    slot: u32,
+}
+
+static_assertions::assert_eq_size!(Entry, [u64; 3]);
+
+impl Timed for Entry {
+    fn time(&self) -> EmulatedTime {
+        self.time
+    }
+}
+
 impl EventQueue {
+    /// A new queue backed by a binary heap.
     pub fn new() -> Self {
+        Self::with_queue(Queue::Heap(BinaryHeap::new()))
+    }
+
+    /// A new queue backed by a [`CalendarQueue`] with buckets of width `bucket_width`. This is
+    /// faster than the binary heap when the host has many pending events, and bucket widths of a
+    /// fraction of the scheduling round width work well.
+    pub fn new_calendar(bucket_width: SimulationTime) -> Self {
+        Self::with_queue(Queue::Calendar(CalendarQueue::new(bucket_width)))
+    }
+
+    fn with_queue(queue: Queue) -> Self {
         Self {
-            queue: BinaryHeap::new(),
+            queue,
+            events: Vec::new(),
+            free_slots: Vec::new(),
             last_popped_event_time: EmulatedTime::SIMULATION_START,
         }
     }
 
+    /// Store the event in the slab and return its entry.
+    fn insert(
+        events: &mut Vec<Option<Event>>,
+        free_slots: &mut Vec<u32>,
+        last_popped_event_time: EmulatedTime,
+        event: Event,
+    ) -> Entry {
+        // make sure time never moves backward
+        assert!(event.time() >= last_popped_event_time);
+
+        let (host, id) = event.order_key();
+        let time = event.time();
+
+        let slot = match free_slots.pop() {
+            Some(slot) => {
+                events[usize::try_from(slot).unwrap()] = Some(event);
+                slot
+            }
+            None => {
+                events.push(Some(event));
+                u32::try_from(events.len() - 1).unwrap()
+            }
+        };
+
+        Entry {
+            time,
+            host,
+            id,
+            slot,
+        }
+    }
+
     /// Push a new [`Event`] on to the queue.
     ///
-    /// Will panic if two events are pushed that have no relative order
-    /// (`event_a.partial_cmp(&event_b) == None`). Will be non-deterministic if two events are
-    /// pushed that are equal (`event_a == event_b`).
-    ///
     /// Will panic if the event time is earlier than the last popped event time (time moves
     /// backward).
     pub fn push(&mut self, event: Event) {
-        // make sure time never moves backward
-        assert!(event.time() >= self.last_popped_event_time);
+        let entry = Self::insert(
+            &mut self.events,
+            &mut self.free_slots,
+            self.last_popped_event_time,
+            event,
+        );
+
+        match &mut self.queue {
+            Queue::Heap(heap) => heap.push(Reverse(entry)),
+            Queue::Calendar(calendar) => calendar.push(entry),
+        }
+    }
+
+    /// Push several [`Event`]s on to the queue. When backed by a binary heap, a large number of
+    /// events is added by rebuilding the heap rather than pushing them one at a time.
+    ///
+    /// Has the same requirements as [`EventQueue::push`].
+    pub fn extend(&mut self, events: impl IntoIterator<Item = Event>) {
+        let Self {
+            queue,
+            events: slab,
+            free_slots,
+            last_popped_event_time,
+        } = self;
+        let entries = events
+            .into_iter()
+            .map(|event| Self::insert(slab, free_slots, *last_popped_event_time, event));
 
-        self.queue.push(Reverse(event.into()));
+        match queue {
+            Queue::Heap(heap) => heap.extend(entries.map(Reverse)),
+            Queue::Calendar(calendar) => entries.for_each(|x| calendar.push(x)),
+        }
     }
 
     /// Pop the earliest [`Event`] from the queue.
     pub fn pop(&mut self) -> Option<Event> {
-        let event = self.queue.pop().map(|x| x.0.into_inner());
+        let entry = match &mut self.queue {
+            Queue::Heap(heap) => heap.pop().map(|x| x.0),
+            Queue::Calendar(calendar) => calendar.pop(),
+        }?;
+
+        let event = self.events[usize::try_from(entry.slot).unwrap()]
+            .take()
+            .unwrap();
+        self.free_slots.push(entry.slot);
 
         // make sure time never moves backward
-        if let Some(ref event) = event {
-            assert!(event.time() >= self.last_popped_event_time);
-            self.last_popped_event_time = event.time();
+        assert!(event.time() >= self.last_popped_event_time);
+        self.last_popped_event_time = event.time();
+
+        Some(event)
+    }
+
+    /// Pop the earliest [`Event`] from the queue if `f` returns true for it.
+    pub fn pop_if(&mut self, f: impl FnOnce(&Event) -> bool) -> Option<Event> {
+        let next = self.peek_entry().map(|x| {
+            self.events[usize::try_from(x.slot).unwrap()]
+                .as_ref()
+                .unwrap()
+        });
+
+        if next.is_some_and(f) {
+            self.pop()
+        } else {
+            None
+        }
+    }
+
+    fn peek_entry(&self) -> Option<&Entry> {
+        match &self.queue {
+            Queue::Heap(heap) => heap.peek().map(|x| &x.0),
+            Queue::Calendar(calendar) => calendar.peek(),
+        }
+    }
+
+    /// The number of events in the queue.
+    pub fn len(&self) -> usize {
+        match &self.queue {
+            Queue::Heap(heap) => heap.len(),
+            Queue::Calendar(calendar) => calendar.len(),
         }
+    }
 
-        event
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
     }
 
     /// The time of the next [`Event`] (the time of the earliest event in the queue).
     pub fn next_event_time(&self) -> Option<EmulatedTime> {
-        self.queue.peek().map(|x| x.0.time())
+        self.peek_entry().map(|x| x.time)
+    }
+
+    /// Free unused capacity, for example after a burst of events. Doesn't change the order that
+    /// the queued events are popped in.
+    pub fn shrink_to_fit(&mut self) {
+        match &mut self.queue {
+            Queue::Heap(heap) => heap.shrink_to_fit(),
+            Queue::Calendar(calendar) => calendar.shrink_to_fit(),
+        }
+
+        // empty slots at the end of the slab don't need to be kept
+        while self.events.last().is_some_and(Option::is_none) {
+            self.events.pop();
+        }
+        let len = self.events.len();
+        self.free_slots
+            .retain(|slot| usize::try_from(*slot).unwrap() < len);
+
+        self.events.shrink_to_fit();
+        self.free_slots.shrink_to_fit();
     }
 }
 
@@ -64,7 +233,7 @@ impl Default for EventQueue {
 /// objects cannot be compared (`PartialOrd::partial_cmp` returns `None`), the comparison will
 /// panic.
 #[derive(Debug, Default, Copy, Clone, PartialEq, Eq)]
-struct PanickingOrd<T: PartialOrd + Eq>(T);
+pub(super) struct PanickingOrd<T: PartialOrd + Eq>(T);
 
 impl<T: PartialOrd + Eq> PanickingOrd<T> {
     pub fn into_inner(self) -> T {
@@ -1,3 +1,6 @@
+pub mod calendar_queue;
 pub mod event;
+pub mod event_mailbox;
 pub mod event_queue;
 pub mod task;
+pub mod timer_wheel;
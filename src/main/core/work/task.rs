@@ -13,12 +13,15 @@ pub struct TaskRef {
     magic: Magic<Self>,
     _counter: ObjectCounter,
     inner: Arc<dyn Fn(&Host) + Send + Sync>,
+    /// The type name of the task's closure, which identifies where the task was created.
+    name: &'static str,
 }
 
 impl TaskRef {
     pub fn new<T: 'static + Fn(&Host) + Send + Sync>(f: T) -> Self {
         Self {
             inner: Arc::new(f),
+            name: std::any::type_name::<T>(),
             magic: Magic::new(),
             _counter: ObjectCounter::new("TaskRef"),
         }
@@ -31,6 +34,11 @@ impl TaskRef {
         self.magic.debug_check();
         (self.inner)(host)
     }
+
+    /// The type name of the task's closure, such as `shadow_rs::host::Host::foo::{{closure}}`.
+    pub fn name(&self) -> &'static str {
+        self.name
+    }
 }
 
 impl IsSend for TaskRef {}
@@ -0,0 +1,382 @@
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
+
+/// The width of a level-0 slot is `2^TICK_SHIFT` nanoseconds (about 1 ms).
+const TICK_SHIFT: u32 = 20;
+/// Each level has `2^LEVEL_BITS` slots, and each slot at level `n + 1` spans all of the slots at
+/// level `n`.
+const LEVEL_BITS: u32 = 6;
+const NUM_SLOTS: usize = 1 << LEVEL_BITS;
+/// Enough levels to hold any nanosecond deadline that fits in a `u64`.
+const NUM_LEVELS: usize = (u64::BITS - TICK_SHIFT).div_ceil(LEVEL_BITS) as usize;
+
+/// An identifier for a timer in a [`TimerWheel`]. An identifier is never reused, so a timer that
+/// has already expired or been cancelled can't accidentally cancel a different timer.
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub struct TimerId {
+    index: u32,
+    generation: u32,
+}
+
+#[derive(Debug)]
+struct Timer<T> {
+    deadline_ns: u64,
+    /// Orders timers with the same deadline by when they were inserted.
+    seq: u64,
+    level: u8,
+    slot: u8,
+    /// The timer's position in its slot.
+    pos: u32,
+    value: T,
+}
+
+#[derive(Debug)]
+struct Entry<T> {
+    generation: u32,
+    timer: Option<Timer<T>>,
+}
+
+/// A hierarchical timer wheel of values that expire at a deadline.
+///
+/// Timers are placed in one of several levels of slots depending on how far their deadline is
+/// from the wheel's current time, and are moved to lower levels as the wheel reaches them.
+/// Inserting and cancelling a timer are O(1), regardless of how many timers are in the wheel, so
+/// timers that are frequently re-armed (cancelled and re-inserted) are cheap. Timers are popped in
+/// order of their deadline, and timers with the same deadline are popped in the order they were
+/// inserted.
+#[derive(Debug)]
+pub struct TimerWheel<T> {
+    entries: Vec<Entry<T>>,
+    /// Unused indexes of `entries`.
+    free: Vec<u32>,
+    /// The slots of every level, each holding indexes of `entries`.
+    slots: Vec<Vec<u32>>,
+    /// A bit for each non-empty slot.
+    occupied: [u64; NUM_LEVELS],
+    /// The wheel's current time in ticks. Every timer's deadline is treated as being at least this
+    /// tick.
+    current: u64,
+    next_seq: u64,
+    len: usize,
+}
+
+impl<T> TimerWheel<T> {
+    pub fn new() -> Self {
+        Self {
+            entries: Vec::new(),
+            free: Vec::new(),
+            slots: (0..NUM_LEVELS * NUM_SLOTS).map(|_| Vec::new()).collect(),
+            occupied: [0; NUM_LEVELS],
+            current: 0,
+            next_seq: 0,
+            len: 0,
+        }
+    }
+
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    fn deadline_ns(time: EmulatedTime) -> u64 {
+        let since_start = time.saturating_duration_since(&EmulatedTime::SIMULATION_START);
+        u64::try_from(since_start.as_nanos()).unwrap()
+    }
+
+    /// Add a timer that expires at `deadline`. The deadline may be in the past.
+    pub fn insert(&mut self, deadline: EmulatedTime, value: T) -> TimerId {
+        let timer = Timer {
+            deadline_ns: Self::deadline_ns(deadline),
+            seq: self.next_seq,
+            level: 0,
+            slot: 0,
+            pos: 0,
+            value,
+        };
+        self.next_seq += 1;
+
+        let index = match self.free.pop() {
+            Some(index) => index,
+            None => {
+                self.entries.push(Entry {
+                    generation: 0,
+                    timer: None,
+                });
+                u32::try_from(self.entries.len() - 1).unwrap()
+            }
+        };
+
+        let entry = &mut self.entries[index as usize];
+        debug_assert!(entry.timer.is_none());
+        entry.timer = Some(timer);
+        let generation = entry.generation;
+
+        self.place(index);
+        self.len += 1;
+
+        TimerId { index, generation }
+    }
+
+    /// Remove a timer, returning its value. Returns `None` if the timer has already been popped or
+    /// cancelled.
+    pub fn cancel(&mut self, id: TimerId) -> Option<T> {
+        let entry = self.entries.get(id.index as usize)?;
+        if entry.generation != id.generation || entry.timer.is_none() {
+            return None;
+        }
+
+        Some(self.remove(id.index).1)
+    }
+
+    /// The deadline of the earliest timer.
+    pub fn next_deadline(&mut self) -> Option<EmulatedTime> {
+        let index = self.earliest()?;
+        let timer = self.entries[index as usize].timer.as_ref().unwrap();
+        Some(EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(timer.deadline_ns))
+    }
+
+    /// Remove and return the earliest timer if its deadline is at or before `now`.
+    pub fn pop_expired(&mut self, now: EmulatedTime) -> Option<(EmulatedTime, T)> {
+        let index = self.earliest()?;
+        let timer = self.entries[index as usize].timer.as_ref().unwrap();
+        if timer.deadline_ns > Self::deadline_ns(now) {
+            return None;
+        }
+
+        let (deadline_ns, value) = self.remove(index);
+        Some((
+            EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(deadline_ns),
+            value,
+        ))
+    }
+
+    /// Put the timer into the slot for its deadline relative to the current tick.
+    fn place(&mut self, index: u32) {
+        let timer = self.entries[index as usize].timer.as_mut().unwrap();
+        let tick = std::cmp::max(timer.deadline_ns >> TICK_SHIFT, self.current);
+
+        // the level is given by the most significant bit where the tick differs from the current
+        // tick, so every timer in a level shares the current tick's higher-level slot numbers
+        let level = match tick ^ self.current {
+            0 => 0,
+            diff => (diff.ilog2() / LEVEL_BITS) as usize,
+        };
+        let slot = ((tick >> (level as u32 * LEVEL_BITS)) as usize) & (NUM_SLOTS - 1);
+
+        let list = &mut self.slots[level * NUM_SLOTS + slot];
+        timer.level = level.try_into().unwrap();
+        timer.slot = slot.try_into().unwrap();
+        timer.pos = list.len().try_into().unwrap();
+        list.push(index);
+        self.occupied[level] |= 1 << slot;
+    }
+
+    fn remove(&mut self, index: u32) -> (u64, T) {
+        let entry = &mut self.entries[index as usize];
+        let timer = entry.timer.take().unwrap();
+        entry.generation = entry.generation.wrapping_add(1);
+
+        let (level, slot) = (timer.level as usize, timer.slot as usize);
+        let pos = timer.pos as usize;
+        let list = &mut self.slots[level * NUM_SLOTS + slot];
+        debug_assert_eq!(list[pos], index);
+        list.swap_remove(pos);
+        if let Some(&moved) = list.get(pos) {
+            self.entries[moved as usize].timer.as_mut().unwrap().pos = pos.try_into().unwrap();
+        }
+        if list.is_empty() {
+            self.occupied[level] &= !(1 << slot);
+        }
+
+        self.free.push(index);
+        self.len -= 1;
+
+        (timer.deadline_ns, timer.value)
+    }
+
+    /// Returns the index of the earliest timer, first moving timers down to level 0 as needed.
+    fn earliest(&mut self) -> Option<u32> {
+        loop {
+            // lower levels always hold earlier timers than higher levels, and within a level the
+            // slots are never behind the current tick
+            let level = self.occupied.iter().position(|x| *x != 0)?;
+            let slot = self.occupied[level].trailing_zeros() as usize;
+
+            if level == 0 {
+                // all timers in the slot have the same tick, except for timers whose deadline was
+                // already behind the current tick when they were inserted
+                return self.slots[slot].iter().copied().min_by_key(|x| {
+                    let timer = self.entries[*x as usize].timer.as_ref().unwrap();
+                    (timer.deadline_ns, timer.seq)
+                });
+            }
+
+            // there are no timers before this slot, so advance to its first tick and redistribute
+            // its timers to lower levels
+            let shift = level as u32 * LEVEL_BITS;
+            let upper = (self.current >> (shift + LEVEL_BITS)) << (shift + LEVEL_BITS);
+            self.current = upper | ((slot as u64) << shift);
+
+            let mut list = std::mem::take(&mut self.slots[level * NUM_SLOTS + slot]);
+            self.occupied[level] &= !(1 << slot);
+            for index in list.iter() {
+                self.place(*index);
+            }
+
+            // keep the slot's allocation
+            list.clear();
+            self.slots[level * NUM_SLOTS + slot] = list;
+        }
+    }
+}
+
+impl<T> Default for TimerWheel<T> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use rand::{Rng, SeedableRng};
+
+    use super::*;
+
+    fn time(ns: u64) -> EmulatedTime {
+        EmulatedTime::SIMULATION_START + SimulationTime::from_nanos(ns)
+    }
+
+    fn pop_all(wheel: &mut TimerWheel<u64>, now: u64) -> Vec<u64> {
+        std::iter::from_fn(|| wheel.pop_expired(time(now)).map(|(_, x)| x)).collect()
+    }
+
+    #[test]
+    fn test_ordering() {
+        let mut wheel = TimerWheel::new();
+
+        for (ns, value) in [
+            (25, 0),
+            (5, 1),
+            (5, 2),
+            (1 << 40, 3),
+            (3 << 20, 4),
+            (25, 5),
+            (1 << 30, 6),
+        ] {
+            wheel.insert(time(ns), value);
+        }
+
+        assert_eq!(wheel.len(), 7);
+        assert_eq!(wheel.next_deadline(), Some(time(5)));
+        assert_eq!(pop_all(&mut wheel, 4), Vec::<u64>::new());
+        assert_eq!(pop_all(&mut wheel, 25), [1, 2, 0, 5]);
+        assert_eq!(wheel.next_deadline(), Some(time(3 << 20)));
+        assert_eq!(pop_all(&mut wheel, 1 << 30), [4, 6]);
+        assert_eq!(wheel.pop_expired(time(u64::MAX)), Some((time(1 << 40), 3)));
+        assert!(wheel.is_empty());
+        assert_eq!(wheel.next_deadline(), None);
+    }
+
+    #[test]
+    fn test_past_deadline() {
+        let mut wheel = TimerWheel::new();
+
+        wheel.insert(time(10 << 20), 0);
+        assert_eq!(wheel.next_deadline(), Some(time(10 << 20)));
+
+        // the wheel has moved forward, but a deadline before it should still come first
+        wheel.insert(time(5), 1);
+        wheel.insert(time(9 << 20), 2);
+        assert_eq!(wheel.next_deadline(), Some(time(5)));
+        assert_eq!(pop_all(&mut wheel, u64::MAX), [1, 2, 0]);
+    }
+
+    #[test]
+    fn test_cancel() {
+        let mut wheel = TimerWheel::new();
+
+        let a = wheel.insert(time(100), 0);
+        let b = wheel.insert(time(100 << 20), 1);
+        let c = wheel.insert(time(100), 2);
+
+        assert_eq!(wheel.cancel(a), Some(0));
+        assert_eq!(wheel.cancel(a), None);
+        assert_eq!(wheel.len(), 2);
+
+        // the cancelled timer's storage is reused, but its id is still invalid
+        let d = wheel.insert(time(50), 3);
+        assert_eq!(wheel.cancel(a), None);
+
+        assert_eq!(pop_all(&mut wheel, 100), [3, 2]);
+        assert_eq!(wheel.cancel(c), None);
+        assert_eq!(wheel.cancel(d), None);
+        assert_eq!(wheel.cancel(b), Some(1));
+        assert!(wheel.is_empty());
+    }
+
+    #[test]
+    fn test_rearm() {
+        let mut wheel = TimerWheel::new();
+
+        // a timer that keeps getting pushed further into the future
+        let mut id = wheel.insert(time(1000), 0);
+        for i in 1..10_000 {
+            assert_eq!(wheel.cancel(id), Some(i - 1));
+            id = wheel.insert(time(1000 + i * 1000), i);
+        }
+
+        assert_eq!(wheel.len(), 1);
+        assert_eq!(pop_all(&mut wheel, 9_999_999), Vec::<u64>::new());
+        assert_eq!(pop_all(&mut wheel, 10_000_000), [9_999]);
+    }
+
+    #[test]
+    fn test_random() {
+        let mut rng = rand_xoshiro::Xoshiro256PlusPlus::seed_from_u64(0);
+        let mut wheel = TimerWheel::new();
+        let mut expected = std::collections::BTreeMap::new();
+        let mut ids = Vec::new();
+        let mut now = 0;
+
+        for value in 0..20_000 {
+            match rng.random_range(0..10) {
+                // insert a timer, sometimes in the past
+                0..=5 => {
+                    let range = 1 << rng.random_range(1..40);
+                    let deadline = now + rng.random_range(0..range) - now / 8;
+                    let id = wheel.insert(time(deadline), value);
+                    expected.insert((deadline, value), id);
+                    ids.push((id, deadline, value));
+                }
+                // cancel a timer, which may have already expired
+                6..=7 if !ids.is_empty() => {
+                    let (id, deadline, value) = ids.swap_remove(rng.random_range(0..ids.len()));
+                    let was_pending = expected.remove(&(deadline, value)).is_some();
+                    assert_eq!(wheel.cancel(id), was_pending.then_some(value));
+                }
+                // move forward in time and check that timers expire in order
+                _ => {
+                    now += rng.random_range(0..(1 << 30));
+                    let popped = pop_all(&mut wheel, now);
+                    let mut expired = Vec::new();
+                    while let Some(entry) = expected.first_entry() {
+                        if entry.key().0 > now {
+                            break;
+                        }
+                        expired.push(entry.remove_entry().0.1);
+                    }
+                    assert_eq!(popped, expired);
+                }
+            }
+
+            assert_eq!(wheel.len(), expected.len());
+            assert_eq!(
+                wheel.next_deadline(),
+                expected.keys().next().map(|(deadline, _)| time(*deadline))
+            );
+        }
+    }
+}
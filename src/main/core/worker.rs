@@ -1,7 +1,7 @@
 use std::cell::{Cell, RefCell};
 use std::collections::HashMap;
+use std::sync::Arc;
 use std::sync::atomic::{AtomicBool, AtomicU32};
-use std::sync::{Arc, Mutex};
 
 use atomic_refcell::{AtomicRef, AtomicRefCell};
 use linux_api::posix_types::Pid;
@@ -13,20 +13,31 @@ use shadow_shim_helper_rs::rootedcell::rc::RootedRc;
 use shadow_shim_helper_rs::rootedcell::refcell::RootedRefCell;
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
-use super::work::event_queue::EventQueue;
+use super::work::event_mailbox::EventMailbox;
 use crate::core::controller::ShadowStatusBarState;
-use crate::core::runahead::Runahead;
+use crate::core::event_trace::{EventTrace, EventTraceBuffer, TracedEvent};
+use crate::core::memory_data_dir::MemoryDataDir;
+use crate::core::output_store::OutputStore;
+use crate::core::profile::{HostProfile, SyscallLatencies};
+use crate::core::runahead::{HostLookahead, RoundWindow, Runahead};
 use crate::core::sim_config::Bandwidth;
-use crate::core::sim_stats::{LocalSimStats, SharedSimStats};
+use crate::core::sim_stats::{LocalSimStats, ObjectTypeId, SharedSimStats, syscall_counter_name};
+use crate::core::stats_stream::EventCounts;
 use crate::core::work::event::Event;
+use crate::host::descriptor::file_cache::FileCache;
+use crate::host::file_io_pool::FileIoPool;
 use crate::host::host::Host;
 use crate::host::process::{Process, ProcessId};
+use crate::host::process_launcher::ProcessLauncher;
 use crate::host::thread::{Thread, ThreadId};
+use crate::host::zygote::ZygotePool;
 use crate::network::dns::Dns;
-use crate::network::graph::{IpAssignment, RoutingInfo};
+use crate::network::graph::{IpAssignment, PathProperties, RoutingInfo};
+use crate::network::ip_table::Ipv4Table;
 use crate::network::packet::{PacketRc, PacketStatus};
 use crate::utility::childpid_watcher::ChildPidWatcher;
 use crate::utility::counter::Counter;
+use crate::utility::flat_counter::FlatCounter;
 use crate::utility::status_bar;
 
 static USE_OBJECT_COUNTERS: AtomicBool = AtomicBool::new(false);
@@ -38,19 +49,23 @@ static SIM_STATS: Lazy<SharedSimStats> = Lazy::new(SharedSimStats::new);
 std::thread_local! {
     // Initialized when the worker thread starts running. No shared ownership
     // or access from outside of the current thread.
-    static WORKER: once_cell::unsync::OnceCell<RefCell<Worker>> = const { once_cell::unsync::OnceCell::new() };
+    //
+    // The worker is only ever accessed through shared references (its mutable state has its own
+    // cells), so it isn't in a `RefCell` that would need to be borrowed on every access.
+    static WORKER: once_cell::unsync::OnceCell<Worker> = const { once_cell::unsync::OnceCell::new() };
 }
 
 // shared global state
 // Must not mutably borrow when the simulation is running.
 pub static WORKER_SHARED: AtomicRefCell<Option<WorkerShared>> = AtomicRefCell::new(None);
 
-#[derive(Copy, Clone, Debug)]
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
 pub struct WorkerThreadID(pub u32);
 
 struct Clock {
     now: Option<EmulatedTime>,
     barrier: Option<EmulatedTime>,
+    window: Option<RoundWindow>,
 }
 
 /// Worker context, containing 'global' information for the current thread.
@@ -77,27 +92,51 @@ pub struct Worker {
     // Statistics about the simulation, such as syscall counts.
     sim_stats: LocalSimStats,
 
+    // The number of packets sent along each path (between graph nodes), which are added to the
+    // routing info's counts when the worker's stats are added to the global stats.
+    packet_counts: RefCell<HashMap<(u32, u32), u64>>,
+
+    // Packet events sent by this worker in the current round that haven't yet been delivered to
+    // their destination hosts' mailboxes. Only used if `WorkerShared::use_packet_outbox` is set.
+    packet_outbox: RefCell<Vec<(HostId, Event)>>,
+
     next_event_time: Cell<Option<EmulatedTime>>,
+
+    // The events run by this worker since the counts were last taken.
+    event_counts: Cell<EventCounts>,
+
+    // Records of the events run by this worker. Only present if `WorkerShared::event_trace` is.
+    event_trace_buffer: RefCell<Option<EventTraceBuffer>>,
 }
 
 impl Worker {
     // Create worker for this thread.
     pub fn new_for_this_thread(worker_id: WorkerThreadID) {
         WORKER.with(|worker| {
-            let res = worker.set(RefCell::new(Self {
+            let shared = AtomicRef::map(WORKER_SHARED.borrow(), |x| x.as_ref().unwrap());
+            let event_trace_buffer = shared
+                .event_trace
+                .as_ref()
+                .map(|_| EventTraceBuffer::new(worker_id.0));
+            let res = worker.set(Self {
                 worker_id,
-                shared: AtomicRef::map(WORKER_SHARED.borrow(), |x| x.as_ref().unwrap()),
+                shared,
                 active_host: RefCell::new(None),
                 active_process: RefCell::new(None),
                 active_thread: RefCell::new(None),
                 clock: RefCell::new(Clock {
                     now: None,
                     barrier: None,
+                    window: None,
                 }),
                 min_latency_cache: Cell::new(None),
                 sim_stats: LocalSimStats::new(),
+                packet_counts: RefCell::new(HashMap::new()),
+                packet_outbox: RefCell::new(Vec::new()),
                 next_event_time: Cell::new(None),
-            }));
+                event_counts: Cell::new(EventCounts::default()),
+                event_trace_buffer: RefCell::new(event_trace_buffer),
+            });
             assert!(res.is_ok(), "Worker already initialized");
         });
     }
@@ -267,6 +306,25 @@ impl Worker {
         Worker::with(|w| w.clock.borrow().barrier).flatten()
     }
 
+    /// Set the global bounds of the current scheduling round.
+    pub fn set_round_window(window: RoundWindow) {
+        Worker::with(|w| w.clock.borrow_mut().window.replace(window)).unwrap();
+    }
+
+    /// The time that the given host may run up to (but not including) in the current round. This
+    /// is the end of the round window unless per-host lookahead is enabled.
+    pub fn host_round_end_time(host_id: HostId) -> EmulatedTime {
+        Worker::with(|w| w.host_round_end_time_inner(host_id)).unwrap()
+    }
+
+    fn host_round_end_time_inner(&self, host_id: HostId) -> EmulatedTime {
+        let window = self.clock.borrow().window.unwrap();
+        match &self.shared.lookahead {
+            Some(lookahead) => lookahead.host_window_end(host_id, &window),
+            None => window.end,
+        }
+    }
+
     /// Maximum time that the current event may run ahead to.
     pub fn max_event_runahead_time(host: &Host) -> EmulatedTime {
         let mut max = Worker::round_end_time().unwrap();
@@ -289,16 +347,17 @@ impl Worker {
     }
 
     pub fn update_lowest_used_latency(t: SimulationTime) {
+        Worker::with(|w| w.update_lowest_used_latency_inner(t)).unwrap();
+    }
+
+    fn update_lowest_used_latency_inner(&self, t: SimulationTime) {
         assert!(t != SimulationTime::ZERO);
 
-        Worker::with(|w| {
-            let min_latency_cache = w.min_latency_cache.get();
-            if min_latency_cache.is_none() || t < min_latency_cache.unwrap() {
-                w.min_latency_cache.set(Some(t));
-                w.shared.update_lowest_used_latency(t);
-            }
-        })
-        .unwrap();
+        let min_latency_cache = self.min_latency_cache.get();
+        if min_latency_cache.is_none() || t < min_latency_cache.unwrap() {
+            self.min_latency_cache.set(Some(t));
+            self.shared.update_lowest_used_latency(t);
+        }
     }
 
     pub fn reset_next_event_time() {
@@ -310,24 +369,29 @@ impl Worker {
     }
 
     pub fn update_next_event_time(t: EmulatedTime) {
-        Worker::with(|w| {
-            let next_event_time = w.next_event_time.get();
-            if next_event_time.is_none() || t < next_event_time.unwrap() {
-                w.next_event_time.set(Some(t));
-            }
-        })
-        .unwrap();
+        Worker::with(|w| w.update_next_event_time_inner(t)).unwrap();
+    }
+
+    fn update_next_event_time_inner(&self, t: EmulatedTime) {
+        let next_event_time = self.next_event_time.get();
+        if next_event_time.is_none() || t < next_event_time.unwrap() {
+            self.next_event_time.set(Some(t));
+        }
     }
 
     /// The packet will be dropped if the packet's destination IP is not part of the simulation (no
     /// host has been configured for the IP).
     pub fn send_packet(src_host: &Host, packetrc: PacketRc) {
-        let current_time = Worker::current_time().unwrap();
-        let round_end_time = Worker::round_end_time().unwrap();
+        // this runs for every packet, so everything is done within a single access of the
+        // thread-local worker
+        Worker::with(|w| w.send_packet_inner(src_host, packetrc)).unwrap()
+    }
+
+    fn send_packet_inner(&self, src_host: &Host, packetrc: PacketRc) {
+        let current_time = self.clock.borrow().now.unwrap();
 
-        let is_completed = current_time >= Worker::with(|w| w.shared.sim_end_time).unwrap();
-        let is_bootstrapping =
-            current_time < Worker::with(|w| w.shared.bootstrap_end_time).unwrap();
+        let is_completed = current_time >= self.shared.sim_end_time;
+        let is_bootstrapping = current_time < self.shared.bootstrap_end_time;
 
         if is_completed {
             // the simulation is over, don't bother
@@ -338,7 +402,7 @@ impl Worker {
         let dst_ip = *packetrc.dst_ipv4_address().ip();
         let payload_size = packetrc.payload_len();
 
-        let Some(dst_host_id) = Worker::resolve_ip_to_host_id(dst_ip) else {
+        let Some(dst) = self.shared.host_addrs.get(dst_ip) else {
             log_once_per_value_at_level!(
                 dst_ip,
                 std::net::Ipv4Addr,
@@ -350,13 +414,18 @@ impl Worker {
             return;
         };
 
-        let src_ip = std::net::IpAddr::V4(src_ip);
-        let dst_ip = std::net::IpAddr::V4(dst_ip);
+        let dst_host_id = dst.host_id;
+
+        // look up the latency and reliability of the path at once
+        let src = self.shared.host_addrs.get(src_ip).unwrap();
+        let path = self.shared.routing_info.path_by_index_at(
+            src.node_index,
+            dst.node_index,
+            u64::try_from((current_time - EmulatedTime::SIMULATION_START).as_nanos()).unwrap(),
+        );
 
         // check if network reliability forces us to 'drop' the packet
-        let reliability: f64 = Worker::with(|w| w.shared.reliability(src_ip, dst_ip).unwrap())
-            .unwrap()
-            .into();
+        let reliability: f64 = (1.0 - path.packet_loss).into();
         let chance: f64 = src_host.random_mut().random();
 
         // don't drop control packets with length 0, otherwise congestion control has problems
@@ -367,31 +436,126 @@ impl Worker {
             return;
         }
 
-        let delay = Worker::with(|w| w.shared.latency(src_ip, dst_ip).unwrap()).unwrap();
+        let delay = SimulationTime::from_nanos(path.latency_ns);
 
-        Worker::update_lowest_used_latency(delay);
-        Worker::with(|w| w.shared.increment_packet_count(src_ip, dst_ip)).unwrap();
+        self.update_lowest_used_latency_inner(delay);
+        self.increment_packet_count_inner(src.node_id, dst.node_id);
 
         // TODO: this should change for sending to remote manager (on a different machine); this is
-        // the only place where tasks are sent between separate host
+        // the only place where tasks are sent between separate host. A remote destination would
+        // need the packet to be queued in a per-remote-manager batch (rather than pushed to the
+        // destination's mailbox) which is sent at the end of the round, and the deliver time
+        // below would also need to be reported to the remote managers' round coordination.
 
         packetrc.add_status(PacketStatus::InetSent);
-
-        // delay the packet until the next round
+        usdt_probe!(
+            packet_send,
+            src_host.id(),
+            current_time,
+            dst_host_id,
+            payload_size
+        );
+
+        // delay the packet until the destination's next round; the destination may have already
+        // run up to the end of its window for this round
+        let dst_round_end_time = self.host_round_end_time_inner(dst_host_id);
         let mut deliver_time = current_time + delay;
-        if deliver_time < round_end_time {
-            deliver_time = round_end_time;
+        if deliver_time < dst_round_end_time {
+            deliver_time = dst_round_end_time;
         }
 
         // we may have sent this packet after the destination host finished running the current
         // round and calculated its min event time, so we put this in our min event time instead
-        Worker::update_next_event_time(deliver_time);
+        self.update_next_event_time_inner(deliver_time);
 
-        // copy the packet (except the payload) so the dst gets its own header info
+        // copy the packet (sharing its transport data) so the dst gets its own header and status
+        // info
         let dst_packet = packetrc.new_copy_inner();
-        Worker::with(|w| {
-            w.shared
+        if self.shared.use_packet_outbox {
+            // the deliver time is at or after the destination's round end time, so the
+            // destination won't need this packet until the next round
+            let event = Event::new_packet(dst_packet, deliver_time, src_host);
+            self.packet_outbox.borrow_mut().push((dst_host_id, event));
+        } else {
+            self.shared
                 .push_packet_to_host(dst_packet, dst_host_id, deliver_time, src_host)
+        }
+    }
+
+    /// Count an event run by this worker, which contained `packets` packets with `packet_bytes`
+    /// bytes of payload.
+    #[inline]
+    pub fn count_event(packets: u64, packet_bytes: u64) {
+        Worker::with(|w| {
+            let mut counts = w.event_counts.get();
+            counts.events += 1;
+            counts.packets += packets;
+            counts.packet_bytes += packet_bytes;
+            w.event_counts.set(counts);
+        })
+        .unwrap()
+    }
+
+    /// Count the syscalls handled by a host while this worker was running it.
+    pub fn count_syscalls(syscalls: u64) {
+        Worker::with(|w| {
+            let mut counts = w.event_counts.get();
+            counts.syscalls += syscalls;
+            w.event_counts.set(counts);
+        })
+        .unwrap()
+    }
+
+    /// Is the event trace enabled? If not, [`Worker::trace_event`] shouldn't be called.
+    pub fn is_event_trace_enabled() -> bool {
+        Worker::with(|w| w.shared.event_trace.is_some()).unwrap()
+    }
+
+    /// Add a record of an event to the event trace.
+    pub fn trace_event(event: &TracedEvent) {
+        Worker::with(|w| {
+            let trace = w.shared.event_trace.as_ref().unwrap();
+            let mut buffer = w.event_trace_buffer.borrow_mut();
+            if let Err(e) = buffer.as_mut().unwrap().add(trace, event) {
+                log::warn!("Unable to write to the event trace: {e}");
+            }
+        })
+        .unwrap()
+    }
+
+    /// Take the counts of the events run by this worker since the counts were last taken.
+    pub fn take_event_counts() -> EventCounts {
+        Worker::with(|w| w.event_counts.take()).unwrap()
+    }
+
+    /// Deliver the packets in this worker's outbox to their destination hosts, with a single
+    /// batch for each host. Must be called by each worker at the end of every round.
+    pub fn flush_packet_outbox() {
+        Worker::with(|w| {
+            let mut outbox = w.packet_outbox.borrow_mut();
+            if outbox.is_empty() {
+                return;
+            }
+
+            // group the events by destination host
+            outbox.sort_by_key(|(host_id, _)| *host_id);
+
+            let mut events = outbox.drain(..).peekable();
+            while let Some((host_id, event)) = events.next() {
+                let mut batch = vec![event];
+                while let Some((_, event)) = events.next_if(|(x, _)| *x == host_id) {
+                    if w.shared.use_packet_trains {
+                        // consecutive packets from the same source host for the same time can be
+                        // delivered as a single event
+                        if let Err(event) = batch.last_mut().unwrap().try_merge_packets(event) {
+                            batch.push(event);
+                        }
+                    } else {
+                        batch.push(event);
+                    }
+                }
+                w.shared.push_packets_to_host(batch, host_id);
+            }
         })
         .unwrap();
     }
@@ -403,41 +567,47 @@ impl Worker {
     where
         F: FnOnce(&Worker) -> O,
     {
-        WORKER
-            .try_with(|w| w.get().map(|w| f(&w.borrow())))
-            .ok()
-            .flatten()
+        WORKER.try_with(|w| w.get().map(f)).ok().flatten()
+    }
+
+    /// Whether object allocations and deallocations are counted. Always `false` when shadow was
+    /// built with the `no_object_counters` feature.
+    #[inline]
+    pub fn use_object_counters() -> bool {
+        !cfg!(feature = "no_object_counters")
+            && USE_OBJECT_COUNTERS.load(std::sync::atomic::Ordering::Relaxed)
     }
 
-    pub fn increment_object_alloc_counter(s: &str) {
-        if !USE_OBJECT_COUNTERS.load(std::sync::atomic::Ordering::Relaxed) {
+    pub fn increment_object_alloc_counter(id: ObjectTypeId) {
+        if !Worker::use_object_counters() {
             return;
         }
 
         Worker::with(|w| {
-            w.sim_stats.alloc_counts.borrow_mut().add_one(s);
+            w.sim_stats.alloc_counts.borrow_mut().add_one(id.into());
         })
         .unwrap_or_else(|| {
             // no live worker; fall back to the shared counter
-            SIM_STATS.alloc_counts.lock().unwrap().add_one(s);
+            SIM_STATS.alloc_counts.lock().unwrap().add_one(id.name());
         });
     }
 
-    pub fn increment_object_dealloc_counter(s: &str) {
-        if !USE_OBJECT_COUNTERS.load(std::sync::atomic::Ordering::Relaxed) {
+    pub fn increment_object_dealloc_counter(id: ObjectTypeId) {
+        if !Worker::use_object_counters() {
             return;
         }
 
         Worker::with(|w| {
-            w.sim_stats.dealloc_counts.borrow_mut().add_one(s);
+            w.sim_stats.dealloc_counts.borrow_mut().add_one(id.into());
         })
         .unwrap_or_else(|| {
             // no live worker; fall back to the shared counter
-            SIM_STATS.dealloc_counts.lock().unwrap().add_one(s);
+            SIM_STATS.dealloc_counts.lock().unwrap().add_one(id.name());
         });
     }
 
-    pub fn add_syscall_counts(syscall_counts: &Counter) {
+    /// Add syscall counts that are indexed by syscall number.
+    pub fn add_syscall_counts(syscall_counts: &FlatCounter) {
         Worker::with(|w| {
             w.sim_stats
                 .syscall_counts
@@ -450,7 +620,7 @@ impl Worker {
                 .syscall_counts
                 .lock()
                 .unwrap()
-                .add_counter(syscall_counts);
+                .add_counter(&syscall_counts.to_counter(syscall_counter_name));
 
             // while we handle this okay, this probably indicates an issue somewhere else in the
             // code so panic only in debug builds
@@ -458,8 +628,103 @@ impl Worker {
         });
     }
 
+    pub fn add_syscall_latencies(syscall_latencies: &SyscallLatencies) {
+        Worker::with(|w| {
+            w.sim_stats
+                .syscall_latencies
+                .borrow_mut()
+                .add_latencies(syscall_latencies);
+        })
+        .unwrap_or_else(|| {
+            // no live worker; fall back to the shared stats
+            SIM_STATS
+                .syscall_latencies
+                .lock()
+                .unwrap()
+                .add_latencies(syscall_latencies);
+        });
+    }
+
+    /// Record the final profile of a host. Hosts are only profiled once, so this is written to the
+    /// shared stats directly.
+    pub fn add_host_profile(hostname: &str, profile: HostProfile) {
+        SIM_STATS
+            .host_profiles
+            .lock()
+            .unwrap()
+            .insert(hostname.to_string(), profile);
+    }
+
+    pub fn add_ipc_counts(ipc_counts: &Counter) {
+        Worker::with(|w| {
+            w.sim_stats.ipc_counts.borrow_mut().add_counter(ipc_counts);
+        })
+        .unwrap_or_else(|| {
+            // no live worker (for example if the thread is dropped during teardown); fall back to
+            // the shared counter
+            SIM_STATS.ipc_counts.lock().unwrap().add_counter(ipc_counts);
+        });
+    }
+
+    pub fn add_lock_counts(lock_counts: &Counter) {
+        Worker::with(|w| {
+            w.sim_stats
+                .lock_counts
+                .borrow_mut()
+                .add_counter(lock_counts);
+        })
+        .unwrap_or_else(|| {
+            SIM_STATS
+                .lock_counts
+                .lock()
+                .unwrap()
+                .add_counter(lock_counts);
+        });
+    }
+
+    pub fn add_round_trip_latencies(latencies: &SyscallLatencies) {
+        Worker::with(|w| {
+            w.sim_stats
+                .round_trip_latencies
+                .borrow_mut()
+                .add_latencies(latencies);
+        })
+        .unwrap_or_else(|| {
+            // no live worker; fall back to the shared stats
+            SIM_STATS
+                .round_trip_latencies
+                .lock()
+                .unwrap()
+                .add_latencies(latencies);
+        });
+    }
+
     pub fn add_to_global_sim_stats() {
-        Worker::with(|w| SIM_STATS.add_from_local_stats(&w.sim_stats)).unwrap()
+        Worker::with(|w| {
+            SIM_STATS.add_from_local_stats(&w.sim_stats);
+            w.shared
+                .routing_info
+                .add_packet_counts(w.packet_counts.take());
+
+            // the trace is written when `WORKER_SHARED` is dropped
+            if let Some(buffer) = w.event_trace_buffer.borrow_mut().as_mut() {
+                if let Err(e) = buffer.flush(w.shared.event_trace.as_ref().unwrap()) {
+                    log::warn!("Unable to write to the event trace: {e}");
+                }
+            }
+        })
+        .unwrap()
+    }
+
+    /// Count a packet sent from graph node `src` to `dst` in this worker's local packet counts.
+    fn increment_packet_count_inner(&self, src: u32, dst: u32) {
+        if !self.shared.use_packet_counters {
+            return;
+        }
+
+        let mut packet_counts = self.packet_counts.borrow_mut();
+        let x = packet_counts.entry((src, dst)).or_insert(0);
+        *x = x.saturating_add(1);
     }
 
     pub fn is_routable(src: std::net::IpAddr, dst: std::net::IpAddr) -> bool {
@@ -477,6 +742,16 @@ impl Worker {
         Worker::with(|w| w.clock.borrow().now.unwrap() < w.shared.bootstrap_end_time).unwrap()
     }
 
+    /// The experimental bootstrap runahead, if it's set and the simulation is bootstrapping.
+    pub fn bootstrap_runahead() -> Option<SimulationTime> {
+        Worker::with(|w| {
+            w.shared
+                .runahead
+                .bootstrap_runahead(w.clock.borrow().now.unwrap())
+        })
+        .unwrap()
+    }
+
     pub fn resolve_name_to_ip(name: &std::ffi::CStr) -> Option<std::net::Ipv4Addr> {
         if let Ok(name) = name.to_str() {
             Worker::with_dns(|dns| dns.name_to_addr(name))
@@ -484,16 +759,25 @@ impl Worker {
             None
         }
     }
+}
 
-    fn resolve_ip_to_host_id(ip: std::net::Ipv4Addr) -> Option<HostId> {
-        Worker::with_dns(|dns| dns.addr_to_host_id(ip))
-    }
+/// The host and graph node that a simulated IP address belongs to.
+#[derive(Copy, Clone, Debug)]
+pub struct HostAddrInfo {
+    pub host_id: HostId,
+    /// The graph node id.
+    pub node_id: u32,
+    /// The graph node's index in the routing info.
+    pub node_index: usize,
 }
 
 #[derive(Debug)]
 pub struct WorkerShared {
-    pub ip_assignment: IpAssignment<u32>,
-    pub routing_info: RoutingInfo<u32>,
+    pub ip_assignment: Arc<IpAssignment<u32>>,
+    pub routing_info: Arc<RoutingInfo<u32>>,
+    /// The host and graph node of every host address, so that routing a packet doesn't need to
+    /// hash its addresses.
+    pub host_addrs: Ipv4Table<HostAddrInfo>,
     pub host_bandwidths: HashMap<std::net::IpAddr, Bandwidth>,
     pub dns: Dns,
     // allows for easy updating of the status bar's state
@@ -502,9 +786,36 @@ pub struct WorkerShared {
     pub num_plugin_errors: AtomicU32,
     // calculates the runahead for the next simulation round
     pub runahead: Runahead,
+    /// Per-host round windows; `None` if all hosts run in lockstep using the runahead.
+    pub lookahead: Option<HostLookahead>,
     pub child_pid_watcher: ChildPidWatcher,
-    /// Event queues for each host. This should only be used to push packet events.
-    pub event_queues: HashMap<HostId, Arc<Mutex<EventQueue>>>,
+    /// Zygotes to spawn managed processes from; `None` if processes are spawned with `execve`.
+    pub zygotes: Option<ZygotePool>,
+    /// Launches managed processes before their start time; `None` if processes are started at
+    /// their start time.
+    pub process_launcher: Option<ProcessLauncher>,
+    /// Does file I/O for managed processes on background threads; `None` if the I/O is done on
+    /// the worker threads.
+    pub file_io_pool: Option<FileIoPool>,
+    /// Inbound event mailboxes for each host. This should only be used to push packet events.
+    pub event_mailboxes: HashMap<HostId, Arc<EventMailbox>>,
+    /// Should workers count the packets sent along each path?
+    pub use_packet_counters: bool,
+    /// Buffer sent packets in a per-worker outbox and deliver them at the end of the round.
+    pub use_packet_outbox: bool,
+    /// Merge consecutive packet events in the outbox into packet trains. Requires
+    /// `use_packet_outbox`.
+    pub use_packet_trains: bool,
+    /// The trace of the events run by all workers; `None` if event tracing is disabled.
+    pub event_trace: Option<EventTrace>,
+    /// The cache of file contents shared by all hosts; `None` if no file cache paths are set.
+    pub file_cache: Option<FileCache>,
+    /// The segment files for the output of managed processes; `None` if process output is written
+    /// to a file for each stream.
+    pub output_store: Option<Arc<OutputStore>>,
+    /// The hosts' data directories on a memory-backed filesystem; `None` if they're in the data
+    /// directory.
+    pub memory_data_dir: Option<Arc<MemoryDataDir>>,
     pub bootstrap_end_time: EmulatedTime,
     pub sim_end_time: EmulatedTime,
 }
@@ -514,39 +825,52 @@ impl WorkerShared {
         &self.dns
     }
 
-    pub fn latency(&self, src: std::net::IpAddr, dst: std::net::IpAddr) -> Option<SimulationTime> {
-        let src = self.ip_assignment.get_node(src)?;
-        let dst = self.ip_assignment.get_node(dst)?;
+    fn host_addr(&self, ip: std::net::IpAddr) -> Option<HostAddrInfo> {
+        let std::net::IpAddr::V4(ip) = ip else {
+            return None;
+        };
+        self.host_addrs.get(ip)
+    }
 
-        Some(SimulationTime::from_nanos(
-            self.routing_info.path(src, dst)?.latency_ns,
+    /// The latency and packet loss of the path between two hosts.
+    /// The path between two hosts at time `time`.
+    pub fn path(
+        &self,
+        src: std::net::IpAddr,
+        dst: std::net::IpAddr,
+        time: EmulatedTime,
+    ) -> Option<PathProperties> {
+        let src = self.host_addr(src)?;
+        let dst = self.host_addr(dst)?;
+
+        Some(self.routing_info.path_by_index_at(
+            src.node_index,
+            dst.node_index,
+            u64::try_from((time - EmulatedTime::SIMULATION_START).as_nanos()).unwrap(),
         ))
     }
 
-    pub fn reliability(&self, src: std::net::IpAddr, dst: std::net::IpAddr) -> Option<f32> {
-        let src = self.ip_assignment.get_node(src)?;
-        let dst = self.ip_assignment.get_node(dst)?;
-
-        Some(1.0 - self.routing_info.path(src, dst)?.packet_loss)
+    pub fn latency(
+        &self,
+        src: std::net::IpAddr,
+        dst: std::net::IpAddr,
+        time: EmulatedTime,
+    ) -> Option<SimulationTime> {
+        Some(SimulationTime::from_nanos(
+            self.path(src, dst, time)?.latency_ns,
+        ))
     }
 
     pub fn bandwidth(&self, ip: std::net::IpAddr) -> Option<&Bandwidth> {
         self.host_bandwidths.get(&ip)
     }
 
-    pub fn increment_packet_count(&self, src: std::net::IpAddr, dst: std::net::IpAddr) {
-        let src = self.ip_assignment.get_node(src).unwrap();
-        let dst = self.ip_assignment.get_node(dst).unwrap();
-
-        self.routing_info.increment_packet_count(src, dst)
-    }
-
     pub fn is_routable(&self, src: std::net::IpAddr, dst: std::net::IpAddr) -> bool {
-        if self.ip_assignment.get_node(src).is_none() {
+        if self.host_addr(src).is_none() {
             return false;
         }
 
-        if self.ip_assignment.get_node(dst).is_none() {
+        if self.host_addr(dst).is_none() {
             return false;
         }
 
@@ -578,8 +902,19 @@ impl WorkerShared {
         }
     }
 
-    pub fn get_runahead(&self) -> SimulationTime {
-        self.runahead.get()
+    /// The runahead for the round starting at `start`.
+    pub fn get_runahead(&self, start: EmulatedTime) -> SimulationTime {
+        self.runahead.get(start)
+    }
+
+    /// The length of the scheduling round starting at `start`. This is the runahead, or the
+    /// largest per-host lookahead if per-host lookahead is enabled and it's larger.
+    pub fn get_round_length(&self, start: EmulatedTime) -> SimulationTime {
+        let runahead = self.runahead.get(start);
+        match &self.lookahead {
+            Some(lookahead) => std::cmp::max(runahead, lookahead.max_lookahead()),
+            None => runahead,
+        }
     }
 
     /// Should only be called from the thread-local worker.
@@ -592,8 +927,29 @@ impl WorkerShared {
         &self.child_pid_watcher
     }
 
-    /// Push a packet to the destination host's event queue. Does not check that the time is valid
-    /// (is outside of the current scheduling round, etc).
+    pub fn zygotes(&self) -> Option<&ZygotePool> {
+        self.zygotes.as_ref()
+    }
+
+    pub fn process_launcher(&self) -> Option<&ProcessLauncher> {
+        self.process_launcher.as_ref()
+    }
+
+    pub fn file_io_pool(&self) -> Option<&FileIoPool> {
+        self.file_io_pool.as_ref()
+    }
+
+    pub fn output_store(&self) -> Option<&Arc<OutputStore>> {
+        self.output_store.as_ref()
+    }
+
+    pub fn memory_data_dir(&self) -> Option<&Arc<MemoryDataDir>> {
+        self.memory_data_dir.as_ref()
+    }
+
+    /// Push a packet to the destination host's event mailbox. The destination host will move it
+    /// to its event queue before it next runs. Does not check that the time is valid (is outside
+    /// of the current scheduling round, etc).
     pub fn push_packet_to_host(
         &self,
         packet: PacketRc,
@@ -602,8 +958,14 @@ impl WorkerShared {
         src_host: &Host,
     ) {
         let event = Event::new_packet(packet, time, src_host);
-        let event_queue = self.event_queues.get(&dst_host_id).unwrap();
-        event_queue.lock().unwrap().push(event);
+        let mailbox = self.event_mailboxes.get(&dst_host_id).unwrap();
+        mailbox.push(event);
+    }
+
+    /// Push a batch of packet events to a host.
+    pub fn push_packets_to_host(&self, events: Vec<Event>, dst_host_id: HostId) {
+        let mailbox = self.event_mailboxes.get(&dst_host_id).unwrap();
+        mailbox.push_batch(events);
     }
 }
 
@@ -617,7 +979,7 @@ pub fn with_global_sim_stats<T>(f: impl FnOnce(&SharedSimStats) -> T) -> T {
 }
 
 mod export {
-    use std::ffi::CString;
+    use std::ffi::{CStr, CString};
     use std::os::unix::ffi::OsStrExt;
 
     use shadow_shim_helper_rs::emulated_time::CEmulatedTime;
@@ -647,6 +1009,35 @@ mod export {
         }
     }
 
+    /// Get the contents of the file at absolute path `path`, which is open as `fd`, from the
+    /// shared file cache, and write its length to `len`. Returns NULL if the file isn't cached.
+    /// The contents are valid and unchanged until Shadow exits.
+    ///
+    /// # Safety
+    ///
+    /// `path` must be a valid nul-terminated string, and `len` must be valid for writes.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn worker_getCachedFileContents(
+        path: *const std::ffi::c_char,
+        fd: libc::c_int,
+        len: *mut libc::size_t,
+    ) -> *const std::ffi::c_char {
+        let path = unsafe { CStr::from_ptr(path) };
+        let path = std::path::Path::new(std::ffi::OsStr::from_bytes(path.to_bytes()));
+
+        let contents = Worker::with(|w| {
+            let cache = w.shared.file_cache.as_ref()?;
+            cache.contents(path, fd)
+        })
+        .unwrap();
+
+        let Some(contents) = contents else {
+            return std::ptr::null();
+        };
+        unsafe { len.write(contents.len()) };
+        contents.as_ptr().cast()
+    }
+
     /// Addresses must be provided in network byte order.
     #[unsafe(no_mangle)]
     pub extern "C-unwind" fn worker_getLatency(
@@ -656,7 +1047,8 @@ mod export {
         let src = std::net::IpAddr::V4(u32::from_be(src).into());
         let dst = std::net::IpAddr::V4(u32::from_be(dst).into());
 
-        let latency = Worker::with(|w| w.shared.latency(src, dst)).unwrap();
+        let current_time = Worker::current_time().unwrap();
+        let latency = Worker::with(|w| w.shared.latency(src, dst, current_time)).unwrap();
         SimulationTime::to_c_simtime(latency)
     }
 
@@ -691,37 +1083,47 @@ mod export {
 
     /// Implementation for counting allocated objects. Do not use this function directly.
     /// Use worker_count_allocation instead from the call site.
+    ///
+    /// # Safety
+    ///
+    /// `object_name` must be a string literal (as it is when called through
+    /// worker_count_allocation).
     #[unsafe(no_mangle)]
-    pub extern "C-unwind" fn worker_increment_object_alloc_counter(
+    pub unsafe extern "C-unwind" fn worker_increment_object_alloc_counter(
         object_name: *const libc::c_char,
     ) {
-        assert!(!object_name.is_null());
-
-        let s = unsafe { std::ffi::CStr::from_ptr(object_name) };
-        let s = s.to_str().unwrap();
-        Worker::increment_object_alloc_counter(s);
+        if !Worker::use_object_counters() {
+            return;
+        }
+        Worker::increment_object_alloc_counter(unsafe { object_type_id(object_name) });
     }
 
     /// Implementation for counting deallocated objects. Do not use this function directly.
     /// Use worker_count_deallocation instead from the call site.
+    ///
+    /// # Safety
+    ///
+    /// `object_name` must be a string literal (as it is when called through
+    /// worker_count_deallocation).
     #[unsafe(no_mangle)]
-    pub extern "C-unwind" fn worker_increment_object_dealloc_counter(
+    pub unsafe extern "C-unwind" fn worker_increment_object_dealloc_counter(
         object_name: *const libc::c_char,
     ) {
-        assert!(!object_name.is_null());
-
-        let s = unsafe { std::ffi::CStr::from_ptr(object_name) };
-        let s = s.to_str().unwrap();
-        Worker::increment_object_dealloc_counter(s);
+        if !Worker::use_object_counters() {
+            return;
+        }
+        Worker::increment_object_dealloc_counter(unsafe { object_type_id(object_name) });
     }
 
-    /// Aggregate the given syscall counts in a worker syscall counter.
-    #[unsafe(no_mangle)]
-    pub extern "C-unwind" fn worker_add_syscall_counts(syscall_counts: *const Counter) {
-        assert!(!syscall_counts.is_null());
-        let syscall_counts = unsafe { syscall_counts.as_ref() }.unwrap();
+    /// # Safety
+    ///
+    /// `object_name` must be a string literal.
+    unsafe fn object_type_id(object_name: *const libc::c_char) -> ObjectTypeId {
+        assert!(!object_name.is_null());
 
-        Worker::add_syscall_counts(syscall_counts);
+        // SAFETY: String literals live for the rest of the program.
+        let s: &'static std::ffi::CStr = unsafe { std::ffi::CStr::from_ptr(object_name) };
+        ObjectTypeId::new(s.to_str().unwrap())
     }
 
     #[unsafe(no_mangle)]
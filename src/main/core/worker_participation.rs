@@ -0,0 +1,116 @@
+//! Chooses how many worker threads run each scheduling round.
+//!
+//! Waking a parked worker thread and waiting for it at the end of the round has a fixed cost,
+//! which can be more than the work itself when only a few hosts have events in the round (for
+//! example during quiet periods of the simulation, or with a small runahead and sparse traffic).
+//! The number of threads is chosen from the number of hosts that ran in the previous round and a
+//! moving average of the worker time per host, so that each thread has enough work to be worth
+//! waking.
+
+use std::time::Duration;
+
+/// Roughly the cost of waking a parked worker thread and waiting for it at the end of the round.
+const MIN_WORK_PER_THREAD: Duration = Duration::from_micros(50);
+
+#[derive(Debug)]
+pub struct WorkerParticipation {
+    max_threads: usize,
+    /// The number of hosts that ran events in the previous round.
+    active_hosts: u64,
+    /// A moving average of the worker time per active host.
+    host_cost: Duration,
+}
+
+impl WorkerParticipation {
+    /// Until the first round has run, all hosts are assumed to be active and each host is assumed
+    /// to be worth a thread.
+    pub fn new(max_threads: usize, num_hosts: usize) -> Self {
+        assert!(max_threads > 0);
+        Self {
+            max_threads,
+            active_hosts: num_hosts.try_into().unwrap(),
+            host_cost: MIN_WORK_PER_THREAD,
+        }
+    }
+
+    /// The number of threads that should run the next round.
+    pub fn threads(&self) -> usize {
+        // a host only runs on one thread, so a round with a single host doesn't need more
+        if self.active_hosts <= 1 {
+            return 1;
+        }
+
+        let work = self.host_cost.as_nanos() * u128::from(self.active_hosts);
+        let threads = work.div_ceil(MIN_WORK_PER_THREAD.as_nanos());
+        let threads = std::cmp::min(threads, u128::from(self.active_hosts));
+
+        usize::try_from(threads)
+            .unwrap_or(usize::MAX)
+            .clamp(1, self.max_threads)
+    }
+
+    /// Update with the number of hosts that ran events in a round, and the total time that the
+    /// worker threads spent in the round.
+    pub fn add_round(&mut self, active_hosts: u64, busy: Duration) {
+        self.active_hosts = active_hosts;
+
+        // a round without active hosts says nothing about their cost
+        if active_hosts > 0 {
+            let cost = busy / u32::try_from(active_hosts).unwrap_or(u32::MAX);
+            // a moving average so that a single slow round doesn't wake many threads
+            self.host_cost = (self.host_cost * 3 + cost) / 4;
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_initial() {
+        assert_eq!(WorkerParticipation::new(8, 100).threads(), 8);
+        assert_eq!(WorkerParticipation::new(8, 3).threads(), 3);
+        assert_eq!(WorkerParticipation::new(8, 1).threads(), 1);
+        assert_eq!(WorkerParticipation::new(8, 0).threads(), 1);
+    }
+
+    #[test]
+    fn test_single_host() {
+        let mut x = WorkerParticipation::new(8, 100);
+
+        // even an expensive host only needs one thread
+        x.add_round(1, Duration::from_secs(1));
+        assert_eq!(x.threads(), 1);
+
+        x.add_round(0, Duration::from_micros(1));
+        assert_eq!(x.threads(), 1);
+    }
+
+    #[test]
+    fn test_cheap_hosts() {
+        let mut x = WorkerParticipation::new(8, 100);
+
+        // 10 hosts that take 1 us each aren't worth waking a second thread
+        for _ in 0..50 {
+            x.add_round(10, Duration::from_micros(10));
+        }
+        assert_eq!(x.threads(), 1);
+
+        // the same hosts taking 20 us each are
+        for _ in 0..50 {
+            x.add_round(10, Duration::from_micros(200));
+        }
+        assert_eq!(x.threads(), 4);
+
+        // but never more threads than hosts
+        for _ in 0..50 {
+            x.add_round(2, Duration::from_secs(1));
+        }
+        assert_eq!(x.threads(), 2);
+
+        // or more threads than there are
+        x.add_round(1000, Duration::from_secs(1));
+        assert_eq!(x.threads(), 8);
+    }
+}
@@ -93,6 +93,46 @@ impl Cpu {
     }
 }
 
+/// Tracks how much a single thread's CPU latency may be batched before its time is moved forward,
+/// as a multiple of the configured `max_unapplied_cpu_latency`. The multiple doubles each time the
+/// thread reaches the limit without interacting with the network or blocking, so that busy loops
+/// yield less often, and is reset when it does either so that network code keeps its timing.
+#[derive(Debug)]
+pub struct CpuLatencyBatching {
+    scale: u32,
+}
+
+impl CpuLatencyBatching {
+    /// The largest multiple of the configured limit that a thread may batch.
+    pub const MAX_SCALE: u32 = 16;
+
+    pub fn new() -> Self {
+        Self { scale: 1 }
+    }
+
+    /// The limit for this thread, given the configured limit `max_unapplied`.
+    pub fn max_unapplied(&self, max_unapplied: SimulationTime) -> SimulationTime {
+        max_unapplied.saturating_mul(self.scale.into())
+    }
+
+    /// The thread reached its limit without interacting with the network or blocking since the
+    /// last time.
+    pub fn limit_reached(&mut self) {
+        self.scale = (self.scale * 2).min(Self::MAX_SCALE);
+    }
+
+    /// The thread interacted with the network or blocked.
+    pub fn reset(&mut self) {
+        self.scale = 1;
+    }
+}
+
+impl Default for CpuLatencyBatching {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -243,4 +283,27 @@ mod tests {
         cpu.add_delay(Duration::from_millis(151));
         assert_eq!(cpu.delay(), SimulationTime::from_millis(200));
     }
+
+    #[test]
+    fn batching() {
+        let max = SimulationTime::from_micros(1);
+        let mut batching = CpuLatencyBatching::new();
+        assert_eq!(batching.max_unapplied(max), max);
+
+        batching.limit_reached();
+        assert_eq!(batching.max_unapplied(max), max * 2);
+        batching.limit_reached();
+        assert_eq!(batching.max_unapplied(max), max * 4);
+
+        for _ in 0..10 {
+            batching.limit_reached();
+        }
+        assert_eq!(
+            batching.max_unapplied(max),
+            max * CpuLatencyBatching::MAX_SCALE
+        );
+
+        batching.reset();
+        assert_eq!(batching.max_unapplied(max), max);
+    }
 }
@@ -1,4 +1,4 @@
-use std::collections::{BTreeSet, HashMap};
+use std::collections::BTreeMap;
 
 use log::*;
 use shadow_shim_helper_rs::explicit_drop::ExplicitDrop;
@@ -12,18 +12,30 @@ use crate::utility::callback_queue::CallbackQueue;
 /// POSIX requires fds to be assigned as `libc::c_int`, so we can't allow any fds larger than this.
 pub const FD_MAX: u32 = i32::MAX as u32;
 
+/// Indices less than this are always stored in the dense table.
+const MIN_DENSE_LEN: usize = 1024;
+
 /// Map of file handles to file descriptors. Typically owned by a
 /// [`Thread`][crate::host::thread::Thread].
+///
+/// Descriptors are stored in a dense table indexed by fd, with a bitmap of the indices in use so
+/// that the lowest available index can be found by scanning a word at a time. An index that's far
+/// past the end of the dense table (for example from `dup2` with a large fd) is stored in a sparse
+/// map instead, so that it doesn't make the table allocate space for every index below it.
 #[derive(Clone)]
 pub struct DescriptorTable {
-    descriptors: HashMap<DescriptorHandle, Descriptor>,
+    // Descriptors at indices less than `dense.len()`.
+    dense: Vec<Option<Descriptor>>,
+
+    // Bit `i % 64` of word `i / 64` is set if `dense[i]` is `Some`. Bits for indices past the end
+    // of `dense` are unset.
+    in_use: Vec<u64>,
 
-    // Indices less than `next_index` known to be available.
-    available_indices: BTreeSet<u32>,
+    // No indices in the words of `in_use` before this one are available.
+    first_available_word: usize,
 
-    // Lowest index not in `available_indices` that *might* be available. We still need to verify
-    // availability in `descriptors`, though.
-    next_index: u32,
+    // Descriptors at indices greater than or equal to `dense.len()`.
+    sparse: BTreeMap<u32, Descriptor>,
 
     _counter: ObjectCounter,
 }
@@ -31,13 +43,44 @@ pub struct DescriptorTable {
 impl DescriptorTable {
     pub fn new() -> Self {
         DescriptorTable {
-            descriptors: HashMap::new(),
-            available_indices: BTreeSet::new(),
-            next_index: 0,
+            dense: Vec::new(),
+            in_use: Vec::new(),
+            first_available_word: 0,
+            sparse: BTreeMap::new(),
             _counter: ObjectCounter::new("DescriptorTable"),
         }
     }
 
+    /// Returns the lowest index in the dense table that's at least `min_index` and isn't in use,
+    /// if any.
+    fn lowest_available_dense(&mut self, min_index: usize) -> Option<usize> {
+        // If we're searching from before the first word that might have an available index, we
+        // can start at that word instead, and any full words that we pass are also before it.
+        let from_first_available = min_index <= self.first_available_word * 64;
+
+        // The mask treats the indices below `min_index` in the first word as in use.
+        let (mut word_index, mut mask) = if from_first_available {
+            (self.first_available_word, u64::MAX)
+        } else {
+            (min_index / 64, u64::MAX << (min_index % 64))
+        };
+
+        while word_index < self.in_use.len() && (!self.in_use[word_index] & mask) == 0 {
+            word_index += 1;
+            mask = u64::MAX;
+        }
+
+        if from_first_available {
+            self.first_available_word = word_index;
+        }
+
+        let available = !self.in_use.get(word_index)? & mask;
+        let idx = word_index * 64 + available.trailing_zeros() as usize;
+
+        // the bits past the end of `dense` are also unset
+        (idx < self.dense.len()).then_some(idx)
+    }
+
     /// Add the descriptor at an unused index, and return the index. If the descriptor could not be
     /// added, the descriptor is returned in the `Err`.
     fn add(
@@ -45,97 +88,104 @@ impl DescriptorTable {
         descriptor: Descriptor,
         min_index: DescriptorHandle,
     ) -> Result<DescriptorHandle, Descriptor> {
-        let idx = if let Some(idx) = self.available_indices.range(min_index.val()..).next() {
-            // Un-borrow from `available_indices`.
-            let idx = *idx;
-            // Take from `available_indices`
-            trace!("Reusing available index {}", idx);
-            self.available_indices.remove(&idx);
-            idx
-        } else {
-            // Start our search at either the next likely available index or the minimum index,
-            // whichever is larger.
-            let mut idx = std::cmp::max(self.next_index, min_index.val());
-
-            // Check if this index out of range.
-            if idx > FD_MAX {
-                return Err(descriptor);
-            }
-
-            // Only update next_index if we started at it, otherwise there may be other
-            // available indexes lower than idx.
-            let should_update_next_index = idx == self.next_index;
-
-            // Skip past any indexes that are in use. This can happen after
-            // calling `set` with a value greater than `next_index`.
-            while self
-                .descriptors
-                .contains_key(&DescriptorHandle::new(idx).unwrap())
-            {
-                trace!("Skipping past in-use index {}", idx);
-
-                // Check if the next index is out of range.
-                if idx >= FD_MAX {
-                    return Err(descriptor);
+        let min_index = usize::try_from(min_index.val()).unwrap();
+
+        let idx = match self.lowest_available_dense(min_index) {
+            Some(idx) => u32::try_from(idx).unwrap(),
+            None => {
+                // All dense indices from the minimum are in use, so start past the end of the
+                // dense table and skip past any sparse indices that are in use.
+                let mut idx = u32::try_from(std::cmp::max(min_index, self.dense.len())).unwrap();
+                for in_use in self.sparse.range(idx..).map(|(idx, _)| *idx) {
+                    if in_use != idx {
+                        break;
+                    }
+                    trace!("Skipping past in-use index {idx}");
+                    idx = idx.saturating_add(1);
                 }
-
-                // Won't overflow because of the check above.
-                idx += 1;
-            }
-
-            if should_update_next_index {
-                self.next_index = idx + 1;
+                idx
             }
-
-            // Take the next index.
-            trace!("Using index {}", idx);
-            idx
         };
 
-        let idx = DescriptorHandle::new(idx).unwrap();
+        let Some(idx) = DescriptorHandle::new(idx) else {
+            return Err(descriptor);
+        };
 
-        let prev = self.descriptors.insert(idx, descriptor);
-        assert!(prev.is_none(), "Already a descriptor at {}", idx);
+        trace!("Using index {idx}");
+        let prev = self.set(idx, descriptor);
+        assert!(prev.is_none(), "Already a descriptor at {idx}");
 
         Ok(idx)
     }
 
-    // Call after inserting to `available_indices`, to free any that are contiguous
-    // with `next_index`.
-    fn trim_tail(&mut self) {
-        while let Some(last_in_available) = self.available_indices.iter().next_back().copied() {
-            if (last_in_available + 1) == self.next_index {
-                // Last entry in available_indices is adjacent to next_index.
-                // We can merge them, freeing an entry in `available_indices`.
-                self.next_index -= 1;
-                self.available_indices.remove(&last_in_available);
-            } else {
-                break;
-            }
+    fn set_in_use(&mut self, idx: usize, in_use: bool) {
+        let bit = 1 << (idx % 64);
+        if in_use {
+            self.in_use[idx / 64] |= bit;
+        } else {
+            self.in_use[idx / 64] &= !bit;
+        }
+    }
+
+    /// Grow the dense table to `new_len`, moving any sparse descriptors below `new_len` to it.
+    fn grow_dense(&mut self, new_len: usize) {
+        debug_assert!(new_len > self.dense.len());
+
+        let old_len = self.dense.len();
+        self.dense.resize_with(new_len, || None);
+        self.in_use.resize(new_len.div_ceil(64), 0);
+
+        let old_len_u32 = u32::try_from(old_len).unwrap();
+        let new_len_u32 = u32::try_from(new_len).unwrap();
+        let moved: Vec<u32> = self
+            .sparse
+            .range(old_len_u32..new_len_u32)
+            .map(|(idx, _)| *idx)
+            .collect();
+        for idx in moved {
+            let desc = self.sparse.remove(&idx).unwrap();
+            let idx = usize::try_from(idx).unwrap();
+            self.dense[idx] = Some(desc);
+            self.set_in_use(idx, true);
         }
     }
 
     /// Get the descriptor at `idx`, if any.
     pub fn get(&self, idx: DescriptorHandle) -> Option<&Descriptor> {
-        self.descriptors.get(&idx)
+        let i = usize::try_from(idx.val()).unwrap();
+        match self.dense.get(i) {
+            Some(desc) => desc.as_ref(),
+            None => self.sparse.get(&idx.val()),
+        }
     }
 
     /// Get the descriptor at `idx`, if any.
     pub fn get_mut(&mut self, idx: DescriptorHandle) -> Option<&mut Descriptor> {
-        self.descriptors.get_mut(&idx)
+        let i = usize::try_from(idx.val()).unwrap();
+        match self.dense.get_mut(i) {
+            Some(desc) => desc.as_mut(),
+            None => self.sparse.get_mut(&idx.val()),
+        }
     }
 
     /// Insert a descriptor at `index`. If a descriptor is already present at that index, it is
     /// unregistered from that index and returned.
     #[must_use]
     fn set(&mut self, index: DescriptorHandle, descriptor: Descriptor) -> Option<Descriptor> {
-        // We ensure the index is no longer in `self.available_indices`. We *don't* ensure
-        // `self.next_index` is > `index`, since that'd require adding the indices in between to
-        // `self.available_indices`. It uses less memory and is no more expensive to iterate when
-        // *using* `self.available_indices` instead.
-        self.available_indices.remove(&index.val());
+        let i = usize::try_from(index.val()).unwrap();
+
+        // Grow the dense table to hold the index unless it's far past the end, in which case
+        // growing the table would use a lot of memory for indices that probably won't be used.
+        if i >= self.dense.len() && i < std::cmp::max(MIN_DENSE_LEN, 2 * self.dense.len()) {
+            self.grow_dense(std::cmp::max(i + 1, 2 * self.dense.len()).next_multiple_of(64));
+        }
 
-        let prev = self.descriptors.insert(index, descriptor);
+        let prev = if i < self.dense.len() {
+            self.set_in_use(i, true);
+            self.dense[i].replace(descriptor)
+        } else {
+            self.sparse.insert(index.val(), descriptor)
+        };
 
         if prev.is_some() {
             trace!("Overwriting index {}", index);
@@ -183,10 +233,14 @@ impl DescriptorTable {
     /// Deregister the descriptor with the given fd handle and return it.
     #[must_use]
     pub fn deregister_descriptor(&mut self, fd: DescriptorHandle) -> Option<Descriptor> {
-        let maybe_descriptor = self.descriptors.remove(&fd);
-        self.available_indices.insert(fd.val());
-        self.trim_tail();
-        maybe_descriptor
+        let i = usize::try_from(fd.val()).unwrap();
+        if i < self.dense.len() {
+            self.set_in_use(i, false);
+            self.first_available_word = std::cmp::min(self.first_available_word, i / 64);
+            self.dense[i].take()
+        } else {
+            self.sparse.remove(&fd.val())
+        }
     }
 
     /// Remove and return all descriptors.
@@ -194,7 +248,11 @@ impl DescriptorTable {
         // reset the descriptor table
         let old_self = std::mem::take(self);
         // return the old descriptors
-        old_self.descriptors.into_values()
+        old_self
+            .dense
+            .into_iter()
+            .flatten()
+            .chain(old_self.sparse.into_values())
     }
 
     /// Remove and return all descriptors in the range. If you want to remove all descriptors, you
@@ -203,13 +261,9 @@ impl DescriptorTable {
         &mut self,
         range: impl std::ops::RangeBounds<DescriptorHandle>,
     ) -> impl Iterator<Item = Descriptor> {
-        // This code is not very efficient but it shouldn't be called often, so it should be fine
-        // for now. If we wanted something more efficient, we'd need to redesign the descriptor
-        // table to not use a hash map.
-
         let fds: Vec<_> = self
             .iter()
-            .filter_map(|(fd, _)| range.contains(fd).then_some(*fd))
+            .filter_map(|(fd, _)| range.contains(&fd).then_some(fd))
             .collect();
 
         let mut descriptors = Vec::with_capacity(fds.len());
@@ -220,12 +274,30 @@ impl DescriptorTable {
         descriptors.into_iter()
     }
 
-    pub fn iter(&self) -> impl Iterator<Item = (&DescriptorHandle, &Descriptor)> {
-        self.descriptors.iter()
+    /// Iterate over the descriptors in order of their fd handles.
+    pub fn iter(&self) -> impl Iterator<Item = (DescriptorHandle, &Descriptor)> {
+        let dense = self.dense.iter().enumerate().filter_map(|(i, desc)| {
+            let fd = DescriptorHandle::new(u32::try_from(i).unwrap()).unwrap();
+            desc.as_ref().map(|desc| (fd, desc))
+        });
+        let sparse = self
+            .sparse
+            .iter()
+            .map(|(fd, desc)| (DescriptorHandle::new(*fd).unwrap(), desc));
+        dense.chain(sparse)
     }
 
-    pub fn iter_mut(&mut self) -> impl Iterator<Item = (&DescriptorHandle, &mut Descriptor)> {
-        self.descriptors.iter_mut()
+    /// Iterate over the descriptors in order of their fd handles.
+    pub fn iter_mut(&mut self) -> impl Iterator<Item = (DescriptorHandle, &mut Descriptor)> {
+        let dense = self.dense.iter_mut().enumerate().filter_map(|(i, desc)| {
+            let fd = DescriptorHandle::new(u32::try_from(i).unwrap()).unwrap();
+            desc.as_mut().map(|desc| (fd, desc))
+        });
+        let sparse = self
+            .sparse
+            .iter_mut()
+            .map(|(fd, desc)| (DescriptorHandle::new(*fd).unwrap(), desc));
+        dense.chain(sparse)
     }
 }
 
@@ -360,3 +432,144 @@ impl std::fmt::Display for DescriptorHandleError {
 }
 
 impl std::error::Error for DescriptorHandleError {}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::Arc;
+
+    use atomic_refcell::AtomicRefCell;
+
+    use super::*;
+    use crate::host::descriptor::eventfd::EventFd;
+    use crate::host::descriptor::{CompatFile, File, FileStatus, OpenFile};
+
+    fn descriptor() -> Descriptor {
+        let eventfd = EventFd::new(0, false, FileStatus::empty());
+        let file = File::EventFd(Arc::new(AtomicRefCell::new(eventfd)));
+        Descriptor::new(CompatFile::New(OpenFile::new(file)))
+    }
+
+    fn fd(x: u32) -> DescriptorHandle {
+        DescriptorHandle::new(x).unwrap()
+    }
+
+    fn fds(table: &DescriptorTable) -> Vec<u32> {
+        table.iter().map(|(fd, _)| fd.val()).collect()
+    }
+
+    #[test]
+    fn test_lowest_fd() {
+        let desc = descriptor();
+        let mut table = DescriptorTable::new();
+
+        for i in 0..200 {
+            assert_eq!(table.register_descriptor(desc.clone()).unwrap(), fd(i));
+        }
+
+        // the lowest available fd is reused first
+        for i in [150, 3, 70] {
+            assert!(table.deregister_descriptor(fd(i)).is_some());
+        }
+        assert_eq!(table.register_descriptor(desc.clone()).unwrap(), fd(3));
+        assert_eq!(table.register_descriptor(desc.clone()).unwrap(), fd(70));
+        assert_eq!(table.register_descriptor(desc.clone()).unwrap(), fd(150));
+        assert_eq!(table.register_descriptor(desc.clone()).unwrap(), fd(200));
+
+        // the minimum fd is respected
+        assert!(table.deregister_descriptor(fd(5)).is_some());
+        assert!(table.deregister_descriptor(fd(100)).is_some());
+        let min = fd(64);
+        let new_fd = table
+            .register_descriptor_with_min_fd(desc.clone(), min)
+            .unwrap();
+        assert_eq!(new_fd, fd(100));
+        let new_fd = table
+            .register_descriptor_with_min_fd(desc.clone(), min)
+            .unwrap();
+        assert_eq!(new_fd, fd(201));
+        assert_eq!(table.register_descriptor(desc.clone()).unwrap(), fd(5));
+
+        assert!(table.deregister_descriptor(fd(300)).is_none());
+        assert_eq!(fds(&table), (0..202).collect::<Vec<_>>());
+    }
+
+    #[test]
+    fn test_sparse_fds() {
+        let desc = descriptor();
+        let mut table = DescriptorTable::new();
+
+        for i in 0..3 {
+            assert_eq!(table.register_descriptor(desc.clone()).unwrap(), fd(i));
+        }
+
+        // fds far past the end of the table
+        assert!(
+            table
+                .register_descriptor_with_fd(desc.clone(), fd(FD_MAX))
+                .is_none()
+        );
+        assert!(
+            table
+                .register_descriptor_with_fd(desc.clone(), fd(1_000_001))
+                .is_none()
+        );
+        assert!(
+            table
+                .register_descriptor_with_fd(desc.clone(), fd(1_000_000))
+                .is_none()
+        );
+        assert!(table.get(fd(1_000_000)).is_some());
+        assert!(table.get(fd(999_999)).is_none());
+
+        // allocating from a minimum fd skips past the sparse fds that are in use
+        let new_fd = table.register_descriptor_with_min_fd(desc.clone(), fd(1_000_000));
+        assert_eq!(new_fd.unwrap(), fd(1_000_002));
+
+        // there are no fds available from the maximum
+        assert!(
+            table
+                .register_descriptor_with_min_fd(desc.clone(), fd(FD_MAX))
+                .is_err()
+        );
+
+        assert_eq!(table.register_descriptor(desc.clone()).unwrap(), fd(3));
+        assert_eq!(
+            fds(&table),
+            [0, 1, 2, 3, 1_000_000, 1_000_001, 1_000_002, FD_MAX]
+        );
+
+        // replacing a sparse fd returns the previous descriptor
+        assert!(
+            table
+                .register_descriptor_with_fd(desc.clone(), fd(1_000_001))
+                .is_some()
+        );
+
+        let removed = table.remove_range(fd(2)..fd(FD_MAX));
+        assert_eq!(removed.count(), 5);
+        assert_eq!(fds(&table), [0, 1, FD_MAX]);
+
+        assert_eq!(table.remove_all().count(), 3);
+        assert!(fds(&table).is_empty());
+    }
+
+    #[test]
+    fn test_dense_growth() {
+        let desc = descriptor();
+        let mut table = DescriptorTable::new();
+
+        // sparse fds are moved to the dense table when it grows to include them
+        assert!(
+            table
+                .register_descriptor_with_fd(desc.clone(), fd(5000))
+                .is_none()
+        );
+        for i in 0..5000 {
+            assert_eq!(table.register_descriptor(desc.clone()).unwrap(), fd(i));
+        }
+        assert!(table.sparse.is_empty());
+        assert_eq!(table.register_descriptor(desc.clone()).unwrap(), fd(5001));
+        assert!(table.deregister_descriptor(fd(5000)).is_some());
+        assert_eq!(table.register_descriptor(desc.clone()).unwrap(), fd(5000));
+    }
+}
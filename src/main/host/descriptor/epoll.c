@@ -86,6 +86,8 @@ struct _EpollWatch {
     /* The last time we reported an event on this watch.
      * This is used to ensure fairness across watches when reporting events. */
     CEmulatedTime last_reported_event_time;
+    /* the epoll's generation when this watch was last added or retained */
+    uint64_t generation;
     gint referenceCount;
     MAGIC_DECLARE;
 };
@@ -113,6 +115,10 @@ struct _Epoll {
     /* A counter for sorting watches, for guaranteeing determinism when reporting events. */
     uint64_t watch_id_counter;
 
+    /* Incremented by `epoll_removeUnretainedWatches`, so that it can tell which watches weren't
+     * retained since the previous call. */
+    uint64_t generation;
+
     MAGIC_DECLARE;
 };
 
@@ -168,8 +174,20 @@ static gint _epollwatch_compare(gconstpointer ptr_1, gconstpointer ptr_2) {
     }
 }
 
-/* forward declaration */
+/* forward declarations */
 static void _epoll_fileStatusChanged(Epoll* epoll, const EpollKey* key);
+static void _epoll_removeWatch(Epoll* epoll, EpollWatch* watch);
+
+static uintptr_t _epollwatch_getObjectPtr(const EpollWatch* watch) {
+    if (watch->watchType == EWT_LEGACY_FILE) {
+        return (uintptr_t)(void*)watch->watchObject.as_legacy_file;
+    } else if (watch->watchType == EWT_GENERIC_FILE) {
+        return file_getCanonicalHandle(watch->watchObject.as_file);
+    } else {
+        warning("Unrecognized epoll watch type: %d", watch->watchType);
+        return (uintptr_t)NULL;
+    }
+}
 
 // Will take its own reference to the file object.
 static EpollWatch* _epollwatch_new(Epoll* epoll, int fd, EpollWatchTypes type,
@@ -193,19 +211,10 @@ static EpollWatch* _epollwatch_new(Epoll* epoll, int fd, EpollWatchTypes type,
     watch->watchObject = object;
     watch->fd = fd;
     watch->event = *event;
+    watch->generation = epoll->generation;
     watch->referenceCount = 1;
 
-    uintptr_t objectPtr;
-    if (watch->watchType == EWT_LEGACY_FILE) {
-        objectPtr = (uintptr_t)(void*)object.as_legacy_file;
-    } else if (watch->watchType == EWT_GENERIC_FILE) {
-        objectPtr = file_getCanonicalHandle(object.as_file);
-    } else {
-        warning("Unrecognized epoll watch type: %d", type);
-        objectPtr = (uintptr_t)NULL;
-    }
-
-    EpollKey *key = _epollkey_new(fd, objectPtr);
+    EpollKey* key = _epollkey_new(fd, _epollwatch_getObjectPtr(watch));
 
     /* Create the listener and ref the objects held by the listener.
      * The watch object already holds a ref to the descriptor so we
@@ -424,6 +433,29 @@ static gboolean _epollwatch_isReady(EpollWatch* watch) {
     return isReady;
 }
 
+static void _epoll_removeWatch(Epoll* epoll, EpollWatch* watch) {
+    MAGIC_ASSERT(epoll);
+    MAGIC_ASSERT(watch);
+    watch->flags &= ~EWF_WATCHING;
+
+    /* the watch may be freed when it's removed from the tables below */
+    EpollKey key = {.fd = watch->fd, .objectPtr = _epollwatch_getObjectPtr(watch)};
+
+    /* its deleted, so stop listening for updates */
+    statuslistener_setMonitorStatus(watch->listener, FileState_NONE, SLF_NEVER);
+    if (watch->watchType == EWT_LEGACY_FILE) {
+        legacyfile_removeListener(watch->watchObject.as_legacy_file, watch->listener);
+    } else if (watch->watchType == EWT_GENERIC_FILE) {
+        file_removeListener(watch->watchObject.as_file, watch->listener);
+    }
+
+    /* unref gets called on the watch when it is removed from these tables */
+    g_hash_table_remove(epoll->ready, &key);
+    g_hash_table_remove(epoll->watching, &key);
+    /* if that was the last watch, this epoll is not readable to its parents */
+    _epoll_fileStatusChanged(epoll, NULL);
+}
+
 static const gchar* _epoll_operationToStr(gint op) {
     switch(op) {
     case EPOLL_CTL_ADD:
@@ -571,23 +603,7 @@ gint epoll_control(Epoll* epoll, gint operation, int fd, const Descriptor* descr
                 break;
             }
 
-            MAGIC_ASSERT(watch);
-            watch->flags &= ~EWF_WATCHING;
-
-            /* its deleted, so stop listening for updates */
-            statuslistener_setMonitorStatus(watch->listener, FileState_NONE, SLF_NEVER);
-            if (watch->watchType == EWT_LEGACY_FILE) {
-                legacyfile_removeListener(watch->watchObject.as_legacy_file, watch->listener);
-            } else if (watch->watchType == EWT_GENERIC_FILE) {
-                file_removeListener(watch->watchObject.as_file, watch->listener);
-            }
-
-            /* unref gets called on the watch when it is removed from these tables */
-            g_hash_table_remove(epoll->ready, &key);
-            g_hash_table_remove(epoll->watching, &key);
-            /* if that was the last watch, this epoll is not readable to its parents */
-            _epoll_fileStatusChanged(epoll, NULL);
-
+            _epoll_removeWatch(epoll, watch);
             break;
         }
 
@@ -611,6 +627,72 @@ gint epoll_control(Epoll* epoll, gint operation, int fd, const Descriptor* descr
     return rv;
 }
 
+gint epoll_retainWatch(Epoll* epoll, int fd, const Descriptor* descriptor,
+                       const struct epoll_event* event, const Host* host) {
+    MAGIC_ASSERT(epoll);
+
+    EpollWatchTypes watchType;
+    EpollWatchObject watchObject;
+    _getWatchObject(descriptor, &watchType, &watchObject);
+
+    EpollKey key = {.fd = fd};
+    switch (watchType) {
+        case EWT_LEGACY_FILE:
+            key.objectPtr = (uintptr_t)(void*)watchObject.as_legacy_file;
+            legacyfile_unref(watchObject.as_legacy_file);
+            break;
+        case EWT_GENERIC_FILE:
+            key.objectPtr = file_getCanonicalHandle(watchObject.as_file);
+            file_drop(watchObject.as_file);
+            break;
+        default: utility_panic("unrecognized watch type");
+    }
+
+    EpollWatch* watch = g_hash_table_lookup(epoll->watching, &key);
+    if (watch == NULL) {
+        /* the new watch gets the current generation */
+        return epoll_control(epoll, EPOLL_CTL_ADD, fd, descriptor, event, host);
+    }
+
+    MAGIC_ASSERT(watch);
+    if (watch->generation == epoll->generation) {
+        /* already added or retained since the last removal, the same as adding it twice */
+        return -EEXIST;
+    }
+    watch->generation = epoll->generation;
+
+    if (watch->event.events != event->events || watch->event.data.u64 != event->data.u64) {
+        return epoll_control(epoll, EPOLL_CTL_MOD, fd, descriptor, event, host);
+    }
+
+    return 0;
+}
+
+void epoll_removeUnretainedWatches(Epoll* epoll) {
+    MAGIC_ASSERT(epoll);
+
+    GList* stale = NULL;
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, epoll->watching);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        EpollWatch* watch = value;
+        MAGIC_ASSERT(watch);
+        if (watch->generation != epoll->generation) {
+            stale = g_list_prepend(stale, watch);
+        }
+    }
+
+    /* remove them in a deterministic order */
+    stale = g_list_sort(stale, _epollwatch_compare);
+    for (GList* item = stale; item != NULL; item = g_list_next(item)) {
+        _epoll_removeWatch(epoll, item->data);
+    }
+    g_list_free(stale);
+
+    epoll->generation++;
+}
+
 guint epoll_getNumReadyEvents(Epoll* epoll) {
     MAGIC_ASSERT(epoll);
     return g_hash_table_size(epoll->ready);
@@ -22,6 +22,18 @@ gint epoll_control(Epoll* epoll, gint operation, int fd, const Descriptor* descr
 gint epoll_getEvents(Epoll* epoll, struct epoll_event* eventArray,
         gint eventArrayLength, gint* nEvents);
 
+// Like adding the watch with `EPOLL_CTL_ADD`, but if the epoll already watches the descriptor
+// under `fd`, keeps the existing watch (and its listener), modifying its events if they differ.
+// Returns -EEXIST if the watch was already added or retained since the last call to
+// `epoll_removeUnretainedWatches`.
+gint epoll_retainWatch(Epoll* epoll, int fd, const Descriptor* descriptor,
+                       const struct epoll_event* event, const Host* host);
+
+// Removes the watches that weren't added or retained since the previous call. A caller that
+// watches a similar set of descriptors each time can use this with `epoll_retainWatch` to only
+// update the watches that changed, instead of resetting and re-adding all of them.
+void epoll_removeUnretainedWatches(Epoll* epoll);
+
 void epoll_clearWatchListeners(Epoll* epoll);
 guint epoll_getNumReadyEvents(Epoll* epoll);
 
@@ -7,7 +7,8 @@ use crate::host::descriptor::{FileSignals, FileState};
 /// deciding when a file has events that epoll should report should be specified in this object's
 /// implementation.
 pub(super) struct Entry {
-    /// Priority value among other ready entries.
+    /// The priority of the entry's position in the ready list, or `None` if it's not in the ready
+    /// list.
     priority: Option<u64>,
     /// The events of interest registered by the managed process.
     interest: EpollEvents,
@@ -64,6 +65,10 @@ impl Entry {
         self.priority
     }
 
+    pub fn interest(&self) -> EpollEvents {
+        self.interest
+    }
+
     pub fn notify(&mut self, new_state: FileState, changed: FileState, signals: FileSignals) {
         log::trace!(
             "Notify old state {:?}, new state {:?}, changed {:?}, signals {:?}",
@@ -1,5 +1,4 @@
 use core::hash::Hash;
-use std::cmp::Ordering;
 
 use crate::host::descriptor::File;
 
@@ -37,21 +36,19 @@ impl Hash for Key {
     }
 }
 
-/// A `PriorityKey` helps us sort keys by a given priority. We use monitonically increasing priority
-/// values to ensure fairness when reporting events (so that we don't always report events from the
-/// same entry first and starve other entries). Using unique priority values for every key also
-/// ensure deterministic sorting.
+/// A `PriorityKey` is a key in epoll's ready list. We use monotonically increasing priority values
+/// to ensure fairness when reporting events (so that we don't always report events from the same
+/// entry first and starve other entries), and to ensure deterministic ordering. The priority also
+/// identifies which position in the ready list holds an entry, so an entry can be removed from the
+/// list lazily by forgetting its priority.
 pub(super) struct PriorityKey {
     pri: u64,
     key: Key,
 }
 
 impl PriorityKey {
-    /// Creates a new `PriorityKey` with the given priority.
-    ///
-    /// The new key will be tested for equality and order based exclusively on the `pri` value while
-    /// ignoring the `key` value. Thus, callers should ensure that every instance of this object
-    /// that should be considered unique is created with a unique priority value.
+    /// Creates a new `PriorityKey` with the given priority. Callers should ensure that every
+    /// instance of this object is created with a unique priority value.
     pub fn new(pri: u64, key: Key) -> Self {
         Self { pri, key }
     }
@@ -59,27 +56,9 @@ impl PriorityKey {
     pub fn priority(&self) -> u64 {
         self.pri
     }
-}
-
-impl Eq for PriorityKey {}
-
-impl PartialEq for PriorityKey {
-    fn eq(&self, other: &Self) -> bool {
-        // Equality is based only on the priority value as explained in `PriorityKey::new()`.
-        self.pri.eq(&other.pri)
-    }
-}
-
-impl Ord for PriorityKey {
-    fn cmp(&self, other: &Self) -> Ordering {
-        // Order is based only on the priority value as explained in `PriorityKey::new()`.
-        self.pri.cmp(&other.pri)
-    }
-}
 
-impl PartialOrd for PriorityKey {
-    fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
-        Some(self.cmp(other))
+    pub fn key(&self) -> &Key {
+        &self.key
     }
 }
 
@@ -1,5 +1,5 @@
 use std::collections::hash_map::Entry as HashMapEntry;
-use std::collections::{BinaryHeap, HashMap};
+use std::collections::{HashMap, VecDeque};
 use std::sync::{Arc, Weak};
 
 use atomic_refcell::AtomicRefCell;
@@ -33,14 +33,18 @@ pub struct Epoll {
     // Should only be used by `OpenFile` to make sure there is only ever one `OpenFile` instance for
     // this file.
     has_open_file: bool,
-    // A counter for sorting entries, to guarantee fairness and determinism when reporting events.
-    // Because our ready set is a max heap, we initialize this counter to u64::MAX and count down as
-    // we assign values so that entries whose events were last reported longest ago are prioritized.
+    // A counter for ordering entries, to guarantee fairness and determinism when reporting events.
+    // Entries are reported in the order they were added to the ready list, so entries whose events
+    // were last reported longest ago are prioritized.
     pri_counter: u64,
     // Stores entries for all descriptors we are currently monitoring for events.
     monitoring: HashMap<Key, Entry>,
-    // Stores keys for entries with events that are ready to be reported.
-    ready: BinaryHeap<PriorityKey>,
+    // A FIFO list of keys for entries with events that are ready to be reported. Keys are removed
+    // lazily: a key is only valid while its priority matches its entry's priority, and invalid keys
+    // are skipped when popped. This keeps adding to and removing from the ready list O(1).
+    ready: VecDeque<PriorityKey>,
+    // The number of valid keys in `ready`.
+    num_ready: usize,
     _counter: ObjectCounter,
 }
 
@@ -51,9 +55,10 @@ impl Epoll {
             status: FileStatus::empty(),
             state: FileState::ACTIVE,
             has_open_file: false,
-            pri_counter: u64::MAX,
+            pri_counter: 0,
             monitoring: HashMap::new(),
-            ready: BinaryHeap::new(),
+            ready: VecDeque::new(),
+            num_ready: 0,
             _counter: ObjectCounter::new("Epoll"),
         };
 
@@ -192,6 +197,13 @@ impl Epoll {
             }
             EpollCtlOp::EPOLL_CTL_MOD => {
                 let entry = self.monitoring.get_mut(&key).ok_or(Errno::ENOENT)?;
+
+                // From epoll_ctl(2): Returns EINVAL when "op was EPOLL_CTL_MOD and the
+                // EPOLLEXCLUSIVE flag has previously been applied to this epfd, fd pair."
+                if entry.interest().contains(EpollEvents::EPOLLEXCLUSIVE) {
+                    return Err(Errno::EINVAL);
+                }
+
                 entry.modify(events, data, state);
             }
             EpollCtlOp::EPOLL_CTL_DEL => {
@@ -199,9 +211,9 @@ impl Epoll {
                 // for status changes on its inner `File` event source object.
                 let entry = self.monitoring.remove(&key).ok_or(Errno::ENOENT)?;
 
-                // If it has a priority, then we also remove it from the ready set.
-                if let Some(pri) = entry.priority() {
-                    self.ready.retain(|e| e.priority() != pri)
+                // If it has a priority, then its key in the ready list is no longer valid.
+                if entry.priority().is_some() {
+                    self.forget_ready();
                 }
             }
         };
@@ -349,19 +361,53 @@ impl Epoll {
             if entry.priority().is_none() {
                 // It's ready but not in the ready set yet.
                 let pri = self.pri_counter;
-                self.pri_counter -= 1;
-                self.ready.push(PriorityKey::new(pri, key));
+                self.pri_counter += 1;
+                self.ready.push_back(PriorityKey::new(pri, key));
+                self.num_ready += 1;
                 entry.set_priority(Some(pri));
             }
-        } else if let Some(pri) = entry.priority() {
-            // It's not ready anymore but it's in the ready set, so remove it.
-            self.ready.retain(|e| e.priority() != pri);
+        } else if entry.priority().is_some() {
+            // It's not ready anymore but it's in the ready set, so invalidate its key.
             entry.set_priority(None);
+            self.forget_ready();
+        }
+    }
+
+    /// Account for a key in the ready list that is no longer valid. The invalid keys are dropped
+    /// once they outnumber the valid keys, so that the ready list's length stays proportional to
+    /// the number of ready entries.
+    fn forget_ready(&mut self) {
+        self.num_ready -= 1;
+
+        if self.ready.len() > 64 && self.ready.len() > 2 * self.num_ready {
+            let monitoring = &self.monitoring;
+            self.ready.retain(|x| {
+                monitoring
+                    .get(x.key())
+                    .is_some_and(|entry| entry.priority() == Some(x.priority()))
+            });
+            debug_assert_eq!(self.ready.len(), self.num_ready);
         }
     }
 
+    /// Remove the next valid key from the ready list. The entry's priority is left unchanged.
+    fn pop_ready(&mut self) -> Option<Key> {
+        while let Some(pri_key) = self.ready.pop_front() {
+            let pri = pri_key.priority();
+            let key = Key::from(pri_key);
+
+            if let Some(entry) = self.monitoring.get(&key) {
+                if entry.priority() == Some(pri) {
+                    return Some(key);
+                }
+            }
+        }
+
+        None
+    }
+
     pub fn has_ready_events(&self) -> bool {
-        !self.ready.is_empty()
+        self.num_ready > 0
     }
 
     pub fn collect_ready_events(
@@ -372,14 +418,16 @@ impl Epoll {
         let mut events = vec![];
         let mut keep = vec![];
 
-        while !self.ready.is_empty() && events.len() < max_events as usize {
+        while events.len() < max_events as usize {
             // Get the next ready entry.
-            let pri_key = self.ready.pop().unwrap();
-            let key = Key::from(pri_key);
+            let Some(key) = self.pop_ready() else {
+                break;
+            };
             let entry = self.monitoring.get_mut(&key).unwrap();
 
             // Just removed from the ready set, keep the priority consistent.
             entry.set_priority(None);
+            self.num_ready -= 1;
 
             // It was ready so it should have events.
             debug_assert!(entry.has_ready_events());
@@ -391,7 +439,7 @@ impl Epoll {
             if entry.has_ready_events() {
                 // It's ready again. Assign a new priority to ensure fairness with other entries.
                 let pri = self.pri_counter;
-                self.pri_counter -= 1;
+                self.pri_counter += 1;
                 let pri_key = PriorityKey::new(pri, key);
 
                 // Use temp vec so we don't report the same entry twice in the same round.
@@ -399,10 +447,11 @@ impl Epoll {
 
                 // The entry will be in the ready set, keep its priority consistent.
                 entry.set_priority(Some(pri));
+                self.num_ready += 1;
             }
         }
 
-        // Add everything that is still ready back to the ready set.
+        // Add everything that is still ready back to the end of the ready set.
         self.ready.extend(keep);
 
         // We've mutated the ready list; we may need to trigger callbacks.
@@ -0,0 +1,185 @@
+//! A read-only cache of file contents shared by all hosts, used when the experimental
+//! `file_cache_paths` option is set.
+//!
+//! Each file within one of the configured directories is memory-mapped the first time that a host
+//! opens it for reading, and reads of the file are then copied directly from the mapping. Files are
+//! identified by their device and inode so that different paths to a file share a mapping. The
+//! mappings are never unmapped, so that open files can refer to them without holding a reference
+//! to the cache.
+
+use std::collections::HashMap;
+use std::os::fd::RawFd;
+use std::path::{Path, PathBuf};
+use std::sync::RwLock;
+
+use anyhow::Context;
+
+#[derive(Debug)]
+pub struct FileCache {
+    /// The canonical directories whose files are cached.
+    dirs: Vec<PathBuf>,
+    /// Whether each absolute path that has been looked up is within one of `dirs`, so that each
+    /// path only needs to be resolved once.
+    resolved_paths: RwLock<HashMap<PathBuf, bool>>,
+    /// The cached files by device and inode.
+    files: RwLock<HashMap<(u64, u64), CachedFile>>,
+}
+
+#[derive(Debug)]
+struct CachedFile {
+    content: &'static [u8],
+    mtime: (i64, i64),
+}
+
+impl FileCache {
+    pub fn new(dirs: impl IntoIterator<Item = impl AsRef<Path>>) -> anyhow::Result<Self> {
+        let dirs = dirs
+            .into_iter()
+            .map(|dir| {
+                let dir = dir.as_ref();
+                std::fs::canonicalize(dir).with_context(|| {
+                    format!("Failed to resolve file cache path '{}'", dir.display())
+                })
+            })
+            .collect::<anyhow::Result<_>>()?;
+
+        Ok(Self {
+            dirs,
+            resolved_paths: RwLock::new(HashMap::new()),
+            files: RwLock::new(HashMap::new()),
+        })
+    }
+
+    /// Is the file at absolute path `path` within one of the cached directories?
+    fn is_cached_path(&self, path: &Path) -> bool {
+        if let Some(cached) = self.resolved_paths.read().unwrap().get(path) {
+            return *cached;
+        }
+
+        let cached = match std::fs::canonicalize(path) {
+            Ok(resolved) => self.dirs.iter().any(|dir| resolved.starts_with(dir)),
+            Err(_) => false,
+        };
+        self.resolved_paths
+            .write()
+            .unwrap()
+            .insert(path.to_path_buf(), cached);
+        cached
+    }
+
+    /// Get the contents of the file at absolute path `path`, which is open as `fd`. Returns `None`
+    /// if the file isn't within one of the cached directories, isn't a non-empty regular file, or
+    /// has changed since it was cached.
+    pub fn contents(&self, path: &Path, fd: RawFd) -> Option<&'static [u8]> {
+        if !self.is_cached_path(path) {
+            return None;
+        }
+
+        let mut stat = std::mem::MaybeUninit::<libc::stat>::uninit();
+        if unsafe { libc::fstat(fd, stat.as_mut_ptr()) } != 0 {
+            return None;
+        }
+        let stat = unsafe { stat.assume_init() };
+        if stat.st_mode & libc::S_IFMT != libc::S_IFREG || stat.st_size <= 0 {
+            return None;
+        }
+
+        let key = (stat.st_dev, stat.st_ino);
+        let mtime = (stat.st_mtime, stat.st_mtime_nsec);
+        let size = usize::try_from(stat.st_size).unwrap();
+
+        let is_current = |file: &CachedFile| file.mtime == mtime && file.content.len() == size;
+
+        if let Some(file) = self.files.read().unwrap().get(&key) {
+            if !is_current(file) {
+                log::debug!("Not caching '{}' since it changed", path.display());
+                return None;
+            }
+            return Some(file.content);
+        }
+
+        let mut files = self.files.write().unwrap();
+
+        // another thread may have mapped the file while we weren't holding the lock
+        if let Some(file) = files.get(&key) {
+            return is_current(file).then_some(file.content);
+        }
+
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                size,
+                libc::PROT_READ,
+                libc::MAP_PRIVATE,
+                fd,
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            log::warn!(
+                "Unable to map '{}' for the file cache: {}",
+                path.display(),
+                std::io::Error::last_os_error(),
+            );
+            return None;
+        }
+
+        // the mapping is never unmapped
+        let content = unsafe { std::slice::from_raw_parts(ptr.cast::<u8>(), size) };
+        log::debug!("Cached '{}' ({size} bytes)", path.display());
+        files.insert(key, CachedFile { content, mtime });
+        Some(content)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::io::Write;
+    use std::os::fd::AsRawFd;
+
+    use super::*;
+
+    #[test]
+    fn test_contents() {
+        let dir = tempfile::tempdir().unwrap();
+        let cached_dir = dir.path().join("cached");
+        std::fs::create_dir(&cached_dir).unwrap();
+
+        let cached_path = cached_dir.join("file");
+        std::fs::write(&cached_path, b"hello").unwrap();
+        let other_path = dir.path().join("other");
+        std::fs::write(&other_path, b"world").unwrap();
+        let link_path = dir.path().join("link");
+        std::os::unix::fs::symlink(&cached_path, &link_path).unwrap();
+
+        let cache = FileCache::new([&cached_dir]).unwrap();
+
+        let file = std::fs::File::open(&cached_path).unwrap();
+        let content = cache.contents(&cached_path, file.as_raw_fd()).unwrap();
+        assert_eq!(content, b"hello");
+
+        // a symlink to a cached file shares its mapping
+        let link = std::fs::File::open(&link_path).unwrap();
+        let link_content = cache.contents(&link_path, link.as_raw_fd()).unwrap();
+        assert_eq!(link_content.as_ptr(), content.as_ptr());
+
+        // files outside of the cached directories aren't cached
+        let other = std::fs::File::open(&other_path).unwrap();
+        assert!(cache.contents(&other_path, other.as_raw_fd()).is_none());
+
+        // a modified file isn't served from the cache
+        std::fs::OpenOptions::new()
+            .append(true)
+            .open(&cached_path)
+            .unwrap()
+            .write_all(b"!")
+            .unwrap();
+        let file = std::fs::File::open(&cached_path).unwrap();
+        assert!(cache.contents(&cached_path, file.as_raw_fd()).is_none());
+    }
+
+    #[test]
+    fn test_missing_dir() {
+        assert!(FileCache::new(["/nonexistent/shadow/file/cache"]).is_err());
+    }
+}
@@ -21,7 +21,9 @@ use crate::utility::{HostTreePointer, IsSend, IsSync, ObjectCounter};
 pub mod descriptor_table;
 pub mod epoll;
 pub mod eventfd;
+pub mod file_cache;
 pub mod listener;
+pub mod output_file;
 pub mod pipe;
 pub mod shared_buf;
 pub mod socket;
@@ -166,6 +168,7 @@ pub enum File {
     Socket(Socket),
     TimerFd(Arc<AtomicRefCell<timerfd::TimerFd>>),
     Epoll(Arc<AtomicRefCell<epoll::Epoll>>),
+    Output(Arc<AtomicRefCell<output_file::OutputFile>>),
 }
 
 // will not compile if `File` is not Send + Sync
@@ -180,6 +183,7 @@ impl File {
             Self::Socket(f) => FileRef::Socket(f.borrow()),
             Self::TimerFd(f) => FileRef::TimerFd(f.borrow()),
             Self::Epoll(f) => FileRef::Epoll(f.borrow()),
+            Self::Output(f) => FileRef::Output(f.borrow()),
         }
     }
 
@@ -190,6 +194,7 @@ impl File {
             Self::Socket(f) => FileRef::Socket(f.try_borrow()?),
             Self::TimerFd(f) => FileRef::TimerFd(f.try_borrow()?),
             Self::Epoll(f) => FileRef::Epoll(f.try_borrow()?),
+            Self::Output(f) => FileRef::Output(f.try_borrow()?),
         })
     }
 
@@ -200,6 +205,7 @@ impl File {
             Self::Socket(f) => FileRefMut::Socket(f.borrow_mut()),
             Self::TimerFd(f) => FileRefMut::TimerFd(f.borrow_mut()),
             Self::Epoll(f) => FileRefMut::Epoll(f.borrow_mut()),
+            Self::Output(f) => FileRefMut::Output(f.borrow_mut()),
         }
     }
 
@@ -210,6 +216,7 @@ impl File {
             Self::Socket(f) => FileRefMut::Socket(f.try_borrow_mut()?),
             Self::TimerFd(f) => FileRefMut::TimerFd(f.try_borrow_mut()?),
             Self::Epoll(f) => FileRefMut::Epoll(f.try_borrow_mut()?),
+            Self::Output(f) => FileRefMut::Output(f.try_borrow_mut()?),
         })
     }
 
@@ -220,6 +227,7 @@ impl File {
             Self::Socket(f) => f.canonical_handle(),
             Self::TimerFd(f) => Arc::as_ptr(f) as usize,
             Self::Epoll(f) => Arc::as_ptr(f) as usize,
+            Self::Output(f) => Arc::as_ptr(f) as usize,
         }
     }
 }
@@ -232,6 +240,7 @@ impl std::fmt::Debug for File {
             Self::Socket(_) => write!(f, "Socket")?,
             Self::TimerFd(_) => write!(f, "TimerFd")?,
             Self::Epoll(_) => write!(f, "Epoll")?,
+            Self::Output(_) => write!(f, "Output")?,
         }
 
         if let Ok(file) = self.try_borrow() {
@@ -251,6 +260,7 @@ pub enum FileRef<'a> {
     Socket(SocketRef<'a>),
     TimerFd(atomic_refcell::AtomicRef<'a, timerfd::TimerFd>),
     Epoll(atomic_refcell::AtomicRef<'a, epoll::Epoll>),
+    Output(atomic_refcell::AtomicRef<'a, output_file::OutputFile>),
 }
 
 /// Wraps a mutably borrowed [`File`]. Created from [`File::borrow_mut`] or
@@ -261,61 +271,62 @@ pub enum FileRefMut<'a> {
     Socket(SocketRefMut<'a>),
     TimerFd(atomic_refcell::AtomicRefMut<'a, timerfd::TimerFd>),
     Epoll(atomic_refcell::AtomicRefMut<'a, epoll::Epoll>),
+    Output(atomic_refcell::AtomicRefMut<'a, output_file::OutputFile>),
 }
 
 impl FileRef<'_> {
-    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn state(&self) -> FileState
     );
-    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn mode(&self) -> FileMode
     );
-    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn status(&self) -> FileStatus
     );
-    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn stat(&self) -> Result<linux_api::stat::stat, SyscallError>
     );
-    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn has_open_file(&self) -> bool
     );
-    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn supports_sa_restart(&self) -> bool
     );
 }
 
 impl FileRefMut<'_> {
-    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn state(&self) -> FileState
     );
-    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn mode(&self) -> FileMode
     );
-    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn status(&self) -> FileStatus
     );
-    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn stat(&self) -> Result<linux_api::stat::stat, SyscallError>
     );
-    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn has_open_file(&self) -> bool
     );
-    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn supports_sa_restart(&self) -> bool
     );
-    enum_passthrough!(self, (val), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (val), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn set_has_open_file(&mut self, val: bool)
     );
-    enum_passthrough!(self, (cb_queue), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (cb_queue), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn close(&mut self, cb_queue: &mut CallbackQueue) -> Result<(), SyscallError>
     );
-    enum_passthrough!(self, (status), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (status), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn set_status(&mut self, status: FileStatus)
     );
-    enum_passthrough!(self, (request, arg_ptr, memory_manager), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (request, arg_ptr, memory_manager), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn ioctl(&mut self, request: IoctlRequest, arg_ptr: ForeignPtr<()>, memory_manager: &mut MemoryManager) -> SyscallResult
     );
-    enum_passthrough!(self, (monitoring_state, monitoring_signals, filter, notify_fn), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (monitoring_state, monitoring_signals, filter, notify_fn), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn add_listener(
             &mut self,
             monitoring_state: FileState,
@@ -324,17 +335,17 @@ impl FileRefMut<'_> {
             notify_fn: impl Fn(FileState, FileState, FileSignals, &mut CallbackQueue) + Send + Sync + 'static,
         ) -> StateListenHandle
     );
-    enum_passthrough!(self, (ptr), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (ptr), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn add_legacy_listener(&mut self, ptr: HostTreePointer<c::StatusListener>)
     );
-    enum_passthrough!(self, (ptr), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (ptr), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn remove_legacy_listener(&mut self, ptr: *mut c::StatusListener)
     );
-    enum_passthrough!(self, (iovs, offset, flags, mem, cb_queue), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (iovs, offset, flags, mem, cb_queue), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn readv(&mut self, iovs: &[IoVec], offset: Option<libc::off_t>, flags: libc::c_int,
                      mem: &mut MemoryManager, cb_queue: &mut CallbackQueue) -> Result<libc::ssize_t, SyscallError>
     );
-    enum_passthrough!(self, (iovs, offset, flags, mem, cb_queue), Pipe, EventFd, Socket, TimerFd, Epoll;
+    enum_passthrough!(self, (iovs, offset, flags, mem, cb_queue), Pipe, EventFd, Socket, TimerFd, Epoll, Output;
         pub fn writev(&mut self, iovs: &[IoVec], offset: Option<libc::off_t>, flags: libc::c_int,
                       mem: &mut MemoryManager, cb_queue: &mut CallbackQueue) -> Result<libc::ssize_t, SyscallError>
     );
@@ -348,6 +359,7 @@ impl std::fmt::Debug for FileRef<'_> {
             Self::Socket(_) => write!(f, "Socket")?,
             Self::TimerFd(_) => write!(f, "TimerFd")?,
             Self::Epoll(_) => write!(f, "Epoll")?,
+            Self::Output(_) => write!(f, "Output")?,
         }
 
         let state = self.state();
@@ -364,6 +376,7 @@ impl std::fmt::Debug for FileRefMut<'_> {
             Self::Socket(_) => write!(f, "Socket")?,
             Self::TimerFd(_) => write!(f, "TimerFd")?,
             Self::Epoll(_) => write!(f, "Epoll")?,
+            Self::Output(_) => write!(f, "Output")?,
         }
 
         let state = self.state();
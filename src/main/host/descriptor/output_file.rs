@@ -0,0 +1,208 @@
+//! A write-only file that appends to a stream of the shared [`OutputStore`]. Used for the stdout
+//! and stderr of managed processes when the experimental `use_output_segments` option is enabled.
+
+use std::io::Read;
+use std::sync::Arc;
+
+use linux_api::errno::Errno;
+use linux_api::ioctls::IoctlRequest;
+use shadow_shim_helper_rs::syscall_types::ForeignPtr;
+
+use crate::core::output_store::OutputStore;
+use crate::cshadow as c;
+use crate::host::descriptor::listener::{StateEventSource, StateListenHandle, StateListenerFilter};
+use crate::host::descriptor::{FileMode, FileSignals, FileState, FileStatus};
+use crate::host::memory_manager::MemoryManager;
+use crate::host::syscall::io::{IoVec, IoVecReader};
+use crate::host::syscall::types::{SyscallError, SyscallResult};
+use crate::utility::HostTreePointer;
+use crate::utility::callback_queue::CallbackQueue;
+
+pub struct OutputFile {
+    store: Arc<OutputStore>,
+    stream: u32,
+    /// The number of bytes written to the stream.
+    len: u64,
+    event_source: StateEventSource,
+    state: FileState,
+    status: FileStatus,
+    // should only be used by `OpenFile` to make sure there is only ever one `OpenFile` instance for
+    // this file
+    has_open_file: bool,
+}
+
+impl OutputFile {
+    pub fn new(store: Arc<OutputStore>, stream: u32, status: FileStatus) -> Self {
+        Self {
+            store,
+            stream,
+            len: 0,
+            event_source: StateEventSource::new(),
+            // writes never block
+            state: FileState::ACTIVE | FileState::WRITABLE,
+            status,
+            has_open_file: false,
+        }
+    }
+
+    pub fn status(&self) -> FileStatus {
+        self.status
+    }
+
+    pub fn set_status(&mut self, status: FileStatus) {
+        self.status = status;
+    }
+
+    pub fn mode(&self) -> FileMode {
+        FileMode::WRITE
+    }
+
+    pub fn has_open_file(&self) -> bool {
+        self.has_open_file
+    }
+
+    pub fn supports_sa_restart(&self) -> bool {
+        false
+    }
+
+    pub fn set_has_open_file(&mut self, val: bool) {
+        self.has_open_file = val;
+    }
+
+    pub fn close(&mut self, cb_queue: &mut CallbackQueue) -> Result<(), SyscallError> {
+        // set the closed flag and remove the active and writable flags
+        self.update_state(
+            FileState::CLOSED | FileState::ACTIVE | FileState::WRITABLE,
+            FileState::CLOSED,
+            FileSignals::empty(),
+            cb_queue,
+        );
+
+        Ok(())
+    }
+
+    pub fn readv(
+        &mut self,
+        _iovs: &[IoVec],
+        _offset: Option<libc::off_t>,
+        _flags: libc::c_int,
+        _mem: &mut MemoryManager,
+        _cb_queue: &mut CallbackQueue,
+    ) -> Result<libc::ssize_t, SyscallError> {
+        // the file is only open for writing
+        Err(Errno::EBADF.into())
+    }
+
+    pub fn writev(
+        &mut self,
+        iovs: &[IoVec],
+        offset: Option<libc::off_t>,
+        _flags: libc::c_int,
+        mem: &mut MemoryManager,
+        _cb_queue: &mut CallbackQueue,
+    ) -> Result<libc::ssize_t, SyscallError> {
+        // the stream can only be appended to
+        if offset.is_some() {
+            return Err(Errno::ESPIPE.into());
+        }
+
+        let len: libc::size_t = iovs.iter().map(|x| x.len).sum();
+        let mut data = Vec::with_capacity(len);
+        IoVecReader::new(iovs, mem).read_to_end(&mut data)?;
+
+        if let Err(e) = self.store.write(self.stream, self.len, &data) {
+            log::warn!("Unable to write process output: {e}");
+            return Err(Errno::EIO.into());
+        }
+        self.len += u64::try_from(data.len()).unwrap();
+
+        Ok(data.len().try_into().unwrap())
+    }
+
+    pub fn ioctl(
+        &mut self,
+        request: IoctlRequest,
+        _arg_ptr: ForeignPtr<()>,
+        _memory_manager: &mut MemoryManager,
+    ) -> SyscallResult {
+        // not a terminal, the same as a regular file
+        log::debug!("Ioctl request {request:?} on a process output file");
+        Err(Errno::ENOTTY.into())
+    }
+
+    pub fn stat(&self) -> Result<linux_api::stat::stat, SyscallError> {
+        warn_once_then_debug!("Not all fields of 'struct stat' are implemented for output files");
+
+        Ok(linux_api::stat::stat {
+            st_dev: 0,
+            st_ino: 0,
+            st_nlink: 1,
+            // look like the regular file that the output would otherwise be written to
+            st_mode: libc::S_IFREG | libc::S_IRUSR | libc::S_IWUSR,
+            st_uid: 0,
+            st_gid: 0,
+            l__pad0: 0,
+            st_rdev: 0,
+            st_size: self.len.try_into().unwrap_or(i64::MAX),
+            st_blksize: 4096,
+            st_blocks: 0,
+            st_atime: 0,
+            st_atime_nsec: 0,
+            st_mtime: 0,
+            st_mtime_nsec: 0,
+            st_ctime: 0,
+            st_ctime_nsec: 0,
+            l__unused: [0; 3],
+        })
+    }
+
+    pub fn add_listener(
+        &mut self,
+        monitoring_state: FileState,
+        monitoring_signals: FileSignals,
+        filter: StateListenerFilter,
+        notify_fn: impl Fn(FileState, FileState, FileSignals, &mut CallbackQueue)
+        + Send
+        + Sync
+        + 'static,
+    ) -> StateListenHandle {
+        self.event_source
+            .add_listener(monitoring_state, monitoring_signals, filter, notify_fn)
+    }
+
+    pub fn add_legacy_listener(&mut self, ptr: HostTreePointer<c::StatusListener>) {
+        self.event_source.add_legacy_listener(ptr);
+    }
+
+    pub fn remove_legacy_listener(&mut self, ptr: *mut c::StatusListener) {
+        self.event_source.remove_legacy_listener(ptr);
+    }
+
+    pub fn state(&self) -> FileState {
+        self.state
+    }
+
+    fn update_state(
+        &mut self,
+        mask: FileState,
+        state: FileState,
+        signals: FileSignals,
+        cb_queue: &mut CallbackQueue,
+    ) {
+        let old_state = self.state;
+
+        // remove the masked flags, then copy the masked flags
+        self.state.remove(mask);
+        self.state.insert(state & mask);
+
+        let states_changed = self.state ^ old_state;
+
+        // if nothing changed
+        if states_changed.is_empty() && signals.is_empty() {
+            return;
+        }
+
+        self.event_source
+            .notify_listeners(self.state, states_changed, signals, cb_queue);
+    }
+}
@@ -18,6 +18,13 @@ use crate::host::syscall::types::{SyscallError, SyscallResult};
 use crate::utility::HostTreePointer;
 use crate::utility::callback_queue::CallbackQueue;
 
+/// The largest capacity that an unprivileged process can give a pipe with `F_SETPIPE_SZ` (the
+/// default of `/proc/sys/fs/pipe-max-size`).
+pub const PIPE_MAX_SIZE: usize = 1024 * 1024;
+
+/// Pipe capacities are a power-of-two number of pages of this size.
+const PIPE_PAGE_SIZE: usize = 4096;
+
 pub struct Pipe {
     buffer: Option<Arc<AtomicRefCell<SharedBuf>>>,
     event_source: StateEventSource,
@@ -79,6 +86,38 @@ impl Pipe {
         self.buffer.as_ref().unwrap().borrow().max_len()
     }
 
+    /// Change the capacity of the pipe's buffer, enabling support for `F_SETPIPE_SZ`. Like Linux,
+    /// the size is rounded up to a power-of-two number of pages. Returns the new capacity.
+    pub fn set_max_size(
+        &mut self,
+        size: u64,
+        cb_queue: &mut CallbackQueue,
+    ) -> Result<usize, Errno> {
+        // fcntl(2): "Attempts to set the pipe capacity below the page size are silently rounded
+        // up to the page size."
+        let size = usize::try_from(size)
+            .ok()
+            .filter(|size| *size <= 1 << 31)
+            .ok_or(Errno::EINVAL)?;
+        let size = std::cmp::max(size, PIPE_PAGE_SIZE).next_power_of_two();
+
+        // fcntl(2): "An unprivileged process can adjust the pipe capacity to any value between the
+        // system page size and the limit defined in /proc/sys/fs/pipe-max-size"
+        if size > PIPE_MAX_SIZE {
+            return Err(Errno::EPERM);
+        }
+
+        // fcntl(2): "Attempting to set the pipe capacity smaller than the amount of buffer space
+        // currently used to store data produces the error EBUSY."
+        self.buffer
+            .as_ref()
+            .unwrap()
+            .borrow_mut()
+            .set_max_len(size, cb_queue)?;
+
+        Ok(size)
+    }
+
     pub fn close(&mut self, cb_queue: &mut CallbackQueue) -> Result<(), SyscallError> {
         if self.state.contains(FileState::CLOSED) {
             log::warn!("Attempting to close an already-closed pipe");
@@ -237,6 +276,72 @@ impl Pipe {
         Ok(num_copied.try_into().unwrap())
     }
 
+    /// Move up to `len` bytes from this pipe to the `dst` pipe without copying them, as in
+    /// `splice(2)`. If `share` is true, the bytes are also left in this pipe, as in `tee(2)`.
+    pub fn splice_to(
+        &mut self,
+        dst: &mut Pipe,
+        len: usize,
+        share: bool,
+        cb_queue: &mut CallbackQueue,
+    ) -> Result<usize, SyscallError> {
+        if !self.mode.contains(FileMode::READ) || !dst.mode.contains(FileMode::WRITE) {
+            return Err(Errno::EBADF.into());
+        }
+
+        let src_buffer = self.buffer.as_ref().unwrap();
+        let dst_buffer = dst.buffer.as_ref().unwrap();
+
+        // linux doesn't allow splicing a pipe to itself
+        if Arc::ptr_eq(src_buffer, dst_buffer) {
+            return Err(Errno::EINVAL.into());
+        }
+
+        if dst.status.contains(FileStatus::DIRECT) {
+            warn_once_then_debug!("Splicing to a pipe in packet mode (O_DIRECT) is not supported");
+            return Err(Errno::EINVAL.into());
+        }
+
+        let mut src_buffer = src_buffer.borrow_mut();
+        let mut dst_buffer = dst_buffer.borrow_mut();
+
+        if len == 0 {
+            return Ok(0);
+        }
+
+        if dst_buffer.num_readers() == 0 {
+            return Err(Errno::EPIPE.into());
+        }
+
+        if !src_buffer.has_data() {
+            // the source pipe is at EOF if there are no writers
+            if src_buffer.num_writers() == 0 {
+                return Ok(0);
+            }
+            return Err(Errno::EWOULDBLOCK.into());
+        }
+
+        if dst_buffer.space_available() == 0 {
+            return Err(Errno::EWOULDBLOCK.into());
+        }
+
+        let num = if share {
+            src_buffer.tee_stream(&mut dst_buffer, len, cb_queue)
+        } else {
+            src_buffer.splice_stream(&mut dst_buffer, len, cb_queue)
+        };
+
+        if num == 0 {
+            // the source pipe has data but it's not stream data
+            warn_once_then_debug!(
+                "Splicing from a pipe in packet mode (O_DIRECT) is not supported"
+            );
+            return Err(Errno::EINVAL.into());
+        }
+
+        Ok(num)
+    }
+
     pub fn ioctl(
         &mut self,
         request: IoctlRequest,
@@ -50,6 +50,12 @@ struct _RegularFile {
             mode_t modeAtOpen;
             /* The path of the file when it was opened. */
             char* absPathAtOpen;
+            /* The file's contents in the shared file cache, or NULL if the file isn't cached.
+             * Reads of a cached file are copied from its contents, at `cachedOffset` rather than
+             * at the offset of `fd`. */
+            const char* cachedContents;
+            size_t cachedLen;
+            off_t cachedOffset;
         } osfile;
         struct {
             off_t cursor;
@@ -116,6 +122,11 @@ static inline bool _fd_isValid(int fd) { return fd >= 0; }
 
 int regularfile_getOSBackedFD(RegularFile* file) { return _regularfile_getOSBackedFD(file); }
 
+bool regularfile_hasCachedContents(RegularFile* file) {
+    MAGIC_ASSERT(file);
+    return file->type != FILE_TYPE_IN_MEMORY && file->osfile.cachedContents != NULL;
+}
+
 static void _regularfile_closeHelper(RegularFile* file) {
     if(file && file->type != FILE_TYPE_IN_MEMORY) {
         if (file && _fd_isValid(file->osfile.fd)) {
@@ -354,6 +365,13 @@ int regularfile_openat(RegularFile* file, RegularFile* dir, const char* pathname
     trace("RegularFile %p opened os-backed file %i at absolute path %s", file,
           _regularfile_getOSBackedFD(file), file->osfile.absPathAtOpen);
 
+    /* Files that are only read may be served from the shared file cache. */
+    if (file->type == FILE_TYPE_REGULAR && (flags & O_ACCMODE) == O_RDONLY && !(flags & O_PATH)) {
+        file->osfile.cachedContents =
+            worker_getCachedFileContents(abspath, osfd, &file->osfile.cachedLen);
+        file->osfile.cachedOffset = 0;
+    }
+
     /* The os-backed file is now ready. */
     legacyfile_adjustStatus(&file->super, FileState_ACTIVE, TRUE, 0);
 
@@ -387,6 +405,28 @@ static size_t _regularfile_readvRandomBytes(RegularFile* file, const Host* host,
     return total;
 }
 
+static ssize_t _regularfile_preadvCached(RegularFile* file, const struct iovec* iov, int iovcnt,
+                                         off_t offset) {
+    utility_debugAssert(file->osfile.cachedContents != NULL);
+
+    if (offset < 0) {
+        return -EINVAL;
+    }
+
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if ((size_t)offset >= file->osfile.cachedLen) {
+            break;
+        }
+        size_t len = MIN(iov[i].iov_len, file->osfile.cachedLen - offset);
+        memcpy(iov[i].iov_base, file->osfile.cachedContents + offset, len);
+        offset += len;
+        total += len;
+    }
+
+    return total;
+}
+
 ssize_t regularfile_read(RegularFile* file, const Host* host, void* buf, size_t bufSize) {
     MAGIC_ASSERT(file);
 
@@ -405,6 +445,15 @@ ssize_t regularfile_read(RegularFile* file, const Host* host, void* buf, size_t
         return -EBADF;
     }
 
+    if (file->osfile.cachedContents != NULL) {
+        struct iovec iov = {.iov_base = buf, .iov_len = bufSize};
+        ssize_t result = _regularfile_preadvCached(file, &iov, 1, file->osfile.cachedOffset);
+        if (result > 0) {
+            file->osfile.cachedOffset += result;
+        }
+        return result;
+    }
+
     trace("RegularFile %p will read %zu bytes from os-backed file %i at path '%s'", file, bufSize,
           _regularfile_getOSBackedFD(file), file->osfile.absPathAtOpen);
 
@@ -435,6 +484,11 @@ ssize_t regularfile_pread(RegularFile* file, const Host* host, void* buf, size_t
         return -EBADF;
     }
 
+    if (file->osfile.cachedContents != NULL) {
+        struct iovec iov = {.iov_base = buf, .iov_len = bufSize};
+        return _regularfile_preadvCached(file, &iov, 1, offset);
+    }
+
     trace("RegularFile %p will pread %zu bytes from os-backed file %i offset %ld at path '%s'",
           file, bufSize, _regularfile_getOSBackedFD(file), offset, file->osfile.absPathAtOpen);
 
@@ -487,6 +541,10 @@ ssize_t regularfile_preadv(RegularFile* file, const Host* host, const struct iov
         return -EBADF;
     }
 
+    if (file->osfile.cachedContents != NULL) {
+        return _regularfile_preadvCached(file, iov, iovcnt, offset);
+    }
+
     trace("RegularFile %p will preadv %d vector items from os-backed file %i at path '%s'", file,
           iovcnt, _regularfile_getOSBackedFD(file), file->osfile.absPathAtOpen);
 
@@ -514,6 +572,18 @@ ssize_t regularfile_preadv2(RegularFile* file, const Host* host, const struct io
         return -EBADF;
     }
 
+    if (file->osfile.cachedContents != NULL) {
+        /* An offset of -1 reads at the current offset. */
+        if (offset != -1) {
+            return _regularfile_preadvCached(file, iov, iovcnt, offset);
+        }
+        ssize_t result = _regularfile_preadvCached(file, iov, iovcnt, file->osfile.cachedOffset);
+        if (result > 0) {
+            file->osfile.cachedOffset += result;
+        }
+        return result;
+    }
+
     trace("RegularFile %p will preadv2 %d vector items from os-backed file %i at path '%s'", file,
           iovcnt, _regularfile_getOSBackedFD(file), file->osfile.absPathAtOpen);
 
@@ -816,6 +886,21 @@ off_t regularfile_lseek(RegularFile* file, off_t offset, int whence) {
 
     trace("RegularFile %p lseek os-backed file %i", file, _regularfile_getOSBackedFD(file));
 
+    if (file->osfile.cachedContents != NULL) {
+        /* Seek the os-backed file relative to the offset that we read the cached contents at, so
+         * that the kernel still validates the offset and handles e.g. SEEK_DATA. */
+        if (whence == SEEK_CUR) {
+            offset += file->osfile.cachedOffset;
+            whence = SEEK_SET;
+        }
+        ssize_t result = lseek(_regularfile_getOSBackedFD(file), offset, whence);
+        if (result < 0) {
+            return -errno;
+        }
+        file->osfile.cachedOffset = result;
+        return result;
+    }
+
     ssize_t result = lseek(_regularfile_getOSBackedFD(file), offset, whence);
     return (result < 0) ? -errno : result;
 }
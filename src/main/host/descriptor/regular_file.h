@@ -7,6 +7,7 @@
 #define SRC_MAIN_HOST_DESCRIPTOR_FILE_H_
 
 #include <poll.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <sys/stat.h>
 #include <sys/statfs.h>
@@ -79,6 +80,10 @@ FileType regularfile_getType(RegularFile* file);
 /* Returns the linux-backed fd that shadow uses to perform the file operations.  */
 int regularfile_getOSBackedFD(RegularFile* file);
 
+/* Returns true if the file's reads are served from the file cache rather than the linux-backed
+ * fd. */
+bool regularfile_hasCachedContents(RegularFile* file);
+
 // ****************************************
 // Operations that require a non-null RegularFile*
 // ****************************************
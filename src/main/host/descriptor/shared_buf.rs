@@ -40,6 +40,22 @@ impl SharedBuf {
         self.max_len - self.queue.num_bytes()
     }
 
+    /// Change the maximum number of bytes that the buffer can hold. Returns `EBUSY` if the buffer
+    /// currently holds more than `max_len` bytes.
+    pub fn set_max_len(
+        &mut self,
+        max_len: usize,
+        cb_queue: &mut CallbackQueue,
+    ) -> Result<(), Errno> {
+        assert_ne!(max_len, 0);
+        if max_len < self.queue.num_bytes() {
+            return Err(Errno::EBUSY);
+        }
+        self.max_len = max_len;
+        self.refresh_state(BufferSignals::empty(), cb_queue);
+        Ok(())
+    }
+
     /// Register as a reader. The [`ReaderHandle`] must be returned to the buffer later with
     /// [`remove_reader()`](Self::remove_reader).
     pub fn add_reader(&mut self, cb_queue: &mut CallbackQueue) -> ReaderHandle {
@@ -118,9 +134,10 @@ impl SharedBuf {
             return Err(Errno::EAGAIN.into());
         }
 
+        let max_len = std::cmp::min(len, self.space_available());
         let written = self
             .queue
-            .push_stream(bytes.take(self.space_available().try_into().unwrap()))?;
+            .push_stream_sized(bytes.take(max_len.try_into().unwrap()), max_len)?;
 
         let signals = if written > 0 {
             BufferSignals::BUFFER_GREW
@@ -154,6 +171,49 @@ impl SharedBuf {
         Ok(())
     }
 
+    /// Move up to `len` bytes of stream data from this buffer to `dst` without copying them. At
+    /// most `dst.space_available()` bytes will be moved. Returns the number of bytes moved.
+    pub fn splice_stream(
+        &mut self,
+        dst: &mut SharedBuf,
+        len: usize,
+        cb_queue: &mut CallbackQueue,
+    ) -> usize {
+        let len = std::cmp::min(len, dst.space_available());
+        let moved = self.queue.move_stream_bytes(&mut dst.queue, len);
+        self.refresh_after_transfer(dst, moved, cb_queue);
+        moved
+    }
+
+    /// Like [`splice_stream()`](Self::splice_stream), but the bytes are shared with `dst` rather
+    /// than removed from this buffer.
+    pub fn tee_stream(
+        &mut self,
+        dst: &mut SharedBuf,
+        len: usize,
+        cb_queue: &mut CallbackQueue,
+    ) -> usize {
+        let len = std::cmp::min(len, dst.space_available());
+        let shared = self.queue.share_stream_bytes(&mut dst.queue, len);
+        self.refresh_after_transfer(dst, shared, cb_queue);
+        shared
+    }
+
+    fn refresh_after_transfer(
+        &mut self,
+        dst: &mut SharedBuf,
+        num: usize,
+        cb_queue: &mut CallbackQueue,
+    ) {
+        let signals = if num > 0 {
+            BufferSignals::BUFFER_GREW
+        } else {
+            BufferSignals::empty()
+        };
+        self.refresh_state(BufferSignals::empty(), cb_queue);
+        dst.refresh_state(signals, cb_queue);
+    }
+
     pub fn add_listener(
         &mut self,
         monitoring_state: BufferState,
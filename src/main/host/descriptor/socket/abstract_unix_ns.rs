@@ -1,8 +1,9 @@
-use std::collections::HashMap;
+use std::collections::hash_map::Entry;
 use std::sync::{Arc, Weak};
 
 use atomic_refcell::AtomicRefCell;
 use rand::seq::IndexedRandom;
+use rustc_hash::FxHashMap;
 
 use crate::host::descriptor::listener::{StateEventSource, StateListenHandle, StateListenerFilter};
 use crate::host::descriptor::socket::unix::{UnixSocket, UnixSocketType};
@@ -24,25 +25,40 @@ impl NamespaceEntry {
     }
 }
 
+/// The bound names of one socket type. A name is stored once, and its close listener shares it
+/// rather than keeping its own copy. Lookups borrow the name from the socket address, so they don't
+/// allocate.
+type AddressMap = FxHashMap<Arc<[u8]>, NamespaceEntry>;
+
 pub struct AbstractUnixNamespace {
-    address_map: HashMap<UnixSocketType, HashMap<Vec<u8>, NamespaceEntry>>,
+    stream: AddressMap,
+    dgram: AddressMap,
+    seq_packet: AddressMap,
 }
 
 impl AbstractUnixNamespace {
     pub fn new() -> Self {
-        let mut rv = Self {
-            // initializes an empty hash map for each unix socket type
-            address_map: HashMap::new(),
-        };
+        Self {
+            stream: AddressMap::default(),
+            dgram: AddressMap::default(),
+            seq_packet: AddressMap::default(),
+        }
+    }
 
-        // the namespace code will assume that there is an entry for each socket type
-        rv.address_map
-            .insert(UnixSocketType::Stream, HashMap::new());
-        rv.address_map.insert(UnixSocketType::Dgram, HashMap::new());
-        rv.address_map
-            .insert(UnixSocketType::SeqPacket, HashMap::new());
+    fn address_map(&self, sock_type: UnixSocketType) -> &AddressMap {
+        match sock_type {
+            UnixSocketType::Stream => &self.stream,
+            UnixSocketType::Dgram => &self.dgram,
+            UnixSocketType::SeqPacket => &self.seq_packet,
+        }
+    }
 
-        rv
+    fn address_map_mut(&mut self, sock_type: UnixSocketType) -> &mut AddressMap {
+        match sock_type {
+            UnixSocketType::Stream => &mut self.stream,
+            UnixSocketType::Dgram => &mut self.dgram,
+            UnixSocketType::SeqPacket => &mut self.seq_packet,
+        }
     }
 
     pub fn lookup(
@@ -54,9 +70,7 @@ impl AbstractUnixNamespace {
         // only be possible at the end of the simulation and there wouldn't be any reason to call
         // lookup() at that time, so a panic here would most likely indicate an issue somewhere else
         // in shadow
-        self.address_map
-            .get(&sock_type)
-            .unwrap()
+        self.address_map(sock_type)
             .get(name)
             .map(|x| x.socket.upgrade().unwrap())
     }
@@ -64,31 +78,19 @@ impl AbstractUnixNamespace {
     pub fn bind(
         ns_arc: &Arc<AtomicRefCell<Self>>,
         sock_type: UnixSocketType,
-        mut name: Vec<u8>,
+        name: &[u8],
         socket: &Arc<AtomicRefCell<UnixSocket>>,
         socket_event_source: &mut StateEventSource,
     ) -> Result<(), BindError> {
-        // make sure we aren't wasting memory since we don't mutate the name
-        name.shrink_to_fit();
-
         let mut ns = ns_arc.borrow_mut();
-        let name_copy = name.clone();
-
-        // look up the name in the address map
-        let entry = match ns.address_map.get_mut(&sock_type).unwrap().entry(name) {
-            std::collections::hash_map::Entry::Occupied(_) => return Err(BindError::NameInUse),
-            std::collections::hash_map::Entry::Vacant(x) => x,
-        };
-
-        // when the socket closes, remove this entry from the namespace
-        let handle =
-            Self::on_socket_close(Arc::downgrade(ns_arc), socket_event_source, move |ns| {
-                assert!(ns.unbind(sock_type, &name_copy).is_ok());
-            });
-
-        entry.insert(NamespaceEntry::new(Arc::downgrade(socket), handle));
-
-        Ok(())
+        Self::insert(
+            ns_arc,
+            &mut ns,
+            sock_type,
+            name.into(),
+            socket,
+            socket_event_source,
+        )
     }
 
     pub fn autobind(
@@ -97,7 +99,7 @@ impl AbstractUnixNamespace {
         socket: &Arc<AtomicRefCell<UnixSocket>>,
         socket_event_source: &mut StateEventSource,
         mut rng: impl rand::Rng,
-    ) -> Result<Vec<u8>, BindError> {
+    ) -> Result<Arc<[u8]>, BindError> {
         let mut ns = ns_arc.borrow_mut();
 
         // the unused name that we will bind the socket to
@@ -107,13 +109,8 @@ impl AbstractUnixNamespace {
         for _ in 0..10 {
             let random_name: [u8; NAME_LEN] = random_name(&mut rng);
 
-            if !ns
-                .address_map
-                .get(&sock_type)
-                .unwrap()
-                .contains_key(&random_name[..])
-            {
-                name = Some(random_name.to_vec());
+            if !ns.address_map(sock_type).contains_key(&random_name[..]) {
+                name = Some(random_name);
                 break;
             }
         }
@@ -123,25 +120,49 @@ impl AbstractUnixNamespace {
             for x in 0..CHARSET.len().pow(NAME_LEN as u32) {
                 let temp_name: [u8; NAME_LEN] = incremental_name(x);
 
-                if !ns
-                    .address_map
-                    .get(&sock_type)
-                    .unwrap()
-                    .contains_key(&temp_name[..])
-                {
-                    name = Some(temp_name.to_vec());
+                if !ns.address_map(sock_type).contains_key(&temp_name[..]) {
+                    name = Some(temp_name);
                     break;
                 }
             }
         }
 
-        let name = match name {
-            Some(x) => x,
+        let name: Arc<[u8]> = match name {
+            Some(x) => x.into(),
             // every valid name has been taken
             None => return Err(BindError::NoNamesAvailable),
         };
 
-        let name_copy = name.clone();
+        // we checked above that the name isn't in use
+        Self::insert(
+            ns_arc,
+            &mut ns,
+            sock_type,
+            Arc::clone(&name),
+            socket,
+            socket_event_source,
+        )
+        .unwrap();
+
+        Ok(name)
+    }
+
+    /// Add an entry for the name, which is removed when the socket closes.
+    fn insert(
+        ns_arc: &Arc<AtomicRefCell<Self>>,
+        ns: &mut Self,
+        sock_type: UnixSocketType,
+        name: Arc<[u8]>,
+        socket: &Arc<AtomicRefCell<UnixSocket>>,
+        socket_event_source: &mut StateEventSource,
+    ) -> Result<(), BindError> {
+        let name_copy = Arc::clone(&name);
+
+        // look up the name in the address map
+        let entry = match ns.address_map_mut(sock_type).entry(name) {
+            Entry::Occupied(_) => return Err(BindError::NameInUse),
+            Entry::Vacant(x) => x,
+        };
 
         // when the socket closes, remove this entry from the namespace
         let handle =
@@ -149,30 +170,15 @@ impl AbstractUnixNamespace {
                 assert!(ns.unbind(sock_type, &name_copy).is_ok());
             });
 
-        if let std::collections::hash_map::Entry::Vacant(entry) = ns
-            .address_map
-            .get_mut(&sock_type)
-            .unwrap()
-            .entry(name.clone())
-        {
-            entry.insert(NamespaceEntry::new(Arc::downgrade(socket), handle));
-        } else {
-            unreachable!();
-        }
+        entry.insert(NamespaceEntry::new(Arc::downgrade(socket), handle));
 
-        Ok(name)
+        Ok(())
     }
 
-    pub fn unbind(&mut self, sock_type: UnixSocketType, name: &Vec<u8>) -> Result<(), BindError> {
+    pub fn unbind(&mut self, sock_type: UnixSocketType, name: &[u8]) -> Result<(), BindError> {
         // remove the namespace entry which includes the handle, so the event listener will
         // automatically be removed from the socket
-        if self
-            .address_map
-            .get_mut(&sock_type)
-            .unwrap()
-            .remove(name)
-            .is_none()
-        {
+        if self.address_map_mut(sock_type).remove(name).is_none() {
             // didn't exist in the address map
             return Err(BindError::NameNotFound);
         }
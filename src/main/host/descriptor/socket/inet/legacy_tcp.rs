@@ -37,6 +37,9 @@ pub struct LegacyTcpSocket {
     has_open_file: bool,
     /// Did the last connect() call block, and if so what thread?
     thread_of_blocked_connect: Option<ThreadId>,
+    /// Was `SO_REUSEPORT` set? The socket can then listen on the same address as other sockets
+    /// that set it, and new connections are distributed over them.
+    reuse_port: bool,
     _counter: ObjectCounter,
 }
 
@@ -65,6 +68,7 @@ impl LegacyTcpSocket {
             socket: HostTreePointer::new(legacy_tcp),
             has_open_file: false,
             thread_of_blocked_connect: None,
+            reuse_port: false,
             _counter: ObjectCounter::new("LegacyTcpSocket"),
         };
 
@@ -188,6 +192,14 @@ impl LegacyTcpSocket {
         self.peek_packet().is_some()
     }
 
+    /// The number of bytes in the socket's send and receive buffers.
+    pub fn buffered_bytes(&self) -> usize {
+        let tcp = self.as_legacy_tcp();
+        let input = unsafe { c::tcp_getInputBufferLength(tcp) };
+        let output = unsafe { c::tcp_getOutputBufferLength(tcp) };
+        (input + output).try_into().unwrap()
+    }
+
     pub fn getsockname(&self) -> Result<Option<SockaddrIn>, Errno> {
         let mut ip: libc::in_addr_t = 0;
         let mut port: libc::in_port_t = 0;
@@ -255,13 +267,13 @@ impl LegacyTcpSocket {
         let addr: SocketAddrV4 = (*addr).into();
 
         // if the socket is already bound
-        {
+        let reuse_port = {
             let socket = socket.borrow();
-            let socket = socket.as_legacy_socket();
-            if unsafe { c::legacysocket_isBound(socket) } == 1 {
+            if unsafe { c::legacysocket_isBound(socket.as_legacy_socket()) } == 1 {
                 return Err(Errno::EINVAL.into());
             }
-        }
+            socket.reuse_port
+        };
 
         // make sure the socket doesn't have a peer
         {
@@ -283,6 +295,7 @@ impl LegacyTcpSocket {
             addr,
             peer_addr,
             /* check_generic_peer= */ true,
+            reuse_port,
             net_ns,
             rng,
         )?;
@@ -672,6 +685,7 @@ impl LegacyTcpSocket {
                 local_addr,
                 peer_addr,
                 /* check_generic_peer= */ true,
+                socket_ref.reuse_port,
                 net_ns,
                 rng,
             )?;
@@ -782,6 +796,7 @@ impl LegacyTcpSocket {
                 local_addr,
                 peer_addr,
                 /* check_generic_peer= */ true,
+                socket_ref.reuse_port,
                 net_ns,
                 rng,
             )?;
@@ -1134,6 +1149,14 @@ impl LegacyTcpSocket {
 
                 Ok(bytes_written as libc::socklen_t)
             }
+            (libc::SOL_SOCKET, libc::SO_REUSEPORT) => {
+                let optval_ptr = optval_ptr.cast::<libc::c_int>();
+                let reuse_port = libc::c_int::from(self.reuse_port);
+                let bytes_written =
+                    write_partial(memory_manager, &reuse_port, optval_ptr, optlen as usize)?;
+
+                Ok(bytes_written as libc::socklen_t)
+            }
             (libc::SOL_SOCKET, libc::SO_BROADCAST) => {
                 let optval_ptr = optval_ptr.cast::<libc::c_int>();
                 // we don't support broadcast sockets, so just just return the default 0
@@ -1282,8 +1305,17 @@ impl LegacyTcpSocket {
                 log::trace!("setsockopt SO_REUSEADDR not yet implemented");
             }
             (libc::SOL_SOCKET, libc::SO_REUSEPORT) => {
-                // TODO: implement this, tgen uses it
-                log::trace!("setsockopt SO_REUSEPORT not yet implemented");
+                type OptType = libc::c_int;
+
+                if usize::try_from(optlen).unwrap() < std::mem::size_of::<OptType>() {
+                    return Err(Errno::EINVAL.into());
+                }
+
+                let optval_ptr = optval_ptr.cast::<OptType>();
+                let val = memory_manager.read(optval_ptr)?;
+
+                // like linux, this only affects later binds
+                self.reuse_port = val != 0;
             }
             (libc::SOL_SOCKET, libc::SO_KEEPALIVE) => {
                 // TODO: implement this, libevent uses it in
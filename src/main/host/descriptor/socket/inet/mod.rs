@@ -93,6 +93,16 @@ impl InetSocket {
         }
     }
 
+    /// A unique integer handle for the socket object that can be used without borrowing the
+    /// socket. It's the same as the [`InetSocketWeak::identity`] of its weak references.
+    pub fn identity(&self) -> usize {
+        match self {
+            Self::LegacyTcp(f) => Arc::as_ptr(f) as usize,
+            Self::Tcp(f) => Arc::as_ptr(f) as usize,
+            Self::Udp(f) => Arc::as_ptr(f) as usize,
+        }
+    }
+
     pub fn bind(
         &self,
         addr: Option<&SockaddrStorage>,
@@ -308,6 +318,9 @@ impl InetSocketRef<'_> {
     enum_passthrough!(self, (), LegacyTcp, Tcp, Udp;
         pub fn has_data_to_send(&self) -> bool
     );
+    enum_passthrough!(self, (), LegacyTcp, Tcp, Udp;
+        pub fn buffered_bytes(&self) -> usize
+    );
 }
 
 // file functions
@@ -484,6 +497,15 @@ impl InetSocketWeak {
             Self::Udp(x) => x.upgrade().map(InetSocket::Udp),
         }
     }
+
+    /// See [`InetSocket::identity`]. This is valid even if the socket has been dropped.
+    pub fn identity(&self) -> usize {
+        match self {
+            Self::LegacyTcp(x) => Weak::as_ptr(x) as usize,
+            Self::Tcp(x) => Weak::as_ptr(x) as usize,
+            Self::Udp(x) => Weak::as_ptr(x) as usize,
+        }
+    }
 }
 
 /// Associate the socket with a network interface. If the local address is unspecified, the socket
@@ -492,12 +514,15 @@ impl InetSocketWeak {
 /// unspecified and has a port of 0, the socket will receive packets from every peer address. The
 /// socket will be automatically disassociated when the returned [`AssociationHandle`] is dropped.
 /// If `check_generic_peer` is true, the association will also fail if there is already a socket
-/// associated with the local address `local_addr` and peer address 0.0.0.0:0.
+/// associated with the local address `local_addr` and peer address 0.0.0.0:0. If `reuse_port` is
+/// true, the socket has `SO_REUSEPORT` set and can share the association with other sockets that
+/// have it set.
 fn associate_socket(
     socket: InetSocket,
     local_addr: SocketAddrV4,
     peer_addr: SocketAddrV4,
     check_generic_peer: bool,
+    reuse_port: bool,
     net_ns: &NetworkNamespace,
     rng: impl rand::Rng,
 ) -> Result<(SocketAddrV4, AssociationHandle), Errno> {
@@ -535,7 +560,7 @@ fn associate_socket(
     };
 
     // make sure the port is available at this address for this protocol
-    match net_ns.is_addr_in_use(protocol, local_addr, peer_addr) {
+    match net_ns.is_addr_in_use(protocol, local_addr, peer_addr, reuse_port) {
         Ok(true) => {
             log::debug!(
                 "The provided addresses (local={local_addr}, peer={peer_addr}) are not available"
@@ -551,6 +576,7 @@ fn associate_socket(
             protocol,
             local_addr,
             SocketAddrV4::new(Ipv4Addr::UNSPECIFIED, 0),
+            reuse_port,
         ) {
             Ok(true) => {
                 log::debug!(
@@ -565,7 +591,8 @@ fn associate_socket(
     }
 
     // associate the interfaces corresponding to addr with socket
-    let handle = unsafe { net_ns.associate_interface(&socket, protocol, local_addr, peer_addr) };
+    let handle =
+        unsafe { net_ns.associate_interface(&socket, protocol, local_addr, peer_addr, reuse_port) };
 
     Ok((local_addr, handle))
 }
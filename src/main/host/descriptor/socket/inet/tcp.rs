@@ -39,6 +39,9 @@ pub struct TcpSocket {
     association: Option<AssociationHandle>,
     connect_result_is_pending: bool,
     shutdown_status: Option<Shutdown>,
+    /// Was `SO_REUSEPORT` set? The socket can then listen on the same address as other sockets
+    /// that set it, and new connections are distributed over them.
+    reuse_port: bool,
     // should only be used by `OpenFile` to make sure there is only ever one `OpenFile` instance for
     // this file
     has_open_file: bool,
@@ -46,7 +49,7 @@ pub struct TcpSocket {
 }
 
 impl TcpSocket {
-    pub fn new(status: FileStatus) -> Arc<AtomicRefCell<Self>> {
+    pub fn new(status: FileStatus, config: tcp::TcpConfig) -> Arc<AtomicRefCell<Self>> {
         let rv = Arc::new_cyclic(|weak: &Weak<AtomicRefCell<Self>>| {
             let tcp_dependencies = TcpDeps {
                 timer_state: Arc::new(AtomicRefCell::new(TcpDepsTimerState {
@@ -56,7 +59,7 @@ impl TcpSocket {
             };
 
             AtomicRefCell::new(Self {
-                tcp_state: tcp::TcpState::new(tcp_dependencies, tcp::TcpConfig::default()),
+                tcp_state: tcp::TcpState::new(tcp_dependencies, config),
                 socket_weak: weak.clone(),
                 event_source: StateEventSource::new(),
                 status,
@@ -66,6 +69,7 @@ impl TcpSocket {
                 association: None,
                 connect_result_is_pending: false,
                 shutdown_status: None,
+                reuse_port: false,
                 has_open_file: false,
                 _counter: ObjectCounter::new("TcpSocket"),
             })
@@ -276,6 +280,12 @@ impl TcpSocket {
         self.tcp_state.wants_to_send()
     }
 
+    /// The number of bytes in the socket's send and receive buffers.
+    pub fn buffered_bytes(&self) -> usize {
+        let (send, recv) = self.tcp_state.buffer_lens();
+        usize::try_from(send).unwrap() + usize::try_from(recv).unwrap()
+    }
+
     pub fn getsockname(&self) -> Result<Option<SockaddrIn>, Errno> {
         // The socket state won't always have the local address. For example if the socket was bound
         // but connect() hasn't yet been called, the socket state will not have a local or remote
@@ -361,6 +371,7 @@ impl TcpSocket {
             addr,
             peer_addr,
             /* check_generic_peer= */ true,
+            socket_ref.reuse_port,
             net_ns,
             rng,
         )?;
@@ -551,6 +562,7 @@ impl TcpSocket {
         let backlog = backlog as u32;
 
         let is_associated = socket_ref.association.is_some();
+        let reuse_port = socket_ref.reuse_port;
 
         let rv = if is_associated {
             // if already associated, do nothing
@@ -572,6 +584,7 @@ impl TcpSocket {
                     local_addr,
                     peer_addr,
                     /* check_generic_peer= */ true,
+                    reuse_port,
                     net_ns,
                     rng,
                 )?;
@@ -647,6 +660,7 @@ impl TcpSocket {
         }
 
         let local_addr = socket_ref.association.as_ref().map(|x| x.local_addr());
+        let reuse_port = socket_ref.reuse_port;
 
         let rv = if let Some(mut local_addr) = local_addr {
             // the local address needs to be a specific address (this is normally what a routing
@@ -681,6 +695,7 @@ impl TcpSocket {
                     local_addr,
                     peer_addr,
                     /* check_generic_peer= */ true,
+                    reuse_port,
                     net_ns,
                     rng,
                 )?;
@@ -778,6 +793,7 @@ impl TcpSocket {
                 association: None,
                 connect_result_is_pending: false,
                 shutdown_status: None,
+                reuse_port: false,
                 has_open_file: false,
                 _counter: ObjectCounter::new("TcpSocket"),
             })
@@ -797,6 +813,7 @@ impl TcpSocket {
             local_addr,
             remote_addr,
             /* check_generic_peer= */ false,
+            /* reuse_port= */ false,
             net_ns,
             rng,
         )?;
@@ -918,6 +935,13 @@ impl TcpSocket {
 
                 Ok(bytes_written as libc::socklen_t)
             }
+            (libc::SOL_SOCKET, libc::SO_REUSEPORT) => {
+                let optval_ptr = optval_ptr.cast::<libc::c_int>();
+                let reuse_port = libc::c_int::from(self.reuse_port);
+                let bytes_written = write_partial(mem, &reuse_port, optval_ptr, optlen as usize)?;
+
+                Ok(bytes_written as libc::socklen_t)
+            }
             (libc::SOL_SOCKET, libc::SO_BROADCAST) => {
                 let optval_ptr = optval_ptr.cast::<libc::c_int>();
                 // we don't support broadcast sockets, so just just return the default 0
@@ -952,8 +976,17 @@ impl TcpSocket {
                 log::trace!("setsockopt SO_REUSEADDR not yet implemented");
             }
             (libc::SOL_SOCKET, libc::SO_REUSEPORT) => {
-                // TODO: implement this, tgen uses it
-                log::trace!("setsockopt SO_REUSEPORT not yet implemented");
+                type OptType = libc::c_int;
+
+                if usize::try_from(optlen).unwrap() < std::mem::size_of::<OptType>() {
+                    return Err(Errno::EINVAL.into());
+                }
+
+                let optval_ptr = optval_ptr.cast::<OptType>();
+                let val = mem.read(optval_ptr)?;
+
+                // like linux, this only affects later binds
+                self.reuse_port = val != 0;
             }
             (libc::SOL_SOCKET, libc::SO_KEEPALIVE) => {
                 // TODO: implement this, libevent uses it in evconnlistener_new_bind()
@@ -1120,7 +1153,13 @@ impl tcp::Dependencies for TcpDeps {
                 });
             });
 
-            host.schedule_task_at_emulated_time(task, time);
+            // the tcp state never cancels its timers, but the timer wheel still saves the host from
+            // scheduling an event for each of them
+            if host.has_timer_wheel() {
+                host.add_timer(task, time);
+            } else {
+                host.schedule_task_at_emulated_time(task, time);
+            }
         })
         .unwrap();
     }
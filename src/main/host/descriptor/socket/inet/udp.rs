@@ -1,4 +1,4 @@
-use std::collections::LinkedList;
+use std::collections::VecDeque;
 use std::io::{Read, Write};
 use std::net::{Ipv4Addr, SocketAddrV4};
 use std::sync::Arc;
@@ -44,6 +44,9 @@ pub struct UdpSocket {
     peer_addr: Option<SocketAddrV4>,
     bound_addr: Option<SocketAddrV4>,
     association: Option<AssociationHandle>,
+    /// Was `SO_REUSEPORT` set? The socket can then be bound to the same address as other sockets
+    /// that set it, and the packets from different peers are distributed over them.
+    reuse_port: bool,
     /// The receive time of the last packet returned to the managed process during a call to
     /// `recvmsg()`. Used for `SIOCGSTAMP`.
     recv_time_of_last_read_packet: Option<EmulatedTime>,
@@ -64,11 +67,12 @@ impl UdpSocket {
             status,
             state: FileState::ACTIVE,
             shutdown_status: ShutdownFlags::empty(),
-            send_buffer: MessageBuffer::new(send_buf_size),
-            recv_buffer: MessageBuffer::new(recv_buf_size),
+            send_buffer: MessageBuffer::new(send_buf_size, /* charge_skb_overhead= */ false),
+            recv_buffer: MessageBuffer::new(recv_buf_size, /* charge_skb_overhead= */ true),
             peer_addr: None,
             bound_addr: None,
             association: None,
+            reuse_port: false,
             recv_time_of_last_read_packet: None,
             has_open_file: false,
             _counter: ObjectCounter::new("UdpSocket"),
@@ -196,6 +200,11 @@ impl UdpSocket {
         !self.send_buffer.is_empty()
     }
 
+    /// The number of payload bytes in the socket's send and receive buffers.
+    pub fn buffered_bytes(&self) -> usize {
+        self.send_buffer.len_bytes() + self.recv_buffer.len_bytes()
+    }
+
     pub fn getsockname(&self) -> Result<Option<SockaddrIn>, Errno> {
         let mut addr = self
             .bound_addr
@@ -251,7 +260,7 @@ impl UdpSocket {
 
         let addr: SocketAddrV4 = (*addr).into();
 
-        {
+        let reuse_port = {
             let socket = socket.borrow();
 
             // if the socket is already bound
@@ -265,7 +274,9 @@ impl UdpSocket {
 
             // must not have been associated with the network interface
             assert!(socket.association.is_none());
-        }
+
+            socket.reuse_port
+        };
 
         // this will allow us to receive packets from any peer
         let unspecified_addr = SocketAddrV4::new(Ipv4Addr::UNSPECIFIED, 0);
@@ -276,6 +287,7 @@ impl UdpSocket {
             addr,
             unspecified_addr,
             /* check_generic_peer= */ true,
+            reuse_port,
             net_ns,
             rng,
         )?;
@@ -402,6 +414,7 @@ impl UdpSocket {
                 local_addr,
                 unspecified_addr,
                 /* check_generic_peer= */ true,
+                socket_ref.reuse_port,
                 net_ns,
                 rng,
             )?;
@@ -754,6 +767,7 @@ impl UdpSocket {
                     local_addr,
                     unspecified_addr,
                     /* check_generic_peer= */ true,
+                    socket_ref.reuse_port,
                     net_ns,
                     rng,
                 )?;
@@ -864,6 +878,13 @@ impl UdpSocket {
 
                 Ok(bytes_written as libc::socklen_t)
             }
+            (libc::SOL_SOCKET, libc::SO_REUSEPORT) => {
+                let optval_ptr = optval_ptr.cast::<libc::c_int>();
+                let reuse_port = libc::c_int::from(self.reuse_port);
+                let bytes_written = write_partial(mem, &reuse_port, optval_ptr, optlen as usize)?;
+
+                Ok(bytes_written as libc::socklen_t)
+            }
             (libc::SOL_SOCKET, libc::SO_BROADCAST) => {
                 let optval_ptr = optval_ptr.cast::<libc::c_int>();
                 // we don't support broadcast sockets, so just just return the default 0
@@ -961,9 +982,17 @@ impl UdpSocket {
                 return Err(Errno::ENOPROTOOPT.into());
             }
             (libc::SOL_SOCKET, libc::SO_REUSEPORT) => {
-                // TODO: implement this
-                warn_once_then_debug!("setsockopt SO_REUSEPORT not yet implemented for udp");
-                return Err(Errno::ENOPROTOOPT.into());
+                type OptType = libc::c_int;
+
+                if usize::try_from(optlen).unwrap() < std::mem::size_of::<OptType>() {
+                    return Err(Errno::EINVAL.into());
+                }
+
+                let optval_ptr = optval_ptr.cast::<OptType>();
+                let val = mem.read(optval_ptr)?;
+
+                // like linux, this only affects later binds
+                self.reuse_port = val != 0;
             }
             (libc::SOL_SOCKET, libc::SO_KEEPALIVE) => {
                 // TODO: implement this
@@ -1108,36 +1137,51 @@ struct MessageRecvHeader {
 #[derive(Debug)]
 struct MessageBuffer<Hdr> {
     /// The message payloads and headers.
-    // use a `LinkedList` so that socket buffers can shrink when they're empty (as opposed to
-    // `VecDeque`)
-    buffer: LinkedList<(Bytes, Hdr)>,
+    buffer: VecDeque<(Bytes, Hdr)>,
     /// The number of payload bytes in this socket.
     len_bytes: usize,
-    /// A soft limit for the maximum number of payload bytes this buffer can hold.
+    /// The number of bytes charged against the soft limit. This is the same as `len_bytes`, unless
+    /// we charge each message's skb overhead like Linux does.
+    mem_bytes: usize,
+    /// Charge each message as its [`skb_truesize`] rather than its payload length.
+    charge_skb_overhead: bool,
+    /// A soft limit for the maximum number of bytes this buffer can hold.
     soft_limit_bytes: usize,
 }
 
 impl<Hdr> MessageBuffer<Hdr> {
-    pub fn new(soft_limit_bytes: usize) -> Self {
+    /// Release the ring's memory when it becomes empty if it's grown beyond this many messages, so
+    /// that a burst doesn't leave an idle socket holding a large allocation.
+    const MAX_IDLE_CAPACITY: usize = 64;
+
+    pub fn new(soft_limit_bytes: usize, charge_skb_overhead: bool) -> Self {
         Self {
-            buffer: std::collections::LinkedList::new(),
+            buffer: VecDeque::new(),
             len_bytes: 0,
+            mem_bytes: 0,
+            charge_skb_overhead,
             soft_limit_bytes,
         }
     }
 
+    fn charge(&self, message: &Bytes) -> usize {
+        if self.charge_skb_overhead {
+            skb_truesize(message.len())
+        } else {
+            message.len()
+        }
+    }
+
     /// Push a message to the buffer. Returns the message and header as an `Err` if there wasn't
     /// enough space.
     pub fn push_message(&mut self, message: Bytes, header: Hdr) -> Result<(), (Bytes, Hdr)> {
-        // TODO: i think udp allows at most one packet to exceed the buffer capacity; should confirm
-        // this
+        // like Linux, we allow the message that takes the buffer over the limit
         if !self.has_space() {
             return Err((message, header));
         }
 
-        // TODO: on linux the socket buffer length also takes into account any header and struct
-        // overhead, otherwise the buffer would take an infinite amount of 0-len packets
         self.len_bytes += message.len();
+        self.mem_bytes += self.charge(&message);
         self.buffer.push_back((message, header));
 
         Ok(())
@@ -1148,6 +1192,11 @@ impl<Hdr> MessageBuffer<Hdr> {
     pub fn pop_message(&mut self) -> Option<(Bytes, Hdr)> {
         let (message, header) = self.buffer.pop_front()?;
         self.len_bytes -= message.len();
+        self.mem_bytes -= self.charge(&message);
+
+        if self.buffer.is_empty() && self.buffer.capacity() > Self::MAX_IDLE_CAPACITY {
+            self.buffer = VecDeque::new();
+        }
 
         Some((message, header))
     }
@@ -1165,7 +1214,7 @@ impl<Hdr> MessageBuffer<Hdr> {
 
     /// Is there space for at least one more packet?
     pub fn has_space(&self) -> bool {
-        self.len_bytes < self.soft_limit_bytes
+        self.mem_bytes < self.soft_limit_bytes
     }
 
     /// Is the buffer empty (does it have 0 packets)?
@@ -1183,3 +1232,57 @@ impl<Hdr> MessageBuffer<Hdr> {
         self.soft_limit_bytes = soft_limit_bytes;
     }
 }
+
+/// The memory that Linux charges to a socket's receive buffer for a datagram with `len` payload
+/// bytes: the `SKB_TRUESIZE()` of a linear skb on x86-64. This is why Linux doubles the `SO_RCVBUF`
+/// value, and why a buffer can't hold an unbounded number of empty datagrams.
+fn skb_truesize(len: usize) -> usize {
+    // SKB_DATA_ALIGN(sizeof(struct sk_buff)) + SKB_DATA_ALIGN(sizeof(struct skb_shared_info))
+    const SKB_OVERHEAD: usize = 256 + 320;
+    // SKB_DATA_ALIGN() aligns to the cache line size
+    len.next_multiple_of(64) + SKB_OVERHEAD
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_skb_overhead() {
+        let mut buf = MessageBuffer::new(2048, /* charge_skb_overhead= */ true);
+
+        // empty datagrams still use space
+        let mut count = 0;
+        while buf.push_message(Bytes::new(), ()).is_ok() {
+            count += 1;
+        }
+        assert_eq!(count, 4);
+        assert_eq!(buf.len_bytes(), 0);
+
+        buf.pop_message().unwrap();
+        assert!(buf.has_space());
+        while buf.pop_message().is_some() {}
+        assert_eq!(buf.mem_bytes, 0);
+    }
+
+    #[test]
+    fn test_payload_only() {
+        let mut buf = MessageBuffer::new(10, /* charge_skb_overhead= */ false);
+        buf.push_message(Bytes::from_static(b"hello"), ()).unwrap();
+        buf.push_message(Bytes::from_static(b"world!"), ()).unwrap();
+        assert!(buf.push_message(Bytes::new(), ()).is_err());
+        assert_eq!(buf.len_bytes(), 11);
+        assert_eq!(buf.pop_message().unwrap().0, b"hello"[..]);
+        assert_eq!(buf.len_bytes(), 6);
+    }
+
+    #[test]
+    fn test_release_idle_capacity() {
+        let mut buf = MessageBuffer::new(usize::MAX, /* charge_skb_overhead= */ true);
+        for _ in 0..1000 {
+            buf.push_message(Bytes::new(), ()).unwrap();
+        }
+        while buf.pop_message().is_some() {}
+        assert_eq!(buf.buffer.capacity(), 0);
+    }
+}
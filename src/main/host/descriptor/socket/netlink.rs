@@ -58,29 +58,10 @@ impl NetlinkSocket {
             let buffer = SharedBuf::new(usize::MAX);
             let buffer = Arc::new(AtomicRefCell::new(buffer));
 
-            // Get the IP address of the host
-            let default_ip = Worker::with_active_host(|host| host.default_ip()).unwrap();
-            // All the interface configurations are the same as in the getifaddrs function handler
-            let interfaces = vec![
-                Interface {
-                    address: Ipv4Addr::LOCALHOST,
-                    label: String::from("lo"),
-                    prefix_len: 8,
-                    if_type: Arphrd::Loopback,
-                    mtu: c::CONFIG_MTU,
-                    scope: RtScope::Host,
-                    index: 1,
-                },
-                Interface {
-                    address: default_ip,
-                    label: String::from("eth0"),
-                    prefix_len: 24,
-                    if_type: Arphrd::Ether,
-                    mtu: c::CONFIG_MTU,
-                    scope: RtScope::Universe,
-                    index: 2,
-                },
-            ];
+            // The host's interfaces never change, so it serializes their dumps once
+            let dumps =
+                Worker::with_active_host(|host| host.network_namespace_borrow().netlink_dumps())
+                    .unwrap();
 
             let mut common = NetlinkSocketCommon {
                 buffer,
@@ -90,7 +71,7 @@ impl NetlinkSocket {
                 state: FileState::ACTIVE,
                 status,
                 has_open_file: false,
-                interfaces,
+                dumps,
             };
             let protocol_state = ProtocolState::new(&mut common, weak);
             let mut socket = Self {
@@ -821,69 +802,7 @@ impl InitialState {
             return self.handle_error(bytes);
         }
 
-        let mut buffer = Cursor::new(Vec::new());
-        // Send the interface addresses
-        for interface in &common.interfaces {
-            let address = interface.address.octets();
-            let broadcast = Ipv4Addr::from(
-                0xffff_ffff_u32
-                    .checked_shr(u32::from(interface.prefix_len))
-                    .unwrap_or(0)
-                    | u32::from(interface.address),
-            )
-            .octets();
-            let mut label = Vec::from(interface.label.as_bytes());
-            label.push(0); // Null-terminate
-
-            // List of attribtes sent with the response for the current interface
-            let attrs = [
-                // I don't know the difference between IFA_ADDRESS and IFA_LOCAL. However, Linux
-                // provides the same address for both attributes, so I do the same.
-                // Run `strace ip addr` to see.
-                Rtattr::new(None, Ifa::Address, Buffer::from(&address[..])).unwrap(),
-                Rtattr::new(None, Ifa::Local, Buffer::from(&address[..])).unwrap(),
-                Rtattr::new(None, Ifa::Broadcast, Buffer::from(&broadcast[..])).unwrap(),
-                Rtattr::new(None, Ifa::Label, Buffer::from(label)).unwrap(),
-            ];
-            let ifaddrmsg = Ifaddrmsg {
-                ifa_family: RtAddrFamily::Inet,
-                ifa_prefixlen: interface.prefix_len,
-                // IFA_F_PERMANENT is used to indicate that the address is permanent
-                ifa_flags: IfaFFlags::new(&[IfaF::Permanent]),
-                ifa_scope: libc::c_uchar::from(interface.scope),
-                ifa_index: interface.index,
-                rtattrs: RtBuffer::from_iter(attrs),
-            };
-            let nlmsg = {
-                let len = None;
-                let nl_type = Rtm::Newaddr;
-                // The NLM_F_MULTI flag is used to indicate that we will send multiple messages
-                let flags = NlmFFlags::new(&[NlmF::Multi]);
-                // Use the same sequence number as the request
-                let seq = Some(nlmsg.nl_seq);
-                let pid = None;
-                let payload = NlPayload::Payload(ifaddrmsg);
-                Nlmsghdr::new(len, nl_type, flags, seq, pid, payload)
-            };
-            nlmsg.to_bytes(&mut buffer).unwrap();
-        }
-        // After sending the messages with the NLM_F_MULTI flag set, we need to send the NLMSG_DONE message
-        let done_msg = {
-            let len = None;
-            let nl_type = Nlmsg::Done;
-            let flags = NlmFFlags::new(&[NlmF::Multi]);
-            // Use the same sequence number as the request
-            let seq = Some(nlmsg.nl_seq);
-            let pid = None;
-            // Linux also emits the errno of zero after the header. See `strace ip addr`
-            // For documentation reference, see https://git.kernel.org/pub/scm/linux/kernel/git/torvalds/linux.git/tree/Documentation/userspace-api/netlink/intro.rst?h=v6.2#n232
-            // For code reference, see https://git.kernel.org/pub/scm/linux/kernel/git/torvalds/linux.git/tree/net/netlink/af_netlink.c?h=v6.2#n2222
-            let payload: NlPayload<Nlmsg, u32> = NlPayload::Payload(0);
-            Nlmsghdr::new(len, nl_type, flags, seq, pid, payload)
-        };
-        done_msg.to_bytes(&mut buffer).unwrap();
-
-        buffer.into_inner()
+        common.dumps.addr_dump(nlmsg.nl_seq)
     }
 
     fn handle_ifinfomsg(&self, common: &mut NetlinkSocketCommon, bytes: &[u8]) -> Vec<u8> {
@@ -921,71 +840,7 @@ impl InitialState {
         // We don't check for ifi_change because we found that `ip addr` sets it to zero even if
         // rtnetlink(7) recommends to set it to all 1s
 
-        let mut buffer = Cursor::new(Vec::new());
-        // Send the interface addresses
-        for interface in &common.interfaces {
-            let mut label = Vec::from(interface.label.as_bytes());
-            label.push(0); // Null-terminate
-
-            // List of attribtes sent with the response for the current interface
-            let attrs = [
-                Rtattr::new(None, Ifla::Ifname, Buffer::from(label)).unwrap(),
-                // Not sure about the value of this one, but I always see 1000 from `ip addr`. If
-                // we don't specify this, `ip addr` will create an AF_INET socket and do ioctl. See
-                // https://git.kernel.org/pub/scm/network/iproute2/iproute2.git/tree/ip/ipaddress.c#n168
-                Rtattr::new(None, Ifla::Txqlen, Buffer::from(&1000u32.to_le_bytes()[..])).unwrap(),
-                Rtattr::new(
-                    None,
-                    Ifla::Mtu,
-                    Buffer::from(&interface.mtu.to_le_bytes()[..]),
-                )
-                .unwrap(),
-                // TODO: Add the MAC address through IFLA_ADDRESS and IFLA_BROADCAST
-            ];
-            let flags = if interface.if_type == Arphrd::Loopback {
-                IffFlags::new(&[Iff::Up, Iff::Loopback, Iff::Running])
-            } else {
-                // Not sure about the IFF_MULTICAST, but it's also the one I got from `strace ip addr`
-                IffFlags::new(&[Iff::Up, Iff::Broadcast, Iff::Running, Iff::Multicast])
-            };
-            let ifinfomsg = Ifinfomsg::new(
-                RtAddrFamily::Inet,
-                interface.if_type,
-                interface.index,
-                flags,
-                IffFlags::from_bitmask(0xffffffff), // rtnetlink(7) recommends to set it to all 1s
-                RtBuffer::from_iter(attrs),
-            );
-            let nlmsg = {
-                let len = None;
-                let nl_type = Rtm::Newlink;
-                // The NLM_F_MULTI flag is used to indicate that we will send multiple messages
-                let flags = NlmFFlags::new(&[NlmF::Multi]);
-                // Use the same sequence number as the request
-                let seq = Some(nlmsg.nl_seq);
-                let pid = None;
-                let payload = NlPayload::Payload(ifinfomsg);
-                Nlmsghdr::new(len, nl_type, flags, seq, pid, payload)
-            };
-            nlmsg.to_bytes(&mut buffer).unwrap();
-        }
-        // After sending the messages with the NLM_F_MULTI flag set, we need to send the NLMSG_DONE message
-        let done_msg = {
-            let len = None;
-            let nl_type = Nlmsg::Done;
-            let flags = NlmFFlags::new(&[NlmF::Multi]);
-            // Use the same sequence number as the request
-            let seq = Some(nlmsg.nl_seq);
-            let pid = None;
-            // Linux also emits the errno of zero after the header. See `strace ip addr`
-            // For documentation reference, see https://git.kernel.org/pub/scm/linux/kernel/git/torvalds/linux.git/tree/Documentation/userspace-api/netlink/intro.rst?h=v6.2#n232
-            // For code reference, see https://git.kernel.org/pub/scm/linux/kernel/git/torvalds/linux.git/tree/net/netlink/af_netlink.c?h=v6.2#n2222
-            let payload: NlPayload<Nlmsg, u32> = NlPayload::Payload(0);
-            Nlmsghdr::new(len, nl_type, flags, seq, pid, payload)
-        };
-        done_msg.to_bytes(&mut buffer).unwrap();
-
-        buffer.into_inner()
+        common.dumps.link_dump(nlmsg.nl_seq)
     }
 }
 
@@ -1067,6 +922,227 @@ struct Interface {
     index: libc::c_int,
 }
 
+/// A serialized sequence of netlink messages.
+struct Dump {
+    bytes: Vec<u8>,
+    /// The offset of each message in `bytes`.
+    nlmsg_offsets: Vec<usize>,
+}
+
+impl Dump {
+    /// A copy of the messages with their sequence numbers set to `seq`.
+    fn with_seq(&self, seq: u32) -> Vec<u8> {
+        let mut bytes = self.bytes.clone();
+        let seq_span = memoffset::span_of!(nlmsghdr, nlmsg_seq);
+        for offset in &self.nlmsg_offsets {
+            bytes[offset + seq_span.start..offset + seq_span.end]
+                .copy_from_slice(&seq.to_ne_bytes());
+        }
+        bytes
+    }
+}
+
+/// The host's responses to `RTM_GETLINK` and `RTM_GETADDR` dump requests. A host's interfaces
+/// never change, so these are serialized once per host (see
+/// [`NetworkNamespace::netlink_dumps`]) rather than for each request. Only the sequence number
+/// differs between responses.
+pub struct NetlinkDumps {
+    links: Dump,
+    addrs: Dump,
+}
+
+impl NetlinkDumps {
+    pub fn new(default_ip: Ipv4Addr) -> Self {
+        let interfaces = Self::interfaces(default_ip);
+        Self {
+            links: Self::serialize_links(&interfaces, 0),
+            addrs: Self::serialize_addrs(&interfaces, 0),
+        }
+    }
+
+    fn interfaces(default_ip: Ipv4Addr) -> [Interface; 2] {
+        // All the interface configurations are the same as in the getifaddrs function handler
+        [
+            Interface {
+                address: Ipv4Addr::LOCALHOST,
+                label: String::from("lo"),
+                prefix_len: 8,
+                if_type: Arphrd::Loopback,
+                mtu: c::CONFIG_MTU,
+                scope: RtScope::Host,
+                index: 1,
+            },
+            Interface {
+                address: default_ip,
+                label: String::from("eth0"),
+                prefix_len: 24,
+                if_type: Arphrd::Ether,
+                mtu: c::CONFIG_MTU,
+                scope: RtScope::Universe,
+                index: 2,
+            },
+        ]
+    }
+
+    /// The response to a `RTM_GETLINK` dump request with sequence number `seq`.
+    fn link_dump(&self, seq: u32) -> Vec<u8> {
+        self.links.with_seq(seq)
+    }
+
+    /// The response to a `RTM_GETADDR` dump request with sequence number `seq`.
+    fn addr_dump(&self, seq: u32) -> Vec<u8> {
+        self.addrs.with_seq(seq)
+    }
+
+    /// Serialize the `RTM_NEWLINK` messages for the interfaces, followed by `NLMSG_DONE`.
+    fn serialize_links(interfaces: &[Interface], seq: u32) -> Dump {
+        let mut buffer = Cursor::new(Vec::new());
+        let mut nlmsg_offsets = Vec::new();
+        // Send the interface addresses
+        for interface in interfaces {
+            let mut label = Vec::from(interface.label.as_bytes());
+            label.push(0); // Null-terminate
+
+            // List of attribtes sent with the response for the current interface
+            let attrs = [
+                Rtattr::new(None, Ifla::Ifname, Buffer::from(label)).unwrap(),
+                // Not sure about the value of this one, but I always see 1000 from `ip addr`. If
+                // we don't specify this, `ip addr` will create an AF_INET socket and do ioctl. See
+                // https://git.kernel.org/pub/scm/network/iproute2/iproute2.git/tree/ip/ipaddress.c#n168
+                Rtattr::new(None, Ifla::Txqlen, Buffer::from(&1000u32.to_le_bytes()[..])).unwrap(),
+                Rtattr::new(
+                    None,
+                    Ifla::Mtu,
+                    Buffer::from(&interface.mtu.to_le_bytes()[..]),
+                )
+                .unwrap(),
+                // TODO: Add the MAC address through IFLA_ADDRESS and IFLA_BROADCAST
+            ];
+            let flags = if interface.if_type == Arphrd::Loopback {
+                IffFlags::new(&[Iff::Up, Iff::Loopback, Iff::Running])
+            } else {
+                // Not sure about the IFF_MULTICAST, but it's also the one I got from `strace ip addr`
+                IffFlags::new(&[Iff::Up, Iff::Broadcast, Iff::Running, Iff::Multicast])
+            };
+            let ifinfomsg = Ifinfomsg::new(
+                RtAddrFamily::Inet,
+                interface.if_type,
+                interface.index,
+                flags,
+                IffFlags::from_bitmask(0xffffffff), // rtnetlink(7) recommends to set it to all 1s
+                RtBuffer::from_iter(attrs),
+            );
+            let nlmsg = {
+                let len = None;
+                let nl_type = Rtm::Newlink;
+                // The NLM_F_MULTI flag is used to indicate that we will send multiple messages
+                let flags = NlmFFlags::new(&[NlmF::Multi]);
+                // Use the same sequence number as the request
+                let seq = Some(seq);
+                let pid = None;
+                let payload = NlPayload::Payload(ifinfomsg);
+                Nlmsghdr::new(len, nl_type, flags, seq, pid, payload)
+            };
+            nlmsg_offsets.push(buffer.position() as usize);
+            nlmsg.to_bytes(&mut buffer).unwrap();
+        }
+        // After sending the messages with the NLM_F_MULTI flag set, we need to send the NLMSG_DONE message
+        let done_msg = {
+            let len = None;
+            let nl_type = Nlmsg::Done;
+            let flags = NlmFFlags::new(&[NlmF::Multi]);
+            // Use the same sequence number as the request
+            let seq = Some(seq);
+            let pid = None;
+            // Linux also emits the errno of zero after the header. See `strace ip addr`
+            // For documentation reference, see https://git.kernel.org/pub/scm/linux/kernel/git/torvalds/linux.git/tree/Documentation/userspace-api/netlink/intro.rst?h=v6.2#n232
+            // For code reference, see https://git.kernel.org/pub/scm/linux/kernel/git/torvalds/linux.git/tree/net/netlink/af_netlink.c?h=v6.2#n2222
+            let payload: NlPayload<Nlmsg, u32> = NlPayload::Payload(0);
+            Nlmsghdr::new(len, nl_type, flags, seq, pid, payload)
+        };
+        nlmsg_offsets.push(buffer.position() as usize);
+        done_msg.to_bytes(&mut buffer).unwrap();
+
+        Dump {
+            bytes: buffer.into_inner(),
+            nlmsg_offsets,
+        }
+    }
+
+    /// Serialize the `RTM_NEWADDR` messages for the interfaces, followed by `NLMSG_DONE`.
+    fn serialize_addrs(interfaces: &[Interface], seq: u32) -> Dump {
+        let mut buffer = Cursor::new(Vec::new());
+        let mut nlmsg_offsets = Vec::new();
+        // Send the interface addresses
+        for interface in interfaces {
+            let address = interface.address.octets();
+            let broadcast = Ipv4Addr::from(
+                0xffff_ffff_u32
+                    .checked_shr(u32::from(interface.prefix_len))
+                    .unwrap_or(0)
+                    | u32::from(interface.address),
+            )
+            .octets();
+            let mut label = Vec::from(interface.label.as_bytes());
+            label.push(0); // Null-terminate
+
+            // List of attribtes sent with the response for the current interface
+            let attrs = [
+                // I don't know the difference between IFA_ADDRESS and IFA_LOCAL. However, Linux
+                // provides the same address for both attributes, so I do the same.
+                // Run `strace ip addr` to see.
+                Rtattr::new(None, Ifa::Address, Buffer::from(&address[..])).unwrap(),
+                Rtattr::new(None, Ifa::Local, Buffer::from(&address[..])).unwrap(),
+                Rtattr::new(None, Ifa::Broadcast, Buffer::from(&broadcast[..])).unwrap(),
+                Rtattr::new(None, Ifa::Label, Buffer::from(label)).unwrap(),
+            ];
+            let ifaddrmsg = Ifaddrmsg {
+                ifa_family: RtAddrFamily::Inet,
+                ifa_prefixlen: interface.prefix_len,
+                // IFA_F_PERMANENT is used to indicate that the address is permanent
+                ifa_flags: IfaFFlags::new(&[IfaF::Permanent]),
+                ifa_scope: libc::c_uchar::from(interface.scope),
+                ifa_index: interface.index,
+                rtattrs: RtBuffer::from_iter(attrs),
+            };
+            let nlmsg = {
+                let len = None;
+                let nl_type = Rtm::Newaddr;
+                // The NLM_F_MULTI flag is used to indicate that we will send multiple messages
+                let flags = NlmFFlags::new(&[NlmF::Multi]);
+                // Use the same sequence number as the request
+                let seq = Some(seq);
+                let pid = None;
+                let payload = NlPayload::Payload(ifaddrmsg);
+                Nlmsghdr::new(len, nl_type, flags, seq, pid, payload)
+            };
+            nlmsg_offsets.push(buffer.position() as usize);
+            nlmsg.to_bytes(&mut buffer).unwrap();
+        }
+        // After sending the messages with the NLM_F_MULTI flag set, we need to send the NLMSG_DONE message
+        let done_msg = {
+            let len = None;
+            let nl_type = Nlmsg::Done;
+            let flags = NlmFFlags::new(&[NlmF::Multi]);
+            // Use the same sequence number as the request
+            let seq = Some(seq);
+            let pid = None;
+            // Linux also emits the errno of zero after the header. See `strace ip addr`
+            // For documentation reference, see https://git.kernel.org/pub/scm/linux/kernel/git/torvalds/linux.git/tree/Documentation/userspace-api/netlink/intro.rst?h=v6.2#n232
+            // For code reference, see https://git.kernel.org/pub/scm/linux/kernel/git/torvalds/linux.git/tree/net/netlink/af_netlink.c?h=v6.2#n2222
+            let payload: NlPayload<Nlmsg, u32> = NlPayload::Payload(0);
+            Nlmsghdr::new(len, nl_type, flags, seq, pid, payload)
+        };
+        nlmsg_offsets.push(buffer.position() as usize);
+        done_msg.to_bytes(&mut buffer).unwrap();
+
+        Dump {
+            bytes: buffer.into_inner(),
+            nlmsg_offsets,
+        }
+    }
+}
+
 /// Common data and functionality that is useful for all states.
 struct NetlinkSocketCommon {
     buffer: Arc<AtomicRefCell<SharedBuf>>,
@@ -1080,8 +1156,8 @@ struct NetlinkSocketCommon {
     // should only be used by `OpenFile` to make sure there is only ever one `OpenFile` instance for
     // this file
     has_open_file: bool,
-    /// Interfaces
-    interfaces: Vec<Interface>,
+    /// The host's serialized interface dumps
+    dumps: Arc<NetlinkDumps>,
 }
 
 impl NetlinkSocketCommon {
@@ -1326,3 +1402,29 @@ impl std::fmt::Display for NetlinkFamilyConversionError {
         )
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_dump_with_seq() {
+        let interfaces = NetlinkDumps::interfaces(Ipv4Addr::new(11, 0, 0, 1));
+        let dumps = NetlinkDumps::new(Ipv4Addr::new(11, 0, 0, 1));
+
+        for seq in [0, 1, 0x1234_5678] {
+            assert_eq!(
+                dumps.link_dump(seq),
+                NetlinkDumps::serialize_links(&interfaces, seq).bytes
+            );
+            assert_eq!(
+                dumps.addr_dump(seq),
+                NetlinkDumps::serialize_addrs(&interfaces, seq).bytes
+            );
+        }
+
+        // a response with one message per interface, and the done message
+        assert_eq!(dumps.links.nlmsg_offsets.len(), interfaces.len() + 1);
+        assert_eq!(dumps.addrs.nlmsg_offsets.len(), interfaces.len() + 1);
+    }
+}
@@ -2025,7 +2025,7 @@ impl UnixSocketCommon {
             match AbstractUnixNamespace::bind(
                 &namespace,
                 self.socket_type,
-                name.to_vec(),
+                name,
                 socket,
                 &mut self.event_source,
             ) {
@@ -2371,7 +2371,6 @@ fn backlog_to_queue_size(backlog: i32) -> u32 {
     queue_limit.saturating_add(1)
 }
 
-// WARNING: don't add new enum variants without updating 'AbstractUnixNamespace::new()'
 #[derive(Copy, Clone, Debug, Hash, PartialEq, Eq)]
 pub enum UnixSocketType {
     Stream,
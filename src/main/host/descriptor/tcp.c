@@ -25,8 +25,10 @@
 #include "main/core/worker.h"
 #include "main/host/descriptor/descriptor.h"
 #include "main/host/descriptor/socket.h"
+#include "main/host/descriptor/tcp_child_table.h"
 #include "main/host/descriptor/tcp_cong.h"
 #include "main/host/descriptor/tcp_cong_reno.h"
+#include "main/host/descriptor/tcp_packet_ring.h"
 #include "main/host/descriptor/tcp_retransmit_tally.h"
 #include "main/network/legacypacket.h"
 #include "main/utility/priority_queue.h"
@@ -61,6 +63,7 @@ enum TCPFlags {
     TCPF_WAS_ESTABLISHED = 1 << 6,
     TCPF_CONNECT_SIGNAL_NEEDED = 1 << 7,
     TCPF_SHOULD_SEND_WR_FIN = 1 << 8,
+    TCPF_FLUSH_SCHEDULED = 1 << 9,
 };
 
 enum TCPError {
@@ -84,8 +87,13 @@ enum TCPReceiveState {
 typedef struct _TCPChild TCPChild;
 struct _TCPChild {
     enum TCPChildState state;
-    guint key; /* hash(peerIP, peerPort) */
+    /* my parent can find me by my peer's address; both in network byte order */
+    in_addr_t peerIP;
+    in_port_t peerPort;
     TCP* parent;
+    /* the neighbours in the parent's accept queue, while the child is in it */
+    TCP* pendingPrev;
+    TCP* pendingNext;
     /* the handle to return when the socket is accepted */
     int handle;
     MAGIC_DECLARE;
@@ -96,9 +104,11 @@ struct _TCPServer {
     /* children will be registered in this process' descriptor table */
     pid_t processForChildren;
     /* all children of this server */
-    GHashTable* children;
-    /* pending children to accept in order. */
-    GQueue *pending;
+    TCPChildTable* children;
+    /* pending children to accept in order, linked through their TCPChild */
+    TCP* pendingHead;
+    TCP* pendingTail;
+    guint pendingLength;
     /* maximum number of pending connections (capped at SHADOW_SOMAXCONN) */
     guint pendingMax;
     guint pendingCount;
@@ -176,7 +186,7 @@ struct _TCP {
 
     struct {
         /* TCP provides reliable transport, keep track of packets until they are acked */
-        GHashTable* queue;
+        TCPPacketRing queue;
         /* track amount of queued application data */
         gsize queueLength;
         /* retransmission timeout value (rto), in milliseconds */
@@ -200,6 +210,13 @@ struct _TCP {
         gsize bytesCopied;
         CEmulatedTime lastAdjustment;
         gsize space;
+        /* the max buffer sizes for the smoothed rtt `maxMemRtt`, which only change with the rtt */
+        gboolean maxMemIsValid;
+        gint maxMemRtt;
+        gsize maxRMEM;
+        gsize maxWMEM;
+        /* the memory taken from the host's socket buffer budget to grow the buffers */
+        gsize allocatedMemory;
     } autotune;
 
     /* congestion object for implementing different types of congestion control (aimd, reno, cubic) */
@@ -227,7 +244,7 @@ struct _TCP {
     gsize throttledOutputLength;
 
     /* TCP ensures that the user receives data in-order */
-    PriorityQueue* unorderedInput;
+    TCPPacketRing unorderedInput;
     /* track amount of queued application data */
     gsize unorderedInputLength;
 
@@ -257,14 +274,6 @@ static void _rswlog(const TCP *tcp, const char *format, ...) {
 #endif // RSWLOG
 }
 
-static guint _ipPortHash(in_addr_t ip, in_port_t port) {
-    GString* buffer = g_string_new(NULL);
-    g_string_printf(buffer, "%u:%u", ip, port);
-    guint hash_value = g_str_hash(buffer->str);
-    g_string_free(buffer, TRUE);
-    return hash_value;
-}
-
 static gint _simulationTimeCompare(const CSimulationTime* value1, const CSimulationTime* value2,
                                    gpointer userData) {
     utility_debugAssert(value1 && value2);
@@ -273,6 +282,7 @@ static gint _simulationTimeCompare(const CSimulationTime* value1, const CSimulat
 }
 
 static void _tcp_flush(TCP* tcp, const Host* host);
+static void _tcp_flushSoon(TCP* tcp, const Host* host);
 
 static TCP* _tcp_fromLegacyFile(LegacyFile* descriptor) {
     utility_debugAssert(legacyfile_getType(descriptor) == DT_TCPSOCKET);
@@ -288,8 +298,9 @@ static TCPChild* _tcpchild_new(TCP* tcp, TCP* parent, int handle, in_addr_t peer
     TCPChild* child = g_new0(TCPChild, 1);
     MAGIC_INIT(child);
 
-    /* my parent can find me by my key */
-    child->key = _ipPortHash(peerIP, peerPort);
+    /* my parent can find me by my peer's address */
+    child->peerIP = peerIP;
+    child->peerPort = peerPort;
 
     legacyfile_ref(parent);
     child->parent = parent;
@@ -312,14 +323,72 @@ static TCPChild* _tcpchild_new(TCP* tcp, TCP* parent, int handle, in_addr_t peer
     return child;
 }
 
-static void _tcpchild_free(TCPChild* child) {
+/* Append the established child to the server's accept queue. */
+static void _tcpserver_pushPending(TCPServer* server, TCP* tcp) {
+    MAGIC_ASSERT(server);
+    MAGIC_ASSERT(tcp->child);
+
+    tcp->child->pendingPrev = server->pendingTail;
+    tcp->child->pendingNext = NULL;
+    if (server->pendingTail) {
+        server->pendingTail->child->pendingNext = tcp;
+    } else {
+        server->pendingHead = tcp;
+    }
+    server->pendingTail = tcp;
+    server->pendingLength++;
+}
+
+static bool _tcpserver_isPending(TCPServer* server, TCP* tcp) {
+    MAGIC_ASSERT(server);
+    return tcp->child->pendingPrev || tcp->child->pendingNext || server->pendingHead == tcp;
+}
+
+/* Remove the child from anywhere in the server's accept queue. */
+static void _tcpserver_unlinkPending(TCPServer* server, TCP* tcp) {
+    MAGIC_ASSERT(server);
+    TCPChild* child = tcp->child;
+    MAGIC_ASSERT(child);
+
+    if (child->pendingPrev) {
+        child->pendingPrev->child->pendingNext = child->pendingNext;
+    } else {
+        server->pendingHead = child->pendingNext;
+    }
+    if (child->pendingNext) {
+        child->pendingNext->child->pendingPrev = child->pendingPrev;
+    } else {
+        server->pendingTail = child->pendingPrev;
+    }
+    child->pendingPrev = NULL;
+    child->pendingNext = NULL;
+    server->pendingLength--;
+}
+
+/* Remove and return the oldest child in the server's accept queue, or NULL if it's empty. */
+static TCP* _tcpserver_popPending(TCPServer* server) {
+    MAGIC_ASSERT(server);
+    TCP* tcp = server->pendingHead;
+    if (tcp) {
+        _tcpserver_unlinkPending(server, tcp);
+    }
+    return tcp;
+}
+
+static void _tcpchild_free(TCP* tcp, TCPChild* child) {
     MAGIC_ASSERT(child);
     MAGIC_ASSERT(child->parent);
     MAGIC_ASSERT(child->parent->server);
 
+    /* a child that was never accepted must not be returned by a later accept */
+    if (_tcpserver_isPending(child->parent->server, tcp)) {
+        _tcpserver_unlinkPending(child->parent->server, tcp);
+        child->parent->server->pendingCount -= 1;
+    }
+
     /* remove parents reference to child, if it exists */
     if (child->parent->server->children) {
-        g_hash_table_remove(child->parent->server->children, &(child->key));
+        tcpchildtable_remove(child->parent->server->children, child->peerIP, child->peerPort);
     }
 
     legacyfile_unref(child->parent);
@@ -351,27 +420,28 @@ static TCPServer* _tcpserver_new(gint backlog, pid_t processForChildren) {
     TCPServer* server = g_new0(TCPServer, 1);
     MAGIC_INIT(server);
 
-    // store weak references to children
-    server->children =
-        g_hash_table_new_full(g_int_hash, g_int_equal, NULL, (GDestroyNotify)legacyfile_unrefWeak);
-    server->pending = g_queue_new();
     server->pendingMax = 0;
 
     server->processForChildren = processForChildren;
 
     _tcpserver_updateBacklog(server, backlog);
 
+    // store weak references to children. the table starts out large enough for a full accept
+    // queue, and grows with the number of connections.
+    server->children = tcpchildtable_new(server->pendingMax, legacyfile_unrefWeak);
+
     return server;
 }
 
 static void _tcpserver_free(TCPServer* server) {
     MAGIC_ASSERT(server);
 
-    /* no need to destroy children in this queue */
-    g_queue_free(server->pending);
+    /* no need to destroy children in the accept queue, since it's linked through them */
     /* this will unref all children */
     if(server->children) {
-        g_hash_table_destroy(server->children);
+        TCPChildTable* children = server->children;
+        server->children = NULL;
+        tcpchildtable_free(children);
     }
 
     MAGIC_CLEAR(server);
@@ -390,8 +460,10 @@ struct TCPCong_ *tcp_cong(TCP *tcp) {
 void tcp_clearAllChildrenIfServer(TCP* tcp) {
     MAGIC_ASSERT(tcp);
     if(tcp->server && tcp->server->children) {
-        g_hash_table_destroy(tcp->server->children);
+        /* children that are freed by this must not try to remove themselves from the table */
+        TCPChildTable* children = tcp->server->children;
         tcp->server->children = NULL;
+        tcpchildtable_free(children);
     }
 }
 
@@ -480,16 +552,65 @@ static gsize _tcp_computeRTTMEM(TCP* tcp, const Host* host, gboolean isRMEM) {
     return mem;
 }
 
+/* The autotuning runs on every read and ack, but the host bandwidths never change and the smoothed
+ * rtt changes much less often, so we only recompute the max buffer sizes when the rtt changes. */
+static void _tcp_refreshMaxMEM(TCP* tcp, const Host* host) {
+    if (tcp->autotune.maxMemIsValid && tcp->autotune.maxMemRtt == tcp->timing.rttSmoothed) {
+        return;
+    }
+
+    gsize rmem = _tcp_computeRTTMEM(tcp, host, TRUE);
+    tcp->autotune.maxRMEM = CLAMP(rmem, CONFIG_TCP_RMEM_MAX, CONFIG_TCP_RMEM_MAX * 10);
+    gsize wmem = _tcp_computeRTTMEM(tcp, host, FALSE);
+    tcp->autotune.maxWMEM = CLAMP(wmem, CONFIG_TCP_WMEM_MAX, CONFIG_TCP_WMEM_MAX * 10);
+
+    tcp->autotune.maxMemRtt = tcp->timing.rttSmoothed;
+    tcp->autotune.maxMemIsValid = TRUE;
+}
+
 static gsize _tcp_computeMaxRMEM(TCP* tcp, const Host* host) {
-    gsize mem = _tcp_computeRTTMEM(tcp, host, TRUE);
-    mem = CLAMP(mem, CONFIG_TCP_RMEM_MAX, CONFIG_TCP_RMEM_MAX*10);
-    return mem;
+    _tcp_refreshMaxMEM(tcp, host);
+    return tcp->autotune.maxRMEM;
 }
 
 static gsize _tcp_computeMaxWMEM(TCP* tcp, const Host* host) {
-    gsize mem = _tcp_computeRTTMEM(tcp, host, FALSE);
-    mem = CLAMP(mem, CONFIG_TCP_WMEM_MAX, CONFIG_TCP_WMEM_MAX*10);
-    return mem;
+    _tcp_refreshMaxMEM(tcp, host);
+    return tcp->autotune.maxWMEM;
+}
+
+/* Sets a buffer size chosen by autotuning. Growing a buffer takes memory from the host's socket
+ * buffer budget, and the buffer keeps its current size if the host can't spare it. The memory is
+ * returned to the host when the socket closes. Returns FALSE if the size wasn't changed. */
+static gboolean _tcp_setAutotunedBufferSize(TCP* tcp, const Host* host, gboolean isInput,
+                                        gsize newSize) {
+    gsize currentSize = isInput ? legacysocket_getInputBufferSize(&tcp->super)
+                                : legacysocket_getOutputBufferSize(&tcp->super);
+
+    if (newSize > currentSize) {
+        gsize growth = newSize - currentSize;
+        if (tcp->state == TCPS_CLOSED || !host_tryAllocateSocketMemory(host, growth)) {
+            trace("[autotune] %s buffer can't grow from %" G_GSIZE_FORMAT " to %" G_GSIZE_FORMAT
+                  " under memory pressure",
+                  isInput ? "input" : "output", currentSize, newSize);
+            return FALSE;
+        }
+        tcp->autotune.allocatedMemory += growth;
+    }
+
+    if (isInput) {
+        legacysocket_setInputBufferSize(&tcp->super, newSize);
+    } else {
+        legacysocket_setOutputBufferSize(&tcp->super, newSize);
+    }
+    return TRUE;
+}
+
+/* Return the memory that autotuning took from the host's socket buffer budget. */
+static void _tcp_freeAutotunedMemory(TCP* tcp, const Host* host) {
+    if (tcp->autotune.allocatedMemory > 0) {
+        host_freeSocketMemory(host, tcp->autotune.allocatedMemory);
+        tcp->autotune.allocatedMemory = 0;
+    }
 }
 
 static void _tcp_tuneInitialBufferSizes(TCP* tcp, const Host* host) {
@@ -527,11 +648,11 @@ static void _tcp_tuneInitialBufferSizes(TCP* tcp, const Host* host) {
 
         /* localhost always gets adjusted unless user explicitly set a set */
         if(!tcp->autotune.userDisabledReceive) {
-            legacysocket_setInputBufferSize(&(tcp->super), (gsize) CONFIG_TCP_RMEM_MAX);
+            _tcp_setAutotunedBufferSize(tcp, host, TRUE, (gsize)CONFIG_TCP_RMEM_MAX);
             trace("set loopback receive buffer size to %"G_GSIZE_FORMAT, (gsize)CONFIG_TCP_RMEM_MAX);
         }
         if(!tcp->autotune.userDisabledSend) {
-            legacysocket_setOutputBufferSize(&(tcp->super), (gsize) CONFIG_TCP_WMEM_MAX);
+            _tcp_setAutotunedBufferSize(tcp, host, FALSE, (gsize)CONFIG_TCP_WMEM_MAX);
             trace("set loopback send buffer size to %"G_GSIZE_FORMAT, (gsize)CONFIG_TCP_WMEM_MAX);
         }
 
@@ -569,11 +690,10 @@ static void _tcp_tuneInitialBufferSizes(TCP* tcp, const Host* host) {
     /* check to see if the node should set buffer sizes via autotuning, or
      * they were specified by configuration or parameters in XML */
     if (!tcp->autotune.userDisabledReceive && host_autotuneReceiveBuffer(host)) {
-        legacysocket_setInputBufferSize(&(tcp->super), (gsize) receivebuf_size);
+        _tcp_setAutotunedBufferSize(tcp, host, TRUE, (gsize)receivebuf_size);
     }
     if (!tcp->autotune.userDisabledSend && host_autotuneSendBuffer(host)) {
-        tcp->super.outputBufferSize = sendbuf_size;
-        legacysocket_setOutputBufferSize(&(tcp->super), (gsize) sendbuf_size);
+        _tcp_setAutotunedBufferSize(tcp, host, FALSE, (gsize)sendbuf_size);
     }
 
     debug("set network buffer sizes: send %" G_GSIZE_FORMAT " receive %" G_GSIZE_FORMAT,
@@ -593,8 +713,7 @@ static void _tcp_autotuneReceiveBuffer(TCP* tcp, const Host* host, guint bytesCo
         tcp->autotune.space = space;
 
         gsize newSize = (gsize)MIN(space, _tcp_computeMaxRMEM(tcp, host));
-        if(newSize > currentSize) {
-            legacysocket_setInputBufferSize(&tcp->super, newSize);
+        if(newSize > currentSize && _tcp_setAutotunedBufferSize(tcp, host, TRUE, newSize)) {
             trace("[autotune] input buffer size adjusted from %"G_GSIZE_FORMAT" to %"G_GSIZE_FORMAT,
                     currentSize, newSize);
         }
@@ -633,8 +752,7 @@ static void _tcp_autotuneSendBuffer(TCP* tcp, const Host* host) {
     gsize newSize = (gsize)MIN((gsize)(sndmem * 2 * demanded), _tcp_computeMaxWMEM(tcp, host));
 
     gsize currentSize = legacysocket_getOutputBufferSize(&tcp->super);
-    if(newSize > currentSize) {
-        legacysocket_setOutputBufferSize(&tcp->super, newSize);
+    if(newSize > currentSize && _tcp_setAutotunedBufferSize(tcp, host, FALSE, newSize)) {
         trace("[autotune] output buffer size adjusted from %"G_GSIZE_FORMAT" to %"G_GSIZE_FORMAT,
                 currentSize, newSize);
     }
@@ -689,6 +807,7 @@ static void _tcp_setState(TCP* tcp, const Host* host, enum TCPState state) {
         }
         case TCPS_CLOSED: {
             _tcp_clearRetransmit(tcp, (guint)-1);
+            _tcp_freeAutotunedMemory(tcp, host);
 
             /* user can no longer use socket */
             legacyfile_adjustStatus((LegacyFile*)tcp, FileState_ACTIVE, FALSE, 0);
@@ -711,28 +830,31 @@ static void _tcp_setState(TCP* tcp, const Host* host, enum TCPState state) {
              * children need to notify their parents when closing.
              */
             if (!tcp->server || !tcp->server->children ||
-                g_hash_table_size(tcp->server->children) <= 0) {
+                tcpchildtable_getLength(tcp->server->children) <= 0) {
                 if(tcp->child && tcp->child->parent) {
                     TCP* parent = tcp->child->parent;
                     utility_debugAssert(parent->server);
 
                     /* tell my server to stop accepting packets for me
                      * this will destroy the child and NULL out tcp->child */
-                    g_hash_table_remove(parent->server->children, &(tcp->child->key));
+                    tcpchildtable_remove(
+                        parent->server->children, tcp->child->peerIP, tcp->child->peerPort);
 
                     /* if i was the server's last child and its waiting to close, close it */
-                    if((parent->state == TCPS_CLOSED) && (g_hash_table_size(parent->server->children) <= 0)) {
+                    if ((parent->state == TCPS_CLOSED) &&
+                        (tcpchildtable_getLength(parent->server->children) <= 0)) {
                         if (disassociate) {
                             /* this will unbind from the network interface and free socket */
-                            host_disassociateInterface(
-                                host, PTCP, sock_ip, sock_port, peer_ip, peer_port);
+                            host_disassociateInterface(host, PTCP, sock_ip, sock_port, peer_ip,
+                                                       peer_port, parent->rustSocket);
                         }
                     }
                 }
 
                 if (disassociate) {
                     /* TODO: we should only be disassociating non-child sockets */
-                    host_disassociateInterface(host, PTCP, sock_ip, sock_port, peer_ip, peer_port);
+                    host_disassociateInterface(
+                        host, PTCP, sock_ip, sock_port, peer_ip, peer_port, tcp->rustSocket);
                 }
             }
             break;
@@ -837,10 +959,10 @@ static void _tcp_bufferPacketIn(TCP* tcp, Packet* packet) {
     PacketTCPHeader hdr = packet_getTCPHeader(packet);
     bool already_received = hdr.sequence < tcp->receive.next;
 
-    if (!already_received && !priorityqueue_find(tcp->unorderedInput, packet)) {
+    if (!already_received && !tcppacketring_get(&tcp->unorderedInput, hdr.sequence)) {
         /* TCP wants in-order data */
-        priorityqueue_push(tcp->unorderedInput, packet);
         packet_ref(packet);
+        tcppacketring_insert(&tcp->unorderedInput, hdr.sequence, packet);
 
         /* account for the packet length */
         tcp->unorderedInputLength += packet_getPayloadSize(packet);
@@ -967,7 +1089,7 @@ static void _tcp_sendControlPacket(TCP* tcp, const Host* host, ProtocolTCPFlags
 
     /* push it in the buffer and to the socket */
     _tcp_bufferPacketOut(tcp, control);
-    _tcp_flush(tcp, host);
+    _tcp_flushSoon(tcp, host);
 
     /* the output buffer holds the packet ref now */
     packet_unref(control);
@@ -977,13 +1099,12 @@ static void _tcp_addRetransmit(TCP* tcp, Packet* packet) {
     MAGIC_ASSERT(tcp);
 
     PacketTCPHeader header = packet_getTCPHeader(packet);
-    gpointer key = GINT_TO_POINTER(header.sequence);
 
     /* if it is already in the queue, it won't consume another packet reference */
-    if(g_hash_table_lookup(tcp->retransmit.queue, key) == NULL) {
+    if (tcppacketring_get(&tcp->retransmit.queue, header.sequence) == NULL) {
         /* its not in the queue yet */
-        g_hash_table_insert(tcp->retransmit.queue, key, packet);
         packet_ref(packet);
+        tcppacketring_insert(&tcp->retransmit.queue, header.sequence, packet);
 
         packet_addDeliveryStatus(packet, PDS_SND_TCP_ENQUEUE_RETRANSMIT);
 
@@ -1000,44 +1121,24 @@ static gint _tcp_compare_sequence(gconstpointer ptr_1, gconstpointer ptr_2) {
     return (seq_1 < seq_2) ? -1 : (seq_1 > seq_2) ? 1 : 0;
 }
 
-static gint _tcp_compare_sequence_data(gconstpointer ptr_1, gconstpointer ptr_2,
-                                       gpointer user_data) {
-    return _tcp_compare_sequence(ptr_1, ptr_2);
-}
-
 /* remove all packets with a sequence number less than the sequence parameter */
 static void _tcp_clearRetransmit(TCP* tcp, guint sequence) {
     MAGIC_ASSERT(tcp);
 
-    // Clear the retrans packets in a deterministic order
-    GQueue* keys_sorted = g_queue_new();
-    GHashTableIter iter;
-    gpointer key;
-
-    // First get the keys that need to be removed
-    g_hash_table_iter_init(&iter, tcp->retransmit.queue);
-
-    while (g_hash_table_iter_next(&iter, &key, NULL)) {
-        guint ackedSequence = GPOINTER_TO_INT(key);
-        if(ackedSequence < sequence) {
-            g_queue_insert_sorted(keys_sorted, key, _tcp_compare_sequence_data, NULL);
+    // Clear the retrans packets in sequence order
+    while (!tcppacketring_isEmpty(&tcp->retransmit.queue)) {
+        Packet* ackedPacket = tcppacketring_peekFirst(&tcp->retransmit.queue);
+        guint ackedSequence = packet_getTCPHeader(ackedPacket).sequence;
+        if (ackedSequence >= sequence) {
+            break;
         }
-    }
 
-    // Now remove the packets in order
-    while (g_queue_get_length(keys_sorted) > 0) {
-        key = g_queue_pop_head(keys_sorted);
-        Packet* ackedPacket = g_hash_table_lookup(tcp->retransmit.queue, key);
-        if (ackedPacket) {
-            tcp->retransmit.queueLength -= packet_getPayloadSize(ackedPacket);
-            packet_addDeliveryStatus(ackedPacket, PDS_SND_TCP_DEQUEUE_RETRANSMIT);
-            g_hash_table_remove(tcp->retransmit.queue, key);
-        }
+        tcppacketring_take(&tcp->retransmit.queue, ackedSequence);
+        tcp->retransmit.queueLength -= packet_getPayloadSize(ackedPacket);
+        packet_addDeliveryStatus(ackedPacket, PDS_SND_TCP_DEQUEUE_RETRANSMIT);
+        packet_unref(ackedPacket);
     }
 
-    // Cleanup
-    g_queue_free(keys_sorted);
-
     if (_tcp_getBufferSpaceOut(tcp) > 0 &&
         (legacyfile_getStatus((LegacyFile*)tcp) & FileState_ACTIVE)) {
         legacyfile_adjustStatus((LegacyFile*)tcp, FileState_WRITABLE, TRUE, 0);
@@ -1050,15 +1151,12 @@ static void _tcp_clearRetransmitRange(TCP* tcp, guint begin, guint end) {
 
 
     for (uint32_t seq = begin; seq < end; ++seq) {
-        Packet *packet = g_hash_table_lookup(tcp->retransmit.queue,
-                                             GINT_TO_POINTER(seq));
+        Packet* packet = tcppacketring_take(&tcp->retransmit.queue, seq);
 
         if (packet != NULL) {
             tcp->retransmit.queueLength -= packet_getPayloadSize(packet);
             packet_addDeliveryStatus(packet, PDS_SND_TCP_DEQUEUE_RETRANSMIT);
-            bool success = g_hash_table_remove(tcp->retransmit.queue,
-                                               GINT_TO_POINTER(seq));
-            utility_debugAssert(success);
+            packet_unref(packet);
         }
     }
 
@@ -1181,7 +1279,8 @@ static void _tcp_updateRTTEstimate(TCP* tcp, const Host* host, CSimulationTime t
 static void _tcp_retransmitPacket(TCP* tcp, const Host* host, gint sequence) {
     MAGIC_ASSERT(tcp);
 
-    Packet* packet = g_hash_table_lookup(tcp->retransmit.queue, GINT_TO_POINTER(sequence));
+    /* remove from queue; the packet ref count is not decremented */
+    Packet* packet = tcppacketring_take(&tcp->retransmit.queue, sequence);
     /* if packet wasn't found is was most likely retransmitted from a previous SACK
      * but has yet to be received/acknowledged by the receiver */
     if(!packet) {
@@ -1191,10 +1290,6 @@ static void _tcp_retransmitPacket(TCP* tcp, const Host* host, gint sequence) {
 
     trace("retransmitting packet %d", sequence);
 
-    /* remove from queue and update length and status.
-     * calling steal means that the packet ref count is not decremented */
-    g_hash_table_steal(tcp->retransmit.queue, GINT_TO_POINTER(sequence));
-
     /* update queue length and status */
     tcp->retransmit.queueLength -= packet_getPayloadSize(packet);
     packet_addDeliveryStatus(packet, PDS_SND_TCP_DEQUEUE_RETRANSMIT);
@@ -1232,7 +1327,7 @@ static void _tcp_sendShutdownFin(TCP* tcp, const Host* host) {
         /* send a fin */
         Packet* fin = _tcp_createControlPacket(tcp, host, PTCP_FIN);
         _tcp_bufferPacketOut(tcp, fin);
-        _tcp_flush(tcp, host);
+        _tcp_flushSoon(tcp, host);
 
         /* the output buffer holds the packet ref now */
         packet_unref(fin);
@@ -1418,8 +1513,8 @@ static void _tcp_flush(TCP* tcp, const Host* host) {
     }
 
     /* any packets now in order can be pushed to our user input buffer */
-    while(!priorityqueue_isEmpty(tcp->unorderedInput)) {
-        Packet* packet = priorityqueue_peek(tcp->unorderedInput);
+    while (!tcppacketring_isEmpty(&tcp->unorderedInput)) {
+        Packet* packet = tcppacketring_peekFirst(&tcp->unorderedInput);
 
         PacketTCPHeader header = packet_getTCPHeader(packet);
 
@@ -1428,7 +1523,7 @@ static void _tcp_flush(TCP* tcp, const Host* host) {
             // This is a (probably retransmitted) copy of a packet we already stored
             // and delivered to the plugin.
             trace("Removing packet %u with duplicate data", header.sequence);
-            priorityqueue_pop(tcp->unorderedInput);
+            tcppacketring_take(&tcp->unorderedInput, header.sequence);
             tcp->unorderedInputLength -= packet_getPayloadSize(packet);
             packet_unref(packet);
         } else if (header.sequence == tcp->receive.next) {
@@ -1447,7 +1542,7 @@ static void _tcp_flush(TCP* tcp, const Host* host) {
             if(fitInBuffer) {
                 // fprintf(stderr, "SND/RCV Recv %s %s %d @ %f\n", tcp->super.boundString, tcp->super.peerString, header.sequence, dtime);
                 tcp->receive.lastSequence = header.sequence;
-                priorityqueue_pop(tcp->unorderedInput);
+                tcppacketring_take(&tcp->unorderedInput, header.sequence);
                 tcp->unorderedInputLength -= packet_getPayloadSize(packet);
                 packet_unref(packet);
                 (tcp->receive.next)++;
@@ -1494,6 +1589,46 @@ static void _tcp_flush(TCP* tcp, const Host* host) {
     }
 }
 
+static void _tcp_runScheduledFlush(void* voidInetSocket) {
+    const InetSocket* inetSocket = voidInetSocket;
+    utility_alwaysAssert(inetSocket != NULL);
+    TCP* tcp = inetsocket_asLegacyTcp(inetSocket);
+    MAGIC_ASSERT(tcp);
+
+    /* flushing may schedule another flush, which will run after this one */
+    tcp->flags &= ~TCPF_FLUSH_SCHEDULED;
+    _tcp_flush(tcp, worker_getCurrentHost());
+
+    inetsocket_drop(inetSocket);
+}
+
+/* Flush at the end of the current syscall or received packet, so that several changes that each
+ * need a flush only walk our send and receive state once. If no callback queue is running, this
+ * flushes now. */
+static void _tcp_flushSoon(TCP* tcp, const Host* host) {
+    MAGIC_ASSERT(tcp);
+
+    if (!host_useDeferredTcpFlush(host) || tcp->rustSocket == NULL) {
+        _tcp_flush(tcp, host);
+        return;
+    }
+
+    if (tcp->flags & TCPF_FLUSH_SCHEDULED) {
+        /* the scheduled flush will see this change too */
+        return;
+    }
+
+    /* the callback holds a reference so that the socket can't be freed before it runs */
+    const InetSocket* inetSocket = inetsocketweak_upgrade(tcp->rustSocket);
+    if (inetSocket == NULL) {
+        _tcp_flush(tcp, host);
+        return;
+    }
+
+    tcp->flags |= TCPF_FLUSH_SCHEDULED;
+    add_callback_with_global_cb_queue(_tcp_runScheduledFlush, (void*)inetSocket);
+}
+
 static void _tcp_runRetransmitTimerExpiredTask(const Host* host, gpointer voidInetSocket,
                                                gpointer unused) {
     const InetSocket* inetSocket = voidInetSocket;
@@ -1517,7 +1652,7 @@ static void _tcp_runRetransmitTimerExpiredTask(const Host* host, gpointer voidIn
         return;
     }
 
-    if(g_hash_table_size(tcp->retransmit.queue) == 0) {
+    if (tcppacketring_isEmpty(&tcp->retransmit.queue)) {
         _tcp_stopRetransmitTimer(tcp);
         return;
     }
@@ -1744,6 +1879,9 @@ void tcp_updateServerBacklog(TCP* tcp, gint backlog) {
     MAGIC_ASSERT(tcp);
     utility_debugAssert(tcp_isValidListener(tcp));
     _tcpserver_updateBacklog(tcp->server, backlog);
+    if (tcp->server->children) {
+        tcpchildtable_reserve(tcp->server->children, tcp->server->pendingMax);
+    }
 }
 
 /* Address and port must be in network byte order. */
@@ -1763,7 +1901,7 @@ gint tcp_acceptServerPeer(TCP* tcp, const Host* host, in_addr_t* ip, in_port_t*
     }
 
     /* if there are no pending connection ready to accept, dont block waiting */
-    if(g_queue_get_length(tcp->server->pending) <= 0) {
+    if(tcp->server->pendingLength <= 0) {
         /* listen sockets should have no data, and should not be readable if no pending conns */
         utility_debugAssert(legacysocket_getInputBufferLength(&tcp->super) == 0);
         legacyfile_adjustStatus(&(tcp->super.super), FileState_READABLE, FALSE, 0);
@@ -1771,7 +1909,7 @@ gint tcp_acceptServerPeer(TCP* tcp, const Host* host, in_addr_t* ip, in_port_t*
     }
 
     /* double check the pending child before its accepted */
-    TCP* tcpChild = g_queue_pop_head(tcp->server->pending);
+    TCP* tcpChild = _tcpserver_popPending(tcp->server);
     if(!tcpChild) {
         return -ECONNABORTED;
     }
@@ -1795,7 +1933,7 @@ gint tcp_acceptServerPeer(TCP* tcp, const Host* host, in_addr_t* ip, in_port_t*
         &(tcpChild->super.super), FileState_ACTIVE | FileState_WRITABLE, TRUE, 0);
 
     /* update server descriptor status */
-    if(g_queue_get_length(tcp->server->pending) > 0) {
+    if(tcp->server->pendingLength > 0) {
         legacyfile_adjustStatus(&(tcp->super.super), FileState_READABLE, TRUE, 0);
     } else {
         legacyfile_adjustStatus(&(tcp->super.super), FileState_READABLE, FALSE, 0);
@@ -1828,8 +1966,7 @@ static TCP* _tcp_getSourceTCP(TCP* tcp, in_addr_t ip, in_port_t port) {
         MAGIC_ASSERT(tcp->server);
 
         /* children are multiplexed based on remote ip and port */
-        guint childKey = _ipPortHash(ip, port);
-        TCP* tcpChild = g_hash_table_lookup(tcp->server->children, &childKey);
+        TCP* tcpChild = tcpchildtable_lookup(tcp->server->children, ip, port);
 
         if(tcpChild) {
             return tcpChild;
@@ -2159,13 +2296,15 @@ static void _tcp_processPacket(LegacySocket* socket, const Host* host, Packet* p
 
                 multiplexed->child =
                     _tcpchild_new(multiplexed, tcp, handle, header->sourceIP, header->sourcePort);
-                utility_debugAssert(
-                    g_hash_table_lookup(tcp->server->children, &(multiplexed->child->key)) == NULL);
+                utility_debugAssert(tcpchildtable_lookup(tcp->server->children,
+                                                         header->sourceIP,
+                                                         header->sourcePort) == NULL);
 
                 /* multiplexed TCP was initialized with a ref of 1, which the host table consumes.
                  * so we need another ref for the children table */
                 legacyfile_refWeak(multiplexed);
-                g_hash_table_replace(tcp->server->children, &(multiplexed->child->key), multiplexed);
+                tcpchildtable_replace(
+                    tcp->server->children, header->sourceIP, header->sourcePort, multiplexed);
 
                 tcp->server->pendingCount += 1;
 
@@ -2219,7 +2358,7 @@ static void _tcp_processPacket(LegacySocket* socket, const Host* host, Packet* p
                 /* if this is a child, mark it accordingly */
                 if(tcp->child) {
                     tcp->child->state = TCPCS_PENDING;
-                    g_queue_push_tail(tcp->child->parent->server->pending, tcp);
+                    _tcpserver_pushPending(tcp->child->parent->server, tcp);
                     /* user should accept new child from parent */
                     legacyfile_adjustStatus(
                         &(tcp->child->parent->super.super), FileState_READABLE, TRUE, 0);
@@ -2428,7 +2567,7 @@ static void _tcp_processPacket(LegacySocket* socket, const Host* host, Packet* p
     }
 
     /* now flush as many packets as we can to socket */
-    _tcp_flush(tcp, host);
+    _tcp_flushSoon(tcp, host);
 
     /* clear it so we dont send outdated timestamp echos */
     tcp->receive.lastTimestamp = 0;
@@ -2446,7 +2585,7 @@ static void _tcp_dropPacket(LegacySocket* socket, const Host* host, Packet* pack
     /* now we have the true TCP for the packet */
     MAGIC_ASSERT(tcp);
 
-    _tcp_flush(tcp, host);
+    _tcp_flushSoon(tcp, host);
 }
 
 static void _tcp_endOfFileSignalled(TCP* tcp, enum TCPFlags flags) {
@@ -2527,7 +2666,7 @@ gssize tcp_sendUserData(TCP* tcp, const Host* host, UntypedForeignPtr buffer, gs
     trace("%s <-> %s: sending %"G_GSIZE_FORMAT" user bytes", tcp->super.boundString, tcp->super.peerString, bytesCopied);
 
     /* now flush as much as possible out to socket */
-    _tcp_flush(tcp, host);
+    _tcp_flushSoon(tcp, host);
 
     return (gssize)(bytesCopied == 0 && nBytes != 0 ? -EWOULDBLOCK : bytesCopied);
 }
@@ -2730,7 +2869,7 @@ static void _tcp_cleanup(LegacyFile* descriptor) {
 
     // if we have a parent, we should break any references between it and us
     if (tcp->child) {
-        _tcpchild_free(tcp->child);
+        _tcpchild_free(tcp, tcp->child);
         tcp->child = NULL;
     }
 }
@@ -2740,10 +2879,19 @@ static void _tcp_free(LegacyFile* descriptor) {
     MAGIC_ASSERT(tcp);
 
     priorityqueue_free(tcp->throttledOutput);
-    priorityqueue_free(tcp->unorderedInput);
-    g_hash_table_destroy(tcp->retransmit.queue);
+    tcppacketring_destroy(&tcp->unorderedInput);
+    tcppacketring_destroy(&tcp->retransmit.queue);
     priorityqueue_free(tcp->retransmit.scheduledTimerExpirations);
 
+    /* a socket can be freed without reaching TCPS_CLOSED (for example an unaccepted child of a
+     * closed server), so return its autotuned buffer memory to the host's budget here */
+    if (tcp->autotune.allocatedMemory > 0) {
+        const Host* host = worker_getCurrentHost();
+        if (host != NULL) {
+            _tcp_freeAutotunedMemory(tcp, host);
+        }
+    }
+
     if (tcp->partialUserDataPacket != NULL) {
         packet_unref(tcp->partialUserDataPacket);
         tcp->partialUserDataPacket = NULL;
@@ -2751,7 +2899,7 @@ static void _tcp_free(LegacyFile* descriptor) {
     }
 
     if (tcp->child) {
-        _tcpchild_free(tcp->child);
+        _tcpchild_free(tcp, tcp->child);
         tcp->child = NULL;
     }
 
@@ -2924,10 +3072,8 @@ TCP* tcp_new(const Host* host, guint receiveBufferSize, guint sendBufferSize) {
 
     tcp->throttledOutput = priorityqueue_new((GCompareDataFunc)packet_compareTCPSequence, NULL,
                                              (GDestroyNotify)packet_unref, NULL, NULL);
-    tcp->unorderedInput = priorityqueue_new((GCompareDataFunc)packet_compareTCPSequence, NULL,
-                                            (GDestroyNotify)packet_unref, NULL, NULL);
-    tcp->retransmit.queue =
-            g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)packet_unref);
+    tcppacketring_init(&tcp->unorderedInput);
+    tcppacketring_init(&tcp->retransmit.queue);
 
     retransmit_tally_init(&tcp->retransmit.tally);
 
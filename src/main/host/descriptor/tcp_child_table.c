@@ -0,0 +1,187 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+#include "main/host/descriptor/tcp_child_table.h"
+
+#include <glib.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "main/utility/utility.h"
+
+static const guint MIN_CAPACITY = 16;
+
+typedef struct _TCPChildEntry TCPChildEntry;
+struct _TCPChildEntry {
+    in_addr_t peerIP;
+    in_port_t peerPort;
+    /* NULL if the slot is empty */
+    TCP* child;
+};
+
+struct _TCPChildTable {
+    /* capacity is a power of 2, and is 2^bits */
+    TCPChildEntry* slots;
+    guint capacity;
+    guint bits;
+    guint length;
+    /* the table doesn't shrink below this capacity */
+    guint minCapacity;
+    GDestroyNotify valueDestroy;
+};
+
+/* the smallest capacity that keeps 'length' children at most half full */
+static guint _tcpchildtable_capacityFor(guint length) {
+    guint capacity = MIN_CAPACITY;
+    while (capacity / 2 < length) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+static inline gsize _tcpchildtable_home(const TCPChildTable* table, in_addr_t peerIP,
+                                        in_port_t peerPort) {
+    /* fibonacci hashing: the high bits of the product depend on all bits of the key */
+    guint64 key = ((guint64)peerIP << 16) | peerPort;
+    return (gsize)((key * 0x9E3779B97F4A7C15ull) >> (64 - table->bits));
+}
+
+static inline gsize _tcpchildtable_next(const TCPChildTable* table, gsize index) {
+    return (index + 1) & (table->capacity - 1);
+}
+
+/* returns the index of the slot holding the key, or of the empty slot where it would go */
+static gsize _tcpchildtable_find(const TCPChildTable* table, in_addr_t peerIP,
+                                 in_port_t peerPort) {
+    gsize index = _tcpchildtable_home(table, peerIP, peerPort);
+    while (table->slots[index].child != NULL) {
+        const TCPChildEntry* entry = &table->slots[index];
+        if (entry->peerIP == peerIP && entry->peerPort == peerPort) {
+            break;
+        }
+        index = _tcpchildtable_next(table, index);
+    }
+    return index;
+}
+
+static void _tcpchildtable_resize(TCPChildTable* table, guint capacity) {
+    TCPChildEntry* oldSlots = table->slots;
+    guint oldCapacity = table->capacity;
+
+    table->slots = g_new0(TCPChildEntry, capacity);
+    table->capacity = capacity;
+    table->bits = g_bit_nth_lsf(capacity, -1);
+
+    for (guint i = 0; i < oldCapacity; i++) {
+        if (oldSlots[i].child != NULL) {
+            gsize index = _tcpchildtable_find(table, oldSlots[i].peerIP, oldSlots[i].peerPort);
+            table->slots[index] = oldSlots[i];
+        }
+    }
+
+    g_free(oldSlots);
+}
+
+TCPChildTable* tcpchildtable_new(guint minCapacity, GDestroyNotify valueDestroy) {
+    TCPChildTable* table = g_new0(TCPChildTable, 1);
+    table->minCapacity = _tcpchildtable_capacityFor(minCapacity);
+    table->valueDestroy = valueDestroy;
+    _tcpchildtable_resize(table, table->minCapacity);
+    return table;
+}
+
+void tcpchildtable_free(TCPChildTable* table) {
+    for (guint i = 0; i < table->capacity; i++) {
+        if (table->slots[i].child != NULL && table->valueDestroy != NULL) {
+            table->valueDestroy(table->slots[i].child);
+        }
+    }
+
+    g_free(table->slots);
+    g_free(table);
+}
+
+void tcpchildtable_reserve(TCPChildTable* table, guint minCapacity) {
+    table->minCapacity = _tcpchildtable_capacityFor(minCapacity);
+    if (table->capacity < table->minCapacity) {
+        _tcpchildtable_resize(table, table->minCapacity);
+    }
+}
+
+guint tcpchildtable_getLength(const TCPChildTable* table) { return table->length; }
+
+TCP* tcpchildtable_lookup(const TCPChildTable* table, in_addr_t peerIP, in_port_t peerPort) {
+    return table->slots[_tcpchildtable_find(table, peerIP, peerPort)].child;
+}
+
+void tcpchildtable_replace(TCPChildTable* table, in_addr_t peerIP, in_port_t peerPort, TCP* child) {
+    utility_debugAssert(child != NULL);
+
+    gsize index = _tcpchildtable_find(table, peerIP, peerPort);
+    TCPChildEntry* entry = &table->slots[index];
+
+    if (entry->child != NULL) {
+        TCP* old = entry->child;
+        entry->child = child;
+        if (old != child && table->valueDestroy != NULL) {
+            table->valueDestroy(old);
+        }
+        return;
+    }
+
+    /* keep the table at most half full so that probe sequences stay short */
+    if (table->length + 1 > table->capacity / 2) {
+        _tcpchildtable_resize(table, table->capacity * 2);
+        index = _tcpchildtable_find(table, peerIP, peerPort);
+    }
+
+    table->slots[index] = (TCPChildEntry){
+        .peerIP = peerIP,
+        .peerPort = peerPort,
+        .child = child,
+    };
+    table->length++;
+}
+
+bool tcpchildtable_remove(TCPChildTable* table, in_addr_t peerIP, in_port_t peerPort) {
+    gsize hole = _tcpchildtable_find(table, peerIP, peerPort);
+    TCP* child = table->slots[hole].child;
+    if (child == NULL) {
+        return false;
+    }
+
+    /* shift back the following entries of the probe sequence that would otherwise become
+     * unreachable, i.e. those whose home slot isn't cyclically in (hole, index] */
+    gsize index = hole;
+    while (true) {
+        index = _tcpchildtable_next(table, index);
+        const TCPChildEntry* entry = &table->slots[index];
+        if (entry->child == NULL) {
+            break;
+        }
+
+        gsize home = _tcpchildtable_home(table, entry->peerIP, entry->peerPort);
+        bool reachable =
+            (hole < index) ? (hole < home && home <= index) : (hole < home || home <= index);
+        if (!reachable) {
+            table->slots[hole] = *entry;
+            hole = index;
+        }
+    }
+    table->slots[hole] = (TCPChildEntry){0};
+    table->length--;
+
+    /* give back the memory of a burst of connections once most of them have closed */
+    if (table->capacity > table->minCapacity && table->length < table->capacity / 8) {
+        _tcpchildtable_resize(table, table->capacity / 2);
+    }
+
+    /* the table is consistent again, so the destroy function may use it */
+    if (table->valueDestroy != NULL) {
+        table->valueDestroy(child);
+    }
+    return true;
+}
@@ -0,0 +1,44 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+#ifndef SHD_TCP_CHILD_TABLE_H_
+#define SHD_TCP_CHILD_TABLE_H_
+
+#include <glib.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+
+typedef struct _TCP TCP;
+
+/*
+ * The child sockets of a listening TCP server, indexed by the peer's IP and port. The table is an
+ * open-addressing array with linear probing, so a lookup is a multiplicative hash of the key and
+ * a scan of adjacent slots, without allocating or chasing pointers. Removals shift the following
+ * entries back rather than leaving tombstones, so a server whose connections keep being opened
+ * and closed doesn't degrade over time. The array is sized to hold at least the server's backlog,
+ * doubles when it becomes half full, and halves when it becomes mostly empty again.
+ */
+typedef struct _TCPChildTable TCPChildTable;
+
+/* Returns a new table sized for at least 'minCapacity' children. 'valueDestroy' (may be NULL) is
+ * called for each child when it's removed, replaced, or when the table is freed. */
+TCPChildTable* tcpchildtable_new(guint minCapacity, GDestroyNotify valueDestroy);
+/* Frees the table, calling 'valueDestroy' for each remaining child. The table must not be used by
+ * 'valueDestroy'. */
+void tcpchildtable_free(TCPChildTable* table);
+
+/* Make sure that the table doesn't shrink below 'minCapacity' children. */
+void tcpchildtable_reserve(TCPChildTable* table, guint minCapacity);
+
+guint tcpchildtable_getLength(const TCPChildTable* table);
+
+/* Address and port must be in network byte order. Returns the child, or NULL. */
+TCP* tcpchildtable_lookup(const TCPChildTable* table, in_addr_t peerIP, in_port_t peerPort);
+/* Stores the child, replacing (and destroying) any existing child with the same key. */
+void tcpchildtable_replace(TCPChildTable* table, in_addr_t peerIP, in_port_t peerPort, TCP* child);
+/* Removes and destroys the child with this key. Returns false if there wasn't one. */
+bool tcpchildtable_remove(TCPChildTable* table, in_addr_t peerIP, in_port_t peerPort);
+
+#endif // SHD_TCP_CHILD_TABLE_H_
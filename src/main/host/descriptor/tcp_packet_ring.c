@@ -0,0 +1,135 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+#include "main/host/descriptor/tcp_packet_ring.h"
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "main/bindings/c/bindings.h"
+#include "main/utility/utility.h"
+
+static const guint32 INITIAL_CAPACITY = 64;
+/* the largest power of 2 that fits in a guint32; doubling past it would wrap to 0 */
+static const guint32 MAX_CAPACITY = ((guint32)1) << 31;
+
+static inline gsize _tcppacketring_index(const TCPPacketRing* ring, guint32 sequence) {
+    return sequence & (ring->capacity - 1);
+}
+
+void tcppacketring_init(TCPPacketRing* ring) {
+    ring->slots = NULL;
+    ring->capacity = 0;
+    ring->first = 0;
+    ring->end = 0;
+    ring->length = 0;
+}
+
+void tcppacketring_destroy(TCPPacketRing* ring) {
+    for (guint32 i = 0; i < ring->capacity; i++) {
+        if (ring->slots[i] != NULL) {
+            packet_unref(ring->slots[i]);
+        }
+    }
+
+    g_free(ring->slots);
+    tcppacketring_init(ring);
+}
+
+gsize tcppacketring_getLength(const TCPPacketRing* ring) { return ring->length; }
+
+bool tcppacketring_isEmpty(const TCPPacketRing* ring) { return ring->length == 0; }
+
+Packet* tcppacketring_get(const TCPPacketRing* ring, guint32 sequence) {
+    if (ring->length == 0 || sequence < ring->first || sequence >= ring->end) {
+        return NULL;
+    }
+    return ring->slots[_tcppacketring_index(ring, sequence)];
+}
+
+Packet* tcppacketring_peekFirst(const TCPPacketRing* ring) {
+    return tcppacketring_get(ring, ring->first);
+}
+
+/* grow the array so that it can hold sequence numbers in [first, end) */
+static void _tcppacketring_reserve(TCPPacketRing* ring, guint32 first, guint32 end) {
+    guint32 span = end - first;
+    if (span <= ring->capacity) {
+        return;
+    }
+
+    if (span > MAX_CAPACITY) {
+        utility_panic("TCP packet ring can't span %" G_GUINT32_FORMAT
+                      " sequence numbers (maximum is %" G_GUINT32_FORMAT ")",
+                      span, MAX_CAPACITY);
+    }
+
+    guint32 newCapacity = MAX(ring->capacity, INITIAL_CAPACITY);
+    while (newCapacity < span) {
+        utility_debugAssert(newCapacity <= MAX_CAPACITY / 2);
+        newCapacity *= 2;
+    }
+
+    Packet** newSlots = g_new0(Packet*, newCapacity);
+
+    for (guint32 seq = ring->first; ring->length > 0 && seq < ring->end; seq++) {
+        newSlots[seq & (newCapacity - 1)] = ring->slots[_tcppacketring_index(ring, seq)];
+    }
+
+    g_free(ring->slots);
+    ring->slots = newSlots;
+    ring->capacity = newCapacity;
+}
+
+void tcppacketring_insert(TCPPacketRing* ring, guint32 sequence, Packet* packet) {
+    utility_debugAssert(packet != NULL);
+    utility_debugAssert(tcppacketring_get(ring, sequence) == NULL);
+
+    if (ring->length == 0) {
+        _tcppacketring_reserve(ring, sequence, sequence + 1);
+        ring->first = sequence;
+        ring->end = sequence + 1;
+    } else {
+        guint32 first = MIN(ring->first, sequence);
+        guint32 end = MAX(ring->end, sequence + 1);
+        _tcppacketring_reserve(ring, first, end);
+        ring->first = first;
+        ring->end = end;
+    }
+
+    ring->slots[_tcppacketring_index(ring, sequence)] = packet;
+    ring->length++;
+}
+
+Packet* tcppacketring_take(TCPPacketRing* ring, guint32 sequence) {
+    Packet* packet = tcppacketring_get(ring, sequence);
+    if (packet == NULL) {
+        return NULL;
+    }
+
+    ring->slots[_tcppacketring_index(ring, sequence)] = NULL;
+    ring->length--;
+
+    if (ring->length == 0) {
+        ring->first = 0;
+        ring->end = 0;
+        return packet;
+    }
+
+    /* keep the bounds tight so that the span only covers stored packets */
+    if (sequence == ring->first) {
+        while (ring->slots[_tcppacketring_index(ring, ring->first)] == NULL) {
+            ring->first++;
+        }
+    }
+    if (sequence == ring->end - 1) {
+        while (ring->slots[_tcppacketring_index(ring, ring->end - 1)] == NULL) {
+            ring->end--;
+        }
+    }
+
+    return packet;
+}
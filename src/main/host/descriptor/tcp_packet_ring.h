@@ -0,0 +1,54 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+#ifndef SHD_TCP_PACKET_RING_H_
+#define SHD_TCP_PACKET_RING_H_
+
+#include <glib.h>
+#include <stdbool.h>
+
+#include "main/bindings/c/bindings-opaque.h"
+
+/*
+ * A set of packets indexed by their TCP sequence number, holding at most one packet per
+ * sequence number. The packets are stored in a circular array indexed by the sequence number
+ * modulo its capacity, so lookups, insertions, and removals don't allocate or hash. The array
+ * grows (by doubling) when the stored sequence numbers span more than its capacity, which
+ * happens only while the window grows.
+ *
+ * The ring holds a reference to each stored packet.
+ */
+typedef struct _TCPPacketRing TCPPacketRing;
+struct _TCPPacketRing {
+    /* capacity is 0 or a power of 2 */
+    Packet** slots;
+    guint32 capacity;
+    /* all stored packets have a sequence number in [first, end); the packets at 'first' and
+     * 'end - 1' are always present when the ring is non-empty */
+    guint32 first;
+    guint32 end;
+    gsize length;
+};
+
+void tcppacketring_init(TCPPacketRing* ring);
+/* unrefs all stored packets and frees the array */
+void tcppacketring_destroy(TCPPacketRing* ring);
+
+gsize tcppacketring_getLength(const TCPPacketRing* ring);
+bool tcppacketring_isEmpty(const TCPPacketRing* ring);
+
+/* returns the packet with this sequence number, or NULL */
+Packet* tcppacketring_get(const TCPPacketRing* ring, guint32 sequence);
+/* returns the packet with the lowest sequence number, or NULL if empty */
+Packet* tcppacketring_peekFirst(const TCPPacketRing* ring);
+
+/* stores the packet and takes ownership of the caller's reference. there must not already be a
+ * packet with this sequence number. */
+void tcppacketring_insert(TCPPacketRing* ring, guint32 sequence, Packet* packet);
+/* removes and returns the packet with this sequence number, or NULL. the caller takes ownership
+ * of the ring's reference. */
+Packet* tcppacketring_take(TCPPacketRing* ring, guint32 sequence);
+
+#endif // SHD_TCP_PACKET_RING_H_
@@ -33,146 +33,83 @@ static const RetransmitTally *cast_and_assert(const void *p) {
    return rt;
 }
 
-static bool range_contains(const SeqRange &range, SeqNum value) {
-   return (value >= range.first && value < range.second);
-}
-
-static bool range_overlap(const SeqRange &lhs, const SeqRange &rhs) {
-   return lhs.first < rhs.second && rhs.first < lhs.second;
-}
-
-static bool range_adj(const SeqRange &lhs, const SeqRange &rhs) {
-   return (lhs.second == rhs.first || rhs.second == lhs.first);
-}
-
+// Returns true if `value` is in one of the sorted `ranges`. Uses a binary search.
 static bool ranges_contains(const Ranges &ranges, SeqNum value) {
-  for (const auto &range : ranges) {
-    if (range_contains(range, value)) {
-      return true;
-    }
-  }
-
-  return false;
-}
-
-static std::pair<Ranges::iterator, Ranges::iterator>
-ranges_mergable(Ranges &ranges, const SeqRange &value) {
-   assert(still_sorted_(ranges));
-   std::pair<Ranges::iterator, Ranges::iterator> mergable;
-
-   mergable.first = ranges.end();
-
-   auto itr = ranges.begin();
-   for (; itr != ranges.end() && value.second >= itr->first; ++itr) {
-      if (mergable.first == ranges.cend()
-          && (range_overlap(*itr, value) || range_adj(*itr, value)))
-      {
-         mergable.first = itr;
-      }
-   }
-
-   mergable.second = itr;
-
-   assert(still_sorted_(ranges));
-
-   return mergable;
-}
+   // the first range that starts after `value`
+   auto itr = std::upper_bound(ranges.cbegin(), ranges.cend(), value,
+                               [](SeqNum v, const SeqRange &range) {
+                                  return v < range.first;
+                               });
 
-static void range_merge(SeqRange *x, const SeqRange &y) {
-   x->first = std::min(x->first, y.first);
-   x->second = std::max(x->second, y.second);
+   return itr != ranges.cbegin() && value < (itr - 1)->second;
 }
 
+// Inserts `value` into the sorted `ranges`, merging it with any ranges that it overlaps or is
+// adjacent to. Finding the ranges to merge uses a binary search.
 static void ranges_insert(Ranges *ranges, const SeqRange &value) {
    assert(still_sorted_(*ranges));
-   auto original = *ranges;
-   auto mergable = ranges_mergable(*ranges, value);
 
-   if (mergable.first == ranges->end()) {
-      ranges->insert(mergable.second, value);
+   // the first range that overlaps, is adjacent to, or is after `value`
+   auto first = std::lower_bound(ranges->begin(), ranges->end(), value.first,
+                                 [](const SeqRange &range, SeqNum start) {
+                                    return range.second < start;
+                                 });
+   // the first range that is after `value` and not adjacent to it
+   auto last = std::upper_bound(first, ranges->end(), value.second,
+                                [](SeqNum end, const SeqRange &range) {
+                                   return end < range.first;
+                                });
+
+   if (first == last) {
+      ranges->insert(first, value);
    } else {
-      auto itr = mergable.first;
-      range_merge(&(*itr), value);
-      for (auto jtr = itr + 1; jtr != mergable.second; ++jtr) {
-         range_merge(&(*itr), *jtr);
-      }
-      ranges->erase(mergable.first + 1, mergable.second);
+      // merge [first, last) and `value` into a single range
+      first->first = std::min(first->first, value.first);
+      first->second = std::max((last - 1)->second, value.second);
+      ranges->erase(first + 1, last);
    }
 
    assert(still_sorted_(*ranges));
 }
 
-static Ranges range_subtract(const SeqRange &lhs, const SeqRange &rhs) {
-   // Can produce two ranges in the case that rhs \in lhs.
-   // Returning a std::vector makes checking for this case easy.
-   Ranges result;
-   result.reserve(2);
-
-   if (range_overlap(lhs, rhs)) {
-      if (lhs.first < rhs.first) {
-         result.emplace_back(lhs.first, rhs.first);
-      }
+// Sets `result` to the ranges of `lhs` with the ranges of `rhs` removed. Both `lhs` and `rhs`
+// must be sorted, and this is linear in their sizes. `result` is reused so that its allocation
+// can be reused.
+static void ranges_subtract(const Ranges &lhs, const Ranges &rhs, Ranges *result) {
+   assert(still_sorted_(lhs));
+   assert(still_sorted_(rhs));
+   assert(result != &lhs && result != &rhs);
 
-      if (rhs.second < lhs.second) {
-         result.emplace_back(rhs.second, lhs.second);
-      }
-   } else {
-      result.push_back(lhs);
-   }
-
-   assert(still_sorted_(result));
-
-   return result;
-}
+   result->clear();
 
-static Ranges ranges_subtract(const Ranges &lhs, const Ranges &rhs) {
-   Ranges result;
+   auto jtr = rhs.cbegin();
 
-   if (rhs.size() == 0) {
-      result = lhs; // Assignment here to encourage RVO
-   } else if (lhs.size() > 0) {
-
-      std::size_t idx = 0;
-      auto jtr = rhs.cbegin();
-      SeqRange lhs_to_consider = lhs[0];
+   for (SeqRange range : lhs) {
+      // skip the rhs ranges that end before this range
+      while (jtr != rhs.cend() && jtr->second <= range.first) {
+         ++jtr;
+      }
 
-      while (idx < lhs.size() && jtr != rhs.cend()) {
-         if (jtr->second <= lhs_to_consider.first) {
-            ++jtr;
+      // remove each rhs range that overlaps this range
+      for (auto ktr = jtr; ktr != rhs.cend() && ktr->first < range.second; ++ktr) {
+         if (range.first < ktr->first) {
+            result->emplace_back(range.first, ktr->first);
          }
-         else if (lhs_to_consider.second <= jtr->first) {
-            result.push_back(lhs_to_consider);
-            ++idx;
-            if (idx < lhs.size()) { lhs_to_consider = lhs[idx]; }
-         } else {
-            Ranges sub = range_subtract(lhs_to_consider, *jtr);
-            if (sub.size() == 2) { result.push_back(sub.front()); }
-            if (sub.size() >= 1) { lhs_to_consider = sub.back(); }
-            else {
-               ++idx;
-               if (idx < lhs.size()) { lhs_to_consider = lhs[idx]; }
-            }
-         }
-      }
 
-      if (jtr == rhs.cend()) {
-         result.push_back(lhs_to_consider);
-         ++idx;
+         range.first = std::max(range.first, ktr->second);
 
-         while (idx < lhs.size()) {
-            result.push_back(lhs[idx++]);
+         if (range.second <= ktr->second) {
+            // the rest of this range was removed
+            break;
          }
       }
 
+      if (range.first < range.second) {
+         result->push_back(range);
+      }
    }
 
-   for (const auto &range : result) {
-      assert(range.first < range.second);
-   }
-
-   assert(still_sorted_(result));
-
-   return result;
+   assert(still_sorted_(*result));
 }
 
 extern "C" {
@@ -276,7 +213,7 @@ RetransmitTally::RetransmitTally()
    : last_ack_(-1),
      num_dupl_ack_(0),
      magic_num_(kMagicNum),
-     marked_lost_{}, sacked_{}, retransmitted_{}, lost_{}
+     marked_lost_{}, sacked_{}, retransmitted_{}, lost_{}, scratch_{}
 {
 }
 
@@ -288,17 +225,17 @@ RetransmitTally &RetransmitTally::operator=(RetransmitTally &&rhs) {
    sacked_ = std::move(rhs.sacked_);
    retransmitted_ = std::move(rhs.retransmitted_);
    lost_ = std::move(rhs.lost_);
+   scratch_ = std::move(rhs.scratch_);
    return *this;
 }
 
 void RetransmitTally::compute_lost() {
-   lost_ = ranges_subtract(marked_lost_, sacked_);
-   lost_ = ranges_subtract(lost_, retransmitted_);
+   ranges_subtract(marked_lost_, sacked_, &scratch_);
+   ranges_subtract(scratch_, retransmitted_, &lost_);
 }
 
 void RetransmitTally::tidy_ranges(Ranges *ranges) {
    assert(still_sorted_(*ranges));
-   auto original = *ranges;
 
    auto pred = [=] (const SeqRange range) -> bool {
       return last_ack_ >= range.second;
@@ -310,8 +247,9 @@ void RetransmitTally::tidy_ranges(Ranges *ranges) {
       ranges->front().first = last_ack_;
    }
    else if (ranges->size() > 0 && last_ack_ >= ranges->front().second - 1) {
-      auto new_end = std::remove_if(ranges->begin(), ranges->end(), pred);
-      ranges->erase(new_end, ranges->end());
+      // the ranges are sorted, so the ranges to remove are a prefix
+      auto new_begin = std::find_if_not(ranges->begin(), ranges->end(), pred);
+      ranges->erase(ranges->begin(), new_begin);
    }
 
    assert(still_sorted_(*ranges));
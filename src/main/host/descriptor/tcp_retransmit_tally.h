@@ -52,6 +52,8 @@ void retransmit_tally_populate_lost_ranges(const void *p, uint32_t *lost);
 using SeqNum = std::int64_t;
 // Using standard left-closed, right-open (i.e. half-open) semantics
 using SeqRange = std::pair<SeqNum, SeqNum>;
+// A sorted set of disjoint, non-adjacent ranges. A contiguous vector keeps lookups (which are
+// binary searches) cache-friendly.
 using Ranges = std::vector<SeqRange>;
 
 struct RetransmitTally {
@@ -71,6 +73,8 @@ struct RetransmitTally {
    std::size_t num_dupl_ack_;
    std::uint64_t magic_num_;
    Ranges marked_lost_, sacked_, retransmitted_, lost_;
+   // Reused by `compute_lost()` to avoid allocating.
+   Ranges scratch_;
 };
 #endif // __cplusplus
 
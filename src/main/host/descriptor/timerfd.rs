@@ -40,10 +40,12 @@ impl TimerFd {
     pub fn new(status: FileStatus) -> Arc<AtomicRefCell<Self>> {
         // We need a circular reference here, so that the inner Timer can refer back to the outer
         // TimerFd when executing a callback that will mutate the TimerFd when the timer expires.
+        // The TimerFd only changes when its expiration count becomes non-zero, so the timer can
+        // count the rest of its periodic expirations when the count is read.
         Arc::new_cyclic(|weak| {
             let weak_cloned = weak.clone();
             AtomicRefCell::new(Self {
-                timer: Timer::new(move |_host| Self::timer_expired(&weak_cloned)),
+                timer: Timer::new_lazy(move |_host| Self::timer_expired(&weak_cloned)),
                 event_source: StateEventSource::new(),
                 state: FileState::ACTIVE,
                 status,
@@ -0,0 +1,260 @@
+//! Doing the file I/O of managed processes on background threads.
+//!
+//! A read, write, or sync of an os-backed file blocks the worker thread that Shadow does it on
+//! until the kernel completes it, and the worker's other hosts can't run in the meantime. When the
+//! experimental `use_file_io_offload` option is enabled, these syscalls are instead submitted to a
+//! [`FileIoPool`]. The syscall blocks the calling thread, and its host stops running events until
+//! the I/O is done, so that the worker can run its other hosts. The result is returned to the
+//! thread at the same emulated time that it made the syscall.
+
+use std::sync::{Arc, Condvar, Mutex};
+
+use linux_api::errno::Errno;
+
+/// A pool of threads that do file I/O. The number of threads limits how many file operations are
+/// done at once.
+pub struct FileIoPool {
+    pool: rayon::ThreadPool,
+}
+
+impl FileIoPool {
+    pub fn new(num_threads: usize) -> Self {
+        let pool = rayon::ThreadPoolBuilder::new()
+            .num_threads(num_threads)
+            .thread_name(|i| format!("file-io-{i}"))
+            .build()
+            .expect("Couldn't create the file I/O pool's threads");
+        Self { pool }
+    }
+
+    /// Do `op` on one of the pool's threads. The fd that `op` uses must stay open until the
+    /// returned [`PendingFileIo`] has completed.
+    pub fn submit(&self, op: FileIoOp) -> PendingFileIo {
+        let slot = Arc::new(FileIoSlot {
+            state: Mutex::new(SlotState {
+                done: false,
+                result: None,
+            }),
+            done: Condvar::new(),
+        });
+
+        let io_slot = Arc::clone(&slot);
+        self.pool.spawn(move || {
+            let result = op.run();
+            *io_slot.state.lock().unwrap() = SlotState {
+                done: true,
+                result: Some(result),
+            };
+            io_slot.done.notify_all();
+        });
+
+        PendingFileIo { slot }
+    }
+}
+
+/// A file operation on a native fd.
+#[derive(Debug)]
+pub enum FileIoOp {
+    /// Read up to `len` bytes, at `offset` if given or at the file's offset otherwise.
+    Read {
+        fd: libc::c_int,
+        len: usize,
+        offset: Option<libc::off_t>,
+    },
+    /// Write `data`, at `offset` if given or at the file's offset otherwise.
+    Write {
+        fd: libc::c_int,
+        data: Vec<u8>,
+        offset: Option<libc::off_t>,
+    },
+    Fsync {
+        fd: libc::c_int,
+    },
+    Fdatasync {
+        fd: libc::c_int,
+    },
+}
+
+/// The result of a [`FileIoOp`].
+#[derive(Debug)]
+pub struct FileIoResult {
+    /// The syscall's return value.
+    pub rv: Result<usize, Errno>,
+    /// The bytes that were read, if the operation was a read.
+    pub data: Vec<u8>,
+}
+
+impl FileIoOp {
+    fn run(self) -> FileIoResult {
+        let mut data = Vec::new();
+        let rv = match self {
+            Self::Read { fd, len, offset } => {
+                data.resize(len, 0);
+                let buf = data.as_mut_ptr().cast();
+                let rv = match offset {
+                    Some(offset) => unsafe { libc::pread(fd, buf, len, offset) },
+                    None => unsafe { libc::read(fd, buf, len) },
+                };
+                let rv = len_result(rv);
+                data.truncate(*rv.as_ref().unwrap_or(&0));
+                rv
+            }
+            Self::Write {
+                fd,
+                data: buf,
+                offset,
+            } => {
+                let rv = match offset {
+                    Some(offset) => unsafe {
+                        libc::pwrite(fd, buf.as_ptr().cast(), buf.len(), offset)
+                    },
+                    None => unsafe { libc::write(fd, buf.as_ptr().cast(), buf.len()) },
+                };
+                len_result(rv)
+            }
+            Self::Fsync { fd } => {
+                Errno::result_from_libc_errno(-1, unsafe { libc::fsync(fd) }).map(|_| 0)
+            }
+            Self::Fdatasync { fd } => {
+                Errno::result_from_libc_errno(-1, unsafe { libc::fdatasync(fd) }).map(|_| 0)
+            }
+        };
+        FileIoResult { rv, data }
+    }
+}
+
+fn len_result(rv: isize) -> Result<usize, Errno> {
+    Errno::result_from_libc_errno(-1, rv).map(|x| usize::try_from(x).unwrap())
+}
+
+struct FileIoSlot {
+    state: Mutex<SlotState>,
+    done: Condvar,
+}
+
+impl FileIoSlot {
+    fn wait(&self) -> std::sync::MutexGuard<'_, SlotState> {
+        let state = self.state.lock().unwrap();
+        self.done.wait_while(state, |x| !x.done).unwrap()
+    }
+}
+
+struct SlotState {
+    done: bool,
+    /// `None` until the operation is done, or if the result was taken.
+    result: Option<FileIoResult>,
+}
+
+/// A file operation that was submitted to a [`FileIoPool`].
+pub struct PendingFileIo {
+    slot: Arc<FileIoSlot>,
+}
+
+impl PendingFileIo {
+    /// Has the operation completed?
+    pub fn is_done(&self) -> bool {
+        self.slot.state.lock().unwrap().done
+    }
+
+    /// Wait until the operation has completed, without taking its result.
+    pub fn wait_done(&self) {
+        drop(self.slot.wait());
+    }
+
+    /// Another handle to the same operation, for example for the host to check whether the
+    /// operation has completed. Only one of the handles can take the result.
+    pub fn handle(&self) -> Self {
+        Self {
+            slot: Arc::clone(&self.slot),
+        }
+    }
+
+    /// Wait until the operation has completed, and return its result. Panics if the result was
+    /// already taken through another handle.
+    pub fn wait(self) -> FileIoResult {
+        self.slot.wait().result.take().unwrap()
+    }
+}
+
+impl Drop for PendingFileIo {
+    fn drop(&mut self) {
+        // the fd that the operation uses may be closed after this, so the operation must not still
+        // be using it
+        drop(self.slot.wait());
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::io::{Read, Seek};
+    use std::os::fd::AsRawFd;
+
+    use super::*;
+
+    #[test]
+    fn test_ops() {
+        let pool = FileIoPool::new(2);
+        let mut file = tempfile::tempfile().unwrap();
+        let fd = file.as_raw_fd();
+
+        let rv = pool
+            .submit(FileIoOp::Write {
+                fd,
+                data: b"hello world".to_vec(),
+                offset: None,
+            })
+            .wait();
+        assert_eq!(rv.rv, Ok(11));
+
+        let rv = pool
+            .submit(FileIoOp::Write {
+                fd,
+                data: b"W".to_vec(),
+                offset: Some(6),
+            })
+            .wait();
+        assert_eq!(rv.rv, Ok(1));
+        assert_eq!(pool.submit(FileIoOp::Fsync { fd }).wait().rv, Ok(0));
+        assert_eq!(pool.submit(FileIoOp::Fdatasync { fd }).wait().rv, Ok(0));
+
+        // the file offset is after the first write
+        let io = pool.submit(FileIoOp::Read {
+            fd,
+            len: 100,
+            offset: None,
+        });
+        io.handle().wait_done();
+        assert!(io.is_done());
+        let rv = io.wait();
+        assert_eq!(rv.rv, Ok(0));
+        assert!(rv.data.is_empty());
+
+        let rv = pool
+            .submit(FileIoOp::Read {
+                fd,
+                len: 100,
+                offset: Some(0),
+            })
+            .wait();
+        assert_eq!(rv.rv, Ok(11));
+        assert_eq!(rv.data, b"hello World");
+
+        let mut contents = String::new();
+        file.rewind().unwrap();
+        file.read_to_string(&mut contents).unwrap();
+        assert_eq!(contents, "hello World");
+    }
+
+    #[test]
+    fn test_error() {
+        let pool = FileIoPool::new(1);
+        let rv = pool
+            .submit(FileIoOp::Read {
+                fd: -1,
+                len: 1,
+                offset: None,
+            })
+            .wait();
+        assert_eq!(rv.rv, Err(Errno::EBADF));
+    }
+}
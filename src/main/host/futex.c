@@ -10,18 +10,49 @@
 #include <stdbool.h>
 
 #include "lib/logger/logger.h"
-#include "main/bindings/c/bindings-opaque.h"
+#include "main/bindings/c/bindings.h"
 #include "main/core/definitions.h"
 #include "main/core/worker.h"
 #include "main/utility/utility.h"
 
+typedef struct _FutexWaiter FutexWaiter;
+
+// A listener (or a member of a futex group) waiting for a wakeup. A waiter is owned by the futex
+// that it started waiting on, but may be queued on a different futex after a requeue.
+struct _FutexWaiter {
+    // The listener to notify on a wakeup, or NULL if the waiter wakes a group instead.
+    StatusListener* listener;
+    // The group to wake on a wakeup, and the index of the waiter in that group.
+    Futex* group;
+    unsigned int groupIndex;
+    // The futex that owns this waiter.
+    Futex* origin;
+    // The futex that the waiter is queued on. Holds a reference if it isn't `origin`.
+    Futex* current;
+    // The waiter's link in the `current` futex's queue, or NULL if it's not queued.
+    GList* link;
+};
+
 struct _Futex {
     // The unique physical address that is used to refer to this futex
     ManagedPhysicalMemoryAddr word;
-    // Listeners waiting for wakups on this futex
-    // The key is a listener of type StatusListener*, the value is a boolean that indicates
-    // whether or not a wakeup has already been performed on the listener.
+    // Waiters that haven't been woken yet, in the order that they started waiting (or were
+    // requeued to this futex). A wakeup pops waiters from the front of the queue, so waking any
+    // number of waiters doesn't need to look at waiters that aren't woken.
+    GQueue waiting;
+    // The key is a listener of type StatusListener*, the value is the listener's FutexWaiter*. Woken
+    // listeners stay in this table until they're removed.
     GHashTable* listeners;
+    // The number of waiters owned by this futex, including group members.
+    unsigned int numOwned;
+    // The number of waiters in `waiting` that were requeued from other futexes.
+    unsigned int numRequeued;
+    // For a futex group created by `futex_newGroup()`, the futexes that the group waits on and
+    // the members queued on them while the group has a listener. Otherwise NULL.
+    GPtrArray* groupFutexes;
+    GPtrArray* groupMembers;
+    // The index of the group member that was woken, or -1.
+    int groupWokenIndex;
     // Manage references
     int referenceCount;
     MAGIC_DECLARE;
@@ -30,21 +61,147 @@ struct _Futex {
 Futex* futex_new(ManagedPhysicalMemoryAddr word) {
     Futex* futex = malloc(sizeof(*futex));
     *futex = (Futex){.word = word,
-                     .listeners = g_hash_table_new_full(
-                         g_direct_hash, g_direct_equal, (GDestroyNotify)statuslistener_unref, NULL),
+                     .listeners = g_hash_table_new(g_direct_hash, g_direct_equal),
+                     .groupWokenIndex = -1,
                      .referenceCount = 1,
                      MAGIC_INITIALIZER};
+    g_queue_init(&futex->waiting);
 
     worker_count_allocation(Futex);
 
     return futex;
 }
 
+Futex* futex_newGroup(Futex* const* futexes, unsigned int numFutexes) {
+    Futex* group = futex_new((ManagedPhysicalMemoryAddr){0});
+
+    group->groupFutexes = g_ptr_array_new_full(numFutexes, futex_unref_func);
+    for (unsigned int i = 0; i < numFutexes; i++) {
+        futex_ref(futexes[i]);
+        g_ptr_array_add(group->groupFutexes, futexes[i]);
+    }
+    group->groupMembers = g_ptr_array_new();
+
+    return group;
+}
+
+static void _futex_enqueue(FutexWaiter* waiter, Futex* futex) {
+    utility_debugAssert(waiter->link == NULL);
+
+    if (waiter->current != futex) {
+        if (waiter->current != waiter->origin) {
+            futex_unref(waiter->current);
+        }
+        if (futex != waiter->origin) {
+            futex_ref(futex);
+        }
+        waiter->current = futex;
+    }
+
+    g_queue_push_tail(&futex->waiting, waiter);
+    waiter->link = g_queue_peek_tail_link(&futex->waiting);
+
+    if (futex != waiter->origin) {
+        futex->numRequeued++;
+    }
+}
+
+static void _futex_dequeue(FutexWaiter* waiter) {
+    utility_debugAssert(waiter->link != NULL);
+
+    Futex* futex = waiter->current;
+    g_queue_delete_link(&futex->waiting, waiter->link);
+    waiter->link = NULL;
+
+    if (futex != waiter->origin) {
+        utility_debugAssert(futex->numRequeued > 0);
+        futex->numRequeued--;
+    }
+}
+
+static FutexWaiter* _futex_newWaiter(Futex* origin, StatusListener* listener, Futex* group,
+                                     unsigned int groupIndex) {
+    FutexWaiter* waiter = malloc(sizeof(*waiter));
+    *waiter = (FutexWaiter){.listener = listener,
+                            .group = group,
+                            .groupIndex = groupIndex,
+                            .origin = origin,
+                            .current = origin};
+    if (listener) {
+        statuslistener_ref(listener);
+    }
+    origin->numOwned++;
+    _futex_enqueue(waiter, origin);
+    return waiter;
+}
+
+// Remove a requeued futex that no longer has any waiters from the host's futex table. Futexes
+// that still own waiters are removed by the futex syscall handler instead.
+static void _futex_removeFromTableIfUnused(Futex* futex) {
+    if (futex_getListenerCount(futex) > 0) {
+        return;
+    }
+
+    const Host* host = worker_getCurrentHost();
+    if (host == NULL) {
+        return;
+    }
+
+    FutexTable* ftable = host_getFutexTable(host);
+    if (futextable_get(ftable, futex->word) == futex) {
+        futextable_remove(ftable, futex->word);
+    }
+}
+
+static void _futex_freeWaiter(FutexWaiter* waiter) {
+    if (waiter->link) {
+        _futex_dequeue(waiter);
+    }
+
+    Futex* origin = waiter->origin;
+    utility_debugAssert(origin->numOwned > 0);
+    origin->numOwned--;
+
+    if (waiter->current != origin) {
+        Futex* current = waiter->current;
+        _futex_removeFromTableIfUnused(current);
+        futex_unref(current);
+    }
+
+    if (waiter->listener) {
+        statuslistener_unref(waiter->listener);
+    }
+
+    free(waiter);
+}
+
+static void _futex_removeGroupMembers(Futex* group) {
+    for (unsigned int i = 0; i < group->groupMembers->len; i++) {
+        _futex_freeWaiter(g_ptr_array_index(group->groupMembers, i));
+    }
+    g_ptr_array_set_size(group->groupMembers, 0);
+}
+
 static void _futex_free(Futex* futex) {
     MAGIC_ASSERT(futex);
 
+    GHashTableIter iter;
+    gpointer waiter;
+    g_hash_table_iter_init(&iter, futex->listeners);
+    while (g_hash_table_iter_next(&iter, NULL, &waiter)) {
+        g_hash_table_iter_steal(&iter);
+        _futex_freeWaiter(waiter);
+    }
     g_hash_table_destroy(futex->listeners);
 
+    if (futex->groupMembers) {
+        _futex_removeGroupMembers(futex);
+        g_ptr_array_free(futex->groupMembers, true);
+        g_ptr_array_free(futex->groupFutexes, true);
+    }
+
+    utility_debugAssert(g_queue_is_empty(&futex->waiting));
+
     MAGIC_CLEAR(futex);
     free(futex);
     worker_count_deallocation(Futex);
@@ -70,70 +227,111 @@ ManagedPhysicalMemoryAddr futex_getAddress(Futex* futex) {
     return futex->word;
 }
 
-unsigned int futex_wake(Futex* futex, unsigned int numWakeups) {
-    MAGIC_ASSERT(futex);
+static void _futex_wakeGroup(Futex* group, unsigned int index) {
+    MAGIC_ASSERT(group);
+    utility_debugAssert(group->groupWokenIndex < 0);
 
-    // We cannot use an iterator here, in case the hash table is modified
-    // in the status changed callback.
-    GList* listenerList = g_hash_table_get_keys(futex->listeners);
+    group->groupWokenIndex = (int)index;
 
-    // Iterate the listeners in deterministic order and perform the requested
-    // number of wakeups if we can. It's probably better to maintain the items
-    // in a sorted structure, e.g. a ring, to make it easier / more efficient to
-    // iterate deterministically while also moving the ring entry pointer so we
-    // don't always wake up the same listener first on every iteration and
-    // possibly starve the others.
-    GList* item = NULL;
-    if(listenerList != NULL) {
-        listenerList = g_list_sort(listenerList, status_listener_compare);
-        item = g_list_first(listenerList);
+    // only one member of the group can be woken, so stop waiting on the other futexes
+    for (unsigned int i = 0; i < group->groupMembers->len; i++) {
+        FutexWaiter* member = g_ptr_array_index(group->groupMembers, i);
+        if (member->link) {
+            _futex_dequeue(member);
+        }
     }
 
+    futex_wake(group, 1);
+}
+
+unsigned int futex_wake(Futex* futex, unsigned int numWakeups) {
+    MAGIC_ASSERT(futex);
+
     unsigned int numWoken = 0;
 
-    while (item && (numWoken < numWakeups)) {
-        StatusListener* listener = item->data;
-
-        // Only call if the listener is still valid
-        if (g_hash_table_contains(futex->listeners, listener)) {
-            // If this listener was already woken up, skip it this time
-            bool did_wakeup =
-                (bool)GPOINTER_TO_UINT(g_hash_table_lookup(futex->listeners, listener));
-            if (!did_wakeup) {
-                // Tell the status listener to unblock the thread waiting on the futex
-                statuslistener_onStatusChanged(listener, FileState_FUTEX_WAKEUP, FileState_FUTEX_WAKEUP);
-
-                // Track that we did a wakeup on this listener without destroying the listener
-                g_hash_table_steal(futex->listeners, listener);
-                g_hash_table_insert(futex->listeners, listener, GUINT_TO_POINTER(true));
-
-                // Count the wake-up
-                numWoken++;
-            }
+    // The waiters are woken in the order that they started waiting. We dequeue each waiter before
+    // notifying it, in case the futex is modified in the status changed callback.
+    while (numWoken < numWakeups && !g_queue_is_empty(&futex->waiting)) {
+        FutexWaiter* waiter = g_queue_peek_head(&futex->waiting);
+        _futex_dequeue(waiter);
+
+        if (waiter->group) {
+            _futex_wakeGroup(waiter->group, waiter->groupIndex);
+        } else {
+            // Tell the status listener to unblock the thread waiting on the futex
+            statuslistener_onStatusChanged(
+                waiter->listener, FileState_FUTEX_WAKEUP, FileState_FUTEX_WAKEUP);
         }
 
-        item = g_list_next(item);
+        // Count the wake-up
+        numWoken++;
     }
 
-    if(listenerList != NULL) {
-        g_list_free(listenerList);
-    }
     return numWoken;
 }
 
+unsigned int futex_requeue(Futex* futex, Futex* target, unsigned int numRequeues) {
+    MAGIC_ASSERT(futex);
+    MAGIC_ASSERT(target);
+    utility_debugAssert(futex != target);
+
+    unsigned int numRequeued = 0;
+
+    while (numRequeued < numRequeues && !g_queue_is_empty(&futex->waiting)) {
+        FutexWaiter* waiter = g_queue_peek_head(&futex->waiting);
+        _futex_dequeue(waiter);
+        _futex_enqueue(waiter, target);
+        numRequeued++;
+    }
+
+    return numRequeued;
+}
+
 void futex_addListener(Futex* futex, StatusListener* listener) {
     MAGIC_ASSERT(futex);
     utility_debugAssert(listener);
-    statuslistener_ref(listener);
-    g_hash_table_insert(futex->listeners, listener, GUINT_TO_POINTER(false));
+    utility_debugAssert(!g_hash_table_contains(futex->listeners, listener));
+
+    FutexWaiter* waiter = _futex_newWaiter(futex, listener, NULL, 0);
+    g_hash_table_insert(futex->listeners, listener, waiter);
+
+    // a group starts waiting on its futexes once something is waiting on the group
+    if (futex->groupMembers && futex->groupMembers->len == 0 && futex->groupWokenIndex < 0) {
+        for (unsigned int i = 0; i < futex->groupFutexes->len; i++) {
+            FutexWaiter* member =
+                _futex_newWaiter(g_ptr_array_index(futex->groupFutexes, i), NULL, futex, i);
+            g_ptr_array_add(futex->groupMembers, member);
+        }
+    }
 }
 
 void futex_removeListener(Futex* futex, StatusListener* listener) {
     MAGIC_ASSERT(futex);
-    g_hash_table_remove(futex->listeners, listener); // Will unref the listener
+
+    FutexWaiter* waiter = g_hash_table_lookup(futex->listeners, listener);
+    if (waiter == NULL) {
+        return;
+    }
+
+    g_hash_table_remove(futex->listeners, listener);
+    _futex_freeWaiter(waiter);
+
+    if (futex->groupMembers) {
+        _futex_removeGroupMembers(futex);
+    }
 }
 
 unsigned int futex_getListenerCount(Futex* futex) {
     MAGIC_ASSERT(futex);
-    return g_hash_table_size(futex->listeners);
+    return futex->numOwned + futex->numRequeued;
+}
+
+unsigned int futex_getWaitingCount(Futex* futex) {
+    MAGIC_ASSERT(futex);
+    return g_queue_get_length(&futex->waiting);
+}
+
+int futex_getGroupWokenIndex(Futex* group) {
+    MAGIC_ASSERT(group);
+    return group->groupWokenIndex;
 }
@@ -19,6 +19,11 @@ typedef struct _Futex Futex;
 // Create a new futex object using the unique address as the futex word.
 Futex* futex_new(ManagedPhysicalMemoryAddr word);
 
+// Create a futex group that is woken when any one of the given futexes is woken, as with
+// `futex_waitv()`. The group isn't associated with an address, and only waits on the futexes while
+// it has a listener. Only one of the futexes can wake the group.
+Futex* futex_newGroup(Futex* const* futexes, unsigned int numFutexes);
+
 // Increment the reference count for the futex.
 void futex_ref(Futex* futex);
 
@@ -30,16 +35,29 @@ void futex_unref_func(void* futex);
 ManagedPhysicalMemoryAddr futex_getAddress(Futex* futex);
 
 // Wakeup at most the given number of listener threads waiting on this futex; return the number of
-// threads that were woken up.
+// threads that were woken up. Listeners are woken in the order that they started waiting.
 unsigned int futex_wake(Futex* futex, unsigned int numWakeups);
 
+// Move at most the given number of listener threads that haven't been woken yet from this futex to
+// the `target` futex, so that they'll be woken by wakeups on `target` instead; return the number of
+// threads that were moved. The listeners must still be removed from the futex that they were
+// added to.
+unsigned int futex_requeue(Futex* futex, Futex* target, unsigned int numRequeues);
+
 // Add a listener that will be notified when a wakup occurs
 void futex_addListener(Futex* futex, StatusListener* listener);
 
 // Remove a listener from those that are waiting for wakeups
 void futex_removeListener(Futex* futex, StatusListener* listener);
 
-// Return the number of listers currently awaiting a wakeup
+// Return the number of listeners that are using this futex: listeners that were added to it and
+// haven't been removed, and listeners that were requeued to it and haven't been woken.
 unsigned int futex_getListenerCount(Futex* futex);
 
+// Return the number of listeners queued on this futex that haven't been woken yet.
+unsigned int futex_getWaitingCount(Futex* futex);
+
+// Return the index of the futex that woke this futex group, or -1 if it hasn't been woken.
+int futex_getGroupWokenIndex(Futex* group);
+
 #endif /* SRC_MAIN_HOST_FUTEX_H_ */
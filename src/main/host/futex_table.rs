@@ -45,6 +45,12 @@ impl FutexTable {
     pub fn get(&self, addr: ManagedPhysicalMemoryAddr) -> Option<&FutexRef> {
         self.futexes.get(&addr)
     }
+
+    /// Are there no futexes in the table? Futexes are removed from the table once they have no
+    /// waiters, so this means that no thread is waiting on a futex.
+    pub fn is_empty(&self) -> bool {
+        self.futexes.is_empty()
+    }
 }
 
 /// An owned reference to a [`Futex`][c::Futex].
@@ -1,17 +1,22 @@
 //! An emulated Linux system.
 
 use std::cell::{Cell, Ref, RefCell, RefMut, UnsafeCell};
-use std::collections::BTreeMap;
+use std::collections::btree_map::Entry;
+use std::collections::{BTreeMap, VecDeque};
 use std::ffi::{CStr, CString, OsString};
 use std::net::{Ipv4Addr, SocketAddrV4};
 use std::ops::{Deref, DerefMut};
 use std::os::unix::prelude::OsStringExt;
 use std::path::{Path, PathBuf};
 use std::sync::{Arc, Mutex};
+use std::time::Instant;
 
 use atomic_refcell::AtomicRefCell;
+use linux_api::posix_types::Pid;
 use linux_api::signal::{Signal, siginfo_t};
-use log::{debug, trace};
+use linux_api::syscall::SyscallNum;
+use linux_api::utsname::new_utsname;
+use log::{debug, trace, warn};
 use logger::LogLevel;
 use once_cell::unsync::OnceCell;
 use rand::SeedableRng;
@@ -25,28 +30,40 @@ use shadow_shim_helper_rs::rootedcell::rc::RootedRc;
 use shadow_shim_helper_rs::rootedcell::refcell::RootedRefCell;
 use shadow_shim_helper_rs::shim_shmem::{HostShmem, HostShmemProtected, ManagerShmem};
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
+use shadow_shim_helper_rs::util::SendPointer;
 use shadow_shmem::allocator::ShMemBlock;
 use shadow_tsc::Tsc;
 use vasi_sync::scmutex::SelfContainedMutexGuard;
 
-use crate::core::configuration::{ProcessFinalState, QDiscMode};
+use crate::core::cgroup::HostCgroup;
+use crate::core::configuration::{ProcessFinalState, QDiscMode, RouterQDiscMode};
+use crate::core::event_trace::{TracedEvent, TracedEventKind};
+use crate::core::profile::HostProfiler;
+use crate::core::resource_usage::{self, HostMemoryUsage};
 use crate::core::sim_config::PcapConfig;
 use crate::core::work::event::{Event, EventData};
+use crate::core::work::event_mailbox::EventMailbox;
 use crate::core::work::event_queue::EventQueue;
 use crate::core::work::task::TaskRef;
-use crate::core::worker::Worker;
+use crate::core::work::timer_wheel::{TimerId, TimerWheel};
+use crate::core::worker::{WORKER_SHARED, Worker, WorkerThreadID};
 use crate::cshadow;
 use crate::host::descriptor::socket::abstract_unix_ns::AbstractUnixNamespace;
 use crate::host::descriptor::socket::inet::InetSocket;
+use crate::host::file_io_pool::PendingFileIo;
 use crate::host::futex_table::FutexTable;
-use crate::host::network::interface::{FifoPacketPriority, NetworkInterface, PcapOptions};
+use crate::host::network::interface::{
+    FifoPacketPriority, NetworkInterface, PcapOptions, PcapRingOptions, pcap_ring_dump_requests,
+};
 use crate::host::network::namespace::NetworkNamespace;
-use crate::host::process::Process;
+use crate::host::process::{PrelaunchedProcess, Process};
+use crate::host::socket_memory::SocketMemory;
 use crate::host::thread::{Thread, ThreadId};
 use crate::network::PacketDevice;
 use crate::network::relay::{RateLimit, Relay};
 use crate::network::router::Router;
 use crate::utility;
+use crate::utility::counter::Counter;
 #[cfg(feature = "perf_timers")]
 use crate::utility::perf_timer::PerfTimer;
 
@@ -67,20 +84,62 @@ pub struct HostParameters {
     pub log_level: LogLevel,
     pub pcap_config: Option<PcapConfig>,
     pub qdisc: QDiscMode,
+    pub router_qdisc: RouterQDiscMode,
     pub init_sock_recv_buf_size: u64,
     pub autotune_recv_buf: bool,
     pub init_sock_send_buf_size: u64,
     pub autotune_send_buf: bool,
+    /// The memory that autotuning may grow the host's socket buffers by, or `None` if unlimited.
+    pub socket_buffer_budget: Option<u64>,
+    /// The cgroup for the host's managed processes, if cgroup isolation is enabled.
+    pub cgroup: Option<HostCgroup>,
     pub native_tsc_frequency: u64,
     pub model_unblocked_syscall_latency: bool,
     pub max_unapplied_cpu_latency: SimulationTime,
     pub unblocked_syscall_latency: SimulationTime,
     pub unblocked_vdso_latency: SimulationTime,
+    pub use_adaptive_cpu_latency: bool,
+    pub use_batched_memory_writes: bool,
     pub strace_logging_options: Option<FmtOptions>,
+    pub use_binary_strace: bool,
     pub shim_log_level: LogLevel,
     pub use_new_tcp: bool,
+    pub use_new_tcp_delayed_ack: bool,
+    pub use_deferred_tcp_flush: bool,
     pub use_mem_mapper: bool,
+    pub use_mem_mapper_huge_pages: bool,
+    pub use_mem_mapper_shared_file_pages: bool,
+    pub use_smt_sibling_affinity: bool,
     pub use_syscall_counters: bool,
+    pub use_profiling: bool,
+    /// Use a calendar queue with buckets of this width for the host's events, or a binary heap if
+    /// `None`.
+    pub event_queue_bucket_width: Option<SimulationTime>,
+    /// Pace packets through the host's bandwidth limits continuously rather than with refills
+    /// every millisecond.
+    pub use_continuous_rate_limits: bool,
+    /// Forward loopback packets as soon as a socket has them to send, rather than from a scheduled
+    /// task.
+    pub use_direct_loopback: bool,
+    /// Keep the host's timers in a [`TimerWheel`] rather than scheduling an event for each timer.
+    pub use_timer_wheel: bool,
+    /// How many times Shadow and the host's managed threads poll their IPC channels before
+    /// sleeping.
+    pub ipc_spin_limit: u32,
+    /// Launch the configured managed processes at the start of the simulation, and start them
+    /// (from the shim's point of view) at their start times.
+    pub use_process_prelaunch: bool,
+    /// Have the shim do the I/O of the host's regular files natively.
+    pub use_native_file_io: bool,
+    /// Do the file I/O that Shadow does for the host's processes on a
+    /// [`FileIoPool`](crate::host::file_io_pool::FileIoPool).
+    pub use_file_io_offload: bool,
+    pub use_shim_random: bool,
+    /// Have the shim handle futex wakes itself while no futex on the host has any waiters.
+    pub use_shim_futex_wake: bool,
+    /// Reclaim the native memory of the host's processes when it won't have events for at least
+    /// this long, or never if `None`.
+    pub idle_reclaim_delay: Option<SimulationTime>,
 }
 
 use super::cpu::Cpu;
@@ -113,6 +172,13 @@ pub struct Host {
     root: Root,
 
     event_queue: Arc<Mutex<EventQueue>>,
+    // Packet events sent from other hosts, which are moved to `event_queue` before the host runs.
+    event_mailbox: Arc<EventMailbox>,
+
+    // Timers added with `add_timer()`, or `None` if timers are scheduled directly as events.
+    timer_wheel: Option<RefCell<TimerWheel<TaskRef>>>,
+    // The earliest time that an event to run the expired timers is scheduled for.
+    timer_wheel_wakeup: Cell<Option<EmulatedTime>>,
 
     random: RefCell<Xoshiro256PlusPlus>,
 
@@ -131,9 +197,24 @@ pub struct Host {
     // map address to futex objects
     futex_table: RefCell<FutexTable>,
 
+    // Syscall conditions waiting to be woken by a shared exclusive wakeup task, keyed by the
+    // canonical handle of the file and the file state that they're waiting for.
+    exclusive_wakeups:
+        RefCell<BTreeMap<(usize, u16), VecDeque<SendPointer<cshadow::SysCallCondition>>>>,
+
     #[cfg(feature = "perf_timers")]
     execution_timer: RefCell<PerfTimer>,
 
+    // Only present if profiling is enabled.
+    profiler: Option<RefCell<HostProfiler>>,
+
+    // The worker thread that last ran the host, and the number of times that the host has been
+    // run by a different worker thread than the previous time.
+    last_worker_id: Cell<Option<WorkerThreadID>>,
+    worker_migrations: Cell<u64>,
+    // The socket buffer memory given out by autotuning.
+    socket_memory: SocketMemory,
+
     pub params: HostParameters,
 
     cpu: RefCell<Cpu>,
@@ -147,18 +228,30 @@ pub struct Host {
     // store it at all)
     data_dir_path: PathBuf,
     data_dir_path_cstring: CString,
+    /// Whether `data_dir_path` has been created. It's created the first time that it's used.
+    data_dir_created: Cell<bool>,
 
     // virtual process and event id counter
     thread_id_counter: Cell<libc::pid_t>,
     event_id_counter: Cell<u64>,
     packet_id_counter: Cell<u64>,
 
+    // the number of syscalls that the host's processes have made
+    syscall_counter: Cell<u64>,
+
+    /// File I/O that's being done for the host's threads on a pool thread. The host doesn't run
+    /// any events until it's done.
+    pending_file_io: RefCell<Vec<PendingFileIo>>,
+
     // Enables us to sort objects deterministically based on their creation order.
     determinism_sequence_counter: Cell<u64>,
 
     // track the order in which the application sent us application data
     packet_priority_counter: Cell<FifoPacketPriority>,
 
+    // the number of requested pcap ring dumps that we've handled
+    pcap_ring_dumps_handled: Cell<u64>,
+
     // Owned pointers to processes.
     processes: RefCell<BTreeMap<ProcessId, RootedRc<RootedRefCell<Process>>>>,
 
@@ -216,8 +309,17 @@ impl Host {
     ) -> Self {
         #[cfg(feature = "perf_timers")]
         let execution_timer = RefCell::new(PerfTimer::new_started());
+        let profiler = params
+            .use_profiling
+            .then(|| RefCell::new(HostProfiler::new()));
 
+        #[cfg(not(feature = "unchecked_roots"))]
         let root = Root::new();
+        // SAFETY: a host's root is only used while the host is running on a worker thread, to
+        // access the objects of that host. This build option trusts that rather than checking it
+        // in release builds.
+        #[cfg(feature = "unchecked_roots")]
+        let root = unsafe { Root::new_unchecked() };
         let random = RefCell::new(Xoshiro256PlusPlus::seed_from_u64(params.node_seed));
         let cpu = RefCell::new(Cpu::new(
             params.cpu_frequency,
@@ -237,7 +339,9 @@ impl Host {
             nix::unistd::getpid().as_raw(),
             params.native_tsc_frequency,
             params.shim_log_level,
+            Self::make_utsname(&params.hostname),
             manager_shmem,
+            params.ipc_spin_limit,
         );
         let shim_shmem = UnsafeCell::new(shadow_shmem::allocator::shmalloc(host_shmem));
 
@@ -250,8 +354,6 @@ impl Host {
         let packet_priority_counter = Cell::new(1);
         let tsc = Tsc::new(params.native_tsc_frequency);
 
-        std::fs::create_dir_all(&data_dir_path).unwrap();
-
         // Register using the param hints.
         // We already checked that the addresses are available, so fail if they are not.
 
@@ -260,6 +362,10 @@ impl Host {
         let pcap_options = params.pcap_config.as_ref().map(|x| PcapOptions {
             path: data_dir_path.clone(),
             capture_size_bytes: x.capture_size.try_into().unwrap(),
+            ring: x.ring.map(|ring| PcapRingOptions {
+                max_packets: ring.max_packets.map(|x| x.try_into().unwrap()),
+                max_duration: ring.max_duration.map(Into::into),
+            }),
         });
 
         let net_ns = NetworkNamespace::new(public_ip, pcap_options, params.qdisc);
@@ -267,13 +373,20 @@ impl Host {
         // Packets that are not for localhost or our public ip go to the router.
         // Use `Ipv4Addr::UNSPECIFIED` for the router to encode this for our
         // routing table logic inside of `Host::get_packet_device()`.
-        let router = Router::new(Ipv4Addr::UNSPECIFIED);
+        let router = Router::new(Ipv4Addr::UNSPECIFIED, params.router_qdisc);
+        let rate_limit = |bits_per_second: u64| {
+            if params.use_continuous_rate_limits {
+                RateLimit::PacedBytesPerSecond(bits_per_second / 8)
+            } else {
+                RateLimit::BytesPerSecond(bits_per_second / 8)
+            }
+        };
         let relay_inet_out = Relay::new(
-            RateLimit::BytesPerSecond(params.requested_bw_up_bits / 8),
+            rate_limit(params.requested_bw_up_bits),
             net_ns.internet.borrow().get_address(),
         );
         let relay_inet_in = Relay::new(
-            RateLimit::BytesPerSecond(params.requested_bw_down_bits / 8),
+            rate_limit(params.requested_bw_down_bits),
             router.get_address(),
         );
         let relay_loopback = Relay::new(
@@ -282,17 +395,27 @@ impl Host {
         );
 
         let in_notify_socket_has_packets = RootedCell::new(&root, false);
+        let socket_memory = SocketMemory::new(params.socket_buffer_budget);
 
         let res = Self {
             info: OnceCell::new(),
             root,
-            event_queue: Arc::new(Mutex::new(EventQueue::new())),
+            event_queue: Arc::new(Mutex::new(match params.event_queue_bucket_width {
+                Some(width) => EventQueue::new_calendar(width),
+                None => EventQueue::new(),
+            })),
+            event_mailbox: Arc::new(EventMailbox::new()),
+            timer_wheel: params
+                .use_timer_wheel
+                .then(|| RefCell::new(TimerWheel::new())),
+            timer_wheel_wakeup: Cell::new(None),
             params,
             router: RefCell::new(router),
             relay_inet_out: Arc::new(relay_inet_out),
             relay_inet_in: Arc::new(relay_inet_in),
             relay_loopback: Arc::new(relay_loopback),
             futex_table: RefCell::new(FutexTable::new()),
+            exclusive_wakeups: RefCell::new(BTreeMap::new()),
             random,
             shim_shmem,
             shim_shmem_lock: RefCell::new(None),
@@ -300,15 +423,23 @@ impl Host {
             net_ns,
             data_dir_path,
             data_dir_path_cstring,
+            data_dir_created: Cell::new(false),
             thread_id_counter,
             event_id_counter,
             packet_id_counter,
+            syscall_counter: Cell::new(0),
+            pending_file_io: RefCell::new(Vec::new()),
             packet_priority_counter,
             determinism_sequence_counter,
+            pcap_ring_dumps_handled: Cell::new(pcap_ring_dump_requests()),
             tsc,
             processes: RefCell::new(BTreeMap::new()),
             #[cfg(feature = "perf_timers")]
             execution_timer,
+            profiler,
+            last_worker_id: Cell::new(None),
+            worker_migrations: Cell::new(0),
+            socket_memory,
             in_notify_socket_has_packets,
             preload_paths,
         };
@@ -347,6 +478,27 @@ impl Host {
         &self.root
     }
 
+    fn make_utsname(hostname: &CStr) -> new_utsname {
+        let mut name: new_utsname = shadow_pod::zeroed();
+
+        let nodename = utility::u8_to_i8_slice(hostname.to_bytes());
+
+        // Currently hardcoded with values reported in Debian 12
+        let sysname = utility::u8_to_i8_slice(&b"Linux"[..]);
+        let release = utility::u8_to_i8_slice(&b"6.1.0-25-amd64"[..]);
+        let version =
+            utility::u8_to_i8_slice(&b"#1 SMP PREEMPT_DYNAMIC Debian 6.1.106-3 (2024-08-26)"[..]);
+        let machine = utility::u8_to_i8_slice(&b"x86_64"[..]);
+
+        name.sysname[..sysname.len()].copy_from_slice(sysname);
+        name.nodename[..nodename.len()].copy_from_slice(nodename);
+        name.release[..release.len()].copy_from_slice(release);
+        name.version[..version.len()].copy_from_slice(version);
+        name.machine[..machine.len()].copy_from_slice(machine);
+
+        name
+    }
+
     fn make_data_dir_path(hostname: &CStr, host_root_path: &Path) -> PathBuf {
         let hostname: OsString = { OsString::from_vec(hostname.to_bytes().to_vec()) };
 
@@ -356,7 +508,12 @@ impl Host {
         data_dir_path
     }
 
+    /// The host's data directory. It's created the first time that this is called, so that hosts
+    /// aren't given a directory until they start a process or write a file.
     pub fn data_dir_path(&self) -> &Path {
+        if !self.data_dir_created.replace(true) {
+            std::fs::create_dir_all(&self.data_dir_path).unwrap();
+        }
         &self.data_dir_path
     }
 
@@ -371,9 +528,37 @@ impl Host {
         envv: Vec<CString>,
         pause_for_debugging: bool,
         expected_final_state: ProcessFinalState,
+        native_syscalls: Vec<SyscallNum>,
     ) {
         debug_assert!(shutdown_time.is_none() || shutdown_time.unwrap() > start_time);
 
+        // The process launched by the prelaunch task, if any.
+        let prelaunched: Arc<Mutex<Option<PrelaunchedProcess>>> = Arc::new(Mutex::new(None));
+
+        // Schedule launching the process in the background at the start of the simulation. There's
+        // nothing to gain for processes that start at the beginning of the simulation, and
+        // processes that start after the end of the simulation would never be used.
+        if self.params.use_process_prelaunch
+            && start_time != SimulationTime::ZERO
+            && EmulatedTime::SIMULATION_START + start_time < self.params.sim_end_time
+        {
+            let prelaunched = Arc::clone(&prelaunched);
+            let plugin_name = plugin_name.clone();
+            let plugin_path = plugin_path.clone();
+            let argv = argv.clone();
+            let envv = envv.clone();
+            let task = TaskRef::new(move |host| {
+                *prelaunched.lock().unwrap() = Process::prelaunch(
+                    host,
+                    &plugin_name,
+                    &plugin_path,
+                    argv.clone(),
+                    envv.clone(),
+                );
+            });
+            self.schedule_task_at_emulated_time(task, EmulatedTime::SIMULATION_START);
+        }
+
         // Schedule spawning the process.
         let task = TaskRef::new(move |host| {
             // We can't move out of these captured variables, since TaskRef takes
@@ -390,7 +575,10 @@ impl Host {
                 envv,
                 pause_for_debugging,
                 host.params.strace_logging_options,
+                host.params.use_binary_strace,
                 expected_final_state,
+                &native_syscalls,
+                prelaunched.lock().unwrap().take(),
             )
             .unwrap_or_else(|e| panic!("Failed to initialize application {plugin_name:?}: {e:?}"));
             let (process_id, thread_id) = {
@@ -601,6 +789,59 @@ impl Host {
         &self.net_ns
     }
 
+    /// The memory used by the host's managed processes, and by Shadow for the host.
+    pub fn memory_usage(&self) -> HostMemoryUsage {
+        let managed_rss = self
+            .processes
+            .borrow()
+            .values()
+            .filter_map(|processrc| {
+                let process = processrc.borrow(&self.root);
+                if !process.is_running() {
+                    return None;
+                }
+                let pid = process.native_pid().as_raw_nonzero().get();
+                // the process may have exited natively but not yet been reaped by shadow
+                let mut file = std::fs::File::open(format!("/proc/{pid}/statm")).ok()?;
+                resource_usage::statm_rss(&mut file).ok()
+            })
+            .sum();
+
+        let num_events = self.event_queue.lock().unwrap().len();
+
+        HostMemoryUsage {
+            managed_rss,
+            event_queue: (num_events * std::mem::size_of::<Event>()) as u64,
+            socket_buffers: self.net_ns.socket_buffer_bytes() as u64,
+            socket_buffer_budget: self.socket_memory.allocated(),
+            router_queue: self.router.borrow().queued_bytes() as u64,
+            pcap_rings: self.net_ns.pcap_ring_bytes() as u64,
+        }
+    }
+
+    /// Write the packets in the in-memory pcap rings of the host's interfaces (if configured) to
+    /// pcap files.
+    pub fn dump_pcap_rings(&self, reason: &str) {
+        self.net_ns.dump_pcap_rings(reason);
+    }
+
+    /// Dump the host's pcap rings if a dump was requested (for example by a signal sent to Shadow)
+    /// since the last time this was called.
+    pub fn dump_pcap_rings_if_requested(&self) {
+        if !self
+            .params
+            .pcap_config
+            .is_some_and(|config| config.ring.is_some())
+        {
+            return;
+        }
+
+        let requests = pcap_ring_dump_requests();
+        if self.pcap_ring_dumps_handled.replace(requests) != requests {
+            self.dump_pcap_rings("dump requested");
+        }
+    }
+
     #[track_caller]
     pub fn futextable_borrow(&self) -> impl Deref<Target = FutexTable> + '_ {
         self.futex_table.borrow()
@@ -664,6 +905,23 @@ impl Host {
         res
     }
 
+    /// Count a syscall that was handled for one of the host's processes.
+    pub fn count_syscall(&self) {
+        self.syscall_counter.set(self.syscall_counter.get() + 1);
+    }
+
+    /// Don't run any more of the host's events until `io` has completed.
+    pub fn add_pending_file_io(&self, io: &PendingFileIo) {
+        self.pending_file_io.borrow_mut().push(io.handle());
+    }
+
+    /// Is file I/O still being done for one of the host's threads?
+    fn file_io_in_progress(&self) -> bool {
+        let mut pending = self.pending_file_io.borrow_mut();
+        pending.retain(|io| !io.is_done());
+        !pending.is_empty()
+    }
+
     pub fn get_next_deterministic_sequence_value(&self) -> u64 {
         let res = self.determinism_sequence_counter.get();
         self.determinism_sequence_counter.set(res + 1);
@@ -680,11 +938,22 @@ impl Host {
     pub fn continue_execution_timer(&self) {
         #[cfg(feature = "perf_timers")]
         self.execution_timer.borrow_mut().start();
+        if let Some(profiler) = &self.profiler {
+            profiler.borrow_mut().start();
+        }
     }
 
     pub fn stop_execution_timer(&self) {
         #[cfg(feature = "perf_timers")]
         self.execution_timer.borrow_mut().stop();
+        if let Some(profiler) = &self.profiler {
+            profiler.borrow_mut().stop();
+        }
+    }
+
+    /// The host's profiler, if profiling is enabled.
+    pub fn profiler_borrow_mut(&self) -> Option<impl DerefMut<Target = HostProfiler> + '_> {
+        self.profiler.as_ref().map(|p| p.borrow_mut())
     }
 
     pub fn schedule_task_at_emulated_time(&self, task: TaskRef, t: EmulatedTime) -> bool {
@@ -696,14 +965,85 @@ impl Host {
         self.schedule_task_at_emulated_time(task, Worker::current_time().unwrap() + t)
     }
 
+    /// Returns true if the host's timers should be added with [`Host::add_timer()`] rather than
+    /// scheduled as tasks.
+    pub fn has_timer_wheel(&self) -> bool {
+        self.timer_wheel.is_some()
+    }
+
+    /// Run `task` at time `t` from the host's timer wheel. Unlike a task scheduled with
+    /// [`Host::schedule_task_at_emulated_time()`], the task can be cancelled with
+    /// [`Host::cancel_timer()`]. Panics if the host doesn't have a timer wheel.
+    pub fn add_timer(&self, task: TaskRef, t: EmulatedTime) -> TimerId {
+        let id = self
+            .timer_wheel
+            .as_ref()
+            .unwrap()
+            .borrow_mut()
+            .insert(t, task);
+        self.schedule_timer_wakeup(t);
+        id
+    }
+
+    /// Cancel a timer added with [`Host::add_timer()`]. Does nothing if the timer has already run
+    /// or been cancelled.
+    pub fn cancel_timer(&self, id: TimerId) {
+        // don't drop the task while the wheel is borrowed
+        let _task = self.timer_wheel.as_ref().unwrap().borrow_mut().cancel(id);
+
+        // any event that was scheduled for this timer is left in the event queue, and when it runs
+        // it will schedule a new event for the next timer
+    }
+
+    /// Make sure that an event will run the host's expired timers at or before time `t`.
+    fn schedule_timer_wakeup(&self, t: EmulatedTime) {
+        if self.timer_wheel_wakeup.get().is_some_and(|x| x <= t) {
+            return;
+        }
+
+        let task = TaskRef::new(|host| host.run_expired_timers());
+        if self.schedule_task_at_emulated_time(task, t) {
+            self.timer_wheel_wakeup.set(Some(t));
+        }
+    }
+
+    fn run_expired_timers(&self) {
+        let now = Worker::current_time().unwrap();
+        let wheel = self.timer_wheel.as_ref().unwrap();
+
+        // the event may have been delayed by the CPU model, so it might be later than the wakeup
+        if self.timer_wheel_wakeup.get().is_some_and(|x| x <= now) {
+            self.timer_wheel_wakeup.set(None);
+        }
+
+        // the wheel must not be borrowed while the tasks run, since they may add or cancel timers
+        loop {
+            let Some((_time, task)) = wheel.borrow_mut().pop_expired(now) else {
+                break;
+            };
+            task.execute(self);
+        }
+
+        let next = wheel.borrow_mut().next_deadline();
+        if let Some(next) = next {
+            self.schedule_timer_wakeup(next);
+        }
+    }
+
     pub fn event_queue(&self) -> &Arc<Mutex<EventQueue>> {
         &self.event_queue
     }
 
+    /// The mailbox that other hosts should use to send packet events to this host.
+    pub fn event_mailbox(&self) -> &Arc<EventMailbox> {
+        &self.event_mailbox
+    }
+
     pub fn push_local_event(&self, event: Event) -> bool {
         if event.time() >= self.params.sim_end_time {
             return false;
         }
+        self.event_mailbox.lower_next_event_time(event.time());
         self.event_queue.lock().unwrap().push(event);
         true
     }
@@ -717,15 +1057,92 @@ impl Host {
         // the network namespace object needs to be cleaned up before it's dropped
         self.net_ns.cleanup();
 
+        // drop any timers that haven't run while the host is still active, since their tasks may
+        // hold objects that cancel their own timers when dropped
+        if let Some(wheel) = &self.timer_wheel {
+            let timers = std::mem::take(&mut *wheel.borrow_mut());
+            drop(timers);
+        }
+
         assert!(self.processes.borrow().is_empty());
 
         self.stop_execution_timer();
+        if let Some(profiler) = &self.profiler {
+            profiler.borrow_mut().end_run();
+        }
         #[cfg(feature = "perf_timers")]
         debug!(
             "host '{}' has been shut down, total execution time was {:?}",
             self.name(),
             self.execution_timer.borrow().elapsed()
         );
+
+        debug!(
+            "host '{}' was moved between worker threads {} times",
+            self.name(),
+            self.worker_migrations.get()
+        );
+
+        let native_preemptions = self
+            .shim_shmem()
+            .native_preemptions
+            .load(std::sync::atomic::Ordering::Relaxed);
+        debug!(
+            "host '{}' natively preempted managed code {} times",
+            self.name(),
+            native_preemptions
+        );
+
+        let cgroup_cpu_time = self.params.cgroup.as_ref().and_then(|cgroup| {
+            cgroup
+                .cpu_time()
+                .map_err(|e| {
+                    warn!(
+                        "Failed to get the CPU time of host '{}': {e:#}",
+                        self.name()
+                    )
+                })
+                .ok()
+        });
+        if let Some(cpu_time) = cgroup_cpu_time {
+            debug!(
+                "host '{}' managed processes used {:?} of CPU time",
+                self.name(),
+                cpu_time
+            );
+        }
+
+        let lock_stats = self.shim_shmem().protected().stats();
+        let mut lock_counts = Counter::new();
+        lock_counts.add_value("host_shmem_spun", lock_stats.spun as i64);
+        lock_counts.add_value("host_shmem_slept", lock_stats.slept as i64);
+        Worker::add_lock_counts(&lock_counts);
+
+        if let Some(profiler) = &self.profiler {
+            let mut profile = profiler.borrow().profile();
+            profile.worker_migrations = self.worker_migrations.get();
+            profile.native_preemptions = native_preemptions;
+            profile.cgroup_cpu_ns = cgroup_cpu_time.map(|x| x.as_nanos().try_into().unwrap());
+            Worker::add_host_profile(self.name(), profile);
+        }
+
+        // the processes have exited and the pcap files have been closed, so the files in an
+        // in-memory data directory can be copied to the data directory
+        if self.data_dir_created.get() {
+            if let Some(dir) = WORKER_SHARED.borrow().as_ref().unwrap().memory_data_dir() {
+                dir.spill(self.name());
+            }
+        }
+    }
+
+    /// Send SIGKILL to all of the host's native processes without reaping them. Called for every
+    /// host before any host is freed with [`Host::free_all_applications`], so that the kernel tears
+    /// down all of the simulation's processes concurrently rather than one at a time as each is
+    /// reaped.
+    pub fn kill_all_applications(&self) {
+        for processrc in self.processes.borrow().values() {
+            processrc.borrow(self.root()).kill_native();
+        }
     }
 
     pub fn free_all_applications(&self) {
@@ -747,7 +1164,38 @@ impl Host {
     }
 
     pub fn execute(&self, until: EmulatedTime) {
+        let worker_id = Worker::worker_id();
+        if self
+            .last_worker_id
+            .replace(worker_id)
+            .is_some_and(|last| Some(last) != worker_id)
+        {
+            self.worker_migrations.set(self.worker_migrations.get() + 1);
+        }
+
+        // Packets sent to us during the previous round always have a delivery time of at least
+        // the end of our previous window, and packets sent during this round always have a
+        // delivery time of at least `until`, so we only need to drain the mailbox once here.
+        self.event_mailbox
+            .drain_into(&mut self.event_queue.lock().unwrap());
+
+        // The worker ran its other hosts for the rest of the round in which the file I/O was
+        // started, so wait for it here rather than running empty rounds until it's done.
+        for io in self.pending_file_io.take() {
+            io.wait_done();
+        }
+
+        let trace_events = Worker::is_event_trace_enabled();
+        let syscalls_at_start = self.syscall_counter.get();
+        let mut last_event_time = None;
+
         loop {
+            // one of our threads is waiting for file I/O, so let the worker run its other hosts
+            // and continue in the next round
+            if self.params.use_file_io_offload && self.file_io_in_progress() {
+                break;
+            }
+
             let mut event = {
                 let mut event_queue = self.event_queue.lock().unwrap();
                 match event_queue.next_event_time() {
@@ -777,23 +1225,125 @@ impl Host {
             }
 
             // run the event
-            Worker::set_current_time(event.time());
+            let event_time = event.time();
+            last_event_time = Some(event_time);
+            let trace_start = trace_events.then(|| (Instant::now(), self.syscall_counter.get()));
+            Worker::set_current_time(event_time);
             self.continue_execution_timer();
-            match event.data() {
+            let kind = match event.data() {
                 EventData::Packet(data) => {
-                    self.upstream_router_borrow_mut()
-                        .route_incoming_packet(data.into());
+                    let mut router = self.upstream_router_borrow_mut();
+                    let mut total_packets = 0;
+                    let mut next = Some(data);
+
+                    // Packet events are ordered before local events with the same time, so route
+                    // the packets of all packet events for this time before notifying the relay
+                    // once, rather than having it forward the packets after each event.
+                    while let Some(data) = next {
+                        let mut num_packets = 0;
+                        let mut packet_bytes = 0;
+                        for packet in data.into_packets() {
+                            usdt_probe!(packet_recv, self.id(), event_time, packet.payload_len());
+                            packet_bytes += u64::try_from(packet.payload_len()).unwrap();
+                            router.route_incoming_packet(packet);
+                            num_packets += 1;
+                        }
+                        Worker::count_event(num_packets, packet_bytes);
+                        total_packets += num_packets;
+
+                        next = self
+                            .event_queue
+                            .lock()
+                            .unwrap()
+                            .pop_if(|event| event.time() == event_time && event.is_packet())
+                            .map(|event| match event.data() {
+                                EventData::Packet(data) => data,
+                                EventData::Local(_) => unreachable!(),
+                            });
+                    }
+
+                    drop(router);
                     self.notify_router_has_packets();
+                    TracedEventKind::Packet(total_packets.try_into().unwrap_or(u32::MAX))
                 }
-                EventData::Local(data) => TaskRef::from(data).execute(self),
-            }
+                EventData::Local(data) => {
+                    let task = TaskRef::from(data);
+                    task.execute(self);
+                    Worker::count_event(0, 0);
+                    TracedEventKind::Local(task.name())
+                }
+            };
             self.stop_execution_timer();
             Worker::clear_current_time();
+
+            if let Some((wall_start, syscalls_start)) = trace_start {
+                let syscalls = self.syscall_counter.get() - syscalls_start;
+                Worker::trace_event(&TracedEvent {
+                    host_id: self.id(),
+                    kind,
+                    sim_time: event_time,
+                    wall_start,
+                    wall_duration: wall_start.elapsed(),
+                    syscalls: syscalls.try_into().unwrap_or(u32::MAX),
+                });
+            }
+        }
+
+        Worker::count_syscalls(self.syscall_counter.get() - syscalls_at_start);
+
+        if let Some(profiler) = &self.profiler {
+            profiler.borrow_mut().end_run();
+        }
+
+        // a host that isn't running any processes (before its first process starts, or after
+        // they've all exited) doesn't need to keep its pcap files open once they've gone idle
+        if self.params.pcap_config.is_some() && self.processes.borrow().is_empty() {
+            self.net_ns.release_pcap_files(until);
+        }
+
+        // a host that has gone idle won't need its memory for a while
+        if let (Some(delay), Some(now)) = (self.params.idle_reclaim_delay, last_event_time) {
+            if !self.file_io_in_progress()
+                && self.next_event_time().is_none_or(|t| t >= until + delay)
+            {
+                self.reclaim_memory(now);
+            }
+        }
+    }
+
+    /// Give the native memory of the host's processes back to the system, and free unused
+    /// capacity of the host's event queue. `now` is the time of the host's last event. This only
+    /// changes what memory is resident, so it doesn't affect the simulation.
+    fn reclaim_memory(&self, now: EmulatedTime) {
+        trace!("Host {} is idle, reclaiming its memory", self.name());
+
+        // the processes' threads make the madvise syscalls natively
+        Worker::set_current_time(now);
+        for process in self.processes.borrow().values() {
+            process.borrow(self.root()).reclaim_memory(self);
         }
+        Worker::clear_current_time();
+
+        self.event_queue.lock().unwrap().shrink_to_fit();
     }
 
+    /// The time of the host's next event. Also updates the next event time tracked by the host's
+    /// [`EventMailbox`].
     pub fn next_event_time(&self) -> Option<EmulatedTime> {
-        self.event_queue.lock().unwrap().next_event_time()
+        // reset before draining so that we don't overwrite the time of any event pushed after the
+        // drain
+        self.event_mailbox.reset_next_event_time();
+
+        let mut event_queue = self.event_queue.lock().unwrap();
+        if !self.event_mailbox.is_empty() {
+            self.event_mailbox.drain_into(&mut event_queue);
+        }
+
+        let time = event_queue.next_event_time();
+        if let Some(time) = time {
+            self.event_mailbox.lower_next_event_time(time);
+        }
+        time
     }
 
     /// The unprotected part of the Host's shared memory.
@@ -916,6 +1466,19 @@ impl Host {
         }
     }
 
+    /// Move a new native process into the host's cgroup, if cgroup isolation is enabled.
+    pub fn add_to_cgroup(&self, native_pid: Pid) {
+        let Some(cgroup) = &self.params.cgroup else {
+            return;
+        };
+        if let Err(e) = cgroup.add_process(native_pid) {
+            warn!(
+                "Failed to move process {native_pid:?} into the cgroup of host '{}': {e:#}",
+                self.name()
+            );
+        }
+    }
+
     /// Call to trigger the forwarding of packets from the router to the network
     /// interface.
     pub fn notify_router_has_packets(&self) {
@@ -928,21 +1491,38 @@ impl Host {
     ///
     /// WARNING: This is not reentrant. Do not allow this to be called recursively. Nothing in
     /// `add_data_source()` or `notify()` can call back into this method. This includes any socket
-    /// code called in any indirect way from here.
+    /// code called in any indirect way from here. The exception is when loopback packets are
+    /// forwarded directly, since that's done after the recursion check is reset.
     pub fn notify_socket_has_packets(&self, addr: Ipv4Addr, socket: &InetSocket) {
         if self.in_notify_socket_has_packets.replace(&self.root, true) {
             panic!("Recursively calling host.notify_socket_has_packets()");
         }
 
+        let mut forward_loopback = false;
         if let Some(iface) = self.interface_borrow(addr) {
             iface.add_data_source(socket);
             match addr {
+                // The legacy TCP stack may call this method in the middle of updating the socket,
+                // so we can't deliver packets back to it yet.
+                Ipv4Addr::LOCALHOST
+                    if self.params.use_direct_loopback
+                        && !matches!(socket, InetSocket::LegacyTcp(_)) =>
+                {
+                    forward_loopback = true
+                }
                 Ipv4Addr::LOCALHOST => self.relay_loopback.notify(self),
                 _ => self.relay_inet_out.notify(self),
             };
         }
 
         self.in_notify_socket_has_packets.set(&self.root, false);
+
+        if forward_loopback {
+            // Delivering the packets runs the receiving sockets' code, which may send more packets
+            // and call back into this method. This call's forwarding loop will forward those
+            // packets too.
+            self.relay_loopback.forward_immediately(self);
+        }
     }
 
     /// Returns the Session ID for the given process group ID, if it exists.
@@ -981,6 +1561,8 @@ mod export {
 
     use super::*;
     use crate::cshadow::{CEmulatedTime, CSimulationTime};
+    use crate::host::descriptor::FileState;
+    use crate::host::descriptor::socket::inet::InetSocketWeak;
     use crate::network::packet::IanaProtocol;
 
     #[unsafe(no_mangle)]
@@ -1055,6 +1637,30 @@ mod export {
         hostrc.params.autotune_send_buf
     }
 
+    /// Allocate `bytes` from the host's socket buffer budget for growing a socket buffer. Returns
+    /// false if the buffer must not grow.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn host_tryAllocateSocketMemory(
+        hostrc: *const Host,
+        bytes: u64,
+    ) -> bool {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        hostrc.socket_memory.try_allocate(bytes)
+    }
+
+    /// Return `bytes` that were allocated with `host_tryAllocateSocketMemory`.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn host_freeSocketMemory(hostrc: *const Host, bytes: u64) {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        hostrc.socket_memory.free(bytes)
+    }
+
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn host_useDeferredTcpFlush(hostrc: *const Host) -> bool {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        hostrc.params.use_deferred_tcp_flush
+    }
+
     #[unsafe(no_mangle)]
     pub unsafe extern "C-unwind" fn host_getConfiguredRecvBufSize(hostrc: *const Host) -> u64 {
         let hostrc = unsafe { hostrc.as_ref().unwrap() };
@@ -1090,6 +1696,8 @@ mod export {
     #[unsafe(no_mangle)]
     pub unsafe extern "C-unwind" fn host_getDataPath(hostrc: *const Host) -> *const c_char {
         let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        // make sure that the directory exists
+        hostrc.data_dir_path();
         hostrc.data_dir_path_cstring.as_ptr()
     }
 
@@ -1101,8 +1709,11 @@ mod export {
         bind_port: in_port_t,
         peer_ip: in_addr_t,
         peer_port: in_port_t,
+        socket: *const InetSocketWeak,
     ) {
         let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        // identifies the socket if several sockets with `SO_REUSEPORT` share the addresses
+        let socket = unsafe { socket.as_ref() }.map(InetSocketWeak::identity);
 
         let bind_ip = Ipv4Addr::from(u32::from_be(bind_ip));
         let peer_ip = Ipv4Addr::from(u32::from_be(peer_ip));
@@ -1117,7 +1728,7 @@ mod export {
         // associate the interfaces corresponding to bind_addr with socket
         hostrc
             .net_ns
-            .disassociate_interface(protocol, bind_addr, peer_addr);
+            .disassociate_interface(protocol, bind_addr, peer_addr, socket);
     }
 
     #[unsafe(no_mangle)]
@@ -1161,6 +1772,58 @@ mod export {
         &mut *hostrc.futextable_borrow_mut()
     }
 
+    /// Add a syscall condition to the exclusive wakeups for the file with canonical handle
+    /// `file_handle` and the file state `state`. Returns true if there's no task for this wakeup
+    /// yet, in which case the caller must schedule a task that pops the conditions with
+    /// `host_popExclusiveWakeup` until it returns NULL.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn host_pushExclusiveWakeup(
+        hostrc: *const Host,
+        file_handle: libc::uintptr_t,
+        state: FileState,
+        cond: *mut cshadow::SysCallCondition,
+    ) -> bool {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        assert!(!cond.is_null());
+        let mut wakeups = hostrc.exclusive_wakeups.borrow_mut();
+        let cond = unsafe { SendPointer::new(cond) };
+        match wakeups.entry((file_handle, state.bits())) {
+            Entry::Occupied(mut entry) => {
+                entry.get_mut().push_back(cond);
+                false
+            }
+            Entry::Vacant(entry) => {
+                entry.insert(VecDeque::from([cond]));
+                true
+            }
+        }
+    }
+
+    /// Pop the next syscall condition waiting for the exclusive wakeup for the file with canonical
+    /// handle `file_handle` and the file state `state`, or NULL if there are none. The caller takes
+    /// the reference that was held by the wait queue.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn host_popExclusiveWakeup(
+        hostrc: *const Host,
+        file_handle: libc::uintptr_t,
+        state: FileState,
+    ) -> *mut cshadow::SysCallCondition {
+        let hostrc = unsafe { hostrc.as_ref().unwrap() };
+        let mut wakeups = hostrc.exclusive_wakeups.borrow_mut();
+        let key = (file_handle, state.bits());
+        let Some(queue) = wakeups.get_mut(&key) else {
+            return std::ptr::null_mut();
+        };
+        match queue.pop_front() {
+            Some(cond) => cond.ptr(),
+            None => {
+                // the task is done, so the next waiter needs a new task
+                wakeups.remove(&key);
+                std::ptr::null_mut()
+            }
+        }
+    }
+
     /// Returns the specified process, or NULL if it doesn't exist.
     #[unsafe(no_mangle)]
     pub unsafe extern "C-unwind" fn host_getProcess(
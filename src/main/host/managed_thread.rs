@@ -5,10 +5,11 @@
 use std::cell::{Cell, RefCell};
 use std::ffi::{CStr, CString};
 use std::io::Write;
-use std::os::fd::AsRawFd;
+use std::os::fd::{AsFd, AsRawFd, BorrowedFd};
 use std::os::unix::prelude::OsStrExt;
 use std::path::PathBuf;
 use std::sync::{Arc, atomic};
+use std::time::{Duration, Instant};
 
 use linux_api::errno::Errno;
 use linux_api::posix_types::Pid;
@@ -19,10 +20,12 @@ use rand::Rng as _;
 use rustix::pipe::PipeFlags;
 use rustix::process::WaitOptions;
 use shadow_shim_helper_rs::ipc::IPCData;
+use shadow_shim_helper_rs::option::FfiOption;
 use shadow_shim_helper_rs::shim_event::{
-    ShimEventAddThreadReq, ShimEventAddThreadRes, ShimEventStartRes, ShimEventSyscall,
-    ShimEventSyscallComplete, ShimEventToShadow, ShimEventToShim,
+    ShimEventAddThreadReq, ShimEventAddThreadRes, ShimEventStartReq, ShimEventStartRes,
+    ShimEventSyscall, ShimEventSyscallComplete, ShimEventToShadow, ShimEventToShim,
 };
+use shadow_shim_helper_rs::shim_shmem::ThreadShmem;
 use shadow_shim_helper_rs::syscall_types::{ForeignPtr, SyscallArgs, SyscallReg};
 use shadow_shmem::allocator::ShMemBlock;
 use vasi_sync::scchannel::SelfContainedChannelError;
@@ -30,10 +33,12 @@ use vasi_sync::scchannel::SelfContainedChannelError;
 use super::context::ThreadContext;
 use super::host::Host;
 use super::syscall::condition::SyscallCondition;
+use crate::core::profile::SyscallLatencies;
 use crate::core::worker::{WORKER_SHARED, Worker};
 use crate::cshadow;
 use crate::host::syscall::handler::SyscallHandler;
 use crate::host::syscall::types::{ForeignArrayPtr, SyscallReturn};
+use crate::utility::counter::Counter;
 use crate::utility::{VerifyPluginPathError, inject_preloads, syscall, verify_plugin_path};
 
 /// The ManagedThread's state after having been allowed to execute some code.
@@ -64,6 +69,9 @@ pub struct ManagedThread {
     // to AFFINITY_UNINIT if CPU pinning is not enabled or if the thread has
     // not yet been pinned to a CPU.
     affinity: Cell<i32>,
+
+    /// How long the plugin had control before returning with each syscall.
+    round_trip_latencies: RefCell<SyscallLatencies>,
 }
 
 impl ManagedThread {
@@ -101,6 +109,8 @@ impl ManagedThread {
         strace_file: Option<&std::fs::File>,
         log_file: &std::fs::File,
         injected_preloads: &[PathBuf],
+        ipc_spin_limit: u32,
+        collect_ipc_stats: bool,
     ) -> Result<Self, Errno> {
         debug!(
             "spawning new mthread '{plugin_path:?}' with environment '{envv:?}', arguments '{argv:?}'"
@@ -110,10 +120,25 @@ impl ManagedThread {
 
         debug!("env after preload injection: {envv:?}");
 
-        let ipc_shmem = Arc::new(shadow_shmem::allocator::shmalloc(IPCData::new()));
+        let ipc_shmem = Arc::new(shadow_shmem::allocator::shmalloc(IPCData::with_spin_limit(
+            ipc_spin_limit,
+            collect_ipc_stats,
+        )));
 
-        let child_pid =
-            Self::spawn_native(plugin_path, argv, envv, strace_file, log_file, &ipc_shmem)?;
+        Self::verify_plugin(plugin_path)?;
+
+        let zygote_pid = WORKER_SHARED
+            .borrow()
+            .as_ref()
+            .unwrap()
+            .zygotes()
+            .and_then(|zygotes| {
+                zygotes.spawn(plugin_path, &argv, &envv, strace_file, log_file, &ipc_shmem)
+            });
+        let child_pid = match zygote_pid {
+            Some(pid) => pid,
+            None => Self::spawn_native(plugin_path, argv, envv, strace_file, log_file, &ipc_shmem)?,
+        };
 
         // In Linux, the PID is equal to the TID of its first thread.
         let native_pid = child_pid;
@@ -184,6 +209,7 @@ impl ManagedThread {
             native_pid,
             native_tid,
             affinity: Cell::new(cshadow::AFFINITY_UNINIT),
+            round_trip_latencies: RefCell::new(SyscallLatencies::new()),
         })
     }
 
@@ -194,26 +220,33 @@ impl ManagedThread {
     ) -> ResumeResult {
         debug_assert!(self.is_running());
 
-        self.sync_affinity_with_worker();
+        self.sync_affinity_with_worker(ctx.host);
 
         // Flush any pending writes, e.g. from a previous mthread that exited
         // without flushing.
         ctx.process.free_unsafe_borrows_flush().unwrap();
 
         loop {
+            // write out what the shim logged since it last returned control to us
+            if !ctx.thread.shmem().shim_log.is_empty() {
+                ctx.process.drain_shim_log(ctx.thread.shmem());
+            }
+
             let mut current_event = self.current_event.borrow_mut();
             let last_event = *current_event;
             *current_event = match last_event {
                 ShimEventToShadow::StartReq(start_req) => {
-                    // Write the serialized thread shmem handle directly to shim
-                    // memory.
-                    ctx.process
-                        .memory_borrow_mut()
-                        .write(
-                            start_req.thread_shmem_block_to_init,
-                            &ctx.thread.shmem().serialize(),
-                        )
-                        .unwrap();
+                    if !start_req.thread_shmem_block_to_init.is_null() {
+                        // Write the serialized thread shmem handle directly to
+                        // shim memory.
+                        ctx.process
+                            .memory_borrow_mut()
+                            .write(
+                                start_req.thread_shmem_block_to_init,
+                                &ctx.thread.shmem().serialize(),
+                            )
+                            .unwrap();
+                    }
 
                     if !start_req.process_shmem_block_to_init.is_null() {
                         // Write the serialized process shmem handle directly to
@@ -355,6 +388,12 @@ impl ManagedThread {
     /// `ManagedThread` object to manage it. The new thread will be managed
     /// by Shadow, and suitable for use with `Thread::wrap_mthread`.
     ///
+    /// `thread_shmem` is the shared memory of the new thread. A new thread in the
+    /// same process (`CLONE_THREAD`) is given it, and its process's shared
+    /// memory, with the clone request, so that it doesn't need to send us a
+    /// start request before it can run. We don't wait for such a thread to
+    /// start.
+    ///
     /// If the `clone` syscall fails, the native error is returned.
     pub fn native_clone(
         &self,
@@ -364,14 +403,30 @@ impl ManagedThread {
         ptid: ForeignPtr<libc::pid_t>,
         ctid: ForeignPtr<libc::pid_t>,
         newtls: libc::c_ulong,
+        thread_shmem: &ShMemBlock<ThreadShmem>,
     ) -> Result<ManagedThread, linux_api::errno::Errno> {
-        let child_ipc_shmem = Arc::new(shadow_shmem::allocator::shmalloc(IPCData::new()));
+        let child_ipc_shmem = Arc::new(shadow_shmem::allocator::shmalloc(
+            IPCData::with_spin_limit(self.ipc_shmem.spin_limit(), self.ipc_shmem.collects_stats()),
+        ));
+
+        let is_thread = flags.contains(CloneFlags::CLONE_THREAD);
+        let (thread_shmem_block, process_shmem_block) = if is_thread {
+            (
+                FfiOption::Some(thread_shmem.serialize()),
+                FfiOption::Some(ctx.process.shmem().serialize()),
+            )
+        } else {
+            // A new process's shared memory doesn't exist yet.
+            (FfiOption::None, FfiOption::None)
+        };
 
         // Send the IPC block for the new mthread to use.
         let clone_res: i64 = match self.continue_plugin(
             ctx.host,
             &ShimEventToShim::AddThreadReq(ShimEventAddThreadReq {
                 ipc_block: child_ipc_shmem.serialize(),
+                thread_shmem_block,
+                process_shmem_block,
                 flags: flags.bits(),
                 child_stack,
                 ptid: ptid.cast::<()>(),
@@ -386,23 +441,35 @@ impl ManagedThread {
         let child_native_tid = Pid::from_raw(libc::pid_t::from(clone_res)).unwrap();
         trace!("native clone treated tid {child_native_tid:?}");
 
-        trace!(
-            "waiting for start event from shim with native tid {:?}",
-            child_native_tid
-        );
-        let start_req = child_ipc_shmem.from_plugin().receive().unwrap();
-        match &start_req {
-            ShimEventToShadow::StartReq(_) => (),
-            other => panic!("Unexpected result from shim: {other:?}"),
+        let start_req = if is_thread {
+            // The thread already has everything it needs, and will wait for our
+            // start response when we first resume it.
+            ShimEventToShadow::StartReq(ShimEventStartReq {
+                thread_shmem_block_to_init: ForeignPtr::null(),
+                process_shmem_block_to_init: ForeignPtr::null(),
+                initial_working_dir_to_init: ForeignPtr::null(),
+                initial_working_dir_to_init_len: 0,
+            })
+        } else {
+            trace!(
+                "waiting for start event from shim with native tid {:?}",
+                child_native_tid
+            );
+            let start_req = child_ipc_shmem.from_plugin().receive().unwrap();
+            match &start_req {
+                ShimEventToShadow::StartReq(_) => (),
+                other => panic!("Unexpected result from shim: {other:?}"),
+            };
+            start_req
         };
 
-        let native_pid = if flags.contains(CloneFlags::CLONE_THREAD) {
+        let native_pid = if is_thread {
             self.native_pid
         } else {
             child_native_tid
         };
 
-        if !flags.contains(CloneFlags::CLONE_THREAD) {
+        if !is_thread {
             // Child is a new process; register it.
             WORKER_SHARED
                 .borrow()
@@ -434,6 +501,7 @@ impl ManagedThread {
             native_tid: child_native_tid,
             // TODO: can we assume it's inherited from the current thread affinity?
             affinity: Cell::new(cshadow::AFFINITY_UNINIT),
+            round_trip_latencies: RefCell::new(SyscallLatencies::new()),
         })
     }
 
@@ -445,16 +513,70 @@ impl ManagedThread {
         host.shim_shmem()
             .sim_time
             .store(Worker::current_time().unwrap(), atomic::Ordering::Relaxed);
+        if host.params.use_shim_futex_wake {
+            // the futexes only change while we're running the host, so the shim sees the same
+            // value for as long as it has control
+            host.shim_shmem().futex_waiters.store(
+                !host.futextable_borrow().is_empty(),
+                atomic::Ordering::Relaxed,
+            );
+        }
 
         // Release lock so that plugin can take it. Reacquired in `wait_for_next_event`.
         host.unlock_shmem();
 
+        // Measure how long the plugin had control when counting syscalls, and also how much of
+        // that time it spent running when profiling.
+        let profiling = host.profiler_borrow_mut().is_some();
+        let start = (profiling || host.params.use_syscall_counters).then(|| {
+            let cpu_start = profiling.then(|| self.native_process_cpu_time());
+            (Instant::now(), cpu_start)
+        });
+
+        usdt_probe!(
+            ipc_send,
+            host.id(),
+            Worker::current_time(),
+            self.native_tid.as_raw_nonzero().get()
+        );
         self.ipc_shmem.to_plugin().send(*event);
 
         let event = match self.ipc_shmem.from_plugin().receive() {
             Ok(e) => e,
             Err(SelfContainedChannelError::WriterIsClosed) => ShimEventToShadow::ProcessDeath,
         };
+        usdt_probe!(
+            ipc_recv,
+            host.id(),
+            Worker::current_time(),
+            self.native_tid.as_raw_nonzero().get()
+        );
+
+        if let Some((start, cpu_start)) = start {
+            let wall_time = start.elapsed();
+
+            if let (true, ShimEventToShadow::Syscall(syscall)) =
+                (host.params.use_syscall_counters, &event)
+            {
+                // the syscall handler rejects negative syscall numbers
+                if let Ok(num) = usize::try_from(syscall.syscall_args.number) {
+                    self.round_trip_latencies.borrow_mut().add(num, wall_time);
+                }
+            }
+
+            if let Some(cpu_start) = cpu_start {
+                // the process may have exited, in which case we can't read its cpu time
+                let cpu_time = match (cpu_start, self.native_process_cpu_time()) {
+                    (Some(cpu_start), Some(cpu_end)) => cpu_end.saturating_sub(cpu_start),
+                    _ => Duration::ZERO,
+                };
+                host.profiler_borrow_mut().unwrap().add_round_trip(
+                    self.native_pid,
+                    wall_time,
+                    cpu_time,
+                );
+            }
+        }
 
         // Reacquire the shared memory lock, now that the shim has yielded control
         // back to us.
@@ -476,6 +598,26 @@ impl ManagedThread {
         event
     }
 
+    /// The total CPU time used by the native process, or `None` if it can't be read (for example if
+    /// the process has exited).
+    fn native_process_cpu_time(&self) -> Option<Duration> {
+        // The clock id of a process's cpu-time clock, as computed by glibc's
+        // `clock_getcpuclockid` (`MAKE_PROCESS_CPUCLOCK(pid, CPUCLOCK_SCHED)`).
+        let clock_id = (!self.native_pid.as_raw_nonzero().get() << 3) | 2;
+
+        let mut ts = libc::timespec {
+            tv_sec: 0,
+            tv_nsec: 0,
+        };
+        if unsafe { libc::clock_gettime(clock_id, &mut ts) } != 0 {
+            return None;
+        }
+        Some(Duration::new(
+            ts.tv_sec.try_into().ok()?,
+            ts.tv_nsec.try_into().ok()?,
+        ))
+    }
+
     /// To be called after we expect the native thread to have exited, or to
     /// exit imminently.
     fn cleanup_after_exit_initiated(&self) {
@@ -540,10 +682,25 @@ impl ManagedThread {
         }
     }
 
-    fn sync_affinity_with_worker(&self) {
+    fn sync_affinity_with_worker(&self, host: &Host) {
+        // the managed processes can't run on the worker CPUs
+        if host
+            .params
+            .cgroup
+            .as_ref()
+            .is_some_and(|x| x.restricts_cpus())
+        {
+            return;
+        }
+
         let current_affinity = scheduler::core_affinity()
             .map(|x| i32::try_from(x).unwrap())
             .unwrap_or(cshadow::AFFINITY_UNINIT);
+        let current_affinity = if host.params.use_smt_sibling_affinity {
+            smt_sibling_affinity(current_affinity)
+        } else {
+            current_affinity
+        };
         self.affinity.set(unsafe {
             cshadow::affinity_setProcessAffinity(
                 self.native_tid().as_raw_nonzero().get(),
@@ -553,14 +710,8 @@ impl ManagedThread {
         });
     }
 
-    fn spawn_native(
-        plugin_path: &CStr,
-        argv: Vec<CString>,
-        envv: Vec<CString>,
-        strace_file: Option<&std::fs::File>,
-        shimlog_file: &std::fs::File,
-        shmem_block: &ShMemBlock<IPCData>,
-    ) -> Result<Pid, Errno> {
+    /// Check that `plugin_path` can be spawned.
+    pub(crate) fn verify_plugin(plugin_path: &CStr) -> Result<(), Errno> {
         // Preemptively check for likely reasons that execve might fail.
         // In particular we want to ensure that we  don't launch a statically
         // linked executable, since we'd then deadlock the whole simulation
@@ -593,8 +744,62 @@ impl ManagedThread {
             }
         }
         verify_plugin_path(std::ffi::OsStr::from_bytes(plugin_path.to_bytes()))
-            .map_err(map_verify_err)?;
+            .map_err(map_verify_err)
+    }
 
+    fn spawn_native(
+        plugin_path: &CStr,
+        argv: Vec<CString>,
+        envv: Vec<CString>,
+        strace_file: Option<&std::fs::File>,
+        shimlog_file: &std::fs::File,
+        shmem_block: &ShMemBlock<IPCData>,
+    ) -> Result<Pid, Errno> {
+        // Set up stdin
+        let (stdin_reader, stdin_writer) = rustix::pipe::pipe_with(PipeFlags::CLOEXEC).unwrap();
+
+        let child_pid_res = Self::posix_spawn(
+            plugin_path,
+            argv,
+            envv,
+            strace_file,
+            shimlog_file,
+            stdin_reader.as_fd(),
+        );
+
+        // Write the serialized shmem descriptor to the stdin pipe. The pipe
+        // buffer should be large enough that we can write it all without having
+        // to wait for data to be read.
+        if child_pid_res.is_ok() {
+            // we avoid using the rustix write wrapper here, since we can't guarantee
+            // that all bytes of the serialized shmem block are initd, and hence
+            // can't safely construct the &[u8] that it wants.
+            let serialized = shmem_block.serialize();
+            let serialized_bytes = shadow_pod::as_u8_slice(&serialized);
+            let written = Errno::result_from_libc_errno(-1, unsafe {
+                libc::write(
+                    stdin_writer.as_raw_fd(),
+                    serialized_bytes.as_ptr().cast(),
+                    serialized_bytes.len(),
+                )
+            })
+            .unwrap();
+            // TODO: loop if needed. Shouldn't be in practice, though.
+            assert_eq!(written, isize::try_from(serialized_bytes.len()).unwrap());
+        }
+
+        child_pid_res
+    }
+
+    /// Spawn `plugin_path` with `stdin` as its stdin, and the shim log as its stdout and stderr.
+    pub(crate) fn posix_spawn(
+        plugin_path: &CStr,
+        argv: Vec<CString>,
+        envv: Vec<CString>,
+        strace_file: Option<&std::fs::File>,
+        shimlog_file: &std::fs::File,
+        stdin: BorrowedFd,
+    ) -> Result<Pid, Errno> {
         // posix_spawn is documented as taking pointers to *mutable* char for argv and
         // envv. It *probably* doesn't actually mutate them, but we
         // conservatively give it what it asks for. We have to "reconstitute"
@@ -619,11 +824,10 @@ impl ManagedThread {
         .unwrap();
 
         // Set up stdin
-        let (stdin_reader, stdin_writer) = rustix::pipe::pipe_with(PipeFlags::CLOEXEC).unwrap();
         Errno::result_from_libc_errnum(unsafe {
             libc::posix_spawn_file_actions_adddup2(
                 &mut file_actions,
-                stdin_reader.as_raw_fd(),
+                stdin.as_raw_fd(),
                 libc::STDIN_FILENO,
             )
         })
@@ -712,27 +916,6 @@ impl ManagedThread {
             .map(|_| Pid::from_raw(child_pid).unwrap_or_else(|| panic!("Invalid pid: {child_pid}")))
         };
 
-        // Write the serialized shmem descriptor to the stdin pipe. The pipe
-        // buffer should be large enough that we can write it all without having
-        // to wait for data to be read.
-        if child_pid_res.is_ok() {
-            // we avoid using the rustix write wrapper here, since we can't guarantee
-            // that all bytes of the serialized shmem block are initd, and hence
-            // can't safely construct the &[u8] that it wants.
-            let serialized = shmem_block.serialize();
-            let serialized_bytes = shadow_pod::as_u8_slice(&serialized);
-            let written = Errno::result_from_libc_errno(-1, unsafe {
-                libc::write(
-                    stdin_writer.as_raw_fd(),
-                    serialized_bytes.as_ptr().cast(),
-                    serialized_bytes.len(),
-                )
-            })
-            .unwrap();
-            // TODO: loop if needed. Shouldn't be in practice, though.
-            assert_eq!(written, isize::try_from(serialized_bytes.len()).unwrap());
-        }
-
         Errno::result_from_libc_errnum(unsafe {
             libc::posix_spawn_file_actions_destroy(&mut file_actions)
         })
@@ -782,6 +965,36 @@ impl ManagedThread {
     }
 }
 
+thread_local! {
+    /// The worker thread's CPU and the CPU that its managed threads are pinned to when they're
+    /// placed on the worker's SMT sibling. A worker thread's CPU doesn't change, so the sibling is
+    /// only looked up once.
+    static SMT_SIBLING_AFFINITY: Cell<Option<(i32, i32)>> = const { Cell::new(None) };
+}
+
+/// The CPU to pin managed threads to when placing them on an SMT sibling of `worker_cpu`. This is
+/// `worker_cpu` itself if it doesn't have a sibling without a worker.
+fn smt_sibling_affinity(worker_cpu: i32) -> i32 {
+    if worker_cpu == cshadow::AFFINITY_UNINIT {
+        return worker_cpu;
+    }
+
+    SMT_SIBLING_AFFINITY.with(|cached| {
+        if let Some((cpu, sibling)) = cached.get() {
+            if cpu == worker_cpu {
+                return sibling;
+            }
+        }
+
+        let sibling = match unsafe { cshadow::affinity_getSmtSibling(worker_cpu) } {
+            cshadow::AFFINITY_UNINIT => worker_cpu,
+            sibling => sibling,
+        };
+        cached.set(Some((worker_cpu, sibling)));
+        sibling
+    })
+}
+
 impl Drop for ManagedThread {
     fn drop(&mut self) {
         // Dropping while the thread is running is unsound because the running
@@ -790,5 +1003,21 @@ impl Drop for ManagedThread {
         // running thread accessing a deallocated or repurposed memory region
         // can cause numerous problems.
         assert!(!self.is_running());
+
+        // Record how each side of the IPC channel received its messages. The shim's side of the
+        // channel lives in the same shared memory, so we can read its counters here too.
+        if self.ipc_shmem.collects_stats() {
+            let shadow_stats = self.ipc_shmem.from_plugin().stats();
+            let shim_stats = self.ipc_shmem.from_shadow().stats();
+            let mut counts = Counter::new();
+            counts.add_value("shadow_receive_ready", shadow_stats.ready as i64);
+            counts.add_value("shadow_receive_spun", shadow_stats.spun as i64);
+            counts.add_value("shadow_receive_slept", shadow_stats.slept as i64);
+            counts.add_value("shim_receive_ready", shim_stats.ready as i64);
+            counts.add_value("shim_receive_spun", shim_stats.spun as i64);
+            counts.add_value("shim_receive_slept", shim_stats.slept as i64);
+            Worker::add_ipc_counts(&counts);
+        }
+        Worker::add_round_trip_latencies(&self.round_trip_latencies.borrow());
     }
 }
@@ -122,6 +122,35 @@ impl MemoryCopier {
         Ok(())
     }
 
+    // Copy each of `srcs` into the corresponding buffer in `dsts`, which must
+    // have the same length. Uses as few syscalls as possible.
+    /// SAFETY: A mutable reference to the process memory must not exist.
+    pub unsafe fn copy_from_ptrs(
+        &self,
+        dsts: &mut [&mut [u8]],
+        srcs: &[ForeignArrayPtr<u8>],
+    ) -> Result<(), Errno> {
+        assert_eq!(dsts.len(), srcs.len());
+
+        // process_vm_readv accepts at most `UIO_MAXIOV` iovecs on each side
+        let max_iovs: usize = libc::UIO_MAXIOV.try_into().unwrap();
+
+        for (dsts, srcs) in dsts.chunks_mut(max_iovs).zip(srcs.chunks(max_iovs)) {
+            let len = srcs.iter().map(|src| src.len()).sum::<usize>();
+            for (dst, src) in dsts.iter().zip(srcs) {
+                assert_eq!(dst.len(), src.len());
+            }
+
+            let bytes_read = unsafe { self.readv_ptrs(dsts, srcs)? };
+            if bytes_read != len {
+                warn!("Tried to read {len} bytes but only got {bytes_read}");
+                return Err(Errno::EFAULT);
+            }
+        }
+
+        Ok(())
+    }
+
     // Low level helper for reading directly from `srcs` to `dsts`.
     // Returns the number of bytes read. Panics if the
     // MemoryManager's process isn't currently active.
@@ -217,6 +246,41 @@ impl MemoryCopier {
             len: towrite,
         }];
 
+        let nwritten = unsafe { self.writev_iovecs(&local, &remote)? };
+        // There shouldn't be any partial writes with a single remote iovec.
+        assert_eq!(nwritten, towrite);
+        Ok(())
+    }
+
+    // Low level helper for writing directly from `srcs` to `dsts`, using a single syscall.
+    // Returns the number of bytes written, which may be less than the total length if some of the
+    // `dsts` are invalid. Panics if the MemoryManager's process isn't currently active.
+    /// SAFETY: A reference to the process memory must not exist.
+    pub unsafe fn writev_ptrs(
+        &self,
+        dsts: &[ForeignArrayPtr<u8>],
+        srcs: &[std::io::IoSlice],
+    ) -> Result<usize, Errno> {
+        let dsts: Vec<_> = dsts
+            .iter()
+            .map(|dst| nix::sys::uio::RemoteIoVec {
+                base: usize::from(dst.ptr()),
+                len: dst.len(),
+            })
+            .collect();
+
+        unsafe { self.writev_iovecs(srcs, &dsts) }
+    }
+
+    // Low level helper for writing directly from `srcs` to `dsts`.
+    // Returns the number of bytes written. Panics if the
+    // MemoryManager's process isn't currently active.
+    /// SAFETY: A reference to the process memory must not exist.
+    unsafe fn writev_iovecs(
+        &self,
+        srcs: &[std::io::IoSlice],
+        dsts: &[nix::sys::uio::RemoteIoVec],
+    ) -> Result<usize, Errno> {
         // While the documentation for process_vm_writev says to use the pid, in
         // practice it needs to be the tid of a still-running thread. i.e. using the
         // pid after the thread group leader has exited will fail.
@@ -246,12 +310,11 @@ impl MemoryCopier {
 
         let nwritten = nix::sys::uio::process_vm_writev(
             nix::unistd::Pid::from_raw(tid.as_raw_nonzero().get()),
-            &local,
-            &remote,
+            srcs,
+            dsts,
         )
         .map_err(|e| Errno::try_from(e as i32).unwrap())?;
-        // There shouldn't be any partial writes with a single remote iovec.
-        assert_eq!(nwritten, towrite);
-        Ok(())
+
+        Ok(nwritten)
     }
 }
@@ -4,6 +4,7 @@ use std::ffi::CString;
 use std::fmt::Debug;
 use std::fs::File;
 use std::os::raw::c_void;
+use std::os::unix::fs::FileExt;
 use std::os::unix::io::AsRawFd;
 use std::path::PathBuf;
 use std::process;
@@ -31,6 +32,13 @@ use crate::utility::proc_maps::{MappingPath, Sharing};
 const HEAP_PROT: ProtFlags = ProtFlags::PROT_READ.union(ProtFlags::PROT_WRITE);
 /// Used when mapping stack regions.
 const STACK_PROT: ProtFlags = ProtFlags::PROT_READ.union(ProtFlags::PROT_WRITE);
+/// The size of a transparent huge page on x86-64.
+const HUGE_PAGE_SIZE: usize = 2 * (1 << 20); // 2 MB.
+
+/// File mappings larger than this aren't remapped on a miss, since remapping copies the whole
+/// mapping into the shared memory file. Large read-only files such as locale archives are often
+/// mapped but rarely accessed by Shadow.
+const MAX_REMAPPED_FILE_MAPPING_LEN: usize = 16 * (1 << 20); // 16 MB.
 
 // Represents a region of plugin memory.
 #[derive(Clone, Debug, Eq, PartialEq)]
@@ -41,6 +49,8 @@ struct Region {
     sharing: proc_maps::Sharing,
     // The *original* path. Not the path to our mem file.
     original_path: Option<proc_maps::MappingPath>,
+    // Whether we tried and failed to remap the region into Shadow after a miss.
+    remap_failed: bool,
 }
 
 // Safety: The Region owns the shadow_base pointer, and the mapper enforces
@@ -87,10 +97,18 @@ pub struct MemoryMapper {
 
     misses_by_path: RefCell<HashMap<String, u32>>,
 
+    /// The start addresses of regions that had a miss and should be remapped into Shadow by
+    /// [`remap_missed_regions`](Self::remap_missed_regions).
+    missed_regions: RefCell<Vec<usize>>,
+
     /// The bounds of the heap. Note that before the plugin's first `brk` syscall this will be a
     /// zero-sized interval (though in the case of thread-preload that'll have already happened
     /// before we get control).
     heap: Interval,
+
+    /// Whether to leave read-only private file mappings in the page cache (where they're shared
+    /// with other processes that map the same file) rather than remapping them after a miss.
+    share_readonly_file_mappings: bool,
 }
 
 /// Shared memory file into which we relocate parts of the plugin's address space.
@@ -99,9 +117,57 @@ struct ShmFile {
     shm_file: File,
     shm_plugin_fd: i32,
     len: usize,
+    /// Whether to ask the kernel to back mappings of the file with transparent huge pages.
+    huge_pages: bool,
 }
 
 impl ShmFile {
+    /// Create an empty file for the process, and open it in the plugin.
+    fn new(memory_manager: &mut MemoryManager, ctx: &ThreadContext) -> Self {
+        let shm_name = CString::new(format!(
+            "shadow_memory_manager_{}_{:?}_{}",
+            process::id(),
+            ctx.thread.host_id(),
+            u32::from(ctx.process.id())
+        ))
+        .unwrap();
+        let raw_file = rustix::fs::memfd_create(&shm_name, MemfdFlags::CLOEXEC).unwrap();
+        let shm_file = File::from(raw_file);
+
+        // Other processes can open the file via /proc.
+        let shm_path = format!("/proc/{}/fd/{}\0", process::id(), shm_file.as_raw_fd());
+
+        let shm_plugin_fd = {
+            let (ctx, thread) = ctx.split_thread();
+            let path_buf_foreign_ptr = ForeignArrayPtr::new(
+                thread.malloc_foreign_ptr(&ctx, shm_path.len()).unwrap(),
+                shm_path.len(),
+            );
+            memory_manager
+                .copy_to_ptr(path_buf_foreign_ptr, shm_path.as_bytes())
+                .unwrap();
+            let shm_plugin_fd = thread
+                .native_open(
+                    &ctx,
+                    path_buf_foreign_ptr.ptr(),
+                    libc::O_RDWR | libc::O_CLOEXEC,
+                    0,
+                )
+                .unwrap();
+            thread
+                .free_foreign_ptr(&ctx, path_buf_foreign_ptr.ptr(), path_buf_foreign_ptr.len())
+                .unwrap();
+            shm_plugin_fd
+        };
+
+        ShmFile {
+            shm_file,
+            shm_plugin_fd,
+            len: 0,
+            huge_pages: ctx.host.params.use_mem_mapper_huge_pages,
+        }
+    }
+
     /// Allocate space in the file for the given interval.
     fn alloc(&mut self, interval: &Interval) {
         let needed_len = interval.end;
@@ -126,8 +192,55 @@ impl ShmFile {
         .unwrap();
     }
 
+    /// Copy the contents of `src` into this file, which must be empty. The copy is done within
+    /// the kernel, and skips the holes in `src` so that unallocated space stays unallocated.
+    fn copy_from(&mut self, src: &ShmFile) {
+        assert_eq!(self.len, 0);
+        self.alloc(&(0..src.len));
+
+        let mut offset = 0;
+        while offset < src.len {
+            let start = match rustix::fs::seek(
+                &src.shm_file,
+                rustix::fs::SeekFrom::Data(i64::try_from(offset).unwrap()),
+            ) {
+                Ok(start) => start,
+                // no more data
+                Err(rustix::io::Errno::NXIO) => break,
+                Err(e) => panic!("lseek(SEEK_DATA): {e}"),
+            };
+            let end = rustix::fs::seek(
+                &src.shm_file,
+                rustix::fs::SeekFrom::Hole(i64::try_from(start).unwrap()),
+            )
+            .unwrap();
+
+            let mut src_offset = start;
+            let mut dst_offset = start;
+            while src_offset < end {
+                let len = usize::try_from(end - src_offset).unwrap();
+                let copied = rustix::fs::copy_file_range(
+                    &src.shm_file,
+                    Some(&mut src_offset),
+                    &self.shm_file,
+                    Some(&mut dst_offset),
+                    len,
+                )
+                .unwrap();
+                assert_ne!(copied, 0);
+            }
+            offset = usize::try_from(end).unwrap();
+        }
+    }
+
     /// Map the given interval of the file into shadow's address space.
     fn mmap_into_shadow(&self, interval: &Interval, prot: ProtFlags) -> *mut c_void {
+        if self.huge_pages {
+            if let Some(ptr) = self.mmap_into_shadow_huge(interval, prot) {
+                return ptr;
+            }
+        }
+
         unsafe {
             linux_api::mman::mmap(
                 std::ptr::null_mut(),
@@ -141,6 +254,59 @@ impl ShmFile {
         .unwrap()
     }
 
+    /// Like [`mmap_into_shadow`](Self::mmap_into_shadow), but maps the interval at an address that
+    /// is congruent to its file offset modulo the huge page size, and asks the kernel to use huge
+    /// pages. The kernel can only use huge pages for a file mapping at such an address.
+    fn mmap_into_shadow_huge(&self, interval: &Interval, prot: ProtFlags) -> Option<*mut c_void> {
+        // Reserve enough address space to contain an aligned mapping.
+        let reserve_len = interval.len() + HUGE_PAGE_SIZE;
+        let reserved = unsafe {
+            linux_api::mman::mmap(
+                std::ptr::null_mut(),
+                reserve_len,
+                ProtFlags::PROT_NONE,
+                MapFlags::MAP_PRIVATE | MapFlags::MAP_ANONYMOUS | MapFlags::MAP_NORESERVE,
+                -1,
+                0,
+            )
+        }
+        .ok()?;
+
+        let reserved_start = reserved as usize;
+        let reserved_end = reserved_start + reserve_len;
+        let mut start =
+            reserved_start - reserved_start % HUGE_PAGE_SIZE + interval.start % HUGE_PAGE_SIZE;
+        if start < reserved_start {
+            start += HUGE_PAGE_SIZE;
+        }
+        let end = start + interval.len();
+        debug_assert!(end <= reserved_end);
+
+        // Replace part of the reservation with the mapping, and release the rest.
+        let ptr = unsafe {
+            linux_api::mman::mmap(
+                start as *mut c_void,
+                interval.len(),
+                prot,
+                MapFlags::MAP_SHARED | MapFlags::MAP_FIXED,
+                self.shm_file.as_raw_fd(),
+                interval.start,
+            )
+        }
+        .unwrap();
+        for unused in [reserved_start..start, end..reserved_end] {
+            if !unused.is_empty() {
+                unsafe { linux_api::mman::munmap(unused.start as *mut c_void, unused.len()) }
+                    .unwrap_or_else(|e| warn!("munmap: {}", e));
+            }
+        }
+
+        unsafe { rustix::mm::madvise(ptr, interval.len(), rustix::mm::Advice::LinuxHugepage) }
+            .unwrap_or_else(|e| debug!("madvise(MADV_HUGEPAGE): {e}"));
+
+        Some(ptr)
+    }
+
     /// Copy data from the plugin's address space into the file. `interval` must be contained within
     /// `region_interval`. It can be the whole region, but notably for the stack we only copy in
     /// the part of the stack that's already allocated and initialized.
@@ -151,8 +317,22 @@ impl ShmFile {
         region: &Region,
         interval: &Interval,
     ) {
+        self.try_copy_into_file(memory_manager, region_interval, region, interval)
+            .unwrap()
+    }
+
+    /// Like [`copy_into_file`](Self::copy_into_file), but returns an error if the plugin's memory
+    /// couldn't be read (for example the part of a file mapping that extends beyond the end of the
+    /// file).
+    fn try_copy_into_file(
+        &self,
+        memory_manager: &MemoryManager,
+        region_interval: &Interval,
+        region: &Region,
+        interval: &Interval,
+    ) -> Result<(), Errno> {
         if interval.is_empty() {
-            return;
+            return Ok(());
         }
         assert!(!region.shadow_base.is_null());
         assert!(region_interval.contains(&interval.start));
@@ -165,23 +345,23 @@ impl ShmFile {
             )
         };
 
-        memory_manager
-            .copy_from_ptr(
-                dst,
-                ForeignArrayPtr::new(
-                    ForeignPtr::from(interval.start).cast::<u8>(),
-                    interval.len(),
-                ),
-            )
-            .unwrap()
+        memory_manager.copy_from_ptr(
+            dst,
+            ForeignArrayPtr::new(
+                ForeignPtr::from(interval.start).cast::<u8>(),
+                interval.len(),
+            ),
+        )
     }
 
     /// Map the given range of the file into the plugin's address space.
     fn mmap_into_plugin(&self, ctx: &ThreadContext, interval: &Interval, prot: ProtFlags) {
+        let pctx = ProcessContext::new(ctx.host, ctx.process);
+        let addr = ForeignPtr::from(interval.start).cast::<u8>();
         ctx.thread
             .native_mmap(
-                &ProcessContext::new(ctx.host, ctx.process),
-                ForeignPtr::from(interval.start).cast::<u8>(),
+                &pctx,
+                addr,
                 interval.len(),
                 prot,
                 MapFlags::MAP_SHARED | MapFlags::MAP_FIXED,
@@ -189,13 +369,47 @@ impl ShmFile {
                 interval.start as i64,
             )
             .unwrap();
+
+        if self.huge_pages {
+            // The file offset is the same as the address, so the plugin's mapping is always
+            // suitably aligned.
+            ctx.thread
+                .native_madvise(&pctx, addr, interval.len(), libc::MADV_HUGEPAGE)
+                .unwrap_or_else(|e| debug!("madvise(MADV_HUGEPAGE): {e}"));
+        }
     }
 }
 
-/// Get the current mapped regions of the process.
-fn get_regions(pid: Pid) -> IntervalMap<Region> {
+/// Warn if the kernel won't use transparent huge pages for shared memory even when asked to.
+fn check_shmem_huge_pages() {
+    const PATH: &str = "/sys/kernel/mm/transparent_hugepage/shmem_enabled";
+
+    // The current setting is in brackets, e.g. "always within_size [advise] never deny force".
+    let setting = std::fs::read_to_string(PATH).ok().and_then(|s| {
+        let start = s.find('[')?;
+        let end = s.find(']')?;
+        Some(s[start + 1..end].to_string())
+    });
+
+    match setting.as_deref() {
+        Some("always" | "within_size" | "advise" | "force") => {}
+        Some(setting) => warn_once_then_debug!(
+            "Huge pages were requested for the memory manager, but {PATH} is '{setting}'"
+        ),
+        None => warn_once_then_debug!(
+            "Huge pages were requested for the memory manager, but couldn't read {PATH}"
+        ),
+    }
+}
+
+/// The number of distinct maps files whose regions each thread keeps in [`get_regions`].
+const REGIONS_CACHE_LEN: usize = 8;
+
+/// Parse the regions in the contents of a /proc/\[pid\]/maps file.
+fn parse_regions(maps: &str) -> IntervalMap<Region> {
     let mut regions = IntervalMap::new();
-    for mapping in proc_maps::mappings_for_pid(pid.as_raw_nonzero().get()).unwrap() {
+    for mapping in proc_maps::parse_mappings(maps) {
+        let mapping = mapping.unwrap();
         let mut prot = ProtFlags::empty();
         if mapping.read {
             prot |= ProtFlags::PROT_READ;
@@ -213,6 +427,7 @@ fn get_regions(pid: Pid) -> IntervalMap<Region> {
                 prot,
                 sharing: mapping.sharing,
                 original_path: mapping.path,
+                remap_failed: false,
             },
         );
         // Regions shouldn't overlap.
@@ -221,6 +436,37 @@ fn get_regions(pid: Pid) -> IntervalMap<Region> {
     regions
 }
 
+/// Get the current mapped regions of the process, coalesced with [`coalesce_regions`].
+///
+/// Since address space randomization is disabled for managed processes, processes started from
+/// the same binary with the same environment usually have identical maps files when the memory
+/// mapper is created. Each thread keeps the regions of the maps files that it most recently
+/// parsed, so that these processes only need to read their maps file and not parse it again.
+fn get_regions(pid: Pid) -> IntervalMap<Region> {
+    thread_local! {
+        static MAPS_BUF: RefCell<String> = const { RefCell::new(String::new()) };
+        static CACHE: RefCell<Vec<(String, IntervalMap<Region>)>> =
+            const { RefCell::new(Vec::new()) };
+    }
+
+    MAPS_BUF.with_borrow_mut(|maps| {
+        proc_maps::read_maps_for_pid(pid.as_raw_nonzero().get(), maps).unwrap();
+
+        CACHE.with_borrow_mut(|cache| {
+            if let Some(i) = cache.iter().position(|(cached, _)| cached == maps) {
+                // move it to the front, so that the least recently used entry is last
+                cache[..=i].rotate_right(1);
+                return cache[0].1.clone();
+            }
+
+            let regions = coalesce_regions(parse_regions(maps));
+            cache.truncate(REGIONS_CACHE_LEN - 1);
+            cache.insert(0, (maps.clone(), regions.clone()));
+            regions
+        })
+    })
+}
+
 /// Find the heap range, and map it if non-empty.
 fn get_heap(
     ctx: &ThreadContext,
@@ -317,6 +563,159 @@ fn map_stack(
     }
 }
 
+/// Whether a region that isn't mapped into Shadow can be remapped into the shared memory file.
+///
+/// We only remap private mappings, since the plugin wouldn't see changes made through other
+/// mappings of a shared region after it was remapped. We don't remap executable mappings; Shadow
+/// rarely accesses them, and moving code into the memory file would hide where it came from in
+/// the process's maps. We also skip regions the plugin can't read, since we couldn't copy them.
+fn is_remappable(interval: &Interval, region: &Region) -> bool {
+    if !region.shadow_base.is_null() || region.remap_failed {
+        return false;
+    }
+    if region.sharing != Sharing::Private
+        || !region.prot.contains(ProtFlags::PROT_READ)
+        || region.prot.contains(ProtFlags::PROT_EXEC)
+    {
+        return false;
+    }
+    match &region.original_path {
+        // private anonymous mappings
+        None => true,
+        // private file mappings
+        Some(MappingPath::Path(_)) => interval.len() <= MAX_REMAPPED_FILE_MAPPING_LEN,
+        // the heap and stack are mapped separately, and the kernel's special mappings (e.g.
+        // vdso) can't be moved
+        Some(_) => false,
+    }
+}
+
+/// Whether the region is a private file mapping that the plugin can't write to. Until the plugin
+/// makes it writable, its pages stay in the kernel's page cache and are shared with every other
+/// process that maps the same file.
+fn is_readonly_file_mapping(region: &Region) -> bool {
+    matches!(region.original_path, Some(MappingPath::Path(_)))
+        && region.sharing == Sharing::Private
+        && !region.prot.contains(ProtFlags::PROT_WRITE)
+}
+
+/// Returns the stack pointer of the native thread `tid` if it's blocked in a syscall (for example
+/// while the shim waits for Shadow), or `None` if it isn't or we can't tell.
+fn blocked_stack_pointer(tid: Pid) -> Option<usize> {
+    // See proc(5). If the thread is blocked in a syscall, the fields are the syscall number, its
+    // six arguments, the stack pointer, and the program counter.
+    let syscall =
+        std::fs::read_to_string(format!("/proc/{}/syscall", tid.as_raw_nonzero().get())).ok()?;
+    let sp = syscall.split_whitespace().nth(7)?;
+    usize::from_str_radix(sp.strip_prefix("0x")?, 16).ok()
+}
+
+/// Returns the runs of pages in `interval` of process `pid` that are private anonymous memory
+/// rather than pages of the mapped file, such as the pages of a private file mapping that the
+/// process wrote to after mapping it. Returns `None` if the process's pagemap can't be read.
+fn private_pages(pid: Pid, interval: &Interval) -> Option<Vec<Interval>> {
+    // See the kernel's Documentation/admin-guide/mm/pagemap.rst. Each page has a 64-bit entry.
+    const PRESENT: u64 = 1 << 63;
+    const SWAPPED: u64 = 1 << 62;
+    const FILE_OR_SHARED_ANON: u64 = 1 << 61;
+
+    let pagemap = File::open(format!("/proc/{}/pagemap", pid.as_raw_nonzero().get())).ok()?;
+    let page_size = page_size();
+    let mut entries = vec![0u8; interval.len() / page_size * 8];
+    let offset = u64::try_from(interval.start / page_size * 8).unwrap();
+    pagemap.read_exact_at(&mut entries, offset).ok()?;
+
+    let mut runs: Vec<Interval> = Vec::new();
+    for (i, entry) in entries.chunks_exact(8).enumerate() {
+        let entry = u64::from_ne_bytes(entry.try_into().unwrap());
+        if entry & (PRESENT | SWAPPED) == 0 || entry & FILE_OR_SHARED_ANON != 0 {
+            continue;
+        }
+        let page = interval.start + i * page_size;
+        match runs.last_mut() {
+            Some(run) if run.end == page => run.end += page_size,
+            _ => runs.push(page..page + page_size),
+        }
+    }
+    Some(runs)
+}
+
+/// Move the region at `interval` into the shared memory file, copying in its current contents.
+/// Returns false and leaves the region unmapped if its contents couldn't be read.
+///
+/// The region must not contain the stack that `ctx`'s thread is running on. The thread remaps the
+/// region itself after we copy its contents, so anything it writes to its stack in between
+/// (including the return address of the `mmap` call) would be lost.
+fn remap_region(
+    ctx: &ThreadContext,
+    shm_file: &mut ShmFile,
+    memory_manager: &MemoryManager,
+    regions: &mut IntervalMap<Region>,
+    interval: &Interval,
+) -> bool {
+    let mut region = regions.get(interval.start).unwrap().1.clone();
+    trace!(
+        "Remapping region {:x}-{:x} {:?}",
+        interval.start, interval.end, region
+    );
+
+    shm_file.alloc(interval);
+    // we need to write to the region to copy in its contents, even if the plugin can't
+    let rw_prot = ProtFlags::PROT_READ | ProtFlags::PROT_WRITE;
+    region.shadow_base = shm_file.mmap_into_shadow(interval, rw_prot);
+
+    if let Err(e) = shm_file.try_copy_into_file(memory_manager, interval, &region, interval) {
+        debug!(
+            "Couldn't copy region {:x}-{:x} into the memory file: {e}",
+            interval.start, interval.end
+        );
+        unsafe { linux_api::mman::munmap(region.shadow_base, interval.len()) }
+            .unwrap_or_else(|e| warn!("munmap: {}", e));
+        shm_file.dealloc(interval);
+        return false;
+    }
+
+    if region.prot != rw_prot {
+        unsafe { linux_api::mman::mprotect(region.shadow_base, interval.len(), region.prot) }
+            .unwrap_or_else(|e| warn!("mprotect: {}", e));
+    }
+    shm_file.mmap_into_plugin(ctx, interval, region.prot);
+
+    let mutations = regions.insert(interval.clone(), region);
+    // Should have overwritten the old region and not affected any others.
+    assert!(mutations.len() == 1);
+
+    true
+}
+
+/// Remap the private anonymous regions that existed before the mapper was created, such as
+/// regions allocated by the dynamic loader.
+fn map_anonymous_regions(
+    ctx: &ThreadContext,
+    shm_file: &mut ShmFile,
+    memory_manager: &MemoryManager,
+    regions: &mut IntervalMap<Region>,
+) {
+    // The shim is running on a temporary stack that it allocated, which we must not remap. If we
+    // can't tell where it is, the regions should get remapped after a miss instead.
+    let Some(sp) = blocked_stack_pointer(ctx.thread.native_tid()) else {
+        debug!("Couldn't get the stack pointer; not remapping anonymous regions");
+        return;
+    };
+
+    let intervals: Vec<Interval> = regions
+        .iter()
+        .filter(|(i, r)| r.original_path.is_none() && !i.contains(&sp) && is_remappable(i, r))
+        .map(|(i, _)| i)
+        .collect();
+
+    for interval in intervals {
+        if !remap_region(ctx, shm_file, memory_manager, regions, &interval) {
+            regions.get_mut(interval.start).unwrap().1.remap_failed = true;
+        }
+    }
+}
+
 impl Drop for MemoryMapper {
     fn drop(&mut self) {
         let misses = self.misses_by_path.borrow();
@@ -381,57 +780,22 @@ fn coalesce_regions(regions: IntervalMap<Region>) -> IntervalMap<Region> {
 
 impl MemoryMapper {
     pub fn new(memory_manager: &mut MemoryManager, ctx: &ThreadContext) -> MemoryMapper {
-        let shm_name = CString::new(format!(
-            "shadow_memory_manager_{}_{:?}_{}",
-            process::id(),
-            ctx.thread.host_id(),
-            u32::from(ctx.process.id())
-        ))
-        .unwrap();
-        let raw_file = rustix::fs::memfd_create(&shm_name, MemfdFlags::CLOEXEC).unwrap();
-        let shm_file = File::from(raw_file);
-
-        // Other processes can open the file via /proc.
-        let shm_path = format!("/proc/{}/fd/{}\0", process::id(), shm_file.as_raw_fd());
-
-        let shm_plugin_fd = {
-            let (ctx, thread) = ctx.split_thread();
-            let path_buf_foreign_ptr = ForeignArrayPtr::new(
-                thread.malloc_foreign_ptr(&ctx, shm_path.len()).unwrap(),
-                shm_path.len(),
-            );
-            memory_manager
-                .copy_to_ptr(path_buf_foreign_ptr, shm_path.as_bytes())
-                .unwrap();
-            let shm_plugin_fd = thread
-                .native_open(
-                    &ctx,
-                    path_buf_foreign_ptr.ptr(),
-                    libc::O_RDWR | libc::O_CLOEXEC,
-                    0,
-                )
-                .unwrap();
-            thread
-                .free_foreign_ptr(&ctx, path_buf_foreign_ptr.ptr(), path_buf_foreign_ptr.len())
-                .unwrap();
-            shm_plugin_fd
-        };
-
-        let mut shm_file = ShmFile {
-            shm_file,
-            shm_plugin_fd,
-            len: 0,
-        };
-        let regions = get_regions(memory_manager.pid);
-        let mut regions = coalesce_regions(regions);
+        let mut shm_file = ShmFile::new(memory_manager, ctx);
+        if shm_file.huge_pages {
+            check_shmem_huge_pages();
+        }
+        let mut regions = get_regions(memory_manager.pid);
         let heap = get_heap(ctx, &mut shm_file, memory_manager, &mut regions);
         map_stack(memory_manager, ctx, &mut shm_file, &mut regions);
+        map_anonymous_regions(ctx, &mut shm_file, memory_manager, &mut regions);
 
         MemoryMapper {
             shm_file,
             regions,
             misses_by_path: RefCell::new(HashMap::new()),
+            missed_regions: RefCell::new(Vec::new()),
             heap,
+            share_readonly_file_mappings: ctx.host.params.use_mem_mapper_shared_file_pages,
         }
     }
 
@@ -533,8 +897,10 @@ impl MemoryMapper {
     ///
     /// Executes the actual mmap operation in the plugin, updates the MemoryManager's understanding of
     /// the plugin's address space, and in some cases remaps the given region into the
-    /// MemoryManager's shared memory file for fast access. Currently only private anonymous
-    /// mappings are remapped.
+    /// MemoryManager's shared memory file for fast access. Private anonymous mappings are remapped
+    /// immediately. Private file mappings are remapped by
+    /// [`remap_missed_regions`](Self::remap_missed_regions) once Shadow fails to access them
+    /// directly.
     pub fn handle_mmap_result(
         &mut self,
         ctx: &ThreadContext,
@@ -579,6 +945,7 @@ impl MemoryMapper {
             prot,
             sharing,
             original_path,
+            remap_failed: false,
         };
 
         // Clear out metadata and mappings for anything that was already there.
@@ -594,9 +961,8 @@ impl MemoryMapper {
             self.shm_file.mmap_into_plugin(ctx, &interval, prot);
         }
 
-        // TODO: We *could* handle file mappings and some shared mappings as well. Doesn't make
-        // sense to add that complexity until if/when we see a lot of misses in such regions,
-        // though.
+        // TODO: We *could* handle some shared mappings as well. Doesn't make sense to add that
+        // complexity until if/when we see a lot of misses in such regions, though.
 
         {
             // There shouldn't be any mutations here; we already cleared a hole above.
@@ -605,6 +971,167 @@ impl MemoryMapper {
         }
     }
 
+    /// Remap the regions that had misses since the last call into the shared memory file, so that
+    /// later accesses to them don't need to copy. `memory_manager` is used to copy the regions'
+    /// current contents, and shouldn't be using this mapper.
+    pub fn remap_missed_regions(&mut self, ctx: &ThreadContext, memory_manager: &MemoryManager) {
+        // The thread may be running on a stack in one of the regions (for example the signal
+        // stack that the shim handles syscalls on), which we must not remap. If we can't tell
+        // where its stack is, the regions will be queued again on their next miss.
+        let missed = std::mem::take(self.missed_regions.get_mut());
+        let Some(sp) = blocked_stack_pointer(ctx.thread.native_tid()) else {
+            trace!("Couldn't get the stack pointer; not remapping missed regions");
+            return;
+        };
+
+        for start in missed {
+            // the region may have changed since the miss
+            let Some((interval, region)) = self.regions.get(start) else {
+                continue;
+            };
+            if interval.start != start || !self.should_remap(&interval, region) {
+                continue;
+            }
+            if interval.contains(&sp) {
+                // don't try again
+                self.regions.get_mut(start).unwrap().1.remap_failed = true;
+                continue;
+            }
+
+            if !remap_region(
+                ctx,
+                &mut self.shm_file,
+                memory_manager,
+                &mut self.regions,
+                &interval,
+            ) {
+                self.regions.get_mut(start).unwrap().1.remap_failed = true;
+            }
+        }
+    }
+
+    /// Prepare for the plugin to fork natively. Must be followed by
+    /// [`finish_fork`](Self::finish_fork) once the fork has been attempted.
+    ///
+    /// The child would otherwise inherit the parent's shared mappings of the memory file, and the
+    /// two would see each other's writes. We replace them in the plugin with private mappings of
+    /// the same file (which have the same contents), so that the kernel gives the child
+    /// copy-on-write copies of the regions instead of Shadow having to copy them.
+    pub fn prepare_fork(&self, ctx: &ThreadContext) {
+        let pctx = ProcessContext::new(ctx.host, ctx.process);
+        for (interval, region) in self.regions.iter() {
+            if region.shadow_base.is_null() {
+                continue;
+            }
+            ctx.thread
+                .native_mmap(
+                    &pctx,
+                    ForeignPtr::from(interval.start).cast::<u8>(),
+                    interval.len(),
+                    region.prot,
+                    MapFlags::MAP_PRIVATE | MapFlags::MAP_FIXED,
+                    self.shm_file.shm_plugin_fd,
+                    interval.start as i64,
+                )
+                .unwrap();
+        }
+    }
+
+    /// Finish a native fork prepared by [`prepare_fork`](Self::prepare_fork). `memory_manager` is
+    /// used to copy the regions' current contents, and shouldn't be using this mapper.
+    ///
+    /// The child keeps its private mappings of the current memory file, so the file must not
+    /// change from now on. The kernel copies it into a new file for the parent, and we then copy
+    /// in the pages that the parent wrote to through its private mappings since `prepare_fork`
+    /// (for example the shim's stack while it forked).
+    pub fn finish_fork(&mut self, ctx: &ThreadContext, memory_manager: &mut MemoryManager) {
+        let mut shm_file = ShmFile::new(memory_manager, ctx);
+        shm_file.copy_from(&self.shm_file);
+
+        // The thread is running on a stack in one of the regions (the signal stack that the shim
+        // handles syscalls on), which we must not remap; see `remap_region`. That region stays a
+        // private mapping, and is remapped after a miss. If we can't tell where the stack is, we
+        // leave all of the anonymous regions that way.
+        let sp = blocked_stack_pointer(ctx.thread.native_tid());
+
+        let mapped: Vec<Interval> = self
+            .regions
+            .iter()
+            .filter(|(_, r)| !r.shadow_base.is_null())
+            .map(|(i, _)| i)
+            .collect();
+
+        for interval in mapped {
+            let region = &mut self.regions.get_mut(interval.start).unwrap().1;
+            unsafe { linux_api::mman::munmap(region.shadow_base, interval.len()) }
+                .unwrap_or_else(|e| warn!("munmap: {}", e));
+            region.shadow_base = std::ptr::null_mut();
+
+            let is_stack = match sp {
+                Some(sp) => interval.contains(&sp),
+                None => region.original_path.is_none(),
+            };
+            if is_stack {
+                shm_file.dealloc(&interval);
+                continue;
+            }
+
+            // we need to write to the region to copy in its contents, even if the plugin can't
+            let rw_prot = ProtFlags::PROT_READ | ProtFlags::PROT_WRITE;
+            region.shadow_base = shm_file.mmap_into_shadow(&interval, rw_prot);
+
+            // the plugin can only have written to writable regions
+            if region.prot.contains(ProtFlags::PROT_WRITE) {
+                match private_pages(memory_manager.pid, &interval) {
+                    Some(runs) => {
+                        for run in runs {
+                            shm_file.copy_into_file(memory_manager, &interval, region, &run);
+                        }
+                    }
+                    None => shm_file.copy_into_file(memory_manager, &interval, region, &interval),
+                }
+            }
+
+            if region.prot != rw_prot {
+                unsafe {
+                    linux_api::mman::mprotect(region.shadow_base, interval.len(), region.prot)
+                }
+                .unwrap_or_else(|e| warn!("mprotect: {}", e));
+            }
+            shm_file.mmap_into_plugin(ctx, &interval, region.prot);
+        }
+
+        // The child inherited the plugin's descriptor for the old file, which keeps it open as
+        // long as the child needs it.
+        let pctx = ProcessContext::new(ctx.host, ctx.process);
+        ctx.thread
+            .native_close(&pctx, self.shm_file.shm_plugin_fd)
+            .unwrap_or_else(|e| warn!("close: {}", e));
+        self.shm_file = shm_file;
+    }
+
+    /// Mark the regions that are mapped into Shadow as cold, so that the kernel reclaims their
+    /// pages of the memory file before those of other processes.
+    pub fn advise_cold(&self) {
+        for (interval, region) in self.regions.iter() {
+            if region.shadow_base.is_null() {
+                continue;
+            }
+            unsafe {
+                rustix::mm::madvise(
+                    region.shadow_base,
+                    interval.len(),
+                    rustix::mm::Advice::LinuxCold,
+                )
+            }
+            .unwrap_or_else(|e| debug!("madvise(MADV_COLD): {e}"));
+        }
+    }
+
+    pub fn has_missed_regions(&self) -> bool {
+        !self.missed_regions.borrow().is_empty()
+    }
+
     /// Shadow should delegate a plugin's call to munmap to this method.
     ///
     /// Executes the actual mmap operation in the plugin, updates the MemoryManager's understanding of
@@ -684,9 +1211,21 @@ impl MemoryMapper {
         }
 
         if !region.shadow_base.is_null() {
-            // We currently only map in anonymous mmap'd regions, stack, and heap.  We don't bother
-            // implementing mremap for stack or heap regions for now; that'd be pretty weird.
-            assert_eq!(region.original_path, None);
+            // We don't bother implementing mremap for stack or heap regions for now; that'd be
+            // pretty weird.
+            assert!(matches!(
+                region.original_path,
+                None | Some(MappingPath::Path(_))
+            ));
+
+            if region.original_path.is_some() && new_size > old_size {
+                // The plugin would see the following part of the file in the new part of the
+                // mapping, but we only copied the original mapping into the memory file.
+                warn!(
+                    "Growing a remapped file mapping; the new part of the mapping will be zeroed \
+                     instead of containing the file's contents"
+                );
+            }
 
             if new_interval.start != old_interval.start {
                 // region has moved
@@ -831,6 +1370,7 @@ impl MemoryMapper {
                     prot: HEAP_PROT,
                     sharing: Sharing::Private,
                     original_path: Some(MappingPath::Heap),
+                    remap_failed: false,
                 },
             );
         } else {
@@ -1083,10 +1623,28 @@ impl MemoryMapper {
         Some(unsafe { std::slice::from_raw_parts_mut(notnull_mut_debug(ptr), src.len()) })
     }
 
+    /// Whether to remap the region into the shared memory file after a miss.
+    fn should_remap(&self, interval: &Interval, region: &Region) -> bool {
+        if self.share_readonly_file_mappings && is_readonly_file_mapping(region) {
+            // the copy would use memory in each process, while the page cache shares the
+            // file's pages between all of them
+            return false;
+        }
+        is_remappable(interval, region)
+    }
+
     /// Counts accesses where we had to fall back to the thread's (slow) apis.
     fn inc_misses<T: Pod>(&self, src: ForeignArrayPtr<T>) {
         let key = match self.regions.get(usize::from(src.ptr())) {
-            Some((_, original_path)) => format!("{:?}", original_path),
+            Some((interval, region)) => {
+                if self.should_remap(&interval, region) {
+                    let mut missed = self.missed_regions.borrow_mut();
+                    if !missed.contains(&interval.start) {
+                        missed.push(interval.start);
+                    }
+                }
+                format!("{:?}", region)
+            }
             None => "not found".to_string(),
         };
         let mut misses = self.misses_by_path.borrow_mut();
@@ -15,6 +15,7 @@
 //! all access to process memory must go through it. This includes servicing syscalls that
 //! modify the process address space (such as `mmap`).
 
+use std::cell::RefCell;
 use std::fmt::Debug;
 use std::mem::MaybeUninit;
 use std::ops::{Deref, DerefMut};
@@ -29,8 +30,9 @@ use memory_mapper::MemoryMapper;
 use shadow_pod::Pod;
 use shadow_shim_helper_rs::syscall_types::ForeignPtr;
 
-use super::context::ThreadContext;
+use super::context::{ProcessContext, ThreadContext};
 use crate::host::syscall::types::{ForeignArrayPtr, SyscallError};
+use crate::utility::proc_maps;
 
 mod memory_copier;
 mod memory_mapper;
@@ -144,7 +146,7 @@ impl ProcessMemoryRef<'_, u8> {
     /// Get a `cstr` from the reference. Fails with `ENAMETOOLONG` if there is no
     /// NULL byte.
     pub fn get_cstr(&self) -> Result<&std::ffi::CStr, Errno> {
-        std::ffi::CStr::from_bytes_until_nul(self).or(Err(Errno::ENAMETOOLONG))
+        cstr_until_nul(self)
     }
 }
 
@@ -165,7 +167,7 @@ where
 #[derive(Debug)]
 enum CopiedOrMappedMut<'a, T: Pod> {
     // Data copied from process memory, to be written back.
-    Copied(MemoryCopier, ForeignArrayPtr<T>, Vec<T>),
+    Copied(&'a MemoryManager, ForeignArrayPtr<T>, Vec<T>),
     // Memory-mapped process memory.
     Mapped(&'a mut [T]),
 }
@@ -189,9 +191,9 @@ pub struct ProcessMemoryRefMut<'a, T: Pod> {
 }
 
 impl<'a, T: Pod> ProcessMemoryRefMut<'a, T> {
-    fn new_copied(copier: MemoryCopier, ptr: ForeignArrayPtr<T>, v: Vec<T>) -> Self {
+    fn new_copied(memory_manager: &'a MemoryManager, ptr: ForeignArrayPtr<T>, v: Vec<T>) -> Self {
         Self {
-            copied_or_mapped: CopiedOrMappedMut::Copied(copier, ptr, v),
+            copied_or_mapped: CopiedOrMappedMut::Copied(memory_manager, ptr, v),
             dirty: true,
         }
     }
@@ -216,13 +218,13 @@ impl<'a, T: Pod> ProcessMemoryRefMut<'a, T> {
         self.dirty = false;
 
         match &self.copied_or_mapped {
-            CopiedOrMappedMut::Copied(copier, ptr, v) => {
+            CopiedOrMappedMut::Copied(memory_manager, ptr, v) => {
                 trace!(
                     "Flushing {} bytes to {:x}",
                     ptr.len() * std::mem::size_of::<T>(),
                     usize::from(ptr.ptr())
                 );
-                unsafe { copier.copy_to_ptr(*ptr, v)? };
+                memory_manager.write_copied(*ptr, v)?;
             }
             CopiedOrMappedMut::Mapped(_) => (),
         };
@@ -270,6 +272,127 @@ where
     }
 }
 
+/// A list of reads from plugin memory to be performed together by
+/// [`MemoryManager::copy_from_ptrs`]. Useful when a syscall handler needs to
+/// read several independent arguments, for example a socket address and an
+/// iovec array.
+///
+/// ```no_run
+/// # use shadow_shim_helper_rs::syscall_types::ForeignPtr;
+/// # use shadow_rs::host::memory_manager::{MemoryGather, MemoryManager};
+/// # use shadow_rs::host::syscall::types::ForeignArrayPtr;
+/// # use linux_api::errno::Errno;
+/// # fn foo() -> Result<(), Errno> {
+/// # let memory_manager: MemoryManager = todo!();
+/// let a_ptr: ForeignPtr<u32> = todo!();
+/// let b_ptr: ForeignPtr<u64> = todo!();
+/// let mut a = [0u32; 4];
+/// let mut b = [0u64; 2];
+/// let mut gather = MemoryGather::new();
+/// gather.add(&mut a, ForeignArrayPtr::new(a_ptr, 4));
+/// gather.add(&mut b, ForeignArrayPtr::new(b_ptr, 2));
+/// memory_manager.copy_from_ptrs(gather)?;
+/// # Ok(())
+/// # }
+/// ```
+#[derive(Default)]
+pub struct MemoryGather<'a> {
+    dsts: Vec<&'a mut [u8]>,
+    srcs: Vec<ForeignArrayPtr<u8>>,
+}
+
+impl<'a> MemoryGather<'a> {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Add a read of `src` into `dst`, which must have the same length.
+    pub fn add<T: Pod>(&mut self, dst: &'a mut [T], src: ForeignArrayPtr<T>) {
+        assert_eq!(dst.len(), src.len());
+        // SAFETY: We do not write uninitialized data into `buf`.
+        let buf = unsafe { shadow_pod::to_u8_slice_mut(dst) };
+        // SAFETY: this buffer is write-only.
+        let buf: &mut [u8] =
+            unsafe { std::slice::from_raw_parts_mut(buf.as_mut_ptr() as *mut u8, buf.len()) };
+        self.dsts.push(buf);
+        self.srcs.push(src.cast_u8());
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.srcs.is_empty()
+    }
+}
+
+/// Writes to plugin memory that isn't mapped into Shadow, held back while a write batch is open so
+/// that they can be made together. See [`MemoryManager::begin_write_batch`].
+#[derive(Debug, Default)]
+struct WriteBatch {
+    dsts: Vec<ForeignArrayPtr<u8>>,
+    // The data for all of `dsts`, concatenated.
+    data: Vec<u8>,
+    // Whether any of the held-back writes failed.
+    faulted: bool,
+}
+
+impl WriteBatch {
+    /// Make the held-back writes followed by writing `srcs` to `dsts`, with a single syscall.
+    /// Returns the number of bytes of `srcs` written.
+    ///
+    /// # Safety
+    ///
+    /// A reference to the process memory must not exist.
+    unsafe fn write(
+        &mut self,
+        copier: &MemoryCopier,
+        dsts: &[ForeignArrayPtr<u8>],
+        srcs: &[std::io::IoSlice],
+    ) -> Result<usize, Errno> {
+        let held_len = self.data.len();
+
+        let mut all_dsts = std::mem::take(&mut self.dsts);
+        all_dsts.extend_from_slice(dsts);
+        let mut all_srcs = Vec::with_capacity(srcs.len() + 1);
+        all_srcs.push(std::io::IoSlice::new(&self.data));
+        all_srcs.extend_from_slice(srcs);
+
+        let res = unsafe { copier.writev_ptrs(&all_dsts, &all_srcs) };
+
+        // keep the buffers for the next writes
+        drop(all_srcs);
+        all_dsts.clear();
+        self.dsts = all_dsts;
+        self.data.clear();
+
+        match res {
+            Ok(n) if n >= held_len => Ok(n - held_len),
+            Ok(_) => {
+                self.faulted = true;
+                Err(Errno::EFAULT)
+            }
+            Err(e) => {
+                self.faulted = true;
+                Err(e)
+            }
+        }
+    }
+}
+
+/// Larger writes aren't held back, to avoid copying large buffers. They're made right away, together
+/// with any held-back writes.
+const MAX_HELD_WRITE_LEN: usize = 4096;
+
+/// The most writes held back at a time.
+const MAX_HELD_WRITES: usize = 64;
+
+/// The NULL-terminated string at the beginning of `bytes`. Fails with `ENAMETOOLONG` if there is
+/// no NULL byte. Like `CStr::from_bytes_until_nul`, but uses a vectorized search for the NULL
+/// byte since the buffers that paths are read from are usually much longer than the paths.
+pub fn cstr_until_nul(bytes: &[u8]) -> Result<&std::ffi::CStr, Errno> {
+    let len = memchr::memchr(0, bytes).ok_or(Errno::ENAMETOOLONG)? + 1;
+    // SAFETY: `bytes[len - 1]` is the first NULL byte.
+    Ok(unsafe { std::ffi::CStr::from_bytes_with_nul_unchecked(&bytes[..len]) })
+}
+
 fn page_size() -> usize {
     nix::unistd::sysconf(nix::unistd::SysconfVar::PAGE_SIZE)
         .unwrap()
@@ -303,6 +426,10 @@ pub struct MemoryManager {
 
     // Native pid of the plugin process.
     pid: Pid,
+
+    // Writes held back while a write batch is open. A `RefCell` since reads of memory with
+    // held-back writes need to make them first.
+    write_batch: RefCell<Option<WriteBatch>>,
 }
 
 impl MemoryManager {
@@ -325,7 +452,135 @@ impl MemoryManager {
             pid,
             memory_copier: MemoryCopier::new(pid),
             memory_mapper: None,
+            write_batch: RefCell::new(None),
+        }
+    }
+
+    /// Hold back writes to plugin memory that isn't mapped into Shadow until
+    /// [`end_write_batch`](Self::end_write_batch), so that a syscall handler making several such
+    /// writes needs a single `process_vm_writev` syscall rather than one per write. Reads of
+    /// memory with held-back writes make the held-back writes first.
+    ///
+    /// The plugin must not access its memory while the batch is open, e.g. by natively executing
+    /// a syscall, and the process's mappings must not change.
+    pub fn begin_write_batch(&mut self) {
+        let prev = self.write_batch.get_mut().replace(WriteBatch::default());
+        assert!(prev.is_none());
+    }
+
+    /// Make the writes held back since [`begin_write_batch`](Self::begin_write_batch). Returns
+    /// `EFAULT` if any of them failed.
+    pub fn end_write_batch(&mut self) -> Result<(), Errno> {
+        self.flush_write_batch();
+        let batch = self.write_batch.get_mut().take().unwrap();
+        if batch.faulted {
+            return Err(Errno::EFAULT);
+        }
+        Ok(())
+    }
+
+    // Changing the process's mappings may have the plugin natively execute syscalls that access
+    // its memory, or change which memory is mapped into Shadow.
+    fn assert_no_write_batch(&self) {
+        assert!(
+            self.write_batch.borrow().is_none(),
+            "Can't change the process's mappings while a write batch is open"
+        );
+    }
+
+    /// Make any held-back writes.
+    fn flush_write_batch(&self) {
+        // any failure is recorded in the batch
+        let _ = self.writev_copied(&[], &[]);
+    }
+
+    /// Make any held-back writes that overlap `ptr`, so that reading it returns what was written.
+    fn flush_writes_overlapping<T: Pod>(&self, ptr: ForeignArrayPtr<T>) {
+        let ptr = ptr.cast_u8();
+        let start = usize::from(ptr.ptr());
+        let end = start + ptr.len();
+
+        let overlaps = self.write_batch.borrow().as_ref().is_some_and(|batch| {
+            batch.dsts.iter().any(|dst| {
+                let dst_start = usize::from(dst.ptr());
+                dst_start < end && start < dst_start + dst.len()
+            })
+        });
+
+        if overlaps {
+            self.flush_write_batch();
+        }
+    }
+
+    /// Write `src` to plugin memory that isn't mapped into Shadow, or hold the write back if a
+    /// write batch is open.
+    fn write_copied<T: Pod>(&self, dst: ForeignArrayPtr<T>, src: &[T]) -> Result<(), Errno> {
+        let dst = dst.cast_u8();
+        let src: &[MaybeUninit<u8>] = shadow_pod::to_u8_slice(src);
+        // SAFETY: We never read from this buffer in this process; it will either be passed to the
+        // process_vm_writev syscall, for which uninitialized data is ok, or copied into the
+        // batch's buffer, which is only passed to the same syscall.
+        let src: &[u8] =
+            unsafe { std::slice::from_raw_parts(src.as_ptr() as *const u8, src.len()) };
+        assert_eq!(src.len(), dst.len());
+
+        match self.write_batch.borrow_mut().as_mut() {
+            Some(batch)
+                if src.len() <= MAX_HELD_WRITE_LEN && batch.dsts.len() < MAX_HELD_WRITES =>
+            {
+                batch.dsts.push(dst);
+                batch.data.extend_from_slice(src);
+                return Ok(());
+            }
+            Some(_) => (),
+            None => {
+                // SAFETY: No other refs to process memory exist by preconditions of
+                // MemoryManager::new + the memory isn't mapped into Shadow.
+                return unsafe { self.memory_copier.copy_to_ptr(dst, src) };
+            }
+        }
+
+        let nwritten = self.writev_copied(&[dst], &[std::io::IoSlice::new(src)])?;
+        // Partial writes don't split a remote iovec.
+        if nwritten != src.len() {
+            return Err(Errno::EFAULT);
+        }
+        Ok(())
+    }
+
+    /// Write `srcs` to `dsts` in plugin memory that isn't mapped into Shadow, after any held-back
+    /// writes. The writes are made with a single syscall if possible. Returns the number of bytes
+    /// of `srcs` written.
+    fn writev_copied(
+        &self,
+        dsts: &[ForeignArrayPtr<u8>],
+        srcs: &[std::io::IoSlice],
+    ) -> Result<usize, Errno> {
+        let mut batch = self.write_batch.borrow_mut();
+        let batch = match batch.as_mut() {
+            Some(batch) if !batch.dsts.is_empty() => batch,
+            _ => {
+                if dsts.is_empty() {
+                    return Ok(0);
+                }
+                // SAFETY: No other refs to process memory exist by preconditions of
+                // MemoryManager::new + the memory isn't mapped into Shadow.
+                return unsafe { self.memory_copier.writev_ptrs(dsts, srcs) };
+            }
+        };
+
+        // process_vm_writev accepts at most `UIO_MAXIOV` iovecs on each side
+        let max_iovs: usize = libc::UIO_MAXIOV.try_into().unwrap();
+        if batch.dsts.len() + dsts.len() > max_iovs || srcs.len() + 1 > max_iovs {
+            // SAFETY: As above.
+            unsafe {
+                let _ = batch.write(&self.memory_copier, &[], &[]);
+                return self.memory_copier.writev_ptrs(dsts, srcs);
+            }
         }
+
+        // SAFETY: As above.
+        unsafe { batch.write(&self.memory_copier, dsts, srcs) }
     }
 
     // Internal helper for getting a reference to memory via the
@@ -342,9 +597,18 @@ impl MemoryManager {
     // `memory_mapper`.  Calling methods should fall back to the `memory_copier`
     // on failure.
     fn mapped_mut<T: Pod>(&mut self, ptr: ForeignArrayPtr<T>) -> Option<&mut [T]> {
-        let mm = self.memory_mapper.as_ref()?;
+        Self::mapper_mut(&self.memory_mapper, ptr)
+    }
+
+    // Like `mapped_mut`, but only borrows the `memory_mapper`. Callers must hold an exclusive
+    // reference to the MemoryManager.
+    fn mapper_mut<T: Pod>(
+        memory_mapper: &Option<MemoryMapper>,
+        ptr: ForeignArrayPtr<T>,
+    ) -> Option<&mut [T]> {
+        let mm = memory_mapper.as_ref()?;
         // SAFETY: No other refs to process memory exist by preconditions of
-        // MemoryManager::new + we have an exclusive reference.
+        // MemoryManager::new + the caller has an exclusive reference.
         unsafe { mm.get_mut(ptr) }
     }
 
@@ -357,6 +621,7 @@ impl MemoryManager {
         if let Some(mref) = self.mapped_ref(ptr) {
             Ok(ProcessMemoryRef::new_mapped(mref))
         } else {
+            self.flush_writes_overlapping(ptr);
             Ok(ProcessMemoryRef::new_copied(unsafe {
                 self.memory_copier.clone_mem(ptr)?
             }))
@@ -381,6 +646,7 @@ impl MemoryManager {
         if let Some(mref) = self.mapped_ref(ptr) {
             Ok(ProcessMemoryRef::new_mapped(mref))
         } else {
+            self.flush_writes_overlapping(ptr);
             Ok(ProcessMemoryRef::new_copied(unsafe {
                 self.memory_copier.clone_mem_prefix(ptr)?
             }))
@@ -467,9 +733,39 @@ impl MemoryManager {
             dst.copy_from_slice(src);
             return Ok(());
         }
+        self.flush_writes_overlapping(src);
         unsafe { self.memory_copier.copy_from_ptr(dst, src) }
     }
 
+    /// Performs all of the reads in `gather`. The reads from plugin memory
+    /// that isn't mapped into Shadow are done with a single syscall rather
+    /// than one per read. Returns `EFAULT` if any of the reads can't be
+    /// completed, in which case the contents of the destination buffers are
+    /// unspecified.
+    pub fn copy_from_ptrs(&self, gather: MemoryGather) -> Result<(), Errno> {
+        let mut copy_dsts = Vec::new();
+        let mut copy_srcs = Vec::new();
+
+        for (dst, src) in gather.dsts.into_iter().zip(gather.srcs) {
+            if let Some(src) = self.mapped_ref(src) {
+                dst.copy_from_slice(src);
+            } else {
+                self.flush_writes_overlapping(src);
+                copy_dsts.push(dst);
+                copy_srcs.push(src);
+            }
+        }
+
+        if copy_srcs.is_empty() {
+            return Ok(());
+        }
+
+        unsafe {
+            self.memory_copier
+                .copy_from_ptrs(&mut copy_dsts, &copy_srcs)
+        }
+    }
+
     // Copies memory from the beginning of the given pointer to the last address
     // in the pointer that's accessible. Not exposed as a public interface
     // because this is generally only useful for strings, and
@@ -483,6 +779,7 @@ impl MemoryManager {
             buf.copy_from_slice(src);
             return Ok(src.len());
         }
+        self.flush_writes_overlapping(ptr);
         unsafe { self.memory_copier.copy_prefix_from_ptr(buf, ptr) }
     }
 
@@ -499,9 +796,14 @@ impl MemoryManager {
         dst: &'a mut [u8],
         src: ForeignArrayPtr<u8>,
     ) -> Result<&'a std::ffi::CStr, Errno> {
+        if let Some(src) = self.mapped_ref(src) {
+            // Only copy the string rather than all of `src`, which is usually much longer.
+            let len = cstr_until_nul(src)?.to_bytes_with_nul().len();
+            dst[..len].copy_from_slice(&src[..len]);
+            return cstr_until_nul(&dst[..len]);
+        }
         let nread = self.copy_prefix_from_ptr(dst, src)?;
-        let dst = &dst[..nread];
-        std::ffi::CStr::from_bytes_until_nul(dst).or(Err(Errno::ENAMETOOLONG))
+        cstr_until_nul(&dst[..nread])
     }
 
     /// Returns a mutable reference to the given memory. If the memory isn't
@@ -511,17 +813,17 @@ impl MemoryManager {
         &mut self,
         ptr: ForeignArrayPtr<T>,
     ) -> Result<ProcessMemoryRefMut<'_, T>, Errno> {
-        // Work around a limitation of the borrow checker by getting this
-        // immutable borrow of self out of the way before we do a mutable
-        // borrow.
-        let pid = self.pid;
-
-        if let Some(mref) = self.mapped_mut(ptr) {
+        // Only borrow the mapper here, so that the copied reference can borrow the rest of self
+        // (a limitation of the borrow checker).
+        //
+        // SAFETY: No other refs to process memory exist by preconditions of MemoryManager::new +
+        // we have an exclusive reference.
+        if let Some(mref) = Self::mapper_mut(&self.memory_mapper, ptr) {
             Ok(ProcessMemoryRefMut::new_mapped(mref))
         } else {
-            let copier = MemoryCopier::new(pid);
-            let v = unsafe { copier.clone_mem(ptr)? };
-            Ok(ProcessMemoryRefMut::new_copied(copier, ptr, v))
+            self.flush_writes_overlapping(ptr);
+            let v = unsafe { self.memory_copier.clone_mem(ptr)? };
+            Ok(ProcessMemoryRefMut::new_copied(self, ptr, v))
         }
     }
 
@@ -540,12 +842,8 @@ impl MemoryManager {
         &mut self,
         ptr: ForeignArrayPtr<T>,
     ) -> Result<ProcessMemoryRefMut<'_, T>, Errno> {
-        // Work around a limitation of the borrow checker by getting this
-        // immutable borrow of self out of the way before we do a mutable
-        // borrow.
-        let pid = self.pid;
-
-        let mut mref = if let Some(mref) = self.mapped_mut(ptr) {
+        // See `memory_ref_mut`.
+        let mut mref = if let Some(mref) = Self::mapper_mut(&self.memory_mapper, ptr) {
             // Even if we haven't initialized the data from this process, the
             // data is initialized from the Rust compiler's perspective; it has
             // *some* set contents via mmap, even if the other process hasn't
@@ -554,7 +852,7 @@ impl MemoryManager {
         } else {
             let mut v = Vec::with_capacity(ptr.len());
             v.resize(ptr.len(), shadow_pod::zeroed());
-            ProcessMemoryRefMut::new_copied(MemoryCopier::new(pid), ptr, v)
+            ProcessMemoryRefMut::new_copied(self, ptr, v)
         };
 
         // In debug builds, overwrite with garbage to shake out bugs where
@@ -579,9 +877,45 @@ impl MemoryManager {
             dst.copy_from_slice(src);
             return Ok(());
         }
-        // SAFETY: No other refs to process memory exist by preconditions of
-        // MemoryManager::new + we have an exclusive reference.
-        unsafe { self.memory_copier.copy_to_ptr(dst, src) }
+        self.write_copied(dst, src)
+    }
+
+    /// Writes the memory from a list of local buffers to a list of plugin buffers, which must have
+    /// the same total length. If the plugin memory isn't mapped into Shadow, this is a single
+    /// syscall rather than one per buffer. Returns the number of bytes written. If some of the
+    /// plugin buffers are invalid, this may be less than the total length.
+    pub fn copy_to_ptrs(
+        &mut self,
+        dsts: &[ForeignArrayPtr<u8>],
+        srcs: &[std::io::IoSlice],
+    ) -> Result<usize, Errno> {
+        let len = srcs.iter().map(|x| x.len()).sum::<usize>();
+        assert_eq!(len, dsts.iter().map(|x| x.len()).sum::<usize>());
+
+        if dsts.iter().all(|dst| self.mapped_ref(*dst).is_some()) {
+            let mut srcs = srcs.iter().map(|x| &x[..]);
+            let mut src: &[u8] = &[];
+
+            for dst in dsts {
+                let mut dst = self.mapped_mut(*dst).unwrap();
+                while !dst.is_empty() {
+                    if src.is_empty() {
+                        src = srcs.next().unwrap();
+                        continue;
+                    }
+
+                    let n = std::cmp::min(src.len(), dst.len());
+                    let (dst_head, dst_tail) = std::mem::take(&mut dst).split_at_mut(n);
+                    dst_head.copy_from_slice(&src[..n]);
+                    dst = dst_tail;
+                    src = &src[n..];
+                }
+            }
+
+            return Ok(len);
+        }
+
+        self.writev_copied(dsts, srcs)
     }
 
     /// Which process's address space this MemoryManager manages.
@@ -592,15 +926,88 @@ impl MemoryManager {
     /// Initialize the MemoryMapper, allowing for more efficient access. Needs a
     /// running thread.
     pub fn init_mapper(&mut self, ctx: &ThreadContext) {
+        self.assert_no_write_batch();
         assert!(self.memory_mapper.is_none());
         self.memory_mapper = Some(MemoryMapper::new(self, ctx));
     }
 
+    /// Remap plugin memory regions that the MemoryMapper recently failed to access directly, if
+    /// it knows how to remap them. Needs a running thread.
+    pub fn remap_missed_regions(&mut self, ctx: &ThreadContext) {
+        if !self
+            .memory_mapper
+            .as_ref()
+            .is_some_and(|mm| mm.has_missed_regions())
+        {
+            return;
+        }
+
+        // Copy the regions' contents without going through the mapper.
+        self.assert_no_write_batch();
+        let mut mm = self.memory_mapper.take().unwrap();
+        mm.remap_missed_regions(ctx, self);
+        self.memory_mapper = Some(mm);
+    }
+
+    /// Prepare the MemoryMapper, if any, for the process to fork natively. Must be followed by
+    /// [`finish_fork`](Self::finish_fork) once the fork has been attempted. Needs a running thread.
+    pub fn prepare_fork(&self, ctx: &ThreadContext) {
+        self.assert_no_write_batch();
+        if let Some(mm) = &self.memory_mapper {
+            mm.prepare_fork(ctx);
+        }
+    }
+
+    /// Finish a native fork prepared by [`prepare_fork`](Self::prepare_fork). The child process
+    /// gets copy-on-write copies of the regions that the MemoryMapper had mapped, and doesn't have
+    /// a MemoryMapper of its own. Needs a running thread.
+    pub fn finish_fork(&mut self, ctx: &ThreadContext) {
+        let Some(mut mm) = self.memory_mapper.take() else {
+            return;
+        };
+        // Copy the regions' contents without going through the mapper.
+        mm.finish_fork(ctx, self);
+        self.memory_mapper = Some(mm);
+    }
+
     /// Whether the internal MemoryMapper has been initialized.
     pub fn has_mapper(&self) -> bool {
         self.memory_mapper.is_some()
     }
 
+    /// Ask the kernel to reclaim the process's memory, for a process that won't run for a while.
+    /// The plugin's private writable mappings are paged out, and the regions that the
+    /// MemoryMapper has mapped into Shadow are marked as cold so that they're reclaimed before the
+    /// memory of running processes. This only changes which pages are resident, not their
+    /// contents. Needs a running thread.
+    pub fn reclaim(&self, ctx: &ThreadContext) {
+        self.assert_no_write_batch();
+
+        if let Some(mm) = &self.memory_mapper {
+            mm.advise_cold();
+        }
+
+        let mappings = match proc_maps::mappings_for_pid(self.pid.as_raw_nonzero().get()) {
+            Ok(x) => x,
+            Err(e) => {
+                debug!("Couldn't read the mappings of process {:?}: {e}", self.pid);
+                return;
+            }
+        };
+
+        let pctx = ProcessContext::new(ctx.host, ctx.process);
+        for mapping in mappings.iter().filter(|x| is_reclaimable(x)) {
+            ctx.thread
+                .native_madvise(
+                    &pctx,
+                    ForeignPtr::from(mapping.begin).cast::<u8>(),
+                    mapping.end - mapping.begin,
+                    libc::MADV_PAGEOUT,
+                )
+                .unwrap_or_else(|e| debug!("madvise(MADV_PAGEOUT): {e}"));
+        }
+    }
+
     /// Create a write accessor for the specified plugin memory.
     pub fn writer(&mut self, ptr: ForeignArrayPtr<u8>) -> MemoryWriterCursor<'_> {
         MemoryWriterCursor {
@@ -615,6 +1022,7 @@ impl MemoryManager {
         ctx: &ThreadContext,
         ptr: ForeignPtr<u8>,
     ) -> Result<ForeignPtr<u8>, SyscallError> {
+        self.assert_no_write_batch();
         match &mut self.memory_mapper {
             Some(mm) => Ok(mm.handle_brk(ctx, ptr)?),
             None => Err(SyscallError::Native),
@@ -631,6 +1039,7 @@ impl MemoryManager {
         fd: i32,
         offset: i64,
     ) -> Result<ForeignPtr<u8>, Errno> {
+        self.assert_no_write_batch();
         let addr = {
             let (ctx, thread) = ctx.split_thread();
             thread.native_mmap(&ctx, addr, length, prot, flags, fd, offset)?
@@ -647,6 +1056,7 @@ impl MemoryManager {
         addr: ForeignPtr<u8>,
         length: usize,
     ) -> Result<(), SyscallError> {
+        self.assert_no_write_batch();
         if self.memory_mapper.is_some() {
             // Do it ourselves so that we can update our mappings based on
             // whether it succeeded.
@@ -682,6 +1092,7 @@ impl MemoryManager {
         flags: i32,
         new_address: ForeignPtr<u8>,
     ) -> Result<ForeignPtr<u8>, SyscallError> {
+        self.assert_no_write_batch();
         match &mut self.memory_mapper {
             Some(mm) => {
                 Ok(mm.handle_mremap(ctx, old_address, old_size, new_size, flags, new_address)?)
@@ -697,6 +1108,7 @@ impl MemoryManager {
         size: usize,
         prot: ProtFlags,
     ) -> Result<(), SyscallError> {
+        self.assert_no_write_batch();
         match &mut self.memory_mapper {
             Some(mm) => Ok(mm.handle_mprotect(ctx, addr, size, prot)?),
             None => Err(SyscallError::Native),
@@ -825,3 +1237,62 @@ mod export {
         }
     }
 }
+
+/// Whether [`MemoryManager::reclaim`] should page out the plugin's `mapping`. Shared mappings
+/// (including the MemoryMapper's mappings of its memory file) are also mapped elsewhere, and the
+/// kernel's special mappings can't be paged out.
+fn is_reclaimable(mapping: &proc_maps::Mapping) -> bool {
+    mapping.write
+        && mapping.sharing == proc_maps::Sharing::Private
+        && !matches!(
+            mapping.path,
+            Some(proc_maps::MappingPath::Vdso | proc_maps::MappingPath::OtherSpecial(_))
+        )
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_cstr_until_nul() {
+        assert_eq!(
+            cstr_until_nul(b"/etc/hosts\0garbage").unwrap(),
+            c"/etc/hosts"
+        );
+        assert_eq!(cstr_until_nul(b"\0").unwrap(), c"");
+        assert_eq!(cstr_until_nul(b"/etc/hosts"), Err(Errno::ENAMETOOLONG));
+        assert_eq!(cstr_until_nul(b""), Err(Errno::ENAMETOOLONG));
+
+        let long = [b"a".repeat(4000), vec![0]].concat();
+        assert_eq!(cstr_until_nul(&long).unwrap().to_bytes().len(), 4000);
+    }
+
+    #[test]
+    fn test_is_reclaimable() {
+        let maps = "\
+555555554000-555555556000 r--p 00000000 08:01 1 /usr/bin/test
+555555556000-555555558000 rw-p 00002000 08:01 1 /usr/bin/test
+555555558000-555555579000 rw-p 00000000 00:00 0 [heap]
+7ffff7a00000-7ffff7c00000 rw-p 00000000 00:00 0
+7ffff7c00000-7ffff7e00000 rw-s 00000000 00:01 2 /dev/shm/shadow_memory_manager (deleted)
+7ffff7fc1000-7ffff7fc5000 r--p 00000000 00:00 0 [vvar]
+7ffff7fc5000-7ffff7fc7000 r-xp 00000000 00:00 0 [vdso]
+7ffffffde000-7ffffffff000 rw-p 00000000 00:00 0 [stack]
+";
+        let reclaimable: Vec<_> = proc_maps::parse_mappings(maps)
+            .map(Result::unwrap)
+            .filter(is_reclaimable)
+            .map(|x| x.begin)
+            .collect();
+        assert_eq!(
+            reclaimable,
+            [
+                0x555555556000,
+                0x555555558000,
+                0x7ffff7a00000,
+                0x7ffffffde000
+            ]
+        );
+    }
+}
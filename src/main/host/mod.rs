@@ -7,6 +7,7 @@
 pub mod context;
 pub mod cpu;
 pub mod descriptor;
+pub mod file_io_pool;
 pub mod futex_table;
 #[allow(clippy::module_inception)]
 pub mod host;
@@ -14,7 +15,10 @@ pub mod managed_thread;
 pub mod memory_manager;
 pub mod network;
 pub mod process;
+pub mod process_launcher;
+pub mod socket_memory;
 pub mod status_listener;
 pub mod syscall;
 pub mod thread;
 pub mod timer;
+pub mod zygote;
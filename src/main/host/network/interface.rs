@@ -1,20 +1,30 @@
-use std::cell::RefCell;
-use std::collections::HashMap;
-use std::collections::hash_map::Entry;
+use std::cell::{Cell, RefCell};
 use std::fs::File;
 use std::io::BufWriter;
 use std::net::{Ipv4Addr, SocketAddrV4};
 use std::path::PathBuf;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::Duration;
+
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
 use crate::core::configuration::QDiscMode;
 use crate::core::worker::Worker;
 use crate::host::descriptor::socket::inet::InetSocket;
 use crate::host::network::queuing::{NetworkQueue, NetworkQueueKind};
+use crate::host::network::socket_demux::SocketDemux;
 use crate::network::PacketDevice;
 use crate::network::packet::{IanaProtocol, PacketRc, PacketStatus};
 use crate::utility::ObjectCounter;
+use crate::utility::background_writer::{self, BackgroundWriter};
 use crate::utility::callback_queue::CallbackQueue;
-use crate::utility::pcap_writer::{PacketDisplay, PcapWriter};
+use crate::utility::pcap_writer::{PacketDisplay, PcapRing, PcapWriter};
+
+/// How long an interface must go without capturing a packet before
+/// [`NetworkInterface::release_pcap_file`] closes its pcap file.
+const PCAP_RELEASE_IDLE_TIME: SimulationTime =
+    SimulationTime::from_duration(Duration::from_secs(10));
 
 /// The priority used by the fifo qdisc to choose the next socket to send a packet from.
 pub type FifoPacketPriority = u64;
@@ -23,31 +33,86 @@ pub type FifoPacketPriority = u64;
 pub struct PcapOptions {
     pub path: PathBuf,
     pub capture_size_bytes: u32,
+    /// If set, packets are kept in an in-memory ring and only written to disk when dumped.
+    pub ring: Option<PcapRingOptions>,
 }
 
-#[derive(Clone, Debug, Eq, Hash, PartialEq)]
-struct AssociatedSocketKey {
-    protocol: IanaProtocol,
-    local: SocketAddrV4,
-    remote: SocketAddrV4,
+#[derive(Debug, Clone)]
+pub struct PcapRingOptions {
+    pub max_packets: Option<usize>,
+    pub max_duration: Option<Duration>,
 }
 
-impl AssociatedSocketKey {
-    fn new(protocol: IanaProtocol, local: SocketAddrV4, remote: SocketAddrV4) -> Self {
-        Self {
-            protocol,
-            local,
-            remote,
-        }
-    }
+/// The number of times that a dump of all pcap rings has been requested, for example by a signal
+/// sent to Shadow.
+static PCAP_RING_DUMP_REQUESTS: AtomicU64 = AtomicU64::new(0);
+
+/// Request that all hosts dump their pcap rings. The hosts perform the dump the next time they're
+/// scheduled.
+pub fn request_pcap_ring_dump() {
+    PCAP_RING_DUMP_REQUESTS.fetch_add(1, Ordering::Relaxed);
+}
+
+/// The number of pcap ring dumps that have been requested with [`request_pcap_ring_dump`].
+pub fn pcap_ring_dump_requests() -> u64 {
+    PCAP_RING_DUMP_REQUESTS.load(Ordering::Relaxed)
 }
 
-fn setup_pcap_writer(
+enum PcapOutput {
+    /// Packets are written to a pcap file as they're captured.
+    File(PcapWriter<BackgroundWriter>),
+    /// Packets are kept in memory and written to a new pcap file each time the ring is dumped.
+    Ring {
+        ring: PcapRing,
+        /// The directory to write dump files to.
+        dir: PathBuf,
+        name: String,
+        dump_count: u32,
+    },
+}
+
+/// The configured pcap output of an interface. A pcap file is only opened when the first packet is
+/// captured, and is closed again by [`NetworkInterface::release_pcap_file`], so that hosts that
+/// aren't running any processes don't hold an open file and write buffer for each interface.
+enum PcapState {
+    /// The file isn't open. If `created` is set, the file was already created (and closed), and
+    /// packets will be appended to it.
+    Pending {
+        created: bool,
+    },
+    Active(PcapOutput),
+}
+
+/// Set up the pcap output for the interface `name`. If `append` is set, the pcap file already has
+/// a header and packets are appended to it.
+fn setup_pcap_output(
     name: &str,
     options: &PcapOptions,
-) -> std::io::Result<PcapWriter<BufWriter<File>>> {
-    let file = File::create(options.path.join(format!("{name}.pcap")))?;
-    PcapWriter::new(BufWriter::new(file), options.capture_size_bytes)
+    append: bool,
+) -> std::io::Result<PcapOutput> {
+    if let Some(ring) = &options.ring {
+        return Ok(PcapOutput::Ring {
+            ring: PcapRing::new(
+                options.capture_size_bytes,
+                ring.max_packets,
+                ring.max_duration,
+            ),
+            dir: options.path.clone(),
+            name: name.to_string(),
+            dump_count: 0,
+        });
+    }
+
+    std::fs::create_dir_all(&options.path)?;
+    let path = options.path.join(format!("{name}.pcap"));
+    let writer = if append {
+        let file = File::options().append(true).open(path)?;
+        PcapWriter::new_appending(BackgroundWriter::new(file), options.capture_size_bytes)
+    } else {
+        let file = File::create(path)?;
+        PcapWriter::new(BackgroundWriter::new(file), options.capture_size_bytes)?
+    };
+    Ok(PcapOutput::File(writer))
 }
 
 /// Represents a network device that can send and receive packets.
@@ -55,14 +120,18 @@ fn setup_pcap_writer(
 // in a `RefCell`. We should remove the `RefCell`s to simplify the code and fix any circular
 // code paths that exist.
 pub struct NetworkInterface {
+    name: String,
     addr: Ipv4Addr,
     /// The sockets from which we will pull out packets so that we can send them over the network.
     send_sockets: RefCell<NetworkQueue<InetSocket>>,
     /// The sockets to which we will push incoming packets so they can be received by the network
     /// stack and their payloads read by the managed process.
-    recv_sockets: RefCell<HashMap<AssociatedSocketKey, InetSocket>>,
+    recv_sockets: RefCell<SocketDemux<InetSocket>>,
     /// If configured, assists us in writing out pcap files of our packet flows.
-    pcap: RefCell<Option<PcapWriter<BufWriter<File>>>>,
+    pcap: RefCell<Option<PcapState>>,
+    pcap_options: Option<PcapOptions>,
+    /// When the interface last captured a packet.
+    pcap_last_capture: Cell<Option<EmulatedTime>>,
     /// Used to prevent recursion during cleanup.
     // TODO: remove when the legacy stack is removed.
     cleanup_in_progress: RefCell<bool>,
@@ -80,13 +149,10 @@ impl NetworkInterface {
         pcap_options: Option<PcapOptions>,
         qdisc: QDiscMode,
     ) -> Self {
-        // Try to set up the pcap writer if configured.
-        let pcap = pcap_options.and_then(|opt| match setup_pcap_writer(name, &opt) {
-            Ok(writer) => Some(writer),
-            Err(e) => {
-                log::warn!("Unable to set up the configured pcap writer for '{name}': {e}");
-                None
-            }
+        // A pcap file (if configured) is opened when the first packet is captured.
+        let pcap = pcap_options.as_ref().map(|opt| match opt.ring {
+            Some(_) => PcapState::Active(setup_pcap_output(name, opt, false).unwrap()),
+            None => PcapState::Pending { created: false },
         });
 
         log::debug!(
@@ -109,10 +175,13 @@ impl NetworkInterface {
         };
 
         Self {
+            name: name.to_string(),
             addr,
             send_sockets: RefCell::new(NetworkQueue::new(queue_kind)),
-            recv_sockets: RefCell::new(HashMap::new()),
+            recv_sockets: RefCell::new(SocketDemux::new()),
             pcap: RefCell::new(pcap),
+            pcap_options,
+            pcap_last_capture: Cell::new(None),
             cleanup_in_progress: RefCell::new(false),
             _counter: ObjectCounter::new("NetworkInterface"),
         }
@@ -124,44 +193,89 @@ impl NetworkInterface {
         protocol: IanaProtocol,
         port: u16,
         peer: SocketAddrV4,
+        reuse_port: bool,
     ) {
-        let local = SocketAddrV4::new(self.addr, port);
-        let key = AssociatedSocketKey::new(protocol, local, peer);
-        log::trace!("Associating socket key {key:?}");
+        log::trace!(
+            "Associating socket {protocol:?} {}:{port} with peer {peer}",
+            self.addr
+        );
 
-        if let Entry::Vacant(entry) = self.recv_sockets.borrow_mut().entry(key) {
-            entry.insert(socket.clone());
-        } else {
+        if !self.recv_sockets.borrow_mut().insert(
+            protocol,
+            port,
+            peer,
+            socket.clone(),
+            socket.identity(),
+            reuse_port,
+        ) {
             // TODO: Return an error if the association fails.
             debug_panic!("Entry is unexpectedly occupied");
         }
     }
 
-    pub fn disassociate(&self, protocol: IanaProtocol, port: u16, peer: SocketAddrV4) {
+    /// Disassociate the socket identified by `socket` (see [`InetSocket::identity`]), or any
+    /// socket with the association if `socket` is `None`.
+    pub fn disassociate(
+        &self,
+        protocol: IanaProtocol,
+        port: u16,
+        peer: SocketAddrV4,
+        socket: Option<usize>,
+    ) {
         if *self.cleanup_in_progress.borrow() {
             return;
         }
 
-        let local = SocketAddrV4::new(self.addr, port);
-        let key = AssociatedSocketKey::new(protocol, local, peer);
-        log::trace!("Disassociating socket key {key:?}");
+        log::trace!(
+            "Disassociating socket {protocol:?} {}:{port} with peer {peer}",
+            self.addr
+        );
 
         // TODO: Return an error if the disassociation fails. Generally the calling code should only
         // try to disassociate a socket if it thinks that the socket is actually associated with
         // this interface, and if it's not, then it's probably an error. But TCP sockets will
         // disassociate all sockets (including ones that have never been associated) and will try to
         // disassociate the same socket multiple times, so we can't just add an assert here.
-        if self.recv_sockets.borrow_mut().remove(&key).is_none() {
+        if self
+            .recv_sockets
+            .borrow_mut()
+            .remove(protocol, port, peer, socket)
+            .is_none()
+        {
             // Since this always occurs with our legacy TCP stack and is not really a bug, we log at
             // trace instead of warn level for now until the legacy TCP stack is removed.
             log::trace!("Attempted to disassociate a vacant socket key");
         }
     }
 
-    pub fn is_addr_in_use(&self, protocol: IanaProtocol, port: u16, peer: SocketAddrV4) -> bool {
-        let local = SocketAddrV4::new(self.addr, port);
-        let key = AssociatedSocketKey::new(protocol, local, peer);
-        self.recv_sockets.borrow().contains_key(&key)
+    pub fn is_addr_in_use(
+        &self,
+        protocol: IanaProtocol,
+        port: u16,
+        peer: SocketAddrV4,
+        reuse_port: bool,
+    ) -> bool {
+        !self
+            .recv_sockets
+            .borrow()
+            .is_available(protocol, port, peer, reuse_port)
+    }
+
+    /// See [`SocketDemux::used_ports_word`].
+    pub fn used_ports_word(&self, protocol: IanaProtocol, index: usize) -> u64 {
+        self.recv_sockets.borrow().used_ports_word(protocol, index)
+    }
+
+    /// See [`SocketDemux::unavailable_ports_word`].
+    pub fn unavailable_ports_word(
+        &self,
+        protocol: IanaProtocol,
+        peer: SocketAddrV4,
+        index: usize,
+    ) -> u64 {
+        self.recv_sockets
+            .borrow()
+            .unavailable_ports_word(protocol, peer, index)
     }
 
     // Add the socket to the list of sockets that have data ready for us to send out to the network.
@@ -192,20 +306,142 @@ impl NetworkInterface {
         *self.cleanup_in_progress.borrow_mut() = false;
     }
 
+    /// Call `f` for each socket associated with the interface. A socket with several associations
+    /// is given once for each.
+    pub fn for_each_socket(&self, mut f: impl FnMut(&InetSocket)) {
+        for socket in self.recv_sockets.borrow().iter() {
+            f(socket);
+        }
+    }
+
+    /// The number of bytes allocated for the interface's in-memory pcap ring, if it has one.
+    pub fn pcap_ring_bytes(&self) -> usize {
+        match self.pcap.borrow().as_ref() {
+            Some(PcapState::Active(PcapOutput::Ring { ring, .. })) => ring.allocated_bytes(),
+            _ => 0,
+        }
+    }
+
+    /// If the interface is capturing packets to an in-memory ring, write the packets in the ring
+    /// to a new pcap file.
+    pub fn dump_pcap_ring(&self, reason: &str) {
+        let mut pcap_borrowed = self.pcap.borrow_mut();
+
+        let Some(PcapState::Active(PcapOutput::Ring {
+            ring,
+            dir,
+            name,
+            dump_count,
+        })) = pcap_borrowed.as_mut()
+        else {
+            return;
+        };
+
+        let path = dir.join(format!("{name}-dump{dump_count}.pcap"));
+        *dump_count += 1;
+
+        log::info!(
+            "Dumping {} packets for interface '{}' to '{}' ({reason})",
+            ring.len(),
+            self.addr,
+            path.display(),
+        );
+
+        let rv = std::fs::create_dir_all(&*dir)
+            .and_then(|()| File::create(&path))
+            .and_then(|file| ring.dump(BufWriter::new(file)));
+        if let Err(e) = rv {
+            log::warn!("Unable to write pcap ring to '{}': {e}", path.display());
+        }
+    }
+
+    /// If the interface is configured to write a pcap file but hasn't captured any packets, create
+    /// the file with no packets. If the file was released, wait for its packets to be written.
+    /// This should be called when the host shuts down, so that each interface has a complete pcap
+    /// file.
+    pub fn finish_pcap_file(&self) {
+        match *self.pcap.borrow() {
+            Some(PcapState::Pending { created: false }) => {
+                let options = self.pcap_options.as_ref().unwrap();
+                if let Err(e) = setup_pcap_output(&self.name, options, false) {
+                    log::warn!(
+                        "Unable to set up the configured pcap writer for '{}': {e}",
+                        self.name
+                    );
+                }
+            }
+            Some(PcapState::Pending { created: true }) => {
+                background_writer::wait_for_pending_writes()
+            }
+            _ => {}
+        }
+    }
+
+    /// Close the interface's pcap file (if it's writing to one) if it hasn't captured a packet in
+    /// the [`PCAP_RELEASE_IDLE_TIME`] before `now`. Its buffered packets are written out and the
+    /// file closed by the background writer thread, so this doesn't wait on disk I/O. The file is
+    /// reopened and appended to if another packet is captured. In-memory pcap rings are kept, since
+    /// they hold the captured packets.
+    pub fn release_pcap_file(&self, now: EmulatedTime) {
+        if let Some(last_capture) = self.pcap_last_capture.get() {
+            if now < last_capture + PCAP_RELEASE_IDLE_TIME {
+                return;
+            }
+        }
+
+        let mut pcap_borrowed = self.pcap.borrow_mut();
+        if let Some(PcapState::Active(PcapOutput::File(_))) = pcap_borrowed.as_ref() {
+            let Some(PcapState::Active(PcapOutput::File(writer))) =
+                pcap_borrowed.replace(PcapState::Pending { created: true })
+            else {
+                unreachable!();
+            };
+            writer.into_inner().close_in_background();
+            log::trace!("Closed the pcap file for interface '{}'", self.name);
+        }
+    }
+
     fn capture_if_configured(&self, packet: &PacketRc) {
         // Avoid double mutable borrow of pcap.
         let mut pcap_borrowed = self.pcap.borrow_mut();
 
-        if let Some(pcap) = pcap_borrowed.as_mut() {
-            let now = Worker::current_time().unwrap().to_abs_simtime();
+        if let Some(&PcapState::Pending { created }) = pcap_borrowed.as_ref() {
+            let options = self.pcap_options.as_ref().unwrap();
+            *pcap_borrowed = match setup_pcap_output(&self.name, options, created) {
+                Ok(output) => Some(PcapState::Active(output)),
+                Err(e) => {
+                    log::warn!(
+                        "Unable to set up the configured pcap writer for '{}': {e}",
+                        self.name
+                    );
+                    None
+                }
+            };
+        }
+
+        if let Some(PcapState::Active(pcap)) = pcap_borrowed.as_mut() {
+            let current_time = Worker::current_time().unwrap();
+            self.pcap_last_capture.set(Some(current_time));
+            let now = current_time.to_abs_simtime();
 
             let ts_sec: u32 = now.as_secs().try_into().unwrap_or(u32::MAX);
             let ts_usec: u32 = now.subsec_micros();
             let packet_len: u32 = packet.len().try_into().unwrap_or(u32::MAX);
 
-            if let Err(e) = pcap.write_packet_fmt(ts_sec, ts_usec, packet_len, |writer| {
-                packet.display_bytes(writer)
-            }) {
+            let rv = match pcap {
+                PcapOutput::File(writer) => {
+                    writer.write_packet_fmt(ts_sec, ts_usec, packet_len, |writer| {
+                        packet.display_bytes(writer)
+                    })
+                }
+                PcapOutput::Ring { ring, .. } => {
+                    ring.push_packet_fmt(ts_sec, ts_usec, packet_len, |writer| {
+                        packet.display_bytes(writer)
+                    })
+                }
+            };
+
+            if let Err(e) = rv {
                 // There was a non-recoverable error.
                 log::warn!("Unable to write packet to pcap output: {}", e);
                 log::warn!(
@@ -269,28 +505,19 @@ impl PacketDevice for NetworkInterface {
 
         // Find the socket that should process the packet.
         let protocol = packet.iana_protocol();
-        let local = SocketAddrV4::new(self.addr, packet.dst_ipv4_address().port());
+        let port = packet.dst_ipv4_address().port();
         let peer = packet.src_ipv4_address();
-        let key = AssociatedSocketKey::new(protocol, local, peer);
-
-        // First check for a socket with the specific association.
-        log::trace!("Looking for socket associated with specific key {key:?}");
-        let maybe_socket = {
-            let associated = self.recv_sockets.borrow();
-            associated
-                .get(&key)
-                .or_else(|| {
-                    // Then fall back to checking for the wildcard association.
-                    let wildcard = SocketAddrV4::new(Ipv4Addr::UNSPECIFIED, 0);
-                    let key = AssociatedSocketKey::new(protocol, local, wildcard);
-                    log::trace!("Looking for socket associated with general key {key:?}");
-                    associated.get(&key)
-                })
-                // Pushing a packet to the socket may cause the socket to be disassociated, so we
-                // can't hold on to the borrow of `recv_sockets` when we call `push_in_packet`. We
-                // need to clone the socket instead so that we can drop the `recv_sockets` borrow.
-                .cloned()
-        };
+
+        // Check for a socket with the specific association, then fall back to the wildcard
+        // association.
+        log::trace!(
+            "Looking for socket {protocol:?} {}:{port} associated with peer {peer}",
+            self.addr
+        );
+        // Pushing a packet to the socket may cause the socket to be disassociated, so we can't hold
+        // on to the borrow of `recv_sockets` when we call `push_in_packet`. The demux returns a
+        // clone of the socket so that the `recv_sockets` borrow is dropped.
+        let maybe_socket = self.recv_sockets.borrow().get(protocol, port, peer);
 
         if let Some(socket) = maybe_socket {
             let recv_time = Worker::current_time().unwrap();
@@ -1,3 +1,5 @@
 pub mod interface;
 pub mod namespace;
+mod ports;
 mod queuing;
+mod socket_demux;
@@ -1,15 +1,20 @@
-use std::cell::{Cell, RefCell};
+use std::cell::{Cell, Ref, RefCell};
+use std::collections::HashSet;
 use std::net::{Ipv4Addr, SocketAddrV4};
 use std::ops::{Deref, DerefMut};
 use std::sync::Arc;
 
 use atomic_refcell::AtomicRefCell;
+use once_cell::unsync::OnceCell;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
 
 use crate::core::configuration::QDiscMode;
 use crate::core::worker::Worker;
 use crate::host::descriptor::socket::abstract_unix_ns::AbstractUnixNamespace;
 use crate::host::descriptor::socket::inet::InetSocket;
+use crate::host::descriptor::socket::netlink::NetlinkDumps;
 use crate::host::network::interface::{NetworkInterface, PcapOptions};
+use crate::host::network::ports;
 use crate::network::packet::IanaProtocol;
 
 // The start of our random port range in host order, used if application doesn't
@@ -31,6 +36,9 @@ pub struct NetworkNamespace {
 
     pub default_ip: Ipv4Addr,
 
+    /// The serialized responses to netlink interface dump requests, created on first use.
+    netlink_dumps: OnceCell<Arc<NetlinkDumps>>,
+
     // used for debugging to make sure we've cleaned up before being dropped
     has_run_cleanup: Cell<bool>,
 }
@@ -46,10 +54,20 @@ impl NetworkNamespace {
             localhost: RefCell::new(localhost),
             internet: RefCell::new(internet),
             default_ip: public_ip,
+            netlink_dumps: OnceCell::new(),
             has_run_cleanup: Cell::new(false),
         }
     }
 
+    /// The serialized responses to netlink `RTM_GETLINK` and `RTM_GETADDR` dump requests for this
+    /// namespace's interfaces.
+    pub fn netlink_dumps(&self) -> Arc<NetlinkDumps> {
+        Arc::clone(
+            self.netlink_dumps
+                .get_or_init(|| Arc::new(NetlinkDumps::new(self.default_ip))),
+        )
+    }
+
     /// Clean up the network namespace. This should be called while `Worker` has the active host
     /// set.
     pub fn cleanup(&self) {
@@ -60,9 +78,52 @@ impl NetworkNamespace {
         self.localhost.borrow().remove_all_sockets();
         self.internet.borrow().remove_all_sockets();
 
+        self.localhost.borrow().finish_pcap_file();
+        self.internet.borrow().finish_pcap_file();
+
         self.has_run_cleanup.set(true);
     }
 
+    /// Close the interfaces' pcap files (if configured and idle at time `now`) until they capture
+    /// another packet. This can be called when the host isn't running any processes.
+    pub fn release_pcap_files(&self, now: EmulatedTime) {
+        self.localhost.borrow().release_pcap_file(now);
+        self.internet.borrow().release_pcap_file(now);
+    }
+
+    /// Write the packets in the in-memory pcap rings of the interfaces (if configured) to pcap
+    /// files.
+    pub fn dump_pcap_rings(&self, reason: &str) {
+        self.localhost.borrow().dump_pcap_ring(reason);
+        self.internet.borrow().dump_pcap_ring(reason);
+    }
+
+    /// The number of bytes in the send and receive buffers of the sockets associated with the
+    /// interfaces. Sockets that are currently borrowed are skipped.
+    pub fn socket_buffer_bytes(&self) -> usize {
+        // a socket may be associated with both interfaces, or several times with one
+        let mut seen = HashSet::new();
+        let mut bytes = 0;
+
+        for interface in [&self.localhost, &self.internet] {
+            interface.borrow().for_each_socket(|socket| {
+                if !seen.insert(socket.canonical_handle()) {
+                    return;
+                }
+                if let Ok(socket) = socket.try_borrow() {
+                    bytes += socket.buffered_bytes();
+                }
+            });
+        }
+
+        bytes
+    }
+
+    /// The number of bytes allocated for the interfaces' in-memory pcap rings.
+    pub fn pcap_ring_bytes(&self) -> usize {
+        self.localhost.borrow().pcap_ring_bytes() + self.internet.borrow().pcap_ring_bytes()
+    }
+
     /// Returns `None` if there is no such interface.
     #[track_caller]
     pub fn interface_borrow(
@@ -107,24 +168,30 @@ impl NetworkNamespace {
         }
     }
 
+    /// Returns true if a socket can't be associated with the addresses. If `reuse_port` is set,
+    /// the socket sets `SO_REUSEPORT` and can share an association with the wildcard peer with
+    /// other sockets that set it.
     pub fn is_addr_in_use(
         &self,
         protocol_type: IanaProtocol,
         src: SocketAddrV4,
         dst: SocketAddrV4,
+        reuse_port: bool,
     ) -> Result<bool, NoInterface> {
         if src.ip().is_unspecified() {
             Ok(self
                 .localhost
                 .borrow()
-                .is_addr_in_use(protocol_type, src.port(), dst)
-                || self
-                    .internet
-                    .borrow()
-                    .is_addr_in_use(protocol_type, src.port(), dst))
+                .is_addr_in_use(protocol_type, src.port(), dst, reuse_port)
+                || self.internet.borrow().is_addr_in_use(
+                    protocol_type,
+                    src.port(),
+                    dst,
+                    reuse_port,
+                ))
         } else {
             match self.interface_borrow(*src.ip()) {
-                Some(i) => Ok(i.is_addr_in_use(protocol_type, src.port(), dst)),
+                Some(i) => Ok(i.is_addr_in_use(protocol_type, src.port(), dst, reuse_port)),
                 None => Err(NoInterface),
             }
         }
@@ -138,58 +205,43 @@ impl NetworkNamespace {
         peer: SocketAddrV4,
         mut rng: impl rand::Rng,
     ) -> Option<u16> {
-        // we need a random port that is free everywhere we need it to be.
-        // we have two modes here: first we just try grabbing a random port until we
-        // get a free one. if we cannot find one fast enough, then as a fallback we
-        // do an inefficient linear search that is guaranteed to succeed or fail.
-
-        // if choosing randomly doesn't succeed within 10 tries, then we have already
-        // allocated a lot of ports (>90% on average). then we fall back to linear search.
-        for _ in 0..10 {
-            let random_port = rng.random_range(MIN_RANDOM_PORT..=u16::MAX);
-
-            // `is_addr_in_use` will check all interfaces in the case of INADDR_ANY
-            let specific_in_use = self
-                .is_addr_in_use(
-                    protocol_type,
-                    SocketAddrV4::new(interface_ip, random_port),
-                    peer,
-                )
-                .unwrap_or(true);
-            let generic_in_use = self
-                .is_addr_in_use(
-                    protocol_type,
-                    SocketAddrV4::new(interface_ip, random_port),
-                    SocketAddrV4::new(Ipv4Addr::UNSPECIFIED, 0),
-                )
-                .unwrap_or(true);
-            if !specific_in_use && !generic_in_use {
-                return Some(random_port);
-            }
-        }
+        // we need a port that is free on every interface that we would associate it with
+        let interfaces: Vec<Ref<NetworkInterface>> = if interface_ip.is_unspecified() {
+            vec![self.localhost.borrow(), self.internet.borrow()]
+        } else if interface_ip.is_loopback() {
+            vec![self.localhost.borrow()]
+        } else if interface_ip == self.default_ip {
+            vec![self.internet.borrow()]
+        } else {
+            log::warn!("no interface for {interface_ip} to find an ephemeral port on");
+            return None;
+        };
 
-        // now if we tried too many times and still don't have a port, fall back
-        // to a linear search to make sure we get a free port if we have one.
-        // but start from a random port instead of the min.
+        // we take the first free port from a random starting point, searching the interfaces'
+        // port bitmaps a word (64 ports) at a time
         let start = rng.random_range(MIN_RANDOM_PORT..=u16::MAX);
-        for port in (start..=u16::MAX).chain(MIN_RANDOM_PORT..start) {
-            let specific_in_use = self
-                .is_addr_in_use(protocol_type, SocketAddrV4::new(interface_ip, port), peer)
-                .unwrap_or(true);
-            let generic_in_use = self
-                .is_addr_in_use(
-                    protocol_type,
-                    SocketAddrV4::new(interface_ip, port),
-                    SocketAddrV4::new(Ipv4Addr::UNSPECIFIED, 0),
-                )
-                .unwrap_or(true);
-            if !specific_in_use && !generic_in_use {
-                return Some(port);
-            }
+
+        // prefer a port that isn't used at all, so that each port is only used with one peer
+        // while there are ports left
+        let unused = ports::find_free_port(MIN_RANDOM_PORT, start, |i| {
+            interfaces
+                .iter()
+                .fold(0, |bits, x| bits | x.used_ports_word(protocol_type, i))
+        });
+        if unused.is_some() {
+            return unused;
         }
 
-        log::warn!("unable to find free ephemeral port for {protocol_type:?} peer {peer}");
-        None
+        // otherwise use any port that isn't used with this peer or by a listening socket
+        let free = ports::find_free_port(MIN_RANDOM_PORT, start, |i| {
+            interfaces.iter().fold(0, |bits, x| {
+                bits | x.unavailable_ports_word(protocol_type, peer, i)
+            })
+        });
+        if free.is_none() {
+            log::warn!("unable to find free ephemeral port for {protocol_type:?} peer {peer}");
+        }
+        free
     }
 
     /// Associate the socket with any applicable network interfaces. The socket will be
@@ -204,19 +256,21 @@ impl NetworkNamespace {
         protocol: IanaProtocol,
         bind_addr: SocketAddrV4,
         peer_addr: SocketAddrV4,
+        reuse_port: bool,
     ) -> AssociationHandle {
+        let port = bind_addr.port();
         if bind_addr.ip().is_unspecified() {
             // need to associate all interfaces
             self.localhost
                 .borrow()
-                .associate(socket, protocol, bind_addr.port(), peer_addr);
+                .associate(socket, protocol, port, peer_addr, reuse_port);
             self.internet
                 .borrow()
-                .associate(socket, protocol, bind_addr.port(), peer_addr);
+                .associate(socket, protocol, port, peer_addr, reuse_port);
         } else {
             // TODO: return error if interface does not exist
             if let Some(iface) = self.interface_borrow(*bind_addr.ip()) {
-                iface.associate(socket, protocol, bind_addr.port(), peer_addr);
+                iface.associate(socket, protocol, port, peer_addr, reuse_port);
             }
         }
 
@@ -224,11 +278,13 @@ impl NetworkNamespace {
             protocol,
             local_addr: bind_addr,
             remote_addr: peer_addr,
+            socket: socket.identity(),
         }
     }
 
     /// Disassociate the socket associated using the local and remote addresses from all network
-    /// interfaces.
+    /// interfaces. Sockets with `SO_REUSEPORT` may share the addresses, so `socket` identifies the
+    /// socket (see [`InetSocket::identity`]). If it's `None`, any one of them is disassociated.
     ///
     /// Is only public so that it can be called from `host_disassociateInterface`. Normally this
     /// should only be called from the [`AssociationHandle`].
@@ -237,20 +293,22 @@ impl NetworkNamespace {
         protocol: IanaProtocol,
         bind_addr: SocketAddrV4,
         peer_addr: SocketAddrV4,
+        socket: Option<usize>,
     ) {
+        let port = bind_addr.port();
         if bind_addr.ip().is_unspecified() {
             // need to disassociate all interfaces
             self.localhost
                 .borrow()
-                .disassociate(protocol, bind_addr.port(), peer_addr);
+                .disassociate(protocol, port, peer_addr, socket);
 
             self.internet
                 .borrow()
-                .disassociate(protocol, bind_addr.port(), peer_addr);
+                .disassociate(protocol, port, peer_addr, socket);
         } else {
             // TODO: return error if interface does not exist
             if let Some(iface) = self.interface_borrow(*bind_addr.ip()) {
-                iface.disassociate(protocol, bind_addr.port(), peer_addr);
+                iface.disassociate(protocol, port, peer_addr, socket);
             }
         }
     }
@@ -284,6 +342,8 @@ pub struct AssociationHandle {
     protocol: IanaProtocol,
     local_addr: SocketAddrV4,
     remote_addr: SocketAddrV4,
+    /// The [`InetSocket::identity`] of the associated socket.
+    socket: usize,
 }
 
 impl AssociationHandle {
@@ -303,6 +363,7 @@ impl std::ops::Drop for AssociationHandle {
                 self.protocol,
                 self.local_addr,
                 self.remote_addr,
+                Some(self.socket),
             );
         })
         .unwrap();
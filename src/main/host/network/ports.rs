@@ -0,0 +1,145 @@
+//! Sets of local ports, used to find free ephemeral ports without probing the socket tables for
+//! each candidate port.
+
+use rustc_hash::FxHashMap;
+
+/// The number of ports in each word of a [`PortBitmap`].
+const WORD_BITS: usize = u64::BITS as usize;
+
+/// The number of words needed for all 2^16 ports.
+const NUM_WORDS: usize = (u16::MAX as usize + 1) / WORD_BITS;
+
+/// A set of ports, stored as a bitmap with 64 ports per word. Only non-zero words are stored, so
+/// that a set of a few ports (for example the ports used with a single peer) is small.
+#[derive(Debug, Default, Clone)]
+pub struct PortBitmap {
+    words: FxHashMap<u16, u64>,
+}
+
+impl PortBitmap {
+    fn position(port: u16) -> (u16, u64) {
+        let port = usize::from(port);
+        let word = u16::try_from(port / WORD_BITS).unwrap();
+        (word, 1 << (port % WORD_BITS))
+    }
+
+    /// Returns `false` if the port was already in the set.
+    pub fn insert(&mut self, port: u16) -> bool {
+        let (word, bit) = Self::position(port);
+        let bits = self.words.entry(word).or_default();
+        let inserted = *bits & bit == 0;
+        *bits |= bit;
+        inserted
+    }
+
+    /// Returns `false` if the port wasn't in the set.
+    pub fn remove(&mut self, port: u16) -> bool {
+        let (word, bit) = Self::position(port);
+        let Some(bits) = self.words.get_mut(&word) else {
+            return false;
+        };
+        let removed = *bits & bit != 0;
+        *bits &= !bit;
+        if *bits == 0 {
+            self.words.remove(&word);
+        }
+        removed
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.words.is_empty()
+    }
+
+    /// The bits of word `index`, where bit `i` is set if port `index * 64 + i` is in the set.
+    pub fn word(&self, index: usize) -> u64 {
+        if index >= NUM_WORDS {
+            return 0;
+        }
+        let index = u16::try_from(index).unwrap();
+        self.words.get(&index).copied().unwrap_or(0)
+    }
+}
+
+/// Find the first port in `start..=u16::MAX`, or otherwise in `min..start`, that isn't set in the
+/// bitmap given by `used`, which returns the bits of a word as in [`PortBitmap::word`]. Each word
+/// is only requested once, so at most [`NUM_WORDS`] words are looked at.
+pub fn find_free_port(min: u16, start: u16, used: impl Fn(usize) -> u64) -> Option<u16> {
+    assert!(min <= start);
+    find_free_port_in(start, u16::MAX, &used).or_else(|| {
+        let end = start.checked_sub(1)?;
+        (min <= end).then(|| find_free_port_in(min, end, &used))?
+    })
+}
+
+/// Find the first port in `lo..=hi` that isn't set in `used`.
+fn find_free_port_in(lo: u16, hi: u16, used: &impl Fn(usize) -> u64) -> Option<u16> {
+    let (lo, hi) = (usize::from(lo), usize::from(hi));
+    for index in lo / WORD_BITS..=hi / WORD_BITS {
+        let mut free = !used(index);
+        if index == lo / WORD_BITS {
+            free &= u64::MAX << (lo % WORD_BITS);
+        }
+        if index == hi / WORD_BITS {
+            free &= u64::MAX >> (WORD_BITS - 1 - hi % WORD_BITS);
+        }
+        if free != 0 {
+            let port = index * WORD_BITS + usize::try_from(free.trailing_zeros()).unwrap();
+            return Some(u16::try_from(port).unwrap());
+        }
+    }
+    None
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_bitmap() {
+        let mut ports = PortBitmap::default();
+        assert!(ports.is_empty());
+        assert!(ports.insert(80));
+        assert!(!ports.insert(80));
+        assert!(ports.insert(u16::MAX));
+        assert_eq!(ports.word(1), 1 << 16);
+        assert_eq!(ports.word(NUM_WORDS - 1), 1 << 63);
+        assert_eq!(ports.word(NUM_WORDS), 0);
+
+        assert!(ports.remove(80));
+        assert!(!ports.remove(80));
+        assert!(ports.remove(u16::MAX));
+        assert!(ports.is_empty());
+    }
+
+    #[test]
+    fn test_find_free_port() {
+        let mut used = PortBitmap::default();
+        let find = |used: &PortBitmap, min, start| find_free_port(min, start, |i| used.word(i));
+
+        assert_eq!(find(&used, 10000, 20000), Some(20000));
+        assert_eq!(find(&used, 10000, u16::MAX), Some(u16::MAX));
+
+        for port in 20000..20100 {
+            used.insert(port);
+        }
+        assert_eq!(find(&used, 10000, 20000), Some(20100));
+        assert_eq!(find(&used, 10000, 19999), Some(19999));
+
+        // wraps around to `min`
+        for port in 20000..=u16::MAX {
+            used.insert(port);
+        }
+        assert_eq!(find(&used, 10000, 20000), Some(10000));
+        assert_eq!(find(&used, 20000, 20000), None);
+
+        used.insert(10000);
+        used.insert(10001);
+        assert_eq!(find(&used, 10000, 30000), Some(10002));
+
+        for port in 10000..20000 {
+            used.insert(port);
+        }
+        assert_eq!(find(&used, 10000, 10000), None);
+        assert_eq!(find(&used, 0, 10000), Some(0));
+    }
+}
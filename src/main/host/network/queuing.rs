@@ -6,6 +6,9 @@ use std::hash::Hash;
 /// Tracks the order in which items are pushed into the queue, which is useful for some disciplines.
 type PushOrder = u64;
 
+/// The queue never shrinks its capacity below this many items.
+const MIN_CAPACITY: usize = 16;
+
 /// An item wrapper that allows us to implement a min-heap WRT item priority. Our implementation of
 /// the `Ord` trait is such that the item containing the smallest priority (across all items) will
 /// be dequeued first, where ties are broken by preferring the item that was pushed into the queue
@@ -68,9 +71,9 @@ pub enum NetworkQueueKind {
 /// different data structures to help us realize different queuing strategies. The supported
 /// variants match those described in `NetworkQueueKind`.
 ///
-/// Note that the `NetworkQueue` will live for the lifetime of the simulation and these qdisc data
-/// structures will only ever grow and not shrink. Thus, if there's a burst of packets, the queue
-/// will grow to accommodate them but will never shrink again to reclaim memory.
+/// Note that the `NetworkQueue` will live for the lifetime of the simulation. If there's a burst of
+/// items, these qdisc data structures will grow to accommodate them, and are shrunk again by
+/// `NetworkQueue::pop()` once most of their capacity is unused.
 enum QueuingDiscipline<T> {
     /// See `NetworkQueueKind::MinPriority`.
     MinPriority((BinaryHeap<Prioritized<T>>, PushOrder)),
@@ -151,9 +154,29 @@ impl<T: Clone + Debug + Eq + Hash> NetworkQueue<T> {
         }
         .inspect(|x| {
             assert!(self.membership.remove(x));
+            self.maybe_shrink();
         })
     }
 
+    /// Reclaim memory after a burst of items. The capacity is halved once it's more than four
+    /// times the number of queued items, so that alternating pushes and pops never repeatedly
+    /// reallocate, and the cost of shrinking is amortized over the pops.
+    fn maybe_shrink(&mut self) {
+        let capacity = self.membership.capacity();
+        let len = self.membership.len();
+        // the hash set's capacity is rounded up, so leave some slack to not shrink it repeatedly
+        if capacity <= 2 * MIN_CAPACITY || len.saturating_mul(4) >= capacity {
+            return;
+        }
+
+        let new_capacity = std::cmp::max(MIN_CAPACITY, len.saturating_mul(2));
+        self.membership.shrink_to(new_capacity);
+        match &mut self.queue {
+            QueuingDiscipline::MinPriority((heap, _)) => heap.shrink_to(new_capacity),
+            QueuingDiscipline::FirstInFirstOut(deque) => deque.shrink_to(new_capacity),
+        }
+    }
+
     /// Pushes an item into the queue, internally cloning it to support membership checks. It may be
     /// useful to wrap items with a `std::rc::Rc` or `std::sync::Arc` before calling this function.
     ///
@@ -365,6 +388,36 @@ mod tests {
         );
     }
 
+    #[test]
+    fn shrink_after_burst() {
+        for kind in [
+            NetworkQueueKind::MinPriority,
+            NetworkQueueKind::FirstInFirstOut,
+        ] {
+            let mut q = new_helper(kind);
+
+            const NUM_ITEMS: u64 = 10_000;
+            for i in 0..NUM_ITEMS {
+                q.push(format!("Item:{i}"), Some(i));
+            }
+            assert!(q.membership.capacity() >= NUM_ITEMS as usize);
+
+            for i in 0..NUM_ITEMS {
+                assert_eq!(q.pop(), Some(format!("Item:{i}")));
+            }
+            len_helper(&q, 0);
+            assert!(q.membership.capacity() < 4 * MIN_CAPACITY);
+            match &q.queue {
+                QueuingDiscipline::MinPriority((heap, _)) => {
+                    assert!(heap.capacity() < 4 * MIN_CAPACITY)
+                }
+                QueuingDiscipline::FirstInFirstOut(deque) => {
+                    assert!(deque.capacity() < 4 * MIN_CAPACITY)
+                }
+            }
+        }
+    }
+
     #[test]
     fn rc_wrapped_items() {
         // This test is very specific to the current implementation which clones an item on push,
@@ -0,0 +1,576 @@
+use std::cell::RefCell;
+use std::hash::{Hash, Hasher};
+use std::net::{Ipv4Addr, SocketAddrV4};
+
+use rustc_hash::{FxHashMap, FxHasher};
+
+use crate::host::network::ports::PortBitmap;
+use crate::network::packet::IanaProtocol;
+
+/// The peer of sockets that can receive packets from any peer.
+const WILDCARD_PEER: SocketAddrV4 = SocketAddrV4::new(Ipv4Addr::UNSPECIFIED, 0);
+
+#[derive(Copy, Clone, Debug, Eq, Hash, PartialEq)]
+struct FlowKey {
+    protocol: IanaProtocol,
+    port: u16,
+    peer: SocketAddrV4,
+}
+
+#[derive(Copy, Clone, Debug, Eq, Hash, PartialEq)]
+struct ListenerKey {
+    protocol: IanaProtocol,
+    port: u16,
+}
+
+/// The sockets associated with the wildcard peer on one port. There's only more than one if they
+/// all set `SO_REUSEPORT`.
+#[derive(Debug)]
+struct ListenerGroup<S> {
+    /// Ordered by `seq`.
+    members: Vec<GroupMember<S>>,
+    /// Can other sockets with `SO_REUSEPORT` join the group?
+    reuse_port: bool,
+    /// The `seq` of the member that each peer was given to, if the group pins peers. A TCP
+    /// listener demuxes the packets of its established connections itself, so their peers must
+    /// stay with it when other members join. `None` for groups that don't pin.
+    pins: Option<RefCell<FxHashMap<SocketAddrV4, u64>>>,
+}
+
+#[derive(Debug)]
+struct GroupMember<S> {
+    socket: S,
+    /// Identifies the socket when it's removed.
+    id: usize,
+    /// When the socket joined, which is used instead of `id` to choose between the members so
+    /// that the choice doesn't depend on memory addresses.
+    seq: u64,
+}
+
+impl<S> ListenerGroup<S> {
+    fn new(member: GroupMember<S>, protocol: IanaProtocol, reuse_port: bool) -> Self {
+        // only groups that set `reuse_port` can be joined by other members
+        let pin_peers = reuse_port && protocol == IanaProtocol::Tcp;
+        Self {
+            members: vec![member],
+            reuse_port,
+            pins: pin_peers.then(|| RefCell::new(FxHashMap::default())),
+        }
+    }
+
+    /// The member that should receive packets from `peer`. Each peer is consistently given to the
+    /// same member, and the peers are spread evenly over the members. This uses rendezvous
+    /// hashing, so when a member leaves the group only the peers of that member move to other
+    /// members, and the peers of the other members are unaffected. If the group pins peers, a peer
+    /// also stays with its member when other members join.
+    fn select(&self, peer: SocketAddrV4) -> &S {
+        let Some(pins) = &self.pins else {
+            return &self.members[self.rendezvous(peer)].socket;
+        };
+
+        let mut pins = pins.borrow_mut();
+        if let Some(seq) = pins.get(&peer) {
+            let index = self.members.binary_search_by_key(seq, |x| x.seq).unwrap();
+            return &self.members[index].socket;
+        }
+
+        let member = &self.members[self.rendezvous(peer)];
+        pins.insert(peer, member.seq);
+        &member.socket
+    }
+
+    /// The index of the member that rendezvous hashing gives `peer` to.
+    fn rendezvous(&self, peer: SocketAddrV4) -> usize {
+        if self.members.len() == 1 {
+            return 0;
+        }
+
+        let mut hasher = FxHasher::default();
+        peer.hash(&mut hasher);
+        let peer_hash = hasher.finish();
+
+        (0..self.members.len())
+            .max_by_key(|&i| mix(peer_hash ^ self.members[i].seq))
+            .unwrap()
+    }
+
+    /// Remove the member at `index`, and unpin its peers so that they move to other members.
+    fn remove(&mut self, index: usize) -> GroupMember<S> {
+        // keep the order of the remaining members so that the oldest is removed first
+        let member = self.members.remove(index);
+        if let Some(pins) = &mut self.pins {
+            pins.get_mut().retain(|_, seq| *seq != member.seq);
+        }
+        member
+    }
+}
+
+/// The splitmix64 finalizer, so that the members' weights for a peer are independent.
+fn mix(mut x: u64) -> u64 {
+    x = (x ^ (x >> 30)).wrapping_mul(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)).wrapping_mul(0x94d049bb133111eb);
+    x ^ (x >> 31)
+}
+
+/// The sockets associated with a network interface, which finds the socket that should receive
+/// each incoming packet.
+///
+/// Sockets associated with a specific peer (for example connected TCP sockets) are kept separate
+/// from sockets associated with the wildcard peer (for example listening TCP sockets and unbound
+/// UDP sockets), so that a lookup is at most one probe of each table. The tables use a fast
+/// non-cryptographic hash since the keys are not controlled by an adversary. The result of the
+/// last lookup is cached, since consecutive packets often belong to the same flow.
+///
+/// The ports in use are also tracked for each protocol in [`PortBitmap`]s, so that free ephemeral
+/// ports can be found without probing the tables for each candidate port.
+pub struct SocketDemux<S: Clone> {
+    /// Sockets associated with a specific peer.
+    flows: FxHashMap<FlowKey, S>,
+    /// Sockets associated with the wildcard peer.
+    listeners: FxHashMap<ListenerKey, ListenerGroup<S>>,
+    /// The `seq` of the next listener group member.
+    next_seq: u64,
+    /// The key and result of the last successful lookup. Cleared whenever the tables change.
+    last_hit: RefCell<Option<(FlowKey, S)>>,
+    /// The ports in use for each protocol.
+    ports: FxHashMap<IanaProtocol, ProtocolPorts>,
+}
+
+/// The ports in use by the associations of one protocol.
+#[derive(Debug, Default)]
+struct ProtocolPorts {
+    /// Ports associated with the wildcard peer.
+    listeners: PortBitmap,
+    /// Ports associated with each specific peer.
+    peers: FxHashMap<SocketAddrV4, PortBitmap>,
+    /// Ports with any association.
+    used: PortBitmap,
+    /// The number of associations of each port in `used`.
+    counts: FxHashMap<u16, u32>,
+}
+
+impl ProtocolPorts {
+    fn insert(&mut self, port: u16, peer: SocketAddrV4) {
+        if peer == WILDCARD_PEER {
+            self.listeners.insert(port);
+        } else {
+            self.peers.entry(peer).or_default().insert(port);
+        }
+
+        *self.counts.entry(port).or_default() += 1;
+        self.used.insert(port);
+    }
+
+    fn remove(&mut self, port: u16, peer: SocketAddrV4) {
+        if peer == WILDCARD_PEER {
+            self.listeners.remove(port);
+        } else if let Some(ports) = self.peers.get_mut(&peer) {
+            ports.remove(port);
+            if ports.is_empty() {
+                self.peers.remove(&peer);
+            }
+        }
+
+        let count = self.counts.get_mut(&port).unwrap();
+        *count -= 1;
+        if *count == 0 {
+            self.counts.remove(&port);
+            self.used.remove(port);
+        }
+    }
+}
+
+impl<S: Clone> SocketDemux<S> {
+    pub fn new() -> Self {
+        Self {
+            flows: FxHashMap::default(),
+            listeners: FxHashMap::default(),
+            next_seq: 0,
+            last_hit: RefCell::new(None),
+            ports: FxHashMap::default(),
+        }
+    }
+
+    /// Associate the socket with the protocol, local port, and peer. The peer may be the wildcard
+    /// address `0.0.0.0:0` to receive packets from any peer. The `id` identifies the socket when
+    /// it's removed. If `reuse_port` is set, the socket can share an association with the wildcard
+    /// peer with other sockets that set `reuse_port`. Returns `false` and does nothing if the
+    /// association is already taken (see [`Self::is_available`]).
+    pub fn insert(
+        &mut self,
+        protocol: IanaProtocol,
+        port: u16,
+        peer: SocketAddrV4,
+        socket: S,
+        id: usize,
+        reuse_port: bool,
+    ) -> bool {
+        if !self.is_available(protocol, port, peer, reuse_port) {
+            return false;
+        }
+        self.last_hit.get_mut().take();
+
+        if peer == WILDCARD_PEER {
+            let key = ListenerKey { protocol, port };
+            let member = GroupMember {
+                socket,
+                id,
+                seq: self.next_seq,
+            };
+            self.next_seq += 1;
+
+            if let Some(group) = self.listeners.get_mut(&key) {
+                // the port is already marked as used
+                group.members.push(member);
+                return true;
+            }
+            self.listeners
+                .insert(key, ListenerGroup::new(member, protocol, reuse_port));
+        } else {
+            let key = FlowKey {
+                protocol,
+                port,
+                peer,
+            };
+            self.flows.insert(key, socket);
+        }
+        self.ports.entry(protocol).or_default().insert(port, peer);
+        true
+    }
+
+    /// Remove the socket with exactly this association. If several sockets share the association,
+    /// `id` chooses the one to remove, and if `id` is `None` the oldest one is removed.
+    pub fn remove(
+        &mut self,
+        protocol: IanaProtocol,
+        port: u16,
+        peer: SocketAddrV4,
+        id: Option<usize>,
+    ) -> Option<S> {
+        self.last_hit.get_mut().take();
+
+        let socket = if peer == WILDCARD_PEER {
+            let key = ListenerKey { protocol, port };
+            let group = self.listeners.get_mut(&key)?;
+            let index = match id {
+                Some(id) => group.members.iter().position(|x| x.id == id)?,
+                None => 0,
+            };
+            let member = group.remove(index);
+            if !group.members.is_empty() {
+                return Some(member.socket);
+            }
+            self.listeners.remove(&key);
+            member.socket
+        } else {
+            self.flows.remove(&FlowKey {
+                protocol,
+                port,
+                peer,
+            })?
+        };
+        self.ports.get_mut(&protocol).unwrap().remove(port, peer);
+        Some(socket)
+    }
+
+    /// The bits of word `index` of the bitmap of ports that have any association for `protocol`
+    /// (see [`PortBitmap::word`]).
+    pub fn used_ports_word(&self, protocol: IanaProtocol, index: usize) -> u64 {
+        self.ports
+            .get(&protocol)
+            .map_or(0, |ports| ports.used.word(index))
+    }
+
+    /// The bits of word `index` of the bitmap of ports that a new association with `peer` for
+    /// `protocol` couldn't use without conflicting with an existing association: the ports
+    /// associated with `peer` or with the wildcard peer (see [`PortBitmap::word`]).
+    pub fn unavailable_ports_word(
+        &self,
+        protocol: IanaProtocol,
+        peer: SocketAddrV4,
+        index: usize,
+    ) -> u64 {
+        let Some(ports) = self.ports.get(&protocol) else {
+            return 0;
+        };
+        let peer_ports = ports.peers.get(&peer).map_or(0, |x| x.word(index));
+        ports.listeners.word(index) | peer_ports
+    }
+
+    /// Returns true if there's a socket with exactly this association.
+    pub fn contains(&self, protocol: IanaProtocol, port: u16, peer: SocketAddrV4) -> bool {
+        if peer == WILDCARD_PEER {
+            self.listeners.contains_key(&ListenerKey { protocol, port })
+        } else {
+            self.flows.contains_key(&FlowKey {
+                protocol,
+                port,
+                peer,
+            })
+        }
+    }
+
+    /// Returns true if a socket could be inserted with this association: there's no socket with
+    /// exactly this association, or the association is with the wildcard peer and the sockets
+    /// that have it and the new socket all set `reuse_port`.
+    pub fn is_available(
+        &self,
+        protocol: IanaProtocol,
+        port: u16,
+        peer: SocketAddrV4,
+        reuse_port: bool,
+    ) -> bool {
+        if peer == WILDCARD_PEER {
+            match self.listeners.get(&ListenerKey { protocol, port }) {
+                Some(group) => reuse_port && group.reuse_port,
+                None => true,
+            }
+        } else {
+            !self.contains(protocol, port, peer)
+        }
+    }
+
+    /// Find the socket that should receive a packet from `peer` to the local `port`: the socket
+    /// associated with that specific peer if there is one, or otherwise the socket associated with
+    /// the wildcard peer. If several sockets share the association with the wildcard peer, each
+    /// peer is consistently given to one of them.
+    pub fn get(&self, protocol: IanaProtocol, port: u16, peer: SocketAddrV4) -> Option<S> {
+        let key = FlowKey {
+            protocol,
+            port,
+            peer,
+        };
+
+        if let Some((last_key, socket)) = self.last_hit.borrow().as_ref() {
+            if *last_key == key {
+                return Some(socket.clone());
+            }
+        }
+
+        let socket = self
+            .flows
+            .get(&key)
+            .or_else(|| {
+                self.listeners
+                    .get(&ListenerKey { protocol, port })
+                    .map(|x| x.select(peer))
+            })?
+            .clone();
+
+        self.last_hit.replace(Some((key, socket.clone())));
+        Some(socket)
+    }
+
+    /// All associated sockets. A socket with several associations is returned once for each.
+    pub fn iter(&self) -> impl Iterator<Item = &S> {
+        self.flows.values().chain(
+            self.listeners
+                .values()
+                .flat_map(|x| x.members.iter().map(|x| &x.socket)),
+        )
+    }
+
+    /// Remove all sockets.
+    pub fn clear(&mut self) {
+        self.last_hit.get_mut().take();
+        self.flows.clear();
+        self.listeners.clear();
+        self.ports.clear();
+    }
+}
+
+impl<S: Clone> Default for SocketDemux<S> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_lookup() {
+        let mut demux = SocketDemux::new();
+        let peer_1 = SocketAddrV4::new(Ipv4Addr::new(1, 2, 3, 4), 5000);
+        let peer_2 = SocketAddrV4::new(Ipv4Addr::new(1, 2, 3, 4), 5001);
+
+        assert!(demux.insert(IanaProtocol::Tcp, 80, WILDCARD_PEER, "listener", 0, false));
+        assert!(demux.insert(IanaProtocol::Tcp, 80, peer_1, "flow", 0, false));
+        assert!(!demux.insert(IanaProtocol::Tcp, 80, peer_1, "other", 0, false));
+        assert!(demux.insert(IanaProtocol::Udp, 80, peer_1, "udp", 0, false));
+
+        assert_eq!(demux.get(IanaProtocol::Tcp, 80, peer_1), Some("flow"));
+        // cached
+        assert_eq!(demux.get(IanaProtocol::Tcp, 80, peer_1), Some("flow"));
+        assert_eq!(demux.get(IanaProtocol::Tcp, 80, peer_2), Some("listener"));
+        assert_eq!(demux.get(IanaProtocol::Udp, 80, peer_1), Some("udp"));
+        assert_eq!(demux.get(IanaProtocol::Udp, 80, peer_2), None);
+        assert_eq!(demux.get(IanaProtocol::Tcp, 81, peer_1), None);
+
+        assert!(demux.contains(IanaProtocol::Tcp, 80, WILDCARD_PEER));
+        assert!(!demux.contains(IanaProtocol::Tcp, 80, peer_2));
+
+        // the cache must not return removed sockets
+        assert_eq!(demux.get(IanaProtocol::Tcp, 80, peer_1), Some("flow"));
+        assert_eq!(
+            demux.remove(IanaProtocol::Tcp, 80, peer_1, None),
+            Some("flow")
+        );
+        assert_eq!(demux.get(IanaProtocol::Tcp, 80, peer_1), Some("listener"));
+        assert_eq!(
+            demux.remove(IanaProtocol::Tcp, 80, WILDCARD_PEER, None),
+            Some("listener")
+        );
+        assert_eq!(demux.get(IanaProtocol::Tcp, 80, peer_1), None);
+
+        demux.clear();
+        assert_eq!(demux.get(IanaProtocol::Udp, 80, peer_1), None);
+    }
+
+    #[test]
+    fn test_ports() {
+        let mut demux = SocketDemux::new();
+        let peer_1 = SocketAddrV4::new(Ipv4Addr::new(1, 2, 3, 4), 5000);
+        let peer_2 = SocketAddrV4::new(Ipv4Addr::new(1, 2, 3, 4), 5001);
+        let tcp = IanaProtocol::Tcp;
+
+        // ports 64 and 65 are in word 1
+        assert!(demux.insert(tcp, 64, WILDCARD_PEER, "listener", 0, false));
+        assert!(demux.insert(tcp, 65, peer_1, "flow", 0, false));
+        assert!(demux.insert(tcp, 65, peer_2, "flow", 0, false));
+        assert!(!demux.insert(tcp, 65, peer_2, "other", 0, false));
+
+        assert_eq!(demux.used_ports_word(tcp, 1), 0b11);
+        assert_eq!(demux.used_ports_word(tcp, 0), 0);
+        assert_eq!(demux.used_ports_word(IanaProtocol::Udp, 1), 0);
+        assert_eq!(demux.unavailable_ports_word(tcp, peer_1, 1), 0b11);
+        assert_eq!(demux.unavailable_ports_word(tcp, WILDCARD_PEER, 1), 0b01);
+
+        // the port is still used with the other peer
+        assert_eq!(demux.remove(tcp, 65, peer_1, None), Some("flow"));
+        assert_eq!(demux.remove(tcp, 65, peer_1, None), None);
+        assert_eq!(demux.used_ports_word(tcp, 1), 0b11);
+        assert_eq!(demux.unavailable_ports_word(tcp, peer_1, 1), 0b01);
+
+        assert_eq!(demux.remove(tcp, 65, peer_2, None), Some("flow"));
+        assert_eq!(demux.used_ports_word(tcp, 1), 0b01);
+        assert_eq!(demux.remove(tcp, 64, WILDCARD_PEER, None), Some("listener"));
+        assert_eq!(demux.used_ports_word(tcp, 1), 0);
+        assert!(demux.ports[&tcp].peers.is_empty());
+        assert!(demux.ports[&tcp].counts.is_empty());
+    }
+
+    #[test]
+    fn test_reuse_port() {
+        let mut demux = SocketDemux::new();
+        let udp = IanaProtocol::Udp;
+        let peers: Vec<_> = (0..1000)
+            .map(|i| SocketAddrV4::new(Ipv4Addr::new(1, 2, 3, 4), 5000 + i))
+            .collect();
+
+        // a socket without reuse_port can't share the association, or be joined
+        assert!(demux.insert(udp, 80, WILDCARD_PEER, 'a', 1, false));
+        assert!(!demux.is_available(udp, 80, WILDCARD_PEER, true));
+        assert!(!demux.insert(udp, 80, WILDCARD_PEER, 'b', 2, true));
+        assert_eq!(demux.remove(udp, 80, WILDCARD_PEER, Some(1)), Some('a'));
+
+        assert!(demux.insert(udp, 80, WILDCARD_PEER, 'a', 1, true));
+        assert!(demux.insert(udp, 80, WILDCARD_PEER, 'b', 2, true));
+        assert!(demux.insert(udp, 80, WILDCARD_PEER, 'c', 3, true));
+        assert!(!demux.is_available(udp, 80, WILDCARD_PEER, false));
+        assert!(!demux.insert(udp, 80, WILDCARD_PEER, 'd', 4, false));
+        assert_eq!(demux.used_ports_word(udp, 1), 0b1 << (80 - 64));
+
+        let lookup = |demux: &SocketDemux<char>| -> Vec<char> {
+            peers
+                .iter()
+                .map(|&peer| demux.get(udp, 80, peer).unwrap())
+                .collect()
+        };
+
+        // each peer is consistently given to one socket, and each socket gets some peers
+        let before = lookup(&demux);
+        assert_eq!(before, lookup(&demux));
+        for c in ['a', 'b', 'c'] {
+            let count = before.iter().filter(|&&x| x == c).count();
+            assert!(count > 200, "{c} received {count} peers");
+        }
+
+        // only the peers of the removed socket move
+        assert_eq!(demux.remove(udp, 80, WILDCARD_PEER, Some(2)), Some('b'));
+        assert_eq!(demux.remove(udp, 80, WILDCARD_PEER, Some(2)), None);
+        let after = lookup(&demux);
+        for (x, y) in before.iter().zip(&after) {
+            assert!(*y != 'b');
+            if *x != 'b' {
+                assert_eq!(x, y);
+            }
+        }
+
+        assert_eq!(demux.iter().count(), 2);
+        assert_eq!(demux.remove(udp, 80, WILDCARD_PEER, None), Some('a'));
+        assert_eq!(demux.used_ports_word(udp, 1), 0b1 << (80 - 64));
+        assert_eq!(demux.remove(udp, 80, WILDCARD_PEER, Some(3)), Some('c'));
+        assert_eq!(demux.used_ports_word(udp, 1), 0);
+        assert!(demux.is_available(udp, 80, WILDCARD_PEER, false));
+    }
+
+    #[test]
+    fn test_reuse_port_join_after_connections() {
+        let mut demux = SocketDemux::new();
+        let tcp = IanaProtocol::Tcp;
+        let udp = IanaProtocol::Udp;
+        let peers: Vec<_> = (0..1000)
+            .map(|i| SocketAddrV4::new(Ipv4Addr::new(1, 2, 3, 4), 5000 + i))
+            .collect();
+        let new_peers: Vec<_> = (0..1000)
+            .map(|i| SocketAddrV4::new(Ipv4Addr::new(5, 6, 7, 8), 5000 + i))
+            .collect();
+
+        let lookup = |demux: &SocketDemux<char>, protocol, peers: &[SocketAddrV4]| -> Vec<char> {
+            peers
+                .iter()
+                .map(|&peer| demux.get(protocol, 80, peer).unwrap())
+                .collect()
+        };
+
+        for protocol in [tcp, udp] {
+            assert!(demux.insert(protocol, 80, WILDCARD_PEER, 'a', 1, true));
+            assert!(demux.insert(protocol, 80, WILDCARD_PEER, 'b', 2, true));
+        }
+        let tcp_before = lookup(&demux, tcp, &peers);
+        let udp_before = lookup(&demux, udp, &peers);
+        for protocol in [tcp, udp] {
+            assert!(demux.insert(protocol, 80, WILDCARD_PEER, 'c', 3, true));
+        }
+
+        // the tcp peers that were already seen keep their member, and new peers are spread over
+        // all members
+        assert_eq!(tcp_before, lookup(&demux, tcp, &peers));
+        let tcp_new = lookup(&demux, tcp, &new_peers);
+        for c in ['a', 'b', 'c'] {
+            let count = tcp_new.iter().filter(|&&x| x == c).count();
+            assert!(count > 200, "{c} received {count} peers");
+        }
+
+        // udp peers are rehashed over all members
+        let udp_after = lookup(&demux, udp, &peers);
+        assert!(udp_after.contains(&'c'));
+        for (x, y) in udp_before.iter().zip(&udp_after) {
+            assert!(x == y || *y == 'c');
+        }
+
+        // the peers of a removed member are unpinned and move to other members, and the other
+        // peers stay
+        let tcp_before = lookup(&demux, tcp, &peers);
+        assert_eq!(demux.remove(tcp, 80, WILDCARD_PEER, Some(1)), Some('a'));
+        let tcp_after = lookup(&demux, tcp, &peers);
+        for (x, y) in tcp_before.iter().zip(&tcp_after) {
+            assert!(*y != 'a');
+            if *x != 'a' {
+                assert_eq!(x, y);
+            }
+        }
+    }
+}
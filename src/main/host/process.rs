@@ -4,15 +4,17 @@ use std::cell::{Cell, Ref, RefCell, RefMut};
 use std::collections::BTreeMap;
 use std::ffi::{CStr, CString, c_char, c_void};
 use std::fmt::Write;
+use std::io::Write as _;
 use std::num::TryFromIntError;
 use std::ops::{Deref, DerefMut};
 use std::os::fd::AsRawFd;
 use std::path::{Path, PathBuf};
 use std::sync::Arc;
-use std::sync::atomic::Ordering;
+use std::sync::atomic::{AtomicU64, Ordering};
 #[cfg(feature = "perf_timers")]
 use std::time::Duration;
 
+use atomic_refcell::AtomicRefCell;
 use linux_api::errno::Errno;
 use linux_api::fcntl::OFlag;
 use linux_api::posix_types::Pid;
@@ -21,6 +23,7 @@ use linux_api::signal::{
     LinuxDefaultAction, SigActionFlags, Signal, SignalFromI32Error, defaultaction, siginfo_t,
     sigset_t,
 };
+use linux_api::syscall::SyscallNum;
 use log::{debug, trace, warn};
 use rustix::process::{WaitOptions, WaitStatus};
 use shadow_shim_helper_rs::HostId;
@@ -28,27 +31,31 @@ use shadow_shim_helper_rs::explicit_drop::{ExplicitDrop, ExplicitDropper};
 use shadow_shim_helper_rs::rootedcell::Root;
 use shadow_shim_helper_rs::rootedcell::rc::RootedRc;
 use shadow_shim_helper_rs::rootedcell::refcell::RootedRefCell;
-use shadow_shim_helper_rs::shim_shmem::ProcessShmem;
+use shadow_shim_helper_rs::shim_shmem::{ProcessShmem, ThreadShmem};
 use shadow_shim_helper_rs::simulation_time::SimulationTime;
 use shadow_shim_helper_rs::syscall_types::{ForeignPtr, ManagedPhysicalMemoryAddr};
 use shadow_shmem::allocator::ShMemBlock;
 
 use super::descriptor::descriptor_table::{DescriptorHandle, DescriptorTable};
 use super::descriptor::listener::StateEventSource;
-use super::descriptor::{FileSignals, FileState};
+use super::descriptor::{CompatFile, File, FileSignals, FileState, FileStatus, OpenFile};
 use super::host::Host;
-use super::memory_manager::{MemoryManager, ProcessMemoryRef, ProcessMemoryRefMut};
+use super::memory_manager::{MemoryManager, ProcessMemoryRef, ProcessMemoryRefMut, cstr_until_nul};
 use super::syscall::formatter::StraceFmtMode;
 use super::syscall::types::ForeignArrayPtr;
 use super::thread::{Thread, ThreadId};
 use super::timer::Timer;
 use crate::core::configuration::{ProcessFinalState, RunningVal};
+use crate::core::output_store::OutputStore;
 use crate::core::work::task::TaskRef;
-use crate::core::worker::Worker;
+use crate::core::worker::{WORKER_SHARED, Worker};
 use crate::cshadow;
-use crate::host::context::ProcessContext;
+use crate::host::context::{ProcessContext, ThreadContext};
 use crate::host::descriptor::Descriptor;
+use crate::host::descriptor::output_file::OutputFile;
 use crate::host::managed_thread::ManagedThread;
+use crate::host::process_launcher::LaunchedThread;
+use crate::host::syscall::binary_strace::BinaryStraceWriter;
 use crate::host::syscall::formatter::FmtOptions;
 use crate::utility::callback_queue::CallbackQueue;
 #[cfg(feature = "perf_timers")]
@@ -136,6 +143,53 @@ struct StraceLogging {
     options: FmtOptions,
 }
 
+/// A process that was launched by [`Process::prelaunch`] and hasn't been started yet. Its output
+/// files have temporary names until it's started.
+pub struct PrelaunchedProcess {
+    thread: LaunchedThread,
+    file_basename: PathBuf,
+    strace_file: Option<Arc<std::fs::File>>,
+    shimlog_file: Arc<std::fs::File>,
+}
+
+impl PrelaunchedProcess {
+    /// Wait until the process has been launched, and rename its output files to use
+    /// `file_basename`. Returns the strace file, the shim log file, and the process's thread.
+    fn finish(
+        self,
+        file_basename: &Path,
+    ) -> (
+        Option<std::fs::File>,
+        Arc<std::fs::File>,
+        Result<ManagedThread, Errno>,
+    ) {
+        let Self {
+            thread,
+            file_basename: prelaunch_basename,
+            strace_file,
+            shimlog_file,
+        } = self;
+
+        // the launcher drops its references to the files once the launch has finished
+        let mthread = thread.wait();
+
+        let mut extensions = vec!["shimlog"];
+        if strace_file.is_some() {
+            extensions.push("strace");
+        }
+        for extension in extensions {
+            std::fs::rename(
+                Process::static_output_file_name(&prelaunch_basename, extension),
+                Process::static_output_file_name(file_basename, extension),
+            )
+            .unwrap();
+        }
+
+        let strace_file = strace_file.map(|f| Arc::into_inner(f).unwrap());
+        (strace_file, shimlog_file, mthread)
+    }
+}
+
 /// Parts of the process that are present in all states.
 struct Common {
     id: ProcessId,
@@ -237,6 +291,9 @@ pub struct RunnableProcess {
     // Shared with forked Processes
     strace_logging: Option<Arc<StraceLogging>>,
 
+    // Shared with forked Processes
+    binary_strace: Option<Arc<RootedRefCell<BinaryStraceWriter>>>,
+
     // The shim's log file. This gets dup'd into the ManagedProcess
     // where the shim can write to it directly. We persist it to handle the case
     // where we need to recreatea a ManagedProcess and have it continue writing
@@ -249,6 +306,11 @@ pub struct RunnableProcess {
     // and PR_GET_DUMPABLE.
     dumpable: Cell<SuidDump>,
 
+    // Whether the shim must not handle the I/O of the process's files itself (see the
+    // `use_native_file_io` and `use_shim_random` options), since its descriptor tables aren't
+    // shared by exactly its own threads.
+    local_file_io_disabled: Cell<bool>,
+
     native_pid: Pid,
 
     // timer that tracks the amount of CPU time we spend on plugin execution and processing
@@ -311,7 +373,10 @@ impl RunnableProcess {
                 .as_deref(),
             &self.shimlog_file,
             host.preload_paths(),
+            host.params.ipc_spin_limit,
+            host.params.use_syscall_counters,
         )
+        .inspect(|mthread| host.add_to_cgroup(mthread.native_pid()))
     }
 
     /// Call after a thread has exited. Removes the thread and does corresponding cleanup and notifications.
@@ -323,6 +388,9 @@ impl RunnableProcess {
 
         assert!(!thread.is_running());
 
+        // anything the thread logged after its last exchange with shadow
+        self.drain_shim_log(thread.shmem());
+
         // If the `clear_child_tid` attribute on the thread is set, and there are
         // any other threads left alive in the process, perform a futex wake on
         // that address. This mechanism is typically used in `pthread_join` etc.
@@ -400,6 +468,16 @@ impl RunnableProcess {
         .unwrap()
     }
 
+    /// If binary strace logging is disabled, this function will do nothing and return `None`.
+    pub fn with_binary_strace<T>(&self, f: impl FnOnce(&mut BinaryStraceWriter) -> T) -> Option<T> {
+        Worker::with_active_host(|host| {
+            let writer = self.binary_strace.as_ref()?;
+            let mut writer = writer.borrow_mut(host.root());
+            Some(f(&mut writer))
+        })
+        .unwrap()
+    }
+
     pub fn native_pid(&self) -> Pid {
         self.native_pid
     }
@@ -543,6 +621,9 @@ impl RunnableProcess {
             }
             process_shmem_protected.pending_signals.add(signal);
             process_shmem_protected.set_pending_standard_siginfo(signal, siginfo_t);
+            self.shim_shared_mem_block
+                .maybe_pending_signals
+                .store(true, Ordering::Relaxed);
         }
 
         if let Some(thread) = current_thread {
@@ -627,6 +708,7 @@ impl RunnableProcess {
         // The child will log to the same strace log file. Entries contain thread IDs,
         // though it might be tricky to map those back to processes.
         let strace_logging = self.strace_logging.as_ref().cloned();
+        let binary_strace = self.binary_strace.as_ref().cloned();
 
         // `fork(2)`:
         //  > The child does not inherit timers from its parent
@@ -639,9 +721,12 @@ impl RunnableProcess {
             &host.shim_shmem_lock_borrow().unwrap().root,
             host.shim_shmem().serialize(),
             host.id(),
+            pid.into(),
             strace_logging
                 .as_ref()
                 .map(|x| x.file.borrow(host.root()).as_raw_fd()),
+            // The child inherits the parent's seccomp filter.
+            &self.shmem().native_syscalls().collect::<Vec<_>>(),
         );
         let shim_shared_mem_block = shadow_shmem::allocator::shmalloc(shim_shared_mem);
 
@@ -650,7 +735,9 @@ impl RunnableProcess {
             expected_final_state: None,
             shim_shared_mem_block,
             strace_logging,
+            binary_strace,
             dumpable: self.dumpable.clone(),
+            local_file_io_disabled: Cell::new(false),
             native_pid,
             #[cfg(feature = "perf_timers")]
             cpu_delay_timer: RefCell::new(PerfTimer::new_stopped()),
@@ -674,6 +761,16 @@ impl RunnableProcess {
     pub fn shmem(&self) -> impl Deref<Target = ShMemBlock<'static, ProcessShmem>> + '_ {
         &self.shim_shared_mem_block
     }
+
+    /// Write the log records that the shim buffered in a thread's shared memory to the shim's
+    /// log file (see the `use_shim_log_ring` option).
+    pub fn drain_shim_log(&self, thread_shmem: &ThreadShmem) {
+        thread_shmem.shim_log.drain(|bytes| {
+            if let Err(e) = (&*self.shimlog_file).write_all(bytes) {
+                warn_once_then_debug!("Unable to write to the shim log: {e}");
+            }
+        });
+    }
 }
 
 impl ExplicitDrop for RunnableProcess {
@@ -939,8 +1036,78 @@ impl Process {
         self.as_zombie()
     }
 
+    /// Launch a process on the simulation's
+    /// [`ProcessLauncher`](crate::host::process_launcher::ProcessLauncher) ahead of its start
+    /// time. The process can be started by passing the result to [`Self::spawn`]. Returns `None`
+    /// if there's no launcher.
+    pub fn prelaunch(
+        host: &Host,
+        plugin_name: &CStr,
+        plugin_path: &CStr,
+        argv: Vec<CString>,
+        envv: Vec<CString>,
+    ) -> Option<PrelaunchedProcess> {
+        let worker_shared = WORKER_SHARED.borrow();
+        let launcher = worker_shared.as_ref().unwrap().process_launcher()?;
+
+        // The process's id isn't assigned until it's started, so its output files get temporary
+        // names until then.
+        static NEXT_PRELAUNCH_ID: AtomicU64 = AtomicU64::new(0);
+        let mut file_basename = PathBuf::new();
+        file_basename.push(host.data_dir_path());
+        file_basename.push(format!(
+            "{exe_name}.prelaunch-{id}",
+            exe_name = plugin_name.to_str().unwrap(),
+            id = NEXT_PRELAUNCH_ID.fetch_add(1, Ordering::Relaxed),
+        ));
+
+        let strace_file = host.params.strace_logging_options.map(|_| {
+            let file =
+                std::fs::File::create(Self::static_output_file_name(&file_basename, "strace"))
+                    .unwrap();
+            debug_assert_cloexec(&file);
+            Arc::new(file)
+        });
+        let shimlog_file = Arc::new(
+            std::fs::File::create(Self::static_output_file_name(&file_basename, "shimlog"))
+                .unwrap(),
+        );
+        debug_assert_cloexec(&shimlog_file);
+
+        let thread = {
+            let plugin_path = plugin_path.to_owned();
+            let strace_file = strace_file.clone();
+            let shimlog_file = Arc::clone(&shimlog_file);
+            let preload_paths = host.preload_paths().to_vec();
+            let ipc_spin_limit = host.params.ipc_spin_limit;
+            let use_syscall_counters = host.params.use_syscall_counters;
+            launcher.launch(move || {
+                ManagedThread::spawn(
+                    &plugin_path,
+                    argv,
+                    envv,
+                    strace_file.as_deref(),
+                    &shimlog_file,
+                    &preload_paths,
+                    ipc_spin_limit,
+                    use_syscall_counters,
+                )
+            })
+        };
+
+        debug!("launching process '{plugin_name:?}' before its start time");
+
+        Some(PrelaunchedProcess {
+            thread,
+            file_basename,
+            strace_file,
+            shimlog_file,
+        })
+    }
+
     /// Spawn a new process. The process will be runnable via [`Self::resume`]
-    /// once it has been added to the `Host`'s process list.
+    /// once it has been added to the `Host`'s process list. If `prelaunched` is
+    /// given, it's used instead of launching a new native process.
     pub fn spawn(
         host: &Host,
         plugin_name: CString,
@@ -949,7 +1116,10 @@ impl Process {
         envv: Vec<CString>,
         pause_for_debugging: bool,
         strace_logging_options: Option<FmtOptions>,
+        binary_strace: bool,
         expected_final_state: ProcessFinalState,
+        native_syscalls: &[SyscallNum],
+        prelaunched: Option<PrelaunchedProcess>,
     ) -> Result<RootedRc<RootedRefCell<Process>>, Errno> {
         debug!("starting process '{:?}'", plugin_name);
 
@@ -974,10 +1144,20 @@ impl Process {
             id = u32::from(process_id)
         ));
 
+        // A prelaunched process already has its output files and native thread.
+        let (mut strace_file, shimlog_file, prelaunched_mthread) = match prelaunched {
+            Some(prelaunched) => {
+                let (strace_file, shimlog_file, mthread) = prelaunched.finish(&file_basename);
+                (strace_file, Some(shimlog_file), Some(mthread))
+            }
+            None => (None, None, None),
+        };
+
         let strace_logging = strace_logging_options.map(|options| {
-            let file =
+            let file = strace_file.take().unwrap_or_else(|| {
                 std::fs::File::create(Self::static_output_file_name(&file_basename, "strace"))
-                    .unwrap();
+                    .unwrap()
+            });
             debug_assert_cloexec(&file);
             Arc::new(StraceLogging {
                 file: RootedRefCell::new(host.root(), file),
@@ -985,13 +1165,24 @@ impl Process {
             })
         });
 
+        // The shim only knows about the text log, so this is written by shadow alone.
+        let binary_strace = binary_strace.then(|| {
+            let file =
+                std::fs::File::create(Self::static_output_file_name(&file_basename, "strace.bin"))
+                    .unwrap();
+            let writer = BinaryStraceWriter::new(file).unwrap();
+            Arc::new(RootedRefCell::new(host.root(), writer))
+        });
+
         let shim_shared_mem = ProcessShmem::new(
             &host.shim_shmem_lock_borrow().unwrap().root,
             host.shim_shmem().serialize(),
             host.id(),
+            process_id.into(),
             strace_logging
                 .as_ref()
                 .map(|x| x.file.borrow(host.root()).as_raw_fd()),
+            native_syscalls,
         );
         let shim_shared_mem_block = shadow_shmem::allocator::shmalloc(shim_shared_mem);
 
@@ -1008,43 +1199,68 @@ impl Process {
                 OFlag::O_RDONLY,
             );
 
-            let name = Self::static_output_file_name(&file_basename, "stdout");
-            Self::open_stdio_file_helper(
-                &mut descriptor_table,
-                libc::STDOUT_FILENO.try_into().unwrap(),
-                name,
-                OFlag::O_WRONLY,
-            );
-
-            let name = Self::static_output_file_name(&file_basename, "stderr");
-            Self::open_stdio_file_helper(
-                &mut descriptor_table,
-                libc::STDERR_FILENO.try_into().unwrap(),
-                name,
-                OFlag::O_WRONLY,
-            );
+            let output_store = WORKER_SHARED
+                .borrow()
+                .as_ref()
+                .unwrap()
+                .output_store()
+                .cloned();
+
+            for (fd, extension) in [
+                (libc::STDOUT_FILENO, "stdout"),
+                (libc::STDERR_FILENO, "stderr"),
+            ] {
+                let fd = fd.try_into().unwrap();
+                let name = Self::static_output_file_name(&file_basename, extension);
+                match &output_store {
+                    Some(store) => {
+                        Self::open_stdio_output_stream(&mut descriptor_table, fd, store, &name)
+                    }
+                    None => Self::open_stdio_file_helper(
+                        &mut descriptor_table,
+                        fd,
+                        name,
+                        OFlag::O_WRONLY,
+                    ),
+                }
+            }
         }
 
-        let shimlog_file = Arc::new(
-            std::fs::File::create(Self::static_output_file_name(&file_basename, "shimlog"))
-                .unwrap(),
-        );
+        let shimlog_file = shimlog_file.unwrap_or_else(|| {
+            Arc::new(
+                std::fs::File::create(Self::static_output_file_name(&file_basename, "shimlog"))
+                    .unwrap(),
+            )
+        });
         debug_assert_cloexec(&shimlog_file);
 
-        let mthread = ManagedThread::spawn(
-            plugin_path,
-            argv,
-            envv,
-            strace_logging
-                .as_ref()
-                .map(|s| s.file.borrow(host.root()))
-                .as_deref(),
-            &shimlog_file,
-            host.preload_paths(),
-        )?;
+        let mthread = match prelaunched_mthread {
+            Some(mthread) => mthread?,
+            None => ManagedThread::spawn(
+                plugin_path,
+                argv,
+                envv,
+                strace_logging
+                    .as_ref()
+                    .map(|s| s.file.borrow(host.root()))
+                    .as_deref(),
+                &shimlog_file,
+                host.preload_paths(),
+                host.params.ipc_spin_limit,
+                host.params.use_syscall_counters,
+            )?,
+        };
         let native_pid = mthread.native_pid();
-        let main_thread =
-            Thread::wrap_mthread(host, mthread, desc_table, process_id, main_thread_id).unwrap();
+        host.add_to_cgroup(native_pid);
+        let main_thread = Thread::wrap_mthread(
+            host,
+            mthread,
+            Thread::new_shmem(host, main_thread_id),
+            desc_table,
+            process_id,
+            main_thread_id,
+        )
+        .unwrap();
 
         debug!("process '{:?}' started", plugin_name);
 
@@ -1105,7 +1321,9 @@ impl Process {
                         memory_manager: Box::new(RefCell::new(memory_manager)),
                         itimer_real,
                         strace_logging,
+                        binary_strace,
                         dumpable: Cell::new(SuidDump::SUID_DUMP_USER),
+                        local_file_io_disabled: Cell::new(false),
                         native_pid,
                         unsafe_borrow_mut: RefCell::new(None),
                         unsafe_borrows: RefCell::new(Vec::new()),
@@ -1167,6 +1385,17 @@ impl Process {
         self.as_runnable().unwrap().dumpable.set(val)
     }
 
+    /// Whether the shim must not handle the I/O of the process's files itself.
+    pub fn local_file_io_disabled(&self) -> bool {
+        self.as_runnable().unwrap().local_file_io_disabled.get()
+    }
+
+    /// Prevent the shim from handling the I/O of the process's files itself, e.g. since one of
+    /// its descriptor tables is shared with another process.
+    pub fn disable_local_file_io(&self) {
+        self.as_runnable().unwrap().local_file_io_disabled.set(true)
+    }
+
     /// Deprecated wrapper for `RunnableProcess::start_cpu_delay_timer`
     #[cfg(feature = "perf_timers")]
     pub fn start_cpu_delay_timer(&self) {
@@ -1303,6 +1532,23 @@ impl Process {
         self.handle_process_exit(host, true);
     }
 
+    /// Send SIGKILL to the native process without waiting for it to exit, so that the kernel can
+    /// tear it down while shadow stops the host's other processes (and other hosts' processes).
+    /// The process must still be stopped with [`Process::stop`], which reaps it.
+    ///
+    /// Should only be called from [`Host::kill_all_applications`].
+    pub fn kill_native(&self) {
+        let Some(runnable) = self.as_runnable() else {
+            return;
+        };
+        if let Err(err) = rustix::process::kill_process(
+            runnable.native_pid().into(),
+            rustix::process::Signal::Kill,
+        ) {
+            warn!("kill: {:?}", err);
+        }
+    }
+
     /// See `RunnableProcess::signal`.
     ///
     /// No-op if the `self` is a `ZombieProcess`.
@@ -1365,6 +1611,28 @@ impl Process {
         );
     }
 
+    /// Register a descriptor for `fd` that writes to a new stream of the shared output segments,
+    /// in place of the file at `path`.
+    fn open_stdio_output_stream(
+        descriptor_table: &mut DescriptorTable,
+        fd: DescriptorHandle,
+        store: &Arc<OutputStore>,
+        path: &Path,
+    ) {
+        let stream = store.add_stream(path).unwrap_or_else(|e| {
+            panic!("Adding output stream for {}: {e}", path.display());
+        });
+        let file = OutputFile::new(Arc::clone(store), stream, FileStatus::empty());
+        let file = File::Output(Arc::new(AtomicRefCell::new(file)));
+        let desc = Descriptor::new(CompatFile::New(OpenFile::new(file)));
+        let prev = descriptor_table.register_descriptor_with_fd(desc, fd);
+        assert!(prev.is_none());
+        trace!(
+            "Opened fd {fd} as output stream {stream} for {}",
+            path.display()
+        );
+    }
+
     // Needed during early init, before `Self` is created.
     fn static_output_file_name(file_basename: &Path, extension: &str) -> PathBuf {
         let mut path = file_basename.to_owned().into_os_string();
@@ -1397,6 +1665,11 @@ impl Process {
         })
     }
 
+    /// Deprecated wrapper for `RunnableProcess::drain_shim_log`
+    pub fn drain_shim_log(&self, thread_shmem: &ThreadShmem) {
+        self.as_runnable().unwrap().drain_shim_log(thread_shmem)
+    }
+
     /// Deprecated wrapper for `RunnableProcess::strace_logging_options`
     pub fn strace_logging_options(&self) -> Option<FmtOptions> {
         self.as_runnable().unwrap().strace_logging_options()
@@ -1407,6 +1680,11 @@ impl Process {
         self.as_runnable().unwrap().with_strace_file(f)
     }
 
+    /// Deprecated wrapper for `RunnableProcess::with_binary_strace`
+    pub fn with_binary_strace<T>(&self, f: impl FnOnce(&mut BinaryStraceWriter) -> T) -> Option<T> {
+        self.as_runnable().unwrap().with_binary_strace(f)
+    }
+
     /// Deprecated wrapper for `RunnableProcess::native_pid`
     pub fn native_pid(&self) -> Pid {
         self.as_runnable().unwrap().native_pid()
@@ -1467,6 +1745,17 @@ impl Process {
         self.as_runnable().is_some()
     }
 
+    /// Give the process's native memory back to the system; see [`MemoryManager::reclaim`]. Does
+    /// nothing if the process isn't running.
+    pub fn reclaim_memory(&self, host: &Host) {
+        let Some(thread) = self.first_live_thread_borrow(host.root()) else {
+            return;
+        };
+        let thread = thread.borrow(host.root());
+        let ctx = ThreadContext::new(host, self, &thread);
+        self.memory_borrow().reclaim(&ctx);
+    }
+
     /// Transitions `self` from a `RunnableProcess` to a `ZombieProcess`.
     fn handle_process_exit(&self, host: &Host, killed_by_shadow: bool) {
         debug!(
@@ -1547,6 +1836,7 @@ impl Process {
                     (s, log::Level::Debug)
                 } else {
                     Worker::increment_plugin_error_count();
+                    host.dump_pcap_rings("unexpected process final state");
                     write!(s, "; expected end state was {expected_final_state} but was {actual_final_state}").unwrap();
                     (s, log::Level::Error)
                 }
@@ -1698,6 +1988,8 @@ impl Process {
             "updating for exec; pid:{pid}, tid:{tid:?}, new_tid:{new_tid:?}",
             pid = runnable.common.id
         );
+        // exec replaces the thread's shared memory
+        runnable.drain_shim_log(execing_thread.borrow(host.root()).shmem());
         execing_thread
             .borrow_mut(host.root())
             .update_for_exec(host, mthread, new_tid);
@@ -1823,9 +2115,7 @@ impl UnsafeBorrow {
         let memory = unsafe {
             std::mem::transmute::<ProcessMemoryRef<'_, u8>, ProcessMemoryRef<'static, u8>>(memory)
         };
-        if !memory.contains(&0) {
-            return Err(Errno::ENAMETOOLONG);
-        }
+        cstr_until_nul(&memory)?;
         assert_eq!(std::mem::size_of::<c_char>(), std::mem::size_of::<u8>());
         let ptr = memory.as_ptr() as *const c_char;
         let len = memory.len();
@@ -0,0 +1,93 @@
+//! Starting managed processes in the background before their start time.
+//!
+//! Starting a managed process blocks until the process has been exec'd, has been dynamically
+//! linked, and has initialized the shim, which is slow compared to most of the work done in a
+//! round. When many processes have the same start time, they would otherwise all be started in the
+//! same round. Instead, the processes can be launched on a [`ProcessLauncher`] at the beginning of
+//! the simulation. A launched process waits in the shim for its start event until its host takes it
+//! with [`LaunchedThread::wait`] at the process's start time.
+
+use std::sync::{Arc, Condvar, Mutex};
+
+use linux_api::errno::Errno;
+
+use crate::host::managed_thread::ManagedThread;
+
+/// A pool of threads that launch managed processes. The number of threads limits how many
+/// processes are started at once.
+pub struct ProcessLauncher {
+    pool: rayon::ThreadPool,
+}
+
+impl ProcessLauncher {
+    pub fn new(num_threads: usize) -> Self {
+        let pool = rayon::ThreadPoolBuilder::new()
+            .num_threads(num_threads)
+            .thread_name(|i| format!("process-launcher-{i}"))
+            .build()
+            .expect("Couldn't create the process launcher's threads");
+        Self { pool }
+    }
+
+    /// Run `spawn` on one of the launcher's threads. `spawn` should start a managed process and
+    /// return its (not yet started) thread.
+    pub fn launch(
+        &self,
+        spawn: impl FnOnce() -> Result<ManagedThread, Errno> + Send + 'static,
+    ) -> LaunchedThread {
+        let slot = Arc::new(LaunchSlot {
+            result: Mutex::new(None),
+            ready: Condvar::new(),
+        });
+
+        let launch_slot = Arc::clone(&slot);
+        self.pool.spawn(move || {
+            let result = spawn();
+            *launch_slot.result.lock().unwrap() = Some(result);
+            launch_slot.ready.notify_all();
+        });
+
+        LaunchedThread { slot: Some(slot) }
+    }
+}
+
+struct LaunchSlot {
+    result: Mutex<Option<Result<ManagedThread, Errno>>>,
+    ready: Condvar,
+}
+
+impl LaunchSlot {
+    fn wait(&self) -> Result<ManagedThread, Errno> {
+        let mut result = self.result.lock().unwrap();
+        loop {
+            if let Some(result) = result.take() {
+                return result;
+            }
+            result = self.ready.wait(result).unwrap();
+        }
+    }
+}
+
+/// A managed process that was (or is being) started by a [`ProcessLauncher`].
+pub struct LaunchedThread {
+    slot: Option<Arc<LaunchSlot>>,
+}
+
+impl LaunchedThread {
+    /// Wait until the process has been started, and return its thread.
+    pub fn wait(mut self) -> Result<ManagedThread, Errno> {
+        self.slot.take().unwrap().wait()
+    }
+}
+
+impl Drop for LaunchedThread {
+    fn drop(&mut self) {
+        // The process was never used (for example if its start time was after the end of the
+        // simulation), so we need to kill it before its thread can be dropped.
+        if let Some(slot) = self.slot.take() {
+            if let Ok(mthread) = slot.wait() {
+                mthread.kill_and_drop();
+            }
+        }
+    }
+}
@@ -0,0 +1,136 @@
+//! Accounting of the memory that autotuning gives a host's socket buffers, modeled on the Linux
+//! `tcp_mem` limits.
+//!
+//! Linux has three limits for the memory used by all TCP sockets: below `low` the sockets aren't
+//! regulated, above `pressure` the kernel enters "memory pressure" and stops growing socket
+//! buffers until the usage falls below `low` again, and allocations above `high` fail. Here the
+//! memory is the amount by which autotuning grew the buffers of the host's sockets, which is what
+//! lets the buffers (and so Shadow's memory usage) grow with the number of connections.
+//!
+//!  More info:
+//!   - <https://man7.org/linux/man-pages/man7/tcp.7.html> (`tcp_mem`)
+
+use std::cell::Cell;
+
+#[derive(Debug)]
+pub struct SocketMemory {
+    /// `None` if the host's socket buffers are unlimited.
+    limits: Option<Limits>,
+    /// The bytes that autotuning grew the host's socket buffers by.
+    allocated: Cell<u64>,
+    under_pressure: Cell<bool>,
+}
+
+#[derive(Debug, Copy, Clone)]
+struct Limits {
+    low: u64,
+    pressure: u64,
+    high: u64,
+}
+
+impl Limits {
+    /// The ratios between the limits are those of the default `tcp_mem` values.
+    fn new(high: u64) -> Self {
+        Self {
+            low: high / 2,
+            pressure: high / 3 * 2,
+            high,
+        }
+    }
+}
+
+impl SocketMemory {
+    /// Accounting for a host whose sockets can grow their buffers by at most `budget` bytes in
+    /// total, or without a limit if `None`.
+    pub fn new(budget: Option<u64>) -> Self {
+        Self {
+            limits: budget.map(Limits::new),
+            allocated: Cell::new(0),
+            under_pressure: Cell::new(false),
+        }
+    }
+
+    /// Allocate `bytes` for growing a socket buffer. Returns false if the buffer must not grow,
+    /// either since the host is under memory pressure or since the allocation would exceed the
+    /// budget.
+    pub fn try_allocate(&self, bytes: u64) -> bool {
+        let allocated = self.allocated.get() + bytes;
+
+        if let Some(limits) = self.limits {
+            if self.under_pressure.get() || allocated > limits.high {
+                return false;
+            }
+            if allocated > limits.pressure {
+                self.under_pressure.set(true);
+            }
+        }
+
+        self.allocated.set(allocated);
+        true
+    }
+
+    /// Free `bytes` that were previously allocated with [`Self::try_allocate`].
+    pub fn free(&self, bytes: u64) {
+        let allocated = self.allocated.get().checked_sub(bytes).unwrap();
+        self.allocated.set(allocated);
+
+        if let Some(limits) = self.limits {
+            if allocated < limits.low {
+                self.under_pressure.set(false);
+            }
+        }
+    }
+
+    /// The bytes that are currently allocated.
+    pub fn allocated(&self) -> u64 {
+        self.allocated.get()
+    }
+
+    pub fn is_under_pressure(&self) -> bool {
+        self.under_pressure.get()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn unlimited() {
+        let mem = SocketMemory::new(None);
+        assert!(mem.try_allocate(u64::MAX / 2));
+        assert!(mem.try_allocate(u64::MAX / 2));
+        assert!(!mem.is_under_pressure());
+        mem.free(u64::MAX / 2);
+        assert_eq!(mem.allocated(), u64::MAX / 2);
+    }
+
+    #[test]
+    fn high_limit() {
+        let mem = SocketMemory::new(Some(3000));
+        assert!(mem.try_allocate(1000));
+        assert!(!mem.try_allocate(2001));
+        assert_eq!(mem.allocated(), 1000);
+        assert!(!mem.is_under_pressure());
+    }
+
+    #[test]
+    fn pressure() {
+        let mem = SocketMemory::new(Some(3000));
+
+        // crossing the pressure limit is allowed, but enters memory pressure
+        assert!(mem.try_allocate(1900));
+        assert!(mem.try_allocate(200));
+        assert!(mem.is_under_pressure());
+        assert!(!mem.try_allocate(1));
+
+        // memory pressure ends once the usage falls below the low limit
+        mem.free(500);
+        assert_eq!(mem.allocated(), 1600);
+        assert!(mem.is_under_pressure());
+        assert!(!mem.try_allocate(1));
+        mem.free(200);
+        assert!(!mem.is_under_pressure());
+        assert!(mem.try_allocate(1));
+    }
+}
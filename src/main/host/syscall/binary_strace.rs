@@ -0,0 +1,187 @@
+//! A compact binary strace log format, used by the "binary" strace logging mode.
+//!
+//! Formatting each syscall as text is slow, so in this mode the raw syscall arguments and result
+//! are written as fixed-size records, and the records are written to the file by a
+//! [`BackgroundWriter`]. The `shadow-strace-decode` tool in shadowtools converts a log to text.
+//!
+//! All integers are little-endian. A file starts with a header:
+//!
+//! | bytes | field                 |
+//! |-------|-----------------------|
+//! | 8     | magic (`b"SHDWSTRC"`) |
+//! | 4     | format version (1)    |
+//! | 4     | reserved              |
+//!
+//! followed by records. A syscall record is [`SYSCALL_RECORD_LEN`] bytes, followed by the captured
+//! buffer (if any), padded to a multiple of 8 bytes:
+//!
+//! | bytes | field                                                              |
+//! |-------|--------------------------------------------------------------------|
+//! | 1     | record type ([`RECORD_SYSCALL`])                                   |
+//! | 1     | result type (`RESULT_*`)                                           |
+//! | 2     | length of the captured buffer                                      |
+//! | 4     | thread id (signed)                                                 |
+//! | 8     | simulation time in nanoseconds                                     |
+//! | 4     | syscall number                                                     |
+//! | 4     | reserved                                                           |
+//! | 48    | the six syscall arguments                                          |
+//! | 8     | the return value (signed; the negated errno for [`RESULT_ERROR`])  |
+//!
+//! Since the records don't contain syscall names, a name record is written before the first
+//! syscall record for each syscall number that has a name:
+//!
+//! | bytes | field                                  |
+//! |-------|----------------------------------------|
+//! | 1     | record type ([`RECORD_NAME`])          |
+//! | 1     | length of the name                     |
+//! | 2     | reserved                               |
+//! | 4     | syscall number                         |
+//! | n     | the name, padded to a multiple of 8    |
+
+use std::collections::HashSet;
+use std::io::Write;
+
+use linux_api::syscall::SyscallNum;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+use shadow_shim_helper_rs::syscall_types::{ForeignPtr, SyscallArgs};
+
+use crate::host::memory_manager::MemoryManager;
+use crate::host::syscall::types::{ForeignArrayPtr, SyscallError, SyscallResult};
+use crate::host::thread::ThreadId;
+use crate::utility::background_writer::BackgroundWriter;
+
+pub const MAGIC: &[u8; 8] = b"SHDWSTRC";
+pub const VERSION: u32 = 1;
+
+pub const RECORD_SYSCALL: u8 = 1;
+pub const RECORD_NAME: u8 = 2;
+
+pub const RESULT_OK: u8 = 0;
+pub const RESULT_ERROR: u8 = 1;
+pub const RESULT_NATIVE: u8 = 2;
+pub const RESULT_BLOCKED: u8 = 3;
+
+pub const SYSCALL_RECORD_LEN: usize = 80;
+
+/// The maximum number of bytes of a syscall's data buffer that are logged.
+const MAX_CAPTURE_LEN: usize = 256;
+
+/// Writes syscall records for the processes that share a strace log.
+pub struct BinaryStraceWriter {
+    writer: BackgroundWriter,
+    /// Syscall numbers that have had a name record written.
+    named: HashSet<u32>,
+}
+
+impl BinaryStraceWriter {
+    pub fn new(file: std::fs::File) -> std::io::Result<Self> {
+        let mut writer = BackgroundWriter::new(file);
+        writer.write_all(MAGIC)?;
+        writer.write_all(&VERSION.to_le_bytes())?;
+        writer.write_all(&0u32.to_le_bytes())?;
+
+        Ok(Self {
+            writer,
+            named: HashSet::new(),
+        })
+    }
+
+    pub fn write_syscall(
+        &mut self,
+        sim_time: EmulatedTime,
+        tid: ThreadId,
+        args: &SyscallArgs,
+        rv: &SyscallResult,
+        mem: &MemoryManager,
+    ) -> std::io::Result<()> {
+        let number = u32::try_from(args.number).unwrap();
+
+        if self.named.insert(number) {
+            if let Some(name) = SyscallNum::new(number).to_str() {
+                self.write_name(number, name)?;
+            }
+        }
+
+        let (result_type, rv_val) = match rv {
+            Ok(x) => (RESULT_OK, i64::from(*x)),
+            Err(SyscallError::Failed(failed)) => (RESULT_ERROR, failed.errno.to_negated_i64()),
+            Err(SyscallError::Native) => (RESULT_NATIVE, 0),
+            Err(SyscallError::Blocked(_)) => (RESULT_BLOCKED, 0),
+        };
+
+        let mut captured = [0u8; MAX_CAPTURE_LEN];
+        let captured = capture_buffer(args, rv, mem, &mut captured);
+
+        let sim_time = sim_time.duration_since(&EmulatedTime::SIMULATION_START);
+
+        let mut record = [0u8; SYSCALL_RECORD_LEN];
+        record[0] = RECORD_SYSCALL;
+        record[1] = result_type;
+        record[2..4].copy_from_slice(&u16::try_from(captured.len()).unwrap().to_le_bytes());
+        record[4..8].copy_from_slice(&libc::pid_t::from(tid).to_le_bytes());
+        record[8..16].copy_from_slice(&u64::try_from(sim_time.as_nanos()).unwrap().to_le_bytes());
+        record[16..20].copy_from_slice(&number.to_le_bytes());
+        for (i, arg) in args.args.iter().enumerate() {
+            let offset = 24 + i * 8;
+            record[offset..offset + 8].copy_from_slice(&u64::from(*arg).to_le_bytes());
+        }
+        record[72..80].copy_from_slice(&rv_val.to_le_bytes());
+
+        self.writer.write_all(&record)?;
+        self.write_padded(captured)
+    }
+
+    fn write_name(&mut self, number: u32, name: &str) -> std::io::Result<()> {
+        let mut record = [0u8; 8];
+        record[0] = RECORD_NAME;
+        record[1] = u8::try_from(name.len()).unwrap();
+        record[4..8].copy_from_slice(&number.to_le_bytes());
+
+        self.writer.write_all(&record)?;
+        self.write_padded(name.as_bytes())
+    }
+
+    /// Write `bytes` followed by zeros up to a multiple of 8 bytes.
+    fn write_padded(&mut self, bytes: &[u8]) -> std::io::Result<()> {
+        self.writer.write_all(bytes)?;
+        let padding = bytes.len().next_multiple_of(8) - bytes.len();
+        self.writer.write_all(&[0u8; 8][..padding])
+    }
+}
+
+/// Copy the start of the syscall's data buffer (for syscalls that have one) into `buf`, and return
+/// the copied bytes.
+fn capture_buffer<'a>(
+    args: &SyscallArgs,
+    rv: &SyscallResult,
+    mem: &MemoryManager,
+    buf: &'a mut [u8],
+) -> &'a [u8] {
+    let syscall = SyscallNum::new(u32::try_from(args.number).unwrap());
+    let ptr: ForeignPtr<u8> = args.args[1].into();
+
+    let len: usize = match syscall {
+        // the buffer is written by the syscall, so it only holds data if the syscall succeeded
+        SyscallNum::NR_read | SyscallNum::NR_pread64 | SyscallNum::NR_recvfrom => match rv {
+            Ok(x) => i64::from(*x).try_into().unwrap_or(0),
+            Err(_) => 0,
+        },
+        SyscallNum::NR_write | SyscallNum::NR_pwrite64 | SyscallNum::NR_sendto => {
+            args.args[2].into()
+        }
+        _ => 0,
+    };
+    let len = std::cmp::min(len, buf.len());
+
+    if len == 0 {
+        return &[];
+    }
+
+    // the pointer may be invalid, or only partially valid
+    let Ok(mem_ref) = mem.memory_ref_prefix(ForeignArrayPtr::new(ptr, len)) else {
+        return &[];
+    };
+    let len = mem_ref.len();
+    buf[..len].copy_from_slice(&mem_ref[..]);
+    &buf[..len]
+}
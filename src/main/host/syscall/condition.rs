@@ -46,6 +46,12 @@ impl SyscallConditionRef<'_> {
         let timeout = unsafe { cshadow::syscallcondition_getTimeout(self.c_ptr.ptr()) };
         EmulatedTime::from_c_emutime(timeout)
     }
+
+    /// The futex that the condition is waiting on, or NULL if it isn't waiting on a futex. The
+    /// pointer is borrowed from the condition.
+    pub fn futex(&self) -> *mut cshadow::Futex {
+        unsafe { cshadow::syscallcondition_getFutex(self.c_ptr.ptr()) }
+    }
 }
 
 /// A mutable reference to a syscall condition.
@@ -89,6 +95,13 @@ impl SyscallConditionRefMut<'_> {
         let timeout = EmulatedTime::to_c_emutime(timeout);
         unsafe { cshadow::syscallcondition_setTimeout(self.c_ptr.ptr(), timeout) };
     }
+
+    /// Mark the condition as one of many exclusive waiters on its file, so that the waiters are
+    /// woken in order by a single task that only resumes a thread if the file's state still allows
+    /// it, rather than each waiter scheduling its own wakeup task.
+    pub fn set_exclusive(&mut self, exclusive: bool) {
+        unsafe { cshadow::syscallcondition_setExclusive(self.c_ptr.ptr(), exclusive) };
+    }
 }
 
 impl<'a> std::ops::Deref for SyscallConditionRefMut<'a> {
@@ -13,7 +13,7 @@ use crate::host::descriptor::descriptor_table::DescriptorTable;
 use crate::host::process::ProcessId;
 use crate::host::thread::Thread;
 
-use super::{SyscallContext, SyscallHandler};
+use super::{SyscallContext, SyscallHandler, local_files};
 
 impl SyscallHandler {
     fn clone_internal(
@@ -74,10 +74,6 @@ impl SyscallHandler {
 
             handled_flags.insert(CloneFlags::CLONE_THREAD);
         } else {
-            if ctx.objs.process.memory_borrow().has_mapper() {
-                warn!("Fork with memory mapper unimplemented");
-                return Err(Errno::ENOTSUP);
-            }
             // Make shadow the parent process
             native_flags.insert(CloneFlags::CLONE_PARENT);
         }
@@ -199,6 +195,21 @@ impl SyscallHandler {
             return Err(Errno::ENOTSUP);
         }
 
+        let params = &ctx.objs.host.params;
+        if params.use_native_file_io || params.use_shim_random {
+            local_files::before_clone(ctx.objs, flags);
+        }
+
+        let is_fork = !flags.contains(CloneFlags::CLONE_THREAD);
+        if is_fork {
+            ctx.objs.process.memory_borrow().prepare_fork(ctx.objs);
+        }
+
+        // The new thread's shared memory is passed to it with the clone request,
+        // so that it can start without first asking us for it.
+        let child_tid = ctx.objs.host.get_new_thread_id();
+        let child_shmem = Thread::new_shmem(ctx.objs.host, child_tid);
+
         let child_mthread = ctx.objs.thread.mthread().native_clone(
             ctx.objs,
             native_flags,
@@ -206,9 +217,14 @@ impl SyscallHandler {
             native_ptid,
             native_ctid,
             native_newtls,
-        )?;
+            &child_shmem,
+        );
+
+        if is_fork {
+            ctx.objs.process.memory_borrow_mut().finish_fork(ctx.objs);
+        }
+        let child_mthread = child_mthread?;
 
-        let child_tid = ctx.objs.host.get_new_thread_id();
         let child_pid = if flags.contains(CloneFlags::CLONE_THREAD) {
             ctx.objs.process.id()
         } else {
@@ -218,6 +234,7 @@ impl SyscallHandler {
         let child_thread = Thread::wrap_mthread(
             ctx.objs.host,
             child_mthread,
+            child_shmem,
             desc_table.into_value(),
             child_pid,
             child_tid,
@@ -262,6 +279,10 @@ impl SyscallHandler {
                     .borrow(ctx.objs.host.root()),
             );
             child_process = child_process_borrow.as_ref().unwrap();
+            if flags.contains(CloneFlags::CLONE_FILES) {
+                // the child shares our fds but not our shared memory
+                child_process.disable_local_file_io();
+            }
             ctx.objs
                 .host
                 .add_and_schedule_forked_process(ctx.objs.host, process);
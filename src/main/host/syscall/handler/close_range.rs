@@ -59,7 +59,7 @@ impl SyscallHandler {
 
             // set the CLOEXEC flag on all descriptors in the range
             for (fd, desc) in desc_table.iter_mut() {
-                if range.contains(fd) {
+                if range.contains(&fd) {
                     desc.set_flags(desc.flags() | DescriptorFlags::FD_CLOEXEC);
                 }
             }
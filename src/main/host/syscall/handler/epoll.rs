@@ -173,6 +173,24 @@ impl SyscallHandler {
                 return Err(Errno::EINVAL);
             };
 
+            if events.contains(EpollEvents::EPOLLEXCLUSIVE) {
+                // epoll_ctl(2): EPOLLEXCLUSIVE may only be used with EPOLL_CTL_ADD, can't be used
+                // with an epoll target, and may only be combined with some of the other flags.
+                let allowed = EpollEvents::EPOLLIN
+                    | EpollEvents::EPOLLOUT
+                    | EpollEvents::EPOLLERR
+                    | EpollEvents::EPOLLHUP
+                    | EpollEvents::EPOLLWAKEUP
+                    | EpollEvents::EPOLLET
+                    | EpollEvents::EPOLLEXCLUSIVE;
+                if op == EpollCtlOp::EPOLL_CTL_MOD
+                    || matches!(target, File::Epoll(_))
+                    || !allowed.contains(events)
+                {
+                    return Err(Errno::EINVAL);
+                }
+            }
+
             // epoll_ctl(2): epoll always reports for EPOLLERR and EPOLLHUP
             events.insert(EpollEvents::EPOLLERR | EpollEvents::EPOLLHUP);
 
@@ -7,6 +7,7 @@ use crate::host::descriptor::{CompatFile, File, FileStatus};
 use crate::host::syscall::handler::{SyscallContext, SyscallHandler};
 use crate::host::syscall::type_formatting::SyscallNonDeterministicArg;
 use crate::host::syscall::types::SyscallError;
+use crate::utility::callback_queue::CallbackQueue;
 
 impl SyscallHandler {
     log_syscall!(
@@ -177,6 +178,26 @@ impl SyscallHandler {
                     return Err(Errno::EINVAL.into());
                 }
             }
+            FcntlCommand::F_SETPIPE_SZ => {
+                let file = match desc.file() {
+                    CompatFile::New(d) => d,
+                    // if it's a legacy file, use the C syscall handler instead
+                    CompatFile::Legacy(_) => {
+                        return legacy_syscall_fn(ctx);
+                    }
+                };
+
+                let File::Pipe(pipe) = file.inner_file() else {
+                    return Err(Errno::EINVAL.into());
+                };
+
+                // the arg is an int, but linux treats it as unsigned
+                let size = u64::from(arg as std::ffi::c_uint);
+                let size = CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
+                    pipe.borrow_mut().set_max_size(size, cb_queue)
+                })?;
+                size.try_into().unwrap()
+            }
             cmd => {
                 warn_once_then_debug!("Unhandled fcntl command: {cmd:?}");
                 return Err(Errno::EINVAL.into());
@@ -10,6 +10,7 @@
 #include <linux/futex.h>
 #include <stdbool.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "lib/logger/logger.h"
 #include "main/bindings/c/bindings.h"
@@ -18,10 +19,83 @@
 #include "main/host/syscall/syscall_condition.h"
 #include "main/utility/utility.h"
 
+// Older kernel headers don't define `futex_waitv()` types.
+#ifndef FUTEX_32
+#define FUTEX_32 2
+#endif
+#ifndef FUTEX_WAITV_MAX
+#define FUTEX_WAITV_MAX 128
+#endif
+
+// Same layout as `struct futex_waitv`.
+typedef struct _FutexWaitv {
+    uint64_t val;
+    uint64_t uaddr;
+    uint32_t flags;
+    uint32_t reserved;
+} FutexWaitv;
+
 ///////////////////////////////////////////////////////////
 // Helpers
 ///////////////////////////////////////////////////////////
 
+// Read the optional timeout at `timeoutVPtr`; returns 0 or a negative errno.
+static int _syscallhandler_futexReadTimeout(SyscallHandler* sys, UntypedForeignPtr timeoutVPtr,
+                                            CSimulationTime* timeoutSimTime) {
+    *timeoutSimTime = SIMTIME_INVALID;
+    if (timeoutVPtr.val) {
+        struct timespec ts = {0};
+        int rv = process_readPtr(rustsyscallhandler_getProcess(sys), &ts, timeoutVPtr, sizeof(ts));
+        if (rv < 0) {
+            return rv;
+        }
+        *timeoutSimTime = simtime_from_timespec(ts);
+        if (*timeoutSimTime == SIMTIME_INVALID) {
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+// Returns a new reference to the futex for the address, adding a new futex to the table if needed.
+static Futex* _syscallhandler_futexGetOrCreate(FutexTable* ftable,
+                                               ManagedPhysicalMemoryAddr futexPPtr) {
+    Futex* futex = futextable_get(ftable, futexPPtr);
+
+    if (futex != NULL) {
+        futex_ref(futex);
+    } else {
+        trace("Dynamically created a new futex object for futex addr %p", (void*)futexPPtr.val);
+        futex = futex_new(futexPPtr);
+        bool success = futextable_add(ftable, futex);
+        utility_debugAssert(success);
+    }
+
+    return futex;
+}
+
+// Remove the futex from the table if nothing is using it anymore.
+static void _syscallhandler_futexRemoveIfUnused(FutexTable* ftable, Futex* futex) {
+    if (futex_getListenerCount(futex) == 0) {
+        ManagedPhysicalMemoryAddr futexPPtr = futex_getAddress(futex);
+        if (futextable_get(ftable, futexPPtr) == futex) {
+            trace("Dynamically freed a futex object for futex addr %p", (void*)futexPPtr.val);
+            futextable_remove(ftable, futexPPtr);
+        }
+    }
+}
+
+static void _syscallhandler_futexAbsoluteTimeout(SysCallCondition* cond,
+                                                 CSimulationTime timeoutSimTime) {
+    CEmulatedTime now = worker_getCurrentEmulatedTime();
+    CEmulatedTime timeoutEmulatedTime = timeoutSimTime;
+    if (timeoutEmulatedTime < now) {
+        // The timeout has already expired
+        timeoutEmulatedTime = now;
+    }
+    syscallcondition_setTimeout(cond, timeoutEmulatedTime);
+}
+
 static SyscallReturn _syscallhandler_futexWaitHelper(SyscallHandler* sys,
                                                      UntypedForeignPtr futexVPtr, int expectedVal,
                                                      UntypedForeignPtr timeoutVPtr,
@@ -29,16 +103,9 @@ static SyscallReturn _syscallhandler_futexWaitHelper(SyscallHandler* sys,
     // This is a new wait operation on the futex for this thread.
     // Check if a timeout was given in the syscall args.
     CSimulationTime timeoutSimTime = SIMTIME_INVALID;
-    if (timeoutVPtr.val) {
-        struct timespec ts = {0};
-        int rv = process_readPtr(rustsyscallhandler_getProcess(sys), &ts, timeoutVPtr, sizeof(ts));
-        if (rv < 0) {
-            return syscallreturn_makeDoneErrno(-rv);
-        }
-        timeoutSimTime = simtime_from_timespec(ts);
-        if (timeoutSimTime == SIMTIME_INVALID) {
-            return syscallreturn_makeDoneErrno(EINVAL);
-        }
+    int rv = _syscallhandler_futexReadTimeout(sys, timeoutVPtr, &timeoutSimTime);
+    if (rv < 0) {
+        return syscallreturn_makeDoneErrno(-rv);
     }
 
     // Normally, the load/compare is done atomically. Since Shadow does not run multiple
@@ -92,11 +159,7 @@ static SyscallReturn _syscallhandler_futexWaitHelper(SyscallHandler* sys,
         }
 
         // Dynamically clean up the futex if needed
-        if (futex_getListenerCount(futex) == 0) {
-            trace("Dynamically freed a futex object for futex addr %p", (void*)futexPPtr.val);
-            bool success = futextable_remove(ftable, futexPPtr);
-            utility_debugAssert(success);
-        }
+        _syscallhandler_futexRemoveIfUnused(ftable, futex);
 
         futex_unref(futex);
         return syscallreturn_makeDoneI64(result);
@@ -104,10 +167,7 @@ static SyscallReturn _syscallhandler_futexWaitHelper(SyscallHandler* sys,
 
     // We'll need to block, dynamically create a futex if one does not yet exist
     if (!futex) {
-        trace("Dynamically created a new futex object for futex addr %p", (void*)futexPPtr.val);
-        futex = futex_new(futexPPtr);
-        bool success = futextable_add(ftable, futex);
-        utility_debugAssert(success);
+        futex = _syscallhandler_futexGetOrCreate(ftable, futexPPtr);
     }
 
     // Now we need to block until another thread does a wake on the futex.
@@ -117,23 +177,18 @@ static SyscallReturn _syscallhandler_futexWaitHelper(SyscallHandler* sys,
         (Trigger){.type = TRIGGER_FUTEX, .object = futex, .state = FileState_FUTEX_WAKEUP};
     SysCallCondition* cond = syscallcondition_new(trigger);
     if (timeoutSimTime != SIMTIME_INVALID) {
-        CEmulatedTime now = worker_getCurrentEmulatedTime();
-        CEmulatedTime timeoutEmulatedTime = (type == TIMEOUT_RELATIVE)
-                                                ? timeoutSimTime + now
-                                                : timeoutSimTime;
-        if (timeoutEmulatedTime < now) {
-            // The timeout has already expired
-            timeoutEmulatedTime = now;
+        if (type == TIMEOUT_RELATIVE) {
+            timeoutSimTime += worker_getCurrentEmulatedTime();
         }
-        syscallcondition_setTimeout(cond, timeoutEmulatedTime);
+        _syscallhandler_futexAbsoluteTimeout(cond, timeoutSimTime);
     }
 
     futex_unref(futex);
     return syscallreturn_makeBlocked(cond, true);
 }
 
-static SyscallReturn _syscallhandler_futexWakeHelper(SyscallHandler* sys,
-                                                     UntypedForeignPtr futexVPtr, int numWakeups) {
+static unsigned int _syscallhandler_futexWake(SyscallHandler* sys, UntypedForeignPtr futexVPtr,
+                                              int numWakeups) {
     // Convert the virtual ptr to a physical ptr that can uniquely identify the futex
     ManagedPhysicalMemoryAddr futexPPtr =
         process_getPhysicalAddress(rustsyscallhandler_getProcess(sys), futexVPtr);
@@ -147,8 +202,144 @@ static SyscallReturn _syscallhandler_futexWakeHelper(SyscallHandler* sys,
     unsigned int numWoken = 0;
     if (futex && numWakeups > 0) {
         trace("Futex trying to perform %i wakeups", numWakeups);
+        futex_ref(futex);
         numWoken = futex_wake(futex, (unsigned int)numWakeups);
         trace("Futex was able to perform %i/%i wakeups", numWoken, numWakeups);
+
+        // waiters that were requeued to this futex aren't using it anymore once they're woken
+        _syscallhandler_futexRemoveIfUnused(ftable, futex);
+        futex_unref(futex);
+    }
+
+    return numWoken;
+}
+
+static SyscallReturn _syscallhandler_futexWakeHelper(SyscallHandler* sys,
+                                                     UntypedForeignPtr futexVPtr, int numWakeups) {
+    return syscallreturn_makeDoneU64(_syscallhandler_futexWake(sys, futexVPtr, numWakeups));
+}
+
+static SyscallReturn _syscallhandler_futexRequeueHelper(SyscallHandler* sys,
+                                                        UntypedForeignPtr futexVPtr, int numWakeups,
+                                                        int numRequeues,
+                                                        UntypedForeignPtr futex2VPtr, bool compare,
+                                                        uint32_t expectedVal) {
+    if (numWakeups < 0 || numRequeues < 0) {
+        return syscallreturn_makeDoneErrno(EINVAL);
+    }
+
+    if (compare) {
+        uint32_t futexVal;
+        int result = process_readPtr(
+            rustsyscallhandler_getProcess(sys), &futexVal, futexVPtr, sizeof(futexVal));
+        if (result) {
+            return syscallreturn_makeDoneErrno(-result);
+        }
+        if (futexVal != expectedVal) {
+            trace("Futex values don't match, try again later");
+            return syscallreturn_makeDoneErrno(EAGAIN);
+        }
+    }
+
+    ManagedPhysicalMemoryAddr futexPPtr =
+        process_getPhysicalAddress(rustsyscallhandler_getProcess(sys), futexVPtr);
+    ManagedPhysicalMemoryAddr futex2PPtr =
+        process_getPhysicalAddress(rustsyscallhandler_getProcess(sys), futex2VPtr);
+
+    FutexTable* ftable = host_getFutexTable(rustsyscallhandler_getHost(sys));
+    Futex* futex = futextable_get(ftable, futexPPtr);
+    if (!futex) {
+        return syscallreturn_makeDoneU64(0);
+    }
+    futex_ref(futex);
+
+    unsigned int numWoken = futex_wake(futex, (unsigned int)numWakeups);
+
+    // Move the remaining waiters without waking them, so that they don't all wake up just to wait
+    // on the second futex (for example a mutex after a condition variable broadcast).
+    unsigned int numRequeued = 0;
+    unsigned int numWaiting = futex_getWaitingCount(futex);
+    if (numRequeues > 0 && numWaiting > 0) {
+        if (futexPPtr.val == futex2PPtr.val) {
+            numRequeued = MIN(numWaiting, (unsigned int)numRequeues);
+        } else {
+            Futex* target = _syscallhandler_futexGetOrCreate(ftable, futex2PPtr);
+            numRequeued = futex_requeue(futex, target, (unsigned int)numRequeues);
+            _syscallhandler_futexRemoveIfUnused(ftable, target);
+            futex_unref(target);
+        }
+    }
+
+    trace("Futex woke %u and requeued %u waiters", numWoken, numRequeued);
+
+    _syscallhandler_futexRemoveIfUnused(ftable, futex);
+    futex_unref(futex);
+
+    return syscallreturn_makeDoneU64(numWoken + numRequeued);
+}
+
+static int _syscallhandler_futexSignExtend12(uint32_t val) {
+    return (val & 0x800) ? (int)(val | 0xfffff000) : (int)val;
+}
+
+static SyscallReturn _syscallhandler_futexWakeOpHelper(SyscallHandler* sys,
+                                                       UntypedForeignPtr futexVPtr, int numWakeups,
+                                                       int numWakeups2,
+                                                       UntypedForeignPtr futex2VPtr,
+                                                       uint32_t encodedOp) {
+    unsigned int op = (encodedOp >> 28) & 0x7;
+    unsigned int cmp = (encodedOp >> 24) & 0xf;
+    int oparg = _syscallhandler_futexSignExtend12((encodedOp >> 12) & 0xfff);
+    int cmparg = _syscallhandler_futexSignExtend12(encodedOp & 0xfff);
+
+    if (encodedOp & (FUTEX_OP_OPARG_SHIFT << 28)) {
+        // like linux, only the low bits of the shift are used
+        oparg = (int)(1u << (oparg & 31));
+    }
+
+    if (op > FUTEX_OP_XOR) {
+        return syscallreturn_makeDoneErrno(ENOSYS);
+    }
+
+    // Normally, the read-modify-write is done atomically. Since Shadow does not run multiple
+    // threads from the same plugin at the same time, we do not use atomic ops.
+    const Process* proc = rustsyscallhandler_getProcess(sys);
+    int oldVal;
+    int result = process_readPtr(proc, &oldVal, futex2VPtr, sizeof(oldVal));
+    if (result) {
+        return syscallreturn_makeDoneErrno(-result);
+    }
+
+    int newVal = 0;
+    switch (op) {
+        case FUTEX_OP_SET: newVal = oparg; break;
+        case FUTEX_OP_ADD: newVal = (int)((uint32_t)oldVal + (uint32_t)oparg); break;
+        case FUTEX_OP_OR: newVal = oldVal | oparg; break;
+        case FUTEX_OP_ANDN: newVal = oldVal & ~oparg; break;
+        case FUTEX_OP_XOR: newVal = oldVal ^ oparg; break;
+    }
+
+    result = process_writePtr(proc, futex2VPtr, &newVal, sizeof(newVal));
+    if (result) {
+        return syscallreturn_makeDoneErrno(-result);
+    }
+
+    bool wakeSecond = false;
+    switch (cmp) {
+        case FUTEX_OP_CMP_EQ: wakeSecond = oldVal == cmparg; break;
+        case FUTEX_OP_CMP_NE: wakeSecond = oldVal != cmparg; break;
+        case FUTEX_OP_CMP_LT: wakeSecond = oldVal < cmparg; break;
+        case FUTEX_OP_CMP_LE: wakeSecond = oldVal <= cmparg; break;
+        case FUTEX_OP_CMP_GT: wakeSecond = oldVal > cmparg; break;
+        case FUTEX_OP_CMP_GE: wakeSecond = oldVal >= cmparg; break;
+        default:
+            // like linux, an invalid comparison is only detected after the operation is done
+            return syscallreturn_makeDoneErrno(ENOSYS);
+    }
+
+    unsigned int numWoken = _syscallhandler_futexWake(sys, futexVPtr, numWakeups);
+    if (wakeSecond) {
+        numWoken += _syscallhandler_futexWake(sys, futex2VPtr, numWakeups2);
     }
 
     return syscallreturn_makeDoneU64(numWoken);
@@ -171,6 +362,8 @@ SyscallReturn syscallhandler_futex(SyscallHandler* sys, const SyscallArgs* args)
     UntypedForeignPtr timeoutptr = args->args[3].as_ptr; // const struct timespec*, or uint32_t
     UntypedForeignPtr uaddr2ptr = args->args[4].as_ptr;  // int*
     int val3 = args->args[5].as_i64;
+    // some operations use the timeout argument as a second value
+    int val2 = (int)(uint32_t)args->args[3].as_u64;
 
     const int possible_options = FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME;
     int options = futex_op & possible_options;
@@ -209,9 +402,25 @@ SyscallReturn syscallhandler_futex(SyscallHandler* sys, const SyscallArgs* args)
             break;
         }
 
+        case FUTEX_REQUEUE: {
+            trace("Handling FUTEX_REQUEUE operation %i", operation);
+            return _syscallhandler_futexRequeueHelper(
+                sys, uaddrptr, val, val2, uaddr2ptr, false, 0);
+        }
+
+        case FUTEX_CMP_REQUEUE: {
+            trace("Handling FUTEX_CMP_REQUEUE operation %i", operation);
+            return _syscallhandler_futexRequeueHelper(
+                sys, uaddrptr, val, val2, uaddr2ptr, true, (uint32_t)val3);
+        }
+
+        case FUTEX_WAKE_OP: {
+            trace("Handling FUTEX_WAKE_OP operation %i op %d", operation, val3);
+            return _syscallhandler_futexWakeOpHelper(
+                sys, uaddrptr, val, val2, uaddr2ptr, (uint32_t)val3);
+        }
+
         case FUTEX_FD:
-        case FUTEX_REQUEUE:
-        case FUTEX_WAKE_OP:
         case FUTEX_LOCK_PI:
         case FUTEX_TRYLOCK_PI:
         case FUTEX_UNLOCK_PI:
@@ -222,3 +431,117 @@ SyscallReturn syscallhandler_futex(SyscallHandler* sys, const SyscallArgs* args)
     warning("Unhandled futex operation %i", operation);
     return syscallreturn_makeDoneErrno(ENOSYS);
 }
+
+SyscallReturn syscallhandler_futex_waitv(SyscallHandler* sys, const SyscallArgs* args) {
+    utility_debugAssert(sys && args);
+
+    UntypedForeignPtr waitersPtr = args->args[0].as_ptr; // struct futex_waitv*
+    unsigned int numWaiters = args->args[1].as_u64;
+    unsigned int flags = args->args[2].as_u64;
+    UntypedForeignPtr timeoutptr = args->args[3].as_ptr; // const struct timespec*
+    clockid_t clockid = args->args[4].as_i64;
+
+    if (flags != 0 || !waitersPtr.val || numWaiters == 0 || numWaiters > FUTEX_WAITV_MAX) {
+        return syscallreturn_makeDoneErrno(EINVAL);
+    }
+
+    // the timeout is always absolute
+    CSimulationTime timeoutSimTime = SIMTIME_INVALID;
+    if (timeoutptr.val) {
+        if (clockid != CLOCK_MONOTONIC && clockid != CLOCK_REALTIME) {
+            return syscallreturn_makeDoneErrno(EINVAL);
+        }
+        int rv = _syscallhandler_futexReadTimeout(sys, timeoutptr, &timeoutSimTime);
+        if (rv < 0) {
+            return syscallreturn_makeDoneErrno(-rv);
+        }
+    }
+
+    const Process* proc = rustsyscallhandler_getProcess(sys);
+
+    FutexWaitv waiters[FUTEX_WAITV_MAX];
+    int rv = process_readPtr(proc, waiters, waitersPtr, numWaiters * sizeof(waiters[0]));
+    if (rv < 0) {
+        return syscallreturn_makeDoneErrno(-rv);
+    }
+
+    ManagedPhysicalMemoryAddr futexPPtrs[FUTEX_WAITV_MAX];
+    for (unsigned int i = 0; i < numWaiters; i++) {
+        if ((waiters[i].flags & ~(FUTEX_32 | FUTEX_PRIVATE_FLAG)) != 0 ||
+            (waiters[i].flags & FUTEX_32) == 0 || waiters[i].reserved != 0 ||
+            waiters[i].uaddr % sizeof(uint32_t) != 0) {
+            return syscallreturn_makeDoneErrno(EINVAL);
+        }
+        futexPPtrs[i] =
+            process_getPhysicalAddress(proc, (UntypedForeignPtr){.val = waiters[i].uaddr});
+    }
+
+    FutexTable* ftable = host_getFutexTable(rustsyscallhandler_getHost(sys));
+
+    if (rustsyscallhandler_wasBlocked(sys)) {
+        Futex* group = rustsyscallhandler_getBlockedFutex(sys);
+        utility_debugAssert(group != NULL);
+
+        int result = futex_getGroupWokenIndex(group);
+        if (result >= 0) {
+            trace("Futex group was woken by futex %d", result);
+        } else if (timeoutSimTime != SIMTIME_INVALID &&
+                   rustsyscallhandler_didListenTimeoutExpire(sys)) {
+            result = -ETIMEDOUT;
+        } else if (thread_unblockedSignalPending(
+                       rustsyscallhandler_getThread(sys),
+                       host_getShimShmemLock(rustsyscallhandler_getHost(sys)))) {
+            result = -EINTR;
+        } else {
+            utility_panic("Futex group was unblocked without a wakeup, timeout, or signal");
+        }
+
+        // The group stopped waiting when the condition was cancelled.
+        for (unsigned int i = 0; i < numWaiters; i++) {
+            Futex* futex = futextable_get(ftable, futexPPtrs[i]);
+            if (futex) {
+                futex_ref(futex);
+                _syscallhandler_futexRemoveIfUnused(ftable, futex);
+                futex_unref(futex);
+            }
+        }
+
+        return syscallreturn_makeDoneI64(result);
+    }
+
+    // `man 2 futex_waitv`: blocks only if all of the futex values match
+    for (unsigned int i = 0; i < numWaiters; i++) {
+        uint32_t futexVal;
+        rv = process_readPtr(proc, &futexVal, (UntypedForeignPtr){.val = waiters[i].uaddr},
+                             sizeof(futexVal));
+        if (rv < 0) {
+            return syscallreturn_makeDoneErrno(-rv);
+        }
+        if (futexVal != waiters[i].val) {
+            trace("Futex %u values don't match, try again later", i);
+            return syscallreturn_makeDoneErrno(EAGAIN);
+        }
+    }
+
+    Futex* futexes[FUTEX_WAITV_MAX];
+    for (unsigned int i = 0; i < numWaiters; i++) {
+        futexes[i] = _syscallhandler_futexGetOrCreate(ftable, futexPPtrs[i]);
+    }
+
+    Futex* group = futex_newGroup(futexes, numWaiters);
+    for (unsigned int i = 0; i < numWaiters; i++) {
+        futex_unref(futexes[i]);
+    }
+
+    trace("Futex group blocking for wakeup on %u futexes %s timeout", numWaiters,
+          timeoutSimTime != SIMTIME_INVALID ? "with" : "without");
+    Trigger trigger =
+        (Trigger){.type = TRIGGER_FUTEX, .object = group, .state = FileState_FUTEX_WAKEUP};
+    SysCallCondition* cond = syscallcondition_new(trigger);
+    if (timeoutSimTime != SIMTIME_INVALID) {
+        _syscallhandler_futexAbsoluteTimeout(cond, timeoutSimTime);
+    }
+
+    futex_unref(group);
+    return syscallreturn_makeBlocked(cond, true);
+}
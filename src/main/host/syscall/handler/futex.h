@@ -9,5 +9,6 @@
 #include "main/host/syscall/protected.h"
 
 SYSCALL_HANDLER(futex);
+SYSCALL_HANDLER(futex_waitv);
 
 #endif /* SRC_MAIN_HOST_SYSCALL_FUTEX_H_ */
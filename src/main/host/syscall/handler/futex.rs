@@ -29,6 +29,26 @@ impl SyscallHandler {
         Self::legacy_syscall(c::syscallhandler_futex, ctx)
     }
 
+    log_syscall!(
+        futex_waitv,
+        /* rv */ std::ffi::c_int,
+        /* waiters */ *const std::ffi::c_void,
+        /* nr_futexes */ std::ffi::c_uint,
+        /* flags */ std::ffi::c_uint,
+        /* timeout */ *const std::ffi::c_void,
+        /* clockid */ linux_api::time::ClockId,
+    );
+    pub fn futex_waitv(
+        ctx: &mut SyscallContext,
+        _waiters: ForeignPtr<std::ffi::c_void>,
+        _nr_futexes: std::ffi::c_uint,
+        _flags: std::ffi::c_uint,
+        _timeout: ForeignPtr<linux_api::time::kernel_timespec>,
+        _clockid: linux_api::time::linux___kernel_clockid_t,
+    ) -> Result<std::ffi::c_int, SyscallError> {
+        Self::legacy_syscall(c::syscallhandler_futex_waitv, ctx)
+    }
+
     log_syscall!(
         get_robust_list,
         /* rv */ std::ffi::c_int,
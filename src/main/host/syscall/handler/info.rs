@@ -0,0 +1,112 @@
+//! Static properties of the syscalls that the syscall handler looks up on every syscall, in a
+//! table indexed by the syscall number that's built at compile time. Looking up a syscall is a
+//! bounds check and a load, regardless of how many syscalls have a property.
+
+use linux_api::syscall::SyscallNum;
+
+/// Properties of a syscall.
+#[derive(Debug, Copy, Clone, Default, PartialEq, Eq)]
+pub struct SyscallInfo {
+    /// Whether the syscall sends or receives on the network (or manages a connection). Reads and
+    /// writes are not included since we'd need to look up the descriptor to know if it's a socket.
+    pub network: bool,
+    /// Whether the syscall's handler may hold back its writes to plugin memory until it returns.
+    /// The handlers must not have the plugin natively execute syscalls or change its mappings.
+    pub batched_writes: bool,
+}
+
+impl SyscallInfo {
+    const NONE: Self = Self {
+        network: false,
+        batched_writes: false,
+    };
+
+    /// The properties of the syscall `n`. Syscalls outside of the table (for example shadow's own
+    /// syscalls) have none.
+    #[inline]
+    pub fn get(n: SyscallNum) -> &'static Self {
+        SYSCALL_INFO
+            .get(usize::try_from(n.val()).unwrap())
+            .unwrap_or(&Self::NONE)
+    }
+}
+
+/// Larger than the largest linux syscall number.
+const TABLE_LEN: usize = 512;
+
+const NETWORK_SYSCALLS: &[SyscallNum] = &[
+    SyscallNum::NR_connect,
+    SyscallNum::NR_accept,
+    SyscallNum::NR_accept4,
+    SyscallNum::NR_sendto,
+    SyscallNum::NR_sendmsg,
+    SyscallNum::NR_sendmmsg,
+    SyscallNum::NR_recvfrom,
+    SyscallNum::NR_recvmsg,
+    SyscallNum::NR_recvmmsg,
+    SyscallNum::NR_shutdown,
+];
+
+const BATCHED_WRITE_SYSCALLS: &[SyscallNum] = &[
+    SyscallNum::NR_accept,
+    SyscallNum::NR_accept4,
+    SyscallNum::NR_epoll_pwait,
+    SyscallNum::NR_epoll_pwait2,
+    SyscallNum::NR_epoll_wait,
+    SyscallNum::NR_getpeername,
+    SyscallNum::NR_getsockname,
+    SyscallNum::NR_getsockopt,
+    SyscallNum::NR_readv,
+    SyscallNum::NR_recvfrom,
+    SyscallNum::NR_recvmmsg,
+    SyscallNum::NR_recvmsg,
+];
+
+static SYSCALL_INFO: [SyscallInfo; TABLE_LEN] = build_table();
+
+const fn build_table() -> [SyscallInfo; TABLE_LEN] {
+    let mut table = [SyscallInfo::NONE; TABLE_LEN];
+
+    let mut i = 0;
+    while i < NETWORK_SYSCALLS.len() {
+        table[NETWORK_SYSCALLS[i].val() as usize].network = true;
+        i += 1;
+    }
+
+    let mut i = 0;
+    while i < BATCHED_WRITE_SYSCALLS.len() {
+        table[BATCHED_WRITE_SYSCALLS[i].val() as usize].batched_writes = true;
+        i += 1;
+    }
+
+    table
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_lookup() {
+        for n in NETWORK_SYSCALLS {
+            assert!(SyscallInfo::get(*n).network);
+        }
+        for n in BATCHED_WRITE_SYSCALLS {
+            assert!(SyscallInfo::get(*n).batched_writes);
+        }
+
+        assert_eq!(SyscallInfo::get(SyscallNum::NR_read), &SyscallInfo::NONE);
+        assert_eq!(
+            SyscallInfo::get(SyscallNum::NR_sendto).batched_writes,
+            false
+        );
+        assert!(!SyscallInfo::get(SyscallNum::NR_readv).network);
+
+        // outside of the table
+        assert_eq!(SyscallInfo::get(SyscallNum::new(1003)), &SyscallInfo::NONE);
+        assert_eq!(
+            SyscallInfo::get(SyscallNum::new(u32::MAX)),
+            &SyscallInfo::NONE
+        );
+    }
+}
@@ -0,0 +1,255 @@
+//! Files whose I/O the shim handles itself, rather than asking Shadow to handle it.
+//!
+//! When the experimental `use_native_file_io` option is enabled and a managed process opens a
+//! regular file, we have the process open its own fd for the same file (through
+//! `/proc/<shadow-pid>/fd/<fd>`, as we do for mmap), and record the native fd in the process's
+//! shared memory. The shim then handles the file's reads, writes, seeks, and stats on the native fd
+//! without asking Shadow to handle them.
+//!
+//! The native fd has its own file offset, so before Shadow handles a syscall that uses the file in
+//! some other way (or that could share it with another descriptor or process), we copy the native
+//! offset to Shadow's file and close the native fd. We call this "demoting" the file, and a demoted
+//! file has its I/O done by Shadow from then on.
+//!
+//! When the experimental `use_shim_random` option is enabled, each thread has a buffer of random
+//! bytes from the host's random source in its shared memory, which the shim uses for `getrandom`
+//! and for reads of random files such as `/dev/urandom`. Random files are recorded in the same
+//! table as native files, and are demoted in the same cases (which only needs the table entry to be
+//! removed). Each time Shadow handles one of these syscalls because the thread didn't have enough
+//! random bytes left, we refill the thread's buffer. Since the bytes come from the host's random
+//! source in the order that Shadow handles syscalls, simulations remain deterministic.
+
+use linux_api::close_range::CloseRangeFlags;
+use linux_api::fcntl::FcntlCommand;
+use linux_api::sched::CloneFlags;
+use linux_api::syscall::SyscallNum;
+use rand::RngCore;
+use shadow_shim_helper_rs::shim_shmem::{LocalFile, MAX_LOCAL_FILES};
+use shadow_shim_helper_rs::syscall_types::SyscallArgs;
+
+use crate::cshadow as c;
+use crate::host::descriptor::CompatFile;
+use crate::host::syscall::handler::{SyscallHandler, ThreadContext};
+use crate::host::syscall::types::SyscallResult;
+
+/// Returns the legacy regular file at `fd`, if any.
+pub(super) fn regular_file(ctx: &ThreadContext, fd: u32) -> Option<*mut c::RegularFile> {
+    let desc_table = ctx.thread.descriptor_table_borrow(ctx.host);
+    let desc = SyscallHandler::get_descriptor(&desc_table, fd).ok()?;
+
+    let CompatFile::Legacy(file) = desc.file() else {
+        return None;
+    };
+    let file = file.ptr();
+
+    if unsafe { c::legacyfile_getType(file) } != c::_LegacyFileType_DT_FILE {
+        return None;
+    }
+    Some(file as *mut c::RegularFile)
+}
+
+/// Can the I/O of `file` be done natively?
+pub(super) fn is_native_capable(file: *mut c::RegularFile) -> bool {
+    // not special files like `/dev/urandom`, whose I/O Shadow emulates
+    if unsafe { c::regularfile_getType(file) } != c::_FileType_FILE_TYPE_REGULAR {
+        return false;
+    }
+
+    // not e.g. character devices or fifos that the application opened by path
+    let mut stat = std::mem::MaybeUninit::<libc::stat>::uninit();
+    let os_fd = unsafe { c::regularfile_getOSBackedFD(file) };
+    if unsafe { libc::fstat(os_fd, stat.as_mut_ptr()) } != 0 {
+        return false;
+    }
+    unsafe { stat.assume_init() }.st_mode & libc::S_IFMT == libc::S_IFREG
+}
+
+/// Have the shim handle the I/O of the newly opened file at `fd`, if possible.
+pub fn after_open(ctx: &ThreadContext, fd: u32) {
+    if usize::try_from(fd).unwrap() >= MAX_LOCAL_FILES || ctx.process.local_file_io_disabled() {
+        return;
+    }
+
+    let Some(file) = regular_file(ctx, fd) else {
+        return;
+    };
+
+    let local_file = if unsafe { c::regularfile_getType(file) } == c::_FileType_FILE_TYPE_RANDOM {
+        if !ctx.host.params.use_shim_random {
+            return;
+        }
+        LocalFile::Random
+    } else {
+        if !ctx.host.params.use_native_file_io || !is_native_capable(file) {
+            return;
+        }
+
+        let Ok(native_fd) = SyscallHandler::open_plugin_file(ctx, fd.into(), file) else {
+            log::debug!("Couldn't open file {fd} in the plugin for native I/O");
+            return;
+        };
+
+        // both offsets are at the start of the file
+        log::trace!("Doing the I/O of file {fd} natively on plugin fd {native_fd}");
+        LocalFile::Native(native_fd)
+    };
+
+    let prev = ctx.process.shmem().set_local_file(fd, Some(local_file));
+    assert!(prev.is_none());
+}
+
+/// Have Shadow do the I/O of the file at `fd`, if the shim currently handles it.
+pub fn demote(ctx: &ThreadContext, fd: i32) {
+    let Ok(fd) = u32::try_from(fd) else {
+        return;
+    };
+    let Some(LocalFile::Native(native_fd)) = ctx.process.shmem().set_local_file(fd, None) else {
+        // nothing else to do for random files
+        return;
+    };
+
+    log::trace!("Demoting file {fd} from native I/O on plugin fd {native_fd}");
+
+    let (process_ctx, thread) = ctx.split_thread();
+    match thread.native_lseek(&process_ctx, native_fd, 0, libc::SEEK_CUR) {
+        Ok(offset) => {
+            // the file is still open since we forget the native fd before closing the file
+            if let Some(file) = regular_file(ctx, fd) {
+                unsafe { c::regularfile_lseek(file, offset, libc::SEEK_SET) };
+            }
+        }
+        Err(e) => log::warn!("Couldn't get the offset of plugin fd {native_fd}: {e}"),
+    }
+
+    SyscallHandler::close_plugin_file(ctx, native_fd);
+}
+
+/// Have Shadow do the I/O of all of the process's files.
+pub fn demote_all(ctx: &ThreadContext) {
+    let fds: Vec<u32> = ctx
+        .process
+        .shmem()
+        .local_files()
+        .map(|(fd, _)| fd)
+        .collect();
+    for fd in fds {
+        demote(ctx, fd.try_into().unwrap());
+    }
+}
+
+/// Forget how the shim handles the I/O of the file at `fd`, which is about to be closed.
+fn forget(ctx: &ThreadContext, fd: u32) {
+    if let Some(LocalFile::Native(native_fd)) = ctx.process.shmem().set_local_file(fd, None) {
+        SyscallHandler::close_plugin_file(ctx, native_fd);
+    }
+}
+
+/// Replace the random bytes that the thread has used.
+fn refill_random_bytes(ctx: &ThreadContext) {
+    let lock = ctx.host.shim_shmem_lock_borrow_mut().unwrap();
+    let mut thread_shmem = ctx.thread.shmem().protected.borrow_mut(&lock.root);
+    thread_shmem.refill_random_bytes(|buf| ctx.host.random_mut().fill_bytes(buf));
+}
+
+/// Called before Shadow handles a syscall, to demote any file that the syscall uses other than
+/// for native I/O.
+pub fn before_syscall(ctx: &ThreadContext, syscall: SyscallNum, args: &SyscallArgs) {
+    let fd = |i: usize| i32::from(args.get(i));
+
+    match syscall {
+        SyscallNum::NR_close => {
+            if let Ok(fd) = u32::try_from(fd(0)) {
+                forget(ctx, fd);
+            }
+        }
+        SyscallNum::NR_close_range => {
+            let first = u32::from(args.get(0));
+            let last = u32::from(args.get(1));
+            let flags = CloseRangeFlags::from_bits_retain(u32::from(args.get(2)));
+            if flags.contains(CloseRangeFlags::CLOSE_RANGE_CLOEXEC) {
+                // the fds are only marked close-on-exec, and exec demotes all files anyways
+                return;
+            }
+            let fds: Vec<u32> = ctx
+                .process
+                .shmem()
+                .local_files()
+                .map(|(fd, _)| fd)
+                .filter(|fd| (first..=last).contains(fd))
+                .collect();
+            for fd in fds {
+                forget(ctx, fd);
+            }
+        }
+        SyscallNum::NR_dup | SyscallNum::NR_ioctl => demote(ctx, fd(0)),
+        SyscallNum::NR_dup2 | SyscallNum::NR_dup3 => {
+            demote(ctx, fd(0));
+            // the new fd is closed if it's open
+            if let Ok(new_fd) = u32::try_from(fd(1)) {
+                forget(ctx, new_fd);
+            }
+        }
+        SyscallNum::NR_fcntl => {
+            let cmd = FcntlCommand::try_from(u32::from(args.get(1)));
+            if matches!(
+                cmd,
+                Ok(FcntlCommand::F_DUPFD | FcntlCommand::F_DUPFD_CLOEXEC | FcntlCommand::F_SETFL)
+            ) {
+                demote(ctx, fd(0));
+            }
+        }
+        SyscallNum::NR_sendfile | SyscallNum::NR_tee => {
+            demote(ctx, fd(0));
+            demote(ctx, fd(1));
+        }
+        SyscallNum::NR_splice | SyscallNum::NR_copy_file_range => {
+            demote(ctx, fd(0));
+            demote(ctx, fd(2));
+        }
+        // the exec'd process has new native fds
+        SyscallNum::NR_execve | SyscallNum::NR_execveat => demote_all(ctx),
+        _ => {}
+    }
+}
+
+/// Called after Shadow handles a syscall that didn't block.
+pub fn after_syscall(
+    ctx: &ThreadContext,
+    syscall: SyscallNum,
+    args: &SyscallArgs,
+    rv: &SyscallResult,
+) {
+    match syscall {
+        SyscallNum::NR_open | SyscallNum::NR_openat | SyscallNum::NR_creat => {
+            if let Ok(fd) = rv {
+                after_open(ctx, u32::from(*fd));
+            }
+        }
+        SyscallNum::NR_getrandom if ctx.host.params.use_shim_random => refill_random_bytes(ctx),
+        SyscallNum::NR_read if ctx.host.params.use_shim_random => {
+            let fd = u32::from(args.get(0));
+            if ctx.process.shmem().local_file(fd) == Some(LocalFile::Random) {
+                refill_random_bytes(ctx);
+            }
+        }
+        _ => {}
+    }
+}
+
+/// Called before a thread clones itself with `flags`.
+pub fn before_clone(ctx: &ThreadContext, flags: CloneFlags) {
+    let new_process = !flags.contains(CloneFlags::CLONE_THREAD);
+    let shared_table = flags.contains(CloneFlags::CLONE_FILES);
+
+    if new_process || !shared_table {
+        // The native fds would be inherited by the child and would share their offsets with the
+        // parent's native fds, which Shadow's files wouldn't see.
+        demote_all(ctx);
+    }
+
+    if new_process == shared_table {
+        // Either the other process would share our fds but not our shared memory, or the new
+        // thread would share our shared memory but not our fds.
+        ctx.process.disable_local_file_io();
+    }
+}
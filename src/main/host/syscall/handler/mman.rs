@@ -281,7 +281,7 @@ impl SyscallHandler {
         mmap_result
     }
 
-    fn open_plugin_file(
+    pub(super) fn open_plugin_file(
         ctx: &ThreadContext,
         fd: std::ffi::c_ulong,
         file: *mut c::RegularFile,
@@ -412,7 +412,7 @@ impl SyscallHandler {
     }
 
     /// Instruct the plugin to close the file at the given fd.
-    fn close_plugin_file(ctx: &ThreadContext, plugin_fd: i32) {
+    pub(super) fn close_plugin_file(ctx: &ThreadContext, plugin_fd: i32) {
         let (ctx, thread) = ctx.split_thread();
         let result = thread.native_close(&ctx, plugin_fd);
 
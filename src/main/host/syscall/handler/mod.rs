@@ -1,4 +1,5 @@
 use std::borrow::Cow;
+use std::time::Instant;
 
 #[cfg(feature = "perf_timers")]
 use std::time::Duration;
@@ -12,18 +13,22 @@ use shadow_shim_helper_rs::syscall_types::SyscallArgs;
 use shadow_shim_helper_rs::syscall_types::SyscallReg;
 use shadow_shim_helper_rs::util::SendPointer;
 
+use crate::core::profile::SyscallLatencies;
+use crate::core::sim_stats::{syscall_counter_key, syscall_counter_name};
 use crate::core::worker::Worker;
 use crate::cshadow as c;
 use crate::host::context::ThreadContext;
+use crate::host::cpu::CpuLatencyBatching;
 use crate::host::descriptor::Descriptor;
 use crate::host::descriptor::descriptor_table::{DescriptorHandle, DescriptorTable};
 use crate::host::process::ProcessId;
 use crate::host::syscall::formatter::log_syscall_simple;
+use crate::host::syscall::handler::info::SyscallInfo;
 use crate::host::syscall::is_shadow_syscall;
 use crate::host::syscall::types::SyscallReturn;
 use crate::host::syscall::types::{SyscallError, SyscallResult};
 use crate::host::thread::ThreadId;
-use crate::utility::counter::Counter;
+use crate::utility::flat_counter::FlatCounter;
 
 #[cfg(feature = "perf_timers")]
 use crate::utility::perf_timer::PerfTimer;
@@ -36,8 +41,11 @@ mod fcntl;
 mod file;
 mod fileat;
 mod futex;
+mod info;
 mod ioctl;
+mod local_files;
 mod mman;
+mod offloaded_file_io;
 mod poll;
 mod prctl;
 mod random;
@@ -47,6 +55,7 @@ mod select;
 mod shadow;
 mod signal;
 mod socket;
+mod splice;
 mod stat;
 mod sysinfo;
 mod time;
@@ -58,6 +67,49 @@ mod wait;
 type LegacySyscallFn =
     unsafe extern "C-unwind" fn(*mut SyscallHandler, *const SyscallArgs) -> SyscallReturn;
 
+/// Syscalls that a process may be configured to make natively, without being trapped by the shim's
+/// seccomp filter. These are a subset of the syscalls that the handler passes through to Linux
+/// without changing any of Shadow's state, so the only observable difference is that they aren't
+/// logged to strace and aren't counted.
+pub const NATIVE_PASSTHROUGH_SYSCALLS: &[SyscallNum] = &[
+    SyscallNum::NR_access,
+    SyscallNum::NR_chmod,
+    SyscallNum::NR_chown,
+    SyscallNum::NR_getcwd,
+    SyscallNum::NR_geteuid,
+    SyscallNum::NR_getegid,
+    SyscallNum::NR_getgid,
+    SyscallNum::NR_getgroups,
+    SyscallNum::NR_getresgid,
+    SyscallNum::NR_getresuid,
+    SyscallNum::NR_getrlimit,
+    SyscallNum::NR_getuid,
+    SyscallNum::NR_getxattr,
+    SyscallNum::NR_lchown,
+    SyscallNum::NR_lgetxattr,
+    SyscallNum::NR_link,
+    SyscallNum::NR_listxattr,
+    SyscallNum::NR_llistxattr,
+    SyscallNum::NR_lremovexattr,
+    SyscallNum::NR_lsetxattr,
+    SyscallNum::NR_lstat,
+    SyscallNum::NR_madvise,
+    SyscallNum::NR_mkdir,
+    SyscallNum::NR_mknod,
+    SyscallNum::NR_readlink,
+    SyscallNum::NR_removexattr,
+    SyscallNum::NR_rename,
+    SyscallNum::NR_rmdir,
+    SyscallNum::NR_setxattr,
+    SyscallNum::NR_stat,
+    SyscallNum::NR_statfs,
+    SyscallNum::NR_symlink,
+    SyscallNum::NR_truncate,
+    SyscallNum::NR_unlink,
+    SyscallNum::NR_utime,
+    SyscallNum::NR_utimes,
+];
+
 // Will eventually contain syscall handler state once migrated from the c handler
 pub struct SyscallHandler {
     /// The host that this `SyscallHandler` belongs to. Intended to be used for logging.
@@ -69,7 +121,9 @@ pub struct SyscallHandler {
     /// The total number of syscalls that we have handled.
     num_syscalls: u64,
     /// A counter for individual syscalls.
-    syscall_counter: Option<Counter>,
+    syscall_counter: Option<FlatCounter>,
+    /// Histograms of the time taken by each invocation of the syscall handlers.
+    syscall_latencies: Option<SyscallLatencies>,
     /// If we are currently blocking a specific syscall, i.e., waiting for a socket to be
     /// readable/writable or waiting for a timeout, the syscall number of that function is stored
     /// here. Will be `None` if a syscall is not currently blocked.
@@ -78,9 +132,16 @@ pub struct SyscallHandler {
     /// forward. This stores the result of the completed syscall, to be returned when the caller
     /// resumes.
     pending_result: Option<SyscallResult>,
+    /// File I/O that's being done on a pool thread for the blocked syscall, if the experimental
+    /// `use_file_io_offload` option is enabled.
+    offloaded_file_io: Option<offloaded_file_io::OffloadedFileIo>,
     /// We use this epoll to service syscalls that need to block on the status of multiple
-    /// descriptors, like poll.
+    /// descriptors, like poll. It keeps its watches between calls, so that a call that watches the
+    /// same descriptors as the previous one doesn't need to recreate them.
     epoll: SendPointer<c::Epoll>,
+    /// How much of this thread's CPU latency may be batched before moving time forward, if the
+    /// experimental `use_adaptive_cpu_latency` option is enabled.
+    cpu_latency_batching: Option<CpuLatencyBatching>,
     /// The cumulative time consumed while handling the current syscall. This includes the time from
     /// previous calls that ended up blocking.
     #[cfg(feature = "perf_timers")]
@@ -96,16 +157,21 @@ impl SyscallHandler {
         process_id: ProcessId,
         thread_id: ThreadId,
         count_syscalls: bool,
+        profile_syscalls: bool,
+        adaptive_cpu_latency: bool,
     ) -> SyscallHandler {
         SyscallHandler {
             host_id,
             process_id,
             thread_id,
             num_syscalls: 0,
-            syscall_counter: count_syscalls.then(Counter::new),
+            syscall_counter: count_syscalls.then(FlatCounter::new),
+            syscall_latencies: profile_syscalls.then(SyscallLatencies::new),
             blocked_syscall: None,
             pending_result: None,
+            offloaded_file_io: None,
             epoll: unsafe { SendPointer::new(c::epoll_new()) },
+            cpu_latency_batching: adaptive_cpu_latency.then(CpuLatencyBatching::new),
             #[cfg(feature = "perf_timers")]
             perf_duration_current: Duration::ZERO,
             #[cfg(feature = "perf_timers")]
@@ -160,19 +226,69 @@ impl SyscallHandler {
             ctx.thread.id(),
         );
 
+        usdt_probe!(
+            syscall_enter,
+            self.host_id,
+            Worker::current_time(),
+            args.number,
+            libc::pid_t::from(self.thread_id)
+        );
+
         // Count the frequency of each syscall, but only on the initial call. This avoids double
         // counting in the case where the initial call blocked at first, but then later became
         // unblocked and is now being handled again here.
         if let Some(syscall_counter) = self.syscall_counter.as_mut() {
             if !was_blocked {
-                syscall_counter.add_one(syscall_name);
+                syscall_counter.add_one(syscall_counter_key(syscall));
             }
         }
 
+        // Remap any plugin memory that earlier syscalls couldn't access directly, so that this and
+        // later syscalls can access it without copying.
+        ctx.process.memory_borrow_mut().remap_missed_regions(ctx);
+
         #[cfg(feature = "perf_timers")]
         let timer = PerfTimer::new_started();
 
-        let mut rv = self.run_handler(ctx, args);
+        let profile_start = self.syscall_latencies.is_some().then(Instant::now);
+
+        let use_local_files = ctx.host.params.use_native_file_io || ctx.host.params.use_shim_random;
+
+        if use_local_files && !was_blocked {
+            local_files::before_syscall(ctx, syscall, args);
+        }
+
+        let batch_writes =
+            ctx.host.params.use_batched_memory_writes && SyscallInfo::get(syscall).batched_writes;
+        if batch_writes {
+            ctx.process.memory_borrow_mut().begin_write_batch();
+        }
+
+        let offloaded = if ctx.host.params.use_file_io_offload {
+            self.offload_file_io(ctx, syscall, args, was_blocked)
+        } else {
+            None
+        };
+        let mut rv = match offloaded {
+            Some(rv) => rv,
+            None => self.run_handler(ctx, args),
+        };
+
+        if batch_writes {
+            // the handler's writes to plugin memory may have failed
+            let flushed = ctx.process.memory_borrow_mut().end_write_batch();
+            if let (Err(e), Ok(_)) = (flushed, &rv) {
+                rv = Err(e.into());
+            }
+        }
+
+        if use_local_files {
+            local_files::after_syscall(ctx, syscall, args, &rv);
+        }
+
+        if let (Some(latencies), Some(start)) = (self.syscall_latencies.as_mut(), profile_start) {
+            latencies.add(u32::from(syscall).try_into().unwrap(), start.elapsed());
+        }
 
         #[cfg(feature = "perf_timers")]
         {
@@ -187,9 +303,18 @@ impl SyscallHandler {
             );
         }
 
+        usdt_probe!(
+            syscall_exit,
+            self.host_id,
+            Worker::current_time(),
+            args.number,
+            matches!(rv, Err(SyscallError::Blocked(_)))
+        );
+
         if !matches!(rv, Err(SyscallError::Blocked(_))) {
             // the syscall completed, count it and the cumulative time to complete it
             self.num_syscalls += 1;
+            ctx.host.count_syscall();
 
             #[cfg(feature = "perf_timers")]
             {
@@ -220,6 +345,14 @@ impl SyscallHandler {
             );
         }
 
+        ctx.process.with_binary_strace(|writer| {
+            let now = Worker::current_time().unwrap();
+            let mem = ctx.process.memory_borrow();
+            if let Err(e) = writer.write_syscall(now, ctx.thread.id(), &args, &rv, &mem) {
+                log::warn!("Couldn't write to the binary strace log: {e}");
+            }
+        });
+
         // If the syscall would be blocked, but there's a signal pending, fail with
         // EINTR instead. The shim-side code will run the signal handlers and then
         // either return the EINTR or restart the syscall (See SA_RESTART in
@@ -268,6 +401,13 @@ impl SyscallHandler {
                 .expect("flushing syscall ptrs");
         }
 
+        if let Some(batching) = self.cpu_latency_batching.as_mut() {
+            // keep the configured latency for threads that are using the network or waiting
+            if SyscallInfo::get(syscall).network || matches!(rv, Err(SyscallError::Blocked(_))) {
+                batching.reset();
+            }
+        }
+
         if ctx.process.is_running() && !matches!(rv, Err(SyscallError::Blocked(_))) {
             let host_shmem = ctx.host.shim_shmem();
             let mut host_shmem_prot = ctx.host.shim_shmem_lock_borrow_mut().unwrap();
@@ -280,13 +420,28 @@ impl SyscallHandler {
                 host_shmem_prot.unapplied_cpu_latency += host_shmem.unblocked_syscall_latency;
             }
 
+            let max_unapplied_cpu_latency = match &self.cpu_latency_batching {
+                Some(batching) => batching.max_unapplied(host_shmem.max_unapplied_cpu_latency),
+                None => host_shmem.max_unapplied_cpu_latency,
+            };
+            // model the CPU more coarsely while bootstrapping with a larger runahead
+            let max_unapplied_cpu_latency = match Worker::bootstrap_runahead() {
+                Some(runahead) => std::cmp::max(max_unapplied_cpu_latency, runahead),
+                None => max_unapplied_cpu_latency,
+            };
+
             log::trace!(
                 "Unapplied CPU latency amt={}ns max={}ns",
                 host_shmem_prot.unapplied_cpu_latency.as_nanos(),
-                host_shmem.max_unapplied_cpu_latency.as_nanos()
+                max_unapplied_cpu_latency.as_nanos()
             );
 
-            if host_shmem_prot.unapplied_cpu_latency > host_shmem.max_unapplied_cpu_latency {
+            if host_shmem_prot.unapplied_cpu_latency > max_unapplied_cpu_latency {
+                if let Some(batching) = self.cpu_latency_batching.as_mut() {
+                    // a busy loop that isn't waiting on the network; batch more next time
+                    batching.limit_reached();
+                }
+
                 let new_time = Worker::current_time().unwrap()
                     + core::mem::replace(
                         &mut host_shmem_prot.unapplied_cpu_latency,
@@ -420,6 +575,7 @@ impl SyscallHandler {
             SyscallNum::NR_fsync => handle!(fsync),
             SyscallNum::NR_ftruncate => handle!(ftruncate),
             SyscallNum::NR_futex => handle!(futex),
+            SyscallNum::NR_futex_waitv => handle!(futex_waitv),
             SyscallNum::NR_futimesat => handle!(futimesat),
             SyscallNum::NR_get_robust_list => handle!(get_robust_list),
             SyscallNum::NR_getdents => handle!(getdents),
@@ -468,6 +624,7 @@ impl SyscallHandler {
             SyscallNum::NR_readlinkat => handle!(readlinkat),
             SyscallNum::NR_readv => handle!(readv),
             SyscallNum::NR_recvfrom => handle!(recvfrom),
+            SyscallNum::NR_recvmmsg => handle!(recvmmsg),
             SyscallNum::NR_recvmsg => handle!(recvmsg),
             SyscallNum::NR_renameat => handle!(renameat),
             SyscallNum::NR_renameat2 => handle!(renameat2),
@@ -477,6 +634,7 @@ impl SyscallHandler {
             SyscallNum::NR_sched_getaffinity => handle!(sched_getaffinity),
             SyscallNum::NR_sched_setaffinity => handle!(sched_setaffinity),
             SyscallNum::NR_select => handle!(select),
+            SyscallNum::NR_sendmmsg => handle!(sendmmsg),
             SyscallNum::NR_sendmsg => handle!(sendmsg),
             SyscallNum::NR_sendto => handle!(sendto),
             SyscallNum::NR_set_robust_list => handle!(set_robust_list),
@@ -489,11 +647,13 @@ impl SyscallHandler {
             SyscallNum::NR_sigaltstack => handle!(sigaltstack),
             SyscallNum::NR_socket => handle!(socket),
             SyscallNum::NR_socketpair => handle!(socketpair),
+            SyscallNum::NR_splice => handle!(splice),
             SyscallNum::NR_statx => handle!(statx),
             SyscallNum::NR_symlinkat => handle!(symlinkat),
             SyscallNum::NR_sync_file_range => handle!(sync_file_range),
             SyscallNum::NR_syncfs => handle!(syncfs),
             SyscallNum::NR_sysinfo => handle!(sysinfo),
+            SyscallNum::NR_tee => handle!(tee),
             SyscallNum::NR_tgkill => handle!(tgkill),
             SyscallNum::NR_timerfd_create => handle!(timerfd_create),
             SyscallNum::NR_timerfd_gettime => handle!(timerfd_gettime),
@@ -723,13 +883,17 @@ impl std::ops::Drop for SyscallHandler {
             log::debug!(
                 "Thread {} syscall counts: {}",
                 self.thread_id,
-                syscall_counter,
+                syscall_counter.to_counter(syscall_counter_name),
             );
 
             // add up the counts at the worker level
             Worker::add_syscall_counts(syscall_counter);
         }
 
+        if let Some(syscall_latencies) = self.syscall_latencies.as_ref() {
+            Worker::add_syscall_latencies(syscall_latencies);
+        }
+
         unsafe { c::legacyfile_unref(self.epoll.ptr() as *mut std::ffi::c_void) };
     }
 }
@@ -955,6 +1119,23 @@ mod export {
             .unwrap_or(false)
     }
 
+    /// Returns the futex that the blocked syscall was waiting on, or NULL if it wasn't waiting on a
+    /// futex. The returned pointer is borrowed from the syscall condition.
+    #[unsafe(no_mangle)]
+    pub extern "C-unwind" fn rustsyscallhandler_getBlockedFutex(
+        sys: *const SyscallHandler,
+    ) -> *mut c::Futex {
+        let sys = unsafe { sys.as_ref() }.unwrap();
+
+        Worker::with_active_thread(|t| {
+            assert_eq!(t.id(), sys.thread_id);
+            t.syscall_condition()
+                .map(|x| x.futex())
+                .unwrap_or(std::ptr::null_mut())
+        })
+        .unwrap()
+    }
+
     #[unsafe(no_mangle)]
     pub extern "C-unwind" fn rustsyscallhandler_getEpoll(
         sys: *const SyscallHandler,
@@ -0,0 +1,156 @@
+//! File syscalls whose I/O is done on a [`FileIoPool`](crate::host::file_io_pool::FileIoPool)
+//! thread rather than on the worker thread.
+//!
+//! When the experimental `use_file_io_offload` option is enabled, a read, write, or sync of an
+//! os-backed regular file submits the I/O to the pool and blocks the thread until the current
+//! time. The host doesn't run any events while the I/O is in progress (see [`Host::execute`]), so
+//! the thread's wakeup runs after the I/O has completed, and the restarted syscall returns its
+//! result. Nothing else happens on the host in the meantime, so the simulation is the same as if
+//! the I/O had been done by the syscall handler.
+//!
+//! [`Host::execute`]: crate::host::host::Host::execute
+
+use linux_api::syscall::SyscallNum;
+use shadow_shim_helper_rs::syscall_types::{ForeignPtr, SyscallArgs, SyscallReg};
+
+use crate::core::worker::{WORKER_SHARED, Worker};
+use crate::cshadow as c;
+use crate::host::descriptor::FileState;
+use crate::host::file_io_pool::{FileIoOp, PendingFileIo};
+use crate::host::syscall::handler::{SyscallHandler, ThreadContext, local_files};
+use crate::host::syscall::types::{ForeignArrayPtr, SyscallError, SyscallResult};
+
+/// File I/O that a thread is blocked on.
+pub struct OffloadedFileIo {
+    io: PendingFileIo,
+    /// Where to copy the bytes to, if the syscall is a read.
+    read_buf: Option<ForeignPtr<u8>>,
+}
+
+impl SyscallHandler {
+    /// Handle the syscall by doing its I/O on a pool thread, or return the result of the I/O if
+    /// the thread was blocked on it. Returns `None` if the syscall should be handled normally.
+    pub(super) fn offload_file_io(
+        &mut self,
+        ctx: &ThreadContext,
+        syscall: SyscallNum,
+        args: &SyscallArgs,
+        was_blocked: bool,
+    ) -> Option<SyscallResult> {
+        if let Some(offloaded) = self.offloaded_file_io.take() {
+            // the host doesn't run any events while the I/O is in progress, so the thread can't
+            // have made a different syscall
+            assert!(was_blocked);
+            return Some(Self::finish_file_io(ctx, offloaded));
+        }
+
+        if was_blocked {
+            return None;
+        }
+
+        // only syscalls that the C syscall handler would do directly on the os-backed fd
+        if !matches!(
+            syscall,
+            SyscallNum::NR_read
+                | SyscallNum::NR_pread64
+                | SyscallNum::NR_write
+                | SyscallNum::NR_pwrite64
+                | SyscallNum::NR_fsync
+                | SyscallNum::NR_fdatasync
+        ) {
+            return None;
+        }
+
+        let fd = i32::from(args.get(0));
+        let buf_ptr = ForeignPtr::<u8>::from(args.get(1));
+        let len = std::cmp::min(usize::from(args.get(2)), c::SYSCALL_IO_BUFSIZE as usize);
+        let offset = || libc::off_t::from(args.get(3));
+
+        let file = local_files::regular_file(ctx, u32::try_from(fd).ok()?)?;
+        if unsafe { c::legacyfile_getStatus(file.cast()) }.contains(FileState::CLOSED)
+            || !local_files::is_native_capable(file)
+            || unsafe { c::regularfile_hasCachedContents(file) }
+        {
+            return None;
+        }
+        let os_fd = unsafe { c::regularfile_getOSBackedFD(file) };
+
+        // the syscall would be interrupted instead of blocking
+        if ctx
+            .thread
+            .unblocked_signal_pending(ctx.process, &ctx.host.shim_shmem_lock_borrow().unwrap())
+        {
+            return None;
+        }
+
+        let (op, read_buf) = match syscall {
+            SyscallNum::NR_read => (
+                FileIoOp::Read {
+                    fd: os_fd,
+                    len,
+                    offset: None,
+                },
+                Some(buf_ptr),
+            ),
+            SyscallNum::NR_pread64 => (
+                FileIoOp::Read {
+                    fd: os_fd,
+                    len,
+                    offset: Some(offset()),
+                },
+                Some(buf_ptr),
+            ),
+            SyscallNum::NR_write | SyscallNum::NR_pwrite64 => {
+                let mut data = vec![0; len];
+                let src = ForeignArrayPtr::new(buf_ptr, len);
+                // let the syscall handler return the error
+                ctx.process
+                    .memory_borrow()
+                    .copy_from_ptr(&mut data, src)
+                    .ok()?;
+                let offset = (syscall == SyscallNum::NR_pwrite64).then(offset);
+                (
+                    FileIoOp::Write {
+                        fd: os_fd,
+                        data,
+                        offset,
+                    },
+                    None,
+                )
+            }
+            SyscallNum::NR_fsync => (FileIoOp::Fsync { fd: os_fd }, None),
+            SyscallNum::NR_fdatasync => (FileIoOp::Fdatasync { fd: os_fd }, None),
+            _ => unreachable!(),
+        };
+
+        let io = WORKER_SHARED
+            .borrow()
+            .as_ref()
+            .unwrap()
+            .file_io_pool()
+            .unwrap()
+            .submit(op);
+        ctx.host.add_pending_file_io(&io);
+        self.offloaded_file_io = Some(OffloadedFileIo { io, read_buf });
+
+        log::trace!("Doing the I/O of syscall {syscall} on file {fd} on a pool thread");
+
+        // the host won't run the wakeup until the I/O is done
+        let now = Worker::current_time().unwrap();
+        Some(Err(SyscallError::new_blocked_until(now, false)))
+    }
+
+    fn finish_file_io(ctx: &ThreadContext, offloaded: OffloadedFileIo) -> SyscallResult {
+        let result = offloaded.io.wait();
+        let len = result.rv?;
+
+        if let Some(buf_ptr) = offloaded.read_buf {
+            let dst = ForeignArrayPtr::new(buf_ptr, len);
+            ctx.process
+                .memory_borrow_mut()
+                .copy_to_ptr(dst, &result.data)?;
+        }
+
+        Ok(SyscallReg::from(len))
+    }
+}
@@ -91,9 +91,11 @@ static int _syscallhandler_getPollEvents(SyscallHandler* sys, struct pollfd* fds
     return num_ready;
 }
 
+// Our epoll keeps the watches from the previous call, since applications usually poll the same fds
+// each time. We only add, modify, or remove the watches that changed, instead of creating a new
+// watch and listener for every fd on every call.
 static void _syscallhandler_registerPollFDs(SyscallHandler* sys, struct pollfd* fds, nfds_t nfds) {
-    // Epoll should already be clear, but let's make sure
-    epoll_reset(rustsyscallhandler_getEpoll(sys));
+    Epoll* epoll = rustsyscallhandler_getEpoll(sys);
 
     for (nfds_t i = 0; i < nfds; i++) {
         struct pollfd* pfd = &fds[i];
@@ -115,10 +117,12 @@ static void _syscallhandler_registerPollFDs(SyscallHandler* sys, struct pollfd*
         }
 
         if (epev.events) {
-            epoll_control(rustsyscallhandler_getEpoll(sys), EPOLL_CTL_ADD, pfd->fd, desc, &epev,
-                          rustsyscallhandler_getHost(sys));
+            epoll_retainWatch(epoll, pfd->fd, desc, &epev, rustsyscallhandler_getHost(sys));
         }
     }
+
+    // Stop watching the fds that aren't in this call
+    epoll_removeUnretainedWatches(epoll);
 }
 
 SyscallReturn _syscallhandler_pollHelper(SyscallHandler* sys, struct pollfd* fds, nfds_t nfds,
@@ -166,8 +170,7 @@ SyscallReturn _syscallhandler_pollHelper(SyscallHandler* sys, struct pollfd* fds
     // We have events now and we've already written them to fds_ptr
     trace("poll returning %i ready events now", num_ready);
 done:
-    // Clear epoll for the next poll
-    epoll_reset(rustsyscallhandler_getEpoll(sys));
+    // We keep the epoll's watches for the next poll, which will likely watch the same fds
     return syscallreturn_makeDoneI64(num_ready);
 }
 
@@ -14,6 +14,8 @@ use crate::host::descriptor::socket::netlink::{NetlinkFamily, NetlinkSocket, Net
 use crate::host::descriptor::socket::unix::{UnixSocket, UnixSocketType};
 use crate::host::descriptor::socket::{RecvmsgArgs, RecvmsgReturn, SendmsgArgs, Socket};
 use crate::host::descriptor::{CompatFile, Descriptor, File, FileState, FileStatus, OpenFile};
+use crate::host::memory_manager::MemoryManager;
+use crate::host::network::namespace::NetworkNamespace;
 use crate::host::syscall::handler::{SyscallContext, SyscallHandler};
 use crate::host::syscall::io::{self, IoVec};
 use crate::host::syscall::type_formatting::{SyscallBufferArg, SyscallSockAddrArg};
@@ -84,7 +86,9 @@ impl SyscallHandler {
                     }
 
                     if ctx.objs.host.params.use_new_tcp {
-                        Socket::Inet(InetSocket::Tcp(TcpSocket::new(file_flags)))
+                        let mut config = tcp::TcpConfig::default();
+                        config.delayed_ack(ctx.objs.host.params.use_new_tcp_delayed_ack);
+                        Socket::Inet(InetSocket::Tcp(TcpSocket::new(file_flags, config)))
                     } else {
                         Socket::Inet(InetSocket::LegacyTcp(LegacyTcpSocket::new(
                             file_flags,
@@ -308,20 +312,7 @@ impl SyscallHandler {
         let mut rng = ctx.objs.host.random_mut();
         let net_ns = ctx.objs.host.network_namespace_borrow();
 
-        let msg = io::read_msghdr(&mem, msg_ptr)?;
-
-        let args = SendmsgArgs {
-            addr: io::read_sockaddr(&mem, msg.name, msg.name_len)?,
-            iovs: &msg.iovs,
-            control_ptr: ForeignArrayPtr::new(msg.control, msg.control_len),
-            // note: "the msg_flags field is ignored" for sendmsg; see send(2)
-            flags,
-        };
-
-        // call the socket's sendmsg(), and run any resulting events
-        let mut result = CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
-            Socket::sendmsg(socket, args, &mut mem, &net_ns, &mut *rng, cb_queue)
-        });
+        let mut result = Self::sendmsg_helper(socket, msg_ptr, flags, &mut mem, &net_ns, &mut *rng);
 
         // if the syscall will block, keep the file open until the syscall restarts
         if let Some(err) = result.as_mut().err() {
@@ -334,6 +325,125 @@ impl SyscallHandler {
         Ok(bytes_written)
     }
 
+    log_syscall!(
+        sendmmsg,
+        /* rv */ std::ffi::c_int,
+        /* sockfd */ std::ffi::c_int,
+        /* msgvec */ *const libc::mmsghdr,
+        /* vlen */ std::ffi::c_uint,
+        /* flags */ nix::sys::socket::MsgFlags,
+    );
+    /// Sends each message in turn, stopping early if one can't be sent. If the first message would
+    /// block, the syscall blocks. Unlike Linux, later messages never block, and the syscall
+    /// instead returns the number of messages sent so far.
+    pub fn sendmmsg(
+        ctx: &mut SyscallContext,
+        fd: std::ffi::c_int,
+        msgvec_ptr: ForeignPtr<libc::mmsghdr>,
+        vlen: std::ffi::c_uint,
+        flags: std::ffi::c_int,
+    ) -> Result<std::ffi::c_int, SyscallError> {
+        // if we were previously blocked, get the active file from the last syscall handler
+        // invocation since it may no longer exist in the descriptor table
+        let file = ctx
+            .objs
+            .thread
+            .syscall_condition()
+            // if this was for a C descriptor, then there won't be an active file object
+            .and_then(|x| x.active_file().cloned());
+
+        let file = match file {
+            // we were previously blocked, so re-use the file from the previous syscall invocation
+            Some(x) => x,
+            // get the file from the descriptor table, or return early if it doesn't exist
+            None => {
+                let desc_table = ctx.objs.thread.descriptor_table_borrow(ctx.objs.host);
+                match Self::get_descriptor(&desc_table, fd)?.file() {
+                    CompatFile::New(file) => file.clone(),
+                    CompatFile::Legacy(_file) => {
+                        return Err(Errno::ENOTSOCK.into());
+                    }
+                }
+            }
+        };
+
+        let File::Socket(socket) = file.inner_file() else {
+            return Err(Errno::ENOTSOCK.into());
+        };
+
+        let mut mem = ctx.objs.process.memory_borrow_mut();
+        let mut rng = ctx.objs.host.random_mut();
+        let net_ns = ctx.objs.host.network_namespace_borrow();
+
+        // linux silently truncates the vector to `UIO_MAXIOV` messages
+        let vlen = std::cmp::min(vlen, libc::UIO_MAXIOV as std::ffi::c_uint);
+
+        let mut num_sent = 0;
+
+        for mmsg_ptr in (0..vlen as usize).map(|i| msgvec_ptr.add(i)) {
+            let flags = if num_sent == 0 {
+                flags
+            } else {
+                flags | libc::MSG_DONTWAIT
+            };
+
+            let mut result = Self::sendmsg_helper(
+                socket,
+                mmsghdr_msg(mmsg_ptr),
+                flags,
+                &mut mem,
+                &net_ns,
+                &mut *rng,
+            );
+
+            if num_sent > 0 {
+                // the error will be returned by the next send instead (if it persists)
+                let Ok(bytes_sent) = result else { break };
+                mem.write(mmsghdr_len(mmsg_ptr), &(bytes_sent as std::ffi::c_uint))?;
+                num_sent += 1;
+                continue;
+            }
+
+            // if the syscall will block, keep the file open until the syscall restarts
+            if let Some(err) = result.as_mut().err() {
+                if let Some(cond) = err.blocked_condition() {
+                    cond.set_active_file(file.clone());
+                }
+            }
+
+            let bytes_sent = result?;
+            mem.write(mmsghdr_len(mmsg_ptr), &(bytes_sent as std::ffi::c_uint))?;
+            num_sent += 1;
+        }
+
+        Ok(num_sent)
+    }
+
+    /// Send a single message described by the plugin's `msghdr`.
+    fn sendmsg_helper(
+        socket: &Socket,
+        msg_ptr: ForeignPtr<libc::msghdr>,
+        flags: std::ffi::c_int,
+        mem: &mut MemoryManager,
+        net_ns: &NetworkNamespace,
+        rng: impl rand::Rng,
+    ) -> Result<libc::ssize_t, SyscallError> {
+        let (msg, addr) = io::read_msghdr_and_sockaddr(mem, msg_ptr)?;
+
+        let args = SendmsgArgs {
+            addr,
+            iovs: &msg.iovs,
+            control_ptr: ForeignArrayPtr::new(msg.control, msg.control_len),
+            // note: "the msg_flags field is ignored" for sendmsg; see send(2)
+            flags,
+        };
+
+        // call the socket's sendmsg(), and run any resulting events
+        CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
+            Socket::sendmsg(socket, args, mem, net_ns, rng, cb_queue)
+        })
+    }
+
     log_syscall!(
         recvfrom,
         /* rv */ libc::ssize_t,
@@ -463,18 +573,7 @@ impl SyscallHandler {
 
         let mut mem = ctx.objs.process.memory_borrow_mut();
 
-        let mut msg = io::read_msghdr(&mem, msg_ptr)?;
-
-        let args = RecvmsgArgs {
-            iovs: &msg.iovs,
-            control_ptr: ForeignArrayPtr::new(msg.control, msg.control_len),
-            flags,
-        };
-
-        // call the socket's recvmsg(), and run any resulting events
-        let mut result = CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
-            Socket::recvmsg(socket, args, &mut mem, cb_queue)
-        });
+        let mut result = Self::recvmsg_helper(socket, msg_ptr, flags, &mut mem);
 
         // if the syscall will block, keep the file open until the syscall restarts
         if let Some(err) = result.as_mut().err() {
@@ -483,12 +582,126 @@ impl SyscallHandler {
             }
         }
 
-        let result = result?;
+        let bytes_read = result?;
+        Ok(bytes_read)
+    }
+
+    log_syscall!(
+        recvmmsg,
+        /* rv */ std::ffi::c_int,
+        /* sockfd */ std::ffi::c_int,
+        /* msgvec */ *const libc::mmsghdr,
+        /* vlen */ std::ffi::c_uint,
+        /* flags */ nix::sys::socket::MsgFlags,
+        /* timeout */ *const linux_api::time::kernel_timespec,
+    );
+    /// Receives messages until the vector is full or no more messages are available. If no
+    /// message is available, the syscall blocks until one is. Unlike Linux, it never blocks after
+    /// the first message (as if `MSG_WAITFORONE` were always set), so the timeout is never
+    /// reached and is ignored.
+    pub fn recvmmsg(
+        ctx: &mut SyscallContext,
+        fd: std::ffi::c_int,
+        msgvec_ptr: ForeignPtr<libc::mmsghdr>,
+        vlen: std::ffi::c_uint,
+        flags: std::ffi::c_int,
+        _timeout: ForeignPtr<linux_api::time::kernel_timespec>,
+    ) -> Result<std::ffi::c_int, SyscallError> {
+        // if we were previously blocked, get the active file from the last syscall handler
+        // invocation since it may no longer exist in the descriptor table
+        let file = ctx
+            .objs
+            .thread
+            .syscall_condition()
+            // if this was for a C descriptor, then there won't be an active file object
+            .and_then(|x| x.active_file().cloned());
+
+        let file = match file {
+            // we were previously blocked, so re-use the file from the previous syscall invocation
+            Some(x) => x,
+            // get the file from the descriptor table, or return early if it doesn't exist
+            None => {
+                let desc_table = ctx.objs.thread.descriptor_table_borrow(ctx.objs.host);
+                match Self::get_descriptor(&desc_table, fd)?.file() {
+                    CompatFile::New(file) => file.clone(),
+                    CompatFile::Legacy(_file) => {
+                        return Err(Errno::ENOTSOCK.into());
+                    }
+                }
+            }
+        };
+
+        let File::Socket(socket) = file.inner_file() else {
+            return Err(Errno::ENOTSOCK.into());
+        };
+
+        let mut mem = ctx.objs.process.memory_borrow_mut();
+
+        // linux silently truncates the vector to `UIO_MAXIOV` messages
+        let vlen = std::cmp::min(vlen, libc::UIO_MAXIOV as std::ffi::c_uint);
+
+        // the sockets don't understand this flag; we always behave as if it were set
+        let flags = flags & !libc::MSG_WAITFORONE;
+
+        let mut num_received = 0;
+
+        for mmsg_ptr in (0..vlen as usize).map(|i| msgvec_ptr.add(i)) {
+            let flags = if num_received == 0 {
+                flags
+            } else {
+                flags | libc::MSG_DONTWAIT
+            };
+
+            let mut result = Self::recvmsg_helper(socket, mmsghdr_msg(mmsg_ptr), flags, &mut mem);
+
+            if num_received > 0 {
+                // the error will be returned by the next receive instead (if it persists)
+                let Ok(bytes_read) = result else { break };
+                mem.write(mmsghdr_len(mmsg_ptr), &(bytes_read as std::ffi::c_uint))?;
+                num_received += 1;
+                continue;
+            }
+
+            // if the syscall will block, keep the file open until the syscall restarts
+            if let Some(err) = result.as_mut().err() {
+                if let Some(cond) = err.blocked_condition() {
+                    cond.set_active_file(file.clone());
+                }
+            }
+
+            let bytes_read = result?;
+            mem.write(mmsghdr_len(mmsg_ptr), &(bytes_read as std::ffi::c_uint))?;
+            num_received += 1;
+        }
+
+        Ok(num_received)
+    }
+
+    /// Receive a single message into the buffers described by the plugin's `msghdr`, and update
+    /// the `msghdr`.
+    fn recvmsg_helper(
+        socket: &Socket,
+        msg_ptr: ForeignPtr<libc::msghdr>,
+        flags: std::ffi::c_int,
+        mem: &mut MemoryManager,
+    ) -> Result<libc::ssize_t, SyscallError> {
+        let mut msg = io::read_msghdr(mem, msg_ptr)?;
+
+        let args = RecvmsgArgs {
+            iovs: &msg.iovs,
+            control_ptr: ForeignArrayPtr::new(msg.control, msg.control_len),
+            flags,
+        };
+
+        // call the socket's recvmsg(), and run any resulting events
+        let result = CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
+            Socket::recvmsg(socket, args, mem, cb_queue)
+        })?;
 
         // write the socket address to the plugin and update the length in msg
         if !msg.name.is_null() {
             if let Some(from_addr) = result.addr.as_ref() {
-                msg.name_len = io::write_sockaddr(&mut mem, from_addr, msg.name, msg.name_len)?;
+                msg.name_len = io::write_sockaddr(mem, from_addr, msg.name, msg.name_len)?;
             } else {
                 msg.name_len = 0;
             }
@@ -499,7 +712,7 @@ impl SyscallHandler {
         msg.flags = result.msg_flags;
 
         // write msg back to the plugin
-        io::update_msghdr(&mut mem, msg_ptr, msg)?;
+        io::update_msghdr(mem, msg_ptr, msg)?;
 
         Ok(result.return_val)
     }
@@ -766,11 +979,15 @@ impl SyscallHandler {
         if result.as_ref().err() == Some(&Errno::EWOULDBLOCK.into())
             && !file_status.contains(FileStatus::NONBLOCK)
         {
-            return Err(SyscallError::new_blocked_on_file(
+            let mut err = SyscallError::new_blocked_on_file(
                 file.clone(),
                 FileState::READABLE,
                 socket.borrow().supports_sa_restart(),
-            ));
+            );
+            // like linux, wake the threads blocked in accept() one at a time rather than all of
+            // them for each new connection
+            err.blocked_condition().unwrap().set_exclusive(true);
+            return Err(err);
         }
 
         let new_socket = result?;
@@ -1103,3 +1320,18 @@ impl SyscallHandler {
         Ok(())
     }
 }
+
+/// The `msg_hdr` field of a plugin's `mmsghdr`.
+fn mmsghdr_msg(mmsg_ptr: ForeignPtr<libc::mmsghdr>) -> ForeignPtr<libc::msghdr> {
+    // `msg_hdr` is the first field
+    const _: () = assert!(std::mem::offset_of!(libc::mmsghdr, msg_hdr) == 0);
+    mmsg_ptr.cast::<libc::msghdr>()
+}
+
+/// The `msg_len` field of a plugin's `mmsghdr`.
+fn mmsghdr_len(mmsg_ptr: ForeignPtr<libc::mmsghdr>) -> ForeignPtr<std::ffi::c_uint> {
+    mmsg_ptr
+        .cast::<u8>()
+        .add(std::mem::offset_of!(libc::mmsghdr, msg_len))
+        .cast::<std::ffi::c_uint>()
+}
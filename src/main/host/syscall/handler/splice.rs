@@ -0,0 +1,148 @@
+use std::sync::Arc;
+
+use linux_api::errno::Errno;
+use shadow_shim_helper_rs::syscall_types::ForeignPtr;
+
+use crate::host::descriptor::{CompatFile, File, FileState, FileStatus};
+use crate::host::syscall::handler::{SyscallContext, SyscallHandler};
+use crate::host::syscall::types::SyscallError;
+use crate::utility::callback_queue::CallbackQueue;
+
+const SPLICE_F_ALL: std::ffi::c_uint =
+    libc::SPLICE_F_MOVE | libc::SPLICE_F_NONBLOCK | libc::SPLICE_F_MORE | libc::SPLICE_F_GIFT;
+
+impl SyscallHandler {
+    log_syscall!(
+        splice,
+        /* rv */ isize,
+        /* fd_in */ std::ffi::c_int,
+        /* off_in */ *const std::ffi::c_void,
+        /* fd_out */ std::ffi::c_int,
+        /* off_out */ *const std::ffi::c_void,
+        /* len */ usize,
+        /* flags */ std::ffi::c_uint,
+    );
+    pub fn splice(
+        ctx: &mut SyscallContext,
+        fd_in: std::ffi::c_int,
+        off_in: ForeignPtr<libc::loff_t>,
+        fd_out: std::ffi::c_int,
+        off_out: ForeignPtr<libc::loff_t>,
+        len: usize,
+        flags: std::ffi::c_uint,
+    ) -> Result<isize, SyscallError> {
+        if flags & !SPLICE_F_ALL != 0 {
+            return Err(Errno::EINVAL.into());
+        }
+
+        let (src, dst) = Self::splice_pipes(ctx, fd_in, fd_out)?;
+
+        // pipes don't support offsets
+        if !off_in.is_null() || !off_out.is_null() {
+            return Err(Errno::ESPIPE.into());
+        }
+
+        Self::splice_helper(&src, &dst, len, flags, /* share= */ false)
+    }
+
+    log_syscall!(
+        tee,
+        /* rv */ isize,
+        /* fd_in */ std::ffi::c_int,
+        /* fd_out */ std::ffi::c_int,
+        /* len */ usize,
+        /* flags */ std::ffi::c_uint,
+    );
+    pub fn tee(
+        ctx: &mut SyscallContext,
+        fd_in: std::ffi::c_int,
+        fd_out: std::ffi::c_int,
+        len: usize,
+        flags: std::ffi::c_uint,
+    ) -> Result<isize, SyscallError> {
+        if flags & !SPLICE_F_ALL != 0 {
+            return Err(Errno::EINVAL.into());
+        }
+
+        let (src, dst) = Self::splice_pipes(ctx, fd_in, fd_out)?;
+
+        Self::splice_helper(&src, &dst, len, flags, /* share= */ true)
+    }
+
+    /// Get the files for a `splice()` or `tee()`. Bytes are only moved between pipes, where they
+    /// can be moved without copying them. Returns `EINVAL` if either file isn't a pipe.
+    fn splice_pipes(
+        ctx: &mut SyscallContext,
+        fd_in: std::ffi::c_int,
+        fd_out: std::ffi::c_int,
+    ) -> Result<(File, File), SyscallError> {
+        let desc_table = ctx.objs.thread.descriptor_table_borrow(ctx.objs.host);
+
+        let get_pipe = |fd| -> Result<File, SyscallError> {
+            let file = match Self::get_descriptor(&desc_table, fd)?.file() {
+                CompatFile::New(file) => file.inner_file().clone(),
+                CompatFile::Legacy(_) => {
+                    warn_once_then_debug!("splice() and tee() are only supported between pipes");
+                    return Err(Errno::EINVAL.into());
+                }
+            };
+
+            if !matches!(file, File::Pipe(_)) {
+                warn_once_then_debug!("splice() and tee() are only supported between pipes");
+                return Err(Errno::EINVAL.into());
+            }
+
+            Ok(file)
+        };
+
+        Ok((get_pipe(fd_in)?, get_pipe(fd_out)?))
+    }
+
+    fn splice_helper(
+        src: &File,
+        dst: &File,
+        len: usize,
+        flags: std::ffi::c_uint,
+        share: bool,
+    ) -> Result<isize, SyscallError> {
+        let (File::Pipe(src_pipe), File::Pipe(dst_pipe)) = (src, dst) else {
+            panic!("Expected pipes");
+        };
+
+        // the same end of a pipe can't be both read from and written to
+        if Arc::ptr_eq(src_pipe, dst_pipe) {
+            return Err(Errno::EINVAL.into());
+        }
+
+        // like linux, a non-blocking pipe makes the splice non-blocking
+        let nonblocking = flags & libc::SPLICE_F_NONBLOCK != 0
+            || src.borrow().status().contains(FileStatus::NONBLOCK)
+            || dst.borrow().status().contains(FileStatus::NONBLOCK);
+
+        let result = CallbackQueue::queue_and_run_with_legacy(|cb_queue| {
+            src_pipe
+                .borrow_mut()
+                .splice_to(&mut dst_pipe.borrow_mut(), len, share, cb_queue)
+        });
+
+        if result == Err(Errno::EWOULDBLOCK.into()) && !nonblocking {
+            // wait for the source to have data, or otherwise for the destination to have space
+            let (file, wait_for) = if !src.borrow().state().contains(FileState::READABLE) {
+                (src, FileState::READABLE)
+            } else {
+                (dst, FileState::WRITABLE)
+            };
+
+            // check that we're not already in the state that we're going to wait for
+            debug_assert!(!file.borrow().state().intersects(wait_for));
+
+            return Err(SyscallError::new_blocked_on_file(
+                file.clone(),
+                wait_for,
+                file.borrow().supports_sa_restart(),
+            ));
+        }
+
+        Ok(result?.try_into().unwrap())
+    }
+}
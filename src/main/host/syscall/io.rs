@@ -5,7 +5,7 @@ use std::ops::{Deref, DerefMut};
 use linux_api::errno::Errno;
 use shadow_shim_helper_rs::syscall_types::ForeignPtr;
 
-use crate::host::memory_manager::MemoryManager;
+use crate::host::memory_manager::{MemoryGather, MemoryManager};
 use crate::host::syscall::types::ForeignArrayPtr;
 use crate::utility::sockaddr::SockaddrStorage;
 
@@ -97,22 +97,11 @@ pub fn read_sockaddr(
         return Ok(None);
     }
 
-    let addr_len_usize: usize = addr_len.try_into().unwrap();
+    let addr_len_usize = sockaddr_len_to_read(addr_len)?;
 
     // this won't have the correct alignment, but that's fine since `SockaddrStorage::from_bytes()`
     // doesn't require alignment
     let mut addr_buf = [MaybeUninit::new(0u8); std::mem::size_of::<libc::sockaddr_storage>()];
-
-    // make sure we will not lose data when we copy
-    if addr_len_usize > std::mem::size_of_val(&addr_buf) {
-        log::warn!(
-            "Shadow does not support the address length {}, which is larger than {}",
-            addr_len,
-            std::mem::size_of_val(&addr_buf),
-        );
-        return Err(Errno::EINVAL);
-    }
-
     let addr_buf = &mut addr_buf[..addr_len_usize];
 
     mem.copy_from_ptr(
@@ -125,6 +114,25 @@ pub fn read_sockaddr(
     Ok(Some(addr))
 }
 
+/// Returns the number of bytes to read for a plugin's socket address of length `addr_len`, or
+/// `EINVAL` if Shadow doesn't support the length.
+fn sockaddr_len_to_read(addr_len: libc::socklen_t) -> Result<usize, Errno> {
+    let addr_len_usize: usize = addr_len.try_into().unwrap();
+    let max_len = std::mem::size_of::<libc::sockaddr_storage>();
+
+    // make sure we will not lose data when we copy
+    if addr_len_usize > max_len {
+        log::warn!(
+            "Shadow does not support the address length {}, which is larger than {}",
+            addr_len,
+            max_len,
+        );
+        return Err(Errno::EINVAL);
+    }
+
+    Ok(addr_len_usize)
+}
+
 /// Writes `val` to `val_ptr`, but will only write a partial value if `val_len_bytes` is smaller
 /// than the size of `val`. Returns the number of bytes written.
 ///
@@ -222,45 +230,76 @@ impl<'a, I> IoVecReader<'a, I> {
 }
 
 impl<'a, I: Iterator<Item = &'a IoVec>> std::io::Read for IoVecReader<'a, I> {
-    fn read(&mut self, mut buf: &mut [u8]) -> std::io::Result<usize> {
-        let mut bytes_read = 0;
+    /// Reads from as many `IoVec`s as needed to fill `buf` in a single copy, rather than one copy
+    /// per `IoVec`.
+    fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+        // the plugin memory that we'll read from
+        let mut srcs = Vec::new();
+        let mut srcs_len = 0;
+
+        while srcs_len < buf.len() {
+            let src = match self.current_src.take() {
+                Some(x) => x,
+                None => match self.iovs.next() {
+                    Some(next_iov) => (*next_iov).into(),
+                    // no iovs remaining
+                    None => break,
+                },
+            };
+
+            let num_to_read = std::cmp::min(src.len(), buf.len() - srcs_len);
+            if num_to_read < src.len() {
+                // there will be bytes remaining in this iov
+                self.current_src = Some(src.slice(num_to_read..));
+            }
 
-        loop {
-            // we filled the buffer
-            if buf.is_empty() {
-                break;
+            if num_to_read > 0 {
+                srcs.push(src.slice(..num_to_read));
+                srcs_len += num_to_read;
             }
+        }
 
-            if let Some(ref mut src) = self.current_src {
-                let num_to_read = std::cmp::min(src.len(), buf.len());
-                let result = self
-                    .mem
-                    .copy_from_ptr(&mut buf[..num_to_read], src.slice(..num_to_read));
+        if srcs_len == 0 {
+            return Ok(0);
+        }
 
-                match (result, bytes_read) {
-                    // we successfully read the bytes
-                    (Ok(()), _) => {}
-                    // we haven't yet read any bytes, so return the error
-                    (Err(e), 0) => return Err(e.into()),
-                    // return how many bytes we've read
-                    (Err(_), _) => break,
-                }
+        let mut gather = MemoryGather::new();
+        let mut remaining = &mut buf[..srcs_len];
+        for src in &srcs {
+            let (dst, rest) = std::mem::take(&mut remaining).split_at_mut(src.len());
+            gather.add(dst, *src);
+            remaining = rest;
+        }
 
-                bytes_read += num_to_read;
-                buf = &mut buf[num_to_read..];
-                *src = src.slice(num_to_read..);
+        if self.mem.copy_from_ptrs(gather).is_ok() {
+            return Ok(srcs_len);
+        }
 
-                if src.is_empty() {
-                    // no bytes remaining in this iov
-                    self.current_src = None;
+        // Some iov couldn't be read. Read them one at a time to find out how many bytes we can
+        // read before the error.
+        let mut bytes_read = 0;
+        for src in srcs {
+            let result = self
+                .mem
+                .copy_from_ptr(&mut buf[bytes_read..][..src.len()], src);
+
+            match (result, bytes_read) {
+                // we successfully read the bytes
+                (Ok(()), _) => {}
+                // we haven't yet read any bytes, so return the error
+                (Err(e), 0) => {
+                    self.current_src = Some(src);
+                    return Err(e.into());
                 }
-            } else {
-                let Some(next_iov) = self.iovs.next() else {
-                    // no iovs remaining
+                // return how many bytes we've read (we don't try reading from any later iovs
+                // since the next read will see the same error and stop)
+                (Err(_), _) => {
+                    self.current_src = Some(src);
                     break;
-                };
-                self.current_src = Some((*next_iov).into());
+                }
             }
+
+            bytes_read += src.len();
         }
 
         Ok(bytes_read)
@@ -341,6 +380,79 @@ impl<'a, I: Iterator<Item = &'a IoVec>> std::io::Write for IoVecWriter<'a, I> {
         Ok(bytes_written)
     }
 
+    /// Writes the buffers to as many `IoVec`s as needed in a single copy, rather than one copy per
+    /// buffer and `IoVec`.
+    fn write_vectored(&mut self, bufs: &[std::io::IoSlice<'_>]) -> std::io::Result<usize> {
+        let len: usize = bufs.iter().map(|x| x.len()).sum();
+
+        // the plugin memory that we'll write to
+        let mut dsts = Vec::new();
+        let mut dsts_len = 0;
+
+        while dsts_len < len {
+            let dst = match self.current_dst.take() {
+                Some(x) => x,
+                None => match self.iovs.next() {
+                    Some(next_iov) => (*next_iov).into(),
+                    // no iovs remaining
+                    None => break,
+                },
+            };
+
+            let num_to_write = std::cmp::min(dst.len(), len - dsts_len);
+            if num_to_write < dst.len() {
+                // there will be space remaining in this iov
+                self.current_dst = Some(dst.slice(num_to_write..));
+            }
+
+            if num_to_write > 0 {
+                dsts.push(dst.slice(..num_to_write));
+                dsts_len += num_to_write;
+            }
+        }
+
+        if dsts_len == 0 {
+            return Ok(0);
+        }
+
+        // the buffers, truncated to the size of the plugin memory
+        let mut srcs = Vec::with_capacity(bufs.len());
+        let mut srcs_len = 0;
+        for buf in bufs {
+            let num_to_write = std::cmp::min(buf.len(), dsts_len - srcs_len);
+            if num_to_write == 0 {
+                break;
+            }
+            srcs.push(std::io::IoSlice::new(&buf[..num_to_write]));
+            srcs_len += num_to_write;
+        }
+
+        let bytes_written = match self.mem.copy_to_ptrs(&dsts, &srcs) {
+            Ok(x) => x,
+            Err(e) => {
+                // we haven't written any bytes, so the next write should start at the first iov
+                self.current_dst = Some(dsts[0]);
+                return Err(e.into());
+            }
+        };
+
+        if bytes_written < dsts_len {
+            // there was an error partway through, so the next write should start where this one
+            // stopped (we don't try writing to any later iovs since the next write will see the
+            // same error and stop)
+            let mut offset = bytes_written;
+            for dst in dsts {
+                if offset < dst.len() {
+                    self.current_dst = Some(dst.slice(offset..));
+                    break;
+                }
+                offset -= dst.len();
+            }
+        }
+
+        Ok(bytes_written)
+    }
+
     fn flush(&mut self) -> std::io::Result<()> {
         Ok(())
     }
@@ -356,20 +468,21 @@ pub fn read_iovecs(
         return Err(Errno::EINVAL);
     }
 
-    let mut iovs = Vec::with_capacity(count);
-
     let iov_ptr = ForeignArrayPtr::new(iov_ptr, count);
     let mem_ref = mem.memory_ref(iov_ptr)?;
-    let plugin_iovs = mem_ref.deref();
 
-    for plugin_iov in plugin_iovs {
-        iovs.push(IoVec {
+    Ok(iovecs_to_rust(mem_ref.deref()))
+}
+
+/// Helper to convert an array of [`libc::iovec`] copied from plugin memory into a [`Vec<IoVec>`].
+fn iovecs_to_rust(plugin_iovs: &[libc::iovec]) -> Vec<IoVec> {
+    plugin_iovs
+        .iter()
+        .map(|plugin_iov| IoVec {
             base: ForeignPtr::from_raw_ptr(plugin_iov.iov_base as *mut u8),
             len: plugin_iov.iov_len,
-        });
-    }
-
-    Ok(iovs)
+        })
+        .collect()
 }
 
 /// Read a plugin's [`libc::msghdr`] into a [`MsgHdr`].
@@ -384,6 +497,62 @@ pub fn read_msghdr(
     msghdr_to_rust(&plugin_msg, mem)
 }
 
+/// Read a plugin's [`libc::msghdr`] into a [`MsgHdr`], along with the socket address that it
+/// points to (for example for `sendmsg()`). The iovec array and the socket address are read from
+/// plugin memory together rather than with separate reads.
+pub fn read_msghdr_and_sockaddr(
+    mem: &MemoryManager,
+    msg_ptr: ForeignPtr<libc::msghdr>,
+) -> Result<(MsgHdr, Option<SockaddrStorage>), Errno> {
+    let plugin_msg = mem.read(msg_ptr)?;
+
+    let iov_count = plugin_msg.msg_iovlen;
+    if iov_count > libc::UIO_MAXIOV.try_into().unwrap() {
+        return Err(Errno::EINVAL);
+    }
+
+    let addr_ptr = ForeignPtr::from_raw_ptr(plugin_msg.msg_name as *mut u8);
+    let addr_len = if addr_ptr.is_null() {
+        0
+    } else {
+        sockaddr_len_to_read(plugin_msg.msg_namelen)?
+    };
+
+    let mut plugin_iovs = vec![shadow_pod::zeroed::<libc::iovec>(); iov_count];
+    let mut addr_buf = [MaybeUninit::new(0u8); std::mem::size_of::<libc::sockaddr_storage>()];
+    let addr_buf = &mut addr_buf[..addr_len];
+
+    let mut gather = MemoryGather::new();
+    gather.add(
+        &mut plugin_iovs[..],
+        ForeignArrayPtr::new(ForeignPtr::from_raw_ptr(plugin_msg.msg_iov), iov_count),
+    );
+    if !addr_ptr.is_null() {
+        gather.add(
+            &mut *addr_buf,
+            ForeignArrayPtr::new(addr_ptr.cast::<MaybeUninit<u8>>(), addr_len),
+        );
+    }
+    mem.copy_from_ptrs(gather)?;
+
+    let addr = if addr_ptr.is_null() {
+        None
+    } else {
+        Some(unsafe { SockaddrStorage::from_bytes(addr_buf).ok_or(Errno::EINVAL)? })
+    };
+
+    let msg = MsgHdr {
+        name: addr_ptr,
+        name_len: plugin_msg.msg_namelen,
+        iovs: iovecs_to_rust(&plugin_iovs),
+        control: ForeignPtr::from_raw_ptr(plugin_msg.msg_control as *mut u8),
+        control_len: plugin_msg.msg_controllen,
+        flags: plugin_msg.msg_flags,
+    };
+
+    Ok((msg, addr))
+}
+
 /// Used to update a `libc::msghdr`. Only writes the [`libc::msghdr`] `msg_namelen`,
 /// `msg_controllen`, and `msg_flags` fields, which are the only fields that can be changed by
 /// `recvmsg()`.
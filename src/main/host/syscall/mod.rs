@@ -4,6 +4,7 @@ use shadow_shim_helper_rs::shadow_syscalls::ShadowSyscallNum;
 use crate::cshadow as c;
 use crate::host::descriptor::{File, FileState};
 
+pub mod binary_strace;
 pub mod condition;
 pub mod formatter;
 pub mod handler;
@@ -39,6 +39,8 @@ struct _SysCallCondition {
     // Whether a wakeup event has already been scheduled.
     // Used to avoid scheduling multiple events when multiple triggers fire.
     bool wakeupScheduled;
+    // Whether the wakeup is shared with the other exclusive waiters on the trigger file.
+    bool exclusive;
     // Memory tracking
     gint referenceCount;
     MAGIC_DECLARE;
@@ -103,6 +105,12 @@ void syscallcondition_setTimeout(SysCallCondition* cond, CEmulatedTime t) {
     cond->timeoutExpiration = t;
 }
 
+void syscallcondition_setExclusive(SysCallCondition* cond, bool exclusive) {
+    MAGIC_ASSERT(cond);
+
+    cond->exclusive = exclusive;
+}
+
 void syscallcondition_setActiveFile(SysCallCondition* cond, OpenFile* file) {
     MAGIC_ASSERT(cond);
 
@@ -395,6 +403,20 @@ static void _syscallcondition_trigger(const Host* host, void* obj, void* arg) {
     }
 }
 
+/* Wake the exclusive waiters on the file with canonical handle `fileHandle` that are waiting for
+ * state `arg`. */
+static void _syscallcondition_triggerExclusive(const Host* host, void* fileHandle, void* arg) {
+    FileState state = (FileState)(uintptr_t)arg;
+
+    // Conditions that are added while we're running the threads are woken by this same task.
+    SysCallCondition* cond;
+    while ((cond =
+                host_popExclusiveWakeup(host, (uintptr_t)fileHandle, state)) != NULL) {
+        _syscallcondition_trigger(host, cond, NULL);
+        syscallcondition_unref(cond);
+    }
+}
+
 static void _syscallcondition_scheduleWakeupTask(SysCallCondition* cond, const Host* host) {
     MAGIC_ASSERT(cond);
 
@@ -404,6 +426,25 @@ static void _syscallcondition_scheduleWakeupTask(SysCallCondition* cond, const H
         return;
     }
 
+    if (cond->exclusive && cond->trigger.type == TRIGGER_FILE) {
+        uintptr_t fileHandle = file_getCanonicalHandle(cond->trigger.object.as_file);
+
+        /* The wait queue holds a ref to the condition. */
+        syscallcondition_ref(cond);
+        cond->wakeupScheduled = true;
+
+        /* The first waiter schedules the task that wakes everyone in the wait queue. */
+        if (host_pushExclusiveWakeup(host, fileHandle, cond->trigger.state, cond)) {
+            TaskRef* wakeupTask =
+                taskref_new_bound(cond->hostId, _syscallcondition_triggerExclusive,
+                                  (void*)fileHandle, (void*)(uintptr_t)cond->trigger.state, NULL,
+                                  NULL);
+            host_scheduleTaskWithDelay(host, wakeupTask, 0); // Call without moving time forward
+            taskref_drop(wakeupTask);
+        }
+        return;
+    }
+
     /* We deliver the wakeup via a task, to make sure whatever
      * code triggered our listener finishes its logic first before
      * we tell the process to run the plugin and potentially change
@@ -561,3 +602,8 @@ CEmulatedTime syscallcondition_getTimeout(SysCallCondition* cond) {
 }
 
 OpenFile* syscallcondition_getActiveFile(SysCallCondition* cond) { return cond->activeFile; }
+
+Futex* syscallcondition_getFutex(SysCallCondition* cond) {
+    MAGIC_ASSERT(cond);
+    return cond->trigger.type == TRIGGER_FUTEX ? cond->trigger.object.as_futex : NULL;
+}
@@ -67,6 +67,12 @@ void syscallcondition_setTimeout(SysCallCondition* cond, CEmulatedTime t);
  * the descriptor table). */
 void syscallcondition_setActiveFile(SysCallCondition* cond, OpenFile* file);
 
+/* Mark the condition as an exclusive waiter, as for accept(). Exclusive waiters on the same file
+ * and state are woken together by a single task, in the order that their listeners fired, and each
+ * one only resumes its thread if the file is still in the state after the earlier threads ran. Only
+ * has an effect on conditions with a TRIGGER_FILE trigger. */
+void syscallcondition_setExclusive(SysCallCondition* cond, bool exclusive);
+
 /* Increment the reference count on the given condition. */
 void syscallcondition_ref(SysCallCondition* cond);
 
@@ -91,6 +97,9 @@ CEmulatedTime syscallcondition_getTimeout(SysCallCondition* cond);
 /* Get the active file for the condition, or NULL if there isn't one. */
 OpenFile* syscallcondition_getActiveFile(SysCallCondition* cond);
 
+/* Get the futex that the condition is waiting on, or NULL if it isn't waiting on a futex. */
+Futex* syscallcondition_getFutex(SysCallCondition* cond);
+
 /* If the condition's thread doesn't have `signo` blocked, schedule a wakeup.
  *
  * Returns whether a wakeup was scheduled.
@@ -12,7 +12,7 @@ use shadow_shim_helper_rs::HostId;
 use shadow_shim_helper_rs::explicit_drop::ExplicitDrop;
 use shadow_shim_helper_rs::rootedcell::rc::RootedRc;
 use shadow_shim_helper_rs::rootedcell::refcell::RootedRefCell;
-use shadow_shim_helper_rs::shim_shmem::{HostShmemProtected, ThreadShmem};
+use shadow_shim_helper_rs::shim_shmem::{self, HostShmemProtected, ThreadShmem};
 use shadow_shim_helper_rs::syscall_types::{ForeignPtr, SyscallReg};
 use shadow_shim_helper_rs::util::SendPointer;
 use shadow_shmem::allocator::{ShMemBlock, shmalloc};
@@ -119,6 +119,8 @@ impl Thread {
                 self.process_id,
                 new_tid,
                 host.params.use_syscall_counters,
+                host.params.use_profiling,
+                host.params.use_adaptive_cpu_latency,
             ),
         );
 
@@ -357,6 +359,26 @@ impl Thread {
         Ok(())
     }
 
+    /// Natively execute madvise(2) on the given thread.
+    pub fn native_madvise(
+        &self,
+        ctx: &ProcessContext,
+        addr: ForeignPtr<u8>,
+        len: usize,
+        advice: i32,
+    ) -> Result<(), Errno> {
+        self.native_syscall(
+            ctx,
+            libc::SYS_madvise,
+            &[
+                SyscallReg::from(addr),
+                SyscallReg::from(len),
+                SyscallReg::from(advice),
+            ],
+        )?;
+        Ok(())
+    }
+
     /// Natively execute open(2) on the given thread.
     pub fn native_open(
         &self,
@@ -383,6 +405,26 @@ impl Thread {
         Ok(())
     }
 
+    /// Natively execute lseek(2) on the given thread.
+    pub fn native_lseek(
+        &self,
+        ctx: &ProcessContext,
+        fd: i32,
+        offset: i64,
+        whence: i32,
+    ) -> Result<i64, Errno> {
+        let res = self.native_syscall(
+            ctx,
+            libc::SYS_lseek,
+            &[
+                SyscallReg::from(fd),
+                SyscallReg::from(offset),
+                SyscallReg::from(whence),
+            ],
+        );
+        Ok(i64::from(res?))
+    }
+
     /// Natively execute brk(2) on the given thread.
     pub fn native_brk(
         &self,
@@ -433,11 +475,22 @@ impl Thread {
         Ok(())
     }
 
+    /// Allocate the shared memory for a new thread with id `tid`, for use with
+    /// `wrap_mthread`.
+    pub fn new_shmem(host: &Host, tid: ThreadId) -> ShMemBlock<'static, ThreadShmem> {
+        shmalloc(ThreadShmem::new(
+            &host.shim_shmem_lock_borrow().unwrap(),
+            tid.into(),
+        ))
+    }
+
     /// Create a new `Thread`, wrapping `mthread`. Intended for use by
-    /// syscall handlers such as `clone`.
+    /// syscall handlers such as `clone`. `shmem` is the thread's shared memory
+    /// from `new_shmem`.
     pub fn wrap_mthread(
         host: &Host,
         mthread: ManagedThread,
+        shmem: ShMemBlock<'static, ThreadShmem>,
         desc_table: RootedRc<RootedRefCell<DescriptorTable>>,
         pid: ProcessId,
         tid: ThreadId,
@@ -446,17 +499,21 @@ impl Thread {
             mthread: RefCell::new(mthread),
             syscallhandler: RootedRefCell::new(
                 host.root(),
-                SyscallHandler::new(host.id(), pid, tid, host.params.use_syscall_counters),
+                SyscallHandler::new(
+                    host.id(),
+                    pid,
+                    tid,
+                    host.params.use_syscall_counters,
+                    host.params.use_profiling,
+                    host.params.use_adaptive_cpu_latency,
+                ),
             ),
             cond: Cell::new(unsafe { SendPointer::new(std::ptr::null_mut()) }),
             id: tid,
             host_id: host.id(),
             process_id: pid,
             tid_address: Cell::new(ForeignPtr::null()),
-            shim_shared_memory: shmalloc(ThreadShmem::new(
-                &host.shim_shmem_lock_borrow().unwrap(),
-                tid.into(),
-            )),
+            shim_shared_memory: shmem,
             desc_table: Some(desc_table),
             _counter: ObjectCounter::new("Thread"),
         };
@@ -537,6 +594,10 @@ impl Thread {
     ) -> bool {
         debug_assert_eq!(process.id(), self.process_id);
 
+        if !shim_shmem::signals_maybe_pending(&process.shmem(), self.shmem()) {
+            return false;
+        }
+
         let thread_shmem_protected = self.shmem().protected.borrow(&host_shmem.root);
 
         let unblocked_signals = !thread_shmem_protected.blocked_signals;
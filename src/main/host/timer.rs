@@ -7,6 +7,7 @@ use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
 use super::host::Host;
 use crate::core::work::task::TaskRef;
+use crate::core::work::timer_wheel::TimerId;
 use crate::core::worker::Worker;
 use crate::utility::{Magic, ObjectCounter};
 
@@ -27,6 +28,11 @@ struct TimerInternal {
     expiration_count: u64,
     next_expire_id: u64,
     min_valid_expire_id: u64,
+    /// The pending expiration in the host's timer wheel, if the host has one.
+    wheel_timer: Option<TimerId>,
+    /// Whether the periodic expirations that occur while the expiration count is non-zero are
+    /// counted when the count is read rather than by an event each (see [`Timer::new_lazy`]).
+    lazy: bool,
     on_expire: Box<dyn Fn(&Host) + Send + Sync>,
 }
 
@@ -41,6 +47,37 @@ impl TimerInternal {
         self.next_expire_time = next_expire_time;
         self.expire_interval = expire_interval;
     }
+
+    /// The periodic expirations of a lazy timer that have occurred by `now` but haven't been
+    /// counted yet, and the time of the first expiration after them.
+    fn uncounted_expirations(&self, now: EmulatedTime) -> Option<(u64, EmulatedTime)> {
+        if !self.lazy {
+            return None;
+        }
+        periodic_expirations(self.next_expire_time?, self.expire_interval?, now)
+    }
+
+    /// Count the periodic expirations of a lazy timer that have occurred by `now`.
+    fn count_expirations(&mut self, now: EmulatedTime) {
+        if let Some((count, next_expire_time)) = self.uncounted_expirations(now) {
+            self.expiration_count += count;
+            self.next_expire_time = Some(next_expire_time);
+        }
+    }
+}
+
+/// The number of expirations of a periodic timer with the given next expiration time and interval
+/// that have occurred by `now`, and the time of the first expiration after them. Returns `None` if
+/// the timer hasn't expired by `now`.
+fn periodic_expirations(
+    next_expire_time: EmulatedTime,
+    interval: SimulationTime,
+    now: EmulatedTime,
+) -> Option<(u64, EmulatedTime)> {
+    let since = now.checked_duration_since(&next_expire_time)?;
+    let count = u64::try_from(since.as_nanos() / interval.as_nanos()).unwrap() + 1;
+    let next_expire_time = next_expire_time + interval.checked_mul(count).unwrap();
+    Some((count, next_expire_time))
 }
 
 impl Timer {
@@ -49,6 +86,19 @@ impl Timer {
     /// of the enclosing Timer.  If it may need to call mutable methods of the
     /// Timer, it should push a new task to the scheduler to do so.
     pub fn new<F: 'static + Fn(&Host) + Send + Sync>(on_expire: F) -> Self {
+        Self::new_internal(on_expire, false)
+    }
+
+    /// Like [`Timer::new`], but while the expiration count is non-zero the timer's periodic
+    /// expirations don't run `on_expire()`, and are counted arithmetically when the count is read
+    /// rather than by an event each. The timer only schedules an event for the next expiration
+    /// once the count has been consumed. This is for timers that only act when their count
+    /// becomes non-zero, such as a timerfd becoming readable.
+    pub fn new_lazy<F: 'static + Fn(&Host) + Send + Sync>(on_expire: F) -> Self {
+        Self::new_internal(on_expire, true)
+    }
+
+    fn new_internal<F: 'static + Fn(&Host) + Send + Sync>(on_expire: F, lazy: bool) -> Self {
         Self {
             magic: Magic::new(),
             _counter: ObjectCounter::new("Timer"),
@@ -58,6 +108,8 @@ impl Timer {
                 expiration_count: 0,
                 next_expire_id: 0,
                 min_valid_expire_id: 0,
+                wheel_timer: None,
+                lazy,
                 on_expire: Box::new(on_expire),
             })),
         }
@@ -67,7 +119,12 @@ impl Timer {
     /// [`Timer::consume_expiration_count()`] was called without resetting the counter.
     pub fn expiration_count(&self) -> u64 {
         self.magic.debug_check();
-        self.internal.borrow().expiration_count
+        let internal = self.internal.borrow();
+        let now = Worker::current_time().unwrap();
+        let uncounted = internal
+            .uncounted_expirations(now)
+            .map_or(0, |(count, _)| count);
+        internal.expiration_count + uncounted
     }
 
     /// Returns the currently configured timer expiration interval if this timer is configured to
@@ -82,8 +139,18 @@ impl Timer {
     pub fn consume_expiration_count(&mut self) -> u64 {
         self.magic.debug_check();
         let mut internal = self.internal.borrow_mut();
+        internal.count_expirations(Worker::current_time().unwrap());
         let e = internal.expiration_count;
         internal.expiration_count = 0;
+
+        // a lazy timer doesn't have a pending expiration event while its count is non-zero
+        if internal.lazy && e > 0 && internal.next_expire_time.is_some() {
+            // if there's no active host, there's nothing to run the expiration anyways
+            let _ = Worker::with_active_host(|host| {
+                Self::schedule_new_expire_event(&mut internal, Arc::downgrade(&self.internal), host)
+            });
+        }
+
         e
     }
 
@@ -91,8 +158,12 @@ impl Timer {
     /// armed, or None otherwise.
     pub fn remaining_time(&self) -> Option<SimulationTime> {
         self.magic.debug_check();
-        let t = self.internal.borrow().next_expire_time?;
+        let internal = self.internal.borrow();
         let now = Worker::current_time().unwrap();
+        let t = match internal.uncounted_expirations(now) {
+            Some((_, next_expire_time)) => next_expire_time,
+            None => internal.next_expire_time?,
+        };
         Some(t.saturating_duration_since(&now))
     }
 
@@ -101,6 +172,10 @@ impl Timer {
         self.magic.debug_check();
         let mut internal = self.internal.borrow_mut();
         internal.reset(None, None);
+        if let Some(id) = internal.wheel_timer.take() {
+            // if there's no active host, the expiration will be ignored when it runs
+            let _ = Worker::with_active_host(|host| host.cancel_timer(id));
+        }
     }
 
     fn timer_expire(
@@ -133,20 +208,26 @@ impl Timer {
         }
 
         // Now we know it's a valid expiration.
-        internal_brw.expiration_count += 1;
-
-        // A timer configured with an interval continues to periodically expire.
-        if let Some(interval) = internal_brw.expire_interval {
-            // The interval must be positive.
-            debug_assert!(interval.is_positive());
-            internal_brw.next_expire_time = Some(next_expire_time + interval);
-            Self::schedule_new_expire_event(&mut internal_brw, internal_weak.clone(), host);
+        if internal_brw.lazy && internal_brw.expire_interval.is_some() {
+            // Count this and any other expirations up to now. We don't schedule the next
+            // expiration until the count is consumed.
+            internal_brw.count_expirations(Worker::current_time().unwrap());
         } else {
-            // Reset next expire time to None, so that `remaining_time`
-            // correctly returns `None`, instead of `Some(0)`. (i.e. `Some(0)`
-            // should mean that the timer is scheduled to fire now, but the
-            // event hasn't executed yet).
-            internal_brw.next_expire_time = None;
+            internal_brw.expiration_count += 1;
+
+            // A timer configured with an interval continues to periodically expire.
+            if let Some(interval) = internal_brw.expire_interval {
+                // The interval must be positive.
+                debug_assert!(interval.is_positive());
+                internal_brw.next_expire_time = Some(next_expire_time + interval);
+                Self::schedule_new_expire_event(&mut internal_brw, internal_weak.clone(), host);
+            } else {
+                // Reset next expire time to None, so that `remaining_time`
+                // correctly returns `None`, instead of `Some(0)`. (i.e. `Some(0)`
+                // should mean that the timer is scheduled to fire now, but the
+                // event hasn't executed yet).
+                internal_brw.next_expire_time = None;
+            }
         }
 
         // Re-borrow as an immutable reference while executing the callback.
@@ -160,6 +241,24 @@ impl Timer {
         internal_ptr: Weak<AtomicRefCell<TimerInternal>>,
         host: &Host,
     ) {
+        let expire_id = internal_ref.next_expire_id;
+        internal_ref.next_expire_id += 1;
+        // any expiration that was scheduled before is superseded by this one (a lazy timer may
+        // schedule its next expiration before its previous one has run)
+        internal_ref.min_valid_expire_id = expire_id;
+        let task = TaskRef::new(move |host| Self::timer_expire(&internal_ptr, host, expire_id));
+
+        if host.has_timer_wheel() {
+            // the wheel runs the task at the exact expiration time, and we remove any previous
+            // expiration so that it doesn't need to run
+            if let Some(id) = internal_ref.wheel_timer.take() {
+                host.cancel_timer(id);
+            }
+            let time = internal_ref.next_expire_time.unwrap();
+            internal_ref.wheel_timer = Some(host.add_timer(task, time));
+            return;
+        }
+
         let now = Worker::current_time().unwrap();
 
         // have the timer expire between (1,2] seconds from now, but on a 1-second edge so that all
@@ -173,9 +272,6 @@ impl Timer {
             internal_ref.next_expire_time.unwrap(),
             EmulatedTime::SIMULATION_START + early_expire_time_since_start,
         );
-        let expire_id = internal_ref.next_expire_id;
-        internal_ref.next_expire_id += 1;
-        let task = TaskRef::new(move |host| Self::timer_expire(&internal_ptr, host, expire_id));
         host.schedule_task_at_emulated_time(task, time);
     }
 
@@ -208,6 +304,22 @@ impl Timer {
     }
 }
 
+impl Drop for Timer {
+    fn drop(&mut self) {
+        // The timer may be dropped from its own `on_expire()` callback, in which case its pending
+        // expiration (if any) will be a no-op since it can't upgrade its weak reference.
+        let Ok(mut internal) = self.internal.try_borrow_mut() else {
+            return;
+        };
+
+        if let Some(id) = internal.wheel_timer.take() {
+            // there may not be an active host if the host is being dropped, in which case the
+            // timer wheel is already empty
+            let _ = Worker::with_active_host(|host| host.cancel_timer(id));
+        }
+    }
+}
+
 pub mod export {
     use shadow_shim_helper_rs::emulated_time::CEmulatedTime;
     use shadow_shim_helper_rs::simulation_time::CSimulationTime;
@@ -267,3 +379,44 @@ pub mod export {
         timer.disarm()
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_periodic_expirations() {
+        let start = EmulatedTime::SIMULATION_START + SimulationTime::SECOND;
+        let interval = SimulationTime::from_millis(10);
+
+        assert_eq!(
+            periodic_expirations(start, interval, start - SimulationTime::NANOSECOND),
+            None
+        );
+        assert_eq!(
+            periodic_expirations(start, interval, start),
+            Some((1, start + interval))
+        );
+        assert_eq!(
+            periodic_expirations(
+                start,
+                interval,
+                start + interval - SimulationTime::NANOSECOND
+            ),
+            Some((1, start + interval))
+        );
+        assert_eq!(
+            periodic_expirations(start, interval, start + interval),
+            Some((2, start + interval * 2))
+        );
+        // a 1 ms timer left running for an hour
+        assert_eq!(
+            periodic_expirations(
+                start,
+                SimulationTime::MILLISECOND,
+                start + SimulationTime::from_secs(3600)
+            ),
+            Some((3_600_001, start + SimulationTime::from_millis(3_600_001)))
+        );
+    }
+}
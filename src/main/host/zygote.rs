@@ -0,0 +1,253 @@
+//! Zygote processes, which let managed processes that are started from the same binary, arguments,
+//! and environment skip `execve` and dynamic linking. See [`shadow_shim_helper_rs::zygote`] for
+//! the protocol.
+//!
+//! A zygote is started the first time a process is spawned with a given binary, arguments, and
+//! environment, and lives until the end of the simulation. If a zygote can't be started or stops
+//! responding, processes are spawned with `posix_spawn` instead.
+
+use std::collections::HashMap;
+use std::ffi::{CStr, CString};
+use std::os::fd::{AsFd, AsRawFd, OwnedFd};
+use std::sync::{Arc, Mutex};
+
+use linux_api::errno::Errno;
+use linux_api::posix_types::Pid;
+use log::{debug, warn};
+use nix::sys::socket::{AddressFamily, SockFlag, SockType, socketpair};
+use rustix::process::WaitOptions;
+use shadow_shim_helper_rs::ipc::IPCData;
+use shadow_shim_helper_rs::zygote::{ZYGOTE_MAX_FDS, ZygoteSpawnReply, ZygoteSpawnRequest};
+use shadow_shmem::allocator::ShMemBlock;
+
+use crate::host::managed_thread::ManagedThread;
+
+/// The binary, arguments, and environment that a zygote was started with. Only processes with
+/// the same key can be spawned from it, since the arguments and environment are set up by
+/// `execve`.
+#[derive(Debug, PartialEq, Eq, Hash)]
+struct ZygoteKey {
+    plugin_path: CString,
+    argv: Vec<CString>,
+    envv: Vec<CString>,
+}
+
+enum ZygoteState {
+    Unstarted,
+    Running(Zygote),
+    /// The zygote couldn't be started or stopped responding, and won't be retried.
+    Failed,
+}
+
+struct Zygote {
+    pid: Pid,
+    socket: OwnedFd,
+}
+
+impl Zygote {
+    fn start(
+        plugin_path: &CStr,
+        argv: &[CString],
+        envv: &[CString],
+        log_file: &std::fs::File,
+    ) -> Result<Self, Errno> {
+        let (socket, zygote_socket) = socketpair(
+            AddressFamily::Unix,
+            SockType::SeqPacket,
+            None,
+            SockFlag::SOCK_CLOEXEC,
+        )
+        .map_err(|e| Errno::from_libc_errnum(e as i32).unwrap())?;
+
+        // The zygote doesn't normally write anything, but if it panics the message goes to the log
+        // of the process that it was started for.
+        let pid = ManagedThread::posix_spawn(
+            plugin_path,
+            argv.to_vec(),
+            envv.to_vec(),
+            None,
+            log_file,
+            zygote_socket.as_fd(),
+        )?;
+
+        Ok(Self { pid, socket })
+    }
+
+    fn spawn(
+        &self,
+        ipc_shmem: &ShMemBlock<IPCData>,
+        strace_file: Option<&std::fs::File>,
+        log_file: &std::fs::File,
+    ) -> Result<Pid, Errno> {
+        let req = ZygoteSpawnRequest {
+            ipc_block: ipc_shmem.serialize(),
+            strace_fd: strace_file.map(|f| f.as_raw_fd()).unwrap_or(-1),
+        };
+        let mut fds = vec![log_file.as_raw_fd()];
+        fds.extend(strace_file.map(|f| f.as_raw_fd()));
+        assert!(fds.len() <= ZYGOTE_MAX_FDS);
+
+        // As in `ManagedThread::spawn_native`, we send the request from a raw pointer since we
+        // can't guarantee that all bytes of the serialized shmem block are initialized.
+        let mut iov = libc::iovec {
+            iov_base: std::ptr::from_ref(&req).cast_mut().cast(),
+            iov_len: size_of::<ZygoteSpawnRequest>(),
+        };
+        let fds_len = std::mem::size_of_val(fds.as_slice());
+        let cmsg_space = unsafe { libc::CMSG_SPACE(fds_len as u32) } as usize;
+        // u64 for the alignment of `cmsghdr`
+        let mut cmsg_buf = vec![0u64; cmsg_space.div_ceil(size_of::<u64>())];
+        let mut msg: libc::msghdr = shadow_pod::zeroed();
+        msg.msg_iov = &mut iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cmsg_buf.as_mut_ptr().cast();
+        msg.msg_controllen = cmsg_space;
+        unsafe {
+            let cmsg = libc::CMSG_FIRSTHDR(&msg);
+            (*cmsg).cmsg_level = libc::SOL_SOCKET;
+            (*cmsg).cmsg_type = libc::SCM_RIGHTS;
+            (*cmsg).cmsg_len = libc::CMSG_LEN(fds_len as u32) as usize;
+            std::ptr::copy_nonoverlapping(fds.as_ptr().cast(), libc::CMSG_DATA(cmsg), fds_len);
+        }
+
+        let sent = Errno::result_from_libc_errno(-1, unsafe {
+            libc::sendmsg(self.socket.as_raw_fd(), &msg, libc::MSG_NOSIGNAL)
+        })?;
+        assert_eq!(
+            sent,
+            isize::try_from(size_of::<ZygoteSpawnRequest>()).unwrap()
+        );
+
+        let mut reply = ZygoteSpawnReply { pid: 0 };
+        let received = Errno::result_from_libc_errno(-1, unsafe {
+            libc::recv(
+                self.socket.as_raw_fd(),
+                std::ptr::from_mut(&mut reply).cast(),
+                size_of::<ZygoteSpawnReply>(),
+                0,
+            )
+        })?;
+        if received != isize::try_from(size_of::<ZygoteSpawnReply>()).unwrap() {
+            // The zygote exited.
+            return Err(Errno::EPIPE);
+        }
+
+        Pid::from_raw(reply.pid).ok_or_else(|| {
+            // The zygote couldn't fork.
+            Errno::from_u16((-reply.pid).try_into().unwrap()).unwrap_or(Errno::EAGAIN)
+        })
+    }
+
+    /// Close the zygote's socket, which tells it to exit, and reap it.
+    fn stop(self) {
+        let Self { pid, socket } = self;
+        drop(socket);
+        if let Err(e) = rustix::process::waitpid(Some(pid.into()), WaitOptions::empty()) {
+            warn!("Couldn't wait for zygote {pid:?}: {e:?}");
+        }
+    }
+}
+
+pub struct ZygotePool {
+    zygotes: Mutex<HashMap<ZygoteKey, Arc<Mutex<ZygoteState>>>>,
+}
+
+impl ZygotePool {
+    /// Make the current process (Shadow) a child subreaper, which processes spawned from a
+    /// zygote rely on to have Shadow as their parent.
+    pub fn new() -> Self {
+        Errno::result_from_libc_errno(-1, unsafe {
+            libc::prctl(libc::PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0)
+        })
+        .expect("Couldn't make shadow a child subreaper");
+
+        Self {
+            zygotes: Mutex::new(HashMap::new()),
+        }
+    }
+
+    /// Spawn a process from the zygote for `plugin_path`, `argv`, and `envv`, starting the zygote
+    /// if there isn't one yet. Returns `None` if the process should be spawned normally instead.
+    pub fn spawn(
+        &self,
+        plugin_path: &CStr,
+        argv: &[CString],
+        envv: &[CString],
+        strace_file: Option<&std::fs::File>,
+        log_file: &std::fs::File,
+        ipc_shmem: &ShMemBlock<IPCData>,
+    ) -> Option<Pid> {
+        let key = ZygoteKey {
+            plugin_path: plugin_path.to_owned(),
+            argv: argv.to_vec(),
+            envv: envv.to_vec(),
+        };
+
+        // Only hold the pool's lock while looking up the zygote, so that processes can be spawned
+        // from different zygotes in parallel.
+        let state = {
+            let mut zygotes = self.zygotes.lock().unwrap();
+            if let Some(state) = zygotes.get(&key) {
+                Arc::clone(state)
+            } else {
+                let state = Arc::new(Mutex::new(ZygoteState::Unstarted));
+                zygotes.insert(key, Arc::clone(&state));
+                state
+            }
+        };
+        let mut state = state.lock().unwrap();
+
+        if matches!(*state, ZygoteState::Unstarted) {
+            *state = match Zygote::start(plugin_path, argv, envv, log_file) {
+                Ok(zygote) => {
+                    debug!("Started zygote {:?} for {plugin_path:?}", zygote.pid);
+                    ZygoteState::Running(zygote)
+                }
+                Err(e) => {
+                    warn!("Couldn't start a zygote for {plugin_path:?}: {e}");
+                    ZygoteState::Failed
+                }
+            };
+        }
+
+        let ZygoteState::Running(zygote) = &*state else {
+            return None;
+        };
+
+        match zygote.spawn(ipc_shmem, strace_file, log_file) {
+            Ok(pid) => {
+                debug!("Spawned process {pid:?} from zygote {:?}", zygote.pid);
+                Some(pid)
+            }
+            Err(Errno::EPIPE) | Err(Errno::ECONNRESET) => {
+                warn!(
+                    "Zygote {:?} for {plugin_path:?} exited; spawning processes normally",
+                    zygote.pid
+                );
+                let ZygoteState::Running(zygote) =
+                    std::mem::replace(&mut *state, ZygoteState::Failed)
+                else {
+                    unreachable!();
+                };
+                zygote.stop();
+                None
+            }
+            Err(e) => {
+                warn!("Couldn't spawn a process from zygote {:?}: {e}", zygote.pid);
+                None
+            }
+        }
+    }
+}
+
+impl Drop for ZygotePool {
+    fn drop(&mut self) {
+        let zygotes = std::mem::take(self.zygotes.get_mut().unwrap());
+        for state in zygotes.into_values() {
+            let state = Arc::into_inner(state).unwrap().into_inner().unwrap();
+            if let ZygoteState::Running(zygote) = state {
+                zygote.stop();
+            }
+        }
+    }
+}
@@ -4,7 +4,7 @@ use std::fmt::Display;
 use std::fs::File;
 use std::io::Write;
 use std::net::Ipv4Addr;
-use std::os::fd::AsRawFd;
+use std::os::fd::{AsRawFd, RawFd};
 use std::path::PathBuf;
 use std::sync::Arc;
 
@@ -12,6 +12,7 @@ use std::sync::Arc;
 #[cfg(not(miri))]
 use rustix::fs::MemfdFlags;
 use shadow_shim_helper_rs::HostId;
+use shadow_shim_helper_rs::dns_index;
 
 #[derive(Debug)]
 struct Database {
@@ -149,9 +150,23 @@ impl DnsBuilder {
             writeln!(file, "{} {}", record.addr, record.name)?;
         }
 
+        #[cfg(miri)]
+        let mut index_file = tempfile::tempfile()?;
+        #[cfg(not(miri))]
+        let mut index_file = {
+            let name = format!("shadow_dns_index_{}", std::process::id());
+            File::from(rustix::fs::memfd_create(name, MemfdFlags::CLOEXEC)?)
+        };
+        index_file.write_all(&dns_index::build(
+            records
+                .iter()
+                .map(|record| (record.name.as_bytes(), u32::from(record.addr).to_be())),
+        ))?;
+
         Ok(Dns {
             db: self.db,
             hosts_file: file,
+            index_file,
         })
     }
 }
@@ -168,6 +183,9 @@ pub struct Dns {
     // Keep this handle while Dns is valid to prevent closing the file
     // containing the hosts database in /etc/hosts format.
     hosts_file: File,
+    // The same database as a hash table that the shim can map; see
+    // [`shadow_shim_helper_rs::dns_index`].
+    index_file: File,
 }
 
 impl Dns {
@@ -190,6 +208,11 @@ impl Dns {
     pub fn hosts_path(&self) -> PathBuf {
         PathBuf::from(format!("/proc/self/fd/{}", self.hosts_file.as_raw_fd()))
     }
+
+    /// The descriptor of the file containing the database as a hash table.
+    pub fn index_fd(&self) -> RawFd {
+        self.index_file.as_raw_fd()
+    }
 }
 
 #[cfg(test)]
@@ -298,4 +321,25 @@ mod tests {
         let unexpected = "127.0.0.1 localhost\n200.3.2.1 theirhost\n100.1.2.3 myhost\n";
         assert_ne!(contents.as_str(), unexpected);
     }
+
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn index_file() {
+        let (id_a, addr_a, name_a) = host_a();
+        let (id_b, addr_b, name_b) = host_b();
+
+        let mut builder = DnsBuilder::new();
+        builder.register(id_a, addr_a, name_a.clone()).unwrap();
+        builder.register(id_b, addr_b, name_b.clone()).unwrap();
+        let dns = builder.into_dns().unwrap();
+
+        let index = std::fs::read(format!("/proc/self/fd/{}", dns.index_fd())).unwrap();
+        let lookup = |name: &str| {
+            dns_index::lookup(&index, name.as_bytes()).map(|x| Ipv4Addr::from(u32::from_be(x)))
+        };
+        assert_eq!(lookup(&name_a), Some(addr_a));
+        assert_eq!(lookup(&name_b), Some(addr_b));
+        assert_eq!(lookup("empty"), None);
+        assert_eq!(lookup("localhost"), None);
+    }
 }
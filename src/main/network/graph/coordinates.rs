@@ -0,0 +1,297 @@
+//! A network model where each node has coordinates, and the path between two nodes is computed
+//! from them when needed, rather than storing the path between every pair of nodes.
+//!
+//! Each node has a position in a Euclidean space whose distances are latencies in milliseconds
+//! (for example [Vivaldi] network coordinates, or geographic positions scaled by the speed of light
+//! in fiber), and a height, which is the latency of its access link. The latency of the path
+//! between two nodes is the distance between their positions plus both of their heights, and a
+//! packet on the path is dropped with the chance that either node's access link drops it. This
+//! needs memory linear in the number of nodes.
+//!
+//! The coordinates are given as text, with one node per line as comma-separated columns:
+//!
+//! ```text
+//! # id, bandwidth down, bandwidth up, packet loss, height (ms), coordinates (ms)...
+//! 0, 100 Mbit, 100 Mbit, 0.0, 2.5, 10.0, -4.5
+//! 1, 1 Gbit, 1 Gbit, 0.001, 0.5, -20.25, 3.0
+//! ```
+//!
+//! Every node must have the same number of coordinates. A bandwidth column can be left empty if
+//! the node's hosts set their bandwidths. Empty lines and lines beginning with `#` are ignored.
+//!
+//! [Vivaldi]: https://doi.org/10.1145/1030194.1015471
+
+use std::collections::HashMap;
+
+use anyhow::Context;
+
+use crate::network::graph::PathProperties;
+use crate::utility::units::{self, Unit};
+
+/// The number of columns before the coordinates.
+const NUM_NODE_COLUMNS: usize = 5;
+
+/// The positions and access links of network nodes. The fields hold the value of each node by
+/// index, so that computing many paths reads contiguous memory.
+#[derive(Debug, Clone)]
+pub struct NetworkCoordinates {
+    /// The number of coordinates of each node.
+    dims: usize,
+    ids: Vec<u32>,
+    node_indices: HashMap<u32, usize>,
+    /// The `dims` coordinates of the node at index `i` are at `i * dims`.
+    coordinates: Vec<f64>,
+    heights_ms: Vec<f64>,
+    packet_loss: Vec<f32>,
+    bandwidth_down_bits: Vec<Option<u64>>,
+    bandwidth_up_bits: Vec<Option<u64>>,
+}
+
+impl NetworkCoordinates {
+    pub fn parse(text: &str) -> anyhow::Result<Self> {
+        let mut rv = Self {
+            dims: 0,
+            ids: Vec::new(),
+            node_indices: HashMap::new(),
+            coordinates: Vec::new(),
+            heights_ms: Vec::new(),
+            packet_loss: Vec::new(),
+            bandwidth_down_bits: Vec::new(),
+            bandwidth_up_bits: Vec::new(),
+        };
+
+        for (line_num, line) in text.lines().enumerate() {
+            let line = line.trim();
+            if line.is_empty() || line.starts_with('#') {
+                continue;
+            }
+            rv.parse_node(line)
+                .with_context(|| format!("Invalid node on line {}", line_num + 1))?;
+        }
+
+        if rv.ids.is_empty() {
+            anyhow::bail!("The network coordinates don't have any nodes");
+        }
+
+        Ok(rv)
+    }
+
+    fn parse_node(&mut self, line: &str) -> anyhow::Result<()> {
+        let columns: Vec<&str> = line.split(',').map(str::trim).collect();
+        if columns.len() <= NUM_NODE_COLUMNS {
+            anyhow::bail!("Expected an id, bandwidths, packet loss, height, and coordinates");
+        }
+
+        let dims = columns.len() - NUM_NODE_COLUMNS;
+        if self.ids.is_empty() {
+            self.dims = dims;
+        } else if dims != self.dims {
+            anyhow::bail!(
+                "The node has {dims} coordinates, but the first node has {}",
+                self.dims
+            );
+        }
+
+        let id: u32 = columns[0].parse().context("The id is not an integer")?;
+        let bandwidth = |x: &str| -> anyhow::Result<Option<u64>> {
+            if x.is_empty() {
+                return Ok(None);
+            }
+            let bw: units::BitsPerSec<units::SiPrefixUpper> = x
+                .parse()
+                .map_err(|e| anyhow::anyhow!("The bandwidth '{x}' is not a valid unit: {e}"))?;
+            Ok(Some(
+                bw.convert(units::SiPrefixUpper::Base).unwrap().value(),
+            ))
+        };
+        let bandwidth_down = bandwidth(columns[1])?;
+        let bandwidth_up = bandwidth(columns[2])?;
+        let packet_loss: f32 = columns[3]
+            .parse()
+            .context("The packet loss is not a float")?;
+        let height_ms: f64 = columns[4].parse().context("The height is not a float")?;
+
+        if !(0f32..=1f32).contains(&packet_loss) {
+            anyhow::bail!("The packet loss is not in the range [0,1]");
+        }
+        // every path, including from a node to itself, must have a non-zero latency
+        if !(height_ms.is_finite() && height_ms > 0.0) {
+            anyhow::bail!("The height must be greater than 0");
+        }
+
+        for x in &columns[NUM_NODE_COLUMNS..] {
+            let x: f64 = x.parse().context("A coordinate is not a float")?;
+            if !x.is_finite() {
+                anyhow::bail!("A coordinate is not finite");
+            }
+            self.coordinates.push(x);
+        }
+
+        if self.node_indices.insert(id, self.ids.len()).is_some() {
+            anyhow::bail!("There is more than one node with id {id}");
+        }
+        self.ids.push(id);
+        self.heights_ms.push(height_ms);
+        self.packet_loss.push(packet_loss);
+        self.bandwidth_down_bits.push(bandwidth_down);
+        self.bandwidth_up_bits.push(bandwidth_up);
+
+        Ok(())
+    }
+
+    pub fn num_nodes(&self) -> usize {
+        self.ids.len()
+    }
+
+    /// The index of the node with id `id`.
+    pub fn node_index(&self, id: u32) -> Option<usize> {
+        self.node_indices.get(&id).copied()
+    }
+
+    /// The downstream bandwidth of the node at `index`, if it has one.
+    pub fn bandwidth_down_bits(&self, index: usize) -> Option<u64> {
+        self.bandwidth_down_bits[index]
+    }
+
+    /// The upstream bandwidth of the node at `index`, if it has one.
+    pub fn bandwidth_up_bits(&self, index: usize) -> Option<u64> {
+        self.bandwidth_up_bits[index]
+    }
+
+    /// Only keep the nodes at `indices`, so that the node at `indices[i]` is now at index `i`.
+    pub fn select(&self, indices: &[usize]) -> Self {
+        let pick = |i: &usize| &self.coordinates[i * self.dims..][..self.dims];
+        let ids: Vec<u32> = indices.iter().map(|i| self.ids[*i]).collect();
+
+        Self {
+            dims: self.dims,
+            node_indices: ids.iter().enumerate().map(|(i, id)| (*id, i)).collect(),
+            ids,
+            coordinates: indices.iter().flat_map(pick).copied().collect(),
+            heights_ms: indices.iter().map(|i| self.heights_ms[*i]).collect(),
+            packet_loss: indices.iter().map(|i| self.packet_loss[*i]).collect(),
+            bandwidth_down_bits: indices
+                .iter()
+                .map(|i| self.bandwidth_down_bits[*i])
+                .collect(),
+            bandwidth_up_bits: indices.iter().map(|i| self.bandwidth_up_bits[*i]).collect(),
+        }
+    }
+
+    /// The path from the node at index `src` to the node at index `dst`. Will panic if an index is
+    /// out of bounds.
+    pub fn path(&self, src: usize, dst: usize) -> PathProperties {
+        let src_coordinates = &self.coordinates[src * self.dims..][..self.dims];
+        let dst_coordinates = &self.coordinates[dst * self.dims..][..self.dims];
+
+        let distance_ms = src_coordinates
+            .iter()
+            .zip(dst_coordinates)
+            .map(|(a, b)| (a - b) * (a - b))
+            .sum::<f64>()
+            .sqrt();
+        let latency_ms = distance_ms + self.heights_ms[src] + self.heights_ms[dst];
+
+        PathProperties {
+            // the heights are positive, but may round down to 0 ns
+            latency_ns: std::cmp::max((latency_ms * 1_000_000.0).round() as u64, 1),
+            packet_loss: 1f32 - (1f32 - self.packet_loss[src]) * (1f32 - self.packet_loss[dst]),
+        }
+    }
+
+    /// A lower bound on the latency of any path, which is the latency from the node with the
+    /// smallest height to itself.
+    pub fn smallest_latency_ns(&self) -> Option<u64> {
+        let index = (0..self.num_nodes())
+            .min_by(|a, b| self.heights_ms[*a].total_cmp(&self.heights_ms[*b]))?;
+        Some(self.path(index, index).latency_ns)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::network::graph::RoutingInfo;
+
+    const COORDINATES: &str = "
+        # id, bandwidth down, bandwidth up, packet loss, height (ms), coordinates (ms)...
+        7, 100 Mbit, 10 Mbit, 0.0, 1.0, 0.0, 0.0
+        3, , , 0.5, 2.0, 3.0, 4.0
+
+        5, 1 Gbit, 1 Gbit, 0.5, 0.5, -3.0, 0.0
+    ";
+
+    #[test]
+    fn test_parse() {
+        let coords = NetworkCoordinates::parse(COORDINATES).unwrap();
+        assert_eq!(coords.num_nodes(), 3);
+        assert_eq!(coords.node_index(7), Some(0));
+        assert_eq!(coords.node_index(3), Some(1));
+        assert_eq!(coords.node_index(5), Some(2));
+        assert_eq!(coords.node_index(0), None);
+
+        assert_eq!(coords.bandwidth_down_bits(0), Some(100_000_000));
+        assert_eq!(coords.bandwidth_up_bits(0), Some(10_000_000));
+        assert_eq!(coords.bandwidth_down_bits(1), None);
+        assert_eq!(coords.bandwidth_up_bits(1), None);
+    }
+
+    #[test]
+    fn test_paths() {
+        let coords = NetworkCoordinates::parse(COORDINATES).unwrap();
+
+        // distance of 5 ms plus the heights
+        let path = coords.path(0, 1);
+        assert_eq!(path.latency_ns, 8_000_000);
+        assert_eq!(path.packet_loss, 0.5);
+        assert_eq!(coords.path(1, 0).latency_ns, 8_000_000);
+
+        let path = coords.path(1, 2);
+        let expected_ns = ((2.5 + 52f64.sqrt()) * 1e6).round() as u64;
+        assert!(path.latency_ns.abs_diff(expected_ns) <= 1);
+        assert_eq!(path.packet_loss, 0.75);
+
+        assert_eq!(coords.path(2, 2).latency_ns, 1_000_000);
+        assert_eq!(coords.smallest_latency_ns(), Some(1_000_000));
+    }
+
+    #[test]
+    fn test_select() {
+        let coords = NetworkCoordinates::parse(COORDINATES).unwrap();
+        let selected = coords.select(&[2, 0]);
+        assert_eq!(selected.num_nodes(), 2);
+        assert_eq!(selected.node_index(5), Some(0));
+        assert_eq!(selected.node_index(7), Some(1));
+        assert_eq!(selected.node_index(3), None);
+        assert_eq!(selected.path(0, 1), coords.path(2, 0));
+        assert_eq!(selected.bandwidth_up_bits(1), Some(10_000_000));
+    }
+
+    #[test]
+    fn test_routing_info() {
+        let coords = NetworkCoordinates::parse(COORDINATES).unwrap();
+        let routing_info = RoutingInfo::new_coordinates(&coords, [(3, 1), (7, 0)]);
+        assert_eq!(routing_info.path(7, 3).unwrap().latency_ns, 8_000_000);
+        assert_eq!(routing_info.path(3, 3).unwrap().latency_ns, 4_000_000);
+        assert!(routing_info.path(7, 5).is_none());
+        assert_eq!(routing_info.get_smallest_latency_ns(), Some(2_000_000));
+        assert!(routing_info.matrix().is_none());
+    }
+
+    #[test]
+    fn test_invalid() {
+        for text in [
+            "",
+            "0, 1 Gbit, 1 Gbit, 0.0, 1.0",
+            "0, 1 Gbit, 1 Gbit, 0.0, 1.0, 1.0\n1, 1 Gbit, 1 Gbit, 0.0, 1.0, 1.0, 2.0",
+            "0, 1 Gbit, 1 Gbit, 0.0, 1.0, 1.0\n0, 1 Gbit, 1 Gbit, 0.0, 1.0, 2.0",
+            "0, 1 Gbit, 1 Gbit, 1.5, 1.0, 1.0",
+            "0, 1 Gbit, 1 Gbit, 0.0, 0.0, 1.0",
+            "0, 1 Gbit, 1 Gbit, 0.0, 1.0, inf",
+            "0, 1 Gbyte, 1 Gbit, 0.0, 1.0, 1.0",
+            "x, 1 Gbit, 1 Gbit, 0.0, 1.0, 1.0",
+        ] {
+            assert!(NetworkCoordinates::parse(text).is_err(), "{text:?}");
+        }
+    }
+}
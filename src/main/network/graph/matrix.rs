@@ -0,0 +1,385 @@
+//! A network topology given as a binary matrix of the paths between every pair of nodes, as an
+//! alternative to a GML graph.
+//!
+//! A GML graph with an edge between every pair of nodes is slow to parse and large to hold in
+//! memory, while the matrix file is mapped into memory as is, and a path is only read from it when
+//! a packet is sent along it. All values are little-endian, and the file is laid out as:
+//!
+//! | Bytes                 | Contents                                                        |
+//! |-----------------------|-----------------------------------------------------------------|
+//! | 8                     | the magic bytes `SHDWMX01`                                      |
+//! | 8                     | the number of nodes `n` as a `u64`                              |
+//! | `4n`, padded to `8k`  | the node ids as `u32`s, padded with zeros to a multiple of 8    |
+//! | `8n`                  | each node's downstream bandwidth in bits per second as a `u64`  |
+//! | `8n`                  | each node's upstream bandwidth in bits per second as a `u64`    |
+//! | `8n²`                 | the latency in nanoseconds of each path as a `u64`              |
+//! | `4n²`                 | the packet loss of each path as an `f32`                        |
+//!
+//! A bandwidth of 0 means that the node doesn't have a bandwidth. The paths are in row-major
+//! order, so that the path from the `i`th node to the `j`th node is at index `i * n + j`.
+
+use std::collections::HashMap;
+use std::os::fd::AsFd;
+use std::path::Path;
+
+use anyhow::Context;
+
+use crate::network::graph::PathProperties;
+
+const MAGIC: &[u8; 8] = b"SHDWMX01";
+
+/// A latency matrix file mapped into memory.
+pub struct LatencyMatrix {
+    map: MappedFile,
+    num_nodes: usize,
+    /// The index of each node id in the matrix.
+    node_indices: HashMap<u32, usize>,
+    bandwidth_down_offset: usize,
+    bandwidth_up_offset: usize,
+    latency_offset: usize,
+    packet_loss_offset: usize,
+}
+
+impl LatencyMatrix {
+    /// Map the matrix file at `path` into memory. The file must not be changed while the matrix
+    /// is in use.
+    pub fn open(path: &Path) -> anyhow::Result<Self> {
+        let file = std::fs::File::open(path).with_context(|| format!("Failed to open {path:?}"))?;
+        let len = file.metadata()?.len();
+        let len = usize::try_from(len).context("The latency matrix file is too large")?;
+
+        if len < 16 {
+            anyhow::bail!("The latency matrix file is too short");
+        }
+
+        let map = MappedFile::new(file.as_fd(), len)
+            .with_context(|| format!("Failed to map {path:?} into memory"))?;
+        let bytes = map.bytes();
+
+        if &bytes[..8] != MAGIC {
+            anyhow::bail!(
+                "The file is not a latency matrix (no '{}' header)",
+                MAGIC.escape_ascii()
+            );
+        }
+
+        let num_nodes = usize::try_from(u64::from_le_bytes(bytes[8..16].try_into().unwrap()))
+            .context("The latency matrix has too many nodes")?;
+
+        // the byte offset of each section, and the expected size of the file
+        let sections = || -> Option<[usize; 5]> {
+            let nodes_offset = 16usize;
+            let bandwidth_down_offset =
+                nodes_offset.checked_add(num_nodes.checked_mul(4)?.checked_next_multiple_of(8)?)?;
+            let bandwidth_up_offset =
+                bandwidth_down_offset.checked_add(num_nodes.checked_mul(8)?)?;
+            let latency_offset = bandwidth_up_offset.checked_add(num_nodes.checked_mul(8)?)?;
+            let num_paths = num_nodes.checked_mul(num_nodes)?;
+            let packet_loss_offset = latency_offset.checked_add(num_paths.checked_mul(8)?)?;
+            let end = packet_loss_offset.checked_add(num_paths.checked_mul(4)?)?;
+            Some([
+                bandwidth_down_offset,
+                bandwidth_up_offset,
+                latency_offset,
+                packet_loss_offset,
+                end,
+            ])
+        };
+        let Some(
+            [
+                bandwidth_down_offset,
+                bandwidth_up_offset,
+                latency_offset,
+                packet_loss_offset,
+                end,
+            ],
+        ) = sections()
+        else {
+            anyhow::bail!("The latency matrix has too many nodes");
+        };
+
+        if len != end {
+            anyhow::bail!(
+                "The latency matrix file has {len} bytes, but a matrix of {num_nodes} nodes has \
+                 {end} bytes"
+            );
+        }
+
+        let mut node_indices = HashMap::with_capacity(num_nodes);
+        for (index, id) in bytes[16..16 + num_nodes * 4].chunks_exact(4).enumerate() {
+            let id = u32::from_le_bytes(id.try_into().unwrap());
+            if node_indices.insert(id, index).is_some() {
+                anyhow::bail!("The latency matrix has more than one node with id {id}");
+            }
+        }
+
+        Ok(Self {
+            map,
+            num_nodes,
+            node_indices,
+            bandwidth_down_offset,
+            bandwidth_up_offset,
+            latency_offset,
+            packet_loss_offset,
+        })
+    }
+
+    pub fn num_nodes(&self) -> usize {
+        self.num_nodes
+    }
+
+    /// The index in the matrix of the node with id `id`.
+    pub fn node_index(&self, id: u32) -> Option<usize> {
+        self.node_indices.get(&id).copied()
+    }
+
+    /// The downstream bandwidth of the node at `index`, if it has one.
+    pub fn bandwidth_down_bits(&self, index: usize) -> Option<u64> {
+        assert!(index < self.num_nodes);
+        Some(self.read_u64(self.bandwidth_down_offset + index * 8)).filter(|x| *x != 0)
+    }
+
+    /// The upstream bandwidth of the node at `index`, if it has one.
+    pub fn bandwidth_up_bits(&self, index: usize) -> Option<u64> {
+        assert!(index < self.num_nodes);
+        Some(self.read_u64(self.bandwidth_up_offset + index * 8)).filter(|x| *x != 0)
+    }
+
+    /// The path from the node at index `src` to the node at index `dst`. Will panic if an index is
+    /// out of bounds.
+    pub fn path(&self, src: usize, dst: usize) -> PathProperties {
+        assert!(src < self.num_nodes && dst < self.num_nodes);
+        let i = src * self.num_nodes + dst;
+        PathProperties {
+            latency_ns: self.read_u64(self.latency_offset + i * 8),
+            packet_loss: f32::from_le_bytes(
+                self.map.bytes()[self.packet_loss_offset + i * 4..][..4]
+                    .try_into()
+                    .unwrap(),
+            ),
+        }
+    }
+
+    /// Check the paths between every pair of the nodes at `indices`, which are the only paths that
+    /// are read during the simulation. The rest of the file is never read, so doesn't need to be in
+    /// memory.
+    pub fn check_paths(&self, indices: &[usize]) -> anyhow::Result<()> {
+        let id = |index| {
+            self.node_indices
+                .iter()
+                .find(|(_, x)| **x == index)
+                .map(|(id, _)| *id)
+                .unwrap()
+        };
+
+        for src in indices {
+            for dst in indices {
+                let path = self.path(*src, *dst);
+                if path.latency_ns == 0 {
+                    anyhow::bail!(
+                        "The latency of the path from node {} to {} must not be 0",
+                        id(*src),
+                        id(*dst)
+                    );
+                }
+                if !(0f32..=1f32).contains(&path.packet_loss) {
+                    anyhow::bail!(
+                        "The packet loss of the path from node {} to {} is not in the range [0,1]",
+                        id(*src),
+                        id(*dst)
+                    );
+                }
+            }
+        }
+
+        Ok(())
+    }
+
+    fn read_u64(&self, offset: usize) -> u64 {
+        u64::from_le_bytes(self.map.bytes()[offset..][..8].try_into().unwrap())
+    }
+}
+
+impl std::fmt::Debug for LatencyMatrix {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("LatencyMatrix")
+            .field("num_nodes", &self.num_nodes)
+            .finish_non_exhaustive()
+    }
+}
+
+/// A read-only private mapping of a whole file.
+struct MappedFile {
+    ptr: *mut std::ffi::c_void,
+    len: usize,
+}
+
+// SAFETY: The mapping is read-only and owned by this object.
+unsafe impl Send for MappedFile {}
+unsafe impl Sync for MappedFile {}
+
+impl MappedFile {
+    fn new(fd: impl AsFd, len: usize) -> rustix::io::Result<Self> {
+        use rustix::mm::{MapFlags, ProtFlags};
+        let ptr = unsafe {
+            rustix::mm::mmap(
+                std::ptr::null_mut(),
+                len,
+                ProtFlags::READ,
+                MapFlags::PRIVATE,
+                fd,
+                0,
+            )
+        }?;
+        Ok(Self { ptr, len })
+    }
+
+    fn bytes(&self) -> &[u8] {
+        // SAFETY: The mapping is valid until dropped, and we never write to it.
+        unsafe { std::slice::from_raw_parts(self.ptr.cast_const().cast(), self.len) }
+    }
+}
+
+impl Drop for MappedFile {
+    fn drop(&mut self) {
+        if let Err(e) = unsafe { rustix::mm::munmap(self.ptr, self.len) } {
+            log::warn!("Failed to unmap the latency matrix: {e}");
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::io::Write;
+
+    use super::*;
+    use crate::network::graph::RoutingInfo;
+
+    /// Write a matrix file with the given nodes as `(id, bandwidth_down, bandwidth_up)`, and the
+    /// paths in row-major order.
+    fn write_matrix(nodes: &[(u32, u64, u64)], paths: &[(u64, f32)]) -> tempfile::NamedTempFile {
+        let mut bytes = MAGIC.to_vec();
+        bytes.extend((nodes.len() as u64).to_le_bytes());
+        for (id, _, _) in nodes {
+            bytes.extend(id.to_le_bytes());
+        }
+        bytes.resize(bytes.len().next_multiple_of(8), 0);
+        for (_, down, _) in nodes {
+            bytes.extend(down.to_le_bytes());
+        }
+        for (_, _, up) in nodes {
+            bytes.extend(up.to_le_bytes());
+        }
+        for (latency, _) in paths {
+            bytes.extend(latency.to_le_bytes());
+        }
+        for (_, loss) in paths {
+            bytes.extend(loss.to_le_bytes());
+        }
+
+        let mut file = tempfile::NamedTempFile::new().unwrap();
+        file.write_all(&bytes).unwrap();
+        file
+    }
+
+    #[test]
+    fn test_matrix() {
+        let file = write_matrix(
+            &[(7, 100, 200), (3, 0, 0), (5, 1, 2)],
+            &[
+                (1, 0.0),
+                (2, 0.1),
+                (3, 0.2),
+                (4, 0.3),
+                (5, 0.4),
+                (6, 0.5),
+                (7, 0.6),
+                (8, 0.7),
+                (9, 0.8),
+            ],
+        );
+        let matrix = LatencyMatrix::open(file.path()).unwrap();
+
+        assert_eq!(matrix.num_nodes(), 3);
+        assert_eq!(matrix.node_index(7), Some(0));
+        assert_eq!(matrix.node_index(3), Some(1));
+        assert_eq!(matrix.node_index(5), Some(2));
+        assert_eq!(matrix.node_index(0), None);
+
+        assert_eq!(matrix.bandwidth_down_bits(0), Some(100));
+        assert_eq!(matrix.bandwidth_up_bits(0), Some(200));
+        assert_eq!(matrix.bandwidth_down_bits(1), None);
+        assert_eq!(matrix.bandwidth_up_bits(1), None);
+
+        let path = matrix.path(1, 2);
+        assert_eq!(path.latency_ns, 6);
+        assert_eq!(path.packet_loss, 0.5);
+        let path = matrix.path(2, 0);
+        assert_eq!(path.latency_ns, 7);
+        assert_eq!(path.packet_loss, 0.6);
+
+        matrix.check_paths(&[0, 1, 2]).unwrap();
+    }
+
+    #[test]
+    fn test_routing_info() {
+        let file = write_matrix(
+            &[(0, 1, 1), (1, 1, 1), (2, 1, 1)],
+            &[
+                (5, 0.0),
+                (1, 0.0),
+                (6, 0.0),
+                (7, 0.0),
+                (8, 0.0),
+                (9, 0.0),
+                (10, 0.0),
+                (11, 0.0),
+                (12, 0.5),
+            ],
+        );
+        let matrix = LatencyMatrix::open(file.path()).unwrap();
+
+        // the routing info only uses the paths between the given nodes
+        let routing_info = RoutingInfo::new_mapped(matrix, [(2, 2), (0, 0)]);
+        assert_eq!(routing_info.path(0, 2).unwrap().latency_ns, 6);
+        assert_eq!(routing_info.path(2, 0).unwrap().latency_ns, 10);
+        assert_eq!(routing_info.path(2, 2).unwrap().packet_loss, 0.5);
+        assert!(routing_info.path(0, 1).is_none());
+        assert_eq!(routing_info.get_smallest_latency_ns(), Some(5));
+        assert!(routing_info.matrix().is_none());
+    }
+
+    #[test]
+    fn test_invalid_paths() {
+        let file = write_matrix(
+            &[(0, 1, 1), (1, 1, 1)],
+            &[(1, 0.0), (0, 0.0), (1, 0.0), (1, 1.5)],
+        );
+        let matrix = LatencyMatrix::open(file.path()).unwrap();
+
+        // only the paths between the given nodes are checked
+        matrix.check_paths(&[0]).unwrap();
+        assert!(matrix.check_paths(&[1]).is_err());
+        assert!(matrix.check_paths(&[0, 1]).is_err());
+    }
+
+    #[test]
+    fn test_invalid_file() {
+        // wrong size
+        let file = write_matrix(&[(0, 1, 1), (1, 1, 1)], &[(1, 0.0)]);
+        assert!(LatencyMatrix::open(file.path()).is_err());
+
+        // duplicate node
+        let file = write_matrix(&[(0, 1, 1), (0, 1, 1)], &[(1, 0.0); 4]);
+        assert!(LatencyMatrix::open(file.path()).is_err());
+
+        // not a matrix
+        let mut file = tempfile::NamedTempFile::new().unwrap();
+        file.write_all(b"graph [\n  directed 0\n]\n").unwrap();
+        assert!(LatencyMatrix::open(file.path()).is_err());
+
+        // too short for the header
+        let file = tempfile::NamedTempFile::new().unwrap();
+        assert!(LatencyMatrix::open(file.path()).is_err());
+    }
+}
@@ -1,16 +1,27 @@
+pub mod coordinates;
+pub mod matrix;
+mod path_cache;
 mod petgraph_wrapper;
+pub mod routing_cache;
+pub mod updates;
+mod xz;
 
-use std::collections::HashMap;
 use std::collections::hash_map::Entry;
+use std::collections::{HashMap, HashSet};
 use std::error::Error;
 use std::hash::Hash;
 
 use anyhow::Context;
 use log::*;
-use petgraph::graph::NodeIndex;
-use rayon::iter::{IntoParallelIterator, ParallelIterator};
+use petgraph::graph::{EdgeIndex, NodeIndex};
+use petgraph::visit::EdgeRef;
+use rayon::iter::{IndexedParallelIterator, ParallelIterator};
+use rayon::slice::ParallelSliceMut;
 
 use crate::core::configuration::{self, Compression, FileSource, GraphOptions, GraphSource};
+use crate::network::graph::coordinates::NetworkCoordinates;
+use crate::network::graph::matrix::LatencyMatrix;
+use crate::network::graph::path_cache::PathCache;
 use crate::network::graph::petgraph_wrapper::GraphWrapper;
 use crate::utility::tilde_expansion;
 use crate::utility::units::{self, Unit};
@@ -132,20 +143,33 @@ impl NetworkGraph {
     }
 
     pub fn parse(graph_text: &str) -> Result<Self, NetGraphError> {
-        let gml_graph = gml_parser::parse(graph_text)?;
+        // convert each item as it's parsed so that we never hold the parsed GML representation of
+        // every node and edge at once, which is much larger than the converted nodes and edges
+        let mut directed = false;
+        let mut nodes: Vec<ShadowNode> = Vec::new();
+        let mut edges: Vec<ShadowEdge> = Vec::new();
+
+        for item in gml_parser::parse_items(graph_text)? {
+            match item? {
+                gml_parser::gml::GmlItem::Node(x) => nodes.push(x.try_into()?),
+                gml_parser::gml::GmlItem::Edge(x) => edges.push(x.try_into()?),
+                gml_parser::gml::GmlItem::Directed(x) => directed = x,
+                gml_parser::gml::GmlItem::KeyValue(_) => {}
+            }
+        }
 
-        let mut g = match gml_graph.directed {
+        let mut g = match directed {
             true => GraphWrapper::Directed(
                 petgraph::graph::Graph::<_, _, petgraph::Directed, _>::with_capacity(
-                    gml_graph.nodes.len(),
-                    gml_graph.edges.len(),
+                    nodes.len(),
+                    edges.len(),
                 ),
             ),
             false => {
                 GraphWrapper::Undirected(
                     petgraph::graph::Graph::<_, _, petgraph::Undirected, _>::with_capacity(
-                        gml_graph.nodes.len(),
-                        gml_graph.edges.len(),
+                        nodes.len(),
+                        edges.len(),
                     ),
                 )
             }
@@ -154,16 +178,13 @@ impl NetworkGraph {
         // map from GML id to petgraph id
         let mut id_map = HashMap::new();
 
-        for x in gml_graph.nodes.into_iter() {
-            let x: ShadowNode = x.try_into()?;
+        for x in nodes.into_iter() {
             let gml_id = x.id;
             let petgraph_id = g.add_node(x);
             id_map.insert(gml_id, petgraph_id);
         }
 
-        for x in gml_graph.edges.into_iter() {
-            let x: ShadowEdge = x.try_into()?;
-
+        for x in edges.into_iter() {
             let source = *id_map
                 .get(&x.source)
                 .ok_or(format!("Edge source {} doesn't exist", x.source))?;
@@ -180,43 +201,29 @@ impl NetworkGraph {
         })
     }
 
+    /// The shortest paths between every pair of `nodes`, as a row-major matrix in the order of
+    /// `nodes` (see [`RoutingInfo::from_matrix`]).
     pub fn compute_shortest_paths(
         &self,
         nodes: &[NodeIndex],
-    ) -> Result<HashMap<(NodeIndex, NodeIndex), PathProperties>, NetGraphError> {
+    ) -> Result<Vec<PathProperties>, NetGraphError> {
         let start = std::time::Instant::now();
 
-        // calculate shortest paths
-        let mut paths: HashMap<(_, _), PathProperties> = nodes
-            .into_par_iter()
-            .flat_map(|src| {
-                match &self.graph {
-                    GraphWrapper::Directed(graph) => {
-                        petgraph::algo::dijkstra(&graph, *src, None, |e| e.weight().into())
-                    }
-                    GraphWrapper::Undirected(graph) => {
-                        petgraph::algo::dijkstra(&graph, *src, None, |e| e.weight().into())
-                    }
+        let node_set: HashSet<NodeIndex> = nodes.iter().copied().collect();
+
+        // calculate shortest paths, writing each source's paths into its row of the matrix so
+        // that each thread only holds the distances from one source at a time
+        let mut paths = vec![PathProperties::default(); nodes.len().pow(2)];
+        paths
+            .par_chunks_mut(std::cmp::max(nodes.len(), 1))
+            .zip(nodes)
+            .try_for_each(|(row, src)| {
+                let paths_from = self.compute_shortest_paths_from(*src, &node_set)?;
+                for (path, dst) in row.iter_mut().zip(nodes) {
+                    *path = paths_from[dst];
                 }
-                .into_iter()
-                // ignore nodes that aren't in use
-                .filter(|(dst, _)| nodes.contains(dst))
-                // include the src node
-                .map(|(dst, path)| ((*src, dst), path))
-                .collect::<HashMap<(_, _), _>>()
-            })
-            .collect();
-
-        // use the self-loop for paths from a node to itself
-        for node in nodes {
-            // the dijkstra shortest path from node -> node will always be 0
-            assert_eq!(paths[&(*node, *node)], PathProperties::default());
-
-            // there must be a single self-loop for each node
-            paths.insert((*node, *node), self.get_edge_weight(node, node)?.into());
-        }
-
-        assert_eq!(paths.len(), nodes.len().pow(2));
+                Ok::<_, NetGraphError>(())
+            })?;
 
         debug!(
             "Finished computing shortest paths: {} seconds, {} entries",
@@ -227,17 +234,137 @@ impl NetworkGraph {
         Ok(paths)
     }
 
+    /// Compute the shortest paths from `src` to each node in `nodes`. The path from `src` to itself
+    /// is its self-loop.
+    pub fn compute_shortest_paths_from(
+        &self,
+        src: NodeIndex,
+        nodes: &HashSet<NodeIndex>,
+    ) -> Result<HashMap<NodeIndex, PathProperties>, NetGraphError> {
+        let mut paths = self.shortest_distances_from(src, nodes);
+
+        // the dijkstra shortest path from node -> node will always be 0
+        assert_eq!(paths[&src], PathProperties::default());
+
+        // there must be a single self-loop for each node
+        paths.insert(src, self.get_edge_weight(&src, &src)?.into());
+
+        Ok(paths)
+    }
+
+    /// The shortest distances from `src` to each node in `nodes` that it can reach. Unlike
+    /// [`Self::compute_shortest_paths_from`], the distance from `src` to itself is 0.
+    fn shortest_distances_from(
+        &self,
+        src: NodeIndex,
+        nodes: &HashSet<NodeIndex>,
+    ) -> HashMap<NodeIndex, PathProperties> {
+        match &self.graph {
+            GraphWrapper::Directed(graph) => {
+                petgraph::algo::dijkstra(&graph, src, None, |e| e.weight().into())
+            }
+            GraphWrapper::Undirected(graph) => {
+                petgraph::algo::dijkstra(&graph, src, None, |e| e.weight().into())
+            }
+        }
+        .into_iter()
+        // ignore nodes that aren't in use
+        .filter(|(dst, _)| nodes.contains(dst))
+        .collect()
+    }
+
+    /// Check that shortest paths can be computed between every pair of `nodes`: each node must
+    /// have a single self-loop, and every node must be reachable from every other node.
+    pub fn check_shortest_paths(&self, nodes: &[NodeIndex]) -> Result<(), NetGraphError> {
+        for node in nodes {
+            self.get_edge_weight(node, node)?;
+        }
+
+        let Some(root) = nodes.first() else {
+            return Ok(());
+        };
+
+        // if every node can reach the root and the root can reach every node, then every node can
+        // reach every other node
+        let check_reachable = |reachable: HashSet<NodeIndex>, from_root: bool| {
+            for node in nodes {
+                if !reachable.contains(node) {
+                    let (src, dst) = match from_root {
+                        true => (root, node),
+                        false => (node, root),
+                    };
+                    return Err(format!(
+                        "No path from node {} to {}",
+                        self.node_index_to_id(*src).unwrap(),
+                        self.node_index_to_id(*dst).unwrap(),
+                    ));
+                }
+            }
+            Ok(())
+        };
+
+        match &self.graph {
+            GraphWrapper::Directed(graph) => {
+                check_reachable(reachable_from(graph, *root), true)?;
+                check_reachable(
+                    reachable_from(petgraph::visit::Reversed(graph), *root),
+                    false,
+                )?;
+            }
+            GraphWrapper::Undirected(graph) => {
+                check_reachable(reachable_from(graph, *root), true)?;
+            }
+        }
+
+        Ok(())
+    }
+
+    /// The lowest latency of any edge into `node` (including self-loops). Every path to `node`
+    /// has at least this latency.
+    pub fn smallest_incoming_latency_ns(&self, node: NodeIndex) -> Option<u64> {
+        match &self.graph {
+            GraphWrapper::Directed(graph) => graph
+                .edges_directed(node, petgraph::Direction::Incoming)
+                .map(|e| PathProperties::from(e.weight()).latency_ns)
+                .min(),
+            GraphWrapper::Undirected(graph) => graph
+                .edges(node)
+                .map(|e| PathProperties::from(e.weight()).latency_ns)
+                .min(),
+        }
+    }
+
+    /// The lowest latency of any edge leaving one of `nodes` (including self-loops). Every path
+    /// from one of `nodes` has at least this latency.
+    pub fn smallest_outgoing_latency_ns(&self, nodes: &[NodeIndex]) -> Option<u64> {
+        nodes
+            .iter()
+            .filter_map(|node| match &self.graph {
+                GraphWrapper::Directed(graph) => graph
+                    .edges(*node)
+                    .map(|e| PathProperties::from(e.weight()).latency_ns)
+                    .min(),
+                GraphWrapper::Undirected(graph) => graph
+                    .edges(*node)
+                    .map(|e| PathProperties::from(e.weight()).latency_ns)
+                    .min(),
+            })
+            .min()
+    }
+
+    /// The direct paths between every pair of `nodes`, as a row-major matrix in the order of
+    /// `nodes` (see [`RoutingInfo::from_matrix`]).
     pub fn get_direct_paths(
         &self,
         nodes: &[NodeIndex],
-    ) -> Result<HashMap<(NodeIndex, NodeIndex), PathProperties>, NetGraphError> {
+    ) -> Result<Vec<PathProperties>, NetGraphError> {
         let start = std::time::Instant::now();
 
-        let paths: HashMap<_, _> = nodes
+        let paths: Vec<_> = nodes
             .iter()
             .flat_map(|src| nodes.iter().map(move |dst| (*src, *dst)))
             // we require the graph to be connected with exactly one edge between any two nodes
-            .map(|(src, dst)| Ok(((src, dst), self.get_edge_weight(&src, &dst)?.into())))
+            .map(|(src, dst)| Ok(self.get_edge_weight(&src, &dst)?.into()))
             .collect::<Result<_, NetGraphError>>()?;
 
         assert_eq!(paths.len(), nodes.len().pow(2));
@@ -258,41 +385,47 @@ impl NetworkGraph {
         src: &NodeIndex,
         dst: &NodeIndex,
     ) -> Result<&ShadowEdge, NetGraphError> {
-        let src_id = self.node_index_to_id(*src).unwrap();
-        let dst_id = self.node_index_to_id(*dst).unwrap();
-        match &self.graph {
+        let edge = self.get_edge(*src, *dst)?;
+        Ok(self.graph.edge_weight(edge).unwrap())
+    }
+
+    /// Get the edge between two nodes. Returns an error if there is not exactly one edge between
+    /// them.
+    fn get_edge(&self, src: NodeIndex, dst: NodeIndex) -> Result<EdgeIndex<u32>, NetGraphError> {
+        let src_id = self.node_index_to_id(src).unwrap();
+        let dst_id = self.node_index_to_id(dst).unwrap();
+        let mut edges: Box<dyn Iterator<Item = EdgeIndex<u32>> + '_> = match &self.graph {
             GraphWrapper::Directed(graph) => {
-                let mut edges = graph.edges_connecting(*src, *dst);
-                let edge = edges
-                    .next()
-                    .ok_or(format!("No edge connecting node {} to {}", src_id, dst_id))?;
-                if edges.count() != 0 {
-                    return Err(format!(
-                        "More than one edge connecting node {} to {}",
-                        src_id, dst_id
-                    )
-                    .into());
-                }
-                Ok(edge.weight())
+                Box::new(graph.edges_connecting(src, dst).map(|e| e.id()))
             }
             GraphWrapper::Undirected(graph) => {
-                let mut edges = graph.edges_connecting(*src, *dst);
-                let edge = edges
-                    .next()
-                    .ok_or(format!("No edge connecting node {} to {}", src_id, dst_id))?;
-                if edges.count() != 0 {
-                    return Err(format!(
-                        "More than one edge connecting node {} to {}",
-                        src_id, dst_id
-                    )
-                    .into());
-                }
-                Ok(edge.weight())
+                Box::new(graph.edges_connecting(src, dst).map(|e| e.id()))
             }
+        };
+        let edge = edges
+            .next()
+            .ok_or(format!("No edge connecting node {} to {}", src_id, dst_id))?;
+        if edges.count() != 0 {
+            return Err(format!(
+                "More than one edge connecting node {} to {}",
+                src_id, dst_id
+            )
+            .into());
         }
+        Ok(edge)
     }
 }
 
+/// The set of nodes reachable from `root` (including `root`).
+fn reachable_from<G>(graph: G, root: G::NodeId) -> HashSet<G::NodeId>
+where
+    G: petgraph::visit::IntoNeighbors + petgraph::visit::Visitable,
+    G::NodeId: Eq + Hash,
+{
+    let mut bfs = petgraph::visit::Bfs::new(graph, root);
+    std::iter::from_fn(|| bfs.next(graph)).collect()
+}
+
 /// Network characteristics for a path between two nodes.
 #[derive(Debug, Default, Clone, Copy)]
 pub struct PathProperties {
@@ -430,40 +563,377 @@ impl<T: Copy + Eq + Hash + std::fmt::Display> Default for IpAssignment<T> {
 }
 
 /// Routing information for paths between nodes.
+///
+/// The nodes are assigned compact indices. The path properties are either stored in a dense
+/// row-major matrix indexed by these, so that looking up a path only needs a lookup in the small
+/// node index map and a single access to the matrix, are computed on first use and cached for a
+/// bounded number of source nodes, are read from a mapped [`LatencyMatrix`] file, or are computed
+/// from [`NetworkCoordinates`] on every lookup.
+///
+/// If the graph changes during the simulation, the paths from each affected source node after each
+/// change are stored as separate rows, which are only looked at for source nodes that have them.
 #[derive(Debug)]
 pub struct RoutingInfo<T: Eq + Hash + std::fmt::Display + Clone + Copy> {
-    paths: HashMap<(T, T), PathProperties>,
-    packet_counters: std::sync::RwLock<HashMap<(T, T), u64>>,
+    /// The compact index of each node.
+    node_indices: HashMap<T, usize>,
+    paths: Paths<T>,
+    /// The changes to the paths from each source node (by compact index) in time order, as the
+    /// time in nanoseconds since the start of the simulation and the paths to every node from that
+    /// time on. Empty if the paths never change.
+    path_updates: Vec<Vec<(u64, Box<[PathProperties]>)>>,
+    /// The number of packets sent along each path, merged from each worker's local counts.
+    packet_counters: std::sync::Mutex<HashMap<(T, T), u64>>,
+}
+
+#[derive(Debug)]
+enum Paths<T> {
+    /// The properties of the path from node `i` to node `j` at `i * num_nodes + j`.
+    Dense(Vec<PathProperties>),
+    /// Paths that are computed when first needed. Every path has a latency of at least
+    /// `smallest_latency_ns`, and every path into node `i` (by compact index) has a latency of at
+    /// least `inbound_latency_ns[i]`.
+    Lazy {
+        cache: PathCache<T>,
+        smallest_latency_ns: u64,
+        inbound_latency_ns: Vec<u64>,
+    },
+    /// Paths that are read from a latency matrix, where `matrix_indices` has the index in the
+    /// matrix of each node (by compact index).
+    Mapped {
+        matrix: LatencyMatrix,
+        matrix_indices: Vec<usize>,
+        smallest_latency_ns: u64,
+    },
+    /// Paths that are computed from the coordinates of each node (by compact index).
+    Coordinates(NetworkCoordinates),
 }
 
 impl<T: Eq + Hash + std::fmt::Display + Clone + Copy> RoutingInfo<T> {
+    /// Build the routing information from the paths between each pair of nodes. There must be a
+    /// path between every pair of nodes (including from each node to itself).
     pub fn new(paths: HashMap<(T, T), PathProperties>) -> Self {
+        let mut node_indices = HashMap::new();
+        for (src, dst) in paths.keys() {
+            for node in [src, dst] {
+                let next_index = node_indices.len();
+                node_indices.entry(*node).or_insert(next_index);
+            }
+        }
+
+        let num_nodes = node_indices.len();
+        assert_eq!(
+            paths.len(),
+            num_nodes.pow(2),
+            "Missing paths between some pairs of nodes"
+        );
+
+        let mut matrix = vec![PathProperties::default(); num_nodes.pow(2)];
+        for ((src, dst), path) in paths {
+            matrix[node_indices[&src] * num_nodes + node_indices[&dst]] = path;
+        }
+
+        Self {
+            node_indices,
+            paths: Paths::Dense(matrix),
+            path_updates: Vec::new(),
+            packet_counters: std::sync::Mutex::new(HashMap::new()),
+        }
+    }
+
+    /// Build routing information that computes the paths from a node when they're first needed,
+    /// and keeps the paths from at most `cache_capacity` nodes. `nodes` are the nodes and a lower
+    /// bound of the latency of every path into each node (such as the lowest latency of the edges
+    /// into it). `compute_paths_from` must return the paths from the given node to every node in
+    /// `nodes`, and every path must have a latency of at least `smallest_latency_ns`.
+    pub fn new_lazy(
+        nodes: impl IntoIterator<Item = (T, u64)>,
+        smallest_latency_ns: u64,
+        cache_capacity: usize,
+        compute_paths_from: impl Fn(T) -> HashMap<T, PathProperties> + Send + Sync + 'static,
+    ) -> Self {
+        let mut node_indices = HashMap::new();
+        let mut ordered_nodes = Vec::new();
+        let mut inbound_latency_ns = Vec::new();
+        for (node, latency_ns) in nodes {
+            if let Entry::Vacant(e) = node_indices.entry(node) {
+                e.insert(ordered_nodes.len());
+                ordered_nodes.push(node);
+                inbound_latency_ns.push(latency_ns);
+            }
+        }
+
+        Self {
+            node_indices,
+            paths: Paths::Lazy {
+                cache: PathCache::new(ordered_nodes, cache_capacity, Box::new(compute_paths_from)),
+                smallest_latency_ns,
+                inbound_latency_ns,
+            },
+            path_updates: Vec::new(),
+            packet_counters: std::sync::Mutex::new(HashMap::new()),
+        }
+    }
+
+    /// Build the routing information from a dense row-major matrix of the paths between `nodes`,
+    /// as returned by [`Self::matrix`].
+    pub fn from_matrix(nodes: Vec<T>, paths: Vec<PathProperties>) -> Self {
+        assert_eq!(paths.len(), nodes.len().pow(2));
+
+        let node_indices: HashMap<_, _> = nodes.iter().enumerate().map(|(i, x)| (*x, i)).collect();
+        assert_eq!(node_indices.len(), nodes.len(), "Duplicate nodes");
+
         Self {
-            paths,
-            packet_counters: std::sync::RwLock::new(HashMap::new()),
+            node_indices,
+            paths: Paths::Dense(paths),
+            path_updates: Vec::new(),
+            packet_counters: std::sync::Mutex::new(HashMap::new()),
+        }
+    }
+
+    /// Build the routing information from the paths in a latency matrix, which are read from the
+    /// matrix when needed. `nodes` are the nodes and their indices in the matrix.
+    pub fn new_mapped(matrix: LatencyMatrix, nodes: impl IntoIterator<Item = (T, usize)>) -> Self {
+        let mut node_indices = HashMap::new();
+        let mut matrix_indices = Vec::new();
+        for (node, index) in nodes {
+            assert!(index < matrix.num_nodes());
+            if let Entry::Vacant(e) = node_indices.entry(node) {
+                e.insert(matrix_indices.len());
+                matrix_indices.push(index);
+            }
+        }
+
+        let smallest_latency_ns = matrix_indices
+            .iter()
+            .flat_map(|src| {
+                matrix_indices
+                    .iter()
+                    .map(|dst| matrix.path(*src, *dst).latency_ns)
+            })
+            .min()
+            .unwrap_or(0);
+
+        Self {
+            node_indices,
+            paths: Paths::Mapped {
+                matrix,
+                matrix_indices,
+                smallest_latency_ns,
+            },
+            path_updates: Vec::new(),
+            packet_counters: std::sync::Mutex::new(HashMap::new()),
+        }
+    }
+
+    /// Build the routing information from network coordinates, computing each path when it's
+    /// looked up. `nodes` are the nodes and their indices in `coordinates`.
+    pub fn new_coordinates(
+        coordinates: &NetworkCoordinates,
+        nodes: impl IntoIterator<Item = (T, usize)>,
+    ) -> Self {
+        let mut node_indices = HashMap::new();
+        let mut coordinate_indices = Vec::new();
+        for (node, index) in nodes {
+            if let Entry::Vacant(e) = node_indices.entry(node) {
+                e.insert(coordinate_indices.len());
+                coordinate_indices.push(index);
+            }
+        }
+
+        Self {
+            node_indices,
+            // only keep the coordinates of the nodes in use, in order of their compact index
+            paths: Paths::Coordinates(coordinates.select(&coordinate_indices)),
+            path_updates: Vec::new(),
+            packet_counters: std::sync::Mutex::new(HashMap::new()),
+        }
+    }
+
+    /// Change the paths from `src` to every node at `time_ns` (nanoseconds since the start of the
+    /// simulation). The changes to the paths from a node must be added in time order. Will panic
+    /// if the paths aren't stored in a dense matrix, or if a path to a node is missing.
+    pub fn add_path_update(&mut self, time_ns: u64, src: T, paths: &HashMap<T, PathProperties>) {
+        assert!(
+            matches!(self.paths, Paths::Dense(_)),
+            "Only paths in a dense matrix can be updated"
+        );
+
+        let mut row = vec![PathProperties::default(); self.num_nodes()];
+        for (node, index) in &self.node_indices {
+            row[*index] = *paths
+                .get(node)
+                .unwrap_or_else(|| panic!("No path from node {src} to {node}"));
+        }
+
+        let num_nodes = self.num_nodes();
+        self.path_updates.resize_with(num_nodes, Vec::new);
+        let updates = &mut self.path_updates[self.node_indices[&src]];
+        assert!(updates.last().is_none_or(|(x, _)| *x <= time_ns));
+        updates.push((time_ns, row.into_boxed_slice()));
+    }
+
+    /// The nodes in order of their compact index, and the dense row-major matrix of the paths
+    /// between them. Returns `None` if the paths aren't in a dense matrix or change over time.
+    pub fn matrix(&self) -> Option<(Vec<T>, &[PathProperties])> {
+        let Paths::Dense(matrix) = &self.paths else {
+            return None;
+        };
+        if !self.path_updates.is_empty() {
+            return None;
         }
+
+        let mut nodes: Vec<_> = self.node_indices.iter().collect();
+        nodes.sort_unstable_by_key(|(_, i)| **i);
+        let nodes = nodes.into_iter().map(|(x, _)| *x).collect();
+
+        Some((nodes, matrix))
+    }
+
+    fn num_nodes(&self) -> usize {
+        self.node_indices.len()
     }
 
     /// Get properties for the path from one node to another.
     pub fn path(&self, start: T, end: T) -> Option<PathProperties> {
-        self.paths.get(&(start, end)).copied()
+        let start = self.node_index(start)?;
+        let end = self.node_index(end)?;
+        Some(self.path_by_index(start, end))
     }
 
-    /// Increment the number of packets sent from one node to another.
-    pub fn increment_packet_count(&self, start: T, end: T) {
-        let key = (start, end);
-        let mut packet_counters = self.packet_counters.write().unwrap();
-        match packet_counters.get_mut(&key) {
-            Some(x) => *x = x.saturating_add(1),
-            None => assert!(packet_counters.insert(key, 1).is_none()),
+    /// The compact index of a node, for use with [`Self::path_by_index`].
+    pub fn node_index(&self, node: T) -> Option<usize> {
+        self.node_indices.get(&node).copied()
+    }
+
+    /// Get properties for the path from one node to another, given the nodes' compact indices.
+    /// Will panic if an index is out of bounds.
+    pub fn path_by_index(&self, start: usize, end: usize) -> PathProperties {
+        match &self.paths {
+            Paths::Dense(matrix) => {
+                let num_nodes = self.num_nodes();
+                assert!(start < num_nodes && end < num_nodes);
+                matrix[start * num_nodes + end]
+            }
+            Paths::Lazy { cache, .. } => cache.path(start, end),
+            Paths::Mapped {
+                matrix,
+                matrix_indices,
+                ..
+            } => matrix.path(matrix_indices[start], matrix_indices[end]),
+            Paths::Coordinates(coordinates) => coordinates.path(start, end),
+        }
+    }
+
+    /// Get properties for the path from one node to another at `time_ns` (nanoseconds since the
+    /// start of the simulation), given the nodes' compact indices. Will panic if an index is out of
+    /// bounds.
+    pub fn path_by_index_at(&self, start: usize, end: usize, time_ns: u64) -> PathProperties {
+        if let Some(updates) = self.path_updates.get(start) {
+            let applied = updates.partition_point(|(x, _)| *x <= time_ns);
+            if let Some((_, row)) = applied.checked_sub(1).map(|i| &updates[i]) {
+                return row[end];
+            }
+        }
+        self.path_by_index(start, end)
+    }
+
+    /// The lowest latency of the path from one node to another at any time.
+    pub fn lowest_path_latency_ns(&self, start: T, end: T) -> Option<u64> {
+        let start = self.node_index(start)?;
+        let end = self.node_index(end)?;
+        let updates = self.path_updates.get(start).map(|x| &x[..]).unwrap_or(&[]);
+        updates
+            .iter()
+            .map(|(_, row)| row[end].latency_ns)
+            .chain([self.path_by_index(start, end).latency_ns])
+            .min()
+    }
+
+    /// The lowest latency at any time of the paths from any of `starts` to `end`. If the paths are
+    /// computed lazily, this is a lower bound that doesn't require computing the paths.
+    pub fn lowest_inbound_latency_ns(&self, starts: &[T], end: T) -> Option<u64> {
+        if let Paths::Lazy {
+            inbound_latency_ns, ..
+        } = &self.paths
+        {
+            return Some(inbound_latency_ns[self.node_index(end)?]);
+        }
+
+        let mut lowest = None;
+        for start in starts {
+            let latency_ns = self.lowest_path_latency_ns(*start, end)?;
+            lowest = Some(lowest.map_or(latency_ns, |x: u64| x.min(latency_ns)));
+        }
+        lowest
+    }
+
+    /// The times (in nanoseconds since the start of the simulation) at which the smallest latency
+    /// of any path changes, and the smallest latency from each time on, in time order.
+    pub fn smallest_latency_changes_ns(&self) -> Vec<(u64, u64)> {
+        let Some(start_latency_ns) = self.get_smallest_latency_ns() else {
+            return Vec::new();
+        };
+        if self.path_updates.is_empty() {
+            return Vec::new();
+        }
+
+        // the current smallest latency of the paths from each source node
+        let num_nodes = self.num_nodes();
+        let mut smallest: Vec<u64> = (0..num_nodes)
+            .map(|src| {
+                (0..num_nodes)
+                    .map(|dst| self.path_by_index(src, dst).latency_ns)
+                    .min()
+                    .unwrap()
+            })
+            .collect();
+        let mut current_ns = start_latency_ns;
+
+        let mut updates: Vec<(u64, usize, u64)> = self
+            .path_updates
+            .iter()
+            .enumerate()
+            .flat_map(|(src, updates)| {
+                updates.iter().map(move |(time_ns, row)| {
+                    let latency_ns = row.iter().map(|x| x.latency_ns).min().unwrap();
+                    (*time_ns, src, latency_ns)
+                })
+            })
+            .collect();
+        updates.sort_unstable();
+
+        let mut changes = Vec::new();
+        for group in updates.chunk_by(|a, b| a.0 == b.0) {
+            for (_, src, latency_ns) in group {
+                smallest[*src] = *latency_ns;
+            }
+            let latency_ns = *smallest.iter().min().unwrap();
+            if latency_ns != current_ns {
+                changes.push((group[0].0, latency_ns));
+                current_ns = latency_ns;
+            }
+        }
+        changes
+    }
+
+    /// Add to the number of packets sent between nodes. Workers count packets locally and add
+    /// their counts here once, so that sending a packet doesn't need to take a shared lock.
+    pub fn add_packet_counts(&self, counts: impl IntoIterator<Item = ((T, T), u64)>) {
+        let mut packet_counters = self.packet_counters.lock().unwrap();
+        for (key, count) in counts {
+            let x = packet_counters.entry(key).or_insert(0);
+            *x = x.saturating_add(count);
         }
     }
 
     /// Log the number of packets sent between nodes.
+    /// Log and reset the number of packets sent between nodes.
     pub fn log_packet_counts(&self) {
+        let packet_counters = std::mem::take(&mut *self.packet_counters.lock().unwrap());
+
         // only logs paths that have transmitted at least one packet
-        for ((start, end), count) in self.packet_counters.read().unwrap().iter() {
-            let path = self.paths.get(&(*start, *end)).unwrap();
+        for ((start, end), count) in packet_counters.iter() {
+            let path = self.path(*start, *end).unwrap();
             log::debug!(
                 "Found path {}->{}: latency={}ns, packet_loss={}, packet_count={}",
                 start,
@@ -475,8 +945,21 @@ impl<T: Eq + Hash + std::fmt::Display + Clone + Copy> RoutingInfo<T> {
         }
     }
 
+    /// The smallest latency of any path at the start of the simulation. If paths are computed
+    /// lazily, this is a lower bound.
     pub fn get_smallest_latency_ns(&self) -> Option<u64> {
-        self.paths.values().map(|x| x.latency_ns).min()
+        match &self.paths {
+            Paths::Dense(matrix) => matrix.iter().map(|x| x.latency_ns).min(),
+            Paths::Lazy {
+                smallest_latency_ns,
+                ..
+            }
+            | Paths::Mapped {
+                smallest_latency_ns,
+                ..
+            } => (self.num_nodes() > 0).then_some(*smallest_latency_ns),
+            Paths::Coordinates(coordinates) => coordinates.smallest_latency_ns(),
+        }
     }
 }
 
@@ -484,18 +967,16 @@ impl<T: Eq + Hash + std::fmt::Display + Clone + Copy> RoutingInfo<T> {
 fn read_xz<P: AsRef<std::path::Path>>(path: P) -> Result<String, NetGraphError> {
     let path = path.as_ref();
 
-    let mut f = std::io::BufReader::new(
-        std::fs::File::open(path).with_context(|| format!("Failed to open file: {path:?}"))?,
-    );
+    let compressed =
+        std::fs::read(path).with_context(|| format!("Failed to open file: {path:?}"))?;
 
-    let mut decomp: Vec<u8> = Vec::new();
-    lzma_rs::xz_decompress(&mut f, &mut decomp).context("Failed to decompress file")?;
-    decomp.shrink_to_fit();
+    // decompresses the file's blocks in parallel if it has more than one
+    let decomp = xz::decompress(&compressed)?;
 
     Ok(String::from_utf8(decomp)?)
 }
 
-/// Get the network graph as a string.
+/// Get the network graph (or the network coordinates) as a string.
 pub fn load_network_graph(graph_options: &GraphOptions) -> Result<String, NetGraphError> {
     Ok(match graph_options {
         GraphOptions::Gml(GraphSource::File(FileSource {
@@ -509,6 +990,17 @@ pub fn load_network_graph(graph_options: &GraphOptions) -> Result<String, NetGra
         })) => read_xz(tilde_expansion(f))?,
         GraphOptions::Gml(GraphSource::Inline(s)) => s.clone(),
         GraphOptions::OneGbitSwitch => configuration::ONE_GBIT_SWITCH_GRAPH.to_string(),
+        GraphOptions::Coordinates(GraphSource::File(FileSource {
+            compression: None,
+            path: f,
+        })) => std::fs::read_to_string(tilde_expansion(f))
+            .with_context(|| format!("Failed to read file: {f}"))?,
+        GraphOptions::Coordinates(GraphSource::File(FileSource {
+            compression: Some(Compression::Xz),
+            path: f,
+        })) => read_xz(tilde_expansion(f))?,
+        GraphOptions::Coordinates(GraphSource::Inline(s)) => s.clone(),
+        GraphOptions::Matrix(_) => return Err("A latency matrix is not a GML graph".into()),
     })
 }
 
@@ -624,7 +1116,10 @@ mod tests {
                 .compute_shortest_paths(&[node_0, node_1, node_2])
                 .unwrap();
 
-            let lookup_latency = |a, b| shortest_paths.get(&(a, b)).unwrap().latency_ns;
+            let nodes = [node_0, node_1, node_2];
+            let index = |x| nodes.iter().position(|y| *y == x).unwrap();
+            let lookup_latency =
+                |a, b| shortest_paths[index(a) * nodes.len() + index(b)].latency_ns;
 
             if *directed {
                 assert_eq!(lookup_latency(node_0, node_0), 3333);
@@ -650,6 +1145,69 @@ mod tests {
         }
     }
 
+    #[test]
+    fn test_routing_info() {
+        let path = |latency_ns| PathProperties {
+            latency_ns,
+            packet_loss: 0.0,
+        };
+        let paths = HashMap::from([
+            ((10, 10), path(1)),
+            ((10, 20), path(2)),
+            ((20, 10), path(3)),
+            ((20, 20), path(4)),
+        ]);
+        let routing_info = RoutingInfo::new(paths);
+
+        assert_eq!(routing_info.path(10, 10).unwrap().latency_ns, 1);
+        assert_eq!(routing_info.path(10, 20).unwrap().latency_ns, 2);
+        assert_eq!(routing_info.path(20, 10).unwrap().latency_ns, 3);
+        assert_eq!(routing_info.path(20, 20).unwrap().latency_ns, 4);
+        assert!(routing_info.path(10, 30).is_none());
+        assert_eq!(routing_info.get_smallest_latency_ns(), Some(1));
+    }
+
+    #[test]
+    fn test_routing_info_updates() {
+        let path = |latency_ns| PathProperties {
+            latency_ns,
+            packet_loss: 0.0,
+        };
+        let paths = HashMap::from([
+            ((10, 10), path(5)),
+            ((10, 20), path(6)),
+            ((20, 10), path(7)),
+            ((20, 20), path(8)),
+        ]);
+        let mut routing_info = RoutingInfo::new(paths);
+        let (i10, i20) = (
+            routing_info.node_index(10).unwrap(),
+            routing_info.node_index(20).unwrap(),
+        );
+
+        routing_info.add_path_update(100, 10, &HashMap::from([(10, path(5)), (20, path(9))]));
+        routing_info.add_path_update(200, 20, &HashMap::from([(10, path(2)), (20, path(8))]));
+        routing_info.add_path_update(300, 20, &HashMap::from([(10, path(7)), (20, path(8))]));
+
+        assert_eq!(routing_info.path_by_index_at(i10, i20, 99).latency_ns, 6);
+        assert_eq!(routing_info.path_by_index_at(i10, i20, 100).latency_ns, 9);
+        assert_eq!(routing_info.path_by_index_at(i10, i20, 1000).latency_ns, 9);
+        assert_eq!(routing_info.path_by_index_at(i20, i10, 250).latency_ns, 2);
+        assert_eq!(routing_info.path_by_index_at(i20, i10, 300).latency_ns, 7);
+        assert_eq!(routing_info.path_by_index_at(i20, i20, 300).latency_ns, 8);
+
+        assert_eq!(routing_info.lowest_path_latency_ns(10, 20), Some(6));
+        assert_eq!(routing_info.lowest_path_latency_ns(20, 10), Some(2));
+        assert_eq!(routing_info.get_smallest_latency_ns(), Some(5));
+        assert_eq!(
+            routing_info.smallest_latency_changes_ns(),
+            [(200, 2), (300, 5)]
+        );
+
+        // paths that change can't be stored in the routing cache
+        assert!(routing_info.matrix().is_none());
+    }
+
     #[test]
     fn test_increment_address_skip_broadcast() {
         let addr = std::net::IpAddr::V4(std::net::Ipv4Addr::new(11, 0, 0, 254));
@@ -0,0 +1,185 @@
+use std::collections::HashMap;
+use std::hash::Hash;
+use std::sync::RwLock;
+use std::sync::atomic::{AtomicBool, Ordering};
+
+use super::PathProperties;
+
+/// A function that computes the paths from a source node to every node.
+type ComputePaths<T> = dyn Fn(T) -> HashMap<T, PathProperties> + Send + Sync;
+
+/// Paths between nodes that are computed when first needed, for one source node at a time. The
+/// paths from a bounded number of source nodes are cached, and the least recently used are
+/// approximately evicted first (using the "clock" algorithm).
+///
+/// Cache hits only take a read lock, so workers looking up paths from cached source nodes don't
+/// block each other.
+pub struct PathCache<T> {
+    /// All nodes, ordered by their compact index.
+    nodes: Vec<T>,
+    compute_paths_from: Box<ComputePaths<T>>,
+    cache: RwLock<CachedRows>,
+}
+
+struct CachedRows {
+    /// The slot for each cached source node, by the node's compact index.
+    slots_by_src: HashMap<usize, usize>,
+    slots: Vec<CacheSlot>,
+    capacity: usize,
+    /// The next slot to consider for eviction.
+    hand: usize,
+}
+
+struct CacheSlot {
+    src: usize,
+    /// The paths from `src` to every node, by the destination node's compact index.
+    row: Vec<PathProperties>,
+    /// Has this slot been used since the clock hand last passed it?
+    referenced: AtomicBool,
+}
+
+impl<T: Eq + Hash + std::fmt::Display + Copy> PathCache<T> {
+    /// A new cache of the paths from at most `capacity` source nodes. `compute_paths_from` must
+    /// return paths from the given node to every node in `nodes`. Will panic if the capacity is 0.
+    pub fn new(nodes: Vec<T>, capacity: usize, compute_paths_from: Box<ComputePaths<T>>) -> Self {
+        assert!(capacity > 0);
+
+        Self {
+            nodes,
+            compute_paths_from,
+            cache: RwLock::new(CachedRows {
+                slots_by_src: HashMap::new(),
+                slots: Vec::new(),
+                capacity,
+                hand: 0,
+            }),
+        }
+    }
+
+    /// Get the path between two nodes, given by their compact indices.
+    pub fn path(&self, src: usize, dst: usize) -> PathProperties {
+        if let Some(path) = self.cache.read().unwrap().path(src, dst) {
+            return path;
+        }
+
+        // compute the paths without holding the lock; another thread may be computing the same
+        // paths at the same time, but this should be rare and the result is the same
+        let src_node = self.nodes[src];
+        let paths = (self.compute_paths_from)(src_node);
+        let row: Vec<_> = self
+            .nodes
+            .iter()
+            .map(|dst_node| {
+                *paths
+                    .get(dst_node)
+                    .unwrap_or_else(|| panic!("No path from node {src_node} to {dst_node}"))
+            })
+            .collect();
+
+        let path = row[dst];
+        self.cache.write().unwrap().insert(src, row);
+        path
+    }
+}
+
+impl CachedRows {
+    fn path(&self, src: usize, dst: usize) -> Option<PathProperties> {
+        let slot = &self.slots[*self.slots_by_src.get(&src)?];
+        slot.referenced.store(true, Ordering::Relaxed);
+        Some(slot.row[dst])
+    }
+
+    fn insert(&mut self, src: usize, row: Vec<PathProperties>) {
+        if self.slots_by_src.contains_key(&src) {
+            // another thread already inserted it
+            return;
+        }
+
+        let slot = CacheSlot {
+            src,
+            row,
+            referenced: AtomicBool::new(false),
+        };
+
+        if self.slots.len() < self.capacity {
+            self.slots_by_src.insert(src, self.slots.len());
+            self.slots.push(slot);
+            return;
+        }
+
+        // advance the hand to the first slot that hasn't been used since the hand last passed it
+        while self.slots[self.hand]
+            .referenced
+            .swap(false, Ordering::Relaxed)
+        {
+            self.hand = (self.hand + 1) % self.capacity;
+        }
+
+        let evicted = std::mem::replace(&mut self.slots[self.hand], slot);
+        self.slots_by_src.remove(&evicted.src);
+        self.slots_by_src.insert(src, self.hand);
+        self.hand = (self.hand + 1) % self.capacity;
+    }
+}
+
+impl<T: std::fmt::Debug> std::fmt::Debug for PathCache<T> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        let cache = self.cache.read().unwrap();
+        f.debug_struct("PathCache")
+            .field("nodes", &self.nodes)
+            .field("num_cached", &cache.slots.len())
+            .field("capacity", &cache.capacity)
+            .finish_non_exhaustive()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::Arc;
+    use std::sync::atomic::AtomicUsize;
+
+    use super::*;
+
+    #[test]
+    fn test_eviction() {
+        let nodes = vec![10, 20, 30];
+        let num_computed = Arc::new(AtomicUsize::new(0));
+
+        let compute = {
+            let nodes = nodes.clone();
+            let num_computed = Arc::clone(&num_computed);
+            move |src: u32| {
+                num_computed.fetch_add(1, Ordering::Relaxed);
+                nodes
+                    .iter()
+                    .map(|dst| {
+                        let path = PathProperties {
+                            latency_ns: (src * 100 + dst).into(),
+                            packet_loss: 0.0,
+                        };
+                        (*dst, path)
+                    })
+                    .collect()
+            }
+        };
+
+        let cache = PathCache::new(nodes, 2, Box::new(compute));
+
+        assert_eq!(cache.path(0, 1).latency_ns, 1020);
+        assert_eq!(cache.path(0, 2).latency_ns, 1030);
+        assert_eq!(num_computed.load(Ordering::Relaxed), 1);
+
+        assert_eq!(cache.path(1, 0).latency_ns, 2010);
+        assert_eq!(num_computed.load(Ordering::Relaxed), 2);
+
+        // evicts one of the cached sources
+        assert_eq!(cache.path(2, 2).latency_ns, 3030);
+        assert_eq!(num_computed.load(Ordering::Relaxed), 3);
+
+        // the most recent source is still cached
+        assert_eq!(cache.path(2, 0).latency_ns, 3010);
+        assert_eq!(num_computed.load(Ordering::Relaxed), 3);
+
+        assert_eq!(cache.cache.read().unwrap().slots.len(), 2);
+    }
+}
@@ -23,6 +23,9 @@ impl<N, E, Ix: IndexType> GraphWrapper<N, E, Ix> {
     enum_passthrough!(self, (edge), Directed, Undirected;
         pub fn edge_weight(&self, edge: EdgeIndex<Ix>) -> Option<&E>
     );
+    enum_passthrough!(self, (edge), Directed, Undirected;
+        pub fn remove_edge(&mut self, edge: EdgeIndex<Ix>) -> Option<E>
+    );
     enum_passthrough!(self, (a, b), Directed, Undirected;
         pub fn find_edge(&self, a: NodeIndex<Ix>, b: NodeIndex<Ix>) -> Option<EdgeIndex<Ix>>
     );
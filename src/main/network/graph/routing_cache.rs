@@ -0,0 +1,267 @@
+//! An on-disk cache of the paths between graph nodes, so that simulations that use the same graph
+//! and the same graph nodes don't need to recompute them.
+//!
+//! Each cache file holds the inputs that the paths were computed from and the dense path matrix
+//! of a [`RoutingInfo`], in a fixed little-endian binary layout:
+//!
+//! ```text
+//! magic: [u8; 8]
+//! key: u64
+//! use_shortest_path: u8
+//! num_input_nodes: u64
+//! input_nodes: [u32; num_input_nodes]
+//! graph_len: u64
+//! graph: [u8; graph_len]
+//! num_nodes: u64
+//! nodes: [u32; num_nodes]
+//! paths: [(latency_ns: u64, packet_loss: f32); num_nodes * num_nodes]
+//! ```
+//!
+//! The key is a hash of the inputs (everything from `use_shortest_path` through `graph`), and
+//! names the file. The inputs are compared when the file is loaded, so a hash collision is only a
+//! cache miss.
+
+use std::hash::Hasher;
+use std::io::Write;
+use std::path::{Path, PathBuf};
+
+use anyhow::Context;
+use rustc_hash::FxHasher;
+
+use super::{PathProperties, RoutingInfo};
+
+/// Identifies the file format. Must be changed if the format or the path computation changes.
+const MAGIC: [u8; 8] = *b"SHDWRT02";
+
+const PATH_SIZE: usize = size_of::<u64>() + size_of::<f32>();
+
+/// The inputs that cached paths are computed from: the paths between `nodes` in the graph given by
+/// `graph_text`.
+#[derive(Debug)]
+pub struct CacheInput<'a> {
+    graph_text: &'a str,
+    /// In sorted order.
+    nodes: Vec<u32>,
+    use_shortest_path: bool,
+}
+
+impl<'a> CacheInput<'a> {
+    /// The order of `nodes` doesn't matter.
+    pub fn new(graph_text: &'a str, nodes: &[u32], use_shortest_path: bool) -> Self {
+        let mut nodes = nodes.to_vec();
+        nodes.sort_unstable();
+
+        Self {
+            graph_text,
+            nodes,
+            use_shortest_path,
+        }
+    }
+
+    /// The inputs up to (but not including) the graph text, as they're written to the file.
+    fn header(&self) -> Vec<u8> {
+        let mut bytes = Vec::with_capacity(1 + 16 + self.nodes.len() * size_of::<u32>());
+        bytes.push(u8::from(self.use_shortest_path));
+        bytes.extend_from_slice(&u64::try_from(self.nodes.len()).unwrap().to_le_bytes());
+        for node in &self.nodes {
+            bytes.extend_from_slice(&node.to_le_bytes());
+        }
+        bytes.extend_from_slice(&u64::try_from(self.graph_text.len()).unwrap().to_le_bytes());
+        bytes
+    }
+
+    /// The cache key. Unlike the standard library's `DefaultHasher`, FxHash (with its fixed seed)
+    /// doesn't change between Rust versions, so the key is the same for every build of shadow.
+    pub fn key(&self) -> u64 {
+        let mut hasher = FxHasher::default();
+        hasher.write(&self.header());
+        hasher.write(self.graph_text.as_bytes());
+        hasher.finish()
+    }
+}
+
+fn cache_file(dir: &Path, key: u64) -> PathBuf {
+    dir.join(format!("routing-{key:016x}.bin"))
+}
+
+/// Load the routing info for the given input from the cache directory. Returns `Ok(None)` if it
+/// isn't cached.
+pub fn load(dir: &Path, input: &CacheInput) -> anyhow::Result<Option<RoutingInfo<u32>>> {
+    let path = cache_file(dir, input.key());
+    let bytes = match std::fs::read(&path) {
+        Ok(x) => x,
+        Err(e) if e.kind() == std::io::ErrorKind::NotFound => return Ok(None),
+        Err(e) => return Err(e).with_context(|| format!("Failed to read {path:?}")),
+    };
+
+    let routing_info =
+        parse(&bytes, input).with_context(|| format!("Invalid routing cache file {path:?}"))?;
+    if routing_info.is_none() {
+        log::debug!("The routing cache file {path:?} was computed from a different input");
+    }
+    Ok(routing_info)
+}
+
+/// Remove and return the first `len` bytes of `bytes`.
+fn take<'a>(bytes: &mut &'a [u8], len: usize) -> anyhow::Result<&'a [u8]> {
+    if bytes.len() < len {
+        anyhow::bail!("Unexpected end of file");
+    }
+    let (x, rest) = bytes.split_at(len);
+    *bytes = rest;
+    Ok(x)
+}
+
+/// Parse a cache file. Returns `Ok(None)` if the file's paths were computed from a different input
+/// with the same key.
+fn parse(mut bytes: &[u8], input: &CacheInput) -> anyhow::Result<Option<RoutingInfo<u32>>> {
+    if take(&mut bytes, MAGIC.len())? != MAGIC {
+        anyhow::bail!("Unknown file format");
+    }
+    if u64::from_le_bytes(take(&mut bytes, 8)?.try_into().unwrap()) != input.key() {
+        anyhow::bail!("Cache key mismatch");
+    }
+
+    // a file with the same key may still have been computed from a different input
+    let header = input.header();
+    let Some(rest) = bytes
+        .strip_prefix(&header[..])
+        .and_then(|x| x.strip_prefix(input.graph_text.as_bytes()))
+    else {
+        return Ok(None);
+    };
+    bytes = rest;
+
+    let mut next = |len: usize| take(&mut bytes, len);
+
+    let num_nodes: usize = u64::from_le_bytes(next(8)?.try_into().unwrap()).try_into()?;
+
+    let nodes = next(
+        num_nodes
+            .checked_mul(size_of::<u32>())
+            .context("Too many nodes")?,
+    )?
+    .chunks_exact(size_of::<u32>())
+    .map(|x| u32::from_le_bytes(x.try_into().unwrap()))
+    .collect();
+
+    let num_paths = num_nodes.checked_mul(num_nodes).context("Too many nodes")?;
+    let paths = next(num_paths.checked_mul(PATH_SIZE).context("Too many nodes")?)?
+        .chunks_exact(PATH_SIZE)
+        .map(|x| {
+            let (latency, loss) = x.split_at(size_of::<u64>());
+            PathProperties {
+                latency_ns: u64::from_le_bytes(latency.try_into().unwrap()),
+                packet_loss: f32::from_le_bytes(loss.try_into().unwrap()),
+            }
+        })
+        .collect();
+
+    if !bytes.is_empty() {
+        anyhow::bail!("Unexpected data at the end of the file");
+    }
+
+    Ok(Some(RoutingInfo::from_matrix(nodes, paths)))
+}
+
+/// Write the routing info computed from the given input to the cache directory. Does nothing if
+/// the routing info's paths are computed lazily.
+pub fn store(
+    dir: &Path,
+    input: &CacheInput,
+    routing_info: &RoutingInfo<u32>,
+) -> anyhow::Result<()> {
+    let Some((nodes, paths)) = routing_info.matrix() else {
+        return Ok(());
+    };
+
+    let key = input.key();
+    let header = input.header();
+
+    let mut bytes = Vec::with_capacity(
+        MAGIC.len()
+            + 16
+            + header.len()
+            + input.graph_text.len()
+            + nodes.len() * size_of::<u32>()
+            + paths.len() * PATH_SIZE,
+    );
+    bytes.extend_from_slice(&MAGIC);
+    bytes.extend_from_slice(&key.to_le_bytes());
+    bytes.extend_from_slice(&header);
+    bytes.extend_from_slice(input.graph_text.as_bytes());
+    bytes.extend_from_slice(&u64::try_from(nodes.len()).unwrap().to_le_bytes());
+    for node in &nodes {
+        bytes.extend_from_slice(&node.to_le_bytes());
+    }
+    for path in paths {
+        bytes.extend_from_slice(&path.latency_ns.to_le_bytes());
+        bytes.extend_from_slice(&path.packet_loss.to_le_bytes());
+    }
+
+    std::fs::create_dir_all(dir).with_context(|| format!("Failed to create {dir:?}"))?;
+
+    // write to a temporary file and rename it so that concurrent simulations never see a partial
+    // file
+    let mut file = tempfile::NamedTempFile::new_in(dir)
+        .with_context(|| format!("Failed to create a temporary file in {dir:?}"))?;
+    file.write_all(&bytes)?;
+    let path = cache_file(dir, key);
+    file.persist(&path)
+        .with_context(|| format!("Failed to write {path:?}"))?;
+
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use std::collections::HashMap;
+
+    use super::*;
+
+    #[test]
+    fn test_store_load() {
+        let dir = tempfile::tempdir().unwrap();
+
+        let path = |latency_ns, packet_loss| PathProperties {
+            latency_ns,
+            packet_loss,
+        };
+        let paths = HashMap::from([
+            ((3, 3), path(1, 0.0)),
+            ((3, 7), path(2, 0.5)),
+            ((7, 3), path(3, 0.25)),
+            ((7, 7), path(4, 1.0)),
+        ]);
+        let routing_info = RoutingInfo::new(paths.clone());
+
+        let input = CacheInput::new("graph", &[7, 3], true);
+        let key = input.key();
+        assert_eq!(key, CacheInput::new("graph", &[3, 7], true).key());
+        assert_ne!(key, CacheInput::new("graph", &[3, 7], false).key());
+        assert_ne!(key, CacheInput::new("graph2", &[3, 7], true).key());
+
+        assert!(load(dir.path(), &input).unwrap().is_none());
+        store(dir.path(), &input, &routing_info).unwrap();
+        let loaded = load(dir.path(), &input).unwrap().unwrap();
+
+        for ((src, dst), path) in paths {
+            assert_eq!(loaded.path(src, dst), Some(path));
+        }
+
+        // a file with the wrong key is rejected
+        let other = CacheInput::new("graph", &[3, 7, 9], true);
+        std::fs::rename(
+            cache_file(dir.path(), key),
+            cache_file(dir.path(), other.key()),
+        )
+        .unwrap();
+        assert!(load(dir.path(), &other).is_err());
+
+        // a file with the right key but a different input (a hash collision) is a cache miss
+        let mut bytes = std::fs::read(cache_file(dir.path(), other.key())).unwrap();
+        bytes[MAGIC.len()..][..8].copy_from_slice(&other.key().to_le_bytes());
+        assert!(parse(&bytes, &other).unwrap().is_none());
+        assert!(parse(&bytes, &input).is_err());
+    }
+}
@@ -0,0 +1,445 @@
+//! Scheduled changes to the edges of the network graph, and the changes to the paths between the
+//! nodes in use that they cause.
+//!
+//! The paths after each change are computed before the simulation starts. After a change, only the
+//! paths from source nodes that the changed edges could affect are recomputed. When following
+//! shortest paths, a source is affected if a changed edge was on one of its shortest paths (its
+//! old weight was tight), or if the edge's new weight gives a shorter path to the edge's target.
+//! For each source, only the distances to the nodes in use and to the endpoints of updated edges
+//! are kept.
+//!
+//! While there's no path from one node to another, packets between them are dropped, as if the
+//! path had a packet loss of 1.
+
+use std::collections::{HashMap, HashSet};
+
+use petgraph::graph::NodeIndex;
+use rayon::iter::{IntoParallelIterator, IntoParallelRefIterator, ParallelIterator};
+
+use super::petgraph_wrapper::GraphWrapper;
+use super::{NetGraphError, NetworkGraph, PathProperties, ShadowEdge};
+use crate::utility::units;
+
+/// A change to the edge between two graph nodes.
+#[derive(Debug, Clone)]
+pub struct EdgeUpdate {
+    /// The time of the change, in nanoseconds since the start of the simulation.
+    pub time_ns: u64,
+    /// The GML id of the edge's source node.
+    pub source: u32,
+    /// The GML id of the edge's target node.
+    pub target: u32,
+    /// The new latency of the edge, if it changes. Must not be 0.
+    pub latency: Option<units::Time<units::TimePrefix>>,
+    /// The new packet loss of the edge, if it changes.
+    pub packet_loss: Option<f32>,
+    /// Whether the edge is up or down after the change, if it changes.
+    pub up: Option<bool>,
+}
+
+/// The paths from a node to every node in use, from a time until the next update of the paths
+/// from the same node.
+#[derive(Debug)]
+pub struct PathUpdate {
+    /// The time of the change, in nanoseconds since the start of the simulation.
+    pub time_ns: u64,
+    pub src: NodeIndex,
+    pub paths: HashMap<NodeIndex, PathProperties>,
+}
+
+/// A change to the weight of the edge from `src` to `dst`. A weight of `None` means that the edge
+/// is down.
+#[derive(Debug)]
+struct EdgeChange {
+    src: NodeIndex,
+    dst: NodeIndex,
+    old: Option<PathProperties>,
+    new: Option<PathProperties>,
+}
+
+/// Compute the paths between every pair of `nodes` at the start of the simulation (as a row-major
+/// matrix in the order of `nodes`), and the paths from each node that change after each of the
+/// `updates`. The updates are applied to `graph`.
+/// Returns an error if an update refers to an edge that doesn't exist, or if a path is missing at
+/// the start of the simulation.
+pub fn compute_path_updates(
+    graph: &mut NetworkGraph,
+    nodes: &[NodeIndex],
+    updates: &[EdgeUpdate],
+    use_shortest_paths: bool,
+) -> Result<(Vec<PathProperties>, Vec<PathUpdate>), NetGraphError> {
+    let mut updates = updates.to_vec();
+    // a stable sort, so that updates at the same time are applied in order
+    updates.sort_by_key(|x| x.time_ns);
+
+    // the nodes that we need the distances to, to decide if an update affects a source node
+    let mut dist_nodes: HashSet<NodeIndex> = nodes.iter().copied().collect();
+    for update in &updates {
+        for id in [update.source, update.target] {
+            let node = graph
+                .node_id_to_index(id)
+                .ok_or(format!("Graph update node {id} doesn't exist"))?;
+            dist_nodes.insert(*node);
+        }
+    }
+
+    let mut dists: Vec<HashMap<NodeIndex, PathProperties>> = if use_shortest_paths {
+        nodes
+            .par_iter()
+            .map(|src| graph.shortest_distances_from(*src, &dist_nodes))
+            .collect()
+    } else {
+        Vec::new()
+    };
+
+    let mut rows: Vec<HashMap<NodeIndex, PathProperties>> = (0..nodes.len())
+        .into_par_iter()
+        .map(|i| paths_from(graph, nodes, i, dists.get(i), None))
+        .collect::<Result<_, _>>()?;
+
+    let initial = rows
+        .iter()
+        .flat_map(|row| nodes.iter().map(|dst| row[dst]))
+        .collect();
+
+    let mut down_edges = HashMap::new();
+    let mut path_updates = Vec::new();
+
+    for group in updates.chunk_by(|a, b| a.time_ns == b.time_ns) {
+        let mut changes = Vec::new();
+        for update in group {
+            changes.extend(apply_update(graph, update, &mut down_edges)?);
+        }
+
+        let graph = &*graph;
+        let affected: Vec<usize> = (0..nodes.len())
+            .filter(|i| {
+                changes.iter().any(|change| match use_shortest_paths {
+                    true => affects(&dists[*i], nodes[*i], change),
+                    false => change.src == nodes[*i],
+                })
+            })
+            .collect();
+
+        let recomputed: Vec<_> = affected
+            .into_par_iter()
+            .map(|i| {
+                let new_dists = use_shortest_paths
+                    .then(|| graph.shortest_distances_from(nodes[i], &dist_nodes));
+                let row = paths_from(graph, nodes, i, new_dists.as_ref(), Some(&rows[i]))?;
+                Ok::<_, NetGraphError>((i, new_dists, row))
+            })
+            .collect::<Result<_, _>>()?;
+
+        for (i, new_dists, row) in recomputed {
+            if let Some(new_dists) = new_dists {
+                dists[i] = new_dists;
+            }
+            if row != rows[i] {
+                path_updates.push(PathUpdate {
+                    time_ns: group[0].time_ns,
+                    src: nodes[i],
+                    paths: row.clone(),
+                });
+                rows[i] = row;
+            }
+        }
+    }
+
+    Ok((initial, path_updates))
+}
+
+/// Apply the update to the graph. Edges that are down are removed from the graph and kept in
+/// `down_edges`. Returns the changes to the weights of the directed edges.
+fn apply_update(
+    graph: &mut NetworkGraph,
+    update: &EdgeUpdate,
+    down_edges: &mut HashMap<(NodeIndex, NodeIndex), ShadowEdge>,
+) -> Result<Vec<EdgeChange>, NetGraphError> {
+    let src = *graph.node_id_to_index(update.source).unwrap();
+    let dst = *graph.node_id_to_index(update.target).unwrap();
+    let directed = matches!(graph.graph, GraphWrapper::Directed(_));
+
+    // an undirected edge can be given in either direction
+    let key = if directed || src <= dst {
+        (src, dst)
+    } else {
+        (dst, src)
+    };
+
+    let (mut edge, was_up) = match down_edges.remove(&key) {
+        Some(edge) => (edge, false),
+        None => {
+            let index = graph.get_edge(src, dst)?;
+            (graph.graph.remove_edge(index).unwrap(), true)
+        }
+    };
+    let old = was_up.then(|| PathProperties::from(&edge));
+
+    if let Some(latency) = update.latency {
+        edge.latency = latency;
+    }
+    if let Some(packet_loss) = update.packet_loss {
+        edge.packet_loss = packet_loss;
+    }
+
+    let is_up = update.up.unwrap_or(was_up);
+    if !is_up && src == dst {
+        return Err(format!("The self-loop of node {} can't be down", update.source).into());
+    }
+    let new = is_up.then(|| PathProperties::from(&edge));
+
+    if is_up {
+        graph.graph.add_edge(key.0, key.1, edge);
+    } else {
+        down_edges.insert(key, edge);
+    }
+
+    let mut changes = vec![EdgeChange { src, dst, old, new }];
+    if !directed && src != dst {
+        changes.push(EdgeChange {
+            src: dst,
+            dst: src,
+            old,
+            new,
+        });
+    }
+    Ok(changes)
+}
+
+/// Could the change affect the shortest paths from `src`, given the distances from `src` before
+/// the change?
+fn affects(
+    dists: &HashMap<NodeIndex, PathProperties>,
+    src: NodeIndex,
+    change: &EdgeChange,
+) -> bool {
+    // a self-loop is only used for the path from its node to itself
+    if change.src == change.dst {
+        return change.src == src;
+    }
+
+    // if the edge's source wasn't reachable, the edge can only be on a new shortest path after
+    // another changed edge, which is checked separately
+    let Some(to_edge) = dists.get(&change.src) else {
+        return false;
+    };
+    let to_dst = dists.get(&change.dst);
+
+    let was_tight = change
+        .old
+        .is_some_and(|old| to_dst.is_some_and(|x| *to_edge + old == *x));
+    let is_shorter = change
+        .new
+        .is_some_and(|new| to_dst.is_none_or(|x| *to_edge + new < *x));
+    was_tight || is_shorter
+}
+
+/// The paths from `nodes[i]` to every node in `nodes`, using the shortest distances `dists` if
+/// given, or otherwise the direct edges. A node that can't be reached is given the latency of its
+/// path in `prev_paths` and a packet loss of 1, or is an error if there are no previous paths.
+fn paths_from(
+    graph: &NetworkGraph,
+    nodes: &[NodeIndex],
+    i: usize,
+    dists: Option<&HashMap<NodeIndex, PathProperties>>,
+    prev_paths: Option<&HashMap<NodeIndex, PathProperties>>,
+) -> Result<HashMap<NodeIndex, PathProperties>, NetGraphError> {
+    let src = nodes[i];
+
+    nodes
+        .iter()
+        .map(|dst| {
+            let path = match dists {
+                // the path from a node to itself is its self-loop
+                Some(dists) if *dst != src => dists.get(dst).copied(),
+                _ => graph
+                    .get_edge_weight(&src, dst)
+                    .ok()
+                    .map(PathProperties::from),
+            };
+
+            let path = match (path, prev_paths) {
+                (Some(path), _) => path,
+                (None, Some(prev_paths)) => PathProperties {
+                    latency_ns: prev_paths[dst].latency_ns,
+                    packet_loss: 1.0,
+                },
+                (None, None) => {
+                    return Err(NetGraphError::from(format!(
+                        "No path from node {} to {}",
+                        graph.node_index_to_id(src).unwrap(),
+                        graph.node_index_to_id(*dst).unwrap(),
+                    )));
+                }
+            };
+            Ok((*dst, path))
+        })
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn update(time_ns: u64, source: u32, target: u32) -> EdgeUpdate {
+        EdgeUpdate {
+            time_ns,
+            source,
+            target,
+            latency: None,
+            packet_loss: None,
+            up: None,
+        }
+    }
+
+    fn ms(x: u64) -> Option<units::Time<units::TimePrefix>> {
+        Some(units::Time::new(x, units::TimePrefix::Milli))
+    }
+
+    #[test]
+    fn test_shortest_path_updates() {
+        // a line 0 - 1 - 2, with a slow direct edge 0 - 2, and node 3 off to the side of node 2
+        let graph_text = r#"graph [
+            node [ id 0 ]
+            node [ id 1 ]
+            node [ id 2 ]
+            node [ id 3 ]
+            edge [ source 0 target 0 latency "1 ms" ]
+            edge [ source 2 target 2 latency "1 ms" ]
+            edge [ source 3 target 3 latency "1 ms" ]
+            edge [ source 0 target 1 latency "10 ms" ]
+            edge [ source 1 target 2 latency "10 ms" ]
+            edge [ source 0 target 2 latency "50 ms" ]
+            edge [ source 2 target 3 latency "5 ms" ]
+        ]"#;
+        let mut graph = NetworkGraph::parse(graph_text).unwrap();
+        let node = |id| *graph.node_id_to_index(id).unwrap();
+        let (n0, n2, n3) = (node(0), node(2), node(3));
+
+        let updates = [
+            // the 0 - 1 edge goes down, so 0 - 2 uses the direct edge
+            EdgeUpdate {
+                up: Some(false),
+                ..update(2_000, 0, 1)
+            },
+            // an edge between other nodes doesn't change any path
+            EdgeUpdate {
+                latency: ms(100),
+                ..update(1_000, 0, 2)
+            },
+            // the 0 - 1 edge comes back up with a lower latency
+            EdgeUpdate {
+                up: Some(true),
+                latency: ms(1),
+                ..update(3_000, 1, 0)
+            },
+            // node 3 is only affected by its own self-loop
+            EdgeUpdate {
+                latency: ms(2),
+                ..update(3_000, 3, 3)
+            },
+        ];
+
+        let (initial, path_updates) =
+            compute_path_updates(&mut graph, &[n0, n2, n3], &updates, true).unwrap();
+
+        let latency = |paths: &HashMap<_, PathProperties>, dst| paths[&dst].latency_ns / 1_000_000;
+        // the paths between nodes 0, 2, and 3, in that order
+        assert_eq!(initial.len(), 9);
+        assert_eq!(initial[1].latency_ns, 20_000_000);
+        assert_eq!(initial[2].latency_ns, 25_000_000);
+        assert_eq!(initial[8].latency_ns, 1_000_000);
+
+        // at 1000, the 0 - 2 edge isn't on any shortest path
+        let times: Vec<_> = path_updates.iter().map(|x| (x.time_ns, x.src)).collect();
+        assert_eq!(
+            times,
+            [
+                (2_000, n0),
+                (2_000, n2),
+                (2_000, n3),
+                (3_000, n0),
+                (3_000, n2),
+                (3_000, n3),
+            ]
+        );
+
+        assert_eq!(latency(&path_updates[0].paths, n2), 100);
+        assert_eq!(latency(&path_updates[1].paths, n0), 100);
+        assert_eq!(latency(&path_updates[2].paths, n0), 105);
+        assert_eq!(latency(&path_updates[3].paths, n2), 11);
+        assert_eq!(latency(&path_updates[4].paths, n0), 11);
+        assert_eq!(latency(&path_updates[5].paths, n0), 16);
+        assert_eq!(latency(&path_updates[5].paths, n3), 2);
+    }
+
+    #[test]
+    fn test_unreachable() {
+        let graph_text = r#"graph [
+            directed 1
+            node [ id 0 ]
+            node [ id 1 ]
+            edge [ source 0 target 0 latency "1 ms" ]
+            edge [ source 1 target 1 latency "1 ms" ]
+            edge [ source 0 target 1 latency "10 ms" ]
+            edge [ source 1 target 0 latency "10 ms" ]
+        ]"#;
+
+        for use_shortest_paths in [true, false] {
+            let mut graph = NetworkGraph::parse(graph_text).unwrap();
+            let n0 = *graph.node_id_to_index(0).unwrap();
+            let n1 = *graph.node_id_to_index(1).unwrap();
+
+            let updates = [
+                EdgeUpdate {
+                    up: Some(false),
+                    ..update(1_000, 0, 1)
+                },
+                EdgeUpdate {
+                    up: Some(true),
+                    packet_loss: Some(0.5),
+                    ..update(2_000, 0, 1)
+                },
+            ];
+            let (_, path_updates) =
+                compute_path_updates(&mut graph, &[n0, n1], &updates, use_shortest_paths).unwrap();
+
+            // only paths from the edge's source change in a directed graph
+            assert_eq!(path_updates.len(), 2);
+            assert!(path_updates.iter().all(|x| x.src == n0));
+
+            let down = path_updates[0].paths[&n1];
+            assert_eq!(down.latency_ns, 10_000_000);
+            assert_eq!(down.packet_loss, 1.0);
+            let up = path_updates[1].paths[&n1];
+            assert_eq!(up.packet_loss, 0.5);
+        }
+    }
+
+    #[test]
+    fn test_invalid_updates() {
+        let graph_text = r#"graph [
+            node [ id 0 ]
+            node [ id 1 ]
+            edge [ source 0 target 0 latency "1 ms" ]
+            edge [ source 1 target 1 latency "1 ms" ]
+            edge [ source 0 target 1 latency "10 ms" ]
+        ]"#;
+        let mut graph = NetworkGraph::parse(graph_text).unwrap();
+        let nodes = [
+            *graph.node_id_to_index(0).unwrap(),
+            *graph.node_id_to_index(1).unwrap(),
+        ];
+
+        // no such node
+        assert!(compute_path_updates(&mut graph, &nodes, &[update(1, 0, 2)], true).is_err());
+
+        let mut graph = NetworkGraph::parse(graph_text).unwrap();
+        let down = EdgeUpdate {
+            up: Some(false),
+            ..update(1, 1, 1)
+        };
+        assert!(compute_path_updates(&mut graph, &nodes, &[down], true).is_err());
+    }
+}
@@ -0,0 +1,359 @@
+//! Decompression of xz files. Files with more than one block (for example those compressed with
+//! `xz -T0`) have their blocks decompressed in parallel, since each block is an independent LZMA2
+//! stream. Files that use features we don't handle here (single blocks, multiple streams, filters
+//! other than LZMA2, or SHA-256 checks) are decompressed serially by `lzma_rs`.
+//!
+//! See the [xz file format specification](https://tukaani.org/xz/xz-file-format.txt).
+
+use anyhow::Context;
+use rayon::iter::{IndexedParallelIterator, IntoParallelIterator, ParallelIterator};
+
+const HEADER_MAGIC: [u8; 6] = [0xFD, b'7', b'z', b'X', b'Z', 0x00];
+const FOOTER_MAGIC: [u8; 2] = [b'Y', b'Z'];
+const STREAM_HEADER_SIZE: usize = 12;
+const STREAM_FOOTER_SIZE: usize = 12;
+const FILTER_ID_LZMA2: u64 = 0x21;
+
+/// The integrity check of each block.
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+enum Check {
+    None,
+    Crc32,
+    Crc64,
+}
+
+impl Check {
+    fn from_flags(flags: [u8; 2]) -> Option<Self> {
+        match flags {
+            [0, 0x00] => Some(Self::None),
+            [0, 0x01] => Some(Self::Crc32),
+            [0, 0x04] => Some(Self::Crc64),
+            _ => None,
+        }
+    }
+
+    fn size(&self) -> usize {
+        match self {
+            Self::None => 0,
+            Self::Crc32 => 4,
+            Self::Crc64 => 8,
+        }
+    }
+
+    fn verify(&self, data: &[u8], expected: &[u8]) -> bool {
+        match self {
+            Self::None => true,
+            Self::Crc32 => crc32(data).to_le_bytes() == expected,
+            Self::Crc64 => crc64(data).to_le_bytes() == expected,
+        }
+    }
+}
+
+/// A block's LZMA2 data and where its output goes in the decompressed file.
+#[derive(Debug)]
+struct Block<'a> {
+    compressed: &'a [u8],
+    check: &'a [u8],
+    uncompressed_size: usize,
+}
+
+/// Decompress an xz file.
+pub fn decompress(data: &[u8]) -> anyhow::Result<Vec<u8>> {
+    match parse_blocks(data) {
+        Some((check, blocks)) if blocks.len() > 1 => decompress_blocks(check, &blocks),
+        _ => {
+            let mut decomp = Vec::new();
+            lzma_rs::xz_decompress(&mut &data[..], &mut decomp)
+                .context("Failed to decompress file")?;
+            decomp.shrink_to_fit();
+            Ok(decomp)
+        }
+    }
+}
+
+fn decompress_blocks(check: Check, blocks: &[Block]) -> anyhow::Result<Vec<u8>> {
+    let total_size = blocks
+        .iter()
+        .try_fold(0usize, |acc, x| acc.checked_add(x.uncompressed_size))
+        .context("Decompressed file is too large")?;
+
+    // split the output into a separate slice for each block so that blocks can be decompressed
+    // directly into the output
+    let mut decomp = vec![0u8; total_size];
+    let mut outputs = Vec::with_capacity(blocks.len());
+    let mut remaining = &mut decomp[..];
+    for block in blocks {
+        let (output, rest) = remaining.split_at_mut(block.uncompressed_size);
+        outputs.push(output);
+        remaining = rest;
+    }
+
+    blocks
+        .into_par_iter()
+        .zip(outputs)
+        .enumerate()
+        .try_for_each(|(i, (block, output))| {
+            let mut writer = &mut output[..];
+            lzma_rs::lzma2_decompress(&mut &block.compressed[..], &mut writer)
+                .with_context(|| format!("Failed to decompress block {i}"))?;
+            anyhow::ensure!(writer.is_empty(), "Block {i} is shorter than expected");
+            anyhow::ensure!(
+                check.verify(output, block.check),
+                "Block {i} failed its integrity check"
+            );
+            Ok(())
+        })?;
+
+    Ok(decomp)
+}
+
+/// Find the blocks of a single-stream xz file using the stream's index. Returns `None` if the file
+/// uses a feature that isn't supported for parallel decompression, or appears invalid (in which
+/// case the serial decompressor will report the error).
+fn parse_blocks(data: &[u8]) -> Option<(Check, Vec<Block<'_>>)> {
+    let header = data.get(..STREAM_HEADER_SIZE)?;
+    if header[..6] != HEADER_MAGIC {
+        return None;
+    }
+    let flags: [u8; 2] = header[6..8].try_into().unwrap();
+    if crc32(&flags).to_le_bytes() != header[8..12] {
+        return None;
+    }
+    let check = Check::from_flags(flags)?;
+
+    let footer = data.get(data.len().checked_sub(STREAM_FOOTER_SIZE)?..)?;
+    if footer[10..12] != FOOTER_MAGIC || footer[8..10] != flags {
+        return None;
+    }
+    if crc32(&footer[4..10]).to_le_bytes() != footer[..4] {
+        return None;
+    }
+
+    // the index immediately precedes the footer; if it doesn't end up immediately after the last
+    // block, the file has multiple streams or stream padding
+    let backward_size = u32::from_le_bytes(footer[4..8].try_into().unwrap());
+    let index_size = (usize::try_from(backward_size).ok()? + 1) * 4;
+    let index_start = data
+        .len()
+        .checked_sub(STREAM_FOOTER_SIZE)?
+        .checked_sub(index_size)?;
+    let index = data.get(index_start..data.len() - STREAM_FOOTER_SIZE)?;
+    let records = parse_index(index)?;
+
+    let mut blocks = Vec::with_capacity(records.len());
+    let mut offset = STREAM_HEADER_SIZE;
+    for (unpadded_size, uncompressed_size) in records {
+        let block_size = unpadded_size.checked_next_multiple_of(4)?;
+        let block = data.get(offset..offset.checked_add(block_size)?)?;
+        offset += block_size;
+
+        let header_size = parse_block_header(block)?;
+        let compressed_size = unpadded_size
+            .checked_sub(header_size)?
+            .checked_sub(check.size())?;
+        let check_start = block_size - check.size();
+
+        blocks.push(Block {
+            compressed: &block[header_size..header_size + compressed_size],
+            check: &block[check_start..],
+            uncompressed_size,
+        });
+    }
+
+    if offset != index_start {
+        return None;
+    }
+
+    Some((check, blocks))
+}
+
+/// Parse the index, returning the unpadded size and uncompressed size of each block.
+fn parse_index(index: &[u8]) -> Option<Vec<(usize, usize)>> {
+    let (body, crc) = index.split_at(index.len().checked_sub(4)?);
+    if crc32(body).to_le_bytes() != crc {
+        return None;
+    }
+
+    let mut input = body;
+    if read_byte(&mut input)? != 0x00 {
+        return None;
+    }
+
+    let num_records = read_varint(&mut input)?;
+    let mut records = Vec::new();
+    for _ in 0..num_records {
+        let unpadded_size = usize::try_from(read_varint(&mut input)?).ok()?;
+        let uncompressed_size = usize::try_from(read_varint(&mut input)?).ok()?;
+        records.push((unpadded_size, uncompressed_size));
+    }
+
+    // only zero padding may remain
+    if input.len() >= 4 || input.iter().any(|x| *x != 0) {
+        return None;
+    }
+
+    Some(records)
+}
+
+/// Parse a block header, returning the header's size. Returns `None` if the block uses any filter
+/// other than a single LZMA2 filter.
+fn parse_block_header(block: &[u8]) -> Option<usize> {
+    let header_size = (usize::from(*block.first()?) + 1) * 4;
+    if block[0] == 0 {
+        // this is the index indicator, not a block header
+        return None;
+    }
+    let header = block.get(..header_size)?;
+    let (body, crc) = header.split_at(header_size - 4);
+    if crc32(body).to_le_bytes() != crc {
+        return None;
+    }
+
+    let mut input = &body[1..];
+    let flags = read_byte(&mut input)?;
+    let num_filters = (flags & 0x03) + 1;
+    if flags & 0x3C != 0 || num_filters != 1 {
+        return None;
+    }
+    if flags & 0x40 != 0 {
+        // compressed size; we use the index instead
+        read_varint(&mut input)?;
+    }
+    if flags & 0x80 != 0 {
+        // uncompressed size; we use the index instead
+        read_varint(&mut input)?;
+    }
+
+    let filter_id = read_varint(&mut input)?;
+    let props_size = read_varint(&mut input)?;
+    if filter_id != FILTER_ID_LZMA2 || props_size != 1 {
+        return None;
+    }
+
+    Some(header_size)
+}
+
+fn read_byte(input: &mut &[u8]) -> Option<u8> {
+    let (x, rest) = input.split_first()?;
+    *input = rest;
+    Some(*x)
+}
+
+/// Read a variable-length integer (up to 9 bytes, 7 bits per byte, least significant first).
+fn read_varint(input: &mut &[u8]) -> Option<u64> {
+    let mut value = 0u64;
+    for i in 0..9 {
+        let byte = read_byte(input)?;
+        value |= u64::from(byte & 0x7F) << (i * 7);
+        if byte & 0x80 == 0 {
+            // the encoding must be minimal
+            if i > 0 && byte == 0 {
+                return None;
+            }
+            return Some(value);
+        }
+    }
+    None
+}
+
+/// The lookup table for a reflected CRC with the given (reflected) polynomial.
+const fn crc_table(poly: u64, bits: u32) -> [u64; 256] {
+    let mut table = [0u64; 256];
+    let mut i = 0;
+    while i < 256 {
+        let mut crc = i as u64;
+        let mut j = 0;
+        while j < 8 {
+            crc = if crc & 1 != 0 {
+                (crc >> 1) ^ poly
+            } else {
+                crc >> 1
+            };
+            j += 1;
+        }
+        table[i] = crc & (u64::MAX >> (64 - bits));
+        i += 1;
+    }
+    table
+}
+
+static CRC32_TABLE: [u64; 256] = crc_table(0xEDB88320, 32);
+static CRC64_TABLE: [u64; 256] = crc_table(0xC96C5795D7870F42, 64);
+
+fn crc(table: &[u64; 256], init: u64, data: &[u8]) -> u64 {
+    let mut crc = init;
+    for byte in data {
+        crc = table[usize::from(crc as u8 ^ byte)] ^ (crc >> 8);
+    }
+    !crc & init
+}
+
+fn crc32(data: &[u8]) -> u32 {
+    crc(&CRC32_TABLE, u32::MAX.into(), data) as u32
+}
+
+fn crc64(data: &[u8]) -> u64 {
+    crc(&CRC64_TABLE, u64::MAX, data)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_crc() {
+        assert_eq!(crc32(b"123456789"), 0xCBF43926);
+        assert_eq!(crc64(b"123456789"), 0x995DC9BBDF1939FA);
+    }
+
+    #[test]
+    fn test_varint() {
+        let mut input: &[u8] = &[0x00, 0x7F, 0x80, 0x01, 0xFF, 0xFF, 0x03];
+        assert_eq!(read_varint(&mut input), Some(0));
+        assert_eq!(read_varint(&mut input), Some(127));
+        assert_eq!(read_varint(&mut input), Some(128));
+        assert_eq!(read_varint(&mut input), Some(0xFFFF));
+        assert!(input.is_empty());
+
+        // not minimally encoded
+        assert_eq!(read_varint(&mut &[0x80, 0x00][..]), None);
+    }
+
+    #[test]
+    fn test_multi_block() {
+        // "node 0\nnode 1\nnode 2\n" compressed with `xz -T2 --block-size=7`
+        let compressed = [
+            0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x04, 0xe6, 0xd6, 0xb4, 0x46, 0x02, 0xc0,
+            0x0b, 0x07, 0x21, 0x01, 0x16, 0x00, 0xf7, 0x7c, 0x29, 0x36, 0x01, 0x00, 0x06, 0x6e,
+            0x6f, 0x64, 0x65, 0x20, 0x30, 0x0a, 0x00, 0x00, 0xf4, 0x15, 0x33, 0x93, 0x98, 0xa0,
+            0xad, 0x19, 0x02, 0xc0, 0x0b, 0x07, 0x21, 0x01, 0x16, 0x00, 0xf7, 0x7c, 0x29, 0x36,
+            0x01, 0x00, 0x06, 0x6e, 0x6f, 0x64, 0x65, 0x20, 0x31, 0x0a, 0x00, 0x00, 0xf9, 0xe4,
+            0xe3, 0xcf, 0x0a, 0xd9, 0x44, 0x4d, 0x02, 0xc0, 0x0b, 0x07, 0x21, 0x01, 0x16, 0x00,
+            0xf7, 0x7c, 0x29, 0x36, 0x01, 0x00, 0x06, 0x6e, 0x6f, 0x64, 0x65, 0x20, 0x32, 0x0a,
+            0x00, 0x00, 0xee, 0xf7, 0x92, 0x2a, 0xbc, 0x53, 0x7f, 0xb0, 0x00, 0x03, 0x1f, 0x07,
+            0x1f, 0x07, 0x1f, 0x07, 0xdb, 0x63, 0x61, 0x4a, 0xb1, 0xc4, 0x67, 0xfb, 0x02, 0x00,
+            0x00, 0x00, 0x00, 0x04, 0x59, 0x5a,
+        ];
+
+        let (check, blocks) = parse_blocks(&compressed).unwrap();
+        assert_eq!(check, Check::Crc64);
+        assert_eq!(blocks.len(), 3);
+
+        assert_eq!(
+            decompress(&compressed).unwrap(),
+            b"node 0\nnode 1\nnode 2\n"
+        );
+
+        // a corrupted check is detected
+        let mut corrupted = compressed;
+        corrupted[40] ^= 0x01;
+        decompress(&corrupted).unwrap_err();
+    }
+
+    #[test]
+    fn test_single_block() {
+        let mut compressed = Vec::new();
+        lzma_rs::xz_compress(&mut &b"hello world"[..], &mut compressed).unwrap();
+        assert_eq!(decompress(&compressed).unwrap(), b"hello world");
+    }
+}
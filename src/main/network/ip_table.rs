@@ -0,0 +1,110 @@
+use std::net::Ipv4Addr;
+
+/// A table at the second or third level, indexed by 8 bits of the address.
+type Level<T> = [T; 256];
+
+/// A map from IPv4 addresses to values.
+///
+/// The addresses are stored in a three-level radix table indexed by the address's upper 16 bits,
+/// next 8 bits, and lower 8 bits, so that a lookup is three array accesses rather than hashing the
+/// address. Lower levels are only allocated when an address in their range is inserted, so
+/// addresses that are close together (such as those assigned automatically to hosts) share
+/// tables.
+#[derive(Debug)]
+pub struct Ipv4Table<V: Copy> {
+    root: Vec<Option<Box<Level<Option<Box<Level<Option<V>>>>>>>>,
+    len: usize,
+}
+
+impl<V: Copy> Ipv4Table<V> {
+    pub fn new() -> Self {
+        Self {
+            root: (0..1 << 16).map(|_| None).collect(),
+            len: 0,
+        }
+    }
+
+    fn indices(addr: Ipv4Addr) -> (usize, usize, usize) {
+        let addr = u32::from(addr);
+        (
+            (addr >> 16) as usize,
+            ((addr >> 8) & 0xFF) as usize,
+            (addr & 0xFF) as usize,
+        )
+    }
+
+    /// Insert a value for the address, returning the previous value if there was one.
+    pub fn insert(&mut self, addr: Ipv4Addr, value: V) -> Option<V> {
+        let (i, j, k) = Self::indices(addr);
+
+        let level_2 = self.root[i].get_or_insert_with(|| Box::new(std::array::from_fn(|_| None)));
+        let level_3 = level_2[j].get_or_insert_with(|| Box::new([None; 256]));
+
+        let old = level_3[k].replace(value);
+        if old.is_none() {
+            self.len += 1;
+        }
+        old
+    }
+
+    pub fn get(&self, addr: Ipv4Addr) -> Option<V> {
+        let (i, j, k) = Self::indices(addr);
+        self.root[i].as_ref()?[j].as_ref()?[k]
+    }
+
+    pub fn contains(&self, addr: Ipv4Addr) -> bool {
+        self.get(addr).is_some()
+    }
+
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+}
+
+impl<V: Copy> Default for Ipv4Table<V> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_insert_get() {
+        let mut table = Ipv4Table::new();
+        assert!(table.is_empty());
+
+        let addrs = [
+            Ipv4Addr::new(11, 0, 0, 1),
+            Ipv4Addr::new(11, 0, 0, 2),
+            Ipv4Addr::new(11, 0, 1, 1),
+            Ipv4Addr::new(192, 168, 0, 1),
+            Ipv4Addr::new(0, 0, 0, 0),
+            Ipv4Addr::new(255, 255, 255, 255),
+        ];
+
+        for (i, addr) in addrs.iter().enumerate() {
+            assert_eq!(table.insert(*addr, i), None);
+        }
+        assert_eq!(table.len(), addrs.len());
+
+        for (i, addr) in addrs.iter().enumerate() {
+            assert_eq!(table.get(*addr), Some(i));
+        }
+
+        assert_eq!(table.get(Ipv4Addr::new(11, 0, 0, 3)), None);
+        assert_eq!(table.get(Ipv4Addr::new(11, 0, 2, 1)), None);
+        assert_eq!(table.get(Ipv4Addr::new(12, 0, 0, 1)), None);
+        assert!(!table.contains(Ipv4Addr::new(10, 0, 0, 1)));
+
+        assert_eq!(table.insert(addrs[0], 100), Some(0));
+        assert_eq!(table.get(addrs[0]), Some(100));
+        assert_eq!(table.len(), addrs.len());
+    }
+}
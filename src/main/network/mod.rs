@@ -9,6 +9,7 @@ use crate::network::packet::PacketRc;
 
 pub mod dns;
 pub mod graph;
+pub mod ip_table;
 pub mod packet;
 pub mod relay;
 pub mod router;
@@ -1,5 +1,5 @@
 use std::io::Write;
-use std::mem::MaybeUninit;
+use std::mem::{ManuallyDrop, MaybeUninit};
 use std::net::{IpAddr, SocketAddrV4};
 use std::sync::Arc;
 
@@ -94,7 +94,8 @@ pub enum TypeOfService {
 /// accessed from instances of `PacketRc` too.
 #[derive(Clone, Debug)]
 pub struct PacketRc {
-    inner: Arc<Packet>,
+    // Only taken in `drop()` and `into_raw()`.
+    inner: ManuallyDrop<Arc<Packet>>,
 }
 
 impl PacketRc {
@@ -143,7 +144,7 @@ impl PacketRc {
     pub fn new_copy_inner(&self) -> Self {
         // We want a copy of the inner packet, since cloning the `Arc` wrapper would just increase
         // the reference count.
-        Self::from(self.inner.as_ref().clone())
+        Self::from(self.inner.as_ref().new_copy())
     }
 
     /// Transfers ownership of the given packet_ptr reference into a new `PacketRc` object. The provided
@@ -163,7 +164,7 @@ impl PacketRc {
     pub fn from_raw(packet_ptr: *mut Packet) -> Self {
         assert!(!packet_ptr.is_null());
         Self {
-            inner: unsafe { Arc::from_raw(packet_ptr) },
+            inner: ManuallyDrop::new(unsafe { Arc::from_raw(packet_ptr) }),
         }
     }
 
@@ -182,7 +183,10 @@ impl PacketRc {
     /// This function provides compatibility with the legacy C TCP stack and should be considered
     /// deprecated and removed when the legacy C TCP stack is removed.
     pub fn into_raw(self) -> *mut Packet {
-        Arc::into_raw(self.inner).cast_mut()
+        let mut packet = ManuallyDrop::new(self);
+        // SAFETY: the `PacketRc` is never used or dropped again
+        let inner = unsafe { ManuallyDrop::take(&mut packet.inner) };
+        Arc::into_raw(inner).cast_mut()
     }
 
     /// Borrow a reference that is owned by the C code so that we can temporarily operate on the
@@ -229,11 +233,79 @@ impl PartialEq for PacketRc {
 
 impl Eq for PacketRc {}
 
+impl Drop for PacketRc {
+    fn drop(&mut self) {
+        // SAFETY: `inner` is never used again
+        let inner = unsafe { ManuallyDrop::take(&mut self.inner) };
+        pool::recycle(inner);
+    }
+}
+
 impl From<Packet> for PacketRc {
     fn from(packet: Packet) -> Self {
         Self {
-            inner: Arc::new(packet),
+            inner: ManuallyDrop::new(pool::alloc(packet)),
+        }
+    }
+}
+
+/// A thread-local pool of packet allocations.
+///
+/// Nearly every packet sent in the simulation is allocated, copied when it's sent to another
+/// host, and dropped soon after, so rather than freeing the memory of a packet when its last
+/// [`PacketRc`] is dropped, we keep it for the next packet that is created on the same thread.
+mod pool {
+    use std::cell::RefCell;
+    use std::mem::MaybeUninit;
+    use std::sync::Arc;
+
+    use super::Packet;
+
+    /// The maximum number of unused packet allocations kept by each thread.
+    const CAPACITY: usize = 1024;
+
+    std::thread_local! {
+        static POOL: RefCell<Vec<Arc<MaybeUninit<Packet>>>> = const { RefCell::new(Vec::new()) };
+    }
+
+    /// Move the packet into a new `Arc`, reusing an unused allocation if there is one.
+    pub fn alloc(packet: Packet) -> Arc<Packet> {
+        let unused = POOL.try_with(|pool| pool.borrow_mut().pop()).ok().flatten();
+
+        let Some(mut unused) = unused else {
+            return Arc::new(packet);
+        };
+
+        // the pool only holds allocations with no other references
+        Arc::get_mut(&mut unused).unwrap().write(packet);
+        // SAFETY: we just initialized it
+        unsafe { unused.assume_init() }
+    }
+
+    /// Drop the reference, and if it was the last reference to the packet, drop the packet and
+    /// keep its allocation for reuse.
+    pub fn recycle(mut packet: Arc<Packet>) {
+        if Arc::get_mut(&mut packet).is_none() {
+            // there are other references
+            return;
         }
+
+        // if the thread-local has been destroyed, the packet will be freed when the closure is
+        // dropped
+        let _ = POOL.try_with(move |pool| {
+            if pool.borrow().len() >= CAPACITY {
+                return;
+            }
+
+            let ptr = Arc::into_raw(packet).cast_mut();
+            // SAFETY: we have the only reference, and the packet is never accessed again; the
+            // packet doesn't contain any `PacketRc`s, so this won't recursively use the pool
+            unsafe { ptr.drop_in_place() };
+            // SAFETY: `MaybeUninit<Packet>` has the same size and alignment as `Packet`
+            let unused = unsafe { Arc::from_raw(ptr.cast_const().cast::<MaybeUninit<Packet>>()) };
+
+            pool.borrow_mut().push(unused);
+        });
     }
 }
 
@@ -254,17 +326,18 @@ impl std::ops::Deref for PacketRc {
 /// and payload for TCP, or a UDP header and payload for UDP).
 ///
 /// The `Packet` is designed to be read-only after creation to simplify implementation and to reduce
-/// the need for mutable borrows.
+/// the need for mutable borrows. Since the transport data is read-only, copies of a `Packet` made
+/// with [`Packet::new_copy`] share it, and only the IP header and the metadata are copied.
 ///
 /// # Deprecation
 ///
 /// As an exception to the read-only design, some legacy TCP data is mutable to support the legacy C
 /// TCP stack. When the legacy TCP stack and the `Packet`'s C interface is removed, mutability will
 /// also be removed.
-#[derive(Clone, Debug)]
+#[derive(Debug)]
 pub struct Packet {
     header: Header,
-    data: Data,
+    data: Arc<Data>,
     meta: Metadata,
     _counter: ObjectCounter,
 }
@@ -274,6 +347,10 @@ impl Packet {
     ///
     /// This function is private because we do not expose the inner `Packet` structures.
     fn new(header: Header, data: Data, meta: Metadata) -> Self {
+        Self::new_shared(header, Arc::new(data), meta)
+    }
+
+    fn new_shared(header: Header, data: Arc<Data>, meta: Metadata) -> Self {
         Self {
             header,
             data,
@@ -282,6 +359,20 @@ impl Packet {
         }
     }
 
+    /// Creates a copy of the `Packet` with its own IP header and metadata (such as the packet
+    /// statuses). The transport data is shared with the original packet rather than copied,
+    /// except for legacy TCP data which may still be modified.
+    pub fn new_copy(&self) -> Self {
+        let data = match self.data.as_ref() {
+            Data::LegacyTcp(tcp) => {
+                Arc::new(Data::LegacyTcp(AtomicRefCell::new(tcp.borrow().clone())))
+            }
+            Data::Tcp(_) | Data::Udp(_) => Arc::clone(&self.data),
+        };
+
+        Self::new_shared(self.header.clone(), data, self.meta.clone())
+    }
+
     /// Creates a new IPv4 TCP packet using the provided data.
     pub fn new_ipv4_tcp(
         header: tcp::TcpHeader,
@@ -342,7 +433,7 @@ impl Packet {
             return None;
         };
 
-        let tcp_hdr = match &self.data {
+        let tcp_hdr = match self.data.as_ref() {
             // The legacy TCP header is obtained with `packet_getTCPHeader()` in the legacy C API.
             Data::LegacyTcp(_) => unimplemented!(),
             Data::Tcp(tcp) => tcp.header.clone(),
@@ -375,7 +466,7 @@ impl Packet {
     // a pre-set payload, and we do not add more bytes later. Thus, we can then store them as a
     // slice of `Bytes` rather than a `Vec<Bytes>`.
     pub fn payload(&self) -> Vec<Bytes> {
-        match &self.data {
+        match self.data.as_ref() {
             Data::LegacyTcp(tcp_rc) => tcp_rc.borrow().payload.clone(),
             Data::Tcp(tcp) => tcp.payload.clone(),
             Data::Udp(udp) => vec![udp.payload.clone()],
@@ -417,7 +508,7 @@ impl Packet {
             unimplemented!()
         };
 
-        let port = match &self.data {
+        let port = match self.data.as_ref() {
             Data::LegacyTcp(tcp_rc) => tcp_rc.borrow().header.src_port,
             Data::Tcp(tcp) => tcp.header.src_port,
             Data::Udp(udp) => udp.header.src_port,
@@ -436,7 +527,7 @@ impl Packet {
             unimplemented!()
         };
 
-        let port = match &self.data {
+        let port = match self.data.as_ref() {
             Data::LegacyTcp(tcp_rc) => tcp_rc.borrow().header.dst_port,
             Data::Tcp(tcp) => tcp.header.dst_port,
             Data::Udp(udp) => udp.header.dst_port,
@@ -486,7 +577,7 @@ impl Header {
 
 /// Stores the data part of an IP packet. The data segment varies depending on the protocol being
 /// carried by the packet.
-#[derive(Clone, Debug)]
+#[derive(Debug)]
 enum Data {
     // We need a mutable TCP packet to support the legacy TCP stack, which writes some header and
     // payload data after the packet was created.
@@ -832,7 +923,7 @@ impl PacketDisplay for Packet {
 
         // write protocol-specific data
 
-        match &self.data {
+        match self.data.as_ref() {
             Data::LegacyTcp(tcp_ref) => write_tcpdata_bytes(&tcp_ref.borrow(), writer),
             Data::Tcp(tcp) => write_tcpdata_bytes(tcp, writer),
             Data::Udp(udp) => write_udpdata_bytes(udp, writer),
@@ -984,6 +1075,42 @@ mod tests {
         assert_eq!(0, chunks.first().unwrap().len());
     }
 
+    #[test]
+    fn ipv4_udp_copy() {
+        let src = SocketAddrV4::new(Ipv4Addr::new(192, 168, 1, 1), 10_000);
+        let dst = SocketAddrV4::new(Ipv4Addr::new(192, 168, 1, 2), 80);
+        let payload = Bytes::from_static(b"Hello World!");
+        let priority = 123;
+
+        let packetrc = PacketRc::new_ipv4_udp(src, dst, payload.clone(), priority);
+        let copy = packetrc.new_copy_inner();
+
+        assert_ne!(packetrc, copy);
+        // the transport data is shared
+        assert!(Arc::ptr_eq(&packetrc.data, &copy.data));
+
+        assert_eq!(src, copy.src_ipv4_address());
+        assert_eq!(dst, copy.dst_ipv4_address());
+        assert_eq!(priority, copy.priority());
+        assert_eq!(payload, copy.payload().first().unwrap());
+    }
+
+    #[test]
+    fn packet_pool_reuse() {
+        let packetrc = PacketRc::new_ipv4_udp_mock();
+        let clone = packetrc.clone();
+        let ptr = Arc::as_ptr(&packetrc.inner);
+
+        // not the last reference
+        drop(packetrc);
+        assert_eq!(clone.iana_protocol(), IanaProtocol::Udp);
+
+        // the allocation is reused for the next packet
+        drop(clone);
+        let packetrc = PacketRc::new_ipv4_udp_mock();
+        assert_eq!(Arc::as_ptr(&packetrc.inner), ptr);
+    }
+
     fn make_tcp_header(src: SocketAddrV4, dst: SocketAddrV4) -> tcp::TcpHeader {
         // Selective acks with two ranges: [1-3) and [5-6).
         let sel_acks =
@@ -1153,7 +1280,7 @@ mod export {
     ) {
         let packet = PacketRc::borrow_raw_mut(packet_ptr);
 
-        let Data::LegacyTcp(tcp) = &packet.data else {
+        let Data::LegacyTcp(tcp) = packet.data.as_ref() else {
             unimplemented!()
         };
 
@@ -1186,7 +1313,7 @@ mod export {
         let IpAddr::V4(dst_ip) = packet.header.dst else {
             unimplemented!()
         };
-        let Data::LegacyTcp(tcp_rc) = &packet.data else {
+        let Data::LegacyTcp(tcp_rc) = packet.data.as_ref() else {
             unimplemented!()
         };
         let tcp = tcp_rc.borrow();
@@ -1223,7 +1350,7 @@ mod export {
         let packet = PacketRc::borrow_raw_mut(packet_ptr);
         let mem = unsafe { mem.as_ref() }.unwrap();
 
-        let Data::LegacyTcp(tcp) = &packet.data else {
+        let Data::LegacyTcp(tcp) = packet.data.as_ref() else {
             unimplemented!()
         };
 
@@ -1274,7 +1401,7 @@ mod export {
         let packet = PacketRc::borrow_raw(packet_ptr);
         let mem = unsafe { mem.as_mut() }.unwrap();
 
-        let Data::LegacyTcp(tcp) = &packet.data else {
+        let Data::LegacyTcp(tcp) = packet.data.as_ref() else {
             unimplemented!()
         };
 
@@ -1413,7 +1540,7 @@ mod export {
     }
 
     fn get_sequence_number(packet: &PacketRc) -> u32 {
-        let Data::LegacyTcp(tcp_ref) = &packet.data else {
+        let Data::LegacyTcp(tcp_ref) = packet.data.as_ref() else {
             unimplemented!()
         };
         tcp_ref.borrow().header.sequence
@@ -9,12 +9,12 @@ use crate::core::work::task::TaskRef;
 use crate::core::worker::Worker;
 use crate::cshadow as c;
 use crate::host::host::Host;
-use crate::network::PacketRc;
 use crate::network::packet::PacketStatus;
-use crate::network::relay::token_bucket::TokenBucket;
+use crate::network::relay::token_bucket::{Refill, TokenBucket};
+use crate::network::{PacketDevice, PacketRc};
 use crate::utility::ObjectCounter;
 
-mod token_bucket;
+pub mod token_bucket;
 
 /// A `Relay` forwards `PacketRc`s between `PacketDevice`s, optionally enforcing a
 /// bandwidth limit on the rate at which we forward `PacketRc`s between devices.
@@ -60,6 +60,11 @@ struct RelayInternal {
     src_dev_address: Ipv4Addr,
     state: RelayState,
     next_packet: Option<PacketRc>,
+    /// The forwarding task, created the first time we schedule it and then reused, since we
+    /// schedule it often and there is never more than one pending at a time.
+    forward_task: Option<TaskRef>,
+    /// The packets being forwarded, which is kept to reuse its allocation.
+    batch: Vec<PacketRc>,
 }
 
 /// Track's the `Relay`s state, which typically moves from Idle to Pending to
@@ -79,6 +84,9 @@ enum RelayState {
 /// Specifies a throughput limit the relay should enforce when forwarding packets.
 pub enum RateLimit {
     BytesPerSecond(u64),
+    /// Like `BytesPerSecond`, but the bandwidth is added to the token bucket continuously so that
+    /// packets are sent at their exact departure times rather than at millisecond boundaries.
+    PacedBytesPerSecond(u64),
     Unlimited,
 }
 
@@ -90,7 +98,10 @@ impl Relay {
     /// forwarded over time without exceeding the configured `RateLimit`.
     pub fn new(rate: RateLimit, src_dev_address: Ipv4Addr) -> Self {
         let rate_limiter = match rate {
-            RateLimit::BytesPerSecond(bytes) => Some(create_token_bucket(bytes)),
+            RateLimit::BytesPerSecond(bytes) => Some(create_token_bucket(bytes, Refill::Discrete)),
+            RateLimit::PacedBytesPerSecond(bytes) => {
+                Some(create_token_bucket(bytes, Refill::Continuous))
+            }
             RateLimit::Unlimited => None,
         };
 
@@ -101,6 +112,8 @@ impl Relay {
                 src_dev_address,
                 state: RelayState::Idle,
                 next_packet: None,
+                forward_task: None,
+                batch: Vec::new(),
             }),
         }
     }
@@ -135,6 +148,30 @@ impl Relay {
         }
     }
 
+    /// Run the forwarding loop now rather than from a scheduled task, so that the packets that the
+    /// source has available are forwarded before returning. Does nothing if the loop is already
+    /// running (it will forward the new packets before it stops) or a forwarding task is pending.
+    ///
+    /// Unlike with [`Relay::notify()`], the packets are forwarded on the caller's stack, so the
+    /// caller must not hold borrows of anything that forwarding the packets to their destinations
+    /// needs (such as the source or destination sockets).
+    pub fn forward_immediately(self: &Arc<Self>, host: &Host) {
+        let state = match self.internal.try_borrow() {
+            Ok(internal) => internal.state,
+            Err(_) => RelayState::Forwarding,
+        };
+
+        match state {
+            RelayState::Idle => self.forward_now(host),
+            RelayState::Pending => {
+                log::trace!("Relay forward task already scheduled; skipping forward request.");
+            }
+            RelayState::Forwarding => {
+                log::trace!("Relay forward task currently running; skipping forward request.");
+            }
+        }
+    }
+
     /// Schedule an event to trigger us to run the forwarding loop later, and
     /// changes our state to `RelayState::Pending`. This allows us to run the
     /// forwarding loop after unwinding the current stack, and allows socket
@@ -143,17 +180,26 @@ impl Relay {
     /// Must not be called if our state is already `RelayState::Pending`, to
     /// avoid scheduling multiple forwarding events simultaneously.
     fn forward_later(self: &Arc<Self>, delay: SimulationTime, host: &Host) {
-        // We should not already be waiting for a scheduled forwarding task.
-        {
+        let task = {
             let mut internal = self.internal.borrow_mut();
+
+            // We should not already be waiting for a scheduled forwarding task.
             assert_ne!(internal.state, RelayState::Pending);
             internal.state = RelayState::Pending;
-        }
 
-        // Schedule a forwarding task using a weak reference to allow the relay
-        // to be dropped before the forwarding task is executed.
-        let weak_self = Arc::downgrade(self);
-        let task = TaskRef::new(move |host| Self::run_forward_task(&weak_self, host));
+            // The forwarding task uses a weak reference to allow the relay to
+            // be dropped before the forwarding task is executed. It doesn't
+            // capture any per-schedule state, so we only need to allocate it
+            // once.
+            internal
+                .forward_task
+                .get_or_insert_with(|| {
+                    let weak_self = Arc::downgrade(self);
+                    TaskRef::new(move |host| Self::run_forward_task(&weak_self, host))
+                })
+                .clone()
+        };
+
         host.schedule_task_with_delay(task, delay);
         log::trace!(
             "Relay src={} scheduled event to start forwarding packets after {:?}",
@@ -213,69 +259,133 @@ impl Relay {
 
         // Continue forwarding until we run out of either packets or tokens.
         loop {
+            let mut batch = std::mem::take(&mut internal.batch);
+            let blocking_dur = internal.pop_batch(&*src, is_bootstrapping, &mut batch);
+
+            if batch.is_empty() {
+                internal.batch = batch;
+                internal.state = RelayState::Idle;
+                // Either ran out of packets to forward, or need to block until we have enough
+                // tokens. Call Relay::forward_later() after dropping the mutable borrow.
+                return blocking_dur;
+            }
+
+            // Forward the packets to their destination devices now, looking up the device once
+            // for each run of packets with the same destination.
+            let src_address = src.get_address();
+            let mut packets = batch.drain(..).peekable();
+            while let Some(packet) = packets.next() {
+                let dst_address = *packet.dst_ipv4_address().ip();
+                let has_dst = |x: &PacketRc| *x.dst_ipv4_address().ip() == dst_address;
+
+                if dst_address == src_address {
+                    // The source and destination are the same. Avoid a double mutable borrow of
+                    // the packet device.
+                    src.push(packet);
+                    while let Some(packet) = packets.next_if(has_dst) {
+                        src.push(packet);
+                    }
+                } else {
+                    // The source and destination are different.
+                    let dst = host.get_packet_device(dst_address);
+                    dst.push(packet);
+                    while let Some(packet) = packets.next_if(has_dst) {
+                        dst.push(packet);
+                    }
+                }
+            }
+            drop(packets);
+            internal.batch = batch;
+
+            if let Some(blocking_dur) = blocking_dur {
+                internal.state = RelayState::Idle;
+                return Some(blocking_dur);
+            }
+        }
+    }
+}
+
+impl RelayInternal {
+    /// Pop packets from the source device into `batch` until either the source runs out of
+    /// packets or we run out of tokens. The tokens for the whole batch are removed from the token
+    /// bucket at once. If we ran out of tokens, the packet that didn't conform is cached in
+    /// `next_packet` and the duration until we have enough tokens to forward it is returned.
+    fn pop_batch(
+        &mut self,
+        src: &dyn PacketDevice,
+        is_bootstrapping: bool,
+        batch: &mut Vec<PacketRc>,
+    ) -> Option<SimulationTime> {
+        let src_address = src.get_address();
+
+        // Rate limits do not apply during bootstrapping.
+        let mut rate_limiter = self.rate_limiter.as_mut().filter(|_| !is_bootstrapping);
+
+        // The number of tokens available for this batch.
+        let mut available = rate_limiter
+            .as_mut()
+            .map(|tb| tb.comforming_remove(0).unwrap());
+        let mut used = 0;
+
+        let blocking_dur = loop {
             // Get next packet from our local cache, or from the source device.
-            let Some(packet) = internal.next_packet.take().or_else(|| src.pop()) else {
+            let Some(packet) = self.next_packet.take().or_else(|| src.pop()) else {
                 // Ran out of packets to forward.
-                internal.state = RelayState::Idle;
-                return None;
+                break None;
             };
 
-            // The packet is local if the src and dst refer to the same device.
-            // This can happen for the loopback device, and for the inet device
-            // if both sockets use the public ip to communicate over localhost.
-            let is_local = src.get_address() == *packet.dst_ipv4_address().ip();
-
-            // Check if we have enough tokens for forward the packet. Rate
-            // limits do not apply during bootstrapping, or if the source and
-            // destination are the same device.
-            if !is_bootstrapping && !is_local {
-                // Rate limit applies only if we have a token bucket.
-                if let Some(tb) = internal.rate_limiter.as_mut() {
-                    // Try to remove tokens for this packet.
-                    if let Err(blocking_dur) = tb.comforming_remove(packet.len() as u64) {
-                        // Too few tokens, need to block.
-                        log::trace!(
-                            "Relay src={} dst={} exceeded rate limit, need {} more tokens \
-                            for packet of size {}, blocking for {:?}",
-                            src.get_address(),
-                            packet.dst_ipv4_address().ip(),
-                            packet
-                                .len()
-                                .saturating_sub(tb.comforming_remove(0).unwrap() as usize),
-                            packet.len(),
-                            blocking_dur
-                        );
-
-                        // Cache the packet until we can forward it later.
-                        packet.add_status(PacketStatus::RelayCached);
-                        assert!(internal.next_packet.is_none());
-                        internal.next_packet = Some(packet);
-                        internal.state = RelayState::Idle;
-
-                        // Call Relay::forward_later() after dropping the mutable borrow.
-                        return Some(blocking_dur);
-                    }
+            // The packet is local if the src and dst refer to the same device. This can happen
+            // for the loopback device, and for the inet device if both sockets use the public ip
+            // to communicate over localhost. Rate limits do not apply to local packets.
+            let is_local = src_address == *packet.dst_ipv4_address().ip();
+
+            // Check if we have enough tokens for forward the packet.
+            if let (false, Some(available)) = (is_local, available.as_mut()) {
+                let len = packet.len() as u64;
+                if len > *available {
+                    // Too few tokens, need to block.
+                    let tb = rate_limiter.as_mut().unwrap();
+                    tb.comforming_remove(used).unwrap();
+                    used = 0;
+                    let blocking_dur = tb.comforming_remove(len).unwrap_err();
+
+                    log::trace!(
+                        "Relay src={} dst={} exceeded rate limit, need {} more tokens \
+                        for packet of size {}, blocking for {:?}",
+                        src_address,
+                        packet.dst_ipv4_address().ip(),
+                        len.saturating_sub(*available),
+                        len,
+                        blocking_dur
+                    );
+
+                    // Cache the packet until we can forward it later.
+                    packet.add_status(PacketStatus::RelayCached);
+                    assert!(self.next_packet.is_none());
+                    self.next_packet = Some(packet);
+
+                    break Some(blocking_dur);
                 }
+                *available -= len;
+                used += len;
             }
 
-            // Forward the packet to the destination device now.
             packet.add_status(PacketStatus::RelayForwarded);
-            if is_local {
-                // The source and destination are the same. Avoid a double
-                // mutable borrow of the packet device.
-                src.push(packet);
-            } else {
-                // The source and destination are different.
-                let dst = host.get_packet_device(*packet.dst_ipv4_address().ip());
-                dst.push(packet);
-            }
+            batch.push(packet);
+        };
+
+        // Remove the tokens for the packets in the batch.
+        if let Some(tb) = rate_limiter {
+            tb.comforming_remove(used).unwrap();
         }
+
+        blocking_dur
     }
 }
 
 /// Configures a token bucket according the the given bytes_per_second rate
 /// limit. We always refill at least 1 byte per millisecond.
-fn create_token_bucket(bytes_per_second: u64) -> TokenBucket {
+fn create_token_bucket(bytes_per_second: u64, refill: Refill) -> TokenBucket {
     let refill_interval = SimulationTime::from_millis(1);
     let refill_size = std::cmp::max(1, bytes_per_second / 1000);
 
@@ -284,7 +394,11 @@ fn create_token_bucket(bytes_per_second: u64) -> TokenBucket {
     // the token bucket (configured by `refill_size`) is not affected much.
     let capacity = refill_size + get_burst_allowance();
 
-    TokenBucket::new(capacity, refill_size, refill_interval).unwrap()
+    match refill {
+        Refill::Discrete => TokenBucket::new(capacity, refill_size, refill_interval),
+        Refill::Continuous => TokenBucket::new_continuous(capacity, refill_size, refill_interval),
+    }
+    .unwrap()
 }
 
 /// Returns the "burst allowance" we use in our token buckets.
@@ -3,11 +3,23 @@ use shadow_shim_helper_rs::simulation_time::SimulationTime;
 
 use crate::core::worker::Worker;
 
+/// How tokens are added to a [`TokenBucket`].
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum Refill {
+    /// `refill_increment` tokens are added at the end of each refill interval.
+    Discrete,
+    /// Tokens are added continuously at a rate of `refill_increment` tokens per refill interval.
+    Continuous,
+}
+
 pub struct TokenBucket {
     capacity: u64,
     balance: u64,
     refill_increment: u64,
     refill_interval: SimulationTime,
+    refill: Refill,
+    /// For discrete refills, the time of the last refill event. For continuous refills, the time
+    /// up to which tokens have been added.
     last_refill: EmulatedTime,
 }
 
@@ -32,6 +44,20 @@ impl TokenBucket {
         )
     }
 
+    /// Like `new()`, but tokens are added to the bucket continuously rather than in discrete
+    /// refills at the end of each `refill_interval`. Instead of being aligned to the refill
+    /// interval boundaries, the durations returned by `comforming_remove()` are the exact time
+    /// until enough tokens are available (but see `continuous_conforming_duration()`).
+    pub fn new_continuous(
+        capacity: u64,
+        refill_increment: u64,
+        refill_interval: SimulationTime,
+    ) -> Option<TokenBucket> {
+        let mut tb = TokenBucket::new(capacity, refill_increment, refill_interval)?;
+        tb.refill = Refill::Continuous;
+        Some(tb)
+    }
+
     /// Implements the functionality of `new()` allowing the caller to set the
     /// last refill time. Useful for testing.
     fn new_inner(
@@ -52,6 +78,7 @@ impl TokenBucket {
                 balance: capacity,
                 refill_increment,
                 refill_interval,
+                refill: Refill::Discrete,
                 last_refill,
             })
         } else {
@@ -64,19 +91,29 @@ impl TokenBucket {
     /// on success, or the duration until the next refill event after which we
     /// would have enough tokens to allow the decrement to conform on error
     /// (returned durations always align with this `TokenBucket`'s discrete
-    /// refill interval boundaries). Passing a 0 `decrement` always succeeds.
+    /// refill interval boundaries, unless the bucket refills continuously). Passing a 0
+    /// `decrement` always succeeds.
     pub fn comforming_remove(&mut self, decrement: u64) -> Result<u64, SimulationTime> {
         let now = Worker::current_time().unwrap();
         self.conforming_remove_inner(decrement, &now)
     }
 
     /// Implements the functionality of `comforming_remove()` without calling into the
-    /// `Worker` module. Useful for testing.
-    fn conforming_remove_inner(
+    /// `Worker` module. Useful for testing and benchmarking.
+    pub fn conforming_remove_inner(
         &mut self,
         decrement: u64,
         now: &EmulatedTime,
     ) -> Result<u64, SimulationTime> {
+        if self.refill == Refill::Continuous {
+            self.continuous_refill(now);
+            self.balance = self
+                .balance
+                .checked_sub(decrement)
+                .ok_or_else(|| self.continuous_conforming_duration(decrement, now))?;
+            return Ok(self.balance);
+        }
+
         let next_refill_span = self.lazy_refill(now);
         self.balance = self
             .balance
@@ -85,6 +122,56 @@ impl TokenBucket {
         Ok(self.balance)
     }
 
+    /// Adds the tokens that have accumulated since the last refill at the continuous refill rate.
+    fn continuous_refill(&mut self, now: &EmulatedTime) {
+        let elapsed = now.duration_since(&self.last_refill).as_nanos();
+        let interval = self.refill_interval.as_nanos();
+        let increment = u128::from(self.refill_increment);
+
+        let num_tokens = elapsed * increment / interval;
+        if num_tokens == 0 {
+            return;
+        }
+
+        self.balance = self
+            .balance
+            .saturating_add(num_tokens.try_into().unwrap_or(u64::MAX))
+            .min(self.capacity);
+
+        if self.balance == self.capacity {
+            // tokens that would overflow the bucket are lost
+            self.last_refill = *now;
+        } else {
+            // only advance by the time it took to add these tokens, rounded up so that we never
+            // add tokens early; the rest of the elapsed time carries over to the next refill
+            let used = (num_tokens * interval).div_ceil(increment);
+            debug_assert!(used <= elapsed);
+            let used = SimulationTime::from_nanos(used.try_into().unwrap());
+            self.last_refill = self.last_refill.saturating_add(used);
+        }
+    }
+
+    /// Computes the duration until the bucket has refilled enough tokens such that our balance
+    /// can be decremented by the given `decrement`, when using continuous refills.
+    ///
+    /// If `decrement` is smaller than `refill_increment`, this instead waits until the bucket
+    /// holds `refill_increment` tokens. Otherwise a paced sender would wake up for every packet
+    /// rather than once for each refill interval's worth of tokens like with discrete refills.
+    fn continuous_conforming_duration(&self, decrement: u64, now: &EmulatedTime) -> SimulationTime {
+        let target = u128::from(decrement.max(self.refill_increment.min(self.capacity)));
+        let required_tokens = target.saturating_sub(self.balance.into());
+
+        let interval = self.refill_interval.as_nanos();
+        let increment = u128::from(self.refill_increment);
+
+        // the time since the last refill at which the required tokens will have been added
+        let required_time = (required_tokens * interval).div_ceil(increment);
+        let elapsed = now.duration_since(&self.last_refill).as_nanos();
+
+        let dur = required_time.saturating_sub(elapsed).max(1);
+        SimulationTime::from_nanos(dur.try_into().unwrap_or(u64::MAX))
+    }
+
     /// Computes the duration required to refill enough tokens such that our
     /// balance can be decremented by the given `decrement`. Returned durations
     /// always align with this `TokenBucket`'s discrete refill interval
@@ -245,6 +332,56 @@ mod tests {
         assert_eq!(tb.balance, 100);
     }
 
+    #[test]
+    fn test_continuous_refill() {
+        let now = mock_time_millis(1000);
+        let mut tb = TokenBucket::new_inner(100, 10, SimulationTime::from_millis(10), now).unwrap();
+        tb.refill = Refill::Continuous;
+
+        // Remove all tokens
+        assert_eq!(tb.conforming_remove_inner(100, &now), Ok(0));
+
+        // One token is added every millisecond
+        let later = now + SimulationTime::from_micros(3500);
+        assert_eq!(tb.conforming_remove_inner(0, &later), Ok(3));
+
+        // The partial token is not lost
+        let later = now + SimulationTime::from_millis(4);
+        assert_eq!(tb.conforming_remove_inner(0, &later), Ok(4));
+
+        // Should not exceed capacity
+        let later = now + SimulationTime::from_secs(60);
+        assert_eq!(tb.conforming_remove_inner(0, &later), Ok(100));
+    }
+
+    #[test]
+    fn test_continuous_remove_error() {
+        let now = mock_time_millis(1000);
+        let mut tb =
+            TokenBucket::new_inner(100, 10, SimulationTime::from_millis(125), now).unwrap();
+        tb.refill = Refill::Continuous;
+
+        assert_eq!(tb.conforming_remove_inner(100, &now), Ok(0));
+
+        // Refilling 10 tokens every 125 millis takes 625 millis for 50 tokens
+        let result = tb.conforming_remove_inner(50, &now);
+        assert_eq!(result, Err(SimulationTime::from_millis(625)));
+
+        // 32.5 millis later, 2 tokens have been added
+        let now = now + SimulationTime::from_micros(32_500);
+        let result = tb.conforming_remove_inner(50, &now);
+        assert_eq!(result, Err(SimulationTime::from_micros(625_000 - 32_500)));
+        assert_eq!(tb.balance, 2);
+
+        // A small decrement waits for a full refill increment
+        let result = tb.conforming_remove_inner(5, &now);
+        assert_eq!(result, Err(SimulationTime::from_micros(125_000 - 32_500)));
+
+        // the time of the returned duration conforms
+        let now = now + result.unwrap_err();
+        assert_eq!(tb.conforming_remove_inner(5, &now), Ok(5));
+    }
+
     #[test]
     fn test_remove_error() {
         let now = mock_time_millis(1000);
@@ -1,7 +1,8 @@
 //! An active queue management (AQM) algorithm implementing CoDel.
 //! <https://tools.ietf.org/html/rfc8289>
 //!
-//!  The "Flow Queue" variant is not implemented.
+//!  The "Flow Queue" variant is implemented in the
+//!  [`fq_codel_queue`](super::fq_codel_queue) module.
 //!  <https://tools.ietf.org/html/rfc8290>
 //!
 //!  More info:
@@ -32,6 +33,11 @@ const INTERVAL: SimulationTime = SimulationTime::from_duration(Duration::from_mi
 /// routers, but in Shadow we don't enforce a limit due to our batched sending.
 const LIMIT: usize = usize::MAX;
 
+/// The number of packets that the queue has space for when it's created. Reserving space up front
+/// avoids growing the queue several times in the first bursts of packets, while keeping the memory
+/// overhead of idle hosts small.
+const INITIAL_CAPACITY: usize = 64;
+
 /// Encodes if CoDel determines that the next available packet can be dropped.
 struct CoDelPopItem {
     packet: PacketRc,
@@ -50,6 +56,8 @@ enum CoDelMode {
 /// An entry in the CoDel queque.
 struct CoDelElement {
     packet: PacketRc,
+    /// The packet's size, which is saved so that we don't need to compute it again on `pop()`.
+    packet_len: usize,
     enqueue_ts: EmulatedTime,
 }
 
@@ -83,8 +91,13 @@ pub struct CoDelQueue {
 impl CoDelQueue {
     /// Creates a new empty packet queue.
     pub fn new() -> CoDelQueue {
+        Self::with_capacity(INITIAL_CAPACITY)
+    }
+
+    /// Creates a new empty packet queue with space for `capacity` packets.
+    pub fn with_capacity(capacity: usize) -> CoDelQueue {
         CoDelQueue {
-            elements: VecDeque::new(),
+            elements: VecDeque::with_capacity(capacity),
             total_bytes_stored: 0,
             mode: CoDelMode::Store,
             interval_end: None,
@@ -94,6 +107,11 @@ impl CoDelQueue {
         }
     }
 
+    /// Returns the total size of the packets stored in the queue.
+    pub fn total_bytes(&self) -> usize {
+        self.total_bytes_stored
+    }
+
     /// Returns the total number of packets stored in the queue.
     #[cfg(test)]
     pub fn len(&self) -> usize {
@@ -205,9 +223,9 @@ impl CoDelQueue {
         match self.elements.pop_front() {
             Some(element) => {
                 // Found a packet.
-                debug_assert!(element.packet.len() <= self.total_bytes_stored);
+                debug_assert!(element.packet_len <= self.total_bytes_stored);
                 self.total_bytes_stored =
-                    self.total_bytes_stored.saturating_sub(element.packet.len());
+                    self.total_bytes_stored.saturating_sub(element.packet_len);
 
                 debug_assert!(now >= &element.enqueue_ts);
                 let standing_delay = now.saturating_duration_since(&element.enqueue_ts);
@@ -303,9 +321,11 @@ impl CoDelQueue {
     pub fn push(&mut self, packet: PacketRc, now: EmulatedTime) {
         if self.elements.len() < LIMIT {
             packet.add_status(PacketStatus::RouterEnqueued);
-            self.total_bytes_stored += packet.len();
+            let packet_len = packet.len();
+            self.total_bytes_stored += packet_len;
             self.elements.push_back(CoDelElement {
                 packet,
+                packet_len,
                 enqueue_ts: now,
             });
         } else {
@@ -0,0 +1,293 @@
+//! The "Flow Queue" variant of CoDel (FQ-CoDel).
+//! <https://tools.ietf.org/html/rfc8290>
+//!
+//! Packets are hashed by their addresses, ports, and protocol into one of a fixed number of
+//! buckets, each of which has its own [`CoDelQueue`]. The buckets that have packets are scheduled
+//! with deficit round robin (DRR), and buckets that became active recently are served before the
+//! others. A bulk flow that builds a standing queue then only causes its own packets to be
+//! dropped, and it can't delay the packets of sparse flows by more than one quantum per round.
+//!
+//! Flows that hash to the same bucket share it, so the memory used doesn't depend on the number of
+//! flows. Only the total size limit of the RFC is not implemented, since [`CoDelQueue`] doesn't
+//! enforce a limit either.
+//!
+//!  More info:
+//!   - <http://man7.org/linux/man-pages/man8/tc-fq_codel.8.html>
+
+use std::collections::VecDeque;
+use std::hash::{Hash, Hasher};
+
+use rustc_hash::FxHasher;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+
+use super::codel_queue::CoDelQueue;
+use crate::cshadow as c;
+use crate::network::packet::PacketRc;
+
+/// The number of buckets that flows are hashed into, corresponding to the "flows" parameter in the
+/// fq_codel man page.
+const NUM_BUCKETS: usize = 1024;
+
+/// The number of bytes a flow can send in each round, corresponding to the "quantum" parameter in
+/// the fq_codel man page. This is one MTU, so that a flow is served at least one packet per round.
+const QUANTUM: isize = c::CONFIG_MTU as isize;
+
+/// A bucket holding the packets of the flows that hash to it.
+struct Flow {
+    queue: CoDelQueue,
+    /// The number of bytes the flow can still send in the current round.
+    deficit: isize,
+    /// Is the flow in the list of new or old flows?
+    is_active: bool,
+}
+
+/// A packet queue implementing the FQ-CoDel queue management algorithm, suitable for use in
+/// network routers.
+pub struct FqCoDelQueue {
+    /// The flow buckets, which are allocated when a packet first hashes to them.
+    buckets: Vec<Option<Box<Flow>>>,
+    /// Indexes of flows that became active and haven't used up their first quantum yet.
+    new_flows: VecDeque<usize>,
+    /// Indexes of the other active flows.
+    old_flows: VecDeque<usize>,
+    /// The running sum of the sizes of packets stored in all buckets.
+    total_bytes_stored: usize,
+}
+
+impl FqCoDelQueue {
+    /// Creates a new empty packet queue.
+    pub fn new() -> FqCoDelQueue {
+        FqCoDelQueue {
+            buckets: std::iter::repeat_with(|| None).take(NUM_BUCKETS).collect(),
+            new_flows: VecDeque::new(),
+            old_flows: VecDeque::new(),
+            total_bytes_stored: 0,
+        }
+    }
+
+    /// Returns the total size of the packets stored in the queue.
+    pub fn total_bytes(&self) -> usize {
+        self.total_bytes_stored
+    }
+
+    /// Returns the total number of packets stored in the queue.
+    #[cfg(test)]
+    pub fn len(&self) -> usize {
+        self.buckets.iter().flatten().map(|x| x.queue.len()).sum()
+    }
+
+    /// Returns the packet that is at the front of the first active flow, or None if the queue is
+    /// empty. As with [`CoDelQueue::peek()`], a subsequent `pop()` may not return this packet.
+    #[cfg(test)]
+    pub fn peek(&self) -> Option<&PacketRc> {
+        self.new_flows
+            .iter()
+            .chain(self.old_flows.iter())
+            .find_map(|&i| self.buckets[i].as_ref().unwrap().queue.peek())
+    }
+
+    /// Returns the bucket that the packet's flow hashes to.
+    fn bucket(packet: &PacketRc) -> usize {
+        let mut hasher = FxHasher::default();
+        packet.src_ipv4_address().hash(&mut hasher);
+        packet.dst_ipv4_address().hash(&mut hasher);
+        packet.iana_protocol().hash(&mut hasher);
+        (hasher.finish() % NUM_BUCKETS as u64) as usize
+    }
+
+    /// Append a packet to the end of its flow's queue.
+    /// Requires the current time as an argument to avoid calling into the
+    /// worker module internally.
+    pub fn push(&mut self, packet: PacketRc, now: EmulatedTime) {
+        let index = Self::bucket(&packet);
+        let flow = self.buckets[index].get_or_insert_with(|| {
+            Box::new(Flow {
+                // most buckets only ever hold a few packets, so don't reserve space up front
+                queue: CoDelQueue::with_capacity(0),
+                deficit: 0,
+                is_active: false,
+            })
+        });
+
+        let bytes_before = flow.queue.total_bytes();
+        flow.queue.push(packet, now);
+        self.total_bytes_stored += flow.queue.total_bytes() - bytes_before;
+
+        if !flow.is_active {
+            flow.is_active = true;
+            flow.deficit = QUANTUM;
+            self.new_flows.push_back(index);
+        }
+    }
+
+    /// Returns the next packet from the flow that is scheduled next, or None if all flows are
+    /// empty. The CoDel packet dropping logic is applied separately to each flow.
+    /// Requires the current time as an argument to avoid calling into the
+    /// worker module internally.
+    pub fn pop(&mut self, now: EmulatedTime) -> Option<PacketRc> {
+        loop {
+            let (index, is_new) = match self.new_flows.front() {
+                Some(&index) => (index, true),
+                None => (*self.old_flows.front()?, false),
+            };
+            let list = match is_new {
+                true => &mut self.new_flows,
+                false => &mut self.old_flows,
+            };
+            let flow = self.buckets[index].as_mut().unwrap();
+
+            if flow.deficit <= 0 {
+                // the flow used up its quantum, so give it another and move it to the end of the
+                // round
+                flow.deficit += QUANTUM;
+                list.pop_front();
+                self.old_flows.push_back(index);
+                continue;
+            }
+
+            let bytes_before = flow.queue.total_bytes();
+            let packet = flow.queue.pop(now);
+            self.total_bytes_stored -= bytes_before - flow.queue.total_bytes();
+
+            let Some(packet) = packet else {
+                // a new flow that became empty goes to the end of the round, so that it can't
+                // become a new flow again right away and get ahead of the old flows
+                list.pop_front();
+                if is_new && !self.old_flows.is_empty() {
+                    self.old_flows.push_back(index);
+                } else {
+                    flow.is_active = false;
+                }
+                continue;
+            };
+
+            flow.deficit -= packet.len() as isize;
+            return Some(packet);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::net::{Ipv4Addr, SocketAddrV4};
+
+    use bytes::Bytes;
+
+    use super::*;
+    use crate::network::tests::mock_time_millis;
+
+    // Some of the tests here don't run in miri because they cause c::packet*
+    // functions to be called during the test.
+
+    fn packet(src_port: u16, payload_len: usize) -> PacketRc {
+        let src = SocketAddrV4::new(Ipv4Addr::new(11, 0, 0, 1), src_port);
+        let dst = SocketAddrV4::new(Ipv4Addr::new(11, 0, 0, 2), 80);
+        PacketRc::new_ipv4_udp(src, dst, Bytes::from(vec![0; payload_len]), 0)
+    }
+
+    /// Returns two source ports whose flows hash to different buckets.
+    fn distinct_ports() -> (u16, u16) {
+        let bucket = |port| FqCoDelQueue::bucket(&packet(port, 0));
+        let other = (2..).find(|&port| bucket(port) != bucket(1)).unwrap();
+        (1, other)
+    }
+
+    #[test]
+    fn empty() {
+        let now = mock_time_millis(1000);
+        let mut fq = FqCoDelQueue::new();
+        assert_eq!(fq.len(), 0);
+        assert_eq!(fq.total_bytes(), 0);
+        assert!(fq.peek().is_none());
+        assert!(fq.pop(now).is_none());
+    }
+
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn push_pop_simple() {
+        let now = mock_time_millis(1000);
+        let mut fq = FqCoDelQueue::new();
+
+        const N: usize = 10;
+
+        for i in 1..=N {
+            fq.push(packet(i as u16, 100), now);
+            assert_eq!(fq.len(), i);
+        }
+        assert!(fq.peek().is_some());
+        assert!(fq.total_bytes() > 0);
+
+        for i in 1..=N {
+            assert!(fq.pop(now).is_some());
+            assert_eq!(fq.len(), N - i);
+        }
+        assert_eq!(fq.total_bytes(), 0);
+        assert!(fq.pop(now).is_none());
+        assert!(fq.new_flows.is_empty());
+        assert!(fq.old_flows.is_empty());
+    }
+
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn same_flow_is_fifo() {
+        let now = mock_time_millis(1000);
+        let mut fq = FqCoDelQueue::new();
+
+        let packets: Vec<_> = (0..5).map(|_| packet(1, 100)).collect();
+        for p in &packets {
+            fq.push(p.clone(), now);
+        }
+        for p in &packets {
+            assert_eq!(fq.pop(now).unwrap(), *p);
+        }
+    }
+
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn sparse_flow_not_delayed() {
+        let now = mock_time_millis(1000);
+        let mut fq = FqCoDelQueue::new();
+        let (bulk, sparse) = distinct_ports();
+
+        for _ in 0..100 {
+            fq.push(packet(bulk, 1000), now);
+        }
+        // use up the bulk flow's first quantum so that it's an old flow
+        fq.pop(now).unwrap();
+        fq.pop(now).unwrap();
+
+        // the sparse flow is a new flow, so it's served next
+        let sparse_packet = packet(sparse, 100);
+        fq.push(sparse_packet.clone(), now);
+        assert_eq!(fq.pop(now).unwrap(), sparse_packet);
+    }
+
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn drr_shares_bytes() {
+        let now = mock_time_millis(1000);
+        let mut fq = FqCoDelQueue::new();
+        let (large, small) = distinct_ports();
+
+        // one flow with large packets and one with small packets
+        for _ in 0..100 {
+            fq.push(packet(large, 1000), now);
+        }
+        for _ in 0..1000 {
+            fq.push(packet(small, 100), now);
+        }
+
+        let mut bytes = [0usize; 2];
+        for _ in 0..300 {
+            let p = fq.pop(now).unwrap();
+            let i = match p.src_ipv4_address().port() == large {
+                true => 0,
+                false => 1,
+            };
+            bytes[i] += p.len();
+        }
+
+        // both flows get about the same number of bytes, within a quantum
+        assert!(bytes[0].abs_diff(bytes[1]) <= 2 * QUANTUM as usize);
+    }
+}
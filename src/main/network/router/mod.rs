@@ -2,11 +2,14 @@ use std::cell::RefCell;
 use std::net::Ipv4Addr;
 
 use self::codel_queue::CoDelQueue;
+use self::fq_codel_queue::FqCoDelQueue;
+use crate::core::configuration::RouterQDiscMode;
 use crate::core::worker::Worker;
 use crate::network::PacketDevice;
 use crate::network::packet::PacketRc;
 use crate::utility::{Magic, ObjectCounter};
-mod codel_queue;
+pub mod codel_queue;
+pub mod fq_codel_queue;
 
 use shadow_shim_helper_rs::emulated_time::EmulatedTime;
 
@@ -17,19 +20,61 @@ pub struct Router {
     _counter: ObjectCounter,
     address: Ipv4Addr,
     /// Packets inbound to the host from the simulated network.
-    inbound_packets: RefCell<CoDelQueue>,
+    inbound_packets: RefCell<InboundQueue>,
+}
+
+/// The queue that holds a router's inbound packets.
+enum InboundQueue {
+    CoDel(CoDelQueue),
+    FqCoDel(FqCoDelQueue),
+}
+
+impl InboundQueue {
+    fn push(&mut self, packet: PacketRc, now: EmulatedTime) {
+        match self {
+            Self::CoDel(queue) => queue.push(packet, now),
+            Self::FqCoDel(queue) => queue.push(packet, now),
+        }
+    }
+
+    fn pop(&mut self, now: EmulatedTime) -> Option<PacketRc> {
+        match self {
+            Self::CoDel(queue) => queue.pop(now),
+            Self::FqCoDel(queue) => queue.pop(now),
+        }
+    }
+
+    fn total_bytes(&self) -> usize {
+        match self {
+            Self::CoDel(queue) => queue.total_bytes(),
+            Self::FqCoDel(queue) => queue.total_bytes(),
+        }
+    }
+
+    #[cfg(test)]
+    fn peek(&self) -> Option<&PacketRc> {
+        match self {
+            Self::CoDel(queue) => queue.peek(),
+            Self::FqCoDel(queue) => queue.peek(),
+        }
+    }
 }
 
 impl Router {
     /// Create a new router for a host that will help route packets between it
     /// and other hosts. The `address` must uniquely identify this router to the
-    /// host that owns it.
-    pub fn new(address: Ipv4Addr) -> Router {
+    /// host that owns it. The `qdisc` selects how the packets inbound to the
+    /// host are queued.
+    pub fn new(address: Ipv4Addr, qdisc: RouterQDiscMode) -> Router {
+        let inbound_packets = match qdisc {
+            RouterQDiscMode::Codel => InboundQueue::CoDel(CoDelQueue::new()),
+            RouterQDiscMode::FqCodel => InboundQueue::FqCoDel(FqCoDelQueue::new()),
+        };
         Router {
             magic: Magic::new(),
             address,
             _counter: ObjectCounter::new("Router"),
-            inbound_packets: RefCell::new(CoDelQueue::new()),
+            inbound_packets: RefCell::new(inbound_packets),
         }
     }
 
@@ -50,7 +95,12 @@ impl Router {
         Worker::with_active_host(|src_host| Worker::send_packet(src_host, packet)).unwrap();
     }
 
-    /// Routes the packet from the virtual internet into our CoDel queue, which
+    /// The total size of the packets queued for the host.
+    pub fn queued_bytes(&self) -> usize {
+        self.inbound_packets.borrow().total_bytes()
+    }
+
+    /// Routes the packet from the virtual internet into our inbound queue, which
     /// can then be received by the destiantion host by calling pop().
     pub fn route_incoming_packet(&self, packet: PacketRc) {
         self.push_inner(packet, Worker::current_time().unwrap())
@@ -63,7 +113,7 @@ impl PacketDevice for Router {
     }
 
     fn pop(&self) -> Option<PacketRc> {
-        // When the host calls pop, we provide the next packet from the CoDel queue.
+        // When the host calls pop, we provide the next packet from the inbound queue.
         self.pop_inner(Worker::current_time().unwrap())
     }
 
@@ -78,33 +128,41 @@ mod tests {
     use super::*;
     use crate::network::tests::mock_time_millis;
 
+    const QDISCS: [RouterQDiscMode; 2] = [RouterQDiscMode::Codel, RouterQDiscMode::FqCodel];
+
     #[test]
     fn empty() {
-        let now = mock_time_millis(1000);
-        let router = Router::new(Ipv4Addr::UNSPECIFIED);
-        assert!(router.inbound_packets.borrow().peek().is_none());
-        assert!(router.pop_inner(now).is_none());
+        for qdisc in QDISCS {
+            let now = mock_time_millis(1000);
+            let router = Router::new(Ipv4Addr::UNSPECIFIED, qdisc);
+            assert!(router.inbound_packets.borrow().peek().is_none());
+            assert!(router.pop_inner(now).is_none());
+        }
     }
 
     #[test]
     // Ignore in miri for use of c::packet* functions.
     #[cfg_attr(miri, ignore)]
     fn push_pop_simple() {
-        let now = mock_time_millis(1000);
-        let router = Router::new(Ipv4Addr::UNSPECIFIED);
-
-        const N: usize = 10;
-
-        for _ in 1..=N {
-            router.push_inner(PacketRc::new_ipv4_udp_mock(), now);
-            assert!(router.inbound_packets.borrow().peek().is_some());
+        for qdisc in QDISCS {
+            let now = mock_time_millis(1000);
+            let router = Router::new(Ipv4Addr::UNSPECIFIED, qdisc);
+
+            const N: usize = 10;
+
+            for _ in 1..=N {
+                router.push_inner(PacketRc::new_ipv4_udp_mock(), now);
+                assert!(router.inbound_packets.borrow().peek().is_some());
+            }
+            assert!(router.queued_bytes() > 0);
+            for _ in 1..=N {
+                assert!(router.inbound_packets.borrow().peek().is_some());
+                assert!(router.pop_inner(now).is_some());
+            }
+
+            assert!(router.inbound_packets.borrow().peek().is_none());
+            assert!(router.pop_inner(now).is_none());
+            assert_eq!(router.queued_bytes(), 0);
         }
-        for _ in 1..=N {
-            assert!(router.inbound_packets.borrow().peek().is_some());
-            assert!(router.pop_inner(now).is_some());
-        }
-
-        assert!(router.inbound_packets.borrow().peek().is_none());
-        assert!(router.pop_inner(now).is_none());
     }
 }
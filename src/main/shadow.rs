@@ -13,7 +13,8 @@ use clap::Parser;
 use nix::sys::{personality, resource, signal};
 use signal_hook::{consts, iterator::Signals};
 
-use crate::core::configuration::{CliOptions, ConfigFileOptions, ConfigOptions};
+use crate::core::cgroup::CgroupIsolation;
+use crate::core::configuration::{CliOptions, ConfigFileOptions, ConfigOptions, Flatten};
 use crate::core::controller::Controller;
 use crate::core::logger::shadow_logger;
 use crate::core::sim_config::SimConfig;
@@ -46,6 +47,15 @@ pub fn run_shadow(args: Vec<&OsStr>) -> anyhow::Result<()> {
         log::debug!("Finished waiting for a signal");
     });
 
+    // write the in-memory pcap rings (if configured) when we receive SIGUSR1
+    let mut dump_signals_list = Signals::new([consts::signal::SIGUSR1])?;
+    thread::spawn(move || {
+        for signal in dump_signals_list.forever() {
+            log::info!("Received signal {}. Dumping pcap rings", signal);
+            crate::host::network::interface::request_pcap_ring_dump();
+        }
+    });
+
     // unblock all signals in shadow and child processes since cmake's ctest blocks
     // SIGTERM (and maybe others)
     signal::sigprocmask(
@@ -130,6 +140,16 @@ pub fn run_shadow(args: Vec<&OsStr>) -> anyhow::Result<()> {
         );
     }
 
+    // check if the object counters have been compiled out
+    if cfg!(feature = "no_object_counters")
+        && shadow_config.experimental.use_object_counters.unwrap()
+    {
+        log::warn!(
+            "Object counters are enabled, but they have been compiled out, so object memory leaks \
+             will not be detected"
+        );
+    }
+
     // warn if running with root privileges
     if nix::unistd::getuid().is_root() {
         // a real-world example is opentracker, which will attempt to drop privileges if it detects
@@ -148,10 +168,34 @@ pub fn run_shadow(args: Vec<&OsStr>) -> anyhow::Result<()> {
         );
     }
 
-    // before we run the simulation, clean up any orphaned shared memory
-    if let Err(e) = shm_cleanup::shm_cleanup(shm_cleanup::SHM_DIR_PATH) {
-        log::warn!("Unable to clean up shared memory files: {:?}", e);
-    }
+    // clean up any orphaned shared memory in the background while we set up and run the
+    // simulation; it only removes files of processes that are no longer running, so it won't touch
+    // the files that this simulation creates
+    let shm_cleanup_thread = std::thread::Builder::new()
+        .name("shm-cleanup".into())
+        .spawn(|| shm_cleanup::shm_cleanup(shm_cleanup::SHM_DIR_PATH))
+        .context("Failed to spawn the shared memory cleanup thread")?;
+
+    // the cgroups limit which CPUs shadow can pin its workers to, so must be set up first
+    let cgroups = shadow_config
+        .experimental
+        .use_cgroup_isolation
+        .unwrap()
+        .then(|| {
+            CgroupIsolation::new(
+                shadow_config
+                    .experimental
+                    .managed_cgroup_cpus
+                    .flatten_ref()
+                    .map(String::as_str),
+                shadow_config
+                    .experimental
+                    .managed_cgroup_cpu_limit
+                    .flatten(),
+            )
+        })
+        .transpose()
+        .context("Failed to set up the cgroups for the simulation")?;
 
     // save the platform data required for CPU pinning
     if shadow_config.experimental.use_cpu_pinning.unwrap() {
@@ -214,9 +258,6 @@ pub fn run_shadow(args: Vec<&OsStr>) -> anyhow::Result<()> {
     let sim_config = SimConfig::new(&shadow_config, &options.debug_hosts.unwrap_or_default())
         .context("Failed to initialize the simulation")?;
 
-    // allocate and initialize our main simulation driver
-    let controller = Controller::new(sim_config, &shadow_config);
-
     // enable log buffering if not at trace level
     let buffer_log = !log::log_enabled!(log::Level::Trace);
     shadow_logger::set_buffering_enabled(buffer_log);
@@ -224,8 +265,20 @@ pub fn run_shadow(args: Vec<&OsStr>) -> anyhow::Result<()> {
         log::info!("Log message buffering is enabled for efficiency");
     }
 
-    // run the simulation
-    controller.run().context("Failed to run the simulation")?;
+    match &options.seeds {
+        None => {
+            // allocate and initialize our main simulation driver
+            let controller = Controller::new(sim_config, &shadow_config, cgroups.as_ref());
+
+            // run the simulation
+            controller.run().context("Failed to run the simulation")?;
+        }
+        Some(seeds) => run_seeds(&shadow_config, &sim_config, seeds, cgroups.as_ref())?,
+    }
+
+    if let Err(e) = shm_cleanup_thread.join().unwrap() {
+        log::warn!("Unable to clean up shared memory files: {:?}", e);
+    }
 
     // disable log buffering
     shadow_logger::set_buffering_enabled(false);
@@ -237,6 +290,59 @@ pub fn run_shadow(args: Vec<&OsStr>) -> anyhow::Result<()> {
     Ok(())
 }
 
+/// Run the simulation once with each of `seeds`, one after another. The network graph, routing
+/// information, and IP assignment are only computed once (in `sim_config`) and are shared by every
+/// run. Each run's data directory is the directory 'seed-N' in the configured data directory.
+fn run_seeds(
+    config: &ConfigOptions,
+    sim_config: &SimConfig,
+    seeds: &[u32],
+    cgroups: Option<&CgroupIsolation>,
+) -> anyhow::Result<()> {
+    if let Some(seed) = seeds
+        .iter()
+        .enumerate()
+        .find_map(|(i, x)| seeds[..i].contains(x).then_some(x))
+    {
+        return Err(anyhow::anyhow!("The seed {seed} is given more than once"));
+    }
+
+    let data_directory = config.general.data_directory.as_ref().unwrap();
+    std::fs::create_dir(data_directory)
+        .with_context(|| format!("Failed to create data directory '{data_directory}'"))?;
+
+    let mut failed_seeds = Vec::new();
+
+    for (i, seed) in seeds.iter().enumerate() {
+        let mut seed_config = config.clone();
+        seed_config.general.seed = Some(*seed);
+        seed_config.general.data_directory = Some(format!("{data_directory}/seed-{seed}"));
+
+        log::info!(
+            "Running simulation {} of {} with seed {seed}",
+            i + 1,
+            seeds.len()
+        );
+
+        // the stats written to the data directory are only for this run
+        worker::with_global_sim_stats(|stats| stats.reset());
+
+        let controller = Controller::new(sim_config.with_seed(*seed), &seed_config, cgroups);
+        if let Err(e) = controller.run() {
+            log::error!("Failed to run the simulation with seed {seed}: {e:?}");
+            failed_seeds.push(*seed);
+        }
+    }
+
+    if !failed_seeds.is_empty() {
+        return Err(anyhow::anyhow!(
+            "Failed to run the simulation with seeds {failed_seeds:?}"
+        ));
+    }
+
+    Ok(())
+}
+
 pub fn version() -> String {
     let mut s = env!("CARGO_PKG_VERSION").to_string();
 
@@ -0,0 +1,199 @@
+//! Writing files from a background thread.
+
+use std::fs::File;
+use std::io::Write;
+use std::sync::{Arc, Mutex};
+
+use crossbeam::channel::{Receiver, Sender};
+use once_cell::sync::Lazy;
+
+/// Data is sent to the background thread in chunks of at least this many bytes.
+const CHUNK_SIZE: usize = 1024 * 1024;
+
+/// The maximum number of chunks waiting to be written. Writers block if the background thread
+/// falls this far behind, so that we don't use an unbounded amount of memory when the disk is
+/// slow.
+const MAX_PENDING_CHUNKS: usize = 64;
+
+enum Request {
+    Write(Arc<FileState>, Vec<u8>),
+    /// Reply once all previous requests have been handled.
+    Sync(Sender<()>),
+}
+
+struct FileState {
+    file: File,
+    /// The first error from writing to the file, if any.
+    error: Mutex<Option<std::io::Error>>,
+}
+
+/// The channel to the background thread, which is started the first time it's used. The thread is
+/// shared by all [`BackgroundWriter`]s.
+static SENDER: Lazy<Sender<Request>> = Lazy::new(|| {
+    let (sender, receiver) = crossbeam::channel::bounded(MAX_PENDING_CHUNKS);
+    std::thread::Builder::new()
+        .name("shadow-file-writer".to_string())
+        .spawn(move || writer_thread_fn(receiver))
+        .unwrap();
+    sender
+});
+
+fn writer_thread_fn(receiver: Receiver<Request>) {
+    for request in receiver {
+        match request {
+            Request::Write(state, bytes) => {
+                let mut error = state.error.lock().unwrap();
+                if error.is_none() {
+                    if let Err(e) = (&state.file).write_all(&bytes) {
+                        *error = Some(e);
+                    }
+                }
+            }
+            Request::Sync(reply) => {
+                // the requester may have stopped waiting
+                let _ = reply.send(());
+            }
+        }
+    }
+}
+
+/// A buffered file writer whose writes to the file are done by a background thread, so that the
+/// writer never blocks on disk I/O (unless the background thread falls far behind).
+///
+/// Errors from writing to the file are returned by a later call to [`Write::write`] or
+/// [`Write::flush`]. Dropping the writer waits until all of its data has been written, unless it's
+/// closed with [`BackgroundWriter::close_in_background`].
+pub struct BackgroundWriter {
+    state: Arc<FileState>,
+    buf: Vec<u8>,
+    /// Set by `close_in_background`, after which dropping doesn't wait.
+    closed: bool,
+}
+
+impl BackgroundWriter {
+    pub fn new(file: File) -> Self {
+        Self {
+            state: Arc::new(FileState {
+                file,
+                error: Mutex::new(None),
+            }),
+            buf: Vec::with_capacity(CHUNK_SIZE),
+            closed: false,
+        }
+    }
+
+    /// Send the buffered data to the background thread without waiting for it to be written. The
+    /// background thread closes the file once it's written. Errors from writing that data are
+    /// logged rather than returned. Use [`wait_for_pending_writes`] to wait for the data.
+    pub fn close_in_background(mut self) {
+        if let Err(e) = self.check_error() {
+            log::warn!("Failed to write to file: {e}");
+        }
+        let bytes = std::mem::take(&mut self.buf);
+        if !bytes.is_empty() {
+            SENDER
+                .send(Request::Write(Arc::clone(&self.state), bytes))
+                .unwrap();
+        }
+        self.closed = true;
+    }
+
+    /// Returns an error if a previous write to the file failed.
+    fn check_error(&self) -> std::io::Result<()> {
+        match self.state.error.lock().unwrap().as_ref() {
+            Some(e) => Err(std::io::Error::new(e.kind(), e.to_string())),
+            None => Ok(()),
+        }
+    }
+
+    /// Send the buffered data to the background thread.
+    fn send_buffer(&mut self) {
+        if self.buf.is_empty() {
+            return;
+        }
+
+        let bytes = std::mem::replace(&mut self.buf, Vec::with_capacity(CHUNK_SIZE));
+        SENDER
+            .send(Request::Write(Arc::clone(&self.state), bytes))
+            .unwrap();
+    }
+}
+
+/// Wait until the background thread has written all data that any [`BackgroundWriter`] sent to it
+/// before this call, including data from writers closed with
+/// [`BackgroundWriter::close_in_background`].
+pub fn wait_for_pending_writes() {
+    let (reply_sender, reply_receiver) = crossbeam::channel::bounded(1);
+    SENDER.send(Request::Sync(reply_sender)).unwrap();
+    reply_receiver.recv().unwrap();
+}
+
+impl Write for BackgroundWriter {
+    fn write(&mut self, buf: &[u8]) -> std::io::Result<usize> {
+        self.check_error()?;
+
+        self.buf.extend_from_slice(buf);
+        if self.buf.len() >= CHUNK_SIZE {
+            self.send_buffer();
+        }
+
+        Ok(buf.len())
+    }
+
+    /// Send all buffered data to the background thread and wait for it to be written.
+    fn flush(&mut self) -> std::io::Result<()> {
+        self.send_buffer();
+        wait_for_pending_writes();
+        self.check_error()
+    }
+}
+
+impl Drop for BackgroundWriter {
+    fn drop(&mut self) {
+        if self.closed {
+            return;
+        }
+        if let Err(e) = self.flush() {
+            log::warn!("Failed to write to file: {e}");
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::io::{Read, Seek, SeekFrom};
+
+    use super::*;
+
+    #[test]
+    fn test_write() {
+        let mut file = tempfile::tempfile().unwrap();
+
+        let mut writer = BackgroundWriter::new(file.try_clone().unwrap());
+        let data: Vec<u8> = (0..3 * CHUNK_SIZE).map(|x| x as u8).collect();
+        for chunk in data.chunks(1000) {
+            writer.write_all(chunk).unwrap();
+        }
+        drop(writer);
+
+        file.seek(SeekFrom::Start(0)).unwrap();
+        let mut written = vec![];
+        file.read_to_end(&mut written).unwrap();
+        assert!(written == data);
+    }
+
+    #[test]
+    fn test_close_in_background() {
+        let mut file = tempfile::tempfile().unwrap();
+
+        let mut writer = BackgroundWriter::new(file.try_clone().unwrap());
+        writer.write_all(b"hello").unwrap();
+        writer.close_in_background();
+        wait_for_pending_writes();
+
+        file.seek(SeekFrom::Start(0)).unwrap();
+        let mut written = vec![];
+        file.read_to_end(&mut written).unwrap();
+        assert_eq!(written, b"hello");
+    }
+}
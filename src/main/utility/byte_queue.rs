@@ -4,10 +4,13 @@
  */
 
 use std::collections::LinkedList;
-use std::io::{ErrorKind, Read, Write};
+use std::io::{ErrorKind, IoSlice, Read, Write};
 
 use bytes::{Bytes, BytesMut};
 
+/// The maximum number of chunks to pass to a single vectored write.
+const MAX_WRITE_SLICES: usize = 64;
+
 /// A queue of bytes that supports reading and writing stream and/or packet data.
 ///
 /// Both stream and packet data can be pushed onto the buffer and their order will be preserved.
@@ -67,19 +70,43 @@ impl ByteQueue {
             self.total_allocations += 1;
         }
 
-        BytesMut::from_iter(std::iter::repeat_n(0, size))
+        // uses `calloc()`, which can skip zeroing freshly-mapped memory for large buffers
+        BytesMut::zeroed(size)
     }
 
     /// Push stream data onto the queue. The data may be merged into the previous stream chunk.
-    pub fn push_stream<R: Read>(&mut self, mut src: R) -> std::io::Result<usize> {
+    pub fn push_stream<R: Read>(&mut self, src: R) -> std::io::Result<usize> {
+        self.push_stream_inner(src, None)
+    }
+
+    /// Like [`push_stream()`](Self::push_stream), but reads at most `len` bytes from `src`. If they
+    /// don't fit in the current unused buffer, the new buffer is allocated large enough to hold all
+    /// of the remaining bytes (rather than the default chunk capacity), so that a large write is a
+    /// single allocation and a single read from `src`.
+    pub fn push_stream_sized<R: Read>(&mut self, src: R, len: usize) -> std::io::Result<usize> {
+        self.push_stream_inner(src.take(len.try_into().unwrap()), Some(len))
+    }
+
+    fn push_stream_inner<R: Read>(
+        &mut self,
+        mut src: R,
+        len: Option<usize>,
+    ) -> std::io::Result<usize> {
         let mut total_copied = 0;
 
         loop {
+            if len == Some(total_copied) {
+                break;
+            }
+
             let mut unused = match self.unused_buffer.take() {
                 // we already have an allocated buffer
                 Some(x) => x,
                 // we need to allocate a new buffer
-                None => self.alloc_zeroed_buffer(self.default_chunk_capacity),
+                None => {
+                    let remaining = len.map_or(0, |len| len - total_copied);
+                    self.alloc_zeroed_buffer(std::cmp::max(self.default_chunk_capacity, remaining))
+                }
             };
             assert_eq!(unused.len(), unused.capacity());
 
@@ -194,13 +221,20 @@ impl ByteQueue {
         );
 
         loop {
-            let bytes = match self.bytes.front_mut() {
-                Some(x) if x.chunk_type != ChunkType::Stream => break,
-                Some(x) => &mut x.data,
-                None => break,
-            };
+            // write as many chunks as we can in a single vectored write, so that writers which
+            // support it (such as plugin memory) can copy all of the chunks at once
+            let mut slices = [IoSlice::new(&[]); MAX_WRITE_SLICES];
+            let mut num_slices = 0;
+            for (slice, chunk) in slices.iter_mut().zip(self.stream_chunks()) {
+                *slice = IoSlice::new(chunk);
+                num_slices += 1;
+            }
 
-            let copied = match dst.write(bytes.as_ref()) {
+            if num_slices == 0 {
+                break;
+            }
+
+            let copied = match dst.write_vectored(&slices[..num_slices]) {
                 Ok(x) => x,
                 // may have been interrupted due to a signal, so try again
                 Err(e) if e.kind() == ErrorKind::Interrupted => continue,
@@ -216,21 +250,94 @@ impl ByteQueue {
                 Err(e) => return Err(e),
             };
 
-            let _ = bytes.split_to(copied);
-
             if copied == 0 {
                 break;
             }
 
-            self.length -= copied;
+            self.remove_stream_bytes(copied);
             total_copied += copied;
+        }
 
-            if bytes.is_empty() {
+        Ok(total_copied)
+    }
+
+    /// The chunks of stream data at the front of the queue, up to the first packet chunk (if any).
+    /// This allows callers to copy the stream data out of the queue using a single vectored write,
+    /// after which the bytes can be removed from the queue with
+    /// [`remove_stream_bytes`](Self::remove_stream_bytes).
+    pub fn stream_chunks(&self) -> impl Iterator<Item = &[u8]> {
+        self.bytes
+            .iter()
+            .take_while(|x| x.chunk_type == ChunkType::Stream)
+            .map(|x| x.data.as_ref())
+    }
+
+    /// Remove `len` bytes of stream data from the front of the queue. Panics if the front of the
+    /// queue doesn't have at least `len` bytes of stream data.
+    pub fn remove_stream_bytes(&mut self, mut len: usize) {
+        self.length = self.length.checked_sub(len).unwrap();
+
+        while len > 0 {
+            let chunk = self.bytes.front_mut().unwrap();
+            assert_eq!(chunk.chunk_type, ChunkType::Stream);
+
+            if chunk.data.len() <= len {
+                len -= chunk.data.len();
                 self.bytes.pop_front();
+            } else {
+                let _ = chunk.data.split_to(len);
+                len = 0;
             }
         }
+    }
 
-        Ok(total_copied)
+    /// Move up to `len` bytes of stream data from the front of the queue to the back of `dst`
+    /// without copying them. Stops at the first packet in the queue. Returns the number of bytes
+    /// moved.
+    pub fn move_stream_bytes(&mut self, dst: &mut ByteQueue, len: usize) -> usize {
+        let mut total_moved = 0;
+
+        while total_moved < len {
+            match self.bytes.front() {
+                Some(chunk) if chunk.chunk_type == ChunkType::Stream => {}
+                _ => break,
+            }
+
+            let (bytes, chunk_type) = self.pop_chunk(len - total_moved).unwrap();
+            assert_eq!(chunk_type, ChunkType::Stream);
+
+            total_moved += dst.push_chunk(bytes, ChunkType::Stream);
+        }
+
+        total_moved
+    }
+
+    /// Push new references to up to `len` bytes of stream data at the front of the queue onto the
+    /// back of `dst`, without removing or copying them. Stops at the first packet in the queue.
+    /// Mutable chunks are frozen so that they can be shared, so new stream data will no longer be
+    /// merged into them. Returns the number of bytes shared.
+    pub fn share_stream_bytes(&mut self, dst: &mut ByteQueue, len: usize) -> usize {
+        let mut total_shared = 0;
+
+        for chunk in self.bytes.iter_mut() {
+            if total_shared == len || chunk.chunk_type != ChunkType::Stream {
+                break;
+            }
+
+            if let BytesWrapper::Mutable(_) = chunk.data {
+                let data = std::mem::replace(&mut chunk.data, Bytes::new().into());
+                chunk.data = BytesWrapper::Immutable(data.into());
+            }
+
+            let BytesWrapper::Immutable(bytes) = &chunk.data else {
+                unreachable!();
+            };
+
+            let num = std::cmp::min(bytes.len(), len - total_shared);
+            total_shared += dst.push_chunk(bytes.slice(..num), ChunkType::Stream);
+        }
+
+        total_shared
     }
 
     fn pop_packet<W: Write>(&mut self, mut dst: W) -> std::io::Result<(usize, usize)> {
@@ -587,6 +694,33 @@ mod tests {
         assert_eq!(bq.num_bytes(), 0);
     }
 
+    #[test]
+    fn test_bytequeue_stream_sized() {
+        let mut bq = ByteQueue::new(10);
+
+        let src: Vec<u8> = (0..1000).map(|x| x as u8).collect();
+        assert_eq!(
+            bq.push_stream_sized(&src[..], src.len()).unwrap(),
+            src.len()
+        );
+
+        // a single allocation rather than one per 10 bytes
+        assert_eq!(bq.total_allocations, 1);
+        assert_eq!(bq.bytes.len(), 1);
+
+        // a short source still works
+        assert_eq!(bq.push_stream_sized(&src[..5], 100).unwrap(), 5);
+        assert_eq!(bq.total_allocations, 2);
+
+        let mut dst = vec![];
+        assert_eq!(
+            bq.pop(&mut dst).unwrap(),
+            Some((1005, 1005, ChunkType::Stream))
+        );
+        assert_eq!(&dst[..1000], &src[..]);
+        assert_eq!(&dst[1000..], &src[..5]);
+    }
+
     #[test]
     fn test_bytequeue_combined_1() {
         let mut bq = ByteQueue::new(10);
@@ -718,6 +852,79 @@ mod tests {
         assert_eq!(bq.num_bytes(), 3);
     }
 
+    #[test]
+    fn test_bytequeue_stream_chunks() {
+        let mut bq = ByteQueue::new(10);
+
+        bq.push_chunk(Bytes::from_static(&[1, 2, 3]), ChunkType::Stream);
+        bq.push_chunk(Bytes::from_static(&[4, 5]), ChunkType::Stream);
+        bq.push_chunk(Bytes::from_static(&[6]), ChunkType::Packet);
+        bq.push_chunk(Bytes::from_static(&[7, 8]), ChunkType::Stream);
+        bq.push_chunk(Bytes::from_static(&[9]), ChunkType::Stream);
+
+        assert_eq!(
+            bq.stream_chunks().collect::<Vec<_>>(),
+            [&[1, 2, 3][..], &[4, 5][..]]
+        );
+
+        bq.remove_stream_bytes(4);
+        assert_eq!(bq.stream_chunks().collect::<Vec<_>>(), [&[5][..]]);
+        assert_eq!(bq.num_bytes(), 5);
+
+        let mut buf = [0u8; 4];
+        assert_eq!(
+            bq.pop(&mut buf[..]).unwrap(),
+            Some((1, 1, ChunkType::Stream))
+        );
+        assert_eq!(
+            bq.pop(&mut buf[..]).unwrap(),
+            Some((1, 1, ChunkType::Packet))
+        );
+
+        // the remaining stream chunks are popped together
+        let mut buf = vec![];
+        assert_eq!(bq.pop(&mut buf).unwrap(), Some((3, 3, ChunkType::Stream)));
+        assert_eq!(buf, [7, 8, 9]);
+        assert!(!bq.has_chunks());
+    }
+
+    #[test]
+    fn test_bytequeue_move_and_share_stream_bytes() {
+        let mut src = ByteQueue::new(4);
+        let mut dst = ByteQueue::new(4);
+
+        src.push_stream(&[1, 2, 3, 4, 5, 6][..]).unwrap();
+        src.push_chunk(Bytes::from_static(&[7]), ChunkType::Packet);
+        src.push_stream(&[8, 9][..]).unwrap();
+
+        // sharing doesn't remove the bytes, and stops at the packet
+        assert_eq!(src.share_stream_bytes(&mut dst, 100), 6);
+        assert_eq!(src.num_bytes(), 9);
+        assert_eq!(dst.num_bytes(), 6);
+
+        // moving splits the last chunk
+        assert_eq!(src.move_stream_bytes(&mut dst, 5), 5);
+        assert_eq!(src.num_bytes(), 4);
+        assert_eq!(dst.num_bytes(), 11);
+        assert_eq!(src.move_stream_bytes(&mut dst, 5), 1);
+        assert_eq!(src.move_stream_bytes(&mut dst, 5), 0);
+
+        // no new allocations were made for the destination
+        assert_eq!(dst.total_allocations, 0);
+
+        let mut buf = vec![];
+        assert_eq!(
+            dst.pop(&mut buf).unwrap(),
+            Some((12, 12, ChunkType::Stream))
+        );
+        assert_eq!(buf, [1, 2, 3, 4, 5, 6, 1, 2, 3, 4, 5, 6]);
+
+        let mut buf = vec![];
+        assert_eq!(src.pop(&mut buf).unwrap(), Some((1, 1, ChunkType::Packet)));
+        assert_eq!(src.pop(&mut buf).unwrap(), Some((2, 2, ChunkType::Stream)));
+        assert_eq!(buf, [7, 8, 9]);
+    }
+
     /// Test that the peek output always matches the pop output.
     #[test]
     fn test_bytequeue_peek() {
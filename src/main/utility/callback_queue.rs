@@ -4,21 +4,39 @@
 //! attempting to mutate the same state simultaneously, an event queue is used to defer new events
 //! until the current event has finished running.
 
+use std::cell::RefCell;
 use std::collections::VecDeque;
+use std::marker::PhantomData;
+use std::mem::{ManuallyDrop, MaybeUninit};
 use std::num::Wrapping;
 use std::sync::{Arc, Weak};
 
 use atomic_refcell::AtomicRefCell;
 
+/// The maximum number of unused queue allocations kept by each thread.
+const SPARE_QUEUES_CAPACITY: usize = 16;
+
+/// Queue allocations that have grown larger than this many callbacks aren't kept for reuse.
+const SPARE_QUEUE_MAX_LEN: usize = 1024;
+
+std::thread_local! {
+    /// Empty queue allocations from dropped queues, so that new queues don't need to allocate.
+    static SPARE_QUEUES: RefCell<Vec<VecDeque<Callback>>> = const { RefCell::new(Vec::new()) };
+}
+
 /// A queue of events (functions/closures) which when run can add their own events to the queue.
 /// This allows events to be deferred and run later.
-#[allow(clippy::type_complexity)]
-pub struct CallbackQueue(VecDeque<Box<dyn FnOnce(&mut Self)>>);
+pub struct CallbackQueue(VecDeque<Callback>);
 
 impl CallbackQueue {
-    /// Create an empty event queue.
+    /// Create an empty event queue. This reuses the allocation of a previously dropped queue on
+    /// this thread if there is one.
     pub fn new() -> Self {
-        Self(VecDeque::new())
+        let spare = SPARE_QUEUES
+            .try_with(|spare| spare.borrow_mut().pop())
+            .ok()
+            .flatten();
+        Self(spare.unwrap_or_default())
     }
 
     pub fn len(&self) -> usize {
@@ -31,7 +49,7 @@ impl CallbackQueue {
 
     /// Add an event to the queue.
     pub fn add(&mut self, f: impl FnOnce(&mut Self) + 'static) {
-        self.0.push_back(Box::new(f));
+        self.0.push_back(Callback::new(f));
     }
 
     /// Process all of the events in the queue (and any new events that are generated).
@@ -40,7 +58,7 @@ impl CallbackQueue {
         let mut count = 0;
         while let Some(f) = self.0.pop_front() {
             // run the event and allow it to add new events
-            (f)(self);
+            f.call(self);
 
             count += 1;
             if count == 10_000 {
@@ -100,6 +118,99 @@ impl Drop for CallbackQueue {
             // panic in debug builds since the backtrace will be helpful for debugging
             debug_panic!("Dropping EventQueue while it still has events pending.");
         }
+
+        // keep the allocation for reuse
+        let mut queue = std::mem::take(&mut self.0);
+        queue.clear();
+        if queue.capacity() == 0 || queue.capacity() > SPARE_QUEUE_MAX_LEN {
+            return;
+        }
+        let _ = SPARE_QUEUES.try_with(|spare| {
+            let mut spare = spare.borrow_mut();
+            if spare.len() < SPARE_QUEUES_CAPACITY {
+                spare.push(queue);
+            }
+        });
+    }
+}
+
+/// The number of words that a [`Callback`] can store inline.
+const CALLBACK_INLINE_WORDS: usize = 6;
+
+/// A `FnOnce(&mut CallbackQueue)` closure. Closures that are small enough (such as the closures
+/// created for each listener in [`EventSource::notify_listeners`]) are stored inline rather than
+/// being boxed, so that queueing them doesn't allocate.
+struct Callback {
+    storage: MaybeUninit<[usize; CALLBACK_INLINE_WORDS]>,
+    /// Runs the closure stored in `storage` with the queue, or drops it if there is no queue. Must
+    /// be called exactly once.
+    run_or_drop: unsafe fn(*mut u8, Option<&mut CallbackQueue>),
+    /// The closure may not be `Send` or `Sync`.
+    _phantom: PhantomData<*const ()>,
+}
+
+impl Callback {
+    fn new<F: FnOnce(&mut CallbackQueue) + 'static>(f: F) -> Self {
+        if Self::fits_inline::<F>() {
+            Self::new_inline(f)
+        } else {
+            let f = Box::new(f);
+            Self::new_inline(move |cb_queue: &mut CallbackQueue| (f)(cb_queue))
+        }
+    }
+
+    const fn fits_inline<F>() -> bool {
+        size_of::<F>() <= size_of::<[usize; CALLBACK_INLINE_WORDS]>()
+            && align_of::<F>() <= align_of::<[usize; CALLBACK_INLINE_WORDS]>()
+    }
+
+    #[cfg(test)]
+    fn fits_inline_val<F>(_f: &F) -> bool {
+        Self::fits_inline::<F>()
+    }
+
+    fn new_inline<F: FnOnce(&mut CallbackQueue) + 'static>(f: F) -> Self {
+        assert!(Self::fits_inline::<F>());
+
+        let mut storage = MaybeUninit::<[usize; CALLBACK_INLINE_WORDS]>::uninit();
+        // SAFETY: we checked that `F` fits in the storage and isn't over-aligned
+        unsafe { storage.as_mut_ptr().cast::<F>().write(f) };
+
+        Self {
+            storage,
+            run_or_drop: Self::run_or_drop_inline::<F>,
+            _phantom: PhantomData,
+        }
+    }
+
+    /// # Safety
+    ///
+    /// `ptr` must point to an initialized `F`, which must not be used after this call.
+    unsafe fn run_or_drop_inline<F: FnOnce(&mut CallbackQueue)>(
+        ptr: *mut u8,
+        cb_queue: Option<&mut CallbackQueue>,
+    ) {
+        // SAFETY: guaranteed by the caller
+        let f = unsafe { ptr.cast::<F>().read() };
+        if let Some(cb_queue) = cb_queue {
+            (f)(cb_queue);
+        }
+    }
+
+    fn call(self, cb_queue: &mut CallbackQueue) {
+        // we're moving the closure out of the storage, so we must not run our drop impl
+        let mut this = ManuallyDrop::new(self);
+        // SAFETY: the storage holds the closure that `run_or_drop` expects, and it won't be used
+        // again
+        unsafe { (this.run_or_drop)(this.storage.as_mut_ptr().cast(), Some(cb_queue)) };
+    }
+}
+
+impl Drop for Callback {
+    fn drop(&mut self) {
+        // SAFETY: the storage holds the closure that `run_or_drop` expects, and it won't be used
+        // again
+        unsafe { (self.run_or_drop)(self.storage.as_mut_ptr().cast(), None) };
     }
 }
 
@@ -238,4 +349,69 @@ mod tests {
 
         assert_eq!(*counter.borrow(), 4);
     }
+
+    #[test]
+    fn test_callback_sizes() {
+        // the closures created by `notify_listeners()` for file listeners are stored inline
+        let listener: Listener<(u64, u64, u64)> = Arc::new(|_, _| {});
+        let message = (0u64, 0u64, 0u64);
+        let f = move |cb_queue: &mut CallbackQueue| (listener)(message, cb_queue);
+        assert!(Callback::fits_inline_val(&f));
+
+        let large = [0u64; 16];
+        let f = move |_: &mut CallbackQueue| {
+            std::hint::black_box(large);
+        };
+        assert!(!Callback::fits_inline_val(&f));
+
+        let aligned = 0u128;
+        let f = move |_: &mut CallbackQueue| {
+            std::hint::black_box(aligned);
+        };
+        assert!(!Callback::fits_inline_val(&f));
+    }
+
+    #[test]
+    fn test_callback_run_order_and_drop() {
+        let order = std::rc::Rc::new(RefCell::new(Vec::new()));
+        // dropped when the closures holding it are dropped
+        let token = std::rc::Rc::new(());
+
+        let mut queue = CallbackQueue::new();
+
+        // a small closure that adds a new callback when run
+        let order_clone = order.clone();
+        let token_clone = token.clone();
+        queue.add(move |cb_queue| {
+            let _token = &token_clone;
+            order_clone.borrow_mut().push(1);
+            let order_clone = order_clone.clone();
+            cb_queue.add(move |_| order_clone.borrow_mut().push(3));
+        });
+
+        // a large closure that is boxed
+        let order_clone = order.clone();
+        let token_clone = token.clone();
+        let large = [2u64; 16];
+        queue.add(move |_| {
+            let _token = &token_clone;
+            order_clone.borrow_mut().push(large[0] as u32);
+        });
+
+        assert_eq!(std::rc::Rc::strong_count(&token), 3);
+        queue.run();
+        assert_eq!(*order.borrow(), [1, 2, 3]);
+        assert_eq!(std::rc::Rc::strong_count(&token), 1);
+
+        // closures that never run are still dropped
+        let mut queue = CallbackQueue::new();
+        let token_clone = token.clone();
+        queue.add(move |_| drop(token_clone));
+        let token_clone = token.clone();
+        let large = [0u64; 16];
+        queue.add(move |_| drop((token_clone, large)));
+        assert_eq!(std::rc::Rc::strong_count(&token), 3);
+        queue.0.clear();
+        assert_eq!(std::rc::Rc::strong_count(&token), 1);
+    }
 }
@@ -22,6 +22,9 @@ pub struct ChildPidWatcher {
 
 pub type WatchHandle = u64;
 
+/// The maximum number of epoll events handled each time the watcher thread wakes up.
+const EVENTS_PER_WAKEUP: usize = 1024;
+
 #[derive(Debug)]
 enum Command {
     RunCallbacks(Pid),
@@ -29,9 +32,49 @@ enum Command {
     Finish,
 }
 
+type Callback = Box<dyn Send + FnOnce(Pid)>;
+
+/// The callbacks registered for a pid. Most pids only ever have one, so the first is stored inline
+/// and only additional callbacks are stored in a (lazily allocated) vector.
+#[derive(Default)]
+struct Callbacks {
+    first: Option<(WatchHandle, Callback)>,
+    rest: Vec<(WatchHandle, Callback)>,
+}
+
+impl Callbacks {
+    fn insert(&mut self, handle: WatchHandle, callback: Callback) {
+        if self.first.is_none() {
+            self.first = Some((handle, callback));
+        } else {
+            self.rest.push((handle, callback));
+        }
+    }
+
+    fn remove(&mut self, handle: WatchHandle) {
+        if self.first.as_ref().is_some_and(|(h, _)| *h == handle) {
+            // keep the next callback inline
+            self.first = self.rest.pop();
+        } else if let Some(i) = self.rest.iter().position(|(h, _)| *h == handle) {
+            drop(self.rest.swap_remove(i));
+        }
+    }
+
+    fn is_empty(&self) -> bool {
+        self.first.is_none() && self.rest.is_empty()
+    }
+
+    /// Run and remove all of the callbacks, in no particular order.
+    fn run(&mut self, pid: Pid) {
+        for (_handle, cb) in self.first.take().into_iter().chain(self.rest.drain(..)) {
+            cb(pid)
+        }
+    }
+}
+
 struct PidData {
     // Registered callbacks.
-    callbacks: HashMap<WatchHandle, Box<dyn Send + FnOnce(Pid)>>,
+    callbacks: Callbacks,
     // After the pid has exited, this fd is closed and set to None.
     pidfd: Option<OwnedFd>,
     // Whether this pid has been unregistered. The whole struct is removed after
@@ -82,9 +125,7 @@ impl Inner {
     }
 
     fn run_callbacks_for_pid(&mut self, pid: Pid) {
-        for (_handle, cb) in self.pids.get_mut(&pid).unwrap().callbacks.drain() {
-            cb(pid)
-        }
+        self.pids.get_mut(&pid).unwrap().callbacks.run(pid)
     }
 
     fn should_remove_pid(&mut self, pid: Pid) -> bool {
@@ -140,9 +181,11 @@ impl ChildPidWatcher {
 
     fn thread_loop(inner: &Mutex<Inner>, epoll: impl AsFd) {
         let mut commands = Vec::new();
+        // Reused across wake-ups, so that the exits of many children can be handled in one batch
+        // without allocating.
+        let mut events = epoll::EventVec::with_capacity(EVENTS_PER_WAKEUP);
         let mut done = false;
         while !done {
-            let mut events = epoll::EventVec::with_capacity(10);
             match epoll::wait(epoll.as_fd(), &mut events, -1) {
                 Ok(()) => (),
                 Err(rustix::io::Errno::INTR) => {
@@ -159,10 +202,12 @@ impl ChildPidWatcher {
             // caller unregisters it.
             let mut inner = inner.lock().unwrap();
 
-            for event in events.into_iter() {
+            let mut notified = false;
+            for event in &events {
                 if event.data.u64() == 0 {
                     // We get an event for pid=0 when there's a write to the
                     // command_notifier; Ignore that here and handle below.
+                    notified = true;
                     continue;
                 }
                 let pid = Pid::from_raw(i32::try_from(event.data.u64()).unwrap()).unwrap();
@@ -170,16 +215,18 @@ impl ChildPidWatcher {
                 inner.run_callbacks_for_pid(pid);
                 inner.maybe_remove_pid(epoll.as_fd(), pid);
             }
-            // Reading an eventfd always returns an 8 byte integer. Do so to ensure it's
-            // no longer marked 'readable'.
-            let mut buf = [0; 8];
-            let res = rustix::io::read(&inner.command_notifier, &mut buf);
-            debug_assert!(match res {
-                Ok(8) => true,
-                Ok(i) => panic!("Unexpected read size {}", i),
-                Err(rustix::io::Errno::AGAIN) => true,
-                Err(e) => panic!("Unexpected error {:?}", e),
-            });
+            if notified {
+                // Reading an eventfd always returns an 8 byte integer. Do so to ensure it's
+                // no longer marked 'readable'.
+                let mut buf = [0; 8];
+                let res = rustix::io::read(&inner.command_notifier, &mut buf);
+                debug_assert!(match res {
+                    Ok(8) => true,
+                    Ok(i) => panic!("Unexpected read size {}", i),
+                    Err(rustix::io::Errno::AGAIN) => true,
+                    Err(e) => panic!("Unexpected error {:?}", e),
+                });
+            }
             // Run commands
             std::mem::swap(&mut commands, &mut inner.commands);
             for cmd in commands.drain(..) {
@@ -245,7 +292,6 @@ impl ChildPidWatcher {
     /// function both to avoid such panics, and to avoid accidentally watching
     /// an unrelated process with a recycled `pid`.
     pub fn register_pid(&self, pid: Pid) {
-        let mut inner = self.inner.lock().unwrap();
         // We defensively make the pidfd non-blocking, since we intend to always
         // use epoll to validate that it's ready before operating on it.
         let pidfd = rustix::process::pidfd_open(pid.into(), PidfdFlags::NONBLOCK)
@@ -257,6 +303,11 @@ impl ChildPidWatcher {
                 .contains(FdFlags::CLOEXEC),
             "pidfd_open unexpected didn't set CLOEXEC"
         );
+
+        // Open the pidfd before taking the lock, so that registering many children doesn't hold
+        // up the watcher thread. We hold the lock while adding the pidfd to the epoll set and
+        // inserting the pid, so that the watcher thread can't handle its exit before then.
+        let mut inner = self.inner.lock().unwrap();
         epoll::add(
             &self.epoll,
             &pidfd,
@@ -268,7 +319,7 @@ impl ChildPidWatcher {
         let prev = inner.pids.insert(
             pid,
             PidData {
-                callbacks: HashMap::new(),
+                callbacks: Callbacks::default(),
                 pidfd: Some(pidfd),
                 unregistered: false,
             },
@@ -327,7 +378,7 @@ impl ChildPidWatcher {
     pub fn unregister_callback(&self, pid: Pid, handle: WatchHandle) {
         let mut inner = self.inner.lock().unwrap();
         if let Some(pid_data) = inner.pids.get_mut(&pid) {
-            pid_data.callbacks.remove(&handle);
+            pid_data.callbacks.remove(handle);
             inner.maybe_remove_pid(&self.epoll, pid);
         }
     }
@@ -614,4 +665,41 @@ mod tests {
             Some(42)
         );
     }
+
+    #[test]
+    // can't call foreign functions
+    #[cfg_attr(miri, ignore)]
+    fn many_children() {
+        // More children than the watcher handles per wake-up.
+        const CHILDREN: usize = EVENTS_PER_WAKEUP + 100;
+
+        let watcher = ChildPidWatcher::new();
+        let exited = Arc::new((Mutex::new(0), Condvar::new()));
+
+        let mut children = Vec::new();
+        for _ in 0..CHILDREN {
+            let child = unsafe { watcher.fork_watchable(|| libc::_exit(42)) }.unwrap();
+            let exited = exited.clone();
+            watcher.register_callback(child, move |_pid| {
+                *exited.0.lock().unwrap() += 1;
+                exited.1.notify_all();
+            });
+            watcher.unregister_pid(child);
+            children.push(child);
+        }
+
+        // Wait for all of the callbacks to run.
+        let mut exited_lock = exited.0.lock().unwrap();
+        while *exited_lock < CHILDREN {
+            exited_lock = exited.1.wait(exited_lock).unwrap();
+        }
+        drop(exited_lock);
+
+        for child in children {
+            let status = waitpid(Some(child.into()), WaitOptions::empty())
+                .unwrap()
+                .unwrap();
+            assert_eq!(status.exit_status(), Some(42));
+        }
+    }
 }
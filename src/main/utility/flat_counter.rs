@@ -0,0 +1,119 @@
+/*!
+A counter for small integer keys, such as syscall numbers or interned names. The counts are stored
+in a flat array indexed by the key, so counting doesn't need to hash or allocate once the array has
+grown to fit the largest key. Counters can be converted to a [`Counter`] with named keys for
+output.
+*/
+
+use super::counter::Counter;
+
+/// Counts values for integer keys.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct FlatCounter {
+    counts: Vec<i64>,
+}
+
+impl FlatCounter {
+    /// Initializes a new counter with all counts 0.
+    pub const fn new() -> Self {
+        Self { counts: Vec::new() }
+    }
+
+    /// Increment the counter value by one for `key`.
+    #[inline]
+    pub fn add_one(&mut self, key: usize) {
+        self.add_value(key, 1)
+    }
+
+    /// Increment the counter value by the given value for `key`.
+    #[inline]
+    pub fn add_value(&mut self, key: usize, value: i64) {
+        if key >= self.counts.len() {
+            self.counts.resize(key + 1, 0);
+        }
+        self.counts[key] += value;
+    }
+
+    /// Returns the counter value for `key`.
+    pub fn get_value(&self, key: usize) -> i64 {
+        self.counts.get(key).copied().unwrap_or(0)
+    }
+
+    /// Add all values in `other` to this counter.
+    pub fn add_counter(&mut self, other: &FlatCounter) {
+        if other.counts.len() > self.counts.len() {
+            self.counts.resize(other.counts.len(), 0);
+        }
+        // a simple loop over two slices, which the compiler vectorizes
+        for (count, other) in self.counts.iter_mut().zip(&other.counts) {
+            *count += other;
+        }
+    }
+
+    /// Returns the keys and values of the non-zero counts, in key order.
+    pub fn iter(&self) -> impl Iterator<Item = (usize, i64)> + '_ {
+        self.counts
+            .iter()
+            .enumerate()
+            .filter(|(_, count)| **count != 0)
+            .map(|(key, count)| (key, *count))
+    }
+
+    /// Convert to a [`Counter`], using `name` to get each key's name. Keys with the same name are
+    /// combined.
+    pub fn to_counter<'a>(&self, mut name: impl FnMut(usize) -> &'a str) -> Counter {
+        let mut counter = Counter::new();
+        for (key, count) in self.iter() {
+            counter.add_value(name(key), count);
+        }
+        counter
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_add_value() {
+        let mut counter = FlatCounter::new();
+        assert_eq!(counter.get_value(3), 0);
+        counter.add_one(3);
+        counter.add_value(3, 10);
+        counter.add_value(0, -2);
+        assert_eq!(counter.get_value(0), -2);
+        assert_eq!(counter.get_value(3), 11);
+        assert_eq!(counter.get_value(100), 0);
+        assert_eq!(counter.iter().collect::<Vec<_>>(), [(0, -2), (3, 11)]);
+    }
+
+    #[test]
+    fn test_add_counter() {
+        let mut counter_a = FlatCounter::new();
+        counter_a.add_value(1, 5);
+
+        let mut counter_b = FlatCounter::new();
+        counter_b.add_value(1, 2);
+        counter_b.add_value(7, 3);
+
+        counter_a.add_counter(&counter_b);
+        assert_eq!(counter_a.iter().collect::<Vec<_>>(), [(1, 7), (7, 3)]);
+
+        // adding a shorter counter
+        counter_b.add_counter(&counter_a);
+        assert_eq!(counter_b.iter().collect::<Vec<_>>(), [(1, 9), (7, 6)]);
+    }
+
+    #[test]
+    fn test_to_counter() {
+        let mut counter = FlatCounter::new();
+        counter.add_value(0, 1);
+        counter.add_value(1, 2);
+        counter.add_value(2, 4);
+
+        let names = ["read", "write", "read"];
+        let counter = counter.to_counter(|key| names[key]);
+        assert_eq!(counter.get_value("read"), 5);
+        assert_eq!(counter.get_value("write"), 2);
+    }
+}
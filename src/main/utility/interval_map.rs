@@ -1,3 +1,4 @@
+use std::collections::BTreeMap;
 use std::ops::Range;
 
 pub type Interval = Range<usize>;
@@ -43,81 +44,71 @@ pub enum Mutation<V> {
 }
 
 pub struct ItemIter<'a, V> {
-    map: &'a IntervalMap<V>,
-    i: usize,
+    inner: std::collections::btree_map::Range<'a, usize, (usize, V)>,
 }
 
 impl<'a, V> Iterator for ItemIter<'a, V> {
     type Item = (Interval, &'a V);
 
     fn next(&mut self) -> Option<Self::Item> {
-        let i = self.i;
-        let m = self.map;
-        if i >= m.starts.len() {
-            return None;
-        }
-        let rv = Some(((m.starts[i]..m.ends[i]), &m.vals[i]));
-        self.i += 1;
-        rv
+        self.inner
+            .next()
+            .map(|(start, (end, val))| (*start..*end, val))
     }
 }
 
 pub struct KeyIter<'a, V> {
-    map: &'a IntervalMap<V>,
-    i: usize,
+    inner: std::collections::btree_map::Range<'a, usize, (usize, V)>,
 }
 
 impl<V> Iterator for KeyIter<'_, V> {
     type Item = Interval;
 
     fn next(&mut self) -> Option<Self::Item> {
-        let i = self.i;
-        let m = self.map;
-        if i >= m.starts.len() {
-            return None;
-        }
-        let rv = Some(m.starts[i]..m.ends[i]);
-        self.i += 1;
-        rv
+        self.inner.next().map(|(start, (end, _))| *start..*end)
     }
 }
 
 #[derive(Clone, Debug)]
 pub struct IntervalMap<V> {
-    starts: Vec<usize>,
-    ends: Vec<usize>,
-    vals: Vec<V>,
+    // Maps the start of each interval to its end and value. Using a B-tree (rather than sorted
+    // vectors) keeps the cost of splitting, merging, and removing intervals logarithmic in the
+    // number of intervals, which matters for processes with many memory mappings.
+    intervals: BTreeMap<usize, (usize, V)>,
 }
 
 /// Maps from non-overlapping `Interval`s to `V`.
 impl<V: Clone> IntervalMap<V> {
     pub fn new() -> IntervalMap<V> {
         IntervalMap {
-            starts: Vec::new(),
-            ends: Vec::new(),
-            vals: Vec::new(),
+            intervals: BTreeMap::new(),
         }
     }
 
     /// Returns iterator over all intervals keys, in sorted order.
     pub fn keys(&self) -> KeyIter<V> {
-        KeyIter { map: self, i: 0 }
+        KeyIter {
+            inner: self.intervals.range(..),
+        }
     }
 
     /// Returns iterator over all intervals keys and their values, in order by interval key.
     pub fn iter(&self) -> ItemIter<V> {
-        ItemIter { map: self, i: 0 }
+        ItemIter {
+            inner: self.intervals.range(..),
+        }
     }
 
     /// Returns iterator over all interval keys and their values, starting with the first interval
     /// containing or after `begin`.
     pub fn iter_from(&self, begin: usize) -> ItemIter<V> {
-        let idx = match self.starts.binary_search(&begin) {
-            Ok(i) => i,
-            Err(i) if (i > 0 && begin < self.ends[i - 1]) => i - 1,
-            Err(i) => i,
+        let from = match self.get_start(begin) {
+            Some(start) => start,
+            None => begin,
         };
-        ItemIter { map: self, i: idx }
+        ItemIter {
+            inner: self.intervals.range(from..),
+        }
     }
 
     /// Mutates the map so that the given range maps to nothing, modifying and removing intervals
@@ -147,138 +138,92 @@ impl<V: Clone> IntervalMap<V> {
         // List of mutations we had to perform to do the splice, which we'll ultimately return.
         let mut mutations = Vec::new();
 
-        // Vectors that we'll ultimately splice insto self.{starts,ends,vals}.
-        let mut starts_insertions = Vec::new();
-        let mut ends_insertions = Vec::new();
-        let mut vals_insertions = Vec::new();
-
-        // We'll splice in the provided value, if any.
-        if let Some(v) = val {
-            starts_insertions.push(start);
-            ends_insertions.push(end);
-            vals_insertions.push(v);
-        };
-
-        // We're eventually going to call Vec::splice on our vectors, and
-        // this will be the starting index.
-        let splice_start = match self.starts.binary_search(&start) {
-            Ok(i) | Err(i) => i,
-        };
-
-        // Check whether there's an interval before the splice point,
-        // and if so whether it overlaps.
-        if splice_start > 0 && self.ends[splice_start - 1] > start {
-            let overlapping_idx = splice_start - 1;
-            let overlapping_int = self.starts[overlapping_idx]..self.ends[overlapping_idx];
-
-            if overlapping_int.end <= end {
-                // overlapping_int :   -----
-                // - (start, end)  :      -----
-                //           --->  :   ---
-                self.ends[overlapping_idx] = start;
-                mutations.push(Mutation::ModifiedEnd(
-                    overlapping_int,
-                    self.ends[overlapping_idx],
-                ));
-            } else {
-                // If it ends after the end of our interval, we need to split it.
-                // overlapping_int : ----------
-                // - (start, end)  :    ----
-                //           --->  : ---    ---
-                let new1 = overlapping_int.start..start;
-                let new2 = end..overlapping_int.end;
-
-                // Truncate the existing interval.
-                self.ends[overlapping_idx] = new1.end;
-
-                // Create a new interval, starting after the insertion interval.
-                starts_insertions.push(new2.start);
-                ends_insertions.push(new2.end);
-                vals_insertions.push(self.vals[overlapping_idx].clone());
-                mutations.push(Mutation::Split(overlapping_int, new1, new2));
-            }
-        }
-
-        // Find the end of the splice interval, which is the index of the first interval that ends
-        // after the splice end (after having clipped the end of any existing interval contained in
-        // the range, above).
-        let splice_end = match self.ends.binary_search(&end) {
-            Ok(i) => i + 1,
-            Err(i) => i,
-        };
-
-        // Check whether we need to clip the startning of splice_end's interval.
-        let mut modified_start: Option<Mutation<V>> = None;
-        if splice_end < self.starts.len()
-            && self.starts[splice_end] < end
-            && self.ends[splice_end] > end
+        // Check whether there's an interval starting before the splice interval, and if so whether
+        // it overlaps.
+        if let Some((&overlapping_start, (overlapping_end, overlapping_val))) =
+            self.intervals.range_mut(..start).next_back()
         {
-            let overlapping_idx = splice_end;
-            let overlapping_int = self.starts[overlapping_idx]..self.ends[overlapping_idx];
-            // overlapping_int :   ------
-            // - (start, end)  : -----
-            //           --->  :      ---
-            self.starts[overlapping_idx] = end;
-            // We don't push this onto `mutations` yet because we want to keep it sorted, and this
-            // will always be the last mutation.
-            modified_start = Some(Mutation::ModifiedBegin(
-                overlapping_int,
-                self.starts[overlapping_idx],
-            ));
+            if *overlapping_end > start {
+                let overlapping_int = overlapping_start..*overlapping_end;
+
+                if overlapping_int.end <= end {
+                    // overlapping_int :   -----
+                    // - (start, end)  :      -----
+                    //           --->  :   ---
+                    *overlapping_end = start;
+                    mutations.push(Mutation::ModifiedEnd(overlapping_int, start));
+                } else {
+                    // If it ends after the end of our interval, we need to split it.
+                    // overlapping_int : ----------
+                    // - (start, end)  :    ----
+                    //           --->  : ---    ---
+                    let new1 = overlapping_int.start..start;
+                    let new2 = end..overlapping_int.end;
+
+                    // Truncate the existing interval, and create a new interval starting after
+                    // the splice interval. No other intervals can overlap the splice interval.
+                    *overlapping_end = new1.end;
+                    let new2_val = overlapping_val.clone();
+                    self.intervals.insert(new2.start, (new2.end, new2_val));
+                    mutations.push(Mutation::Split(overlapping_int, new1, new2));
+
+                    if let Some(v) = val {
+                        self.intervals.insert(start, (end, v));
+                    }
+                    return mutations;
+                }
+            }
         }
 
-        // Do the splice into each parallel vector, tracking intervals that are dropped completely.
+        // Remove the intervals that start within the splice interval, tracking intervals that are
+        // dropped completely.
         // dropped         :   --- --- --- --- --- ----
         // - (start, end)  : ----------------------------
         //           --->  :
-        let dropped_starts = self
-            .starts
-            .splice(splice_start..splice_end, starts_insertions);
-        let dropped_ends = self.ends.splice(splice_start..splice_end, ends_insertions);
-        let mut dropped_vals = self.vals.splice(splice_start..splice_end, vals_insertions);
-        for (dropped_start, dropped_end) in dropped_starts.zip(dropped_ends) {
-            mutations.push(Mutation::Removed(
-                dropped_start..dropped_end,
-                dropped_vals.next().unwrap(),
-            ));
+        while let Some((&overlapping_start, &(overlapping_end, _))) =
+            self.intervals.range(start..end).next()
+        {
+            let (_, overlapping_val) = self.intervals.remove(&overlapping_start).unwrap();
+            let overlapping_int = overlapping_start..overlapping_end;
+
+            if overlapping_end <= end {
+                mutations.push(Mutation::Removed(overlapping_int, overlapping_val));
+            } else {
+                // This is the last interval that overlaps, so we need to clip its start.
+                // overlapping_int :   ------
+                // - (start, end)  : -----
+                //           --->  :      ---
+                self.intervals
+                    .insert(end, (overlapping_end, overlapping_val));
+                mutations.push(Mutation::ModifiedBegin(overlapping_int, end));
+                break;
+            }
         }
 
-        // Do the modified startning, if any, last, so that mutations are ordered.
-        if let Some(m) = modified_start {
-            mutations.push(m)
+        // We'll splice in the provided value, if any.
+        if let Some(v) = val {
+            self.intervals.insert(start, (end, v));
         }
 
         mutations
     }
 
-    // Returns the index of the interval containing `x`.
-    fn get_index(&self, x: usize) -> Option<usize> {
-        match self.starts.binary_search(&x) {
-            Ok(i) => Some(i),
-            Err(i) => {
-                if i == 0 {
-                    None
-                } else if x < self.ends[i - 1] {
-                    Some(i - 1)
-                } else {
-                    None
-                }
-            }
-        }
+    // Returns the start of the interval containing `x`.
+    fn get_start(&self, x: usize) -> Option<usize> {
+        let (start, (end, _)) = self.intervals.range(..=x).next_back()?;
+        (x < *end).then_some(*start)
     }
 
     // Returns the entry of the interval containing `x`.
     pub fn get(&self, x: usize) -> Option<(Interval, &V)> {
-        self.get_index(x)
-            .map(|i| (self.starts[i]..self.ends[i], &self.vals[i]))
+        let (start, (end, val)) = self.intervals.range(..=x).next_back()?;
+        (x < *end).then_some((*start..*end, val))
     }
 
     // Returns the entry of the interval containing `x`.
     pub fn get_mut(&mut self, x: usize) -> Option<(Interval, &mut V)> {
-        match self.get_index(x) {
-            None => None,
-            Some(i) => Some((self.starts[i]..self.ends[i], &mut self.vals[i])),
-        }
+        let (start, (end, val)) = self.intervals.range_mut(..=x).next_back()?;
+        (x < *end).then_some((*start..*end, val))
     }
 }
 
@@ -94,6 +94,24 @@ mod export {
         });
     }
 
+    /// Run `callback` with `arg` using the global callback queue. If the queue hasn't been set using
+    /// [`with_global_cb_queue`], the callback will be run here before returning.
+    #[unsafe(no_mangle)]
+    pub unsafe extern "C-unwind" fn add_callback_with_global_cb_queue(
+        callback: unsafe extern "C-unwind" fn(arg: *mut libc::c_void),
+        arg: *mut libc::c_void,
+    ) {
+        with_global_cb_queue(|| {
+            C_CALLBACK_QUEUE.with(|cb_queue| {
+                let mut cb_queue = cb_queue.borrow_mut();
+                // must not be `None` since it will be set to `Some` by `with_global_cb_queue`
+                let cb_queue = cb_queue.deref_mut().as_mut().unwrap();
+
+                cb_queue.add(move |_cb_queue| unsafe { callback(arg) });
+            });
+        });
+    }
+
     /// Tell the host that the socket wants to send packets using the global callback queue. If the
     /// queue hasn't been set using [`with_global_cb_queue`], the host will be notified here before
     /// returning. Takes ownership of `inetSocket` (will free/drop).
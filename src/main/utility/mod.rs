@@ -5,11 +5,15 @@
 pub mod enum_passthrough;
 #[macro_use]
 pub mod macros;
+#[macro_use]
+pub mod usdt;
 
+pub mod background_writer;
 pub mod byte_queue;
 pub mod callback_queue;
 pub mod childpid_watcher;
 pub mod counter;
+pub mod flat_counter;
 pub mod give;
 pub mod interval_map;
 pub mod legacy_callback_queue;
@@ -23,19 +27,25 @@ pub mod status_bar;
 pub mod stream_len;
 pub mod syscall;
 pub mod units;
+pub mod vdso;
 
 use std::collections::HashSet;
 use std::ffi::{CString, OsStr};
 use std::io::Read;
 use std::marker::PhantomData;
+use std::os::fd::AsRawFd;
 use std::os::unix::fs::{DirBuilderExt, MetadataExt};
 use std::os::unix::prelude::OsStrExt;
 use std::path::{Path, PathBuf};
 use std::sync::RwLock;
+use std::sync::atomic::{AtomicBool, Ordering};
 
 use once_cell::sync::Lazy;
+use rayon::iter::{IntoParallelIterator, ParallelIterator};
 use shadow_shim_helper_rs::HostId;
 
+#[cfg(not(feature = "no_object_counters"))]
+use crate::core::sim_stats::ObjectTypeId;
 use crate::core::worker::Worker;
 use crate::host::host::Host;
 
@@ -195,28 +205,54 @@ impl<T> Clone for Magic<T> {
 }
 
 /// Helper for tracking the number of allocated objects.
+#[cfg(not(feature = "no_object_counters"))]
 #[derive(Debug)]
 pub struct ObjectCounter {
-    name: &'static str,
+    /// `None` if object counters are disabled.
+    id: Option<ObjectTypeId>,
 }
 
+#[cfg(not(feature = "no_object_counters"))]
 impl ObjectCounter {
     pub fn new(name: &'static str) -> Self {
-        Worker::increment_object_alloc_counter(name);
-        Self { name }
+        let id = Worker::use_object_counters().then(|| ObjectTypeId::new(name));
+        if let Some(id) = id {
+            Worker::increment_object_alloc_counter(id);
+        }
+        Self { id }
     }
 }
 
+#[cfg(not(feature = "no_object_counters"))]
 impl Drop for ObjectCounter {
     fn drop(&mut self) {
-        Worker::increment_object_dealloc_counter(self.name);
+        if let Some(id) = self.id {
+            Worker::increment_object_dealloc_counter(id);
+        }
     }
 }
 
+#[cfg(not(feature = "no_object_counters"))]
 impl Clone for ObjectCounter {
     fn clone(&self) -> Self {
-        Worker::increment_object_alloc_counter(self.name);
-        Self { name: self.name }
+        if let Some(id) = self.id {
+            Worker::increment_object_alloc_counter(id);
+        }
+        Self { id: self.id }
+    }
+}
+
+/// Helper for tracking the number of allocated objects. Object counters were compiled out with the
+/// `no_object_counters` feature, so this is zero-sized and has no drop glue.
+#[cfg(feature = "no_object_counters")]
+#[derive(Debug, Clone)]
+pub struct ObjectCounter;
+
+#[cfg(feature = "no_object_counters")]
+impl ObjectCounter {
+    #[inline(always)]
+    pub fn new(_name: &'static str) -> Self {
+        Self
     }
 }
 
@@ -244,48 +280,97 @@ pub fn tilde_expansion(path: &str) -> std::path::PathBuf {
 }
 
 /// Copy the contents of the `src` directory to a new directory named `dst`. Permissions will be
-/// preserved.
-pub fn copy_dir_all(src: impl AsRef<Path>, dst: impl AsRef<Path>) -> std::io::Result<()> {
-    // a directory to copy
-    struct DirCopyTask {
-        src: PathBuf,
-        dst: PathBuf,
-        mode: u32,
-    }
-
-    // a stack of directories to copy
-    let mut stack: Vec<DirCopyTask> = vec![];
+/// preserved. Files are reflinked (their data blocks are shared until either copy is modified) on
+/// filesystems that support it, such as btrfs and XFS. If `hardlink_readonly_files` is true,
+/// regular files that nobody has permission to write are hard linked instead of copied, so they're
+/// the same files as in `src`.
+pub fn copy_dir_all(
+    src: impl AsRef<Path>,
+    dst: impl AsRef<Path>,
+    hardlink_readonly_files: bool,
+) -> std::io::Result<()> {
+    let src = src.as_ref();
+    let copier = DirCopier {
+        hardlink_readonly_files,
+        try_reflink: AtomicBool::new(true),
+    };
+    copier.copy_dir_with_mode(src, dst.as_ref(), src.metadata()?.mode())
+}
 
-    stack.push(DirCopyTask {
-        src: src.as_ref().to_path_buf(),
-        dst: dst.as_ref().to_path_buf(),
-        mode: src.as_ref().metadata()?.mode(),
-    });
+struct DirCopier {
+    hardlink_readonly_files: bool,
+    /// Cleared once reflinking fails, since it will fail for every other file on the same
+    /// filesystems.
+    try_reflink: AtomicBool,
+}
 
-    while let Some(DirCopyTask { src, dst, mode }) = stack.pop() {
+impl DirCopier {
+    fn copy_dir_with_mode(&self, src: &Path, dst: &Path, mode: u32) -> std::io::Result<()> {
         // create the directory with the same permissions
-        create_dir_with_mode(&dst, mode)?;
+        create_dir_with_mode(dst, mode)?;
 
-        // copy directory contents
-        for entry in std::fs::read_dir(src)? {
-            let entry = entry?;
+        let entries = std::fs::read_dir(src)?.collect::<std::io::Result<Vec<_>>>()?;
+
+        // copy directory contents in parallel, since template directories often have a directory
+        // for each of a large number of hosts
+        entries.into_par_iter().try_for_each(|entry| {
             let meta = entry.metadata()?;
             let new_dst_path = dst.join(entry.file_name());
 
             if meta.is_dir() {
-                stack.push(DirCopyTask {
-                    src: entry.path(),
-                    dst: new_dst_path,
-                    mode: meta.mode(),
-                });
+                self.copy_dir_with_mode(&entry.path(), &new_dst_path, meta.mode())
             } else {
-                // copy() will also copy the permissions
-                std::fs::copy(entry.path(), &new_dst_path)?;
+                self.copy_file(&entry.path(), &new_dst_path, &meta)
+            }
+        })
+    }
+
+    fn copy_file(&self, src: &Path, dst: &Path, meta: &std::fs::Metadata) -> std::io::Result<()> {
+        if meta.is_file() {
+            if self.hardlink_readonly_files
+                && meta.mode() & 0o222 == 0
+                && std::fs::hard_link(src, dst).is_ok()
+            {
+                return Ok(());
+            }
+
+            if self.try_reflink.load(Ordering::Relaxed) {
+                if try_reflink(src, dst, meta)? {
+                    return Ok(());
+                }
+                self.try_reflink.store(false, Ordering::Relaxed);
             }
         }
+
+        // copy() will also copy the permissions
+        std::fs::copy(src, dst).map(|_| ())
+    }
+}
+
+/// Create `dst` as a reflink of `src`, with the same permissions. Returns `false` (and doesn't
+/// leave `dst` behind) if the filesystem doesn't support reflinks or `src` and `dst` are on
+/// different filesystems.
+fn try_reflink(src: &Path, dst: &Path, meta: &std::fs::Metadata) -> std::io::Result<bool> {
+    let src_file = std::fs::File::open(src)?;
+    let dst_file = std::fs::OpenOptions::new()
+        .write(true)
+        .create_new(true)
+        .open(dst)?;
+
+    // SAFETY: both fds are valid for the duration of the call
+    if unsafe { libc::ioctl(dst_file.as_raw_fd(), libc::FICLONE, src_file.as_raw_fd()) } != 0 {
+        let err = std::io::Error::last_os_error();
+        drop(dst_file);
+        std::fs::remove_file(dst)?;
+        return match err.raw_os_error() {
+            Some(libc::EOPNOTSUPP | libc::EXDEV | libc::EINVAL | libc::ENOTTY) => Ok(false),
+            _ => Err(err),
+        };
     }
 
-    Ok(())
+    // the file was created with the default mode
+    dst_file.set_permissions(meta.permissions())?;
+    Ok(true)
 }
 
 fn create_dir_with_mode(path: impl AsRef<Path>, mode: u32) -> std::io::Result<()> {
@@ -640,6 +725,14 @@ mod tests {
         }
     }
 
+    #[test]
+    #[cfg(feature = "no_object_counters")]
+    fn test_object_counter_compiled_out() {
+        assert_eq!(std::mem::size_of::<ObjectCounter>(), 0);
+        assert!(!std::mem::needs_drop::<ObjectCounter>());
+        assert!(!Worker::use_object_counters());
+    }
+
     #[test]
     fn test_inject_preloads() {
         // Base case
@@ -703,6 +796,66 @@ mod tests {
             ]
         );
     }
+
+    // disabled under miri since rayon and the filesystem aren't supported
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn test_copy_dir_all() {
+        use std::os::unix::fs::PermissionsExt;
+
+        let tmp = tempfile::tempdir().unwrap();
+        let src = tmp.path().join("src");
+        let dst = tmp.path().join("dst");
+
+        for host in 0..20 {
+            let dir = src.join("hosts").join(format!("host{host}"));
+            std::fs::create_dir_all(&dir).unwrap();
+            std::fs::write(dir.join("file"), format!("{host}")).unwrap();
+        }
+        std::fs::write(src.join("exe"), "x").unwrap();
+        std::fs::set_permissions(src.join("exe"), std::fs::Permissions::from_mode(0o751)).unwrap();
+
+        copy_dir_all(&src, &dst, false).unwrap();
+
+        for host in 0..20 {
+            let file = dst.join("hosts").join(format!("host{host}")).join("file");
+            assert_eq!(std::fs::read_to_string(file).unwrap(), format!("{host}"));
+        }
+        let mode = dst.join("exe").metadata().unwrap().mode();
+        assert_eq!(mode & 0o777, 0o751);
+
+        // the destination must not already exist
+        assert!(copy_dir_all(&src, &dst, false).is_err());
+    }
+
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn test_copy_dir_all_hardlinks() {
+        use std::os::unix::fs::PermissionsExt;
+
+        let tmp = tempfile::tempdir().unwrap();
+        let src = tmp.path().join("src");
+        std::fs::create_dir(&src).unwrap();
+        std::fs::write(src.join("readonly"), "r").unwrap();
+        std::fs::set_permissions(src.join("readonly"), std::fs::Permissions::from_mode(0o444))
+            .unwrap();
+        std::fs::write(src.join("writable"), "w").unwrap();
+
+        let ino = |path: &Path| path.metadata().unwrap().ino();
+
+        let dst = tmp.path().join("linked");
+        copy_dir_all(&src, &dst, true).unwrap();
+        assert_eq!(ino(&dst.join("readonly")), ino(&src.join("readonly")));
+        assert_ne!(ino(&dst.join("writable")), ino(&src.join("writable")));
+        assert_eq!(std::fs::read_to_string(dst.join("writable")).unwrap(), "w");
+
+        let dst = tmp.path().join("copied");
+        copy_dir_all(&src, &dst, false).unwrap();
+        assert_ne!(ino(&dst.join("readonly")), ino(&src.join("readonly")));
+        assert_eq!(std::fs::read_to_string(dst.join("readonly")).unwrap(), "r");
+        let mode = dst.join("readonly").metadata().unwrap().mode();
+        assert_eq!(mode & 0o777, 0o444);
+    }
 }
 
 mod export {
@@ -1,10 +1,14 @@
-use std::io::{Seek, SeekFrom, Write};
+use std::collections::VecDeque;
+use std::io::Write;
+use std::time::Duration;
 
 use crate::utility::give::Give;
 
 pub struct PcapWriter<W: Write> {
     writer: W,
     capture_len: u32,
+    /// A buffer for assembling packet records in `write_packet_fmt()`.
+    record: Vec<u8>,
 }
 
 impl<W: Write> PcapWriter<W> {
@@ -14,6 +18,7 @@ impl<W: Write> PcapWriter<W> {
         let mut rv = PcapWriter {
             writer,
             capture_len,
+            record: Vec::new(),
         };
 
         rv.write_header()?;
@@ -21,6 +26,22 @@ impl<W: Write> PcapWriter<W> {
         Ok(rv)
     }
 
+    /// A packet capture writer that appends to a capture whose header was already written, for
+    /// example by a previous writer for the same file.
+    pub fn new_appending(writer: W, capture_len: u32) -> Self {
+        PcapWriter {
+            writer,
+            capture_len,
+            record: Vec::new(),
+        }
+    }
+
+    /// The underlying writer. Data that was already written to the `PcapWriter` isn't buffered by
+    /// it, so nothing is lost.
+    pub fn into_inner(self) -> W {
+        self.writer
+    }
+
     fn write_header(&mut self) -> std::io::Result<()> {
         // magic number to show endianness
         const MAGIC_NUMBER: u32 = 0xA1B2C3D4;
@@ -78,67 +99,187 @@ impl<W: Write> PcapWriter<W> {
 
         Ok(())
     }
-}
 
-impl<W: Write + Seek> PcapWriter<W> {
-    /// Write a packet without requiring an intermediate buffer.
+    /// Write a packet without requiring the caller to provide a buffer. The packet record is
+    /// assembled in an internal buffer and written to the writer with a single write.
     pub fn write_packet_fmt(
         &mut self,
         ts_sec: u32,
         ts_usec: u32,
         packet_len: u32,
-        write_packet_fn: impl FnOnce(&mut Give<&mut W>) -> std::io::Result<()>,
+        write_packet_fn: impl FnOnce(&mut Give<&mut Vec<u8>>) -> std::io::Result<()>,
     ) -> std::io::Result<()> {
-        // timestamp (seconds): 4 bytes
-        self.writer.write_all(&ts_sec.to_ne_bytes())?;
-        // timestamp (microseconds): 4 bytes
-        self.writer.write_all(&ts_usec.to_ne_bytes())?;
+        build_record(
+            &mut self.record,
+            self.capture_len,
+            ts_sec,
+            ts_usec,
+            packet_len,
+            write_packet_fn,
+        )?;
+        self.writer.write_all(&self.record)
+    }
+}
+
+/// Assemble a packet record (header and packet data) in `record`, replacing its previous contents.
+/// The packet data is truncated to a length of `capture_len`.
+fn build_record(
+    record: &mut Vec<u8>,
+    capture_len: u32,
+    ts_sec: u32,
+    ts_usec: u32,
+    packet_len: u32,
+    write_packet_fn: impl FnOnce(&mut Give<&mut Vec<u8>>) -> std::io::Result<()>,
+) -> std::io::Result<()> {
+    record.clear();
+
+    // timestamp (seconds): 4 bytes
+    record.extend_from_slice(&ts_sec.to_ne_bytes());
+    // timestamp (microseconds): 4 bytes
+    record.extend_from_slice(&ts_usec.to_ne_bytes());
+
+    // position of the captured packet length field
+    let pos_of_len = record.len();
+
+    // captured packet length: 4 bytes
+    // (write initially as 0, we'll update it later)
+    record.extend_from_slice(&0u32.to_ne_bytes());
+    // original packet length: 4 bytes
+    record.extend_from_slice(&packet_len.to_ne_bytes());
+
+    // position of the packet data
+    let pos_before_packet_data = record.len();
+
+    // packet data: a soft limit of `capture_len` bytes
+    match write_packet_fn(&mut Give::new(&mut *record, capture_len as u64)) {
+        Ok(()) => {}
+        // this should mean that the entire packet couldn't be written, which is fine since
+        // we'll use a smaller captured packet length value
+        Err(e) if e.kind() == std::io::ErrorKind::WriteZero => {}
+        Err(e) => return Err(e),
+    }
 
-        // position of the captured packet length field
-        let pos_of_len = self.writer.stream_position()?;
+    // the number of packet data bytes written
+    let bytes_written = record.len() - pos_before_packet_data;
 
-        // captured packet length: 4 bytes
-        // (write initially as 0, we'll update it later)
-        self.writer.write_all(&0u32.to_ne_bytes())?;
-        // original packet length: 4 bytes
-        self.writer.write_all(&packet_len.to_ne_bytes())?;
+    // it is still possible for 'write_payload_fn' to have written more bytes than it was
+    // supposed to, so double check here
+    if bytes_written > capture_len as usize {
+        log::warn!("Pcap writer wrote more bytes than intended: {bytes_written} > {capture_len}");
+        return Err(std::io::ErrorKind::InvalidData.into());
+    }
 
-        // position of the packet data
-        let pos_before_packet_data = self.writer.stream_position()?;
+    // go back and update the captured packet length
+    let bytes_written = u32::try_from(bytes_written).unwrap();
+    // captured packet length: 4 bytes
+    record[pos_of_len..][..4].copy_from_slice(&bytes_written.to_ne_bytes());
 
-        // packet data: a soft limit of `capture_len` bytes
-        match write_packet_fn(&mut Give::new(&mut self.writer, self.capture_len as u64)) {
-            Ok(()) => {}
-            // this should mean that the entire packet couldn't be written, which is fine since
-            // we'll use a smaller captured packet length value
-            Err(e) if e.kind() == std::io::ErrorKind::WriteZero => {}
-            Err(e) => return Err(e),
+    Ok(())
+}
+
+/// An in-memory "flight recorder" for packets. It keeps the records of only the most recent
+/// packets, and can write them out as a pcap file when needed.
+///
+/// Record buffers of packets that are evicted from the ring are reused for new packets, so once
+/// the ring is full, capturing a packet is a copy into an existing buffer.
+pub struct PcapRing {
+    capture_len: u32,
+    /// The maximum number of packets to keep.
+    max_packets: Option<usize>,
+    /// The maximum difference between the timestamps of the oldest and newest packet.
+    max_duration: Option<Duration>,
+    records: VecDeque<RingRecord>,
+}
+
+struct RingRecord {
+    time: Duration,
+    bytes: Vec<u8>,
+}
+
+impl PcapRing {
+    /// A new packet ring. If neither `max_packets` nor `max_duration` are set, the ring will keep
+    /// all packets. Each packet (header and payload) captured will be truncated to a length
+    /// `capture_len`.
+    pub fn new(
+        capture_len: u32,
+        max_packets: Option<usize>,
+        max_duration: Option<Duration>,
+    ) -> Self {
+        Self {
+            capture_len,
+            max_packets,
+            max_duration,
+            records: VecDeque::new(),
         }
+    }
 
-        // position after the packet data
-        let pos_after_packet_data = self.writer.stream_position()?;
-        // the number of packet data bytes written
-        let bytes_written = pos_after_packet_data - pos_before_packet_data;
-
-        // it is still possible for 'write_payload_fn' to have written more bytes than it was
-        // supposed to, so double check here
-        if bytes_written > self.capture_len.into() {
-            log::warn!(
-                "Pcap writer wrote more bytes than intended: {bytes_written} > {}",
-                self.capture_len
-            );
-            return Err(std::io::ErrorKind::InvalidData.into());
+    /// Add a packet to the ring, evicting older packets if needed. See
+    /// [`PcapWriter::write_packet_fmt`].
+    pub fn push_packet_fmt(
+        &mut self,
+        ts_sec: u32,
+        ts_usec: u32,
+        packet_len: u32,
+        write_packet_fn: impl FnOnce(&mut Give<&mut Vec<u8>>) -> std::io::Result<()>,
+    ) -> std::io::Result<()> {
+        if self.max_packets == Some(0) {
+            return Ok(());
         }
 
-        // go back and update the captured packet length
-        let bytes_written = u32::try_from(bytes_written).unwrap();
-        self.writer.seek(SeekFrom::Start(pos_of_len))?;
-        // captured packet length: 4 bytes
-        self.writer.write_all(&bytes_written.to_ne_bytes())?;
-        self.writer.seek(SeekFrom::Start(pos_after_packet_data))?;
+        let time = Duration::new(ts_sec.into(), ts_usec.saturating_mul(1000));
+        let mut spare = None;
+
+        if let Some(max_duration) = self.max_duration {
+            while let Some(oldest) = self.records.front() {
+                if time.saturating_sub(oldest.time) <= max_duration {
+                    break;
+                }
+                spare = self.records.pop_front().map(|x| x.bytes);
+            }
+        }
 
+        if let Some(max_packets) = self.max_packets {
+            if self.records.len() >= max_packets {
+                spare = self.records.pop_front().map(|x| x.bytes);
+            }
+        }
+
+        let mut bytes = spare.unwrap_or_default();
+        build_record(
+            &mut bytes,
+            self.capture_len,
+            ts_sec,
+            ts_usec,
+            packet_len,
+            write_packet_fn,
+        )?;
+
+        self.records.push_back(RingRecord { time, bytes });
         Ok(())
     }
+
+    /// The number of packets in the ring.
+    pub fn len(&self) -> usize {
+        self.records.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.records.is_empty()
+    }
+
+    /// The number of bytes allocated for the packet records in the ring.
+    pub fn allocated_bytes(&self) -> usize {
+        self.records.iter().map(|x| x.bytes.capacity()).sum()
+    }
+
+    /// Write the packets in the ring as a pcap file. The packets remain in the ring.
+    pub fn dump(&self, writer: impl Write) -> std::io::Result<()> {
+        let mut pcap = PcapWriter::new(writer, self.capture_len)?;
+        for record in &self.records {
+            pcap.writer.write_all(&record.bytes)?;
+        }
+        pcap.writer.flush()
+    }
 }
 
 pub trait PacketDisplay {
@@ -192,6 +333,22 @@ mod tests {
         );
     }
 
+    #[test]
+    fn test_appending_pcap_writer() {
+        let mut expected = vec![];
+        let mut pcap = PcapWriter::new(&mut expected, 65535).unwrap();
+        pcap.write_packet(32, 128, &[0x01, 0x02, 0x03]).unwrap();
+        pcap.write_packet(33, 0, &[0x04]).unwrap();
+
+        let mut buf = vec![];
+        let mut pcap = PcapWriter::new(&mut buf, 65535).unwrap();
+        pcap.write_packet(32, 128, &[0x01, 0x02, 0x03]).unwrap();
+        let mut pcap = PcapWriter::new_appending(&mut buf, 65535);
+        pcap.write_packet(33, 0, &[0x04]).unwrap();
+
+        assert_eq!(buf, expected);
+    }
+
     #[test]
     fn test_write_packet_fmt() {
         let mut buf = Cursor::new(vec![]);
@@ -225,4 +382,27 @@ mod tests {
             .concat()
         );
     }
+
+    #[test]
+    fn test_pcap_ring() {
+        let mut ring = PcapRing::new(65535, Some(2), Some(Duration::from_secs(10)));
+        for (ts_sec, byte) in [(1, 0x01), (2, 0x02), (3, 0x03)] {
+            ring.push_packet_fmt(ts_sec, 0, 1, |writer| writer.write_all(&[byte]))
+                .unwrap();
+        }
+        assert_eq!(ring.len(), 2);
+
+        // evicts the packets at 2 and 3 seconds
+        ring.push_packet_fmt(20, 0, 1, |writer| writer.write_all(&[0x04]))
+            .unwrap();
+        assert_eq!(ring.len(), 1);
+
+        let mut expected = vec![];
+        let mut pcap = PcapWriter::new(&mut expected, 65535).unwrap();
+        pcap.write_packet(20, 0, &[0x04]).unwrap();
+
+        let mut buf = vec![];
+        ring.dump(&mut buf).unwrap();
+        assert_eq!(buf, expected);
+    }
 }
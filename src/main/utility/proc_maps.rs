@@ -3,9 +3,6 @@ use std::fmt::Display;
 use std::path::PathBuf;
 use std::str::FromStr;
 
-use once_cell::sync::Lazy;
-use regex::Regex;
-
 /// Whether a region of memory is shared.
 #[derive(PartialEq, Eq, Debug, Copy, Clone)]
 pub enum Sharing {
@@ -40,22 +37,21 @@ pub enum MappingPath {
 impl FromStr for MappingPath {
     type Err = Box<dyn Error>;
     fn from_str(s: &str) -> Result<Self, Self::Err> {
-        static SPECIAL_RE: Lazy<Regex> = Lazy::new(|| Regex::new(r"^\[(\S+)\]$").unwrap());
-        static THREAD_STACK_RE: Lazy<Regex> = Lazy::new(|| Regex::new(r"^stack:(\d+)$").unwrap());
-
         if s.starts_with('/') {
             return Ok(MappingPath::Path(PathBuf::from(s)));
         }
-        if let Some(caps) = SPECIAL_RE.captures(s) {
-            let s = caps.get(1).unwrap().as_str();
-            if let Some(caps) = THREAD_STACK_RE.captures(s) {
-                return Ok(MappingPath::ThreadStack(
-                    caps.get(1)
-                        .unwrap()
-                        .as_str()
-                        .parse::<i32>()
-                        .map_err(|e| format!("Parsing thread id: {}", e))?,
-                ));
+        if let Some(s) = s
+            .strip_prefix('[')
+            .and_then(|s| s.strip_suffix(']'))
+            .filter(|s| !s.is_empty() && !s.contains(char::is_whitespace))
+        {
+            if let Some(tid) = s.strip_prefix("stack:") {
+                if !tid.is_empty() && tid.bytes().all(|b| b.is_ascii_digit()) {
+                    return Ok(MappingPath::ThreadStack(
+                        tid.parse::<i32>()
+                            .map_err(|e| format!("Parsing thread id: {}", e))?,
+                    ));
+                }
             }
             return Ok(match s {
                 "stack" => MappingPath::InitialStack,
@@ -100,79 +96,89 @@ where
     }
 }
 
+// Parses a permission bit, which is either `set` or '-'.
+fn parse_bit(field: u8, set: u8, field_name: &str) -> Result<bool, String> {
+    match field {
+        b'-' => Ok(false),
+        x if x == set => Ok(true),
+        x => Err(format!(
+            "Couldn't parse {} bit {}",
+            field_name,
+            char::from(x)
+        )),
+    }
+}
+
 impl FromStr for Mapping {
     type Err = Box<dyn Error>;
     fn from_str(line: &str) -> Result<Self, Self::Err> {
-        static RE: Lazy<Regex> = Lazy::new(|| {
-            Regex::new(
-                r"^(\S+)-(\S+)\s+(\S)(\S)(\S)(\S)\s+(\S+)\s+(\S+):(\S+)\s+(\S+)\s*(\S*)\s*(\S*)$",
-            )
-            .unwrap()
-        });
+        // The fields are separated by whitespace, and are parsed without allocating (except for
+        // the path). This is called for every line of a process's maps file whenever we start
+        // tracking its memory, so it's worth avoiding a regex here.
+        if line.starts_with(|c: char| c.is_ascii_whitespace()) {
+            return Err(format!("Leading whitespace: {}", line).into());
+        }
+
+        let mut fields = line.split_ascii_whitespace();
+        let mut next_field = |name: &str| {
+            fields
+                .next()
+                .ok_or_else(|| format!("Missing {} field: {}", name, line))
+        };
+
+        let range = next_field("address")?;
+        let perms = next_field("perms")?;
+        let offset = next_field("offset")?;
+        let device = next_field("device")?;
+        let inode = next_field("inode")?;
+        let path = fields.next().unwrap_or("");
+        let trailing = fields.next().unwrap_or("");
+        if let Some(field) = fields.next() {
+            return Err(format!("Unexpected field '{}': {}", field, line).into());
+        }
+
+        let (begin, end) = range
+            .split_once('-')
+            .ok_or_else(|| format!("Couldn't parse address range {}", range))?;
+        let (device_major, device_minor) = device
+            .split_once(':')
+            .ok_or_else(|| format!("Couldn't parse device {}", device))?;
 
-        let caps = RE
-            .captures(line)
-            .ok_or_else(|| format!("Didn't match regex: {}", line))?;
+        let &[read, write, execute, sharing] = perms.as_bytes() else {
+            return Err(format!("Couldn't parse perms {}", perms).into());
+        };
 
         Ok(Mapping {
-            begin: parse_field(caps.get(1).unwrap().as_str(), "begin", |s| {
-                usize::from_str_radix(s, 16)
-            })?,
-            end: parse_field(caps.get(2).unwrap().as_str(), "end", |s| {
-                usize::from_str_radix(s, 16)
-            })?,
-            read: {
-                let s = caps.get(3).unwrap().as_str();
-                match s {
-                    "r" => true,
-                    "-" => false,
-                    _ => return Err(format!("Couldn't parse read bit {}", s).into()),
+            begin: parse_field(begin, "begin", |s| usize::from_str_radix(s, 16))?,
+            end: parse_field(end, "end", |s| usize::from_str_radix(s, 16))?,
+            read: parse_bit(read, b'r', "read")?,
+            write: parse_bit(write, b'w', "write")?,
+            execute: parse_bit(execute, b'x', "execute")?,
+            sharing: match sharing {
+                b'p' => Sharing::Private,
+                b's' => Sharing::Shared,
+                x => {
+                    return Err(format!("Bad sharing specifier {}", char::from(x)).into());
                 }
             },
-            write: {
-                let s = caps.get(4).unwrap().as_str();
-                match s {
-                    "w" => true,
-                    "-" => false,
-                    _ => return Err(format!("Couldn't parse write bit {}", s).into()),
-                }
-            },
-            execute: {
-                let s = caps.get(5).unwrap().as_str();
-                match s {
-                    "x" => true,
-                    "-" => false,
-                    _ => return Err(format!("Couldn't parse execute bit {}", s).into()),
-                }
-            },
-            sharing: caps.get(6).unwrap().as_str().parse::<Sharing>()?,
-            offset: parse_field(caps.get(7).unwrap().as_str(), "offset", |s| {
-                usize::from_str_radix(s, 16)
-            })?,
-            device_major: parse_field(caps.get(8).unwrap().as_str(), "device_major", |s| {
+            offset: parse_field(offset, "offset", |s| usize::from_str_radix(s, 16))?,
+            device_major: parse_field(device_major, "device_major", |s| {
                 i32::from_str_radix(s, 16)
             })?,
-            device_minor: parse_field(caps.get(9).unwrap().as_str(), "device_minor", |s| {
+            device_minor: parse_field(device_minor, "device_minor", |s| {
                 i32::from_str_radix(s, 16)
             })?,
             // Undocumented whether this is actually base 10; change to 16 if we find
             // counter-examples.
-            inode: parse_field(caps.get(10).unwrap().as_str(), "inode", |s| s.parse())?,
-            path: parse_field::<_, _, Box<dyn Error>>(
-                caps.get(11).unwrap().as_str(),
-                "path",
-                |s| match s {
-                    "" => Ok(None),
-                    s => Ok(Some(s.parse::<MappingPath>()?)),
-                },
-            )?,
-            deleted: {
-                let s = caps.get(12).unwrap().as_str();
-                match s {
-                    "" => false,
-                    "(deleted)" => true,
-                    _ => return Err(format!("Couldn't parse trailing field '{}'", s).into()),
-                }
+            inode: parse_field(inode, "inode", |s| s.parse())?,
+            path: parse_field::<_, _, Box<dyn Error>>(path, "path", |s| match s {
+                "" => Ok(None),
+                s => Ok(Some(s.parse::<MappingPath>()?)),
+            })?,
+            deleted: match trailing {
+                "" => false,
+                "(deleted)" => true,
+                s => return Err(format!("Couldn't parse trailing field '{}'", s).into()),
             },
         })
     }
@@ -180,21 +186,32 @@ impl FromStr for Mapping {
 
 /// Parses the contents of a /proc/\[pid\]/maps file
 pub fn parse_file_contents(mappings: &str) -> Result<Vec<Mapping>, Box<dyn Error>> {
-    let res: Result<Vec<_>, String> = mappings
-        .lines()
-        .map(|line| Mapping::from_str(line).map_err(|e| format!("Parsing line: {}\n{}", line, e)))
-        .collect();
-    Ok(res?)
+    parse_mappings(mappings).collect()
 }
 
-/// Reads and parses the contents of a /proc/\[pid\]/maps file
-pub fn mappings_for_pid(pid: libc::pid_t) -> Result<Vec<Mapping>, Box<dyn Error>> {
+/// Parses the contents of a /proc/\[pid\]/maps file lazily, one line at a time.
+pub fn parse_mappings(mappings: &str) -> impl Iterator<Item = Result<Mapping, Box<dyn Error>>> {
+    mappings.lines().map(|line| {
+        Mapping::from_str(line).map_err(|e| format!("Parsing line: {}\n{}", line, e).into())
+    })
+}
+
+/// Reads the contents of a /proc/\[pid\]/maps file into `contents`, replacing its previous
+/// contents. Reusing `contents` avoids allocating a new buffer for each file.
+pub fn read_maps_for_pid(pid: libc::pid_t, contents: &mut String) -> std::io::Result<()> {
     use std::fs::File;
     use std::io::Read;
 
+    contents.clear();
     let mut file = File::open(format!("/proc/{}/maps", pid))?;
+    file.read_to_string(contents)?;
+    Ok(())
+}
+
+/// Reads and parses the contents of a /proc/\[pid\]/maps file
+pub fn mappings_for_pid(pid: libc::pid_t) -> Result<Vec<Mapping>, Box<dyn Error>> {
     let mut contents = String::new();
-    file.read_to_string(&mut contents)?;
+    read_maps_for_pid(pid, &mut contents)?;
     parse_file_contents(&contents)
 }
 
@@ -550,4 +567,17 @@ mod tests {
         let mappings = mappings_for_pid(pid).unwrap();
         assert!(!mappings.is_empty());
     }
+
+    #[test]
+    #[cfg_attr(miri, ignore)]
+    fn test_read_maps_for_pid() {
+        let pid = unsafe { libc::getpid() };
+        let mut contents = "leftover".to_string();
+        read_maps_for_pid(pid, &mut contents).unwrap();
+        assert!(!contents.starts_with("leftover"));
+
+        let mappings: Vec<_> = parse_mappings(&contents).map(Result::unwrap).collect();
+        assert_eq!(mappings, parse_file_contents(&contents).unwrap());
+        assert!(!mappings.is_empty());
+    }
 }
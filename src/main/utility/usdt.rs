@@ -0,0 +1,156 @@
+//! Statically defined tracepoints (USDT probes) for tools like `perf` and `bpftrace`, which can
+//! attach to them to correlate native profiles with hosts and scheduling rounds. Probes are
+//! compiled in when shadow is built with the `usdt` feature (`./setup build --use-usdt-probes`),
+//! and are otherwise removed along with their arguments. A compiled-in probe that no tool has
+//! attached to costs a `nop` instruction and the moves of its arguments into registers.
+//!
+//! The probes use the `shadow` provider, and can be listed with for example `bpftrace -l
+//! 'usdt:/path/to/shadow:*'`. Each probe's first two arguments are the host id (`u64::MAX` for
+//! the round probes) and the simulation time in nanoseconds (`u64::MAX` if there's no current
+//! time):
+//!
+//! - `round_start`, `round_end`: the round's start time, and its end time.
+//! - `host_execute_begin`, `host_execute_end`: the end time of the host's window in the round. The
+//!   simulation time is the time of the host's next event.
+//! - `syscall_enter`: the syscall number, and the thread id.
+//! - `syscall_exit`: the syscall number, and 1 if the syscall blocked (otherwise 0).
+//! - `packet_send`: the destination host id, and the payload length.
+//! - `packet_recv`: the payload length.
+//! - `ipc_send`, `ipc_recv`: the native thread id of the managed thread that shadow is resuming
+//!   or that returned control to shadow.
+
+use shadow_shim_helper_rs::HostId;
+use shadow_shim_helper_rs::emulated_time::EmulatedTime;
+
+/// Define a probe named `$name` at this location, with up to 4 arguments (see
+/// [`ProbeArg`]). The arguments are only evaluated when probes are enabled.
+macro_rules! usdt_probe {
+    ($name:ident $(, $arg:expr)* $(,)?) => {{
+        #[cfg(all(feature = "usdt", target_arch = "x86_64"))]
+        {
+            usdt_probe_asm!($name, $($crate::utility::usdt::ProbeArg::probe_arg($arg)),*);
+        }
+        #[cfg(not(all(feature = "usdt", target_arch = "x86_64")))]
+        {
+            // type check the arguments without evaluating them
+            if false {
+                $(let _ = $crate::utility::usdt::ProbeArg::probe_arg($arg);)*
+            }
+        }
+    }};
+}
+
+/// Emit the probe's `nop` and its SystemTap SDT note, which tells the tools the address of the
+/// `nop` and where to find the arguments. See
+/// <https://sourceware.org/systemtap/wiki/UserSpaceProbeImplementation>.
+#[cfg(all(feature = "usdt", target_arch = "x86_64"))]
+macro_rules! usdt_probe_asm {
+    ($name:ident $(,)?) => {
+        usdt_probe_asm!(@emit $name, "",)
+    };
+    ($name:ident, $a0:expr $(,)?) => {
+        usdt_probe_asm!(@emit $name, "8@{a0}", a0 = in(reg) $a0,)
+    };
+    ($name:ident, $a0:expr, $a1:expr $(,)?) => {
+        usdt_probe_asm!(@emit $name, "8@{a0} 8@{a1}", a0 = in(reg) $a0, a1 = in(reg) $a1,)
+    };
+    ($name:ident, $a0:expr, $a1:expr, $a2:expr $(,)?) => {
+        usdt_probe_asm!(
+            @emit $name,
+            "8@{a0} 8@{a1} 8@{a2}",
+            a0 = in(reg) $a0,
+            a1 = in(reg) $a1,
+            a2 = in(reg) $a2,
+        )
+    };
+    ($name:ident, $a0:expr, $a1:expr, $a2:expr, $a3:expr $(,)?) => {
+        usdt_probe_asm!(
+            @emit $name,
+            "8@{a0} 8@{a1} 8@{a2} 8@{a3}",
+            a0 = in(reg) $a0,
+            a1 = in(reg) $a1,
+            a2 = in(reg) $a2,
+            a3 = in(reg) $a3,
+        )
+    };
+    (@emit $name:ident, $spec:literal, $($ops:tt)*) => {
+        // SAFETY: The `nop` has no effect, and the sections only contain data.
+        #[allow(named_asm_labels)]
+        unsafe {
+            ::std::arch::asm!(
+                "990: nop",
+                ".pushsection .note.stapsdt, \"\", \"note\"",
+                ".balign 4",
+                ".4byte 992f-991f, 994f-993f, 3",
+                "991: .asciz \"stapsdt\"",
+                "992: .balign 4",
+                "993: .8byte 990b",
+                ".8byte _.stapsdt.base",
+                // no semaphore
+                ".8byte 0",
+                ".asciz \"shadow\"",
+                concat!(".asciz \"", stringify!($name), "\""),
+                concat!(".asciz \"", $spec, "\""),
+                "994: .balign 4",
+                ".popsection",
+                ".ifndef _.stapsdt.base",
+                ".pushsection .stapsdt.base, \"aGR\", \"progbits\", .stapsdt.base, comdat",
+                ".weak _.stapsdt.base",
+                ".hidden _.stapsdt.base",
+                "_.stapsdt.base: .space 1",
+                ".size _.stapsdt.base, 1",
+                ".popsection",
+                ".endif",
+                $($ops)*
+                options(att_syntax, nomem, nostack, preserves_flags),
+            );
+        }
+    };
+}
+
+/// A value that can be passed to a probe, which is given to the tools as 8 bytes.
+pub trait ProbeArg {
+    fn probe_arg(self) -> u64;
+}
+
+macro_rules! impl_probe_arg {
+    ($($t:ty),*) => {
+        $(
+            impl ProbeArg for $t {
+                #[inline(always)]
+                fn probe_arg(self) -> u64 {
+                    // signed values are sign-extended, and the tools can read them back as i64
+                    self as u64
+                }
+            }
+        )*
+    };
+}
+
+impl_probe_arg!(u8, u16, u32, u64, usize, i8, i16, i32, i64, isize, bool);
+
+impl ProbeArg for HostId {
+    #[inline(always)]
+    fn probe_arg(self) -> u64 {
+        u32::from(self).into()
+    }
+}
+
+impl ProbeArg for EmulatedTime {
+    /// The nanoseconds since the start of the simulation.
+    #[inline(always)]
+    fn probe_arg(self) -> u64 {
+        let nanos = self
+            .saturating_duration_since(&EmulatedTime::SIMULATION_START)
+            .as_nanos();
+        nanos.try_into().unwrap_or(u64::MAX)
+    }
+}
+
+impl<T: ProbeArg> ProbeArg for Option<T> {
+    /// `u64::MAX` if `None`.
+    #[inline(always)]
+    fn probe_arg(self) -> u64 {
+        self.map_or(u64::MAX, T::probe_arg)
+    }
+}
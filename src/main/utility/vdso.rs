@@ -0,0 +1,157 @@
+//! Finding where the shim patches the vDSO.
+//!
+//! The shim replaces some vDSO functions with trampolines to syscalls that it can intercept. The
+//! vDSO is the same in every process on the system, so rather than have every managed process
+//! parse `/proc/self/maps` and the vDSO's symbol table at startup, Shadow looks up the functions
+//! once in its own vDSO and passes their offsets to the shim in [`ManagerShmem`].
+//!
+//! [`ManagerShmem`]: shadow_shim_helper_rs::shim_shmem::ManagerShmem
+
+use std::ffi::CStr;
+
+use shadow_shim_helper_rs::shim_shmem::{VdsoFunction, VdsoPatchTable, VdsoSymbol};
+
+use crate::utility::proc_maps::{self, MappingPath};
+
+/// Find where to patch Shadow's vDSO. Returns `None` if the process has no vDSO or if it couldn't
+/// be parsed, in which case the shim finds the functions itself.
+pub fn patch_table() -> Option<VdsoPatchTable> {
+    let base = unsafe { libc::getauxval(libc::AT_SYSINFO_EHDR) } as usize;
+    if base == 0 {
+        return None;
+    }
+
+    let mappings = match proc_maps::mappings_for_pid(std::process::id().try_into().unwrap()) {
+        Ok(x) => x,
+        Err(e) => {
+            log::warn!("Couldn't read the vDSO's mapping: {e}");
+            return None;
+        }
+    };
+    let mapping = mappings
+        .iter()
+        .find(|x| x.path == Some(MappingPath::Vdso) && x.begin == base)?;
+
+    // the mapping is readable and starts with the vDSO's ELF image
+    let image = unsafe { std::slice::from_raw_parts(base as *const u8, mapping.end - base) };
+
+    let mut symbols = [VdsoSymbol { offset: 0, size: 0 }; VdsoFunction::ALL.len()];
+    for function in VdsoFunction::ALL {
+        match find_symbol(image, function.symbol_name()) {
+            Ok(Some(symbol)) => symbols[function as usize] = symbol,
+            // the shim will warn about it for each process
+            Ok(None) => {}
+            Err(e) => {
+                log::warn!("Couldn't parse the vDSO: {e}");
+                return None;
+            }
+        }
+    }
+
+    Some(VdsoPatchTable {
+        len: (mapping.end - base).try_into().unwrap(),
+        symbols,
+    })
+}
+
+/// Find the offset and size of the dynamic symbol `name` in the ELF `image`.
+fn find_symbol(image: &[u8], name: &str) -> Result<Option<VdsoSymbol>, &'static str> {
+    let header: libc::Elf64_Ehdr = read(image, 0)?;
+    if header.e_ident[..4] != *b"\x7fELF" || header.e_ident[libc::EI_CLASS] != libc::ELFCLASS64 {
+        return Err("not a 64-bit ELF image");
+    }
+
+    let section = |i: usize| -> Result<libc::Elf64_Shdr, &'static str> {
+        let offset =
+            usize::try_from(header.e_shoff).unwrap() + i * std::mem::size_of::<libc::Elf64_Shdr>();
+        read(image, offset)
+    };
+    let section_names = section(header.e_shstrndx.into())?;
+
+    let mut dynsym = None;
+    let mut dynstr = None;
+    for i in 0..usize::from(header.e_shnum) {
+        let section = section(i)?;
+        let offset = section_names.sh_offset + u64::from(section.sh_name);
+        match string(image, offset.try_into().unwrap())? {
+            b".dynsym" => dynsym = Some(section),
+            b".dynstr" => dynstr = Some(section),
+            _ => {}
+        }
+    }
+    let (Some(dynsym), Some(dynstr)) = (dynsym, dynstr) else {
+        return Err("no dynamic symbols");
+    };
+
+    if dynsym.sh_entsize == 0 {
+        return Err("bad symbol table");
+    }
+
+    let num_symbols = dynsym.sh_size / dynsym.sh_entsize;
+    for i in 0..num_symbols {
+        let offset = dynsym.sh_offset + i * dynsym.sh_entsize;
+        let symbol: libc::Elf64_Sym = read(image, offset.try_into().unwrap())?;
+        let offset = dynstr.sh_offset + u64::from(symbol.st_name);
+        if string(image, offset.try_into().unwrap())? == name.as_bytes() {
+            return Ok(Some(VdsoSymbol {
+                offset: symbol.st_value,
+                size: symbol.st_size,
+            }));
+        }
+    }
+
+    Ok(None)
+}
+
+/// Read a `T` at `offset` of `image`.
+fn read<T: Copy>(image: &[u8], offset: usize) -> Result<T, &'static str> {
+    let bytes = offset
+        .checked_add(std::mem::size_of::<T>())
+        .and_then(|end| image.get(offset..end))
+        .ok_or("out of bounds")?;
+    Ok(unsafe { bytes.as_ptr().cast::<T>().read_unaligned() })
+}
+
+/// Read the nul-terminated string at `offset` of `image`.
+fn string(image: &[u8], offset: usize) -> Result<&[u8], &'static str> {
+    let bytes = image.get(offset..).ok_or("out of bounds")?;
+    let string = CStr::from_bytes_until_nul(bytes).map_err(|_| "unterminated string")?;
+    Ok(string.to_bytes())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    // miri can't read the auxiliary vector or the vDSO
+    #[cfg_attr(miri, ignore)]
+    fn test_patch_table() {
+        let base = unsafe { libc::getauxval(libc::AT_SYSINFO_EHDR) };
+        let Some(table) = patch_table() else {
+            // the process has no vDSO
+            assert_eq!(base, 0);
+            return;
+        };
+
+        assert!(table.len > 0);
+        let symbol = table.symbols[VdsoFunction::ClockGettime as usize];
+        assert!(symbol.size > 0);
+        assert!(symbol.offset + symbol.size <= table.len);
+
+        // the image at the offset is the function's code, not padding
+        let code = unsafe {
+            std::slice::from_raw_parts(
+                (base + symbol.offset) as *const u8,
+                symbol.size.try_into().unwrap(),
+            )
+        };
+        assert!(code.iter().any(|x| *x != 0));
+    }
+
+    #[test]
+    fn test_bad_image() {
+        assert!(find_symbol(&[], "x").is_err());
+        assert!(find_symbol(&[0; 64], "x").is_err());
+    }
+}
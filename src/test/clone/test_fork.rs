@@ -75,6 +75,45 @@ fn test_fork_runs(fork_fn: impl FnOnce() -> Result<CloneResult, Errno>) -> anyho
     Ok(())
 }
 
+fn test_fork_copies_memory(
+    fork_fn: impl FnOnce() -> Result<CloneResult, Errno>,
+) -> anyhow::Result<()> {
+    let (reader, writer) = rustix::pipe::pipe().unwrap();
+
+    let mut heap = vec![1u8; 1 << 20];
+    let mut stack = [1u8; 64];
+
+    let res = fork_fn()?;
+
+    match res {
+        CloneResult::CallerIsChild => {
+            // the child starts with the parent's memory
+            let ok = heap.iter().all(|x| *x == 1) && stack.iter().all(|x| *x == 1);
+            heap.fill(2);
+            stack.fill(2);
+            assert_eq!(rustix::io::write(&writer, &[u8::from(ok)]), Ok(1));
+            linux_api::exit::exit_group(0);
+        }
+        CloneResult::CallerIsParent(_pid) => (),
+    };
+
+    let mut buf = [0];
+    assert_eq!(rustix::io::read(&reader, &mut buf), Ok(1));
+    assert_eq!(buf[0], 1);
+
+    // the child's writes aren't visible to the parent
+    ensure_ord!(heap.iter().filter(|x| **x != 1).count(), ==, 0);
+    ensure_ord!(stack.iter().filter(|x| **x != 1).count(), ==, 0);
+
+    // and the parent can still write to its own memory
+    heap.fill(3);
+    stack.fill(3);
+    ensure_ord!(heap.iter().filter(|x| **x != 3).count(), ==, 0);
+    ensure_ord!(stack.iter().filter(|x| **x != 3).count(), ==, 0);
+
+    Ok(())
+}
+
 fn test_clone_parent(set_clone_parent: bool) -> anyhow::Result<()> {
     let (reader, writer) = rustix::pipe::pipe().unwrap();
 
@@ -1330,6 +1369,12 @@ fn main() -> Result<(), Box<dyn Error>> {
             move || test_fork_runs(&*fork_fn),
             all_envs.clone(),
         ));
+        let fork_fn = fork_fn.clone();
+        tests.push(ShadowTest::new(
+            &format!("{fork_fn_name}-fork_copies_memory"),
+            move || test_fork_copies_memory(&*fork_fn),
+            all_envs.clone(),
+        ));
     }
     for value in [true, false] {
         tests.push(ShadowTest::new(
@@ -457,6 +457,110 @@ fn test_ctl_invalid_op() -> anyhow::Result<()> {
     })
 }
 
+fn test_ctl_exclusive() -> anyhow::Result<()> {
+    let (read_fd, write_fd) = unistd::pipe()?;
+    let epoll_fd = epoll::epoll_create()?;
+    let other_epoll_fd = epoll::epoll_create()?;
+
+    test_utils::run_and_close_fds(&[epoll_fd, other_epoll_fd, read_fd, write_fd], || {
+        let ctl = |op, fd, events: libc::c_int| {
+            let mut event = libc::epoll_event {
+                events: events as u32,
+                u64: 0,
+            };
+            Errno::result(unsafe { libc::epoll_ctl(epoll_fd, op, fd, &mut event) })
+        };
+
+        // can't be combined with EPOLLONESHOT
+        assert_eq!(
+            ctl(
+                libc::EPOLL_CTL_ADD,
+                read_fd,
+                libc::EPOLLIN | libc::EPOLLEXCLUSIVE | libc::EPOLLONESHOT
+            ),
+            Err(Errno::EINVAL)
+        );
+
+        // can't be used with an epoll target
+        assert_eq!(
+            ctl(
+                libc::EPOLL_CTL_ADD,
+                other_epoll_fd,
+                libc::EPOLLIN | libc::EPOLLEXCLUSIVE
+            ),
+            Err(Errno::EINVAL)
+        );
+
+        assert_eq!(
+            ctl(
+                libc::EPOLL_CTL_ADD,
+                read_fd,
+                libc::EPOLLIN | libc::EPOLLEXCLUSIVE
+            ),
+            Ok(0)
+        );
+
+        // an exclusive entry can't be modified
+        assert_eq!(
+            ctl(libc::EPOLL_CTL_MOD, read_fd, libc::EPOLLIN),
+            Err(Errno::EINVAL)
+        );
+
+        // but it still reports events
+        unistd::write(write_fd, &[1])?;
+        let res = do_epoll_wait(epoll_fd, Duration::ZERO, false);
+        assert_eq!(res.epoll_res, Ok(1));
+        assert_eq!(res.events[0].events(), EpollFlags::EPOLLIN);
+
+        assert_eq!(ctl(libc::EPOLL_CTL_DEL, read_fd, 0), Ok(0));
+
+        Ok(())
+    })
+}
+
+/// Test that epoll reports the right entries when many entries become ready and then not ready.
+fn test_many_ready_entries() -> anyhow::Result<()> {
+    const NUM_PIPES: usize = 200;
+
+    let epoll_fd = epoll::epoll_create()?;
+    let pipes = (0..NUM_PIPES)
+        .map(|_| unistd::pipe())
+        .collect::<Result<Vec<_>, _>>()?;
+
+    let fds: Vec<_> = std::iter::once(epoll_fd)
+        .chain(pipes.iter().flat_map(|(r, w)| [*r, *w]))
+        .collect();
+
+    test_utils::run_and_close_fds(&fds, || {
+        for (read_fd, write_fd) in &pipes {
+            let mut event = epoll::EpollEvent::new(EpollFlags::EPOLLIN, *read_fd as u64);
+            epoll::epoll_ctl(
+                epoll_fd,
+                epoll::EpollOp::EpollCtlAdd,
+                *read_fd,
+                Some(&mut event),
+            )?;
+            unistd::write(*write_fd, &[1])?;
+        }
+
+        // make every other pipe not readable
+        for (read_fd, _) in pipes.iter().step_by(2) {
+            unistd::read(*read_fd, &mut [0])?;
+        }
+
+        let mut events = vec![epoll::EpollEvent::empty(); NUM_PIPES];
+        let num = epoll::epoll_wait(epoll_fd, &mut events, 0)?;
+
+        let mut ready: Vec<_> = events[..num].iter().map(|x| x.data() as i32).collect();
+        ready.sort();
+        let mut expected: Vec<_> = pipes.iter().skip(1).step_by(2).map(|(r, _)| *r).collect();
+        expected.sort();
+        assert_eq!(ready, expected);
+
+        Ok(())
+    })
+}
+
 fn main() -> anyhow::Result<()> {
     // should we restrict the tests we run?
     let filter_shadow_passing = std::env::args().any(|x| x == "--shadow-passing");
@@ -485,6 +589,12 @@ fn main() -> anyhow::Result<()> {
             all_envs.clone(),
         ),
         ShadowTest::new("test_ctl_invalid_op", test_ctl_invalid_op, all_envs.clone()),
+        ShadowTest::new("test_ctl_exclusive", test_ctl_exclusive, all_envs.clone()),
+        ShadowTest::new(
+            "test_many_ready_entries",
+            test_many_ready_entries,
+            all_envs.clone(),
+        ),
     ];
     for use_edge in [UseEPOLLET::Yes, UseEPOLLET::No] {
         for use_rdhup in [UseEPOLLRDHUP::Yes, UseEPOLLRDHUP::No] {
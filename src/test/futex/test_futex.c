@@ -9,12 +9,14 @@
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "lib/logger/logger.h"
@@ -417,6 +419,172 @@ static void _futex_stress_test() {
     g_assert_cmpint(PTR_TO_INT(aux_result), ==, 0);
 }
 
+static void _futex_cmp_requeue_stale_test() {
+    int futex = AVAILABLE;
+    int futex2 = AVAILABLE;
+    g_assert_cmpint(
+        syscall(SYS_futex, &futex, FUTEX_CMP_REQUEUE, 1, INT_MAX, &futex2, UNAVAILABLE), ==, -1);
+    assert_errno_is(EAGAIN);
+}
+
+typedef struct {
+    atomic_int futex;
+    atomic_int futex2;
+    atomic_int num_waiting;
+    atomic_int num_finished;
+} FutexRequeueTestArg;
+
+static void* _futex_requeue_test_child(void* void_arg) {
+    FutexRequeueTestArg* arg = void_arg;
+    atomic_fetch_add(&arg->num_waiting, 1);
+    while (atomic_load(&arg->futex) != AVAILABLE) {
+        long rv = syscall(SYS_futex, &arg->futex, FUTEX_WAIT, UNAVAILABLE, NULL, NULL, 0);
+        if (rv != 0) {
+            assert_errno_is(EAGAIN);
+        }
+    }
+    atomic_fetch_add(&arg->num_finished, 1);
+    return NULL;
+}
+
+static void _futex_cmp_requeue_test() {
+    FutexRequeueTestArg arg = {
+        .futex = UNAVAILABLE, .futex2 = UNAVAILABLE, .num_waiting = 0, .num_finished = 0};
+    pthread_t children[2] = {0};
+    for (int i = 0; i < 2; i++) {
+        assert_nonneg_errno(pthread_create(&children[i], NULL, _futex_requeue_test_child, &arg));
+    }
+
+    // Move both children to the second futex once they're asleep. There's no way to guarantee
+    // that the children are already asleep, so we need to loop.
+    long moved = 0;
+    while (moved < 2) {
+        long rv =
+            syscall(SYS_futex, &arg.futex, FUTEX_CMP_REQUEUE, 0, INT_MAX, &arg.futex2, UNAVAILABLE);
+        assert_nonneg_errno(rv);
+        moved += rv;
+        usleep(1);
+    }
+    g_assert_cmpint(moved, ==, 2);
+
+    // The children are waiting on the second futex now, so waking the first futex does nothing.
+    g_assert_cmpint(syscall(SYS_futex, &arg.futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0), ==, 0);
+    g_assert_cmpint(atomic_load(&arg.num_finished), ==, 0);
+
+    g_assert_cmpint(atomic_exchange(&arg.futex, AVAILABLE), ==, UNAVAILABLE);
+    g_assert_cmpint(syscall(SYS_futex, &arg.futex2, FUTEX_WAKE, INT_MAX, NULL, NULL, 0), ==, 2);
+
+    for (int i = 0; i < 2; i++) {
+        assert_nonneg_errno(pthread_join(children[i], NULL));
+    }
+    g_assert_cmpint(atomic_load(&arg.num_finished), ==, 2);
+}
+
+static void _futex_wake_op_test() {
+    int futex = AVAILABLE;
+    int futex2 = 5;
+
+    // add 3 to futex2, and wake futex2 if its old value was equal to 5
+    int op = FUTEX_OP(FUTEX_OP_ADD, 3, FUTEX_OP_CMP_EQ, 5);
+    g_assert_cmpint(syscall(SYS_futex, &futex, FUTEX_WAKE_OP, 1, 1, &futex2, op), ==, 0);
+    g_assert_cmpint(futex2, ==, 8);
+
+    // set futex2 to 1 << 4
+    op = FUTEX_OP(FUTEX_OP_SET | FUTEX_OP_OPARG_SHIFT, 4, FUTEX_OP_CMP_NE, 0);
+    g_assert_cmpint(syscall(SYS_futex, &futex, FUTEX_WAKE_OP, 1, 1, &futex2, op), ==, 0);
+    g_assert_cmpint(futex2, ==, 16);
+
+    // an invalid operation
+    op = FUTEX_OP(6, 0, FUTEX_OP_CMP_EQ, 0);
+    g_assert_cmpint(syscall(SYS_futex, &futex, FUTEX_WAKE_OP, 1, 1, &futex2, op), ==, -1);
+    assert_errno_is(ENOSYS);
+    g_assert_cmpint(futex2, ==, 16);
+}
+
+// Same layout as `struct futex_waitv`, which older kernel headers don't define.
+typedef struct {
+    uint64_t val;
+    uint64_t uaddr;
+    uint32_t flags;
+    uint32_t reserved;
+} TestFutexWaitv;
+
+#define TEST_FUTEX_32 2
+
+typedef struct {
+    atomic_int futexes[2];
+    atomic_bool child_started;
+    atomic_int result;
+} FutexWaitvTestChildArg;
+
+static void* _futex_waitv_test_child(void* void_arg) {
+    FutexWaitvTestChildArg* arg = void_arg;
+    TestFutexWaitv waiters[2] = {0};
+    for (int i = 0; i < 2; i++) {
+        waiters[i] = (TestFutexWaitv){.val = UNAVAILABLE,
+                                      .uaddr = (uintptr_t)&arg->futexes[i],
+                                      .flags = TEST_FUTEX_32};
+    }
+    atomic_store(&arg->child_started, true);
+    long rv;
+    do {
+        rv = syscall(SYS_futex_waitv, waiters, 2, 0, NULL, CLOCK_MONOTONIC);
+    } while (rv == -1 && errno == EAGAIN && atomic_load(&arg->futexes[1]) != AVAILABLE);
+    atomic_store(&arg->result, rv == -1 ? -errno : (int)rv);
+    return NULL;
+}
+
+static void _futex_waitv_test() {
+    FutexWaitvTestChildArg arg = {.futexes = {UNAVAILABLE, UNAVAILABLE},
+                                  .child_started = false,
+                                  .result = INT_MIN};
+    pthread_t child = {0};
+    assert_nonneg_errno(pthread_create(&child, NULL, _futex_waitv_test_child, &arg));
+    _wait_for_condition(&arg.child_started);
+
+    // Wake the child through the second futex. There's no way to guarantee that the child is
+    // already asleep, so we need to loop.
+    while (syscall(SYS_futex, &arg.futexes[1], FUTEX_WAKE, 1, NULL, NULL, 0) == 0) {
+        usleep(1);
+    }
+
+    assert_nonneg_errno(pthread_join(child, NULL));
+    g_assert_cmpint(atomic_load(&arg.result), ==, 1);
+}
+
+static void _futex_waitv_stale_test() {
+    int futexes[2] = {UNAVAILABLE, AVAILABLE};
+    TestFutexWaitv waiters[2] = {0};
+    for (int i = 0; i < 2; i++) {
+        waiters[i] = (TestFutexWaitv){
+            .val = UNAVAILABLE, .uaddr = (uintptr_t)&futexes[i], .flags = TEST_FUTEX_32};
+    }
+    g_assert_cmpint(syscall(SYS_futex_waitv, waiters, 2, 0, NULL, CLOCK_MONOTONIC), ==, -1);
+    assert_errno_is(EAGAIN);
+
+    // a futex must be 32 bits
+    futexes[1] = UNAVAILABLE;
+    waiters[1].flags = 0;
+    g_assert_cmpint(syscall(SYS_futex_waitv, waiters, 2, 0, NULL, CLOCK_MONOTONIC), ==, -1);
+    assert_errno_is(EINVAL);
+}
+
+static void _futex_waitv_timeout_test() {
+    int futex = UNAVAILABLE;
+    TestFutexWaitv waiter = {.val = UNAVAILABLE, .uaddr = (uintptr_t)&futex, .flags = TEST_FUTEX_32};
+
+    struct timespec timeout;
+    assert_nonneg_errno(clock_gettime(CLOCK_MONOTONIC, &timeout));
+    timeout.tv_nsec += 10 * 1000 * 1000;
+    if (timeout.tv_nsec >= 1000 * 1000 * 1000) {
+        timeout.tv_sec += 1;
+        timeout.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    g_assert_cmpint(syscall(SYS_futex_waitv, &waiter, 1, 0, &timeout, CLOCK_MONOTONIC), ==, -1);
+    assert_errno_is(ETIMEDOUT);
+}
+
 int main(int argc, char** argv) {
     g_test_init(&argc, &argv, NULL);
     g_test_set_nonfatal_assertions();
@@ -429,6 +597,12 @@ int main(int argc, char** argv) {
     g_test_add_func("/futex/wait_timeout", _futex_wait_timeout_test);
     g_test_add_func("/futex/wait_bitset_timeout", _futex_wait_bitset_timeout_test);
     g_test_add_func("/futex/wait_bitset_timeout_expired", _futex_wait_bitset_timeout_expired_test);
+    g_test_add_func("/futex/cmp_requeue", _futex_cmp_requeue_test);
+    g_test_add_func("/futex/cmp_requeue_stale", _futex_cmp_requeue_stale_test);
+    g_test_add_func("/futex/wake_op", _futex_wake_op_test);
+    g_test_add_func("/futex/waitv", _futex_waitv_test);
+    g_test_add_func("/futex/waitv_stale", _futex_waitv_stale_test);
+    g_test_add_func("/futex/waitv_timeout", _futex_waitv_timeout_test);
 
     if (!running_in_shadow()) {
         // TODO: implement FUTEX_WAKE_BITSET in Shadow.
@@ -0,0 +1,115 @@
+/*
+ * The Shadow Simulator
+ * See LICENSE for licensing information
+ */
+
+//! A microbenchmark of syscall round trips. Makes syscalls from several classes in tight loops:
+//! a syscall with a trivial handler, syscalls that copy a few bytes and a page of data between
+//! the managed process and Shadow, and a syscall that the shim handles without a round trip to
+//! Shadow.
+//!
+//! When run under Shadow, the round trip latency of each syscall is written to the
+//! `syscall_round_trips` section of `sim-stats.json`, and the handler latency to `profile.json`
+//! when `experimental.use_profiling` is enabled; the times printed here are simulated. When run
+//! natively, the printed times are the native cost of each syscall.
+//!
+//! Usage: `test_ipc_round_trip [iterations]`
+
+use std::time::Instant;
+
+/// A class of syscalls. Each iteration makes one or two syscalls.
+struct Class {
+    name: &'static str,
+    iteration: fn(&Fds),
+}
+
+struct Fds {
+    eventfd: libc::c_int,
+    pipe: [libc::c_int; 2],
+}
+
+const PIPE_BYTES: usize = 4096;
+
+const CLASSES: &[Class] = &[
+    Class {
+        name: "getpid",
+        iteration: |_| {
+            // bypass any caching in libc
+            let rv = unsafe { libc::syscall(libc::SYS_getpid) };
+            assert!(rv > 0);
+        },
+    },
+    Class {
+        name: "eventfd-write-read",
+        iteration: |fds| {
+            let val: u64 = 1;
+            let rv = unsafe { libc::write(fds.eventfd, std::ptr::from_ref(&val).cast(), 8) };
+            assert_eq!(rv, 8);
+            let mut val: u64 = 0;
+            let rv = unsafe { libc::read(fds.eventfd, std::ptr::from_mut(&mut val).cast(), 8) };
+            assert_eq!(rv, 8);
+            assert_eq!(val, 1);
+        },
+    },
+    Class {
+        name: "pipe-write-read-4096",
+        iteration: |fds| {
+            let buf = [0u8; PIPE_BYTES];
+            let rv = unsafe { libc::write(fds.pipe[1], buf.as_ptr().cast(), PIPE_BYTES) };
+            assert_eq!(rv, PIPE_BYTES as isize);
+            let mut buf = [0u8; PIPE_BYTES];
+            let rv = unsafe { libc::read(fds.pipe[0], buf.as_mut_ptr().cast(), PIPE_BYTES) };
+            assert_eq!(rv, PIPE_BYTES as isize);
+        },
+    },
+    Class {
+        // handled by the shim
+        name: "clock_gettime",
+        iteration: |_| {
+            let mut ts = libc::timespec {
+                tv_sec: 0,
+                tv_nsec: 0,
+            };
+            let rv = unsafe { libc::clock_gettime(libc::CLOCK_MONOTONIC, &mut ts) };
+            assert_eq!(rv, 0);
+        },
+    },
+];
+
+fn main() {
+    let iterations: u32 = match std::env::args().nth(1) {
+        Some(x) => x
+            .parse()
+            .expect("The number of iterations must be an integer"),
+        None => 10_000,
+    };
+
+    let eventfd = unsafe { libc::eventfd(0, libc::EFD_NONBLOCK) };
+    assert!(eventfd >= 0);
+    let mut pipe = [0; 2];
+    assert_eq!(
+        unsafe { libc::pipe2(pipe.as_mut_ptr(), libc::O_NONBLOCK) },
+        0
+    );
+    let fds = Fds { eventfd, pipe };
+
+    for class in CLASSES {
+        let start = Instant::now();
+        for _ in 0..iterations {
+            (class.iteration)(&fds);
+        }
+        let elapsed = start.elapsed();
+        println!(
+            "{}: {} iterations, {:?} per iteration",
+            class.name,
+            iterations,
+            elapsed / iterations.max(1),
+        );
+    }
+
+    for fd in [fds.eventfd, fds.pipe[0], fds.pipe[1]] {
+        assert_eq!(unsafe { libc::close(fd) }, 0);
+    }
+
+    println!("Success");
+}
@@ -69,6 +69,11 @@ fn get_tests() -> Vec<test_utils::ShadowTest<(), String>> {
             test_get_size,
             set![TestEnv::Libc, TestEnv::Shadow],
         ),
+        test_utils::ShadowTest::new(
+            "test_set_size",
+            test_set_size,
+            set![TestEnv::Libc, TestEnv::Shadow],
+        ),
         test_utils::ShadowTest::new(
             "test_read_after_write_close_with_empty_buffer",
             test_read_after_write_close_with_empty_buffer,
@@ -149,6 +154,12 @@ fn get_tests() -> Vec<test_utils::ShadowTest<(), String>> {
             test_close_during_blocking_write,
             set![TestEnv::Libc, TestEnv::Shadow],
         ),
+        test_utils::ShadowTest::new(
+            "test_splice",
+            test_splice,
+            set![TestEnv::Libc, TestEnv::Shadow],
+        ),
+        test_utils::ShadowTest::new("test_tee", test_tee, set![TestEnv::Libc, TestEnv::Shadow]),
     ];
 
     tests
@@ -470,6 +481,51 @@ fn test_get_size() -> Result<(), String> {
     })
 }
 
+fn test_set_size() -> Result<(), String> {
+    let mut fds = [0 as libc::c_int; 2];
+    test_utils::check_system_call!(
+        || { unsafe { libc::pipe2(fds.as_mut_ptr(), libc::O_NONBLOCK) } },
+        &[]
+    )?;
+
+    test_utils::result_assert(fds[0] > 0, "fds[0] not set")?;
+    test_utils::result_assert(fds[1] > 0, "fds[1] not set")?;
+
+    let (read_fd, write_fd) = (fds[0], fds[1]);
+
+    test_utils::run_and_close_fds(&[write_fd, read_fd], || {
+        let set_size = |fd: libc::c_int, size: libc::c_int| unsafe {
+            libc::fcntl(fd, libc::F_SETPIPE_SZ, size)
+        };
+        let get_size = |fd: libc::c_int| unsafe { libc::fcntl(fd, libc::F_GETPIPE_SZ) };
+
+        // sizes are rounded up to a power-of-two number of pages
+        let size = test_utils::check_system_call!(|| set_size(write_fd, 1), &[])?;
+        test_utils::result_assert_eq(size, 4096, "Unexpected pipe size")?;
+        let size = test_utils::check_system_call!(|| set_size(read_fd, 100_000), &[])?;
+        test_utils::result_assert_eq(size, 131072, "Unexpected pipe size")?;
+        let size = test_utils::check_system_call!(|| get_size(write_fd), &[])?;
+        test_utils::result_assert_eq(size, 131072, "Unexpected pipe size")?;
+
+        // the whole capacity can be written
+        let buffer = vec![0u8; 131072 + 1];
+        let rv = nix::unistd::write(write_fd, &buffer).unwrap();
+        test_utils::result_assert_eq(rv, 131072, "Unexpected number of bytes written")?;
+
+        // the pipe can't be shrunk below the data it holds
+        test_utils::check_system_call!(|| set_size(write_fd, 65536), &[libc::EBUSY])?;
+
+        // once the data is read, the pipe can be shrunk
+        let mut buffer = vec![0u8; 131072];
+        let rv = nix::unistd::read(read_fd, &mut buffer).unwrap();
+        test_utils::result_assert_eq(rv, 131072, "Unexpected number of bytes read")?;
+        let size = test_utils::check_system_call!(|| set_size(write_fd, 65536), &[])?;
+        test_utils::result_assert_eq(size, 65536, "Unexpected pipe size")?;
+
+        Ok(())
+    })
+}
+
 fn test_read_after_write_close_with_empty_buffer() -> Result<(), String> {
     let mut fds = [0 as libc::c_int; 2];
     test_utils::check_system_call!(
@@ -1224,3 +1280,81 @@ fn test_close_during_blocking_write() -> Result<(), String> {
 
     Ok(())
 }
+
+fn test_splice() -> Result<(), String> {
+    let (read_fd_1, write_fd_1) = nix::unistd::pipe().unwrap();
+    let (read_fd_2, write_fd_2) = nix::unistd::pipe().unwrap();
+
+    // 'write_fd_1' and 'read_fd_2' are closed during the test
+    test_utils::run_and_close_fds(&[read_fd_1, write_fd_2], || {
+        let splice = |fd_in, fd_out, len| unsafe {
+            libc::splice(
+                fd_in,
+                std::ptr::null_mut(),
+                fd_out,
+                std::ptr::null_mut(),
+                len,
+                libc::SPLICE_F_NONBLOCK,
+            )
+        };
+
+        // the source pipe is empty
+        test_utils::check_system_call!(|| splice(read_fd_1, write_fd_2, 10), &[libc::EAGAIN])?;
+
+        // the wrong ends of the pipes
+        test_utils::check_system_call!(|| splice(write_fd_1, write_fd_2, 10), &[libc::EBADF])?;
+        test_utils::check_system_call!(|| splice(read_fd_1, read_fd_2, 10), &[libc::EBADF])?;
+
+        // a pipe can't be spliced to itself
+        test_utils::check_system_call!(|| splice(read_fd_1, write_fd_1, 10), &[libc::EINVAL])?;
+
+        assert_eq!(nix::unistd::write(write_fd_1, &[1, 2, 3, 4, 5]), Ok(5));
+
+        let rv = test_utils::check_system_call!(|| splice(read_fd_1, write_fd_2, 3), &[])?;
+        test_utils::result_assert_eq(rv, 3, "Expected to splice 3 bytes")?;
+        let rv = test_utils::check_system_call!(|| splice(read_fd_1, write_fd_2, 10), &[])?;
+        test_utils::result_assert_eq(rv, 2, "Expected to splice 2 bytes")?;
+
+        let mut buf = [0u8; 10];
+        assert_eq!(nix::unistd::read(read_fd_2, &mut buf), Ok(5));
+        test_utils::result_assert_eq(&buf[..5], &[1, 2, 3, 4, 5], "Buffers differ")?;
+
+        // the source pipe is at EOF
+        nix::unistd::close(write_fd_1).unwrap();
+        let rv = test_utils::check_system_call!(|| splice(read_fd_1, write_fd_2, 10), &[])?;
+        test_utils::result_assert_eq(rv, 0, "Expected EOF")?;
+
+        nix::unistd::close(read_fd_2).unwrap();
+
+        Ok(())
+    })
+}
+
+fn test_tee() -> Result<(), String> {
+    let (read_fd_1, write_fd_1) = nix::unistd::pipe().unwrap();
+    let (read_fd_2, write_fd_2) = nix::unistd::pipe().unwrap();
+
+    test_utils::run_and_close_fds(&[read_fd_1, write_fd_1, read_fd_2, write_fd_2], || {
+        assert_eq!(nix::unistd::write(write_fd_1, &[1, 2, 3, 4, 5]), Ok(5));
+
+        let rv = test_utils::check_system_call!(
+            || unsafe { libc::tee(read_fd_1, write_fd_2, 3, 0) },
+            &[]
+        )?;
+        test_utils::result_assert_eq(rv, 3, "Expected to tee 3 bytes")?;
+
+        // the bytes are in both pipes
+        let mut buf = [0u8; 10];
+        assert_eq!(nix::unistd::read(read_fd_2, &mut buf), Ok(3));
+        test_utils::result_assert_eq(&buf[..3], &[1, 2, 3], "Buffers differ")?;
+        assert_eq!(nix::unistd::read(read_fd_1, &mut buf), Ok(5));
+        test_utils::result_assert_eq(&buf[..5], &[1, 2, 3, 4, 5], "Buffers differ")?;
+
+        // writes to the source pipe after the tee are unaffected
+        assert_eq!(nix::unistd::write(write_fd_1, &[6, 7]), Ok(2));
+        assert_eq!(nix::unistd::read(read_fd_1, &mut buf), Ok(2));
+        test_utils::result_assert_eq(&buf[..2], &[6, 7], "Buffers differ")?;
+
+        Ok(())
+    })
+}
@@ -160,6 +160,49 @@ fn test_regular_file() -> Result<(), String> {
     })
 }
 
+/// Poll a pipe until it times out, then replace it with a new pipe (which probably reuses the same
+/// fds) and check that poll wakes up when the new pipe becomes readable.
+fn test_replaced_fd() -> Result<(), String> {
+    let poll_read = |fd: i32, timeout: i32| {
+        let mut read_poll = libc::pollfd {
+            fd,
+            events: libc::POLLIN,
+            revents: 0,
+        };
+        let ready = unsafe { libc::poll(std::ptr::from_mut(&mut read_poll), 1, timeout) };
+        (ready, read_poll.revents)
+    };
+
+    let (pfd_read, pfd_write) = nix::unistd::pipe().map_err(|e| e.to_string())?;
+    test_utils::run_and_close_fds(&[pfd_read, pfd_write], || {
+        let (ready, revents) = poll_read(pfd_read, 100);
+        if ready != 0 {
+            return Err(format!("error: pipe marked readable. revents={revents}"));
+        }
+        Ok(())
+    })?;
+
+    let (pfd_read, pfd_write) = nix::unistd::pipe().map_err(|e| e.to_string())?;
+    test_utils::run_and_close_fds(&[pfd_read, pfd_write], || {
+        let writer = std::thread::spawn(move || {
+            std::thread::sleep(Duration::from_millis(10));
+            fd_write(pfd_write)
+        });
+
+        // should block until the new pipe is written to
+        let (ready, revents) = poll_read(pfd_read, 1000);
+        writer.join().unwrap()?;
+        if ready != 1 {
+            return Err(format!("error: poll returned {} instead of 1", ready));
+        }
+        if revents & libc::POLLIN == 0 {
+            return Err(format!("error: read_poll has wrong revents: {revents}"));
+        }
+
+        fd_read_cmp(pfd_read)
+    })
+}
+
 fn get_pollable_fd() -> Result<libc::c_int, String> {
     // Get an fd we can poll
     let fd = test_utils::check_system_call!(
@@ -339,6 +382,11 @@ fn main() -> Result<(), String> {
             test_regular_file,
             set![TestEnv::Libc, TestEnv::Shadow],
         ),
+        test_utils::ShadowTest::new(
+            "test_replaced_fd",
+            test_replaced_fd,
+            set![TestEnv::Libc, TestEnv::Shadow],
+        ),
     ];
 
     // For each combination of args, test both poll and ppoll
@@ -114,6 +114,11 @@ fn get_tests() -> Vec<test_utils::ShadowTest<(), String>> {
                         move || test_double_bind_address(domain, sock_type, flag),
                         set![TestEnv::Libc, TestEnv::Shadow],
                     ),
+                    test_utils::ShadowTest::new(
+                        &append_args("test_double_bind_address_reuseport"),
+                        move || test_double_bind_address_reuseport(domain, sock_type, flag),
+                        set![TestEnv::Libc, TestEnv::Shadow],
+                    ),
                     test_utils::ShadowTest::new(
                         &append_args("test_autobind"),
                         move || test_autobind(domain, sock_type, flag),
@@ -623,6 +628,58 @@ fn test_double_bind_address(
     })
 }
 
+// test binding several sockets with SO_REUSEPORT to the same address on the loopback interface
+fn test_double_bind_address_reuseport(
+    domain: libc::c_int,
+    sock_type: libc::c_int,
+    flag: libc::c_int,
+) -> Result<(), String> {
+    let fds: Vec<_> = (0..3)
+        .map(|_| unsafe { libc::socket(domain, sock_type | flag, 0) })
+        .collect();
+    assert!(fds.iter().all(|&fd| fd >= 0));
+
+    // only the first two sockets set SO_REUSEPORT
+    for &fd in &fds[..2] {
+        let enable: libc::c_int = 1;
+        let rv = unsafe {
+            libc::setsockopt(
+                fd,
+                libc::SOL_SOCKET,
+                libc::SO_REUSEPORT,
+                std::ptr::from_ref(&enable).cast(),
+                std::mem::size_of_val(&enable) as u32,
+            )
+        };
+        assert_eq!(rv, 0);
+    }
+
+    let addr = libc::sockaddr_in {
+        sin_family: libc::AF_INET as u16,
+        sin_port: 11113u16.to_be(),
+        sin_addr: libc::in_addr {
+            s_addr: libc::INADDR_LOOPBACK.to_be(),
+        },
+        sin_zero: [0; 8],
+    };
+
+    let args: Vec<_> = fds
+        .iter()
+        .map(|&fd| BindArguments {
+            fd,
+            addr: Some(SockAddr::Inet(addr)),
+            addr_len: std::mem::size_of_val(&addr) as u32,
+        })
+        .collect();
+
+    test_utils::run_and_close_fds(&fds, || {
+        check_bind_call(&args[0], None)?;
+        check_bind_call(&args[1], None)?;
+        check_bind_call(&args[2], Some(libc::EADDRINUSE))?;
+        Ok(())
+    })
+}
+
 // test binding two sockets to the same address, but using both 'loopback' and 'any' interfaces
 fn test_double_bind_loopback_and_any(
     reverse: bool,
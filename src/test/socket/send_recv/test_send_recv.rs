@@ -488,6 +488,16 @@ fn get_tests() -> Vec<test_utils::ShadowTest<(), String>> {
         set![TestEnv::Libc, TestEnv::Shadow],
     )]);
 
+    for &init_method in &[SocketInitMethod::Inet, SocketInitMethod::UnixSocketpair] {
+        let append_args = |s| format!("{s} <init_method={init_method:?}>");
+
+        tests.extend(vec![test_utils::ShadowTest::new(
+            &append_args("test_mmsg_dgram_batch"),
+            move || test_mmsg_dgram_batch(init_method),
+            set![TestEnv::Libc, TestEnv::Shadow],
+        )]);
+    }
+
     tests
 }
 
@@ -2510,6 +2520,127 @@ fn test_dgram_loopback_bound_sendmsg(
     Ok(())
 }
 
+/// Test sending and receiving several datagrams with a single sendmmsg() and recvmmsg().
+fn test_mmsg_dgram_batch(init_method: SocketInitMethod) -> Result<(), String> {
+    let (fd_client, fd_server) = socket_init_helper(
+        init_method,
+        libc::SOCK_DGRAM,
+        0,
+        /* bind_client = */ false,
+    );
+
+    test_utils::run_and_close_fds(&[fd_client, fd_server], || {
+        let send_bufs = [vec![1u8; 1], vec![2u8; 300], vec![3u8; 5]];
+        let mut send_iovs: Vec<libc::iovec> = send_bufs
+            .iter()
+            .map(|buf| libc::iovec {
+                // casting a const pointer to a mut pointer, but syscall should not mutate data
+                iov_base: buf.as_ptr() as *mut core::ffi::c_void,
+                iov_len: buf.len(),
+            })
+            .collect();
+        let mut send_msgs: Vec<libc::mmsghdr> = send_iovs
+            .iter_mut()
+            .map(|iov| libc::mmsghdr {
+                msg_hdr: libc::msghdr {
+                    msg_name: std::ptr::null_mut(),
+                    msg_namelen: 0,
+                    msg_iov: iov,
+                    msg_iovlen: 1,
+                    msg_control: std::ptr::null_mut(),
+                    msg_controllen: 0,
+                    msg_flags: 0,
+                },
+                msg_len: 0,
+            })
+            .collect();
+
+        let rv = test_utils::check_system_call!(
+            || unsafe {
+                libc::sendmmsg(
+                    fd_client,
+                    send_msgs.as_mut_ptr(),
+                    send_msgs.len() as libc::c_uint,
+                    0,
+                )
+            },
+            &[],
+        )?;
+        test_utils::result_assert_eq(rv, 3, "Unexpected number of messages sent")?;
+        for (msg, buf) in send_msgs.iter().zip(&send_bufs) {
+            test_utils::result_assert_eq(msg.msg_len as usize, buf.len(), "Unexpected msg_len")?;
+        }
+
+        // shadow needs to run events
+        assert_eq!(unsafe { libc::usleep(10000) }, 0);
+
+        // room for more messages than were sent
+        let mut recv_bufs = [[0u8; 500]; 4];
+        let mut recv_iovs: Vec<libc::iovec> = recv_bufs
+            .iter_mut()
+            .map(|buf| libc::iovec {
+                iov_base: buf.as_mut_ptr() as *mut core::ffi::c_void,
+                iov_len: buf.len(),
+            })
+            .collect();
+        let mut recv_msgs: Vec<libc::mmsghdr> = recv_iovs
+            .iter_mut()
+            .map(|iov| libc::mmsghdr {
+                msg_hdr: libc::msghdr {
+                    msg_name: std::ptr::null_mut(),
+                    msg_namelen: 0,
+                    msg_iov: iov,
+                    msg_iovlen: 1,
+                    msg_control: std::ptr::null_mut(),
+                    msg_controllen: 0,
+                    msg_flags: 0,
+                },
+                msg_len: 0,
+            })
+            .collect();
+
+        // without MSG_WAITFORONE, linux would block until all 4 messages were received
+        let rv = test_utils::check_system_call!(
+            || unsafe {
+                libc::recvmmsg(
+                    fd_server,
+                    recv_msgs.as_mut_ptr(),
+                    recv_msgs.len() as libc::c_uint,
+                    libc::MSG_WAITFORONE,
+                    std::ptr::null_mut(),
+                )
+            },
+            &[],
+        )?;
+        test_utils::result_assert_eq(rv, 3, "Unexpected number of messages received")?;
+        for (msg, buf) in recv_msgs.iter().zip(&send_bufs) {
+            test_utils::result_assert_eq(msg.msg_len as usize, buf.len(), "Unexpected msg_len")?;
+        }
+        for (recv_buf, send_buf) in recv_bufs.iter().zip(&send_bufs) {
+            test_utils::result_assert(
+                recv_buf[..send_buf.len()] == send_buf[..],
+                "Unexpected message data",
+            )?;
+        }
+
+        // no more messages
+        test_utils::check_system_call!(
+            || unsafe {
+                libc::recvmmsg(
+                    fd_server,
+                    recv_msgs.as_mut_ptr(),
+                    recv_msgs.len() as libc::c_uint,
+                    libc::MSG_DONTWAIT,
+                    std::ptr::null_mut(),
+                )
+            },
+            &[libc::EAGAIN],
+        )?;
+
+        Ok(())
+    })
+}
+
 /// A helper function to call sendto() and recvfrom() with valid values
 /// and a user-provided fd.
 fn fd_test_helper(